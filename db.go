@@ -9,15 +9,22 @@ package sqlite
 import "C"
 
 import (
+	"bytes"
 	"context"
+	"crypto/sha256"
 	"database/sql"
+	"database/sql/driver"
+	"encoding/hex"
 	"fmt"
+	"io"
 	"log/slog"
 	"os"
 	"os/exec"
 	"path/filepath"
 	"runtime"
 	"sync"
+	"syscall"
+	"time"
 
 	"github.com/mattn/go-sqlite3"
 )
@@ -34,118 +41,332 @@ func LoadVecExtension(db *sql.DB) error {
 	return loadExtension(db, VecExtension, "vec_extension.so", "sqlite3_vec_init")
 }
 
-// loadExtension is a helper function that writes the embedded extension to a temporary file
+// loadExtension is a helper function that extracts the embedded extension
 // and loads it into the database
 func loadExtension(db *sql.DB, extensionData []byte, filename, entryPoint string) error {
-	// Create a temporary directory with a unique name
-	tmpDir, err := os.MkdirTemp("", "sqlite-ext-")
+	path, err := extensionPath(extensionData, filename)
 	if err != nil {
-		return fmt.Errorf("failed to create temp directory: %w", err)
+		return err
 	}
-	defer os.RemoveAll(tmpDir)
 
-	tmpFile := filepath.Join(tmpDir, filename)
+	// Load the extension into the database
+	_, err = db.Exec("SELECT load_extension(?, ?)", path, entryPoint)
+	if err != nil {
+		return fmt.Errorf("failed to load extension %s: %w", filename, err)
+	}
+
+	return nil
+}
+
+var (
+	extensionMu sync.Mutex
+	// extensionPaths maps each extension's filename to its extracted path.
+	// The embedded data behind a filename never changes within a process.
+	extensionPaths = map[string]string{}
+	// extensionDirPath is the directory extensions are extracted to, once
+	// chosen by extensionDir
+	extensionDirPath string
+)
+
+// extensionPath returns the path of extensionData extracted to the user's
+// cache directory under a name derived from its SHA-256. The file is hashed
+// and written at most once per process and reused by every connection; an
+// existing file is reused only if its content hashes to the same name.
+// Loading the same path again on another connection only bumps the dynamic
+// loader's reference count.
+func extensionPath(extensionData []byte, filename string) (string, error) {
+	extensionMu.Lock()
+	defer extensionMu.Unlock()
+	if path, ok := extensionPaths[filename]; ok {
+		return path, nil
+	}
+
+	sum := sha256.Sum256(extensionData)
+	hash := hex.EncodeToString(sum[:])
+
+	dir, err := extensionDir()
+	if err != nil {
+		return "", fmt.Errorf("failed to create extension cache directory: %w", err)
+	}
+	path := filepath.Join(dir, hash[:16]+"-"+filename)
+
+	if !extensionFileMatches(path, sum) {
+		if err := writeExtensionFile(dir, path, extensionData); err != nil {
+			return "", fmt.Errorf("failed to write extension %s: %w", filename, err)
+		}
+	}
+
+	extensionPaths[filename] = path
+	return path, nil
+}
+
+// extensionDir returns a directory only the current user can write to:
+// gogo-sqlite-ext in the user's cache directory, which must be owned by
+// the user with mode 0700. Without a cache directory it is a new private
+// directory under the system temp directory, since a fixed name there
+// could have been created by another user; that directory is not reused
+// by later processes.
+func extensionDir() (string, error) {
+	if extensionDirPath != "" {
+		return extensionDirPath, nil
+	}
 
-	// Write the extension data to the temporary file with executable permissions
-	if err := os.WriteFile(tmpFile, extensionData, 0755); err != nil {
-		return fmt.Errorf("failed to write extension to temporary file: %w", err)
+	cache, err := os.UserCacheDir()
+	if err != nil {
+		dir, err := os.MkdirTemp("", "gogo-sqlite-ext-")
+		if err != nil {
+			return "", err
+		}
+		extensionDirPath = dir
+		return dir, nil
+	}
+
+	dir := filepath.Join(cache, "gogo-sqlite-ext")
+	if err := os.MkdirAll(dir, 0700); err != nil {
+		return "", err
+	}
+	info, err := os.Lstat(dir)
+	if err != nil {
+		return "", err
+	}
+	if !info.IsDir() || !ownedByCurrentUser(info) || info.Mode().Perm() != 0700 {
+		return "", fmt.Errorf("%s must be a directory owned by the current user with mode 0700", dir)
+	}
+	extensionDirPath = dir
+	return dir, nil
+}
+
+// extensionFileMatches reports whether path is a regular file owned by the
+// current user whose content hashes to sum. The file is opened without
+// following a symlink and hashed through the open descriptor, so what is
+// checked is the file itself and not whatever the name pointed to when it
+// was looked up.
+func extensionFileMatches(path string, sum [sha256.Size]byte) bool {
+	f, err := os.OpenFile(path, os.O_RDONLY|syscall.O_NOFOLLOW, 0)
+	if err != nil {
+		return false
+	}
+	defer f.Close()
+
+	info, err := f.Stat()
+	if err != nil || !info.Mode().IsRegular() || !ownedByCurrentUser(info) {
+		return false
+	}
+	h := sha256.New()
+	if _, err := io.Copy(h, f); err != nil {
+		return false
+	}
+	return bytes.Equal(h.Sum(nil), sum[:])
+}
+
+// ownedByCurrentUser reports whether info describes a file owned by the
+// user running the process
+func ownedByCurrentUser(info os.FileInfo) bool {
+	st, ok := info.Sys().(*syscall.Stat_t)
+	return ok && int(st.Uid) == os.Getuid()
+}
+
+// writeExtensionFile writes extension data next to path and renames it into
+// place, so a concurrent process never loads a partly written file
+func writeExtensionFile(dir, path string, extensionData []byte) error {
+	tmpFile, err := os.CreateTemp(dir, filepath.Base(path)+".tmp-")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(tmpFile.Name())
+
+	if err := tmpFile.Chmod(0755); err != nil {
+		tmpFile.Close()
+		return err
+	}
+	if _, err := tmpFile.Write(extensionData); err != nil {
+		tmpFile.Close()
+		return err
+	}
+	if err := tmpFile.Close(); err != nil {
+		return err
 	}
 
 	// On macOS, we might need to remove quarantine attributes
 	if runtime.GOOS == "darwin" {
 		// Try to remove quarantine attribute (this might fail but that's OK)
-		exec.Command("xattr", "-d", "com.apple.quarantine", tmpFile).Run()
+		exec.Command("xattr", "-d", "com.apple.quarantine", tmpFile.Name()).Run()
 	}
 
-	// Load the extension into the database
-	query := fmt.Sprintf("SELECT load_extension('%s', '%s')", tmpFile, entryPoint)
-	_, err = db.Exec(query)
-	if err != nil {
-		return fmt.Errorf("failed to load extension %s: %w", filename, err)
+	return os.Rename(tmpFile.Name(), path)
+}
+
+// DBOption tunes the connection pool or the per-connection settings of NewDB
+type DBOption func(*dbConfig)
+
+type dbConfig struct {
+	maxOpenConns    int
+	maxIdleConns    int
+	connMaxIdleTime time.Duration
+	wal             bool
+	mmapSize        int64
+	cacheSize       int
+	busyTimeout     time.Duration
+}
+
+// WithMaxOpenConns caps the number of open connections (default: unlimited)
+func WithMaxOpenConns(n int) DBOption {
+	return func(c *dbConfig) { c.maxOpenConns = n }
+}
+
+// WithMaxIdleConns sets how many idle connections the pool keeps (default: 2).
+// Keeping as many as the burst concurrency avoids opening cold connections.
+func WithMaxIdleConns(n int) DBOption {
+	return func(c *dbConfig) { c.maxIdleConns = n }
+}
+
+// WithConnMaxIdleTime closes connections idle for longer than d
+func WithConnMaxIdleTime(d time.Duration) DBOption {
+	return func(c *dbConfig) { c.connMaxIdleTime = d }
+}
+
+// WithWAL switches the database to write-ahead logging, so readers run
+// alongside a writer
+func WithWAL() DBOption {
+	return func(c *dbConfig) { c.wal = true }
+}
+
+// WithMmapSize sets PRAGMA mmap_size, in bytes, on every connection
+func WithMmapSize(n int64) DBOption {
+	return func(c *dbConfig) { c.mmapSize = n }
+}
+
+// WithCacheSize sets PRAGMA cache_size on every connection: pages if
+// positive, KiB if negative
+func WithCacheSize(n int) DBOption {
+	return func(c *dbConfig) { c.cacheSize = n }
+}
+
+// WithBusyTimeout sets how long a connection waits on a locked database
+func WithBusyTimeout(d time.Duration) DBOption {
+	return func(c *dbConfig) { c.busyTimeout = d }
+}
+
+// pragmas returns the statements run on each new connection
+func (c *dbConfig) pragmas() []string {
+	var pragmas []string
+	if c.wal {
+		pragmas = append(pragmas, "PRAGMA journal_mode = WAL")
+	}
+	if c.mmapSize > 0 {
+		pragmas = append(pragmas, fmt.Sprintf("PRAGMA mmap_size = %d", c.mmapSize))
+	}
+	if c.cacheSize != 0 {
+		pragmas = append(pragmas, fmt.Sprintf("PRAGMA cache_size = %d", c.cacheSize))
+	}
+	if c.busyTimeout > 0 {
+		pragmas = append(pragmas, fmt.Sprintf("PRAGMA busy_timeout = %d", c.busyTimeout.Milliseconds()))
 	}
+	return pragmas
+}
 
-	return nil
+// connectHook returns the hook that prepares each new pool connection: it
+// loads both extensions from their cached paths and applies pragmas
+func connectHook(pragmas []string) func(conn *sqlite3.SQLiteConn) error {
+	return func(conn *sqlite3.SQLiteConn) error {
+		// Enable extension loading first
+		if _, err := conn.Exec("PRAGMA load_extension = 1", nil); err != nil {
+			wrappedErr := fmt.Errorf("store.NewDB: failed to enable extension loading: %w", err)
+			slog.Error(wrappedErr.Error())
+			return wrappedErr
+		}
+
+		// Extracted once per process; later connections only load them
+		graphPath, err := extensionPath(GraphExtension, "graph_extension.so")
+		if err != nil {
+			wrappedErr := fmt.Errorf("store.NewDB: failed to extract graph extension: %w", err)
+			slog.Error(wrappedErr.Error())
+			return wrappedErr
+		}
+
+		vecPath, err := extensionPath(VecExtension, "vec_extension.so")
+		if err != nil {
+			wrappedErr := fmt.Errorf("store.NewDB: failed to extract vec extension: %w", err)
+			slog.Error(wrappedErr.Error())
+			return wrappedErr
+		}
+
+		// Load the extensions
+		if err := conn.LoadExtension(graphPath, "sqlite3_graph_init"); err != nil {
+			wrappedErr := fmt.Errorf("store.NewDB: failed to load graph extension: %w", err)
+			slog.Error(wrappedErr.Error())
+			return wrappedErr
+		}
+
+		if err := conn.LoadExtension(vecPath, "sqlite3_vec_init"); err != nil {
+			wrappedErr := fmt.Errorf("store.NewDB: failed to load vec extension: %w", err)
+			slog.Error(wrappedErr.Error())
+			return wrappedErr
+		}
+
+		for _, pragma := range pragmas {
+			if _, err := conn.Exec(pragma, nil); err != nil {
+				wrappedErr := fmt.Errorf("store.NewDB: failed to run %q: %w", pragma, err)
+				slog.Error(wrappedErr.Error())
+				return wrappedErr
+			}
+		}
+
+		return nil
+	}
+}
+
+// connector opens connections through a driver whose hook carries one
+// NewDB call's options
+type connector struct {
+	dsn    string
+	driver *sqlite3.SQLiteDriver
+}
+
+func (c *connector) Connect(context.Context) (driver.Conn, error) {
+	return c.driver.Open(c.dsn)
+}
+
+func (c *connector) Driver() driver.Driver {
+	return c.driver
 }
 
 var registerOnce sync.Once
 
-func NewDB(ctx context.Context, dsn string) (db *sql.DB, err error) {
-	// Register the custom SQLite driver only once
+// NewDB opens a pool whose connections have the graph and vec extensions
+// loaded. opts tune the pool and the pragmas applied to each connection.
+func NewDB(ctx context.Context, dsn string, opts ...DBOption) (db *sql.DB, err error) {
+	var cfg dbConfig
+	for _, opt := range opts {
+		opt(&cfg)
+	}
+
+	// Keep the named driver available to sql.Open callers
 	registerOnce.Do(func() {
 		sql.Register("sqlite3_with_extensions", &sqlite3.SQLiteDriver{
-			ConnectHook: func(conn *sqlite3.SQLiteConn) error {
-				// Enable extension loading first
-				if _, err := conn.Exec("PRAGMA load_extension = 1", nil); err != nil {
-					wrappedErr := fmt.Errorf("store.NewDB: failed to enable extension loading: %w", err)
-					slog.Error(wrappedErr.Error())
-					return wrappedErr
-				}
-
-				// Create temporary files for the extensions
-				graphTmpFile, err := writeExtensionToTemp(GraphExtension, "graph_extension.so")
-				if err != nil {
-					wrappedErr := fmt.Errorf("store.NewDB: failed to write graph extension: %w", err)
-					slog.Error(wrappedErr.Error())
-					return wrappedErr
-				}
-				defer os.Remove(graphTmpFile)
-
-				vecTmpFile, err := writeExtensionToTemp(VecExtension, "vec_extension.so")
-				if err != nil {
-					wrappedErr := fmt.Errorf("store.NewDB: failed to write vec extension: %w", err)
-					slog.Error(wrappedErr.Error())
-					return wrappedErr
-				}
-				defer os.Remove(vecTmpFile)
-
-				// Load the extensions
-				if err := conn.LoadExtension(graphTmpFile, "sqlite3_graph_init"); err != nil {
-					wrappedErr := fmt.Errorf("store.NewDB: failed to load graph extension: %w", err)
-					slog.Error(wrappedErr.Error())
-					return wrappedErr
-				}
-
-				if err := conn.LoadExtension(vecTmpFile, "sqlite3_vec_init"); err != nil {
-					wrappedErr := fmt.Errorf("store.NewDB: failed to load vec extension: %w", err)
-					slog.Error(wrappedErr.Error())
-					return wrappedErr
-				}
-
-				return nil
-			},
+			ConnectHook: connectHook(nil),
 		})
 	})
 
-	// Open the database with the custom driver
-	db, err = sql.Open("sqlite3_with_extensions", dsn)
-	if err != nil {
-		wrappedErr := fmt.Errorf("store.NewDB: failed to open database: %w", err)
-		slog.Error(wrappedErr.Error())
-		return nil, wrappedErr
+	// Open the database through a connector carrying this call's pragmas
+	db = sql.OpenDB(&connector{
+		dsn:    dsn,
+		driver: &sqlite3.SQLiteDriver{ConnectHook: connectHook(cfg.pragmas())},
+	})
+	if cfg.maxOpenConns > 0 {
+		db.SetMaxOpenConns(cfg.maxOpenConns)
+	}
+	if cfg.maxIdleConns > 0 {
+		db.SetMaxIdleConns(cfg.maxIdleConns)
+	}
+	if cfg.connMaxIdleTime > 0 {
+		db.SetConnMaxIdleTime(cfg.connMaxIdleTime)
 	}
 	if err := db.PingContext(ctx); err != nil {
+		db.Close()
 		wrappedErr := fmt.Errorf("store.NewDB: failed to ping database: %w", err)
 		slog.Error(wrappedErr.Error())
 		return nil, wrappedErr
 	}
 	return db, nil
 }
-
-// writeExtensionToTemp writes extension data to a temporary file and returns the path
-func writeExtensionToTemp(extensionData []byte, filename string) (string, error) {
-	tmpFile, err := os.CreateTemp("", filename)
-	if err != nil {
-		return "", err
-	}
-	defer tmpFile.Close()
-
-	if err := tmpFile.Chmod(0755); err != nil {
-		return "", err
-	}
-
-	if _, err := tmpFile.Write(extensionData); err != nil {
-		return "", err
-	}
-
-	return tmpFile.Name(), nil
-}
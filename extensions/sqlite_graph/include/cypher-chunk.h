@@ -0,0 +1,120 @@
+/*
+** SQLite Graph Database Extension - Columnar Data Chunks
+**
+** A CypherDataChunk carries up to CYPHER_CHUNK_SIZE rows between
+** iterators as one vector per column, so batch-capable operators
+** exchange rows without a CypherResult, a strdup()'d column name and a
+** virtual call per row. Node columns are plain int64 id arrays; other
+** columns hold CypherValues.
+**
+** A selection vector marks the live rows: filters narrow it instead of
+** moving values, and limits shorten it. Without a selection the first
+** nSel rows are live.
+**
+** Row adapters connect the two models: cypherIteratorNextBatch() fills
+** a chunk from an iterator without xNextBatch, and cypherChunkToResult()
+** turns a live row back into a CypherResult at the executor boundary.
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+*/
+#ifndef CYPHER_CHUNK_H
+#define CYPHER_CHUNK_H
+
+#include "cypher-executor.h"
+
+/*
+** Rows per chunk. Large enough to amortize per-batch overhead, small
+** enough that a chunk's vectors stay in cache.
+*/
+#ifndef CYPHER_CHUNK_SIZE
+# define CYPHER_CHUNK_SIZE 1024
+#endif
+
+/*
+** Column vector types.
+*/
+#define CYPHER_VECTOR_NODE  1   /* aId holds node ids */
+#define CYPHER_VECTOR_VALUE 2   /* aValue holds owned CypherValues */
+
+typedef struct CypherVector CypherVector;
+struct CypherVector {
+  char *zName;                  /* Column (variable) name */
+  int eType;                    /* CYPHER_VECTOR_* */
+  sqlite3_int64 *aId;           /* NODE: CYPHER_CHUNK_SIZE node ids */
+  CypherValue *aValue;          /* VALUE: CYPHER_CHUNK_SIZE values */
+};
+
+struct CypherDataChunk {
+  CypherVector *aCol;           /* Column vectors */
+  int nCol;                     /* Number of columns */
+  int nRow;                     /* Rows filled in every vector */
+  int *aSel;                    /* Selection: indexes of the live rows */
+  int nSel;                     /* Number of live rows */
+  int bSel;                     /* aSel is in use; else rows 0..nSel-1 */
+};
+
+/*
+** Allocate an empty chunk with no columns.
+*/
+int cypherChunkCreate(CypherDataChunk **ppChunk);
+
+/*
+** Free a chunk, its vectors and the values they own. Safe to call with
+** NULL.
+*/
+void cypherChunkFree(CypherDataChunk *pChunk);
+
+/*
+** Drop all rows and the selection, keeping the columns. Producers call
+** this before filling a chunk.
+*/
+void cypherChunkReset(CypherDataChunk *pChunk);
+
+/*
+** Drop all rows and columns, so the next producer defines its own.
+*/
+void cypherChunkClear(CypherDataChunk *pChunk);
+
+/*
+** Add a column of type eType. Returns the column index or -1 if out of
+** memory.
+*/
+int cypherChunkAddColumn(CypherDataChunk *pChunk, const char *zName, int eType);
+
+/*
+** Physical row index of live row i.
+*/
+#define cypherChunkRow(pChunk, i) ((pChunk)->bSel ? (pChunk)->aSel[(i)] : (i))
+
+/*
+** Value of column iCol in physical row iRow. Node ids are materialized
+** into *pTmp; other values are returned in place and owned by the chunk.
+*/
+const CypherValue *cypherChunkValue(CypherDataChunk *pChunk, int iCol,
+                                    int iRow, CypherValue *pTmp);
+
+/*
+** Keep only the live rows whose aKeep[] entry (indexed by live row) is
+** non-zero.
+*/
+void cypherChunkSelect(CypherDataChunk *pChunk, const unsigned char *aKeep);
+
+/*
+** Bind every column of physical row iRow into the execution context,
+** so expressions evaluated next see that row.
+*/
+int cypherChunkBindRow(CypherDataChunk *pChunk, int iRow,
+                       ExecutionContext *pContext);
+
+/*
+** Row adapter: append the columns of live row i to pResult.
+*/
+int cypherChunkToResult(CypherDataChunk *pChunk, int i, CypherResult *pResult);
+
+/*
+** Row adapter: append a CypherResult as a new physical row, defining
+** the columns from the first row appended. The chunk must have room.
+*/
+int cypherChunkAppendResult(CypherDataChunk *pChunk, CypherResult *pResult);
+
+#endif /* CYPHER_CHUNK_H */
@@ -19,6 +19,7 @@
 #define CYPHER_EXECUTOR_H
 
 #include "cypher-planner.h"
+#include "graph-arena.h"
 
 /*
 ** Forward declarations for execution structures.
@@ -28,6 +29,8 @@ typedef struct CypherIterator CypherIterator;
 typedef struct ExecutionContext ExecutionContext;
 typedef struct CypherResult CypherResult;
 typedef struct CypherValue CypherValue;
+typedef struct CypherDataChunk CypherDataChunk;
+typedef struct CypherOpProfile CypherOpProfile;
 
 /*
 ** Cypher value types for runtime values.
@@ -52,6 +55,8 @@ typedef enum {
 */
 struct CypherValue {
   CypherValueType type;         /* Type of the value */
+  int bArena;                   /* String, list or map payload is arena
+                                ** memory: cypherValueDestroy() skips it */
   union {
     int bBoolean;               /* Boolean value */
     sqlite3_int64 iInteger;     /* Integer value */
@@ -80,8 +85,28 @@ struct CypherResult {
   CypherValue *aValues;         /* Column values */
   int nColumns;                 /* Number of columns */
   int nColumnsAlloc;            /* Allocated column space */
+  int bArena;                   /* Names and values are copied into arena */
+  GraphArena arena;             /* Child of the statement arena, rewound by
+                                ** cypherResultClear() */
+  CypherResult *pNextFree;      /* Next in ExecutionContext.pFreeRow */
 };
 
+/*
+** Work counters an ExecutionContext accumulates over a statement.
+** Operators bump them where the work is done; under EXPLAIN ANALYZE the
+** change across each operator call is charged to that operator.
+*/
+typedef struct CypherCounters {
+  sqlite3_int64 nStep;          /* sqlite3_step() calls */
+  sqlite3_int64 nCacheHit;      /* Adjacency read from the CSR snapshot */
+  sqlite3_int64 nCacheMiss;     /* Adjacency read from the edge index */
+  sqlite3_int64 nJsonBytes;     /* Bytes of property JSON decoded */
+} CypherCounters;
+
+/* Step pStmt, counting the call against pContext */
+#define CYPHER_STEP(pContext, pStmt) \
+  ((pContext)->counters.nStep++, sqlite3_step(pStmt))
+
 /*
 ** Execution context structure.
 ** Manages state during query execution including variable bindings.
@@ -97,17 +122,35 @@ struct ExecutionContext {
   int nVariablesAlloc;          /* Allocated variable space */
   
   /* Execution state */
-  int nRowsProduced;            /* Total rows produced */
+  int nRowsProduced;            /* Rows returned since the last open */
   int nRowsProcessed;           /* Total rows processed */
   char *zErrorMsg;              /* Error message */
   int iErrorCode;               /* Error code */
+  sqlite3_int64 nSortMemory;    /* Sort and join spill threshold, 0 for default */
+  int nThreads;                 /* Workers for parallel operators, 0 for the pool */
+  const CypherParams *pParams;  /* Query parameters, or NULL */
+  sqlite3_stmt *apPropStmt[2];  /* Node and relationship property reads of
+                                ** executionContextProperty(), or NULL */
   
   /* Memory management */
-  void **apAllocated;           /* Allocated memory blocks */
-  int nAllocated;               /* Number of allocated blocks */
-  int nAllocatedMax;            /* Maximum allocated blocks */
+  GraphArena arena;             /* Statement-lifetime allocations; parent of
+                                ** the operators' per-row arenas */
+  char **azName;                /* Interned column names, in arena */
+  int nName;                    /* Number of interned names */
+  int nNameAlloc;               /* Allocated azName slots */
+  CypherResult *pFreeRow;       /* Released row buffers, reused first */
+  int nFreeRow;                 /* Rows on pFreeRow */
+  
+  /* Instrumentation */
+  CypherCounters counters;      /* Work done so far */
+  int bAnalyze;                 /* Profile iterators as they are created */
+  CypherOpProfile *pProfile;    /* Profiled iterators, newest first */
+  CypherOpProfile *pRunning;    /* Innermost profiled call in progress */
 };
 
+/* Row buffers an ExecutionContext keeps for reuse */
+#define CYPHER_FREE_ROWS 8
+
 /*
 ** Base iterator interface (Volcano model).
 ** All physical operators implement this interface.
@@ -118,6 +161,7 @@ struct CypherIterator {
   int (*xNext)(CypherIterator*, CypherResult*);     /* Get next result row */
   int (*xClose)(CypherIterator*);                   /* Clean up iterator */
   void (*xDestroy)(CypherIterator*);                /* Destroy iterator */
+  int (*xNextBatch)(CypherIterator*, CypherDataChunk*); /* Next chunk, or NULL */
   
   /* Iterator state */
   ExecutionContext *pContext;   /* Execution context */
@@ -133,6 +177,31 @@ struct CypherIterator {
   /* Statistics */
   int nRowsProduced;            /* Rows produced by this iterator */
   double rCost;                 /* Actual execution cost */
+  CypherOpProfile *pProfile;    /* EXPLAIN ANALYZE record, or NULL */
+};
+
+/*
+** EXPLAIN ANALYZE record of one iterator. cypherIteratorProfile() moves
+** the iterator's xOpen, xNext, xNextBatch and xClose here and installs
+** wrappers that time each call and charge it the change in the context
+** counters. Time and work are inclusive of the operators called from
+** inside; the a*Child fields hold that share so exclusive figures are a
+** subtraction. Records live in the statement arena.
+*/
+struct CypherOpProfile {
+  PhysicalPlanNode *pPlan;      /* Plan node the iterator runs */
+  int (*xOpen)(CypherIterator*);
+  int (*xNext)(CypherIterator*, CypherResult*);
+  int (*xClose)(CypherIterator*);
+  int (*xNextBatch)(CypherIterator*, CypherDataChunk*);
+  sqlite3_int64 nOpen;          /* xOpen calls */
+  sqlite3_int64 nNext;          /* xNext and xNextBatch calls */
+  sqlite3_int64 nRows;          /* Rows returned */
+  double rTime;                 /* Milliseconds inside the iterator */
+  double rChildTime;            /* Of which inside profiled callees */
+  CypherCounters work;          /* Counter changes inside the iterator */
+  CypherCounters childWork;     /* Of which inside profiled callees */
+  CypherOpProfile *pNext;       /* Next in ExecutionContext.pProfile */
 };
 
 /*
@@ -146,6 +215,9 @@ struct CypherExecutor {
   CypherIterator *pRootIterator; /* Root iterator */
   PhysicalPlanNode *pPlan;      /* Physical execution plan */
   char *zErrorMsg;              /* Error message */
+  int bOpen;                    /* Root iterator is open */
+  CypherDataChunk *pChunk;      /* Batch being handed out row by row */
+  int iChunkRow;                /* Next live row of pChunk */
 };
 
 /*
@@ -177,6 +249,23 @@ int cypherExecutorPrepare(CypherExecutor *pExecutor, PhysicalPlanNode *pPlan);
 */
 int cypherExecutorExecute(CypherExecutor *pExecutor, char **pzResults);
 
+/*
+** Row-at-a-time execution of the prepared plan. cypherExecutorOpen()
+** opens the root iterator, each cypherExecutorNext() appends the
+** columns of one row to pResult (SQLITE_DONE after the last) and
+** cypherExecutorClose() ends the run. Memory use is that of the
+** operators, independent of the number of rows returned.
+*/
+int cypherExecutorOpen(CypherExecutor *pExecutor);
+int cypherExecutorNext(CypherExecutor *pExecutor, CypherResult *pResult);
+void cypherExecutorClose(CypherExecutor *pExecutor);
+
+/*
+** Supply the parameters the plan's $name slots are bound to when its
+** iterators open. pParams is not copied and must outlive the run.
+*/
+void cypherExecutorSetParams(CypherExecutor *pExecutor, const CypherParams *pParams);
+
 /*
 ** Get error message from executor.
 ** Returns NULL if no error occurred.
@@ -211,6 +300,44 @@ int executionContextBind(ExecutionContext *pContext, const char *zVar, CypherVal
 */
 CypherValue *executionContextGet(ExecutionContext *pContext, const char *zVar);
 
+/*
+** The statement's copy of column name zName, shared by every row and
+** operator that interns the same name. Returns NULL on OOM. Operators
+** intern their output names once, when created, and add columns with
+** cypherResultAddColumnShared() or cypherResultTakeColumn().
+*/
+const char *executionContextIntern(ExecutionContext *pContext, const char *zName);
+
+/*
+** An empty arena-backed row buffer (cypherResultCreateIn()), from the
+** context's free list when one was released, keeping the column arrays
+** it grew before. Returns NULL on OOM.
+*/
+CypherResult *executionContextRowAcquire(ExecutionContext *pContext);
+
+/*
+** Clear pRow and keep it for executionContextRowAcquire(), or destroy
+** it once CYPHER_FREE_ROWS are kept. pRow may be NULL.
+*/
+void executionContextRowRelease(ExecutionContext *pContext, CypherResult *pRow);
+
+/*
+** The value pPlan compares against and its SQLITE_* type (0 if it has
+** none, see graphParseLiteral()): its parameter's value from the context
+** when the plan has one, else its literal. A missing parameter sets the
+** context error and returns SQLITE_ERROR.
+*/
+int executionContextPlanValue(ExecutionContext *pContext, const PhysicalPlanNode *pPlan,
+                              const char **pzValue, int *peType);
+
+/*
+** Read property zProperty of the node, relationship or map in *pObject
+** into *pResult, NULL when it has none or *pObject is another value.
+** Graph properties are read from the context's graph on its connection.
+*/
+int executionContextProperty(ExecutionContext *pContext, const CypherValue *pObject,
+                             const char *zProperty, CypherValue *pResult);
+
 /*
 ** Iterator creation functions.
 */
@@ -227,6 +354,28 @@ CypherIterator *cypherIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *
 */
 void cypherIteratorDestroy(CypherIterator *pIterator);
 
+/*
+** Fill pChunk with the next batch of rows (see cypher-chunk.h). Uses the
+** iterator's xNextBatch when it has one and otherwise collects rows from
+** xNext. Returns SQLITE_DONE when no rows remain.
+*/
+int cypherIteratorNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk);
+
+/*
+** Attach an EXPLAIN ANALYZE record to pIterator (see CypherOpProfile).
+** cypherIteratorCreate() calls this for every iterator, including those
+** operators create for themselves, when the context's bAnalyze is set.
+*/
+int cypherIteratorProfile(CypherIterator *pIterator);
+
+/*
+** Render pPlan annotated with the profiles the context collected while
+** running it, as a JSON object per operator: estimated and actual rows,
+** inclusive and exclusive time and work, and call counts. Operators that
+** never ran report zeros. Caller must sqlite3_free() the result.
+*/
+char *cypherProfileToJson(ExecutionContext *pContext, PhysicalPlanNode *pPlan);
+
 /*
 ** Specific iterator implementations.
 */
@@ -249,6 +398,34 @@ CypherIterator *cypherLabelIndexScanCreate(PhysicalPlanNode *pPlan, ExecutionCon
 */
 CypherIterator *cypherPropertyIndexScanCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
 
+/*
+** Create a BitmapAnd iterator.
+** Intersects the node id sets of its child label and property index
+** scans, then emits the surviving node ids in ascending order.
+*/
+CypherIterator *cypherBitmapAndCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
+/*
+** Create an Expand iterator.
+** For each input row, follows the edges of type pPlan->zLabel (any type
+** if NULL) from the node bound to pPlan->zFromAlias in pPlan->eDirection
+** and adds the node reached as pPlan->zAlias and the edge as
+** pPlan->zRelAlias. With PLAN_EXPAND_INTO both ends are already bound
+** and only the edges between them are followed. Neighbors come from the
+** CSR snapshot when one is current and the expand needs neither edge
+** types nor edge ids, and from the covering edge index otherwise.
+*/
+CypherIterator *cypherExpandCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
+/*
+** Create a VarLengthExpand iterator.
+** For each input row, adds one row per path of nMinHops..nMaxHops edges
+** from pPlan->zFromAlias that never revisits a node (see cypher-paths.h),
+** binding its last node as pPlan->zAlias and its edges as a list in
+** pPlan->zRelAlias.
+*/
+CypherIterator *cypherVarLengthExpandCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
 /*
 ** Create a Filter iterator.
 ** Filters input rows based on predicate expressions.
@@ -263,10 +440,45 @@ CypherIterator *cypherProjectionCreate(PhysicalPlanNode *pPlan, ExecutionContext
 
 /*
 ** Create a Sort iterator.
-** Sorts input rows based on specified criteria.
+** Sorts input rows on pPlan->apSortKeys, spilling to a temporary file
+** past the context's nSortMemory and keeping only the best nLimit rows
+** when the plan carries a limit (see cypher-sort.h).
 */
 CypherIterator *cypherSortCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
 
+/*
+** Create an Aggregation iterator (cypher-aggregate.c).
+** Groups input rows on the PLAN_AGG_KEY items of pPlan->aAggregate and
+** folds the other items into per-group accumulators, partially on each
+** worker of the pool, spilling groups to partitions past nSortMemory.
+*/
+CypherIterator *cypherAggregationCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
+/*
+** Buckets a hash join partitions its inputs into once the build side
+** exceeds the context's nSortMemory.
+*/
+#ifndef CYPHER_JOIN_PARTITIONS
+# define CYPHER_JOIN_PARTITIONS 16
+#endif
+
+/*
+** Create a HashJoin iterator, also used for NestedLoopJoin.
+** Joins its two children on the node bound to pPlan->zAlias, building
+** a hash table on the child with the smaller row estimate. Without a
+** join variable the children are cross joined.
+*/
+CypherIterator *cypherHashJoinCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
+/*
+** Create an IndexNestedLoop iterator.
+** Looks each row of the first child up in the node or edge indexes
+** instead of reading the second child, when the second child is a node
+** scan of the join variable or an expand reaching it from a node scan.
+** Other inner plans are hash joined.
+*/
+CypherIterator *cypherIndexNestedLoopCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
 /*
 ** Create a Limit iterator.
 ** Limits the number of output rows.
@@ -295,6 +507,14 @@ void cypherValueDestroy(CypherValue *pValue);
 */
 CypherValue *cypherValueCopy(CypherValue *pValue);
 
+/*
+** Deep-copy pSrc into *pDst, which is overwritten without being
+** destroyed. With pArena the copy's strings, lists and maps are
+** allocated there and marked bArena; without, from the heap.
+** Returns SQLITE_OK or SQLITE_NOMEM (leaving *pDst NULL).
+*/
+int cypherValueCopyIn(GraphArena *pArena, CypherValue *pDst, const CypherValue *pSrc);
+
 /*
 ** Initialize a CypherValue to NULL.
 */
@@ -415,24 +635,86 @@ char *cypherValueToJson(const CypherValue *pValue);
 */
 CypherResult *cypherResultCreate(void);
 
+/*
+** Create a result row whose column names and values are copied into a
+** child arena of pParent (an ExecutionContext's arena), so filling and
+** clearing it per row does not touch the heap. Suits row buffers that
+** are reused or short-lived; rows kept until a spill should use
+** cypherResultCreate(). pParent NULL is cypherResultCreate().
+*/
+CypherResult *cypherResultCreateIn(GraphArena *pParent);
+
 /*
 ** Destroy a result row and free all associated memory.
 ** Safe to call with NULL pointer.
 */
 void cypherResultDestroy(CypherResult *pResult);
 
+/*
+** Remove all columns from a result row, keeping its allocation for the
+** next row.
+*/
+void cypherResultClear(CypherResult *pResult);
+
 /*
 ** Add a column to a result row.
 ** Returns SQLITE_OK on success, error code on failure.
 */
 int cypherResultAddColumn(CypherResult *pResult, const char *zName, CypherValue *pValue);
 
+/*
+** Add a column without copying its name into an arena row: zName must
+** stay valid until the row is cleared, as plan strings, interned names
+** and chunk column names do. Rows from cypherResultCreate() copy it.
+** The value is copied.
+*/
+int cypherResultAddColumnShared(CypherResult *pResult, const char *zName, CypherValue *pValue);
+
+/*
+** As cypherResultAddColumnShared(), but move the heap-owned *pValue into
+** the row instead of copying it, leaving *pValue NULL. On error *pValue
+** is unchanged and still the caller's.
+*/
+int cypherResultTakeColumn(CypherResult *pResult, const char *zName, CypherValue *pValue);
+
 /*
 ** Get JSON representation of a result row.
 ** Caller must sqlite3_free() the returned string.
 */
 char *cypherResultToJson(CypherResult *pResult);
 
+/*
+** Append-only JSON output for result rows (cypher-json.c). Each column
+** keeps its escaped '{"name":' or ',"name":' prefix, rebuilt only when
+** a row brings another name, so a plan's rows format without
+** re-escaping names. cypherJsonAppendString() writes z[0..n) as a quoted,
+** escaped JSON string. An append that runs out of memory sets bOom, and
+** cypherJsonWriterFinish() then returns NULL.
+*/
+typedef struct CypherJsonPrefix CypherJsonPrefix;
+struct CypherJsonPrefix {
+  char *zName;                  /* Column name the prefix was built for */
+  char *zPrefix;                /* '{"name":' or ',"name":' */
+  int nPrefix;
+};
+
+typedef struct CypherJsonWriter CypherJsonWriter;
+struct CypherJsonWriter {
+  char *z;                      /* Output so far, not NUL-terminated */
+  sqlite3_int64 n;              /* Bytes used */
+  sqlite3_int64 nAlloc;         /* Bytes allocated */
+  int bOom;                     /* An append failed */
+  CypherJsonPrefix *aPrefix;    /* Per column */
+  int nPrefix;
+};
+
+void cypherJsonWriterInit(CypherJsonWriter *pWriter);
+void cypherJsonWriterReset(CypherJsonWriter *pWriter);
+char *cypherJsonWriterFinish(CypherJsonWriter *pWriter);
+void cypherJsonAppend(CypherJsonWriter *pWriter, const char *z, int n);
+void cypherJsonAppendString(CypherJsonWriter *pWriter, const char *z, int n);
+void cypherJsonAppendRow(CypherJsonWriter *pWriter, const CypherResult *pResult);
+
 /*
 ** Get formatted JSON representation of a result row with indentation.
 ** Caller must sqlite3_free() the returned string.
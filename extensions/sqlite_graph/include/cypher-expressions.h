@@ -20,7 +20,8 @@ typedef enum {
     CYPHER_EXPR_LIST,        /* List operations */
     CYPHER_EXPR_MAP,         /* Map operations */
     CYPHER_EXPR_FUNCTION,    /* Function calls */
-    CYPHER_EXPR_CASE         /* CASE expressions */
+    CYPHER_EXPR_CASE,        /* CASE expressions */
+    CYPHER_EXPR_PARAMETER    /* Query parameter like '$name' */
 } CypherExpressionType;
 
 /* Arithmetic operators */
@@ -78,6 +79,11 @@ typedef struct CypherExpression {
             char *zName;
         } variable;
         
+        /* Query parameter, read from the context's parameters */
+        struct {
+            char *zName;
+        } parameter;
+        
         /* Property access */
         struct {
             struct CypherExpression *pObject;
@@ -126,12 +132,39 @@ int cypherExpressionEvaluate(const CypherExpression *pExpr,
                             ExecutionContext *pContext, 
                             CypherValue *pResult);
 
+/* Operators on evaluated operands, shared with compiled expressions */
+int cypherEvaluateArithmetic(const CypherValue *pLeft, const CypherValue *pRight,
+                           CypherArithmeticOp op, CypherValue *pResult);
+int cypherEvaluateComparison(const CypherValue *pLeft, const CypherValue *pRight,
+                           CypherComparisonOp op, CypherValue *pResult);
+int cypherEvaluateLogical(const CypherValue *pLeft, const CypherValue *pRight,
+                         CypherLogicalOp op, CypherValue *pResult);
+
+/*
+** Build the expression of a Cypher AST expression: literals, parameters,
+** variables, property access, comparisons, AND, OR, XOR, NOT, arithmetic,
+** list literals and function calls. Returns SQLITE_ERROR for any other
+** node, SQLITE_NOMEM on allocation failure.
+*/
+int cypherExpressionFromAst(const CypherAst *pAst, CypherExpression **ppExpr);
+
+/* Deep copy of pExpr, or NULL on allocation failure */
+CypherExpression *cypherExpressionCopy(const CypherExpression *pExpr);
+
+/*
+** Value of query parameter zName in the context's parameters, typed as
+** graphParseLiteral() reads it. A missing parameter sets the context
+** error and returns SQLITE_ERROR.
+*/
+int cypherParameterValue(ExecutionContext *pContext, const char *zName, CypherValue *pResult);
+
 /* Literal expression creation */
 int cypherExpressionCreateLiteral(CypherExpression **ppExpr, const CypherValue *pValue);
 int cypherExpressionCreateVariable(CypherExpression **ppExpr, const char *zName);
 int cypherExpressionCreateProperty(CypherExpression **ppExpr, 
                                   CypherExpression *pObject, 
                                   const char *zProperty);
+int cypherExpressionCreateParameter(CypherExpression **ppExpr, const char *zName);
 
 /* Binary expression creation */
 int cypherExpressionCreateArithmetic(CypherExpression **ppExpr,
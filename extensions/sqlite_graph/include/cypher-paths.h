@@ -9,6 +9,7 @@
 #define CYPHER_PATHS_H
 
 #include "cypher.h"
+#include "graph.h"
 
 /* Path length bounds for variable-length patterns */
 typedef struct PathBounds {
@@ -43,16 +44,43 @@ typedef struct PathResult {
     struct PathResult *pNext;        /* Next path in result set */
 } PathResult;
 
+/* Adjacency statements of a path search, one per direction followed.
+** Zero-initialize; cypherMatchPaths() prepares them on first use. */
+typedef struct PathStmts {
+    sqlite3_stmt *apStmt[2];         /* Neighbors over out- or in-edges */
+    int nStmt;                       /* Statements prepared */
+} PathStmts;
+
 /* Function declarations */
 
-/* Parse path bounds from pattern (e.g., "*1..3", "*", "*..5") */
+/* Parse path bounds from pattern (e.g., "*1..3", "*", "*..5").
+** "*" alone is one or more hops, "*n" exactly n. NULL is a single hop. */
 PathBounds cypherParsePathBounds(const char *pattern);
 
-/* Create variable-length path AST node */
+/* Create the CYPHER_AST_RANGE node holding boundsStr, added to
+** relPattern as a child when relPattern is not NULL */
 CypherAst* cypherCreateVariableLengthPath(CypherAst *relPattern, 
                                          const char *boundsStr);
 
-/* Match variable-length paths in graph */
+/* Match the paths from startNode along eDirection (GRAPH_EXPAND_*) edges
+** of type relType (any type if NULL) whose length is within bounds and
+** that end at endNode, or anywhere if endNode < 0. No node repeats
+** within a path, so unbounded searches terminate. The paths are written
+** to *ppPaths in depth-first order, NULL if there are none. The number
+** of sqlite3_step() calls made is added to *pnStep unless it is NULL.
+** pStmts, if not NULL, keeps the adjacency statements for the next call,
+** which must pass the same pGraph, relType and eDirection; release them
+** with cypherPathStmtsFinalize(). Returns SQLITE_OK or an error code. */
+int cypherMatchPaths(GraphVtab *pGraph, sqlite3_int64 startNode,
+                     sqlite3_int64 endNode, const char *relType,
+                     int eDirection, PathBounds bounds, PathStmts *pStmts,
+                     PathResult **ppPaths, sqlite3_int64 *pnStep);
+
+/* Finalize the statements kept in pStmts and zero it */
+void cypherPathStmtsFinalize(PathStmts *pStmts);
+
+/* Match variable-length paths in graph, following outgoing edges.
+** Returns NULL if there are none or on error. */
 PathResult* cypherMatchVariableLengthPaths(GraphVtab *pGraph,
                                           sqlite3_int64 startNode,
                                           sqlite3_int64 endNode,
@@ -33,6 +33,7 @@ typedef enum {
   LOGICAL_INDEX_SCAN,           /* Scan using property index */
   LOGICAL_RELATIONSHIP_SCAN,    /* Scan all relationships */
   LOGICAL_TYPE_SCAN,           /* Scan relationships by type */
+  LOGICAL_BITMAP_AND,          /* Intersect the id sets of child scans */
   
   /* Pattern Operations */
   LOGICAL_EXPAND,              /* Expand from node along relationships */
@@ -78,6 +79,11 @@ typedef enum {
   PHYSICAL_PROPERTY_INDEX_SCAN, /* Use property index for scanning */
   PHYSICAL_ALL_RELS_SCAN,      /* Sequential scan of all relationships */
   PHYSICAL_TYPE_INDEX_SCAN,    /* Use type index for relationships */
+  PHYSICAL_BITMAP_AND,         /* Intersect child index scans as bitmaps */
+  
+  /* Traversal Operators */
+  PHYSICAL_EXPAND,             /* Follow adjacency from a bound node */
+  PHYSICAL_VAR_LENGTH_EXPAND,  /* Bounded path search from a bound node */
   
   /* Join Operators */
   PHYSICAL_HASH_JOIN,          /* In-memory hash join */
@@ -89,9 +95,61 @@ typedef enum {
   PHYSICAL_PROJECTION,         /* Column projection */
   PHYSICAL_SORT,               /* External sorting */
   PHYSICAL_LIMIT,              /* Result limiting */
-  PHYSICAL_AGGREGATION         /* Grouping and aggregation */
+  PHYSICAL_AGGREGATION,        /* Grouping and aggregation */
+  
+  /* Write Operators */
+  PHYSICAL_CREATE,             /* Create nodes and relationships */
+  PHYSICAL_MERGE               /* Find or create a node */
 } PhysicalOperatorType;
 
+/*
+** LogicalPlanNode.iFlags and PhysicalPlanNode.iFlags for EXPAND: both
+** endpoints are already bound, the expand only checks that an edge
+** joins them.
+*/
+#define PLAN_EXPAND_INTO 0x0001
+
+/*
+** PhysicalPlanNode.aSortFlags, one entry per sort key.
+*/
+#define PLAN_SORT_DESC   0x01   /* Descending; NULLs sort first */
+
+/*
+** PlanAggregate.eFunc: a grouping key or the aggregate it computes.
+*/
+#define PLAN_AGG_KEY     0      /* Grouping key, returned as is */
+#define PLAN_AGG_COUNT   1      /* count(x), or count(*) without zVariable */
+#define PLAN_AGG_SUM     2      /* sum(x) */
+#define PLAN_AGG_AVG     3      /* avg(x) */
+#define PLAN_AGG_MIN     4      /* min(x) */
+#define PLAN_AGG_MAX     5      /* max(x) */
+
+/*
+** One output column of an AGGREGATION, in RETURN order: a grouping key
+** or an aggregate over a variable or one of its properties.
+*/
+typedef struct PlanAggregate {
+  int eFunc;                    /* PLAN_AGG_* */
+  char *zVariable;              /* Argument variable, NULL for count(*) */
+  char *zProperty;              /* Property of zVariable, or NULL */
+  char *zName;                  /* Output column name */
+} PlanAggregate;
+
+/*
+** One element a CREATE writes, in pattern order: a node, or a
+** relationship between two node elements before it. Property values
+** are expressions, evaluated when the operator runs.
+*/
+typedef struct PlanWriteItem {
+  char *zVariable;              /* Variable bound to the element, or NULL */
+  char *zLabel;                 /* Node label or relationship type, or NULL */
+  int iFrom;                    /* Relationship: items of its source and */
+  int iTo;                      /* target node; both -1 for a node */
+  char **azProp;                /* Property names */
+  struct CypherExpression **apValue; /* Property values, owned */
+  int nProp;                    /* Entries in azProp and apValue */
+} PlanWriteItem;
+
 /*
 ** Logical plan node structure.
 ** Forms a tree representing the logical query structure.
@@ -102,6 +160,28 @@ typedef struct LogicalPlanNode {
   char *zLabel;                 /* Node label (for scans) */
   char *zProperty;              /* Property name (for filters/indexes) */
   char *zValue;                 /* Literal value (for filters) */
+  int eValueType;               /* SQLITE_* type zValue was written as */
+  char *zParam;                 /* Parameter supplying the value instead */
+  int eCmp;                     /* GRAPH_CMP_* of zProperty against zValue */
+  char *zFromAlias;             /* Bound endpoint an EXPAND starts from */
+  int eDirection;               /* GRAPH_EXPAND_* direction of an EXPAND */
+  char *zRelAlias;              /* Relationship variable an EXPAND binds */
+  int nMinHops;                 /* Hop bounds of a VAR_LENGTH_EXPAND, */
+  int nMaxHops;                 /* nMaxHops < 0 for unbounded */
+  PlanAggregate *aAggregate;    /* Output columns of an AGGREGATION */
+  int nAggregate;               /* Entries in aAggregate */
+  struct CypherExpression *pExpr; /* Predicate a FILTER or PROPERTY_FILTER
+                                ** evaluates, owned */
+  struct CypherExpression **apProjections; /* Items of a PROJECTION, owned */
+  char **azColumn;              /* Output column name of each item */
+  int nProjections;             /* Entries in apProjections and azColumn */
+  struct CypherExpression **apSortKeys; /* Keys of a SORT, owned */
+  unsigned char *aSortFlags;    /* PLAN_SORT_* per key of a SORT */
+  int nSortKeys;                /* Entries in apSortKeys and aSortFlags */
+  int nLimit;                   /* Rows a LIMIT returns */
+  PlanWriteItem *aWrite;        /* Elements a CREATE writes; for a MERGE
+                                ** its node, ON CREATE and ON MATCH sets */
+  int nWrite;                   /* Entries in aWrite */
   
   /* Child operations */
   struct LogicalPlanNode **apChildren;
@@ -133,6 +213,14 @@ typedef struct PhysicalPlanNode {
   char *zLabel;                 /* Label for scans */
   char *zProperty;              /* Property for filters/indexes */
   char *zValue;                 /* Filter value */
+  int eValueType;               /* SQLITE_* type zValue was written as */
+  char *zParam;                 /* Parameter bound as the value at execution */
+  int eCmp;                     /* GRAPH_CMP_* of zProperty against zValue */
+  char *zFromAlias;             /* Bound endpoint an expand starts from */
+  int eDirection;               /* GRAPH_EXPAND_* direction of an expand */
+  char *zRelAlias;              /* Relationship variable an expand binds */
+  int nMinHops;                 /* Hop bounds of a var-length expand, */
+  int nMaxHops;                 /* nMaxHops < 0 for unbounded */
   
   /* Child operators */
   struct PhysicalPlanNode **apChildren;
@@ -140,15 +228,25 @@ typedef struct PhysicalPlanNode {
   int nChildren;
   int nChildrenAlloc;
   
-  /* Filter and projection expressions */
+  /* Filter and projection expressions, owned like the sort keys */
   struct CypherExpression *pFilterExpr;      /* Filter expression */
   struct CypherExpression **apProjections;   /* Projection expressions */
   int nProjections;                          /* Number of projections */
+  char **azColumn;                           /* Output name per projection */
   
   /* Sort and limit parameters */
   struct CypherExpression **apSortKeys;      /* Sort key expressions */
+  unsigned char *aSortFlags;                 /* PLAN_SORT_* per key, or NULL */
   int nSortKeys;                             /* Number of sort keys */
-  int nLimit;                                /* LIMIT value */
+  int nLimit;                                /* LIMIT value; on a SORT, rows kept */
+  
+  /* Aggregation: keys and aggregates in output order, owned */
+  PlanAggregate *aAggregate;
+  int nAggregate;
+  
+  /* Write: elements to create or merge, owned */
+  PlanWriteItem *aWrite;
+  int nWrite;
   
   /* Cost and statistics */
   double rCost;                 /* Actual estimated cost */
@@ -180,6 +278,9 @@ typedef struct PlanContext {
   char **azPropertyIndexes;     /* Available property indexes */
   int nLabelIndexes;
   int nPropertyIndexes;
+  char **azColumns;             /* Hot-property columns: label (NULL for
+                                ** all nodes) and property of each */
+  int nColumns;
   
   /* Optimization settings */
   int bUseIndexes;              /* Enable index usage */
@@ -272,7 +373,31 @@ int logicalPlanNodeAddChild(LogicalPlanNode *pParent, LogicalPlanNode *pChild);
 int logicalPlanNodeSetAlias(LogicalPlanNode *pNode, const char *zAlias);
 int logicalPlanNodeSetLabel(LogicalPlanNode *pNode, const char *zLabel);
 int logicalPlanNodeSetProperty(LogicalPlanNode *pNode, const char *zProperty);
-int logicalPlanNodeSetValue(LogicalPlanNode *pNode, const char *zValue);
+int logicalPlanNodeSetValue(LogicalPlanNode *pNode, const char *zValue, int eType);
+int logicalPlanNodeSetParam(LogicalPlanNode *pNode, const char *zParam);
+int logicalPlanNodeSetFromAlias(LogicalPlanNode *pNode, const char *zFromAlias);
+int logicalPlanNodeSetRelAlias(LogicalPlanNode *pNode, const char *zRelAlias);
+
+/*
+** Copy and free arrays of aggregation columns. planAggregateCopy()
+** returns NULL if out of memory or nAggregate is 0.
+*/
+PlanAggregate *planAggregateCopy(const PlanAggregate *aAggregate, int nAggregate);
+void planAggregateFree(PlanAggregate *aAggregate, int nAggregate);
+
+/*
+** Copy and free arrays of write items. planWriteItemsCopy() returns
+** NULL on allocation failure.
+*/
+PlanWriteItem *planWriteItemsCopy(const PlanWriteItem *aWrite, int nWrite);
+void planWriteItemsFree(PlanWriteItem *aWrite, int nWrite);
+
+/*
+** Copy and free arrays of projection column names. planColumnsCopy()
+** returns NULL if out of memory or nColumn is 0.
+*/
+char **planColumnsCopy(char **azColumn, int nColumn);
+void planColumnsFree(char **azColumn, int nColumn);
 
 /*
 ** Physical plan construction functions.
@@ -290,6 +415,12 @@ PhysicalPlanNode *physicalPlanNodeCreate(PhysicalOperatorType type);
 */
 void physicalPlanNodeDestroy(PhysicalPlanNode *pNode);
 
+/*
+** Deep copy of a physical plan tree, expressions included, without its
+** execution state. Returns NULL on allocation failure.
+*/
+PhysicalPlanNode *physicalPlanNodeCopy(const PhysicalPlanNode *pNode);
+
 /*
 ** Add a child node to a physical plan node.
 ** Returns SQLITE_OK on success, SQLITE_NOMEM on allocation failure.
@@ -313,8 +444,23 @@ double logicalPlanEstimateCost(LogicalPlanNode *pNode, PlanContext *pContext);
 sqlite3_int64 logicalPlanEstimateRows(LogicalPlanNode *pNode, PlanContext *pContext);
 
 /*
-** Optimize join ordering using dynamic programming.
-** Modifies the logical plan tree for better execution order.
+** True if an index scan in the subtree pNode already applies the
+** predicate of the property filter pFilter.
+*/
+int logicalPlanAppliesPredicate(LogicalPlanNode *pNode, LogicalPlanNode *pFilter);
+
+/*
+** Check whether property zProperty of nodes with zLabel has a hot-
+** property column (graph_create_column()): 2 for one declared for
+** zLabel, 1 for one over all nodes, 0 for none.
+*/
+int planContextHasColumn(PlanContext *pContext, const char *zLabel,
+                         const char *zProperty);
+
+/*
+** Pick the build side of each hash join from the row estimates. Join
+** order itself is chosen when a pattern is compiled (see
+** graphOptimizeJoinOrder()); index nested loops keep their orientation.
 */
 int logicalPlanOptimizeJoins(LogicalPlanNode *pNode, PlanContext *pContext);
 
@@ -352,6 +498,13 @@ char *logicalPlanToString(LogicalPlanNode *pNode);
 */
 char *physicalPlanToString(PhysicalPlanNode *pNode);
 
+/*
+** Operator-specific details of one plan node ("label=Person",
+** "from=a dir=out", ...), or NULL if it has none.
+** Caller must sqlite3_free() the returned string.
+*/
+char *physicalPlanNodeDetails(PhysicalPlanNode *pNode);
+
 /*
 ** Test and demo functions.
 */
@@ -0,0 +1,68 @@
+/*
+ * Cypher Compiled Expressions
+ *
+ * cypherProgramCompile() flattens a CypherExpression tree once, when
+ * the iterators of a plan are built, into register-based bytecode:
+ * one instruction per tree node in evaluation order, each writing its own
+ * register. Constant subtrees are folded into constants, builtin
+ * functions are resolved to their implementations, and comparisons and
+ * arithmetic on integers and floats run inline without cypherValueCompare().
+ * Literals and variables are read in place rather than copied.
+ *
+ * Evaluation reads variables either from the ExecutionContext or straight
+ * from the column vectors of a CypherDataChunk row, so batch operators need
+ * not bind each row into the context. Property access reads the object's
+ * register through executionContextProperty() and parameters come from
+ * the context's parameters on every evaluation, so neither needs a bound
+ * row. Node kinds the compiler does not handle are evaluated by
+ * cypherExpressionEvaluate() and give identical results.
+ *
+ * A program refers to the expression it was compiled from, which must
+ * outlive it. A program is not thread-safe: its registers are reused by
+ * every evaluation.
+ */
+
+#ifndef CYPHER_PROGRAM_H
+#define CYPHER_PROGRAM_H
+
+#include "cypher-expressions.h"
+#include "cypher-chunk.h"
+
+typedef struct CypherProgram CypherProgram;
+
+/* Compile pExpr. Returns SQLITE_OK or SQLITE_NOMEM. */
+int cypherProgramCompile(const CypherExpression *pExpr, CypherProgram **ppProgram);
+
+/* Free a program. Safe to call with NULL. */
+void cypherProgramFree(CypherProgram *pProgram);
+
+/* Evaluate against the context's bindings, as cypherExpressionEvaluate(). */
+int cypherProgramEvaluate(CypherProgram *pProgram, ExecutionContext *pContext,
+                          CypherValue *pResult);
+
+/*
+ * Evaluate against physical row iRow of pChunk. Variables that name a
+ * chunk column read it; other variables come from the context.
+ */
+int cypherProgramEvaluateRow(CypherProgram *pProgram, ExecutionContext *pContext,
+                             CypherDataChunk *pChunk, int iRow,
+                             CypherValue *pResult);
+
+/*
+ * Evaluate a predicate against the context's bindings. *pbTrue is set
+ * when the result is neither NULL nor false.
+ */
+int cypherProgramTest(CypherProgram *pProgram, ExecutionContext *pContext,
+                      int *pbTrue);
+
+/*
+ * Evaluate a predicate over every live row of pChunk. aKeep[i] is set
+ * for live row i as cypherProgramTest() would set *pbTrue.
+ */
+int cypherProgramFilter(CypherProgram *pProgram, ExecutionContext *pContext,
+                        CypherDataChunk *pChunk, unsigned char *aKeep);
+
+/* Instructions in a program, for EXPLAIN output and tests. */
+int cypherProgramSize(const CypherProgram *pProgram);
+
+#endif /* CYPHER_PROGRAM_H */
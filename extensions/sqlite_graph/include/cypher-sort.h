@@ -0,0 +1,93 @@
+/*
+** SQLite Graph Database Extension - Sort Operator Engine
+**
+** Backs PHYSICAL_SORT. Each input row is stored with a normalized sort
+** key: the ORDER BY values encoded so that memcmp() of two keys orders
+** the rows. DESC keys are stored bit-inverted and every key ends with the
+** row's arrival sequence, so comparisons never evaluate an expression
+** and equal rows keep their input order.
+**
+** Rows are buffered in memory and sorted with an introsort. Once the
+** buffered rows exceed the memory budget they are sorted and written to
+** a temporary file as a run; the output is then produced by a k-way
+** merge of the runs. With a row limit the sorter keeps only the best
+** nLimit rows in a bounded heap instead, until they outgrow the budget.
+**
+** Value ordering is that of openCypher ORDER BY: maps, nodes,
+** relationships, lists, paths, strings, booleans, then numbers (integers
+** and floats compared by value), with NULL last ascending and first
+** descending.
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+** Temporary files: Opened through the connection's VFS and deleted on
+**                  close, like SQLite's own sorter files
+*/
+#ifndef CYPHER_SORT_H
+#define CYPHER_SORT_H
+
+#include "cypher-executor.h"
+
+/*
+** Default bytes of buffered rows before a sort spills to disk. Override
+** per query with ExecutionContext.nSortMemory.
+*/
+#ifndef CYPHER_SORT_MEMORY
+# define CYPHER_SORT_MEMORY (16*1024*1024)
+#endif
+
+/*
+** Runs merged per pass. More runs than this are merged in several
+** passes, each writing longer runs back to the temporary file.
+*/
+#ifndef CYPHER_SORT_MERGE_FANIN
+# define CYPHER_SORT_MERGE_FANIN 32
+#endif
+
+typedef struct CypherSorter CypherSorter;
+
+/*
+** Allocate a sorter for rows with nKey sort keys. aSortFlags holds the
+** PLAN_SORT_* flags of each key (NULL sorts every key ascending). A
+** positive nLimit stops the output after that many rows. nMemory is the
+** spill threshold in bytes; zero or less uses CYPHER_SORT_MEMORY. pDb
+** selects the VFS for temporary files and may be NULL.
+*/
+int cypherSorterCreate(sqlite3 *pDb, int nKey, const unsigned char *aSortFlags,
+                       int nLimit, sqlite3_int64 nMemory,
+                       CypherSorter **ppSorter);
+
+/*
+** Add a row with its nKey evaluated sort keys. The sorter takes
+** ownership of pRow (a cypherResultCreate() row) even on error.
+*/
+int cypherSorterAdd(CypherSorter *pSorter, const CypherValue *aKey,
+                    CypherResult *pRow);
+
+/*
+** Stop accepting rows and prepare the sorted output.
+*/
+int cypherSorterFinish(CypherSorter *pSorter);
+
+/*
+** Append the columns of the next row in sort order to pResult. Returns
+** SQLITE_DONE after the last row.
+*/
+int cypherSorterNext(CypherSorter *pSorter, CypherResult *pResult);
+
+/*
+** Rows spilled to the temporary file so far; zero for in-memory sorts.
+*/
+sqlite3_int64 cypherSorterSpilled(const CypherSorter *pSorter);
+
+/*
+** Approximate heap bytes held by pRow, as charged against the budget.
+*/
+sqlite3_int64 cypherSorterRowBytes(const CypherResult *pRow);
+
+/*
+** Free a sorter, its buffered rows and its temporary file. Safe to call
+** with NULL.
+*/
+void cypherSorterFree(CypherSorter *pSorter);
+
+#endif /* CYPHER_SORT_H */
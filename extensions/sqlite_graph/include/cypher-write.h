@@ -54,9 +54,41 @@ struct CypherWriteOp {
     CypherWriteOp *pNext;             /* Next operation in transaction */
 };
 
+/*
+** Rows per multi-row INSERT when flushing buffered creates. Edge rows
+** bind six values, so a batch stays under SQLite's historic limit of
+** 999 host parameters.
+*/
+#define CYPHER_WRITE_BATCH_ROWS 128
+
+/*
+** Node and relationship rows created by a statement and not yet
+** written. The JSON text is owned by the buffer.
+*/
+typedef struct CypherPendingNode CypherPendingNode;
+struct CypherPendingNode {
+    sqlite3_int64 iNodeId;            /* Node ID */
+    char *zLabels;                    /* Labels JSON array */
+    char *zProperties;                /* Properties JSON object */
+};
+
+typedef struct CypherPendingRel CypherPendingRel;
+struct CypherPendingRel {
+    sqlite3_int64 iRelId;             /* Relationship ID */
+    sqlite3_int64 iFromId;            /* Source node ID */
+    sqlite3_int64 iToId;              /* Target node ID */
+    char *zRelType;                   /* Relationship type */
+    double rWeight;                   /* Edge weight */
+    char *zProperties;                /* Properties JSON object */
+};
+
 /*
 ** Write transaction context for managing mutations and rollback.
-** Maintains operation log and provides transaction semantics.
+** Writes run inside a savepoint, which rollback returns to. Created
+** nodes and relationships are buffered and flushed as prepared
+** multi-row INSERTs when a batch fills, before anything reads the
+** graph, and on commit. The operation log records the mutations that
+** are not creates, for reporting; it is not replayed.
 */
 typedef struct CypherWriteContext CypherWriteContext;
 struct CypherWriteContext {
@@ -71,6 +103,23 @@ struct CypherWriteContext {
     char *zErrorMsg;                  /* Error message */
     sqlite3_int64 iNextNodeId;        /* Next available node ID */
     sqlite3_int64 iNextRelId;         /* Next available relationship ID */
+    int bNodeIdsLoaded;               /* iNextNodeId read from storage */
+    int bRelIdsLoaded;                /* iNextRelId read from storage */
+    CypherPendingNode aPendingNode[CYPHER_WRITE_BATCH_ROWS];
+    int nPendingNodes;                /* Buffered node rows */
+    CypherPendingRel aPendingRel[CYPHER_WRITE_BATCH_ROWS];
+    int nPendingRels;                 /* Buffered relationship rows */
+    sqlite3_stmt *pNodeBatchStmt;     /* Full-batch node INSERT */
+    sqlite3_stmt *pNodeStmt;          /* Single-row node INSERT */
+    sqlite3_stmt *pRelBatchStmt;      /* Full-batch relationship INSERT */
+    sqlite3_stmt *pRelStmt;           /* Single-row relationship INSERT */
+    sqlite3_stmt *pSetPropStmt;       /* Node property UPDATE */
+    char *zMergeLabel;                /* Label of the cached MERGE unique key */
+    char *zMergeProp;                 /* Property of the cached MERGE unique key */
+    sqlite3_stmt *pMergeProbeStmt;    /* Unique key index probe */
+    sqlite3_stmt *pMergeUpsertStmt;   /* Single-row node upsert on the key */
+    sqlite3_stmt *pMergeUpsertBatchStmt; /* Full-batch node upsert on the key */
+    int nWriteSteps;                  /* Write statements stepped */
 };
 
 /*
@@ -200,6 +249,12 @@ int cypherWriteContextCommit(CypherWriteContext *pCtx);
 */
 int cypherWriteContextRollback(CypherWriteContext *pCtx);
 
+/*
+** Write the buffered node and relationship rows to storage.
+** Returns SQLITE_OK on success, error code on failure.
+*/
+int cypherWriteContextFlush(CypherWriteContext *pCtx);
+
 /*
 ** Add a write operation to the transaction log.
 ** Returns SQLITE_OK on success, SQLITE_NOMEM on allocation failure.
@@ -208,13 +263,15 @@ int cypherWriteContextAddOperation(CypherWriteContext *pCtx, CypherWriteOp *pOp)
 
 /*
 ** Get the next available node ID from the context.
-** Updates the context's next ID counter.
+** The first call reads the largest stored ID; later ones count up
+** without touching storage.
 */
 sqlite3_int64 cypherWriteContextNextNodeId(CypherWriteContext *pCtx);
 
 /*
 ** Get the next available relationship ID from the context.
-** Updates the context's next ID counter.
+** The first call reads the largest stored ID; later ones count up
+** without touching storage.
 */
 sqlite3_int64 cypherWriteContextNextRelId(CypherWriteContext *pCtx);
 
@@ -260,6 +317,14 @@ CypherWriteIterator *cypherCreateNodeIteratorCreate(CypherWriteContext *pCtx,
 CypherWriteIterator *cypherCreateRelIteratorCreate(CypherWriteContext *pCtx,
                                                  CreateRelOp *pOp);
 
+/*
+** Create the iterator of a PHYSICAL_CREATE plan node. Each run writes
+** the plan's nodes and relationships in a savepoint, committed when
+** all succeed, and returns no rows.
+** Returns NULL on allocation failure.
+*/
+CypherIterator *cypherCreateIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
 /*
 ** MERGE operation functions.
 */
@@ -270,6 +335,24 @@ CypherWriteIterator *cypherCreateRelIteratorCreate(CypherWriteContext *pCtx,
 */
 int cypherMergeNode(CypherWriteContext *pCtx, MergeNodeOp *pOp);
 
+/*
+** Execute nOp MERGE node operations in order, as for UNWIND input. When
+** the pattern's label and a match property carry a uniqueness
+** constraint (graph_create_constraint()), rows are merged by upsert on
+** the constraint's index and one index probe each, up to
+** CYPHER_WRITE_BATCH_ROWS per statement, instead of a scan per row.
+** Returns SQLITE_OK on success, error code on failure.
+*/
+int cypherMergeNodeBatch(CypherWriteContext *pCtx, MergeNodeOp **apOp, int nOp);
+
+/*
+** Create the iterator of a PHYSICAL_MERGE plan node. Each run merges
+** the plan's node with cypherMergeNode() in a savepoint, committed when
+** it succeeds, and returns no rows.
+** Returns NULL on allocation failure.
+*/
+CypherIterator *cypherMergeIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext);
+
 /*
 ** Create a MERGE node iterator.
 ** Returns NULL on allocation failure.
@@ -111,11 +111,13 @@ typedef struct CypherToken {
 // Lexer context structure
 struct CypherLexer {
     const char *zInput;
+    int nInput;              // strlen(zInput)
     int iPos;
     int iLine;
     int iColumn;
     char *zErrorMsg;
-    CypherToken *pLastToken; // Last token returned
+    CypherToken token;       // Current token, overwritten by each call
+    CypherToken *pLastToken; // &token once a token has been returned
 };
 
 // Lexer Functions
@@ -124,6 +126,30 @@ void cypherLexerDestroy(CypherLexer *pLexer);
 CypherToken *cypherLexerNextToken(CypherLexer *pLexer);
 const char *cypherTokenTypeName(CypherTokenType type); // For debugging
 
+// Query parameters by name: the literal text of each value and the
+// SQLITE_* type it is bound as, as graphBindLiteral() reads them. A NULL
+// value is the Cypher null.
+typedef struct CypherParams {
+    char **azName;
+    char **azValue;
+    int *aeType;
+    int nParam;
+    int nParamAlloc;
+} CypherParams;
+
+int cypherParamsAdd(CypherParams *pParams, const char *zName, const char *zValue, int nValue,
+                    int eType);
+const char *cypherParamsFind(const CypherParams *pParams, const char *zName, int *peType,
+                             int *pbFound);
+void cypherParamsClear(CypherParams *pParams);
+
+// Rewrite a query into its plan cache key: tokens separated by single
+// spaces, keywords in upper case, comments dropped, and the literals
+// compared against or assigned to a property replaced by the parameters
+// $_1, $_2, ... whose values are added to pParams. Queries differing only
+// in those literals share a key. Returns NULL if the query does not lex.
+char *cypherNormalizeQuery(const char *zQuery, CypherParams *pParams);
+
 // AST Definitions
 
 // AST Node Types
@@ -175,6 +201,24 @@ typedef enum {
     CYPHER_AST_CONTAINS_OP,
     CYPHER_AST_REGEX,
     
+    // Hop bounds of a variable-length relationship, e.g. "*1..3"
+    CYPHER_AST_RANGE,
+    
+    // Query parameter "$name"; the value is the name without the '$'
+    CYPHER_AST_PARAMETER,
+    
+    // CREATE clause; its child is the pattern list to create
+    CYPHER_AST_CREATE,
+    
+    // MERGE clause; its first child is the pattern of the node to merge,
+    // then a MERGE_ACTION per ON CREATE SET or ON MATCH SET
+    CYPHER_AST_MERGE,
+    
+    // ON CREATE SET or ON MATCH SET of a MERGE; the value is "CREATE" or
+    // "MATCH" and the children are PROPERTY_PAIRs of the property set,
+    // each with the value expression and then the variable it is set on
+    CYPHER_AST_MERGE_ACTION,
+    
     CYPHER_AST_COUNT // Sentinel for max AST node type
 } CypherAstNodeType;
 
@@ -187,7 +231,9 @@ struct CypherAst {
     int nChildrenAlloc; // Allocated size of apChildren
     int iLine; // Line number from source
     int iColumn; // Column number from source
-    int iFlags; // General purpose flags (e.g., DISTINCT for RETURN clause)
+    int iFlags; // General purpose flags (e.g., DISTINCT for RETURN clause);
+                // for a LITERAL the SQLITE_* type it was written as
+    struct GraphArena *pArena; // Owning parse arena, NULL for heap nodes
 };
 
 // AST Node creation functions
@@ -199,9 +245,16 @@ CypherAst *cypherAstCreateUnaryOp(const char *zOp, CypherAst *pExpr, int iLine,
 CypherAst *cypherAstCreateProperty(CypherAst *pObj, const char *zProp, int iLine, int iColumn);
 CypherAst *cypherAstCreateNodeLabel(const char *zLabel, int iLine, int iColumn);
 
+// Make pArena the current thread's AST arena, returning the previous one.
+// While set, cypherAstCreate() allocates nodes and their values there and
+// cypherAstDestroy() leaves them to graphArenaRelease(). cypherParse()
+// installs its parser's arena for the duration of the parse.
+struct GraphArena *cypherAstSetArena(struct GraphArena *pArena);
+
 // AST Node manipulation functions
 void cypherAstAddChild(CypherAst *pParent, CypherAst *pChild);
 void cypherAstSetValue(CypherAst *pNode, const char *zValue);
+void cypherAstSetValueN(CypherAst *pNode, const char *zValue, int nValue);
 CypherAst *cypherAstGetChild(CypherAst *pNode, int iChild);
 int cypherAstGetChildCount(CypherAst *pNode);
 const char *cypherAstGetValue(CypherAst *pNode);
@@ -220,6 +273,7 @@ const char *cypherAstNodeTypeName(CypherAstNodeType type);
 struct CypherParser {
     char *zErrorMsg;
     CypherAst *pAst;
+    struct GraphArena *pArena; // AST nodes of the last parse
 };
 
 // Parser Functions
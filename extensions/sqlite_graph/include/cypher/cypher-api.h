@@ -111,6 +111,45 @@ int cypherExecuteQuery(GraphVtab *pVtab, const char *zQuery,
 */
 void cypherFreeAST(CypherAST *pAST);
 
+/*
+** Prepared Cypher statements, used like sqlite3_stmt. A statement is
+** parsed and planned once, against graph zGraph of pDb or with zGraph
+** NULL the default graph, and keeps its plan and iterator tree between
+** runs, so a run only binds parameters and reopens the iterators.
+**
+** cypherStmtBind*() set the value of $name (given with or without the
+** '$') for the following runs. Values keep the type they were bound
+** with, so cypherStmtBindText(p, "zip", "02139") matches the string and
+** not the number 2139, as with the JSON parameters of cypher_execute().
+** Binding while a run is in progress returns SQLITE_MISUSE; call
+** cypherStmtReset() first.
+**
+** cypherStmtStep() returns SQLITE_ROW with the row in cypherStmtRow()
+** until the next step, SQLITE_DONE at the end, or an error code with
+** the message in cypherStmtErrmsg(). Stepping after SQLITE_DONE starts
+** a new run. cypherStmtReset() ends a run and keeps the bindings.
+**
+** The plan is made again on the next run after graph_create_index() or
+** graph_analyze() retire the graph's cached plans. Statements hold
+** SQLite statements while they run or have run, so finalize them with
+** cypherStmtFinalize() before closing the connection.
+*/
+typedef struct CypherStmt CypherStmt;
+typedef struct CypherResult CypherResult;
+
+int cypherStmtPrepare(sqlite3 *pDb, const char *zGraph, const char *zQuery,
+                      CypherStmt **ppStmt, char **pzErr);
+int cypherStmtBindInt64(CypherStmt *pStmt, const char *zName,
+                        sqlite3_int64 iValue);
+int cypherStmtBindDouble(CypherStmt *pStmt, const char *zName, double rValue);
+int cypherStmtBindText(CypherStmt *pStmt, const char *zName,
+                       const char *zValue);
+int cypherStmtStep(CypherStmt *pStmt);
+CypherResult *cypherStmtRow(CypherStmt *pStmt);
+const char *cypherStmtErrmsg(CypherStmt *pStmt);
+int cypherStmtReset(CypherStmt *pStmt);
+void cypherStmtFinalize(CypherStmt *pStmt);
+
 /*
 ** Cypher transaction support.
 */
@@ -82,6 +82,7 @@ CypherAst *cypherAstCreateUnaryOp(const char *zOp, CypherAst *pExpr, int iLine,
 // AST Node manipulation functions
 void cypherAstAddChild(CypherAst *pParent, CypherAst *pChild);
 void cypherAstSetValue(CypherAst *pNode, const char *zValue);
+void cypherAstSetValueN(CypherAst *pNode, const char *zValue, int nValue);
 CypherAst *cypherAstGetChild(CypherAst *pNode, int iChild);
 int cypherAstGetChildCount(CypherAst *pNode);
 const char *cypherAstGetValue(CypherAst *pNode);
@@ -0,0 +1,87 @@
+/*
+** SQLite Graph Database Extension - Chunked Bump Arenas
+**
+** An arena hands out memory by bumping a pointer through chunks of
+** szChunk bytes and frees it all at once. Query execution uses one per
+** statement (ExecutionContext.arena) for values, result rows and other
+** memory that lives until the statement ends, and the parser one per
+** parse for AST nodes, replacing a malloc/free pair per object.
+**
+** Child arenas serve memory that dies sooner, such as an operator's
+** per-row or per-batch scratch: graphArenaReset() rewinds a child and
+** hands its chunks back to the parent's spare list, so a reset and
+** refill cycle allocates nothing after the first round.
+**
+** An arena and its children belong to one thread.
+**
+** Memory allocation: Chunks come from sqlite3_malloc64()
+** Alignment: Every allocation is 8-byte aligned
+*/
+#ifndef GRAPH_ARENA_H
+#define GRAPH_ARENA_H
+
+#include "graph.h"
+
+#define GRAPH_ARENA_CHUNK 8192     /* Default chunk payload size */
+
+typedef struct GraphArenaChunk GraphArenaChunk;
+typedef struct GraphArena GraphArena;
+
+struct GraphArena {
+  char *zFree;                 /* Next free byte in the current chunk */
+  char *zEnd;                  /* End of the current chunk */
+  GraphArenaChunk *pChunk;     /* Chunks in use, current first */
+  GraphArenaChunk *pSpare;     /* Reset chunks kept for reuse */
+  GraphArena *pParent;         /* Lends and takes back chunks, or NULL */
+  int szChunk;                 /* Payload bytes per standard chunk */
+  sqlite3_int64 nUsed;         /* Bytes handed out since the last reset */
+  sqlite3_int64 nChunkAlloc;   /* Chunks obtained from sqlite3_malloc64() */
+};
+
+/*
+** Initialize an empty arena. No memory is allocated until the first
+** graphArenaAlloc(). szChunk of 0 selects GRAPH_ARENA_CHUNK; a child
+** (pParent not NULL) uses its parent's chunk size.
+*/
+void graphArenaInit(GraphArena *p, GraphArena *pParent, int szChunk);
+
+/*
+** Allocate n bytes, or return NULL on OOM. Requests larger than a
+** quarter chunk get a chunk of their own.
+*/
+void *graphArenaAlloc(GraphArena *p, sqlite3_int64 n);
+
+/*
+** Resize pOld, nOld bytes from graphArenaAlloc(), to nNew bytes. The
+** most recent allocation grows in place when the chunk has room; other
+** blocks are copied and their old space is reclaimed only on reset.
+*/
+void *graphArenaRealloc(GraphArena *p, void *pOld, sqlite3_int64 nOld,
+                        sqlite3_int64 nNew);
+
+/*
+** Copy a nul-terminated string, or its first n bytes when n>=0, into
+** the arena. NULL input returns NULL.
+*/
+char *graphArenaStrdup(GraphArena *p, const char *z, int n);
+
+/*
+** Invalidate every allocation and rewind to an empty arena. Standard
+** chunks are kept for reuse (by the parent for a child arena);
+** oversized ones are freed.
+*/
+void graphArenaReset(GraphArena *p);
+
+/*
+** Payload bytes of the chunks p holds, in use or spare. For a statement
+** arena whose children have been released this is its high-water mark.
+*/
+sqlite3_int64 graphArenaFootprint(const GraphArena *p);
+
+/*
+** Free all chunks. A child returns its standard chunks to the parent.
+** The arena may be reused after graphArenaInit().
+*/
+void graphArenaRelease(GraphArena *p);
+
+#endif /* GRAPH_ARENA_H */
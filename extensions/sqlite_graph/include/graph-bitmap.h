@@ -0,0 +1,80 @@
+/*
+** SQLite Graph Database Extension - Compressed Node Id Bitmaps
+**
+** Roaring-style bitmaps over 64-bit node ids. Ids are split into a
+** 48-bit container key and a 16-bit low half; each container holds its
+** low halves either as a sorted uint16 array (up to 4096 values) or as
+** a 65536-bit bitset, whichever is smaller. Sparse sets stay compact and
+** dense sets get word-at-a-time AND/OR/ANDNOT.
+**
+** Used to evaluate conjunctions of label and property predicates as set
+** intersections before any node row is read (PHYSICAL_BITMAP_AND).
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+** Ordering: Iteration and graphBitmapToArray() yield ascending ids,
+**           negative ids included
+*/
+#ifndef GRAPH_BITMAP_H
+#define GRAPH_BITMAP_H
+
+#include "graph.h"
+
+typedef struct GraphBitmap GraphBitmap;
+
+/*
+** Allocate an empty bitmap. Returns NULL on OOM.
+*/
+GraphBitmap *graphBitmapCreate(void);
+
+/*
+** Free a bitmap. Safe to call with NULL.
+*/
+void graphBitmapFree(GraphBitmap *p);
+
+/*
+** Add iId to the bitmap. Adding ids in ascending order is the fast
+** path. Returns SQLITE_OK or SQLITE_NOMEM.
+*/
+int graphBitmapAdd(GraphBitmap *p, sqlite3_int64 iId);
+
+/*
+** Return non-zero if iId is in the bitmap.
+*/
+int graphBitmapContains(const GraphBitmap *p, sqlite3_int64 iId);
+
+/*
+** Number of ids in the bitmap.
+*/
+sqlite3_int64 graphBitmapCount(const GraphBitmap *p);
+
+/*
+** Set algebra. Each writes a newly allocated bitmap to *ppOut that the
+** caller frees with graphBitmapFree(). The inputs are not modified.
+** Return SQLITE_OK or SQLITE_NOMEM.
+*/
+int graphBitmapAnd(const GraphBitmap *pA, const GraphBitmap *pB,
+                   GraphBitmap **ppOut);
+int graphBitmapOr(const GraphBitmap *pA, const GraphBitmap *pB,
+                  GraphBitmap **ppOut);
+int graphBitmapAndNot(const GraphBitmap *pA, const GraphBitmap *pB,
+                      GraphBitmap **ppOut);
+
+/*
+** Deep copy of p in *ppOut. Returns SQLITE_OK or SQLITE_NOMEM.
+*/
+int graphBitmapCopy(const GraphBitmap *p, GraphBitmap **ppOut);
+
+/*
+** Step pStmt to completion, adding column 0 of every row. The statement
+** is left for the caller to reset or finalize.
+*/
+int graphBitmapFromStmt(sqlite3_stmt *pStmt, GraphBitmap **ppOut);
+
+/*
+** Copy the ids out in ascending order. *paId is allocated with
+** sqlite3_malloc() (NULL when empty) and must be freed by the caller.
+*/
+int graphBitmapToArray(const GraphBitmap *p, sqlite3_int64 **paId,
+                       int *pnId);
+
+#endif /* GRAPH_BITMAP_H */
@@ -20,11 +20,12 @@
 
 /* Bulk loader configuration */
 typedef struct BulkLoaderConfig {
-    int batchSize;               /* Nodes/edges per transaction */
+    int batchSize;               /* Rows per transaction, 0 for one */
     int deferIndexing;           /* Defer index updates */
-    int parallelImport;          /* Use parallel processing */
+    int parallelImport;          /* Parse workers: 0 on the calling thread,
+                                 ** -1 for the whole pool */
     int validateData;            /* Validate during import */
-    int compressProperties;      /* Enable property compression */
+    int compressProperties;      /* Unused: see properties=compressed */
     void (*progressCallback)(int percent, void *arg);
     void *progressArg;
 } BulkLoaderConfig;
@@ -0,0 +1,522 @@
+/*
+** SQLite Graph Database Extension - CSR Adjacency Snapshot
+**
+** Compressed sparse row (CSR) view of the backing node and edge tables.
+** Algorithms and traversals run over these contiguous arrays instead of
+** issuing one SQL query per visited node.
+**
+** Node identifiers are remapped to dense indices 0..nNodes-1 so that
+** per-node algorithm state can live in flat arrays. Out-edges and
+** in-edges are both materialized, so pull-style kernels (PageRank) and
+** reverse traversals need no extra work.
+**
+** Memory allocation: All arrays use sqlite3_malloc()/sqlite3_free()
+** Lifetime: A snapshot is owned by its GraphVtab and rebuilt lazily
+**           whenever the graph changes in a way it was not told about.
+**           Writes through the graph interfaces that know their effect
+**           on the adjacency are layered over it instead (CSRDelta,
+**           graph-csr-delta.c) and read through a CSRView.
+*/
+#ifndef GRAPH_CSR_H
+#define GRAPH_CSR_H
+
+#include "graph.h"
+
+/*
+** Open-addressed map from node id to dense index. Slots hold indices
+** into a borrowed key array, so the map costs 4 bytes per slot on top
+** of the ids themselves. Lookups are O(1) expected regardless of how
+** sparse or large the ids are.
+*/
+typedef struct GraphIdMap GraphIdMap;
+struct GraphIdMap {
+  const sqlite3_int64 *aKey;   /* Borrowed: dense index -> id */
+  int *aSlot;                  /* Dense index per slot, -1 if empty */
+  int nBits;                   /* log2 of the slot count */
+};
+
+/*
+** Build pMap over the nKey distinct ids in aKey. aKey is not copied and
+** must outlive the map. Returns SQLITE_OK or SQLITE_NOMEM.
+*/
+int graphIdMapBuild(GraphIdMap *pMap, const sqlite3_int64 *aKey, int nKey);
+
+/*
+** Return the dense index of iId, or -1 if it is not in the map.
+*/
+int graphIdMapLookup(const GraphIdMap *pMap, sqlite3_int64 iId);
+
+/*
+** Release the slot array of pMap. The key array is left alone.
+*/
+void graphIdMapClear(GraphIdMap *pMap);
+
+/*
+** Node coordinates for graphAStar(), read from two node properties on
+** first use. Once published on a snapshot they are never written again;
+** a search holds a reference, so a snapshot dropping or replacing its
+** coordinates does not free them under it.
+*/
+typedef struct CSRCoords CSRCoords;
+struct CSRCoords {
+  char *zX, *zY;               /* Properties the coordinates came from */
+  double *aX, *aY;             /* Per dense node, NaN if missing */
+  int nRef;                    /* Holders; see graphCSRCoordsGet() */
+};
+
+/*
+** Compressed sparse row adjacency.
+**
+** Out-edges of dense node i are columnIndices[rowOffsets[i] ..
+** rowOffsets[i+1]-1] with matching edgeWeights. In-edges are laid out
+** the same way in inOffsets/inIndices/inWeights. Both offset arrays
+** have nNodes+1 entries.
+*/
+struct CSRGraph {
+  sqlite3_int64 *rowOffsets;   /* Out-edge offsets, nNodes+1 entries */
+  int *columnIndices;          /* Dense target index per out-edge */
+  double *edgeWeights;         /* Weight per out-edge */
+  sqlite3_int64 *inOffsets;    /* In-edge offsets, nNodes+1 entries */
+  int *inIndices;              /* Dense source index per in-edge */
+  double *inWeights;           /* Weight per in-edge */
+  sqlite3_int64 *aNodeIds;     /* Dense index -> node id, ascending */
+  GraphIdMap idMap;            /* Node id -> dense index over aNodeIds */
+  int nNodes;                  /* Number of nodes */
+  sqlite3_int64 nEdges;        /* Number of edges */
+
+  /* Node coordinates for graphAStar(), read on first use. Searches on
+  ** other threads may share the snapshot, so only touch this through
+  ** graphCSRCoordsGet() and graphCSRCoordsSet() */
+  CSRCoords *pCoords;
+
+  int nRef;                    /* GraphVtab, views and compaction holding it */
+
+  /* Persistence (graph-csr-file.c) */
+  void *pMap;                  /* csr_file= mapping the arrays live in, or NULL */
+  sqlite3_int64 nMap;          /* Size of pMap in bytes */
+  sqlite3_int64 nUnsaved;      /* Writes folded in since the file matched it,
+                               ** or -1 if it never did */
+
+  /* Validity stamp, taken at build time and moved on by tracked writes */
+  sqlite3_int64 iDataVersion;  /* GraphVtab.iDataVersion */
+  unsigned int iFileVersion;   /* SQLITE_FCNTL_DATA_VERSION */
+  int nTotalChanges;           /* sqlite3_total_changes() */
+  int nUncounted;              /* Vtab rows not yet in nTotalChanges */
+  int iForeignVersion;         /* PRAGMA data_version */
+  int bUncommitted;            /* Stamped inside a write transaction */
+  sqlite3_int64 iEpoch;        /* TEMP epoch row written with that stamp */
+};
+
+/*
+** Build a standalone CSR snapshot from a node table (id column) and an
+** edge table (source, target, weight columns). Edges whose endpoints
+** are missing from the node table are skipped. A NULL weight is read
+** as 1.0. Caller must release the result with graphCSRFree().
+*/
+int graphCSRBuild(sqlite3 *pDb, const char *zNodeTable,
+                  const char *zEdgeTable, CSRGraph **ppCSR);
+
+/*
+** Build a standalone snapshot from two queries: zNodeSql returns node
+** ids in ascending order, zEdgeSql (source, target, weight) rows. Edges
+** to ids zNodeSql did not return are skipped, as for graphCSRBuild(),
+** which is this over the whole tables.
+*/
+int graphCSRBuildQuery(sqlite3 *pDb, const char *zNodeSql,
+                       const char *zEdgeSql, CSRGraph **ppCSR);
+
+/*
+** Bytes of memory held by a snapshot's arrays and id map.
+*/
+sqlite3_int64 graphCSRBytes(const CSRGraph *pCSR);
+
+/*
+** Free a snapshot and all of its arrays. NULL is a no-op. Snapshots
+** cached on a GraphVtab are reference counted; let go of those with
+** graphCSRRelease() instead.
+*/
+void graphCSRFree(CSRGraph *pCSR);
+
+/*
+** Drop one reference to a cached snapshot, freeing it with the last.
+*/
+void graphCSRRelease(CSRGraph *pCSR);
+
+/*
+** Snapshot coordinates. graphCSRCoordsGet() returns a new reference to
+** the coordinates of pCSR if they were read from properties zX and zY,
+** else NULL. graphCSRCoordsSet() publishes pCoords (which may be NULL)
+** in place of the current ones, taking a reference of its own. Drop
+** references with graphCSRCoordsRelease(). All three serialize on one
+** mutex, so concurrent searches over a shared snapshot are safe.
+*/
+CSRCoords *graphCSRCoordsGet(CSRGraph *pCSR, const char *zX, const char *zY);
+void graphCSRCoordsSet(CSRGraph *pCSR, CSRCoords *pCoords);
+void graphCSRCoordsRelease(CSRCoords *pCoords);
+
+/*
+** Return the snapshot for pVtab in *ppCSR, building it on first use and
+** rebuilding it if the graph changed since it was taken. Tracked writes
+** since the build are folded in first, so the arrays are complete. The
+** snapshot remains owned by pVtab and is valid until the next graph
+** write.
+*/
+int graphCSRGet(GraphVtab *pVtab, CSRGraph **ppCSR);
+
+/*
+** Return true if pVtab holds a snapshot that, with its write overlay,
+** is current: graphCSRViewOpen() would not rebuild it and graphCSRGet()
+** would at most fold the overlay in memory. Lets callers with small,
+** bounded work choose per-hop SQL lookups over paying for a full build.
+** The first call on a connection without a snapshot maps a matching
+** csr_file= copy, if the graph has one.
+*/
+int graphCSRIsCurrent(GraphVtab *pVtab);
+
+/*
+** Drop the cached snapshot of pVtab and its write overlay, if any.
+*/
+void graphCSRInvalidate(GraphVtab *pVtab);
+
+/*
+** Stamp the snapshot of pVtab as current after a write this connection
+** made and accounted for, nUncounted being the rows the running vtab
+** statement will add to sqlite3_total_changes() when it completes.
+** Returns SQLITE_OK, or an error if the stamp cannot be taken or
+** another connection committed since the snapshot was stamped, in
+** which case the caller must invalidate it.
+*/
+int graphCSRStampWrite(GraphVtab *pVtab, int nUncounted);
+
+/*
+** Write overlay (graph-csr-delta.c).
+**
+** A write that knows its effect on the adjacency brackets its SQL with
+** graphCSRTrackBegin() and graphCSRTrackEnd() and reports that effect in
+** between. If the snapshot was current when the write began it stays
+** current, with the change recorded in an overlay rather than forcing
+** a rebuild:
+**
+**   int bTrack = graphCSRTrackBegin(pVtab);
+**   rc = <the write>;
+**   if( rc==SQLITE_OK ) graphCSRTrack(pVtab, CSR_OP_ADD_EDGE, ...);
+**   graphCSRTrackEnd(pVtab, rc, 0);
+**
+** Deletes report before their SQL runs, while the row can still be read.
+** The reporting calls are no-ops when bTrack is false, and a write that
+** reports nothing (a property update) just keeps the snapshot current.
+*/
+#define CSR_OP_ADD_NODE   1    /* iFrom = node id */
+#define CSR_OP_DEL_NODE   2    /* iFrom = node id; its edges vanish too */
+#define CSR_OP_ADD_EDGE   3    /* iFrom -> iTo with rWeight */
+#define CSR_OP_DEL_EDGE   4    /* One iFrom -> iTo edge of rWeight */
+#define CSR_OP_DEL_EDGES  5    /* Every iFrom -> iTo edge */
+
+int graphCSRTrackBegin(GraphVtab *pVtab);
+void graphCSRTrack(GraphVtab *pVtab, int eOp, sqlite3_int64 iFrom,
+                   sqlite3_int64 iTo, double rWeight);
+void graphCSRTrackEdgeRow(GraphVtab *pVtab, int eOp, sqlite3_int64 iEdgeId);
+void graphCSRTrackEnd(GraphVtab *pVtab, int rc, int nUncounted);
+
+/*
+** Operation-log length at which a background fold of the overlay starts
+** (and a folded snapshot is worth writing to its csr_file=), provided it
+** is also at least 1/16 of the snapshot's edge count.
+*/
+#ifndef CSR_COMPACT_MIN
+# define CSR_COMPACT_MIN 4096
+#endif
+
+/*
+** Fold the write overlay of pVtab into a new snapshot, waiting for a
+** background compaction if one is running. Called by graphCSRGet().
+*/
+int graphCSRDeltaFold(GraphVtab *pVtab);
+
+/*
+** Release the write overlay of pVtab, waiting for a background
+** compaction to finish first. Called by graphCSRInvalidate().
+*/
+void graphCSRDeltaDrop(GraphVtab *pVtab);
+
+/*
+** Drop one reference to an overlay, freeing it with the last.
+*/
+void graphCSRDeltaRelease(CSRDelta *pDelta);
+
+/* An edge the overlay added, stored per endpoint and direction */
+typedef struct CSRDeltaEdge CSRDeltaEdge;
+struct CSRDeltaEdge {
+  int iNbr;                    /* Dense index of the other endpoint */
+  double rWeight;              /* Edge weight */
+};
+
+/*
+** A consistent version of the adjacency: a snapshot and the overlay on
+** top of it, both pinned until graphCSRViewClose(). Writes made while
+** a view is open go to a copy of the overlay and never change what the
+** view reads. Dense indices below pCSR->nNodes are the snapshot's;
+** nodes the overlay added follow them.
+*/
+typedef struct CSRView CSRView;
+struct CSRView {
+  CSRGraph *pCSR;              /* Snapshot, referenced */
+  CSRDelta *pDelta;            /* Overlay on pCSR, referenced, or NULL */
+};
+
+/*
+** Pin the current version of pVtab's adjacency, building the snapshot
+** if needed. Returns SQLITE_OK or an error from the build.
+*/
+int graphCSRViewOpen(GraphVtab *pVtab, CSRView *pView);
+
+/*
+** Release a view. A zeroed or already closed view is a no-op.
+*/
+void graphCSRViewClose(CSRView *pView);
+
+/*
+** Pin the snapshot of projection zName of pDb (graph-project.c), or with
+** zName NULL of the projection picked with graph_use(), as a view with
+** no overlay. Returns 1, or 0 with *pView zeroed if there is none.
+*/
+int graphProjectionView(sqlite3 *pDb, const char *zName, CSRView *pView);
+
+/*
+** True if pView is still the current version of pVtab's adjacency.
+*/
+int graphCSRViewIsCurrent(GraphVtab *pVtab, const CSRView *pView);
+
+/*
+** Build in *ppNew a standalone snapshot of pView, which must have an
+** overlay, with the overlay folded in. Safe to run on a worker thread.
+** Free the result with graphCSRFree().
+*/
+int graphCSRViewFold(const CSRView *pView, CSRGraph **ppNew);
+
+/*
+** Dense index of node iNodeId in pView, or -1 if it does not exist.
+*/
+int graphCSRViewIndexOf(const CSRView *pView, sqlite3_int64 iNodeId);
+
+/*
+** Node id of dense index iNode of pView.
+*/
+sqlite3_int64 graphCSRViewNodeId(const CSRView *pView, int iNode);
+
+/*
+** Number of dense nodes in pView, deleted ones included: the snapshot's
+** followed by those the overlay added.
+*/
+int graphCSRViewNodeCount(const CSRView *pView);
+
+/*
+** Number of writes logged in overlay pDelta (0 if it is NULL), and the
+** iOp-th of them: returns its CSR_OP_* code and sets *piFrom and *piTo
+** as graphCSRTrack() received them. The log of an overlay only grows
+** until the snapshot under it is replaced.
+*/
+int graphCSRDeltaOpCount(const CSRDelta *pDelta);
+int graphCSRDeltaOp(const CSRDelta *pDelta, int iOp,
+                    sqlite3_int64 *piFrom, sqlite3_int64 *piTo);
+
+/*
+** Out-degree (bIn==0) or in-degree of dense node iNode of pView.
+*/
+int graphCSRViewDegree(const CSRView *pView, int iNode, int bIn);
+
+/*
+** Iterator over the out-edges (bIn==0) or in-edges of one node of a
+** view: the snapshot's row minus tombstoned edges, then the edges the
+** overlay added, in the order a rebuild would list them.
+**
+**   CSREdgeIter it;
+**   int iNbr;
+**   double rWeight;
+**   graphCSREdgeFirst(&view, iNode, 0, &it);
+**   while( graphCSREdgeNext(&it, &iNbr, &rWeight) ){ ... }
+*/
+typedef struct CSREdgeIter CSREdgeIter;
+struct CSREdgeIter {
+  const CSRView *pView;        /* View being read */
+  int bIn;                     /* Reading in-edges */
+  sqlite3_int64 k, kEnd;       /* Snapshot slots left */
+  const CSRDeltaEdge *aAdd;    /* Edges the overlay added */
+  int iAdd, nAdd;              /* Next and count of aAdd */
+};
+
+void graphCSREdgeFirst(const CSRView *pView, int iNode, int bIn,
+                       CSREdgeIter *pIter);
+int graphCSREdgeNext(CSREdgeIter *pIter, int *piNbr, double *prWeight);
+
+/*
+** Read the change indicators a cache of pVtab's data is stamped with:
+** the file's SQLITE_FCNTL_DATA_VERSION (commits by other connections)
+** and sqlite3_total_changes() (writes on this one). With
+** GraphVtab.iDataVersion they tell whether a cached value is current.
+*/
+void graphDataStamp(GraphVtab *pVtab, unsigned int *piFileVersion,
+                    int *pnTotalChanges);
+
+/*
+** Map a node id to its dense index in O(1). Returns -1 if the id is
+** unknown.
+*/
+int graphCSRIndexOf(const CSRGraph *pCSR, sqlite3_int64 iNodeId);
+
+/*
+** Breadth-first search over a snapshot from dense node iStart. Reached
+** nodes are written to aQueue (nNodes slots) in level order and their
+** count to *pnQueue. If aParent is not NULL it receives the BFS parent
+** of every reached node (-1 for iStart). The search stops after
+** nMaxDepth levels (<0 for unlimited) or once iTarget (>=0) is reached.
+** eMode is a GRAPH_BFS_* direction policy.
+*/
+int graphCSRBFS(const CSRGraph *pCSR, int iStart, int iTarget,
+                int nMaxDepth, int eMode, int *aQueue, int *pnQueue,
+                int *aParent);
+
+/*
+** Whole-graph algorithms over one snapshot, for callers that hold it:
+** graphPageRank(), graphBetweennessCentrality(),
+** graphConnectedComponents(), graphLabelPropagation() and graphLouvain()
+** (graph.h) run them on the current snapshot, the result cache runs them
+** on the worker pool against a pinned one, and projections run them on
+** their own.
+*/
+int graphPageRankCSR(const CSRGraph *pCSR, double rDamping, int nMaxIter,
+                     double rEpsilon, int nThreads, char **pzResults);
+int graphBetweennessCentralityCSR(const CSRGraph *pCSR, int nThreads,
+                                  char **pzResults);
+int graphConnectedComponentsCSR(const CSRGraph *pCSR, char **pzComponents);
+int graphLabelPropagationCSR(const CSRGraph *pCSR, int nMaxIter,
+                             int nThreads, sqlite3_int64 **paNode,
+                             sqlite3_int64 **paCommunity, int *pnNode);
+int graphLouvainCSR(const CSRGraph *pCSR, double rResolution, int nThreads,
+                    sqlite3_int64 **paNode, sqlite3_int64 **paCommunity,
+                    int *pnNode);
+
+/*
+** How far a long run has got, for background jobs (graph-jobs.c): nDone
+** of nTotal units, sources for centrality and iterations for PageRank.
+** Setting bCancel stops the run after the current unit with
+** SQLITE_INTERRUPT. All three are accessed atomically.
+*/
+typedef struct CSRProgress CSRProgress;
+struct CSRProgress {
+  sqlite3_int64 nDone;         /* Units finished */
+  sqlite3_int64 nTotal;        /* Units in the run, set by the algorithm */
+  int bCancel;                 /* Set by another thread to stop the run */
+};
+
+/*
+** Per-node PageRank, betweenness (bBetweenness) or closeness scores in
+** dense index order, as *paScore from sqlite3_malloc(). pProgress may
+** be NULL. graphPageRankCSR() and graphBetweennessCentralityCSR() are
+** these formatted as JSON.
+*/
+int graphPageRankScores(const CSRGraph *pCSR, double rDamping, int nMaxIter,
+                        double rEpsilon, int nThreads, CSRProgress *pProgress,
+                        double **paScore);
+int graphCentralityScores(const CSRGraph *pCSR, int bBetweenness,
+                          int nThreads, CSRProgress *pProgress,
+                          double **paScore);
+
+/*
+** Personalized PageRank from the dense nodes aSeed (duplicates weigh
+** more) by forward push over out-edges, exploring only the neighbourhood
+** the mass reaches. rAlpha is the restart probability and rEpsilon the
+** residual per out-edge below which a node is not pushed; dead ends
+** restart at the seeds. Sets *paNodeId and *paScore to the nTopK (<=0
+** for all) best touched nodes, in descending score then ascending id,
+** and *pnResult to their count. Free both arrays with sqlite3_free().
+*/
+int graphPersonalizedPageRank(const CSRView *pView, const int *aSeed,
+                              int nSeed, double rAlpha, double rEpsilon,
+                              int nTopK, sqlite3_int64 **paNodeId,
+                              double **paScore, int *pnResult);
+
+/* Degree accessors over dense indices */
+#define graphCSROutDegree(P,I) ((int)((P)->rowOffsets[(I)+1]-(P)->rowOffsets[(I)]))
+#define graphCSRInDegree(P,I)  ((int)((P)->inOffsets[(I)+1]-(P)->inOffsets[(I)]))
+
+/*
+** Persisted snapshots (graph-csr-file.c), for graphs created with the
+** csr_file=<path> module argument.
+**
+** graphCSRFileInit() creates the <graph>_csr generation row and the
+** triggers that move it, also for result_cache=persist graphs, which tag
+** their saved results the same way; graphCSRFileDrop() removes them and
+** the file. graphCSRFileTag() reads the tag the data has now.
+** graphCSRFileLoad() maps the file if it matches the database, leaving
+** *ppCSR NULL otherwise. graphCSRFileSync() writes the current snapshot
+** of pVtab if it is committed and the file lags it far enough; errors
+** are not reported, since the file is only a cache. graphCSRFree()
+** calls graphCSRFileUnmap() for mapped snapshots.
+*/
+typedef struct CSRFileTag CSRFileTag;
+struct CSRFileTag {
+  sqlite3_int64 iInstance;     /* <graph>_csr.instance, random per graph */
+  sqlite3_int64 iGeneration;   /* <graph>_csr.generation */
+  sqlite3_int64 iSchemaVersion;/* PRAGMA schema_version */
+};
+
+int graphCSRFileInit(GraphVtab *pVtab);
+int graphCSRFileTag(GraphVtab *pVtab, CSRFileTag *pTag);
+int graphCSRFileDrop(GraphVtab *pVtab);
+int graphCSRFileLoad(GraphVtab *pVtab, CSRGraph **ppCSR);
+void graphCSRFileSync(GraphVtab *pVtab);
+void graphCSRFileUnmap(CSRGraph *pCSR);
+
+/*
+** Weakly connected components (graph-community.c), as a union-find
+** forest over the dense nodes of a view: aParent[i] is the root of node
+** i's component, which is its member with the smallest node id.
+**
+** graphComponents() pins the current version of pVtab's adjacency in
+** *pView and sets *ppComp to its components; release both with
+** graphCSRViewClose() and graphComponentsRelease(). With bIncremental
+** the result is also kept on pVtab, and the next incremental call
+** links only the nodes and edges the write overlay added since, as
+** long as the snapshot under it is the same and nothing was deleted.
+** graphCSRInvalidate() and overlay folds drop the kept result through
+** graphComponentsReset().
+** nThreads: Worker threads (1 = caller, 0 = whole pool); results do not
+**           depend on it
+*/
+struct GraphComponents {
+  int nRef;                    /* pVtab->pComponents and cursors */
+  const CSRGraph *pCSR;        /* Snapshot the forest was started on */
+  int nOp;                     /* Overlay writes linked in */
+  int nNode;                   /* Dense nodes covered */
+  int *aParent;                /* Dense node -> component root */
+};
+
+int graphComponents(GraphVtab *pVtab, int bIncremental, int nThreads,
+                    CSRView *pView, GraphComponents **ppComp);
+void graphComponentsRelease(GraphComponents *pComp);
+void graphComponentsReset(GraphVtab *pVtab);
+
+/*
+** Free the sorted neighbour sets kept on pVtab (graph-triangle.c), which
+** describe one snapshot. Called wherever the snapshot is replaced.
+*/
+void graphNbrSetsReset(GraphVtab *pVtab);
+
+/*
+** Free the k-hop reach counters kept on pVtab (graph-hll.c), which
+** belong to one snapshot. Called wherever the snapshot is replaced.
+*/
+void graphReachReset(GraphVtab *pVtab);
+
+/*
+** The hot-property columns (graph-columns.c) are indexed like one
+** snapshot. graphColumnsRemap() carries them over when compaction
+** replaces view pFrom with pTo, which holds the same nodes;
+** graphColumnsReset() drops their contents, to be rebuilt on next use.
+*/
+void graphColumnsRemap(GraphVtab *pVtab, const CSRView *pFrom,
+                       const CSRView *pTo);
+void graphColumnsReset(GraphVtab *pVtab);
+
+#endif /* GRAPH_CSR_H */
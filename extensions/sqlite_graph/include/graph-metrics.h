@@ -0,0 +1,112 @@
+/*
+** SQLite Graph Database Extension - Always-On Metrics
+**
+** Process-wide counters and query latency histograms, read through the
+** graph_metrics eponymous virtual table:
+**
+**   SELECT metric, label, value FROM graph_metrics;
+**   SELECT query, value, p50, p99 FROM graph_metrics
+**    WHERE metric='query_latency_us' ORDER BY sum DESC;
+**
+** Every thread that records a metric gets its own shard, so recording
+** is a plain load and store on memory no other thread writes; relaxed
+** atomics only keep readers from seeing torn values. Readers sum the
+** shards under a mutex. A thread's shard is folded into a retired shard
+** when the thread exits.
+**
+** Latency histograms are log-linear in the manner of HDR histograms:
+** each power of two of microseconds is split into GRAPH_HIST_SUB linear
+** buckets, so a recorded value is off by at most 1/GRAPH_HIST_SUB. They
+** are kept per query fingerprint, a hash of the normalized plan cache
+** key, so queries differing only in literals share a histogram.
+**
+** The recording half lives in graph-metrics.c and has no dependencies
+** beyond SQLite; the virtual table is in graph-metrics-vtab.c.
+**
+** Memory allocation: Shards and histograms use sqlite3_malloc()
+** Thread safety: Recording functions may be called from any thread
+*/
+#ifndef GRAPH_METRICS_H
+#define GRAPH_METRICS_H
+
+#include "graph.h"
+
+/* Counters. The *_PEAK metrics keep a maximum instead of a sum. */
+typedef enum GraphMetric {
+  GRAPH_METRIC_QUERIES = 0,      /* Cypher queries prepared */
+  GRAPH_METRIC_CSR_BUILDS,       /* CSR snapshots built */
+  GRAPH_METRIC_CSR_BUILD_US,     /* Microseconds spent building them */
+  GRAPH_METRIC_CSR_FILE_LOADS,   /* CSR snapshots mapped from csr_file= */
+  GRAPH_METRIC_CSR_FILE_SAVES,   /* CSR snapshots written to csr_file= */
+  GRAPH_METRIC_RESULT_HITS,      /* Algorithm results served current */
+  GRAPH_METRIC_RESULT_STALE_HITS,/* Served stale while recomputed */
+  GRAPH_METRIC_RESULT_MISSES,    /* Computed on the calling thread */
+  GRAPH_METRIC_RESULT_REFRESHES, /* Recomputed on the worker pool */
+  GRAPH_METRIC_BULK_LOADS,       /* Successful graph_bulk_load() files */
+  GRAPH_METRIC_BULK_ROWS,        /* Node and edge rows they loaded */
+  GRAPH_METRIC_BULK_BYTES,       /* CSV bytes they parsed */
+  GRAPH_METRIC_BULK_US,          /* Microseconds they took */
+  GRAPH_METRIC_ARENA_PEAK,       /* Largest statement arena, in bytes */
+  GRAPH_METRIC_COUNT
+} GraphMetric;
+
+/* Operator slots, indexed by PhysicalOperatorType */
+#define GRAPH_METRIC_OPERATORS 32
+
+/* Histogram shape: exact below GRAPH_HIST_SUB, then GRAPH_HIST_SUB
+** buckets per power of two up to 2^(GRAPH_HIST_MAX_LOG+1) microseconds
+** (38 hours); longer values land in the last bucket */
+#define GRAPH_HIST_SUB_LOG  3
+#define GRAPH_HIST_SUB      (1 << GRAPH_HIST_SUB_LOG)
+#define GRAPH_HIST_MAX_LOG  36
+#define GRAPH_HIST_BUCKETS  ((GRAPH_HIST_MAX_LOG - GRAPH_HIST_SUB_LOG + 2) * GRAPH_HIST_SUB)
+
+/* Fingerprints with a histogram of their own per thread; later ones
+** share the "(other)" histogram */
+#define GRAPH_METRIC_QUERY_SLOTS 64
+
+/* Add n to a counter, or raise a *_PEAK metric to n */
+void graphMetricAdd(GraphMetric eMetric, sqlite3_int64 n);
+void graphMetricPeak(GraphMetric eMetric, sqlite3_int64 n);
+
+/* Count one execution of an operator of type eType */
+void graphMetricOperator(int eType);
+
+/* Record a query latency under the fingerprint of its plan cache key */
+void graphMetricLatency(const char *zKey, sqlite3_int64 nMicro);
+
+/* Monotonic clock in microseconds */
+sqlite3_int64 graphMetricsClock(void);
+
+/* Histogram bucket of a value and the largest value a bucket holds */
+int graphHistBucket(sqlite3_int64 v);
+sqlite3_int64 graphHistBucketMax(int iBucket);
+
+/* A latency histogram as seen by a reader */
+typedef struct GraphMetricHist {
+  sqlite3_uint64 iFinger;        /* Fingerprint, 0 for "(other)" */
+  char *zKey;                    /* Plan cache key it was first seen with */
+  sqlite3_int64 nCount;          /* Values recorded */
+  sqlite3_int64 nSum;            /* Their sum */
+  sqlite3_int64 nMax;            /* Their maximum */
+  sqlite3_int64 aBucket[GRAPH_HIST_BUCKETS];
+} GraphMetricHist;
+
+/* All shards summed at one point in time */
+typedef struct GraphMetricsSnapshot {
+  sqlite3_int64 aCounter[GRAPH_METRIC_COUNT];
+  sqlite3_int64 aOperator[GRAPH_METRIC_OPERATORS];
+  int nHist;                     /* Entries in aHist */
+  GraphMetricHist *aHist;        /* One per fingerprint, "(other)" last */
+} GraphMetricsSnapshot;
+
+int graphMetricsSnapshot(GraphMetricsSnapshot *pSnap);
+void graphMetricsSnapshotFree(GraphMetricsSnapshot *pSnap);
+
+/* Upper bound of the bucket holding quantile q (0 < q <= 1) */
+sqlite3_int64 graphHistPercentile(const GraphMetricHist *pHist, double q);
+
+/* Register the graph_metrics eponymous virtual table */
+int graphRegisterMetrics(sqlite3 *db);
+
+#endif /* GRAPH_METRICS_H */
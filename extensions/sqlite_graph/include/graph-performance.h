@@ -9,9 +9,12 @@
 #ifndef GRAPH_PERFORMANCE_H
 #define GRAPH_PERFORMANCE_H
 
+#include <stddef.h>
 #include "graph.h"
 #include "cypher-planner.h"
 #include "graph-bulk.h"
+#include "graph-csr.h"
+#include "graph-bitmap.h"
 
 /*
 ** Query Performance Optimization
@@ -24,14 +27,36 @@ typedef struct SelectivityEstimate {
     int confidence;              /* 0-100 confidence level */
 } SelectivityEstimate;
 
-/* Join order optimizer */
+/* Query graph edge: a relationship pattern between join inputs iFrom
+** and iTo. Undirected patterns are GRAPH_EXPAND_BOTH, directed ones are
+** stored source first as GRAPH_EXPAND_OUT. */
+typedef struct JoinEdge {
+    int iFrom;                   /* Input holding the source node */
+    int iTo;                     /* Input holding the target node */
+    const char *zType;           /* Relationship type, NULL for any */
+    int eDirection;              /* GRAPH_EXPAND_OUT or GRAPH_EXPAND_BOTH */
+    const char *zRel;            /* Relationship variable, NULL if none */
+    int nMinHops;                /* Hop bounds, 1..1 for a single edge; */
+    int nMaxHops;                /* nMaxHops < 0 for unbounded */
+} JoinEdge;
+
+/* Join order optimizer. joins[] are node scans, one per pattern
+** variable, and aEdges the relationships between them. */
 typedef struct JoinOrderOptimizer {
     LogicalPlanNode **joins;     /* Array of join operations */
     int nJoins;                  /* Number of joins */
     double *costs;               /* Cost estimates for each order */
     int *bestOrder;              /* Optimal join order */
+    PlanContext *pContext;       /* Estimation context, may be NULL */
+    JoinEdge *aEdges;            /* Query graph edges between joins[] */
+    int nEdges;                  /* Number of edges */
+    LogicalPlanNode *pPlan;      /* OUT: joined plan over all joins[] */
 } JoinOrderOptimizer;
 
+/* Largest query graph enumerated exhaustively; bigger ones are joined
+** greedily */
+#define GRAPH_JOIN_DP_LIMIT 10
+
 /* Pattern matching optimizer */
 typedef struct PatternOptimizer {
     int eliminateCartesian;      /* Eliminate Cartesian products */
@@ -53,14 +78,6 @@ typedef struct CompositeIndex {
     sqlite3_int64 nEntries;      /* Number of entries */
 } CompositeIndex;
 
-/* Bitmap index for set operations */
-typedef struct BitmapIndex {
-    char *property;              /* Indexed property */
-    unsigned char *bitmap;       /* Bitmap data */
-    sqlite3_int64 nBits;         /* Number of bits */
-    sqlite3_int64 nNodes;        /* Number of nodes */
-} BitmapIndex;
-
 /* Index statistics for query planning */
 typedef struct IndexStatistics {
     char *indexName;             /* Index name */
@@ -71,27 +88,11 @@ typedef struct IndexStatistics {
 } IndexStatistics;
 
 /*
-** Memory Pool Optimization
+** Memory Pool Optimization: per-query memory is a GraphArena (see
+** graph-arena.h) and Cypher row buffers are recycled through their
+** ExecutionContext (executionContextRowAcquire())
 */
 
-/* Per-query memory pool */
-typedef struct QueryMemoryPool {
-    void *basePtr;               /* Base memory pointer */
-    size_t totalSize;            /* Total pool size */
-    size_t usedSize;             /* Currently used size */
-    void **allocations;          /* Array of allocations */
-    int nAllocations;            /* Number of allocations */
-    int recycleEnabled;          /* Enable memory recycling */
-} QueryMemoryPool;
-
-/* Tuple memory recycler */
-typedef struct TupleRecycler {
-    void **freeTuples;           /* Array of free tuples */
-    int nFree;                   /* Number of free tuples */
-    int tupleSize;               /* Size of each tuple */
-    int maxFree;                 /* Maximum free list size */
-} TupleRecycler;
-
 /*
 ** Parallel Query Execution
 */
@@ -102,38 +103,23 @@ typedef struct ParallelTask {
     void *arg;                   /* Task argument */
     int priority;                /* Task priority */
     struct ParallelTask *pNext;  /* Next task in queue */
+    struct ParallelBatch *pBatch;/* Completion group, or NULL */
 } ParallelTask;
 
-/* Work-stealing task scheduler */
+/* Work-stealing task scheduler. Workers and their deques belong to a
+** pool shared by all live schedulers. */
 typedef struct TaskScheduler {
-    ParallelTask **queues;       /* Per-thread task queues */
     int nThreads;                /* Number of worker threads */
     int stealingEnabled;         /* Enable work stealing */
-    sqlite3_mutex *mutex;        /* Synchronization mutex */
 } TaskScheduler;
 
 /*
 ** Storage Optimization
 */
 
-/* Cache-friendly node layout */
-typedef struct OptimizedNode {
-    sqlite3_int64 nodeId;        /* Node ID */
-    char *labels;                /* Packed label data */
-    void *properties;            /* Compressed properties */
-    sqlite3_int64 *outEdges;     /* Delta-encoded edge list */
-    int nOutEdges;               /* Number of outgoing edges */
-    int cacheLineAligned;        /* Alignment flag */
-} OptimizedNode;
-
-/* Compressed sparse row format for edges */
-typedef struct CSRGraph {
-    sqlite3_int64 *rowOffsets;   /* Row offset array */
-    sqlite3_int64 *columnIndices;/* Column indices array */
-    double *edgeWeights;         /* Edge weights array */
-    sqlite3_int64 nNodes;        /* Number of nodes */
-    sqlite3_int64 nEdges;        /* Number of edges */
-} CSRGraph;
+/* Columnar copies of hot node properties: see graph-columns.c */
+
+/* Compressed sparse row format for edges: see graph-csr.h */
 
 /*
 ** Benchmarking Infrastructure
@@ -165,16 +151,8 @@ int graphEliminateCartesianProduct(PhysicalPlanNode *plan);
 CompositeIndex* graphCreateCompositeIndex(GraphVtab *pGraph,
                                          const char **properties,
                                          int nProperties);
-BitmapIndex* graphCreateBitmapIndex(GraphVtab *pGraph,
-                                   const char *property);
-int graphIntersectBitmaps(BitmapIndex *idx1, BitmapIndex *idx2,
-                         unsigned char *result);
-
-/* Memory management */
-QueryMemoryPool* graphCreateMemoryPool(size_t initialSize);
-void* graphPoolAlloc(QueryMemoryPool *pool, size_t size);
-void graphPoolFree(QueryMemoryPool *pool, void *ptr);
-void graphDestroyMemoryPool(QueryMemoryPool *pool);
+int graphIntersectBitmaps(GraphBitmap **apBitmap, int nBitmap,
+                         GraphBitmap **ppResult);
 
 /* Parallel execution */
 TaskScheduler* graphCreateTaskScheduler(int nThreads);
@@ -182,25 +160,34 @@ int graphScheduleTask(TaskScheduler *scheduler, ParallelTask *task);
 int graphExecuteParallel(TaskScheduler *scheduler,
                         void (*taskFunc)(void*),
                         void **args, int nTasks);
+int graphRunTasks(TaskScheduler *scheduler, void (*taskFunc)(void*),
+                  void **args, int nTasks);
 void graphDestroyTaskScheduler(TaskScheduler *scheduler);
+int graphSchedulerStats(char **pzJson);
+void graphSchedulerQueueDepth(sqlite3_int64 *pnQueued, int *pnWorkers);
+int graphThreadPoolSetSize(int nThreads, int *pnThreads);
+void graphThreadPoolRetain(void);
+void graphThreadPoolRelease(void *pArg);
+int graphParallelNodeScan(GraphVtab *pGraph, const char *zLabel,
+                          int nThreads, sqlite3_int64 **paId, int *pnId);
 int graphParallelPatternMatch(GraphVtab *pGraph, CypherAst *pattern,
                              sqlite3_int64 **pResults, int *pnResults);
 
 /* Storage optimization */
 CSRGraph* graphConvertToCSR(GraphVtab *pGraph);
-char* graphCompressProperties(const char *zProperties);
 int graphDeltaEncodeEdges(sqlite3_int64 *edges, int nEdges);
 
-/* Compression system */
-int graphInitStringDictionary(int initialBuckets);
-char* graphDecompressProperties(const char *zCompressed);
-char* graphCompressLarge(const char *zData, size_t *pCompressedSize);
-char* graphDecompressLarge(const char *zCompressed, size_t compressedSize);
-void graphCompressionStats(sqlite3_int64 *pDictEntries,
-                          size_t *pDictMemory,
-                          size_t *pSavedBytes);
-void graphCompressionShutdown(void);
-int graphRegisterCompressionFunctions(sqlite3 *db);
+/*
+** Compression system (graph-compress.c). Graphs created with
+** properties=compressed store property values as BLOBs whose first byte
+** holds the codec in its low nibble; for GRAPH_PACK_ZSTD the high nibble
+** is the trained dictionary slot. The codes are ones JSONB reserves, so
+** packed values are never mistaken for JSONB.
+*/
+#define GRAPH_PACK_TEXT 0x0D     /* JSON text with string dictionary refs */
+#define GRAPH_PACK_ZSTD 0x0E     /* zstd frame against a trained dictionary */
+#define GRAPH_PACK_ZLIB 0x0F     /* varint length + zlib stream */
+int graphRegisterCompressionFunctions(sqlite3 *db, void **ppCodec);
 
 /* Bulk loading functions */
 int graphBulkLoadNodesCSV(GraphVtab *pGraph, const char *csvData,
@@ -216,15 +203,29 @@ void graphUpdateMetrics(PerfMetrics *metrics, const char *event);
 char* graphFormatMetrics(PerfMetrics *metrics);
 void graphEndMetrics(PerfMetrics *metrics);
 
-/* Plan cache operations */
+/* Plan cache operations. Keys are normalized queries (see
+** cypherNormalizeQuery()) prefixed by their scope, the graph table name,
+** and 0x1f. A lookup returns a copy of the cached plan the caller
+** destroys and the scope version to pass to the insert after a miss; an
+** insert takes ownership of pPlan. pFront is the calling connection's
+** front cache, or NULL. graphPlanCacheVersion() is a scope's current
+** version. */
+typedef struct GraphPlanFrontCache GraphPlanFrontCache;
 int graphInitPlanCache(int maxEntries, size_t maxMemory);
-PhysicalPlanNode* graphPlanCacheLookup(const char *zQuery);
-int graphPlanCacheInsert(const char *zQuery, PhysicalPlanNode *pPlan);
+PhysicalPlanNode* graphPlanCacheLookup(GraphPlanFrontCache *pFront, const char *zQuery,
+                                       sqlite3_uint64 *piVersion);
+int graphPlanCacheInsert(GraphPlanFrontCache *pFront, const char *zQuery,
+                         sqlite3_uint64 iVersion, PhysicalPlanNode *pPlan);
+void graphPlanCacheInvalidateScope(const char *zScope);
+sqlite3_uint64 graphPlanCacheVersion(const char *zScope);
 int graphPlanCacheInvalidate(const char *pattern);
 void graphPlanCacheStats(sqlite3_int64 *hits, sqlite3_int64 *misses,
                         int *nEntries, size_t *memoryUsed);
 void graphPlanCacheClear(void);
 void graphPlanCacheShutdown(void);
+GraphPlanFrontCache *graphPlanFrontCacheCreate(void);
+void graphPlanFrontCacheRef(GraphPlanFrontCache *pFront);
+void graphPlanFrontCacheUnref(void *pFront);
 int graphRegisterPlanCacheFunctions(sqlite3 *db);
 int graphRegisterBenchmarkFunctions(sqlite3 *db);
 
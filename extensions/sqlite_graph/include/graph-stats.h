@@ -0,0 +1,127 @@
+/*
+** SQLite Graph Database Extension - Persisted Graph Statistics
+**
+** graph_analyze() summarizes the backing tables into the %s_stats table:
+** node and edge counts, per-label and per-type counts, out/in degree
+** histograms and distinct-value estimates for indexed properties. The
+** summary is loaded into the owning GraphVtab so that xBestIndex and
+** the Cypher planner can cost plans without touching the data.
+**
+** Rows of %s_stats(kind, name, n, ndv, lo, hi):
+**   ('graph', 'nodes'|'edges', count)
+**   ('graph', 'sources'|'targets', distinct edge endpoints)
+**   ('label', <label>, nodes carrying it)
+**   ('type', <edge type>, edges of the type, distinct sources)
+**   ('out_degree'|'in_degree', <lo>, nodes with degree in [lo, hi])
+**   ('property', <name>, non-null values, distinct values, min, max)
+**   ('histogram', <name>:<bucket>, numeric values in [lo, hi])
+**
+** Numeric property histograms are equi-depth with up to 16 buckets.
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+** Staleness: Statistics are a snapshot; they change only when
+**            graph_analyze() runs again. The graphEstimate*() functions
+**            scale them to live node and edge counts instead.
+*/
+#ifndef GRAPH_STATS_H
+#define GRAPH_STATS_H
+
+#include "graph.h"
+
+/*
+** One bucket of a numeric property histogram.
+*/
+typedef struct GraphStatsBucket GraphStatsBucket;
+struct GraphStatsBucket {
+  double rLo;               /* Smallest value in the bucket */
+  double rHi;               /* Largest value in the bucket */
+  sqlite3_int64 n;          /* Values in the bucket */
+};
+
+/*
+** One named statistic: a label, an edge type or a property.
+*/
+typedef struct GraphStatsEntry GraphStatsEntry;
+struct GraphStatsEntry {
+  char *zName;              /* Label, type or property name */
+  sqlite3_int64 n;          /* Rows carrying it */
+  sqlite3_int64 nDistinct;  /* Distinct sources (types), values (props) */
+  int bNumeric;             /* Properties: rMin and rMax are valid */
+  double rMin;              /* Properties: smallest numeric value */
+  double rMax;              /* Properties: largest numeric value */
+  int nBucket;              /* Properties: entries in aBucket */
+  GraphStatsBucket *aBucket; /* Properties: histogram in value order */
+};
+
+/*
+** In-memory copy of %s_stats. Each entry array is sorted by name.
+*/
+struct GraphStats {
+  sqlite3_int64 nNodes;     /* Rows in the node table */
+  sqlite3_int64 nEdges;     /* Rows in the edge table */
+  sqlite3_int64 nSources;   /* Distinct edge sources */
+  sqlite3_int64 nTargets;   /* Distinct edge targets */
+  int nLabel;               /* Entries in aLabel */
+  int nType;                /* Entries in aType */
+  int nProp;                /* Entries in aProp */
+  GraphStatsEntry *aLabel;  /* Per-label node counts */
+  GraphStatsEntry *aType;   /* Per-type edge counts */
+  GraphStatsEntry *aProp;   /* Indexed property value counts */
+};
+
+/*
+** Recompute the statistics of pVtab into %s_stats inside a savepoint
+** and reload pVtab->pStats from the result.
+*/
+int graphAnalyze(GraphVtab *pVtab);
+
+/*
+** Replace pVtab->pStats with the contents of %s_stats. Leaves pStats
+** NULL and returns SQLITE_OK when the graph was never analyzed.
+*/
+int graphStatsLoad(GraphVtab *pVtab);
+
+/*
+** Drop %s_stats and free pVtab->pStats.
+*/
+int graphStatsDrop(GraphVtab *pVtab);
+
+/*
+** Free a statistics snapshot. Safe to call with NULL.
+*/
+void graphStatsFree(GraphStats *pStats);
+
+/*
+** Look up a label or edge type. Returns NULL when pStats is NULL or
+** the name was not seen by the last graph_analyze().
+*/
+const GraphStatsEntry *graphStatsLabel(const GraphStats *pStats,
+                                       const char *zLabel);
+const GraphStatsEntry *graphStatsType(const GraphStats *pStats,
+                                      const char *zType);
+const GraphStatsEntry *graphStatsProperty(const GraphStats *pStats,
+                                          const char *zProperty);
+
+/*
+** Cardinality estimates for the Cypher planner and graph-performance.c.
+** Analyzed fractions are scaled to the live node and edge counts, which
+** are cached on the GraphVtab and recounted only after iDataVersion
+** moves. Without statistics the label index and fixed guesses are used.
+**
+** graphEstimateNodes()     - nodes in the graph (at least 1)
+** graphEstimateLabel()     - nodes carrying zLabel
+** graphEstimateFanout()    - average zType edges leaving a node; all
+**                            types when zType is NULL
+** graphEstimatePathFanout() - paths of nMinHops..nMaxHops edges leaving
+**                            a node that has rFan edges per hop
+** graphEstimateProperty()  - fraction of all nodes whose zProperty
+**                            compares eCmp (GRAPH_CMP_*) to zValue
+*/
+double graphEstimateNodes(GraphVtab *pVtab);
+double graphEstimateLabel(GraphVtab *pVtab, const char *zLabel);
+double graphEstimateFanout(GraphVtab *pVtab, const char *zType);
+double graphEstimatePathFanout(double rFan, int nMinHops, int nMaxHops);
+double graphEstimateProperty(GraphVtab *pVtab, const char *zProperty,
+                             int eCmp, const char *zValue);
+
+#endif /* GRAPH_STATS_H */
@@ -59,6 +59,40 @@ struct GraphEdge {
 ** Forward declarations for schema structures
 */
 typedef struct CypherSchema CypherSchema;
+typedef struct CSRGraph CSRGraph;
+typedef struct CSRDelta CSRDelta;
+typedef struct CSRCompact CSRCompact;
+typedef struct GraphComponents GraphComponents;
+typedef struct GraphNbrSets GraphNbrSets;
+typedef struct GraphReachSketch GraphReachSketch;
+typedef struct GraphResultCache GraphResultCache;
+typedef struct GraphColumns GraphColumns;
+typedef struct GraphColumn GraphColumn;
+typedef struct GraphStats GraphStats;
+
+/*
+** Statements cached per virtual table for point lookups against the
+** backing tables. Each is prepared on first use with bound parameters
+** and reset between uses; see graphStmtAcquire().
+*/
+#define GRAPH_STMT_NEIGHBORS_OUT  0  /* ?1=source -> target, weight */
+#define GRAPH_STMT_NEIGHBORS_IN   1  /* ?1=target -> source, weight */
+#define GRAPH_STMT_NODE_BY_ID     2  /* ?1=id -> id, labels, properties */
+#define GRAPH_STMT_EDGE_BY_ENDS   3  /* ?1=source, ?2=target -> edge row */
+#define GRAPH_STMT_NEIGHBORS_OUT_TYPED 4 /* ?1=source, ?2=type -> target, weight */
+#define GRAPH_STMT_NEIGHBORS_IN_TYPED  5 /* ?1=target, ?2=type -> source, weight */
+#define GRAPH_STMT_DEGREE         6  /* ?1=node -> out, in over all types */
+#define GRAPH_STMT_DEGREE_TYPED   7  /* ?1=node, ?2=type -> out, in */
+#define GRAPH_STMT_COUNTS         8  /* -> nodes, edges */
+#define GRAPH_STMT_EDGE_BY_ID     9  /* ?1=id -> source, target, weight */
+#define GRAPH_STMT_EPOCH_GET     10  /* -> CSR write epoch (graph-csr.c) */
+#define GRAPH_STMT_EPOCH_SET     11  /* ?1=CSR write epoch */
+#define GRAPH_STMT_DATA_VERSION  12  /* -> PRAGMA data_version */
+#define GRAPH_STMT_CSR_TAG       13  /* -> instance, generation (csr_file=) */
+#define GRAPH_STMT_SCHEMA_VERSION 14 /* -> PRAGMA schema_version */
+#define GRAPH_STMT_RESULT_GET    15  /* ?1=key -> tag, result (graph-results.c) */
+#define GRAPH_STMT_RESULT_PUT    16  /* ?1=key, ?2..?4=tag, ?5=result */
+#define GRAPH_STMT_COUNT         17
 
 /*
 ** Enhanced graph virtual table structure with schema and indexing support.
@@ -77,10 +111,108 @@ struct GraphVtab {
   void *pLabelIndex;  /* Label-based node index */
   void *pPropertyIndex; /* Property-based index */
   CypherSchema *pSchema;  /* Schema information for labels/types */
+  sqlite3_int64 iDataVersion; /* Bumped on every write through the graph */
+  CSRGraph *pCSR;         /* Cached adjacency snapshot (graph-csr.h) */
+  sqlite3_int64 iCSRSerial; /* Bumped whenever pCSR is replaced */
+  CSRDelta *pCSRDelta;    /* Tracked writes since pCSR was built, or NULL */
+  CSRCompact *pCSRCompact;/* Background fold of pCSRDelta, or NULL */
+  int bCSRTrack;          /* Inside graphCSRTrackBegin()..End() */
+  int bCSREpoch;          /* TEMP epoch table exists (graph-csr.c) */
+  sqlite3_stmt *aStmt[GRAPH_STMT_COUNT]; /* Cached lookup statements */
+  int bLabelIndex;        /* %s_node_labels is maintained (graph-schema.c) */
+  GraphStats *pStats;     /* graph_analyze() snapshot (graph-stats.h) */
+  int bDegreeIndex;       /* %s_degree and %s_counts are maintained */
+  sqlite3_int64 nLiveNodes;   /* Node count cached by graphLiveCounts() */
+  sqlite3_int64 nLiveEdges;   /* Edge count cached by graphLiveCounts() */
+  sqlite3_int64 iLiveVersion; /* iDataVersion+1 of the counts, 0 = none */
+  unsigned int iLiveFileVersion; /* SQLITE_FCNTL_DATA_VERSION of the counts */
+  int nLiveChanges;       /* sqlite3_total_changes() of the counts */
+  int ePropFormat;        /* GRAPH_PROPS_* storage format (graph-schema.c) */
+  char *zPropsExpr;       /* graph_props() call for GRAPH_PROPS_PACKED */
+  char *zCSRFile;         /* csr_file= snapshot path (graph-csr-file.c) */
+  int bCSRFileTried;      /* graphCSRIsCurrent() looked for the file */
+  void *pCodec;           /* Connection's property dictionaries (module aux) */
+  GraphVtab *pNextGraph;  /* Next graph of the connection (graph-registry.c) */
+  GraphComponents *pComponents; /* Kept graph_components() result */
+  GraphNbrSets *pNbrSets; /* Sorted neighbour sets (graph-triangle.c) */
+  GraphReachSketch *pReach; /* k-hop reach counters (graph-hll.c) */
+  GraphResultCache *pResults; /* Memoized algorithm results (graph-results.c) */
+  int bResultPersist;     /* result_cache=persist: also in %s_results */
+  GraphColumns *pColumns; /* Hot-property columns (graph-columns.c) */
 };
 
-/* A global pointer to the graph virtual table. Not ideal, but simple. */
-extern GraphVtab *pGraph;
+/* Property storage formats, chosen by the properties= module argument */
+#define GRAPH_PROPS_JSON   0    /* JSON text */
+#define GRAPH_PROPS_JSONB  1    /* SQLite JSONB */
+#define GRAPH_PROPS_PACKED 2    /* dictionary/zstd packed (graph-compress.c) */
+
+/*
+** Graph registry (graph-registry.c). Connected graph tables are listed
+** per connection by graphRegistryAdd() and graphRegistryRemove(), which
+** xCreate/xConnect and xDisconnect/xDestroy call. graphRegistryFind()
+** returns graph zName of pDb, or with zName NULL the connection's
+** default graph: the one chosen with graph_use(), else the one
+** connected last. A graph table that no statement has touched yet is
+** connected on the way, and with zName NULL the first graph table in
+** the main schema is. Returns NULL if there is no such graph.
+**
+** graphRegistryConn() returns pDb's entry, which lives as long as the
+** connection, and graphConnFind() looks a graph up in it without
+** locking or connecting anything. graphRegisterRegistry() creates the
+** entry and registers graph_use().
+*/
+typedef struct GraphConn GraphConn;
+void graphRegistryAdd(GraphVtab *pVtab);
+void graphRegistryRemove(GraphVtab *pVtab);
+GraphVtab *graphRegistryFind(sqlite3 *pDb, const char *zName);
+GraphConn *graphRegistryConn(sqlite3 *pDb);
+GraphVtab *graphConnFind(GraphConn *pConn, const char *zName);
+int graphRegisterRegistry(sqlite3 *pDb);
+
+/*
+** Named graph projections (graph-project.c): immutable CSR snapshots of
+** a label- and type-filtered subgraph, built by graph_project() and
+** listed on the connection's registry entry until graph_project_drop()
+** or the connection closes. graph_use(name) with a projection's name
+** makes it the input of the whole-graph algorithms, leaving the default
+** graph table as it was.
+**
+** graphProjectionAdd() lists p on pConn, which takes ownership, and
+** graphProjectionRemove() unlists the projection zName and returns it.
+** graphConnProjection() looks zName up, or with zName NULL returns the
+** projection picked with graph_use(), if any. graphProjectionFree()
+** releases one projection; readers pin its snapshot with
+** graphProjectionView() (graph-csr.h) and are unaffected by the drop.
+*/
+typedef struct GraphProjection GraphProjection;
+struct GraphProjection {
+  char *zName;              /* Projection name */
+  char *zGraph;             /* Graph table it was taken from */
+  char *zLabels;            /* node_labels as given, or NULL for all */
+  char *zTypes;             /* rel_types as given, or NULL for all */
+  char *zWeight;            /* weight_property, or NULL for edge weights */
+  CSRGraph *pCSR;           /* Snapshot, referenced */
+  sqlite3_int64 nBytes;     /* graphCSRBytes() of pCSR */
+  GraphProjection *pNext;   /* Next projection of the connection */
+};
+void graphProjectionAdd(GraphConn *pConn, GraphProjection *p);
+GraphProjection *graphProjectionRemove(GraphConn *pConn, const char *zName);
+GraphProjection *graphConnProjection(GraphConn *pConn, const char *zName);
+GraphProjection *graphConnProjectionList(GraphConn *pConn);
+void graphProjectionFree(GraphProjection *p);
+int graphRegisterProjections(sqlite3 *pDb);
+
+/*
+** Background algorithm jobs (graph-jobs.c), started by graph_job_submit()
+** on the worker pool and listed on the connection's registry entry.
+** graphConnJobs() returns the head of pConn's job list.
+** graphJobListFree() cancels the jobs of a closing connection, waits for
+** them and frees them.
+*/
+typedef struct GraphJob GraphJob;
+GraphJob **graphConnJobs(GraphConn *pConn);
+void graphJobListFree(GraphJob *pList);
+int graphRegisterJobs(sqlite3 *pDb);
 
 /*
 ** Graph cursor structure for virtual table iteration.
@@ -115,6 +247,34 @@ struct GraphDepthInfo {
   GraphDepthInfo *pNext;    /* Next in linked list */
 };
 
+/*
+** Record that the graph data changed. Cached derived state such as the
+** CSR adjacency snapshot is rebuilt on next use. NULL is a no-op.
+*/
+void graphBumpDataVersion(GraphVtab *pVtab);
+
+/*
+** Obtain the cached statement eStmt (a GRAPH_STMT_* value) for pVtab,
+** preparing it on first use. The statement is returned reset with its
+** bindings cleared. If the cached copy is already being stepped by an
+** outer caller, a private statement is prepared instead so nested
+** lookups stay safe. Every successful acquire must be paired with
+** graphStmtRelease().
+*/
+int graphStmtAcquire(GraphVtab *pVtab, int eStmt, sqlite3_stmt **ppStmt);
+
+/*
+** Return a statement obtained from graphStmtAcquire(). The cached copy
+** is reset for reuse; a private copy is finalized. NULL is a no-op.
+*/
+void graphStmtRelease(GraphVtab *pVtab, sqlite3_stmt *pStmt);
+
+/*
+** Finalize every cached statement of pVtab. Must be called before the
+** backing tables are dropped and before pVtab is freed.
+*/
+void graphStmtCacheClear(GraphVtab *pVtab);
+
 /*
 ** Core storage function declarations.
 ** All functions return SQLite error codes and follow SQLite patterns.
@@ -183,7 +343,7 @@ int graphGetEdge(GraphVtab *pVtab, sqlite3_int64 iFromId,
 
 /*
 ** Utility functions for graph properties.
-** These provide O(1) access to cached counts.
+** These provide O(1) access to cached counts (see graphLiveCounts()).
 */
 int graphCountNodes(GraphVtab *pVtab);
 int graphCountEdges(GraphVtab *pVtab);
@@ -215,14 +375,43 @@ GraphEdge *graphFindEdge(GraphVtab *pVtab, sqlite3_int64 iFromId,
 int graphDFS(GraphVtab *pVtab, sqlite3_int64 iStartId, int nMaxDepth,
              char **pzPath);
 
+/*
+** BFS expansion direction. GRAPH_BFS_AUTO switches between top-down
+** (frontier scans out-edges) and bottom-up (unvisited nodes scan
+** in-edges for a frontier parent) per level, based on edge counts.
+*/
+#define GRAPH_BFS_AUTO       0
+#define GRAPH_BFS_TOP_DOWN   1
+#define GRAPH_BFS_BOTTOM_UP  2
+
 /*
 ** Breadth-first search with level-order traversal.
 ** Returns SQLITE_OK and sets *pzPath to JSON array of node IDs.
 ** Caller must sqlite3_free() the returned path string.
 ** nMaxDepth: Maximum depth to search (-1 for unlimited)
+** eMode: GRAPH_BFS_* direction policy. Levels are always emitted in
+**        order; within a bottom-up level nodes appear by ascending id.
 */
 int graphBFS(GraphVtab *pVtab, sqlite3_int64 iStartId, int nMaxDepth,
-             char **pzPath);
+             int eMode, char **pzPath);
+
+/*
+** Edge directions for graphExpand().
+*/
+#define GRAPH_EXPAND_OUT   1
+#define GRAPH_EXPAND_IN    2
+#define GRAPH_EXPAND_BOTH  3
+
+/*
+** One-hop expansion of iNodeId along edges of type zType (any type when
+** NULL) in direction eDir. Each lookup is a probe of the covering edge
+** index for that direction, so the cost is O(degree), not O(E).
+** Sets *paId to the neighbor ids in index order (a node reached over
+** several edges appears once per edge) and *pnId to their count. *paId
+** is NULL when there are none; otherwise free it with sqlite3_free().
+*/
+int graphExpand(GraphVtab *pVtab, sqlite3_int64 iNodeId, const char *zType,
+                int eDir, sqlite3_int64 **paId, int *pnId);
 
 /*
 ** Graph algorithms.
@@ -233,17 +422,33 @@ int graphBFS(GraphVtab *pVtab, sqlite3_int64 iStartId, int nMaxDepth,
 ** Dijkstra's shortest path algorithm.
 ** Returns SQLITE_OK and sets *pzPath to JSON array of node IDs.
 ** If prDistance is not NULL, sets it to the total path distance.
-** iEndId: Target node (-1 for distances to all nodes)
+** iEndId: Target node (-1 for distances to all nodes). Point-to-point
+**         searches run bidirectionally.
 */
 int graphDijkstra(GraphVtab *pVtab, sqlite3_int64 iStartId, 
                   sqlite3_int64 iEndId, char **pzPath, double *prDistance);
 
+/*
+** A* shortest path from iStartId to iEndId. The heuristic is the
+** straight-line distance between node coordinates read from the
+** zXProperty and zYProperty node properties; it only finds shortest
+** paths when no edge weighs less than that distance.
+** Returns SQLITE_OK and sets *pzPath to JSON array of node IDs.
+** If prDistance is not NULL, sets it to the total path distance.
+*/
+int graphAStar(GraphVtab *pVtab, sqlite3_int64 iStartId, sqlite3_int64 iEndId,
+               const char *zXProperty, const char *zYProperty,
+               char **pzPath, double *prDistance);
+
 /*
 ** Shortest path for unweighted graphs using BFS.
 ** More efficient than Dijkstra for unweighted graphs.
+** eMode: GRAPH_BFS_* direction policy; GRAPH_BFS_AUTO searches from
+**        both ends when iEndId>=0
 */
 int graphShortestPathUnweighted(GraphVtab *pVtab, sqlite3_int64 iStartId,
-                                sqlite3_int64 iEndId, char **pzPath);
+                                sqlite3_int64 iEndId, int eMode,
+                                char **pzPath);
 
 /*
 ** PageRank algorithm implementation.
@@ -251,13 +456,23 @@ int graphShortestPathUnweighted(GraphVtab *pVtab, sqlite3_int64 iStartId,
 ** rDamping: Damping factor (typically 0.85)
 ** nMaxIter: Maximum iterations
 ** rEpsilon: Convergence threshold
+** nThreads: Worker threads (1 runs on the caller, 0 uses the whole pool)
 */
 int graphPageRank(GraphVtab *pVtab, double rDamping, int nMaxIter, 
-                  double rEpsilon, char **pzResults);
+                  double rEpsilon, int nThreads, char **pzResults);
 
 /*
-** Degree calculations.
+** Degree calculations. graphNodeDegree() counts the edges leaving
+** (GRAPH_DEGREE_OUT), entering (GRAPH_DEGREE_IN) or touching
+** (GRAPH_DEGREE_BOTH) a node, only those of type zType unless it is
+** NULL. A current CSR snapshot answers untyped lookups; otherwise they
+** read the %s_degree table, and only without one build the snapshot.
 */
+#define GRAPH_DEGREE_OUT  1
+#define GRAPH_DEGREE_IN   2
+#define GRAPH_DEGREE_BOTH 3
+sqlite3_int64 graphNodeDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                              const char *zType, int eDir);
 int graphInDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId);
 int graphOutDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId);
 int graphTotalDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId);
@@ -278,15 +493,19 @@ double graphDensity(GraphVtab *pVtab, int bDirected);
 ** Betweenness centrality using Brandes' algorithm.
 ** Returns SQLITE_OK and sets *pzResults to JSON object with scores.
 ** Algorithm complexity: O(V*E) for unweighted graphs.
+** nThreads: Worker threads sharing the sources (1 = caller, 0 = whole pool)
 */
-int graphBetweennessCentrality(GraphVtab *pVtab, char **pzResults);
+int graphBetweennessCentrality(GraphVtab *pVtab, int nThreads,
+                               char **pzResults);
 
 /*
 ** Closeness centrality calculation.
 ** Returns SQLITE_OK and sets *pzResults to JSON object with scores.
 ** Closeness = (n-1) / sum of shortest path distances.
+** nThreads: Worker threads sharing the sources (1 = caller, 0 = whole pool)
 */
-int graphClosenessCentrality(GraphVtab *pVtab, char **pzResults);
+int graphClosenessCentrality(GraphVtab *pVtab, int nThreads,
+                             char **pzResults);
 
 /*
 ** Topological sort using Kahn's algorithm.
@@ -308,6 +527,171 @@ int graphHasCycle(GraphVtab *pVtab);
 */
 int graphConnectedComponents(GraphVtab *pVtab, char **pzComponents);
 
+/*
+** Community detection on the undirected view of the graph
+** (graph-community.c). Each returns one entry per node in *paNode and
+** *paCommunity (*pnNode entries, node ids ascending); a community is
+** named by its smallest member id. Free both arrays with sqlite3_free().
+** nThreads: Worker threads (1 = caller, 0 = whole pool); results do not
+**           depend on it
+*/
+int graphLabelPropagation(GraphVtab *pVtab, int nMaxIter, int nThreads,
+                          sqlite3_int64 **paNode,
+                          sqlite3_int64 **paCommunity, int *pnNode);
+int graphLouvain(GraphVtab *pVtab, double rResolution, int nThreads,
+                 sqlite3_int64 **paNode, sqlite3_int64 **paCommunity,
+                 int *pnNode);
+
+/*
+** Triangles and neighbour similarity on the undirected simple view of
+** the graph (graph-triangle.c): edge direction, duplicate edges and
+** self-loops are ignored.
+**
+** graphTriangleCount() counts the triangles of the graph.
+** graphClustering() returns, per node in ascending id order, its
+** distinct neighbour count and the triangles through it; free the three
+** arrays with sqlite3_free(). The local clustering coefficient is
+** 2*triangles/(degree*(degree-1)).
+** graphNeighborScore() scores the node pair (iA, iB) for link
+** prediction with a GRAPH_SCORE_* measure. Returns SQLITE_NOTFOUND if
+** either node does not exist.
+** nThreads: Worker threads (1 = caller, 0 = whole pool); results do not
+**           depend on it. graphNeighborScore() uses the whole pool for
+**           the one-off build of the neighbour sets.
+*/
+#define GRAPH_SCORE_COMMON       0  /* Number of common neighbours */
+#define GRAPH_SCORE_JACCARD      1  /* Common / union of neighbours */
+#define GRAPH_SCORE_ADAMIC_ADAR  2  /* Sum of 1/log(degree) over common */
+
+int graphTriangleCount(GraphVtab *pVtab, int nThreads,
+                       sqlite3_int64 *pnTriangle);
+int graphClustering(GraphVtab *pVtab, int nThreads, sqlite3_int64 **paNode,
+                    int **paDegree, sqlite3_int64 **paTriangle, int *pnNode);
+int graphNeighborScore(GraphVtab *pVtab, int eScore, sqlite3_int64 iA,
+                       sqlite3_int64 iB, double *prScore);
+
+/*
+** Approximate k-hop reach (graph-hll.c): the number of other nodes
+** reachable from a node in at most nHops out-edges, from HyperLogLog
+** counters of 2^nLog2m registers per node propagated over the snapshot.
+**
+** graphReachEstimate() returns the estimate for node iNode, or
+** SQLITE_NOTFOUND if it does not exist. graphReachAll() returns the
+** estimate of every node, in ascending id order; free both arrays with
+** sqlite3_free(). graphReachError() is the relative standard error of
+** an estimate at precision nLog2m.
+** nThreads: Worker threads (1 = caller, 0 = whole pool) for rounds not
+**           yet run; results do not depend on it. graphReachEstimate()
+**           uses the whole pool.
+*/
+#define GRAPH_REACH_MIN_PRECISION      4
+#define GRAPH_REACH_MAX_PRECISION     12
+#define GRAPH_REACH_DEFAULT_PRECISION  6
+#define GRAPH_REACH_MAX_HOPS          64
+
+int graphReachEstimate(GraphVtab *pVtab, sqlite3_int64 iNode, int nHops,
+                       int nLog2m, double *prReach);
+int graphReachAll(GraphVtab *pVtab, int nHops, int nLog2m, int nThreads,
+                  sqlite3_int64 **paNode, double **paReach, int *pnNode);
+double graphReachError(int nLog2m);
+
+/*
+** Result cache (graph-results.c). graphResultGet() returns in *pzJson
+** the result graphPageRank(), graphBetweennessCentrality() or
+** graphConnectedComponents() would, as described by *pArgs, from a copy
+** kept on pVtab while the graph is unchanged and computing it otherwise.
+** Entries are keyed by algorithm and arguments (not nThreads, which only
+** changes the speed) and tagged with the snapshot they were computed on,
+** so any write to the graph, tracked or not, retires them. They are
+** evicted least recently used first once they take more than the budget.
+**
+** In GRAPH_RESULT_STALE mode a retired entry is still returned, and a
+** recomputation against the current snapshot is started on the worker
+** pool; a later call picks its result up. With result_cache=persist,
+** results are also kept in the %s_results table under the <graph>_csr
+** generation (graph-csr-file.c), so other connections and processes can
+** use them until the graph changes.
+**
+** graphResultCacheConfig() sets the budget in bytes (0 disables the cache
+** and drops its entries, <0 keeps it) and the mode (<0 keeps it) and
+** returns a JSON description of the cache. graphResultCacheInit() and
+** graphResultCacheDrop() create and drop %s_results for persisted graphs.
+** graphResultCacheFree() waits for recomputations and frees everything.
+*/
+#define GRAPH_RESULT_PAGERANK     0
+#define GRAPH_RESULT_BETWEENNESS  1
+#define GRAPH_RESULT_COMPONENTS   2
+
+#define GRAPH_RESULT_FRESH        0  /* Recompute once the graph changes */
+#define GRAPH_RESULT_STALE        1  /* Stale-while-revalidate */
+
+#define GRAPH_RESULT_DEFAULT_BUDGET (8*1024*1024)
+
+typedef struct GraphResultArgs GraphResultArgs;
+struct GraphResultArgs {
+  int eAlgo;                  /* GRAPH_RESULT_* algorithm */
+  double rDamping;            /* PageRank arguments */
+  int nMaxIter;
+  double rEpsilon;
+};
+
+int graphResultGet(GraphVtab *pVtab, const GraphResultArgs *pArgs,
+                   int nThreads, char **pzJson);
+int graphResultCacheConfig(GraphVtab *pVtab, sqlite3_int64 nBudget,
+                           int eMode, char **pzJson);
+int graphResultCacheInit(GraphVtab *pVtab);
+int graphResultCacheDrop(GraphVtab *pVtab);
+void graphResultCacheFree(GraphVtab *pVtab);
+
+/*
+** Hot-property columns (graph-columns.c). graph_create_column(label,
+** property) declares a typed copy of a node property, kept in arrays
+** indexed by the dense node index of the CSR snapshot, for the nodes
+** with label (all nodes for a NULL label). Declarations are rows of
+** %s_columns. A column is built on first use and kept current by the
+** tracked write path; other writes make it be rebuilt.
+**
+** graphColumnCreate() declares and builds a column; SQLITE_MISUSE for a
+** bad property name. graphColumnDrop() forgets one and sets *pbDropped.
+** graphColumnList() reads the declarations into *pazColumn, label and
+** property of each column in turn (label NULL for all nodes), and frees
+** nothing it did not allocate: free each string and the array.
+** graphColumnsDescribe() returns them as JSON.
+**
+** graphColumnGet() sets *ppCol to the column of (zLabel, zProperty) if
+** one is declared, usable (not of mixed types) and current, building it
+** first if bBuild. graphColumnMatch() returns in *paId, ascending, the
+** nodes [with zLabel] whose property compares eCmp (GRAPH_CMP_*) to the
+** Cypher literal zValue of type eType as json_extract() would (see
+** graphParseLiteral()), or SQLITE_NOTFOUND if
+** no column can answer. graphColumnRead() reads one node's value: the
+** SQLITE_* type with *piVal, *prVal or *pzVal and *pnVal set, or 0 if the
+** column does not cover the node.
+**
+** graphColumnsTouch() notes that a tracked write changed node iNodeId
+** (bDelete: deleted it); graphColumnsSync() rereads the noted nodes
+** once the write has succeeded. graphColumnsFree() releases the columns
+** and their statements; graphColumnsDropTable() drops %s_columns.
+*/
+int graphColumnCreate(GraphVtab *pVtab, const char *zLabel,
+                      const char *zProperty);
+int graphColumnDrop(GraphVtab *pVtab, const char *zLabel,
+                    const char *zProperty, int *pbDropped);
+int graphColumnList(GraphVtab *pVtab, char ***pazColumn, int *pnColumn);
+int graphColumnsDescribe(GraphVtab *pVtab, char **pzJson);
+int graphColumnGet(GraphVtab *pVtab, const char *zLabel,
+                   const char *zProperty, int bBuild, GraphColumn **ppCol);
+int graphColumnMatch(GraphVtab *pVtab, const char *zLabel,
+                     const char *zProperty, int eCmp, const char *zValue,
+                     int eType, sqlite3_int64 **paId, int *pnId);
+int graphColumnRead(GraphVtab *pVtab, GraphColumn *pCol,
+                    sqlite3_int64 iNodeId, sqlite3_int64 *piVal,
+                    double *prVal, const char **pzVal, int *pnVal);
+void graphColumnsTouch(GraphVtab *pVtab, sqlite3_int64 iNodeId, int bDelete);
+void graphColumnsSync(GraphVtab *pVtab);
+int graphColumnsDropTable(GraphVtab *pVtab);
+void graphColumnsFree(GraphVtab *pVtab);
+
 /*
 ** Find strongly connected components using Tarjan's algorithm.
 ** Returns SQLITE_OK and sets *pzSCC to JSON array of components.
@@ -338,6 +722,149 @@ int graphAddEdgeWithType(GraphVtab *pVtab, sqlite3_int64 iFromId,
                          sqlite3_int64 iToId, const char *zType,
                          double rWeight, const char *zProperties);
 
+/*
+** Label index (graph-schema.c). graphLabelIndexInit() creates the
+** %s_labels dictionary and %s_node_labels shadow table with the
+** triggers that maintain them; it runs on CREATE and CONNECT.
+*/
+int graphLabelIndexInit(GraphVtab *pVtab);
+int graphLabelIndexDrop(GraphVtab *pVtab);
+
+/*
+** Edge adjacency indexes (graph-schema.c). graphEdgeIndexInit() creates
+** the covering indexes %s_edges_out(source, edge_type, target, weight)
+** and %s_edges_in(target, edge_type, source, weight) on the backing edge
+** table; it runs on CREATE and CONNECT. They go away with the table.
+*/
+int graphEdgeIndexInit(GraphVtab *pVtab);
+
+/*
+** Degree index (graph-schema.c). graphDegreeIndexInit() creates
+** %s_degree(node_id, edge_type, out_degree, in_degree), one row per node
+** and edge type it has edges of, and the one-row %s_counts(nodes, edges),
+** with the triggers that maintain both in the writing transaction; it
+** runs on CREATE and CONNECT and backfills an existing graph. Untyped
+** edges are counted under the type ''. graphDegreeIndexRebuild()
+** recounts them from the backing tables: the node count, or with bEdges
+** the degrees and the edge count. graphDegreeIndexDrop() drops both
+** tables on DROP TABLE.
+**
+** graphLiveCounts() returns the node and edge counts, cached on pVtab
+** until the graph or its database changes. Outside a transaction the
+** cache is reused; inside one, or without the degree index, the counts
+** are read again (from %s_counts, or with count(*)).
+*/
+int graphDegreeIndexInit(GraphVtab *pVtab);
+int graphDegreeIndexRebuild(GraphVtab *pVtab, int bEdges);
+int graphDegreeIndexDrop(GraphVtab *pVtab);
+int graphLiveCounts(GraphVtab *pVtab, sqlite3_int64 *pnNodes,
+                    sqlite3_int64 *pnEdges);
+
+/*
+** Binary property storage (graph-schema.c). A graph created with the
+** properties=jsonb module argument keeps node and edge properties as
+** SQLite JSONB blobs, which json_extract() and the property indexes read
+** without parsing text; properties=compressed keeps them packed against
+** the graph's string and zstd dictionaries (graph-compress.c).
+** graphPropertyFormatInit() installs the triggers that encode properties
+** written as JSON text, and with bConvert also encodes the rows already
+** stored. graphPropsColumn() is the expression that selects properties
+** as JSON text for any format; graphPropsExpr() is the one to hand to
+** json_extract() and friends, which read JSONB directly.
+*/
+int graphPropertyFormatInit(GraphVtab *pVtab, int bConvert);
+const char *graphPropsColumn(GraphVtab *pVtab);
+const char *graphPropsExpr(GraphVtab *pVtab);
+
+/*
+** Drop the connection's in-memory dictionaries for zGraph and finalize
+** their statements (graph-compress.c); they are reloaded on next use.
+** Called on disconnect so sqlite3_close() finds no open statements.
+*/
+void graphCompressRelease(void *pCodec, const char *zGraph);
+
+/*
+** Deferred index maintenance for bulk loads (graph-schema.c).
+** graphIndexesSuspend() drops the edge indexes of pVtab (bEdges), or its
+** label triggers and label and property indexes, keeping their
+** definitions; uniqueness constraint indexes stay. Degree and count
+** triggers are suspended with their table. graphIndexesResume()
+** backfills the label index for node ids in [iMinId, iMaxId], recounts
+** what the suspended degree triggers missed, recreates everything and
+** frees the set. Run both in one transaction; graphIndexesDiscard()
+** frees the set after that transaction rolls back.
+*/
+typedef struct GraphIndexSet GraphIndexSet;
+int graphIndexesSuspend(GraphVtab *pVtab, int bEdges, GraphIndexSet **ppSet);
+int graphIndexesResume(GraphVtab *pVtab, GraphIndexSet *pSet,
+                       sqlite3_int64 iMinId, sqlite3_int64 iMaxId);
+void graphIndexesDiscard(GraphIndexSet *pSet);
+int graphCreateLabelIndex(GraphVtab *pVtab, const char *zLabel);
+int graphDiscoverSchema(GraphVtab *pVtab);
+
+/*
+** SQL expression true when the node id in column zIdColumn has zLabel.
+** Caller must sqlite3_free() the result.
+*/
+char *graphLabelMatchSql(GraphVtab *pVtab, const char *zIdColumn,
+                         const char *zLabel);
+
+/*
+** True if z is a property name that may be spliced into a JSON path or
+** index name: identifier characters only.
+*/
+int graphIsPropertyName(const char *z);
+
+/*
+** Prepare "ids of nodes with label ?1, ascending" against the index.
+*/
+int graphLabelScanPrepare(GraphVtab *pVtab, sqlite3_stmt **ppStmt);
+int graphLabelCount(GraphVtab *pVtab, const char *zLabel,
+                    sqlite3_int64 *pnCount);
+
+/*
+** Property indexes (graph-schema.c). Each is an expression index named
+** %s_prop_<property> on json_extract(properties, '$.<property>') of the
+** node table, so SQLite maintains it on every write.
+*/
+#define GRAPH_CMP_EQ  0
+#define GRAPH_CMP_LT  1
+#define GRAPH_CMP_LE  2
+#define GRAPH_CMP_GT  3
+#define GRAPH_CMP_GE  4
+
+int graphCreatePropertyIndex(GraphVtab *pVtab, const char *zLabel,
+                             const char *zProperty);
+int graphPropertyIndexList(GraphVtab *pVtab, char ***pazProperty,
+                           int *pnProperty);
+
+/*
+** Prepare "ids of nodes [with zLabel] whose zProperty compares eCmp
+** (GRAPH_CMP_*) to ?1, ascending". zLabel may be NULL.
+*/
+int graphPropertyScanPrepare(GraphVtab *pVtab, const char *zLabel,
+                             const char *zProperty, int eCmp,
+                             sqlite3_stmt **ppStmt);
+void graphBindLiteral(sqlite3_stmt *pStmt, int iParam, const char *zValue,
+                      int eType);
+int graphParseLiteral(const char *zValue, int eType, sqlite3_int64 *piVal,
+                      double *prVal);
+
+/*
+** Uniqueness constraints on (label, property) (graph-schema.c), backed
+** by a partial unique expression index %s_uniq_<label>_<property> and
+** listed in %s_constraints. Creating one fails with SQLITE_CONSTRAINT
+** if existing nodes already repeat a key.
+*/
+int graphCreateUniqueConstraint(GraphVtab *pVtab, const char *zLabel,
+                                const char *zProperty);
+int graphUniqueConstraintExists(GraphVtab *pVtab, const char *zLabel,
+                                const char *zProperty);
+int graphUniqueProbePrepare(GraphVtab *pVtab, const char *zLabel,
+                            const char *zProperty, sqlite3_stmt **ppStmt);
+char *graphUniqueUpsertSql(GraphVtab *pVtab, const char *zLabel,
+                           const char *zProperty);
+
 /*
 ** Find nodes by label using index.
 ** Returns linked list of nodes with specified label.
@@ -350,11 +877,4 @@ GraphNode *graphFindNodesByLabel(GraphVtab *pVtab, const char *zLabel);
 */
 GraphEdge *graphFindEdgesByType(GraphVtab *pVtab, const char *zType);
 
-/*
-** Thread-safe global graph access functions.
-** Used to manage the global graph variable in a thread-safe manner.
-*/
-void setGlobalGraph(GraphVtab *pNewGraph);
-GraphVtab *getGlobalGraph(void);
-
 #endif /* GRAPH_H */
\ No newline at end of file
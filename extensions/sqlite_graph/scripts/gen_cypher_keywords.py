@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""
+Generate src/cypher/cypher-keywords.h, the perfect hash the Cypher lexer
+uses to recognise keywords.
+
+An identifier is hashed on its length and its first and last characters,
+upper-cased by clearing bit 0x20 (identifiers are ASCII letters, digits
+and '_', none of which that maps onto a different letter). The script
+searches for multipliers that give every keyword its own slot in a
+power-of-two table, so a lookup is one hash, one length check and one
+memcmp() against the upper-cased identifier.
+
+Usage: gen_cypher_keywords.py > src/cypher/cypher-keywords.h
+"""
+
+import sys
+
+# Keyword -> token type. Keep in sync with CypherTokenType in cypher.h.
+KEYWORDS = {
+    'AS': 'CYPHER_TOK_AS',
+    'BY': 'CYPHER_TOK_BY',
+    'IS': 'CYPHER_TOK_IS_NULL',
+    'IN': 'CYPHER_TOK_IN',
+    'OR': 'CYPHER_TOK_OR',
+    'AND': 'CYPHER_TOK_AND',
+    'ASC': 'CYPHER_TOK_ASC',
+    'NOT': 'CYPHER_TOK_NOT',
+    'SET': 'CYPHER_TOK_SET',
+    'XOR': 'CYPHER_TOK_XOR',
+    'DESC': 'CYPHER_TOK_DESC',
+    'SKIP': 'CYPHER_TOK_SKIP',
+    'WITH': 'CYPHER_TOK_WITH',
+    'NULL': 'CYPHER_TOK_NULL',
+    'TRUE': 'CYPHER_TOK_BOOLEAN',
+    'MATCH': 'CYPHER_TOK_MATCH',
+    'LIMIT': 'CYPHER_TOK_LIMIT',
+    'MERGE': 'CYPHER_TOK_MERGE',
+    'ORDER': 'CYPHER_TOK_ORDER',
+    'UNION': 'CYPHER_TOK_UNION',
+    'WHERE': 'CYPHER_TOK_WHERE',
+    'FALSE': 'CYPHER_TOK_BOOLEAN',
+    'CREATE': 'CYPHER_TOK_CREATE',
+    'DELETE': 'CYPHER_TOK_DELETE',
+    'DETACH': 'CYPHER_TOK_DETACH',
+    'REMOVE': 'CYPHER_TOK_REMOVE',
+    'RETURN': 'CYPHER_TOK_RETURN',
+    'DISTINCT': 'CYPHER_TOK_DISTINCT',
+    'OPTIONAL': 'CYPHER_TOK_OPTIONAL',
+    'CONTAINS': 'CYPHER_TOK_CONTAINS',
+}
+
+
+def slot(word, a, b, mask):
+    return (ord(word[0]) * a + ord(word[-1]) * b + len(word)) & mask
+
+
+def search():
+    """Smallest table, then smallest multipliers, without collisions."""
+    size = 32
+    while size <= 1024:
+        for a in range(1, 64):
+            for b in range(1, 64):
+                slots = {slot(w, a, b, size - 1) for w in KEYWORDS}
+                if len(slots) == len(KEYWORDS):
+                    return size, a, b
+        size *= 2
+    sys.exit('no perfect hash found')
+
+
+def main():
+    size, a, b = search()
+    table = [None] * size
+    for word in KEYWORDS:
+        table[slot(word, a, b, size - 1)] = word
+    width = max(len(w) for w in KEYWORDS)
+
+    out = sys.stdout
+    out.write('/*\n'
+              '** cypher-keywords.h - Perfect hash of the Cypher keywords\n'
+              '**\n'
+              '** Generated by scripts/gen_cypher_keywords.py; do not edit.\n'
+              '** Included by cypher-lexer.c only.\n'
+              '*/\n')
+    out.write('#define CYPHER_KW_MIN_LEN %d\n' % min(len(w) for w in KEYWORDS))
+    out.write('#define CYPHER_KW_MAX_LEN %d\n' % width)
+    out.write('#define CYPHER_KW_HASH(c0, cN, n) '
+              '(((c0)*%d + (cN)*%d + (n)) & %d)\n\n' % (a, b, size - 1))
+    out.write('static const struct {\n'
+              '    char zName[%d];           /* Upper case */\n'
+              '    unsigned char nName;     /* 0 for an empty slot */\n'
+              '    unsigned char eToken;    /* CypherTokenType */\n'
+              '} aCypherKeyword[%d] = {\n' % (width + 1, size))
+    for i, word in enumerate(table):
+        if word is None:
+            out.write('    /* %2d */ { "", 0, 0 },\n' % i)
+        else:
+            out.write('    /* %2d */ { "%s", %d, %s },\n'
+                      % (i, word, len(word), KEYWORDS[word]))
+    out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
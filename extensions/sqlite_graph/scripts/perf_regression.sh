@@ -20,6 +20,10 @@ GRAPH_SIZES=(100 1000 10000)
 WARMUP_RUNS=3
 MEASURE_RUNS=10
 REGRESSION_THRESHOLD=10  # 10% performance regression threshold
+LDBC_SCALE=${LDBC_SCALE:-1}      # graph_benchmark() scale factor
+LDBC_THREADS=${LDBC_THREADS:-4}  # Concurrent read connections
+MICRO_SHAPES=(er powerlaw grid)  # graph_microbench synthetic graphs
+MICRO_NODES=${MICRO_NODES:-10000}
 
 # Colors for output
 RED='\033[0;31m'
@@ -208,6 +212,67 @@ run_test_suite() {
     done
     
     echo "]" >> "$output_file"
+
+    run_ldbc_suite "$output_file"
+    run_microbench "$output_file"
+}
+
+# LDBC SNB Interactive workload. graph_benchmark() writes a JSON report
+# whose "queries" entries have the same shape as the tests above; they
+# are appended to the suite's array and the full report kept beside it.
+run_ldbc_suite() {
+    local output_file=$1
+    local db_file="$RESULTS_DIR/ldbc_sf${LDBC_SCALE}.db"
+    local report_file="${output_file%.json}_ldbc.json"
+
+    echo "Running LDBC SNB Interactive (SF $LDBC_SCALE, $LDBC_THREADS threads)..."
+    sqlite3 "$db_file" > /dev/null <<EOF
+.load $BUILD_DIR/src/graph.so
+SELECT graph_benchmark($LDBC_SCALE, $LDBC_THREADS, $WARMUP_RUNS, $MEASURE_RUNS, '$report_file');
+EOF
+
+    python3 - "$output_file" "$report_file" <<'EOF'
+import json
+import sys
+
+with open(sys.argv[1]) as f:
+    tests = json.load(f)
+with open(sys.argv[2]) as f:
+    report = json.load(f)
+tests.extend(report['queries'])
+with open(sys.argv[1], 'w') as f:
+    json.dump(tests, f, indent=1)
+print(f"  reads: {report['read_ops_per_s']:.1f} ops/s, "
+      f"updates: {report['update_ops_per_s']:.1f} ops/s")
+EOF
+}
+
+# Kernel micro-benchmarks. Each shape's JSON array carries the usual
+# "test"/"avg" fields plus "cv" and "allocs_per_op", which the comparison
+# below uses for a per-test noise threshold and an allocation check.
+run_microbench() {
+    local output_file=$1
+    local bench="$PROJECT_DIR/build/graph_microbench"
+
+    make -C "$PROJECT_DIR" microbench > /dev/null
+    for shape in "${MICRO_SHAPES[@]}"; do
+        local shape_file="${output_file%.json}_micro_${shape}.json"
+        echo "Running micro-benchmarks ($shape, $MICRO_NODES nodes)..."
+        "$bench" --shape "$shape" --nodes "$MICRO_NODES" \
+            --warmup "$WARMUP_RUNS" --reps "$MEASURE_RUNS" --json "$shape_file" > /dev/null
+
+        python3 - "$output_file" "$shape_file" <<'EOF'
+import json
+import sys
+
+with open(sys.argv[1]) as f:
+    tests = json.load(f)
+with open(sys.argv[2]) as f:
+    tests.extend(json.load(f))
+with open(sys.argv[1], 'w') as f:
+    json.dump(tests, f, indent=1)
+EOF
+    done
 }
 
 # Compare results
@@ -230,6 +295,12 @@ with open('$baseline', 'r') as f:
 with open('$current', 'r') as f:
     current_data = json.load(f)
 
+# Accept a graph_benchmark() report as well as a suite's array
+if isinstance(baseline_data, dict):
+    baseline_data = baseline_data['queries']
+if isinstance(current_data, dict):
+    current_data = current_data['queries']
+
 # Create lookup dictionary
 baseline_dict = {test['test']: test for test in baseline_data}
 current_dict = {test['test']: test for test in current_data}
@@ -240,16 +311,30 @@ improvements = []
 
 for test_name in current_dict:
     if test_name in baseline_dict:
+        if 'avg' not in baseline_dict[test_name] or 'avg' not in current_dict[test_name]:
+            continue
         baseline_avg = baseline_dict[test_name]['avg']
         current_avg = current_dict[test_name]['avg']
+        if baseline_avg <= 0:
+            continue
         
         change_percent = ((current_avg - baseline_avg) / baseline_avg) * 100
-        
+
+        # Noisy kernels get a wider band: three times the larger of the
+        # two runs' coefficients of variation
+        cv = max(baseline_dict[test_name].get('cv', 0), current_dict[test_name].get('cv', 0))
+        threshold = max($REGRESSION_THRESHOLD, 3 * cv * 100)
+
         status = "SAME"
-        if change_percent > $REGRESSION_THRESHOLD:
+        if change_percent > threshold:
             status = "REGRESSION"
             regressions.append((test_name, change_percent))
-        elif change_percent < -$REGRESSION_THRESHOLD:
+        elif 'allocs_per_op' in baseline_dict[test_name] and \
+                current_dict[test_name].get('allocs_per_op', 0) > \
+                baseline_dict[test_name]['allocs_per_op'] * 1.01 + 0.5:
+            status = "ALLOCS"
+            regressions.append((test_name, change_percent))
+        elif change_percent < -threshold:
             status = "IMPROVEMENT"
             improvements.append((test_name, change_percent))
             
@@ -0,0 +1,758 @@
+/*
+** graph-microbench.c - Micro-benchmarks for the core kernels
+**
+** A standalone program, built with `make -C src microbench`, that times
+** the extension's hot paths one at a time on a generated graph:
+**
+**   bfs          graphBFS() from a rotating start node over the CSR snapshot
+**   dijkstra     graphDijkstra() between rotating node pairs
+**   pagerank     graphPageRank(), 20 iterations on one thread
+**   lexer        cypherLexerNextToken() over a set of Cypher queries
+**   parser       cypherParse() of the same queries
+**   expr_tree    cypherExpressionEvaluate() of an arithmetic predicate
+**   expr_program cypherProgramEvaluate() of the compiled predicate
+**   plan_cache   cypherNormalizeQuery() + graphPlanCacheLookup() hits
+**   compress     graph_pack() + graph_props() round trip of a property map
+**   csv          graphBulkLoadNodesCSV() of a 1000-row node file, deleted
+**                again outside the timed region
+**
+** The graph shape is Erdos-Renyi (uniform random endpoints), power-law
+** (preferential attachment) or a 2D grid. Each kernel runs --warmup
+** unmeasured repetitions, then --reps repetitions of a batch sized so
+** one repetition lasts at least --min-ms. A repetition performs the same
+** operations as every other, so its result checksum must not change; a
+** kernel whose checksum does differ is reported and fails the run.
+**
+** Reported per kernel: median and minimum ns/op, the coefficient of
+** variation across repetitions, SQLite allocations per op (counted by a
+** wrapper installed with SQLITE_CONFIG_MALLOC) and edges or bytes
+** processed per second. --json writes the same numbers as an array in
+** the format scripts/perf_regression.sh compares.
+**
+** Memory allocation: sqlite3_malloc(); everything is freed before exit
+*/
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "graph.h"
+#include "graph-bulk.h"
+#include "graph-performance.h"
+#include "cypher.h"
+#include "cypher-expressions.h"
+#include "cypher-program.h"
+#include "cypher-planner.h"
+
+int sqlite3_graph_init(sqlite3 *pDb, char **pzErrMsg,
+                       const sqlite3_api_routines *pApi);
+
+#define BENCH_MAX_REPS   64
+#define BENCH_PR_ITER    20    /* PageRank iterations per op */
+#define BENCH_CSV_ROWS   1000  /* Node rows per csv op */
+
+enum { SHAPE_ER, SHAPE_POWERLAW, SHAPE_GRID };
+static const char *const azShape[] = { "er", "powerlaw", "grid" };
+
+typedef struct Bench {
+    int eShape;
+    int nNode;                   /* Nodes generated */
+    int nDegree;                 /* Average out-degree (ER, power-law) */
+    sqlite3_uint64 iSeed;
+    int nWarmup;
+    int nRep;
+    int nMinMs;
+    const char *zFilter;         /* Run kernels whose name contains this */
+    const char *zJson;           /* Write the JSON report here, "-" stdout */
+
+    sqlite3 *db;
+    GraphVtab *pGraph;           /* Graph "g", the generated one */
+    sqlite3_int64 nEdge;         /* Edges generated */
+    sqlite3_int64 nCheck;        /* Result checksum of the current rep */
+    sqlite3_int64 nUntimed;      /* Nanoseconds of cleanup to discount */
+
+    ExecutionContext *pContext;  /* expr_* kernels */
+    CypherExpression *pExpr;
+    CypherProgram *pProgram;
+    sqlite3_stmt *pPack;         /* compress kernel */
+    char *zCsv;                  /* csv kernel input */
+    int nCsv;
+} Bench;
+
+/*
+** Allocation counter
+*/
+static sqlite3_mem_methods benchMemDefault;
+static volatile sqlite3_int64 nBenchAlloc;
+
+static void *benchMalloc(int n) {
+    __atomic_add_fetch(&nBenchAlloc, 1, __ATOMIC_RELAXED);
+    return benchMemDefault.xMalloc(n);
+}
+
+static void *benchRealloc(void *p, int n) {
+    __atomic_add_fetch(&nBenchAlloc, 1, __ATOMIC_RELAXED);
+    return benchMemDefault.xRealloc(p, n);
+}
+
+static int benchInstallAllocCounter(void) {
+    sqlite3_mem_methods m;
+    int rc = sqlite3_config(SQLITE_CONFIG_GETMALLOC, &benchMemDefault);
+    if (rc != SQLITE_OK) return rc;
+    m = benchMemDefault;
+    m.xMalloc = benchMalloc;
+    m.xRealloc = benchRealloc;
+    return sqlite3_config(SQLITE_CONFIG_MALLOC, &m);
+}
+
+static sqlite3_int64 benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* splitmix64 */
+static sqlite3_uint64 benchRandom(sqlite3_uint64 *pState) {
+    sqlite3_uint64 z = (*pState += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void benchCheck(Bench *p, const char *z) {
+    sqlite3_uint64 h = 14695981039346656037ULL;
+    if (!z) return;
+    while (*z) h = (h ^ (unsigned char)*z++) * 1099511628211ULL;
+    p->nCheck += (sqlite3_int64)(h >> 1);
+}
+
+/* The op's node: a fixed stride through the ids, so reps agree */
+static sqlite3_int64 benchNode(const Bench *p, int iOp, int iSalt) {
+    return 1 + ((sqlite3_int64)iOp * 7919 + iSalt * 104729) % p->nNode;
+}
+
+/*
+** Graph generation
+*/
+static int benchExec(sqlite3 *db, const char *zSql) {
+    char *zErr = NULL;
+    int rc = sqlite3_exec(db, zSql, NULL, NULL, &zErr);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", zSql, zErr ? zErr : sqlite3_errstr(rc));
+    }
+    sqlite3_free(zErr);
+    return rc;
+}
+
+static int benchAddEdge(Bench *p, sqlite3_stmt *pEdge, sqlite3_uint64 *pRandom,
+                        sqlite3_int64 iSrc, sqlite3_int64 iDst) {
+    sqlite3_bind_int64(pEdge, 1, iSrc);
+    sqlite3_bind_int64(pEdge, 2, iDst);
+    sqlite3_bind_double(pEdge, 3, 1.0 + (double)(benchRandom(pRandom) % 900) / 100.0);
+    sqlite3_step(pEdge);
+    p->nEdge++;
+    return sqlite3_reset(pEdge);
+}
+
+static int benchGenerate(Bench *p) {
+    sqlite3_uint64 iRandom = p->iSeed;
+    sqlite3_stmt *pNode = NULL, *pEdge = NULL;
+    sqlite3_int64 *aEnd = NULL;        /* Edge endpoints, for power-law */
+    sqlite3_int64 nEnd = 0;
+    int i, j, rc;
+
+    if (p->eShape == SHAPE_GRID) {
+        int nSide = (int)ceil(sqrt((double)p->nNode));
+        p->nNode = nSide * nSide;
+    }
+
+    rc = benchExec(p->db, "BEGIN");
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(p->db,
+            "INSERT INTO g_nodes(id, labels, properties) VALUES(?1, '[\"Person\"]',"
+            " json_object('name', 'n' || ?1, 'age', ?1 % 80))", -1, &pNode, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(p->db,
+            "INSERT INTO g_edges(source, target, edge_type, weight)"
+            " VALUES(?1, ?2, 'KNOWS', ?3)", -1, &pEdge, NULL);
+    }
+    for (i = 1; i <= p->nNode && rc == SQLITE_OK; i++) {
+        sqlite3_bind_int(pNode, 1, i);
+        sqlite3_step(pNode);
+        rc = sqlite3_reset(pNode);
+    }
+
+    if (rc == SQLITE_OK && p->eShape == SHAPE_POWERLAW) {
+        aEnd = sqlite3_malloc64((sqlite3_int64)p->nNode * p->nDegree * 2
+                                * sizeof(sqlite3_int64) + 2 * sizeof(sqlite3_int64));
+        if (!aEnd) rc = SQLITE_NOMEM;
+        if (aEnd) aEnd[nEnd++] = 1;
+    }
+    for (i = 1; i <= p->nNode && rc == SQLITE_OK; i++) {
+        int nSide = (int)sqrt((double)p->nNode);
+        switch (p->eShape) {
+        case SHAPE_ER:
+            for (j = 0; j < p->nDegree && rc == SQLITE_OK; j++) {
+                sqlite3_int64 iDst = 1 + (sqlite3_int64)(benchRandom(&iRandom) % p->nNode);
+                if (iDst != i) rc = benchAddEdge(p, pEdge, &iRandom, i, iDst);
+            }
+            break;
+        case SHAPE_POWERLAW:
+            /* Preferential attachment: endpoints are drawn from the list
+            ** of all earlier endpoints, so in-degree is power-law */
+            if (i == 1) break;
+            for (j = 0; j < p->nDegree && rc == SQLITE_OK; j++) {
+                sqlite3_int64 iDst = aEnd[benchRandom(&iRandom) % nEnd];
+                rc = benchAddEdge(p, pEdge, &iRandom, i, iDst);
+                aEnd[nEnd++] = iDst;
+                aEnd[nEnd++] = i;
+            }
+            break;
+        case SHAPE_GRID:
+            if (i % nSide != 0) {
+                rc = benchAddEdge(p, pEdge, &iRandom, i, i + 1);
+                if (rc == SQLITE_OK) rc = benchAddEdge(p, pEdge, &iRandom, i + 1, i);
+            }
+            if (rc == SQLITE_OK && i + nSide <= p->nNode) {
+                rc = benchAddEdge(p, pEdge, &iRandom, i, i + nSide);
+                if (rc == SQLITE_OK) rc = benchAddEdge(p, pEdge, &iRandom, i + nSide, i);
+            }
+            break;
+        }
+    }
+    sqlite3_free(aEnd);
+    sqlite3_finalize(pNode);
+    sqlite3_finalize(pEdge);
+    if (rc == SQLITE_OK) {
+        rc = benchExec(p->db, "COMMIT");
+    } else {
+        fprintf(stderr, "generating graph: %s\n", sqlite3_errmsg(p->db));
+        sqlite3_exec(p->db, "ROLLBACK", NULL, NULL, NULL);
+    }
+    return rc;
+}
+
+/*
+** Kernels. xSetup runs once before the warmup; xOp performs one
+** operation; xWork is the edges or bytes one operation processes.
+*/
+typedef struct BenchKernel {
+    const char *zName;
+    int (*xSetup)(Bench*);
+    int (*xOp)(Bench*, int iOp);
+    double (*xWork)(Bench*, int iOp);
+    const char *zUnit;           /* "edges" or "bytes", NULL for none */
+} BenchKernel;
+
+static const char *const azBenchQuery[] = {
+    "MATCH (n:Person) RETURN n",
+    "MATCH (n:Person) WHERE n.age > 30 RETURN n.name ORDER BY n.name LIMIT 10",
+    "MATCH (a:Person)-[:KNOWS]->(b:Person) WHERE a.name = 'n1' RETURN b",
+    "MATCH (a:Person)-[:KNOWS*1..3]->(b) RETURN DISTINCT b",
+    "MATCH (a)-[r:KNOWS]->(b)<-[:KNOWS]-(c) WHERE a <> c RETURN a, c, count(*)",
+    "CREATE (n:Person {name: 'x', age: 42})",
+    "MATCH (n:Person {name: 'n7'}) SET n.age = n.age + 1 RETURN n",
+    "MATCH (n) WHERE n.age >= 18 AND n.age < 65 OR n.name STARTS WITH 'n9' RETURN n"
+};
+#define BENCH_NQUERY ((int)(sizeof(azBenchQuery)/sizeof(azBenchQuery[0])))
+
+static double benchEdgesAll(Bench *p, int iOp) {
+    (void)iOp;
+    return (double)p->nEdge;
+}
+
+static int benchBfs(Bench *p, int iOp) {
+    char *zPath = NULL;
+    int rc = graphBFS(p->pGraph, benchNode(p, iOp, 0), -1, GRAPH_BFS_AUTO, &zPath);
+    benchCheck(p, zPath);
+    sqlite3_free(zPath);
+    return rc;
+}
+
+static int benchDijkstra(Bench *p, int iOp) {
+    char *zPath = NULL;
+    double rDist = 0.0;
+    int rc = graphDijkstra(p->pGraph, benchNode(p, iOp, 0), benchNode(p, iOp, 1),
+                           &zPath, &rDist);
+    benchCheck(p, zPath);
+    sqlite3_free(zPath);
+    return rc == SQLITE_NOTFOUND ? SQLITE_OK : rc;
+}
+
+static int benchPageRank(Bench *p, int iOp) {
+    char *zResult = NULL;
+    int rc;
+    (void)iOp;
+    rc = graphPageRank(p->pGraph, 0.85, BENCH_PR_ITER, 0.0, 1, &zResult);
+    benchCheck(p, zResult);
+    sqlite3_free(zResult);
+    return rc;
+}
+
+static double benchPageRankWork(Bench *p, int iOp) {
+    (void)iOp;
+    return (double)p->nEdge * BENCH_PR_ITER;
+}
+
+static double benchQueryBytes(Bench *p, int iOp) {
+    (void)p;
+    return (double)strlen(azBenchQuery[iOp % BENCH_NQUERY]);
+}
+
+static int benchLexer(Bench *p, int iOp) {
+    CypherLexer *pLexer = cypherLexerCreate(azBenchQuery[iOp % BENCH_NQUERY]);
+    CypherToken *pToken;
+    if (!pLexer) return SQLITE_NOMEM;
+    do {
+        pToken = cypherLexerNextToken(pLexer);
+        p->nCheck += pToken ? (int)pToken->type : -1;
+    } while (pToken && pToken->type != CYPHER_TOK_EOF);
+    cypherLexerDestroy(pLexer);
+    return SQLITE_OK;
+}
+
+static int benchParser(Bench *p, int iOp) {
+    CypherParser *pParser = cypherParserCreate();
+    char *zErr = NULL;
+    if (!pParser) return SQLITE_NOMEM;
+    p->nCheck += cypherParse(pParser, azBenchQuery[iOp % BENCH_NQUERY], &zErr) ? 1 : 0;
+    sqlite3_free(zErr);
+    cypherParserDestroy(pParser);
+    return SQLITE_OK;
+}
+
+/* (x * 3 + 7) % 11 > 4 AND x <> 13 */
+static int benchExprSetup(Bench *p) {
+    CypherExpression *pX, *pMul, *pAdd, *pMod, *pGt, *pNe, *pLit;
+    CypherValue v;
+    int rc = SQLITE_OK;
+
+    if (p->pContext) return SQLITE_OK;
+    p->pContext = executionContextCreate(p->db, p->pGraph);
+    if (!p->pContext) return SQLITE_NOMEM;
+
+#define BENCH_LITERAL(i) (cypherValueSetInteger(&v, i), \
+                          cypherExpressionCreateLiteral(&pLit, &v) ? NULL : pLit)
+    rc |= cypherExpressionCreateVariable(&pX, "x");
+    rc |= cypherExpressionCreateArithmetic(&pMul, pX, BENCH_LITERAL(3), CYPHER_OP_MULTIPLY);
+    rc |= cypherExpressionCreateArithmetic(&pAdd, pMul, BENCH_LITERAL(7), CYPHER_OP_ADD);
+    rc |= cypherExpressionCreateArithmetic(&pMod, pAdd, BENCH_LITERAL(11), CYPHER_OP_MODULO);
+    rc |= cypherExpressionCreateComparison(&pGt, pMod, BENCH_LITERAL(4), CYPHER_CMP_GREATER);
+    rc |= cypherExpressionCreateVariable(&pX, "x");
+    rc |= cypherExpressionCreateComparison(&pNe, pX, BENCH_LITERAL(13), CYPHER_CMP_NOT_EQUAL);
+    rc |= cypherExpressionCreateLogical(&p->pExpr, pGt, pNe, CYPHER_LOGIC_AND);
+#undef BENCH_LITERAL
+    if (rc != SQLITE_OK) return SQLITE_NOMEM;
+    return cypherProgramCompile(p->pExpr, &p->pProgram);
+}
+
+static int benchBindX(Bench *p, int iOp) {
+    CypherValue v;
+    cypherValueSetInteger(&v, iOp % 1000);
+    return executionContextBind(p->pContext, "x", &v);
+}
+
+static int benchExprTree(Bench *p, int iOp) {
+    CypherValue result;
+    int rc = benchBindX(p, iOp);
+    cypherValueInit(&result);
+    if (rc == SQLITE_OK) rc = cypherExpressionEvaluate(p->pExpr, p->pContext, &result);
+    p->nCheck += result.type == CYPHER_VALUE_BOOLEAN && result.u.bBoolean;
+    cypherValueDestroy(&result);
+    return rc;
+}
+
+static int benchExprProgram(Bench *p, int iOp) {
+    CypherValue result;
+    int rc = benchBindX(p, iOp);
+    cypherValueInit(&result);
+    if (rc == SQLITE_OK) rc = cypherProgramEvaluate(p->pProgram, p->pContext, &result);
+    p->nCheck += result.type == CYPHER_VALUE_BOOLEAN && result.u.bBoolean;
+    cypherValueDestroy(&result);
+    return rc;
+}
+
+/* Plan every read query once so that the lookups hit */
+static int benchPlanCacheSetup(Bench *p) {
+    int i;
+    for (i = 0; i < BENCH_NQUERY; i++) {
+        char *zSql = sqlite3_mprintf("SELECT cypher_execute(%Q)", azBenchQuery[i]);
+        if (!zSql) return SQLITE_NOMEM;
+        sqlite3_exec(p->db, zSql, NULL, NULL, NULL);  /* Unplannable is a miss */
+        sqlite3_free(zSql);
+    }
+    return SQLITE_OK;
+}
+
+static int benchPlanCache(Bench *p, int iOp) {
+    CypherParams params;
+    PhysicalPlanNode *pPlan = NULL;
+    sqlite3_uint64 iVersion = 0;
+    char *zNorm, *zKey = NULL;
+
+    memset(&params, 0, sizeof(params));
+    zNorm = cypherNormalizeQuery(azBenchQuery[iOp % BENCH_NQUERY], &params);
+    if (zNorm) zKey = sqlite3_mprintf("%s\x1f%s", p->pGraph->zTableName, zNorm);
+    if (zKey) pPlan = graphPlanCacheLookup(NULL, zKey, &iVersion);
+    p->nCheck += pPlan ? 1 : 0;
+    physicalPlanNodeDestroy(pPlan);
+    sqlite3_free(zKey);
+    sqlite3_free(zNorm);
+    cypherParamsClear(&params);
+    return zNorm ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+static const char *benchProps(int iOp, char *zBuf, int nBuf) {
+    sqlite3_snprintf(nBuf, zBuf,
+        "{\"name\":\"Person %d\",\"city\":\"City_%d\",\"age\":%d,"
+        "\"email\":\"person%d@example.com\",\"active\":%s}",
+        iOp % 997, iOp % 31, 18 + iOp % 60, iOp % 997, (iOp & 1) ? "true" : "false");
+    return zBuf;
+}
+
+static int benchCompressSetup(Bench *p) {
+    if (p->pPack) return SQLITE_OK;
+    return sqlite3_prepare_v2(p->db,
+        "SELECT length(graph_pack('c', ?1)), graph_props('c', graph_pack('c', ?1)) = ?1",
+        -1, &p->pPack, NULL);
+}
+
+static int benchCompress(Bench *p, int iOp) {
+    char zBuf[256];
+    int rc;
+    sqlite3_bind_text(p->pPack, 1, benchProps(iOp, zBuf, sizeof(zBuf)), -1, SQLITE_STATIC);
+    if (sqlite3_step(p->pPack) == SQLITE_ROW) {
+        /* A failed round trip changes the checksum between reps only if
+        ** it is intermittent; a constant failure shows in the length */
+        p->nCheck += sqlite3_column_int(p->pPack, 0) * 2 + sqlite3_column_int(p->pPack, 1);
+    }
+    rc = sqlite3_reset(p->pPack);
+    return rc;
+}
+
+static double benchCompressBytes(Bench *p, int iOp) {
+    char zBuf[256];
+    (void)p;
+    return (double)strlen(benchProps(iOp, zBuf, sizeof(zBuf)));
+}
+
+static int benchCsvSetup(Bench *p) {
+    sqlite3_str *pStr;
+    char zBuf[256];
+    int i;
+
+    if (p->zCsv) return SQLITE_OK;
+    pStr = sqlite3_str_new(p->db);
+    sqlite3_str_appendall(pStr, "id,labels,properties\n");
+    for (i = 1; i <= BENCH_CSV_ROWS; i++) {
+        const char *z = benchProps(i, zBuf, sizeof(zBuf));
+        sqlite3_str_appendf(pStr, "%d,%s,\"", p->nNode + i,
+                            (i % 3) ? "Person" : "Person;Admin");
+        for (; *z; z++) {
+            sqlite3_str_appendchar(pStr, *z == '"' ? 2 : 1, *z);
+        }
+        sqlite3_str_appendall(pStr, "\"\n");
+    }
+    p->nCsv = sqlite3_str_length(pStr);
+    p->zCsv = sqlite3_str_finish(pStr);
+    return p->zCsv ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+/* Load new ids into g, then delete them again untimed so that every op
+** loads the same rows. (A savepoint rollback would do, but rolling back
+** resets the schema and with it every graph virtual table.) */
+static int benchCsv(Bench *p, int iOp) {
+    BulkLoaderConfig config;
+    BulkLoadStats stats;
+    sqlite3_int64 iStart;
+    char *zSql;
+    int rc;
+    (void)iOp;
+
+    memset(&config, 0, sizeof(config));
+    rc = graphBulkLoadNodesCSV(p->pGraph, p->zCsv, p->nCsv, &config, &stats);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "csv: %s\n", stats.lastError ? stats.lastError : sqlite3_errmsg(p->db));
+    }
+    p->nCheck += stats.nodesLoaded;
+    sqlite3_free(stats.lastError);
+
+    iStart = benchNow();
+    zSql = sqlite3_mprintf("DELETE FROM g_nodes WHERE id > %d", p->nNode);
+    if (rc == SQLITE_OK) rc = zSql ? benchExec(p->db, zSql) : SQLITE_NOMEM;
+    sqlite3_free(zSql);
+    p->nUntimed += benchNow() - iStart;
+    return rc;
+}
+
+static double benchCsvBytes(Bench *p, int iOp) {
+    (void)iOp;
+    return (double)p->nCsv;
+}
+
+static const BenchKernel aBenchKernel[] = {
+    { "bfs",          NULL,                benchBfs,         benchEdgesAll,      "edges" },
+    { "dijkstra",     NULL,                benchDijkstra,    NULL,               NULL },
+    { "pagerank",     NULL,                benchPageRank,    benchPageRankWork,  "edges" },
+    { "lexer",        NULL,                benchLexer,       benchQueryBytes,    "bytes" },
+    { "parser",       NULL,                benchParser,      benchQueryBytes,    "bytes" },
+    { "expr_tree",    benchExprSetup,      benchExprTree,    NULL,               NULL },
+    { "expr_program", benchExprSetup,      benchExprProgram, NULL,               NULL },
+    { "plan_cache",   benchPlanCacheSetup, benchPlanCache,   NULL,               NULL },
+    { "compress",     benchCompressSetup,  benchCompress,    benchCompressBytes, "bytes" },
+    { "csv",          benchCsvSetup,       benchCsv,         benchCsvBytes,      "bytes" },
+};
+#define BENCH_NKERNEL ((int)(sizeof(aBenchKernel)/sizeof(aBenchKernel[0])))
+
+/*
+** Measurement
+*/
+typedef struct BenchResult {
+    const char *zName;
+    int nOp;                     /* Ops per repetition */
+    int nRep;
+    double rMedian, rMin, rCv;   /* ns/op, and stddev/mean */
+    double rAllocs;              /* Allocations per op */
+    double rRate;                /* Work units per second at the median */
+    const char *zUnit;
+    int bUnstable;               /* Checksum differed between reps */
+} BenchResult;
+
+static int benchRunOps(Bench *p, const BenchKernel *pKernel, int nOp,
+                       sqlite3_int64 *pnNano) {
+    sqlite3_int64 iStart = benchNow();
+    int i, rc = SQLITE_OK;
+    p->nCheck = 0;
+    p->nUntimed = 0;
+    for (i = 0; i < nOp && rc == SQLITE_OK; i++) rc = pKernel->xOp(p, i);
+    *pnNano = benchNow() - iStart - p->nUntimed;
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: op %d failed: %s\n", pKernel->zName, i - 1,
+                sqlite3_errstr(rc));
+    }
+    return rc;
+}
+
+static int benchCompareDouble(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int benchKernel(Bench *p, const BenchKernel *pKernel, BenchResult *pRes) {
+    double aNs[BENCH_MAX_REPS];
+    sqlite3_int64 nNano, nCheck = 0;
+    sqlite3_int64 nAlloc;
+    double rSum = 0.0, rSq = 0.0, rWork = 0.0;
+    int nOp = 1;
+    int i, rc = SQLITE_OK;
+
+    memset(pRes, 0, sizeof(*pRes));
+    pRes->zName = pKernel->zName;
+    pRes->zUnit = pKernel->zUnit;
+    if (pKernel->xSetup) rc = pKernel->xSetup(p);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: setup failed: %s\n", pKernel->zName, sqlite3_errmsg(p->db));
+        return rc;
+    }
+
+    /* Warm up, then grow the batch until one rep lasts --min-ms */
+    for (i = 0; i < p->nWarmup && rc == SQLITE_OK; i++) {
+        rc = benchRunOps(p, pKernel, nOp, &nNano);
+    }
+    while (rc == SQLITE_OK) {
+        rc = benchRunOps(p, pKernel, nOp, &nNano);
+        if (nNano >= (sqlite3_int64)p->nMinMs * 1000000 || nOp >= (1 << 24)) break;
+        nOp = nNano > 0 && nNano * 2 < (sqlite3_int64)p->nMinMs * 1000000 / 4
+            ? nOp * 4 : nOp * 2;
+    }
+    if (rc != SQLITE_OK) return rc;
+
+    nAlloc = __atomic_load_n(&nBenchAlloc, __ATOMIC_RELAXED);
+    for (i = 0; i < p->nRep && rc == SQLITE_OK; i++) {
+        rc = benchRunOps(p, pKernel, nOp, &nNano);
+        aNs[i] = (double)nNano / nOp;
+        if (i > 0 && p->nCheck != nCheck) pRes->bUnstable = 1;
+        nCheck = p->nCheck;
+    }
+    if (rc != SQLITE_OK) return rc;
+    nAlloc = __atomic_load_n(&nBenchAlloc, __ATOMIC_RELAXED) - nAlloc;
+
+    for (i = 0; i < p->nRep; i++) {
+        rSum += aNs[i];
+        rSq += aNs[i] * aNs[i];
+    }
+    qsort(aNs, p->nRep, sizeof(double), benchCompareDouble);
+    pRes->nOp = nOp;
+    pRes->nRep = p->nRep;
+    pRes->rMin = aNs[0];
+    pRes->rMedian = aNs[p->nRep / 2];
+    if (p->nRep > 1 && rSum > 0.0) {
+        double rMean = rSum / p->nRep;
+        double rVar = (rSq - rSum * rMean) / (p->nRep - 1);
+        pRes->rCv = rVar > 0.0 ? sqrt(rVar) / rMean : 0.0;
+    }
+    pRes->rAllocs = (double)nAlloc / ((double)nOp * p->nRep);
+    if (pKernel->xWork) {
+        for (i = 0; i < nOp; i++) rWork += pKernel->xWork(p, i);
+        pRes->rRate = rWork / nOp / (pRes->rMedian / 1e9);
+    }
+    return SQLITE_OK;
+}
+
+static void benchReportJson(Bench *p, FILE *out, const BenchResult *aRes, int nRes) {
+    int i;
+    fprintf(out, "[\n");
+    for (i = 0; i < nRes; i++) {
+        const BenchResult *r = &aRes[i];
+        fprintf(out,
+            "  {\"test\":\"micro_%s_%s\",\"kernel\":\"%s\",\"shape\":\"%s\","
+            "\"nodes\":%d,\"edges\":%lld,\"runs\":%d,\"ops\":%d,"
+            "\"avg\":%.6f,\"min\":%.6f,\"ns_per_op\":%.1f,\"cv\":%.4f,"
+            "\"allocs_per_op\":%.2f",
+            r->zName, azShape[p->eShape], r->zName, azShape[p->eShape],
+            p->nNode, p->nEdge, r->nRep, r->nOp,
+            r->rMedian / 1e6, r->rMin / 1e6, r->rMedian, r->rCv, r->rAllocs);
+        if (r->zUnit) fprintf(out, ",\"%s_per_sec\":%.0f", r->zUnit, r->rRate);
+        fprintf(out, ",\"stable\":%s}%s\n", r->bUnstable ? "false" : "true",
+                i + 1 < nRes ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+static void benchUsage(const char *zArgv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --shape er|powerlaw|grid  graph shape (er)\n"
+        "  --nodes N                 nodes (10000)\n"
+        "  --degree D                average out-degree for er, powerlaw (8)\n"
+        "  --seed S                  generator seed (1)\n"
+        "  --warmup W                unmeasured repetitions (2)\n"
+        "  --reps R                  measured repetitions, up to %d (7)\n"
+        "  --min-ms T                minimum duration of a repetition (50)\n"
+        "  --filter NAME             only kernels whose name contains NAME\n"
+        "  --json FILE               write the JSON report to FILE, - for stdout\n",
+        zArgv0, BENCH_MAX_REPS);
+}
+
+static int benchParseArgs(Bench *p, int argc, char **argv) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        const char *z = argv[i];
+        const char *zVal = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!zVal) return 1;
+        if (strcmp(z, "--shape") == 0) {
+            for (p->eShape = 0; p->eShape < 3 && strcmp(azShape[p->eShape], zVal); p->eShape++) {}
+            if (p->eShape == 3) return 1;
+        } else if (strcmp(z, "--nodes") == 0) {
+            p->nNode = atoi(zVal);
+        } else if (strcmp(z, "--degree") == 0) {
+            p->nDegree = atoi(zVal);
+        } else if (strcmp(z, "--seed") == 0) {
+            p->iSeed = strtoull(zVal, NULL, 10);
+        } else if (strcmp(z, "--warmup") == 0) {
+            p->nWarmup = atoi(zVal);
+        } else if (strcmp(z, "--reps") == 0) {
+            p->nRep = atoi(zVal);
+        } else if (strcmp(z, "--min-ms") == 0) {
+            p->nMinMs = atoi(zVal);
+        } else if (strcmp(z, "--filter") == 0) {
+            p->zFilter = zVal;
+        } else if (strcmp(z, "--json") == 0) {
+            p->zJson = zVal;
+        } else {
+            return 1;
+        }
+        i++;
+    }
+    return p->nNode < 2 || p->nDegree < 1 || p->nWarmup < 0
+        || p->nRep < 1 || p->nRep > BENCH_MAX_REPS || p->nMinMs < 1;
+}
+
+int main(int argc, char **argv) {
+    Bench b;
+    BenchResult aRes[BENCH_NKERNEL];
+    int nRes = 0, nUnstable = 0;
+    int i, rc;
+
+    memset(&b, 0, sizeof(b));
+    b.eShape = SHAPE_ER;
+    b.nNode = 10000;
+    b.nDegree = 8;
+    b.iSeed = 1;
+    b.nWarmup = 2;
+    b.nRep = 7;
+    b.nMinMs = 50;
+    if (benchParseArgs(&b, argc, argv)) {
+        benchUsage(argv[0]);
+        return 2;
+    }
+
+    if (benchInstallAllocCounter() != SQLITE_OK) {
+        fprintf(stderr, "cannot install the allocation counter\n");
+        return 1;
+    }
+    sqlite3_auto_extension((void(*)(void))sqlite3_graph_init);
+    rc = sqlite3_open(":memory:", &b.db);
+
+    /* "g" is created last: Cypher plans against the connection's latest graph */
+    if (rc == SQLITE_OK) {
+        rc = benchExec(b.db, "CREATE VIRTUAL TABLE c USING graph(properties=compressed)");
+    }
+    if (rc == SQLITE_OK) rc = benchExec(b.db, "CREATE VIRTUAL TABLE g USING graph");
+    if (rc == SQLITE_OK) {
+        b.pGraph = graphRegistryFind(b.db, "g");
+        rc = benchGenerate(&b);
+    }
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "setup failed: %s\n", b.db ? sqlite3_errmsg(b.db) : "open");
+        sqlite3_close(b.db);
+        return 1;
+    }
+
+    printf("%s graph: %d nodes, %lld edges; %d warmup, %d reps of >= %d ms\n",
+           azShape[b.eShape], b.nNode, b.nEdge, b.nWarmup, b.nRep, b.nMinMs);
+    printf("%-14s %12s %12s %7s %10s %16s\n",
+           "kernel", "ns/op", "min ns/op", "cv", "allocs/op", "throughput");
+    for (i = 0; i < BENCH_NKERNEL; i++) {
+        const BenchKernel *pKernel = &aBenchKernel[i];
+        BenchResult *r = &aRes[nRes];
+        char zRate[32] = "";
+
+        if (b.zFilter && !strstr(pKernel->zName, b.zFilter)) continue;
+        if (benchKernel(&b, pKernel, r) != SQLITE_OK) {
+            rc = SQLITE_ERROR;
+            continue;
+        }
+        if (r->zUnit) {
+            snprintf(zRate, sizeof(zRate), "%.3g %s/s", r->rRate, r->zUnit);
+        }
+        printf("%-14s %12.1f %12.1f %6.1f%% %10.2f %16s%s\n",
+               r->zName, r->rMedian, r->rMin, r->rCv * 100.0, r->rAllocs, zRate,
+               r->bUnstable ? "  UNSTABLE RESULT" : "");
+        nUnstable += r->bUnstable;
+        nRes++;
+    }
+
+    if (b.zJson) {
+        FILE *out = strcmp(b.zJson, "-") == 0 ? stdout : fopen(b.zJson, "w");
+        if (out) {
+            benchReportJson(&b, out, aRes, nRes);
+            if (out != stdout) fclose(out);
+        } else {
+            fprintf(stderr, "cannot write %s\n", b.zJson);
+            rc = SQLITE_CANTOPEN;
+        }
+    }
+
+    cypherProgramFree(b.pProgram);
+    cypherExpressionDestroy(b.pExpr);
+    executionContextDestroy(b.pContext);
+    sqlite3_finalize(b.pPack);
+    sqlite3_free(b.zCsv);
+    sqlite3_close(b.db);
+    if (nUnstable) fprintf(stderr, "%d kernel(s) returned different results between reps\n", nUnstable);
+    return rc != SQLITE_OK || nUnstable ? 1 : 0;
+}
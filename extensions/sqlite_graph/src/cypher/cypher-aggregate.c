@@ -0,0 +1,1230 @@
+/*
+** SQLite Graph Database Extension - Hash Aggregation
+**
+** Backs PHYSICAL_AGGREGATION, the operator a RETURN with count(), sum(),
+** avg(), min() or max() items compiles to. Rows are grouped on the other
+** items of the RETURN (pPlan->aAggregate, PLAN_AGG_KEY entries) in an
+** open-addressing table of groups, each holding one typed accumulator
+** (AggState) per aggregate. Output rows hold the items in RETURN order,
+** one row per group in no particular order; without grouping keys there
+** is exactly one row, also over empty input.
+**
+** The source is read a batch of up to AGG_BATCH_ROWS rows at a time:
+** the item operands are staged, then the batch is cut into one range
+** per worker and each worker folds its range into a partial table of
+** its own, so no lock is taken per row. The partial tables are merged
+** once the source is exhausted. Property operands (n.country) are read
+** while staging, on the caller's connection, so they come from the same
+** schema and snapshot as the rows being aggregated; only the folding
+** runs in parallel. Inputs smaller than one batch, and
+** ExecutionContext.nThreads of 1, run on a single worker on the calling
+** thread.
+**
+** Once the partial tables outgrow the budget (ExecutionContext.
+** nSortMemory) their groups are written, as rows of accumulator states,
+** into CYPHER_JOIN_PARTITIONS CypherSorter partitions by key hash and the
+** tables are emptied. Every group then lives in a single partition, and
+** at the end the partitions are merged and emitted one at a time.
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+** Error handling: Functions return SQLite error codes
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "cypher-executor.h"
+#include "cypher-chunk.h"
+#include "cypher-sort.h"
+#include "graph-performance.h"
+#include <string.h>
+#include <assert.h>
+
+/*
+** Rows staged per batch. A batch is the unit of parallel work, so a
+** smaller input never leaves the calling thread.
+*/
+#define AGG_BATCH_ROWS (16 * CYPHER_CHUNK_SIZE)
+
+/* Accumulator of one aggregate in one group */
+typedef struct AggState {
+  sqlite3_int64 nCount;         /* Rows for count(*), else non-NULL inputs */
+  sqlite3_int64 iSum;           /* Integer sum while !bFloat */
+  double rSum;                  /* Float sum: sum() once bFloat, and avg() */
+  int bFloat;                   /* sum() has seen a float or overflowed */
+  CypherValue best;             /* min() and max() so far, NULL before any */
+} AggState;
+
+/* A group: its key values and accumulators, allocated as one block */
+typedef struct AggGroup {
+  sqlite3_uint64 h;             /* Hash of the keys */
+  CypherValue *aKey;            /* nKey key values, owned */
+  AggState *aState;             /* nAgg accumulators */
+} AggGroup;
+
+typedef struct AggSlot {
+  sqlite3_uint64 h;             /* Hash of the group in iGroup */
+  int iGroup;                   /* Index in apGroup, -1 if free */
+} AggSlot;
+
+/* Open-addressing table of groups, kept at most half full */
+typedef struct AggTable {
+  AggSlot *aSlot;               /* nSlot slots, a power of two */
+  int nSlot;                    /* Allocated slots */
+  AggGroup **apGroup;           /* Groups in arrival order */
+  int nGroup;                   /* Groups held */
+  int nGroupAlloc;              /* Allocated apGroup entries */
+  sqlite3_int64 nByte;          /* Approximate bytes of the groups */
+} AggTable;
+
+/*
+** Statements reading the item properties from the caller's connection,
+** prepared on first use: apStmt[2*i] reads item i from a node,
+** apStmt[2*i+1] from a relationship.
+*/
+typedef struct AggLookup {
+  sqlite3 *pDb;                 /* Connection the statements run on */
+  sqlite3_stmt **apStmt;        /* 2*nItem statements, or NULL entries */
+} AggLookup;
+
+typedef struct AggregateData AggregateData;
+
+/* One worker: a partial table and its range of the staged batch */
+typedef struct AggWorker {
+  AggregateData *pAgg;          /* Operator state, read-only in the task */
+  AggTable table;               /* Partial groups of this worker */
+  int iFirst;                   /* First staged row of this task */
+  int iLast;                    /* One past its last staged row */
+  int rc;                       /* First error of the task */
+} AggWorker;
+
+struct AggregateData {
+  CypherIterator *pSource;      /* Source iterator, if created here */
+  const PlanAggregate *aItem;   /* Output items, pPlan->aAggregate */
+  int nItem;                    /* Entries in aItem */
+  int *aiKey;                   /* Items that are grouping keys */
+  int nKey;
+  int *aiAgg;                   /* Items that are aggregates */
+  int nAgg;
+  const char **azName;          /* Interned output column names */
+  char **azPath;                /* JSON path of each item's property, or NULL */
+  GraphColumn **apColumn;       /* Label-less column of that property, or NULL */
+  sqlite3_int64 nMemory;        /* Spill threshold in bytes */
+
+  /* Staged batch: nItem operand values per row */
+  CypherDataChunk *pInput;      /* Source rows */
+  CypherValue *aStage;          /* AGG_BATCH_ROWS * nItem values */
+  int nStage;                   /* Rows staged */
+  int *aiColumn;                /* Source column of each item's variable */
+
+  /* Workers */
+  TaskScheduler *pScheduler;    /* Pool handle, NULL when inline */
+  AggWorker *aWorker;           /* nWorker workers; aWorker[0] always */
+  int nWorker;
+  AggLookup lookup;             /* Caller's connection, for staging */
+
+  /* Spilled partitions and output */
+  CypherSorter **apPart;        /* Partitions, or NULL before a spill */
+  int iPart;                    /* Partition in aWorker[0].table */
+  int iEmit;                    /* Next group of aWorker[0].table to emit */
+};
+
+/*
+** Values.
+*/
+
+/* 64-bit finalizer of the hash join; tables use low bits, partitions high */
+static sqlite3_uint64 aggMix(sqlite3_uint64 h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static sqlite3_uint64 aggHashBytes(const char *z, sqlite3_uint64 h) {
+  if (!z) return h;
+  while (*z) {
+    h ^= (unsigned char)*z++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/*
+** Lists, maps and paths have no cheaper identity than their JSON text.
+** Returns NULL if out of memory.
+*/
+static char *aggValueText(const CypherValue *pValue) {
+  return cypherValueToJson(pValue);
+}
+
+static sqlite3_uint64 aggValueHash(const CypherValue *pValue) {
+  sqlite3_uint64 h = 0xcbf29ce484222325ULL ^ (sqlite3_uint64)pValue->type;
+  char *zText;
+
+  switch (pValue->type) {
+    case CYPHER_VALUE_NULL:
+      return h;
+    case CYPHER_VALUE_BOOLEAN:
+      return aggMix(h + (pValue->u.bBoolean != 0));
+    case CYPHER_VALUE_INTEGER:
+      return aggMix(h + (sqlite3_uint64)pValue->u.iInteger);
+    case CYPHER_VALUE_FLOAT: {
+      sqlite3_uint64 x;
+      double r = pValue->u.rFloat == 0.0 ? 0.0 : pValue->u.rFloat;
+      memcpy(&x, &r, sizeof(x));
+      return aggMix(h + x);
+    }
+    case CYPHER_VALUE_STRING:
+      return aggMix(aggHashBytes(pValue->u.zString, h));
+    case CYPHER_VALUE_NODE:
+      return aggMix(h + (sqlite3_uint64)pValue->u.iNodeId);
+    case CYPHER_VALUE_RELATIONSHIP:
+      return aggMix(h + (sqlite3_uint64)pValue->u.iRelId);
+    default:
+      zText = aggValueText(pValue);
+      h = aggMix(aggHashBytes(zText, h));
+      sqlite3_free(zText);
+      return h;
+  }
+}
+
+/* True if two key values fall in the same group */
+static int aggValueEqual(const CypherValue *pA, const CypherValue *pB) {
+  char *zA, *zB;
+  int bEqual;
+
+  if (pA->type != pB->type) return 0;
+  switch (pA->type) {
+    case CYPHER_VALUE_NULL:
+      return 1;
+    case CYPHER_VALUE_FLOAT:
+      return pA->u.rFloat == pB->u.rFloat;
+    case CYPHER_VALUE_BOOLEAN:
+    case CYPHER_VALUE_INTEGER:
+    case CYPHER_VALUE_STRING:
+    case CYPHER_VALUE_NODE:
+    case CYPHER_VALUE_RELATIONSHIP:
+      return cypherValueCompare(pA, pB) == 0;
+    default:
+      zA = aggValueText(pA);
+      zB = aggValueText(pB);
+      bEqual = zA && zB && strcmp(zA, zB) == 0;
+      sqlite3_free(zA);
+      sqlite3_free(zB);
+      return bEqual;
+  }
+}
+
+/* Heap bytes a value holds beyond its CypherValue, as charged to the budget */
+static sqlite3_int64 aggValueBytes(const CypherValue *pValue) {
+  switch (pValue->type) {
+    case CYPHER_VALUE_STRING:
+      return pValue->u.zString ? (sqlite3_int64)strlen(pValue->u.zString) + 1 : 0;
+    case CYPHER_VALUE_LIST:
+      return pValue->u.list.nValues * (sqlite3_int64)(sizeof(CypherValue) + 16);
+    case CYPHER_VALUE_MAP:
+      return pValue->u.map.nPairs * (sqlite3_int64)(sizeof(CypherValue) + 32);
+    default:
+      return 0;
+  }
+}
+
+/*
+** Order of min() and max(): integers and floats by value, other values
+** of one type by cypherValueCompare(), values of different types by
+** type. NULLs never reach it.
+*/
+static int aggValueCompare(const CypherValue *pA, const CypherValue *pB) {
+  int bNumA = pA->type == CYPHER_VALUE_INTEGER || pA->type == CYPHER_VALUE_FLOAT;
+  int bNumB = pB->type == CYPHER_VALUE_INTEGER || pB->type == CYPHER_VALUE_FLOAT;
+  int c;
+
+  if (bNumA && bNumB && pA->type != pB->type) {
+    double rA = cypherValueGetFloat(pA);
+    double rB = cypherValueGetFloat(pB);
+    return rA < rB ? -1 : rA > rB;
+  }
+  if (pA->type != pB->type) return pA->type < pB->type ? -1 : 1;
+  c = cypherValueCompare(pA, pB);
+  return c == SQLITE_MISMATCH ? 0 : c;
+}
+
+/* Move *pSrc into *pDst, leaving *pSrc NULL */
+static void aggValueMove(CypherValue *pDst, CypherValue *pSrc) {
+  *pDst = *pSrc;
+  memset(pSrc, 0, sizeof(CypherValue));
+}
+
+/*
+** Accumulators.
+*/
+
+/* Add integer iValue to a sum, going to floating point on overflow */
+static void aggSumInteger(AggState *pState, sqlite3_int64 iValue) {
+  if (pState->bFloat) {
+    pState->rSum += (double)iValue;
+  } else if (__builtin_add_overflow(pState->iSum, iValue, &pState->iSum)) {
+    pState->rSum = (double)pState->iSum + (double)iValue;
+    pState->bFloat = 1;
+  }
+}
+
+static void aggSumFloat(AggState *pState, double rValue) {
+  if (!pState->bFloat) {
+    pState->rSum = (double)pState->iSum;
+    pState->bFloat = 1;
+  }
+  pState->rSum += rValue;
+}
+
+/*
+** Keep *pValue in pState->best if it beats it (cmp < 0 for min, > 0 for
+** max), moving it out of *pValue. Returns SQLITE_OK.
+*/
+static int aggKeepBest(AggState *pState, CypherValue *pValue, int eFunc) {
+  int c;
+
+  if (pState->best.type != CYPHER_VALUE_NULL) {
+    c = aggValueCompare(pValue, &pState->best);
+    if (eFunc == PLAN_AGG_MIN ? c >= 0 : c <= 0) return SQLITE_OK;
+  }
+  cypherValueDestroy(&pState->best);
+  aggValueMove(&pState->best, pValue);
+  return SQLITE_OK;
+}
+
+/*
+** Fold one input into pState. *pValue may be moved out of (min and max
+** keep it); the caller destroys what is left. bRow is set for count(*).
+*/
+static int aggStep(AggState *pState, int eFunc, int bRow, CypherValue *pValue) {
+  if (bRow) {
+    pState->nCount++;
+    return SQLITE_OK;
+  }
+  if (pValue->type == CYPHER_VALUE_NULL) return SQLITE_OK;
+
+  switch (eFunc) {
+    case PLAN_AGG_COUNT:
+      pState->nCount++;
+      break;
+    case PLAN_AGG_SUM:
+    case PLAN_AGG_AVG:
+      /* Non-numeric inputs are skipped, as NULLs are */
+      if (pValue->type == CYPHER_VALUE_INTEGER) {
+        if (eFunc == PLAN_AGG_SUM) aggSumInteger(pState, pValue->u.iInteger);
+        else pState->rSum += (double)pValue->u.iInteger;
+      } else if (pValue->type == CYPHER_VALUE_FLOAT) {
+        if (eFunc == PLAN_AGG_SUM) aggSumFloat(pState, pValue->u.rFloat);
+        else pState->rSum += pValue->u.rFloat;
+      } else {
+        break;
+      }
+      pState->nCount++;
+      break;
+    case PLAN_AGG_MIN:
+    case PLAN_AGG_MAX:
+      pState->nCount++;
+      return aggKeepBest(pState, pValue, eFunc);
+  }
+  return SQLITE_OK;
+}
+
+/* Merge pSrc into pDst, emptying pSrc */
+static void aggMerge(AggState *pDst, AggState *pSrc, int eFunc) {
+  switch (eFunc) {
+    case PLAN_AGG_SUM:
+      if (pSrc->bFloat) {
+        aggSumFloat(pDst, pSrc->rSum);
+      } else {
+        aggSumInteger(pDst, pSrc->iSum);
+      }
+      break;
+    case PLAN_AGG_AVG:
+      pDst->rSum += pSrc->rSum;
+      break;
+    case PLAN_AGG_MIN:
+    case PLAN_AGG_MAX:
+      if (pSrc->best.type != CYPHER_VALUE_NULL) aggKeepBest(pDst, &pSrc->best, eFunc);
+      cypherValueDestroy(&pSrc->best);
+      memset(&pSrc->best, 0, sizeof(CypherValue));
+      break;
+  }
+  pDst->nCount += pSrc->nCount;
+}
+
+/* The aggregate's result, moving min() and max() out of pState */
+static void aggFinal(AggState *pState, int eFunc, CypherValue *pResult) {
+  memset(pResult, 0, sizeof(CypherValue));
+  switch (eFunc) {
+    case PLAN_AGG_COUNT:
+      cypherValueSetInteger(pResult, pState->nCount);
+      break;
+    case PLAN_AGG_SUM:
+      if (pState->bFloat) {
+        cypherValueSetFloat(pResult, pState->rSum);
+      } else {
+        cypherValueSetInteger(pResult, pState->iSum);
+      }
+      break;
+    case PLAN_AGG_AVG:
+      if (pState->nCount > 0) {
+        cypherValueSetFloat(pResult, pState->rSum / (double)pState->nCount);
+      }
+      break;
+    case PLAN_AGG_MIN:
+    case PLAN_AGG_MAX:
+      aggValueMove(pResult, &pState->best);
+      break;
+  }
+}
+
+/*
+** Spilled state of an aggregate: a primary value, and for sum() and
+** avg() the input count. sum() keeps its integer or float total.
+*/
+static void aggEncode(AggState *pState, int eFunc, CypherValue *pPrimary,
+                      CypherValue *pCount) {
+  memset(pPrimary, 0, sizeof(CypherValue));
+  memset(pCount, 0, sizeof(CypherValue));
+  cypherValueSetInteger(pCount, pState->nCount);
+  switch (eFunc) {
+    case PLAN_AGG_COUNT:
+      cypherValueSetInteger(pPrimary, pState->nCount);
+      break;
+    case PLAN_AGG_SUM:
+      if (pState->bFloat) {
+        cypherValueSetFloat(pPrimary, pState->rSum);
+      } else {
+        cypherValueSetInteger(pPrimary, pState->iSum);
+      }
+      break;
+    case PLAN_AGG_AVG:
+      cypherValueSetFloat(pPrimary, pState->rSum);
+      break;
+    case PLAN_AGG_MIN:
+    case PLAN_AGG_MAX:
+      aggValueMove(pPrimary, &pState->best);
+      break;
+  }
+}
+
+/* Merge a state written by aggEncode() into pState */
+static void aggDecodeMerge(AggState *pState, int eFunc, CypherValue *pPrimary,
+                           CypherValue *pCount) {
+  AggState src;
+
+  memset(&src, 0, sizeof(src));
+  src.nCount = pCount->type == CYPHER_VALUE_INTEGER ? pCount->u.iInteger : 0;
+  if (pPrimary->type == CYPHER_VALUE_FLOAT) {
+    src.rSum = pPrimary->u.rFloat;
+    src.bFloat = 1;
+  } else if (pPrimary->type == CYPHER_VALUE_INTEGER) {
+    src.iSum = pPrimary->u.iInteger;
+  }
+  if (eFunc == PLAN_AGG_MIN || eFunc == PLAN_AGG_MAX) {
+    aggValueMove(&src.best, pPrimary);
+  }
+  aggMerge(pState, &src, eFunc);
+}
+
+/*
+** Group tables.
+*/
+
+static sqlite3_uint64 aggKeyHash(CypherValue *aKey, int nKey) {
+  sqlite3_uint64 h = 0x9e3779b97f4a7c15ULL;
+  int i;
+
+  for (i = 0; i < nKey; i++) h = aggMix(h ^ aggValueHash(&aKey[i])) + i;
+  return h;
+}
+
+static int aggKeyEqual(const AggGroup *pGroup, const CypherValue *aKey, int nKey) {
+  int i;
+
+  for (i = 0; i < nKey; i++) {
+    if (!aggValueEqual(&pGroup->aKey[i], &aKey[i])) return 0;
+  }
+  return 1;
+}
+
+/* Slot of the group with keys aKey, or of the free slot where it would go */
+static AggSlot *aggTableSlot(AggTable *pTable, sqlite3_uint64 h,
+                             const CypherValue *aKey, int nKey) {
+  int i = (int)(h & (sqlite3_uint64)(pTable->nSlot - 1));
+
+  while (pTable->aSlot[i].iGroup >= 0) {
+    AggSlot *pSlot = &pTable->aSlot[i];
+    if (pSlot->h == h && aggKeyEqual(pTable->apGroup[pSlot->iGroup], aKey, nKey)) break;
+    i = (i + 1) & (pTable->nSlot - 1);
+  }
+  return &pTable->aSlot[i];
+}
+
+static int aggTableGrow(AggTable *pTable) {
+  int nNew = pTable->nSlot ? pTable->nSlot * 2 : 64;
+  AggSlot *aNew;
+  int i;
+
+  aNew = sqlite3_malloc64(nNew * sizeof(AggSlot));
+  if (!aNew) return SQLITE_NOMEM;
+  for (i = 0; i < nNew; i++) aNew[i].iGroup = -1;
+  for (i = 0; i < pTable->nSlot; i++) {
+    AggSlot *pSlot = &pTable->aSlot[i];
+    if (pSlot->iGroup >= 0) {
+      int j = (int)(pSlot->h & (sqlite3_uint64)(nNew - 1));
+      while (aNew[j].iGroup >= 0) j = (j + 1) & (nNew - 1);
+      aNew[j] = *pSlot;
+    }
+  }
+  sqlite3_free(pTable->aSlot);
+  pTable->aSlot = aNew;
+  pTable->nSlot = nNew;
+  return SQLITE_OK;
+}
+
+/*
+** Find the group with keys aKey, creating it if it does not exist. The
+** keys of a new group are moved out of aKey.
+*/
+static int aggTableFind(AggTable *pTable, int nKey, int nAgg, sqlite3_uint64 h,
+                        CypherValue *aKey, AggGroup **ppGroup) {
+  AggGroup *pGroup;
+  AggSlot *pSlot;
+  sqlite3_int64 nByte;
+  int i;
+
+  if ((pTable->nGroup + 1) * 2 > pTable->nSlot && aggTableGrow(pTable) != SQLITE_OK) {
+    return SQLITE_NOMEM;
+  }
+  pSlot = aggTableSlot(pTable, h, aKey, nKey);
+  if (pSlot->iGroup >= 0) {
+    *ppGroup = pTable->apGroup[pSlot->iGroup];
+    return SQLITE_OK;
+  }
+
+  if (pTable->nGroup >= pTable->nGroupAlloc) {
+    int nNew = pTable->nGroupAlloc ? pTable->nGroupAlloc * 2 : 64;
+    AggGroup **apNew = sqlite3_realloc64(pTable->apGroup, nNew * sizeof(AggGroup*));
+    if (!apNew) return SQLITE_NOMEM;
+    pTable->apGroup = apNew;
+    pTable->nGroupAlloc = nNew;
+  }
+  nByte = sizeof(AggGroup) + nKey * sizeof(CypherValue) + nAgg * sizeof(AggState);
+  pGroup = sqlite3_malloc64(nByte);
+  if (!pGroup) return SQLITE_NOMEM;
+  memset(pGroup, 0, nByte);
+  pGroup->h = h;
+  pGroup->aKey = (CypherValue*)&pGroup[1];
+  pGroup->aState = (AggState*)&pGroup->aKey[nKey];
+  for (i = 0; i < nKey; i++) {
+    aggValueMove(&pGroup->aKey[i], &aKey[i]);
+    nByte += aggValueBytes(&pGroup->aKey[i]);
+  }
+
+  pSlot->h = h;
+  pSlot->iGroup = pTable->nGroup;
+  pTable->apGroup[pTable->nGroup++] = pGroup;
+  pTable->nByte += nByte + 2 * sizeof(AggSlot) + sizeof(AggGroup*);
+  *ppGroup = pGroup;
+  return SQLITE_OK;
+}
+
+static void aggGroupFree(AggGroup *pGroup, int nKey, int nAgg) {
+  int i;
+
+  if (!pGroup) return;
+  for (i = 0; i < nKey; i++) cypherValueDestroy(&pGroup->aKey[i]);
+  for (i = 0; i < nAgg; i++) cypherValueDestroy(&pGroup->aState[i].best);
+  sqlite3_free(pGroup);
+}
+
+/* Free the groups, keeping the slot array for reuse */
+static void aggTableClear(AggTable *pTable, int nKey, int nAgg) {
+  int i;
+
+  for (i = 0; i < pTable->nGroup; i++) aggGroupFree(pTable->apGroup[i], nKey, nAgg);
+  for (i = 0; i < pTable->nSlot; i++) pTable->aSlot[i].iGroup = -1;
+  pTable->nGroup = 0;
+  pTable->nByte = 0;
+}
+
+static void aggTableFree(AggTable *pTable, int nKey, int nAgg) {
+  aggTableClear(pTable, nKey, nAgg);
+  sqlite3_free(pTable->aSlot);
+  sqlite3_free(pTable->apGroup);
+  memset(pTable, 0, sizeof(AggTable));
+}
+
+/*
+** Property lookups.
+*/
+
+static void aggLookupClose(AggLookup *pLookup, int nItem) {
+  int i;
+
+  if (pLookup->apStmt) {
+    for (i = 0; i < 2 * nItem; i++) sqlite3_finalize(pLookup->apStmt[i]);
+    sqlite3_free(pLookup->apStmt);
+  }
+  memset(pLookup, 0, sizeof(AggLookup));
+}
+
+/* Read the value of the sqlite3 column iCol of pStmt into *pValue */
+static int aggColumnValue(sqlite3_stmt *pStmt, int iCol, CypherValue *pValue) {
+  memset(pValue, 0, sizeof(CypherValue));
+  switch (sqlite3_column_type(pStmt, iCol)) {
+    case SQLITE_INTEGER:
+      cypherValueSetInteger(pValue, sqlite3_column_int64(pStmt, iCol));
+      return SQLITE_OK;
+    case SQLITE_FLOAT:
+      cypherValueSetFloat(pValue, sqlite3_column_double(pStmt, iCol));
+      return SQLITE_OK;
+    case SQLITE_TEXT:
+      return cypherValueSetString(pValue, (const char*)sqlite3_column_text(pStmt, iCol));
+    default:
+      return SQLITE_OK;
+  }
+}
+
+/*
+** Replace the node or relationship in *pValue by the value of item
+** iItem's property, NULL if it has none. Other values become NULL.
+*/
+static int aggLookupProperty(AggregateData *pAgg, AggLookup *pLookup,
+                             GraphVtab *pGraph, int iItem, CypherValue *pValue) {
+  sqlite3_stmt **ppStmt;
+  sqlite3_int64 iId;
+  int bRel, rc;
+
+  if (pValue->type != CYPHER_VALUE_NODE && pValue->type != CYPHER_VALUE_RELATIONSHIP) {
+    cypherValueDestroy(pValue);
+    memset(pValue, 0, sizeof(CypherValue));
+    return SQLITE_OK;
+  }
+  bRel = pValue->type == CYPHER_VALUE_RELATIONSHIP;
+  iId = bRel ? pValue->u.iRelId : pValue->u.iNodeId;
+  memset(pValue, 0, sizeof(CypherValue));
+
+  if (!pLookup->apStmt) {
+    int nByte = 2 * pAgg->nItem * sizeof(sqlite3_stmt*);
+    pLookup->apStmt = sqlite3_malloc(nByte);
+    if (!pLookup->apStmt) return SQLITE_NOMEM;
+    memset(pLookup->apStmt, 0, nByte);
+  }
+  ppStmt = &pLookup->apStmt[2 * iItem + bRel];
+  if (!*ppStmt) {
+    char *zSql = sqlite3_mprintf("SELECT json_extract(%s, ?2) FROM \"%w\" WHERE id = ?1",
+                                 graphPropsExpr(pGraph),
+                                 bRel ? pGraph->zEdgeTableName : pGraph->zNodeTableName);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pLookup->pDb, zSql, -1, ppStmt, 0);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) return rc;
+    sqlite3_bind_text(*ppStmt, 2, pAgg->azPath[iItem], -1, SQLITE_STATIC);
+  }
+
+  sqlite3_bind_int64(*ppStmt, 1, iId);
+  rc = sqlite3_step(*ppStmt);
+  if (rc == SQLITE_ROW) {
+    rc = aggColumnValue(*ppStmt, 0, pValue);
+    sqlite3_reset(*ppStmt);
+    return rc;
+  }
+  rc = sqlite3_reset(*ppStmt);
+  return rc;
+}
+
+/*
+** Folding.
+*/
+
+/* Fold staged rows [iFirst, iLast) into pTable */
+static int aggFoldRows(AggregateData *pAgg, AggTable *pTable, int iFirst, int iLast) {
+  CypherValue aKey[16];
+  CypherValue *aKeyBuf = aKey;
+  int r, i, rc = SQLITE_OK;
+
+  if (pAgg->nKey > (int)(sizeof(aKey) / sizeof(aKey[0]))) {
+    aKeyBuf = sqlite3_malloc64(pAgg->nKey * sizeof(CypherValue));
+    if (!aKeyBuf) return SQLITE_NOMEM;
+  }
+
+  for (r = iFirst; rc == SQLITE_OK && r < iLast; r++) {
+    CypherValue *aRow = &pAgg->aStage[(sqlite3_int64)r * pAgg->nItem];
+    AggGroup *pGroup;
+
+    for (i = 0; i < pAgg->nKey; i++) aggValueMove(&aKeyBuf[i], &aRow[pAgg->aiKey[i]]);
+    rc = aggTableFind(pTable, pAgg->nKey, pAgg->nAgg,
+                      aggKeyHash(aKeyBuf, pAgg->nKey), aKeyBuf, &pGroup);
+    for (i = 0; i < pAgg->nKey; i++) cypherValueDestroy(&aKeyBuf[i]);
+    if (rc != SQLITE_OK) break;
+
+    for (i = 0; rc == SQLITE_OK && i < pAgg->nAgg; i++) {
+      const PlanAggregate *pItem = &pAgg->aItem[pAgg->aiAgg[i]];
+      CypherValue *pValue = &aRow[pAgg->aiAgg[i]];
+      AggState *pState = &pGroup->aState[i];
+      int bBest = pItem->eFunc == PLAN_AGG_MIN || pItem->eFunc == PLAN_AGG_MAX;
+      sqlite3_int64 nBefore = bBest ? aggValueBytes(&pState->best) : 0;
+
+      rc = aggStep(pState, pItem->eFunc, pItem->zVariable == NULL, pValue);
+      if (bBest) pTable->nByte += aggValueBytes(&pState->best) - nBefore;
+    }
+  }
+
+  if (aKeyBuf != aKey) sqlite3_free(aKeyBuf);
+  return rc;
+}
+
+/* Task body: fold one worker's range of the staged batch */
+static void aggWorkerTask(void *pArg) {
+  AggWorker *pWorker = (AggWorker*)pArg;
+
+  if (pWorker->rc != SQLITE_OK) return;
+  pWorker->rc = aggFoldRows(pWorker->pAgg, &pWorker->table,
+                            pWorker->iFirst, pWorker->iLast);
+}
+
+/*
+** Operator.
+*/
+
+static CypherIterator *aggSource(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  if (pAgg->pSource) return pAgg->pSource;
+  return pIterator->nChildren > 0 ? pIterator->apChildren[0] : NULL;
+}
+
+static void aggClearStage(AggregateData *pAgg) {
+  sqlite3_int64 i, n = (sqlite3_int64)pAgg->nStage * pAgg->nItem;
+
+  for (i = 0; i < n; i++) {
+    cypherValueDestroy(&pAgg->aStage[i]);
+    memset(&pAgg->aStage[i], 0, sizeof(CypherValue));
+  }
+  pAgg->nStage = 0;
+}
+
+/* Index of the column named zName in pChunk, or -1 */
+static int aggChunkColumn(CypherDataChunk *pChunk, const char *zName) {
+  int i;
+
+  for (i = 0; i < pChunk->nCol; i++) {
+    if (strcmp(pChunk->aCol[i].zName, zName) == 0) return i;
+  }
+  return -1;
+}
+
+/*
+** Replace the node in *pValue by its value in column pCol. Returns 0,
+** leaving *pValue alone, if the column does not cover the node.
+*/
+static int aggColumnRead(GraphVtab *pGraph, GraphColumn *pCol,
+                         CypherValue *pValue, int *pRc) {
+  sqlite3_int64 iVal = 0;
+  double rVal = 0.0;
+  const char *zVal = NULL;
+  int nVal = 0, eType;
+
+  if (pValue->type != CYPHER_VALUE_NODE) return 0;
+  eType = graphColumnRead(pGraph, pCol, pValue->u.iNodeId, &iVal, &rVal, &zVal, &nVal);
+  if (eType == 0) return 0;
+  memset(pValue, 0, sizeof(CypherValue));
+  switch (eType) {
+    case SQLITE_INTEGER: cypherValueSetInteger(pValue, iVal); break;
+    case SQLITE_FLOAT:   cypherValueSetFloat(pValue, rVal); break;
+    case SQLITE_TEXT:    *pRc = cypherValueSetString(pValue, zVal); break;
+  }
+  return 1;
+}
+
+/*
+** Stage the operands of the live rows of pAgg->pInput: the variable's
+** value, or the value of its property, read from the property's current
+** column where it covers the node and otherwise looked up.
+*/
+static int aggStageChunk(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  ExecutionContext *pContext = pIterator->pContext;
+  CypherDataChunk *pInput = pAgg->pInput;
+  GraphColumn *apCol[16];
+  int i, j, rc = SQLITE_OK;
+
+  for (j = 0; j < pAgg->nItem; j++) {
+    pAgg->aiColumn[j] = -1;
+    if (pAgg->aItem[j].zVariable) {
+      pAgg->aiColumn[j] = aggChunkColumn(pInput, pAgg->aItem[j].zVariable);
+    }
+    /* Writes between chunks may have made the column stale */
+    if (j < (int)(sizeof(apCol) / sizeof(apCol[0]))) {
+      apCol[j] = NULL;
+      if (pAgg->apColumn[j]) {
+        rc = graphColumnGet(pContext->pGraph, NULL, pAgg->aItem[j].zProperty, 0, &apCol[j]);
+        if (rc != SQLITE_OK) return rc;
+      }
+    }
+  }
+
+  for (i = 0; rc == SQLITE_OK && i < pInput->nSel; i++) {
+    int iRow = cypherChunkRow(pInput, i);
+    CypherValue *aRow = &pAgg->aStage[(sqlite3_int64)pAgg->nStage * pAgg->nItem];
+
+    for (j = 0; rc == SQLITE_OK && j < pAgg->nItem; j++) {
+      const PlanAggregate *pItem = &pAgg->aItem[j];
+      const CypherValue *pSrc = NULL;
+      CypherValue tmp;
+
+      if (!pItem->zVariable) continue;
+      if (pAgg->aiColumn[j] >= 0) {
+        pSrc = cypherChunkValue(pInput, pAgg->aiColumn[j], iRow, &tmp);
+      } else {
+        pSrc = executionContextGet(pContext, pItem->zVariable);
+      }
+      if (!pSrc) continue;
+      if (cypherValueCopyIn(0, &aRow[j], pSrc)) rc = SQLITE_NOMEM;
+      if (rc == SQLITE_OK && pAgg->apColumn[j]) {
+        GraphColumn *pCol = j < (int)(sizeof(apCol) / sizeof(apCol[0])) ? apCol[j] : NULL;
+        if (pCol && aggColumnRead(pContext->pGraph, pCol, &aRow[j], &rc)) continue;
+        pContext->counters.nStep++;
+        rc = aggLookupProperty(pAgg, &pAgg->lookup, pContext->pGraph, j, &aRow[j]);
+      } else if (rc == SQLITE_OK && pAgg->azPath[j]) {
+        pContext->counters.nStep++;
+        rc = aggLookupProperty(pAgg, &pAgg->lookup, pContext->pGraph, j, &aRow[j]);
+      }
+    }
+    pAgg->nStage++;
+  }
+  return rc;
+}
+
+/*
+** Read up to AGG_BATCH_ROWS source rows into the stage. Sets *pbEof
+** once the source is exhausted.
+*/
+static int aggStageBatch(CypherIterator *pIterator, int *pbEof) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  CypherIterator *pSource = aggSource(pIterator);
+  int rc = SQLITE_OK;
+
+  *pbEof = 0;
+  while (pAgg->nStage + CYPHER_CHUNK_SIZE <= AGG_BATCH_ROWS) {
+    rc = cypherIteratorNextBatch(pSource, pAgg->pInput);
+    if (rc == SQLITE_DONE) {
+      *pbEof = 1;
+      return SQLITE_OK;
+    }
+    if (rc == SQLITE_OK) rc = aggStageChunk(pIterator);
+    if (rc != SQLITE_OK) return rc;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Called once the first batch is full: take workers from the pool
+** unless the context asks for a single thread.
+*/
+static int aggStartWorkers(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  int nThreads = pIterator->pContext->nThreads;
+  AggWorker *aNew;
+  int i;
+
+  if (nThreads == 1) return SQLITE_OK;
+  pAgg->pScheduler = graphCreateTaskScheduler(nThreads);
+  if (!pAgg->pScheduler) return SQLITE_NOMEM;
+  if (pAgg->pScheduler->nThreads <= 1) {
+    graphDestroyTaskScheduler(pAgg->pScheduler);
+    pAgg->pScheduler = NULL;
+    return SQLITE_OK;
+  }
+
+  aNew = sqlite3_realloc64(pAgg->aWorker, pAgg->pScheduler->nThreads * sizeof(AggWorker));
+  if (!aNew) return SQLITE_NOMEM;
+  pAgg->aWorker = aNew;
+  for (i = pAgg->nWorker; i < pAgg->pScheduler->nThreads; i++) {
+    memset(&aNew[i], 0, sizeof(AggWorker));
+    aNew[i].pAgg = pAgg;
+  }
+  pAgg->nWorker = pAgg->pScheduler->nThreads;
+  return SQLITE_OK;
+}
+
+/* Fold the staged batch, split evenly across the workers */
+static int aggFoldBatch(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  void *apTask[64];
+  void **apArg = apTask;
+  int i, nTask, rc;
+
+  if (pAgg->nStage == 0) return SQLITE_OK;
+  if (!pAgg->pScheduler) {
+    return aggFoldRows(pAgg, &pAgg->aWorker[0].table, 0, pAgg->nStage);
+  }
+
+  nTask = pAgg->nWorker;
+  if (nTask > (int)(sizeof(apTask) / sizeof(apTask[0]))) {
+    apArg = sqlite3_malloc64(nTask * sizeof(void*));
+    if (!apArg) return SQLITE_NOMEM;
+  }
+  for (i = 0; i < nTask; i++) {
+    AggWorker *pWorker = &pAgg->aWorker[i];
+    pWorker->iFirst = (int)((sqlite3_int64)pAgg->nStage * i / nTask);
+    pWorker->iLast = (int)((sqlite3_int64)pAgg->nStage * (i + 1) / nTask);
+    apArg[i] = pWorker;
+  }
+  rc = graphRunTasks(pAgg->pScheduler, aggWorkerTask, apArg, nTask);
+  for (i = 0; rc == SQLITE_OK && i < nTask; i++) rc = pAgg->aWorker[i].rc;
+  if (apArg != apTask) sqlite3_free(apArg);
+  return rc;
+}
+
+static void aggFreePartitions(AggregateData *pAgg) {
+  int i;
+
+  if (!pAgg->apPart) return;
+  for (i = 0; i < CYPHER_JOIN_PARTITIONS; i++) cypherSorterFree(pAgg->apPart[i]);
+  sqlite3_free(pAgg->apPart);
+  pAgg->apPart = NULL;
+}
+
+/*
+** Write the groups of every worker's table to the partitions as state
+** rows (keys, then a primary value and a count per aggregate) and empty
+** the tables.
+*/
+static int aggSpill(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  sqlite3_int64 nPartMemory = pAgg->nMemory / CYPHER_JOIN_PARTITIONS;
+  int w, g, i, rc = SQLITE_OK;
+
+  if (!pAgg->apPart) {
+    int nByte = CYPHER_JOIN_PARTITIONS * sizeof(CypherSorter*);
+    pAgg->apPart = sqlite3_malloc(nByte);
+    if (!pAgg->apPart) return SQLITE_NOMEM;
+    memset(pAgg->apPart, 0, nByte);
+    if (nPartMemory < 1) nPartMemory = 1;
+    for (i = 0; rc == SQLITE_OK && i < CYPHER_JOIN_PARTITIONS; i++) {
+      rc = cypherSorterCreate(pIterator->pContext->pDb, 0, NULL, 0, nPartMemory,
+                              &pAgg->apPart[i]);
+    }
+    if (rc != SQLITE_OK) return rc;
+  }
+
+  for (w = 0; rc == SQLITE_OK && w < pAgg->nWorker; w++) {
+    AggTable *pTable = &pAgg->aWorker[w].table;
+    for (g = 0; rc == SQLITE_OK && g < pTable->nGroup; g++) {
+      AggGroup *pGroup = pTable->apGroup[g];
+      CypherResult *pRow = cypherResultCreate();
+      if (!pRow) {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      for (i = 0; rc == SQLITE_OK && i < pAgg->nKey; i++) {
+        rc = cypherResultAddColumn(pRow, pAgg->azName[pAgg->aiKey[i]], &pGroup->aKey[i]);
+      }
+      for (i = 0; rc == SQLITE_OK && i < pAgg->nAgg; i++) {
+        const char *zName = pAgg->azName[pAgg->aiAgg[i]];
+        CypherValue primary, count;
+        aggEncode(&pGroup->aState[i], pAgg->aItem[pAgg->aiAgg[i]].eFunc, &primary, &count);
+        rc = cypherResultAddColumn(pRow, zName, &primary);
+        if (rc == SQLITE_OK) rc = cypherResultAddColumn(pRow, zName, &count);
+        cypherValueDestroy(&primary);
+      }
+      if (rc == SQLITE_OK) {
+        rc = cypherSorterAdd(pAgg->apPart[(pGroup->h >> 32) % CYPHER_JOIN_PARTITIONS],
+                             NULL, pRow);
+      } else {
+        cypherResultDestroy(pRow);
+      }
+    }
+    aggTableClear(pTable, pAgg->nKey, pAgg->nAgg);
+  }
+  return rc;
+}
+
+/*
+** Merge the state rows of the next partition into aWorker[0].table.
+** Returns SQLITE_DONE after the last partition.
+*/
+static int aggNextPartition(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  AggTable *pTable = &pAgg->aWorker[0].table;
+  CypherResult *pRow;
+  int i, rc = SQLITE_OK;
+
+  aggTableClear(pTable, pAgg->nKey, pAgg->nAgg);
+  pAgg->iEmit = 0;
+  if (++pAgg->iPart >= CYPHER_JOIN_PARTITIONS) return SQLITE_DONE;
+
+  pRow = cypherResultCreate();
+  if (!pRow) return SQLITE_NOMEM;
+  while (rc == SQLITE_OK) {
+    AggGroup *pGroup;
+
+    cypherResultClear(pRow);
+    rc = cypherSorterNext(pAgg->apPart[pAgg->iPart], pRow);
+    if (rc != SQLITE_OK) break;
+    if (pRow->nColumns != pAgg->nKey + 2 * pAgg->nAgg) {
+      rc = SQLITE_CORRUPT;
+      break;
+    }
+    rc = aggTableFind(pTable, pAgg->nKey, pAgg->nAgg,
+                      aggKeyHash(pRow->aValues, pAgg->nKey), pRow->aValues, &pGroup);
+    for (i = 0; rc == SQLITE_OK && i < pAgg->nAgg; i++) {
+      CypherValue *pState = &pRow->aValues[pAgg->nKey + 2 * i];
+      aggDecodeMerge(&pGroup->aState[i], pAgg->aItem[pAgg->aiAgg[i]].eFunc,
+                     &pState[0], &pState[1]);
+    }
+  }
+  cypherResultDestroy(pRow);
+  if (rc != SQLITE_DONE) return rc;
+
+  cypherSorterFree(pAgg->apPart[pAgg->iPart]);
+  pAgg->apPart[pAgg->iPart] = NULL;
+  return SQLITE_OK;
+}
+
+/* Merge the partial tables of workers 1.. into that of worker 0 */
+static int aggMergeWorkers(AggregateData *pAgg) {
+  AggTable *pDst = &pAgg->aWorker[0].table;
+  int w, g, i, rc = SQLITE_OK;
+
+  for (w = 1; rc == SQLITE_OK && w < pAgg->nWorker; w++) {
+    AggTable *pSrc = &pAgg->aWorker[w].table;
+    for (g = 0; rc == SQLITE_OK && g < pSrc->nGroup; g++) {
+      AggGroup *pFrom = pSrc->apGroup[g];
+      AggGroup *pTo;
+      rc = aggTableFind(pDst, pAgg->nKey, pAgg->nAgg, pFrom->h, pFrom->aKey, &pTo);
+      for (i = 0; rc == SQLITE_OK && i < pAgg->nAgg; i++) {
+        aggMerge(&pTo->aState[i], &pFrom->aState[i], pAgg->aItem[pAgg->aiAgg[i]].eFunc);
+      }
+    }
+    aggTableClear(pSrc, pAgg->nKey, pAgg->nAgg);
+  }
+  return rc;
+}
+
+/* Drop the groups, partitions and stage of the previous open */
+static void aggReset(AggregateData *pAgg) {
+  int i;
+
+  aggClearStage(pAgg);
+  aggFreePartitions(pAgg);
+  for (i = 0; i < pAgg->nWorker; i++) {
+    aggTableClear(&pAgg->aWorker[i].table, pAgg->nKey, pAgg->nAgg);
+    pAgg->aWorker[i].rc = SQLITE_OK;
+  }
+  pAgg->iPart = 0;
+  pAgg->iEmit = 0;
+}
+
+static int aggregateOpen(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  CypherIterator *pSource = aggSource(pIterator);
+  int bEof = 0;
+  int i, rc;
+
+  if (!pSource) return SQLITE_ERROR;
+  aggReset(pAgg);
+  if (!pAgg->lookup.pDb) pAgg->lookup.pDb = pIterator->pContext->pDb;
+
+  /* Build the label-less columns of property operands, if declared */
+  for (i = 0; i < pAgg->nItem; i++) {
+    pAgg->apColumn[i] = NULL;
+    if (pAgg->azPath[i] && pIterator->pContext->pGraph) {
+      rc = graphColumnGet(pIterator->pContext->pGraph, NULL, pAgg->aItem[i].zProperty,
+                          1, &pAgg->apColumn[i]);
+      if (rc != SQLITE_OK) return rc;
+    }
+  }
+
+  rc = pSource->xOpen(pSource);
+  if (rc != SQLITE_OK) return rc;
+  pIterator->bOpened = 1;
+
+  while (!bEof) {
+    rc = aggStageBatch(pIterator, &bEof);
+    if (rc == SQLITE_OK && !bEof && !pAgg->pScheduler && pAgg->nWorker == 1) {
+      /* A full batch: the input is large enough to split */
+      rc = aggStartWorkers(pIterator);
+    }
+    if (rc == SQLITE_OK) rc = aggFoldBatch(pIterator);
+    aggClearStage(pAgg);
+    if (rc == SQLITE_OK) {
+      sqlite3_int64 nByte = 0;
+      for (i = 0; i < pAgg->nWorker; i++) nByte += pAgg->aWorker[i].table.nByte;
+      if (nByte > pAgg->nMemory) rc = aggSpill(pIterator);
+    }
+    if (rc != SQLITE_OK) return rc;
+  }
+
+  if (pAgg->apPart) {
+    rc = aggSpill(pIterator);
+    for (i = 0; rc == SQLITE_OK && i < CYPHER_JOIN_PARTITIONS; i++) {
+      rc = cypherSorterFinish(pAgg->apPart[i]);
+    }
+    if (rc != SQLITE_OK) return rc;
+    pAgg->iPart = -1;
+    rc = aggNextPartition(pIterator);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+  }
+
+  rc = aggMergeWorkers(pAgg);
+  if (rc == SQLITE_OK && pAgg->nKey == 0 && pAgg->aWorker[0].table.nGroup == 0) {
+    /* Aggregates without grouping keys return one row for no input */
+    AggGroup *pGroup;
+    rc = aggTableFind(&pAgg->aWorker[0].table, 0, pAgg->nAgg, aggKeyHash(NULL, 0),
+                      NULL, &pGroup);
+  }
+  return rc;
+}
+
+static int aggregateNext(CypherIterator *pIterator, CypherResult *pResult) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  AggTable *pTable = &pAgg->aWorker[0].table;
+  AggGroup *pGroup;
+  int i, iKey = 0, iAgg = 0, rc = SQLITE_OK;
+
+  while (pAgg->iEmit >= pTable->nGroup) {
+    if (!pAgg->apPart) return SQLITE_DONE;
+    rc = aggNextPartition(pIterator);
+    if (rc != SQLITE_OK) return rc;
+  }
+
+  pGroup = pTable->apGroup[pAgg->iEmit++];
+  for (i = 0; rc == SQLITE_OK && i < pAgg->nItem; i++) {
+    CypherValue value;
+    if (pAgg->aItem[i].eFunc == PLAN_AGG_KEY) {
+      aggValueMove(&value, &pGroup->aKey[iKey++]);
+    } else {
+      aggFinal(&pGroup->aState[iAgg], pAgg->aItem[pAgg->aiAgg[iAgg]].eFunc, &value);
+      iAgg++;
+    }
+    rc = cypherResultTakeColumn(pResult, pAgg->azName[i], &value);
+    if (rc != SQLITE_OK) cypherValueDestroy(&value);
+  }
+  if (rc == SQLITE_OK) pIterator->nRowsProduced++;
+  return rc;
+}
+
+static int aggregateClose(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  CypherIterator *pSource = aggSource(pIterator);
+
+  aggReset(pAgg);
+  cypherChunkReset(pAgg->pInput);
+  pIterator->bOpened = 0;
+  return pSource ? pSource->xClose(pSource) : SQLITE_OK;
+}
+
+static void aggregateDestroy(CypherIterator *pIterator) {
+  AggregateData *pAgg = (AggregateData*)pIterator->pIterData;
+  int i;
+
+  if (!pAgg) return;
+  aggReset(pAgg);
+  for (i = 0; i < pAgg->nWorker; i++) {
+    aggTableFree(&pAgg->aWorker[i].table, pAgg->nKey, pAgg->nAgg);
+  }
+  aggLookupClose(&pAgg->lookup, pAgg->nItem);
+  if (pAgg->pScheduler) graphDestroyTaskScheduler(pAgg->pScheduler);
+  cypherIteratorDestroy(pAgg->pSource);
+  cypherChunkFree(pAgg->pInput);
+  if (pAgg->azPath) {
+    for (i = 0; i < pAgg->nItem; i++) sqlite3_free(pAgg->azPath[i]);
+  }
+  sqlite3_free(pAgg->azPath);
+  sqlite3_free(pAgg->apColumn);
+  sqlite3_free((void*)pAgg->azName);
+  sqlite3_free(pAgg->aStage);
+  sqlite3_free(pAgg->aiColumn);
+  sqlite3_free(pAgg->aiKey);
+  sqlite3_free(pAgg->aWorker);
+  sqlite3_free(pAgg);
+}
+
+CypherIterator *cypherAggregationCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator;
+  AggregateData *pAgg;
+  int nItem, i;
+
+  if (!pPlan || (!pPlan->pChild && pPlan->nChildren == 0)) return NULL;
+  if (pPlan->nAggregate <= 0 || !pPlan->aAggregate) return NULL;
+  nItem = pPlan->nAggregate;
+
+  pIterator = sqlite3_malloc(sizeof(CypherIterator));
+  pAgg = sqlite3_malloc(sizeof(AggregateData));
+  if (!pIterator || !pAgg) {
+    sqlite3_free(pIterator);
+    sqlite3_free(pAgg);
+    return NULL;
+  }
+  memset(pIterator, 0, sizeof(CypherIterator));
+  memset(pAgg, 0, sizeof(AggregateData));
+  pIterator->pIterData = pAgg;
+
+  pAgg->aItem = pPlan->aAggregate;
+  pAgg->nItem = nItem;
+  pAgg->nMemory = pContext->nSortMemory > 0 ? pContext->nSortMemory : CYPHER_SORT_MEMORY;
+  pAgg->aiKey = sqlite3_malloc(2 * nItem * sizeof(int));
+  pAgg->aiColumn = sqlite3_malloc(nItem * sizeof(int));
+  pAgg->azName = sqlite3_malloc(nItem * sizeof(char*));
+  pAgg->azPath = sqlite3_malloc(nItem * sizeof(char*));
+  pAgg->apColumn = sqlite3_malloc(nItem * sizeof(GraphColumn*));
+  pAgg->aStage = sqlite3_malloc64((sqlite3_int64)AGG_BATCH_ROWS * nItem * sizeof(CypherValue));
+  pAgg->aWorker = sqlite3_malloc(sizeof(AggWorker));
+  if (!pAgg->aiKey || !pAgg->aiColumn || !pAgg->azName || !pAgg->azPath || !pAgg->apColumn
+   || !pAgg->aStage || !pAgg->aWorker || cypherChunkCreate(&pAgg->pInput) != SQLITE_OK) {
+    aggregateDestroy(pIterator);
+    sqlite3_free(pIterator);
+    return NULL;
+  }
+  memset(pAgg->azPath, 0, nItem * sizeof(char*));
+  memset(pAgg->apColumn, 0, nItem * sizeof(GraphColumn*));
+  memset(pAgg->aStage, 0, (sqlite3_int64)AGG_BATCH_ROWS * nItem * sizeof(CypherValue));
+  memset(pAgg->aWorker, 0, sizeof(AggWorker));
+  pAgg->aWorker[0].pAgg = pAgg;
+  pAgg->nWorker = 1;
+
+  pAgg->aiAgg = &pAgg->aiKey[nItem];
+  for (i = 0; i < nItem; i++) {
+    const PlanAggregate *pItem = &pPlan->aAggregate[i];
+    if (pItem->eFunc == PLAN_AGG_KEY) {
+      pAgg->aiKey[pAgg->nKey++] = i;
+    } else {
+      pAgg->aiAgg[pAgg->nAgg++] = i;
+    }
+    pAgg->azName[i] = executionContextIntern(pContext, pItem->zName ? pItem->zName : "");
+    if (pItem->zProperty) {
+      pAgg->azPath[i] = sqlite3_mprintf("$.\"%w\"", pItem->zProperty);
+    }
+    if (!pAgg->azName[i] || (pItem->zProperty && !pAgg->azPath[i])) {
+      aggregateDestroy(pIterator);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
+  }
+
+  if (pPlan->pChild) {
+    pAgg->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
+    if (!pAgg->pSource) {
+      aggregateDestroy(pIterator);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
+  }
+
+  pIterator->xOpen = aggregateOpen;
+  pIterator->xNext = aggregateNext;
+  pIterator->xClose = aggregateClose;
+  pIterator->xDestroy = aggregateDestroy;
+  pIterator->pContext = pContext;
+  pIterator->pPlan = pPlan;
+  return pIterator;
+}
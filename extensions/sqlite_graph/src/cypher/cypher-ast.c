@@ -43,15 +43,39 @@ static char *CYPHER_MPRINTF(const char *fmt, ...) {
 #endif
 
 #include "cypher.h"
+#include "graph-arena.h"
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 
 #define AST_INITIAL_CHILDREN 4
 
+#ifdef _MSC_VER
+# define AST_THREAD __declspec(thread)
+#else
+# define AST_THREAD __thread
+#endif
+
+// Arena of the parse running on this thread, if any.
+static AST_THREAD GraphArena *pAstArena = NULL;
+
+GraphArena *cypherAstSetArena(GraphArena *pArena) {
+  GraphArena *pPrior = pAstArena;
+  pAstArena = pArena;
+  return pPrior;
+}
+
 // Create a new AST node of the specified type.
 CypherAst *cypherAstCreate(CypherAstNodeType type, int iLine, int iColumn) {
-  CypherAst *pAst = CYPHER_MALLOC(sizeof(CypherAst));
+  GraphArena *pArena = pAstArena;
+  CypherAst *pAst;
+  sqlite3_int64 nChildren = sizeof(CypherAst*) * AST_INITIAL_CHILDREN;
+
+  if( pArena ) {
+    pAst = graphArenaAlloc(pArena, sizeof(CypherAst) + nChildren);
+  } else {
+    pAst = CYPHER_MALLOC(sizeof(CypherAst));
+  }
   if( !pAst ) return NULL;
 
   memset(pAst, 0, sizeof(CypherAst));
@@ -59,20 +83,26 @@ CypherAst *cypherAstCreate(CypherAstNodeType type, int iLine, int iColumn) {
   pAst->iLine = iLine;
   pAst->iColumn = iColumn;
   pAst->nChildrenAlloc = AST_INITIAL_CHILDREN;
-  pAst->apChildren = CYPHER_MALLOC(sizeof(CypherAst*) * pAst->nChildrenAlloc);
-
-  if( !pAst->apChildren ) {
-    CYPHER_FREE(pAst);
-    return NULL;
+  pAst->pArena = pArena;
+  if( pArena ) {
+    // Node and first children in one block
+    pAst->apChildren = (CypherAst**)&pAst[1];
+  } else {
+    pAst->apChildren = CYPHER_MALLOC(nChildren);
+    if( !pAst->apChildren ) {
+      CYPHER_FREE(pAst);
+      return NULL;
+    }
   }
 
-  memset(pAst->apChildren, 0, sizeof(CypherAst*) * pAst->nChildrenAlloc);
+  memset(pAst->apChildren, 0, nChildren);
   return pAst;
 }
 
-// Destroy an AST node and all its children.
+// Destroy an AST node and all its children. Arena nodes, and anything
+// added below them, are freed with their arena.
 void cypherAstDestroy(CypherAst *pAst) {
-  if( !pAst ) return;
+  if( !pAst || pAst->pArena ) return;
   for( int i = 0; i < pAst->nChildren; i++ ) {
     cypherAstDestroy(pAst->apChildren[i]);
   }
@@ -88,7 +118,14 @@ void cypherAstAddChild(CypherAst *pParent, CypherAst *pChild) {
   if( pParent->nChildren >= pParent->nChildrenAlloc ) {
     int nNewMax = pParent->nChildrenAlloc * 2;
     if (nNewMax == 0) nNewMax = AST_INITIAL_CHILDREN;
-    CypherAst **apNew = CYPHER_REALLOC(pParent->apChildren, sizeof(CypherAst*) * nNewMax);
+    CypherAst **apNew;
+    if( pParent->pArena ) {
+      apNew = graphArenaRealloc(pParent->pArena, pParent->apChildren,
+                                sizeof(CypherAst*) * pParent->nChildrenAlloc,
+                                sizeof(CypherAst*) * nNewMax);
+    } else {
+      apNew = CYPHER_REALLOC(pParent->apChildren, sizeof(CypherAst*) * nNewMax);
+    }
     if( !apNew ) {
       // In a real scenario, we'd need more robust error handling.
       // For now, we fail silently, which is bad practice but avoids crashing.
@@ -102,11 +139,22 @@ void cypherAstAddChild(CypherAst *pParent, CypherAst *pChild) {
 
 // Set the string value of an AST node.
 void cypherAstSetValue(CypherAst *pAst, const char *zValue) {
+  cypherAstSetValueN(pAst, zValue, -1);
+}
+
+// Set the value to the first nValue bytes of zValue (all of it if
+// nValue<0), so lexer tokens can be stored without a NUL-terminated copy.
+void cypherAstSetValueN(CypherAst *pAst, const char *zValue, int nValue) {
   if( !pAst ) return;
+  if( pAst->pArena ) {
+    pAst->zValue = graphArenaStrdup(pAst->pArena, zValue, nValue);
+    return;
+  }
   CYPHER_FREE(pAst->zValue);
   pAst->zValue = NULL;
   if( zValue ) {
-    pAst->zValue = CYPHER_MPRINTF("%s", zValue);
+    pAst->zValue = nValue<0 ? CYPHER_MPRINTF("%s", zValue)
+                            : CYPHER_MPRINTF("%.*s", nValue, zValue);
     // No return value to check against CYPHER_MPRINTF failure in this function signature
   }
 }
@@ -154,6 +202,11 @@ const char *cypherAstNodeTypeName(CypherAstNodeType type) {
     case CYPHER_AST_ENDS_WITH:       return "ENDS_WITH";
     case CYPHER_AST_CONTAINS_OP:     return "CONTAINS_OP";
     case CYPHER_AST_REGEX:           return "REGEX";
+    case CYPHER_AST_RANGE:           return "RANGE";
+    case CYPHER_AST_PARAMETER:       return "PARAMETER";
+    case CYPHER_AST_CREATE:          return "CREATE";
+    case CYPHER_AST_MERGE:           return "MERGE";
+    case CYPHER_AST_MERGE_ACTION:    return "MERGE_ACTION";
     case CYPHER_AST_COUNT:           return "COUNT";
     default:                         return "UNKNOWN";
   }
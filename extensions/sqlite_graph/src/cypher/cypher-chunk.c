@@ -0,0 +1,212 @@
+/*
+** SQLite Graph Database Extension - Columnar Data Chunks
+**
+** Vector storage, selection vectors and the row adapters between
+** CypherDataChunk batches and CypherResult rows. See cypher-chunk.h.
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+** Error handling: Functions return SQLite error codes
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "cypher-chunk.h"
+#include <string.h>
+#include <assert.h>
+
+int cypherChunkCreate(CypherDataChunk **ppChunk) {
+  CypherDataChunk *pChunk;
+
+  *ppChunk = NULL;
+  pChunk = sqlite3_malloc(sizeof(CypherDataChunk));
+  if( !pChunk ) return SQLITE_NOMEM;
+  memset(pChunk, 0, sizeof(CypherDataChunk));
+
+  pChunk->aSel = sqlite3_malloc(CYPHER_CHUNK_SIZE * sizeof(int));
+  if( !pChunk->aSel ) {
+    sqlite3_free(pChunk);
+    return SQLITE_NOMEM;
+  }
+
+  *ppChunk = pChunk;
+  return SQLITE_OK;
+}
+
+void cypherChunkReset(CypherDataChunk *pChunk) {
+  int i, j;
+
+  if( !pChunk ) return;
+
+  for( i = 0; i < pChunk->nCol; i++ ) {
+    CypherVector *pCol = &pChunk->aCol[i];
+    if( pCol->eType != CYPHER_VECTOR_VALUE ) continue;
+    for( j = 0; j < pChunk->nRow; j++ ) {
+      cypherValueDestroy(&pCol->aValue[j]);
+    }
+    memset(pCol->aValue, 0, pChunk->nRow * sizeof(CypherValue));
+  }
+  pChunk->nRow = 0;
+  pChunk->nSel = 0;
+  pChunk->bSel = 0;
+}
+
+void cypherChunkClear(CypherDataChunk *pChunk) {
+  int i;
+
+  if( !pChunk ) return;
+
+  cypherChunkReset(pChunk);
+  for( i = 0; i < pChunk->nCol; i++ ) {
+    sqlite3_free(pChunk->aCol[i].zName);
+    sqlite3_free(pChunk->aCol[i].aId);
+    sqlite3_free(pChunk->aCol[i].aValue);
+  }
+  sqlite3_free(pChunk->aCol);
+  pChunk->aCol = NULL;
+  pChunk->nCol = 0;
+}
+
+void cypherChunkFree(CypherDataChunk *pChunk) {
+  if( !pChunk ) return;
+
+  cypherChunkClear(pChunk);
+  sqlite3_free(pChunk->aSel);
+  sqlite3_free(pChunk);
+}
+
+int cypherChunkAddColumn(CypherDataChunk *pChunk, const char *zName, int eType) {
+  CypherVector *aNew;
+  CypherVector *pCol;
+
+  assert( pChunk->nRow == 0 );
+
+  aNew = sqlite3_realloc(pChunk->aCol, (pChunk->nCol + 1) * sizeof(CypherVector));
+  if( !aNew ) return -1;
+  pChunk->aCol = aNew;
+
+  pCol = &aNew[pChunk->nCol];
+  memset(pCol, 0, sizeof(CypherVector));
+  pCol->eType = eType;
+  pCol->zName = sqlite3_mprintf("%s", zName);
+  if( eType == CYPHER_VECTOR_NODE ) {
+    pCol->aId = sqlite3_malloc(CYPHER_CHUNK_SIZE * sizeof(sqlite3_int64));
+  } else {
+    pCol->aValue = sqlite3_malloc(CYPHER_CHUNK_SIZE * sizeof(CypherValue));
+    if( pCol->aValue ) {
+      memset(pCol->aValue, 0, CYPHER_CHUNK_SIZE * sizeof(CypherValue));
+    }
+  }
+  if( !pCol->zName || (!pCol->aId && !pCol->aValue) ) {
+    sqlite3_free(pCol->zName);
+    sqlite3_free(pCol->aId);
+    sqlite3_free(pCol->aValue);
+    return -1;
+  }
+
+  return pChunk->nCol++;
+}
+
+const CypherValue *cypherChunkValue(CypherDataChunk *pChunk, int iCol,
+                                    int iRow, CypherValue *pTmp) {
+  CypherVector *pCol = &pChunk->aCol[iCol];
+
+  assert( iRow >= 0 && iRow < pChunk->nRow );
+  if( pCol->eType == CYPHER_VECTOR_NODE ) {
+    memset(pTmp, 0, sizeof(CypherValue));
+    pTmp->type = CYPHER_VALUE_NODE;
+    pTmp->u.iNodeId = pCol->aId[iRow];
+    return pTmp;
+  }
+  return &pCol->aValue[iRow];
+}
+
+void cypherChunkSelect(CypherDataChunk *pChunk, const unsigned char *aKeep) {
+  int i;
+  int nKeep = 0;
+
+  for( i = 0; i < pChunk->nSel; i++ ) {
+    if( aKeep[i] ) pChunk->aSel[nKeep++] = cypherChunkRow(pChunk, i);
+  }
+  pChunk->nSel = nKeep;
+  pChunk->bSel = 1;
+}
+
+int cypherChunkBindRow(CypherDataChunk *pChunk, int iRow,
+                       ExecutionContext *pContext) {
+  CypherValue tmp;
+  int i, rc;
+
+  for( i = 0; i < pChunk->nCol; i++ ) {
+    const CypherValue *pValue = cypherChunkValue(pChunk, i, iRow, &tmp);
+    rc = executionContextBind(pContext, pChunk->aCol[i].zName, (CypherValue*)pValue);
+    if( rc != SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+
+int cypherChunkToResult(CypherDataChunk *pChunk, int i, CypherResult *pResult) {
+  int iRow = cypherChunkRow(pChunk, i);
+  CypherValue tmp;
+  int iCol, rc;
+
+  for( iCol = 0; iCol < pChunk->nCol; iCol++ ) {
+    const CypherValue *pValue = cypherChunkValue(pChunk, iCol, iRow, &tmp);
+    rc = cypherResultAddColumnShared(pResult, pChunk->aCol[iCol].zName, (CypherValue*)pValue);
+    if( rc != SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+
+int cypherChunkAppendResult(CypherDataChunk *pChunk, CypherResult *pResult) {
+  int iRow = pChunk->nRow;
+  int i;
+
+  assert( iRow < CYPHER_CHUNK_SIZE );
+  assert( !pChunk->bSel );
+
+  if( pChunk->nCol == 0 ) {
+    for( i = 0; i < pResult->nColumns; i++ ) {
+      if( cypherChunkAddColumn(pChunk, pResult->azColumnNames[i],
+                               CYPHER_VECTOR_VALUE) < 0 ) {
+        return SQLITE_NOMEM;
+      }
+    }
+  }
+
+  for( i = 0; i < pChunk->nCol; i++ ) {
+    CypherVector *pCol = &pChunk->aCol[i];
+
+    if( i >= pResult->nColumns ) {
+      /* Short row: the missing columns are NULL */
+      if( pCol->eType == CYPHER_VECTOR_VALUE ) {
+        memset(&pCol->aValue[iRow], 0, sizeof(CypherValue));
+      } else {
+        pCol->aId[iRow] = 0;
+      }
+      continue;
+    }
+
+    if( pCol->eType == CYPHER_VECTOR_NODE ) {
+      pCol->aId[iRow] = pResult->aValues[i].u.iNodeId;
+      continue;
+    }
+
+    if( cypherValueCopyIn(0, &pCol->aValue[iRow], &pResult->aValues[i]) ) {
+      /* Drop the partial row */
+      while( --i >= 0 ) {
+        if( pChunk->aCol[i].eType == CYPHER_VECTOR_VALUE ) {
+          cypherValueDestroy(&pChunk->aCol[i].aValue[iRow]);
+          memset(&pChunk->aCol[i].aValue[iRow], 0, sizeof(CypherValue));
+        }
+      }
+      return SQLITE_NOMEM;
+    }
+  }
+
+  pChunk->nRow++;
+  pChunk->nSel = pChunk->nRow;
+  return SQLITE_OK;
+}
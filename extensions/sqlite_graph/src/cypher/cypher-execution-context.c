@@ -21,6 +21,7 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-executor.h"
+#include "graph-metrics.h"
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
@@ -38,6 +39,7 @@ ExecutionContext *executionContextCreate(sqlite3 *pDb, GraphVtab *pGraph) {
   memset(pContext, 0, sizeof(ExecutionContext));
   pContext->pDb = pDb;
   pContext->pGraph = pGraph;
+  graphArenaInit(&pContext->arena, 0, 0);
   
   return pContext;
 }
@@ -59,11 +61,20 @@ void executionContextDestroy(ExecutionContext *pContext) {
   sqlite3_free(pContext->azVariables);
   sqlite3_free(pContext->aBindings);
   
-  /* Free allocated memory blocks */
-  for( i = 0; i < pContext->nAllocated; i++ ) {
-    sqlite3_free(pContext->apAllocated[i]);
+  /* Free recycled rows, then the interned names */
+  while( pContext->pFreeRow ) {
+    CypherResult *pRow = pContext->pFreeRow;
+    pContext->pFreeRow = pRow->pNextFree;
+    cypherResultDestroy(pRow);
   }
-  sqlite3_free(pContext->apAllocated);
+  sqlite3_free(pContext->azName);
+  sqlite3_finalize(pContext->apPropStmt[0]);
+  sqlite3_finalize(pContext->apPropStmt[1]);
+  
+  /* Free the statement arena. Operators have released their child
+  ** arenas, returning the chunks to it, by now */
+  graphMetricPeak(GRAPH_METRIC_ARENA_PEAK, graphArenaFootprint(&pContext->arena));
+  graphArenaRelease(&pContext->arena);
   
   sqlite3_free(pContext->zErrorMsg);
   sqlite3_free(pContext);
@@ -76,6 +87,7 @@ void executionContextDestroy(ExecutionContext *pContext) {
 int executionContextBind(ExecutionContext *pContext, const char *zVar, CypherValue *pValue) {
   char **azNew;
   CypherValue *aNew;
+  CypherValue copy;
   int i;
   
   if( !pContext || !zVar || !pValue ) return SQLITE_MISUSE;
@@ -83,9 +95,11 @@ int executionContextBind(ExecutionContext *pContext, const char *zVar, CypherVal
   /* Check if variable already exists */
   for( i = 0; i < pContext->nVariables; i++ ) {
     if( strcmp(pContext->azVariables[i], zVar) == 0 ) {
-      /* Update existing binding */
+      /* Update existing binding. Operators rebind per row; node and
+      ** relationship ids copy without touching the heap */
+      if( cypherValueCopyIn(0, &copy, pValue) ) return SQLITE_NOMEM;
       cypherValueDestroy(&pContext->aBindings[i]);
-      pContext->aBindings[i] = *cypherValueCopy(pValue);
+      pContext->aBindings[i] = copy;
       return SQLITE_OK;
     }
   }
@@ -109,7 +123,10 @@ int executionContextBind(ExecutionContext *pContext, const char *zVar, CypherVal
   pContext->azVariables[pContext->nVariables] = sqlite3_mprintf("%s", zVar);
   if( !pContext->azVariables[pContext->nVariables] ) return SQLITE_NOMEM;
   
-  pContext->aBindings[pContext->nVariables] = *cypherValueCopy(pValue);
+  if( cypherValueCopyIn(0, &pContext->aBindings[pContext->nVariables], pValue) ) {
+    sqlite3_free(pContext->azVariables[pContext->nVariables]);
+    return SQLITE_NOMEM;
+  }
   pContext->nVariables++;
   
   return SQLITE_OK;
@@ -133,6 +150,152 @@ CypherValue *executionContextGet(ExecutionContext *pContext, const char *zVar) {
   return NULL;
 }
 
+/*
+** Intern a column name for the statement. Operators intern a handful of
+** names when created, so a linear scan is enough.
+*/
+const char *executionContextIntern(ExecutionContext *pContext, const char *zName) {
+  char *zCopy;
+  int i;
+  
+  for( i = 0; i < pContext->nName; i++ ) {
+    if( strcmp(pContext->azName[i], zName) == 0 ) return pContext->azName[i];
+  }
+  
+  if( pContext->nName >= pContext->nNameAlloc ) {
+    int nNew = pContext->nNameAlloc ? pContext->nNameAlloc * 2 : 8;
+    char **azNew = sqlite3_realloc(pContext->azName, nNew * sizeof(char*));
+    if( !azNew ) return NULL;
+    pContext->azName = azNew;
+    pContext->nNameAlloc = nNew;
+  }
+  zCopy = graphArenaStrdup(&pContext->arena, zName, -1);
+  if( !zCopy ) return NULL;
+  pContext->azName[pContext->nName++] = zCopy;
+  return zCopy;
+}
+
+/*
+** Take a row buffer from the free list, or create one.
+*/
+CypherResult *executionContextRowAcquire(ExecutionContext *pContext) {
+  CypherResult *pRow = pContext->pFreeRow;
+  
+  if( pRow ) {
+    pContext->pFreeRow = pRow->pNextFree;
+    pContext->nFreeRow--;
+    pRow->pNextFree = NULL;
+    return pRow;
+  }
+  return cypherResultCreateIn(&pContext->arena);
+}
+
+/*
+** Return a row buffer to the free list.
+*/
+void executionContextRowRelease(ExecutionContext *pContext, CypherResult *pRow) {
+  if( !pRow ) return;
+  if( pContext->nFreeRow >= CYPHER_FREE_ROWS || !pRow->bArena ) {
+    cypherResultDestroy(pRow);
+    return;
+  }
+  cypherResultClear(pRow);
+  pRow->pNextFree = pContext->pFreeRow;
+  pContext->pFreeRow = pRow;
+  pContext->nFreeRow++;
+}
+
+/*
+** The value pPlan compares against, from the context parameters when
+** the plan names one.
+*/
+int executionContextPlanValue(ExecutionContext *pContext, const PhysicalPlanNode *pPlan,
+                              const char **pzValue, int *peType) {
+  int bFound;
+  
+  *pzValue = pPlan->zValue;
+  *peType = pPlan->eValueType;
+  if( !pPlan->zParam ) return SQLITE_OK;
+  
+  *pzValue = cypherParamsFind(pContext->pParams, pPlan->zParam, peType, &bFound);
+  if( !bFound ) {
+    sqlite3_free(pContext->zErrorMsg);
+    pContext->zErrorMsg = sqlite3_mprintf("Missing parameter: $%s", pPlan->zParam);
+    pContext->iErrorCode = SQLITE_ERROR;
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Read a property of a node or relationship with one statement per kind,
+** prepared on first use. Map values look the key up in place.
+*/
+int executionContextProperty(ExecutionContext *pContext, const CypherValue *pObject,
+                             const char *zProperty, CypherValue *pResult) {
+  GraphVtab *pGraph = pContext->pGraph;
+  sqlite3_stmt **ppStmt;
+  sqlite3_int64 iId;
+  char *zPath;
+  int bRel, rc, i;
+  
+  cypherValueInit(pResult);
+  if( pObject->type == CYPHER_VALUE_MAP ) {
+    for( i = 0; i < pObject->u.map.nPairs; i++ ) {
+      if( strcmp(pObject->u.map.azKeys[i], zProperty) == 0 ) {
+        return cypherValueCopyIn(0, pResult, &pObject->u.map.apValues[i]);
+      }
+    }
+    return SQLITE_OK;
+  }
+  if( pObject->type != CYPHER_VALUE_NODE && pObject->type != CYPHER_VALUE_RELATIONSHIP ) {
+    return SQLITE_OK;
+  }
+  if( !pGraph ) {
+    sqlite3_free(pContext->zErrorMsg);
+    pContext->zErrorMsg = sqlite3_mprintf("Property access requires a graph: %s", zProperty);
+    pContext->iErrorCode = SQLITE_ERROR;
+    return SQLITE_ERROR;
+  }
+  
+  bRel = pObject->type == CYPHER_VALUE_RELATIONSHIP;
+  iId = bRel ? pObject->u.iRelId : pObject->u.iNodeId;
+  ppStmt = &pContext->apPropStmt[bRel];
+  if( !*ppStmt ) {
+    char *zSql = sqlite3_mprintf("SELECT json_extract(%s, ?2) FROM \"%w\" WHERE id = ?1",
+                                 graphPropsExpr(pGraph),
+                                 bRel ? pGraph->zEdgeTableName : pGraph->zNodeTableName);
+    if( !zSql ) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pContext->pDb, zSql, -1, ppStmt, 0);
+    sqlite3_free(zSql);
+    if( rc != SQLITE_OK ) return rc;
+  }
+  
+  zPath = sqlite3_mprintf("$.\"%w\"", zProperty);
+  if( !zPath ) return SQLITE_NOMEM;
+  sqlite3_bind_int64(*ppStmt, 1, iId);
+  sqlite3_bind_text(*ppStmt, 2, zPath, -1, SQLITE_TRANSIENT);
+  sqlite3_free(zPath);
+  rc = CYPHER_STEP(pContext, *ppStmt);
+  if( rc == SQLITE_ROW ) {
+    rc = SQLITE_OK;
+    switch( sqlite3_column_type(*ppStmt, 0) ) {
+      case SQLITE_INTEGER:
+        cypherValueSetInteger(pResult, sqlite3_column_int64(*ppStmt, 0));
+        break;
+      case SQLITE_FLOAT:
+        cypherValueSetFloat(pResult, sqlite3_column_double(*ppStmt, 0));
+        break;
+      case SQLITE_TEXT:
+        rc = cypherValueSetString(pResult, (const char*)sqlite3_column_text(*ppStmt, 0));
+        break;
+    }
+  }
+  if( rc == SQLITE_OK || rc == SQLITE_DONE ) return sqlite3_reset(*ppStmt);
+  sqlite3_reset(*ppStmt);
+  return rc;
+}
+
 /*
 ** Create a new Cypher value.
 ** Returns NULL on allocation failure.
@@ -158,6 +321,12 @@ void cypherValueDestroy(CypherValue *pValue) {
   
   if( !pValue ) return;
   
+  /* Arena payloads are reclaimed with their arena */
+  if( pValue->bArena ) {
+    pValue->bArena = 0;
+    return;
+  }
+  
   switch( pValue->type ) {
     case CYPHER_VALUE_STRING:
       sqlite3_free(pValue->u.zString);
@@ -188,84 +357,104 @@ void cypherValueDestroy(CypherValue *pValue) {
 }
 
 /*
-** Copy a Cypher value.
-** Returns NULL on allocation failure.
+** Allocate n bytes from pArena, or from the heap when pArena is NULL.
 */
-CypherValue *cypherValueCopy(CypherValue *pValue) {
-  CypherValue *pCopy;
-  int i;
+static void *valueAlloc(GraphArena *pArena, sqlite3_int64 n) {
+  return pArena ? graphArenaAlloc(pArena, n) : sqlite3_malloc64(n);
+}
+
+/*
+** Deep-copy pSrc into *pDst, from pArena when not NULL.
+*/
+int cypherValueCopyIn(GraphArena *pArena, CypherValue *pDst, const CypherValue *pSrc) {
+  int i, n;
   
-  if( !pValue ) return NULL;
+  memset(pDst, 0, sizeof(CypherValue));
+  pDst->type = pSrc->type;
   
-  pCopy = cypherValueCreate(pValue->type);
-  if( !pCopy ) return NULL;
-  
-  switch( pValue->type ) {
-    case CYPHER_VALUE_NULL:
-      /* Nothing to copy */
-      break;
-      
-    case CYPHER_VALUE_BOOLEAN:
-      pCopy->u.bBoolean = pValue->u.bBoolean;
-      break;
-      
-    case CYPHER_VALUE_INTEGER:
-      pCopy->u.iInteger = pValue->u.iInteger;
-      break;
-      
-    case CYPHER_VALUE_FLOAT:
-      pCopy->u.rFloat = pValue->u.rFloat;
-      break;
-      
+  switch( pSrc->type ) {
     case CYPHER_VALUE_STRING:
-      if( pValue->u.zString ) {
-        pCopy->u.zString = sqlite3_mprintf("%s", pValue->u.zString);
-        if( !pCopy->u.zString ) {
-          cypherValueDestroy(pCopy);
-          sqlite3_free(pCopy);
-          return NULL;
-        }
+      if( pSrc->u.zString ) {
+        n = (int)strlen(pSrc->u.zString);
+        pDst->u.zString = valueAlloc(pArena, n + 1);
+        if( !pDst->u.zString ) goto copy_nomem;
+        memcpy(pDst->u.zString, pSrc->u.zString, n + 1);
       }
       break;
       
-    case CYPHER_VALUE_NODE:
-      pCopy->u.iNodeId = pValue->u.iNodeId;
-      break;
-      
-    case CYPHER_VALUE_RELATIONSHIP:
-      pCopy->u.iRelId = pValue->u.iRelId;
-      break;
-      
     case CYPHER_VALUE_LIST:
-      if( pValue->u.list.nValues > 0 ) {
-        pCopy->u.list.apValues = sqlite3_malloc(pValue->u.list.nValues * sizeof(CypherValue));
-        if( !pCopy->u.list.apValues ) {
-          cypherValueDestroy(pCopy);
-          sqlite3_free(pCopy);
-          return NULL;
+      n = pSrc->u.list.nValues;
+      if( n > 0 ) {
+        pDst->u.list.apValues = valueAlloc(pArena, n * sizeof(CypherValue));
+        if( !pDst->u.list.apValues ) goto copy_nomem;
+        memset(pDst->u.list.apValues, 0, n * sizeof(CypherValue));
+        pDst->u.list.nValues = n;
+        for( i = 0; i < n; i++ ) {
+          if( cypherValueCopyIn(pArena, &pDst->u.list.apValues[i],
+                                &pSrc->u.list.apValues[i]) ) goto copy_nomem;
         }
-        
-        pCopy->u.list.nValues = pValue->u.list.nValues;
-        for( i = 0; i < pValue->u.list.nValues; i++ ) {
-          CypherValue *pElementCopy = cypherValueCopy(&pValue->u.list.apValues[i]);
-          if( !pElementCopy ) {
-            cypherValueDestroy(pCopy);
-            sqlite3_free(pCopy);
-            return NULL;
+      }
+      break;
+      
+    case CYPHER_VALUE_MAP:
+      n = pSrc->u.map.nPairs;
+      if( n > 0 ) {
+        pDst->u.map.azKeys = valueAlloc(pArena, n * sizeof(char*));
+        pDst->u.map.apValues = valueAlloc(pArena, n * sizeof(CypherValue));
+        if( !pDst->u.map.azKeys || !pDst->u.map.apValues ) goto copy_nomem;
+        memset(pDst->u.map.azKeys, 0, n * sizeof(char*));
+        memset(pDst->u.map.apValues, 0, n * sizeof(CypherValue));
+        pDst->u.map.nPairs = n;
+        for( i = 0; i < n; i++ ) {
+          const char *zKey = pSrc->u.map.azKeys[i];
+          if( zKey ) {
+            int nKey = (int)strlen(zKey);
+            pDst->u.map.azKeys[i] = valueAlloc(pArena, nKey + 1);
+            if( !pDst->u.map.azKeys[i] ) goto copy_nomem;
+            memcpy(pDst->u.map.azKeys[i], zKey, nKey + 1);
           }
-          pCopy->u.list.apValues[i] = *pElementCopy;
-          sqlite3_free(pElementCopy);
+          if( cypherValueCopyIn(pArena, &pDst->u.map.apValues[i],
+                                &pSrc->u.map.apValues[i]) ) goto copy_nomem;
         }
       }
       break;
       
     default:
-      /* Unsupported type for copying */
-      cypherValueDestroy(pCopy);
-      sqlite3_free(pCopy);
-      return NULL;
+      /* Scalars, nodes and relationships are self-contained */
+      pDst->u = pSrc->u;
+      break;
+  }
+  
+  pDst->bArena = pArena!=0;
+  return SQLITE_OK;
+
+copy_nomem:
+  if( pArena ) {
+    /* Abandoned in the arena until its reset */
+    memset(pDst, 0, sizeof(CypherValue));
+  } else {
+    /* Everything copied so far is heap-owned and zero-filled beyond */
+    cypherValueDestroy(pDst);
+    memset(pDst, 0, sizeof(CypherValue));
   }
+  return SQLITE_NOMEM;
+}
+
+/*
+** Copy a Cypher value.
+** Returns NULL on allocation failure.
+*/
+CypherValue *cypherValueCopy(CypherValue *pValue) {
+  CypherValue *pCopy;
+  
+  if( !pValue ) return NULL;
   
+  pCopy = sqlite3_malloc(sizeof(CypherValue));
+  if( !pCopy ) return NULL;
+  if( cypherValueCopyIn(0, pCopy, pValue) ) {
+    sqlite3_free(pCopy);
+    return NULL;
+  }
   return pCopy;
 }
 
@@ -277,11 +466,13 @@ int cypherValueSetString(CypherValue *pValue, const char *zString) {
   if( !pValue ) return SQLITE_MISUSE;
   
   /* Free existing string if any */
-  if( pValue->type == CYPHER_VALUE_STRING && pValue->u.zString ) {
+  if( pValue->type == CYPHER_VALUE_STRING && pValue->u.zString
+   && !pValue->bArena ) {
     sqlite3_free(pValue->u.zString);
   }
   
   pValue->type = CYPHER_VALUE_STRING;
+  pValue->bArena = 0;
   
   if( zString ) {
     pValue->u.zString = sqlite3_mprintf("%s", zString);
@@ -412,6 +603,20 @@ CypherResult *cypherResultCreate(void) {
   return pResult;
 }
 
+/*
+** Create a result row that copies its names and values into a child
+** arena of pParent.
+*/
+CypherResult *cypherResultCreateIn(GraphArena *pParent) {
+  CypherResult *pResult = cypherResultCreate();
+  
+  if( pResult && pParent ) {
+    pResult->bArena = 1;
+    graphArenaInit(&pResult->arena, pParent, 0);
+  }
+  return pResult;
+}
+
 /*
 ** Destroy a result row and free all associated memory.
 ** Safe to call with NULL pointer.
@@ -423,49 +628,109 @@ void cypherResultDestroy(CypherResult *pResult) {
   
   /* Free column names */
   for( i = 0; i < pResult->nColumns; i++ ) {
-    sqlite3_free(pResult->azColumnNames[i]);
+    if( !pResult->bArena ) sqlite3_free(pResult->azColumnNames[i]);
     cypherValueDestroy(&pResult->aValues[i]);
   }
+  if( pResult->bArena ) graphArenaRelease(&pResult->arena);
   sqlite3_free(pResult->azColumnNames);
   sqlite3_free(pResult->aValues);
   sqlite3_free(pResult);
 }
 
 /*
-** Add a column to a result row.
-** Returns SQLITE_OK on success, error code on failure.
+** Remove all columns from a result row, keeping its allocation.
 */
-int cypherResultAddColumn(CypherResult *pResult, const char *zName, CypherValue *pValue) {
+void cypherResultClear(CypherResult *pResult) {
+  int i;
+  
+  if( !pResult ) return;
+  
+  for( i = 0; i < pResult->nColumns; i++ ) {
+    if( !pResult->bArena ) sqlite3_free(pResult->azColumnNames[i]);
+    cypherValueDestroy(&pResult->aValues[i]);
+  }
+  if( pResult->bArena ) graphArenaReset(&pResult->arena);
+  pResult->nColumns = 0;
+}
+
+/*
+** Make room for one more column.
+*/
+static int resultGrow(CypherResult *pResult) {
   char **azNew;
   CypherValue *aNew;
+  int nNew;
+  
+  if( pResult->nColumns < pResult->nColumnsAlloc ) return SQLITE_OK;
+  nNew = pResult->nColumnsAlloc ? pResult->nColumnsAlloc * 2 : 4;
+  
+  azNew = sqlite3_realloc(pResult->azColumnNames, nNew * sizeof(char*));
+  if( !azNew ) return SQLITE_NOMEM;
+  pResult->azColumnNames = azNew;
+  
+  aNew = sqlite3_realloc(pResult->aValues, nNew * sizeof(CypherValue));
+  if( !aNew ) return SQLITE_NOMEM;
+  pResult->aValues = aNew;
+  
+  pResult->nColumnsAlloc = nNew;
+  return SQLITE_OK;
+}
+
+/*
+** The name a new column stores: zName itself when bShared and the row
+** is arena-backed, otherwise a copy.
+*/
+static char *resultColumnName(CypherResult *pResult, const char *zName, int bShared) {
+  if( !pResult->bArena ) return sqlite3_mprintf("%s", zName);
+  if( bShared ) return (char*)zName;
+  return graphArenaStrdup(&pResult->arena, zName, -1);
+}
+
+/*
+** Add a column to a result row.
+** Returns SQLITE_OK on success, error code on failure.
+*/
+static int resultAddColumn(CypherResult *pResult, const char *zName, CypherValue *pValue,
+                           int bShared, int bTake) {
+  GraphArena *pArena;
+  char *zCopy;
+  int rc;
   
   if( !pResult || !zName || !pValue ) return SQLITE_MISUSE;
   
   /* Resize arrays if needed */
-  if( pResult->nColumns >= pResult->nColumnsAlloc ) {
-    int nNew = pResult->nColumnsAlloc ? pResult->nColumnsAlloc * 2 : 4;
-    
-    azNew = sqlite3_realloc(pResult->azColumnNames, nNew * sizeof(char*));
-    if( !azNew ) return SQLITE_NOMEM;
-    pResult->azColumnNames = azNew;
-    
-    aNew = sqlite3_realloc(pResult->aValues, nNew * sizeof(CypherValue));
-    if( !aNew ) return SQLITE_NOMEM;
-    pResult->aValues = aNew;
-    
-    pResult->nColumnsAlloc = nNew;
-  }
+  rc = resultGrow(pResult);
+  if( rc != SQLITE_OK ) return rc;
   
   /* Add column */
-  pResult->azColumnNames[pResult->nColumns] = sqlite3_mprintf("%s", zName);
-  if( !pResult->azColumnNames[pResult->nColumns] ) return SQLITE_NOMEM;
-  
-  pResult->aValues[pResult->nColumns] = *cypherValueCopy(pValue);
+  pArena = pResult->bArena ? &pResult->arena : 0;
+  zCopy = resultColumnName(pResult, zName, bShared);
+  if( !zCopy ) return SQLITE_NOMEM;
+  if( bTake ) {
+    pResult->aValues[pResult->nColumns] = *pValue;
+    cypherValueInit(pValue);
+  } else if( cypherValueCopyIn(pArena, &pResult->aValues[pResult->nColumns], pValue) ) {
+    if( !pArena ) sqlite3_free(zCopy);
+    return SQLITE_NOMEM;
+  }
+  pResult->azColumnNames[pResult->nColumns] = zCopy;
   pResult->nColumns++;
   
   return SQLITE_OK;
 }
 
+int cypherResultAddColumn(CypherResult *pResult, const char *zName, CypherValue *pValue) {
+  return resultAddColumn(pResult, zName, pValue, 0, 0);
+}
+
+int cypherResultAddColumnShared(CypherResult *pResult, const char *zName, CypherValue *pValue) {
+  return resultAddColumn(pResult, zName, pValue, 1, 0);
+}
+
+int cypherResultTakeColumn(CypherResult *pResult, const char *zName, CypherValue *pValue) {
+  return resultAddColumn(pResult, zName, pValue, 1, 1);
+}
+
 /*
 ** Set a CypherValue to a boolean.
 */
@@ -646,58 +911,15 @@ void cypherValueSetRelationship(CypherValue *pValue, sqlite3_int64 iRelId) {
 ** Caller must sqlite3_free() the returned string.
 */
 char *cypherResultToJson(CypherResult *pResult) {
-  char *zResult, *zValue;
-  int i, nResult = 0, nAlloc = 256;
+  CypherJsonWriter writer;
+  char *zResult;
   
   if( !pResult ) return sqlite3_mprintf("null");
   
-  zResult = sqlite3_malloc(nAlloc);
-  if( !zResult ) return NULL;
-  
-  /* Start JSON object */
-  nResult = snprintf(zResult, nAlloc, "{");
-  
-  for( i = 0; i < pResult->nColumns; i++ ) {
-    zValue = cypherValueToString(&pResult->aValues[i]);
-    if( !zValue ) {
-      sqlite3_free(zResult);
-      return NULL;
-    }
-    
-    /* Calculate space needed */
-    int nNeeded = snprintf(NULL, 0, "%s\"%s\":%s", 
-                          i > 0 ? "," : "", 
-                          pResult->azColumnNames[i], 
-                          zValue);
-    
-    /* Resize if needed */
-    if( nResult + nNeeded + 2 >= nAlloc ) {
-      nAlloc = (nResult + nNeeded + 256) * 2;
-      char *zNew = sqlite3_realloc(zResult, nAlloc);
-      if( !zNew ) {
-        sqlite3_free(zResult);
-        sqlite3_free(zValue);
-        return NULL;
-      }
-      zResult = zNew;
-    }
-    
-    /* Add column to JSON */
-    nResult += snprintf(zResult + nResult, nAlloc - nResult,
-                       "%s\"%s\":%s", 
-                       i > 0 ? "," : "", 
-                       pResult->azColumnNames[i], 
-                       zValue);
-    
-    sqlite3_free(zValue);
-  }
-  
-  /* Close JSON object */
-  if( nResult + 2 < nAlloc ) {
-    zResult[nResult++] = '}';
-    zResult[nResult] = '\0';
-  }
-  
+  cypherJsonWriterInit(&writer);
+  cypherJsonAppendRow(&writer, pResult);
+  zResult = cypherJsonWriterFinish(&writer);
+  cypherJsonWriterReset(&writer);
   return zResult;
 }
 
@@ -6,9 +6,15 @@
 ** Cypher queries and get results back as JSON.
 **
 ** Functions provided:
-** - cypher_execute(query_text) - Execute Cypher query and return results
+** - cypher_execute(query_text [, params_json]) - Execute Cypher query and return results
 ** - cypher_execute_explain(query_text) - Execute with detailed execution stats
+** - cypher_explain_analyze(query_text [, params_json]) - Per-operator profile
 ** - cypher_test_execute() - Execute test queries for demonstration
+** - cypher_query(query_text [, params_json]) - Table-valued function
+**   streaming the rows
+** - cypher_prepare(query_text [, graph]) - Prepared statement handle,
+**   accepted by cypher_execute() and cypher_query() in place of the text
+** - cypher_finalize(handle) - Free a prepared statement
 **
 ** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
 ** Error handling: Functions return SQLite error codes or NULL on error
@@ -20,122 +26,633 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-executor.h"
+#include "cypher/cypher-api.h"
+#include "graph-performance.h"
+#include "graph-metrics.h"
 #include <string.h>
 #include <assert.h>
 
 /*
-** SQL function: cypher_execute(query_text)
-**
-** Executes a Cypher query and returns the results as JSON.
-** This is the main function for running Cypher queries.
-**
-** Usage: SELECT cypher_execute('MATCH (n:Person) RETURN n.name');
-**
-** Returns: JSON array of result rows
+** A planned and prepared Cypher query. The plan is either the planner's,
+** which owns it together with the parser's AST, or a private copy from
+** the plan cache in pPlan. The parameters are those given by the caller
+** plus the literals lifted out of the query when it was normalized.
+** Everything is released together by cypherQueryFinalize().
 */
-static void cypherExecuteSqlFunc(
-  sqlite3_context *context,
-  int argc,
-  sqlite3_value **argv
-) {
-  const char *zQuery;
-  CypherParser *pParser = NULL;
-  CypherPlanner *pPlanner = NULL;
-  CypherExecutor *pExecutor = NULL;
+typedef struct CypherQuery CypherQuery;
+struct CypherQuery {
+  CypherParser *pParser;
+  CypherPlanner *pPlanner;
+  CypherExecutor *pExecutor;
+  PhysicalPlanNode *pPlan;      /* Plan copied from the cache, or NULL */
+  int bCacheHit;                /* The plan came from the plan cache */
+  CypherParams params;          /* Values of the plan's $name slots */
+  char *zKey;                   /* Plan cache key, for the latency metric */
+  sqlite3_int64 iStart;         /* graphMetricsClock() when prepared */
+};
+
+static void cypherQueryFinalize(CypherQuery *pQuery) {
+  if( pQuery->zKey ) {
+    graphMetricLatency(pQuery->zKey, graphMetricsClock() - pQuery->iStart);
+    sqlite3_free(pQuery->zKey);
+  }
+  cypherExecutorDestroy(pQuery->pExecutor);
+  cypherPlannerDestroy(pQuery->pPlanner);
+  if( pQuery->pParser ) cypherParserDestroy(pQuery->pParser);
+  physicalPlanNodeDestroy(pQuery->pPlan);
+  cypherParamsClear(&pQuery->params);
+  memset(pQuery, 0, sizeof(*pQuery));
+}
+
+/*
+** Add the members of the JSON object zJson to pParams. Strings, numbers
+** and booleans become the literal text a query would have held, typed
+** as JSON typed them, so "30" stays text and 30 an integer; arrays and
+** objects are kept as JSON text.
+*/
+static int cypherParamsFromJson(sqlite3 *db, const char *zJson,
+                                CypherParams *pParams, char **pzErr) {
+  sqlite3_stmt *pStmt;
+  int rc;
+  
+  rc = sqlite3_prepare_v2(db,
+      "SELECT key, CASE type WHEN 'true' THEN 'true' WHEN 'false' THEN 'false'"
+      " ELSE value END, json_type(?1), type FROM json_each(?1)", -1, &pStmt, 0);
+  if( rc != SQLITE_OK ) {
+    *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+    return rc;
+  }
+  sqlite3_bind_text(pStmt, 1, zJson, -1, SQLITE_STATIC);
+  while( (rc = sqlite3_step(pStmt)) == SQLITE_ROW ) {
+    const char *zType = (const char*)sqlite3_column_text(pStmt, 2);
+    if( !zType || strcmp(zType, "object") != 0 ) {
+      *pzErr = sqlite3_mprintf("Cypher parameters must be a JSON object");
+      rc = SQLITE_ERROR;
+      break;
+    }
+    const char *zValueType = (const char*)sqlite3_column_text(pStmt, 3);
+    int eType = SQLITE_TEXT;
+    if( !zValueType || strcmp(zValueType, "null") == 0 ) {
+      eType = SQLITE_NULL;
+    } else if( strcmp(zValueType, "integer") == 0 || strcmp(zValueType, "true") == 0 ||
+               strcmp(zValueType, "false") == 0 ) {
+      eType = SQLITE_INTEGER;
+    } else if( strcmp(zValueType, "real") == 0 ) {
+      eType = SQLITE_FLOAT;
+    }
+    rc = cypherParamsAdd(pParams, (const char*)sqlite3_column_text(pStmt, 0),
+                         (const char*)sqlite3_column_text(pStmt, 1), -1, eType);
+    if( rc != SQLITE_OK ) break;
+  }
+  if( rc == SQLITE_DONE ) rc = SQLITE_OK;
+  if( rc != SQLITE_OK && !*pzErr ) {
+    *pzErr = sqlite3_mprintf("Invalid Cypher parameters: %s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+/*
+** Parse and plan zText, leaving the plan with the planner in pQuery.
+*/
+static int cypherQueryPlan(sqlite3 *db, GraphVtab *pGraph, const char *zText,
+                           CypherQuery *pQuery, PhysicalPlanNode **ppPlan,
+                           char **pzErr) {
   CypherAst *pAst;
-  PhysicalPlanNode *pPlan;
-  char *zResults = NULL;
+  char *zErrMsg = NULL;
   int rc;
   
-  /* Validate arguments */
-  if( argc != 1 ) {
-    sqlite3_result_error(context, "cypher_execute() requires exactly one argument", -1);
-    return;
+  pQuery->pParser = cypherParserCreate();
+  if( !pQuery->pParser ) return SQLITE_NOMEM;
+  
+  pAst = cypherParse(pQuery->pParser, zText, &zErrMsg);
+  if( !pAst ) {
+    *pzErr = zErrMsg ? zErrMsg : sqlite3_mprintf("Parse error");
+    return SQLITE_ERROR;
   }
   
-  zQuery = (const char*)sqlite3_value_text(argv[0]);
-  if( !zQuery ) {
-    sqlite3_result_null(context);
-    return;
+  pQuery->pPlanner = cypherPlannerCreate(db, pGraph);
+  if( !pQuery->pPlanner ) return SQLITE_NOMEM;
+  
+  rc = cypherPlannerCompile(pQuery->pPlanner, pAst);
+  if( rc != SQLITE_OK ) {
+    const char *zError = cypherPlannerGetError(pQuery->pPlanner);
+    *pzErr = sqlite3_mprintf("%s", zError ? zError : "Planning error");
+    return rc;
   }
   
-  /* Parse the query */
-  pParser = cypherParserCreate();
-  if( !pParser ) {
-    sqlite3_result_error_nomem(context);
-    return;
+  rc = cypherPlannerOptimize(pQuery->pPlanner);
+  if( rc != SQLITE_OK ) {
+    const char *zError = cypherPlannerGetError(pQuery->pPlanner);
+    *pzErr = sqlite3_mprintf("%s", zError ? zError : "Optimization error");
+    return rc;
   }
   
-  char *zErrMsg = NULL;
-  pAst = cypherParse(pParser, zQuery, &zErrMsg);
-  if( !pAst ) {
-    sqlite3_result_error(context, zErrMsg ? zErrMsg : "Parse error", -1);
-    if (zErrMsg) sqlite3_free(zErrMsg);
-    cypherParserDestroy(pParser);
-    return;
+  *ppPlan = cypherPlannerGetPlan(pQuery->pPlanner);
+  if( !*ppPlan ) {
+    *pzErr = sqlite3_mprintf("No execution plan generated");
+    return SQLITE_ERROR;
   }
-  if( !pAst ) {
-    sqlite3_result_error(context, "No AST generated", -1);
-    cypherParserDestroy(pParser);
-    return;
+  return SQLITE_OK;
+}
+
+/*
+** Plan and prepare zQuery against pGraph, with the $name parameters
+** of the JSON object zParams (may be NULL). The query is
+** normalized first, so queries differing only in literal values share
+** one plan cache entry; a hit skips parsing and planning. On error
+** *pzErr is set to a message the caller frees with sqlite3_free() and
+** pQuery is left empty. pFront is the connection's front plan cache,
+** or NULL.
+** With bAnalyze set, every operator is profiled for EXPLAIN ANALYZE.
+** The query's latency, from here to cypherQueryFinalize(), is recorded
+** under its plan cache key.
+*/
+static int cypherQueryPrepare(sqlite3 *db, GraphPlanFrontCache *pFront,
+                              GraphVtab *pGraph, const char *zQuery,
+                              const char *zParams, int bAnalyze,
+                              CypherQuery *pQuery, char **pzErr) {
+  PhysicalPlanNode *pPlan = NULL;
+  sqlite3_uint64 iVersion = 0;
+  char *zNorm;
+  char *zKey = NULL;
+  int rc = SQLITE_OK;
+  
+  memset(pQuery, 0, sizeof(*pQuery));
+  *pzErr = NULL;
+  pQuery->iStart = graphMetricsClock();
+  
+  /* Queries that do not lex are planned as written, for the error */
+  zNorm = cypherNormalizeQuery(zQuery, &pQuery->params);
+  if( !zNorm ) cypherParamsClear(&pQuery->params);
+  if( zParams ) rc = cypherParamsFromJson(db, zParams, &pQuery->params, pzErr);
+  
+  /* Plans are specific to the graph they were made for */
+  if( rc == SQLITE_OK && zNorm && pGraph ) {
+    zKey = sqlite3_mprintf("%s\x1f%s", pGraph->zTableName, zNorm);
+    if( zKey ) pQuery->pPlan = pPlan = graphPlanCacheLookup(pFront, zKey, &iVersion);
+    pQuery->bCacheHit = pPlan != NULL;
   }
   
-  /* Plan the query */
-  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context), NULL);
-  if( !pPlanner ) {
-    sqlite3_result_error_nomem(context);
-    cypherParserDestroy(pParser);
-    return;
+  if( rc == SQLITE_OK && !pPlan ) {
+    rc = cypherQueryPlan(db, pGraph, zNorm ? zNorm : zQuery, pQuery, &pPlan, pzErr);
+    if( rc == SQLITE_OK && zKey ) {
+      PhysicalPlanNode *pCopy = physicalPlanNodeCopy(pPlan);
+      if( pCopy ) graphPlanCacheInsert(pFront, zKey, iVersion, pCopy);
+    }
+  }
+  sqlite3_free(zNorm);
+  
+  /* Prepare the executor over the same graph the plan was made for */
+  if( rc == SQLITE_OK ) {
+    pQuery->pExecutor = cypherExecutorCreate(db, pGraph);
+    if( !pQuery->pExecutor ) rc = SQLITE_NOMEM;
+  }
+  if( rc == SQLITE_OK ) {
+    cypherExecutorSetParams(pQuery->pExecutor, &pQuery->params);
+    pQuery->pExecutor->pContext->bAnalyze = bAnalyze;
+    rc = cypherExecutorPrepare(pQuery->pExecutor, pPlan);
+    if( rc != SQLITE_OK ) {
+      const char *zError = cypherExecutorGetError(pQuery->pExecutor);
+      *pzErr = sqlite3_mprintf("%s", zError ? zError : "Executor prepare error");
+    }
   }
   
-  rc = cypherPlannerCompile(pPlanner, pAst);
   if( rc != SQLITE_OK ) {
-    const char *zError = cypherPlannerGetError(pPlanner);
-    sqlite3_result_error(context, zError ? zError : "Planning error", -1);
-    cypherPlannerDestroy(pPlanner);
-    cypherParserDestroy(pParser);
-    return;
+    cypherQueryFinalize(pQuery);
+    sqlite3_free(zKey);
+  } else {
+    pQuery->zKey = zKey;
   }
+  return rc;
+}
+
+/*
+** A prepared Cypher statement (cypher-api.h): a CypherQuery kept planned
+** and prepared between runs, its iterator tree reopened for each run.
+** The plan is made again before a run once it is stale: when the plans
+** of its graph were retired or the graph table was connected anew.
+** Values bound by the caller are kept in bound, so they survive that.
+*/
+#define CYPHER_STMT_READY    0  /* Not running */
+#define CYPHER_STMT_RUNNING  1  /* Iterators open, rows being stepped */
+#define CYPHER_STMT_DONE     2  /* Stepped to the end or an error */
+
+struct CypherStmt {
+  sqlite3 *db;                  /* Connection */
+  GraphPlanFrontCache *pFront;  /* Front plan cache, or NULL */
+  char *zQuery;                 /* Query text */
+  char *zGraph;                 /* Graph table it runs against, or NULL */
+  GraphVtab *pGraph;            /* Graph the plan was made for */
+  sqlite3_uint64 iVersion;      /* Plan cache version of pGraph then */
+  CypherQuery query;            /* Plan, executor and parameters */
+  CypherParams bound;           /* Values bound by the caller */
+  CypherResult *pRow;           /* Row buffer, reused across steps */
+  int eState;                   /* CYPHER_STMT_* */
+  int bFresh;                   /* Prepared and not run yet */
+  int bBusy;                    /* Streamed by a cypher_query() cursor */
+  char *zKey;                   /* Plan cache key, for the latency metric */
+  sqlite3_int64 iStart;         /* graphMetricsClock() when the run began */
+  char *zErrMsg;                /* Message of the last error, or NULL */
+  sqlite3_int64 iHandle;        /* cypher_prepare() handle, or 0 */
+  CypherStmt *pNext;            /* Next statement of the connection */
+};
+
+static void cypherStmtSetError(CypherStmt *p, const char *zErr, int rc) {
+  sqlite3_free(p->zErrMsg);
+  p->zErrMsg = sqlite3_mprintf("%s", zErr ? zErr : sqlite3_errstr(rc));
+}
+
+/*
+** Plan and prepare the query of p against its graph and apply the
+** values bound so far.
+*/
+static int cypherStmtCompile(CypherStmt *p) {
+  char *zErr = NULL;
+  int rc;
+  int i;
   
-  rc = cypherPlannerOptimize(pPlanner);
+  p->pGraph = graphRegistryFind(p->db, p->zGraph);
+  if( p->zGraph && !p->pGraph ) {
+    sqlite3_free(p->zErrMsg);
+    p->zErrMsg = sqlite3_mprintf("no such graph: %s", p->zGraph);
+    return SQLITE_ERROR;
+  }
+  p->iVersion = p->pGraph ? graphPlanCacheVersion(p->pGraph->zTableName) : 0;
+  
+  rc = cypherQueryPrepare(p->db, p->pFront, p->pGraph, p->zQuery, NULL, 0,
+                          &p->query, &zErr);
   if( rc != SQLITE_OK ) {
-    const char *zError = cypherPlannerGetError(pPlanner);
-    sqlite3_result_error(context, zError ? zError : "Optimization error", -1);
-    cypherPlannerDestroy(pPlanner);
-    cypherParserDestroy(pParser);
+    cypherStmtSetError(p, zErr, rc);
+    sqlite3_free(zErr);
+    return rc;
+  }
+  for( i = 0; rc == SQLITE_OK && i < p->bound.nParam; i++ ) {
+    rc = cypherParamsAdd(&p->query.params, p->bound.azName[i],
+                         p->bound.azValue[i], -1, p->bound.aeType[i]);
+  }
+  
+  /* Latency is recorded per run, not once at finalize */
+  sqlite3_free(p->zKey);
+  p->zKey = p->query.zKey;
+  p->query.zKey = NULL;
+  p->iStart = p->query.iStart;
+  p->bFresh = 1;
+  return rc;
+}
+
+/*
+** Make the plan again if it is stale, and note when the run begins.
+*/
+static int cypherStmtRefresh(CypherStmt *p) {
+  GraphVtab *pGraph = graphRegistryFind(p->db, p->zGraph);
+  int rc;
+  
+  if( !p->query.pExecutor || pGraph != p->pGraph ||
+      (pGraph && graphPlanCacheVersion(pGraph->zTableName) != p->iVersion) ) {
+    cypherResultDestroy(p->pRow);
+    p->pRow = NULL;
+    cypherQueryFinalize(&p->query);
+    rc = cypherStmtCompile(p);
+    if( rc != SQLITE_OK ) {
+      cypherQueryFinalize(&p->query);
+      return rc;
+    }
+  }
+  if( !p->bFresh ) p->iStart = graphMetricsClock();
+  p->bFresh = 0;
+  return SQLITE_OK;
+}
+
+/*
+** Close the iterators of a running statement and record its latency.
+*/
+static void cypherStmtEnd(CypherStmt *p) {
+  if( p->eState != CYPHER_STMT_RUNNING ) return;
+  cypherExecutorClose(p->query.pExecutor);
+  if( p->zKey ) graphMetricLatency(p->zKey, graphMetricsClock() - p->iStart);
+  p->eState = CYPHER_STMT_DONE;
+}
+
+static int cypherStmtCreate(sqlite3 *db, GraphPlanFrontCache *pFront,
+                            const char *zGraph, const char *zQuery,
+                            CypherStmt **ppStmt, char **pzErr) {
+  CypherStmt *p;
+  int rc;
+  
+  *ppStmt = NULL;
+  if( pzErr ) *pzErr = NULL;
+  if( !db || !zQuery ) return SQLITE_MISUSE;
+  
+  p = sqlite3_malloc(sizeof(*p));
+  if( !p ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(*p));
+  p->db = db;
+  p->pFront = pFront;
+  p->zQuery = sqlite3_mprintf("%s", zQuery);
+  if( zGraph ) p->zGraph = sqlite3_mprintf("%s", zGraph);
+  if( !p->zQuery || (zGraph && !p->zGraph) ) {
+    rc = SQLITE_NOMEM;
+  } else {
+    rc = cypherStmtCompile(p);
+  }
+  
+  /* Stay on the default graph of now, whatever graph_use() does later */
+  if( rc == SQLITE_OK && !p->zGraph && p->pGraph ) {
+    p->zGraph = sqlite3_mprintf("%s", p->pGraph->zTableName);
+    if( !p->zGraph ) rc = SQLITE_NOMEM;
+  }
+  if( rc != SQLITE_OK ) {
+    if( pzErr ) {
+      *pzErr = p->zErrMsg;
+      p->zErrMsg = NULL;
+    }
+    cypherStmtFinalize(p);
+    return rc;
+  }
+  *ppStmt = p;
+  return SQLITE_OK;
+}
+
+int cypherStmtPrepare(sqlite3 *pDb, const char *zGraph, const char *zQuery,
+                      CypherStmt **ppStmt, char **pzErr) {
+  return cypherStmtCreate(pDb, NULL, zGraph, zQuery, ppStmt, pzErr);
+}
+
+/*
+** Bind the literal text zValue (NULL for null) of SQLITE_* type eType to
+** $zName.
+*/
+static int cypherStmtBind(CypherStmt *p, const char *zName, const char *zValue,
+                          int eType) {
+  int rc;
+  
+  if( !p || !zName || p->eState == CYPHER_STMT_RUNNING ) return SQLITE_MISUSE;
+  if( zName[0] == '$' ) zName++;
+  rc = cypherParamsAdd(&p->bound, zName, zValue, -1, eType);
+  if( rc == SQLITE_OK && p->query.pExecutor ) {
+    rc = cypherParamsAdd(&p->query.params, zName, zValue, -1, eType);
+  }
+  return rc;
+}
+
+int cypherStmtBindInt64(CypherStmt *pStmt, const char *zName,
+                        sqlite3_int64 iValue) {
+  char zBuf[32];
+  sqlite3_snprintf(sizeof(zBuf), zBuf, "%lld", iValue);
+  return cypherStmtBind(pStmt, zName, zBuf, SQLITE_INTEGER);
+}
+
+int cypherStmtBindDouble(CypherStmt *pStmt, const char *zName, double rValue) {
+  char zBuf[32];
+  sqlite3_snprintf(sizeof(zBuf), zBuf, "%!.17g", rValue);
+  return cypherStmtBind(pStmt, zName, zBuf, SQLITE_FLOAT);
+}
+
+int cypherStmtBindText(CypherStmt *pStmt, const char *zName,
+                       const char *zValue) {
+  if( !zValue ) return SQLITE_MISUSE;
+  return cypherStmtBind(pStmt, zName, zValue, SQLITE_TEXT);
+}
+
+/*
+** Bind the members of the JSON object zJson.
+*/
+static int cypherStmtBindJson(CypherStmt *p, const char *zJson, char **pzErr) {
+  CypherParams params;
+  int rc;
+  int i;
+  
+  if( p->eState == CYPHER_STMT_RUNNING ) {
+    *pzErr = sqlite3_mprintf("Cypher statement is running");
+    return SQLITE_MISUSE;
+  }
+  memset(&params, 0, sizeof(params));
+  rc = cypherParamsFromJson(p->db, zJson, &params, pzErr);
+  for( i = 0; rc == SQLITE_OK && i < params.nParam; i++ ) {
+    rc = cypherStmtBind(p, params.azName[i], params.azValue[i],
+                        params.aeType[i]);
+  }
+  cypherParamsClear(&params);
+  return rc;
+}
+
+int cypherStmtStep(CypherStmt *p) {
+  int rc;
+  
+  if( !p ) return SQLITE_MISUSE;
+  if( p->eState != CYPHER_STMT_RUNNING ) {
+    sqlite3_free(p->zErrMsg);
+    p->zErrMsg = NULL;
+    p->eState = CYPHER_STMT_READY;
+    rc = cypherStmtRefresh(p);
+    if( rc == SQLITE_OK ) rc = cypherExecutorOpen(p->query.pExecutor);
+    if( rc != SQLITE_OK ) {
+      if( !p->zErrMsg ) {
+        cypherStmtSetError(p, cypherExecutorGetError(p->query.pExecutor), rc);
+      }
+      return rc;
+    }
+    p->eState = CYPHER_STMT_RUNNING;
+  }
+  
+  if( p->pRow ) {
+    cypherResultClear(p->pRow);
+  } else {
+    p->pRow = executionContextRowAcquire(p->query.pExecutor->pContext);
+    if( !p->pRow ) {
+      cypherStmtEnd(p);
+      return SQLITE_NOMEM;
+    }
+  }
+  
+  rc = cypherExecutorNext(p->query.pExecutor, p->pRow);
+  if( rc == SQLITE_OK || rc == SQLITE_ROW ) return SQLITE_ROW;
+  if( rc != SQLITE_DONE ) {
+    cypherStmtSetError(p, cypherExecutorGetError(p->query.pExecutor), rc);
+  }
+  cypherStmtEnd(p);
+  return rc;
+}
+
+CypherResult *cypherStmtRow(CypherStmt *p) {
+  return p && p->eState == CYPHER_STMT_RUNNING ? p->pRow : NULL;
+}
+
+const char *cypherStmtErrmsg(CypherStmt *p) {
+  return p ? p->zErrMsg : NULL;
+}
+
+int cypherStmtReset(CypherStmt *p) {
+  if( !p ) return SQLITE_OK;
+  cypherStmtEnd(p);
+  if( p->pRow ) cypherResultClear(p->pRow);
+  p->eState = CYPHER_STMT_READY;
+  return SQLITE_OK;
+}
+
+/*
+** Run p to the end and return its rows as a JSON array, the way
+** cypher_execute() does.
+*/
+static int cypherStmtExecute(CypherStmt *p, char **pzResults) {
+  int rc;
+  
+  cypherStmtReset(p);
+  sqlite3_free(p->zErrMsg);
+  p->zErrMsg = NULL;
+  rc = cypherStmtRefresh(p);
+  if( rc != SQLITE_OK ) return rc;
+  rc = cypherExecutorExecute(p->query.pExecutor, pzResults);
+  if( rc != SQLITE_OK ) {
+    cypherStmtSetError(p, cypherExecutorGetError(p->query.pExecutor), rc);
+  }
+  if( p->zKey ) graphMetricLatency(p->zKey, graphMetricsClock() - p->iStart);
+  return rc;
+}
+
+void cypherStmtFinalize(CypherStmt *p) {
+  if( !p ) return;
+  cypherStmtEnd(p);
+  cypherResultDestroy(p->pRow);
+  cypherQueryFinalize(&p->query);
+  cypherParamsClear(&p->bound);
+  sqlite3_free(p->zQuery);
+  sqlite3_free(p->zGraph);
+  sqlite3_free(p->zKey);
+  sqlite3_free(p->zErrMsg);
+  sqlite3_free(p);
+}
+
+/*
+** Per-connection state of the Cypher SQL functions: the front plan cache
+** and the statements of cypher_prepare(). Every registration holds a
+** reference; the last is dropped when the connection closes, which
+** finalizes the statements left.
+*/
+typedef struct CypherConn CypherConn;
+struct CypherConn {
+  GraphPlanFrontCache *pFront;  /* Front plan cache, referenced */
+  CypherStmt *pStmts;           /* cypher_prepare() statements */
+  sqlite3_int64 iLastHandle;    /* Handle of the latest statement */
+  int nRef;                     /* Registrations holding this */
+};
+
+static void cypherConnRef(CypherConn *pConn) {
+  pConn->nRef++;
+}
+
+static void cypherConnUnref(void *pArg) {
+  CypherConn *pConn = (CypherConn*)pArg;
+  
+  if( !pConn || --pConn->nRef > 0 ) return;
+  while( pConn->pStmts ) {
+    CypherStmt *pStmt = pConn->pStmts;
+    pConn->pStmts = pStmt->pNext;
+    cypherStmtFinalize(pStmt);
+  }
+  graphPlanFrontCacheUnref(pConn->pFront);
+  sqlite3_free(pConn);
+}
+
+/*
+** The statement with handle iHandle, or NULL after setting *pzErr.
+** Statements streamed by a cypher_query() cursor are refused.
+*/
+static CypherStmt *cypherConnStmt(CypherConn *pConn, sqlite3_int64 iHandle,
+                                  char **pzErr) {
+  CypherStmt *pStmt;
+  
+  for( pStmt = pConn->pStmts; pStmt; pStmt = pStmt->pNext ) {
+    if( pStmt->iHandle == iHandle ) break;
+  }
+  if( !pStmt ) {
+    *pzErr = sqlite3_mprintf("no such Cypher statement: %lld", iHandle);
+  } else if( pStmt->bBusy ) {
+    *pzErr = sqlite3_mprintf("Cypher statement %lld is in use", iHandle);
+    pStmt = NULL;
+  }
+  return pStmt;
+}
+
+/*
+** SQL function: cypher_execute(query_text [, params_json])
+**
+** Executes a Cypher query and returns the results as JSON.
+** The whole result is built in memory; use cypher_query() to stream it.
+** The optional JSON object supplies the values of $name parameters.
+** A cypher_prepare() handle in place of the text runs that statement,
+** with the parameters bound to it for this and later runs.
+**
+** Usage: SELECT cypher_execute('MATCH (n:Person) RETURN n.name');
+**        SELECT cypher_execute('MATCH (n) WHERE n.age > $age RETURN n',
+**                              '{"age": 30}');
+**        SELECT cypher_execute(1, '{"age": 30}');
+**
+** Returns: JSON array of result rows
+*/
+static void cypherExecuteSqlFunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+) {
+  CypherConn *pConn = (CypherConn*)sqlite3_user_data(context);
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  const char *zQuery;
+  const char *zParams = NULL;
+  CypherQuery query;
+  char *zResults = NULL;
+  char *zErr = NULL;
+  int rc;
+  
+  /* Validate arguments */
+  if( argc != 1 && argc != 2 ) {
+    sqlite3_result_error(context, "cypher_execute() requires a query and optional parameters", -1);
     return;
   }
+  if( argc == 2 ) zParams = (const char*)sqlite3_value_text(argv[1]);
   
-  pPlan = cypherPlannerGetPlan(pPlanner);
-  if( !pPlan ) {
-    sqlite3_result_error(context, "No execution plan generated", -1);
-    cypherPlannerDestroy(pPlanner);
-    cypherParserDestroy(pParser);
+  if( sqlite3_value_type(argv[0]) == SQLITE_INTEGER ) {
+    CypherStmt *pStmt = cypherConnStmt(pConn, sqlite3_value_int64(argv[0]), &zErr);
+    rc = pStmt ? SQLITE_OK : SQLITE_ERROR;
+    if( rc == SQLITE_OK && zParams ) rc = cypherStmtBindJson(pStmt, zParams, &zErr);
+    if( rc == SQLITE_OK ) {
+      rc = cypherStmtExecute(pStmt, &zResults);
+      if( rc != SQLITE_OK ) zErr = sqlite3_mprintf("%s", cypherStmtErrmsg(pStmt));
+    }
+    if( rc != SQLITE_OK ) {
+      sqlite3_result_error(context, zErr ? zErr : sqlite3_errstr(rc), -1);
+      sqlite3_free(zErr);
+    } else if( zResults ) {
+      sqlite3_result_text(context, zResults, -1, sqlite3_free);
+    } else {
+      sqlite3_result_text(context, "[]", -1, SQLITE_STATIC);
+    }
     return;
   }
   
-  /* Execute the query */
-  pExecutor = cypherExecutorCreate(sqlite3_context_db_handle(context), NULL);
-  if( !pExecutor ) {
-    sqlite3_result_error_nomem(context);
-    cypherPlannerDestroy(pPlanner);
-    cypherParserDestroy(pParser);
+  zQuery = (const char*)sqlite3_value_text(argv[0]);
+  if( !zQuery ) {
+    sqlite3_result_null(context);
     return;
   }
   
-  rc = cypherExecutorPrepare(pExecutor, pPlan);
+  rc = cypherQueryPrepare(db, pConn->pFront, graphRegistryFind(db, NULL),
+                          zQuery, zParams, 0, &query, &zErr);
   if( rc != SQLITE_OK ) {
-    const char *zError = cypherExecutorGetError(pExecutor);
-    sqlite3_result_error(context, zError ? zError : "Executor prepare error", -1);
-    cypherExecutorDestroy(pExecutor);
-    cypherPlannerDestroy(pPlanner);
-    cypherParserDestroy(pParser);
+    if( zErr ) {
+      sqlite3_result_error(context, zErr, -1);
+      sqlite3_free(zErr);
+    } else {
+      sqlite3_result_error_code(context, rc);
+    }
     return;
   }
   
-  rc = cypherExecutorExecute(pExecutor, &zResults);
+  /* Execute the query */
+  rc = cypherExecutorExecute(query.pExecutor, &zResults);
   if( rc != SQLITE_OK ) {
-    const char *zError = cypherExecutorGetError(pExecutor);
+    const char *zError = cypherExecutorGetError(query.pExecutor);
     sqlite3_result_error(context, zError ? zError : "Execution error", -1);
   } else if( zResults ) {
     sqlite3_result_text(context, zResults, -1, sqlite3_free);
@@ -143,9 +660,7 @@ static void cypherExecuteSqlFunc(
     sqlite3_result_text(context, "[]", -1, SQLITE_STATIC);
   }
   
-  cypherExecutorDestroy(pExecutor);
-  cypherPlannerDestroy(pPlanner);
-  cypherParserDestroy(pParser);
+  cypherQueryFinalize(&query);
 }
 
 /*
@@ -207,7 +722,8 @@ static void cypherExecuteExplainSqlFunc(
     return;
   }
   
-  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context), NULL);
+  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context),
+      graphRegistryFind(sqlite3_context_db_handle(context), NULL));
   if( !pPlanner ) {
     sqlite3_result_error_nomem(context);
     cypherParserDestroy(pParser);
@@ -268,6 +784,173 @@ static void cypherExecuteExplainSqlFunc(
   cypherParserDestroy(pParser);
 }
 
+/*
+** SQL function: cypher_explain_analyze(query_text [, params_json])
+**
+** Runs a Cypher query with every operator profiled, discards the rows
+** and returns the physical plan annotated with what each operator did:
+** estimated and actual rows, xOpen and xNext calls, inclusive and
+** exclusive milliseconds, and the statements stepped, CSR cache hits
+** and misses and property JSON bytes decoded by the operator itself.
+** Profiling adds two clock reads per operator call, so the times are
+** for comparing operators rather than for absolute latency.
+**
+** Usage: SELECT cypher_explain_analyze('MATCH (a)-[:KNOWS]->(b) RETURN b');
+**
+** Returns: JSON object with the totals and the annotated plan tree
+*/
+static void cypherExplainAnalyzeSqlFunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+) {
+  const char *zQuery;
+  const char *zParams = NULL;
+  CypherQuery query;
+  ExecutionContext *pContext;
+  char *zResults = NULL;
+  char *zPlan;
+  char *zErr = NULL;
+  int rc;
+  
+  if( argc != 1 && argc != 2 ) {
+    sqlite3_result_error(context, "cypher_explain_analyze() requires a query and optional parameters", -1);
+    return;
+  }
+  
+  zQuery = (const char*)sqlite3_value_text(argv[0]);
+  if( !zQuery ) {
+    sqlite3_result_null(context);
+    return;
+  }
+  if( argc == 2 ) zParams = (const char*)sqlite3_value_text(argv[1]);
+  
+  rc = cypherQueryPrepare(sqlite3_context_db_handle(context),
+                          ((CypherConn*)sqlite3_user_data(context))->pFront,
+                          graphRegistryFind(sqlite3_context_db_handle(context), NULL),
+                          zQuery, zParams, 1, &query, &zErr);
+  if( rc != SQLITE_OK ) {
+    if( zErr ) {
+      sqlite3_result_error(context, zErr, -1);
+      sqlite3_free(zErr);
+    } else {
+      sqlite3_result_error_code(context, rc);
+    }
+    return;
+  }
+  
+  rc = cypherExecutorExecute(query.pExecutor, &zResults);
+  sqlite3_free(zResults);
+  if( rc != SQLITE_OK ) {
+    const char *zError = cypherExecutorGetError(query.pExecutor);
+    sqlite3_result_error(context, zError ? zError : "Execution error", -1);
+    cypherQueryFinalize(&query);
+    return;
+  }
+  
+  pContext = query.pExecutor->pContext;
+  zPlan = cypherProfileToJson(pContext, query.pExecutor->pPlan);
+  if( zPlan ) {
+    char *zReport = sqlite3_mprintf(
+        "{\"plan_cache\":\"%s\",\"rows\":%d,\"statements_stepped\":%lld,"
+        "\"cache_hits\":%lld,\"cache_misses\":%lld,\"json_bytes\":%lld,"
+        "\"plan\":%s}",
+        query.bCacheHit ? "hit" : "miss", pContext->nRowsProduced,
+        pContext->counters.nStep, pContext->counters.nCacheHit,
+        pContext->counters.nCacheMiss, pContext->counters.nJsonBytes, zPlan);
+    sqlite3_free(zPlan);
+    zPlan = zReport;
+  }
+  if( zPlan ) {
+    sqlite3_result_text(context, zPlan, -1, sqlite3_free);
+  } else {
+    sqlite3_result_error_nomem(context);
+  }
+  
+  cypherQueryFinalize(&query);
+}
+
+/*
+** SQL function: cypher_prepare(query_text [, graph])
+**
+** Parses and plans a Cypher query once and keeps it on the connection
+** as a prepared statement. Passing the returned handle to
+** cypher_execute() or cypher_query() in place of the text runs it again
+** without normalizing, parsing or planning it or building its iterator
+** tree. graph names the graph table it runs against, by default the
+** default graph. cypher_finalize() frees the statement.
+**
+** Usage: SELECT cypher_prepare('MATCH (n:Person) WHERE n.id = $id RETURN n');
+**        SELECT row FROM cypher_query(1, '{"id": 42}');
+**
+** Returns: integer statement handle
+*/
+static void cypherPrepareSqlFunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+) {
+  CypherConn *pConn = (CypherConn*)sqlite3_user_data(context);
+  const char *zQuery = (const char*)sqlite3_value_text(argv[0]);
+  const char *zGraph = NULL;
+  CypherStmt *pStmt;
+  char *zErr = NULL;
+  int rc;
+  
+  if( !zQuery ) {
+    sqlite3_result_null(context);
+    return;
+  }
+  if( argc == 2 ) zGraph = (const char*)sqlite3_value_text(argv[1]);
+  
+  rc = cypherStmtCreate(sqlite3_context_db_handle(context), pConn->pFront,
+                        zGraph, zQuery, &pStmt, &zErr);
+  if( rc != SQLITE_OK ) {
+    if( zErr ) {
+      sqlite3_result_error(context, zErr, -1);
+      sqlite3_free(zErr);
+    } else {
+      sqlite3_result_error_code(context, rc);
+    }
+    return;
+  }
+  pStmt->iHandle = ++pConn->iLastHandle;
+  pStmt->pNext = pConn->pStmts;
+  pConn->pStmts = pStmt;
+  sqlite3_result_int64(context, pStmt->iHandle);
+}
+
+/*
+** SQL function: cypher_finalize(handle)
+**
+** Frees a statement made by cypher_prepare(). Returns 1, or 0 if there
+** is no such statement.
+*/
+static void cypherFinalizeSqlFunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+) {
+  CypherConn *pConn = (CypherConn*)sqlite3_user_data(context);
+  sqlite3_int64 iHandle = sqlite3_value_int64(argv[0]);
+  CypherStmt **pp;
+  (void)argc;
+  
+  for( pp = &pConn->pStmts; *pp; pp = &(*pp)->pNext ) {
+    CypherStmt *pStmt = *pp;
+    if( pStmt->iHandle != iHandle ) continue;
+    if( pStmt->bBusy ) {
+      sqlite3_result_error(context, "Cypher statement is in use", -1);
+      return;
+    }
+    *pp = pStmt->pNext;
+    cypherStmtFinalize(pStmt);
+    sqlite3_result_int(context, 1);
+    return;
+  }
+  sqlite3_result_int(context, 0);
+}
+
 /*
 ** SQL function: cypher_test_execute()
 **
@@ -325,17 +1008,413 @@ static void cypherTestExecuteSqlFunc(
   }
 }
 
+/*
+** Table-valued function: cypher_query(query_text [, params_json])
+**
+** Streams the rows of a Cypher query. Each xNext pulls one row from the
+** root iterator, so memory use does not grow with the result size and a
+** SQL LIMIT stops the query early. A cypher_prepare() handle in place
+** of the text streams that statement, with params_json bound to it.
+**
+** Usage: SELECT col0, col1 FROM cypher_query('MATCH (n:Person) RETURN n')
+**          LIMIT 10;
+**        SELECT row FROM cypher_query(1, '{"id": 42}');
+**
+** Columns:
+**   row      - the whole row as a JSON object (subtype 'J')
+**   col0..   - the first CYPHER_QUERY_COLUMNS values, natively typed:
+**              integers, floats, text, booleans as 0/1, nodes and
+**              relationships as their ids, lists and maps as JSON
+**   query    - hidden; the query text or statement handle argument
+**   params   - hidden; the parameters argument
+*/
+#define CYPHER_QUERY_COLUMNS 8
+#define CYPHER_QUERY_COL_ROW 0
+#define CYPHER_QUERY_COL_QUERY (CYPHER_QUERY_COLUMNS+1)
+#define CYPHER_QUERY_COL_PARAMS (CYPHER_QUERY_COLUMNS+2)
+
+typedef struct CypherQueryVtab CypherQueryVtab;
+struct CypherQueryVtab {
+  sqlite3_vtab base;            /* Base class - must be first */
+  sqlite3 *db;                  /* Connection the queries run on */
+  CypherConn *pConn;            /* The connection's Cypher state */
+};
+
+typedef struct CypherQueryCursor CypherQueryCursor;
+struct CypherQueryCursor {
+  sqlite3_vtab_cursor base;     /* Base class - must be first */
+  CypherStmt *pStmt;            /* Statement being streamed, or NULL */
+  int bOwned;                   /* pStmt was made for the query text */
+  CypherResult *pRow;           /* Current row, NULL at EOF */
+  sqlite3_int64 iRowid;         /* Rows returned so far */
+  CypherJsonWriter json;        /* Formats the row column, reused */
+};
+
+static int cypherQueryConnect(sqlite3 *db, void *pAux, int argc,
+                              const char *const *argv, sqlite3_vtab **ppVtab,
+                              char **pzErr) {
+  CypherQueryVtab *pNew;
+  char *zSchema;
+  int rc;
+  int i;
+  (void)argc; (void)argv; (void)pzErr;
+  
+  zSchema = sqlite3_mprintf("CREATE TABLE x(row");
+  for( i = 0; zSchema && i < CYPHER_QUERY_COLUMNS; i++ ) {
+    zSchema = sqlite3_mprintf("%z, col%d", zSchema, i);
+  }
+  if( zSchema ) {
+    zSchema = sqlite3_mprintf("%z, query HIDDEN, params HIDDEN)", zSchema);
+  }
+  if( !zSchema ) return SQLITE_NOMEM;
+  
+  rc = sqlite3_declare_vtab(db, zSchema);
+  sqlite3_free(zSchema);
+  if( rc != SQLITE_OK ) return rc;
+  
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( !pNew ) return SQLITE_NOMEM;
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->db = db;
+  pNew->pConn = (CypherConn*)pAux;
+  
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+static int cypherQueryDisconnect(sqlite3_vtab *pVtab) {
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+/*
+** The query text must be supplied as an equality constraint on the
+** hidden column, and the parameters, when given, on theirs. A plan
+** without the query is still costed, as a very expensive one, so that
+** SQLite prefers join orders that can supply it. idxNum has bit 0 set
+** for the query and bit 1 for the parameters.
+*/
+static int cypherQueryBestIndex(sqlite3_vtab *pVtab,
+                                sqlite3_index_info *pInfo) {
+  int iQuery = -1;
+  int iParams = -1;
+  int bUnusable = 0;
+  int i;
+  (void)pVtab;
+  
+  for( i = 0; i < pInfo->nConstraint; i++ ) {
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    if( pCons->iColumn != CYPHER_QUERY_COL_QUERY &&
+        pCons->iColumn != CYPHER_QUERY_COL_PARAMS ) continue;
+    if( pCons->op != SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !pCons->usable ) {
+      bUnusable = 1;
+    } else if( pCons->iColumn == CYPHER_QUERY_COL_QUERY ) {
+      if( iQuery < 0 ) iQuery = i;
+    } else {
+      if( iParams < 0 ) iParams = i;
+    }
+  }
+  
+  if( iQuery >= 0 && !bUnusable ) {
+    pInfo->aConstraintUsage[iQuery].argvIndex = 1;
+    pInfo->aConstraintUsage[iQuery].omit = 1;
+    pInfo->idxNum = 1;
+    if( iParams >= 0 ) {
+      pInfo->aConstraintUsage[iParams].argvIndex = 2;
+      pInfo->aConstraintUsage[iParams].omit = 1;
+      pInfo->idxNum |= 2;
+    }
+    pInfo->estimatedCost = 1000.0;
+    pInfo->estimatedRows = 1000;
+  } else {
+    if( bUnusable ) return SQLITE_CONSTRAINT;
+    pInfo->idxNum = 0;
+    pInfo->estimatedCost = 1e99;
+  }
+  return SQLITE_OK;
+}
+
+static int cypherQueryOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+  CypherQueryCursor *pCur;
+  (void)pVtab;
+  
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( !pCur ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+/*
+** Let go of the statement of a cursor: free it if it was made for the
+** query text, else reset it for its next user.
+*/
+static void cypherQueryCursorReset(CypherQueryCursor *pCur) {
+  if( pCur->bOwned ) {
+    cypherStmtFinalize(pCur->pStmt);
+  } else if( pCur->pStmt ) {
+    cypherStmtReset(pCur->pStmt);
+    pCur->pStmt->bBusy = 0;
+  }
+  pCur->pStmt = NULL;
+  pCur->bOwned = 0;
+  pCur->pRow = NULL;
+  pCur->iRowid = 0;
+}
+
+static int cypherQueryClose(sqlite3_vtab_cursor *pCursor) {
+  CypherQueryCursor *pCur = (CypherQueryCursor*)pCursor;
+  cypherQueryCursorReset(pCur);
+  cypherJsonWriterReset(&pCur->json);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+/*
+** Step the statement into pCur->pRow, leaving it NULL once the query is
+** exhausted. The row is the statement's, its values living in the
+** statement arena until the next step clears them.
+*/
+static int cypherQueryStep(CypherQueryCursor *pCur) {
+  int rc = cypherStmtStep(pCur->pStmt);
+  
+  if( rc == SQLITE_ROW ) {
+    pCur->pRow = cypherStmtRow(pCur->pStmt);
+    pCur->iRowid++;
+    return SQLITE_OK;
+  }
+  
+  pCur->pRow = NULL;
+  if( rc == SQLITE_DONE ) return SQLITE_OK;
+  
+  sqlite3_free(pCur->base.pVtab->zErrMsg);
+  pCur->base.pVtab->zErrMsg = sqlite3_mprintf("%s",
+      cypherStmtErrmsg(pCur->pStmt) ? cypherStmtErrmsg(pCur->pStmt) :
+      "Execution error");
+  return rc;
+}
+
+static int cypherQueryFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                             const char *idxStr, int argc,
+                             sqlite3_value **argv) {
+  CypherQueryCursor *pCur = (CypherQueryCursor*)pCursor;
+  CypherQueryVtab *pVtab = (CypherQueryVtab*)pCursor->pVtab;
+  const char *zQuery;
+  const char *zParams = NULL;
+  char *zErr = NULL;
+  int rc = SQLITE_OK;
+  (void)idxStr;
+  
+  cypherQueryCursorReset(pCur);
+  
+  if( !(idxNum & 1) || argc < 1 ) {
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("cypher_query() requires a query argument");
+    return SQLITE_ERROR;
+  }
+  if( (idxNum & 2) && argc > 1 ) zParams = (const char*)sqlite3_value_text(argv[1]);
+  
+  if( sqlite3_value_type(argv[0]) == SQLITE_INTEGER ) {
+    pCur->pStmt = cypherConnStmt(pVtab->pConn, sqlite3_value_int64(argv[0]), &zErr);
+    if( pCur->pStmt ) {
+      cypherStmtReset(pCur->pStmt);
+      pCur->pStmt->bBusy = 1;
+    } else {
+      rc = SQLITE_ERROR;
+    }
+  } else {
+    /* A NULL query yields no rows, like cypher_execute(NULL) */
+    zQuery = (const char*)sqlite3_value_text(argv[0]);
+    if( !zQuery ) return SQLITE_OK;
+    rc = cypherStmtCreate(pVtab->db, pVtab->pConn->pFront, NULL, zQuery,
+                          &pCur->pStmt, &zErr);
+    pCur->bOwned = pCur->pStmt != NULL;
+  }
+  if( rc == SQLITE_OK && zParams ) rc = cypherStmtBindJson(pCur->pStmt, zParams, &zErr);
+  if( rc != SQLITE_OK ) {
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = zErr ? zErr : sqlite3_mprintf("%s", sqlite3_errstr(rc));
+    return rc;
+  }
+  
+  return cypherQueryStep(pCur);
+}
+
+static int cypherQueryNext(sqlite3_vtab_cursor *pCursor) {
+  return cypherQueryStep((CypherQueryCursor*)pCursor);
+}
+
+static int cypherQueryEof(sqlite3_vtab_cursor *pCursor) {
+  return ((CypherQueryCursor*)pCursor)->pRow == NULL;
+}
+
+/*
+** Return a value as the closest SQL type. Values without one are
+** returned as JSON text.
+*/
+static void cypherQueryResultValue(sqlite3_context *pCtx,
+                                   const CypherValue *pValue) {
+  char *zJson;
+  
+  switch( pValue->type ) {
+    case CYPHER_VALUE_NULL:
+      sqlite3_result_null(pCtx);
+      return;
+    case CYPHER_VALUE_BOOLEAN:
+      sqlite3_result_int(pCtx, pValue->u.bBoolean ? 1 : 0);
+      return;
+    case CYPHER_VALUE_INTEGER:
+      sqlite3_result_int64(pCtx, pValue->u.iInteger);
+      return;
+    case CYPHER_VALUE_FLOAT:
+      sqlite3_result_double(pCtx, pValue->u.rFloat);
+      return;
+    case CYPHER_VALUE_STRING:
+      sqlite3_result_text(pCtx, pValue->u.zString ? pValue->u.zString : "",
+                          -1, SQLITE_TRANSIENT);
+      return;
+    case CYPHER_VALUE_NODE:
+      sqlite3_result_int64(pCtx, pValue->u.iNodeId);
+      return;
+    case CYPHER_VALUE_RELATIONSHIP:
+      sqlite3_result_int64(pCtx, pValue->u.iRelId);
+      return;
+    default:
+      break;
+  }
+  
+  zJson = cypherValueToJson(pValue);
+  if( !zJson ) {
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  sqlite3_result_text(pCtx, zJson, -1, sqlite3_free);
+  sqlite3_result_subtype(pCtx, 'J');
+}
+
+static int cypherQueryColumn(sqlite3_vtab_cursor *pCursor,
+                             sqlite3_context *pCtx, int iCol) {
+  CypherQueryCursor *pCur = (CypherQueryCursor*)pCursor;
+  CypherResult *pRow = pCur->pRow;
+  
+  if( iCol == CYPHER_QUERY_COL_ROW ) {
+    pCur->json.n = 0;
+    cypherJsonAppendRow(&pCur->json, pRow);
+    if( pCur->json.bOom ) {
+      pCur->json.bOom = 0;
+      return SQLITE_NOMEM;
+    }
+    sqlite3_result_text64(pCtx, pCur->json.z, pCur->json.n, SQLITE_TRANSIENT,
+                          SQLITE_UTF8);
+    sqlite3_result_subtype(pCtx, 'J');
+  } else if( iCol >= CYPHER_QUERY_COL_QUERY ) {
+    sqlite3_result_null(pCtx);
+  } else if( iCol - 1 < pRow->nColumns ) {
+    cypherQueryResultValue(pCtx, &pRow->aValues[iCol - 1]);
+  } else {
+    sqlite3_result_null(pCtx);
+  }
+  return SQLITE_OK;
+}
+
+static int cypherQueryRowid(sqlite3_vtab_cursor *pCursor,
+                            sqlite3_int64 *pRowid) {
+  *pRowid = ((CypherQueryCursor*)pCursor)->iRowid;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only module: xCreate is NULL, so cypher_query exists in
+** every schema without CREATE VIRTUAL TABLE.
+*/
+static sqlite3_module cypherQueryModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  cypherQueryConnect,     /* xConnect */
+  cypherQueryBestIndex,   /* xBestIndex */
+  cypherQueryDisconnect,  /* xDisconnect */
+  0,                      /* xDestroy */
+  cypherQueryOpen,        /* xOpen */
+  cypherQueryClose,       /* xClose */
+  cypherQueryFilter,      /* xFilter */
+  cypherQueryNext,        /* xNext */
+  cypherQueryEof,         /* xEof */
+  cypherQueryColumn,      /* xColumn */
+  cypherQueryRowid,       /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
 /*
 ** Register all Cypher executor SQL functions with the database.
-** This should be called during extension initialization.
+** This should be called during extension initialization, after the plan
+** cache is created. cypher_execute(), cypher_query() and
+** cypher_prepare() share the connection's front plan cache and
+** prepared statements in a CypherConn; each registration holds a
+** reference, which SQLite drops when the registration fails or the
+** connection closes.
 */
 int cypherRegisterExecutorSqlFunctions(sqlite3 *db) {
+  CypherConn *pConn;
   int rc = SQLITE_OK;
   
-  /* Register cypher_execute function */
-  rc = sqlite3_create_function(db, "cypher_execute", 1, 
+  pConn = sqlite3_malloc(sizeof(*pConn));
+  if( !pConn ) return SQLITE_NOMEM;
+  memset(pConn, 0, sizeof(*pConn));
+  pConn->pFront = graphPlanFrontCacheCreate();
+  if( !pConn->pFront ) {
+    sqlite3_free(pConn);
+    return SQLITE_NOMEM;
+  }
+  graphPlanFrontCacheRef(pConn->pFront);
+  
+  /* Register cypher_execute function, with and without parameters */
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_execute", 1, 
+                              SQLITE_UTF8,
+                              pConn, cypherExecuteSqlFunc, 0, 0,
+                              cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_execute", 2,
                               SQLITE_UTF8,
-                              0, cypherExecuteSqlFunc, 0, 0);
+                              pConn, cypherExecuteSqlFunc, 0, 0,
+                              cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
+  /* Register cypher_prepare, with and without a graph, and cypher_finalize */
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_prepare", 1,
+                              SQLITE_UTF8,
+                              pConn, cypherPrepareSqlFunc, 0, 0,
+                              cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_prepare", 2,
+                              SQLITE_UTF8,
+                              pConn, cypherPrepareSqlFunc, 0, 0,
+                              cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_finalize", 1,
+                              SQLITE_UTF8,
+                              pConn, cypherFinalizeSqlFunc, 0, 0,
+                              cypherConnUnref);
   if( rc != SQLITE_OK ) return rc;
   
   /* Register cypher_execute_explain function */
@@ -344,11 +1423,32 @@ int cypherRegisterExecutorSqlFunctions(sqlite3 *db) {
                               0, cypherExecuteExplainSqlFunc, 0, 0);
   if( rc != SQLITE_OK ) return rc;
   
+  /* Register cypher_explain_analyze, sharing the plan cache */
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_explain_analyze", 1,
+                              SQLITE_UTF8,
+                              pConn, cypherExplainAnalyzeSqlFunc, 0, 0,
+                              cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
+  cypherConnRef(pConn);
+  rc = sqlite3_create_function_v2(db, "cypher_explain_analyze", 2,
+                              SQLITE_UTF8,
+                              pConn, cypherExplainAnalyzeSqlFunc, 0, 0,
+                              cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
   /* Register cypher_test_execute function */
   rc = sqlite3_create_function(db, "cypher_test_execute", 0,
                               SQLITE_UTF8,
                               0, cypherTestExecuteSqlFunc, 0, 0);
   if( rc != SQLITE_OK ) return rc;
   
+  /* Register the cypher_query table-valued function */
+  cypherConnRef(pConn);
+  rc = sqlite3_create_module_v2(db, "cypher_query", &cypherQueryModule, pConn,
+                                cypherConnUnref);
+  if( rc != SQLITE_OK ) return rc;
+  
   return SQLITE_OK;
-}
\ No newline at end of file
+}
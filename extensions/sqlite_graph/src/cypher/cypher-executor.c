@@ -9,6 +9,7 @@
 ** - Physical plan execution coordination
 ** - Iterator lifecycle management
 ** - Result collection and formatting
+** - Row adapter over batch-capable (xNextBatch) root iterators
 ** - Error handling and cleanup
 **
 ** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
@@ -21,6 +22,8 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-executor.h"
+#include "cypher-chunk.h"
+#include "graph-metrics.h"
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
@@ -57,12 +60,21 @@ CypherExecutor *cypherExecutorCreate(sqlite3 *pDb, GraphVtab *pGraph) {
 void cypherExecutorDestroy(CypherExecutor *pExecutor) {
   if( !pExecutor ) return;
   
+  cypherExecutorClose(pExecutor);
   cypherIteratorDestroy(pExecutor->pRootIterator);
+  cypherChunkFree(pExecutor->pChunk);
   executionContextDestroy(pExecutor->pContext);
   sqlite3_free(pExecutor->zErrorMsg);
   sqlite3_free(pExecutor);
 }
 
+/* Count the query and each of its operators in the process metrics */
+static void countPlanMetrics(PhysicalPlanNode *pPlan) {
+  int i;
+  graphMetricOperator(pPlan->type);
+  for( i = 0; i < pPlan->nChildren; i++ ) countPlanMetrics(pPlan->apChildren[i]);
+}
+
 /*
 ** Recursively create iterators from a physical plan tree.
 ** Returns the root iterator, or NULL on error.
@@ -88,10 +100,8 @@ static CypherIterator *createIteratorTree(PhysicalPlanNode *pPlan, ExecutionCont
     for( int i = 0; i < pPlan->nChildren; i++ ) {
       pChild = createIteratorTree(pPlan->apChildren[i], pContext);
       if( !pChild ) {
-        /* Clean up partial iterator tree */
-        for( int j = 0; j < i; j++ ) {
-          cypherIteratorDestroy(pIterator->apChildren[j]);
-        }
+        /* Clean up partial iterator tree; the children built so far
+        ** go with their parent */
         cypherIteratorDestroy(pIterator);
         return NULL;
       }
@@ -111,9 +121,14 @@ int cypherExecutorPrepare(CypherExecutor *pExecutor, PhysicalPlanNode *pPlan) {
   if( !pExecutor || !pPlan ) return SQLITE_MISUSE;
   
   /* Clean up any previous iterator */
+  cypherExecutorClose(pExecutor);
   cypherIteratorDestroy(pExecutor->pRootIterator);
   pExecutor->pRootIterator = NULL;
   
+  /* The chunk's columns belong to the old plan */
+  cypherChunkFree(pExecutor->pChunk);
+  pExecutor->pChunk = NULL;
+  
   /* Store plan reference */
   pExecutor->pPlan = pPlan;
   
@@ -124,122 +139,154 @@ int cypherExecutorPrepare(CypherExecutor *pExecutor, PhysicalPlanNode *pPlan) {
     return SQLITE_ERROR;
   }
   
+  graphMetricAdd(GRAPH_METRIC_QUERIES, 1);
+  countPlanMetrics(pPlan);
   return SQLITE_OK;
 }
 
 /*
-** Execute the prepared query and collect all results.
+** Supply the parameters bound to the plan's $name slots.
+*/
+void cypherExecutorSetParams(CypherExecutor *pExecutor, const CypherParams *pParams) {
+  if( pExecutor ) pExecutor->pContext->pParams = pParams;
+}
+
+/*
+** Open the prepared plan for row-at-a-time execution.
 ** Returns SQLITE_OK on success, error code on failure.
-** Results are returned as a JSON array string.
 */
-int cypherExecutorExecute(CypherExecutor *pExecutor, char **pzResults) {
+int cypherExecutorOpen(CypherExecutor *pExecutor) {
   CypherIterator *pRoot;
-  char *zResultArray = NULL;
-  int nResults = 0;
-  int nAllocated = 256;
-  int nUsed = 0;
   int rc;
   
-  if( !pExecutor || !pzResults ) return SQLITE_MISUSE;
+  if( !pExecutor ) return SQLITE_MISUSE;
   if( !pExecutor->pRootIterator ) return SQLITE_ERROR;
   
-  *pzResults = NULL;
+  cypherExecutorClose(pExecutor);
+  sqlite3_free(pExecutor->pContext->zErrorMsg);
+  pExecutor->pContext->zErrorMsg = 0;
   pRoot = pExecutor->pRootIterator;
-  
-  /* Allocate result buffer */
-  zResultArray = sqlite3_malloc(nAllocated);
-  if( !zResultArray ) return SQLITE_NOMEM;
-  
-  /* Start JSON array */
-  nUsed = snprintf(zResultArray, nAllocated, "[");
-  
-  /* Open root iterator */
   rc = pRoot->xOpen(pRoot);
   if( rc != SQLITE_OK ) {
-    pExecutor->zErrorMsg = sqlite3_mprintf("Failed to open root iterator");
-    sqlite3_free(zResultArray);
+    sqlite3_free(pExecutor->zErrorMsg);
+    pExecutor->zErrorMsg = sqlite3_mprintf("%s", pExecutor->pContext->zErrorMsg ?
+        pExecutor->pContext->zErrorMsg : "Failed to open root iterator");
+    pRoot->xClose(pRoot);
     return rc;
   }
+  pExecutor->bOpen = 1;
+  pExecutor->pContext->nRowsProduced = 0;
   
-  /* Iterate through results */
-  while( 1 ) {
-    CypherResult *pResult = cypherResultCreate();
-    if( !pResult ) {
-      rc = SQLITE_NOMEM;
-      break;
+  return SQLITE_OK;
+}
+
+/*
+** Produce the next result row into pResult.
+** Returns SQLITE_OK with a row, SQLITE_DONE at the end, or an error code.
+**
+** A root iterator with xNextBatch runs the whole pipeline in chunks;
+** rows become CypherResults only here, one live chunk row per call.
+*/
+int cypherExecutorNext(CypherExecutor *pExecutor, CypherResult *pResult) {
+  CypherIterator *pRoot;
+  int rc;
+  
+  if( !pExecutor || !pResult ) return SQLITE_MISUSE;
+  if( !pExecutor->bOpen ) return SQLITE_DONE;
+  
+  pRoot = pExecutor->pRootIterator;
+  if( pRoot->xNextBatch ) {
+    rc = SQLITE_OK;
+    if( !pExecutor->pChunk ) rc = cypherChunkCreate(&pExecutor->pChunk);
+    while( rc == SQLITE_OK && pExecutor->iChunkRow >= pExecutor->pChunk->nSel ) {
+      pExecutor->iChunkRow = 0;
+      rc = cypherIteratorNextBatch(pRoot, pExecutor->pChunk);
+      if( rc != SQLITE_OK ) pExecutor->pChunk->nSel = 0;
     }
-    
-    /* Get next result row */
+    if( rc == SQLITE_OK ) {
+      rc = cypherChunkToResult(pExecutor->pChunk, pExecutor->iChunkRow++, pResult);
+    }
+  } else {
     rc = pRoot->xNext(pRoot, pResult);
-    if( rc == SQLITE_DONE ) {
-      cypherResultDestroy(pResult);
-      rc = SQLITE_OK;
-      break;
-    } else if( rc != SQLITE_OK ) {
-      cypherResultDestroy(pResult);
-      pExecutor->zErrorMsg = sqlite3_mprintf("Iterator error: %d", rc);
+  }
+  if( rc == SQLITE_OK ) {
+    pExecutor->pContext->nRowsProduced++;
+  } else if( rc != SQLITE_DONE ) {
+    sqlite3_free(pExecutor->zErrorMsg);
+    pExecutor->zErrorMsg = pExecutor->pContext->zErrorMsg ?
+        sqlite3_mprintf("%s", pExecutor->pContext->zErrorMsg) :
+        sqlite3_mprintf("Iterator error: %d", rc);
+  }
+  
+  return rc;
+}
+
+/*
+** Close the root iterator opened by cypherExecutorOpen().
+** Safe to call when the executor is not open.
+*/
+void cypherExecutorClose(CypherExecutor *pExecutor) {
+  if( !pExecutor || !pExecutor->bOpen ) return;
+  
+  pExecutor->pRootIterator->xClose(pExecutor->pRootIterator);
+  cypherChunkReset(pExecutor->pChunk);
+  pExecutor->iChunkRow = 0;
+  pExecutor->bOpen = 0;
+}
+
+/*
+** Execute the prepared query and collect all results.
+** Returns SQLITE_OK on success, error code on failure.
+** Results are returned as a JSON array string, written row by row into
+** one buffer.
+*/
+int cypherExecutorExecute(CypherExecutor *pExecutor, char **pzResults) {
+  CypherResult *pResult;
+  CypherJsonWriter writer;
+  int nResults = 0;
+  int rc;
+  
+  if( !pExecutor || !pzResults ) return SQLITE_MISUSE;
+  if( !pExecutor->pRootIterator ) return SQLITE_ERROR;
+  
+  *pzResults = NULL;
+  
+  rc = cypherExecutorOpen(pExecutor);
+  if( rc != SQLITE_OK ) return rc;
+  
+  cypherJsonWriterInit(&writer);
+  cypherJsonAppend(&writer, "[", 1);
+  
+  /* Iterate through results, reusing one arena-backed row */
+  pResult = executionContextRowAcquire(pExecutor->pContext);
+  if( !pResult ) rc = SQLITE_NOMEM;
+  while( pResult ) {
+    /* Get next result row */
+    cypherResultClear(pResult);
+    rc = cypherExecutorNext(pExecutor, pResult);
+    if( rc != SQLITE_OK ) {
+      if( rc == SQLITE_DONE ) rc = SQLITE_OK;
       break;
     }
     
-    /* Convert result to JSON */
-    char *zRowJson = cypherResultToJson(pResult);
-    cypherResultDestroy(pResult);
-    
-    if( !zRowJson ) {
+    if( nResults > 0 ) cypherJsonAppend(&writer, ",", 1);
+    cypherJsonAppendRow(&writer, pResult);
+    if( writer.bOom ) {
       rc = SQLITE_NOMEM;
       break;
     }
-    
-    /* Calculate space needed */
-    int nRowLen = strlen(zRowJson);
-    int nNeeded = nUsed + (nResults > 0 ? 1 : 0) + nRowLen;
-    
-    /* Resize buffer if needed */
-    if( nNeeded + 2 >= nAllocated ) {
-      nAllocated = (nNeeded + 256) * 2;
-      char *zNew = sqlite3_realloc(zResultArray, nAllocated);
-      if( !zNew ) {
-        sqlite3_free(zRowJson);
-        sqlite3_free(zResultArray);
-        rc = SQLITE_NOMEM;
-        break;
-      }
-      zResultArray = zNew;
-    }
-    
-    /* Add result to array */
-    if( nResults > 0 ) {
-      zResultArray[nUsed++] = ',';
-    }
-    memcpy(zResultArray + nUsed, zRowJson, nRowLen);
-    nUsed += nRowLen;
-    
-    sqlite3_free(zRowJson);
-        sqlite3_free(zResultArray);
     nResults++;
-    
-    /* Sanity check to prevent infinite loops */
-    if( nResults > 10000 ) {
-      pExecutor->zErrorMsg = sqlite3_mprintf("Result limit exceeded (10000 rows)");
-      rc = SQLITE_ERROR;
-      break;
-    }
   }
+  executionContextRowRelease(pExecutor->pContext, pResult);
   
-  /* Close iterator */
-  pRoot->xClose(pRoot);
+  cypherExecutorClose(pExecutor);
   
+  cypherJsonAppend(&writer, "]", 1);
   if( rc == SQLITE_OK ) {
-    /* Close JSON array */
-    if( nUsed + 2 < nAllocated ) {
-      zResultArray[nUsed++] = ']';
-      zResultArray[nUsed] = '\0';
-    }
-    
-    *pzResults = zResultArray;
-  } else {
-    sqlite3_free(zResultArray);
+    *pzResults = cypherJsonWriterFinish(&writer);
+    if( !*pzResults ) rc = SQLITE_NOMEM;
   }
+  cypherJsonWriterReset(&writer);
   
   return rc;
 }
@@ -297,7 +344,7 @@ char *cypherExecuteTestQuery(sqlite3 *pDb, const char *zQuery) {
   if( !pAst ) goto cleanup;
   
   /* Plan query */
-  pPlanner = cypherPlannerCreate(pDb, NULL);
+  pPlanner = cypherPlannerCreate(pDb, graphRegistryFind(pDb, NULL));
   if( !pPlanner ) goto cleanup;
   
   rc = cypherPlannerCompile(pPlanner, pAst);
@@ -429,14 +476,8 @@ int cypherExecutorExecuteWithStats(CypherExecutor *pExecutor, char **pzResults,
   if (rc == SQLITE_OK) {
     *pzResults = zResults;
     
-    /* Count results */
-    if (zResults) {
-      char *p = zResults;
-      while ((p = strchr(p, '{')) != NULL) {
-        nResults++;
-        p++;
-      }
-    }
+    /* Rows handed out by cypherExecutorNext() */
+    nResults = pExecutor->pContext->nRowsProduced;
     
     /* Collect iterator statistics */
     if (pExecutor->pRootIterator) {
@@ -17,10 +17,6 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "cypher-expressions.h"
 
 /* Forward declarations */
-int cypherEvaluateArithmetic(const CypherValue *pLeft, const CypherValue *pRight, 
-                           CypherArithmeticOp op, CypherValue *pResult);
-int cypherEvaluateComparison(const CypherValue *pLeft, const CypherValue *pRight, 
-                           CypherComparisonOp op, CypherValue *pResult);
 int cypherEvaluateFunction(const char *zName, CypherExpression **apArgs, int nArgs,
                          ExecutionContext *pContext, CypherValue *pResult);
 
@@ -58,6 +54,10 @@ int cypherExpressionDestroy(CypherExpression *pExpr) {
             sqlite3_free(pExpr->u.variable.zName);
             break;
             
+        case CYPHER_EXPR_PARAMETER:
+            sqlite3_free(pExpr->u.parameter.zName);
+            break;
+            
         case CYPHER_EXPR_PROPERTY:
             cypherExpressionDestroy(pExpr->u.property.pObject);
             sqlite3_free(pExpr->u.property.zProperty);
@@ -118,14 +118,7 @@ int cypherExpressionEvaluate(const CypherExpression *pExpr,
     switch (pExpr->type) {
         case CYPHER_EXPR_LITERAL:
             {
-                CypherValue *pCopy = cypherValueCopy((CypherValue*)&pExpr->u.literal);
-                if( pCopy ) {
-                    *pResult = *pCopy;
-                    sqlite3_free(pCopy);
-                    return SQLITE_OK;
-                } else {
-                    return SQLITE_NOMEM;
-                }
+                return cypherValueCopyIn(0, pResult, &pExpr->u.literal);
             }
             
         case CYPHER_EXPR_VARIABLE:
@@ -133,8 +126,7 @@ int cypherExpressionEvaluate(const CypherExpression *pExpr,
             if (pContext && pExpr->u.variable.zName) {
                 CypherValue *pValue = executionContextGet(pContext, pExpr->u.variable.zName);
                 if (pValue) {
-                    *pResult = *cypherValueCopy(pValue);
-                    if (pResult->type == CYPHER_VALUE_NULL) {
+                    if (cypherValueCopyIn(0, pResult, pValue)) {
                         return SQLITE_NOMEM; /* Copy failed */
                     }
                 } else {
@@ -171,8 +163,11 @@ int cypherExpressionEvaluate(const CypherExpression *pExpr,
             rc = cypherExpressionEvaluate(pExpr->u.binary.pLeft, pContext, &left);
             if (rc != SQLITE_OK) goto comparison_cleanup;
             
-            rc = cypherExpressionEvaluate(pExpr->u.binary.pRight, pContext, &right);
-            if (rc != SQLITE_OK) goto comparison_cleanup;
+            /* IS NULL and IS NOT NULL are unary */
+            if (pExpr->u.binary.pRight) {
+                rc = cypherExpressionEvaluate(pExpr->u.binary.pRight, pContext, &right);
+                if (rc != SQLITE_OK) goto comparison_cleanup;
+            }
             
             rc = cypherEvaluateComparison(&left, &right, 
                                         (CypherComparisonOp)pExpr->u.binary.op, 
@@ -183,6 +178,69 @@ int cypherExpressionEvaluate(const CypherExpression *pExpr,
             cypherValueDestroy(&right);
             return rc;
             
+        case CYPHER_EXPR_LOGICAL:
+            cypherValueInit(&left);
+            cypherValueInit(&right);
+            
+            /* NOT keeps its operand in pLeft */
+            rc = cypherExpressionEvaluate(pExpr->u.binary.pLeft, pContext, &left);
+            if (rc != SQLITE_OK) goto logical_cleanup;
+            
+            if (pExpr->u.binary.op == CYPHER_LOGIC_NOT) {
+                rc = cypherEvaluateLogical(NULL, &left, CYPHER_LOGIC_NOT, pResult);
+                goto logical_cleanup;
+            }
+            
+            rc = cypherExpressionEvaluate(pExpr->u.binary.pRight, pContext, &right);
+            if (rc != SQLITE_OK) goto logical_cleanup;
+            
+            rc = cypherEvaluateLogical(&left, &right,
+                                     (CypherLogicalOp)pExpr->u.binary.op,
+                                     pResult);
+                                     
+        logical_cleanup:
+            cypherValueDestroy(&left);
+            cypherValueDestroy(&right);
+            return rc;
+            
+        case CYPHER_EXPR_PARAMETER:
+            return cypherParameterValue(pContext, pExpr->u.parameter.zName, pResult);
+            
+        case CYPHER_EXPR_PROPERTY:
+            if (!pContext) {
+                cypherValueSetNull(pResult);
+                return SQLITE_OK;
+            }
+            cypherValueInit(&left);
+            rc = cypherExpressionEvaluate(pExpr->u.property.pObject, pContext, &left);
+            if (rc == SQLITE_OK) {
+                rc = executionContextProperty(pContext, &left, pExpr->u.property.zProperty,
+                                              pResult);
+            }
+            cypherValueDestroy(&left);
+            return rc;
+            
+        case CYPHER_EXPR_LIST: {
+            CypherValue *aValues = NULL;
+            int i, n = pExpr->u.list.nElements;
+            
+            if (n > 0) {
+                aValues = sqlite3_malloc(n * sizeof(CypherValue));
+                if (!aValues) return SQLITE_NOMEM;
+                memset(aValues, 0, n * sizeof(CypherValue));
+            }
+            for (i = 0; rc == SQLITE_OK && i < n; i++) {
+                rc = cypherExpressionEvaluate(pExpr->u.list.apElements[i], pContext, &aValues[i]);
+            }
+            if (rc != SQLITE_OK) {
+                while (--i >= 0) cypherValueDestroy(&aValues[i]);
+                sqlite3_free(aValues);
+                return rc;
+            }
+            cypherValueSetList(pResult, aValues, n);
+            return SQLITE_OK;
+        }
+            
         case CYPHER_EXPR_FUNCTION:
             return cypherEvaluateFunction(pExpr->u.function.zName,
                                         pExpr->u.function.apArgs,
@@ -209,6 +267,34 @@ int cypherEvaluateArithmetic(const CypherValue *pLeft, const CypherValue *pRight
         return SQLITE_OK;
     }
     
+    /* Integer arithmetic stays exact beyond 2^53; overflow wraps */
+    if (pLeft->type == CYPHER_VALUE_INTEGER && pRight->type == CYPHER_VALUE_INTEGER) {
+        sqlite3_uint64 a = (sqlite3_uint64)pLeft->u.iInteger;
+        sqlite3_uint64 b = (sqlite3_uint64)pRight->u.iInteger;
+        switch (op) {
+            case CYPHER_OP_ADD:
+                cypherValueSetInteger(pResult, (sqlite3_int64)(a + b));
+                return SQLITE_OK;
+            case CYPHER_OP_SUBTRACT:
+                cypherValueSetInteger(pResult, (sqlite3_int64)(a - b));
+                return SQLITE_OK;
+            case CYPHER_OP_MULTIPLY:
+                cypherValueSetInteger(pResult, (sqlite3_int64)(a * b));
+                return SQLITE_OK;
+            case CYPHER_OP_MODULO:
+                if (pRight->u.iInteger == 0) {
+                    cypherValueSetNull(pResult);
+                } else if (pRight->u.iInteger == -1) {
+                    cypherValueSetInteger(pResult, 0);
+                } else {
+                    cypherValueSetInteger(pResult, pLeft->u.iInteger % pRight->u.iInteger);
+                }
+                return SQLITE_OK;
+            default:
+                break;
+        }
+    }
+    
     /* Convert to numeric values */
     if (pLeft->type == CYPHER_VALUE_INTEGER) {
         leftVal = (double)pLeft->u.iInteger;
@@ -292,8 +378,15 @@ int cypherEvaluateComparison(const CypherValue *pLeft, const CypherValue *pRight
         return SQLITE_OK;
     }
     
-    /* Compare values */
-    cmp = cypherValueCompare(pLeft, pRight);
+    /* Compare values; integers and floats compare by value */
+    if ((pLeft->type == CYPHER_VALUE_INTEGER && pRight->type == CYPHER_VALUE_FLOAT) ||
+        (pLeft->type == CYPHER_VALUE_FLOAT && pRight->type == CYPHER_VALUE_INTEGER)) {
+        double a = pLeft->type == CYPHER_VALUE_INTEGER ? (double)pLeft->u.iInteger : pLeft->u.rFloat;
+        double b = pRight->type == CYPHER_VALUE_INTEGER ? (double)pRight->u.iInteger : pRight->u.rFloat;
+        cmp = (a > b) - (a < b);
+    } else {
+        cmp = cypherValueCompare(pLeft, pRight);
+    }
     
     switch (op) {
         case CYPHER_CMP_EQUAL:
@@ -430,25 +523,397 @@ int cypherExpressionCreateLiteral(CypherExpression **ppExpr, const CypherValue *
     rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_LITERAL);
     if (rc != SQLITE_OK) return rc;
     
-    {
-        CypherValue *pCopy = cypherValueCopy((CypherValue*)pValue);
-        if( pCopy ) {
-            pExpr->u.literal = *pCopy;
-            sqlite3_free(pCopy);
-            rc = SQLITE_OK;
-        } else {
-            rc = SQLITE_NOMEM;
+    rc = cypherValueCopyIn(0, &pExpr->u.literal, pValue);
+    if (rc != SQLITE_OK) {
+        cypherExpressionDestroy(pExpr);
+        return rc;
+    }
+    
+    *ppExpr = pExpr;
+    return SQLITE_OK;
+}
+
+/* Variable expression creation */
+int cypherExpressionCreateVariable(CypherExpression **ppExpr, const char *zName) {
+    CypherExpression *pExpr;
+    int rc;
+    
+    if (!ppExpr || !zName) return SQLITE_MISUSE;
+    
+    rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_VARIABLE);
+    if (rc != SQLITE_OK) return rc;
+    
+    pExpr->u.variable.zName = sqlite3_mprintf("%s", zName);
+    if (!pExpr->u.variable.zName) {
+        cypherExpressionDestroy(pExpr);
+        return SQLITE_NOMEM;
+    }
+    
+    *ppExpr = pExpr;
+    return SQLITE_OK;
+}
+
+/* Property access expression creation; takes ownership of pObject */
+int cypherExpressionCreateProperty(CypherExpression **ppExpr, 
+                                  CypherExpression *pObject, 
+                                  const char *zProperty) {
+    CypherExpression *pExpr;
+    int rc;
+    
+    if (!ppExpr || !pObject || !zProperty) return SQLITE_MISUSE;
+    
+    rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_PROPERTY);
+    if (rc != SQLITE_OK) return rc;
+    
+    pExpr->u.property.zProperty = sqlite3_mprintf("%s", zProperty);
+    if (!pExpr->u.property.zProperty) {
+        cypherExpressionDestroy(pExpr);
+        return SQLITE_NOMEM;
+    }
+    pExpr->u.property.pObject = pObject;
+    
+    *ppExpr = pExpr;
+    return SQLITE_OK;
+}
+
+/* Parameter expression creation */
+int cypherExpressionCreateParameter(CypherExpression **ppExpr, const char *zName) {
+    CypherExpression *pExpr;
+    int rc;
+    
+    if (!ppExpr || !zName) return SQLITE_MISUSE;
+    
+    rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_PARAMETER);
+    if (rc != SQLITE_OK) return rc;
+    
+    pExpr->u.parameter.zName = sqlite3_mprintf("%s", zName);
+    if (!pExpr->u.parameter.zName) {
+        cypherExpressionDestroy(pExpr);
+        return SQLITE_NOMEM;
+    }
+    
+    *ppExpr = pExpr;
+    return SQLITE_OK;
+}
+
+/* Set *pValue to the Cypher literal zValue written as SQLITE_* type eType */
+static int exprLiteralValue(const char *zValue, int eType, CypherValue *pValue) {
+    sqlite3_int64 iVal = 0;
+    double rVal = 0.0;
+    
+    cypherValueInit(pValue);
+    switch (graphParseLiteral(zValue, eType, &iVal, &rVal)) {
+        case SQLITE_NULL:
+            return SQLITE_OK;
+        case SQLITE_INTEGER:
+            cypherValueSetInteger(pValue, iVal);
+            return SQLITE_OK;
+        case SQLITE_FLOAT:
+            cypherValueSetFloat(pValue, rVal);
+            return SQLITE_OK;
+        default:
+            return cypherValueSetString(pValue, zValue);
+    }
+}
+
+int cypherParameterValue(ExecutionContext *pContext, const char *zName, CypherValue *pResult) {
+    const char *zValue;
+    int eType = 0;
+    int bFound = 0;
+    
+    cypherValueInit(pResult);
+    zValue = cypherParamsFind(pContext ? pContext->pParams : NULL, zName, &eType, &bFound);
+    if (!bFound) {
+        if (pContext) {
+            sqlite3_free(pContext->zErrorMsg);
+            pContext->zErrorMsg = sqlite3_mprintf("Missing parameter: $%s", zName);
+            pContext->iErrorCode = SQLITE_ERROR;
         }
+        return SQLITE_ERROR;
+    }
+    return exprLiteralValue(zValue, eType, pResult);
+}
+
+/* Comparison operator of an AST COMPARISON node's text, or -1 */
+static int exprComparisonOp(const char *zOp) {
+    if (!zOp) return -1;
+    if (strcmp(zOp, "=") == 0) return CYPHER_CMP_EQUAL;
+    if (strcmp(zOp, "<>") == 0) return CYPHER_CMP_NOT_EQUAL;
+    if (strcmp(zOp, "<") == 0) return CYPHER_CMP_LESS;
+    if (strcmp(zOp, "<=") == 0) return CYPHER_CMP_LESS_EQUAL;
+    if (strcmp(zOp, ">") == 0) return CYPHER_CMP_GREATER;
+    if (strcmp(zOp, ">=") == 0) return CYPHER_CMP_GREATER_EQUAL;
+    if (sqlite3_strnicmp(zOp, "STARTS", 6) == 0) return CYPHER_CMP_STARTS_WITH;
+    if (sqlite3_strnicmp(zOp, "ENDS", 4) == 0) return CYPHER_CMP_ENDS_WITH;
+    if (sqlite3_stricmp(zOp, "CONTAINS") == 0) return CYPHER_CMP_CONTAINS;
+    if (sqlite3_stricmp(zOp, "IN") == 0) return CYPHER_CMP_IN;
+    return -1;
+}
+
+/* Arithmetic operator of an ADDITIVE or MULTIPLICATIVE node's text, or -1 */
+static int exprArithmeticOp(const char *zOp) {
+    if (!zOp || !zOp[0] || zOp[1]) return -1;
+    switch (zOp[0]) {
+        case '+': return CYPHER_OP_ADD;
+        case '-': return CYPHER_OP_SUBTRACT;
+        case '*': return CYPHER_OP_MULTIPLY;
+        case '/': return CYPHER_OP_DIVIDE;
+        case '%': return CYPHER_OP_MODULO;
+        case '^': return CYPHER_OP_POWER;
+        default:  return -1;
+    }
+}
+
+/* Build a binary expression of type eType from two AST operands */
+static int exprFromAstBinary(CypherExpressionType eType, int op, const CypherAst *pLeft,
+                             const CypherAst *pRight, CypherExpression **ppExpr) {
+    CypherExpression *pExpr;
+    int rc;
+    
+    rc = cypherExpressionCreate(&pExpr, eType);
+    if (rc != SQLITE_OK) return rc;
+    pExpr->u.binary.op = op;
+    rc = cypherExpressionFromAst(pLeft, &pExpr->u.binary.pLeft);
+    if (rc == SQLITE_OK && pRight) {
+        rc = cypherExpressionFromAst(pRight, &pExpr->u.binary.pRight);
     }
     if (rc != SQLITE_OK) {
         cypherExpressionDestroy(pExpr);
         return rc;
     }
+    *ppExpr = pExpr;
+    return SQLITE_OK;
+}
+
+int cypherExpressionFromAst(const CypherAst *pAst, CypherExpression **ppExpr) {
+    CypherExpression *pExpr = NULL;
+    CypherValue value;
+    const char *zValue;
+    int rc, op, i;
     
+    if (!ppExpr) return SQLITE_MISUSE;
+    *ppExpr = NULL;
+    if (!pAst) return SQLITE_ERROR;
+    zValue = pAst->zValue;
+    
+    switch (pAst->type) {
+        case CYPHER_AST_LITERAL:
+            rc = exprLiteralValue(zValue, pAst->iFlags, &value);
+            if (rc == SQLITE_OK) rc = cypherExpressionCreateLiteral(ppExpr, &value);
+            cypherValueDestroy(&value);
+            return rc;
+            
+        case CYPHER_AST_PARAMETER:
+            return zValue ? cypherExpressionCreateParameter(ppExpr, zValue) : SQLITE_ERROR;
+            
+        case CYPHER_AST_IDENTIFIER:
+            return zValue ? cypherExpressionCreateVariable(ppExpr, zValue) : SQLITE_ERROR;
+            
+        case CYPHER_AST_PROPERTY:
+            if (pAst->nChildren < 2 || !pAst->apChildren[1]->zValue) return SQLITE_ERROR;
+            rc = cypherExpressionFromAst(pAst->apChildren[0], &pExpr);
+            if (rc != SQLITE_OK) return rc;
+            rc = cypherExpressionCreateProperty(ppExpr, pExpr, pAst->apChildren[1]->zValue);
+            if (rc != SQLITE_OK) cypherExpressionDestroy(pExpr);
+            return rc;
+            
+        case CYPHER_AST_COMPARISON:
+            op = exprComparisonOp(zValue);
+            if (op < 0 || pAst->nChildren != 2) return SQLITE_ERROR;
+            return exprFromAstBinary(CYPHER_EXPR_COMPARISON, op, pAst->apChildren[0],
+                                     pAst->apChildren[1], ppExpr);
+            
+        case CYPHER_AST_ADDITIVE:
+        case CYPHER_AST_MULTIPLICATIVE:
+            op = exprArithmeticOp(zValue);
+            if (op < 0 || pAst->nChildren != 2) return SQLITE_ERROR;
+            return exprFromAstBinary(CYPHER_EXPR_ARITHMETIC, op, pAst->apChildren[0],
+                                     pAst->apChildren[1], ppExpr);
+            
+        case CYPHER_AST_AND:
+            if (pAst->nChildren != 2) return SQLITE_ERROR;
+            return exprFromAstBinary(CYPHER_EXPR_LOGICAL, CYPHER_LOGIC_AND, pAst->apChildren[0],
+                                     pAst->apChildren[1], ppExpr);
+            
+        case CYPHER_AST_BINARY_OP:
+            if (!zValue || pAst->nChildren != 2) return SQLITE_ERROR;
+            if (sqlite3_stricmp(zValue, "OR") == 0) {
+                op = CYPHER_LOGIC_OR;
+            } else if (sqlite3_stricmp(zValue, "XOR") == 0) {
+                op = CYPHER_LOGIC_XOR;
+            } else if (sqlite3_stricmp(zValue, "AND") == 0) {
+                op = CYPHER_LOGIC_AND;
+            } else {
+                return SQLITE_ERROR;
+            }
+            return exprFromAstBinary(CYPHER_EXPR_LOGICAL, op, pAst->apChildren[0],
+                                     pAst->apChildren[1], ppExpr);
+            
+        case CYPHER_AST_NOT:
+            if (pAst->nChildren != 1) return SQLITE_ERROR;
+            return exprFromAstBinary(CYPHER_EXPR_LOGICAL, CYPHER_LOGIC_NOT, pAst->apChildren[0],
+                                     NULL, ppExpr);
+            
+        case CYPHER_AST_UNARY_OP:
+            /* -x is 0 - x; the parser may list the operand twice */
+            if (pAst->nChildren < 1 || !zValue) return SQLITE_ERROR;
+            if (strcmp(zValue, "+") == 0) return cypherExpressionFromAst(pAst->apChildren[0], ppExpr);
+            if (strcmp(zValue, "-") != 0) return SQLITE_ERROR;
+            rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_ARITHMETIC);
+            if (rc != SQLITE_OK) return rc;
+            pExpr->u.binary.op = CYPHER_OP_SUBTRACT;
+            cypherValueInit(&value);
+            cypherValueSetInteger(&value, 0);
+            rc = cypherExpressionCreateLiteral(&pExpr->u.binary.pLeft, &value);
+            if (rc == SQLITE_OK) {
+                rc = cypherExpressionFromAst(pAst->apChildren[0], &pExpr->u.binary.pRight);
+            }
+            break;
+            
+        case CYPHER_AST_ARRAY:
+            rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_LIST);
+            if (rc != SQLITE_OK) return rc;
+            if (pAst->nChildren > 0) {
+                pExpr->u.list.apElements = sqlite3_malloc(pAst->nChildren * sizeof(CypherExpression*));
+                if (!pExpr->u.list.apElements) rc = SQLITE_NOMEM;
+            }
+            for (i = 0; rc == SQLITE_OK && i < pAst->nChildren; i++) {
+                rc = cypherExpressionFromAst(pAst->apChildren[i], &pExpr->u.list.apElements[i]);
+                if (rc == SQLITE_OK) pExpr->u.list.nElements++;
+            }
+            break;
+            
+        case CYPHER_AST_FUNCTION_CALL:
+            /* Aggregates and count(*) are planned by the RETURN clause */
+            if (pAst->nChildren < 1 || !pAst->apChildren[0]->zValue ||
+                (zValue && strcmp(zValue, "*") == 0)) {
+                return SQLITE_ERROR;
+            }
+            rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_FUNCTION);
+            if (rc != SQLITE_OK) return rc;
+            pExpr->u.function.zName = sqlite3_mprintf("%s", pAst->apChildren[0]->zValue);
+            if (!pExpr->u.function.zName) rc = SQLITE_NOMEM;
+            if (rc == SQLITE_OK && pAst->nChildren > 1) {
+                pExpr->u.function.apArgs =
+                    sqlite3_malloc((pAst->nChildren - 1) * sizeof(CypherExpression*));
+                if (!pExpr->u.function.apArgs) rc = SQLITE_NOMEM;
+            }
+            for (i = 1; rc == SQLITE_OK && i < pAst->nChildren; i++) {
+                rc = cypherExpressionFromAst(pAst->apChildren[i],
+                                             &pExpr->u.function.apArgs[i - 1]);
+                if (rc == SQLITE_OK) pExpr->u.function.nArgs++;
+            }
+            break;
+            
+        default:
+            return SQLITE_ERROR;
+    }
+    
+    if (rc != SQLITE_OK) {
+        cypherExpressionDestroy(pExpr);
+        return rc;
+    }
     *ppExpr = pExpr;
     return SQLITE_OK;
 }
 
+CypherExpression *cypherExpressionCopy(const CypherExpression *pExpr) {
+    CypherExpression *pCopy;
+    int bOom = 0;
+    int i;
+    
+    if (!pExpr) return NULL;
+    if (cypherExpressionCreate(&pCopy, pExpr->type) != SQLITE_OK) return NULL;
+    
+    switch (pExpr->type) {
+        case CYPHER_EXPR_LITERAL:
+            bOom = cypherValueCopyIn(0, &pCopy->u.literal, &pExpr->u.literal) != SQLITE_OK;
+            break;
+            
+        case CYPHER_EXPR_VARIABLE:
+        case CYPHER_EXPR_PARAMETER:
+            /* Both keep their name first */
+            pCopy->u.variable.zName = sqlite3_mprintf("%s", pExpr->u.variable.zName);
+            bOom = !pCopy->u.variable.zName;
+            break;
+            
+        case CYPHER_EXPR_PROPERTY:
+            pCopy->u.property.zProperty = sqlite3_mprintf("%s", pExpr->u.property.zProperty);
+            pCopy->u.property.pObject = cypherExpressionCopy(pExpr->u.property.pObject);
+            bOom = !pCopy->u.property.zProperty ||
+                   (pExpr->u.property.pObject && !pCopy->u.property.pObject);
+            break;
+            
+        case CYPHER_EXPR_ARITHMETIC:
+        case CYPHER_EXPR_COMPARISON:
+        case CYPHER_EXPR_LOGICAL:
+        case CYPHER_EXPR_STRING:
+            pCopy->u.binary.op = pExpr->u.binary.op;
+            pCopy->u.binary.pLeft = cypherExpressionCopy(pExpr->u.binary.pLeft);
+            pCopy->u.binary.pRight = cypherExpressionCopy(pExpr->u.binary.pRight);
+            bOom = (pExpr->u.binary.pLeft && !pCopy->u.binary.pLeft) ||
+                   (pExpr->u.binary.pRight && !pCopy->u.binary.pRight);
+            break;
+            
+        case CYPHER_EXPR_FUNCTION:
+            pCopy->u.function.zName = sqlite3_mprintf("%s", pExpr->u.function.zName);
+            bOom = !pCopy->u.function.zName;
+            if (!bOom && pExpr->u.function.nArgs > 0) {
+                pCopy->u.function.apArgs =
+                    sqlite3_malloc(pExpr->u.function.nArgs * sizeof(CypherExpression*));
+                bOom = !pCopy->u.function.apArgs;
+            }
+            for (i = 0; !bOom && i < pExpr->u.function.nArgs; i++) {
+                pCopy->u.function.apArgs[i] = cypherExpressionCopy(pExpr->u.function.apArgs[i]);
+                bOom = !pCopy->u.function.apArgs[i];
+                if (!bOom) pCopy->u.function.nArgs++;
+            }
+            break;
+            
+        case CYPHER_EXPR_LIST:
+            if (pExpr->u.list.nElements > 0) {
+                pCopy->u.list.apElements =
+                    sqlite3_malloc(pExpr->u.list.nElements * sizeof(CypherExpression*));
+                bOom = !pCopy->u.list.apElements;
+            }
+            for (i = 0; !bOom && i < pExpr->u.list.nElements; i++) {
+                pCopy->u.list.apElements[i] = cypherExpressionCopy(pExpr->u.list.apElements[i]);
+                bOom = !pCopy->u.list.apElements[i];
+                if (!bOom) pCopy->u.list.nElements++;
+            }
+            break;
+            
+        case CYPHER_EXPR_MAP:
+            if (pExpr->u.map.nPairs > 0) {
+                pCopy->u.map.azKeys = sqlite3_malloc(pExpr->u.map.nPairs * sizeof(char*));
+                pCopy->u.map.apValues =
+                    sqlite3_malloc(pExpr->u.map.nPairs * sizeof(CypherExpression*));
+                bOom = !pCopy->u.map.azKeys || !pCopy->u.map.apValues;
+            }
+            for (i = 0; !bOom && i < pExpr->u.map.nPairs; i++) {
+                pCopy->u.map.azKeys[i] = sqlite3_mprintf("%s", pExpr->u.map.azKeys[i]);
+                pCopy->u.map.apValues[i] = cypherExpressionCopy(pExpr->u.map.apValues[i]);
+                if (!pCopy->u.map.azKeys[i] || !pCopy->u.map.apValues[i]) {
+                    sqlite3_free(pCopy->u.map.azKeys[i]);
+                    cypherExpressionDestroy(pCopy->u.map.apValues[i]);
+                    bOom = 1;
+                } else {
+                    pCopy->u.map.nPairs++;
+                }
+            }
+            break;
+            
+        default:
+            break;
+    }
+    
+    if (bOom) {
+        cypherExpressionDestroy(pCopy);
+        return NULL;
+    }
+    return pCopy;
+}
+
 /* Arithmetic expression creation */
 int cypherExpressionCreateArithmetic(CypherExpression **ppExpr,
                                     CypherExpression *pLeft,
@@ -506,6 +971,60 @@ int cypherExpressionCreateComparison(CypherExpression **ppExpr,
     return SQLITE_OK;
 }
 
+/* Logical expression creation; NOT takes its operand as pLeft */
+int cypherExpressionCreateLogical(CypherExpression **ppExpr,
+                                CypherExpression *pLeft,
+                                CypherExpression *pRight,
+                                CypherLogicalOp op) {
+    CypherExpression *pExpr;
+    int rc;
+    
+    if (!ppExpr || !pLeft) return SQLITE_MISUSE;
+    if (!pRight && op != CYPHER_LOGIC_NOT) return SQLITE_MISUSE;
+    
+    rc = cypherExpressionCreate(&pExpr, CYPHER_EXPR_LOGICAL);
+    if (rc != SQLITE_OK) return rc;
+    
+    pExpr->u.binary.pLeft = pLeft;
+    pExpr->u.binary.pRight = pRight;
+    pExpr->u.binary.op = op;
+    
+    *ppExpr = pExpr;
+    return SQLITE_OK;
+}
+
+/*
+** Constant expressions depend on no variable: literals, and operators
+** and functions over constants. Only kinds cypherExpressionEvaluate()
+** handles count, so a constant can be replaced by its value.
+*/
+int cypherExpressionIsConstant(const CypherExpression *pExpr) {
+    int i;
+    
+    if (!pExpr) return 0;
+    
+    switch (pExpr->type) {
+        case CYPHER_EXPR_LITERAL:
+            return 1;
+            
+        case CYPHER_EXPR_ARITHMETIC:
+        case CYPHER_EXPR_COMPARISON:
+        case CYPHER_EXPR_LOGICAL:
+            if (!cypherExpressionIsConstant(pExpr->u.binary.pLeft)) return 0;
+            return !pExpr->u.binary.pRight ||
+                   cypherExpressionIsConstant(pExpr->u.binary.pRight);
+            
+        case CYPHER_EXPR_FUNCTION:
+            for (i = 0; i < pExpr->u.function.nArgs; i++) {
+                if (!cypherExpressionIsConstant(pExpr->u.function.apArgs[i])) return 0;
+            }
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
 /* Built-in function registration */
 static CypherBuiltinFunction g_builtinFunctions[] = {
     {"toUpper", 1, 1, cypherFunctionToUpper},
@@ -536,6 +1055,7 @@ const CypherBuiltinFunction *cypherGetBuiltinFunction(const char *zName) {
     int i;
     
     if (!zName) return NULL;
+    if (!g_functions) cypherRegisterBuiltinFunctions();
     
     for (i = 0; i < g_nFunctions; i++) {
         if (sqlite3_stricmp(zName, g_functions[i].zName) == 0) {
@@ -781,7 +1301,8 @@ int cypherFunctionToString(CypherValue *apArgs, int nArgs, CypherValue *pResult)
 }
 
 /*
-** Evaluate logical operations (AND, OR, NOT).
+** Evaluate logical operations (AND, OR, XOR, NOT) with three-valued
+** logic. Operands other than booleans and NULL are SQLITE_MISMATCH.
 **
 ** Parameters:
 **   pLeft - Left operand (NULL for unary NOT)
@@ -793,68 +1314,53 @@ int cypherFunctionToString(CypherValue *apArgs, int nArgs, CypherValue *pResult)
 */
 int cypherEvaluateLogical(const CypherValue *pLeft, const CypherValue *pRight,
                          CypherLogicalOp op, CypherValue *pResult) {
-    int bLeft = 0, bRight = 0;
+    int bLeft = -1, bRight = -1;  /* 1 true, 0 false, -1 NULL */
+    int result;
     
     if (!pResult) return SQLITE_MISUSE;
     cypherValueInit(pResult);
     
+    if (op == CYPHER_LOGIC_NOT) {
+        pLeft = NULL;
+    } else if (!pLeft) {
+        return SQLITE_MISUSE;
+    }
+    if (!pRight) return SQLITE_MISUSE;
+    
+    /* Operands must be boolean or NULL */
+    if (pLeft && !cypherValueIsNull(pLeft)) {
+        if (pLeft->type != CYPHER_VALUE_BOOLEAN) return SQLITE_MISMATCH;
+        bLeft = pLeft->u.bBoolean ? 1 : 0;
+    }
+    if (!cypherValueIsNull(pRight)) {
+        if (pRight->type != CYPHER_VALUE_BOOLEAN) return SQLITE_MISMATCH;
+        bRight = pRight->u.bBoolean ? 1 : 0;
+    }
+    
+    /* Three-valued logic: NULL is unknown */
     switch (op) {
         case CYPHER_LOGIC_AND:
-            if (!pLeft || !pRight) return SQLITE_MISUSE;
-            
-            /* Handle NULL values */
-            if (cypherValueIsNull(pLeft) || cypherValueIsNull(pRight)) {
-                cypherValueSetNull(pResult);
-                return SQLITE_OK;
-            }
-            
-            /* Convert to boolean */
-            bLeft = cypherValueGetBoolean(pLeft);
-            bRight = cypherValueGetBoolean(pRight);
-            
-            cypherValueSetBoolean(pResult, bLeft && bRight);
-            return SQLITE_OK;
-            
+            result = (bLeft == 0 || bRight == 0) ? 0 : (bLeft < 0 || bRight < 0) ? -1 : 1;
+            break;
         case CYPHER_LOGIC_OR:
-            if (!pLeft || !pRight) return SQLITE_MISUSE;
-            
-            /* Handle NULL values */
-            if (cypherValueIsNull(pLeft) && cypherValueIsNull(pRight)) {
-                cypherValueSetNull(pResult);
-                return SQLITE_OK;
-            }
-            
-            /* Convert to boolean */
-            bLeft = cypherValueIsNull(pLeft) ? 0 : cypherValueGetBoolean(pLeft);
-            bRight = cypherValueIsNull(pRight) ? 0 : cypherValueGetBoolean(pRight);
-            
-            /* If either is true, result is true */
-            if (bLeft || bRight) {
-                cypherValueSetBoolean(pResult, 1);
-            } else if (cypherValueIsNull(pLeft) || cypherValueIsNull(pRight)) {
-                cypherValueSetNull(pResult);
-            } else {
-                cypherValueSetBoolean(pResult, 0);
-            }
-            return SQLITE_OK;
-            
+            result = (bLeft == 1 || bRight == 1) ? 1 : (bLeft < 0 || bRight < 0) ? -1 : 0;
+            break;
+        case CYPHER_LOGIC_XOR:
+            result = (bLeft < 0 || bRight < 0) ? -1 : (bLeft != bRight);
+            break;
         case CYPHER_LOGIC_NOT:
-            if (!pRight) return SQLITE_MISUSE;
-            
-            /* Handle NULL values */
-            if (cypherValueIsNull(pRight)) {
-                cypherValueSetNull(pResult);
-                return SQLITE_OK;
-            }
-            
-            /* Convert to boolean and negate */
-            bRight = cypherValueGetBoolean(pRight);
-            cypherValueSetBoolean(pResult, !bRight);
-            return SQLITE_OK;
-            
+            result = bRight < 0 ? -1 : !bRight;
+            break;
         default:
             return SQLITE_MISUSE;
     }
+    
+    if (result < 0) {
+        cypherValueSetNull(pResult);
+    } else {
+        cypherValueSetBoolean(pResult, result);
+    }
+    return SQLITE_OK;
 }
 
 /*
@@ -878,11 +1384,7 @@ int cypherExecutionContextLookupVariable(ExecutionContext *pCtx,
     
     pValue = executionContextGet(pCtx, zVariable);
     if (pValue) {
-        CypherValue *pCopy = cypherValueCopy((CypherValue*)pValue);
-        if (!pCopy) return SQLITE_NOMEM;
-        
-        *pResult = *pCopy;
-        sqlite3_free(pCopy);
+        if (cypherValueCopyIn(0, pResult, pValue)) return SQLITE_NOMEM;
     } else {
     cypherValueSetNull(pResult);
     }
@@ -949,13 +1451,13 @@ int cypherFunctionAvg(CypherValue *apArgs, int nArgs, CypherValue *pResult) {
 int cypherFunctionMin(CypherValue *apArgs, int nArgs, CypherValue *pResult) {
     if (nArgs != 1 || !pResult) return SQLITE_MISUSE;
     
-    *pResult = apArgs[0];
-    return SQLITE_OK;
+    /* The caller owns and destroys the argument */
+    return cypherValueCopyIn(0, pResult, &apArgs[0]);
 }
 
 int cypherFunctionMax(CypherValue *apArgs, int nArgs, CypherValue *pResult) {
     if (nArgs != 1 || !pResult) return SQLITE_MISUSE;
     
-    *pResult = apArgs[0];
-    return SQLITE_OK;
+    /* The caller owns and destroys the argument */
+    return cypherValueCopyIn(0, pResult, &apArgs[0]);
 }
\ No newline at end of file
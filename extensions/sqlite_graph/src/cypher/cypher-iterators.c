@@ -9,8 +9,19 @@
 ** - AllNodesScan iterator for full table scans
 ** - LabelIndexScan iterator for label-based filtering
 ** - PropertyIndexScan iterator for property-based filtering
+** - BitmapAnd iterator intersecting index scans as compressed bitmaps
 ** - Filter iterator for predicate evaluation
 ** - Projection iterator for column selection
+** - Sort iterator with normalized keys, spilling and a top-k heap
+** - Hash aggregation with per-worker partial groups (cypher-aggregate.c)
+** - Filter, projection and sort expressions compiled to CypherPrograms
+** - Hash join on node ids with Grace partition spilling, and index
+**   nested loop joins probing the node and edge indexes per outer row
+** - Expand over the CSR snapshot or the covering edge indexes, and
+**   variable-length expand over bounded simple paths
+** - xNextBatch for scans, filter, projection and limit, exchanging
+**   CypherDataChunk vectors instead of one CypherResult per row
+** - The CREATE and MERGE operators live with the other writes in cypher-write.c
 **
 ** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
 ** Error handling: Functions return SQLite error codes
@@ -22,7 +33,14 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-executor.h"
+#include "cypher-write.h"
 #include "cypher-expressions.h"
+#include "cypher-program.h"
+#include "graph-performance.h"
+#include "cypher-sort.h"
+#include "cypher-chunk.h"
+#include "cypher-paths.h"
+#include "graph-csr.h"
 #include <string.h>
 #include <assert.h>
 
@@ -36,9 +54,7 @@ extern const sqlite3_api_routines *sqlite3_api;
 ** Create an iterator from a physical plan node.
 ** Returns NULL on allocation failure or unsupported operator.
 */
-CypherIterator *cypherIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
-  if( !pPlan || !pContext ) return NULL;
-  
+static CypherIterator *iteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
   switch( pPlan->type ) {
     case PHYSICAL_ALL_NODES_SCAN:
       return cypherAllNodesScanCreate(pPlan, pContext);
@@ -49,6 +65,15 @@ CypherIterator *cypherIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *
     case PHYSICAL_PROPERTY_INDEX_SCAN:
       return cypherPropertyIndexScanCreate(pPlan, pContext);
       
+    case PHYSICAL_BITMAP_AND:
+      return cypherBitmapAndCreate(pPlan, pContext);
+      
+    case PHYSICAL_EXPAND:
+      return cypherExpandCreate(pPlan, pContext);
+      
+    case PHYSICAL_VAR_LENGTH_EXPAND:
+      return cypherVarLengthExpandCreate(pPlan, pContext);
+      
     case PHYSICAL_FILTER:
       return cypherFilterCreate(pPlan, pContext);
       
@@ -58,15 +83,45 @@ CypherIterator *cypherIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *
     case PHYSICAL_SORT:
       return cypherSortCreate(pPlan, pContext);
       
+    case PHYSICAL_AGGREGATION:
+      return cypherAggregationCreate(pPlan, pContext);
+      
     case PHYSICAL_LIMIT:
       return cypherLimitCreate(pPlan, pContext);
       
+    case PHYSICAL_HASH_JOIN:
+    case PHYSICAL_NESTED_LOOP_JOIN:
+      /* An equality join is hashed rather than rescanned */
+      return cypherHashJoinCreate(pPlan, pContext);
+      
+    case PHYSICAL_INDEX_NESTED_LOOP:
+      return cypherIndexNestedLoopCreate(pPlan, pContext);
+      
+    case PHYSICAL_CREATE:
+      return cypherCreateIteratorCreate(pPlan, pContext);
+      
+    case PHYSICAL_MERGE:
+      return cypherMergeIteratorCreate(pPlan, pContext);
+      
     default:
       /* Unsupported operator type */
       return NULL;
   }
 }
 
+CypherIterator *cypherIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator;
+  
+  if( !pPlan || !pContext ) return NULL;
+  
+  pIterator = iteratorCreate(pPlan, pContext);
+  if( pIterator && pContext->bAnalyze && cypherIteratorProfile(pIterator) != SQLITE_OK ) {
+    cypherIteratorDestroy(pIterator);
+    return NULL;
+  }
+  return pIterator;
+}
+
 /*
 ** Destroy an iterator and free all associated memory.
 ** Safe to call with NULL pointer.
@@ -95,6 +150,184 @@ void cypherIteratorDestroy(CypherIterator *pIterator) {
   sqlite3_free(pIterator);
 }
 
+/*
+** Fill pChunk with the next batch of rows from pIterator. Iterators
+** without xNextBatch are adapted by collecting up to CYPHER_CHUNK_SIZE
+** rows from xNext.
+*/
+int cypherIteratorNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  CypherResult *pRow;
+  int rc = SQLITE_OK;
+  
+  if( !pIterator || !pChunk ) return SQLITE_MISUSE;
+  if( pIterator->xNextBatch ) return pIterator->xNextBatch(pIterator, pChunk);
+  
+  /* One recycled row buffer per batch, its arena rewound row by row */
+  pRow = pIterator->pContext ? executionContextRowAcquire(pIterator->pContext)
+                             : cypherResultCreate();
+  if( !pRow ) return SQLITE_NOMEM;
+  cypherChunkReset(pChunk);
+  while( pChunk->nRow < CYPHER_CHUNK_SIZE ) {
+    cypherResultClear(pRow);
+    rc = pIterator->xNext(pIterator, pRow);
+    if( rc == SQLITE_OK ) rc = cypherChunkAppendResult(pChunk, pRow);
+    if( rc != SQLITE_OK ) break;
+  }
+  if( pIterator->pContext ) {
+    executionContextRowRelease(pIterator->pContext, pRow);
+  } else {
+    cypherResultDestroy(pRow);
+  }
+  
+  if( rc == SQLITE_DONE && pChunk->nRow > 0 ) return SQLITE_OK;
+  return rc;
+}
+
+/*
+** Source of a unary operator: the iterator it created from the plan's
+** primary child, otherwise the child iterator built by
+** createIteratorTree().
+*/
+static CypherIterator *iteratorSource(CypherIterator *pIterator,
+                                      CypherIterator *pSource) {
+  if( pSource ) return pSource;
+  return pIterator->nChildren > 0 ? pIterator->apChildren[0] : NULL;
+}
+
+/*
+** Bind the columns of pRow into the context so that expressions
+** evaluated next see that row.
+*/
+static int iteratorBindRow(ExecutionContext *pContext, CypherResult *pRow) {
+  int i, rc;
+  
+  for( i = 0; i < pRow->nColumns; i++ ) {
+    rc = executionContextBind(pContext, pRow->azColumnNames[i], &pRow->aValues[i]);
+    if( rc != SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Compile nExpr plan expressions once, when the iterator is created.
+** Returns NULL if out of memory.
+*/
+static CypherProgram **iteratorCompilePrograms(CypherExpression **apExpr, int nExpr) {
+  CypherProgram **apProgram;
+  int i;
+
+  apProgram = sqlite3_malloc(nExpr * sizeof(CypherProgram*));
+  if( !apProgram ) return NULL;
+  memset(apProgram, 0, nExpr * sizeof(CypherProgram*));
+
+  for( i = 0; i < nExpr; i++ ) {
+    if( cypherProgramCompile(apExpr[i], &apProgram[i]) != SQLITE_OK ) {
+      while( --i >= 0 ) cypherProgramFree(apProgram[i]);
+      sqlite3_free(apProgram);
+      return NULL;
+    }
+  }
+  return apProgram;
+}
+
+static void iteratorFreePrograms(CypherProgram **apProgram, int nProgram) {
+  int i;
+
+  if( !apProgram ) return;
+  for( i = 0; i < nProgram; i++ ) cypherProgramFree(apProgram[i]);
+  sqlite3_free(apProgram);
+}
+
+/*
+** The interned output names of a projection, so rows share them instead
+** of copying one per column: azColumn as planned, or "col0".."col<nCol-1>"
+** for a plan without names. Returns NULL if out of memory.
+*/
+static const char **iteratorColumnNames(ExecutionContext *pContext, char **azColumn,
+                                        int nCol) {
+  const char **azName;
+  char zName[32];
+  int i;
+
+  azName = sqlite3_malloc(nCol * sizeof(char*));
+  if( !azName ) return NULL;
+  for( i = 0; i < nCol; i++ ) {
+    sqlite3_snprintf(sizeof(zName), zName, "col%d", i);
+    azName[i] = executionContextIntern(pContext, azColumn ? azColumn[i] : zName);
+    if( !azName[i] ) {
+      sqlite3_free((void*)azName);
+      return NULL;
+    }
+  }
+  return azName;
+}
+
+/*
+** Batch body shared by the statement-backed node scans: step pStmt up
+** to CYPHER_CHUNK_SIZE times straight into the node id vector.
+*/
+static int scanStmtNextBatch(CypherIterator *pIterator, sqlite3_stmt *pStmt,
+                             CypherDataChunk *pChunk) {
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  sqlite3_int64 *aId;
+  int rc = SQLITE_ROW;
+  int n = 0;
+  
+  if( pIterator->bEof ) return SQLITE_DONE;
+  
+  cypherChunkReset(pChunk);
+  if( pChunk->nCol == 0 &&
+      cypherChunkAddColumn(pChunk, pPlan->zAlias ? pPlan->zAlias : "node",
+                           CYPHER_VECTOR_NODE) < 0 ) {
+    return SQLITE_NOMEM;
+  }
+  
+  aId = pChunk->aCol[0].aId;
+  while( n < CYPHER_CHUNK_SIZE && (rc = CYPHER_STEP(pIterator->pContext, pStmt)) == SQLITE_ROW ) {
+    aId[n++] = sqlite3_column_int64(pStmt, 0);
+  }
+  if( rc != SQLITE_ROW ) {
+    pIterator->bEof = 1;
+    if( rc != SQLITE_DONE ) return rc;
+  }
+  
+  pChunk->nRow = pChunk->nSel = n;
+  pIterator->nRowsProduced += n;
+  return n > 0 ? SQLITE_OK : SQLITE_DONE;
+}
+
+/*
+** Batch body shared by the scans that collect their ids up front: copy
+** the next CYPHER_CHUNK_SIZE of aId[*piNext .. nId-1] into the node id
+** vector.
+*/
+static int scanIdsNextBatch(CypherIterator *pIterator, const sqlite3_int64 *aId,
+                            int nId, int *piNext, CypherDataChunk *pChunk) {
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  int n;
+  
+  if( pIterator->bEof || *piNext >= nId ) {
+    pIterator->bEof = 1;
+    return SQLITE_DONE;
+  }
+  
+  cypherChunkReset(pChunk);
+  if( pChunk->nCol == 0 &&
+      cypherChunkAddColumn(pChunk, pPlan->zAlias ? pPlan->zAlias : "node",
+                           CYPHER_VECTOR_NODE) < 0 ) {
+    return SQLITE_NOMEM;
+  }
+  
+  n = nId - *piNext;
+  if( n > CYPHER_CHUNK_SIZE ) n = CYPHER_CHUNK_SIZE;
+  memcpy(pChunk->aCol[0].aId, &aId[*piNext], n * sizeof(sqlite3_int64));
+  *piNext += n;
+  
+  pChunk->nRow = pChunk->nSel = n;
+  pIterator->nRowsProduced += n;
+  return SQLITE_OK;
+}
+
 /*
 ** AllNodesScan iterator implementation.
 ** Scans all nodes in the graph sequentially.
@@ -131,7 +364,7 @@ static int allNodesScanNext(CypherIterator *pIterator, CypherResult *pResult) {
   
   if( pIterator->bEof ) return SQLITE_DONE;
   
-  rc = sqlite3_step(pData->pStmt);
+  rc = CYPHER_STEP(pIterator->pContext, pData->pStmt);
   if( rc!=SQLITE_ROW ){
     pIterator->bEof = 1;
     return SQLITE_DONE;
@@ -141,7 +374,7 @@ static int allNodesScanNext(CypherIterator *pIterator, CypherResult *pResult) {
   nodeValue.type = CYPHER_VALUE_NODE;
   nodeValue.u.iNodeId = sqlite3_column_int64(pData->pStmt, 0);
   
-  rc = cypherResultAddColumn(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
+  rc = cypherResultAddColumnShared(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
   if( rc != SQLITE_OK ) return rc;
   
   pIterator->nRowsProduced++;
@@ -149,6 +382,11 @@ static int allNodesScanNext(CypherIterator *pIterator, CypherResult *pResult) {
   return SQLITE_OK;
 }
 
+static int allNodesScanNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  AllNodesScanData *pData = (AllNodesScanData*)pIterator->pIterData;
+  return scanStmtNextBatch(pIterator, pData->pStmt, pChunk);
+}
+
 static int allNodesScanClose(CypherIterator *pIterator) {
   AllNodesScanData *pData = (AllNodesScanData*)pIterator->pIterData;
   sqlite3_finalize(pData->pStmt);
@@ -181,6 +419,7 @@ CypherIterator *cypherAllNodesScanCreate(PhysicalPlanNode *pPlan, ExecutionConte
   pIterator->xNext = allNodesScanNext;
   pIterator->xClose = allNodesScanClose;
   pIterator->xDestroy = allNodesScanDestroy;
+  pIterator->xNextBatch = allNodesScanNextBatch;
   pIterator->pContext = pContext;
   pIterator->pPlan = pPlan;
   pIterator->pIterData = pData;
@@ -202,17 +441,16 @@ static int labelIndexScanOpen(CypherIterator *pIterator) {
   LabelIndexScanData *pData = (LabelIndexScanData*)pIterator->pIterData;
   PhysicalPlanNode *pPlan = pIterator->pPlan;
   GraphVtab *pGraph = pIterator->pContext->pGraph;
-  char *zSql;
   int rc;
   
   if( !pGraph || !pPlan->zLabel ) return SQLITE_ERROR;
   
   pData->zLabel = pPlan->zLabel;
   
-  zSql = sqlite3_mprintf("SELECT id FROM %s_nodes WHERE labels LIKE '%%%%\"%s\"%%%%'", pGraph->zTableName, pData->zLabel);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pData->pStmt, 0);
-  sqlite3_free(zSql);
+  /* Range scan of the label's (label_id, node_id) block */
+  rc = graphLabelScanPrepare(pGraph, &pData->pStmt);
   if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_text(pData->pStmt, 1, pData->zLabel, -1, SQLITE_STATIC);
 
   pIterator->bOpened = 1;
   pIterator->bEof = 0;
@@ -228,7 +466,7 @@ static int labelIndexScanNext(CypherIterator *pIterator, CypherResult *pResult)
   
   if( pIterator->bEof ) return SQLITE_DONE;
   
-  rc = sqlite3_step(pData->pStmt);
+  rc = CYPHER_STEP(pIterator->pContext, pData->pStmt);
   if( rc!=SQLITE_ROW ){
     pIterator->bEof = 1;
     return SQLITE_DONE;
@@ -238,7 +476,7 @@ static int labelIndexScanNext(CypherIterator *pIterator, CypherResult *pResult)
   nodeValue.type = CYPHER_VALUE_NODE;
   nodeValue.u.iNodeId = sqlite3_column_int64(pData->pStmt, 0);
   
-  rc = cypherResultAddColumn(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
+  rc = cypherResultAddColumnShared(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
   if( rc != SQLITE_OK ) return rc;
   
   pIterator->nRowsProduced++;
@@ -246,6 +484,11 @@ static int labelIndexScanNext(CypherIterator *pIterator, CypherResult *pResult)
   return SQLITE_OK;
 }
 
+static int labelIndexScanNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  LabelIndexScanData *pData = (LabelIndexScanData*)pIterator->pIterData;
+  return scanStmtNextBatch(pIterator, pData->pStmt, pChunk);
+}
+
 static int labelIndexScanClose(CypherIterator *pIterator) {
   LabelIndexScanData *pData = (LabelIndexScanData*)pIterator->pIterData;
   sqlite3_finalize(pData->pStmt);
@@ -278,6 +521,7 @@ CypherIterator *cypherLabelIndexScanCreate(PhysicalPlanNode *pPlan, ExecutionCon
   pIterator->xNext = labelIndexScanNext;
   pIterator->xClose = labelIndexScanClose;
   pIterator->xDestroy = labelIndexScanDestroy;
+  pIterator->xNextBatch = labelIndexScanNextBatch;
   pIterator->pContext = pContext;
   pIterator->pPlan = pPlan;
   pIterator->pIterData = pData;
@@ -293,7 +537,11 @@ CypherIterator *cypherLabelIndexScanCreate(PhysicalPlanNode *pPlan, ExecutionCon
 typedef struct PropertyIndexScanData {
   const char *zProperty;        /* Property to filter by */
   const char *zValue;           /* Value to match */
+  int eValueType;               /* Its SQLITE_* type, see graphParseLiteral() */
   sqlite3_stmt *pStmt;          /* SQL statement for property lookup */
+  sqlite3_int64 *aId;           /* Or the matches of a hot-property column */
+  int nId;                      /* Number of ids in aId */
+  int iNext;                    /* Next id to emit */
 } PropertyIndexScanData;
 
 static int propertyIndexScanOpen(CypherIterator *pIterator) {
@@ -304,21 +552,28 @@ static int propertyIndexScanOpen(CypherIterator *pIterator) {
   if( !pGraph || !pPlan->zProperty ) return SQLITE_ERROR;
   
   pData->zProperty = pPlan->zProperty;
-  pData->zValue = pPlan->zValue;
-  
-  char *zSql = sqlite3_mprintf(
-    "SELECT id FROM %s_nodes WHERE "
-    "json_extract(properties, '$.%s') = %Q",
-    pGraph->zTableName, pData->zProperty, pData->zValue);
-  
-  if (!zSql) {
-    return SQLITE_NOMEM;
+  int rc = executionContextPlanValue(pIterator->pContext, pPlan, &pData->zValue,
+                                     &pData->eValueType);
+  if (rc != SQLITE_OK) {
+    return rc;
   }
   
-  int rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pData->pStmt, NULL);
-  sqlite3_free(zSql);
-  
-  if (rc != SQLITE_OK) {
+  /* A scan of the property's column if it has one, else an equality or
+  ** range probe of its expression index; either is narrowed to the
+  ** scan label when there is one */
+  sqlite3_free(pData->aId);
+  pData->aId = NULL;
+  pData->nId = pData->iNext = 0;
+  rc = graphColumnMatch(pGraph, pPlan->zLabel, pData->zProperty, pPlan->eCmp,
+                        pData->zValue, pData->eValueType, &pData->aId, &pData->nId);
+  if (rc == SQLITE_NOTFOUND) {
+    rc = graphPropertyScanPrepare(pGraph, pPlan->zLabel, pData->zProperty,
+                                  pPlan->eCmp, &pData->pStmt);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+    graphBindLiteral(pData->pStmt, 1, pData->zValue, pData->eValueType);
+  } else if (rc != SQLITE_OK) {
     return rc;
   }
   
@@ -336,17 +591,24 @@ static int propertyIndexScanNext(CypherIterator *pIterator, CypherResult *pResul
   
   if( pIterator->bEof ) return SQLITE_DONE;
   
-  rc = sqlite3_step(pData->pStmt);
-  if( rc!=SQLITE_ROW ){
-    pIterator->bEof = 1;
-    return SQLITE_DONE;
-  }
-  
   memset(&nodeValue, 0, sizeof(nodeValue));
   nodeValue.type = CYPHER_VALUE_NODE;
-  nodeValue.u.iNodeId = sqlite3_column_int64(pData->pStmt, 0);
+  if( !pData->pStmt ) {
+    if( pData->iNext >= pData->nId ) {
+      pIterator->bEof = 1;
+      return SQLITE_DONE;
+    }
+    nodeValue.u.iNodeId = pData->aId[pData->iNext++];
+  } else {
+    rc = CYPHER_STEP(pIterator->pContext, pData->pStmt);
+    if( rc!=SQLITE_ROW ){
+      pIterator->bEof = 1;
+      return SQLITE_DONE;
+    }
+    nodeValue.u.iNodeId = sqlite3_column_int64(pData->pStmt, 0);
+  }
   
-  rc = cypherResultAddColumn(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
+  rc = cypherResultAddColumnShared(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
   if( rc != SQLITE_OK ) return rc;
   
   pIterator->nRowsProduced++;
@@ -354,15 +616,29 @@ static int propertyIndexScanNext(CypherIterator *pIterator, CypherResult *pResul
   return SQLITE_OK;
 }
 
+static int propertyIndexScanNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  PropertyIndexScanData *pData = (PropertyIndexScanData*)pIterator->pIterData;
+  if( !pData->pStmt ) {
+    return scanIdsNextBatch(pIterator, pData->aId, pData->nId, &pData->iNext, pChunk);
+  }
+  return scanStmtNextBatch(pIterator, pData->pStmt, pChunk);
+}
+
 static int propertyIndexScanClose(CypherIterator *pIterator) {
   PropertyIndexScanData *pData = (PropertyIndexScanData*)pIterator->pIterData;
   sqlite3_finalize(pData->pStmt);
+  pData->pStmt = NULL;
+  sqlite3_free(pData->aId);
+  pData->aId = NULL;
+  pData->nId = 0;
   pIterator->bOpened = 0;
   return SQLITE_OK;
 }
 
 static void propertyIndexScanDestroy(CypherIterator *pIterator) {
-  sqlite3_free(pIterator->pIterData);
+  PropertyIndexScanData *pData = (PropertyIndexScanData*)pIterator->pIterData;
+  if( pData ) sqlite3_free(pData->aId);
+  sqlite3_free(pData);
 }
 
 CypherIterator *cypherPropertyIndexScanCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
@@ -386,6 +662,7 @@ CypherIterator *cypherPropertyIndexScanCreate(PhysicalPlanNode *pPlan, Execution
   pIterator->xNext = propertyIndexScanNext;
   pIterator->xClose = propertyIndexScanClose;
   pIterator->xDestroy = propertyIndexScanDestroy;
+  pIterator->xNextBatch = propertyIndexScanNextBatch;
   pIterator->pContext = pContext;
   pIterator->pPlan = pPlan;
   pIterator->pIterData = pData;
@@ -394,40 +671,245 @@ CypherIterator *cypherPropertyIndexScanCreate(PhysicalPlanNode *pPlan, Execution
 }
 
 /*
-** Stub implementations for other iterators.
-** These will be implemented as needed.
+** BitmapAnd iterator implementation.
+** Each child plan (LabelIndexScan or PropertyIndexScan) is run as an id
+** query into a compressed bitmap; the bitmaps are intersected smallest
+** first and only the surviving ids are emitted.
 */
 
-/* Filter iterator implementation */
+typedef struct BitmapAndData {
+  sqlite3_int64 *aId;           /* Surviving node ids, ascending */
+  int nId;                      /* Number of ids in aId */
+  int iNext;                    /* Next id to emit */
+} BitmapAndData;
+
+/*
+** Run one child scan plan as an id query and collect its result.
+*/
+static int bitmapAndInput(ExecutionContext *pContext, PhysicalPlanNode *pChild,
+                          GraphBitmap **ppBitmap) {
+  GraphVtab *pGraph = pContext->pGraph;
+  sqlite3_stmt *pStmt = NULL;
+  sqlite3_int64 *aId = NULL;
+  const char *zValue;
+  int eValueType;
+  int nId = 0;
+  int i;
+  int rc;
+  
+  if( pChild->type == PHYSICAL_LABEL_INDEX_SCAN && pChild->zLabel ) {
+    rc = graphLabelScanPrepare(pGraph, &pStmt);
+    if( rc == SQLITE_OK ) {
+      sqlite3_bind_text(pStmt, 1, pChild->zLabel, -1, SQLITE_STATIC);
+    }
+  } else if( pChild->type == PHYSICAL_PROPERTY_INDEX_SCAN && pChild->zProperty ) {
+    rc = executionContextPlanValue(pContext, pChild, &zValue, &eValueType);
+    if( rc != SQLITE_OK ) return rc;
+    rc = graphColumnMatch(pGraph, pChild->zLabel, pChild->zProperty,
+                          pChild->eCmp, zValue, eValueType, &aId, &nId);
+    if( rc == SQLITE_OK ) {
+      *ppBitmap = graphBitmapCreate();
+      if( !*ppBitmap ) rc = SQLITE_NOMEM;
+      for( i = 0; rc == SQLITE_OK && i < nId; i++ ) {
+        rc = graphBitmapAdd(*ppBitmap, aId[i]);
+      }
+      sqlite3_free(aId);
+      if( rc != SQLITE_OK ) {
+        graphBitmapFree(*ppBitmap);
+        *ppBitmap = NULL;
+      }
+      return rc;
+    }
+    if( rc != SQLITE_NOTFOUND ) return rc;
+    rc = graphPropertyScanPrepare(pGraph, pChild->zLabel, pChild->zProperty,
+                                  pChild->eCmp, &pStmt);
+    if( rc == SQLITE_OK ) graphBindLiteral(pStmt, 1, zValue, eValueType);
+  } else {
+    return SQLITE_MISUSE;
+  }
+  if( rc == SQLITE_OK ) rc = graphBitmapFromStmt(pStmt, ppBitmap);
+  if( rc == SQLITE_OK ) {
+    /* One step per id and the final SQLITE_DONE */
+    pContext->counters.nStep += graphBitmapCount(*ppBitmap) + 1;
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+static int bitmapAndOpen(CypherIterator *pIterator) {
+  BitmapAndData *pData = (BitmapAndData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  GraphVtab *pGraph = pIterator->pContext->pGraph;
+  GraphBitmap **apInput;
+  GraphBitmap *pResult = NULL;
+  int nInput = 0;
+  int rc = SQLITE_OK;
+  int i;
+  
+  if( !pGraph || pPlan->nChildren == 0 ) return SQLITE_ERROR;
+  
+  apInput = sqlite3_malloc(pPlan->nChildren * sizeof(GraphBitmap*));
+  if( !apInput ) return SQLITE_NOMEM;
+  for( i = 0; rc == SQLITE_OK && i < pPlan->nChildren; i++ ) {
+    rc = bitmapAndInput(pIterator->pContext, pPlan->apChildren[i], &apInput[nInput]);
+    if( rc == SQLITE_OK ) {
+      /* An empty input empties the conjunction; skip the other scans */
+      if( graphBitmapCount(apInput[nInput++]) == 0 ) break;
+    }
+  }
+  if( rc == SQLITE_OK ) rc = graphIntersectBitmaps(apInput, nInput, &pResult);
+  if( rc == SQLITE_OK ) rc = graphBitmapToArray(pResult, &pData->aId, &pData->nId);
+  graphBitmapFree(pResult);
+  for( i = 0; i < nInput; i++ ) graphBitmapFree(apInput[i]);
+  sqlite3_free(apInput);
+  if( rc != SQLITE_OK ) return rc;
+  
+  pData->iNext = 0;
+  pIterator->bOpened = 1;
+  pIterator->bEof = 0;
+  
+  return SQLITE_OK;
+}
+
+static int bitmapAndNext(CypherIterator *pIterator, CypherResult *pResult) {
+  BitmapAndData *pData = (BitmapAndData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherValue nodeValue;
+  int rc;
+  
+  if( pIterator->bEof || pData->iNext >= pData->nId ) {
+    pIterator->bEof = 1;
+    return SQLITE_DONE;
+  }
+  
+  memset(&nodeValue, 0, sizeof(nodeValue));
+  nodeValue.type = CYPHER_VALUE_NODE;
+  nodeValue.u.iNodeId = pData->aId[pData->iNext++];
+  
+  rc = cypherResultAddColumnShared(pResult, pPlan->zAlias ? pPlan->zAlias : "node", &nodeValue);
+  if( rc != SQLITE_OK ) return rc;
+  
+  pIterator->nRowsProduced++;
+  
+  return SQLITE_OK;
+}
+
+static int bitmapAndNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  BitmapAndData *pData = (BitmapAndData*)pIterator->pIterData;
+  return scanIdsNextBatch(pIterator, pData->aId, pData->nId, &pData->iNext, pChunk);
+}
+
+static int bitmapAndClose(CypherIterator *pIterator) {
+  BitmapAndData *pData = (BitmapAndData*)pIterator->pIterData;
+  sqlite3_free(pData->aId);
+  pData->aId = NULL;
+  pData->nId = 0;
+  pIterator->bOpened = 0;
+  return SQLITE_OK;
+}
+
+static void bitmapAndDestroy(CypherIterator *pIterator) {
+  BitmapAndData *pData = (BitmapAndData*)pIterator->pIterData;
+  if( pData ) sqlite3_free(pData->aId);
+  sqlite3_free(pData);
+}
+
+CypherIterator *cypherBitmapAndCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator;
+  BitmapAndData *pData;
+  
+  pIterator = sqlite3_malloc(sizeof(CypherIterator));
+  if( !pIterator ) return NULL;
+  
+  pData = sqlite3_malloc(sizeof(BitmapAndData));
+  if( !pData ) {
+    sqlite3_free(pIterator);
+    return NULL;
+  }
+  
+  memset(pIterator, 0, sizeof(CypherIterator));
+  memset(pData, 0, sizeof(BitmapAndData));
+  
+  /* Set up iterator */
+  pIterator->xOpen = bitmapAndOpen;
+  pIterator->xNext = bitmapAndNext;
+  pIterator->xClose = bitmapAndClose;
+  pIterator->xDestroy = bitmapAndDestroy;
+  pIterator->xNextBatch = bitmapAndNextBatch;
+  pIterator->pContext = pContext;
+  pIterator->pPlan = pPlan;
+  pIterator->pIterData = pData;
+  
+  return pIterator;
+}
+
+/*
+** Filter iterator implementation.
+** Rows of the source are bound into the context and kept when the
+** compiled filter is truthy. The batch path runs the filter over the
+** source chunk's vectors and narrows its selection vector in place.
+*/
 typedef struct FilterIteratorData {
-  CypherIterator *pSource;     /* Source iterator */
-  CypherExpression *pFilter;   /* Filter expression */
+  CypherIterator *pSource;     /* Source iterator, if created here */
+  CypherProgram *pProgram;     /* Compiled filter expression */
 } FilterIteratorData;
 
+/* Evaluate the filter against the bound row: NULL and false reject */
+static int filterIteratorTest(CypherIterator *pIterator, int *pbKeep) {
+  FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
+  return cypherProgramTest(pData->pProgram, pIterator->pContext, pbKeep);
+}
+
 static int filterIteratorOpen(CypherIterator *pIterator) {
   FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
-  return pData->pSource->xOpen(pData->pSource);
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  int rc;
+  
+  if (!pSource) return SQLITE_ERROR;
+  rc = pSource->xOpen(pSource);
+  if (rc == SQLITE_OK) pIterator->bOpened = 1;
+  return rc;
 }
 
 static int filterIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
   FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
-  CypherValue filterResult;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  int bKeep;
   int rc;
   
   /* Keep fetching from source until we find a matching row */
-  while ((rc = pData->pSource->xNext(pData->pSource, pResult)) == SQLITE_OK) {
-    /* Evaluate filter expression */
-    rc = cypherExpressionEvaluate(pData->pFilter, pIterator->pContext, &filterResult);
+  while ((rc = pSource->xNext(pSource, pResult)) == SQLITE_OK) {
+    rc = iteratorBindRow(pIterator->pContext, pResult);
+    if (rc == SQLITE_OK) rc = filterIteratorTest(pIterator, &bKeep);
     if (rc != SQLITE_OK) return rc;
-    
-    /* Check if filter passes (truthy value) */
-    if (!cypherValueIsNull(&filterResult) && 
-        (filterResult.type != CYPHER_VALUE_BOOLEAN || filterResult.u.bBoolean)) {
-      cypherValueDestroy(&filterResult);
+    if (bKeep) {
+      pIterator->nRowsProduced++;
       return SQLITE_OK;
     }
     
-    cypherValueDestroy(&filterResult);
+    /* Rejected: clear the row for the next attempt */
+    cypherResultClear(pResult);
+  }
+  
+  return rc;
+}
+
+static int filterIteratorNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  unsigned char aKeep[CYPHER_CHUNK_SIZE];
+  int rc;
+  
+  /* Pull batches until one has a surviving row */
+  while ((rc = cypherIteratorNextBatch(pSource, pChunk)) == SQLITE_OK) {
+    rc = cypherProgramFilter(pData->pProgram, pIterator->pContext, pChunk, aKeep);
+    if (rc != SQLITE_OK) return rc;
+    cypherChunkSelect(pChunk, aKeep);
+    
+    if (pChunk->nSel > 0) {
+      pIterator->nRowsProduced += pChunk->nSel;
+      return SQLITE_OK;
+    }
   }
   
   return rc;
@@ -435,19 +917,19 @@ static int filterIteratorNext(CypherIterator *pIterator, CypherResult *pResult)
 
 static int filterIteratorClose(CypherIterator *pIterator) {
   FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
-  return pData->pSource->xClose(pData->pSource);
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  
+  pIterator->bOpened = 0;
+  return pSource ? pSource->xClose(pSource) : SQLITE_OK;
 }
 
 static void filterIteratorDestroy(CypherIterator *pIterator) {
-  if (pIterator) {
-    FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
-    if (pData) {
-      if (pData->pSource) {
-        pData->pSource->xDestroy(pData->pSource);
-      }
-      sqlite3_free(pData);
-    }
-    sqlite3_free(pIterator);
+  FilterIteratorData *pData = (FilterIteratorData*)pIterator->pIterData;
+  
+  if (pData) {
+    cypherIteratorDestroy(pData->pSource);
+    cypherProgramFree(pData->pProgram);
+    sqlite3_free(pData);
   }
 }
 
@@ -455,7 +937,7 @@ CypherIterator *cypherFilterCreate(PhysicalPlanNode *pPlan, ExecutionContext *pC
   CypherIterator *pIterator;
   FilterIteratorData *pData;
   
-  if (!pPlan || !pPlan->pChild || !pPlan->pFilterExpr) return NULL;
+  if (!pPlan || (!pPlan->pChild && pPlan->nChildren == 0) || !pPlan->pFilterExpr) return NULL;
   
   pIterator = sqlite3_malloc(sizeof(CypherIterator));
   if (!pIterator) return NULL;
@@ -470,20 +952,28 @@ CypherIterator *cypherFilterCreate(PhysicalPlanNode *pPlan, ExecutionContext *pC
   memset(pData, 0, sizeof(FilterIteratorData));
   
   /* Create source iterator */
-  pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
-  if (!pData->pSource) {
+  if (pPlan->pChild) {
+    pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
+    if (!pData->pSource) {
+      sqlite3_free(pData);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
+  }
+  
+  if (cypherProgramCompile(pPlan->pFilterExpr, &pData->pProgram) != SQLITE_OK) {
+    cypherIteratorDestroy(pData->pSource);
     sqlite3_free(pData);
     sqlite3_free(pIterator);
     return NULL;
   }
   
-  pData->pFilter = pPlan->pFilterExpr;
-  
   /* Set up iterator */
   pIterator->xOpen = filterIteratorOpen;
   pIterator->xNext = filterIteratorNext;
   pIterator->xClose = filterIteratorClose;
   pIterator->xDestroy = filterIteratorDestroy;
+  pIterator->xNextBatch = filterIteratorNextBatch;
   pIterator->pContext = pContext;
   pIterator->pPlan = pPlan;
   pIterator->pIterData = pData;
@@ -491,77 +981,157 @@ CypherIterator *cypherFilterCreate(PhysicalPlanNode *pPlan, ExecutionContext *pC
   return pIterator;
 }
 
-/* Projection iterator implementation */
+/*
+** Projection iterator implementation.
+** Each source row is bound into the context and the compiled projection
+** expressions are evaluated into the planned output columns. The batch path evaluates
+** the live rows of a source chunk, reading its vectors directly, into
+** VALUE vectors of the output chunk.
+*/
 typedef struct ProjectionIteratorData {
-  CypherIterator *pSource;          /* Source iterator */
-  CypherExpression **apProjections; /* Projection expressions */
+  CypherIterator *pSource;          /* Source iterator, if created here */
+  CypherProgram **apProgram;        /* Compiled projection expressions */
   int nProjections;                 /* Number of projections */
+  CypherDataChunk *pInput;          /* Batch path: source rows */
+  CypherResult *pSourceRow;         /* Row path: source row, reused */
+  const char **azColName;           /* Interned output column names */
 } ProjectionIteratorData;
 
 static int projectionIteratorOpen(CypherIterator *pIterator) {
   ProjectionIteratorData *pData = (ProjectionIteratorData*)pIterator->pIterData;
-  return pData->pSource->xOpen(pData->pSource);
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  int rc;
+  
+  if (!pSource) return SQLITE_ERROR;
+  rc = pSource->xOpen(pSource);
+  if (rc == SQLITE_OK) pIterator->bOpened = 1;
+  return rc;
+}
+
+/*
+** A projection planned without expressions returns the column of its
+** variable, or the whole row when it names none.
+*/
+static int projectionIteratorPassThrough(CypherIterator *pIterator, CypherResult *pSourceRow,
+                                         CypherResult *pResult) {
+  const char *zAlias = pIterator->pPlan->zAlias;
+  int i, rc;
+  
+  for (i = 0; i < pSourceRow->nColumns; i++) {
+    if (zAlias && strcmp(pSourceRow->azColumnNames[i], zAlias) != 0) continue;
+    rc = cypherResultAddColumn(pResult, pSourceRow->azColumnNames[i], &pSourceRow->aValues[i]);
+    if (rc != SQLITE_OK) return rc;
+  }
+  pIterator->nRowsProduced++;
+  return SQLITE_OK;
 }
 
 static int projectionIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
   ProjectionIteratorData *pData = (ProjectionIteratorData*)pIterator->pIterData;
-  CypherResult sourceResult;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  CypherResult *pSourceRow = pData->pSourceRow;
   int rc, i;
   
   /* Get next row from source */
-  rc = pData->pSource->xNext(pData->pSource, &sourceResult);
-  if (rc != SQLITE_OK) return rc;
-  
-  /* Create new result with projections */
-  memset(pResult, 0, sizeof(CypherResult));
+  if (!pSourceRow) {
+    pSourceRow = executionContextRowAcquire(pIterator->pContext);
+    if (!pSourceRow) return SQLITE_NOMEM;
+    pData->pSourceRow = pSourceRow;
+  }
+  cypherResultClear(pSourceRow);
+  rc = pSource->xNext(pSource, pSourceRow);
+  if (rc == SQLITE_OK && pData->nProjections == 0) {
+    return projectionIteratorPassThrough(pIterator, pSourceRow, pResult);
+  }
+  if (rc == SQLITE_OK) rc = iteratorBindRow(pIterator->pContext, pSourceRow);
+  if (rc != SQLITE_OK) return rc;
   
   for (i = 0; i < pData->nProjections; i++) {
     CypherValue projValue;
     
     /* Evaluate projection expression */
-    rc = cypherExpressionEvaluate(pData->apProjections[i], pIterator->pContext, &projValue);
+    rc = cypherProgramEvaluate(pData->apProgram[i], pIterator->pContext, &projValue);
+    if (rc != SQLITE_OK) return rc;
+    
+    /* Move it into the result */
+    rc = cypherResultTakeColumn(pResult, pData->azColName[i], &projValue);
     if (rc != SQLITE_OK) {
-      cypherResultDestroy(&sourceResult);
+      cypherValueDestroy(&projValue);
       return rc;
     }
-    
-    /* Add to result */
-    char *zColName = sqlite3_mprintf("col%d", i);
-    if (!zColName) {
-      cypherValueDestroy(&projValue);
-      cypherResultDestroy(&sourceResult);
-      return SQLITE_NOMEM;
+  }
+  
+  pIterator->nRowsProduced++;
+  return SQLITE_OK;
+}
+
+static int projectionIteratorNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  ProjectionIteratorData *pData = (ProjectionIteratorData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  CypherDataChunk *pInput;
+  int rc, i, j;
+  
+  if (!pData->pInput) {
+    rc = cypherChunkCreate(&pData->pInput);
+    if (rc != SQLITE_OK) return rc;
+  }
+  pInput = pData->pInput;
+  
+  rc = cypherIteratorNextBatch(pSource, pInput);
+  if (rc != SQLITE_OK) return rc;
+  
+  cypherChunkReset(pChunk);
+  if (pChunk->nCol == 0) {
+    for (j = 0; j < pData->nProjections; j++) {
+      if (cypherChunkAddColumn(pChunk, pData->azColName[j], CYPHER_VECTOR_VALUE) < 0) {
+        return SQLITE_NOMEM;
+      }
     }
+  }
+  
+  for (i = 0; i < pInput->nSel; i++) {
+    int iRow = pChunk->nRow;
+    int iInput = cypherChunkRow(pInput, i);
     
-    rc = cypherResultAddColumn(pResult, zColName, &projValue);
-    sqlite3_free(zColName);
-    cypherValueDestroy(&projValue);
-    
-    if (rc != SQLITE_OK) {
-      cypherResultDestroy(&sourceResult);
-      return rc;
+    for (j = 0; j < pData->nProjections; j++) {
+      rc = cypherProgramEvaluateRow(pData->apProgram[j], pIterator->pContext,
+                                    pInput, iInput, &pChunk->aCol[j].aValue[iRow]);
+      if (rc != SQLITE_OK) {
+        /* Free the columns of the partial row */
+        while (--j >= 0) {
+          cypherValueDestroy(&pChunk->aCol[j].aValue[iRow]);
+          memset(&pChunk->aCol[j].aValue[iRow], 0, sizeof(CypherValue));
+        }
+        return rc;
+      }
     }
+    pChunk->nRow++;
   }
   
-  cypherResultDestroy(&sourceResult);
+  pChunk->nSel = pChunk->nRow;
+  pIterator->nRowsProduced += pChunk->nRow;
   return SQLITE_OK;
 }
 
 static int projectionIteratorClose(CypherIterator *pIterator) {
   ProjectionIteratorData *pData = (ProjectionIteratorData*)pIterator->pIterData;
-  return pData->pSource->xClose(pData->pSource);
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  
+  cypherChunkReset(pData->pInput);
+  pIterator->bOpened = 0;
+  return pSource ? pSource->xClose(pSource) : SQLITE_OK;
 }
 
 static void projectionIteratorDestroy(CypherIterator *pIterator) {
-  if (pIterator) {
-    ProjectionIteratorData *pData = (ProjectionIteratorData*)pIterator->pIterData;
-    if (pData) {
-      if (pData->pSource) {
-        pData->pSource->xDestroy(pData->pSource);
-      }
-      sqlite3_free(pData);
-    }
-    sqlite3_free(pIterator);
+  ProjectionIteratorData *pData = (ProjectionIteratorData*)pIterator->pIterData;
+  
+  if (pData) {
+    cypherIteratorDestroy(pData->pSource);
+    cypherChunkFree(pData->pInput);
+    cypherResultDestroy(pData->pSourceRow);
+    sqlite3_free((void*)pData->azColName);
+    iteratorFreePrograms(pData->apProgram, pData->nProjections);
+    sqlite3_free(pData);
   }
 }
 
@@ -569,7 +1139,8 @@ CypherIterator *cypherProjectionCreate(PhysicalPlanNode *pPlan, ExecutionContext
   CypherIterator *pIterator;
   ProjectionIteratorData *pData;
   
-  if (!pPlan || !pPlan->pChild || !pPlan->apProjections || pPlan->nProjections <= 0) return NULL;
+  if (!pPlan || (!pPlan->pChild && pPlan->nChildren == 0)) return NULL;
+  if (pPlan->nProjections > 0 && !pPlan->apProjections) return NULL;
   
   pIterator = sqlite3_malloc(sizeof(CypherIterator));
   if (!pIterator) return NULL;
@@ -584,21 +1155,34 @@ CypherIterator *cypherProjectionCreate(PhysicalPlanNode *pPlan, ExecutionContext
   memset(pData, 0, sizeof(ProjectionIteratorData));
   
   /* Create source iterator */
-  pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
-  if (!pData->pSource) {
-    sqlite3_free(pData);
-    sqlite3_free(pIterator);
-    return NULL;
+  if (pPlan->pChild) {
+    pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
+    if (!pData->pSource) {
+      sqlite3_free(pData);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
   }
   
-  pData->apProjections = pPlan->apProjections;
   pData->nProjections = pPlan->nProjections;
+  if (pData->nProjections > 0) {
+    pData->apProgram = iteratorCompilePrograms(pPlan->apProjections, pPlan->nProjections);
+    pData->azColName = iteratorColumnNames(pContext, pPlan->azColumn,
+                                             pData->nProjections);
+  }
+  if (pData->nProjections > 0 && (!pData->apProgram || !pData->azColName)) {
+    pIterator->pIterData = pData;
+    projectionIteratorDestroy(pIterator);
+    sqlite3_free(pIterator);
+    return NULL;
+  }
   
   /* Set up iterator */
   pIterator->xOpen = projectionIteratorOpen;
   pIterator->xNext = projectionIteratorNext;
   pIterator->xClose = projectionIteratorClose;
   pIterator->xDestroy = projectionIteratorDestroy;
+  if (pData->nProjections > 0) pIterator->xNextBatch = projectionIteratorNextBatch;
   pIterator->pContext = pContext;
   pIterator->pPlan = pPlan;
   pIterator->pIterData = pData;
@@ -606,106 +1190,120 @@ CypherIterator *cypherProjectionCreate(PhysicalPlanNode *pPlan, ExecutionContext
   return pIterator;
 }
 
-/* Sort iterator implementation */
+/*
+** Sort iterator implementation.
+** Open drains the source into a CypherSorter. Each row's columns are
+** bound into the context before the sort keys are evaluated, so keys see
+** the row being added; the keys are then normalized once per row by the
+** sorter.
+*/
 typedef struct SortIteratorData {
-  CypherIterator *pSource;     /* Source iterator */
-  CypherResult *aResults;      /* Array of results to sort */
-  int nResults;                /* Number of results */
-  int nAllocated;              /* Allocated size */
-  int iCurrent;                /* Current position */
-  CypherExpression **apSortKeys; /* Sort key expressions */
+  CypherIterator *pSource;     /* Source iterator, if created here */
+  CypherSorter *pSorter;       /* Rows of the current open */
+  CypherValue *aKey;           /* Scratch: evaluated keys of one row */
+  CypherProgram **apProgram;   /* Compiled sort key expressions */
   int nSortKeys;               /* Number of sort keys */
 } SortIteratorData;
 
+static CypherIterator *sortIteratorSource(CypherIterator *pIterator) {
+  SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
+  return iteratorSource(pIterator, pData->pSource);
+}
+
+/* Bind the columns of pRow and evaluate the sort keys into aKey */
+static int sortIteratorEvalKeys(CypherIterator *pIterator, CypherResult *pRow) {
+  SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
+  int i, rc;
+  
+  rc = iteratorBindRow(pIterator->pContext, pRow);
+  if (rc != SQLITE_OK) return rc;
+  for (i = 0; i < pData->nSortKeys; i++) {
+    rc = cypherProgramEvaluate(pData->apProgram[i], pIterator->pContext, &pData->aKey[i]);
+    if (rc != SQLITE_OK) return rc;
+  }
+  return SQLITE_OK;
+}
+
+static void sortIteratorClearKeys(SortIteratorData *pData) {
+  int i;
+  for (i = 0; i < pData->nSortKeys; i++) {
+    cypherValueDestroy(&pData->aKey[i]);
+    memset(&pData->aKey[i], 0, sizeof(CypherValue));
+  }
+}
+
 static int sortIteratorOpen(CypherIterator *pIterator) {
   SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
-  CypherResult result;
+  CypherIterator *pSource = sortIteratorSource(pIterator);
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  ExecutionContext *pContext = pIterator->pContext;
   int rc;
   
-  /* Open source iterator */
-  rc = pData->pSource->xOpen(pData->pSource);
+  if (!pSource) return SQLITE_ERROR;
+  
+  cypherSorterFree(pData->pSorter);
+  pData->pSorter = NULL;
+  rc = cypherSorterCreate(pContext->pDb, pData->nSortKeys, pPlan->aSortFlags,
+                          pPlan->nLimit, pContext->nSortMemory, &pData->pSorter);
   if (rc != SQLITE_OK) return rc;
   
-  /* Collect all results */
-  pData->nResults = 0;
-  pData->iCurrent = 0;
-  
-  while ((rc = pData->pSource->xNext(pData->pSource, &result)) == SQLITE_OK) {
-    /* Resize array if needed */
-    if (pData->nResults >= pData->nAllocated) {
-      int nNew = pData->nAllocated ? pData->nAllocated * 2 : 16;
-      CypherResult *aNew = sqlite3_realloc(pData->aResults, nNew * sizeof(CypherResult));
-      if (!aNew) {
-        cypherResultDestroy(&result);
-        return SQLITE_NOMEM;
-      }
-      pData->aResults = aNew;
-      pData->nAllocated = nNew;
+  rc = pSource->xOpen(pSource);
+  if (rc != SQLITE_OK) return rc;
+  pIterator->bOpened = 1;
+  
+  /* Collect all rows with their keys */
+  while (1) {
+    CypherResult *pRow = cypherResultCreate();
+    if (!pRow) return SQLITE_NOMEM;
+    
+    rc = pSource->xNext(pSource, pRow);
+    if (rc != SQLITE_OK) {
+      cypherResultDestroy(pRow);
+      break;
     }
     
-    /* Copy result */
-    pData->aResults[pData->nResults++] = result;
-  }
-  
-  /* Sort results - simple bubble sort for now */
-  for (int i = 0; i < pData->nResults - 1; i++) {
-    for (int j = 0; j < pData->nResults - i - 1; j++) {
-      /* Compare using first sort key only for simplicity */
-      if (pData->nSortKeys > 0) {
-        CypherValue v1, v2;
-        cypherExpressionEvaluate(pData->apSortKeys[0], pIterator->pContext, &v1);
-        cypherExpressionEvaluate(pData->apSortKeys[0], pIterator->pContext, &v2);
-        
-        if (cypherValueCompare(&v1, &v2) > 0) {
-          /* Swap */
-          CypherResult temp = pData->aResults[j];
-          pData->aResults[j] = pData->aResults[j + 1];
-          pData->aResults[j + 1] = temp;
-        }
-        
-        cypherValueDestroy(&v1);
-        cypherValueDestroy(&v2);
-      }
+    rc = sortIteratorEvalKeys(pIterator, pRow);
+    if (rc == SQLITE_OK) {
+      rc = cypherSorterAdd(pData->pSorter, pData->aKey, pRow);
+    } else {
+      cypherResultDestroy(pRow);
     }
+    sortIteratorClearKeys(pData);
+    if (rc != SQLITE_OK) return rc;
   }
+  if (rc != SQLITE_DONE) return rc;
   
-  return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+  return cypherSorterFinish(pData->pSorter);
 }
 
 static int sortIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
   SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
   
-  if (pData->iCurrent >= pData->nResults) {
-    return SQLITE_DONE;
-  }
-  
-  /* Return copy of current result */
-  *pResult = pData->aResults[pData->iCurrent++];
-  return SQLITE_OK;
+  if (!pData->pSorter) return SQLITE_DONE;
+  return cypherSorterNext(pData->pSorter, pResult);
 }
 
 static int sortIteratorClose(CypherIterator *pIterator) {
   SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
+  CypherIterator *pSource = sortIteratorSource(pIterator);
   
-  /* Free sorted results */
-  for (int i = 0; i < pData->nResults; i++) {
-    cypherResultDestroy(&pData->aResults[i]);
-  }
+  /* Free unread rows and the spill file */
+  cypherSorterFree(pData->pSorter);
+  pData->pSorter = NULL;
+  pIterator->bOpened = 0;
   
-  return pData->pSource->xClose(pData->pSource);
+  return pSource ? pSource->xClose(pSource) : SQLITE_OK;
 }
 
 static void sortIteratorDestroy(CypherIterator *pIterator) {
-  if (pIterator) {
-    SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
-    if (pData) {
-      if (pData->pSource) {
-        pData->pSource->xDestroy(pData->pSource);
-      }
-      sqlite3_free(pData->aResults);
-      sqlite3_free(pData);
-    }
-    sqlite3_free(pIterator);
+  SortIteratorData *pData = (SortIteratorData*)pIterator->pIterData;
+  
+  if (pData) {
+    cypherSorterFree(pData->pSorter);
+    cypherIteratorDestroy(pData->pSource);
+    iteratorFreePrograms(pData->apProgram, pData->nSortKeys);
+    sqlite3_free(pData->aKey);
+    sqlite3_free(pData);
   }
 }
 
@@ -713,7 +1311,8 @@ CypherIterator *cypherSortCreate(PhysicalPlanNode *pPlan, ExecutionContext *pCon
   CypherIterator *pIterator;
   SortIteratorData *pData;
   
-  if (!pPlan || !pPlan->pChild) return NULL;
+  if (!pPlan || (!pPlan->pChild && pPlan->nChildren == 0)) return NULL;
+  if (pPlan->nSortKeys > 0 && !pPlan->apSortKeys) return NULL;
   
   pIterator = sqlite3_malloc(sizeof(CypherIterator));
   if (!pIterator) return NULL;
@@ -727,16 +1326,38 @@ CypherIterator *cypherSortCreate(PhysicalPlanNode *pPlan, ExecutionContext *pCon
   memset(pIterator, 0, sizeof(CypherIterator));
   memset(pData, 0, sizeof(SortIteratorData));
   
+  if (pPlan->nSortKeys > 0) {
+    pData->aKey = sqlite3_malloc(pPlan->nSortKeys * sizeof(CypherValue));
+    if (!pData->aKey) {
+      sqlite3_free(pData);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
+    memset(pData->aKey, 0, pPlan->nSortKeys * sizeof(CypherValue));
+  }
+  
   /* Create source iterator */
-  pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
-  if (!pData->pSource) {
-    sqlite3_free(pData);
-    sqlite3_free(pIterator);
-    return NULL;
+  if (pPlan->pChild) {
+    pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
+    if (!pData->pSource) {
+      sqlite3_free(pData->aKey);
+      sqlite3_free(pData);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
   }
   
-  pData->apSortKeys = pPlan->apSortKeys;
   pData->nSortKeys = pPlan->nSortKeys;
+  if (pPlan->nSortKeys > 0) {
+    pData->apProgram = iteratorCompilePrograms(pPlan->apSortKeys, pPlan->nSortKeys);
+    if (!pData->apProgram) {
+      cypherIteratorDestroy(pData->pSource);
+      sqlite3_free(pData->aKey);
+      sqlite3_free(pData);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
+  }
   
   /* Set up iterator */
   pIterator->xOpen = sortIteratorOpen;
@@ -750,21 +1371,32 @@ CypherIterator *cypherSortCreate(PhysicalPlanNode *pPlan, ExecutionContext *pCon
   return pIterator;
 }
 
-/* Limit iterator implementation */
+/*
+** Limit iterator implementation.
+** The batch path shortens the last chunk's selection to the rows still
+** allowed.
+*/
 typedef struct LimitIteratorData {
-  CypherIterator *pSource;  /* Source iterator */
+  CypherIterator *pSource;  /* Source iterator, if created here */
   int nLimit;               /* Limit count */
   int nReturned;            /* Number returned so far */
 } LimitIteratorData;
 
 static int limitIteratorOpen(CypherIterator *pIterator) {
   LimitIteratorData *pData = (LimitIteratorData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  int rc;
+  
+  if (!pSource) return SQLITE_ERROR;
   pData->nReturned = 0;
-  return pData->pSource->xOpen(pData->pSource);
+  rc = pSource->xOpen(pSource);
+  if (rc == SQLITE_OK) pIterator->bOpened = 1;
+  return rc;
 }
 
 static int limitIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
   LimitIteratorData *pData = (LimitIteratorData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
   
   /* Check if limit reached */
   if (pData->nReturned >= pData->nLimit) {
@@ -772,7 +1404,7 @@ static int limitIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
   }
   
   /* Get next from source */
-  int rc = pData->pSource->xNext(pData->pSource, pResult);
+  int rc = pSource->xNext(pSource, pResult);
   if (rc == SQLITE_OK) {
     pData->nReturned++;
   }
@@ -780,21 +1412,36 @@ static int limitIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
   return rc;
 }
 
+static int limitIteratorNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  LimitIteratorData *pData = (LimitIteratorData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  int nLeft = pData->nLimit - pData->nReturned;
+  int rc;
+  
+  if (nLeft <= 0) return SQLITE_DONE;
+  
+  rc = cypherIteratorNextBatch(pSource, pChunk);
+  if (rc != SQLITE_OK) return rc;
+  
+  if (pChunk->nSel > nLeft) pChunk->nSel = nLeft;
+  pData->nReturned += pChunk->nSel;
+  return SQLITE_OK;
+}
+
 static int limitIteratorClose(CypherIterator *pIterator) {
   LimitIteratorData *pData = (LimitIteratorData*)pIterator->pIterData;
-  return pData->pSource->xClose(pData->pSource);
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  
+  pIterator->bOpened = 0;
+  return pSource ? pSource->xClose(pSource) : SQLITE_OK;
 }
 
 static void limitIteratorDestroy(CypherIterator *pIterator) {
-  if (pIterator) {
-    LimitIteratorData *pData = (LimitIteratorData*)pIterator->pIterData;
-    if (pData) {
-      if (pData->pSource) {
-        pData->pSource->xDestroy(pData->pSource);
-      }
-      sqlite3_free(pData);
-    }
-    sqlite3_free(pIterator);
+  LimitIteratorData *pData = (LimitIteratorData*)pIterator->pIterData;
+  
+  if (pData) {
+    cypherIteratorDestroy(pData->pSource);
+    sqlite3_free(pData);
   }
 }
 
@@ -802,7 +1449,7 @@ CypherIterator *cypherLimitCreate(PhysicalPlanNode *pPlan, ExecutionContext *pCo
   CypherIterator *pIterator;
   LimitIteratorData *pData;
   
-  if (!pPlan || !pPlan->pChild || pPlan->nLimit <= 0) return NULL;
+  if (!pPlan || (!pPlan->pChild && pPlan->nChildren == 0) || pPlan->nLimit < 0) return NULL;
   
   pIterator = sqlite3_malloc(sizeof(CypherIterator));
   if (!pIterator) return NULL;
@@ -817,11 +1464,13 @@ CypherIterator *cypherLimitCreate(PhysicalPlanNode *pPlan, ExecutionContext *pCo
   memset(pData, 0, sizeof(LimitIteratorData));
   
   /* Create source iterator */
-  pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
-  if (!pData->pSource) {
-    sqlite3_free(pData);
-    sqlite3_free(pIterator);
-    return NULL;
+  if (pPlan->pChild) {
+    pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
+    if (!pData->pSource) {
+      sqlite3_free(pData);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
   }
   
   pData->nLimit = pPlan->nLimit;
@@ -832,9 +1481,1272 @@ CypherIterator *cypherLimitCreate(PhysicalPlanNode *pPlan, ExecutionContext *pCo
   pIterator->xNext = limitIteratorNext;
   pIterator->xClose = limitIteratorClose;
   pIterator->xDestroy = limitIteratorDestroy;
+  pIterator->xNextBatch = limitIteratorNextBatch;
   pIterator->pContext = pContext;
   pIterator->pPlan = pPlan;
   pIterator->pIterData = pData;
   
   return pIterator;
-}
\ No newline at end of file
+}
+
+/*
+** Hash join and index nested loop iterator implementation.
+**
+** A hash join drains its build side, the child with the smaller row
+** estimate, into an open-addressing table keyed on the node id bound to
+** the join variable (pPlan->zAlias), then streams the other child
+** through it. The table is probed linearly; each slot holds the first
+** and last build row of its key, so rows with the same key come out in
+** arrival order. Rows whose key is NULL or missing never join. A join
+** without a key variable is a cross product: every row has key 0.
+**
+** Once the build rows outgrow the budget (ExecutionContext.nSortMemory)
+** a keyed join turns into a Grace hash join. The table is emptied into
+** CYPHER_JOIN_PARTITIONS CypherSorter partitions by key hash, the rest
+** of the build side and all of the probe side follow, and the partition
+** pairs are then joined one at a time. A cross product keeps its build
+** side in memory.
+**
+** An index nested loop reads only its first child and looks each row up
+** with a prepared probe of the second: a node scan of the join variable
+** becomes a point lookup of that node (and its label), and an expand
+** that reaches the join variable from a scanned node is answered from
+** the edge index of the opposite direction. Inner plans of any other
+** shape are hash joined.
+**
+** Output rows hold the columns of the first child followed by those of
+** the second not already present.
+*/
+
+#define JOIN_MODE_HASH   0      /* Build and probe a hash table */
+#define JOIN_MODE_LOOKUP 1      /* Look outer rows up with pLookup */
+
+typedef struct HashJoinSlot {
+  sqlite3_int64 iKey;           /* Join key */
+  int iFirst;                   /* First entry with this key, -1 if free */
+  int iLast;                    /* Last entry with this key */
+} HashJoinSlot;
+
+typedef struct HashJoinEntry {
+  CypherResult *pRow;           /* Build row */
+  sqlite3_int64 iKey;           /* Its join key */
+  int iNext;                    /* Next entry with the same key, or -1 */
+} HashJoinEntry;
+
+typedef struct HashJoinData {
+  int eMode;                    /* JOIN_MODE_* */
+  int iBuild;                   /* Child index of the build side */
+  sqlite3_int64 nMemory;        /* Spill threshold in bytes */
+  
+  /* Hash table of the build rows */
+  HashJoinSlot *aSlot;          /* nSlot slots, a power of two */
+  int nSlot;                    /* Allocated slots */
+  int nSlotUsed;                /* Distinct keys */
+  HashJoinEntry *aEntry;        /* Build rows in arrival order */
+  int nEntry;                   /* Build rows held */
+  int nEntryAlloc;              /* Allocated entries */
+  sqlite3_int64 nByte;          /* Approximate bytes of build rows held */
+  
+  /* Grace partitions, once spilled */
+  CypherSorter **apBuild;       /* Build rows by partition, or NULL */
+  CypherSorter **apProbe;       /* Probe rows by partition */
+  int iPart;                    /* Partition in the table */
+  
+  /* Probe state */
+  CypherResult *pProbe;         /* Current probe or outer row */
+  int iMatch;                   /* Next entry to pair it with, or -1 */
+  sqlite3_stmt *pLookup;        /* JOIN_MODE_LOOKUP: inner side of one key */
+  char *zLookupSql;             /* SQL of pLookup */
+  const char *zLookupAlias;     /* Column the lookup adds, or NULL */
+  unsigned char abOpen[2];      /* Children opened by xOpen */
+} HashJoinData;
+
+/* Index of the column named zName in pRow, or -1 */
+static int joinColumn(CypherResult *pRow, const char *zName) {
+  int i;
+  
+  for (i = 0; i < pRow->nColumns; i++) {
+    if (strcmp(pRow->azColumnNames[i], zName) == 0) return i;
+  }
+  return -1;
+}
+
+/*
+** Set *piKey to the join key of pRow, the node id (or integer) in
+** column zKey. Returns 0 if the row cannot join.
+*/
+static int joinRowKey(const char *zKey, CypherResult *pRow, sqlite3_int64 *piKey) {
+  int i;
+  
+  *piKey = 0;
+  if (!zKey) return 1;
+  i = joinColumn(pRow, zKey);
+  if (i < 0) return 0;
+  switch (pRow->aValues[i].type) {
+    case CYPHER_VALUE_NODE:
+      *piKey = pRow->aValues[i].u.iNodeId;
+      return 1;
+    case CYPHER_VALUE_INTEGER:
+      *piKey = pRow->aValues[i].u.iInteger;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* 64-bit finalizer: the table uses the low bits, partitions the high */
+static sqlite3_uint64 joinHash(sqlite3_int64 iKey) {
+  sqlite3_uint64 h = (sqlite3_uint64)iKey;
+  
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static int joinPartition(sqlite3_int64 iKey) {
+  return (int)((joinHash(iKey) >> 32) % CYPHER_JOIN_PARTITIONS);
+}
+
+/* Slot of iKey, or of the free slot where it would go */
+static HashJoinSlot *joinTableSlot(HashJoinSlot *aSlot, int nSlot, sqlite3_int64 iKey) {
+  int i = (int)(joinHash(iKey) & (sqlite3_uint64)(nSlot - 1));
+  
+  while (aSlot[i].iFirst >= 0 && aSlot[i].iKey != iKey) {
+    i = (i + 1) & (nSlot - 1);
+  }
+  return &aSlot[i];
+}
+
+/* Double the table, keeping it at most half full */
+static int joinTableGrow(HashJoinData *pData) {
+  int nNew = pData->nSlot ? pData->nSlot * 2 : 64;
+  HashJoinSlot *aNew;
+  int i;
+  
+  aNew = sqlite3_malloc(nNew * sizeof(HashJoinSlot));
+  if (!aNew) return SQLITE_NOMEM;
+  for (i = 0; i < nNew; i++) aNew[i].iFirst = -1;
+  for (i = 0; i < pData->nSlot; i++) {
+    if (pData->aSlot[i].iFirst >= 0) {
+      *joinTableSlot(aNew, nNew, pData->aSlot[i].iKey) = pData->aSlot[i];
+    }
+  }
+  sqlite3_free(pData->aSlot);
+  pData->aSlot = aNew;
+  pData->nSlot = nNew;
+  return SQLITE_OK;
+}
+
+/* Add a build row under iKey. Takes ownership of pRow even on error. */
+static int joinTableInsert(HashJoinData *pData, sqlite3_int64 iKey, CypherResult *pRow) {
+  HashJoinSlot *pSlot;
+  int iEntry;
+  
+  if ((pData->nSlotUsed + 1) * 2 > pData->nSlot && joinTableGrow(pData) != SQLITE_OK) {
+    cypherResultDestroy(pRow);
+    return SQLITE_NOMEM;
+  }
+  if (pData->nEntry >= pData->nEntryAlloc) {
+    int nNew = pData->nEntryAlloc ? pData->nEntryAlloc * 2 : 64;
+    HashJoinEntry *aNew = sqlite3_realloc(pData->aEntry, nNew * sizeof(HashJoinEntry));
+    if (!aNew) {
+      cypherResultDestroy(pRow);
+      return SQLITE_NOMEM;
+    }
+    pData->aEntry = aNew;
+    pData->nEntryAlloc = nNew;
+  }
+  
+  iEntry = pData->nEntry++;
+  pData->aEntry[iEntry].pRow = pRow;
+  pData->aEntry[iEntry].iKey = iKey;
+  pData->aEntry[iEntry].iNext = -1;
+  pData->nByte += sizeof(HashJoinEntry) + cypherSorterRowBytes(pRow);
+  
+  pSlot = joinTableSlot(pData->aSlot, pData->nSlot, iKey);
+  if (pSlot->iFirst < 0) {
+    pSlot->iKey = iKey;
+    pSlot->iFirst = iEntry;
+    pData->nSlotUsed++;
+  } else {
+    pData->aEntry[pSlot->iLast].iNext = iEntry;
+  }
+  pSlot->iLast = iEntry;
+  return SQLITE_OK;
+}
+
+/* First build entry with key iKey, or -1 */
+static int joinTableFind(HashJoinData *pData, sqlite3_int64 iKey) {
+  if (pData->nSlotUsed == 0) return -1;
+  return joinTableSlot(pData->aSlot, pData->nSlot, iKey)->iFirst;
+}
+
+static void joinTableClear(HashJoinData *pData) {
+  int i;
+  
+  for (i = 0; i < pData->nEntry; i++) cypherResultDestroy(pData->aEntry[i].pRow);
+  for (i = 0; i < pData->nSlot; i++) pData->aSlot[i].iFirst = -1;
+  pData->nEntry = 0;
+  pData->nSlotUsed = 0;
+  pData->nByte = 0;
+}
+
+static void joinFreePartitions(HashJoinData *pData) {
+  int i;
+  
+  for (i = 0; i < CYPHER_JOIN_PARTITIONS; i++) {
+    if (pData->apBuild) cypherSorterFree(pData->apBuild[i]);
+    if (pData->apProbe) cypherSorterFree(pData->apProbe[i]);
+  }
+  sqlite3_free(pData->apBuild);
+  sqlite3_free(pData->apProbe);
+  pData->apBuild = NULL;
+  pData->apProbe = NULL;
+}
+
+/*
+** The build side is over budget: create the partitions and move the
+** rows of the table into them.
+*/
+static int joinSpill(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  int nByte = CYPHER_JOIN_PARTITIONS * sizeof(CypherSorter*);
+  sqlite3_int64 nPartMemory = pData->nMemory / CYPHER_JOIN_PARTITIONS;
+  int i, rc = SQLITE_OK;
+  
+  pData->apBuild = sqlite3_malloc(nByte);
+  pData->apProbe = sqlite3_malloc(nByte);
+  if (!pData->apBuild || !pData->apProbe) return SQLITE_NOMEM;
+  memset(pData->apBuild, 0, nByte);
+  memset(pData->apProbe, 0, nByte);
+  
+  if (nPartMemory < 1) nPartMemory = 1;
+  for (i = 0; rc == SQLITE_OK && i < CYPHER_JOIN_PARTITIONS; i++) {
+    rc = cypherSorterCreate(pIterator->pContext->pDb, 0, NULL, 0, nPartMemory,
+                            &pData->apBuild[i]);
+    if (rc == SQLITE_OK) {
+      rc = cypherSorterCreate(pIterator->pContext->pDb, 0, NULL, 0, nPartMemory,
+                              &pData->apProbe[i]);
+    }
+  }
+  
+  for (i = 0; i < pData->nEntry; i++) {
+    HashJoinEntry *pEntry = &pData->aEntry[i];
+    if (rc == SQLITE_OK) {
+      rc = cypherSorterAdd(pData->apBuild[joinPartition(pEntry->iKey)], NULL, pEntry->pRow);
+    } else {
+      cypherResultDestroy(pEntry->pRow);
+    }
+    pEntry->pRow = NULL;
+  }
+  joinTableClear(pData);
+  return rc;
+}
+
+/*
+** Load the build rows of the next partition into the table. Returns
+** SQLITE_DONE after the last partition.
+*/
+static int joinNextPartition(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  const char *zKey = pIterator->pPlan->zAlias;
+  sqlite3_int64 iKey;
+  int rc;
+  
+  joinTableClear(pData);
+  if (++pData->iPart >= CYPHER_JOIN_PARTITIONS) return SQLITE_DONE;
+  
+  while (1) {
+    CypherResult *pRow = cypherResultCreate();
+    if (!pRow) return SQLITE_NOMEM;
+    rc = cypherSorterNext(pData->apBuild[pData->iPart], pRow);
+    if (rc != SQLITE_OK) {
+      cypherResultDestroy(pRow);
+      break;
+    }
+    joinRowKey(zKey, pRow, &iKey);
+    rc = joinTableInsert(pData, iKey, pRow);
+    if (rc != SQLITE_OK) return rc;
+  }
+  if (rc != SQLITE_DONE) return rc;
+  
+  /* The partition is in the table now; release its run */
+  cypherSorterFree(pData->apBuild[pData->iPart]);
+  pData->apBuild[pData->iPart] = NULL;
+  return SQLITE_OK;
+}
+
+/*
+** Read the next probe row into pRow: from the probe child, or once
+** spilled from the probe partition matching the table, moving on to
+** the next partition pair when it runs out.
+*/
+static int joinNextProbe(CypherIterator *pIterator, CypherResult *pRow) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  CypherIterator *pProbe = pIterator->apChildren[1 - pData->iBuild];
+  int rc;
+  
+  if (!pData->apProbe) return pProbe->xNext(pProbe, pRow);
+  
+  while (pData->iPart < CYPHER_JOIN_PARTITIONS) {
+    /* Probe rows of an empty build partition cannot match */
+    if (pData->nEntry > 0) {
+      rc = cypherSorterNext(pData->apProbe[pData->iPart], pRow);
+      if (rc != SQLITE_DONE) return rc;
+    }
+    cypherSorterFree(pData->apProbe[pData->iPart]);
+    pData->apProbe[pData->iPart] = NULL;
+    rc = joinNextPartition(pIterator);
+    if (rc != SQLITE_OK) return rc;
+  }
+  return SQLITE_DONE;
+}
+
+/* Append the columns of pFirst, then those of pSecond not in pFirst */
+static int joinEmit(CypherResult *pResult, CypherResult *pFirst, CypherResult *pSecond) {
+  int i, rc;
+  
+  for (i = 0; i < pFirst->nColumns; i++) {
+    rc = cypherResultAddColumn(pResult, pFirst->azColumnNames[i], &pFirst->aValues[i]);
+    if (rc != SQLITE_OK) return rc;
+  }
+  for (i = 0; pSecond && i < pSecond->nColumns; i++) {
+    if (joinColumn(pFirst, pSecond->azColumnNames[i]) >= 0) continue;
+    rc = cypherResultAddColumn(pResult, pSecond->azColumnNames[i], &pSecond->aValues[i]);
+    if (rc != SQLITE_OK) return rc;
+  }
+  return SQLITE_OK;
+}
+
+/* Drain the build child into the table or, once spilled, its partitions */
+static int hashJoinBuild(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  CypherIterator *pBuild = pIterator->apChildren[pData->iBuild];
+  const char *zKey = pIterator->pPlan->zAlias;
+  sqlite3_int64 iKey;
+  int rc;
+  
+  while (1) {
+    CypherResult *pRow = cypherResultCreate();
+    if (!pRow) return SQLITE_NOMEM;
+    
+    rc = pBuild->xNext(pBuild, pRow);
+    if (rc != SQLITE_OK) {
+      cypherResultDestroy(pRow);
+      break;
+    }
+    if (!joinRowKey(zKey, pRow, &iKey)) {
+      cypherResultDestroy(pRow);
+      continue;
+    }
+    
+    if (pData->apBuild) {
+      rc = cypherSorterAdd(pData->apBuild[joinPartition(iKey)], NULL, pRow);
+    } else {
+      rc = joinTableInsert(pData, iKey, pRow);
+      if (rc == SQLITE_OK && zKey && pData->nByte > pData->nMemory) {
+        rc = joinSpill(pIterator);
+      }
+    }
+    if (rc != SQLITE_OK) return rc;
+  }
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/* Spilled: drain the probe child into its partitions */
+static int hashJoinPartitionProbe(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  CypherIterator *pProbe = pIterator->apChildren[1 - pData->iBuild];
+  const char *zKey = pIterator->pPlan->zAlias;
+  sqlite3_int64 iKey;
+  int i, rc;
+  
+  while (1) {
+    CypherResult *pRow = cypherResultCreate();
+    if (!pRow) return SQLITE_NOMEM;
+    
+    rc = pProbe->xNext(pProbe, pRow);
+    if (rc != SQLITE_OK) {
+      cypherResultDestroy(pRow);
+      break;
+    }
+    if (!joinRowKey(zKey, pRow, &iKey)) {
+      cypherResultDestroy(pRow);
+      continue;
+    }
+    rc = cypherSorterAdd(pData->apProbe[joinPartition(iKey)], NULL, pRow);
+    if (rc != SQLITE_OK) return rc;
+  }
+  if (rc != SQLITE_DONE) return rc;
+  
+  for (i = 0; i < CYPHER_JOIN_PARTITIONS; i++) {
+    rc = cypherSorterFinish(pData->apBuild[i]);
+    if (rc == SQLITE_OK) rc = cypherSorterFinish(pData->apProbe[i]);
+    if (rc != SQLITE_OK) return rc;
+  }
+  
+  /* Load the first partition pair */
+  pData->iPart = -1;
+  rc = joinNextPartition(pIterator);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/* Drop the rows, partitions and probe state of the previous open */
+static void hashJoinReset(HashJoinData *pData) {
+  joinTableClear(pData);
+  joinFreePartitions(pData);
+  cypherResultDestroy(pData->pProbe);
+  pData->pProbe = NULL;
+  pData->iMatch = -1;
+  pData->iPart = 0;
+}
+
+static int hashJoinOpen(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  GraphVtab *pGraph = pIterator->pContext->pGraph;
+  int iProbe = 1 - pData->iBuild;
+  int rc;
+  
+  if (pIterator->nChildren != 2) return SQLITE_ERROR;
+  hashJoinReset(pData);
+  
+  if (pData->eMode == JOIN_MODE_LOOKUP) {
+    if (!pData->pLookup) {
+      if (!pGraph) return SQLITE_ERROR;
+      rc = sqlite3_prepare_v2(pGraph->pDb, pData->zLookupSql, -1, &pData->pLookup, 0);
+      if (rc != SQLITE_OK) return rc;
+    }
+    rc = pIterator->apChildren[0]->xOpen(pIterator->apChildren[0]);
+    if (rc != SQLITE_OK) return rc;
+    pData->abOpen[0] = 1;
+    pIterator->bOpened = 1;
+    return SQLITE_OK;
+  }
+  
+  rc = pIterator->apChildren[pData->iBuild]->xOpen(pIterator->apChildren[pData->iBuild]);
+  if (rc != SQLITE_OK) return rc;
+  pData->abOpen[pData->iBuild] = 1;
+  pIterator->bOpened = 1;
+  
+  rc = hashJoinBuild(pIterator);
+  if (rc != SQLITE_OK) return rc;
+  
+  /* Nothing to join against: the probe side is never read */
+  if (!pData->apBuild && pData->nEntry == 0) return SQLITE_OK;
+  
+  rc = pIterator->apChildren[iProbe]->xOpen(pIterator->apChildren[iProbe]);
+  if (rc != SQLITE_OK) return rc;
+  pData->abOpen[iProbe] = 1;
+  
+  if (pData->apBuild) return hashJoinPartitionProbe(pIterator);
+  return SQLITE_OK;
+}
+
+static int hashJoinNext(CypherIterator *pIterator, CypherResult *pResult) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  const char *zKey = pIterator->pPlan->zAlias;
+  sqlite3_int64 iKey;
+  int rc;
+  
+  if (!pData->apBuild && pData->nEntry == 0) return SQLITE_DONE;
+  
+  while (1) {
+    if (pData->pProbe && pData->iMatch >= 0) {
+      HashJoinEntry *pEntry = &pData->aEntry[pData->iMatch];
+      pData->iMatch = pEntry->iNext;
+      if (pData->iBuild == 0) {
+        rc = joinEmit(pResult, pEntry->pRow, pData->pProbe);
+      } else {
+        rc = joinEmit(pResult, pData->pProbe, pEntry->pRow);
+      }
+      if (rc == SQLITE_OK) pIterator->nRowsProduced++;
+      return rc;
+    }
+    
+    /* Next probe row with a match */
+    executionContextRowRelease(pIterator->pContext, pData->pProbe);
+    pData->pProbe = executionContextRowAcquire(pIterator->pContext);
+    if (!pData->pProbe) return SQLITE_NOMEM;
+    rc = joinNextProbe(pIterator, pData->pProbe);
+    if (rc != SQLITE_OK) {
+      executionContextRowRelease(pIterator->pContext, pData->pProbe);
+      pData->pProbe = NULL;
+      return rc;
+    }
+    pData->iMatch = joinRowKey(zKey, pData->pProbe, &iKey) ? joinTableFind(pData, iKey) : -1;
+  }
+}
+
+static int indexLoopNext(CypherIterator *pIterator, CypherResult *pResult) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  CypherIterator *pOuter = pIterator->apChildren[0];
+  const char *zKey = pIterator->pPlan->zAlias;
+  sqlite3_int64 iKey;
+  int rc;
+  
+  while (1) {
+    if (pData->pProbe) {
+      rc = CYPHER_STEP(pIterator->pContext, pData->pLookup);
+      if (rc == SQLITE_ROW) {
+        CypherValue nodeValue;
+        int iCol;
+        
+        if (!pData->zLookupAlias) {
+          rc = joinEmit(pResult, pData->pProbe, NULL);
+          if (rc == SQLITE_OK) pIterator->nRowsProduced++;
+          return rc;
+        }
+        
+        memset(&nodeValue, 0, sizeof(nodeValue));
+        nodeValue.type = CYPHER_VALUE_NODE;
+        nodeValue.u.iNodeId = sqlite3_column_int64(pData->pLookup, 0);
+        
+        /* A node the outer row already binds must be the same node */
+        iCol = joinColumn(pData->pProbe, pData->zLookupAlias);
+        if (iCol >= 0 && (pData->pProbe->aValues[iCol].type != CYPHER_VALUE_NODE ||
+                          pData->pProbe->aValues[iCol].u.iNodeId != nodeValue.u.iNodeId)) {
+          continue;
+        }
+        rc = joinEmit(pResult, pData->pProbe, NULL);
+        if (rc == SQLITE_OK && iCol < 0) {
+          rc = cypherResultAddColumnShared(pResult, pData->zLookupAlias, &nodeValue);
+        }
+        if (rc == SQLITE_OK) pIterator->nRowsProduced++;
+        return rc;
+      }
+      sqlite3_reset(pData->pLookup);
+      if (rc != SQLITE_DONE) return rc;
+      executionContextRowRelease(pIterator->pContext, pData->pProbe);
+      pData->pProbe = NULL;
+    }
+    
+    /* Next outer row with a key */
+    pData->pProbe = executionContextRowAcquire(pIterator->pContext);
+    if (!pData->pProbe) return SQLITE_NOMEM;
+    rc = pOuter->xNext(pOuter, pData->pProbe);
+    if (rc == SQLITE_OK && !joinRowKey(zKey, pData->pProbe, &iKey)) {
+      executionContextRowRelease(pIterator->pContext, pData->pProbe);
+      pData->pProbe = NULL;
+      continue;
+    }
+    if (rc != SQLITE_OK) {
+      executionContextRowRelease(pIterator->pContext, pData->pProbe);
+      pData->pProbe = NULL;
+      return rc;
+    }
+    sqlite3_bind_int64(pData->pLookup, 1, iKey);
+  }
+}
+
+static int hashJoinClose(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  int i, rc = SQLITE_OK;
+  
+  hashJoinReset(pData);
+  if (pData->pLookup) sqlite3_reset(pData->pLookup);
+  for (i = 0; i < 2; i++) {
+    if (pData->abOpen[i]) {
+      int rc2 = pIterator->apChildren[i]->xClose(pIterator->apChildren[i]);
+      if (rc == SQLITE_OK) rc = rc2;
+      pData->abOpen[i] = 0;
+    }
+  }
+  pIterator->bOpened = 0;
+  return rc;
+}
+
+static void hashJoinDestroy(CypherIterator *pIterator) {
+  HashJoinData *pData = (HashJoinData*)pIterator->pIterData;
+  
+  if (pData) {
+    hashJoinReset(pData);
+    sqlite3_finalize(pData->pLookup);
+    sqlite3_free(pData->zLookupSql);
+    sqlite3_free(pData->aSlot);
+    sqlite3_free(pData->aEntry);
+    sqlite3_free(pData);
+  }
+}
+
+/*
+** One arm of an edge lookup: the far endpoints of the edges of type
+** zType (any type if NULL) whose target (bTarget) or source is ?1.
+*/
+static char *indexLoopEdgeArm(GraphVtab *pGraph, int bTarget, const char *zType,
+                              int bNoLoops) {
+  char *zTypeSql = zType ? sqlite3_mprintf(" AND edge_type=%Q", zType) : NULL;
+  char *zArm;
+  
+  if (zType && !zTypeSql) return NULL;
+  zArm = sqlite3_mprintf("SELECT %s AS x FROM \"%w\" WHERE %s=?1%s%s",
+                         bTarget ? "source" : "target", pGraph->zEdgeTableName,
+                         bTarget ? "target" : "source",
+                         zTypeSql ? zTypeSql : "",
+                         bNoLoops ? " AND source<>target" : "");
+  sqlite3_free(zTypeSql);
+  return zArm;
+}
+
+/*
+** SQL answering the inner side of an index nested loop for the join key
+** bound to ?1, or NULL if the inner plan is not a lookup shape. Sets
+** *pzAlias to the column the lookup adds, or NULL when it adds none.
+*/
+static char *indexLoopLookupSql(GraphVtab *pGraph, PhysicalPlanNode *pPlan,
+                                const char **pzAlias) {
+  PhysicalPlanNode *pInner = pPlan->apChildren[1];
+  PhysicalPlanNode *pScan;
+  const char *zKey = pPlan->zAlias;
+  char *zArms, *zMatch, *zSql;
+  
+  *pzAlias = NULL;
+  if (!zKey || !pInner->zAlias || strcmp(pInner->zAlias, zKey) != 0) return NULL;
+  
+  /* Node scan of the join variable: does the key node qualify? */
+  if (pInner->type == PHYSICAL_ALL_NODES_SCAN) {
+    return sqlite3_mprintf("SELECT 1 FROM \"%w\" WHERE id=?1", pGraph->zNodeTableName);
+  }
+  if (pInner->type == PHYSICAL_LABEL_INDEX_SCAN && pInner->zLabel) {
+    zMatch = graphLabelMatchSql(pGraph, "?1", pInner->zLabel);
+    if (!zMatch) return NULL;
+    zSql = sqlite3_mprintf("SELECT 1 WHERE %s", zMatch);
+    sqlite3_free(zMatch);
+    return zSql;
+  }
+  
+  /* Expand from a scanned node to the join variable: walk the edges
+  ** back from the key node */
+  if (pInner->type != PHYSICAL_EXPAND || (pInner->iFlags & PLAN_EXPAND_INTO) ||
+      !pInner->zFromAlias || pInner->zRelAlias || pInner->nChildren != 1) {
+    return NULL;
+  }
+  pScan = pInner->apChildren[0];
+  if (!pScan->zAlias || strcmp(pScan->zAlias, pInner->zFromAlias) != 0) return NULL;
+  if (pScan->type != PHYSICAL_ALL_NODES_SCAN &&
+      !(pScan->type == PHYSICAL_LABEL_INDEX_SCAN && pScan->zLabel)) {
+    return NULL;
+  }
+  
+  if (pInner->eDirection == GRAPH_EXPAND_BOTH) {
+    char *zOut = indexLoopEdgeArm(pGraph, 1, pInner->zLabel, 0);
+    char *zIn = indexLoopEdgeArm(pGraph, 0, pInner->zLabel, 1);
+    zArms = (zOut && zIn) ? sqlite3_mprintf("%s UNION ALL %s", zOut, zIn) : NULL;
+    sqlite3_free(zOut);
+    sqlite3_free(zIn);
+  } else {
+    zArms = indexLoopEdgeArm(pGraph, pInner->eDirection == GRAPH_EXPAND_OUT,
+                             pInner->zLabel, 0);
+  }
+  if (!zArms) return NULL;
+  
+  if (pScan->type == PHYSICAL_LABEL_INDEX_SCAN) {
+    zMatch = graphLabelMatchSql(pGraph, "x", pScan->zLabel);
+    zSql = zMatch ? sqlite3_mprintf("SELECT x FROM (%s) WHERE %s", zArms, zMatch) : NULL;
+    sqlite3_free(zMatch);
+  } else {
+    zSql = sqlite3_mprintf("SELECT x FROM (%s)", zArms);
+  }
+  sqlite3_free(zArms);
+  if (zSql) *pzAlias = pInner->zFromAlias;
+  return zSql;
+}
+
+/* Estimated rows of a child plan, unknown estimates counting as large */
+static sqlite3_int64 joinChildRows(PhysicalPlanNode *pChild) {
+  return pChild->iRows > 0 ? pChild->iRows : ((sqlite3_int64)1 << 62);
+}
+
+CypherIterator *cypherHashJoinCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator;
+  HashJoinData *pData;
+  
+  if (!pPlan || pPlan->nChildren != 2) return NULL;
+  
+  pIterator = sqlite3_malloc(sizeof(CypherIterator));
+  if (!pIterator) return NULL;
+  
+  pData = sqlite3_malloc(sizeof(HashJoinData));
+  if (!pData) {
+    sqlite3_free(pIterator);
+    return NULL;
+  }
+  
+  memset(pIterator, 0, sizeof(CypherIterator));
+  memset(pData, 0, sizeof(HashJoinData));
+  
+  /* Build on the smaller side; on a tie, the second child as planned */
+  pData->eMode = JOIN_MODE_HASH;
+  pData->iBuild = joinChildRows(pPlan->apChildren[0]) < joinChildRows(pPlan->apChildren[1]) ? 0 : 1;
+  pData->nMemory = pContext->nSortMemory > 0 ? pContext->nSortMemory : CYPHER_SORT_MEMORY;
+  pData->iMatch = -1;
+  
+  /* Set up iterator */
+  pIterator->xOpen = hashJoinOpen;
+  pIterator->xNext = hashJoinNext;
+  pIterator->xClose = hashJoinClose;
+  pIterator->xDestroy = hashJoinDestroy;
+  pIterator->pContext = pContext;
+  pIterator->pPlan = pPlan;
+  pIterator->pIterData = pData;
+  
+  return pIterator;
+}
+
+CypherIterator *cypherIndexNestedLoopCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator;
+  HashJoinData *pData;
+  
+  pIterator = cypherHashJoinCreate(pPlan, pContext);
+  if (!pIterator || !pContext->pGraph) return pIterator;
+  
+  pData = (HashJoinData*)pIterator->pIterData;
+  pData->zLookupSql = indexLoopLookupSql(pContext->pGraph, pPlan, &pData->zLookupAlias);
+  if (pData->zLookupSql) {
+    pData->eMode = JOIN_MODE_LOOKUP;
+    pIterator->xNext = indexLoopNext;
+  }
+  
+  return pIterator;
+}
+
+/*
+** Expand and variable-length expand iterator implementation.
+**
+** An expand walks the adjacency of the node bound to pPlan->zFromAlias
+** in each input row and emits the row once per edge followed, extended
+** with the node reached (pPlan->zAlias) and the edge (pPlan->zRelAlias).
+** An undirected expand reads the outgoing arm and then the incoming one,
+** which skips self-loops so that a loop is followed once. An expand into
+** a bound node keeps only the edges that reach it.
+**
+** Neighbors come from the CSR snapshot when it is current and the
+** expand is untyped and binds no relationship, since the snapshot holds
+** neither edge types nor edge ids. Otherwise each arm is a prepared
+** probe of the covering (from, type) edge index. The batch path expands
+** the live rows of a source chunk straight into the output vectors and
+** resumes mid-row when a chunk fills.
+**
+** A variable-length expand runs cypherMatchPaths() once per input row,
+** over adjacency statements prepared for the first row and kept until
+** the iterator closes, and emits one row per path, binding its last
+** node and the list of its edges.
+*/
+
+typedef struct ExpandData {
+  CypherIterator *pSource;      /* Source iterator, if created here */
+  
+  /* Adjacency cursor over the node being expanded */
+  sqlite3_stmt *apStmt[2];      /* Index probe per arm */
+  int nArm;                     /* Arms: 2 for an undirected expand */
+  CSRView view;                 /* Snapshot the arms read, view.pCSR NULL if none */
+  int iArm;                     /* Arm being read */
+  int iDense;                   /* CSR index of the node expanded */
+  CSREdgeIter it;               /* CSR cursor within the arm */
+  sqlite3_int64 iFrom;          /* Node being expanded */
+  sqlite3_int64 iTo;            /* Into: node an edge must reach */
+  int bActive;                  /* Input row being expanded */
+  int bDone;                    /* Source exhausted */
+  
+  /* Row path */
+  CypherResult *pRow;           /* Input row being expanded */
+  PathResult *pPaths;           /* Var-length: paths of pRow */
+  PathResult *pPath;            /* Next path to emit */
+  PathStmts pathStmts;          /* Var-length: adjacency statements */
+  
+  /* Batch path */
+  CypherDataChunk *pInput;      /* Source chunk */
+  int iInput;                   /* Next live row of pInput */
+  int iInputRow;                /* Physical row being expanded */
+} ExpandData;
+
+/* Arm iArm follows incoming edges */
+static int expandArmIn(PhysicalPlanNode *pPlan, int iArm) {
+  return pPlan->eDirection == GRAPH_EXPAND_IN || iArm > 0;
+}
+
+/* Point the CSR cursor at arm pData->iArm of the node expanded */
+static void expandCsrArm(PhysicalPlanNode *pPlan, ExpandData *pData) {
+  int iNode = pData->iArm < pData->nArm ? pData->iDense : -1;
+  
+  graphCSREdgeFirst(&pData->view, iNode, expandArmIn(pPlan, pData->iArm), &pData->it);
+}
+
+/* Start reading the adjacency of iFrom, restricted to iTo when into */
+static void expandStart(CypherIterator *pIterator, sqlite3_int64 iFrom, sqlite3_int64 iTo) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  int i;
+  
+  pData->iFrom = iFrom;
+  pData->iTo = iTo;
+  pData->iArm = 0;
+  pData->bActive = 1;
+  if (pData->view.pCSR) {
+    pData->iDense = graphCSRViewIndexOf(&pData->view, iFrom);
+    expandCsrArm(pIterator->pPlan, pData);
+    pIterator->pContext->counters.nCacheHit++;
+    return;
+  }
+  pIterator->pContext->counters.nCacheMiss++;
+  for (i = 0; i < pData->nArm && pData->apStmt[i]; i++) {
+    sqlite3_reset(pData->apStmt[i]);
+    sqlite3_bind_int64(pData->apStmt[i], 1, iFrom);
+    if (pIterator->pPlan->iFlags & PLAN_EXPAND_INTO) {
+      sqlite3_bind_int64(pData->apStmt[i], 3, iTo);
+    }
+  }
+}
+
+/*
+** Next edge of the node being expanded: the node reached in *piNode and
+** the edge id in *piEdge (0 when read from the snapshot). Returns
+** SQLITE_ROW, SQLITE_DONE once every arm is read, or an error.
+*/
+static int expandStep(CypherIterator *pIterator, sqlite3_int64 *piNode, sqlite3_int64 *piEdge) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  int bInto = (pPlan->iFlags & PLAN_EXPAND_INTO) != 0;
+  int rc;
+  
+  while (pData->iArm < pData->nArm) {
+    if (pData->view.pCSR) {
+      int bIn = expandArmIn(pPlan, pData->iArm);
+      int iNbr;
+      
+      if (!graphCSREdgeNext(&pData->it, &iNbr, NULL)) {
+        pData->iArm++;
+        expandCsrArm(pPlan, pData);
+        continue;
+      }
+      if (bIn && pData->iArm > 0 && iNbr == pData->iDense) continue;
+      *piNode = graphCSRViewNodeId(&pData->view, iNbr);
+      *piEdge = 0;
+      if (bInto && *piNode != pData->iTo) continue;
+      return SQLITE_ROW;
+    }
+    
+    rc = CYPHER_STEP(pIterator->pContext, pData->apStmt[pData->iArm]);
+    if (rc == SQLITE_ROW) {
+      *piNode = sqlite3_column_int64(pData->apStmt[pData->iArm], 0);
+      *piEdge = sqlite3_column_int64(pData->apStmt[pData->iArm], 1);
+      return SQLITE_ROW;
+    }
+    if (rc != SQLITE_DONE) return rc;
+    pData->iArm++;
+  }
+  pData->bActive = 0;
+  return SQLITE_DONE;
+}
+
+/*
+** Begin expanding input row pRow. Returns 0 if the row has no node
+** bound to the start variable, or none to the end variable when into.
+*/
+static int expandRowStart(CypherIterator *pIterator, CypherResult *pRow) {
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  sqlite3_int64 iTo = -1;
+  int iCol;
+  
+  iCol = joinColumn(pRow, pPlan->zFromAlias);
+  if (iCol < 0 || pRow->aValues[iCol].type != CYPHER_VALUE_NODE) return 0;
+  if (pPlan->iFlags & PLAN_EXPAND_INTO) {
+    int iToCol = pPlan->zAlias ? joinColumn(pRow, pPlan->zAlias) : -1;
+    if (iToCol < 0 || pRow->aValues[iToCol].type != CYPHER_VALUE_NODE) return 0;
+    iTo = pRow->aValues[iToCol].u.iNodeId;
+  }
+  expandStart(pIterator, pRow->aValues[iCol].u.iNodeId, iTo);
+  return 1;
+}
+
+/* Prepare the index probe of each arm: ?1 start, ?2 type, ?3 into */
+static int expandPrepare(CypherIterator *pIterator) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  GraphVtab *pGraph = pIterator->pContext->pGraph;
+  int bInto = (pPlan->iFlags & PLAN_EXPAND_INTO) != 0;
+  int i, rc = SQLITE_OK;
+  
+  for (i = 0; i < pData->nArm && rc == SQLITE_OK; i++) {
+    int bIn = expandArmIn(pPlan, i);
+    const char *zFar = bIn ? "source" : "target";
+    char *zSql;
+    
+    zSql = sqlite3_mprintf("SELECT %s, id FROM \"%w\" WHERE %s=?1%s%s%s",
+                           zFar, pGraph->zEdgeTableName, bIn ? "target" : "source",
+                           pPlan->zLabel ? " AND edge_type=?2" : "",
+                           bInto ? (bIn ? " AND source=?3" : " AND target=?3") : "",
+                           i > 0 ? " AND source<>target" : "");
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pData->apStmt[i], 0);
+    sqlite3_free(zSql);
+    if (rc == SQLITE_OK && pPlan->zLabel) {
+      rc = sqlite3_bind_text(pData->apStmt[i], 2, pPlan->zLabel, -1, SQLITE_STATIC);
+    }
+  }
+  return rc;
+}
+
+static int expandOpen(CypherIterator *pIterator) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  GraphVtab *pGraph = pIterator->pContext->pGraph;
+  int rc = SQLITE_OK;
+  
+  if (!pSource || !pGraph) return SQLITE_ERROR;
+  
+  pData->bActive = 0;
+  pData->bDone = 0;
+  pData->iInput = 0;
+  cypherChunkReset(pData->pInput);
+  if (pPlan->type == PHYSICAL_EXPAND && !pData->apStmt[0] && !pData->view.pCSR) {
+    if (!pPlan->zLabel && !pPlan->zRelAlias && graphCSRIsCurrent(pGraph)) {
+      rc = graphCSRViewOpen(pGraph, &pData->view);
+    } else {
+      rc = expandPrepare(pIterator);
+    }
+  }
+  if (rc == SQLITE_OK) rc = pSource->xOpen(pSource);
+  if (rc == SQLITE_OK) pIterator->bOpened = 1;
+  return rc;
+}
+
+/* Output row: the input row, the node reached and the edge followed */
+static int expandEmit(CypherIterator *pIterator, CypherResult *pResult,
+                      sqlite3_int64 iNode, CypherValue *pRel) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherValue node;
+  int rc;
+  
+  rc = joinEmit(pResult, pData->pRow, NULL);
+  if (rc == SQLITE_OK && pPlan->zAlias && !(pPlan->iFlags & PLAN_EXPAND_INTO)) {
+    memset(&node, 0, sizeof(node));
+    cypherValueSetNode(&node, iNode);
+    rc = cypherResultAddColumnShared(pResult, pPlan->zAlias, &node);
+  }
+  if (rc == SQLITE_OK && pPlan->zRelAlias) {
+    rc = cypherResultAddColumnShared(pResult, pPlan->zRelAlias, pRel);
+  }
+  if (rc == SQLITE_OK) pIterator->nRowsProduced++;
+  return rc;
+}
+
+static int expandNext(CypherIterator *pIterator, CypherResult *pResult) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  sqlite3_int64 iNode, iEdge;
+  CypherValue rel;
+  int rc;
+  
+  for (;;) {
+    if (!pData->bActive) {
+      cypherResultClear(pData->pRow);
+      rc = pSource->xNext(pSource, pData->pRow);
+      if (rc != SQLITE_OK) return rc;
+      if (!expandRowStart(pIterator, pData->pRow)) continue;
+    }
+    rc = expandStep(pIterator, &iNode, &iEdge);
+    if (rc == SQLITE_DONE) continue;
+    if (rc != SQLITE_ROW) return rc;
+    
+    memset(&rel, 0, sizeof(rel));
+    cypherValueSetRelationship(&rel, iEdge);
+    return expandEmit(pIterator, pResult, iNode, &rel);
+  }
+}
+
+/*
+** Copy input row iRow into output row iDst, whose first columns mirror
+** the input's. On OOM the columns copied so far are released.
+*/
+static int expandCopyRow(CypherDataChunk *pOut, int iDst, CypherDataChunk *pIn, int iRow) {
+  int i;
+  
+  for (i = 0; i < pIn->nCol; i++) {
+    CypherVector *pSrc = &pIn->aCol[i];
+    
+    if (pSrc->eType == CYPHER_VECTOR_NODE) {
+      pOut->aCol[i].aId[iDst] = pSrc->aId[iRow];
+      continue;
+    }
+    if (cypherValueCopyIn(0, &pOut->aCol[i].aValue[iDst], &pSrc->aValue[iRow])) {
+      while (--i >= 0) {
+        if (pOut->aCol[i].eType == CYPHER_VECTOR_VALUE) {
+          cypherValueDestroy(&pOut->aCol[i].aValue[iDst]);
+          memset(&pOut->aCol[i].aValue[iDst], 0, sizeof(CypherValue));
+        }
+      }
+      return SQLITE_NOMEM;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Begin expanding live row i of the input chunk. Returns 0 if it binds
+** no start node, or no end node when into.
+*/
+static int expandChunkStart(CypherIterator *pIterator, int i) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherDataChunk *pIn = pData->pInput;
+  sqlite3_int64 iTo = -1;
+  const CypherValue *pValue;
+  CypherValue tmp;
+  int iRow = cypherChunkRow(pIn, i);
+  int iCol, iToCol = -1;
+  
+  for (iCol = pIn->nCol - 1; iCol >= 0; iCol--) {
+    if (strcmp(pIn->aCol[iCol].zName, pPlan->zFromAlias) == 0) break;
+  }
+  if (iCol < 0) return 0;
+  if (pPlan->iFlags & PLAN_EXPAND_INTO) {
+    for (iToCol = pIn->nCol - 1; iToCol >= 0 && pPlan->zAlias; iToCol--) {
+      if (strcmp(pIn->aCol[iToCol].zName, pPlan->zAlias) == 0) break;
+    }
+    if (iToCol < 0 || !pPlan->zAlias) return 0;
+    pValue = cypherChunkValue(pIn, iToCol, iRow, &tmp);
+    if (pValue->type != CYPHER_VALUE_NODE) return 0;
+    iTo = pValue->u.iNodeId;
+  }
+  pValue = cypherChunkValue(pIn, iCol, iRow, &tmp);
+  if (pValue->type != CYPHER_VALUE_NODE) return 0;
+  
+  pData->iInputRow = iRow;
+  expandStart(pIterator, pValue->u.iNodeId, iTo);
+  return 1;
+}
+
+/* Output columns: those of the input, then the node and the edge */
+static int expandChunkColumns(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherDataChunk *pIn = pData->pInput;
+  int i;
+  
+  if (pChunk->nCol > 0) return SQLITE_OK;
+  for (i = 0; i < pIn->nCol; i++) {
+    if (cypherChunkAddColumn(pChunk, pIn->aCol[i].zName, pIn->aCol[i].eType) < 0) {
+      return SQLITE_NOMEM;
+    }
+  }
+  if (pPlan->zAlias && !(pPlan->iFlags & PLAN_EXPAND_INTO) &&
+      cypherChunkAddColumn(pChunk, pPlan->zAlias, CYPHER_VECTOR_NODE) < 0) {
+    return SQLITE_NOMEM;
+  }
+  if (pPlan->zRelAlias &&
+      cypherChunkAddColumn(pChunk, pPlan->zRelAlias, CYPHER_VECTOR_VALUE) < 0) {
+    return SQLITE_NOMEM;
+  }
+  return SQLITE_OK;
+}
+
+static int expandNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  CypherDataChunk *pIn = pData->pInput;
+  sqlite3_int64 iNode, iEdge;
+  int rc = SQLITE_OK;
+  int n = 0;
+  
+  cypherChunkReset(pChunk);
+  while (n < CYPHER_CHUNK_SIZE) {
+    int iCol;
+    
+    if (!pData->bActive) {
+      if (pData->iInput >= pIn->nSel) {
+        if (pData->bDone) break;
+        rc = cypherIteratorNextBatch(pSource, pIn);
+        if (rc == SQLITE_DONE) {
+          pData->bDone = 1;
+          rc = SQLITE_OK;
+          break;
+        }
+        if (rc == SQLITE_OK) rc = expandChunkColumns(pIterator, pChunk);
+        if (rc != SQLITE_OK) break;
+        pData->iInput = 0;
+        continue;
+      }
+      if (!expandChunkStart(pIterator, pData->iInput++)) continue;
+    }
+    
+    rc = expandStep(pIterator, &iNode, &iEdge);
+    if (rc == SQLITE_DONE) {
+      rc = SQLITE_OK;
+      continue;
+    }
+    if (rc != SQLITE_ROW) break;
+    rc = expandCopyRow(pChunk, n, pIn, pData->iInputRow);
+    if (rc != SQLITE_OK) break;
+    
+    iCol = pIn->nCol;
+    if (pPlan->zAlias && !(pPlan->iFlags & PLAN_EXPAND_INTO)) {
+      pChunk->aCol[iCol++].aId[n] = iNode;
+    }
+    if (pPlan->zRelAlias) {
+      cypherValueSetRelationship(&pChunk->aCol[iCol].aValue[n], iEdge);
+    }
+    n++;
+  }
+  
+  pChunk->nRow = pChunk->nSel = n;
+  pIterator->nRowsProduced += n;
+  if (rc != SQLITE_OK) return rc;
+  return n > 0 ? SQLITE_OK : SQLITE_DONE;
+}
+
+static int expandClose(CypherIterator *pIterator) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  int i;
+  
+  for (i = 0; i < 2; i++) {
+    sqlite3_finalize(pData->apStmt[i]);
+    pData->apStmt[i] = NULL;
+  }
+  graphCSRViewClose(&pData->view);
+  cypherPathStmtsFinalize(&pData->pathStmts);
+  pData->bActive = 0;
+  cypherPathResultsFreeAll(pData->pPaths);
+  pData->pPaths = pData->pPath = NULL;
+  pIterator->bOpened = 0;
+  return pSource ? pSource->xClose(pSource) : SQLITE_OK;
+}
+
+static void expandDestroy(CypherIterator *pIterator) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  
+  if (pData) {
+    graphCSRViewClose(&pData->view);
+    cypherPathStmtsFinalize(&pData->pathStmts);
+    cypherIteratorDestroy(pData->pSource);
+    cypherResultDestroy(pData->pRow);
+    cypherChunkFree(pData->pInput);
+    sqlite3_free(pData);
+  }
+}
+
+/* Iterator and state shared by both expands */
+static CypherIterator *expandCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator;
+  ExpandData *pData;
+  
+  if (!pPlan || !pPlan->zFromAlias || (!pPlan->pChild && pPlan->nChildren == 0)) return NULL;
+  
+  pIterator = sqlite3_malloc(sizeof(CypherIterator));
+  if (!pIterator) return NULL;
+  
+  pData = sqlite3_malloc(sizeof(ExpandData));
+  if (!pData) {
+    sqlite3_free(pIterator);
+    return NULL;
+  }
+  
+  memset(pIterator, 0, sizeof(CypherIterator));
+  memset(pData, 0, sizeof(ExpandData));
+  pIterator->pIterData = pData;
+  pData->nArm = pPlan->eDirection == GRAPH_EXPAND_BOTH ? 2 : 1;
+  pData->pRow = executionContextRowAcquire(pContext);
+  if (!pData->pRow || cypherChunkCreate(&pData->pInput) != SQLITE_OK) {
+    expandDestroy(pIterator);
+    sqlite3_free(pIterator);
+    return NULL;
+  }
+  
+  /* Create source iterator */
+  if (pPlan->pChild) {
+    pData->pSource = cypherIteratorCreate(pPlan->pChild, pContext);
+    if (!pData->pSource) {
+      expandDestroy(pIterator);
+      sqlite3_free(pIterator);
+      return NULL;
+    }
+  }
+  
+  pIterator->xOpen = expandOpen;
+  pIterator->xClose = expandClose;
+  pIterator->xDestroy = expandDestroy;
+  pIterator->pContext = pContext;
+  pIterator->pPlan = pPlan;
+  
+  return pIterator;
+}
+
+CypherIterator *cypherExpandCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator = expandCreate(pPlan, pContext);
+  
+  if (pIterator) {
+    pIterator->xNext = expandNext;
+    pIterator->xNextBatch = expandNextBatch;
+  }
+  return pIterator;
+}
+
+/* Bind the edges of pPath as a list of relationships */
+static int varLengthRelList(PathResult *pPath, CypherValue *pList) {
+  CypherValue *aRel = NULL;
+  int i;
+  
+  if (pPath->pathLength > 0) {
+    aRel = sqlite3_malloc(pPath->pathLength * sizeof(CypherValue));
+    if (!aRel) return SQLITE_NOMEM;
+    memset(aRel, 0, pPath->pathLength * sizeof(CypherValue));
+    for (i = 0; i < pPath->pathLength; i++) {
+      cypherValueSetRelationship(&aRel[i], pPath->edgeIds[i]);
+    }
+  }
+  cypherValueSetList(pList, aRel, pPath->pathLength);
+  return SQLITE_OK;
+}
+
+static int varLengthExpandNext(CypherIterator *pIterator, CypherResult *pResult) {
+  ExpandData *pData = (ExpandData*)pIterator->pIterData;
+  PhysicalPlanNode *pPlan = pIterator->pPlan;
+  CypherIterator *pSource = iteratorSource(pIterator, pData->pSource);
+  PathBounds bounds;
+  PathResult *pPath;
+  CypherValue rels;
+  int rc;
+  
+  bounds.minLength = pPlan->nMinHops;
+  bounds.maxLength = pPlan->nMaxHops;
+  bounds.isOptional = pPlan->nMinHops == 0;
+  
+  while (!pData->pPath) {
+    cypherPathResultsFreeAll(pData->pPaths);
+    pData->pPaths = NULL;
+    cypherResultClear(pData->pRow);
+    rc = pSource->xNext(pSource, pData->pRow);
+    if (rc != SQLITE_OK) return rc;
+    if (!expandRowStart(pIterator, pData->pRow)) continue;
+    pData->bActive = 0;
+    
+    rc = cypherMatchPaths(pIterator->pContext->pGraph, pData->iFrom,
+                          (pPlan->iFlags & PLAN_EXPAND_INTO) ? pData->iTo : -1,
+                          pPlan->zLabel, pPlan->eDirection, bounds, &pData->pathStmts,
+                          &pData->pPaths, &pIterator->pContext->counters.nStep);
+    if (rc != SQLITE_OK) return rc;
+    pData->pPath = pData->pPaths;
+  }
+  
+  pPath = pData->pPath;
+  pData->pPath = pPath->pNext;
+  memset(&rels, 0, sizeof(rels));
+  rc = varLengthRelList(pPath, &rels);
+  if (rc == SQLITE_OK) {
+    rc = expandEmit(pIterator, pResult, pPath->nodeIds[pPath->pathLength], &rels);
+  }
+  cypherValueDestroy(&rels);
+  return rc;
+}
+
+CypherIterator *cypherVarLengthExpandCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+  CypherIterator *pIterator = expandCreate(pPlan, pContext);
+  
+  if (pIterator) pIterator->xNext = varLengthExpandNext;
+  return pIterator;
+}
@@ -27,6 +27,7 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 
 /*
 ** Parse JSON properties string and populate a CypherValue map.
@@ -423,4 +424,377 @@ char *cypherValueToJson(const CypherValue *pValue) {
         default:
             return sqlite3_mprintf("null");
     }
-}
\ No newline at end of file
+}
+/*
+** Streaming JSON writer for result rows.
+**
+** Rows are appended to one growing buffer in a single pass: integers
+** and %.6g floats are formatted by hand, strings are copied a 16-byte
+** block at a time until one holds a byte that needs escaping, and each
+** column's '{"name":' or ',"name":' prefix is built once and reused
+** while rows keep the same column names. Values print as in
+** cypherValueToString(), except that strings are escaped.
+*/
+
+#if !defined(GRAPH_NO_SIMD) && defined(__SSE2__)
+# define CYPHER_JSON_SSE2 1
+# include <emmintrin.h>
+#endif
+
+/*
+** Make room for n more bytes. Returns 0 if the writer is out of memory.
+*/
+static int jsonWriterReserve(CypherJsonWriter *pWriter, sqlite3_int64 n) {
+    sqlite3_int64 nNew;
+    char *zNew;
+
+    if( pWriter->bOom ) return 0;
+    if( pWriter->n + n <= pWriter->nAlloc ) return 1;
+    nNew = pWriter->nAlloc ? pWriter->nAlloc : 256;
+    while( nNew < pWriter->n + n ) nNew *= 2;
+    zNew = sqlite3_realloc64(pWriter->z, nNew);
+    if( !zNew ) {
+        pWriter->bOom = 1;
+        return 0;
+    }
+    pWriter->z = zNew;
+    pWriter->nAlloc = nNew;
+    return 1;
+}
+
+void cypherJsonWriterInit(CypherJsonWriter *pWriter) {
+    memset(pWriter, 0, sizeof(*pWriter));
+}
+
+/*
+** Free the buffer and the column prefixes.
+*/
+void cypherJsonWriterReset(CypherJsonWriter *pWriter) {
+    int i;
+    for( i = 0; i < pWriter->nPrefix; i++ ) {
+        sqlite3_free(pWriter->aPrefix[i].zName);
+        sqlite3_free(pWriter->aPrefix[i].zPrefix);
+    }
+    sqlite3_free(pWriter->aPrefix);
+    sqlite3_free(pWriter->z);
+    cypherJsonWriterInit(pWriter);
+}
+
+/*
+** Take the NUL-terminated output, leaving the writer empty but keeping
+** its column prefixes. Returns NULL if any append ran out of memory.
+*/
+char *cypherJsonWriterFinish(CypherJsonWriter *pWriter) {
+    char *z = NULL;
+    if( jsonWriterReserve(pWriter, 1) ) {
+        pWriter->z[pWriter->n] = '\0';
+        z = pWriter->z;
+    } else {
+        sqlite3_free(pWriter->z);
+    }
+    pWriter->z = NULL;
+    pWriter->n = pWriter->nAlloc = 0;
+    pWriter->bOom = 0;
+    return z;
+}
+
+void cypherJsonAppend(CypherJsonWriter *pWriter, const char *z, int n) {
+    if( jsonWriterReserve(pWriter, n) ) {
+        memcpy(&pWriter->z[pWriter->n], z, n);
+        pWriter->n += n;
+    }
+}
+
+/* Characters written as a two-character escape; 'u' means \u00XX */
+static const char jsonEscapeChar[32] = {
+    'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u'
+};
+
+/*
+** Append z[0..n) with quotes and backslashes escaped and control
+** characters as \b, \t, \n, \f, \r or \u00XX, not quoted. Worst case
+** every byte takes six.
+*/
+static void jsonAppendEscaped(CypherJsonWriter *pWriter, const char *z,
+                              sqlite3_int64 n) {
+    static const char zHex[] = "0123456789abcdef";
+    char *zOut;
+    sqlite3_int64 i = 0;
+
+    if( !jsonWriterReserve(pWriter, n*6) ) return;
+    zOut = &pWriter->z[pWriter->n];
+    while( i < n ) {
+        unsigned char c;
+#ifdef CYPHER_JSON_SSE2
+        const __m128i vQuote = _mm_set1_epi8('"');
+        const __m128i vBackslash = _mm_set1_epi8('\\');
+        const __m128i vCtrl = _mm_set1_epi8(0x1F);
+        /* Copy clean 16-byte blocks; stop at the first that needs work */
+        while( i + 16 <= n ) {
+            __m128i v = _mm_loadu_si128((const __m128i*)&z[i]);
+            __m128i vHit = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, vQuote),
+                             _mm_cmpeq_epi8(v, vBackslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(v, vCtrl), vCtrl));
+            int mHit = _mm_movemask_epi8(vHit);
+            if( mHit ) {
+                int nClean = __builtin_ctz(mHit);
+                memcpy(zOut, &z[i], nClean);
+                zOut += nClean;
+                i += nClean;
+                break;
+            }
+            _mm_storeu_si128((__m128i*)zOut, v);
+            zOut += 16;
+            i += 16;
+        }
+        if( i >= n ) break;
+#endif
+        c = (unsigned char)z[i++];
+        if( c == '"' || c == '\\' ) {
+            *zOut++ = '\\';
+            *zOut++ = (char)c;
+        } else if( c < 0x20 ) {
+            *zOut++ = '\\';
+            *zOut++ = jsonEscapeChar[c];
+            if( jsonEscapeChar[c] == 'u' ) {
+                *zOut++ = '0';
+                *zOut++ = '0';
+                *zOut++ = zHex[c >> 4];
+                *zOut++ = zHex[c & 0xF];
+            }
+        } else {
+            *zOut++ = (char)c;
+        }
+    }
+    pWriter->n = zOut - pWriter->z;
+}
+
+void cypherJsonAppendString(CypherJsonWriter *pWriter, const char *z, int n) {
+    cypherJsonAppend(pWriter, "\"", 1);
+    jsonAppendEscaped(pWriter, z, n);
+    cypherJsonAppend(pWriter, "\"", 1);
+}
+
+/*
+** Write the decimal digits of i to zBuf, which has room for 20 bytes.
+** Returns the length.
+*/
+static int jsonFormatInt(sqlite3_int64 i, char *zBuf) {
+    char aDigit[20];
+    sqlite3_uint64 u = i < 0 ? (sqlite3_uint64)0 - (sqlite3_uint64)i
+                             : (sqlite3_uint64)i;
+    int n = 0, nOut = 0;
+
+    do {
+        aDigit[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while( u );
+    if( i < 0 ) zBuf[nOut++] = '-';
+    while( n > 0 ) zBuf[nOut++] = aDigit[--n];
+    return nOut;
+}
+
+/*
+** Format r as printf("%.6g") would into zBuf (32 bytes). The six
+** significant digits come from one scaling by an exact power of ten;
+** when the scaled value is within rounding noise of a tie, or the
+** power is not exact, fall back to snprintf().
+*/
+static int jsonFormatDouble(double r, char *zBuf) {
+    static const double aPow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    char aDigit[6];
+    double a = r < 0.0 ? -r : r;
+    double rScaled, rFrac;
+    sqlite3_int64 m;
+    int e, nDigit, nOut = 0;
+    int i;
+
+    if( a == 0.0 && !signbit(r) ) {
+        zBuf[0] = '0';
+        return 1;
+    }
+    if( !(a >= 1e-15 && a < 1e20) ) {
+        return snprintf(zBuf, 32, "%.6g", r);
+    }
+
+    /* Decimal exponent, then m = a * 10^(5-e) rounded: six digits */
+    e = (int)floor(log10(a));
+    for( ;; ) {
+        rScaled = (5 - e >= 0) ? a * aPow10[5 - e] : a / aPow10[e - 5];
+        if( rScaled > 999999.5 + 1e-7 ) { e++; continue; }
+        if( rScaled < 99999.5 - 1e-7 ) { e--; continue; }
+        break;
+    }
+    rFrac = rScaled - floor(rScaled);
+    if( rFrac > 0.5 - 1e-7 && rFrac < 0.5 + 1e-7 ) {
+        return snprintf(zBuf, 32, "%.6g", r);
+    }
+    m = (sqlite3_int64)(rScaled + 0.5);
+    if( m == 1000000 ) {
+        /* Just above 999999.5: rounds up to the next decade */
+        m = 100000;
+        e++;
+    } else if( m < 100000 ) {
+        return snprintf(zBuf, 32, "%.6g", r);
+    }
+    for( i = 5; i >= 0; i-- ) {
+        aDigit[i] = (char)('0' + m % 10);
+        m /= 10;
+    }
+    nDigit = 6;
+    while( nDigit > 1 && aDigit[nDigit - 1] == '0' ) nDigit--;
+
+    if( r < 0.0 ) zBuf[nOut++] = '-';
+    if( e < -4 || e >= 6 ) {
+        /* d.ddddde+XX */
+        zBuf[nOut++] = aDigit[0];
+        if( nDigit > 1 ) {
+            zBuf[nOut++] = '.';
+            for( i = 1; i < nDigit; i++ ) zBuf[nOut++] = aDigit[i];
+        }
+        zBuf[nOut++] = 'e';
+        zBuf[nOut++] = e < 0 ? '-' : '+';
+        if( e < 0 ) e = -e;
+        if( e >= 100 ) zBuf[nOut++] = (char)('0' + e / 100);
+        zBuf[nOut++] = (char)('0' + e / 10 % 10);
+        zBuf[nOut++] = (char)('0' + e % 10);
+    } else if( e >= 0 ) {
+        for( i = 0; i <= e; i++ ) zBuf[nOut++] = aDigit[i];
+        if( nDigit > e + 1 ) {
+            zBuf[nOut++] = '.';
+            for( i = e + 1; i < nDigit; i++ ) zBuf[nOut++] = aDigit[i];
+        }
+    } else {
+        zBuf[nOut++] = '0';
+        zBuf[nOut++] = '.';
+        for( i = e + 1; i < 0; i++ ) zBuf[nOut++] = '0';
+        for( i = 0; i < nDigit; i++ ) zBuf[nOut++] = aDigit[i];
+    }
+    return nOut;
+}
+
+/*
+** Append one value in the representation of cypherValueToString(),
+** with strings escaped.
+*/
+static void jsonAppendValue(CypherJsonWriter *pWriter,
+                            const CypherValue *pValue) {
+    char zBuf[64];
+    int n;
+
+    switch( pValue->type ) {
+        case CYPHER_VALUE_NULL:
+            cypherJsonAppend(pWriter, "null", 4);
+            return;
+        case CYPHER_VALUE_BOOLEAN:
+            if( pValue->u.bBoolean ) cypherJsonAppend(pWriter, "true", 4);
+            else cypherJsonAppend(pWriter, "false", 5);
+            return;
+        case CYPHER_VALUE_INTEGER:
+            n = jsonFormatInt(pValue->u.iInteger, zBuf);
+            break;
+        case CYPHER_VALUE_FLOAT:
+            n = jsonFormatDouble(pValue->u.rFloat, zBuf);
+            break;
+        case CYPHER_VALUE_STRING: {
+            const char *z = pValue->u.zString ? pValue->u.zString : "";
+            cypherJsonAppendString(pWriter, z, (int)strlen(z));
+            return;
+        }
+        case CYPHER_VALUE_NODE:
+            memcpy(zBuf, "Node(", 5);
+            n = 5 + jsonFormatInt(pValue->u.iNodeId, &zBuf[5]);
+            zBuf[n++] = ')';
+            break;
+        case CYPHER_VALUE_RELATIONSHIP:
+            memcpy(zBuf, "Relationship(", 13);
+            n = 13 + jsonFormatInt(pValue->u.iRelId, &zBuf[13]);
+            zBuf[n++] = ')';
+            break;
+        default: {
+            /* Lists, maps and paths keep their summary form */
+            char *z = cypherValueToString((CypherValue*)pValue);
+            if( !z ) {
+                pWriter->bOom = 1;
+                return;
+            }
+            cypherJsonAppend(pWriter, z, (int)strlen(z));
+            sqlite3_free(z);
+            return;
+        }
+    }
+    cypherJsonAppend(pWriter, zBuf, n);
+}
+
+/*
+** Return the prefix of column iCol named zName, rebuilding it if the
+** cached one is for another name. NULL on OOM.
+*/
+static const CypherJsonPrefix *jsonColumnPrefix(CypherJsonWriter *pWriter,
+                                                int iCol, const char *zName) {
+    CypherJsonPrefix *pPrefix;
+    CypherJsonWriter tmp;
+
+    if( !zName ) zName = "";
+    if( iCol >= pWriter->nPrefix ) {
+        CypherJsonPrefix *aNew = sqlite3_realloc64(pWriter->aPrefix,
+                                     sizeof(CypherJsonPrefix) * (iCol + 1));
+        if( !aNew ) return NULL;
+        memset(&aNew[pWriter->nPrefix], 0,
+               sizeof(CypherJsonPrefix) * (iCol + 1 - pWriter->nPrefix));
+        pWriter->aPrefix = aNew;
+        pWriter->nPrefix = iCol + 1;
+    }
+    pPrefix = &pWriter->aPrefix[iCol];
+    if( pPrefix->zPrefix && (pPrefix->zName == zName ||
+                             strcmp(pPrefix->zName, zName) == 0) ) {
+        return pPrefix;
+    }
+
+    sqlite3_free(pPrefix->zName);
+    sqlite3_free(pPrefix->zPrefix);
+    memset(pPrefix, 0, sizeof(*pPrefix));
+    cypherJsonWriterInit(&tmp);
+    cypherJsonAppend(&tmp, iCol ? ",\"" : "{\"", 2);
+    jsonAppendEscaped(&tmp, zName, (sqlite3_int64)strlen(zName));
+    cypherJsonAppend(&tmp, "\":", 2);
+    pPrefix->nPrefix = (int)tmp.n;
+    pPrefix->zPrefix = cypherJsonWriterFinish(&tmp);
+    pPrefix->zName = sqlite3_mprintf("%s", zName);
+    if( !pPrefix->zPrefix || !pPrefix->zName ) {
+        sqlite3_free(pPrefix->zName);
+        sqlite3_free(pPrefix->zPrefix);
+        memset(pPrefix, 0, sizeof(*pPrefix));
+        return NULL;
+    }
+    return pPrefix;
+}
+
+/*
+** Append pResult as a JSON object.
+*/
+void cypherJsonAppendRow(CypherJsonWriter *pWriter,
+                         const CypherResult *pResult) {
+    int i;
+
+    if( pResult->nColumns == 0 ) {
+        cypherJsonAppend(pWriter, "{}", 2);
+        return;
+    }
+    for( i = 0; i < pResult->nColumns; i++ ) {
+        const CypherJsonPrefix *pPrefix =
+            jsonColumnPrefix(pWriter, i, pResult->azColumnNames[i]);
+        if( !pPrefix ) {
+            pWriter->bOom = 1;
+            return;
+        }
+        cypherJsonAppend(pWriter, pPrefix->zPrefix, pPrefix->nPrefix);
+        jsonAppendValue(pWriter, &pResult->aValues[i]);
+    }
+    cypherJsonAppend(pWriter, "}", 1);
+}
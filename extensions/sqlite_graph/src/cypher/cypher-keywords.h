@@ -0,0 +1,80 @@
+/*
+** cypher-keywords.h - Perfect hash of the Cypher keywords
+**
+** Generated by scripts/gen_cypher_keywords.py; do not edit.
+** Included by cypher-lexer.c only.
+*/
+#define CYPHER_KW_MIN_LEN 2
+#define CYPHER_KW_MAX_LEN 8
+#define CYPHER_KW_HASH(c0, cN, n) (((c0)*49 + (cN)*59 + (n)) & 63)
+
+static const struct {
+    char zName[9];           /* Upper case */
+    unsigned char nName;     /* 0 for an empty slot */
+    unsigned char eToken;    /* CypherTokenType */
+} aCypherKeyword[64] = {
+    /*  0 */ { "CREATE", 6, CYPHER_TOK_CREATE },
+    /*  1 */ { "XOR", 3, CYPHER_TOK_XOR },
+    /*  2 */ { "SET", 3, CYPHER_TOK_SET },
+    /*  3 */ { "WITH", 4, CYPHER_TOK_WITH },
+    /*  4 */ { "UNION", 5, CYPHER_TOK_UNION },
+    /*  5 */ { "", 0, 0 },
+    /*  6 */ { "", 0, 0 },
+    /*  7 */ { "OR", 2, CYPHER_TOK_OR },
+    /*  8 */ { "", 0, 0 },
+    /*  9 */ { "", 0, 0 },
+    /* 10 */ { "ORDER", 5, CYPHER_TOK_ORDER },
+    /* 11 */ { "", 0, 0 },
+    /* 12 */ { "", 0, 0 },
+    /* 13 */ { "NOT", 3, CYPHER_TOK_NOT },
+    /* 14 */ { "", 0, 0 },
+    /* 15 */ { "", 0, 0 },
+    /* 16 */ { "", 0, 0 },
+    /* 17 */ { "", 0, 0 },
+    /* 18 */ { "FALSE", 5, CYPHER_TOK_BOOLEAN },
+    /* 19 */ { "WHERE", 5, CYPHER_TOK_WHERE },
+    /* 20 */ { "AS", 2, CYPHER_TOK_AS },
+    /* 21 */ { "", 0, 0 },
+    /* 22 */ { "", 0, 0 },
+    /* 23 */ { "SKIP", 4, CYPHER_TOK_SKIP },
+    /* 24 */ { "", 0, 0 },
+    /* 25 */ { "", 0, 0 },
+    /* 26 */ { "MATCH", 5, CYPHER_TOK_MATCH },
+    /* 27 */ { "", 0, 0 },
+    /* 28 */ { "IS", 2, CYPHER_TOK_IS_NULL },
+    /* 29 */ { "", 0, 0 },
+    /* 30 */ { "", 0, 0 },
+    /* 31 */ { "REMOVE", 6, CYPHER_TOK_REMOVE },
+    /* 32 */ { "AND", 3, CYPHER_TOK_AND },
+    /* 33 */ { "", 0, 0 },
+    /* 34 */ { "DETACH", 6, CYPHER_TOK_DETACH },
+    /* 35 */ { "", 0, 0 },
+    /* 36 */ { "", 0, 0 },
+    /* 37 */ { "ASC", 3, CYPHER_TOK_ASC },
+    /* 38 */ { "", 0, 0 },
+    /* 39 */ { "BY", 2, CYPHER_TOK_BY },
+    /* 40 */ { "DISTINCT", 8, CYPHER_TOK_DISTINCT },
+    /* 41 */ { "MERGE", 5, CYPHER_TOK_MERGE },
+    /* 42 */ { "", 0, 0 },
+    /* 43 */ { "OPTIONAL", 8, CYPHER_TOK_OPTIONAL },
+    /* 44 */ { "", 0, 0 },
+    /* 45 */ { "LIMIT", 5, CYPHER_TOK_LIMIT },
+    /* 46 */ { "", 0, 0 },
+    /* 47 */ { "", 0, 0 },
+    /* 48 */ { "", 0, 0 },
+    /* 49 */ { "DELETE", 6, CYPHER_TOK_DELETE },
+    /* 50 */ { "RETURN", 6, CYPHER_TOK_RETURN },
+    /* 51 */ { "", 0, 0 },
+    /* 52 */ { "", 0, 0 },
+    /* 53 */ { "IN", 2, CYPHER_TOK_IN },
+    /* 54 */ { "NULL", 4, CYPHER_TOK_NULL },
+    /* 55 */ { "", 0, 0 },
+    /* 56 */ { "", 0, 0 },
+    /* 57 */ { "DESC", 4, CYPHER_TOK_DESC },
+    /* 58 */ { "", 0, 0 },
+    /* 59 */ { "", 0, 0 },
+    /* 60 */ { "CONTAINS", 8, CYPHER_TOK_CONTAINS },
+    /* 61 */ { "", 0, 0 },
+    /* 62 */ { "", 0, 0 },
+    /* 63 */ { "TRUE", 4, CYPHER_TOK_BOOLEAN },
+};
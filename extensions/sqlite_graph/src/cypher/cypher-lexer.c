@@ -34,11 +34,22 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 
 #include "cypher.h"
+#include "cypher-keywords.h"
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <stdarg.h>
 
+static void lexerInit(CypherLexer *pLexer, const char *zInput) {
+    pLexer->zInput = zInput;
+    pLexer->nInput = (int)strlen(zInput);
+    pLexer->iPos = 0;
+    pLexer->iLine = 1;
+    pLexer->iColumn = 1;
+    pLexer->zErrorMsg = NULL;
+    pLexer->pLastToken = NULL;
+}
+
 // Initializes a new lexer instance.
 CypherLexer *cypherLexerCreate(const char *zInput) {
     if (!zInput) {
@@ -48,13 +59,7 @@ CypherLexer *cypherLexerCreate(const char *zInput) {
     if (!pLexer) {
         return NULL;
     }
-    
-    pLexer->zInput = zInput;
-    pLexer->iPos = 0;
-    pLexer->iLine = 1;
-    pLexer->iColumn = 1;
-    pLexer->zErrorMsg = NULL;
-    pLexer->pLastToken = NULL;
+    lexerInit(pLexer, zInput);
     return pLexer;
 }
 
@@ -64,14 +69,11 @@ void cypherLexerDestroy(CypherLexer *pLexer) {
     if (pLexer->zErrorMsg) {
         CYPHER_FREE(pLexer->zErrorMsg);
     }
-    if (pLexer->pLastToken) {
-        CYPHER_FREE(pLexer->pLastToken);
-    }
     CYPHER_FREE(pLexer);
 }
 
 static char lexerPeek(CypherLexer *pLexer, int offset) {
-    if (pLexer->iPos + offset >= (int)strlen(pLexer->zInput)) {
+    if (pLexer->iPos + offset >= pLexer->nInput) {
         return '\0';
     }
     return pLexer->zInput[pLexer->iPos + offset];
@@ -115,15 +117,11 @@ static void lexerSkipComment(CypherLexer *pLexer) {
     }
 }
 
+// Tokens are views into the input held in the lexer itself; each call
+// overwrites the previous token instead of allocating a new one.
 static CypherToken *lexerAddToken(CypherLexer *pLexer, CypherTokenType type, int startPos, int endPos) {
-    if (pLexer->pLastToken) {
-        CYPHER_FREE(pLexer->pLastToken);
-    }
-    CypherToken *pToken = (CypherToken *)CYPHER_MALLOC(sizeof(CypherToken));
-    if (!pToken) {
-        return NULL;
-    }
-    
+    CypherToken *pToken = &pLexer->token;
+
     pToken->type = type;
     pToken->text = &pLexer->zInput[startPos];
     pToken->len = endPos - startPos;
@@ -165,50 +163,23 @@ static void lexerSetError(CypherLexer *pLexer, const char *zFormat, ...) {
     va_end(args);
 }
 
+// Keyword lookup through the perfect hash in cypher-keywords.h. The
+// identifier is upper-cased once into zUpper while its hash inputs are
+// read; a hit is then confirmed with a single memcmp().
 static CypherTokenType cypherGetKeywordToken(const char *zKeyword, size_t len) {
-    switch(len) {
-        case 2:
-            if (strncasecmp(zKeyword, "AS", 2) == 0) return CYPHER_TOK_AS;
-            if (strncasecmp(zKeyword, "BY", 2) == 0) return CYPHER_TOK_BY;
-            if (strncasecmp(zKeyword, "IS", 2) == 0) return CYPHER_TOK_IS_NULL; // Simplified
-            if (strncasecmp(zKeyword, "IN", 2) == 0) return CYPHER_TOK_IN;
-            if (strncasecmp(zKeyword, "OR", 2) == 0) return CYPHER_TOK_OR;
-            break;
-        case 3:
-            if (strncasecmp(zKeyword, "AND", 3) == 0) return CYPHER_TOK_AND;
-            if (strncasecmp(zKeyword, "ASC", 3) == 0) return CYPHER_TOK_ASC;
-            if (strncasecmp(zKeyword, "NOT", 3) == 0) return CYPHER_TOK_NOT;
-            if (strncasecmp(zKeyword, "SET", 3) == 0) return CYPHER_TOK_SET;
-            if (strncasecmp(zKeyword, "XOR", 3) == 0) return CYPHER_TOK_XOR;
-            break;
-        case 4:
-            if (strncasecmp(zKeyword, "DESC", 4) == 0) return CYPHER_TOK_DESC;
-            if (strncasecmp(zKeyword, "SKIP", 4) == 0) return CYPHER_TOK_SKIP;
-            if (strncasecmp(zKeyword, "WITH", 4) == 0) return CYPHER_TOK_WITH;
-            if (strncasecmp(zKeyword, "NULL", 4) == 0) return CYPHER_TOK_NULL;
-            if (strncasecmp(zKeyword, "TRUE", 4) == 0) return CYPHER_TOK_BOOLEAN;
-            break;
-        case 5:
-            if (strncasecmp(zKeyword, "MATCH", 5) == 0) return CYPHER_TOK_MATCH;
-            if (strncasecmp(zKeyword, "LIMIT", 5) == 0) return CYPHER_TOK_LIMIT;
-            if (strncasecmp(zKeyword, "MERGE", 5) == 0) return CYPHER_TOK_MERGE;
-            if (strncasecmp(zKeyword, "ORDER", 5) == 0) return CYPHER_TOK_ORDER;
-            if (strncasecmp(zKeyword, "UNION", 5) == 0) return CYPHER_TOK_UNION;
-            if (strncasecmp(zKeyword, "WHERE", 5) == 0) return CYPHER_TOK_WHERE;
-            if (strncasecmp(zKeyword, "FALSE", 5) == 0) return CYPHER_TOK_BOOLEAN;
-            break;
-        case 6:
-            if (strncasecmp(zKeyword, "CREATE", 6) == 0) return CYPHER_TOK_CREATE;
-            if (strncasecmp(zKeyword, "DELETE", 6) == 0) return CYPHER_TOK_DELETE;
-            if (strncasecmp(zKeyword, "DETACH", 6) == 0) return CYPHER_TOK_DETACH;
-            if (strncasecmp(zKeyword, "REMOVE", 6) == 0) return CYPHER_TOK_REMOVE;
-            if (strncasecmp(zKeyword, "RETURN", 6) == 0) return CYPHER_TOK_RETURN;
-            break;
-        case 8:
-            if (strncasecmp(zKeyword, "DISTINCT", 8) == 0) return CYPHER_TOK_DISTINCT;
-            if (strncasecmp(zKeyword, "OPTIONAL", 8) == 0) return CYPHER_TOK_OPTIONAL;
-            if (strncasecmp(zKeyword, "CONTAINS", 8) == 0) return CYPHER_TOK_CONTAINS;
-            break;
+    char zUpper[CYPHER_KW_MAX_LEN];
+    int h;
+    size_t i;
+
+    if (len < CYPHER_KW_MIN_LEN || len > CYPHER_KW_MAX_LEN) {
+        return CYPHER_TOK_IDENTIFIER;
+    }
+    for (i = 0; i < len; i++) {
+        zUpper[i] = (char)(zKeyword[i] & ~0x20);
+    }
+    h = CYPHER_KW_HASH((unsigned char)zUpper[0], (unsigned char)zUpper[len - 1], (int)len);
+    if (aCypherKeyword[h].nName == len && memcmp(aCypherKeyword[h].zName, zUpper, len) == 0) {
+        return (CypherTokenType)aCypherKeyword[h].eToken;
     }
     return CYPHER_TOK_IDENTIFIER;
 }
@@ -229,7 +200,8 @@ static CypherToken *lexerTokenizeNumber(CypherLexer *pLexer) {
     while (isdigit(lexerPeek(pLexer, 0))) {
         lexerNext(pLexer);
     }
-    if (lexerPeek(pLexer, 0) == '.') {
+    /* "1..3" is a range, not the float "1." */
+    if (lexerPeek(pLexer, 0) == '.' && lexerPeek(pLexer, 1) != '.') {
         type = CYPHER_TOK_FLOAT;
         lexerNext(pLexer);
         while (isdigit(lexerPeek(pLexer, 0))) {
@@ -341,6 +313,173 @@ CypherToken *cypherLexerNextToken(CypherLexer *pLexer) {
     return lexerAddToken(pLexer, CYPHER_TOK_ERROR, startPos, pLexer->iPos);
 }
 
+/*
+** Add parameter zName with the first nValue bytes of zValue (all of it
+** if nValue < 0; zValue NULL for null) and its SQLITE_* type eType. A
+** later value of the same name replaces an earlier one.
+*/
+int cypherParamsAdd(CypherParams *pParams, const char *zName, const char *zValue, int nValue,
+                    int eType) {
+    char *zNewValue = NULL;
+    int i;
+
+    if (!pParams || !zName) return SQLITE_MISUSE;
+    if (!zValue) eType = SQLITE_NULL;
+    if (zValue) {
+        zNewValue = nValue < 0 ? sqlite3_mprintf("%s", zValue)
+                               : sqlite3_mprintf("%.*s", nValue, zValue);
+        if (!zNewValue) return SQLITE_NOMEM;
+    }
+    for (i = 0; i < pParams->nParam; i++) {
+        if (strcmp(pParams->azName[i], zName) == 0) {
+            CYPHER_FREE(pParams->azValue[i]);
+            pParams->azValue[i] = zNewValue;
+            pParams->aeType[i] = eType;
+            return SQLITE_OK;
+        }
+    }
+    if (pParams->nParam >= pParams->nParamAlloc) {
+        int nNew = pParams->nParamAlloc ? pParams->nParamAlloc * 2 : 8;
+        char **azName = CYPHER_REALLOC(pParams->azName, nNew * sizeof(char *));
+        char **azValue;
+        int *aeType;
+        if (azName) pParams->azName = azName;
+        azValue = azName ? CYPHER_REALLOC(pParams->azValue, nNew * sizeof(char *)) : NULL;
+        if (azValue) pParams->azValue = azValue;
+        aeType = azValue ? CYPHER_REALLOC(pParams->aeType, nNew * sizeof(int)) : NULL;
+        if (!aeType) {
+            CYPHER_FREE(zNewValue);
+            return SQLITE_NOMEM;
+        }
+        pParams->aeType = aeType;
+        pParams->nParamAlloc = nNew;
+    }
+    pParams->azName[pParams->nParam] = sqlite3_mprintf("%s", zName);
+    if (!pParams->azName[pParams->nParam]) {
+        CYPHER_FREE(zNewValue);
+        return SQLITE_NOMEM;
+    }
+    pParams->aeType[pParams->nParam] = eType;
+    pParams->azValue[pParams->nParam++] = zNewValue;
+    return SQLITE_OK;
+}
+
+/*
+** The value of parameter zName, with its type in *peType. *pbFound
+** tells a null value from a missing parameter, both of which return
+** NULL.
+*/
+const char *cypherParamsFind(const CypherParams *pParams, const char *zName, int *peType,
+                             int *pbFound) {
+    int i;
+
+    *pbFound = 0;
+    *peType = SQLITE_NULL;
+    if (!pParams || !zName) return NULL;
+    for (i = 0; i < pParams->nParam; i++) {
+        if (strcmp(pParams->azName[i], zName) == 0) {
+            *pbFound = 1;
+            *peType = pParams->aeType[i];
+            return pParams->azValue[i];
+        }
+    }
+    return NULL;
+}
+
+void cypherParamsClear(CypherParams *pParams) {
+    int i;
+
+    if (!pParams) return;
+    for (i = 0; i < pParams->nParam; i++) {
+        CYPHER_FREE(pParams->azName[i]);
+        CYPHER_FREE(pParams->azValue[i]);
+    }
+    CYPHER_FREE(pParams->azName);
+    CYPHER_FREE(pParams->azValue);
+    CYPHER_FREE(pParams->aeType);
+    memset(pParams, 0, sizeof(*pParams));
+}
+
+/*
+** True for a token after which a literal is a property value: the
+** right side of a comparison or the value of a map entry. Literals
+** elsewhere, such as hop bounds and LIMIT counts, shape the plan and
+** stay in the key.
+*/
+static int lexerIsValueContext(CypherTokenType type) {
+    switch (type) {
+        case CYPHER_TOK_EQ:
+        case CYPHER_TOK_NE:
+        case CYPHER_TOK_LT:
+        case CYPHER_TOK_LE:
+        case CYPHER_TOK_GT:
+        case CYPHER_TOK_GE:
+        case CYPHER_TOK_COLON:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+char *cypherNormalizeQuery(const char *zQuery, CypherParams *pParams) {
+    CypherLexer sLexer;          /* On the stack: this runs for every cached query */
+    CypherLexer *pLexer = &sLexer;
+    CypherTokenType prev = CYPHER_TOK_EOF;
+    sqlite3_str *pOut;
+    int nLiteral = 0;
+    int rc = SQLITE_OK;
+    int i;
+
+    if (!zQuery) return NULL;
+    lexerInit(pLexer, zQuery);
+    pOut = sqlite3_str_new(NULL);
+    while (rc == SQLITE_OK) {
+        CypherToken *pToken = cypherLexerNextToken(pLexer);
+        if (!pToken || pToken->type == CYPHER_TOK_ERROR) {
+            rc = SQLITE_ERROR;
+            break;
+        }
+        if (pToken->type == CYPHER_TOK_EOF) break;
+
+        /* "$name" stays one word */
+        if (sqlite3_str_length(pOut) > 0 && prev != CYPHER_TOK_DOLLAR) {
+            sqlite3_str_appendchar(pOut, 1, ' ');
+        }
+        if ((pToken->type == CYPHER_TOK_INTEGER || pToken->type == CYPHER_TOK_FLOAT ||
+             pToken->type == CYPHER_TOK_STRING) && lexerIsValueContext(prev)) {
+            char zName[24];
+            snprintf(zName, sizeof(zName), "_%d", ++nLiteral);
+            rc = cypherParamsAdd(pParams, zName, pToken->text, pToken->len,
+                                 pToken->type == CYPHER_TOK_STRING ? SQLITE_TEXT :
+                                 pToken->type == CYPHER_TOK_FLOAT ? SQLITE_FLOAT :
+                                 SQLITE_INTEGER);
+            sqlite3_str_appendf(pOut, "$%s", zName);
+        } else if (pToken->type == CYPHER_TOK_STRING) {
+            /* The token excludes the quotes; keep the ones written */
+            char q = pToken->text[-1];
+            sqlite3_str_appendf(pOut, "%c%.*s%c", q, pToken->len, pToken->text, q);
+        } else if (((pToken->type >= CYPHER_TOK_MATCH && pToken->type <= CYPHER_TOK_NULL) ||
+                    pToken->type == CYPHER_TOK_BOOLEAN) && pToken->len <= CYPHER_KW_MAX_LEN) {
+            char zUpper[CYPHER_KW_MAX_LEN];
+            for (i = 0; i < pToken->len; i++) {
+                zUpper[i] = (char)(pToken->text[i] & ~0x20);
+            }
+            sqlite3_str_append(pOut, zUpper, pToken->len);
+        } else {
+            sqlite3_str_append(pOut, pToken->text, pToken->len);
+        }
+        prev = pToken->type;
+    }
+    CYPHER_FREE(sLexer.zErrorMsg);
+
+    if (rc == SQLITE_OK) rc = sqlite3_str_errcode(pOut);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(sqlite3_str_finish(pOut));
+        return NULL;
+    }
+    return sqlite3_str_finish(pOut);
+}
+
 /*
 ** Return string name for token type - useful for debugging
 */
@@ -21,8 +21,11 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-planner.h"
+#include "cypher-expressions.h"
+#include "graph-stats.h"
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 /*
 ** Create a new logical plan node.
@@ -62,6 +65,22 @@ void logicalPlanNodeDestroy(LogicalPlanNode *pNode) {
   sqlite3_free(pNode->zLabel);
   sqlite3_free(pNode->zProperty);
   sqlite3_free(pNode->zValue);
+  sqlite3_free(pNode->zParam);
+  sqlite3_free(pNode->zFromAlias);
+  sqlite3_free(pNode->zRelAlias);
+  planAggregateFree(pNode->aAggregate, pNode->nAggregate);
+  cypherExpressionDestroy(pNode->pExpr);
+  for( i = 0; pNode->apProjections && i < pNode->nProjections; i++ ) {
+    cypherExpressionDestroy(pNode->apProjections[i]);
+  }
+  sqlite3_free(pNode->apProjections);
+  planColumnsFree(pNode->azColumn, pNode->nProjections);
+  for( i = 0; pNode->apSortKeys && i < pNode->nSortKeys; i++ ) {
+    cypherExpressionDestroy(pNode->apSortKeys[i]);
+  }
+  sqlite3_free(pNode->apSortKeys);
+  planWriteItemsFree(pNode->aWrite, pNode->nWrite);
+  sqlite3_free(pNode->aSortFlags);
   sqlite3_free(pNode->pExtra);
   sqlite3_free(pNode);
 }
@@ -151,10 +170,11 @@ int logicalPlanNodeSetProperty(LogicalPlanNode *pNode, const char *zProperty) {
   return SQLITE_OK;
 }
 
-int logicalPlanNodeSetValue(LogicalPlanNode *pNode, const char *zValue) {
+int logicalPlanNodeSetValue(LogicalPlanNode *pNode, const char *zValue, int eType) {
   char *zNew;
   
   if( !pNode ) return SQLITE_MISUSE;
+  pNode->eValueType = eType;
   if( !zValue ) {
     sqlite3_free(pNode->zValue);
     pNode->zValue = NULL;
@@ -169,6 +189,199 @@ int logicalPlanNodeSetValue(LogicalPlanNode *pNode, const char *zValue) {
   return SQLITE_OK;
 }
 
+int logicalPlanNodeSetParam(LogicalPlanNode *pNode, const char *zParam) {
+  char *zNew = NULL;
+  
+  if( !pNode ) return SQLITE_MISUSE;
+  if( zParam ) {
+    zNew = sqlite3_mprintf("%s", zParam);
+    if( !zNew ) return SQLITE_NOMEM;
+  }
+  
+  sqlite3_free(pNode->zParam);
+  pNode->zParam = zNew;
+  return SQLITE_OK;
+}
+
+int logicalPlanNodeSetFromAlias(LogicalPlanNode *pNode, const char *zFromAlias) {
+  char *zNew;
+  
+  if( !pNode ) return SQLITE_MISUSE;
+  if( !zFromAlias ) {
+    sqlite3_free(pNode->zFromAlias);
+    pNode->zFromAlias = NULL;
+    return SQLITE_OK;
+  }
+  
+  zNew = sqlite3_mprintf("%s", zFromAlias);
+  if( !zNew ) return SQLITE_NOMEM;
+  
+  sqlite3_free(pNode->zFromAlias);
+  pNode->zFromAlias = zNew;
+  return SQLITE_OK;
+}
+
+int logicalPlanNodeSetRelAlias(LogicalPlanNode *pNode, const char *zRelAlias) {
+  char *zNew;
+  
+  if( !pNode ) return SQLITE_MISUSE;
+  if( !zRelAlias ) {
+    sqlite3_free(pNode->zRelAlias);
+    pNode->zRelAlias = NULL;
+    return SQLITE_OK;
+  }
+  
+  zNew = sqlite3_mprintf("%s", zRelAlias);
+  if( !zNew ) return SQLITE_NOMEM;
+  
+  sqlite3_free(pNode->zRelAlias);
+  pNode->zRelAlias = zNew;
+  return SQLITE_OK;
+}
+
+/*
+** Copy an array of aggregation columns with their strings.
+** Returns NULL if out of memory or nAggregate is 0.
+*/
+PlanAggregate *planAggregateCopy(const PlanAggregate *aAggregate, int nAggregate) {
+  PlanAggregate *aCopy;
+  int bOom = 0;
+  int i;
+  
+  if( !aAggregate || nAggregate <= 0 ) return NULL;
+  aCopy = sqlite3_malloc(nAggregate * sizeof(PlanAggregate));
+  if( !aCopy ) return NULL;
+  memset(aCopy, 0, nAggregate * sizeof(PlanAggregate));
+  
+  for( i = 0; i < nAggregate; i++ ) {
+    const PlanAggregate *pSrc = &aAggregate[i];
+    aCopy[i].eFunc = pSrc->eFunc;
+    if( pSrc->zVariable ) {
+      aCopy[i].zVariable = sqlite3_mprintf("%s", pSrc->zVariable);
+      if( !aCopy[i].zVariable ) bOom = 1;
+    }
+    if( pSrc->zProperty ) {
+      aCopy[i].zProperty = sqlite3_mprintf("%s", pSrc->zProperty);
+      if( !aCopy[i].zProperty ) bOom = 1;
+    }
+    if( pSrc->zName ) {
+      aCopy[i].zName = sqlite3_mprintf("%s", pSrc->zName);
+      if( !aCopy[i].zName ) bOom = 1;
+    }
+  }
+  if( bOom ) {
+    planAggregateFree(aCopy, nAggregate);
+    return NULL;
+  }
+  return aCopy;
+}
+
+void planAggregateFree(PlanAggregate *aAggregate, int nAggregate) {
+  int i;
+  
+  if( !aAggregate ) return;
+  for( i = 0; i < nAggregate; i++ ) {
+    sqlite3_free(aAggregate[i].zVariable);
+    sqlite3_free(aAggregate[i].zProperty);
+    sqlite3_free(aAggregate[i].zName);
+  }
+  sqlite3_free(aAggregate);
+}
+
+char **planColumnsCopy(char **azColumn, int nColumn) {
+  char **azCopy;
+  int i;
+  
+  if( !azColumn || nColumn <= 0 ) return NULL;
+  azCopy = sqlite3_malloc(nColumn * sizeof(char*));
+  if( !azCopy ) return NULL;
+  memset(azCopy, 0, nColumn * sizeof(char*));
+  for( i = 0; i < nColumn; i++ ) {
+    azCopy[i] = sqlite3_mprintf("%s", azColumn[i] ? azColumn[i] : "");
+    if( !azCopy[i] ) {
+      planColumnsFree(azCopy, nColumn);
+      return NULL;
+    }
+  }
+  return azCopy;
+}
+
+void planColumnsFree(char **azColumn, int nColumn) {
+  int i;
+  
+  if( !azColumn ) return;
+  for( i = 0; i < nColumn; i++ ) sqlite3_free(azColumn[i]);
+  sqlite3_free(azColumn);
+}
+
+PlanWriteItem *planWriteItemsCopy(const PlanWriteItem *aWrite, int nWrite) {
+  PlanWriteItem *aCopy;
+  int bOom = 0;
+  int i, j;
+  
+  if( !aWrite || nWrite <= 0 ) return NULL;
+  aCopy = sqlite3_malloc(nWrite * sizeof(PlanWriteItem));
+  if( !aCopy ) return NULL;
+  memset(aCopy, 0, nWrite * sizeof(PlanWriteItem));
+  
+  for( i = 0; i < nWrite && !bOom; i++ ) {
+    const PlanWriteItem *pSrc = &aWrite[i];
+    PlanWriteItem *pDst = &aCopy[i];
+    pDst->iFrom = pSrc->iFrom;
+    pDst->iTo = pSrc->iTo;
+    if( pSrc->zVariable ) {
+      pDst->zVariable = sqlite3_mprintf("%s", pSrc->zVariable);
+      if( !pDst->zVariable ) bOom = 1;
+    }
+    if( pSrc->zLabel ) {
+      pDst->zLabel = sqlite3_mprintf("%s", pSrc->zLabel);
+      if( !pDst->zLabel ) bOom = 1;
+    }
+    if( pSrc->nProp > 0 && !bOom ) {
+      pDst->azProp = sqlite3_malloc(pSrc->nProp * sizeof(char*));
+      pDst->apValue = sqlite3_malloc(pSrc->nProp * sizeof(CypherExpression*));
+      if( !pDst->azProp || !pDst->apValue ) {
+        sqlite3_free(pDst->azProp);
+        sqlite3_free(pDst->apValue);
+        pDst->azProp = 0;
+        pDst->apValue = 0;
+        bOom = 1;
+        break;
+      }
+      memset(pDst->azProp, 0, pSrc->nProp * sizeof(char*));
+      memset(pDst->apValue, 0, pSrc->nProp * sizeof(CypherExpression*));
+      pDst->nProp = pSrc->nProp;
+      for( j = 0; j < pSrc->nProp; j++ ) {
+        pDst->azProp[j] = sqlite3_mprintf("%s", pSrc->azProp[j]);
+        pDst->apValue[j] = cypherExpressionCopy(pSrc->apValue[j]);
+        if( !pDst->azProp[j] || !pDst->apValue[j] ) bOom = 1;
+      }
+    }
+  }
+  if( bOom ) {
+    planWriteItemsFree(aCopy, nWrite);
+    return NULL;
+  }
+  return aCopy;
+}
+
+void planWriteItemsFree(PlanWriteItem *aWrite, int nWrite) {
+  int i, j;
+  
+  if( !aWrite ) return;
+  for( i = 0; i < nWrite; i++ ) {
+    sqlite3_free(aWrite[i].zVariable);
+    sqlite3_free(aWrite[i].zLabel);
+    for( j = 0; j < aWrite[i].nProp; j++ ) {
+      if( aWrite[i].azProp ) sqlite3_free(aWrite[i].azProp[j]);
+      if( aWrite[i].apValue ) cypherExpressionDestroy(aWrite[i].apValue[j]);
+    }
+    sqlite3_free(aWrite[i].azProp);
+    sqlite3_free(aWrite[i].apValue);
+  }
+  sqlite3_free(aWrite);
+}
+
 /*
 ** Get string representation of logical plan node type.
 ** Returns static string, do not free.
@@ -180,6 +393,7 @@ const char *logicalPlanNodeTypeName(LogicalPlanNodeType type) {
     case LOGICAL_INDEX_SCAN:        return "INDEX_SCAN";
     case LOGICAL_RELATIONSHIP_SCAN: return "RELATIONSHIP_SCAN";
     case LOGICAL_TYPE_SCAN:         return "TYPE_SCAN";
+    case LOGICAL_BITMAP_AND:        return "BITMAP_AND";
     case LOGICAL_EXPAND:            return "EXPAND";
     case LOGICAL_VAR_LENGTH_EXPAND: return "VAR_LENGTH_EXPAND";
     case LOGICAL_OPTIONAL_EXPAND:   return "OPTIONAL_EXPAND";
@@ -204,65 +418,127 @@ const char *logicalPlanNodeTypeName(LogicalPlanNodeType type) {
   }
 }
 
+/*
+** Nodes in the planned graph. Without a graph the planner assumes a
+** graph of 10000 nodes.
+*/
+static double planGraphNodes(PlanContext *pContext) {
+  if( pContext && pContext->pGraph ) return graphEstimateNodes(pContext->pGraph);
+  return 10000.0;
+}
+
+/*
+** True if an index scan below pNode already applies the predicate of
+** the property filter pFilter, which then only re-checks its rows.
+*/
+int logicalPlanAppliesPredicate(LogicalPlanNode *pNode, LogicalPlanNode *pFilter) {
+  int i;
+  
+  if( !pNode ) return 0;
+  if( pNode->type == LOGICAL_INDEX_SCAN && pNode->eCmp == pFilter->eCmp &&
+      pNode->zProperty && pFilter->zProperty &&
+      strcmp(pNode->zProperty, pFilter->zProperty) == 0 &&
+      ((pNode->zValue && pFilter->zValue && pNode->eValueType == pFilter->eValueType &&
+        strcmp(pNode->zValue, pFilter->zValue) == 0) ||
+       (pNode->zParam && pFilter->zParam && strcmp(pNode->zParam, pFilter->zParam) == 0)) &&
+      (!pNode->zAlias || !pFilter->zAlias || strcmp(pNode->zAlias, pFilter->zAlias) == 0) ) {
+    return 1;
+  }
+  for( i = 0; i < pNode->nChildren; i++ ) {
+    if( logicalPlanAppliesPredicate(pNode->apChildren[i], pFilter) ) return 1;
+  }
+  return 0;
+}
+
 /*
 ** Estimate the cost of executing a logical plan node.
-** Uses simple heuristics for cost calculation.
+** Costs are in rows touched, derived from the row estimates, so
+** logicalPlanEstimateRows() runs first if the node has none yet.
 */
 double logicalPlanEstimateCost(LogicalPlanNode *pNode, PlanContext *pContext) {
   double rCost = 0.0;
+  double rRows;
   int i;
   
   if( !pNode ) return 0.0;
+  if( pNode->iEstimatedRows <= 0 ) logicalPlanEstimateRows(pNode, pContext);
+  rRows = (double)pNode->iEstimatedRows;
   
   /* Base cost depends on operation type */
   switch( pNode->type ) {
     case LOGICAL_NODE_SCAN:
-      /* Full table scan - expensive */
-      rCost = 1000.0;
+      /* Full table scan reads every node whatever it returns */
+      rCost = planGraphNodes(pContext);
       break;
       
     case LOGICAL_LABEL_SCAN:
-      /* Label index scan - much cheaper */
-      rCost = 10.0;
+    case LOGICAL_INDEX_SCAN:
+      /* Index scans read only the rows they return */
+      rCost = rRows;
       break;
       
-    case LOGICAL_INDEX_SCAN:
-      /* Property index scan - very cheap */
-      rCost = 1.0;
+    case LOGICAL_BITMAP_AND:
+      /* Children are index scans; intersection is linear in their size */
+      rCost = rRows * 0.1;
       break;
       
     case LOGICAL_FILTER:
-      /* Filter cost depends on selectivity */
-      rCost = 1.0;
+    case LOGICAL_PROPERTY_FILTER:
+      /* One predicate evaluation per input row */
+      rCost = pNode->nChildren > 0 ? pNode->apChildren[0]->iEstimatedRows * 0.1 : rRows;
       break;
       
     case LOGICAL_EXPAND:
-      /* Relationship traversal */
-      rCost = 5.0;
+    case LOGICAL_VAR_LENGTH_EXPAND:
+      /* One adjacency lookup per input row plus one per produced row */
+      rCost = rRows + (pNode->nChildren > 0 ? pNode->apChildren[0]->iEstimatedRows : 0);
       break;
       
     case LOGICAL_HASH_JOIN:
-      /* Hash join cost */
-      rCost = 10.0;
+      /* Build and probe are linear in the inputs */
+      rCost = rRows;
+      for( i = 0; i < pNode->nChildren; i++ ) {
+        rCost += pNode->apChildren[i]->iEstimatedRows;
+      }
       break;
       
     case LOGICAL_NESTED_LOOP_JOIN:
-      /* Nested loop - expensive */
-      rCost = 100.0;
+      /* Index nested loop: the inner node is looked up by id once per
+      ** outer row and never scanned, so only the outer cost is added */
+      if( pNode->nChildren >= 2 ) {
+        rCost = rRows + 2.0 * pNode->apChildren[0]->iEstimatedRows;
+        rCost += logicalPlanEstimateCost(pNode->apChildren[0], pContext);
+        logicalPlanEstimateCost(pNode->apChildren[1], pContext);
+        pNode->rEstimatedCost = rCost;
+        return rCost;
+      }
+      rCost = rRows;
+      break;
+      
+    case LOGICAL_CARTESIAN_PRODUCT:
+      /* Every pair of input rows is visited */
+      rCost = pNode->nChildren >= 2 ?
+              (double)pNode->apChildren[0]->iEstimatedRows * pNode->apChildren[1]->iEstimatedRows :
+              rRows;
       break;
       
     case LOGICAL_PROJECTION:
       /* Projection is cheap */
-      rCost = 0.1;
+      rCost = rRows * 0.01;
+      break;
+      
+    case LOGICAL_AGGREGATION:
+      /* One hash table probe per input row */
+      rCost = pNode->nChildren > 0 ? pNode->apChildren[0]->iEstimatedRows * 0.05 : rRows;
       break;
       
     case LOGICAL_SORT:
-      /* Sorting cost */
-      rCost = 50.0;
+      /* n log n comparisons */
+      rCost = rRows > 1.0 ? rRows * log2(rRows) : 1.0;
       break;
       
     default:
-      rCost = 1.0;
+      rCost = rRows * 0.1;
       break;
   }
   
@@ -277,87 +553,134 @@ double logicalPlanEstimateCost(LogicalPlanNode *pNode, PlanContext *pContext) {
 
 /*
 ** Estimate the number of rows produced by a logical plan node.
-** Uses simple cardinality estimation.
+** With a graph in the context the estimates come from graphEstimate*()
+** (graph_analyze() statistics scaled to the live graph); predicates
+** are assumed independent. Without one, fixed guesses are used.
 */
 sqlite3_int64 logicalPlanEstimateRows(LogicalPlanNode *pNode, PlanContext *pContext) {
-  sqlite3_int64 iRows = 0;
+  GraphVtab *pGraph = pContext ? pContext->pGraph : NULL;
+  double rNodes = planGraphNodes(pContext);
+  double rRows = 0.0;
+  double rFan;
+  int i;
   
   if( !pNode ) return 0;
   
   /* Estimate based on operation type */
   switch( pNode->type ) {
     case LOGICAL_NODE_SCAN:
-      /* Assume reasonable graph size */
-      iRows = 10000;
+      rRows = rNodes;
       break;
       
     case LOGICAL_LABEL_SCAN:
-      /* Labels are selective */
-      iRows = 1000;
+      rRows = pGraph ? graphEstimateLabel(pGraph, pNode->zLabel) : 1000.0;
       break;
       
     case LOGICAL_INDEX_SCAN:
-      /* Property indexes are very selective */
-      iRows = 100;
+      if( pGraph ) {
+        rRows = pNode->zLabel ? graphEstimateLabel(pGraph, pNode->zLabel) : rNodes;
+        rRows *= graphEstimateProperty(pGraph, pNode->zProperty, pNode->eCmp, pNode->zValue);
+      } else {
+        rRows = 100.0;
+      }
+      break;
+      
+    case LOGICAL_BITMAP_AND:
+      /* Each input keeps its own fraction of the graph */
+      rRows = rNodes;
+      for( i = 0; i < pNode->nChildren; i++ ) {
+        rRows *= logicalPlanEstimateRows(pNode->apChildren[i], pContext) / rNodes;
+      }
+      break;
+      
+    case LOGICAL_PROPERTY_FILTER:
+      rRows = pNode->nChildren > 0 ?
+              (double)logicalPlanEstimateRows(pNode->apChildren[0], pContext) : rNodes;
+      if( pNode->nChildren == 0 || !logicalPlanAppliesPredicate(pNode->apChildren[0], pNode) ) {
+        rRows *= graphEstimateProperty(pGraph, pNode->zProperty, pNode->eCmp, pNode->zValue);
+      }
       break;
       
     case LOGICAL_FILTER:
-      /* Filters reduce cardinality */
+      /* Residual predicates keep a tenth of their input */
       if( pNode->nChildren > 0 ) {
-        iRows = logicalPlanEstimateRows(pNode->apChildren[0], pContext) / 10;
+        rRows = logicalPlanEstimateRows(pNode->apChildren[0], pContext) / 10.0;
       } else {
-        iRows = 100;
+        rRows = 100.0;
       }
       break;
       
     case LOGICAL_EXPAND:
-      /* Relationship expansion multiplies rows */
-      if( pNode->nChildren > 0 ) {
-        iRows = logicalPlanEstimateRows(pNode->apChildren[0], pContext) * 5;
-      } else {
-        iRows = 500;
-      }
+      /* Each input row fans out along its relationships; zLabel holds
+      ** the relationship type, NULL for any. An undirected expand
+      ** follows both directions. An expand into a bound node keeps the
+      ** rows joined by an edge, one pair in nodes. */
+      rRows = pNode->nChildren > 0 ?
+              (double)logicalPlanEstimateRows(pNode->apChildren[0], pContext) : 100.0;
+      rRows *= pGraph ? graphEstimateFanout(pGraph, pNode->zLabel) : 5.0;
+      if( pNode->eDirection == GRAPH_EXPAND_BOTH ) rRows *= 2.0;
+      if( pNode->iFlags & PLAN_EXPAND_INTO ) rRows /= (pGraph ? rNodes : 100.0);
+      break;
+      
+    case LOGICAL_VAR_LENGTH_EXPAND:
+      /* As EXPAND, once per path length in the hop range */
+      rFan = pGraph ? graphEstimateFanout(pGraph, pNode->zLabel) : 5.0;
+      if( pNode->eDirection == GRAPH_EXPAND_BOTH ) rFan *= 2.0;
+      rRows = pNode->nChildren > 0 ?
+              (double)logicalPlanEstimateRows(pNode->apChildren[0], pContext) : 100.0;
+      rRows *= graphEstimatePathFanout(rFan, pNode->nMinHops, pNode->nMaxHops);
+      if( pNode->iFlags & PLAN_EXPAND_INTO ) rRows /= (pGraph ? rNodes : 100.0);
       break;
       
     case LOGICAL_HASH_JOIN:
     case LOGICAL_NESTED_LOOP_JOIN:
-      /* Join multiplies cardinalities */
+      /* Inputs meet on a node variable: a pair matches with 1/nodes */
       if( pNode->nChildren >= 2 ) {
-        sqlite3_int64 iLeft = logicalPlanEstimateRows(pNode->apChildren[0], pContext);
-        sqlite3_int64 iRight = logicalPlanEstimateRows(pNode->apChildren[1], pContext);
-        iRows = (iLeft * iRight) / 100; /* Assume some selectivity */
+        double rLeft = logicalPlanEstimateRows(pNode->apChildren[0], pContext);
+        double rRight = logicalPlanEstimateRows(pNode->apChildren[1], pContext);
+        rRows = rLeft * rRight / (pGraph ? rNodes : 100.0);
       } else {
-        iRows = 1000;
+        rRows = 1000.0;
       }
       break;
       
-    case LOGICAL_PROJECTION:
-    case LOGICAL_DISTINCT:
-      /* Projection doesn't change cardinality much */
-      if( pNode->nChildren > 0 ) {
-        iRows = logicalPlanEstimateRows(pNode->apChildren[0], pContext);
-      } else {
-        iRows = 100;
+    case LOGICAL_CARTESIAN_PRODUCT:
+      rRows = 1.0;
+      for( i = 0; i < pNode->nChildren; i++ ) {
+        rRows *= logicalPlanEstimateRows(pNode->apChildren[i], pContext);
+      }
+      break;
+      
+    case LOGICAL_AGGREGATION:
+      /* One row without grouping keys, else about sqrt(input) groups */
+      rRows = pNode->nChildren > 0 ?
+              (double)logicalPlanEstimateRows(pNode->apChildren[0], pContext) : 100.0;
+      for( i = 0; i < pNode->nAggregate; i++ ) {
+        if( pNode->aAggregate[i].eFunc == PLAN_AGG_KEY ) break;
       }
+      rRows = i < pNode->nAggregate ? sqrt(rRows) : 1.0;
       break;
       
     case LOGICAL_LIMIT:
-      /* Limit reduces cardinality */
-      iRows = 10; /* Assume small limit */
+      /* At most nLimit of the input rows */
+      rRows = pNode->nChildren > 0 ?
+              (double)logicalPlanEstimateRows(pNode->apChildren[0], pContext) : 100.0;
+      if( rRows > pNode->nLimit ) rRows = pNode->nLimit;
       break;
       
     default:
-      /* Default estimate */
+      /* Projection, DISTINCT, sort, ... keep their input cardinality */
       if( pNode->nChildren > 0 ) {
-        iRows = logicalPlanEstimateRows(pNode->apChildren[0], pContext);
+        rRows = logicalPlanEstimateRows(pNode->apChildren[0], pContext);
       } else {
-        iRows = 100;
+        rRows = 100.0;
       }
       break;
   }
   
-  pNode->iEstimatedRows = iRows;
-  return iRows;
+  if( rRows < 1.0 ) rRows = 1.0;
+  pNode->iEstimatedRows = (sqlite3_int64)rRows;
+  return pNode->iEstimatedRows;
 }
 
 /*
@@ -391,7 +714,31 @@ char *logicalPlanToString(LogicalPlanNode *pNode) {
   }
   
   /* Build node string */
-  if( pNode->zAlias ) {
+  if( pNode->type == LOGICAL_EXPAND || pNode->type == LOGICAL_VAR_LENGTH_EXPAND ) {
+    /* EXPAND(a-r:TYPE->b ...); EXPAND_INTO when both ends are bound,
+    ** VAR_LENGTH_EXPAND(a-:TYPE*1..3->b ...) for a hop range */
+    char *zHops = NULL;
+    if( pNode->type == LOGICAL_VAR_LENGTH_EXPAND ) {
+      zHops = pNode->nMaxHops < 0 ? sqlite3_mprintf("*%d..", pNode->nMinHops) :
+              sqlite3_mprintf("*%d..%d", pNode->nMinHops, pNode->nMaxHops);
+    }
+    zResult = sqlite3_mprintf("%s%s(%s%s%s%s%s%s%s%s cost=%.1f rows=%lld%s%s)",
+                             pNode->type == LOGICAL_VAR_LENGTH_EXPAND ? "VAR_LENGTH_" : "",
+                             (pNode->iFlags & PLAN_EXPAND_INTO) ? "EXPAND_INTO" : "EXPAND",
+                             pNode->zFromAlias ? pNode->zFromAlias : "",
+                             pNode->eDirection == GRAPH_EXPAND_IN ? "<-" : "-",
+                             pNode->zRelAlias ? pNode->zRelAlias : "",
+                             pNode->zLabel ? ":" : "",
+                             pNode->zLabel ? pNode->zLabel : "",
+                             zHops ? zHops : "",
+                             pNode->eDirection == GRAPH_EXPAND_OUT ? "->" : "-",
+                             pNode->zAlias ? pNode->zAlias : "",
+                             pNode->rEstimatedCost,
+                             pNode->iEstimatedRows,
+                             zChildren ? " [" : "",
+                             zChildren ? zChildren : "");
+    sqlite3_free(zHops);
+  } else if( pNode->zAlias ) {
     zResult = sqlite3_mprintf("%s(%s cost=%.1f rows=%lld%s%s)",
                              logicalPlanNodeTypeName(pNode->type),
                              pNode->zAlias,
@@ -452,7 +799,7 @@ LogicalPlanNode *cypherCreateTestLogicalPlan(void) {
   
   logicalPlanNodeSetAlias(pFilter, "n");
   logicalPlanNodeSetProperty(pFilter, "age");
-  logicalPlanNodeSetValue(pFilter, "30");
+  logicalPlanNodeSetValue(pFilter, "30", SQLITE_INTEGER);
   
   logicalPlanNodeSetAlias(pProjection, "n");
   logicalPlanNodeSetProperty(pProjection, "name");
@@ -469,8 +816,8 @@ LogicalPlanNode *cypherCreateTestLogicalPlan(void) {
   }
   
   /* Update cost estimates */
-  logicalPlanEstimateCost(pProjection, NULL);
   logicalPlanEstimateRows(pProjection, NULL);
+  logicalPlanEstimateCost(pProjection, NULL);
   
   return pProjection;
 }
\ No newline at end of file
@@ -35,6 +35,8 @@ extern const sqlite3_api_routines *sqlite3_api;
 
 #include "cypher.h"
 #include "cypher-errors.h"
+#include "cypher-paths.h"
+#include "graph-arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +46,9 @@ extern const sqlite3_api_routines *sqlite3_api;
 static CypherAst *parseQuery(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseSingleQuery(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseMatchClause(CypherLexer *pLexer, CypherParser *pParser);
+static CypherAst *parseCreateClause(CypherLexer *pLexer, CypherParser *pParser);
+static CypherAst *parseMergeClause(CypherLexer *pLexer, CypherParser *pParser);
+static CypherAst *parseMergeAction(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parsePatternList(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parsePattern(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseNodePattern(CypherLexer *pLexer, CypherParser *pParser);
@@ -52,9 +57,13 @@ static CypherAst *parsePropertyMap(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseListLiteral(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseMapLiteral(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseFunctionCall(CypherLexer *pLexer, CypherParser *pParser, CypherAst *pFunctionName);
-/* static CypherAst *parseRelationshipPattern(CypherLexer *pLexer, CypherParser *pParser); */
+static CypherAst *parseRelationshipPattern(CypherLexer *pLexer, CypherParser *pParser);
+static CypherAst *parseRelationshipRange(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseWhereClause(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseReturnClause(CypherLexer *pLexer, CypherParser *pParser);
+static CypherAst *parseOrderBy(CypherLexer *pLexer, CypherParser *pParser);
+static CypherAst *parseRowCount(CypherLexer *pLexer, CypherParser *pParser,
+                                CypherTokenType eToken, CypherAstNodeType eType);
 static CypherAst *parseProjectionList(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseProjectionItem(CypherLexer *pLexer, CypherParser *pParser);
 static CypherAst *parseExpression(CypherLexer *pLexer, CypherParser *pParser);
@@ -92,13 +101,56 @@ static CypherToken *parserPeekToken(CypherLexer *pLexer) {
 
 static CypherToken *parserConsumeToken(CypherLexer *pLexer, CypherTokenType expectedType) {
     CypherToken *token = cypherLexerNextToken(pLexer);
-    printf("Consumed token: type=%d, text='%.*s', line=%d, column=%d\n", token->type, token->len, token->text, token->line, token->column);
     if (token->type != expectedType) {
         return NULL;
     }
     return token;
 }
 
+// Tokens point into the query string and are not NUL-terminated, and
+// the lexer overwrites a token on the next call. parserTokenText()
+// copies the text bounded by the token length for callers that need a
+// string; AST values are copied straight from the token into the arena.
+static char *parserTokenText(CypherToken *pToken) {
+    return sqlite3_mprintf("%.*s", pToken->len, pToken->text);
+}
+
+static CypherAst *parserCreateTokenNode(CypherAstNodeType type, CypherToken *pToken) {
+    CypherAst *pAst = cypherAstCreate(type, pToken->line, pToken->column);
+    if (pAst) {
+        cypherAstSetValueN(pAst, pToken->text, pToken->len);
+        if (!pAst->zValue) {
+            cypherAstDestroy(pAst);
+            return NULL;
+        }
+    }
+    return pAst;
+}
+
+static CypherAst *parserCreateIdentifier(CypherToken *pToken) {
+    return parserCreateTokenNode(CYPHER_AST_IDENTIFIER, pToken);
+}
+
+// Literals keep the SQLite type they were written as in iFlags, so a
+// quoted '30' stays text where the value is bound.
+static CypherAst *parserCreateLiteral(CypherToken *pToken) {
+    CypherAst *pAst = parserCreateTokenNode(CYPHER_AST_LITERAL, pToken);
+    if (pAst) {
+        switch (pToken->type) {
+            case CYPHER_TOK_INTEGER:
+            case CYPHER_TOK_BOOLEAN: pAst->iFlags = SQLITE_INTEGER; break;
+            case CYPHER_TOK_FLOAT:   pAst->iFlags = SQLITE_FLOAT; break;
+            case CYPHER_TOK_NULL:    pAst->iFlags = SQLITE_NULL; break;
+            default:                 pAst->iFlags = SQLITE_TEXT; break;
+        }
+    }
+    return pAst;
+}
+
+static void parserSetTokenValue(CypherAst *pAst, CypherToken *pToken) {
+    cypherAstSetValueN(pAst, pToken->text, pToken->len);
+}
+
 CypherParser *cypherParserCreate(void) {
     CypherParser *pParser = (CypherParser *)CYPHER_MALLOC(sizeof(CypherParser));
     if (!pParser) {
@@ -107,6 +159,7 @@ CypherParser *cypherParserCreate(void) {
     
     pParser->pAst = NULL;
     pParser->zErrorMsg = NULL;
+    pParser->pArena = NULL;
     return pParser;
 }
 
@@ -117,6 +170,10 @@ void cypherParserDestroy(CypherParser *pParser) {
     if (pParser->zErrorMsg) {
         CYPHER_FREE(pParser->zErrorMsg);
     }
+    if (pParser->pArena) {
+        graphArenaRelease(pParser->pArena);
+        CYPHER_FREE(pParser->pArena);
+    }
     CYPHER_FREE(pParser);
 }
 
@@ -161,19 +218,26 @@ static void parserSetError(CypherParser *pParser, CypherLexer *pLexer, const cha
 
 CypherAst *cypherParse(CypherParser *pParser, const char *zQuery, char **pzErrMsg) {
     if (!zQuery) {
-        if (pzErrMsg) *pzErrMsg = strdup("Query string is NULL");
+        if (pzErrMsg) *pzErrMsg = sqlite3_mprintf("Query string is NULL");
         return NULL;
     }
     CypherLexer *pLexer = cypherLexerCreate(zQuery);
     if (!pLexer) {
-        if (pzErrMsg) *pzErrMsg = strdup("Failed to create lexer");
+        if (pzErrMsg) *pzErrMsg = sqlite3_mprintf("Failed to create lexer");
         return NULL;
     }
 
+    /* AST nodes come from the parser's arena, released with the parser */
+    if (!pParser->pArena) {
+        pParser->pArena = (GraphArena *)CYPHER_MALLOC(sizeof(GraphArena));
+        if (pParser->pArena) graphArenaInit(pParser->pArena, NULL, 0);
+    }
+    GraphArena *pPrior = cypherAstSetArena(pParser->pArena);
     pParser->pAst = parseQuery(pLexer, pParser);
+    cypherAstSetArena(pPrior);
 
     if (pParser->zErrorMsg) {
-        if (pzErrMsg) *pzErrMsg = strdup(pParser->zErrorMsg);
+        if (pzErrMsg) *pzErrMsg = sqlite3_mprintf("%s", pParser->zErrorMsg);
     }
 
     cypherLexerDestroy(pLexer);
@@ -247,42 +311,66 @@ static CypherAst *parseQuery(CypherLexer *pLexer, CypherParser *pParser) {
 
 static CypherAst *parseSingleQuery(CypherLexer *pLexer, CypherParser *pParser) {
     CypherAst *pSingleQuery = cypherAstCreate(CYPHER_AST_SINGLE_QUERY, 0, 0);
-    CypherAst *pMatchClause = parseMatchClause(pLexer, pParser);
-    if (!pMatchClause) {
-        cypherAstDestroy(pSingleQuery);
-        return NULL;
-    }
-    cypherAstAddChild(pSingleQuery, pMatchClause);
-
     CypherToken *pPeek = parserPeekToken(pLexer);
-    if (pPeek->type == CYPHER_TOK_WHERE) {
-        CypherAst *pWhereClause = parseWhereClause(pLexer, pParser);
-        if (pWhereClause) {
-            cypherAstAddChild(pSingleQuery, pWhereClause);
-        }
-    }
 
-    pPeek = parserPeekToken(pLexer);
-    if (pPeek->type == CYPHER_TOK_RETURN) {
-        CypherAst *pReturnClause = parseReturnClause(pLexer, pParser);
-        if (!pReturnClause) {
+    // A query is a lone CREATE, a lone MERGE or MATCH [WHERE] [RETURN]
+    if (pPeek->type == CYPHER_TOK_CREATE) {
+        CypherAst *pCreateClause = parseCreateClause(pLexer, pParser);
+        if (!pCreateClause) {
             cypherAstDestroy(pSingleQuery);
             return NULL;
         }
-        cypherAstAddChild(pSingleQuery, pReturnClause);
-    }
+        cypherAstAddChild(pSingleQuery, pCreateClause);
+    } else if (pPeek->type == CYPHER_TOK_MERGE) {
+        CypherAst *pMergeClause = parseMergeClause(pLexer, pParser);
+        if (!pMergeClause) {
+            cypherAstDestroy(pSingleQuery);
+            return NULL;
+        }
+        cypherAstAddChild(pSingleQuery, pMergeClause);
+    } else {
+        CypherAst *pMatchClause = parseMatchClause(pLexer, pParser);
+        if (!pMatchClause) {
+            cypherAstDestroy(pSingleQuery);
+            return NULL;
+        }
+        cypherAstAddChild(pSingleQuery, pMatchClause);
+
+        pPeek = parserPeekToken(pLexer);
+        if (pPeek->type == CYPHER_TOK_WHERE) {
+            CypherAst *pWhereClause = parseWhereClause(pLexer, pParser);
+            if (!pWhereClause) {
+                cypherAstDestroy(pSingleQuery);
+                return NULL;
+            }
+            cypherAstAddChild(pSingleQuery, pWhereClause);
+        }
 
-    // Consume tokens until EOF
-    CypherToken *token;
-    do {
-        token = cypherLexerNextToken(pLexer);
-    } while (token->type != CYPHER_TOK_EOF && token->type != CYPHER_TOK_ERROR);
+        pPeek = parserPeekToken(pLexer);
+        if (pPeek->type == CYPHER_TOK_RETURN) {
+            CypherAst *pReturnClause = parseReturnClause(pLexer, pParser);
+            if (!pReturnClause) {
+                cypherAstDestroy(pSingleQuery);
+                return NULL;
+            }
+            cypherAstAddChild(pSingleQuery, pReturnClause);
+        }
+    }
 
+    // Anything after the last clause is a clause this parser does not
+    // support; reject it rather than run the query without it
+    CypherToken *token = cypherLexerNextToken(pLexer);
+    if (token->type == CYPHER_TOK_SEMICOLON) token = cypherLexerNextToken(pLexer);
     if (token->type == CYPHER_TOK_ERROR) {
         parserSetError(pParser, pLexer, "Syntax error");
         cypherAstDestroy(pSingleQuery);
         return NULL;
     }
+    if (token->type != CYPHER_TOK_EOF) {
+        parserSetError(pParser, pLexer, "Unexpected or unsupported input");
+        cypherAstDestroy(pSingleQuery);
+        return NULL;
+    }
 
     return pSingleQuery;
 }
@@ -302,17 +390,136 @@ static CypherAst *parseMatchClause(CypherLexer *pLexer, CypherParser *pParser) {
     return pMatchClause;
 }
 
-static CypherAst *parsePatternList(CypherLexer *pLexer, CypherParser *pParser) {
-    CypherAst *pPatternList = cypherAstCreate(CYPHER_AST_PATTERN, 0, 0);
+static CypherAst *parseCreateClause(CypherLexer *pLexer, CypherParser *pParser) {
+    if (!parserConsumeToken(pLexer, CYPHER_TOK_CREATE)) {
+        parserSetError(pParser, pLexer, "Expected CREATE");
+        return NULL;
+    }
+    CypherAst *pCreateClause = cypherAstCreate(CYPHER_AST_CREATE, 0, 0);
+    CypherAst *pPatternList = parsePatternList(pLexer, pParser);
+    if (!pPatternList) {
+        cypherAstDestroy(pCreateClause);
+        return NULL;
+    }
+    cypherAstAddChild(pCreateClause, pPatternList);
+    return pCreateClause;
+}
+
+// mergeClause: MERGE pattern (ON (CREATE | MATCH) SET setItem (',' setItem)*)*
+static CypherAst *parseMergeClause(CypherLexer *pLexer, CypherParser *pParser) {
+    if (!parserConsumeToken(pLexer, CYPHER_TOK_MERGE)) {
+        parserSetError(pParser, pLexer, "Expected MERGE");
+        return NULL;
+    }
+    CypherAst *pMergeClause = cypherAstCreate(CYPHER_AST_MERGE, 0, 0);
     CypherAst *pPattern = parsePattern(pLexer, pParser);
     if (!pPattern) {
-        cypherAstDestroy(pPatternList);
+        cypherAstDestroy(pMergeClause);
         return NULL;
     }
-    cypherAstAddChild(pPatternList, pPattern);
+    cypherAstAddChild(pMergeClause, pPattern);
+
+    // ON is not a keyword of the lexer and arrives as an identifier
+    CypherToken *pOn = parserPeekToken(pLexer);
+    while (pOn->type == CYPHER_TOK_IDENTIFIER && pOn->len == 2 &&
+           sqlite3_strnicmp(pOn->text, "ON", 2) == 0) {
+        CypherAst *pAction = parseMergeAction(pLexer, pParser);
+        if (!pAction) {
+            cypherAstDestroy(pMergeClause);
+            return NULL;
+        }
+        cypherAstAddChild(pMergeClause, pAction);
+        pOn = parserPeekToken(pLexer);
+    }
+    return pMergeClause;
+}
+
+// mergeAction: ON (CREATE | MATCH) SET variable '.' property '=' expression (',' ...)*
+static CypherAst *parseMergeAction(CypherLexer *pLexer, CypherParser *pParser) {
+    const char *zWhen;
+
+    cypherLexerNextToken(pLexer);
+    CypherToken *pWhen = cypherLexerNextToken(pLexer);
+    if (pWhen->type == CYPHER_TOK_CREATE) {
+        zWhen = "CREATE";
+    } else if (pWhen->type == CYPHER_TOK_MATCH) {
+        zWhen = "MATCH";
+    } else {
+        parserSetError(pParser, pLexer, "Expected CREATE or MATCH after ON");
+        return NULL;
+    }
+    if (!parserConsumeToken(pLexer, CYPHER_TOK_SET)) {
+        parserSetError(pParser, pLexer, "Expected SET");
+        return NULL;
+    }
+
+    CypherAst *pAction = cypherAstCreate(CYPHER_AST_MERGE_ACTION, 0, 0);
+    cypherAstSetValue(pAction, zWhen);
+    do {
+        CypherToken *pVar = parserConsumeToken(pLexer, CYPHER_TOK_IDENTIFIER);
+        if (!pVar) {
+            parserSetError(pParser, pLexer, "Expected variable in SET");
+            cypherAstDestroy(pAction);
+            return NULL;
+        }
+        CypherAst *pVariable = parserCreateIdentifier(pVar);
+
+        CypherToken *pProp = parserConsumeToken(pLexer, CYPHER_TOK_DOT) ?
+                             parserConsumeToken(pLexer, CYPHER_TOK_IDENTIFIER) : NULL;
+        if (!pProp) {
+            parserSetError(pParser, pLexer, "Expected property in SET");
+            cypherAstDestroy(pVariable);
+            cypherAstDestroy(pAction);
+            return NULL;
+        }
+        char *zProp = parserTokenText(pProp);
+
+        if (!parserConsumeToken(pLexer, CYPHER_TOK_EQ)) {
+            parserSetError(pParser, pLexer, "Expected '=' in SET");
+            sqlite3_free(zProp);
+            cypherAstDestroy(pVariable);
+            cypherAstDestroy(pAction);
+            return NULL;
+        }
+        CypherAst *pValue = parseExpression(pLexer, pParser);
+        if (!pValue) {
+            parserSetError(pParser, pLexer, "Expected property value expression");
+            sqlite3_free(zProp);
+            cypherAstDestroy(pVariable);
+            cypherAstDestroy(pAction);
+            return NULL;
+        }
+
+        CypherAst *pPair = cypherAstCreate(CYPHER_AST_PROPERTY_PAIR, 0, 0);
+        cypherAstSetValue(pPair, zProp);
+        sqlite3_free(zProp);
+        cypherAstAddChild(pPair, pValue);
+        cypherAstAddChild(pPair, pVariable);
+        cypherAstAddChild(pAction, pPair);
+
+        if (parserPeekToken(pLexer)->type != CYPHER_TOK_COMMA) break;
+        parserConsumeToken(pLexer, CYPHER_TOK_COMMA);
+    } while (1);
+    return pAction;
+}
+
+// patternList: pattern (',' pattern)*
+static CypherAst *parsePatternList(CypherLexer *pLexer, CypherParser *pParser) {
+    CypherAst *pPatternList = cypherAstCreate(CYPHER_AST_PATTERN, 0, 0);
+    do {
+        CypherAst *pPattern = parsePattern(pLexer, pParser);
+        if (!pPattern) {
+            cypherAstDestroy(pPatternList);
+            return NULL;
+        }
+        cypherAstAddChild(pPatternList, pPattern);
+        if (parserPeekToken(pLexer)->type != CYPHER_TOK_COMMA) break;
+        parserConsumeToken(pLexer, CYPHER_TOK_COMMA);
+    } while (1);
     return pPatternList;
 }
 
+// pattern: nodePattern (relationshipPattern nodePattern)*
 static CypherAst *parsePattern(CypherLexer *pLexer, CypherParser *pParser) {
     CypherAst *pPattern = cypherAstCreate(CYPHER_AST_PATTERN, 0, 0);
     CypherAst *pNodePattern = parseNodePattern(pLexer, pParser);
@@ -321,6 +528,23 @@ static CypherAst *parsePattern(CypherLexer *pLexer, CypherParser *pParser) {
         return NULL;
     }
     cypherAstAddChild(pPattern, pNodePattern);
+
+    while (parserPeekToken(pLexer)->type == CYPHER_TOK_MINUS ||
+           parserPeekToken(pLexer)->type == CYPHER_TOK_ARROW_LEFT ||
+           parserPeekToken(pLexer)->type == CYPHER_TOK_ARROW_BOTH) {
+        CypherAst *pRelPattern = parseRelationshipPattern(pLexer, pParser);
+        if (!pRelPattern) {
+            cypherAstDestroy(pPattern);
+            return NULL;
+        }
+        cypherAstAddChild(pPattern, pRelPattern);
+        pNodePattern = parseNodePattern(pLexer, pParser);
+        if (!pNodePattern) {
+            cypherAstDestroy(pPattern);
+            return NULL;
+        }
+        cypherAstAddChild(pPattern, pNodePattern);
+    }
     return pPattern;
 }
 
@@ -330,9 +554,9 @@ static CypherAst *parseNodePattern(CypherLexer *pLexer, CypherParser *pParser) {
         return NULL;
     }
     CypherAst *pNodePattern = cypherAstCreate(CYPHER_AST_NODE_PATTERN, 0, 0);
-    CypherToken *pId = parserConsumeToken(pLexer, CYPHER_TOK_IDENTIFIER);
-    if (pId) {
-        cypherAstAddChild(pNodePattern, cypherAstCreateIdentifier(pId->text, pId->line, pId->column));
+    // The variable is optional: () and (:Label) are anonymous nodes
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_IDENTIFIER) {
+        cypherAstAddChild(pNodePattern, parserCreateIdentifier(cypherLexerNextToken(pLexer)));
     }
 
     CypherAst *pLabels = parseNodeLabels(pLexer, pParser);
@@ -369,7 +593,7 @@ static CypherAst *parseNodeLabels(CypherLexer *pLexer, CypherParser *pParser) {
         parserSetError(pParser, pLexer, "Expected node label after ':'");
         return NULL;
     }
-    return cypherAstCreateNodeLabel(pLabel->text, pLabel->line, pLabel->column);
+    return parserCreateTokenNode(CYPHER_AST_LABELS, pLabel);
 }
 
 static CypherAst *parsePropertyMap(CypherLexer *pLexer, CypherParser *pParser) {
@@ -395,10 +619,12 @@ static CypherAst *parsePropertyMap(CypherLexer *pLexer, CypherParser *pParser) {
             cypherAstDestroy(pMap);
             return NULL;
         }
+        char *zKey = parserTokenText(pKey);
         
         // Parse colon
         if (!parserConsumeToken(pLexer, CYPHER_TOK_COLON)) {
             parserSetError(pParser, pLexer, "Expected ':' after property name");
+            sqlite3_free(zKey);
             cypherAstDestroy(pMap);
             return NULL;
         }
@@ -407,13 +633,15 @@ static CypherAst *parsePropertyMap(CypherLexer *pLexer, CypherParser *pParser) {
         CypherAst *pValue = parseExpression(pLexer, pParser);
         if (!pValue) {
             parserSetError(pParser, pLexer, "Expected property value expression");
+            sqlite3_free(zKey);
             cypherAstDestroy(pMap);
             return NULL;
         }
         
         // Create property pair
-        CypherAst *pPair = cypherAstCreate(CYPHER_AST_PROPERTY_PAIR, pKey->line, pKey->column);
-        cypherAstSetValue(pPair, pKey->text);
+        CypherAst *pPair = cypherAstCreate(CYPHER_AST_PROPERTY_PAIR, 0, 0);
+        cypherAstSetValue(pPair, zKey);
+        sqlite3_free(zKey);
         cypherAstAddChild(pPair, pValue);
         cypherAstAddChild(pMap, pPair);
         
@@ -435,39 +663,114 @@ static CypherAst *parsePropertyMap(CypherLexer *pLexer, CypherParser *pParser) {
     return pMap;
 }
 
-/* Currently unused - reserved for future relationship pattern parsing
+// relationshipPattern: ('-' | '<-') ('[' variable? (':' type)? range? map? ']')? ('-' | '->')
+// The REL_PATTERN value is its direction: "->", "<-" or "-" when the
+// pattern has no arrow or arrows at both ends.
 static CypherAst *parseRelationshipPattern(CypherLexer *pLexer, CypherParser *pParser) {
-    CypherToken *pArrow = parserConsumeToken(pLexer, CYPHER_TOK_ARROW_RIGHT);
-    if (!pArrow) {
-        pArrow = parserConsumeToken(pLexer, CYPHER_TOK_ARROW_LEFT);
-    }
-    if (!pArrow) {
+    int bLeft = 0;
+    int bRight = 0;
+
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_ARROW_BOTH) {
+        parserConsumeToken(pLexer, CYPHER_TOK_ARROW_BOTH);
+        CypherAst *pBoth = cypherAstCreate(CYPHER_AST_REL_PATTERN, 0, 0);
+        cypherAstSetValue(pBoth, "-");
+        return pBoth;
+    }
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_ARROW_LEFT) {
+        parserConsumeToken(pLexer, CYPHER_TOK_ARROW_LEFT);
+        bLeft = 1;
+    } else if (!parserConsumeToken(pLexer, CYPHER_TOK_MINUS)) {
+        parserSetError(pParser, pLexer, "Expected relationship pattern");
         return NULL;
     }
 
-    CypherAst *pRelPattern = cypherAstCreate(CYPHER_AST_REL_PATTERN, pArrow->line, pArrow->column);
-    cypherAstSetValue(pRelPattern, pArrow->text);
+    CypherAst *pRelPattern = cypherAstCreate(CYPHER_AST_REL_PATTERN, 0, 0);
+    if (!pRelPattern) return NULL;
 
-    if (!parserConsumeToken(pLexer, CYPHER_TOK_LBRACKET)) {
-        parserSetError(pParser, pLexer, "Expected [");
-        cypherAstDestroy(pRelPattern);
-        return NULL;
-    }
-
-    CypherToken *pId = parserConsumeToken(pLexer, CYPHER_TOK_IDENTIFIER);
-    if (pId) {
-        cypherAstAddChild(pRelPattern, cypherAstCreateIdentifier(pId->text, pId->line, pId->column));
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_LBRACKET) {
+        parserConsumeToken(pLexer, CYPHER_TOK_LBRACKET);
+        if (parserPeekToken(pLexer)->type == CYPHER_TOK_IDENTIFIER) {
+            cypherAstAddChild(pRelPattern, parserCreateIdentifier(cypherLexerNextToken(pLexer)));
+        }
+        if (parserPeekToken(pLexer)->type == CYPHER_TOK_COLON) {
+            CypherAst *pType = parseNodeLabels(pLexer, pParser);
+            if (!pType) {
+                cypherAstDestroy(pRelPattern);
+                return NULL;
+            }
+            cypherAstAddChild(pRelPattern, pType);
+        }
+        if (parserPeekToken(pLexer)->type == CYPHER_TOK_MULT) {
+            CypherAst *pRange = parseRelationshipRange(pLexer, pParser);
+            if (!pRange) {
+                cypherAstDestroy(pRelPattern);
+                return NULL;
+            }
+            cypherAstAddChild(pRelPattern, pRange);
+        }
+        if (parserPeekToken(pLexer)->type == CYPHER_TOK_LBRACE) {
+            CypherAst *pProperties = parsePropertyMap(pLexer, pParser);
+            if (!pProperties) {
+                cypherAstDestroy(pRelPattern);
+                return NULL;
+            }
+            cypherAstAddChild(pRelPattern, pProperties);
+        }
+        if (!parserConsumeToken(pLexer, CYPHER_TOK_RBRACKET)) {
+            parserSetError(pParser, pLexer, "Expected ]");
+            cypherAstDestroy(pRelPattern);
+            return NULL;
+        }
     }
 
-    if (!parserConsumeToken(pLexer, CYPHER_TOK_RBRACKET)) {
-        parserSetError(pParser, pLexer, "Expected ]");
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_ARROW_RIGHT) {
+        parserConsumeToken(pLexer, CYPHER_TOK_ARROW_RIGHT);
+        bRight = 1;
+    } else if (!parserConsumeToken(pLexer, CYPHER_TOK_MINUS)) {
+        parserSetError(pParser, pLexer, "Expected - or -> to close relationship pattern");
         cypherAstDestroy(pRelPattern);
         return NULL;
     }
 
+    cypherAstSetValue(pRelPattern, bLeft == bRight ? "-" : (bLeft ? "<-" : "->"));
     return pRelPattern;
 }
-*/
+
+// range: '*' INTEGER? ('..' INTEGER?)?
+// The RANGE value keeps the bounds as written ("*", "*2", "*1..3",
+// "*..3"), to be read back with cypherParsePathBounds().
+static CypherAst *parseRelationshipRange(CypherLexer *pLexer, CypherParser *pParser) {
+    char *zMin = NULL;
+    char *zMax = NULL;
+    char *zBounds;
+    int bDots = 0;
+
+    parserConsumeToken(pLexer, CYPHER_TOK_MULT);
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_INTEGER) {
+        zMin = parserTokenText(cypherLexerNextToken(pLexer));
+    }
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_DOT) {
+        parserConsumeToken(pLexer, CYPHER_TOK_DOT);
+        if (!parserConsumeToken(pLexer, CYPHER_TOK_DOT)) {
+            parserSetError(pParser, pLexer, "Expected .. in relationship range");
+            sqlite3_free(zMin);
+            return NULL;
+        }
+        bDots = 1;
+        if (parserPeekToken(pLexer)->type == CYPHER_TOK_INTEGER) {
+            zMax = parserTokenText(cypherLexerNextToken(pLexer));
+        }
+    }
+
+    zBounds = sqlite3_mprintf("*%s%s%s", zMin ? zMin : "", bDots ? ".." : "", zMax ? zMax : "");
+    sqlite3_free(zMin);
+    sqlite3_free(zMax);
+    if (!zBounds) return NULL;
+
+    CypherAst *pRange = cypherCreateVariableLengthPath(NULL, zBounds);
+    sqlite3_free(zBounds);
+    return pRange;
+}
 
 static CypherAst *parseWhereClause(CypherLexer *pLexer, CypherParser *pParser) {
     if (!parserConsumeToken(pLexer, CYPHER_TOK_WHERE)) {
@@ -495,20 +798,96 @@ static CypherAst *parseReturnClause(CypherLexer *pLexer, CypherParser *pParser)
         return NULL;
     }
     cypherAstAddChild(pReturnClause, pProjectionList);
+
+    // ORDER BY, SKIP and LIMIT follow the items, in that order
+    CypherAst *pModifier;
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_ORDER) {
+        pModifier = parseOrderBy(pLexer, pParser);
+        if (!pModifier) goto return_error;
+        cypherAstAddChild(pReturnClause, pModifier);
+    }
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_SKIP) {
+        pModifier = parseRowCount(pLexer, pParser, CYPHER_TOK_SKIP, CYPHER_AST_SKIP);
+        if (!pModifier) goto return_error;
+        cypherAstAddChild(pReturnClause, pModifier);
+    }
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_LIMIT) {
+        pModifier = parseRowCount(pLexer, pParser, CYPHER_TOK_LIMIT, CYPHER_AST_LIMIT);
+        if (!pModifier) goto return_error;
+        cypherAstAddChild(pReturnClause, pModifier);
+    }
     return pReturnClause;
+
+return_error:
+    cypherAstDestroy(pReturnClause);
+    return NULL;
 }
 
-static CypherAst *parseProjectionList(CypherLexer *pLexer, CypherParser *pParser) {
-    CypherAst *pProjectionList = cypherAstCreate(CYPHER_AST_PROJECTION_LIST, 0, 0);
-    CypherAst *pProjectionItem = parseProjectionItem(pLexer, pParser);
-    if (!pProjectionItem) {
-        cypherAstDestroy(pProjectionList);
+// orderBy: ORDER BY sortItem (',' sortItem)*
+// sortItem: expression (ASC | DESC)?, the direction as the item's value
+static CypherAst *parseOrderBy(CypherLexer *pLexer, CypherParser *pParser) {
+    parserConsumeToken(pLexer, CYPHER_TOK_ORDER);
+    if (!parserConsumeToken(pLexer, CYPHER_TOK_BY)) {
+        parserSetError(pParser, pLexer, "Expected BY after ORDER");
         return NULL;
     }
-    cypherAstAddChild(pProjectionList, pProjectionItem);
+    CypherAst *pOrderBy = cypherAstCreate(CYPHER_AST_ORDER_BY, 0, 0);
+    do {
+        CypherAst *pSortItem = cypherAstCreate(CYPHER_AST_SORT_ITEM, 0, 0);
+        CypherAst *pExpr = parseExpression(pLexer, pParser);
+        if (!pExpr) {
+            if (!pParser->zErrorMsg) parserSetError(pParser, pLexer, "Expected ORDER BY expression");
+            cypherAstDestroy(pSortItem);
+            cypherAstDestroy(pOrderBy);
+            return NULL;
+        }
+        cypherAstAddChild(pSortItem, pExpr);
+        CypherToken *pToken = parserPeekToken(pLexer);
+        if (pToken->type == CYPHER_TOK_ASC || pToken->type == CYPHER_TOK_DESC) {
+            parserSetTokenValue(pSortItem, cypherLexerNextToken(pLexer));
+        }
+        cypherAstAddChild(pOrderBy, pSortItem);
+        if (parserPeekToken(pLexer)->type != CYPHER_TOK_COMMA) break;
+        parserConsumeToken(pLexer, CYPHER_TOK_COMMA);
+    } while (1);
+    return pOrderBy;
+}
+
+// skip: SKIP expression, limit: LIMIT expression
+static CypherAst *parseRowCount(CypherLexer *pLexer, CypherParser *pParser,
+                                CypherTokenType eToken, CypherAstNodeType eType) {
+    parserConsumeToken(pLexer, eToken);
+    CypherAst *pRowCount = cypherAstCreate(eType, 0, 0);
+    CypherAst *pExpr = parseExpression(pLexer, pParser);
+    if (!pExpr) {
+        if (!pParser->zErrorMsg) {
+            parserSetError(pParser, pLexer, "Expected %s count",
+                           eToken == CYPHER_TOK_SKIP ? "SKIP" : "LIMIT");
+        }
+        cypherAstDestroy(pRowCount);
+        return NULL;
+    }
+    cypherAstAddChild(pRowCount, pExpr);
+    return pRowCount;
+}
+
+// projectionList: projectionItem (',' projectionItem)*
+static CypherAst *parseProjectionList(CypherLexer *pLexer, CypherParser *pParser) {
+    CypherAst *pProjectionList = cypherAstCreate(CYPHER_AST_PROJECTION_LIST, 0, 0);
+    do {
+        CypherAst *pProjectionItem = parseProjectionItem(pLexer, pParser);
+        if (!pProjectionItem) {
+            cypherAstDestroy(pProjectionList);
+            return NULL;
+        }
+        cypherAstAddChild(pProjectionList, pProjectionItem);
+        if (parserPeekToken(pLexer)->type != CYPHER_TOK_COMMA) break;
+        parserConsumeToken(pLexer, CYPHER_TOK_COMMA);
+    } while (1);
     return pProjectionList;
 }
 
+// projectionItem: expression ('AS' identifier)?, the alias as second child
 static CypherAst *parseProjectionItem(CypherLexer *pLexer, CypherParser *pParser) {
     CypherAst *pProjectionItem = cypherAstCreate(CYPHER_AST_PROJECTION_ITEM, 0, 0);
     CypherAst *pExpr = parseExpression(pLexer, pParser);
@@ -517,6 +896,16 @@ static CypherAst *parseProjectionItem(CypherLexer *pLexer, CypherParser *pParser
         return NULL;
     }
     cypherAstAddChild(pProjectionItem, pExpr);
+    if (parserPeekToken(pLexer)->type == CYPHER_TOK_AS) {
+        parserConsumeToken(pLexer, CYPHER_TOK_AS);
+        CypherToken *pAlias = parserConsumeToken(pLexer, CYPHER_TOK_IDENTIFIER);
+        if (!pAlias) {
+            cypherAstDestroy(pProjectionItem);
+            parserSetError(pParser, pLexer, "Expected alias after AS");
+            return NULL;
+        }
+        cypherAstAddChild(pProjectionItem, parserCreateIdentifier(pAlias));
+    }
     return pProjectionItem;
 }
 
@@ -537,8 +926,6 @@ static CypherAst *parseOrExpression(CypherLexer *pLexer, CypherParser *pParser)
             return NULL;
         }
         CypherAst *pOrExpr = cypherAstCreateBinaryOp("OR", pLeft, pRight, 0, 0);
-        cypherAstAddChild(pOrExpr, pLeft);
-        cypherAstAddChild(pOrExpr, pRight);
         pLeft = pOrExpr;
     }
     return pLeft;
@@ -590,15 +977,16 @@ static CypherAst *parseComparisonExpression(CypherLexer *pLexer, CypherParser *p
            pToken->type == CYPHER_TOK_GT || pToken->type == CYPHER_TOK_GE ||
            pToken->type == CYPHER_TOK_STARTS_WITH || pToken->type == CYPHER_TOK_ENDS_WITH ||
            pToken->type == CYPHER_TOK_CONTAINS || pToken->type == CYPHER_TOK_IN) {
+        CypherAst *pCompExpr = cypherAstCreate(CYPHER_AST_COMPARISON, 0, 0);
+        parserSetTokenValue(pCompExpr, pToken);
         parserConsumeToken(pLexer, pToken->type);
         CypherAst *pRight = parseAdditiveExpression(pLexer, pParser);
         if (!pRight) {
+            cypherAstDestroy(pCompExpr);
             cypherAstDestroy(pLeft);
             parserSetError(pParser, pLexer, "Expected expression after comparison operator");
             return NULL;
         }
-        CypherAst *pCompExpr = cypherAstCreate(CYPHER_AST_COMPARISON, 0, 0);
-        cypherAstSetValue(pCompExpr, pToken->text);
         cypherAstAddChild(pCompExpr, pLeft);
         cypherAstAddChild(pCompExpr, pRight);
         pLeft = pCompExpr;
@@ -613,15 +1001,16 @@ static CypherAst *parseAdditiveExpression(CypherLexer *pLexer, CypherParser *pPa
 
     CypherToken *pToken = parserPeekToken(pLexer);
     while (pToken->type == CYPHER_TOK_PLUS || pToken->type == CYPHER_TOK_MINUS) {
+        CypherAst *pAddExpr = cypherAstCreate(CYPHER_AST_ADDITIVE, 0, 0);
+        parserSetTokenValue(pAddExpr, pToken);
         parserConsumeToken(pLexer, pToken->type);
         CypherAst *pRight = parseMultiplicativeExpression(pLexer, pParser);
         if (!pRight) {
+            cypherAstDestroy(pAddExpr);
             cypherAstDestroy(pLeft);
             parserSetError(pParser, pLexer, "Expected expression after additive operator");
             return NULL;
         }
-        CypherAst *pAddExpr = cypherAstCreate(CYPHER_AST_ADDITIVE, 0, 0);
-        cypherAstSetValue(pAddExpr, pToken->text);
         cypherAstAddChild(pAddExpr, pLeft);
         cypherAstAddChild(pAddExpr, pRight);
         pLeft = pAddExpr;
@@ -636,15 +1025,16 @@ static CypherAst *parseMultiplicativeExpression(CypherLexer *pLexer, CypherParse
 
     CypherToken *pToken = parserPeekToken(pLexer);
     while (pToken->type == CYPHER_TOK_MULT || pToken->type == CYPHER_TOK_DIV || pToken->type == CYPHER_TOK_MOD) {
+        CypherAst *pMulExpr = cypherAstCreate(CYPHER_AST_MULTIPLICATIVE, 0, 0);
+        parserSetTokenValue(pMulExpr, pToken);
         parserConsumeToken(pLexer, pToken->type);
         CypherAst *pRight = parseUnaryExpression(pLexer, pParser);
         if (!pRight) {
+            cypherAstDestroy(pMulExpr);
             cypherAstDestroy(pLeft);
             parserSetError(pParser, pLexer, "Expected expression after multiplicative operator");
             return NULL;
         }
-        CypherAst *pMulExpr = cypherAstCreate(CYPHER_AST_MULTIPLICATIVE, 0, 0);
-        cypherAstSetValue(pMulExpr, pToken->text);
         cypherAstAddChild(pMulExpr, pLeft);
         cypherAstAddChild(pMulExpr, pRight);
         pLeft = pMulExpr;
@@ -656,14 +1046,17 @@ static CypherAst *parseMultiplicativeExpression(CypherLexer *pLexer, CypherParse
 static CypherAst *parseUnaryExpression(CypherLexer *pLexer, CypherParser *pParser) {
     CypherToken *pToken = parserPeekToken(pLexer);
     if (pToken->type == CYPHER_TOK_PLUS || pToken->type == CYPHER_TOK_MINUS) {
+        char *zOp = parserTokenText(pToken);
         parserConsumeToken(pLexer, pToken->type);
         CypherAst *pExpr = parseUnaryExpression(pLexer, pParser);
         if (!pExpr) {
+            sqlite3_free(zOp);
             parserSetError(pParser, pLexer, "Expected expression after unary operator");
             return NULL;
         }
-        CypherAst *pUnaryExpr = cypherAstCreateUnaryOp(pToken->text, pExpr, 0, 0);
-        cypherAstSetValue(pUnaryExpr, pToken->text);
+        CypherAst *pUnaryExpr = cypherAstCreateUnaryOp(zOp, pExpr, 0, 0);
+        cypherAstSetValue(pUnaryExpr, zOp);
+        sqlite3_free(zOp);
         cypherAstAddChild(pUnaryExpr, pExpr);
         return pUnaryExpr;
     }
@@ -697,7 +1090,7 @@ static CypherAst *parsePropertyExpression(CypherLexer *pLexer, CypherParser *pPa
         }
         CypherAst *pPropExpr = cypherAstCreate(CYPHER_AST_PROPERTY, 0, 0);
         cypherAstAddChild(pPropExpr, pExpr);
-        cypherAstAddChild(pPropExpr, cypherAstCreateIdentifier(pProperty->text, pProperty->line, pProperty->column));
+        cypherAstAddChild(pPropExpr, parserCreateIdentifier(pProperty));
         pExpr = pPropExpr;
         pToken = parserPeekToken(pLexer);
     }
@@ -730,10 +1123,23 @@ static CypherAst *parseLiteral(CypherLexer *pLexer, CypherParser *pParser) {
         return pExpr;
     }
     
+    // Handle parameters $name and $0
+    if (pToken->type == CYPHER_TOK_DOLLAR) {
+        parserConsumeToken(pLexer, CYPHER_TOK_DOLLAR);
+        pToken = cypherLexerNextToken(pLexer);
+        if (pToken->type != CYPHER_TOK_IDENTIFIER && pToken->type != CYPHER_TOK_INTEGER) {
+            parserSetError(pParser, pLexer, "Expected parameter name after '$'");
+            return NULL;
+        }
+        CypherAst *pParam = cypherAstCreate(CYPHER_AST_PARAMETER, pToken->line, pToken->column);
+        if (pParam) parserSetTokenValue(pParam, pToken);
+        return pParam;
+    }
+
     // Handle identifiers separately from literals
     if (pToken->type == CYPHER_TOK_IDENTIFIER) {
         pToken = cypherLexerNextToken(pLexer);
-        return cypherAstCreateIdentifier(pToken->text, pToken->line, pToken->column);
+        return parserCreateIdentifier(pToken);
     }
     
     // Handle basic literals
@@ -741,7 +1147,7 @@ static CypherAst *parseLiteral(CypherLexer *pLexer, CypherParser *pParser) {
         pToken->type == CYPHER_TOK_STRING || pToken->type == CYPHER_TOK_BOOLEAN || 
         pToken->type == CYPHER_TOK_NULL) {
         pToken = cypherLexerNextToken(pLexer);
-        return cypherAstCreateLiteral(pToken->text, pToken->line, pToken->column);
+        return parserCreateLiteral(pToken);
     }
     
     return NULL;
@@ -812,7 +1218,7 @@ static CypherAst *parseMapLiteral(CypherLexer *pLexer, CypherParser *pParser) {
             return NULL;
         }
         pToken = cypherLexerNextToken(pLexer);
-        CypherAst *pKey = cypherAstCreateLiteral(pToken->text, pToken->line, pToken->column);
+        CypherAst *pKey = parserCreateLiteral(pToken);
         
         // Expect colon
         if (!parserConsumeToken(pLexer, CYPHER_TOK_COLON)) {
@@ -869,6 +1275,18 @@ static CypherAst *parseFunctionCall(CypherLexer *pLexer, CypherParser *pParser,
         return pFunctionCall;
     }
     
+    // count(*): no arguments, the call's value is "*"
+    if (pToken->type == CYPHER_TOK_MULT) {
+        parserConsumeToken(pLexer, CYPHER_TOK_MULT);
+        if (!parserConsumeToken(pLexer, CYPHER_TOK_RPAREN)) {
+            cypherAstDestroy(pFunctionCall);
+            parserSetError(pParser, pLexer, "Expected closing parenthesis");
+            return NULL;
+        }
+        cypherAstSetValue(pFunctionCall, "*");
+        return pFunctionCall;
+    }
+    
     // Parse function arguments
     do {
         CypherAst *pArg = parseExpression(pLexer, pParser);
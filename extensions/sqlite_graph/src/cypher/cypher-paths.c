@@ -0,0 +1,354 @@
+/*
+** SQLite Graph Database Extension - Variable-Length Paths
+**
+** Bounds parsing and the depth-first path search behind variable-length
+** relationship patterns such as (a)-[:KNOWS*1..3]->(b). See cypher-paths.h.
+**
+** The search is iterative. Each node on the current path owns a level:
+** the range of its unvisited neighbors in one shared step array, read
+** from the covering edge index of the direction with one prepared
+** statement per direction. A neighbor already on the path is skipped, so
+** a path never revisits a node. Callers searching from many start nodes
+** pass a PathStmts so the statements are prepared once, not per search.
+**
+** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
+** Error handling: Functions return SQLite error codes
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "cypher-paths.h"
+#include <string.h>
+
+/* Largest hop count accepted in a bounds pattern */
+#define PATH_MAX_BOUND 1000000
+
+/* One candidate edge out of a path node */
+typedef struct PathStep {
+    sqlite3_int64 iNode;            /* Node the edge reaches */
+    sqlite3_int64 iEdge;            /* Edge id */
+    double rWeight;                 /* Edge weight, 1.0 if NULL */
+} PathStep;
+
+/* Candidates of one path node: aStep[iFirst..iEnd-1], next at iNext */
+typedef struct PathLevel {
+    int iFirst;
+    int iNext;
+    int iEnd;
+} PathLevel;
+
+typedef struct PathSearch {
+    PathMatchContext ctx;           /* visitedNodes holds the current path */
+    sqlite3_int64 endNode;          /* Required last node, <0 for any */
+    PathStmts *pStmts;              /* Adjacency statements */
+    sqlite3_int64 *aEdge;           /* Edge into each path node */
+    double *aWeight;                /* Weight of aEdge[i] */
+    PathLevel *aLevel;              /* Level of each expanded path node */
+    int nLevel;
+    PathStep *aStep;                /* Candidates of all levels */
+    int nStep;
+    int nStepAlloc;
+    PathResult *pFirst;             /* Paths found so far */
+    PathResult **ppLast;
+    sqlite3_int64 nStepped;         /* sqlite3_step() calls made */
+} PathSearch;
+
+static int pathParseInt(const char **pz) {
+    const char *z = *pz;
+    int n = 0;
+
+    while (*z >= '0' && *z <= '9') {
+        if (n < PATH_MAX_BOUND) n = n * 10 + (*z - '0');
+        z++;
+    }
+    *pz = z;
+    return n < PATH_MAX_BOUND ? n : PATH_MAX_BOUND;
+}
+
+PathBounds cypherParsePathBounds(const char *pattern) {
+    PathBounds bounds;
+    const char *z = pattern;
+
+    bounds.minLength = 1;
+    bounds.maxLength = pattern ? -1 : 1;
+    bounds.isOptional = 0;
+    if (!z) return bounds;
+
+    if (*z == '*') z++;
+    if (*z >= '0' && *z <= '9') {
+        bounds.minLength = pathParseInt(&z);
+        if (z[0] != '.' || z[1] != '.') bounds.maxLength = bounds.minLength;
+    }
+    if (z[0] == '.' && z[1] == '.') {
+        z += 2;
+        if (*z >= '0' && *z <= '9') bounds.maxLength = pathParseInt(&z);
+    }
+    bounds.isOptional = bounds.minLength == 0;
+    return bounds;
+}
+
+CypherAst *cypherCreateVariableLengthPath(CypherAst *relPattern, const char *boundsStr) {
+    CypherAst *pRange = cypherAstCreate(CYPHER_AST_RANGE, 0, 0);
+
+    if (!pRange) return NULL;
+    cypherAstSetValue(pRange, boundsStr ? boundsStr : "*");
+    if (!pRange->zValue) {
+        cypherAstDestroy(pRange);
+        return NULL;
+    }
+    if (relPattern) cypherAstAddChild(relPattern, pRange);
+    return pRange;
+}
+
+/*
+** Prepare one adjacency statement per direction: the far endpoint, id
+** and weight of the edges leaving (bIn==0) or entering ?1. The second
+** arm of an undirected search skips self-loops, which the first has
+** already returned.
+*/
+static int pathPrepare(PathSearch *p, const char *relType, int eDirection) {
+    GraphVtab *pGraph = p->ctx.pGraph;
+    PathStmts *pStmts = p->pStmts;
+    int bIn;
+    int rc = SQLITE_OK;
+
+    if (pStmts->nStmt > 0) return SQLITE_OK;
+    for (bIn = 0; bIn < 2 && rc == SQLITE_OK; bIn++) {
+        char *zSql;
+
+        if (bIn ? eDirection == GRAPH_EXPAND_OUT : eDirection == GRAPH_EXPAND_IN) continue;
+        zSql = sqlite3_mprintf("SELECT %s, id, weight FROM \"%w\" WHERE %s=?1%s%s",
+                               bIn ? "source" : "target", pGraph->zEdgeTableName,
+                               bIn ? "target" : "source",
+                               relType ? " AND edge_type=?2" : "",
+                               (bIn && pStmts->nStmt > 0) ? " AND source<>target" : "");
+        if (!zSql) return SQLITE_NOMEM;
+        rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmts->apStmt[pStmts->nStmt], 0);
+        sqlite3_free(zSql);
+        if (rc == SQLITE_OK && relType) {
+            rc = sqlite3_bind_text(pStmts->apStmt[pStmts->nStmt], 2, relType, -1,
+                                   SQLITE_TRANSIENT);
+        }
+        if (pStmts->apStmt[pStmts->nStmt]) pStmts->nStmt++;
+    }
+    if (rc != SQLITE_OK) cypherPathStmtsFinalize(pStmts);
+    return rc;
+}
+
+void cypherPathStmtsFinalize(PathStmts *pStmts) {
+    int i;
+
+    for (i = 0; i < pStmts->nStmt; i++) sqlite3_finalize(pStmts->apStmt[i]);
+    memset(pStmts, 0, sizeof(PathStmts));
+}
+
+/* Append iNode, reached over iEdge, to the current path */
+static int pathPush(PathSearch *p, sqlite3_int64 iNode, sqlite3_int64 iEdge, double rWeight) {
+    PathMatchContext *pCtx = &p->ctx;
+
+    if (pCtx->nVisited >= pCtx->nAllocated) {
+        int nNew = pCtx->nAllocated ? pCtx->nAllocated * 2 : 16;
+        sqlite3_int64 *aNode = sqlite3_realloc(pCtx->visitedNodes, nNew * sizeof(sqlite3_int64));
+        if (!aNode) return SQLITE_NOMEM;
+        pCtx->visitedNodes = aNode;
+        aNode = sqlite3_realloc(p->aEdge, nNew * sizeof(sqlite3_int64));
+        if (!aNode) return SQLITE_NOMEM;
+        p->aEdge = aNode;
+        double *aWeight = sqlite3_realloc(p->aWeight, nNew * sizeof(double));
+        if (!aWeight) return SQLITE_NOMEM;
+        p->aWeight = aWeight;
+        PathLevel *aLevel = sqlite3_realloc(p->aLevel, nNew * sizeof(PathLevel));
+        if (!aLevel) return SQLITE_NOMEM;
+        p->aLevel = aLevel;
+        pCtx->nAllocated = nNew;
+    }
+    pCtx->visitedNodes[pCtx->nVisited] = iNode;
+    p->aEdge[pCtx->nVisited] = iEdge;
+    p->aWeight[pCtx->nVisited] = rWeight;
+    pCtx->nVisited++;
+    return SQLITE_OK;
+}
+
+static int pathOnPath(PathSearch *p, sqlite3_int64 iNode) {
+    int i;
+
+    for (i = 0; i < p->ctx.nVisited; i++) {
+        if (p->ctx.visitedNodes[i] == iNode) return 1;
+    }
+    return 0;
+}
+
+/* Add the current path to the results */
+static int pathEmit(PathSearch *p) {
+    PathMatchContext *pCtx = &p->ctx;
+    int nEdge = pCtx->nVisited - 1;
+    PathResult *pPath;
+    int i;
+
+    pPath = sqlite3_malloc(sizeof(PathResult));
+    if (!pPath) return SQLITE_NOMEM;
+    memset(pPath, 0, sizeof(PathResult));
+    pPath->nodeIds = sqlite3_malloc(pCtx->nVisited * sizeof(sqlite3_int64));
+    if (nEdge > 0) pPath->edgeIds = sqlite3_malloc(nEdge * sizeof(sqlite3_int64));
+    if (!pPath->nodeIds || (nEdge > 0 && !pPath->edgeIds)) {
+        cypherPathResultFree(pPath);
+        return SQLITE_NOMEM;
+    }
+    memcpy(pPath->nodeIds, pCtx->visitedNodes, pCtx->nVisited * sizeof(sqlite3_int64));
+    for (i = 0; i < nEdge; i++) {
+        pPath->edgeIds[i] = p->aEdge[i + 1];
+        pPath->totalWeight += p->aWeight[i + 1];
+    }
+    pPath->pathLength = nEdge;
+
+    *p->ppLast = pPath;
+    p->ppLast = &pPath->pNext;
+    return SQLITE_OK;
+}
+
+/* Read the neighbors of the last path node into a new level */
+static int pathExpand(PathSearch *p) {
+    sqlite3_int64 iNode = p->ctx.visitedNodes[p->ctx.nVisited - 1];
+    PathLevel *pLevel = &p->aLevel[p->nLevel];
+    int i, rc = SQLITE_OK;
+
+    pLevel->iFirst = pLevel->iNext = p->nStep;
+    for (i = 0; i < p->pStmts->nStmt && rc == SQLITE_OK; i++) {
+        sqlite3_stmt *pStmt = p->pStmts->apStmt[i];
+
+        sqlite3_bind_int64(pStmt, 1, iNode);
+        while ((p->nStepped++, rc = sqlite3_step(pStmt)) == SQLITE_ROW) {
+            PathStep *pStep;
+
+            if (p->nStep >= p->nStepAlloc) {
+                int nNew = p->nStepAlloc ? p->nStepAlloc * 2 : 64;
+                PathStep *aNew = sqlite3_realloc(p->aStep, nNew * sizeof(PathStep));
+                if (!aNew) {
+                    rc = SQLITE_NOMEM;
+                    break;
+                }
+                p->aStep = aNew;
+                p->nStepAlloc = nNew;
+            }
+            pStep = &p->aStep[p->nStep++];
+            pStep->iNode = sqlite3_column_int64(pStmt, 0);
+            pStep->iEdge = sqlite3_column_int64(pStmt, 1);
+            pStep->rWeight = sqlite3_column_type(pStmt, 2) == SQLITE_NULL ?
+                             1.0 : sqlite3_column_double(pStmt, 2);
+        }
+        sqlite3_reset(pStmt);
+        if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    }
+    pLevel->iEnd = p->nStep;
+    p->nLevel++;
+    return rc;
+}
+
+/*
+** The last path node was just reached: report the path if it qualifies
+** and either expand the node or take it off the path again. Paths go no
+** further than maxLength, nor past the node they must end at.
+*/
+static int pathVisit(PathSearch *p) {
+    PathMatchContext *pCtx = &p->ctx;
+    sqlite3_int64 iNode = pCtx->visitedNodes[pCtx->nVisited - 1];
+    int bEnd = p->endNode >= 0 && iNode == p->endNode;
+    int rc = SQLITE_OK;
+
+    pCtx->currentDepth = pCtx->nVisited - 1;
+    if (pCtx->currentDepth >= pCtx->bounds.minLength && (p->endNode < 0 || bEnd)) {
+        rc = pathEmit(p);
+    }
+    if (rc != SQLITE_OK) return rc;
+
+    if (!bEnd && (pCtx->bounds.maxLength < 0 || pCtx->currentDepth < pCtx->bounds.maxLength)) {
+        return pathExpand(p);
+    }
+    pCtx->nVisited--;
+    return SQLITE_OK;
+}
+
+int cypherMatchPaths(GraphVtab *pGraph, sqlite3_int64 startNode,
+                     sqlite3_int64 endNode, const char *relType,
+                     int eDirection, PathBounds bounds, PathStmts *pStmts,
+                     PathResult **ppPaths, sqlite3_int64 *pnStep) {
+    PathStmts local;
+    PathSearch s;
+    int rc;
+
+    *ppPaths = NULL;
+    if (!pGraph) return SQLITE_MISUSE;
+    if (bounds.maxLength >= 0 && bounds.maxLength < bounds.minLength) return SQLITE_OK;
+
+    memset(&s, 0, sizeof(s));
+    s.ctx.pGraph = pGraph;
+    s.ctx.bounds = bounds;
+    s.endNode = endNode;
+    s.ppLast = &s.pFirst;
+    memset(&local, 0, sizeof(local));
+    s.pStmts = pStmts ? pStmts : &local;
+
+    rc = pathPrepare(&s, relType, eDirection);
+    if (rc == SQLITE_OK) rc = pathPush(&s, startNode, 0, 0.0);
+    if (rc == SQLITE_OK) rc = pathVisit(&s);
+    while (rc == SQLITE_OK && s.nLevel > 0) {
+        PathLevel *pLevel = &s.aLevel[s.nLevel - 1];
+        PathStep step;
+
+        if (pLevel->iNext >= pLevel->iEnd) {
+            /* Every neighbor tried: back up to the previous node */
+            s.nStep = pLevel->iFirst;
+            s.nLevel--;
+            s.ctx.nVisited--;
+            continue;
+        }
+        step = s.aStep[pLevel->iNext++];
+        if (pathOnPath(&s, step.iNode)) continue;
+        rc = pathPush(&s, step.iNode, step.iEdge, step.rWeight);
+        if (rc == SQLITE_OK) rc = pathVisit(&s);
+    }
+
+    if (pnStep) *pnStep += s.nStepped;
+    cypherPathStmtsFinalize(&local);
+    sqlite3_free(s.ctx.visitedNodes);
+    sqlite3_free(s.aEdge);
+    sqlite3_free(s.aWeight);
+    sqlite3_free(s.aLevel);
+    sqlite3_free(s.aStep);
+    if (rc != SQLITE_OK) {
+        cypherPathResultsFreeAll(s.pFirst);
+        return rc;
+    }
+    *ppPaths = s.pFirst;
+    return SQLITE_OK;
+}
+
+PathResult *cypherMatchVariableLengthPaths(GraphVtab *pGraph,
+                                           sqlite3_int64 startNode,
+                                           sqlite3_int64 endNode,
+                                           const char *relType,
+                                           PathBounds bounds) {
+    PathResult *pPaths = NULL;
+
+    cypherMatchPaths(pGraph, startNode, endNode, relType, GRAPH_EXPAND_OUT, bounds, NULL,
+                     &pPaths, NULL);
+    return pPaths;
+}
+
+void cypherPathResultFree(PathResult *path) {
+    if (!path) return;
+    sqlite3_free(path->nodeIds);
+    sqlite3_free(path->edgeIds);
+    sqlite3_free(path);
+}
+
+void cypherPathResultsFreeAll(PathResult *paths) {
+    while (paths) {
+        PathResult *pNext = paths->pNext;
+        cypherPathResultFree(paths);
+        paths = pNext;
+    }
+}
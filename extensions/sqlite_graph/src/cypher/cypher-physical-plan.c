@@ -21,6 +21,7 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-planner.h"
+#include "cypher-expressions.h"
 #include <string.h>
 #include <assert.h>
 
@@ -43,6 +44,39 @@ PhysicalPlanNode *physicalPlanNodeCreate(PhysicalOperatorType type) {
   return pNode;
 }
 
+/*
+** Free an array of expressions and the expressions in it.
+*/
+static void physicalPlanFreeExprs(CypherExpression **apExpr, int nExpr) {
+  int i;
+  
+  if( !apExpr ) return;
+  for( i = 0; i < nExpr; i++ ) cypherExpressionDestroy(apExpr[i]);
+  sqlite3_free(apExpr);
+}
+
+/*
+** Copy an array of nExpr expressions. Sets *pbOom on allocation failure.
+*/
+static CypherExpression **physicalPlanCopyExprs(CypherExpression **apExpr, int nExpr,
+                                                int *pbOom) {
+  CypherExpression **apCopy;
+  int i;
+  
+  if( !apExpr || nExpr <= 0 ) return NULL;
+  apCopy = sqlite3_malloc(nExpr * sizeof(CypherExpression*));
+  if( !apCopy ) {
+    *pbOom = 1;
+    return NULL;
+  }
+  memset(apCopy, 0, nExpr * sizeof(CypherExpression*));
+  for( i = 0; i < nExpr; i++ ) {
+    apCopy[i] = cypherExpressionCopy(apExpr[i]);
+    if( apExpr[i] && !apCopy[i] ) *pbOom = 1;
+  }
+  return apCopy;
+}
+
 /*
 ** Destroy a physical plan node and all children recursively.
 ** Safe to call with NULL pointer.
@@ -64,10 +98,106 @@ void physicalPlanNodeDestroy(PhysicalPlanNode *pNode) {
   sqlite3_free(pNode->zLabel);
   sqlite3_free(pNode->zProperty);
   sqlite3_free(pNode->zValue);
+  sqlite3_free(pNode->zParam);
+  sqlite3_free(pNode->zFromAlias);
+  sqlite3_free(pNode->zRelAlias);
+  sqlite3_free(pNode->aSortFlags);
+  cypherExpressionDestroy(pNode->pFilterExpr);
+  physicalPlanFreeExprs(pNode->apProjections, pNode->nProjections);
+  planColumnsFree(pNode->azColumn, pNode->nProjections);
+  physicalPlanFreeExprs(pNode->apSortKeys, pNode->nSortKeys);
+  planAggregateFree(pNode->aAggregate, pNode->nAggregate);
+  planWriteItemsFree(pNode->aWrite, pNode->nWrite);
   sqlite3_free(pNode->pExecState);
   sqlite3_free(pNode);
 }
 
+/*
+** Copy a string member of a plan node. Sets *pbOom if zSrc could not
+** be copied.
+*/
+static char *physicalPlanCopyString(const char *zSrc, int *pbOom) {
+  char *zCopy;
+  
+  if( !zSrc ) return NULL;
+  zCopy = sqlite3_mprintf("%s", zSrc);
+  if( !zCopy ) *pbOom = 1;
+  return zCopy;
+}
+
+/*
+** Deep copy of a physical plan tree without its execution state.
+** Returns NULL on allocation failure.
+*/
+PhysicalPlanNode *physicalPlanNodeCopy(const PhysicalPlanNode *pNode) {
+  PhysicalPlanNode *pCopy;
+  int bOom = 0;
+  int i;
+  
+  if( !pNode ) return NULL;
+  pCopy = physicalPlanNodeCreate(pNode->type);
+  if( !pCopy ) return NULL;
+  
+  /* Scalars, then owned members */
+  *pCopy = *pNode;
+  pCopy->apChildren = NULL;
+  pCopy->pChild = NULL;
+  pCopy->nChildren = pCopy->nChildrenAlloc = 0;
+  pCopy->pExecState = NULL;
+  pCopy->aSortFlags = NULL;
+  pCopy->aAggregate = NULL;
+  pCopy->aWrite = NULL;
+  pCopy->pFilterExpr = cypherExpressionCopy(pNode->pFilterExpr);
+  if( pNode->pFilterExpr && !pCopy->pFilterExpr ) bOom = 1;
+  pCopy->apProjections = physicalPlanCopyExprs(pNode->apProjections, pNode->nProjections, &bOom);
+  pCopy->azColumn = planColumnsCopy(pNode->azColumn, pNode->nProjections);
+  if( pNode->azColumn && pNode->nProjections > 0 && !pCopy->azColumn ) bOom = 1;
+  pCopy->apSortKeys = physicalPlanCopyExprs(pNode->apSortKeys, pNode->nSortKeys, &bOom);
+  pCopy->zAlias = physicalPlanCopyString(pNode->zAlias, &bOom);
+  pCopy->zIndexName = physicalPlanCopyString(pNode->zIndexName, &bOom);
+  pCopy->zLabel = physicalPlanCopyString(pNode->zLabel, &bOom);
+  pCopy->zProperty = physicalPlanCopyString(pNode->zProperty, &bOom);
+  pCopy->zValue = physicalPlanCopyString(pNode->zValue, &bOom);
+  pCopy->zParam = physicalPlanCopyString(pNode->zParam, &bOom);
+  pCopy->zFromAlias = physicalPlanCopyString(pNode->zFromAlias, &bOom);
+  pCopy->zRelAlias = physicalPlanCopyString(pNode->zRelAlias, &bOom);
+  if( pNode->aSortFlags && pNode->nSortKeys > 0 ) {
+    pCopy->aSortFlags = sqlite3_malloc(pNode->nSortKeys);
+    if( pCopy->aSortFlags ) {
+      memcpy(pCopy->aSortFlags, pNode->aSortFlags, pNode->nSortKeys);
+    } else {
+      bOom = 1;
+    }
+  }
+  if( pNode->nAggregate > 0 ) {
+    pCopy->aAggregate = planAggregateCopy(pNode->aAggregate, pNode->nAggregate);
+    if( !pCopy->aAggregate ) bOom = 1;
+  }
+  if( pNode->nWrite > 0 ) {
+    pCopy->aWrite = planWriteItemsCopy(pNode->aWrite, pNode->nWrite);
+    if( !pCopy->aWrite ) bOom = 1;
+  }
+  
+  for( i = 0; !bOom && i < pNode->nChildren; i++ ) {
+    PhysicalPlanNode *pChild = physicalPlanNodeCopy(pNode->apChildren[i]);
+    if( !pChild || physicalPlanNodeAddChild(pCopy, pChild) != SQLITE_OK ) {
+      physicalPlanNodeDestroy(pChild);
+      bOom = 1;
+    }
+  }
+  if( !bOom && pNode->pChild ) {
+    for( i = 0; i < pNode->nChildren; i++ ) {
+      if( pNode->apChildren[i] == pNode->pChild ) pCopy->pChild = pCopy->apChildren[i];
+    }
+  }
+  
+  if( bOom ) {
+    physicalPlanNodeDestroy(pCopy);
+    return NULL;
+  }
+  return pCopy;
+}
+
 /*
 ** Add a child node to a physical plan node.
 ** Returns SQLITE_OK on success, SQLITE_NOMEM on allocation failure.
@@ -105,6 +235,9 @@ const char *physicalOperatorTypeName(PhysicalOperatorType type) {
     case PHYSICAL_PROPERTY_INDEX_SCAN: return "PropertyIndexScan";
     case PHYSICAL_ALL_RELS_SCAN:      return "AllRelsScan";
     case PHYSICAL_TYPE_INDEX_SCAN:    return "TypeIndexScan";
+    case PHYSICAL_BITMAP_AND:         return "BitmapAnd";
+    case PHYSICAL_EXPAND:             return "Expand";
+    case PHYSICAL_VAR_LENGTH_EXPAND:  return "VarLengthExpand";
     case PHYSICAL_HASH_JOIN:          return "HashJoin";
     case PHYSICAL_NESTED_LOOP_JOIN:   return "NestedLoopJoin";
     case PHYSICAL_INDEX_NESTED_LOOP:  return "IndexNestedLoop";
@@ -113,6 +246,8 @@ const char *physicalOperatorTypeName(PhysicalOperatorType type) {
     case PHYSICAL_SORT:               return "Sort";
     case PHYSICAL_LIMIT:              return "Limit";
     case PHYSICAL_AGGREGATION:        return "Aggregation";
+    case PHYSICAL_CREATE:             return "Create";
+    case PHYSICAL_MERGE:              return "Merge";
     default:                          return "Unknown";
   }
 }
@@ -128,6 +263,13 @@ PhysicalPlanNode *logicalPlanToPhysical(LogicalPlanNode *pLogical, PlanContext *
   
   if( !pLogical ) return NULL;
   
+  /* A property filter over an index scan that applies its predicate
+  ** has nothing left to check; the scan takes its place */
+  if( pLogical->type == LOGICAL_PROPERTY_FILTER && pLogical->nChildren == 1 &&
+      logicalPlanAppliesPredicate(pLogical->apChildren[0], pLogical) ) {
+    return logicalPlanToPhysical(pLogical->apChildren[0], pContext);
+  }
+  
   /* Select physical operator based on logical operation */
   switch( pLogical->type ) {
     case LOGICAL_NODE_SCAN:
@@ -155,25 +297,93 @@ PhysicalPlanNode *logicalPlanToPhysical(LogicalPlanNode *pLogical, PlanContext *
       if( pPhysical && pLogical->zProperty ) {
         pPhysical->zProperty = sqlite3_mprintf("%s", pLogical->zProperty);
         pPhysical->zValue = sqlite3_mprintf("%s", pLogical->zValue ? pLogical->zValue : "");
+        pPhysical->eValueType = pLogical->eValueType;
+        if( pLogical->zParam ) {
+          pPhysical->zParam = sqlite3_mprintf("%s", pLogical->zParam);
+        }
+        pPhysical->eCmp = pLogical->eCmp;
+        if( pLogical->zLabel ) {
+          pPhysical->zLabel = sqlite3_mprintf("%s", pLogical->zLabel);
+        }
+        if( pContext && pContext->pGraph ) {
+          /* The iterator scans a hot-property column before the index */
+          switch( planContextHasColumn(pContext, pLogical->zLabel, pLogical->zProperty) ) {
+            case 2:
+              pPhysical->zIndexName = sqlite3_mprintf("column(%s.%s)",
+                  pLogical->zLabel, pLogical->zProperty);
+              break;
+            case 1:
+              pPhysical->zIndexName = sqlite3_mprintf("column(%s)", pLogical->zProperty);
+              break;
+            default:
+              pPhysical->zIndexName = sqlite3_mprintf("%s_prop_%s",
+                  pContext->pGraph->zTableName, pLogical->zProperty);
+              break;
+          }
+        }
         pPhysical->rCost = pLogical->rEstimatedCost * 0.1; /* Index is much faster */
       }
       break;
       
+    case LOGICAL_BITMAP_AND:
+      /* Children become the label and property index scans to intersect */
+      pPhysical = physicalPlanNodeCreate(PHYSICAL_BITMAP_AND);
+      break;
+      
     case LOGICAL_FILTER:
     case LOGICAL_PROPERTY_FILTER:
     case LOGICAL_LABEL_FILTER:
       pPhysical = physicalPlanNodeCreate(PHYSICAL_FILTER);
+      if( pPhysical && pLogical->pExpr ) {
+        pPhysical->pFilterExpr = cypherExpressionCopy(pLogical->pExpr);
+        if( !pPhysical->pFilterExpr ) {
+          physicalPlanNodeDestroy(pPhysical);
+          return NULL;
+        }
+      }
       if( pPhysical ) {
         if( pLogical->zProperty ) {
           pPhysical->zProperty = sqlite3_mprintf("%s", pLogical->zProperty);
         }
         if( pLogical->zValue ) {
           pPhysical->zValue = sqlite3_mprintf("%s", pLogical->zValue);
+          pPhysical->eValueType = pLogical->eValueType;
+        }
+        if( pLogical->zParam ) {
+          pPhysical->zParam = sqlite3_mprintf("%s", pLogical->zParam);
         }
         pPhysical->rSelectivity = 0.1; /* Assume 10% selectivity */
       }
       break;
       
+    case LOGICAL_EXPAND:
+    case LOGICAL_VAR_LENGTH_EXPAND:
+      /* Adjacency comes from the covering edge index of the direction;
+      ** an undirected expand reads both */
+      pPhysical = physicalPlanNodeCreate(pLogical->type == LOGICAL_EXPAND ?
+                                         PHYSICAL_EXPAND : PHYSICAL_VAR_LENGTH_EXPAND);
+      if( pPhysical ) {
+        if( pLogical->zRelAlias ) {
+          pPhysical->zRelAlias = sqlite3_mprintf("%s", pLogical->zRelAlias);
+        }
+        pPhysical->nMinHops = pLogical->nMinHops;
+        pPhysical->nMaxHops = pLogical->nMaxHops;
+        if( pLogical->zLabel ) {
+          pPhysical->zLabel = sqlite3_mprintf("%s", pLogical->zLabel);
+        }
+        if( pLogical->zFromAlias ) {
+          pPhysical->zFromAlias = sqlite3_mprintf("%s", pLogical->zFromAlias);
+        }
+        pPhysical->eDirection = pLogical->eDirection;
+        pPhysical->iFlags = pLogical->iFlags;
+        if( pContext && pContext->pGraph && pLogical->eDirection != GRAPH_EXPAND_BOTH ) {
+          pPhysical->zIndexName = sqlite3_mprintf("%s_edges_%s",
+              pContext->pGraph->zTableName,
+              pLogical->eDirection == GRAPH_EXPAND_IN ? "in" : "out");
+        }
+      }
+      break;
+      
     case LOGICAL_HASH_JOIN:
       pPhysical = physicalPlanNodeCreate(PHYSICAL_HASH_JOIN);
       break;
@@ -187,23 +397,74 @@ PhysicalPlanNode *logicalPlanToPhysical(LogicalPlanNode *pLogical, PlanContext *
       }
       break;
       
+    case LOGICAL_CARTESIAN_PRODUCT:
+      /* Disconnected patterns: a nested loop with no join predicate */
+      pPhysical = physicalPlanNodeCreate(PHYSICAL_NESTED_LOOP_JOIN);
+      break;
+      
     case LOGICAL_PROJECTION:
       pPhysical = physicalPlanNodeCreate(PHYSICAL_PROJECTION);
       if( pPhysical && pLogical->zProperty ) {
         pPhysical->zProperty = sqlite3_mprintf("%s", pLogical->zProperty);
       }
+      if( pPhysical && pLogical->nProjections > 0 ) {
+        int bOom = 0;
+        pPhysical->nProjections = pLogical->nProjections;
+        pPhysical->apProjections = physicalPlanCopyExprs(pLogical->apProjections,
+                                                         pLogical->nProjections, &bOom);
+        pPhysical->azColumn = planColumnsCopy(pLogical->azColumn, pLogical->nProjections);
+        if( bOom || !pPhysical->apProjections || !pPhysical->azColumn ) {
+          physicalPlanNodeDestroy(pPhysical);
+          return NULL;
+        }
+      }
       break;
       
     case LOGICAL_SORT:
       pPhysical = physicalPlanNodeCreate(PHYSICAL_SORT);
+      if( pPhysical && pLogical->nSortKeys > 0 ) {
+        int bOom = 0;
+        pPhysical->nSortKeys = pLogical->nSortKeys;
+        pPhysical->apSortKeys = physicalPlanCopyExprs(pLogical->apSortKeys,
+                                                      pLogical->nSortKeys, &bOom);
+        pPhysical->aSortFlags = sqlite3_malloc(pLogical->nSortKeys);
+        if( bOom || !pPhysical->apSortKeys || !pPhysical->aSortFlags ) {
+          physicalPlanNodeDestroy(pPhysical);
+          return NULL;
+        }
+        memcpy(pPhysical->aSortFlags, pLogical->aSortFlags, pLogical->nSortKeys);
+      }
       break;
       
     case LOGICAL_LIMIT:
       pPhysical = physicalPlanNodeCreate(PHYSICAL_LIMIT);
+      if( pPhysical ) pPhysical->nLimit = pLogical->nLimit;
       break;
       
     case LOGICAL_AGGREGATION:
       pPhysical = physicalPlanNodeCreate(PHYSICAL_AGGREGATION);
+      if( pPhysical && pLogical->nAggregate > 0 ) {
+        pPhysical->aAggregate = planAggregateCopy(pLogical->aAggregate, pLogical->nAggregate);
+        if( !pPhysical->aAggregate ) {
+          physicalPlanNodeDestroy(pPhysical);
+          return NULL;
+        }
+        pPhysical->nAggregate = pLogical->nAggregate;
+      }
+      break;
+      
+    case LOGICAL_CREATE:
+    case LOGICAL_MERGE:
+      pPhysical = physicalPlanNodeCreate(pLogical->type == LOGICAL_CREATE ?
+                                         PHYSICAL_CREATE : PHYSICAL_MERGE);
+      if( pPhysical && pLogical->nWrite > 0 ) {
+        pPhysical->aWrite = planWriteItemsCopy(pLogical->aWrite, pLogical->nWrite);
+        if( !pPhysical->aWrite ) {
+          physicalPlanNodeDestroy(pPhysical);
+          return NULL;
+        }
+        pPhysical->nWrite = pLogical->nWrite;
+      }
       break;
       
     default:
@@ -236,9 +497,85 @@ PhysicalPlanNode *logicalPlanToPhysical(LogicalPlanNode *pLogical, PlanContext *
     }
   }
   
+  /* ORDER BY ... LIMIT k: the sort only has to keep the first k rows */
+  if( pPhysical->type == PHYSICAL_LIMIT && pPhysical->nLimit > 0 &&
+      pPhysical->nChildren == 1 && pPhysical->apChildren[0]->type == PHYSICAL_SORT &&
+      pPhysical->apChildren[0]->nLimit == 0 ) {
+    pPhysical->apChildren[0]->nLimit = pPhysical->nLimit;
+  }
+  
   return pPhysical;
 }
 
+/*
+** Operator-specific part of a physical plan node's description: the
+** index, label or property it reads, or an expand's endpoints. Returns
+** NULL when there is nothing to add. Caller must sqlite3_free() the
+** returned string.
+*/
+char *physicalPlanNodeDetails(PhysicalPlanNode *pNode) {
+  char *zDetails = NULL;
+  char zHops[12];
+  int i;
+  
+  if( pNode->type == PHYSICAL_VAR_LENGTH_EXPAND ) {
+    zDetails = sqlite3_mprintf("from=%s%s%s%s%s hops=%d..%s%s%s",
+                               pNode->zFromAlias ? pNode->zFromAlias : "",
+                               pNode->zRelAlias ? " rel=" : "",
+                               pNode->zRelAlias ? pNode->zRelAlias : "",
+                               pNode->zLabel ? " type=" : "",
+                               pNode->zLabel ? pNode->zLabel : "",
+                               pNode->nMinHops,
+                               pNode->nMaxHops < 0 ? "" : sqlite3_snprintf(12, zHops, "%d", pNode->nMaxHops),
+                               (pNode->iFlags & PLAN_EXPAND_INTO) ? " into" : "",
+                               pNode->eDirection == GRAPH_EXPAND_IN ? " dir=in" :
+                               pNode->eDirection == GRAPH_EXPAND_BOTH ? " dir=both" : " dir=out");
+  } else if( pNode->type == PHYSICAL_EXPAND ) {
+    zDetails = sqlite3_mprintf("%s%s%s%s%s%s%s%s",
+                               pNode->zFromAlias ? "from=" : "",
+                               pNode->zFromAlias ? pNode->zFromAlias : "",
+                               pNode->zRelAlias ? " rel=" : "",
+                               pNode->zRelAlias ? pNode->zRelAlias : "",
+                               pNode->zLabel ? " type=" : "",
+                               pNode->zLabel ? pNode->zLabel : "",
+                               (pNode->iFlags & PLAN_EXPAND_INTO) ? " into" : "",
+                               pNode->eDirection == GRAPH_EXPAND_IN ? " dir=in" :
+                               pNode->eDirection == GRAPH_EXPAND_BOTH ? " dir=both" : " dir=out");
+  } else if( pNode->type == PHYSICAL_SORT ) {
+    zDetails = pNode->nLimit > 0 ?
+               sqlite3_mprintf("keys=%d top=%d", pNode->nSortKeys, pNode->nLimit) :
+               sqlite3_mprintf("keys=%d", pNode->nSortKeys);
+  } else if( pNode->type == PHYSICAL_AGGREGATION ) {
+    int nKey = 0;
+    for( i = 0; i < pNode->nAggregate; i++ ) {
+      if( pNode->aAggregate[i].eFunc == PLAN_AGG_KEY ) nKey++;
+    }
+    zDetails = sqlite3_mprintf("keys=%d aggs=%d", nKey, pNode->nAggregate - nKey);
+  } else if( pNode->type == PHYSICAL_CREATE ) {
+    int nNode = 0;
+    for( i = 0; i < pNode->nWrite; i++ ) {
+      if( pNode->aWrite[i].iFrom < 0 ) nNode++;
+    }
+    zDetails = sqlite3_mprintf("nodes=%d rels=%d", nNode, pNode->nWrite - nNode);
+  } else if( pNode->type == PHYSICAL_MERGE && pNode->nWrite == 3 ) {
+    zDetails = sqlite3_mprintf("label=%s keys=%d", pNode->aWrite[0].zLabel ? pNode->aWrite[0].zLabel : "",
+                               pNode->aWrite[0].nProp);
+  } else if( pNode->zIndexName ) {
+    zDetails = sqlite3_mprintf("index=%s", pNode->zIndexName);
+  } else if( pNode->zLabel ) {
+    zDetails = sqlite3_mprintf("label=%s", pNode->zLabel);
+  } else if( pNode->zProperty ) {
+    if( pNode->zParam ) {
+      zDetails = sqlite3_mprintf("prop=%s val=$%s", pNode->zProperty, pNode->zParam);
+    } else if( pNode->zValue ) {
+      zDetails = sqlite3_mprintf("prop=%s val=%s", pNode->zProperty, pNode->zValue);
+    } else {
+      zDetails = sqlite3_mprintf("prop=%s", pNode->zProperty);
+    }
+  }
+  return zDetails;
+}
+
 /*
 ** Generate string representation of physical plan tree.
 ** Caller must sqlite3_free() the returned string.
@@ -270,18 +607,7 @@ char *physicalPlanToString(PhysicalPlanNode *pNode) {
     }
   }
   
-  /* Build details string */
-  if( pNode->zIndexName ) {
-    zDetails = sqlite3_mprintf("index=%s", pNode->zIndexName);
-  } else if( pNode->zLabel ) {
-    zDetails = sqlite3_mprintf("label=%s", pNode->zLabel);
-  } else if( pNode->zProperty ) {
-    if( pNode->zValue ) {
-      zDetails = sqlite3_mprintf("prop=%s val=%s", pNode->zProperty, pNode->zValue);
-    } else {
-      zDetails = sqlite3_mprintf("prop=%s", pNode->zProperty);
-    }
-  }
+  zDetails = physicalPlanNodeDetails(pNode);
   
   /* Build node string */
   if( pNode->zAlias && zDetails ) {
@@ -358,6 +684,7 @@ PhysicalPlanNode *cypherCreateTestPhysicalPlan(void) {
   pFilter->zAlias = sqlite3_mprintf("n");
   pFilter->zProperty = sqlite3_mprintf("age");
   pFilter->zValue = sqlite3_mprintf("30");
+  pFilter->eValueType = SQLITE_INTEGER;
   pFilter->rCost = 1.0;
   pFilter->iRows = 100;
   pFilter->rSelectivity = 0.1;
@@ -76,7 +76,8 @@ static void cypherPlanSqlFunc(
   }
   
   /* Create planner and compile */
-  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context), NULL);
+  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context),
+      graphRegistryFind(sqlite3_context_db_handle(context), NULL));
   if( !pPlanner ) {
     sqlite3_result_error_nomem(context);
     cypherParserDestroy(pParser);
@@ -169,7 +170,8 @@ static void cypherLogicalPlanSqlFunc(
   }
   
   /* Create planner and compile to logical plan */
-  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context), NULL);
+  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context),
+      graphRegistryFind(sqlite3_context_db_handle(context), NULL));
   if( !pPlanner ) {
     sqlite3_result_error_nomem(context);
     cypherParserDestroy(pParser);
@@ -255,7 +257,8 @@ static void cypherExplainSqlFunc(
   }
   
   /* Create planner and compile */
-  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context), NULL);
+  pPlanner = cypherPlannerCreate(sqlite3_context_db_handle(context),
+      graphRegistryFind(sqlite3_context_db_handle(context), NULL));
   if( !pPlanner ) {
     sqlite3_result_error_nomem(context);
     cypherParserDestroy(pParser);
@@ -22,7 +22,11 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "cypher-planner.h"
+#include "cypher-expressions.h"
+#include "graph-performance.h"
+#include "cypher-paths.h"
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 
 /* Forward declarations for optimization functions */
@@ -57,6 +61,15 @@ CypherPlanner *cypherPlannerCreate(sqlite3 *pDb, GraphVtab *pGraph) {
   pPlanner->pContext->bUseIndexes = 1;
   pPlanner->pContext->bReorderJoins = 1;
   pPlanner->pContext->rIndexCostFactor = 0.1;
+  /* Property indexes are discovered once per planner; a failed lookup
+  ** just plans without them */
+  if( pGraph ) {
+    graphPropertyIndexList(pGraph, &pPlanner->pContext->azPropertyIndexes,
+                           &pPlanner->pContext->nPropertyIndexes);
+    graphColumnList(pGraph, &pPlanner->pContext->azColumns,
+                    &pPlanner->pContext->nColumns);
+  }
+  
   
   return pPlanner;
 }
@@ -90,6 +103,11 @@ void cypherPlannerDestroy(CypherPlanner *pPlanner) {
     }
     sqlite3_free(pPlanner->pContext->azPropertyIndexes);
     
+    for( i = 0; i < pPlanner->pContext->nColumns*2; i++ ) {
+      sqlite3_free(pPlanner->pContext->azColumns[i]);
+    }
+    sqlite3_free(pPlanner->pContext->azColumns);
+    
     sqlite3_free(pPlanner->pContext->zErrorMsg);
     sqlite3_free(pPlanner->pContext);
   }
@@ -140,6 +158,1216 @@ static int planContextAddVariable(PlanContext *pContext, const char *zVar, Logic
 }
 
 
+/*
+** Map a comparison operator to GRAPH_CMP_*, or -1 if a property index
+** cannot answer it.
+*/
+static int planComparisonOp(const char *zOp) {
+  if( !zOp ) return -1;
+  if( strcmp(zOp, "=") == 0 ) return GRAPH_CMP_EQ;
+  if( strcmp(zOp, "<") == 0 ) return GRAPH_CMP_LT;
+  if( strcmp(zOp, "<=") == 0 ) return GRAPH_CMP_LE;
+  if( strcmp(zOp, ">") == 0 ) return GRAPH_CMP_GT;
+  if( strcmp(zOp, ">=") == 0 ) return GRAPH_CMP_GE;
+  return -1;
+}
+
+/*
+** Check whether zProperty has a property index.
+*/
+static int planContextHasPropertyIndex(PlanContext *pContext, const char *zProperty) {
+  int i;
+  
+  if( !pContext || !zProperty ) return 0;
+  for( i = 0; i < pContext->nPropertyIndexes; i++ ) {
+    if( strcmp(pContext->azPropertyIndexes[i], zProperty) == 0 ) return 1;
+  }
+  return 0;
+}
+
+int planContextHasColumn(PlanContext *pContext, const char *zLabel,
+                         const char *zProperty) {
+  int i;
+  int eFound = 0;
+  
+  if( !pContext || !zProperty ) return 0;
+  for( i = 0; i < pContext->nColumns; i++ ) {
+    const char *zColumnLabel = pContext->azColumns[2*i];
+    if( strcmp(pContext->azColumns[2*i+1], zProperty) != 0 ) continue;
+    if( !zColumnLabel ) {
+      eFound = 1;
+    } else if( zLabel && strcmp(zColumnLabel, zLabel) == 0 ) {
+      return 2;
+    }
+  }
+  return eFound;
+}
+
+/*
+** Label of the nodes scan pScan produces: its own, or for a BITMAP_AND
+** that of its label scan input. NULL if unlabelled.
+*/
+static const char *planScanLabel(LogicalPlanNode *pScan) {
+  int i;
+  
+  if( pScan->type != LOGICAL_BITMAP_AND ) return pScan->zLabel;
+  for( i = 0; i < pScan->nChildren; i++ ) {
+    if( pScan->apChildren[i]->type == LOGICAL_LABEL_SCAN ) {
+      return pScan->apChildren[i]->zLabel;
+    }
+  }
+  return NULL;
+}
+
+/*
+** True for the operators that produce the nodes of a pattern variable.
+*/
+static int planIsNodeScan(LogicalPlanNode *pNode) {
+  return pNode && (pNode->type == LOGICAL_NODE_SCAN || pNode->type == LOGICAL_LABEL_SCAN ||
+                   pNode->type == LOGICAL_INDEX_SCAN || pNode->type == LOGICAL_BITMAP_AND);
+}
+
+/*
+** Find the scan that produces variable zVar: a scan child of pNode with
+** that alias, else the node recorded in the planning context.
+*/
+static LogicalPlanNode *planFindScan(LogicalPlanNode *pNode, PlanContext *pContext,
+                                     const char *zVar) {
+  LogicalPlanNode *pScan = NULL;
+  int i;
+  
+  if( !zVar ) return NULL;
+  for( i = 0; i < pNode->nChildren && !pScan; i++ ) {
+    LogicalPlanNode *pChild = pNode->apChildren[i];
+    if( planIsNodeScan(pChild) && pChild->zAlias && strcmp(pChild->zAlias, zVar) == 0 ) {
+      pScan = pChild;
+    }
+  }
+  for( i = 0; i < pContext->nVariables && !pScan; i++ ) {
+    if( strcmp(pContext->azVariables[i], zVar) == 0 ) pScan = pContext->apVarNodes[i];
+  }
+  return planIsNodeScan(pScan) ? pScan : NULL;
+}
+
+/*
+** Create a single-predicate scan to serve as a BITMAP_AND input.
+*/
+static LogicalPlanNode *planPredicateScan(LogicalPlanNodeType type, const char *zAlias,
+                                          const char *zLabel, const char *zProperty,
+                                          const char *zValue, int eValueType,
+                                          const char *zParam, int eCmp,
+                                          PlanContext *pContext) {
+  LogicalPlanNode *pScan = logicalPlanNodeCreate(type);
+  if( !pScan ) return NULL;
+  logicalPlanNodeSetAlias(pScan, zAlias);
+  if( zLabel ) logicalPlanNodeSetLabel(pScan, zLabel);
+  if( zProperty ) logicalPlanNodeSetProperty(pScan, zProperty);
+  if( zValue ) logicalPlanNodeSetValue(pScan, zValue, eValueType);
+  if( zParam ) logicalPlanNodeSetParam(pScan, zParam);
+  pScan->eCmp = eCmp;
+  logicalPlanEstimateRows(pScan, pContext);
+  return pScan;
+}
+
+/*
+** Add the indexed predicate of filter pFilter to the node scan pScan.
+** The first predicate turns the scan into an INDEX_SCAN. A second one
+** turns it into a BITMAP_AND whose inputs are one index scan per
+** predicate plus a label scan, so conjunctions are answered by
+** intersecting id sets before any node row is read. An input keeps the
+** label when a column declared for it can answer the predicate.
+*/
+static int planPushPredicate(LogicalPlanNode *pScan, LogicalPlanNode *pFilter,
+                             PlanContext *pContext) {
+  LogicalPlanNode *pInput;
+  const char *zLabel;
+  int rc;
+  
+  if( pScan->type != LOGICAL_BITMAP_AND && !pScan->zProperty ) {
+    logicalPlanNodeSetProperty(pScan, pFilter->zProperty);
+    logicalPlanNodeSetValue(pScan, pFilter->zValue, pFilter->eValueType);
+    logicalPlanNodeSetParam(pScan, pFilter->zParam);
+    pScan->eCmp = pFilter->eCmp;
+    pScan->type = LOGICAL_INDEX_SCAN;
+    logicalPlanEstimateRows(pScan, pContext);
+    return SQLITE_OK;
+  }
+  
+  if( pScan->type != LOGICAL_BITMAP_AND ) {
+    /* Split the single-predicate index scan into its inputs */
+    zLabel = planContextHasColumn(pContext, pScan->zLabel, pScan->zProperty) == 2 ?
+             pScan->zLabel : NULL;
+    pInput = planPredicateScan(LOGICAL_INDEX_SCAN, pScan->zAlias, zLabel,
+                               pScan->zProperty, pScan->zValue, pScan->eValueType,
+                               pScan->zParam, pScan->eCmp, pContext);
+    if( !pInput ) return SQLITE_NOMEM;
+    rc = logicalPlanNodeAddChild(pScan, pInput);
+    if( rc != SQLITE_OK ) {
+      logicalPlanNodeDestroy(pInput);
+      return rc;
+    }
+    if( pScan->zLabel ) {
+      pInput = planPredicateScan(LOGICAL_LABEL_SCAN, pScan->zAlias, pScan->zLabel,
+                                 NULL, NULL, 0, NULL, GRAPH_CMP_EQ, pContext);
+      if( !pInput ) return SQLITE_NOMEM;
+      rc = logicalPlanNodeAddChild(pScan, pInput);
+      if( rc != SQLITE_OK ) {
+        logicalPlanNodeDestroy(pInput);
+        return rc;
+      }
+    }
+    sqlite3_free(pScan->zProperty);
+    sqlite3_free(pScan->zValue);
+    sqlite3_free(pScan->zParam);
+    sqlite3_free(pScan->zLabel);
+    pScan->zProperty = pScan->zValue = pScan->zParam = pScan->zLabel = NULL;
+    pScan->type = LOGICAL_BITMAP_AND;
+  }
+  
+  zLabel = planScanLabel(pScan);
+  if( planContextHasColumn(pContext, zLabel, pFilter->zProperty) != 2 ) zLabel = NULL;
+  pInput = planPredicateScan(LOGICAL_INDEX_SCAN, pScan->zAlias, zLabel,
+                             pFilter->zProperty, pFilter->zValue, pFilter->eValueType,
+                             pFilter->zParam, pFilter->eCmp, pContext);
+  if( !pInput ) return SQLITE_NOMEM;
+  rc = logicalPlanNodeAddChild(pScan, pInput);
+  if( rc != SQLITE_OK ) {
+    logicalPlanNodeDestroy(pInput);
+    return rc;
+  }
+  logicalPlanEstimateRows(pScan, pContext);
+  return SQLITE_OK;
+}
+
+/*
+** Compile "var.prop <op> literal" or "var.prop <op> $param" into a
+** PROPERTY_FILTER node carrying the comparison as its predicate, for
+** when no index applies it. Returns NULL for any other expression.
+*/
+static LogicalPlanNode *compilePropertyPredicate(CypherAst *pExpr) {
+  LogicalPlanNode *pLogical;
+  CypherAst *pProp;
+  CypherAst *pValue;
+  int eCmp;
+  
+  if( !(cypherAstIsType(pExpr, CYPHER_AST_COMPARISON) ||
+        cypherAstIsType(pExpr, CYPHER_AST_BINARY_OP)) ||
+      pExpr->nChildren < 2 ) {
+    return NULL;
+  }
+  eCmp = planComparisonOp(cypherAstGetValue(pExpr));
+  pProp = pExpr->apChildren[0];
+  pValue = pExpr->apChildren[1];
+  if( eCmp < 0 || !cypherAstIsType(pProp, CYPHER_AST_PROPERTY) ||
+      pProp->nChildren < 2 ||
+      !(cypherAstIsType(pValue, CYPHER_AST_LITERAL) ||
+        cypherAstIsType(pValue, CYPHER_AST_PARAMETER)) ) {
+    return NULL;
+  }
+  
+  pLogical = logicalPlanNodeCreate(LOGICAL_PROPERTY_FILTER);
+  if( pLogical ) {
+    logicalPlanNodeSetAlias(pLogical, cypherAstGetValue(pProp->apChildren[0]));
+    logicalPlanNodeSetProperty(pLogical, cypherAstGetValue(pProp->apChildren[1]));
+    if( cypherAstIsType(pValue, CYPHER_AST_PARAMETER) ) {
+      logicalPlanNodeSetParam(pLogical, cypherAstGetValue(pValue));
+    } else {
+      logicalPlanNodeSetValue(pLogical, cypherAstGetValue(pValue), pValue->iFlags);
+    }
+    pLogical->eCmp = eCmp;
+    if( cypherExpressionFromAst(pExpr, &pLogical->pExpr) != SQLITE_OK ) {
+      logicalPlanNodeDestroy(pLogical);
+      return NULL;
+    }
+  }
+  return pLogical;
+}
+
+/*
+** Walk the AND tree of a WHERE expression, pushing a PROPERTY_FILTER
+** for each property comparison onto the filter stack *ppTop. The other
+** conjuncts are ANDed into *ppResidual, which the caller evaluates with
+** a generic filter. Returns SQLITE_ERROR for a conjunct that cannot be
+** evaluated.
+*/
+static int compileConjuncts(CypherAst *pExpr, LogicalPlanNode **ppTop,
+                            CypherExpression **ppResidual) {
+  LogicalPlanNode *pFilter;
+  CypherExpression *pConjunct = NULL;
+  CypherExpression *pAnd;
+  int i, rc;
+  
+  if( !pExpr ) return SQLITE_OK;
+  if( cypherAstIsType(pExpr, CYPHER_AST_AND) ) {
+    for( i = 0; i < pExpr->nChildren; i++ ) {
+      rc = compileConjuncts(pExpr->apChildren[i], ppTop, ppResidual);
+      if( rc != SQLITE_OK ) return rc;
+    }
+    return SQLITE_OK;
+  }
+  
+  pFilter = compilePropertyPredicate(pExpr);
+  if( pFilter ) {
+    if( *ppTop ) logicalPlanNodeAddChild(pFilter, *ppTop);
+    *ppTop = pFilter;
+    return SQLITE_OK;
+  }
+  
+  rc = cypherExpressionFromAst(pExpr, &pConjunct);
+  if( rc != SQLITE_OK ) return rc;
+  if( !*ppResidual ) {
+    *ppResidual = pConjunct;
+    return SQLITE_OK;
+  }
+  rc = cypherExpressionCreateLogical(&pAnd, *ppResidual, pConjunct, CYPHER_LOGIC_AND);
+  if( rc != SQLITE_OK ) {
+    cypherExpressionDestroy(pConjunct);
+    return rc;
+  }
+  *ppResidual = pAnd;
+  return SQLITE_OK;
+}
+
+/*
+** The variable of a node or relationship pattern, or NULL if it has none.
+*/
+static const char *planPatternAlias(CypherAst *pAst) {
+  int i;
+  
+  for( i = 0; i < pAst->nChildren; i++ ) {
+    if( cypherAstIsType(pAst->apChildren[i], CYPHER_AST_IDENTIFIER) ) {
+      return cypherAstGetValue(pAst->apChildren[i]);
+    }
+  }
+  return NULL;
+}
+
+/*
+** The first label of a node pattern or the type of a relationship
+** pattern, or NULL. The parser stores a single label on the LABELS
+** node itself, a label list as its children.
+*/
+static const char *planPatternLabel(CypherAst *pAst) {
+  int i;
+  
+  for( i = 0; i < pAst->nChildren; i++ ) {
+    CypherAst *pLabels = pAst->apChildren[i];
+    if( !cypherAstIsType(pLabels, CYPHER_AST_LABELS) ) continue;
+    if( pLabels->nChildren > 0 ) return cypherAstGetValue(pLabels->apChildren[0]);
+    return cypherAstGetValue(pLabels);
+  }
+  return NULL;
+}
+
+/*
+** Create the scan producing the nodes of node pattern pAst as zAlias:
+** a label scan when the pattern has a label, else a full node scan.
+*/
+static LogicalPlanNode *planNodePatternScan(CypherAst *pAst, const char *zAlias,
+                                            PlanContext *pContext) {
+  const char *zLabel = planPatternLabel(pAst);
+  LogicalPlanNode *pLogical;
+  
+  pLogical = logicalPlanNodeCreate(zLabel ? LOGICAL_LABEL_SCAN : LOGICAL_NODE_SCAN);
+  if( !pLogical ) return NULL;
+  if( logicalPlanNodeSetAlias(pLogical, zAlias) != SQLITE_OK ||
+      (zLabel && logicalPlanNodeSetLabel(pLogical, zLabel) != SQLITE_OK) ) {
+    logicalPlanNodeDestroy(pLogical);
+    return NULL;
+  }
+  planContextAddVariable(pContext, zAlias, pLogical);
+  return pLogical;
+}
+
+/*
+** Query graph of a MATCH pattern list: one scan per distinct node
+** variable and one edge per relationship pattern between them.
+*/
+typedef struct PlanQueryGraph {
+  LogicalPlanNode **apScan;     /* Node scans, one per variable */
+  int nScan;
+  int nScanAlloc;
+  JoinEdge *aEdge;              /* Relationship patterns */
+  int nEdge;
+  int nEdgeAlloc;
+  int nAnon;                    /* Anonymous nodes named so far */
+} PlanQueryGraph;
+
+/*
+** Return the query graph input for node pattern pAst, adding a scan
+** the first time its variable is seen. Anonymous nodes each get their
+** own generated variable. Returns -1 on OOM.
+*/
+static int planQueryGraphNode(PlanQueryGraph *pQuery, CypherAst *pAst,
+                              PlanContext *pContext) {
+  const char *zAlias = planPatternAlias(pAst);
+  const char *zLabel = planPatternLabel(pAst);
+  char *zAnon = NULL;
+  LogicalPlanNode *pScan;
+  int i;
+  
+  if( zAlias ) {
+    for( i = 0; i < pQuery->nScan; i++ ) {
+      pScan = pQuery->apScan[i];
+      if( strcmp(pScan->zAlias, zAlias) != 0 ) continue;
+      /* (a)-->(b), (a:Person) labels the existing scan */
+      if( zLabel && pScan->type == LOGICAL_NODE_SCAN ) {
+        if( logicalPlanNodeSetLabel(pScan, zLabel) != SQLITE_OK ) return -1;
+        pScan->type = LOGICAL_LABEL_SCAN;
+      }
+      return i;
+    }
+  } else {
+    zAnon = sqlite3_mprintf("_anon%d", pQuery->nAnon++);
+    if( !zAnon ) return -1;
+    zAlias = zAnon;
+  }
+  
+  if( pQuery->nScan >= pQuery->nScanAlloc ) {
+    int nNew = pQuery->nScanAlloc ? pQuery->nScanAlloc * 2 : 8;
+    LogicalPlanNode **apNew = sqlite3_realloc(pQuery->apScan, nNew * sizeof(LogicalPlanNode*));
+    if( !apNew ) {
+      sqlite3_free(zAnon);
+      return -1;
+    }
+    pQuery->apScan = apNew;
+    pQuery->nScanAlloc = nNew;
+  }
+  pScan = planNodePatternScan(pAst, zAlias, pContext);
+  sqlite3_free(zAnon);
+  if( !pScan ) return -1;
+  pQuery->apScan[pQuery->nScan] = pScan;
+  return pQuery->nScan++;
+}
+
+/*
+** Add relationship pattern pRel between inputs iLeft and iRight.
+** Returns SQLITE_OK, SQLITE_NOMEM, or SQLITE_ERROR for a property map,
+** which MATCH does not filter on.
+*/
+static int planQueryGraphEdge(PlanQueryGraph *pQuery, int iLeft, CypherAst *pRel, int iRight) {
+  const char *zDir = cypherAstGetValue(pRel);
+  PathBounds bounds = cypherParsePathBounds(NULL);
+  JoinEdge *pEdge;
+  int i;
+  
+  if( pQuery->nEdge >= pQuery->nEdgeAlloc ) {
+    int nNew = pQuery->nEdgeAlloc ? pQuery->nEdgeAlloc * 2 : 8;
+    JoinEdge *aNew = sqlite3_realloc(pQuery->aEdge, nNew * sizeof(JoinEdge));
+    if( !aNew ) return SQLITE_NOMEM;
+    pQuery->aEdge = aNew;
+    pQuery->nEdgeAlloc = nNew;
+  }
+  pEdge = &pQuery->aEdge[pQuery->nEdge++];
+  for( i = 0; i < pRel->nChildren; i++ ) {
+    if( cypherAstIsType(pRel->apChildren[i], CYPHER_AST_MAP) ) {
+      pQuery->nEdge--;
+      return SQLITE_ERROR;
+    }
+    if( cypherAstIsType(pRel->apChildren[i], CYPHER_AST_RANGE) ) {
+      bounds = cypherParsePathBounds(cypherAstGetValue(pRel->apChildren[i]));
+    }
+  }
+  pEdge->zType = planPatternLabel(pRel);
+  pEdge->zRel = planPatternAlias(pRel);
+  pEdge->nMinHops = bounds.minLength;
+  pEdge->nMaxHops = bounds.maxLength;
+  pEdge->iFrom = iLeft;
+  pEdge->iTo = iRight;
+  pEdge->eDirection = GRAPH_EXPAND_OUT;
+  if( zDir && strcmp(zDir, "<-") == 0 ) {
+    pEdge->iFrom = iRight;
+    pEdge->iTo = iLeft;
+  } else if( !zDir || strcmp(zDir, "->") != 0 ) {
+    pEdge->eDirection = GRAPH_EXPAND_BOTH;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Add the nodes and relationships of a pattern or pattern list to the
+** query graph. A path alternates node and relationship patterns.
+*/
+static int planQueryGraphAdd(PlanQueryGraph *pQuery, CypherAst *pAst, PlanContext *pContext) {
+  CypherAst *pRel = NULL;
+  int iPrev = -1;
+  int i, rc;
+  
+  for( i = 0; i < pAst->nChildren; i++ ) {
+    CypherAst *pChild = pAst->apChildren[i];
+    
+    if( cypherAstIsType(pChild, CYPHER_AST_PATTERN) ) {
+      rc = planQueryGraphAdd(pQuery, pChild, pContext);
+      if( rc != SQLITE_OK ) return rc;
+      iPrev = -1;
+      pRel = NULL;
+    } else if( cypherAstIsType(pChild, CYPHER_AST_NODE_PATTERN) ) {
+      int iNode = planQueryGraphNode(pQuery, pChild, pContext);
+      if( iNode < 0 ) return SQLITE_NOMEM;
+      if( pRel && iPrev >= 0 ) {
+        rc = planQueryGraphEdge(pQuery, iPrev, pRel, iNode);
+        if( rc != SQLITE_OK ) return rc;
+      }
+      pRel = NULL;
+      iPrev = iNode;
+    } else if( cypherAstIsType(pChild, CYPHER_AST_REL_PATTERN) ) {
+      pRel = pChild;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Compile a pattern list into a join over its query graph. The join
+** order, expand directions and join operators are chosen by
+** graphOptimizeJoinOrder(); only disconnected patterns are combined
+** with a Cartesian product.
+*/
+static LogicalPlanNode *compilePatternJoin(CypherAst *pAst, PlanContext *pContext) {
+  PlanQueryGraph query;
+  JoinOrderOptimizer opt;
+  LogicalPlanNode *pLogical = NULL;
+  int nVarMark = pContext->nVariables;
+  int rc;
+  int i;
+  
+  memset(&query, 0, sizeof(query));
+  memset(&opt, 0, sizeof(opt));
+  rc = planQueryGraphAdd(&query, pAst, pContext);
+  if( rc == SQLITE_OK && query.nScan > 0 ) {
+    opt.joins = query.apScan;
+    opt.nJoins = query.nScan;
+    opt.aEdges = query.aEdge;
+    opt.nEdges = query.nEdge;
+    opt.pContext = pContext;
+    rc = graphOptimizeJoinOrder(&opt);
+    pLogical = opt.pPlan;
+  }
+  
+  /* Too many inputs to enumerate: join them as written */
+  for( i = 0; rc == SQLITE_OK && i < query.nScan; i++ ) {
+    LogicalPlanNode *pJoin;
+    
+    if( !query.apScan[i] ) continue;
+    if( !pLogical ) {
+      pLogical = query.apScan[i];
+      query.apScan[i] = NULL;
+      continue;
+    }
+    pJoin = logicalPlanNodeCreate(LOGICAL_HASH_JOIN);
+    if( !pJoin || logicalPlanNodeAddChild(pJoin, pLogical) != SQLITE_OK ) {
+      logicalPlanNodeDestroy(pJoin);
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    pLogical = pJoin;
+    if( logicalPlanNodeAddChild(pJoin, query.apScan[i]) != SQLITE_OK ) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    query.apScan[i] = NULL;
+  }
+  
+  if( rc != SQLITE_OK ) {
+    /* The scans are freed with the plan; forget their variables */
+    logicalPlanNodeDestroy(pLogical);
+    pLogical = NULL;
+    for( i = nVarMark; i < pContext->nVariables; i++ ) {
+      pContext->apVarNodes[i] = NULL;
+    }
+    sqlite3_free(pContext->zErrorMsg);
+    pContext->zErrorMsg = rc == SQLITE_NOMEM ?
+        sqlite3_mprintf("out of memory planning MATCH pattern") :
+        sqlite3_mprintf("Relationship property maps in MATCH are not supported");
+    pContext->nErrors++;
+  }
+  for( i = 0; i < query.nScan; i++ ) {
+    logicalPlanNodeDestroy(query.apScan[i]);
+  }
+  sqlite3_free(query.apScan);
+  sqlite3_free(query.aEdge);
+  return pLogical;
+}
+
+/*
+** The property map of a node or relationship pattern, or NULL.
+*/
+static CypherAst *planPatternMap(CypherAst *pAst) {
+  int i;
+  
+  for( i = 0; i < pAst->nChildren; i++ ) {
+    if( cypherAstIsType(pAst->apChildren[i], CYPHER_AST_MAP) ) return pAst->apChildren[i];
+  }
+  return NULL;
+}
+
+/*
+** Set an error on the planning context. Returns SQLITE_ERROR.
+*/
+static int planContextError(PlanContext *pContext, const char *zFormat, const char *zArg) {
+  sqlite3_free(pContext->zErrorMsg);
+  pContext->zErrorMsg = sqlite3_mprintf(zFormat, zArg);
+  pContext->nErrors++;
+  return SQLITE_ERROR;
+}
+
+/*
+** Append an element to the write items of pCreate, a CREATE or MERGE,
+** with the variable, label and property map of pattern pAst. For a
+** MERGE_ACTION the item holds only the properties it sets. Returns its
+** index, or -1 after setting the context error.
+*/
+static int planWriteItemAdd(LogicalPlanNode *pCreate, CypherAst *pAst,
+                            int iFrom, int iTo, PlanContext *pContext) {
+  const char *zVar = planPatternAlias(pAst);
+  const char *zLabel = planPatternLabel(pAst);
+  CypherAst *pMap = cypherAstIsType(pAst, CYPHER_AST_MERGE_ACTION) ? pAst : planPatternMap(pAst);
+  int bMerge = pCreate->type == LOGICAL_MERGE;
+  PlanWriteItem *aNew;
+  PlanWriteItem *pItem;
+  int i;
+  
+  aNew = sqlite3_realloc(pCreate->aWrite, (pCreate->nWrite + 1) * sizeof(PlanWriteItem));
+  if( !aNew ) goto add_nomem;
+  pCreate->aWrite = aNew;
+  pItem = &aNew[pCreate->nWrite++];
+  memset(pItem, 0, sizeof(*pItem));
+  pItem->iFrom = iFrom;
+  pItem->iTo = iTo;
+  if( zVar && !(pItem->zVariable = sqlite3_mprintf("%s", zVar)) ) goto add_nomem;
+  if( zLabel && !(pItem->zLabel = sqlite3_mprintf("%s", zLabel)) ) goto add_nomem;
+  
+  if( pMap && pMap->nChildren > 0 ) {
+    pItem->azProp = sqlite3_malloc(pMap->nChildren * sizeof(char*));
+    pItem->apValue = sqlite3_malloc(pMap->nChildren * sizeof(CypherExpression*));
+    if( !pItem->azProp || !pItem->apValue ) goto add_nomem;
+    for( i = 0; i < pMap->nChildren; i++ ) {
+      CypherAst *pPair = pMap->apChildren[i];
+      int rc;
+      
+      pItem->azProp[i] = sqlite3_mprintf("%s", cypherAstGetValue(pPair));
+      pItem->apValue[i] = NULL;
+      pItem->nProp++;
+      if( !pItem->azProp[i] ) goto add_nomem;
+      rc = pPair->nChildren > 0 ?
+           cypherExpressionFromAst(pPair->apChildren[0], &pItem->apValue[i]) : SQLITE_ERROR;
+      if( rc == SQLITE_NOMEM ) goto add_nomem;
+      if( rc != SQLITE_OK ) {
+        planContextError(pContext, bMerge ? "Unsupported value for property `%s` in MERGE" :
+                                            "Unsupported value for property `%s` in CREATE",
+                         cypherAstGetValue(pPair));
+        return -1;
+      }
+    }
+  }
+  return pCreate->nWrite - 1;
+  
+add_nomem:
+  planContextError(pContext, "out of memory planning %s", bMerge ? "MERGE" : "CREATE");
+  return -1;
+}
+
+/*
+** The write item of node pattern pAst: the node an earlier pattern of
+** the clause created under the same variable, else a new one. Returns
+** -1 after setting the context error.
+*/
+static int planCreateNode(LogicalPlanNode *pCreate, CypherAst *pAst, PlanContext *pContext) {
+  const char *zVar = planPatternAlias(pAst);
+  int i;
+  
+  for( i = 0; zVar && i < pCreate->nWrite; i++ ) {
+    PlanWriteItem *pItem = &pCreate->aWrite[i];
+    if( !pItem->zVariable || strcmp(pItem->zVariable, zVar) != 0 ) continue;
+    if( pItem->iFrom >= 0 || planPatternLabel(pAst) || planPatternMap(pAst) ) {
+      planContextError(pContext, "Variable `%s` already declared", zVar);
+      return -1;
+    }
+    return i;
+  }
+  return planWriteItemAdd(pCreate, pAst, -1, -1, pContext);
+}
+
+/*
+** Add relationship pattern pRel between the write items iLeft and
+** iRight. A created relationship has one type and one direction.
+*/
+static int planCreateRel(LogicalPlanNode *pCreate, int iLeft, CypherAst *pRel,
+                         int iRight, PlanContext *pContext) {
+  const char *zDir = cypherAstGetValue(pRel);
+  const char *zVar = planPatternAlias(pRel);
+  int i;
+  
+  for( i = 0; zVar && i < pCreate->nWrite; i++ ) {
+    if( pCreate->aWrite[i].zVariable && strcmp(pCreate->aWrite[i].zVariable, zVar) == 0 ) {
+      return planContextError(pContext, "Variable `%s` already declared", zVar);
+    }
+  }
+  for( i = 0; i < pRel->nChildren; i++ ) {
+    if( cypherAstIsType(pRel->apChildren[i], CYPHER_AST_RANGE) ) {
+      return planContextError(pContext, "%s",
+                              "Variable length relationships cannot be created");
+    }
+  }
+  if( !planPatternLabel(pRel) ) {
+    return planContextError(pContext, "%s",
+                            "Exactly one relationship type must be specified for CREATE");
+  }
+  if( !zDir || (strcmp(zDir, "->") != 0 && strcmp(zDir, "<-") != 0) ) {
+    return planContextError(pContext, "%s",
+                            "Only directed relationships are supported in CREATE");
+  }
+  if( strcmp(zDir, "<-") == 0 ) {
+    int iSwap = iLeft;
+    iLeft = iRight;
+    iRight = iSwap;
+  }
+  return planWriteItemAdd(pCreate, pRel, iLeft, iRight, pContext) < 0 ? SQLITE_ERROR : SQLITE_OK;
+}
+
+/*
+** Add the nodes and relationships of a pattern or pattern list to the
+** write items of pCreate, in the order they are written.
+*/
+static int planCreatePattern(LogicalPlanNode *pCreate, CypherAst *pAst, PlanContext *pContext) {
+  CypherAst *pRel = NULL;
+  int iPrev = -1;
+  int i, rc;
+  
+  for( i = 0; i < pAst->nChildren; i++ ) {
+    CypherAst *pChild = pAst->apChildren[i];
+    
+    if( cypherAstIsType(pChild, CYPHER_AST_PATTERN) ) {
+      rc = planCreatePattern(pCreate, pChild, pContext);
+      if( rc != SQLITE_OK ) return rc;
+      iPrev = -1;
+      pRel = NULL;
+    } else if( cypherAstIsType(pChild, CYPHER_AST_NODE_PATTERN) ) {
+      int iNode = planCreateNode(pCreate, pChild, pContext);
+      if( iNode < 0 ) return SQLITE_ERROR;
+      if( pRel && iPrev >= 0 ) {
+        rc = planCreateRel(pCreate, iPrev, pRel, iNode, pContext);
+        if( rc != SQLITE_OK ) return rc;
+      }
+      pRel = NULL;
+      iPrev = iNode;
+    } else if( cypherAstIsType(pChild, CYPHER_AST_REL_PATTERN) ) {
+      pRel = pChild;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Compile a CREATE clause into a CREATE operator listing the nodes and
+** relationships it writes. Relationship items refer to their endpoints
+** by index, so every element is created once per run.
+*/
+static LogicalPlanNode *planCreateClause(CypherAst *pAst, PlanContext *pContext) {
+  LogicalPlanNode *pCreate = logicalPlanNodeCreate(LOGICAL_CREATE);
+  
+  if( !pCreate ) {
+    planContextError(pContext, "%s", "out of memory planning CREATE");
+    return NULL;
+  }
+  if( pAst->nChildren > 0 &&
+      planCreatePattern(pCreate, pAst->apChildren[0], pContext) != SQLITE_OK ) {
+    logicalPlanNodeDestroy(pCreate);
+    return NULL;
+  }
+  return pCreate;
+}
+
+/*
+** Compile a MERGE clause into a MERGE operator. Its write items are the
+** node to merge, then the properties ON CREATE SET gives it and those
+** ON MATCH SET gives it, each present even when empty.
+*/
+static LogicalPlanNode *planMergeClause(CypherAst *pAst, PlanContext *pContext) {
+  CypherAst *pPattern = pAst->nChildren > 0 ? pAst->apChildren[0] : NULL;
+  CypherAst *apAction[2] = { NULL, NULL };
+  LogicalPlanNode *pMerge;
+  const char *zVar;
+  int i, j;
+  
+  if( !pPattern || pPattern->nChildren != 1 ||
+      !cypherAstIsType(pPattern->apChildren[0], CYPHER_AST_NODE_PATTERN) ) {
+    planContextError(pContext, "%s", "MERGE supports a single node pattern");
+    return NULL;
+  }
+  zVar = planPatternAlias(pPattern->apChildren[0]);
+  
+  for( i = 1; i < pAst->nChildren; i++ ) {
+    CypherAst *pAction = pAst->apChildren[i];
+    int iWhen = strcmp(cypherAstGetValue(pAction), "CREATE") == 0 ? 0 : 1;
+    
+    if( apAction[iWhen] ) {
+      planContextError(pContext, "ON %s SET may be given only once",
+                       cypherAstGetValue(pAction));
+      return NULL;
+    }
+    apAction[iWhen] = pAction;
+    for( j = 0; j < pAction->nChildren; j++ ) {
+      CypherAst *pPair = pAction->apChildren[j];
+      const char *zSetVar = pPair->nChildren > 1 ? cypherAstGetValue(pPair->apChildren[1]) : NULL;
+      if( !zVar || !zSetVar || strcmp(zVar, zSetVar) != 0 ) {
+        planContextError(pContext, "Variable `%s` not defined", zSetVar ? zSetVar : "");
+        return NULL;
+      }
+    }
+  }
+  
+  pMerge = logicalPlanNodeCreate(LOGICAL_MERGE);
+  if( !pMerge ) {
+    planContextError(pContext, "%s", "out of memory planning MERGE");
+    return NULL;
+  }
+  if( planWriteItemAdd(pMerge, pPattern->apChildren[0], -1, -1, pContext) < 0 ) {
+    logicalPlanNodeDestroy(pMerge);
+    return NULL;
+  }
+  /* The clause itself has no variable, label or map: an empty item */
+  for( i = 0; i < 2; i++ ) {
+    int iItem = apAction[i] ? planWriteItemAdd(pMerge, apAction[i], -1, -1, pContext)
+                            : planWriteItemAdd(pMerge, pAst, -1, -1, pContext);
+    if( iItem < 0 ) {
+      logicalPlanNodeDestroy(pMerge);
+      return NULL;
+    }
+  }
+  return pMerge;
+}
+
+/*
+** PLAN_AGG_* of an aggregate function name, or -1 for any other name.
+*/
+static int planAggregateFunc(const char *zName) {
+  if( !zName ) return -1;
+  if( sqlite3_stricmp(zName, "count") == 0 ) return PLAN_AGG_COUNT;
+  if( sqlite3_stricmp(zName, "sum") == 0 ) return PLAN_AGG_SUM;
+  if( sqlite3_stricmp(zName, "avg") == 0 ) return PLAN_AGG_AVG;
+  if( sqlite3_stricmp(zName, "min") == 0 ) return PLAN_AGG_MIN;
+  if( sqlite3_stricmp(zName, "max") == 0 ) return PLAN_AGG_MAX;
+  return -1;
+}
+
+/*
+** Point *pzVar and *pzProp at the variable and property that pExpr
+** reads: "n" or "n.prop". Returns 0 for an expression of another shape.
+*/
+static int planAggregateOperand(CypherAst *pExpr, const char **pzVar, const char **pzProp) {
+  *pzProp = NULL;
+  if( cypherAstIsType(pExpr, CYPHER_AST_PROPERTY) && pExpr->nChildren >= 2 ) {
+    *pzProp = cypherAstGetValue(pExpr->apChildren[1]);
+    pExpr = pExpr->apChildren[0];
+  }
+  if( !cypherAstIsType(pExpr, CYPHER_AST_IDENTIFIER) ) return 0;
+  *pzVar = cypherAstGetValue(pExpr);
+  return *pzVar != NULL;
+}
+
+/*
+** Fill *pAgg from the RETURN item pItem: a grouping key that is a
+** variable or one of its properties, or count(*) or an aggregate call
+** over either. The column is named by the item's alias, otherwise by
+** the item's text. Returns SQLITE_ERROR for an item of another shape.
+*/
+static int planAggregateItem(CypherAst *pItem, PlanAggregate *pAgg) {
+  CypherAst *pExpr = pItem->apChildren[0];
+  const char *zFunc = NULL;
+  const char *zVar = NULL;
+  const char *zProp = NULL;
+  
+  memset(pAgg, 0, sizeof(*pAgg));
+  if( cypherAstIsType(pExpr, CYPHER_AST_FUNCTION_CALL) && pExpr->nChildren >= 1 ) {
+    zFunc = cypherAstGetValue(pExpr->apChildren[0]);
+    pAgg->eFunc = planAggregateFunc(zFunc);
+    if( pAgg->eFunc < 0 ) return SQLITE_ERROR;
+    if( pExpr->nChildren == 1 ) {
+      /* count(*) is the only aggregate without an argument */
+      const char *zStar = cypherAstGetValue(pExpr);
+      if( pAgg->eFunc != PLAN_AGG_COUNT || !zStar || strcmp(zStar, "*") != 0 ) {
+        return SQLITE_ERROR;
+      }
+    } else if( pExpr->nChildren != 2
+            || !planAggregateOperand(pExpr->apChildren[1], &zVar, &zProp) ) {
+      return SQLITE_ERROR;
+    }
+  } else if( !planAggregateOperand(pExpr, &zVar, &zProp) ) {
+    return SQLITE_ERROR;
+  }
+  
+  if( pItem->nChildren >= 2 ) {
+    pAgg->zName = sqlite3_mprintf("%s", cypherAstGetValue(pItem->apChildren[1]));
+  } else if( zFunc ) {
+    pAgg->zName = sqlite3_mprintf("%s(%s%s%s)", zFunc, zVar ? zVar : "*",
+                                  zProp ? "." : "", zProp ? zProp : "");
+  } else {
+    pAgg->zName = sqlite3_mprintf("%s%s%s", zVar, zProp ? "." : "", zProp ? zProp : "");
+  }
+  if( zVar ) pAgg->zVariable = sqlite3_mprintf("%s", zVar);
+  if( zProp ) pAgg->zProperty = sqlite3_mprintf("%s", zProp);
+  if( !pAgg->zName || (zVar && !pAgg->zVariable) || (zProp && !pAgg->zProperty) ) {
+    return SQLITE_NOMEM;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** A RETURN whose items include an aggregate call becomes an AGGREGATION
+** grouped on its other items. Returns NULL for a RETURN without one,
+** and NULL with the context error set if the items cannot be planned.
+*/
+static LogicalPlanNode *planReturnAggregation(CypherAst *pList, PlanContext *pContext) {
+  LogicalPlanNode *pLogical;
+  PlanAggregate *aAgg;
+  int i, rc = SQLITE_OK;
+  
+  for( i = 0; i < pList->nChildren; i++ ) {
+    CypherAst *pExpr = pList->apChildren[i]->nChildren > 0 ?
+                       pList->apChildren[i]->apChildren[0] : NULL;
+    if( cypherAstIsType(pExpr, CYPHER_AST_FUNCTION_CALL) && pExpr->nChildren >= 1
+     && planAggregateFunc(cypherAstGetValue(pExpr->apChildren[0])) >= 0 ) {
+      break;
+    }
+  }
+  if( i == pList->nChildren ) return NULL;
+  
+  pLogical = logicalPlanNodeCreate(LOGICAL_AGGREGATION);
+  aAgg = sqlite3_malloc(pList->nChildren * sizeof(PlanAggregate));
+  if( !pLogical || !aAgg ) {
+    logicalPlanNodeDestroy(pLogical);
+    sqlite3_free(aAgg);
+    pContext->zErrorMsg = sqlite3_mprintf("out of memory planning RETURN");
+    pContext->nErrors++;
+    return NULL;
+  }
+  memset(aAgg, 0, pList->nChildren * sizeof(PlanAggregate));
+  pLogical->aAggregate = aAgg;
+  pLogical->nAggregate = pList->nChildren;
+  
+  for( i = 0; rc == SQLITE_OK && i < pList->nChildren; i++ ) {
+    CypherAst *pItem = pList->apChildren[i];
+    rc = SQLITE_ERROR;
+    if( cypherAstIsType(pItem, CYPHER_AST_PROJECTION_ITEM) && pItem->nChildren > 0 ) {
+      rc = planAggregateItem(pItem, &aAgg[i]);
+    }
+  }
+  if( rc != SQLITE_OK ) {
+    logicalPlanNodeDestroy(pLogical);
+    pContext->zErrorMsg = rc == SQLITE_NOMEM ?
+        sqlite3_mprintf("out of memory planning RETURN") :
+        sqlite3_mprintf("RETURN item %d is not a variable, property or aggregate", i);
+    pContext->nErrors++;
+    return NULL;
+  }
+  return pLogical;
+}
+
+/*
+** The text of a RETURN expression, naming an item without an alias:
+** variables, properties, literals, parameters, and calls and operators
+** over them. NULL for any other shape, or if out of memory.
+*/
+static char *planExprText(CypherAst *pExpr) {
+  const char *zValue = cypherAstGetValue(pExpr);
+  char *zLeft = NULL;
+  char *zRight = NULL;
+  char *zText = NULL;
+  int i;
+  
+  if( !pExpr ) return NULL;
+  switch( pExpr->type ) {
+    case CYPHER_AST_IDENTIFIER:
+      return zValue ? sqlite3_mprintf("%s", zValue) : NULL;
+      
+    case CYPHER_AST_LITERAL:
+      if( !zValue ) return NULL;
+      if( pExpr->iFlags == SQLITE_TEXT ) return sqlite3_mprintf("'%s'", zValue);
+      return sqlite3_mprintf("%s", zValue);
+      
+    case CYPHER_AST_PARAMETER:
+      return zValue ? sqlite3_mprintf("$%s", zValue) : NULL;
+      
+    case CYPHER_AST_PROPERTY:
+      if( pExpr->nChildren < 2 ) return NULL;
+      zLeft = planExprText(pExpr->apChildren[0]);
+      if( zLeft ) {
+        zText = sqlite3_mprintf("%s.%s", zLeft, cypherAstGetValue(pExpr->apChildren[1]));
+      }
+      break;
+      
+    case CYPHER_AST_FUNCTION_CALL:
+      if( pExpr->nChildren < 1 ) return NULL;
+      if( pExpr->nChildren == 1 && zValue && strcmp(zValue, "*") == 0 ) {
+        return sqlite3_mprintf("%s(*)", cypherAstGetValue(pExpr->apChildren[0]));
+      }
+      zLeft = sqlite3_mprintf("");
+      for( i = 1; zLeft && i < pExpr->nChildren; i++ ) {
+        char *zArg = planExprText(pExpr->apChildren[i]);
+        char *zList = zArg ? sqlite3_mprintf("%s%s%s", zLeft, i > 1 ? ", " : "", zArg) : NULL;
+        sqlite3_free(zArg);
+        sqlite3_free(zLeft);
+        zLeft = zList;
+      }
+      if( zLeft ) {
+        zText = sqlite3_mprintf("%s(%s)", cypherAstGetValue(pExpr->apChildren[0]), zLeft);
+      }
+      break;
+      
+    case CYPHER_AST_COMPARISON:
+    case CYPHER_AST_ADDITIVE:
+    case CYPHER_AST_MULTIPLICATIVE:
+    case CYPHER_AST_BINARY_OP:
+    case CYPHER_AST_AND:
+      if( pExpr->nChildren != 2 ) return NULL;
+      zLeft = planExprText(pExpr->apChildren[0]);
+      zRight = planExprText(pExpr->apChildren[1]);
+      if( zLeft && zRight ) {
+        zText = sqlite3_mprintf("%s %s %s", zLeft,
+                                pExpr->type == CYPHER_AST_AND ? "AND" : zValue, zRight);
+      }
+      break;
+      
+    case CYPHER_AST_NOT:
+    case CYPHER_AST_UNARY_OP:
+      if( pExpr->nChildren < 1 ) return NULL;
+      zLeft = planExprText(pExpr->apChildren[0]);
+      if( zLeft ) {
+        zText = pExpr->type == CYPHER_AST_NOT ? sqlite3_mprintf("NOT %s", zLeft) :
+                sqlite3_mprintf("%s%s", zValue ? zValue : "", zLeft);
+      }
+      break;
+      
+    default:
+      break;
+  }
+  sqlite3_free(zLeft);
+  sqlite3_free(zRight);
+  return zText;
+}
+
+/*
+** Plan the items of a RETURN list onto the PROJECTION pLogical, one
+** output column per item, named by its alias or otherwise by its text.
+** Sets the context error if an item cannot be evaluated.
+*/
+static int planReturnItems(LogicalPlanNode *pLogical, CypherAst *pList,
+                           PlanContext *pContext) {
+  int nItem = pList->nChildren;
+  int i, rc = SQLITE_OK;
+  
+  pLogical->apProjections = sqlite3_malloc(nItem * sizeof(CypherExpression*));
+  pLogical->azColumn = sqlite3_malloc(nItem * sizeof(char*));
+  if( !pLogical->apProjections || !pLogical->azColumn ) {
+    rc = SQLITE_NOMEM;
+  } else {
+    memset(pLogical->apProjections, 0, nItem * sizeof(CypherExpression*));
+    memset(pLogical->azColumn, 0, nItem * sizeof(char*));
+    pLogical->nProjections = nItem;
+  }
+  
+  for( i = 0; rc == SQLITE_OK && i < nItem; i++ ) {
+    CypherAst *pItem = pList->apChildren[i];
+    
+    if( !cypherAstIsType(pItem, CYPHER_AST_PROJECTION_ITEM) || pItem->nChildren < 1 ) {
+      rc = SQLITE_ERROR;
+      break;
+    }
+    rc = cypherExpressionFromAst(pItem->apChildren[0], &pLogical->apProjections[i]);
+    if( rc != SQLITE_OK ) break;
+    if( pItem->nChildren >= 2 ) {
+      pLogical->azColumn[i] = sqlite3_mprintf("%s", cypherAstGetValue(pItem->apChildren[1]));
+    } else {
+      pLogical->azColumn[i] = planExprText(pItem->apChildren[0]);
+      if( !pLogical->azColumn[i] ) pLogical->azColumn[i] = sqlite3_mprintf("col%d", i);
+    }
+    if( !pLogical->azColumn[i] ) rc = SQLITE_NOMEM;
+  }
+  
+  if( rc != SQLITE_OK ) {
+    pContext->zErrorMsg = rc == SQLITE_NOMEM ?
+        sqlite3_mprintf("out of memory planning RETURN") :
+        sqlite3_mprintf("RETURN item %d is not supported", i + 1);
+    pContext->nErrors++;
+  }
+  return rc;
+}
+
+/*
+** Compile the ORDER BY key pKey of the RETURN planned as pReturn. Below
+** a projection a key reads the matched variables, and a variable naming
+** one of the projection's columns stands for that item's expression.
+** Above an aggregation a key must name one of its output columns.
+*/
+static int planSortKey(LogicalPlanNode *pReturn, CypherAst *pKey, CypherExpression **ppExpr) {
+  char *zText;
+  int i, rc = SQLITE_ERROR;
+  
+  if( pReturn->type == LOGICAL_PROJECTION ) {
+    if( cypherAstIsType(pKey, CYPHER_AST_IDENTIFIER) ) {
+      for( i = 0; i < pReturn->nProjections; i++ ) {
+        if( strcmp(pReturn->azColumn[i], cypherAstGetValue(pKey)) == 0 ) {
+          *ppExpr = cypherExpressionCopy(pReturn->apProjections[i]);
+          return *ppExpr ? SQLITE_OK : SQLITE_NOMEM;
+        }
+      }
+    }
+    return cypherExpressionFromAst(pKey, ppExpr);
+  }
+  
+  zText = planExprText(pKey);
+  for( i = 0; zText && i < pReturn->nAggregate; i++ ) {
+    if( strcmp(pReturn->aAggregate[i].zName, zText) == 0 ) {
+      rc = cypherExpressionCreateVariable(ppExpr, zText);
+      break;
+    }
+  }
+  sqlite3_free(zText);
+  return rc;
+}
+
+/*
+** Plan the ORDER BY and LIMIT of the RETURN clause pAst around pReturn,
+** the projection or aggregation of its items. A projection is evaluated
+** over the sorted and limited rows; an aggregation is sorted on its
+** output. SKIP is rejected. Returns the top of the clause, or NULL with
+** the context error set and pReturn destroyed.
+*/
+static LogicalPlanNode *planReturnModifiers(LogicalPlanNode *pReturn, CypherAst *pAst,
+                                            PlanContext *pContext) {
+  LogicalPlanNode *pSort = NULL;
+  LogicalPlanNode *pLimit = NULL;
+  LogicalPlanNode *pTop = pReturn;
+  const char *zError = NULL;
+  int i, j, rc = SQLITE_OK;
+  
+  for( i = 1; rc == SQLITE_OK && !zError && i < pAst->nChildren; i++ ) {
+    CypherAst *pMod = pAst->apChildren[i];
+    CypherAst *pCount;
+    const char *zCount;
+    
+    switch( pMod->type ) {
+      case CYPHER_AST_ORDER_BY:
+        pSort = logicalPlanNodeCreate(LOGICAL_SORT);
+        if( !pSort ) {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+        pSort->apSortKeys = sqlite3_malloc(pMod->nChildren * sizeof(CypherExpression*));
+        pSort->aSortFlags = sqlite3_malloc(pMod->nChildren);
+        if( !pSort->apSortKeys || !pSort->aSortFlags ) {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+        memset(pSort->apSortKeys, 0, pMod->nChildren * sizeof(CypherExpression*));
+        pSort->nSortKeys = pMod->nChildren;
+        for( j = 0; rc == SQLITE_OK && j < pMod->nChildren; j++ ) {
+          CypherAst *pItem = pMod->apChildren[j];
+          const char *zDir = cypherAstGetValue(pItem);
+          
+          pSort->aSortFlags[j] = zDir && sqlite3_stricmp(zDir, "DESC") == 0 ? PLAN_SORT_DESC : 0;
+          rc = pItem->nChildren > 0 ?
+               planSortKey(pReturn, pItem->apChildren[0], &pSort->apSortKeys[j]) :
+               SQLITE_ERROR;
+          if( rc == SQLITE_ERROR ) {
+            zError = pReturn->type == LOGICAL_AGGREGATION ?
+                "ORDER BY after an aggregation must name a RETURN column" :
+                "ORDER BY expression is not supported";
+            rc = SQLITE_OK;
+            break;
+          }
+        }
+        break;
+        
+      case CYPHER_AST_LIMIT:
+        pCount = pMod->nChildren > 0 ? pMod->apChildren[0] : NULL;
+        zCount = cypherAstGetValue(pCount);
+        if( !cypherAstIsType(pCount, CYPHER_AST_LITERAL) || !zCount || !zCount[0]
+         || strspn(zCount, "0123456789") != strlen(zCount) || strlen(zCount) > 9 ) {
+          zError = "LIMIT must be a non-negative integer literal";
+          break;
+        }
+        pLimit = logicalPlanNodeCreate(LOGICAL_LIMIT);
+        if( !pLimit ) {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+        pLimit->nLimit = atoi(zCount);
+        break;
+        
+      default:
+        zError = "SKIP is not supported";
+        break;
+    }
+  }
+  
+  if( rc != SQLITE_OK || zError ) {
+    pContext->zErrorMsg = zError ? sqlite3_mprintf("%s", zError) :
+                                   sqlite3_mprintf("out of memory planning RETURN");
+    pContext->nErrors++;
+    logicalPlanNodeDestroy(pSort);
+    logicalPlanNodeDestroy(pLimit);
+    logicalPlanNodeDestroy(pReturn);
+    return NULL;
+  }
+  
+  if( pReturn->type == LOGICAL_PROJECTION ) {
+    /* Projection, then limit, then sort, then the clause input */
+    LogicalPlanNode *pBottom = pReturn;
+    if( pLimit ) {
+      rc = logicalPlanNodeAddChild(pBottom, pLimit);
+      if( rc == SQLITE_OK ) pBottom = pLimit;
+    }
+    if( rc == SQLITE_OK && pSort ) rc = logicalPlanNodeAddChild(pBottom, pSort);
+  } else {
+    /* Limit, then sort, over the aggregation */
+    if( pSort ) {
+      rc = logicalPlanNodeAddChild(pSort, pTop);
+      if( rc == SQLITE_OK ) pTop = pSort;
+    }
+    if( rc == SQLITE_OK && pLimit ) {
+      rc = logicalPlanNodeAddChild(pLimit, pTop);
+      if( rc == SQLITE_OK ) pTop = pLimit;
+    }
+  }
+  if( rc != SQLITE_OK ) {
+    /* Free the operators not yet linked under the top */
+    if( pLimit && pLimit != pTop && !pLimit->pParent ) logicalPlanNodeDestroy(pLimit);
+    if( pSort && pSort != pTop && !pSort->pParent ) logicalPlanNodeDestroy(pSort);
+    logicalPlanNodeDestroy(pTop);
+    pContext->zErrorMsg = sqlite3_mprintf("out of memory planning RETURN");
+    pContext->nErrors++;
+    return NULL;
+  }
+  return pTop;
+}
+
+/*
+** The operator of a compiled clause that takes the preceding clauses as
+** its input: the bottom of pClause's single-child chain when that is a
+** filter, projection or other row operator still waiting for a child.
+** NULL if pClause produces rows of its own, such as a MATCH.
+*/
+static LogicalPlanNode *planClauseInput(LogicalPlanNode *pClause) {
+  while( pClause->nChildren == 1 ) pClause = pClause->apChildren[0];
+  if( pClause->nChildren > 0 ) return NULL;
+  switch( pClause->type ) {
+    case LOGICAL_FILTER:
+    case LOGICAL_PROPERTY_FILTER:
+    case LOGICAL_LABEL_FILTER:
+    case LOGICAL_PROJECTION:
+    case LOGICAL_DISTINCT:
+    case LOGICAL_AGGREGATION:
+    case LOGICAL_SORT:
+    case LOGICAL_LIMIT:
+    case LOGICAL_SKIP:
+      return pClause;
+    default:
+      return NULL;
+  }
+}
+
 /*
 ** Compile a Cypher AST node into a logical plan node.
 ** Returns the compiled logical plan node, or NULL on error.
@@ -161,7 +1389,13 @@ static LogicalPlanNode *compileAstNode(CypherAst *pAst, PlanContext *pContext) {
         
         for( i = 1; i < pAst->nChildren; i++ ) {
           pChild = compileAstNode(pAst->apChildren[i], pContext);
-          if( pChild && pLogical ) {
+          if( pChild && pLogical && planClauseInput(pChild) ) {
+            /* WHERE, RETURN and the like read the clauses before them */
+            if( logicalPlanNodeAddChild(planClauseInput(pChild), pLogical) ) {
+              logicalPlanNodeDestroy(pLogical);
+            }
+            pLogical = pChild;
+          } else if( pChild && pLogical ) {
             /* Create a join or sequence node */
             LogicalPlanNode *pJoin = logicalPlanNodeCreate(LOGICAL_HASH_JOIN);
             if( pJoin ) {
@@ -181,77 +1415,72 @@ static LogicalPlanNode *compileAstNode(CypherAst *pAst, PlanContext *pContext) {
       }
       break;
       
+    case CYPHER_AST_CREATE:
+      /* CREATE writes its patterns and returns no rows */
+      pLogical = planCreateClause(pAst, pContext);
+      break;
+      
+    case CYPHER_AST_MERGE:
+      /* MERGE finds or creates its node and returns no rows */
+      pLogical = planMergeClause(pAst, pContext);
+      break;
+      
+    case CYPHER_AST_PATTERN:
+      /* Pattern lists and patterns join their parts */
+      pLogical = compilePatternJoin(pAst, pContext);
+      break;
+      
     case CYPHER_AST_NODE_PATTERN:
       /* Node pattern becomes a scan operation */
-      if( pAst->nChildren > 0 && cypherAstIsType(pAst->apChildren[0], CYPHER_AST_IDENTIFIER) ) {
-        zAlias = cypherAstGetValue(pAst->apChildren[0]);
-        
-        /* Check if this is a labeled node */
-        if( pAst->nChildren > 1 && cypherAstIsType(pAst->apChildren[1], CYPHER_AST_LABELS) ) {
-          /* Label scan */
-          pLogical = logicalPlanNodeCreate(LOGICAL_LABEL_SCAN);
-          if( pLogical ) {
-            logicalPlanNodeSetAlias(pLogical, zAlias);
-            
-            /* Get first label */
-            if( pAst->apChildren[1]->nChildren > 0 ) {
-              const char *zLabel = cypherAstGetValue(pAst->apChildren[1]->apChildren[0]);
-              logicalPlanNodeSetLabel(pLogical, zLabel);
-            }
-            
-            /* Add variable to context */
-            planContextAddVariable(pContext, zAlias, pLogical);
-          }
-        } else {
-          /* Full node scan */
-          pLogical = logicalPlanNodeCreate(LOGICAL_NODE_SCAN);
-          if( pLogical ) {
-            logicalPlanNodeSetAlias(pLogical, zAlias);
-            planContextAddVariable(pContext, zAlias, pLogical);
-          }
-        }
+      zAlias = planPatternAlias(pAst);
+      if( zAlias ) {
+        pLogical = planNodePatternScan(pAst, zAlias, pContext);
       }
       break;
       
     case CYPHER_AST_WHERE:
       /* WHERE clause becomes a filter */
       if( pAst->nChildren > 0 ) {
-        CypherAst *pExpr = pAst->apChildren[0];
+        CypherExpression *pResidual = NULL;
+        LogicalPlanNode *pFilter = NULL;
+        int rc;
         
-        if( cypherAstIsType(pExpr, CYPHER_AST_BINARY_OP) && 
-            strcmp(cypherAstGetValue(pExpr), "=") == 0 &&
-            pExpr->nChildren >= 2 ) {
-          
-          /* Property filter: n.prop = value */
-          if( cypherAstIsType(pExpr->apChildren[0], CYPHER_AST_PROPERTY) ) {
-            pLogical = logicalPlanNodeCreate(LOGICAL_PROPERTY_FILTER);
-            if( pLogical ) {
-              CypherAst *pProp = pExpr->apChildren[0];
-              if( pProp->nChildren >= 2 ) {
-                const char *zVar = cypherAstGetValue(pProp->apChildren[0]);
-                const char *zProp = cypherAstGetValue(pProp->apChildren[1]);
-                const char *zValue = cypherAstGetValue(pExpr->apChildren[1]);
-                
-                logicalPlanNodeSetAlias(pLogical, zVar);
-                logicalPlanNodeSetProperty(pLogical, zProp);
-                logicalPlanNodeSetValue(pLogical, zValue);
-              }
-            }
-          }
+        /* One PROPERTY_FILTER per property comparison conjunct, stacked;
+        ** the remaining conjuncts are evaluated by a generic filter on top */
+        rc = compileConjuncts(pAst->apChildren[0], &pLogical, &pResidual);
+        if( rc == SQLITE_OK && pResidual ) {
+          pFilter = logicalPlanNodeCreate(LOGICAL_FILTER);
+          if( !pFilter ) rc = SQLITE_NOMEM;
         }
-        
-        if( !pLogical ) {
-          /* Generic filter */
-          pLogical = logicalPlanNodeCreate(LOGICAL_FILTER);
+        if( rc != SQLITE_OK ) {
+          pContext->zErrorMsg = rc == SQLITE_NOMEM ?
+              sqlite3_mprintf("out of memory planning WHERE") :
+              sqlite3_mprintf("WHERE expression is not supported");
+          pContext->nErrors++;
+          cypherExpressionDestroy(pResidual);
+          logicalPlanNodeDestroy(pLogical);
+          pLogical = NULL;
+          break;
+        }
+        if( pFilter ) {
+          pFilter->pExpr = pResidual;
+          if( pLogical ) logicalPlanNodeAddChild(pFilter, pLogical);
+          pLogical = pFilter;
         }
       }
       break;
       
     case CYPHER_AST_RETURN:
-      /* RETURN clause becomes a projection */
-      pLogical = logicalPlanNodeCreate(LOGICAL_PROJECTION);
-      if( pLogical && pAst->nChildren > 0 ) {
-        /* Process projection list */
+      /* RETURN clause becomes an aggregation or a projection */
+      if( pAst->nChildren > 0
+       && cypherAstIsType(pAst->apChildren[0], CYPHER_AST_PROJECTION_LIST) ) {
+        pLogical = planReturnAggregation(pAst->apChildren[0], pContext);
+        if( pContext->nErrors > 0 ) break;
+      }
+      if( !pLogical ) pLogical = logicalPlanNodeCreate(LOGICAL_PROJECTION);
+      if( pLogical && pLogical->type == LOGICAL_PROJECTION && pAst->nChildren > 0 ) {
+        /* One output column per item; the first item's variable and
+        ** property also label the operator in EXPLAIN output */
         CypherAst *pProjList = pAst->apChildren[0];
         if( cypherAstIsType(pProjList, CYPHER_AST_PROJECTION_LIST) && 
             pProjList->nChildren > 0 ) {
@@ -271,8 +1500,17 @@ static LogicalPlanNode *compileAstNode(CypherAst *pAst, PlanContext *pContext) {
               logicalPlanNodeSetProperty(pLogical, zProp);
             }
           }
+          if( planReturnItems(pLogical, pProjList, pContext) != SQLITE_OK ) {
+            logicalPlanNodeDestroy(pLogical);
+            pLogical = NULL;
+          }
         }
       }
+      
+      /* ORDER BY and LIMIT wrap the projection or aggregation */
+      if( pLogical && pAst->nChildren > 1 ) {
+        pLogical = planReturnModifiers(pLogical, pAst, pContext);
+      }
       break;
       
     default:
@@ -311,6 +1549,11 @@ int cypherPlannerCompile(CypherPlanner *pPlanner, CypherAst *pAst) {
   
   /* Compile AST to logical plan */
   pRoot = compileAstNode(pAst, pPlanner->pContext);
+  if( pRoot && pPlanner->pContext->nErrors > 0 ) {
+    /* A clause failed to compile; the plan of the rest would be wrong */
+    logicalPlanNodeDestroy(pRoot);
+    pRoot = NULL;
+  }
   if( !pRoot ) {
     if( pPlanner->pContext->zErrorMsg ) {
       pPlanner->zErrorMsg = sqlite3_mprintf("Compilation failed: %s", 
@@ -323,9 +1566,9 @@ int cypherPlannerCompile(CypherPlanner *pPlanner, CypherAst *pAst) {
   
   pPlanner->pLogicalPlan = pRoot;
   
-  /* Estimate costs */
-  logicalPlanEstimateCost(pRoot, pPlanner->pContext);
+  /* Estimate cardinalities, then the costs derived from them */
   logicalPlanEstimateRows(pRoot, pPlanner->pContext);
+  logicalPlanEstimateCost(pRoot, pPlanner->pContext);
   
   return SQLITE_OK;
 }
@@ -355,6 +1598,10 @@ int cypherPlannerOptimize(CypherPlanner *pPlanner) {
   /* Index usage optimization */
   optimizeIndexUsage(pPlanner->pLogicalPlan, pPlanner->pContext);
   
+  /* Pushed-down predicates changed the scans; re-estimate the tree */
+  logicalPlanEstimateRows(pPlanner->pLogicalPlan, pPlanner->pContext);
+  logicalPlanEstimateCost(pPlanner->pLogicalPlan, pPlanner->pContext);
+  
   /* Convert logical plan to physical plan */
   pPhysical = logicalPlanToPhysical(pPlanner->pLogicalPlan, pPlanner->pContext);
   if( !pPhysical ) {
@@ -383,8 +1630,8 @@ const char *cypherPlannerGetError(CypherPlanner *pPlanner) {
 }
 
 /*
-** Optimize join ordering using simple heuristics.
-** This is a simplified version - full implementation would use dynamic programming.
+** Choose the build side of each hash join. The join order of a MATCH
+** is fixed when its pattern is compiled (compilePatternJoin()).
 */
 int logicalPlanOptimizeJoins(LogicalPlanNode *pNode, PlanContext *pContext) {
   int i;
@@ -396,9 +1643,9 @@ int logicalPlanOptimizeJoins(LogicalPlanNode *pNode, PlanContext *pContext) {
     logicalPlanOptimizeJoins(pNode->apChildren[i], pContext);
   }
   
-  /* For join nodes, perform cost-based optimization */
-  if( pNode->type == LOGICAL_HASH_JOIN || 
-      pNode->type == LOGICAL_NESTED_LOOP_JOIN ) {
+  /* For hash joins, build on the cheaper side. Index nested loops
+  ** keep their order: the inner side is looked up, not scanned. */
+  if( pNode->type == LOGICAL_HASH_JOIN ) {
     if( pNode->nChildren >= 2 ) {
       LogicalPlanNode *pLeft = pNode->apChildren[0];
       LogicalPlanNode *pRight = pNode->apChildren[1];
@@ -414,7 +1661,7 @@ int logicalPlanOptimizeJoins(LogicalPlanNode *pNode, PlanContext *pContext) {
       }
       
       /* Update estimated rows for the join */
-      pNode->iEstimatedRows = (pLeft->iEstimatedRows * pRight->iEstimatedRows) / 10;
+      logicalPlanEstimateRows(pNode, pContext);
     }
   }
   
@@ -474,14 +1721,22 @@ static int optimizeIndexUsage(LogicalPlanNode *pNode, PlanContext *pContext) {
     if (pNode->zLabel && strlen(pNode->zLabel) > 0) {
       /* Convert to label index scan - much more efficient */
       pNode->type = LOGICAL_LABEL_SCAN;
-      pNode->iEstimatedRows = pNode->iEstimatedRows / 10;  /* Assume 10x improvement */
+      logicalPlanEstimateRows(pNode, pContext);
     }
-    
-    /* Check if we have property filters that can use property index */
-    if (pNode->zProperty && pNode->zValue) {
-      /* Convert to property index scan - highly selective */
-      pNode->type = LOGICAL_INDEX_SCAN;
-      pNode->iEstimatedRows = pNode->iEstimatedRows / 100;  /* Assume 100x improvement */
+  }
+  
+  /* Push a property predicate that an index or a hot-property column
+  ** can answer into the scan of its variable. The filter stays in place
+  ** and re-checks the rows it sees. */
+  if (pNode->type == LOGICAL_PROPERTY_FILTER && pNode->zProperty &&
+      (pNode->zValue || pNode->zParam) &&
+      pContext && pContext->bUseIndexes) {
+    LogicalPlanNode *pScan = planFindScan(pNode, pContext, pNode->zAlias);
+    if (pScan && (planContextHasPropertyIndex(pContext, pNode->zProperty) ||
+                  planContextHasColumn(pContext, planScanLabel(pScan),
+                                       pNode->zProperty))) {
+      int rc = planPushPredicate(pScan, pNode, pContext);
+      if (rc != SQLITE_OK) return rc;
     }
   }
   
@@ -0,0 +1,218 @@
+/*
+** SQLite Graph Database Extension - Cypher EXPLAIN ANALYZE
+**
+** Profiling of the iterator tree. When an ExecutionContext has bAnalyze
+** set, every iterator is created with its entry points routed through the
+** wrappers below, which time each call and charge it the change in the
+** context's work counters (CypherCounters). Nested calls are tracked with
+** ExecutionContext.pRunning, so each record also knows how much of its
+** time and work belongs to the operators it called; exclusive figures
+** are the difference.
+**
+** Records are looked up by plan node when the plan is rendered, so an
+** operator that built its own input iterator is reported the same way
+** as one whose child came from the executor.
+**
+** Memory allocation: Records use the statement arena, rendering uses
+** sqlite3_str
+** Error handling: Functions return SQLite error codes or NULL on OOM
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "cypher-executor.h"
+#include "cypher-chunk.h"
+#include <string.h>
+#include <time.h>
+
+/* A profiled call in progress */
+typedef struct ProfileCall {
+  double rStart;                /* Clock at entry, in milliseconds */
+  CypherCounters start;         /* Counters at entry */
+  CypherOpProfile *pCaller;     /* Call this one is nested in */
+} ProfileCall;
+
+static double profileNow(void) {
+  struct timespec ts;
+  if( clock_gettime(CLOCK_MONOTONIC, &ts) != 0 ) return 0.0;
+  return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+static void countersAdd(CypherCounters *pTo, const CypherCounters *pNow,
+                        const CypherCounters *pThen) {
+  pTo->nStep += pNow->nStep - pThen->nStep;
+  pTo->nCacheHit += pNow->nCacheHit - pThen->nCacheHit;
+  pTo->nCacheMiss += pNow->nCacheMiss - pThen->nCacheMiss;
+  pTo->nJsonBytes += pNow->nJsonBytes - pThen->nJsonBytes;
+}
+
+static void profileEnter(CypherIterator *pIterator, ProfileCall *pCall) {
+  ExecutionContext *pContext = pIterator->pContext;
+  pCall->pCaller = pContext->pRunning;
+  pCall->start = pContext->counters;
+  pCall->rStart = profileNow();
+  pContext->pRunning = pIterator->pProfile;
+}
+
+static void profileLeave(CypherIterator *pIterator, ProfileCall *pCall) {
+  ExecutionContext *pContext = pIterator->pContext;
+  CypherOpProfile *p = pIterator->pProfile;
+  double rSpent = profileNow() - pCall->rStart;
+
+  p->rTime += rSpent;
+  countersAdd(&p->work, &pContext->counters, &pCall->start);
+  if( pCall->pCaller ) {
+    pCall->pCaller->rChildTime += rSpent;
+    countersAdd(&pCall->pCaller->childWork, &pContext->counters, &pCall->start);
+  }
+  pContext->pRunning = pCall->pCaller;
+}
+
+static int profileOpen(CypherIterator *pIterator) {
+  ProfileCall call;
+  int rc;
+
+  profileEnter(pIterator, &call);
+  rc = pIterator->pProfile->xOpen(pIterator);
+  profileLeave(pIterator, &call);
+  pIterator->pProfile->nOpen++;
+  return rc;
+}
+
+static int profileNext(CypherIterator *pIterator, CypherResult *pResult) {
+  ProfileCall call;
+  int rc;
+
+  profileEnter(pIterator, &call);
+  rc = pIterator->pProfile->xNext(pIterator, pResult);
+  profileLeave(pIterator, &call);
+  pIterator->pProfile->nNext++;
+  if( rc == SQLITE_OK ) pIterator->pProfile->nRows++;
+  return rc;
+}
+
+static int profileNextBatch(CypherIterator *pIterator, CypherDataChunk *pChunk) {
+  ProfileCall call;
+  int rc;
+
+  profileEnter(pIterator, &call);
+  rc = pIterator->pProfile->xNextBatch(pIterator, pChunk);
+  profileLeave(pIterator, &call);
+  pIterator->pProfile->nNext++;
+  if( rc == SQLITE_OK ) pIterator->pProfile->nRows += pChunk->nSel;
+  return rc;
+}
+
+static int profileClose(CypherIterator *pIterator) {
+  ProfileCall call;
+  int rc;
+
+  profileEnter(pIterator, &call);
+  rc = pIterator->pProfile->xClose(pIterator);
+  profileLeave(pIterator, &call);
+  return rc;
+}
+
+int cypherIteratorProfile(CypherIterator *pIterator) {
+  ExecutionContext *pContext = pIterator->pContext;
+  CypherOpProfile *p;
+
+  p = graphArenaAlloc(&pContext->arena, sizeof(CypherOpProfile));
+  if( !p ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(*p));
+  p->pPlan = pIterator->pPlan;
+  p->xOpen = pIterator->xOpen;
+  p->xNext = pIterator->xNext;
+  p->xClose = pIterator->xClose;
+  p->xNextBatch = pIterator->xNextBatch;
+  p->pNext = pContext->pProfile;
+  pContext->pProfile = p;
+
+  pIterator->pProfile = p;
+  pIterator->xOpen = profileOpen;
+  pIterator->xNext = profileNext;
+  pIterator->xClose = profileClose;
+  if( p->xNextBatch ) pIterator->xNextBatch = profileNextBatch;
+  return SQLITE_OK;
+}
+
+/* Append z to pStr as a JSON string */
+static void profileJsonString(sqlite3_str *pStr, const char *z) {
+  sqlite3_str_appendchar(pStr, 1, '"');
+  for( ; *z; z++ ) {
+    unsigned char c = (unsigned char)*z;
+    if( c == '"' || c == '\\' ) {
+      sqlite3_str_appendf(pStr, "\\%c", c);
+    } else if( c < 0x20 ) {
+      sqlite3_str_appendf(pStr, "\\u%04x", c);
+    } else {
+      sqlite3_str_appendchar(pStr, 1, c);
+    }
+  }
+  sqlite3_str_appendchar(pStr, 1, '"');
+}
+
+static void profileRenderNode(sqlite3_str *pStr, ExecutionContext *pContext,
+                              PhysicalPlanNode *pNode) {
+  CypherOpProfile total;
+  CypherOpProfile *p;
+  char *zDetails;
+  int i;
+
+  /* Iterators running the same plan node are reported together */
+  memset(&total, 0, sizeof(total));
+  for( p = pContext->pProfile; p; p = p->pNext ) {
+    if( p->pPlan != pNode ) continue;
+    total.nOpen += p->nOpen;
+    total.nNext += p->nNext;
+    total.nRows += p->nRows;
+    total.rTime += p->rTime;
+    total.rChildTime += p->rChildTime;
+    /* Work is reported exclusive of the callees, time both ways */
+    countersAdd(&total.work, &p->work, &p->childWork);
+  }
+
+  sqlite3_str_appendall(pStr, "{\"operator\":");
+  profileJsonString(pStr, physicalOperatorTypeName(pNode->type));
+  if( pNode->zAlias ) {
+    sqlite3_str_appendall(pStr, ",\"alias\":");
+    profileJsonString(pStr, pNode->zAlias);
+  }
+  zDetails = physicalPlanNodeDetails(pNode);
+  if( zDetails ) {
+    sqlite3_str_appendall(pStr, ",\"details\":");
+    profileJsonString(pStr, zDetails);
+    sqlite3_free(zDetails);
+  }
+  sqlite3_str_appendf(pStr,
+      ",\"estimated_rows\":%lld,\"rows\":%lld,\"opens\":%lld,\"next_calls\":%lld"
+      ",\"time_ms\":%.3f,\"self_time_ms\":%.3f"
+      ",\"statements_stepped\":%lld,\"cache_hits\":%lld,\"cache_misses\":%lld"
+      ",\"json_bytes\":%lld",
+      pNode->iRows, total.nRows, total.nOpen, total.nNext,
+      total.rTime, total.rTime - total.rChildTime,
+      total.work.nStep, total.work.nCacheHit, total.work.nCacheMiss,
+      total.work.nJsonBytes);
+
+  if( pNode->nChildren > 0 ) {
+    sqlite3_str_appendall(pStr, ",\"children\":[");
+    for( i = 0; i < pNode->nChildren; i++ ) {
+      if( i > 0 ) sqlite3_str_appendchar(pStr, 1, ',');
+      profileRenderNode(pStr, pContext, pNode->apChildren[i]);
+    }
+    sqlite3_str_appendchar(pStr, 1, ']');
+  }
+  sqlite3_str_appendchar(pStr, 1, '}');
+}
+
+char *cypherProfileToJson(ExecutionContext *pContext, PhysicalPlanNode *pPlan) {
+  sqlite3_str *pStr;
+
+  if( !pContext || !pPlan ) return NULL;
+  pStr = sqlite3_str_new(pContext->pDb);
+  profileRenderNode(pStr, pContext, pPlan);
+  return sqlite3_str_finish(pStr);
+}
@@ -0,0 +1,732 @@
+/*
+ * Cypher Compiled Expressions Implementation
+ * Flat register bytecode for filter, projection and sort key hot loops
+ */
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include <string.h>
+#include <assert.h>
+#include "cypher-program.h"
+
+/* Opcodes. Instruction i always writes register i. */
+#define PROG_CONST   1   /* r = aConst[p1] */
+#define PROG_VAR     2   /* r = variable azVar[p1] */
+#define PROG_ARITH   3   /* r = r[p1] <p3> r[p2] */
+#define PROG_CMP     4   /* r = r[p1] <p3> r[p2], p2 < 0 for unary tests */
+#define PROG_AND     5   /* r = r[p1] AND r[p2] */
+#define PROG_OR      6   /* r = r[p1] OR r[p2] */
+#define PROG_XOR     7   /* r = r[p1] XOR r[p2] */
+#define PROG_NOT     8   /* r = NOT r[p1] */
+#define PROG_FUNC    9   /* r = pFunc(r[aArgReg[p1]] .. p2 arguments) */
+#define PROG_EVAL   10   /* r = cypherExpressionEvaluate(pExpr) */
+#define PROG_PROP   11   /* r = property pExpr->zProperty of r[p1] */
+#define PROG_PARAM  12   /* r = query parameter pExpr->zName */
+
+typedef struct CypherInstr {
+    int opcode;                           /* PROG_* */
+    int p1, p2, p3;                       /* Operands, see above */
+    const CypherBuiltinFunction *pFunc;   /* FUNC: resolved builtin */
+    const CypherExpression *pExpr;        /* EVAL: subtree to interpret;
+                                          ** PROP, PARAM: node compiled */
+} CypherInstr;
+
+struct CypherProgram {
+    CypherInstr *aOp;            /* Instructions */
+    int nOp, nOpAlloc;
+    CypherValue *aConst;         /* Constant pool, owned */
+    int nConst, nConstAlloc;
+    int *aArgReg;                /* Function argument registers */
+    int nArgReg, nArgRegAlloc;
+    char **azVar;                /* Variable names */
+    int nVar, nVarAlloc;
+    int *aVarSlot;               /* Per variable: last context binding index */
+    int *aVarCol;                /* Per variable: chunk column or -1 */
+    const CypherDataChunk *pColChunk; /* Chunk aVarCol was resolved for */
+    int nColChunk;               /* Its column count at the time */
+    CypherValue *aStore;         /* Values computed by each instruction */
+    const CypherValue **apReg;   /* Register contents: aStore or borrowed */
+    CypherValue *aArg;           /* Function argument scratch */
+    int nArgMax;
+    int bNeedsContext;           /* Has EVAL: chunk rows must be bound */
+};
+
+static const CypherValue nullValue;   /* Zeroed: CYPHER_VALUE_NULL */
+
+/* Append an instruction; returns its index (its register) or -1 */
+static int programEmit(CypherProgram *p, int opcode, int p1, int p2, int p3) {
+    CypherInstr *pOp;
+
+    if (p->nOp >= p->nOpAlloc) {
+        int nNew = p->nOpAlloc ? p->nOpAlloc * 2 : 8;
+        CypherInstr *aNew = sqlite3_realloc(p->aOp, nNew * sizeof(CypherInstr));
+        if (!aNew) return -1;
+        p->aOp = aNew;
+        p->nOpAlloc = nNew;
+    }
+    pOp = &p->aOp[p->nOp];
+    memset(pOp, 0, sizeof(*pOp));
+    pOp->opcode = opcode;
+    pOp->p1 = p1;
+    pOp->p2 = p2;
+    pOp->p3 = p3;
+    return p->nOp++;
+}
+
+/* Add a constant, taking ownership of *pValue; returns its index or -1 */
+static int programAddConst(CypherProgram *p, CypherValue *pValue) {
+    if (p->nConst >= p->nConstAlloc) {
+        int nNew = p->nConstAlloc ? p->nConstAlloc * 2 : 4;
+        CypherValue *aNew = sqlite3_realloc(p->aConst, nNew * sizeof(CypherValue));
+        if (!aNew) {
+            cypherValueDestroy(pValue);
+            return -1;
+        }
+        p->aConst = aNew;
+        p->nConstAlloc = nNew;
+    }
+    p->aConst[p->nConst] = *pValue;
+    return p->nConst++;
+}
+
+/* Index of variable zName, added on first use; -1 if out of memory */
+static int programAddVar(CypherProgram *p, const char *zName) {
+    int i;
+
+    for (i = 0; i < p->nVar; i++) {
+        if (strcmp(p->azVar[i], zName) == 0) return i;
+    }
+    if (p->nVar >= p->nVarAlloc) {
+        int nNew = p->nVarAlloc ? p->nVarAlloc * 2 : 4;
+        char **azNew = sqlite3_realloc(p->azVar, nNew * sizeof(char*));
+        if (!azNew) return -1;
+        p->azVar = azNew;
+        p->nVarAlloc = nNew;
+    }
+    p->azVar[p->nVar] = sqlite3_mprintf("%s", zName);
+    if (!p->azVar[p->nVar]) return -1;
+    return p->nVar++;
+}
+
+static int programAddArgReg(CypherProgram *p, int iReg) {
+    if (p->nArgReg >= p->nArgRegAlloc) {
+        int nNew = p->nArgRegAlloc ? p->nArgRegAlloc * 2 : 4;
+        int *aNew = sqlite3_realloc(p->aArgReg, nNew * sizeof(int));
+        if (!aNew) return -1;
+        p->aArgReg = aNew;
+        p->nArgRegAlloc = nNew;
+    }
+    p->aArgReg[p->nArgReg] = iReg;
+    return p->nArgReg++;
+}
+
+/* Emit an EVAL of pExpr by the tree interpreter */
+static int programEmitEval(CypherProgram *p, const CypherExpression *pExpr) {
+    int iReg = programEmit(p, PROG_EVAL, 0, 0, 0);
+    if (iReg >= 0) {
+        p->aOp[iReg].pExpr = pExpr;
+        p->bNeedsContext = 1;
+    }
+    return iReg;
+}
+
+/*
+ * Compile pExpr, returning the register holding its value or -1 if out
+ * of memory.
+ */
+static int programCompileExpr(CypherProgram *p, const CypherExpression *pExpr) {
+    int iLeft, iRight, iReg, i;
+
+    if (!pExpr) {
+        CypherValue null;
+        cypherValueInit(&null);
+        i = programAddConst(p, &null);
+        return i < 0 ? -1 : programEmit(p, PROG_CONST, i, 0, 0);
+    }
+
+    /* Fold constant subtrees. On an evaluation error the subtree is
+     * compiled as usual so that the error is raised per row, as before. */
+    if (pExpr->type != CYPHER_EXPR_LITERAL && cypherExpressionIsConstant(pExpr)) {
+        CypherValue value;
+        if (cypherExpressionEvaluate(pExpr, NULL, &value) == SQLITE_OK) {
+            i = programAddConst(p, &value);
+            return i < 0 ? -1 : programEmit(p, PROG_CONST, i, 0, 0);
+        }
+        cypherValueDestroy(&value);
+    }
+
+    switch (pExpr->type) {
+        case CYPHER_EXPR_LITERAL: {
+            /* Borrowed from the expression, which outlives the program */
+            CypherValue *pCopy = cypherValueCopy((CypherValue*)&pExpr->u.literal);
+            if (!pCopy) return -1;
+            i = programAddConst(p, pCopy);
+            sqlite3_free(pCopy);
+            return i < 0 ? -1 : programEmit(p, PROG_CONST, i, 0, 0);
+        }
+
+        case CYPHER_EXPR_VARIABLE:
+            if (!pExpr->u.variable.zName) return programEmitEval(p, pExpr);
+            i = programAddVar(p, pExpr->u.variable.zName);
+            return i < 0 ? -1 : programEmit(p, PROG_VAR, i, 0, 0);
+
+        case CYPHER_EXPR_ARITHMETIC:
+        case CYPHER_EXPR_COMPARISON:
+            iLeft = programCompileExpr(p, pExpr->u.binary.pLeft);
+            if (iLeft < 0) return -1;
+            if (pExpr->type == CYPHER_EXPR_COMPARISON &&
+                (pExpr->u.binary.op == CYPHER_CMP_IS_NULL ||
+                 pExpr->u.binary.op == CYPHER_CMP_IS_NOT_NULL) &&
+                !pExpr->u.binary.pRight) {
+                iRight = -1;
+            } else {
+                iRight = programCompileExpr(p, pExpr->u.binary.pRight);
+                if (iRight < 0) return -1;
+            }
+            return programEmit(p, pExpr->type == CYPHER_EXPR_ARITHMETIC ? PROG_ARITH : PROG_CMP,
+                               iLeft, iRight, pExpr->u.binary.op);
+
+        case CYPHER_EXPR_LOGICAL:
+            iLeft = programCompileExpr(p, pExpr->u.binary.pLeft);
+            if (iLeft < 0) return -1;
+            if (pExpr->u.binary.op == CYPHER_LOGIC_NOT) {
+                return programEmit(p, PROG_NOT, iLeft, 0, 0);
+            }
+            iRight = programCompileExpr(p, pExpr->u.binary.pRight);
+            if (iRight < 0) return -1;
+            switch (pExpr->u.binary.op) {
+                case CYPHER_LOGIC_AND: return programEmit(p, PROG_AND, iLeft, iRight, 0);
+                case CYPHER_LOGIC_OR:  return programEmit(p, PROG_OR, iLeft, iRight, 0);
+                case CYPHER_LOGIC_XOR: return programEmit(p, PROG_XOR, iLeft, iRight, 0);
+                default:               return programEmitEval(p, pExpr);
+            }
+
+        case CYPHER_EXPR_FUNCTION: {
+            const CypherBuiltinFunction *pFunc = cypherGetBuiltinFunction(pExpr->u.function.zName);
+            int nArgs = pExpr->u.function.nArgs;
+            int iFirst;
+
+            /* Unknown functions and bad argument counts fail per row */
+            if (!pFunc || nArgs < pFunc->nMinArgs ||
+                (pFunc->nMaxArgs >= 0 && nArgs > pFunc->nMaxArgs)) {
+                return programEmitEval(p, pExpr);
+            }
+
+            /* Arguments first, so their registers are all set when the
+             * call runs; aArgReg then lists them contiguously */
+            int *aArg = nArgs > 0 ? sqlite3_malloc(nArgs * sizeof(int)) : NULL;
+            if (nArgs > 0 && !aArg) return -1;
+            for (i = 0; i < nArgs; i++) {
+                aArg[i] = programCompileExpr(p, pExpr->u.function.apArgs[i]);
+                if (aArg[i] < 0) {
+                    sqlite3_free(aArg);
+                    return -1;
+                }
+            }
+            iFirst = p->nArgReg;
+            for (i = 0; i < nArgs; i++) {
+                if (programAddArgReg(p, aArg[i]) < 0) {
+                    sqlite3_free(aArg);
+                    return -1;
+                }
+            }
+            sqlite3_free(aArg);
+            if (nArgs > p->nArgMax) p->nArgMax = nArgs;
+
+            iReg = programEmit(p, PROG_FUNC, iFirst, nArgs, 0);
+            if (iReg >= 0) p->aOp[iReg].pFunc = pFunc;
+            return iReg;
+        }
+
+        case CYPHER_EXPR_PROPERTY:
+            /* Reads the object's register, so chunk rows need no binding */
+            iLeft = programCompileExpr(p, pExpr->u.property.pObject);
+            if (iLeft < 0) return -1;
+            iReg = programEmit(p, PROG_PROP, iLeft, 0, 0);
+            if (iReg >= 0) p->aOp[iReg].pExpr = pExpr;
+            return iReg;
+
+        case CYPHER_EXPR_PARAMETER:
+            iReg = programEmit(p, PROG_PARAM, 0, 0, 0);
+            if (iReg >= 0) p->aOp[iReg].pExpr = pExpr;
+            return iReg;
+
+        default:
+            /* Lists, maps, CASE and string operators */
+            return programEmitEval(p, pExpr);
+    }
+}
+
+int cypherProgramCompile(const CypherExpression *pExpr, CypherProgram **ppProgram) {
+    CypherProgram *p;
+    int i;
+
+    *ppProgram = NULL;
+    p = sqlite3_malloc(sizeof(CypherProgram));
+    if (!p) return SQLITE_NOMEM;
+    memset(p, 0, sizeof(CypherProgram));
+
+    if (programCompileExpr(p, pExpr) < 0) {
+        cypherProgramFree(p);
+        return SQLITE_NOMEM;
+    }
+
+    p->aStore = sqlite3_malloc(p->nOp * sizeof(CypherValue));
+    p->apReg = sqlite3_malloc(p->nOp * sizeof(CypherValue*));
+    p->aVarSlot = sqlite3_malloc((p->nVar + 1) * sizeof(int));
+    p->aVarCol = sqlite3_malloc((p->nVar + 1) * sizeof(int));
+    p->aArg = sqlite3_malloc((p->nArgMax + 1) * sizeof(CypherValue));
+    if (!p->aStore || !p->apReg || !p->aVarSlot || !p->aVarCol || !p->aArg) {
+        cypherProgramFree(p);
+        return SQLITE_NOMEM;
+    }
+    for (i = 0; i < p->nOp; i++) cypherValueInit(&p->aStore[i]);
+    for (i = 0; i < p->nVar; i++) {
+        p->aVarSlot[i] = 0;
+        p->aVarCol[i] = -1;
+    }
+
+    *ppProgram = p;
+    return SQLITE_OK;
+}
+
+void cypherProgramFree(CypherProgram *p) {
+    int i;
+
+    if (!p) return;
+
+    if (p->aStore) {
+        for (i = 0; i < p->nOp; i++) cypherValueDestroy(&p->aStore[i]);
+    }
+    for (i = 0; i < p->nConst; i++) cypherValueDestroy(&p->aConst[i]);
+    for (i = 0; i < p->nVar; i++) sqlite3_free(p->azVar[i]);
+    sqlite3_free(p->aOp);
+    sqlite3_free(p->aConst);
+    sqlite3_free(p->aArgReg);
+    sqlite3_free(p->azVar);
+    sqlite3_free(p->aVarSlot);
+    sqlite3_free(p->aVarCol);
+    sqlite3_free(p->aStore);
+    sqlite3_free(p->apReg);
+    sqlite3_free(p->aArg);
+    sqlite3_free(p);
+}
+
+int cypherProgramSize(const CypherProgram *p) {
+    return p ? p->nOp : 0;
+}
+
+/* Map variables to the columns of pChunk, once per chunk layout */
+static void programResolveColumns(CypherProgram *p, const CypherDataChunk *pChunk) {
+    int i, iCol;
+
+    if (p->pColChunk == pChunk && p->nColChunk == pChunk->nCol) return;
+    for (i = 0; i < p->nVar; i++) {
+        p->aVarCol[i] = -1;
+        for (iCol = 0; iCol < pChunk->nCol; iCol++) {
+            if (strcmp(pChunk->aCol[iCol].zName, p->azVar[i]) == 0) {
+                p->aVarCol[i] = iCol;
+                break;
+            }
+        }
+    }
+    p->pColChunk = pChunk;
+    p->nColChunk = pChunk->nCol;
+}
+
+/* Context binding of variable i; the slot found last time is tried first */
+static const CypherValue *programContextVar(CypherProgram *p, ExecutionContext *pContext, int i) {
+    int iSlot = p->aVarSlot[i];
+    int j;
+
+    if (!pContext) return &nullValue;
+    if (iSlot < pContext->nVariables && strcmp(pContext->azVariables[iSlot], p->azVar[i]) == 0) {
+        return &pContext->aBindings[iSlot];
+    }
+    for (j = 0; j < pContext->nVariables; j++) {
+        if (strcmp(pContext->azVariables[j], p->azVar[i]) == 0) {
+            p->aVarSlot[i] = j;
+            return &pContext->aBindings[j];
+        }
+    }
+    return &nullValue;
+}
+
+/* Boolean view of a logical operand: 1, 0, or -1 for NULL */
+static int programTruth(const CypherValue *pValue, int *pbValue) {
+    if (pValue->type == CYPHER_VALUE_NULL) {
+        *pbValue = -1;
+        return SQLITE_OK;
+    }
+    if (pValue->type != CYPHER_VALUE_BOOLEAN) return SQLITE_MISMATCH;
+    *pbValue = pValue->u.bBoolean ? 1 : 0;
+    return SQLITE_OK;
+}
+
+static int programIsNumeric(const CypherValue *pValue) {
+    return pValue->type == CYPHER_VALUE_INTEGER || pValue->type == CYPHER_VALUE_FLOAT;
+}
+
+/* Apply an ordering comparison operator to a three-way result */
+static int programCmpResult(int op, int cmp) {
+    switch (op) {
+        case CYPHER_CMP_EQUAL:         return cmp == 0;
+        case CYPHER_CMP_NOT_EQUAL:     return cmp != 0;
+        case CYPHER_CMP_LESS:          return cmp < 0;
+        case CYPHER_CMP_LESS_EQUAL:    return cmp <= 0;
+        case CYPHER_CMP_GREATER:       return cmp > 0;
+        default:                       return cmp >= 0;
+    }
+}
+
+/* Destroy the values computed by the last run */
+static void programRelease(CypherProgram *p) {
+    int i;
+
+    for (i = 0; i < p->nOp; i++) {
+        if (p->aStore[i].type >= CYPHER_VALUE_STRING) {
+            cypherValueDestroy(&p->aStore[i]);
+        }
+        p->aStore[i].type = CYPHER_VALUE_NULL;
+    }
+}
+
+/*
+ * Run the program. Variables come from physical row iRow of pChunk when
+ * pChunk is not NULL and names one of its columns, otherwise from the
+ * context. *ppOut is the result register, valid until programRelease().
+ */
+static int programRun(CypherProgram *p, ExecutionContext *pContext,
+                      CypherDataChunk *pChunk, int iRow,
+                      const CypherValue **ppOut) {
+    const CypherValue **apReg = p->apReg;
+    CypherValue *aStore = p->aStore;
+    int rc = SQLITE_OK;
+    int i;
+
+    if (pChunk) {
+        programResolveColumns(p, pChunk);
+        if (p->bNeedsContext) {
+            rc = cypherChunkBindRow(pChunk, iRow, pContext);
+            if (rc != SQLITE_OK) return rc;
+        }
+    }
+
+    for (i = 0; i < p->nOp; i++) {
+        const CypherInstr *pOp = &p->aOp[i];
+        CypherValue *pOut = &aStore[i];
+
+        switch (pOp->opcode) {
+            case PROG_CONST:
+                apReg[i] = &p->aConst[pOp->p1];
+                break;
+
+            case PROG_VAR: {
+                int iCol = pChunk ? p->aVarCol[pOp->p1] : -1;
+                if (iCol >= 0) {
+                    CypherVector *pCol = &pChunk->aCol[iCol];
+                    if (pCol->eType == CYPHER_VECTOR_NODE) {
+                        pOut->type = CYPHER_VALUE_NODE;
+                        pOut->u.iNodeId = pCol->aId[iRow];
+                        apReg[i] = pOut;
+                    } else {
+                        apReg[i] = &pCol->aValue[iRow];
+                    }
+                } else {
+                    apReg[i] = programContextVar(p, pContext, pOp->p1);
+                }
+                break;
+            }
+
+            case PROG_ARITH: {
+                const CypherValue *pL = apReg[pOp->p1];
+                const CypherValue *pR = apReg[pOp->p2];
+                apReg[i] = pOut;
+                if (pL->type == CYPHER_VALUE_INTEGER && pR->type == CYPHER_VALUE_INTEGER) {
+                    /* Wraps on overflow, as cypherEvaluateArithmetic() */
+                    sqlite3_uint64 a = (sqlite3_uint64)pL->u.iInteger;
+                    sqlite3_uint64 b = (sqlite3_uint64)pR->u.iInteger;
+                    if (pOp->p3 == CYPHER_OP_ADD) {
+                        pOut->type = CYPHER_VALUE_INTEGER;
+                        pOut->u.iInteger = (sqlite3_int64)(a + b);
+                        break;
+                    } else if (pOp->p3 == CYPHER_OP_SUBTRACT) {
+                        pOut->type = CYPHER_VALUE_INTEGER;
+                        pOut->u.iInteger = (sqlite3_int64)(a - b);
+                        break;
+                    } else if (pOp->p3 == CYPHER_OP_MULTIPLY) {
+                        pOut->type = CYPHER_VALUE_INTEGER;
+                        pOut->u.iInteger = (sqlite3_int64)(a * b);
+                        break;
+                    } else if (pOp->p3 == CYPHER_OP_MODULO &&
+                               pR->u.iInteger != 0 && pR->u.iInteger != -1) {
+                        pOut->type = CYPHER_VALUE_INTEGER;
+                        pOut->u.iInteger = pL->u.iInteger % pR->u.iInteger;
+                        break;
+                    }
+                }
+                rc = cypherEvaluateArithmetic(pL, pR, (CypherArithmeticOp)pOp->p3, pOut);
+                break;
+            }
+
+            case PROG_CMP: {
+                const CypherValue *pL = apReg[pOp->p1];
+                const CypherValue *pR = pOp->p2 >= 0 ? apReg[pOp->p2] : &nullValue;
+                int op = pOp->p3;
+                apReg[i] = pOut;
+                if (op <= CYPHER_CMP_GREATER_EQUAL) {
+                    /* Typed fast paths for ordering comparisons */
+                    if (pL->type == CYPHER_VALUE_INTEGER && pR->type == CYPHER_VALUE_INTEGER) {
+                        sqlite3_int64 a = pL->u.iInteger, b = pR->u.iInteger;
+                        pOut->type = CYPHER_VALUE_BOOLEAN;
+                        pOut->u.bBoolean = programCmpResult(op, (a > b) - (a < b));
+                        break;
+                    }
+                    if (programIsNumeric(pL) && programIsNumeric(pR)) {
+                        double a = pL->type == CYPHER_VALUE_INTEGER ? (double)pL->u.iInteger : pL->u.rFloat;
+                        double b = pR->type == CYPHER_VALUE_INTEGER ? (double)pR->u.iInteger : pR->u.rFloat;
+                        pOut->type = CYPHER_VALUE_BOOLEAN;
+                        pOut->u.bBoolean = programCmpResult(op, (a > b) - (a < b));
+                        break;
+                    }
+                    if (pL->type == CYPHER_VALUE_NULL || pR->type == CYPHER_VALUE_NULL) {
+                        pOut->type = CYPHER_VALUE_NULL;
+                        break;
+                    }
+                }
+                rc = cypherEvaluateComparison(pL, pR, (CypherComparisonOp)op, pOut);
+                break;
+            }
+
+            case PROG_AND:
+            case PROG_OR:
+            case PROG_XOR:
+            case PROG_NOT: {
+                int a, b = 0, r;
+                rc = programTruth(apReg[pOp->p1], &a);
+                if (rc == SQLITE_OK && pOp->opcode != PROG_NOT) {
+                    rc = programTruth(apReg[pOp->p2], &b);
+                }
+                if (rc != SQLITE_OK) break;
+                switch (pOp->opcode) {
+                    case PROG_AND:
+                        r = (a == 0 || b == 0) ? 0 : (a < 0 || b < 0) ? -1 : 1;
+                        break;
+                    case PROG_OR:
+                        r = (a == 1 || b == 1) ? 1 : (a < 0 || b < 0) ? -1 : 0;
+                        break;
+                    case PROG_XOR:
+                        r = (a < 0 || b < 0) ? -1 : (a != b);
+                        break;
+                    default:
+                        r = a < 0 ? -1 : !a;
+                        break;
+                }
+                if (r < 0) {
+                    pOut->type = CYPHER_VALUE_NULL;
+                } else {
+                    pOut->type = CYPHER_VALUE_BOOLEAN;
+                    pOut->u.bBoolean = r;
+                }
+                apReg[i] = pOut;
+                break;
+            }
+
+            case PROG_FUNC: {
+                int j;
+                /* Builtins read their arguments only; shallow copies do */
+                for (j = 0; j < pOp->p2; j++) {
+                    p->aArg[j] = *apReg[p->aArgReg[pOp->p1 + j]];
+                }
+                rc = pOp->pFunc->xFunction(p->aArg, pOp->p2, pOut);
+                apReg[i] = pOut;
+                break;
+            }
+
+            case PROG_EVAL:
+                cypherValueDestroy(pOut);
+                rc = cypherExpressionEvaluate(pOp->pExpr, pContext, pOut);
+                apReg[i] = pOut;
+                break;
+
+            case PROG_PROP:
+                cypherValueDestroy(pOut);
+                if (pContext) {
+                    rc = executionContextProperty(pContext, apReg[pOp->p1],
+                                                  pOp->pExpr->u.property.zProperty, pOut);
+                }
+                apReg[i] = pOut;
+                break;
+
+            case PROG_PARAM:
+                cypherValueDestroy(pOut);
+                rc = cypherParameterValue(pContext, pOp->pExpr->u.parameter.zName, pOut);
+                apReg[i] = pOut;
+                break;
+
+            default:
+                rc = SQLITE_CORRUPT;
+                break;
+        }
+        if (rc != SQLITE_OK) return rc;
+    }
+
+    *ppOut = p->nOp > 0 ? apReg[p->nOp - 1] : &nullValue;
+    return SQLITE_OK;
+}
+
+/* Hand the result register to the caller as an owned value */
+static int programTakeResult(CypherProgram *p, const CypherValue *pReg, CypherValue *pResult) {
+    if (pReg >= p->aStore && pReg < p->aStore + p->nOp) {
+        CypherValue *pStore = (CypherValue*)pReg;
+        *pResult = *pStore;
+        cypherValueInit(pStore);
+    } else {
+        if (cypherValueCopyIn(0, pResult, pReg)) return SQLITE_NOMEM;
+    }
+    return SQLITE_OK;
+}
+
+static int programTruthy(const CypherValue *pValue) {
+    return pValue->type != CYPHER_VALUE_NULL &&
+           (pValue->type != CYPHER_VALUE_BOOLEAN || pValue->u.bBoolean);
+}
+
+int cypherProgramEvaluate(CypherProgram *p, ExecutionContext *pContext,
+                          CypherValue *pResult) {
+    return cypherProgramEvaluateRow(p, pContext, NULL, 0, pResult);
+}
+
+int cypherProgramEvaluateRow(CypherProgram *p, ExecutionContext *pContext,
+                             CypherDataChunk *pChunk, int iRow,
+                             CypherValue *pResult) {
+    const CypherValue *pReg;
+    int rc;
+
+    if (!p || !pResult) return SQLITE_MISUSE;
+    cypherValueInit(pResult);
+
+    rc = programRun(p, pContext, pChunk, iRow, &pReg);
+    if (rc == SQLITE_OK) rc = programTakeResult(p, pReg, pResult);
+    programRelease(p);
+    return rc;
+}
+
+int cypherProgramTest(CypherProgram *p, ExecutionContext *pContext, int *pbTrue) {
+    const CypherValue *pReg;
+    int rc;
+
+    if (!p || !pbTrue) return SQLITE_MISUSE;
+
+    rc = programRun(p, pContext, NULL, 0, &pReg);
+    if (rc == SQLITE_OK) *pbTrue = programTruthy(pReg);
+    programRelease(p);
+    return rc;
+}
+
+/*
+ * Batch fast path for "variable <cmp> numeric constant" over a VALUE
+ * column: compares the vector in a tight loop. Returns 1 if it applied.
+ * Rows whose value is not numeric are left to the caller via aKeep = 2.
+ */
+static int programFilterSimple(CypherProgram *p, CypherDataChunk *pChunk,
+                               unsigned char *aKeep, int *pnRest) {
+    const CypherInstr *aOp = p->aOp;
+    const CypherValue *pConst;
+    CypherVector *pCol;
+    int op, iCol, i, bConstLeft;
+    int nRest = 0;
+
+    if (p->nOp != 3 || aOp[2].opcode != PROG_CMP) return 0;
+    op = aOp[2].p3;
+    if (op > CYPHER_CMP_GREATER_EQUAL) return 0;
+    if (aOp[0].opcode == PROG_VAR && aOp[1].opcode == PROG_CONST) {
+        bConstLeft = 0;
+        iCol = p->aVarCol[aOp[0].p1];
+        pConst = &p->aConst[aOp[1].p1];
+    } else if (aOp[0].opcode == PROG_CONST && aOp[1].opcode == PROG_VAR) {
+        bConstLeft = 1;
+        iCol = p->aVarCol[aOp[1].p1];
+        pConst = &p->aConst[aOp[0].p1];
+    } else {
+        return 0;
+    }
+    if (iCol < 0 || !programIsNumeric(pConst)) return 0;
+    pCol = &pChunk->aCol[iCol];
+    if (pCol->eType != CYPHER_VECTOR_VALUE) return 0;
+
+    if (bConstLeft) {
+        /* c < x is x > c */
+        switch (op) {
+            case CYPHER_CMP_LESS:          op = CYPHER_CMP_GREATER; break;
+            case CYPHER_CMP_LESS_EQUAL:    op = CYPHER_CMP_GREATER_EQUAL; break;
+            case CYPHER_CMP_GREATER:       op = CYPHER_CMP_LESS; break;
+            case CYPHER_CMP_GREATER_EQUAL: op = CYPHER_CMP_LESS_EQUAL; break;
+            default: break;
+        }
+    }
+
+    if (pConst->type == CYPHER_VALUE_INTEGER) {
+        sqlite3_int64 c = pConst->u.iInteger;
+        for (i = 0; i < pChunk->nSel; i++) {
+            const CypherValue *pV = &pCol->aValue[cypherChunkRow(pChunk, i)];
+            if (pV->type == CYPHER_VALUE_INTEGER) {
+                sqlite3_int64 v = pV->u.iInteger;
+                aKeep[i] = (unsigned char)programCmpResult(op, (v > c) - (v < c));
+            } else if (pV->type == CYPHER_VALUE_FLOAT) {
+                double v = pV->u.rFloat, d = (double)c;
+                aKeep[i] = (unsigned char)programCmpResult(op, (v > d) - (v < d));
+            } else if (pV->type == CYPHER_VALUE_NULL) {
+                aKeep[i] = 0;
+            } else {
+                aKeep[i] = 2;
+                nRest++;
+            }
+        }
+    } else {
+        double c = pConst->u.rFloat;
+        for (i = 0; i < pChunk->nSel; i++) {
+            const CypherValue *pV = &pCol->aValue[cypherChunkRow(pChunk, i)];
+            if (programIsNumeric(pV)) {
+                double v = pV->type == CYPHER_VALUE_INTEGER ? (double)pV->u.iInteger : pV->u.rFloat;
+                aKeep[i] = (unsigned char)programCmpResult(op, (v > c) - (v < c));
+            } else if (pV->type == CYPHER_VALUE_NULL) {
+                aKeep[i] = 0;
+            } else {
+                aKeep[i] = 2;
+                nRest++;
+            }
+        }
+    }
+
+    *pnRest = nRest;
+    return 1;
+}
+
+int cypherProgramFilter(CypherProgram *p, ExecutionContext *pContext,
+                        CypherDataChunk *pChunk, unsigned char *aKeep) {
+    const CypherValue *pReg;
+    int nRest = 0;
+    int bAll = 1;
+    int rc, i;
+
+    if (!p || !pChunk || !aKeep) return SQLITE_MISUSE;
+
+    programResolveColumns(p, pChunk);
+    if (programFilterSimple(p, pChunk, aKeep, &nRest)) {
+        if (nRest == 0) return SQLITE_OK;
+        bAll = 0;
+    }
+
+    for (i = 0; i < pChunk->nSel; i++) {
+        if (!bAll && aKeep[i] != 2) continue;
+        rc = programRun(p, pContext, pChunk, cypherChunkRow(pChunk, i), &pReg);
+        if (rc == SQLITE_OK) aKeep[i] = (unsigned char)programTruthy(pReg);
+        programRelease(p);
+        if (rc != SQLITE_OK) return rc;
+    }
+    return SQLITE_OK;
+}
@@ -0,0 +1,1173 @@
+/*
+** SQLite Graph Database Extension - Sort Operator Engine
+**
+** A sorter holds SorterRecords: a row plus its normalized key. Keys are
+** built once per row when it is added, so every comparison afterwards is
+** a memcmp(). Records are buffered in aRecord[] and sorted there with an
+** introsort (median-of-three quicksort, heapsort past 2*log2(n) levels,
+** insertion sort below SORTER_INSERTION rows).
+**
+** When the buffered bytes exceed the budget the records are sorted and
+** appended to a temporary file as a run of
+**
+**     u32 nKey, key bytes, u32 nRow, serialized row
+**
+** records. Finishing a spilled sort writes the rest as one more run,
+** merges runs CYPHER_SORT_MERGE_FANIN at a time until at most that many
+** remain, and streams the output from a final merge. Space of merged
+** runs is not reclaimed; the file is deleted when the sorter is freed.
+**
+** With a row limit aRecord[] is instead a max-heap of the nLimit
+** smallest keys seen so far; a row that does not beat the heap top is
+** dropped as soon as its key is built.
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "cypher-sort.h"
+#include <string.h>
+#include <assert.h>
+
+#define SORTER_SIGN       ((sqlite3_uint64)1 << 63)
+#define SORTER_INSERTION  16         /* Insertion sort below this many rows */
+#define SORTER_IO_BUFFER  16384      /* Bytes buffered per run reader/writer */
+#define SORTER_MAX_DEPTH  64         /* Nesting accepted when reading rows */
+
+/*
+** Leading byte of each encoded key value. The order of these classes is
+** the openCypher ORDER BY order across types.
+*/
+#define SORTER_KEY_MAP     1
+#define SORTER_KEY_NODE    2
+#define SORTER_KEY_REL     3
+#define SORTER_KEY_LIST    4
+#define SORTER_KEY_PATH    5
+#define SORTER_KEY_STRING  6
+#define SORTER_KEY_BOOLEAN 7
+#define SORTER_KEY_NUMBER  8
+#define SORTER_KEY_NULL    9
+
+/*
+** Growable byte buffer. The first allocation failure is remembered in
+** rc and turns later appends into no-ops.
+*/
+typedef struct SorterBuf SorterBuf;
+struct SorterBuf {
+  unsigned char *a;
+  int n;
+  int nAlloc;
+  int rc;
+};
+
+/*
+** A buffered row. aKey[] follows the structure in the same allocation.
+*/
+typedef struct SorterRecord SorterRecord;
+struct SorterRecord {
+  CypherResult *pRow;       /* The row, owned */
+  sqlite3_int64 nByte;      /* Bytes charged against the memory budget */
+  int nKey;                 /* Bytes in aKey */
+  unsigned char aKey[];     /* Normalized sort key */
+};
+
+/*
+** A sorted run in the temporary file.
+*/
+typedef struct SorterRun SorterRun;
+struct SorterRun {
+  sqlite3_int64 iOff;       /* Offset of the first record */
+  sqlite3_int64 nByte;      /* Bytes of records */
+};
+
+/*
+** Buffered sequential writer appending to the temporary file.
+*/
+typedef struct SorterWriter SorterWriter;
+struct SorterWriter {
+  sqlite3_file *pFd;
+  sqlite3_int64 iOff;       /* File offset of aBuf[0] */
+  unsigned char *aBuf;      /* SORTER_IO_BUFFER bytes */
+  int nBuf;                 /* Bytes pending in aBuf */
+  int rc;
+};
+
+/*
+** Buffered reader over one run. aRec holds the current record: nKey key
+** bytes followed by nRow row bytes.
+*/
+typedef struct SorterReader SorterReader;
+struct SorterReader {
+  sqlite3_file *pFd;
+  sqlite3_int64 iOff;       /* File offset of the next block to load */
+  sqlite3_int64 iEnd;       /* End of the run */
+  unsigned char *aBuf;      /* SORTER_IO_BUFFER bytes */
+  int nBuf;                 /* Valid bytes in aBuf */
+  int iBuf;                 /* Next unread byte of aBuf */
+  unsigned char *aRec;      /* Current record */
+  int nRecAlloc;            /* Allocated bytes of aRec */
+  int nKey;                 /* Key bytes of the current record */
+  int nRow;                 /* Row bytes of the current record */
+  int bEof;                 /* No current record */
+};
+
+/*
+** K-way merge: a min-heap of reader indexes ordered by current key.
+*/
+typedef struct SorterMerger SorterMerger;
+struct SorterMerger {
+  SorterReader *aReader;
+  int nReader;
+  int *aHeap;
+  int nHeap;
+};
+
+struct CypherSorter {
+  sqlite3 *pDb;             /* Connection whose VFS holds the temp file */
+  int nKey;                 /* Sort keys per row */
+  unsigned char *aFlags;    /* PLAN_SORT_* per key, or NULL */
+  int nLimit;               /* Rows to return, 0 for all */
+  sqlite3_int64 nMemory;    /* Spill threshold in bytes */
+  sqlite3_uint64 iSeq;      /* Sequence number of the next row */
+  SorterBuf key;            /* Scratch key encoding */
+  SorterBuf row;            /* Scratch row serialization */
+
+  SorterRecord **aRecord;   /* Buffered records */
+  int nRecord;
+  int nRecordAlloc;
+  sqlite3_int64 nInMemory;  /* Bytes charged for aRecord */
+  int bTopK;                /* aRecord is a max-heap of at most nLimit */
+  int bFinished;            /* cypherSorterFinish() was called */
+  int iNext;                /* Next in-memory record to return */
+  int nReturned;            /* Rows returned so far */
+
+  sqlite3_file *pFd;        /* Temporary file, once spilled */
+  sqlite3_int64 iEof;       /* End of the temporary file */
+  unsigned char *aWriteBuf; /* Writer buffer, SORTER_IO_BUFFER bytes */
+  SorterRun *aRun;
+  int nRun;
+  int nRunAlloc;
+  sqlite3_int64 nSpilled;   /* Rows written to runs */
+  SorterMerger *pMerger;    /* Final merge of a spilled sort */
+};
+
+/*
+** Byte buffers.
+*/
+
+static void sorterBufAppend(SorterBuf *p, const void *pData, int n){
+  if( p->rc!=SQLITE_OK || n<=0 ) return;
+  if( p->n + n > p->nAlloc ){
+    int nNew = p->nAlloc ? p->nAlloc*2 : 64;
+    unsigned char *aNew;
+    while( nNew < p->n + n ) nNew *= 2;
+    aNew = sqlite3_realloc(p->a, nNew);
+    if( !aNew ){
+      p->rc = SQLITE_NOMEM;
+      return;
+    }
+    p->a = aNew;
+    p->nAlloc = nNew;
+  }
+  memcpy(&p->a[p->n], pData, n);
+  p->n += n;
+}
+
+static void sorterBufByte(SorterBuf *p, unsigned char c){
+  sorterBufAppend(p, &c, 1);
+}
+
+/* Big-endian, so that memcmp() orders the values as unsigned integers */
+static void sorterBufBig64(SorterBuf *p, sqlite3_uint64 u){
+  unsigned char a[8];
+  int i;
+  for( i=0; i<8; i++ ){
+    a[i] = (unsigned char)(u >> (56 - 8*i));
+  }
+  sorterBufAppend(p, a, 8);
+}
+
+static void sorterBufU32(SorterBuf *p, unsigned int u){
+  sorterBufAppend(p, &u, 4);
+}
+
+/*
+** Normalized keys.
+*/
+
+/* Map a double onto an unsigned integer with the same order */
+static sqlite3_uint64 sorterDoubleKey(double r){
+  sqlite3_uint64 u;
+  if( r==0.0 ) r = 0.0;     /* -0.0 and 0.0 are equal */
+  memcpy(&u, &r, sizeof(u));
+  return (u & SORTER_SIGN) ? ~u : (u | SORTER_SIGN);
+}
+
+/*
+** Tie-break for numbers whose doubles are equal: integers beyond 2^53
+** round to the same double but must still order exactly.
+*/
+static sqlite3_int64 sorterDoubleToInt(double r){
+  if( r!=r ) return 0;
+  if( r <= -9223372036854775808.0 ) return (sqlite3_int64)SORTER_SIGN;
+  if( r >= 9223372036854775807.0 ) return (sqlite3_int64)(SORTER_SIGN - 1);
+  return (sqlite3_int64)r;
+}
+
+/* Nul-terminated, so that a string orders before its extensions */
+static void sorterKeyString(SorterBuf *p, const char *z){
+  if( z ) sorterBufAppend(p, z, (int)strlen(z));
+  sorterBufByte(p, 0);
+}
+
+static void sorterKeyValue(SorterBuf *p, const CypherValue *pVal){
+  int i;
+  switch( pVal->type ){
+    case CYPHER_VALUE_NULL:
+      sorterBufByte(p, SORTER_KEY_NULL);
+      break;
+    case CYPHER_VALUE_BOOLEAN:
+      sorterBufByte(p, SORTER_KEY_BOOLEAN);
+      sorterBufByte(p, pVal->u.bBoolean ? 1 : 0);
+      break;
+    case CYPHER_VALUE_INTEGER:
+      sorterBufByte(p, SORTER_KEY_NUMBER);
+      sorterBufBig64(p, sorterDoubleKey((double)pVal->u.iInteger));
+      sorterBufBig64(p, (sqlite3_uint64)pVal->u.iInteger ^ SORTER_SIGN);
+      break;
+    case CYPHER_VALUE_FLOAT:
+      sorterBufByte(p, SORTER_KEY_NUMBER);
+      sorterBufBig64(p, sorterDoubleKey(pVal->u.rFloat));
+      sorterBufBig64(p, (sqlite3_uint64)sorterDoubleToInt(pVal->u.rFloat)
+                        ^ SORTER_SIGN);
+      break;
+    case CYPHER_VALUE_STRING:
+      sorterBufByte(p, SORTER_KEY_STRING);
+      sorterKeyString(p, pVal->u.zString);
+      break;
+    case CYPHER_VALUE_NODE:
+      sorterBufByte(p, SORTER_KEY_NODE);
+      sorterBufBig64(p, (sqlite3_uint64)pVal->u.iNodeId ^ SORTER_SIGN);
+      break;
+    case CYPHER_VALUE_RELATIONSHIP:
+      sorterBufByte(p, SORTER_KEY_REL);
+      sorterBufBig64(p, (sqlite3_uint64)pVal->u.iRelId ^ SORTER_SIGN);
+      break;
+    case CYPHER_VALUE_LIST:
+      /* Each element is preceded by 1 and the list ends with 0 */
+      sorterBufByte(p, SORTER_KEY_LIST);
+      for( i=0; i<pVal->u.list.nValues; i++ ){
+        sorterBufByte(p, 1);
+        sorterKeyValue(p, &pVal->u.list.apValues[i]);
+      }
+      sorterBufByte(p, 0);
+      break;
+    case CYPHER_VALUE_MAP:
+      sorterBufByte(p, SORTER_KEY_MAP);
+      for( i=0; i<pVal->u.map.nPairs; i++ ){
+        sorterBufByte(p, 1);
+        sorterKeyString(p, pVal->u.map.azKeys[i]);
+        sorterKeyValue(p, &pVal->u.map.apValues[i]);
+      }
+      sorterBufByte(p, 0);
+      break;
+    default:
+      sorterBufByte(p, SORTER_KEY_PATH);
+      sorterBufBig64(p, (sqlite3_uint64)pVal->u.iInteger ^ SORTER_SIGN);
+      break;
+  }
+}
+
+/*
+** Encode the nKey values of aKey into p->key. A DESC key is inverted
+** byte-wise; the trailing sequence number is not.
+*/
+static int sorterEncodeKey(CypherSorter *p, const CypherValue *aKey){
+  int i, j;
+  p->key.n = 0;
+  p->key.rc = SQLITE_OK;
+  for( i=0; i<p->nKey; i++ ){
+    int iStart = p->key.n;
+    sorterKeyValue(&p->key, &aKey[i]);
+    if( p->key.rc==SQLITE_OK && p->aFlags && (p->aFlags[i] & PLAN_SORT_DESC) ){
+      for( j=iStart; j<p->key.n; j++ ){
+        p->key.a[j] = (unsigned char)~p->key.a[j];
+      }
+    }
+  }
+  sorterBufBig64(&p->key, p->iSeq++);
+  return p->key.rc;
+}
+
+static int sorterCompare(const SorterRecord *pA, const SorterRecord *pB){
+  int n = pA->nKey < pB->nKey ? pA->nKey : pB->nKey;
+  int c = memcmp(pA->aKey, pB->aKey, n);
+  return c ? c : pA->nKey - pB->nKey;
+}
+
+/*
+** Row serialization for runs. Native byte order: runs never outlive the
+** process that wrote them.
+*/
+
+static void sorterPutString(SorterBuf *p, const char *z){
+  if( !z ){
+    sorterBufU32(p, 0xffffffff);
+    return;
+  }
+  sorterBufU32(p, (unsigned int)strlen(z));
+  sorterBufAppend(p, z, (int)strlen(z));
+}
+
+static void sorterPutValue(SorterBuf *p, const CypherValue *pVal){
+  sqlite3_int64 iVal;
+  int i;
+  sorterBufByte(p, (unsigned char)pVal->type);
+  switch( pVal->type ){
+    case CYPHER_VALUE_NULL:
+      break;
+    case CYPHER_VALUE_BOOLEAN:
+      iVal = pVal->u.bBoolean;
+      sorterBufAppend(p, &iVal, 8);
+      break;
+    case CYPHER_VALUE_FLOAT:
+      sorterBufAppend(p, &pVal->u.rFloat, 8);
+      break;
+    case CYPHER_VALUE_STRING:
+      sorterPutString(p, pVal->u.zString);
+      break;
+    case CYPHER_VALUE_LIST:
+      sorterBufU32(p, (unsigned int)pVal->u.list.nValues);
+      for( i=0; i<pVal->u.list.nValues; i++ ){
+        sorterPutValue(p, &pVal->u.list.apValues[i]);
+      }
+      break;
+    case CYPHER_VALUE_MAP:
+      sorterBufU32(p, (unsigned int)pVal->u.map.nPairs);
+      for( i=0; i<pVal->u.map.nPairs; i++ ){
+        sorterPutString(p, pVal->u.map.azKeys[i]);
+        sorterPutValue(p, &pVal->u.map.apValues[i]);
+      }
+      break;
+    default:
+      /* Integers, node, relationship and path ids share the slot */
+      sorterBufAppend(p, &pVal->u.iInteger, 8);
+      break;
+  }
+}
+
+static void sorterPutRow(SorterBuf *p, const CypherResult *pRow){
+  int i;
+  sorterBufU32(p, (unsigned int)pRow->nColumns);
+  for( i=0; i<pRow->nColumns; i++ ){
+    sorterPutString(p, pRow->azColumnNames[i]);
+    sorterPutValue(p, &pRow->aValues[i]);
+  }
+}
+
+/*
+** Bounds-checked cursor over one serialized row.
+*/
+typedef struct SorterCursor SorterCursor;
+struct SorterCursor {
+  const unsigned char *a;
+  int n;
+  int i;
+};
+
+static int sorterGet(SorterCursor *p, void *pOut, int n){
+  if( n > p->n - p->i ) return SQLITE_CORRUPT;
+  memcpy(pOut, &p->a[p->i], n);
+  p->i += n;
+  return SQLITE_OK;
+}
+
+/* A NULL string reads back as NULL */
+static int sorterGetString(SorterCursor *p, char **pz){
+  unsigned int n;
+  int rc = sorterGet(p, &n, 4);
+  *pz = 0;
+  if( rc!=SQLITE_OK || n==0xffffffff ) return rc;
+  if( n > (unsigned int)(p->n - p->i) ) return SQLITE_CORRUPT;
+  *pz = sqlite3_malloc((int)n + 1);
+  if( !*pz ) return SQLITE_NOMEM;
+  memcpy(*pz, &p->a[p->i], n);
+  (*pz)[n] = 0;
+  p->i += (int)n;
+  return SQLITE_OK;
+}
+
+/*
+** Read one value into *pVal, which starts out zeroed (NULL). On error
+** *pVal is left in a state cypherValueDestroy() can free.
+*/
+static int sorterGetValue(SorterCursor *p, CypherValue *pVal, int iDepth){
+  unsigned char eType;
+  unsigned int n, i;
+  int rc;
+
+  if( iDepth > SORTER_MAX_DEPTH ) return SQLITE_CORRUPT;
+  rc = sorterGet(p, &eType, 1);
+  if( rc!=SQLITE_OK ) return rc;
+
+  switch( eType ){
+    case CYPHER_VALUE_NULL:
+      break;
+    case CYPHER_VALUE_BOOLEAN: {
+      sqlite3_int64 iVal;
+      rc = sorterGet(p, &iVal, 8);
+      pVal->type = CYPHER_VALUE_BOOLEAN;
+      pVal->u.bBoolean = (int)iVal;
+      break;
+    }
+    case CYPHER_VALUE_FLOAT:
+      rc = sorterGet(p, &pVal->u.rFloat, 8);
+      pVal->type = CYPHER_VALUE_FLOAT;
+      break;
+    case CYPHER_VALUE_STRING:
+      pVal->type = CYPHER_VALUE_STRING;
+      rc = sorterGetString(p, &pVal->u.zString);
+      break;
+    case CYPHER_VALUE_LIST:
+      rc = sorterGet(p, &n, 4);
+      if( rc!=SQLITE_OK ) break;
+      if( n > (unsigned int)(p->n - p->i) ) return SQLITE_CORRUPT;
+      pVal->type = CYPHER_VALUE_LIST;
+      if( n==0 ) break;
+      pVal->u.list.apValues = sqlite3_malloc((int)(n * sizeof(CypherValue)));
+      if( !pVal->u.list.apValues ) return SQLITE_NOMEM;
+      memset(pVal->u.list.apValues, 0, n * sizeof(CypherValue));
+      for( i=0; i<n && rc==SQLITE_OK; i++ ){
+        pVal->u.list.nValues++;
+        rc = sorterGetValue(p, &pVal->u.list.apValues[i], iDepth+1);
+      }
+      break;
+    case CYPHER_VALUE_MAP:
+      rc = sorterGet(p, &n, 4);
+      if( rc!=SQLITE_OK ) break;
+      if( n > (unsigned int)(p->n - p->i) ) return SQLITE_CORRUPT;
+      pVal->type = CYPHER_VALUE_MAP;
+      if( n==0 ) break;
+      pVal->u.map.azKeys = sqlite3_malloc((int)(n * sizeof(char*)));
+      pVal->u.map.apValues = sqlite3_malloc((int)(n * sizeof(CypherValue)));
+      if( !pVal->u.map.azKeys || !pVal->u.map.apValues ) return SQLITE_NOMEM;
+      memset(pVal->u.map.azKeys, 0, n * sizeof(char*));
+      memset(pVal->u.map.apValues, 0, n * sizeof(CypherValue));
+      for( i=0; i<n && rc==SQLITE_OK; i++ ){
+        pVal->u.map.nPairs++;
+        rc = sorterGetString(p, &pVal->u.map.azKeys[i]);
+        if( rc==SQLITE_OK ){
+          rc = sorterGetValue(p, &pVal->u.map.apValues[i], iDepth+1);
+        }
+      }
+      break;
+    default:
+      rc = sorterGet(p, &pVal->u.iInteger, 8);
+      pVal->type = (CypherValueType)eType;
+      break;
+  }
+  return rc;
+}
+
+static int sorterGetRow(const unsigned char *a, int n, CypherResult **ppRow){
+  SorterCursor cur;
+  CypherResult *pRow;
+  unsigned int nCol, i;
+  int rc;
+
+  cur.a = a;
+  cur.n = n;
+  cur.i = 0;
+  *ppRow = 0;
+  rc = sorterGet(&cur, &nCol, 4);
+  if( rc!=SQLITE_OK ) return rc;
+  if( nCol > (unsigned int)n ) return SQLITE_CORRUPT;
+
+  pRow = cypherResultCreate();
+  if( !pRow ) return SQLITE_NOMEM;
+  if( nCol>0 ){
+    pRow->azColumnNames = sqlite3_malloc((int)(nCol * sizeof(char*)));
+    pRow->aValues = sqlite3_malloc((int)(nCol * sizeof(CypherValue)));
+    if( !pRow->azColumnNames || !pRow->aValues ){
+      cypherResultDestroy(pRow);
+      return SQLITE_NOMEM;
+    }
+    memset(pRow->aValues, 0, nCol * sizeof(CypherValue));
+    pRow->nColumnsAlloc = (int)nCol;
+  }
+  for( i=0; i<nCol && rc==SQLITE_OK; i++ ){
+    pRow->azColumnNames[i] = 0;
+    pRow->nColumns++;
+    rc = sorterGetString(&cur, &pRow->azColumnNames[i]);
+    if( rc==SQLITE_OK ){
+      rc = sorterGetValue(&cur, &pRow->aValues[i], 0);
+    }
+  }
+  if( rc!=SQLITE_OK ){
+    cypherResultDestroy(pRow);
+    return rc;
+  }
+  *ppRow = pRow;
+  return SQLITE_OK;
+}
+
+/*
+** Approximate heap bytes held by a row, charged against the budget.
+*/
+static sqlite3_int64 sorterValueBytes(const CypherValue *pVal){
+  sqlite3_int64 n = sizeof(CypherValue);
+  int i;
+  switch( pVal->type ){
+    case CYPHER_VALUE_STRING:
+      if( pVal->u.zString ) n += (sqlite3_int64)strlen(pVal->u.zString) + 1;
+      break;
+    case CYPHER_VALUE_LIST:
+      for( i=0; i<pVal->u.list.nValues; i++ ){
+        n += sorterValueBytes(&pVal->u.list.apValues[i]);
+      }
+      break;
+    case CYPHER_VALUE_MAP:
+      for( i=0; i<pVal->u.map.nPairs; i++ ){
+        n += sizeof(char*) + sorterValueBytes(&pVal->u.map.apValues[i]);
+        if( pVal->u.map.azKeys[i] ){
+          n += (sqlite3_int64)strlen(pVal->u.map.azKeys[i]) + 1;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+  return n;
+}
+
+sqlite3_int64 cypherSorterRowBytes(const CypherResult *pRow){
+  sqlite3_int64 n = sizeof(CypherResult);
+  int i;
+  for( i=0; i<pRow->nColumns; i++ ){
+    n += sizeof(char*) + sorterValueBytes(&pRow->aValues[i]);
+    if( pRow->azColumnNames[i] ){
+      n += (sqlite3_int64)strlen(pRow->azColumnNames[i]) + 1;
+    }
+  }
+  return n;
+}
+
+static void sorterRecordFree(SorterRecord *pRec){
+  if( pRec ){
+    cypherResultDestroy(pRec->pRow);
+    sqlite3_free(pRec);
+  }
+}
+
+/*
+** In-memory sorting of SorterRecord pointers.
+*/
+
+static void sorterSwap(SorterRecord **a, int i, int j){
+  SorterRecord *pTmp = a[i];
+  a[i] = a[j];
+  a[j] = pTmp;
+}
+
+/* Restore the max-heap property of a[0..n) below slot i */
+static void sorterSiftDown(SorterRecord **a, int n, int i){
+  for(;;){
+    int iMax = i;
+    int iLeft = 2*i + 1;
+    int iRight = iLeft + 1;
+    if( iLeft<n && sorterCompare(a[iLeft], a[iMax])>0 ) iMax = iLeft;
+    if( iRight<n && sorterCompare(a[iRight], a[iMax])>0 ) iMax = iRight;
+    if( iMax==i ) return;
+    sorterSwap(a, i, iMax);
+    i = iMax;
+  }
+}
+
+static void sorterSiftUp(SorterRecord **a, int i){
+  while( i>0 ){
+    int iParent = (i - 1)/2;
+    if( sorterCompare(a[i], a[iParent])<=0 ) return;
+    sorterSwap(a, i, iParent);
+    i = iParent;
+  }
+}
+
+static void sorterHeapSort(SorterRecord **a, int n){
+  int i;
+  for( i=n/2-1; i>=0; i-- ) sorterSiftDown(a, n, i);
+  for( i=n-1; i>0; i-- ){
+    sorterSwap(a, 0, i);
+    sorterSiftDown(a, i, 0);
+  }
+}
+
+static void sorterInsertionSort(SorterRecord **a, int n){
+  int i, j;
+  for( i=1; i<n; i++ ){
+    SorterRecord *pRec = a[i];
+    for( j=i; j>0 && sorterCompare(a[j-1], pRec)>0; j-- ){
+      a[j] = a[j-1];
+    }
+    a[j] = pRec;
+  }
+}
+
+/*
+** Keys are unique (they end in the sequence number), so the median of
+** three distinct slots is neither the minimum nor the maximum and the
+** Hoare partition below always splits into two non-empty halves.
+*/
+static void sorterIntroSort(SorterRecord **a, int n, int nDepth){
+  while( n>SORTER_INSERTION ){
+    SorterRecord *pA = a[0], *pB = a[n/2], *pC = a[n-1], *pPivot;
+    int i = -1, j = n;
+
+    if( nDepth--==0 ){
+      sorterHeapSort(a, n);
+      return;
+    }
+    if( sorterCompare(pA, pB)<0 ){
+      pPivot = sorterCompare(pB, pC)<0 ? pB : (sorterCompare(pA, pC)<0 ? pC : pA);
+    }else{
+      pPivot = sorterCompare(pA, pC)<0 ? pA : (sorterCompare(pB, pC)<0 ? pC : pB);
+    }
+    for(;;){
+      do{ i++; }while( sorterCompare(a[i], pPivot)<0 );
+      do{ j--; }while( sorterCompare(a[j], pPivot)>0 );
+      if( i>=j ) break;
+      sorterSwap(a, i, j);
+    }
+
+    /* Recurse into the smaller half, loop on the larger */
+    j++;
+    if( j < n - j ){
+      sorterIntroSort(a, j, nDepth);
+      a += j;
+      n -= j;
+    }else{
+      sorterIntroSort(&a[j], n - j, nDepth);
+      n = j;
+    }
+  }
+  sorterInsertionSort(a, n);
+}
+
+static void sorterSortRecords(SorterRecord **a, int n){
+  int nDepth = 0;
+  int m;
+  for( m=n; m>1; m>>=1 ) nDepth += 2;
+  sorterIntroSort(a, n, nDepth);
+}
+
+/*
+** Temporary file and run I/O.
+*/
+
+static int sorterOpenTemp(CypherSorter *p){
+  sqlite3_vfs *pVfs = 0;
+  int flags = 0;
+  int rc;
+
+  if( p->pDb ){
+    sqlite3_file_control(p->pDb, "main", SQLITE_FCNTL_VFS_POINTER, &pVfs);
+  }
+  if( !pVfs ) pVfs = sqlite3_vfs_find(0);
+  if( !pVfs ) return SQLITE_ERROR;
+
+  p->aWriteBuf = sqlite3_malloc(SORTER_IO_BUFFER);
+  p->pFd = sqlite3_malloc(pVfs->szOsFile);
+  if( !p->aWriteBuf || !p->pFd ) return SQLITE_NOMEM;
+  memset(p->pFd, 0, pVfs->szOsFile);
+  rc = pVfs->xOpen(pVfs, 0, p->pFd,
+                   SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                   SQLITE_OPEN_EXCLUSIVE | SQLITE_OPEN_DELETEONCLOSE |
+                   SQLITE_OPEN_TEMP_JOURNAL, &flags);
+  if( rc!=SQLITE_OK ){
+    if( p->pFd->pMethods ) p->pFd->pMethods->xClose(p->pFd);
+    sqlite3_free(p->pFd);
+    p->pFd = 0;
+  }
+  return rc;
+}
+
+static void sorterWriterFlush(SorterWriter *p){
+  if( p->rc==SQLITE_OK && p->nBuf>0 ){
+    p->rc = p->pFd->pMethods->xWrite(p->pFd, p->aBuf, p->nBuf, p->iOff);
+    p->iOff += p->nBuf;
+    p->nBuf = 0;
+  }
+}
+
+static void sorterWrite(SorterWriter *p, const void *pData, int n){
+  const unsigned char *a = (const unsigned char*)pData;
+  while( n>0 && p->rc==SQLITE_OK ){
+    int nCopy = SORTER_IO_BUFFER - p->nBuf;
+    if( nCopy>n ) nCopy = n;
+    memcpy(&p->aBuf[p->nBuf], a, nCopy);
+    p->nBuf += nCopy;
+    a += nCopy;
+    n -= nCopy;
+    if( p->nBuf==SORTER_IO_BUFFER ) sorterWriterFlush(p);
+  }
+}
+
+static void sorterWriteRecord(SorterWriter *p, const unsigned char *aKey,
+                              int nKey, const unsigned char *aRow, int nRow){
+  unsigned int u = (unsigned int)nKey;
+  sorterWrite(p, &u, 4);
+  sorterWrite(p, aKey, nKey);
+  u = (unsigned int)nRow;
+  sorterWrite(p, &u, 4);
+  sorterWrite(p, aRow, nRow);
+}
+
+static void sorterWriterInit(CypherSorter *pSorter, SorterWriter *p){
+  p->pFd = pSorter->pFd;
+  p->iOff = pSorter->iEof;
+  p->aBuf = pSorter->aWriteBuf;
+  p->nBuf = 0;
+  p->rc = SQLITE_OK;
+}
+
+/* Record the bytes written since pSorter->iEof as a new run */
+static int sorterWriterFinish(CypherSorter *pSorter, SorterWriter *p,
+                              SorterRun *pRun){
+  sorterWriterFlush(p);
+  if( p->rc!=SQLITE_OK ) return p->rc;
+  pRun->iOff = pSorter->iEof;
+  pRun->nByte = p->iOff - pSorter->iEof;
+  pSorter->iEof = p->iOff;
+  return SQLITE_OK;
+}
+
+static int sorterRead(SorterReader *p, void *pOut, int n){
+  unsigned char *a = (unsigned char*)pOut;
+  while( n>0 ){
+    int nCopy;
+    if( p->iBuf==p->nBuf ){
+      sqlite3_int64 nLeft = p->iEnd - p->iOff;
+      int nRead = nLeft < SORTER_IO_BUFFER ? (int)nLeft : SORTER_IO_BUFFER;
+      int rc;
+      if( nRead<=0 ) return SQLITE_CORRUPT;
+      rc = p->pFd->pMethods->xRead(p->pFd, p->aBuf, nRead, p->iOff);
+      if( rc!=SQLITE_OK ) return rc;
+      p->iOff += nRead;
+      p->nBuf = nRead;
+      p->iBuf = 0;
+    }
+    nCopy = p->nBuf - p->iBuf;
+    if( nCopy>n ) nCopy = n;
+    memcpy(a, &p->aBuf[p->iBuf], nCopy);
+    p->iBuf += nCopy;
+    a += nCopy;
+    n -= nCopy;
+  }
+  return SQLITE_OK;
+}
+
+/* Bytes of the run not yet consumed */
+static sqlite3_int64 sorterReaderLeft(const SorterReader *p){
+  return (p->iEnd - p->iOff) + (p->nBuf - p->iBuf);
+}
+
+static int sorterReaderReserve(SorterReader *p, sqlite3_int64 nByte){
+  if( nByte > p->nRecAlloc ){
+    unsigned char *aNew;
+    if( nByte > 0x7fffffff ) return SQLITE_CORRUPT;
+    aNew = sqlite3_realloc(p->aRec, (int)nByte);
+    if( !aNew ) return SQLITE_NOMEM;
+    p->aRec = aNew;
+    p->nRecAlloc = (int)nByte;
+  }
+  return SQLITE_OK;
+}
+
+/* Load the next record of the run, or set bEof */
+static int sorterReaderStep(SorterReader *p){
+  unsigned int nKey, nRow;
+  int rc;
+
+  if( sorterReaderLeft(p)==0 ){
+    p->bEof = 1;
+    return SQLITE_OK;
+  }
+  rc = sorterRead(p, &nKey, 4);
+  if( rc!=SQLITE_OK ) return rc;
+  if( nKey > sorterReaderLeft(p) ) return SQLITE_CORRUPT;
+  rc = sorterReaderReserve(p, nKey);
+  if( rc==SQLITE_OK ) rc = sorterRead(p, p->aRec, (int)nKey);
+  if( rc==SQLITE_OK ) rc = sorterRead(p, &nRow, 4);
+  if( rc!=SQLITE_OK ) return rc;
+  if( nRow > sorterReaderLeft(p) ) return SQLITE_CORRUPT;
+  rc = sorterReaderReserve(p, (sqlite3_int64)nKey + nRow);
+  if( rc==SQLITE_OK ) rc = sorterRead(p, &p->aRec[nKey], (int)nRow);
+  p->nKey = (int)nKey;
+  p->nRow = (int)nRow;
+  return rc;
+}
+
+static int sorterReaderCompare(const SorterReader *pA, const SorterReader *pB){
+  int n = pA->nKey < pB->nKey ? pA->nKey : pB->nKey;
+  int c = memcmp(pA->aRec, pB->aRec, n);
+  return c ? c : pA->nKey - pB->nKey;
+}
+
+static void sorterMergerSiftDown(SorterMerger *p, int i){
+  for(;;){
+    int iMin = i;
+    int iLeft = 2*i + 1;
+    int iRight = iLeft + 1;
+    int iTmp;
+    if( iLeft<p->nHeap && sorterReaderCompare(&p->aReader[p->aHeap[iLeft]],
+                                              &p->aReader[p->aHeap[iMin]])<0 ){
+      iMin = iLeft;
+    }
+    if( iRight<p->nHeap && sorterReaderCompare(&p->aReader[p->aHeap[iRight]],
+                                               &p->aReader[p->aHeap[iMin]])<0 ){
+      iMin = iRight;
+    }
+    if( iMin==i ) return;
+    iTmp = p->aHeap[i];
+    p->aHeap[i] = p->aHeap[iMin];
+    p->aHeap[iMin] = iTmp;
+    i = iMin;
+  }
+}
+
+static void sorterMergerFree(SorterMerger *p){
+  int i;
+  if( !p ) return;
+  for( i=0; i<p->nReader; i++ ){
+    sqlite3_free(p->aReader[i].aBuf);
+    sqlite3_free(p->aReader[i].aRec);
+  }
+  sqlite3_free(p->aReader);
+  sqlite3_free(p->aHeap);
+  sqlite3_free(p);
+}
+
+/* Open a merge over runs aRun[iRun..iRun+nRun) */
+static int sorterMergerOpen(CypherSorter *pSorter, int iRun, int nRun,
+                            SorterMerger **ppMerger){
+  SorterMerger *p;
+  int i, rc = SQLITE_OK;
+
+  *ppMerger = 0;
+  p = sqlite3_malloc(sizeof(SorterMerger));
+  if( !p ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(SorterMerger));
+  p->aReader = sqlite3_malloc((nRun>0 ? nRun : 1) * sizeof(SorterReader));
+  p->aHeap = sqlite3_malloc((nRun>0 ? nRun : 1) * sizeof(int));
+  if( !p->aReader || !p->aHeap ){
+    sorterMergerFree(p);
+    return SQLITE_NOMEM;
+  }
+  memset(p->aReader, 0, (nRun>0 ? nRun : 1) * sizeof(SorterReader));
+
+  for( i=0; i<nRun && rc==SQLITE_OK; i++ ){
+    SorterReader *pReader = &p->aReader[i];
+    p->nReader++;
+    pReader->pFd = pSorter->pFd;
+    pReader->iOff = pSorter->aRun[iRun+i].iOff;
+    pReader->iEnd = pReader->iOff + pSorter->aRun[iRun+i].nByte;
+    pReader->aBuf = sqlite3_malloc(SORTER_IO_BUFFER);
+    if( !pReader->aBuf ){
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    rc = sorterReaderStep(pReader);
+    if( rc==SQLITE_OK && !pReader->bEof ) p->aHeap[p->nHeap++] = i;
+  }
+  if( rc!=SQLITE_OK ){
+    sorterMergerFree(p);
+    return rc;
+  }
+  for( i=p->nHeap/2-1; i>=0; i-- ) sorterMergerSiftDown(p, i);
+  *ppMerger = p;
+  return SQLITE_OK;
+}
+
+/* Move past the smallest current record */
+static int sorterMergerStep(SorterMerger *p){
+  SorterReader *pTop = &p->aReader[p->aHeap[0]];
+  int rc = sorterReaderStep(pTop);
+  if( rc!=SQLITE_OK ) return rc;
+  if( pTop->bEof ){
+    p->aHeap[0] = p->aHeap[--p->nHeap];
+  }
+  if( p->nHeap>0 ) sorterMergerSiftDown(p, 0);
+  return SQLITE_OK;
+}
+
+/*
+** Sort the buffered records and append them to the temporary file as a
+** new run.
+*/
+static int sorterSpill(CypherSorter *p){
+  SorterWriter w;
+  SorterRun run;
+  int i, rc = SQLITE_OK;
+
+  if( p->nRecord==0 ) return SQLITE_OK;
+  if( !p->pFd ){
+    rc = sorterOpenTemp(p);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  if( p->nRun>=p->nRunAlloc ){
+    int nNew = p->nRunAlloc ? p->nRunAlloc*2 : 16;
+    SorterRun *aNew = sqlite3_realloc(p->aRun, nNew * sizeof(SorterRun));
+    if( !aNew ) return SQLITE_NOMEM;
+    p->aRun = aNew;
+    p->nRunAlloc = nNew;
+  }
+
+  sorterSortRecords(p->aRecord, p->nRecord);
+  sorterWriterInit(p, &w);
+  for( i=0; i<p->nRecord && w.rc==SQLITE_OK; i++ ){
+    SorterRecord *pRec = p->aRecord[i];
+    p->row.n = 0;
+    sorterPutRow(&p->row, pRec->pRow);
+    if( p->row.rc!=SQLITE_OK ){
+      rc = p->row.rc;
+      p->row.rc = SQLITE_OK;
+      return rc;
+    }
+    sorterWriteRecord(&w, pRec->aKey, pRec->nKey, p->row.a, p->row.n);
+  }
+  rc = sorterWriterFinish(p, &w, &run);
+  if( rc!=SQLITE_OK ) return rc;
+
+  p->aRun[p->nRun++] = run;
+  p->nSpilled += p->nRecord;
+  for( i=0; i<p->nRecord; i++ ){
+    sorterRecordFree(p->aRecord[i]);
+  }
+  p->nRecord = 0;
+  p->nInMemory = 0;
+  return SQLITE_OK;
+}
+
+/*
+** Merge groups of CYPHER_SORT_MERGE_FANIN runs into longer runs until
+** a single merge can produce the output.
+*/
+static int sorterMergePasses(CypherSorter *p){
+  while( p->nRun > CYPHER_SORT_MERGE_FANIN ){
+    int nOut = 0;
+    int i;
+    for( i=0; i<p->nRun; i+=CYPHER_SORT_MERGE_FANIN ){
+      SorterMerger *pMerger;
+      SorterWriter w;
+      SorterRun run;
+      int n = p->nRun - i;
+      int rc;
+
+      if( n > CYPHER_SORT_MERGE_FANIN ) n = CYPHER_SORT_MERGE_FANIN;
+      if( n==1 ){
+        p->aRun[nOut++] = p->aRun[i];
+        continue;
+      }
+      rc = sorterMergerOpen(p, i, n, &pMerger);
+      if( rc!=SQLITE_OK ) return rc;
+      sorterWriterInit(p, &w);
+      while( rc==SQLITE_OK && pMerger->nHeap>0 && w.rc==SQLITE_OK ){
+        SorterReader *pTop = &pMerger->aReader[pMerger->aHeap[0]];
+        sorterWriteRecord(&w, pTop->aRec, pTop->nKey,
+                          &pTop->aRec[pTop->nKey], pTop->nRow);
+        rc = sorterMergerStep(pMerger);
+      }
+      sorterMergerFree(pMerger);
+      if( rc==SQLITE_OK ) rc = sorterWriterFinish(p, &w, &run);
+      if( rc!=SQLITE_OK ) return rc;
+      p->aRun[nOut++] = run;
+    }
+    p->nRun = nOut;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Append the columns of pRow to pResult and free pRow. An empty
+** pResult simply takes over pRow's arrays.
+*/
+static int sorterMoveRow(CypherResult *pResult, CypherResult *pRow){
+  int i, rc = SQLITE_OK;
+  if( pResult->nColumns==0 ){
+    sqlite3_free(pResult->azColumnNames);
+    sqlite3_free(pResult->aValues);
+    *pResult = *pRow;
+    sqlite3_free(pRow);
+    return SQLITE_OK;
+  }
+  for( i=0; i<pRow->nColumns && rc==SQLITE_OK; i++ ){
+    rc = cypherResultAddColumn(pResult, pRow->azColumnNames[i], &pRow->aValues[i]);
+  }
+  cypherResultDestroy(pRow);
+  return rc;
+}
+
+/*
+** Public interface.
+*/
+
+int cypherSorterCreate(sqlite3 *pDb, int nKey, const unsigned char *aSortFlags,
+                       int nLimit, sqlite3_int64 nMemory,
+                       CypherSorter **ppSorter){
+  CypherSorter *p;
+
+  if( !ppSorter || nKey<0 ) return SQLITE_MISUSE;
+  *ppSorter = 0;
+  p = sqlite3_malloc(sizeof(CypherSorter));
+  if( !p ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(CypherSorter));
+
+  p->pDb = pDb;
+  p->nKey = nKey;
+  p->nLimit = nLimit>0 ? nLimit : 0;
+  p->nMemory = nMemory>0 ? nMemory : CYPHER_SORT_MEMORY;
+  p->bTopK = p->nLimit>0;
+  if( aSortFlags && nKey>0 ){
+    p->aFlags = sqlite3_malloc(nKey);
+    if( !p->aFlags ){
+      sqlite3_free(p);
+      return SQLITE_NOMEM;
+    }
+    memcpy(p->aFlags, aSortFlags, nKey);
+  }
+  *ppSorter = p;
+  return SQLITE_OK;
+}
+
+int cypherSorterAdd(CypherSorter *p, const CypherValue *aKey,
+                    CypherResult *pRow){
+  SorterRecord *pRec;
+  int rc;
+
+  if( !p || !pRow || p->bFinished || (p->nKey>0 && !aKey) ){
+    cypherResultDestroy(pRow);
+    return SQLITE_MISUSE;
+  }
+  rc = sorterEncodeKey(p, aKey);
+  if( rc!=SQLITE_OK ){
+    cypherResultDestroy(pRow);
+    return rc;
+  }
+
+  pRec = sqlite3_malloc((int)sizeof(SorterRecord) + p->key.n);
+  if( !pRec ){
+    cypherResultDestroy(pRow);
+    return SQLITE_NOMEM;
+  }
+  pRec->pRow = pRow;
+  pRec->nKey = p->key.n;
+  memcpy(pRec->aKey, p->key.a, p->key.n);
+  pRec->nByte = (sqlite3_int64)sizeof(SorterRecord) + pRec->nKey
+              + cypherSorterRowBytes(pRow);
+
+  /* Top-k: once the heap is full, only rows that beat its top get in */
+  if( p->bTopK && p->nRecord==p->nLimit ){
+    if( sorterCompare(pRec, p->aRecord[0])>=0 ){
+      sorterRecordFree(pRec);
+      return SQLITE_OK;
+    }
+    p->nInMemory += pRec->nByte - p->aRecord[0]->nByte;
+    sorterRecordFree(p->aRecord[0]);
+    p->aRecord[0] = pRec;
+    sorterSiftDown(p->aRecord, p->nRecord, 0);
+  }else{
+    if( p->nRecord>=p->nRecordAlloc ){
+      int nNew = p->nRecordAlloc ? p->nRecordAlloc*2 : 64;
+      SorterRecord **aNew = sqlite3_realloc(p->aRecord,
+                                            nNew * sizeof(SorterRecord*));
+      if( !aNew ){
+        sorterRecordFree(pRec);
+        return SQLITE_NOMEM;
+      }
+      p->aRecord = aNew;
+      p->nRecordAlloc = nNew;
+    }
+    p->aRecord[p->nRecord++] = pRec;
+    p->nInMemory += pRec->nByte;
+    if( p->bTopK ) sorterSiftUp(p->aRecord, p->nRecord-1);
+  }
+
+  if( p->nInMemory > p->nMemory ){
+    /* The best nLimit rows outgrew the budget: fall back to spilling and
+    ** let cypherSorterNext() apply the limit */
+    p->bTopK = 0;
+    return sorterSpill(p);
+  }
+  return SQLITE_OK;
+}
+
+int cypherSorterFinish(CypherSorter *p){
+  int rc = SQLITE_OK;
+
+  if( !p || p->bFinished ) return SQLITE_MISUSE;
+  p->bFinished = 1;
+  p->iNext = 0;
+  if( p->pFd ){
+    rc = sorterSpill(p);
+    if( rc==SQLITE_OK ) rc = sorterMergePasses(p);
+    if( rc==SQLITE_OK ) rc = sorterMergerOpen(p, 0, p->nRun, &p->pMerger);
+  }else{
+    sorterSortRecords(p->aRecord, p->nRecord);
+  }
+  return rc;
+}
+
+int cypherSorterNext(CypherSorter *p, CypherResult *pResult){
+  CypherResult *pRow;
+  int rc;
+
+  if( !p || !pResult || !p->bFinished ) return SQLITE_MISUSE;
+  if( p->nLimit>0 && p->nReturned>=p->nLimit ) return SQLITE_DONE;
+
+  if( p->pMerger ){
+    SorterReader *pTop;
+    if( p->pMerger->nHeap==0 ) return SQLITE_DONE;
+    pTop = &p->pMerger->aReader[p->pMerger->aHeap[0]];
+    rc = sorterGetRow(&pTop->aRec[pTop->nKey], pTop->nRow, &pRow);
+    if( rc==SQLITE_OK ) rc = sorterMergerStep(p->pMerger);
+    if( rc!=SQLITE_OK ){
+      cypherResultDestroy(pRow);
+      return rc;
+    }
+  }else{
+    SorterRecord *pRec;
+    if( p->iNext>=p->nRecord ) return SQLITE_DONE;
+    pRec = p->aRecord[p->iNext];
+    p->aRecord[p->iNext++] = 0;
+    pRow = pRec->pRow;
+    sqlite3_free(pRec);
+  }
+
+  p->nReturned++;
+  return sorterMoveRow(pResult, pRow);
+}
+
+sqlite3_int64 cypherSorterSpilled(const CypherSorter *p){
+  return p ? p->nSpilled : 0;
+}
+
+void cypherSorterFree(CypherSorter *p){
+  int i;
+  if( !p ) return;
+  for( i=0; i<p->nRecord; i++ ){
+    sorterRecordFree(p->aRecord[i]);
+  }
+  sqlite3_free(p->aRecord);
+  sorterMergerFree(p->pMerger);
+  if( p->pFd ){
+    if( p->pFd->pMethods ) p->pFd->pMethods->xClose(p->pFd);
+    sqlite3_free(p->pFd);
+  }
+  sqlite3_free(p->aWriteBuf);
+  sqlite3_free(p->aRun);
+  sqlite3_free(p->aFlags);
+  sqlite3_free(p->key.a);
+  sqlite3_free(p->row.a);
+  sqlite3_free(p);
+}
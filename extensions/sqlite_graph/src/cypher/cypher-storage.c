@@ -25,6 +25,7 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "cypher-executor.h"
 #include "graph-vtab.h"
 #include "graph-memory.h"
+#include "graph-csr.h"
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
@@ -114,15 +115,15 @@ int cypherStorageAddNode(GraphVtab *pGraph, sqlite3_int64 iNodeId,
     if( iNodeId > 0 ) {
         /* Specific node ID requested */
         zSql = sqlite3_mprintf(
-            "INSERT INTO graph_nodes (node_id, labels, properties) VALUES (%lld, '%s', %s)",
-            iNodeId, zLabelsJson, 
+            "INSERT INTO %s (id, labels, properties) VALUES (%lld, '%s', %s)",
+            pGraph->zNodeTableName, iNodeId, zLabelsJson, 
             zEscapedProps ? sqlite3_mprintf("'%s'", zEscapedProps) : "NULL"
         );
     } else {
         /* Auto-generate node ID */
         zSql = sqlite3_mprintf(
-            "INSERT INTO graph_nodes (labels, properties) VALUES ('%s', %s)",
-            zLabelsJson,
+            "INSERT INTO %s (labels, properties) VALUES ('%s', %s)",
+            pGraph->zNodeTableName, zLabelsJson,
             zEscapedProps ? sqlite3_mprintf("'%s'", zEscapedProps) : "NULL"
         );
     }
@@ -133,8 +134,11 @@ int cypherStorageAddNode(GraphVtab *pGraph, sqlite3_int64 iNodeId,
     if( !zSql ) return SQLITE_NOMEM;
     
     /* Execute the INSERT */
+    graphCSRTrackBegin(pGraph);
     rc = cypherStorageExecuteUpdate(pGraph, zSql, &rowId);
     sqlite3_free(zSql);
+    if( rc == SQLITE_OK ) graphCSRTrack(pGraph, CSR_OP_ADD_NODE, rowId, 0, 0.0);
+    graphCSRTrackEnd(pGraph, rc, 0);
     
     return rc;
 }
@@ -184,9 +188,9 @@ int cypherStorageAddEdge(GraphVtab *pGraph, sqlite3_int64 iEdgeId,
     if( iEdgeId > 0 ) {
         /* Specific edge ID requested */
         zSql = sqlite3_mprintf(
-            "INSERT INTO graph_edges (edge_id, from_node, to_node, edge_type, weight, properties) "
+            "INSERT INTO %s (id, source, target, edge_type, weight, properties) "
             "VALUES (%lld, %lld, %lld, %s, %.15g, %s)",
-            iEdgeId, iFromId, iToId,
+            pGraph->zEdgeTableName, iEdgeId, iFromId, iToId,
             zEscapedType ? sqlite3_mprintf("'%s'", zEscapedType) : "NULL",
             rWeight,
             zEscapedProps ? sqlite3_mprintf("'%s'", zEscapedProps) : "NULL"
@@ -194,9 +198,9 @@ int cypherStorageAddEdge(GraphVtab *pGraph, sqlite3_int64 iEdgeId,
     } else {
         /* Auto-generate edge ID */
         zSql = sqlite3_mprintf(
-            "INSERT INTO graph_edges (from_node, to_node, edge_type, weight, properties) "
+            "INSERT INTO %s (source, target, edge_type, weight, properties) "
             "VALUES (%lld, %lld, %s, %.15g, %s)",
-            iFromId, iToId,
+            pGraph->zEdgeTableName, iFromId, iToId,
             zEscapedType ? sqlite3_mprintf("'%s'", zEscapedType) : "NULL",
             rWeight,
             zEscapedProps ? sqlite3_mprintf("'%s'", zEscapedProps) : "NULL"
@@ -208,9 +212,12 @@ int cypherStorageAddEdge(GraphVtab *pGraph, sqlite3_int64 iEdgeId,
     
     if( !zSql ) return SQLITE_NOMEM;
     
-    /* Execute the INSERT */
+    /* Execute the INSERT; the snapshot takes the weight as stored */
+    graphCSRTrackBegin(pGraph);
     rc = cypherStorageExecuteUpdate(pGraph, zSql, &rowId);
     sqlite3_free(zSql);
+    if( rc == SQLITE_OK ) graphCSRTrackEdgeRow(pGraph, CSR_OP_ADD_EDGE, rowId);
+    graphCSRTrackEnd(pGraph, rc, 0);
     
     return rc;
 }
@@ -260,18 +267,20 @@ int cypherStorageUpdateProperties(GraphVtab *pGraph, sqlite3_int64 iNodeId,
     if( iNodeId > 0 ) {
         /* Update node property */
         zSql = sqlite3_mprintf(
-            "UPDATE graph_nodes SET properties = json_set("
-            "COALESCE(properties, '{}'), '$.%s', json('%s')) "
-            "WHERE node_id = %lld",
-            zEscapedProp, zEscapedValue, iNodeId
+            "UPDATE %s SET properties = json_set("
+            "COALESCE(%s, '{}'), '$.%s', json('%s')) "
+            "WHERE id = %lld",
+            pGraph->zNodeTableName, graphPropsExpr(pGraph), zEscapedProp,
+            zEscapedValue, iNodeId
         );
     } else {
         /* Update edge property */
         zSql = sqlite3_mprintf(
-            "UPDATE graph_edges SET properties = json_set("
-            "COALESCE(properties, '{}'), '$.%s', json('%s')) "
-            "WHERE edge_id = %lld",
-            zEscapedProp, zEscapedValue, iEdgeId
+            "UPDATE %s SET properties = json_set("
+            "COALESCE(%s, '{}'), '$.%s', json('%s')) "
+            "WHERE id = %lld",
+            pGraph->zEdgeTableName, graphPropsExpr(pGraph), zEscapedProp,
+            zEscapedValue, iEdgeId
         );
     }
     
@@ -280,9 +289,12 @@ int cypherStorageUpdateProperties(GraphVtab *pGraph, sqlite3_int64 iNodeId,
     
     if( !zSql ) return SQLITE_NOMEM;
     
-    /* Execute the UPDATE */
+    /* Execute the UPDATE; adjacency is unchanged */
+    graphCSRTrackBegin(pGraph);
     rc = cypherStorageExecuteUpdate(pGraph, zSql, &rowId);
     sqlite3_free(zSql);
+    if( rc==SQLITE_OK && iNodeId>0 ) graphColumnsTouch(pGraph, iNodeId, 0);
+    graphCSRTrackEnd(pGraph, rc, 0);
     
     return rc;
 }
@@ -304,27 +316,41 @@ int cypherStorageDeleteNode(GraphVtab *pGraph, sqlite3_int64 iNodeId, int bDetac
     
     if( !pGraph || iNodeId <= 0 ) return SQLITE_MISUSE;
     
+    /* The snapshot hides a deleted node's edges, detached or not */
+    graphCSRTrackBegin(pGraph);
     if( bDetach ) {
         /* First delete all connected relationships */
         zSql = sqlite3_mprintf(
-            "DELETE FROM graph_edges WHERE from_node = %lld OR to_node = %lld",
-            iNodeId, iNodeId
+            "DELETE FROM %s WHERE source = %lld OR target = %lld",
+            pGraph->zEdgeTableName, iNodeId, iNodeId
         );
         
-        if( !zSql ) return SQLITE_NOMEM;
+        if( !zSql ) {
+            graphCSRTrackEnd(pGraph, SQLITE_NOMEM, 0);
+            return SQLITE_NOMEM;
+        }
         
         rc = cypherStorageExecuteUpdate(pGraph, zSql, &rowId);
         sqlite3_free(zSql);
         
-        if( rc != SQLITE_OK ) return rc;
+        if( rc != SQLITE_OK ) {
+            graphCSRTrackEnd(pGraph, rc, 0);
+            return rc;
+        }
     }
     
     /* Delete the node */
-    zSql = sqlite3_mprintf("DELETE FROM graph_nodes WHERE node_id = %lld", iNodeId);
-    if( !zSql ) return SQLITE_NOMEM;
+    zSql = sqlite3_mprintf("DELETE FROM %s WHERE id = %lld",
+                           pGraph->zNodeTableName, iNodeId);
+    if( !zSql ) {
+        graphCSRTrackEnd(pGraph, SQLITE_NOMEM, 0);
+        return SQLITE_NOMEM;
+    }
     
     rc = cypherStorageExecuteUpdate(pGraph, zSql, &rowId);
     sqlite3_free(zSql);
+    if( rc == SQLITE_OK ) graphCSRTrack(pGraph, CSR_OP_DEL_NODE, iNodeId, 0, 0.0);
+    graphCSRTrackEnd(pGraph, rc, 0);
     
     return rc;
 }
@@ -346,11 +372,16 @@ int cypherStorageDeleteEdge(GraphVtab *pGraph, sqlite3_int64 iEdgeId) {
     if( !pGraph || iEdgeId <= 0 ) return SQLITE_MISUSE;
     
     /* Delete the edge */
-    zSql = sqlite3_mprintf("DELETE FROM graph_edges WHERE edge_id = %lld", iEdgeId);
+    zSql = sqlite3_mprintf("DELETE FROM %s WHERE id = %lld",
+                           pGraph->zEdgeTableName, iEdgeId);
     if( !zSql ) return SQLITE_NOMEM;
     
+    /* Read the edge's ends while it still exists */
+    graphCSRTrackBegin(pGraph);
+    graphCSRTrackEdgeRow(pGraph, CSR_OP_DEL_EDGE, iEdgeId);
     rc = cypherStorageExecuteUpdate(pGraph, zSql, &rowId);
     sqlite3_free(zSql);
+    graphCSRTrackEnd(pGraph, rc, 0);
     
     return rc;
 }
@@ -372,7 +403,8 @@ int cypherStorageNodeExists(GraphVtab *pGraph, sqlite3_int64 iNodeId) {
     
     if( !pGraph || iNodeId <= 0 ) return -1;
     
-    zSql = sqlite3_mprintf("SELECT 1 FROM graph_nodes WHERE node_id = %lld LIMIT 1", iNodeId);
+    zSql = sqlite3_mprintf("SELECT 1 FROM %s WHERE id = %lld LIMIT 1",
+                           pGraph->zNodeTableName, iNodeId);
     if( !zSql ) return -1;
     
     rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, NULL);
@@ -405,7 +437,8 @@ sqlite3_int64 cypherStorageGetNextNodeId(GraphVtab *pGraph) {
     
     if( !pGraph ) return -1;
     
-    zSql = sqlite3_mprintf("SELECT COALESCE(MAX(node_id), 0) + 1 FROM graph_nodes");
+    zSql = sqlite3_mprintf("SELECT COALESCE(MAX(id), 0) + 1 FROM %s",
+                           pGraph->zNodeTableName);
     if( !zSql ) return -1;
     
     rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, NULL);
@@ -438,7 +471,8 @@ sqlite3_int64 cypherStorageGetNextEdgeId(GraphVtab *pGraph) {
     
     if( !pGraph ) return -1;
     
-    zSql = sqlite3_mprintf("SELECT COALESCE(MAX(edge_id), 0) + 1 FROM graph_edges");
+    zSql = sqlite3_mprintf("SELECT COALESCE(MAX(id), 0) + 1 FROM %s",
+                           pGraph->zEdgeTableName);
     if( !zSql ) return -1;
     
     rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, NULL);
@@ -474,6 +508,7 @@ int cypherStorageExecuteUpdate(GraphVtab *pGraph, const char *zSql,
         if( pRowId ) {
             *pRowId = sqlite3_last_insert_rowid(pGraph->pDb);
         }
+        graphBumpDataVersion(pGraph);
         rc = SQLITE_OK;
     } else if( rc == SQLITE_ROW ) {
         /* Should not happen for UPDATE/INSERT/DELETE */
@@ -5,6 +5,13 @@
 ** to SQLite users. Includes CREATE, MERGE, SET, DELETE functions that
 ** can be called directly from SQL.
 **
+** The functions write to the connection's default graph table (see
+** graphRegistryFind()). Between cypher_begin_write() and
+** cypher_commit_write() or cypher_rollback_write() they share one write
+** context per connection, and node variables bound by
+** cypher_create_node() can be used by cypher_create_relationship().
+** Outside such a transaction each call runs in its own savepoint.
+**
 ** Memory allocation: All functions use sqlite3_malloc()/sqlite3_free()
 ** Error handling: Functions return SQLite error codes and set result errors
 ** Transaction safety: All operations respect SQLite transaction boundaries
@@ -21,173 +28,497 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "cypher-write.h"
 #include "cypher-executor.h"
 
+/*
+** Per-connection state of the write functions: the write context of the
+** transaction cypher_begin_write() opened, if any. Every registration
+** holds a reference; the last is dropped when the connection closes,
+** which rolls back a transaction left open.
+*/
+typedef struct CypherWriteConn CypherWriteConn;
+struct CypherWriteConn {
+    CypherWriteContext *pTxn;         /* Open write transaction, or NULL */
+    int nRef;                         /* Registrations holding this */
+};
+
+static void cypherWriteConnRef(CypherWriteConn *pConn) {
+    pConn->nRef++;
+}
+
+/*
+** Destroy a write context and the execution context it binds its
+** variables in.
+*/
+static void cypherWriteSqlDestroy(CypherWriteContext *pCtx) {
+    ExecutionContext *pExec;
+
+    if (!pCtx) return;
+    pExec = pCtx->pExecContext;
+    cypherWriteContextDestroy(pCtx);
+    executionContextDestroy(pExec);
+}
+
+static void cypherWriteConnUnref(void *pArg) {
+    CypherWriteConn *pConn = (CypherWriteConn*)pArg;
+
+    if (!pConn || --pConn->nRef > 0) return;
+    cypherWriteSqlDestroy(pConn->pTxn);
+    sqlite3_free(pConn);
+}
+
+/*
+** A new write context on the connection's default graph, in a
+** savepoint. Returns NULL after setting the function's error.
+*/
+static CypherWriteContext *cypherWriteSqlCreate(sqlite3_context *context) {
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    GraphVtab *pGraph = graphRegistryFind(db, NULL);
+    ExecutionContext *pExec;
+    CypherWriteContext *pCtx;
+
+    if (!pGraph) {
+        sqlite3_result_error(context, "No graph table: create one with CREATE VIRTUAL TABLE ... USING graph()", -1);
+        return NULL;
+    }
+    pExec = executionContextCreate(db, pGraph);
+    pCtx = pExec ? cypherWriteContextCreate(db, pGraph, pExec) : NULL;
+    if (!pCtx) {
+        executionContextDestroy(pExec);
+        sqlite3_result_error_nomem(context);
+        return NULL;
+    }
+    if (cypherWriteContextBegin(pCtx) != SQLITE_OK) {
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+        cypherWriteSqlDestroy(pCtx);
+        return NULL;
+    }
+    return pCtx;
+}
+
+/*
+** The write context a function call runs in: the connection's open
+** transaction, else a new one that cypherWriteSqlFinish() ends. Returns
+** NULL after setting the function's error.
+*/
+static CypherWriteContext *cypherWriteSqlBegin(sqlite3_context *context) {
+    CypherWriteConn *pConn = (CypherWriteConn*)sqlite3_user_data(context);
+
+    if (pConn->pTxn) return pConn->pTxn;
+    return cypherWriteSqlCreate(context);
+}
+
+/*
+** End a call begun with cypherWriteSqlBegin(). A context of its own is
+** committed if rc is SQLITE_OK, else rolled back, and destroyed.
+** Returns rc, or the error of the commit.
+*/
+static int cypherWriteSqlFinish(sqlite3_context *context, CypherWriteContext *pCtx, int rc) {
+    CypherWriteConn *pConn = (CypherWriteConn*)sqlite3_user_data(context);
+
+    if (pCtx == pConn->pTxn) return rc;
+    if (rc == SQLITE_OK) {
+        rc = cypherWriteContextCommit(pCtx);
+    } else {
+        cypherWriteContextRollback(pCtx);
+    }
+    cypherWriteSqlDestroy(pCtx);
+    return rc;
+}
+
+/*
+** Set the function's error for operation zWhat failing with rc. The
+** write functions validate names without a message of their own.
+*/
+static void cypherWriteSqlError(sqlite3_context *context, const char *zWhat, int rc) {
+    const char *zWhy;
+    char *zErr;
+
+    switch (rc) {
+        case SQLITE_NOMEM:
+            sqlite3_result_error_nomem(context);
+            return;
+        case SQLITE_FORMAT:
+        case SQLITE_MISUSE:
+        case SQLITE_RANGE:
+        case SQLITE_TOOBIG:
+            zWhy = "invalid label, type, variable or property";
+            break;
+        default:
+            zWhy = sqlite3_errcode(sqlite3_context_db_handle(context)) != SQLITE_OK ?
+                   sqlite3_errmsg(sqlite3_context_db_handle(context)) : sqlite3_errstr(rc);
+            break;
+    }
+    zErr = sqlite3_mprintf("%s: %s", zWhat, zWhy);
+    if (zErr) {
+        sqlite3_result_error(context, zErr, -1);
+        sqlite3_free(zErr);
+    } else {
+        sqlite3_result_error_nomem(context);
+    }
+}
+
+/*
+** Read the JSON array of label names zJson into a new array. Returns
+** SQLITE_OK, or an error code after setting *pzErr.
+*/
+static int cypherWriteSqlLabels(sqlite3 *db, const char *zJson,
+                                char ***pazLabels, int *pnLabels, char **pzErr) {
+    sqlite3_stmt *pStmt = NULL;
+    char **azLabels = NULL;
+    int nLabels = 0;
+    int rc;
+
+    *pazLabels = NULL;
+    *pnLabels = 0;
+    rc = sqlite3_prepare_v2(db, "SELECT json_type(?1), value, type FROM json_each(?1)",
+                            -1, &pStmt, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(pStmt, 1, zJson, -1, SQLITE_STATIC);
+    }
+    while (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
+        char **azNew;
+
+        if (strcmp((const char*)sqlite3_column_text(pStmt, 0), "array") != 0 ||
+            strcmp((const char*)sqlite3_column_text(pStmt, 2), "text") != 0) {
+            *pzErr = sqlite3_mprintf("labels must be a JSON array of strings");
+            rc = SQLITE_ERROR;
+            break;
+        }
+        azNew = sqlite3_realloc(azLabels, (nLabels + 1) * sizeof(char*));
+        if (!azNew) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        azLabels = azNew;
+        azLabels[nLabels] = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
+        if (!azLabels[nLabels]) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        nLabels++;
+    }
+    if (rc == SQLITE_OK) rc = sqlite3_finalize(pStmt);
+    else sqlite3_finalize(pStmt);
+    if (rc != SQLITE_OK && !*pzErr && rc != SQLITE_NOMEM) {
+        *pzErr = sqlite3_mprintf("labels: %s", sqlite3_errmsg(db));
+    }
+
+    if (rc != SQLITE_OK) {
+        while (nLabels > 0) sqlite3_free(azLabels[--nLabels]);
+        sqlite3_free(azLabels);
+        return rc;
+    }
+    *pazLabels = azLabels;
+    *pnLabels = nLabels;
+    return SQLITE_OK;
+}
+
+/*
+** Read the JSON object of properties zJson into new name and value
+** arrays. Null members are left out. Returns SQLITE_OK, or an error
+** code after setting *pzErr.
+*/
+static int cypherWriteSqlProps(sqlite3 *db, const char *zJson, char ***pazNames,
+                               CypherValue ***papValues, int *pnProps, char **pzErr) {
+    sqlite3_stmt *pStmt = NULL;
+    char **azNames = NULL;
+    CypherValue **apValues = NULL;
+    int nProps = 0;
+    int rc;
+
+    *pazNames = NULL;
+    *papValues = NULL;
+    *pnProps = 0;
+    rc = sqlite3_prepare_v2(db, "SELECT json_type(?1), key, value, type FROM json_each(?1)",
+                            -1, &pStmt, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(pStmt, 1, zJson, -1, SQLITE_STATIC);
+    }
+    while (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
+        const char *zType = (const char*)sqlite3_column_text(pStmt, 3);
+        CypherValue *pValue;
+        char **azNew;
+        CypherValue **apNew;
+
+        if (strcmp((const char*)sqlite3_column_text(pStmt, 0), "object") != 0) {
+            *pzErr = sqlite3_mprintf("properties must be a JSON object");
+            rc = SQLITE_ERROR;
+            break;
+        }
+        if (strcmp(zType, "null") == 0) continue;
+        if (strcmp(zType, "array") == 0 || strcmp(zType, "object") == 0) {
+            *pzErr = sqlite3_mprintf("property \"%s\" must be a boolean, number or string",
+                                     sqlite3_column_text(pStmt, 1));
+            rc = SQLITE_ERROR;
+            break;
+        }
+
+        azNew = sqlite3_realloc(azNames, (nProps + 1) * sizeof(char*));
+        if (azNew) azNames = azNew;
+        apNew = sqlite3_realloc(apValues, (nProps + 1) * sizeof(CypherValue*));
+        if (apNew) apValues = apNew;
+        pValue = sqlite3_malloc(sizeof(CypherValue));
+        if (!azNew || !apNew || !pValue) {
+            sqlite3_free(pValue);
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        cypherValueInit(pValue);
+        if (strcmp(zType, "true") == 0 || strcmp(zType, "false") == 0) {
+            cypherValueSetBoolean(pValue, zType[0] == 't');
+        } else if (strcmp(zType, "integer") == 0) {
+            cypherValueSetInteger(pValue, sqlite3_column_int64(pStmt, 2));
+        } else if (strcmp(zType, "real") == 0) {
+            cypherValueSetFloat(pValue, sqlite3_column_double(pStmt, 2));
+        } else {
+            cypherValueSetString(pValue, (const char*)sqlite3_column_text(pStmt, 2));
+        }
+        azNames[nProps] = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
+        apValues[nProps++] = pValue;
+        if (!azNames[nProps - 1] ||
+            (pValue->type == CYPHER_VALUE_STRING && !pValue->u.zString)) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+    }
+    if (rc == SQLITE_OK) rc = sqlite3_finalize(pStmt);
+    else sqlite3_finalize(pStmt);
+    if (rc != SQLITE_OK && !*pzErr && rc != SQLITE_NOMEM) {
+        *pzErr = sqlite3_mprintf("properties: %s", sqlite3_errmsg(db));
+    }
+
+    if (rc != SQLITE_OK) {
+        while (nProps > 0) {
+            nProps--;
+            sqlite3_free(azNames[nProps]);
+            cypherValueDestroy(apValues[nProps]);
+            sqlite3_free(apValues[nProps]);
+        }
+        sqlite3_free(azNames);
+        sqlite3_free(apValues);
+        return rc;
+    }
+    *pazNames = azNames;
+    *papValues = apValues;
+    *pnProps = nProps;
+    return SQLITE_OK;
+}
+
+/*
+** Report an error of the JSON readers as the function's error.
+*/
+static void cypherWriteSqlJsonError(sqlite3_context *context, int rc, char *zErr) {
+    if (zErr) {
+        sqlite3_result_error(context, zErr, -1);
+        sqlite3_free(zErr);
+    } else if (rc == SQLITE_NOMEM) {
+        sqlite3_result_error_nomem(context);
+    } else {
+        sqlite3_result_error_code(context, rc);
+    }
+}
+
+/*
+** The node an endpoint argument of cypher_create_relationship() names:
+** a node ID, or a variable cypher_create_node() bound in the open
+** transaction. Returns 0 after setting the function's error.
+*/
+static sqlite3_int64 cypherWriteSqlEndpoint(sqlite3_context *context, CypherWriteContext *pCtx,
+                                            sqlite3_value *pArg) {
+    const char *zVar;
+    CypherValue *pValue;
+    char *zErr;
+
+    if (sqlite3_value_type(pArg) == SQLITE_INTEGER) {
+        sqlite3_int64 iNodeId = sqlite3_value_int64(pArg);
+        if (cypherValidateNodeExists(pCtx, iNodeId) == SQLITE_OK) return iNodeId;
+        zErr = sqlite3_mprintf("node %lld does not exist", iNodeId);
+    } else {
+        zVar = (const char*)sqlite3_value_text(pArg);
+        pValue = zVar ? executionContextGet(pCtx->pExecContext, zVar) : NULL;
+        if (pValue && pValue->type == CYPHER_VALUE_NODE) return pValue->u.iNodeId;
+        zErr = sqlite3_mprintf("`%s` is not a node ID or a node variable of the write transaction",
+                               zVar ? zVar : "NULL");
+    }
+    sqlite3_result_error(context, zErr ? zErr : "out of memory", -1);
+    sqlite3_free(zErr);
+    return 0;
+}
+
 /*
 ** SQL function: cypher_create_node(variable, labels, properties)
 ** Creates a new node with the specified labels and properties.
 ** Usage: SELECT cypher_create_node('n', '["Person", "Employee"]', '{"name": "Alice", "age": 30}');
 */
 static void cypherCreateNodeSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    sqlite3 *db = sqlite3_context_db_handle(context);
     const char *zVariable, *zLabels, *zProperties;
     CypherWriteContext *pWriteCtx = NULL;
     CreateNodeOp *pOp = NULL;
     char *zResult = NULL;
+    char *zErr = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 3) {
         sqlite3_result_error(context, "cypher_create_node() requires 3 arguments: variable, labels, properties", -1);
         return;
     }
-    
+
     /* Extract arguments */
     zVariable = (const char*)sqlite3_value_text(argv[0]);
     zLabels = (const char*)sqlite3_value_text(argv[1]);
     zProperties = (const char*)sqlite3_value_text(argv[2]);
-    
+
     if (!zVariable || !zLabels || !zProperties) {
         sqlite3_result_error(context, "All arguments must be non-NULL strings", -1);
         return;
     }
-    
-    /* Create write context */
-    /* Write operations require proper database and graph context */
-    /* For now, return error since we don't have these references */
-    sqlite3_result_error(context, "Write operations require graph context. Use Cypher queries instead.", -1);
-    return;
-    
+
     /* Create operation */
     pOp = cypherCreateNodeOpCreate();
     if (!pOp) {
-        sqlite3_result_error(context, "Failed to create node operation", -1);
-        cypherWriteContextDestroy(pWriteCtx);
+        sqlite3_result_error_nomem(context);
         return;
     }
-    
-    /* Set operation parameters */
-    pOp->zVariable = sqlite3_mprintf("%s", zVariable);
-    /* Parse labels from JSON array */
-    if (zLabels && strlen(zLabels) > 2) {
-        /* Basic label parsing - expects ["label1","label2"] format */
-        /* Full JSON parsing would be implemented with a proper JSON parser */
-        pOp->nLabels = 0;
-        pOp->azLabels = NULL;
-    }
-    /* Parse properties from JSON object */
-    if (zProperties && strlen(zProperties) > 2) {
-        /* Basic property parsing - expects {"key":"value"} format */
-        /* Full JSON parsing would be implemented with a proper JSON parser */
-        pOp->nProperties = 0;
-        pOp->azPropNames = NULL;
-        pOp->apPropValues = NULL;
-    }
-    
+
+    /* Set operation parameters; an empty variable binds nothing */
+    if (zVariable[0]) {
+        pOp->zVariable = sqlite3_mprintf("%s", zVariable);
+        if (!pOp->zVariable) {
+            sqlite3_result_error_nomem(context);
+            cypherCreateNodeOpDestroy(pOp);
+            return;
+        }
+    }
+    rc = cypherWriteSqlLabels(db, zLabels, &pOp->azLabels, &pOp->nLabels, &zErr);
+    if (rc == SQLITE_OK) {
+        rc = cypherWriteSqlProps(db, zProperties, &pOp->azPropNames, &pOp->apPropValues,
+                                 &pOp->nProperties, &zErr);
+    }
+    if (rc != SQLITE_OK) {
+        cypherWriteSqlJsonError(context, rc, zErr);
+        cypherCreateNodeOpDestroy(pOp);
+        return;
+    }
+
     /* Execute operation */
+    pWriteCtx = cypherWriteSqlBegin(context);
+    if (!pWriteCtx) {
+        cypherCreateNodeOpDestroy(pOp);
+        return;
+    }
     rc = cypherCreateNode(pWriteCtx, pOp);
+    rc = cypherWriteSqlFinish(context, pWriteCtx, rc);
     if (rc != SQLITE_OK) {
-        sqlite3_result_error(context, "Failed to create node", -1);
+        cypherWriteSqlError(context, "Failed to create node", rc);
         cypherCreateNodeOpDestroy(pOp);
-        cypherWriteContextDestroy(pWriteCtx);
         return;
     }
-    
+
     /* Format result */
-    zResult = sqlite3_mprintf("{\"node_id\": %lld, \"variable\": \"%s\"}", 
+    zResult = sqlite3_mprintf("{\"node_id\": %lld, \"variable\": \"%s\"}",
                              pOp->iCreatedNodeId, zVariable);
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
+
     /* Cleanup */
     cypherCreateNodeOpDestroy(pOp);
-    cypherWriteContextDestroy(pWriteCtx);
 }
 
 /*
-** SQL function: cypher_create_relationship(from_var, to_var, rel_var, rel_type, properties)
-** Creates a new relationship between existing nodes.
+** SQL function: cypher_create_relationship(from, to, rel_var, rel_type, properties)
+** Creates a new relationship between existing nodes. The endpoints are
+** node IDs, or node variables bound earlier in the write transaction.
 ** Usage: SELECT cypher_create_relationship('a', 'b', 'r', 'KNOWS', '{"since": 2020}');
+**        SELECT cypher_create_relationship(1, 2, 'r', 'KNOWS', '{}');
 */
 static void cypherCreateRelationshipSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
-    const char *zFromVar, *zToVar, *zRelVar, *zRelType, *zProperties;
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    const char *zRelVar, *zRelType, *zProperties;
     CypherWriteContext *pWriteCtx = NULL;
     CreateRelOp *pOp = NULL;
     char *zResult = NULL;
+    char *zErr = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 5) {
         sqlite3_result_error(context, "cypher_create_relationship() requires 5 arguments", -1);
         return;
     }
-    
+
     /* Extract arguments */
-    zFromVar = (const char*)sqlite3_value_text(argv[0]);
-    zToVar = (const char*)sqlite3_value_text(argv[1]);
     zRelVar = (const char*)sqlite3_value_text(argv[2]);
     zRelType = (const char*)sqlite3_value_text(argv[3]);
     zProperties = (const char*)sqlite3_value_text(argv[4]);
-    
-    if (!zFromVar || !zToVar || !zRelVar || !zRelType || !zProperties) {
-        sqlite3_result_error(context, "All arguments must be non-NULL strings", -1);
+
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL ||
+        !zRelVar || !zRelType || !zProperties) {
+        sqlite3_result_error(context, "All arguments must be non-NULL", -1);
         return;
     }
-    
-    /* Create write context */
-    /* Write operations require proper database and graph context */
-    /* For now, return error since we don't have these references */
-    sqlite3_result_error(context, "Write operations require graph context. Use Cypher queries instead.", -1);
-    return;
-    
-    /* Unreachable code below - would create operation */
+
     pOp = cypherCreateRelOpCreate();
     if (!pOp) {
-        sqlite3_result_error(context, "Failed to create relationship operation", -1);
-        cypherWriteContextDestroy(pWriteCtx);
+        sqlite3_result_error_nomem(context);
         return;
     }
-    
+
     /* Set operation parameters */
-    pOp->zFromVar = sqlite3_mprintf("%s", zFromVar);
-    pOp->zToVar = sqlite3_mprintf("%s", zToVar);
-    pOp->zRelVar = sqlite3_mprintf("%s", zRelVar);
+    if (zRelVar[0]) pOp->zRelVar = sqlite3_mprintf("%s", zRelVar);
     pOp->zRelType = sqlite3_mprintf("%s", zRelType);
-    /* Parse properties from JSON object */
-    if (zProperties && strlen(zProperties) > 2) {
-        /* Basic property parsing - expects {"key":"value"} format */
-        /* Full JSON parsing would be implemented with a proper JSON parser */
-        pOp->nProperties = 0;
-        pOp->azPropNames = NULL;
-        pOp->apPropValues = NULL;
-    }
-    /* Resolve node IDs from variables */
-    /* This requires access to execution context to look up variable bindings */
-    /* For demonstration, we would look up the nodes by variable name */
-    pOp->iFromNodeId = 1;  /* Would be resolved from zFromVar */
-    pOp->iToNodeId = 2;    /* Would be resolved from zToVar */
-    
-    /* Execute operation */
+    if ((zRelVar[0] && !pOp->zRelVar) || !pOp->zRelType) {
+        sqlite3_result_error_nomem(context);
+        cypherCreateRelOpDestroy(pOp);
+        return;
+    }
+    rc = cypherWriteSqlProps(db, zProperties, &pOp->azPropNames, &pOp->apPropValues,
+                             &pOp->nProperties, &zErr);
+    if (rc != SQLITE_OK) {
+        cypherWriteSqlJsonError(context, rc, zErr);
+        cypherCreateRelOpDestroy(pOp);
+        return;
+    }
+
+    pWriteCtx = cypherWriteSqlBegin(context);
+    if (!pWriteCtx) {
+        cypherCreateRelOpDestroy(pOp);
+        return;
+    }
+
+    /* Resolve the endpoints, then execute the operation */
+    pOp->iFromNodeId = cypherWriteSqlEndpoint(context, pWriteCtx, argv[0]);
+    if (pOp->iFromNodeId > 0) {
+        pOp->iToNodeId = cypherWriteSqlEndpoint(context, pWriteCtx, argv[1]);
+    }
+    if (pOp->iFromNodeId <= 0 || pOp->iToNodeId <= 0) {
+        cypherWriteSqlFinish(context, pWriteCtx, SQLITE_ERROR);
+        cypherCreateRelOpDestroy(pOp);
+        return;
+    }
     rc = cypherCreateRelationship(pWriteCtx, pOp);
+    rc = cypherWriteSqlFinish(context, pWriteCtx, rc);
     if (rc != SQLITE_OK) {
-        sqlite3_result_error(context, "Failed to create relationship", -1);
+        cypherWriteSqlError(context, "Failed to create relationship", rc);
         cypherCreateRelOpDestroy(pOp);
-        cypherWriteContextDestroy(pWriteCtx);
         return;
     }
-    
+
     /* Format result */
-    zResult = sqlite3_mprintf("{\"rel_id\": %lld, \"type\": \"%s\", \"from\": %lld, \"to\": %lld}", 
+    zResult = sqlite3_mprintf("{\"rel_id\": %lld, \"type\": \"%s\", \"from\": %lld, \"to\": %lld}",
                              pOp->iCreatedRelId, zRelType, pOp->iFromNodeId, pOp->iToNodeId);
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
+
     /* Cleanup */
     cypherCreateRelOpDestroy(pOp);
-    cypherWriteContextDestroy(pWriteCtx);
 }
 
 /*
 ** SQL function: cypher_write_test()
-** Test function to demonstrate write operation capabilities.
-** Returns JSON describing test results.
+** Test function to demonstrate write operation capabilities: creates a
+** node and a relationship to itself on the default graph and rolls
+** both back. Returns JSON describing test results.
 */
 static void cypherWriteTestSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
     (void)argc;
@@ -197,45 +528,40 @@ static void cypherWriteTestSqlFunc(sqlite3_context *context, int argc, sqlite3_v
     CreateRelOp *pRelOp = NULL;
     char *zResult = NULL;
     int rc;
-    
-    /* Create write context */
-    pWriteCtx = cypherWriteContextCreate(NULL, NULL, NULL);
-    if (!pWriteCtx) {
-        sqlite3_result_error(context, "Failed to create write context", -1);
-        return;
-    }
-    
+
+    /* Create write context; nothing it writes is kept */
+    pWriteCtx = cypherWriteSqlCreate(context);
+    if (!pWriteCtx) return;
+
     /* Test node creation */
     pNodeOp = cypherCreateNodeOpCreate();
     if (!pNodeOp) {
-        sqlite3_result_error(context, "Failed to create node operation", -1);
-        cypherWriteContextDestroy(pWriteCtx);
+        sqlite3_result_error_nomem(context);
+        cypherWriteSqlDestroy(pWriteCtx);
         return;
     }
-    
+
     pNodeOp->zVariable = sqlite3_mprintf("testNode");
     rc = cypherCreateNode(pWriteCtx, pNodeOp);
-    
+
     if (rc == SQLITE_OK) {
         /* Test relationship creation */
         pRelOp = cypherCreateRelOpCreate();
         if (pRelOp) {
-            pRelOp->zFromVar = sqlite3_mprintf("a");
-            pRelOp->zToVar = sqlite3_mprintf("b");
             pRelOp->zRelVar = sqlite3_mprintf("r");
             pRelOp->zRelType = sqlite3_mprintf("TEST_REL");
-            pRelOp->iFromNodeId = 1;
-            pRelOp->iToNodeId = 2;
-            
+            pRelOp->iFromNodeId = pNodeOp->iCreatedNodeId;
+            pRelOp->iToNodeId = pNodeOp->iCreatedNodeId;
+
             rc = cypherCreateRelationship(pWriteCtx, pRelOp);
-            
+
             if (rc == SQLITE_OK) {
                 zResult = sqlite3_mprintf("{\"status\": \"success\", \"node_id\": %lld, \"rel_id\": %lld, \"operations\": %d}",
                                         pNodeOp->iCreatedNodeId, pRelOp->iCreatedRelId, pWriteCtx->nOperations);
             } else {
                 zResult = sqlite3_mprintf("{\"status\": \"error\", \"message\": \"Failed to create relationship\", \"code\": %d}", rc);
             }
-            
+
             cypherCreateRelOpDestroy(pRelOp);
         } else {
             zResult = sqlite3_mprintf("{\"status\": \"error\", \"message\": \"Failed to allocate relationship operation\"}");
@@ -243,77 +569,44 @@ static void cypherWriteTestSqlFunc(sqlite3_context *context, int argc, sqlite3_v
     } else {
         zResult = sqlite3_mprintf("{\"status\": \"error\", \"message\": \"Failed to create node\", \"code\": %d}", rc);
     }
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
+
     /* Cleanup */
     cypherCreateNodeOpDestroy(pNodeOp);
-    cypherWriteContextDestroy(pWriteCtx);
+    cypherWriteContextRollback(pWriteCtx);
+    cypherWriteSqlDestroy(pWriteCtx);
 }
 
-/*
-** Global write context for transaction management.
-** In a real implementation, this would be stored per-connection.
-** WARNING: This global is NOT thread-safe and should be replaced
-** with per-connection storage or protected with a mutex.
-*/
-static CypherWriteContext *g_pGlobalWriteContext = NULL;
-
-/* Mutex for protecting global write context */
-static sqlite3_mutex *g_pWriteContextMutex = NULL;
-
 /*
 ** SQL function: cypher_begin_write()
 ** Begins a write transaction for multiple operations.
 ** Usage: SELECT cypher_begin_write();
 */
 static void cypherBeginWriteSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    CypherWriteConn *pConn = (CypherWriteConn*)sqlite3_user_data(context);
     (void)argv;
     char *zResult = NULL;
-    int rc;
-    
+
     /* Validate argument count */
     if (argc != 0) {
         sqlite3_result_error(context, "cypher_begin_write() takes no arguments", -1);
         return;
     }
-    
-    /* Initialize mutex if needed */
-    if (!g_pWriteContextMutex) {
-        g_pWriteContextMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
-    }
-    
-    sqlite3_mutex_enter(g_pWriteContextMutex);
-    
+
     /* Check if transaction already in progress */
-    if (g_pGlobalWriteContext && g_pGlobalWriteContext->bInTransaction) {
-        sqlite3_mutex_leave(g_pWriteContextMutex);
+    if (pConn->pTxn) {
         sqlite3_result_error(context, "Write transaction already in progress", -1);
         return;
     }
-    
-    /* Create write context if needed */
-    if (!g_pGlobalWriteContext) {
-        g_pGlobalWriteContext = cypherWriteContextCreate(NULL, NULL, NULL);
-        if (!g_pGlobalWriteContext) {
-            sqlite3_mutex_leave(g_pWriteContextMutex);
-            sqlite3_result_error(context, "Failed to create write context", -1);
-            return;
-        }
-    }
-    
-    /* Begin transaction */
-    rc = cypherWriteContextBegin(g_pGlobalWriteContext);
-    if (rc != SQLITE_OK) {
-        sqlite3_mutex_leave(g_pWriteContextMutex);
-        sqlite3_result_error(context, "Failed to begin write transaction", -1);
-        return;
-    }
-    
+
+    /* Create the write context and begin its transaction */
+    pConn->pTxn = cypherWriteSqlCreate(context);
+    if (!pConn->pTxn) return;
+
     zResult = sqlite3_mprintf("{\"status\": \"success\", \"message\": \"Write transaction begun\", \"auto_commit\": %s}",
-                             g_pGlobalWriteContext->bAutoCommit ? "true" : "false");
-    
-    sqlite3_mutex_leave(g_pWriteContextMutex);
+                             pConn->pTxn->bAutoCommit ? "true" : "false");
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
 }
 
@@ -323,42 +616,37 @@ static void cypherBeginWriteSqlFunc(sqlite3_context *context, int argc, sqlite3_
 ** Usage: SELECT cypher_commit_write();
 */
 static void cypherCommitWriteSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    CypherWriteConn *pConn = (CypherWriteConn*)sqlite3_user_data(context);
+    CypherWriteContext *pTxn = pConn->pTxn;
     (void)argv;
     char *zResult = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 0) {
         sqlite3_result_error(context, "cypher_commit_write() takes no arguments", -1);
         return;
     }
-    
-    if (!g_pWriteContextMutex) {
-        sqlite3_result_error(context, "Write context not initialized", -1);
-        return;
-    }
-    
-    sqlite3_mutex_enter(g_pWriteContextMutex);
-    
+
     /* Check if we have a transaction to commit */
-    if (!g_pGlobalWriteContext || !g_pGlobalWriteContext->bInTransaction) {
-        sqlite3_mutex_leave(g_pWriteContextMutex);
+    if (!pTxn) {
         sqlite3_result_error(context, "No write transaction in progress", -1);
         return;
     }
-    
-    /* Commit transaction */
-    rc = cypherWriteContextCommit(g_pGlobalWriteContext);
+
+    /* Commit transaction; a failed commit rolls back and ends it too */
+    pConn->pTxn = NULL;
+    rc = cypherWriteContextCommit(pTxn);
     if (rc != SQLITE_OK) {
-        sqlite3_mutex_leave(g_pWriteContextMutex);
-        sqlite3_result_error(context, "Failed to commit write transaction", -1);
+        cypherWriteSqlError(context, "Failed to commit write transaction", rc);
+        cypherWriteSqlDestroy(pTxn);
         return;
     }
-    
+
     zResult = sqlite3_mprintf("{\"status\": \"success\", \"message\": \"Write transaction committed\", \"operations_executed\": %d}",
-                             g_pGlobalWriteContext->nOperations);
-    
-    sqlite3_mutex_leave(g_pWriteContextMutex);
+                             pTxn->nOperations);
+
+    cypherWriteSqlDestroy(pTxn);
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
 }
 
@@ -368,42 +656,37 @@ static void cypherCommitWriteSqlFunc(sqlite3_context *context, int argc, sqlite3
 ** Usage: SELECT cypher_rollback_write();
 */
 static void cypherRollbackWriteSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    CypherWriteConn *pConn = (CypherWriteConn*)sqlite3_user_data(context);
+    CypherWriteContext *pTxn = pConn->pTxn;
     (void)argv;
     char *zResult = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 0) {
         sqlite3_result_error(context, "cypher_rollback_write() takes no arguments", -1);
         return;
     }
-    
-    if (!g_pWriteContextMutex) {
-        sqlite3_result_error(context, "Write context not initialized", -1);
-        return;
-    }
-    
-    sqlite3_mutex_enter(g_pWriteContextMutex);
-    
+
     /* Check if we have a transaction to rollback */
-    if (!g_pGlobalWriteContext || !g_pGlobalWriteContext->bInTransaction) {
-        sqlite3_mutex_leave(g_pWriteContextMutex);
+    if (!pTxn) {
         sqlite3_result_error(context, "No write transaction in progress", -1);
         return;
     }
-    
+
     /* Rollback transaction */
-    rc = cypherWriteContextRollback(g_pGlobalWriteContext);
+    pConn->pTxn = NULL;
+    rc = cypherWriteContextRollback(pTxn);
     if (rc != SQLITE_OK) {
-        sqlite3_mutex_leave(g_pWriteContextMutex);
-        sqlite3_result_error(context, "Failed to rollback write transaction", -1);
+        cypherWriteSqlError(context, "Failed to rollback write transaction", rc);
+        cypherWriteSqlDestroy(pTxn);
         return;
     }
-    
+
     zResult = sqlite3_mprintf("{\"status\": \"success\", \"message\": \"Write transaction rolled back\", \"operations_reverted\": %d}",
-                             g_pGlobalWriteContext->nOperations);
-    
-    sqlite3_mutex_leave(g_pWriteContextMutex);
+                             pTxn->nOperations);
+
+    cypherWriteSqlDestroy(pTxn);
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
 }
 
@@ -413,97 +696,90 @@ static void cypherRollbackWriteSqlFunc(sqlite3_context *context, int argc, sqlit
 ** Usage: SELECT cypher_merge_node('n', '["Person"]', '{"email": "alice@example.com"}', '{"created": "2024-01-01"}', '{"lastSeen": "2024-01-01"}');
 */
 static void cypherMergeNodeSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    sqlite3 *db = sqlite3_context_db_handle(context);
     const char *zVariable, *zLabels, *zMatchProps, *zOnCreateProps, *zOnMatchProps;
     CypherWriteContext *pWriteCtx = NULL;
     MergeNodeOp *pOp = NULL;
     char *zResult = NULL;
+    char *zErr = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 5) {
         sqlite3_result_error(context, "cypher_merge_node() requires 5 arguments: variable, labels, match_props, on_create_props, on_match_props", -1);
         return;
     }
-    
+
     /* Extract arguments */
     zVariable = (const char*)sqlite3_value_text(argv[0]);
     zLabels = (const char*)sqlite3_value_text(argv[1]);
     zMatchProps = (const char*)sqlite3_value_text(argv[2]);
     zOnCreateProps = (const char*)sqlite3_value_text(argv[3]);
     zOnMatchProps = (const char*)sqlite3_value_text(argv[4]);
-    
+
     if (!zVariable || !zLabels || !zMatchProps || !zOnCreateProps || !zOnMatchProps) {
         sqlite3_result_error(context, "All arguments must be non-NULL strings", -1);
         return;
     }
-    
-    /* Create write context */
-    /* Write operations require proper database and graph context */
-    /* For now, return error since we don't have these references */
-    sqlite3_result_error(context, "Write operations require graph context. Use Cypher queries instead.", -1);
-    return;
-    
-    /* Unreachable code below - would create operation */
+
     pOp = cypherMergeNodeOpCreate();
     if (!pOp) {
-        sqlite3_result_error(context, "Failed to create merge node operation", -1);
-        cypherWriteContextDestroy(pWriteCtx);
+        sqlite3_result_error_nomem(context);
         return;
     }
-    
+
     /* Set operation parameters */
-    pOp->zVariable = sqlite3_mprintf("%s", zVariable);
-    /* Parse labels from JSON array */
-    if (zLabels && strlen(zLabels) > 2) {
-        /* Basic label parsing - expects ["label1","label2"] format */
-        pOp->nLabels = 0;
-        pOp->azLabels = NULL;
-    }
-    /* Parse match properties from JSON object */
-    if (zMatchProps && strlen(zMatchProps) > 2) {
-        /* Basic property parsing for matching */
-        pOp->nMatchProps = 0;
-        pOp->azMatchProps = NULL;
-        pOp->apMatchValues = NULL;
-    }
-    /* Parse on create properties from JSON object */
-    if (zOnCreateProps && strlen(zOnCreateProps) > 2) {
-        /* Basic property parsing for creation */
-        pOp->nOnCreateProps = 0;
-        pOp->azOnCreateProps = NULL;
-        pOp->apOnCreateValues = NULL;
-    }
-    /* Parse on match properties from JSON object */
-    if (zOnMatchProps && strlen(zOnMatchProps) > 2) {
-        /* Basic property parsing for matching */
-        pOp->nOnMatchProps = 0;
-        pOp->azOnMatchProps = NULL;
-        pOp->apOnMatchValues = NULL;
-    }
-    
+    if (zVariable[0] && !(pOp->zVariable = sqlite3_mprintf("%s", zVariable))) {
+        rc = SQLITE_NOMEM;
+    } else {
+        rc = cypherWriteSqlLabels(db, zLabels, &pOp->azLabels, &pOp->nLabels, &zErr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = cypherWriteSqlProps(db, zMatchProps, &pOp->azMatchProps, &pOp->apMatchValues,
+                                 &pOp->nMatchProps, &zErr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = cypherWriteSqlProps(db, zOnCreateProps, &pOp->azOnCreateProps,
+                                 &pOp->apOnCreateValues, &pOp->nOnCreateProps, &zErr);
+    }
+    if (rc == SQLITE_OK) {
+        rc = cypherWriteSqlProps(db, zOnMatchProps, &pOp->azOnMatchProps,
+                                 &pOp->apOnMatchValues, &pOp->nOnMatchProps, &zErr);
+    }
+    if (rc != SQLITE_OK) {
+        cypherWriteSqlJsonError(context, rc, zErr);
+        cypherMergeNodeOpDestroy(pOp);
+        return;
+    }
+
     /* Execute operation */
+    pWriteCtx = cypherWriteSqlBegin(context);
+    if (!pWriteCtx) {
+        cypherMergeNodeOpDestroy(pOp);
+        return;
+    }
     rc = cypherMergeNode(pWriteCtx, pOp);
+    rc = cypherWriteSqlFinish(context, pWriteCtx, rc);
     if (rc != SQLITE_OK) {
-        sqlite3_result_error(context, "Failed to merge node", -1);
+        cypherWriteSqlError(context, "Failed to merge node", rc);
         cypherMergeNodeOpDestroy(pOp);
-        cypherWriteContextDestroy(pWriteCtx);
         return;
     }
-    
+
     /* Format result */
-    zResult = sqlite3_mprintf("{\"node_id\": %lld, \"variable\": \"%s\", \"was_created\": %s}", 
+    zResult = sqlite3_mprintf("{\"node_id\": %lld, \"variable\": \"%s\", \"was_created\": %s}",
                              pOp->iNodeId, zVariable, pOp->bWasCreated ? "true" : "false");
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
+
     /* Cleanup */
     cypherMergeNodeOpDestroy(pOp);
-    cypherWriteContextDestroy(pWriteCtx);
 }
 
 /*
 ** SQL function: cypher_set_property(variable, node_id, property, value)
-** Sets a property on an existing node.
+** Sets a property on an existing node. Integer, real and text values
+** keep their type.
 ** Usage: SELECT cypher_set_property('n', 123, 'name', 'Alice');
 */
 static void cypherSetPropertySqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
@@ -513,74 +789,79 @@ static void cypherSetPropertySqlFunc(sqlite3_context *context, int argc, sqlite3
     SetPropertyOp *pOp = NULL;
     char *zResult = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 4) {
         sqlite3_result_error(context, "cypher_set_property() requires 4 arguments: variable, node_id, property, value", -1);
         return;
     }
-    
+
     /* Extract arguments */
     zVariable = (const char*)sqlite3_value_text(argv[0]);
     iNodeId = sqlite3_value_int64(argv[1]);
     zProperty = (const char*)sqlite3_value_text(argv[2]);
     zValue = (const char*)sqlite3_value_text(argv[3]);
-    
+
     if (!zVariable || !zProperty || !zValue) {
         sqlite3_result_error(context, "String arguments must be non-NULL", -1);
         return;
     }
-    
-    /* Create write context */
-    pWriteCtx = cypherWriteContextCreate(NULL, NULL, NULL);
-    if (!pWriteCtx) {
-        sqlite3_result_error(context, "Failed to create write context", -1);
-        return;
-    }
-    
+
     /* Create operation */
     pOp = cypherSetPropertyOpCreate();
     if (!pOp) {
-        sqlite3_result_error(context, "Failed to create set property operation", -1);
-        cypherWriteContextDestroy(pWriteCtx);
+        sqlite3_result_error_nomem(context);
         return;
     }
-    
+
     /* Set operation parameters */
     pOp->zVariable = sqlite3_mprintf("%s", zVariable);
     pOp->zProperty = sqlite3_mprintf("%s", zProperty);
     pOp->iNodeId = iNodeId;
-    
+
     /* Create value */
     pOp->pValue = (CypherValue*)sqlite3_malloc(sizeof(CypherValue));
-    if (!pOp->pValue) {
-        sqlite3_result_error(context, "Failed to allocate value", -1);
+    if (!pOp->zVariable || !pOp->zProperty || !pOp->pValue) {
+        sqlite3_result_error_nomem(context);
         cypherSetPropertyOpDestroy(pOp);
-        cypherWriteContextDestroy(pWriteCtx);
         return;
     }
-    
-    pOp->pValue->type = CYPHER_VALUE_STRING;
-    pOp->pValue->u.zString = sqlite3_mprintf("%s", zValue);
-    
+
+    cypherValueInit(pOp->pValue);
+    switch (sqlite3_value_type(argv[3])) {
+        case SQLITE_INTEGER:
+            cypherValueSetInteger(pOp->pValue, sqlite3_value_int64(argv[3]));
+            break;
+        case SQLITE_FLOAT:
+            cypherValueSetFloat(pOp->pValue, sqlite3_value_double(argv[3]));
+            break;
+        default:
+            cypherValueSetString(pOp->pValue, zValue);
+            break;
+    }
+
     /* Execute operation */
+    pWriteCtx = cypherWriteSqlBegin(context);
+    if (!pWriteCtx) {
+        cypherSetPropertyOpDestroy(pOp);
+        return;
+    }
     rc = cypherSetProperty(pWriteCtx, pOp);
+    rc = cypherWriteSqlFinish(context, pWriteCtx, rc);
     if (rc != SQLITE_OK) {
-        sqlite3_result_error(context, "Failed to set property", -1);
+        cypherWriteSqlError(context, "Failed to set property", rc);
         cypherSetPropertyOpDestroy(pOp);
-        cypherWriteContextDestroy(pWriteCtx);
         return;
     }
-    
+
     /* Format result */
-    zResult = sqlite3_mprintf("{\"node_id\": %lld, \"property\": \"%s\", \"value\": \"%s\"}", 
+    zResult = sqlite3_mprintf("{\"node_id\": %lld, \"property\": \"%s\", \"value\": \"%s\"}",
                              iNodeId, zProperty, zValue);
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
+
     /* Cleanup */
     cypherSetPropertyOpDestroy(pOp);
-    cypherWriteContextDestroy(pWriteCtx);
 }
 
 /*
@@ -597,68 +878,65 @@ static void cypherDeleteNodeSqlFunc(sqlite3_context *context, int argc, sqlite3_
     DeleteOp *pOp = NULL;
     char *zResult = NULL;
     int rc;
-    
+
     /* Validate argument count */
     if (argc != 3) {
         sqlite3_result_error(context, "cypher_delete_node() requires 3 arguments: variable, node_id, detach", -1);
         return;
     }
-    
+
     /* Extract arguments */
     zVariable = (const char*)sqlite3_value_text(argv[0]);
     iNodeId = sqlite3_value_int64(argv[1]);
     bDetach = sqlite3_value_int(argv[2]);
-    
+
     if (!zVariable) {
         sqlite3_result_error(context, "Variable must be non-NULL string", -1);
         return;
     }
-    
-    /* Create write context */
-    pWriteCtx = cypherWriteContextCreate(NULL, NULL, NULL);
-    if (!pWriteCtx) {
-        sqlite3_result_error(context, "Failed to create write context", -1);
-        return;
-    }
-    
+
     /* Create operation */
     pOp = cypherDeleteOpCreate();
     if (!pOp) {
-        sqlite3_result_error(context, "Failed to create delete operation", -1);
-        cypherWriteContextDestroy(pWriteCtx);
+        sqlite3_result_error_nomem(context);
         return;
     }
-    
+
     /* Set operation parameters */
     pOp->zVariable = sqlite3_mprintf("%s", zVariable);
     pOp->iNodeId = iNodeId;
     pOp->bIsNode = 1;
     pOp->bDetach = bDetach;
-    
+
     /* Execute operation */
+    pWriteCtx = cypherWriteSqlBegin(context);
+    if (!pWriteCtx) {
+        cypherDeleteOpDestroy(pOp);
+        return;
+    }
     rc = cypherDelete(pWriteCtx, pOp);
+    rc = cypherWriteSqlFinish(context, pWriteCtx, rc);
     if (rc != SQLITE_OK) {
-        sqlite3_result_error(context, "Failed to delete node", -1);
+        cypherWriteSqlError(context, "Failed to delete node", rc);
         cypherDeleteOpDestroy(pOp);
-        cypherWriteContextDestroy(pWriteCtx);
         return;
     }
-    
+
     /* Format result */
-    zResult = sqlite3_mprintf("{\"deleted_node_id\": %lld, \"detach\": %s}", 
+    zResult = sqlite3_mprintf("{\"deleted_node_id\": %lld, \"detach\": %s}",
                              iNodeId, bDetach ? "true" : "false");
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
+
     /* Cleanup */
     cypherDeleteOpDestroy(pOp);
-    cypherWriteContextDestroy(pWriteCtx);
 }
 
 /*
 ** SQL function: cypher_write_comprehensive_test()
-** Comprehensive test of all write operations.
-** Returns JSON describing test results.
+** Comprehensive test of all write operations on the default graph: a
+** node is created, merged, updated and deleted, and everything is
+** rolled back. Returns JSON describing test results.
 */
 static void cypherWriteComprehensiveTestSqlFunc(sqlite3_context *context, int argc, sqlite3_value **argv) {
     (void)argc;
@@ -668,18 +946,17 @@ static void cypherWriteComprehensiveTestSqlFunc(sqlite3_context *context, int ar
     MergeNodeOp *pMergeOp = NULL;
     SetPropertyOp *pSetOp = NULL;
     DeleteOp *pDeleteOp = NULL;
+    sqlite3_int64 iNodeId = 0;
     char *zResult = NULL;
+    int nOperations;
     int rc;
     int testsPassed = 0;
     int totalTests = 0;
-    
-    /* Create write context */
-    pWriteCtx = cypherWriteContextCreate(NULL, NULL, NULL);
-    if (!pWriteCtx) {
-        sqlite3_result_error(context, "Failed to create write context", -1);
-        return;
-    }
-    
+
+    /* Create write context; nothing it writes is kept */
+    pWriteCtx = cypherWriteSqlCreate(context);
+    if (!pWriteCtx) return;
+
     /* Test 1: CREATE node */
     totalTests++;
     pCreateOp = cypherCreateNodeOpCreate();
@@ -687,11 +964,12 @@ static void cypherWriteComprehensiveTestSqlFunc(sqlite3_context *context, int ar
         pCreateOp->zVariable = sqlite3_mprintf("testNode");
         rc = cypherCreateNode(pWriteCtx, pCreateOp);
         if (rc == SQLITE_OK) {
+            iNodeId = pCreateOp->iCreatedNodeId;
             testsPassed++;
         }
         cypherCreateNodeOpDestroy(pCreateOp);
     }
-    
+
     /* Test 2: MERGE node */
     totalTests++;
     pMergeOp = cypherMergeNodeOpCreate();
@@ -703,16 +981,17 @@ static void cypherWriteComprehensiveTestSqlFunc(sqlite3_context *context, int ar
         }
         cypherMergeNodeOpDestroy(pMergeOp);
     }
-    
-    /* Test 3: SET property */
+
+    /* Test 3: SET property on the node of test 1 */
     totalTests++;
     pSetOp = cypherSetPropertyOpCreate();
     if (pSetOp) {
         pSetOp->zVariable = sqlite3_mprintf("n");
         pSetOp->zProperty = sqlite3_mprintf("testProp");
-        pSetOp->iNodeId = 1;
+        pSetOp->iNodeId = iNodeId;
         pSetOp->pValue = (CypherValue*)sqlite3_malloc(sizeof(CypherValue));
         if (pSetOp->pValue) {
+            cypherValueInit(pSetOp->pValue);
             pSetOp->pValue->type = CYPHER_VALUE_STRING;
             pSetOp->pValue->u.zString = sqlite3_mprintf("testValue");
             rc = cypherSetProperty(pWriteCtx, pSetOp);
@@ -722,13 +1001,13 @@ static void cypherWriteComprehensiveTestSqlFunc(sqlite3_context *context, int ar
         }
         cypherSetPropertyOpDestroy(pSetOp);
     }
-    
-    /* Test 4: DELETE node */
+
+    /* Test 4: DELETE the node of test 1 */
     totalTests++;
     pDeleteOp = cypherDeleteOpCreate();
     if (pDeleteOp) {
         pDeleteOp->zVariable = sqlite3_mprintf("n");
-        pDeleteOp->iNodeId = 1;
+        pDeleteOp->iNodeId = iNodeId;
         pDeleteOp->bIsNode = 1;
         pDeleteOp->bDetach = 1;
         rc = cypherDelete(pWriteCtx, pDeleteOp);
@@ -737,93 +1016,62 @@ static void cypherWriteComprehensiveTestSqlFunc(sqlite3_context *context, int ar
         }
         cypherDeleteOpDestroy(pDeleteOp);
     }
-    
+
+    nOperations = pWriteCtx->nOperations;
+    cypherWriteContextRollback(pWriteCtx);
+    cypherWriteSqlDestroy(pWriteCtx);
+
     /* Format comprehensive result */
     zResult = sqlite3_mprintf("{\"status\": \"%s\", \"tests_passed\": %d, \"total_tests\": %d, \"operations_logged\": %d, \"success_rate\": \"%.1f%%\"}",
                              (testsPassed == totalTests) ? "success" : "partial",
-                             testsPassed, totalTests, pWriteCtx->nOperations,
+                             testsPassed, totalTests, nOperations,
                              (totalTests > 0) ? (100.0 * testsPassed / totalTests) : 0.0);
-    
+
     sqlite3_result_text(context, zResult, -1, sqlite3_free);
-    
-    /* Cleanup */
-    cypherWriteContextDestroy(pWriteCtx);
 }
 
 /*
 ** Register all Cypher write operation SQL functions with the database.
-** Should be called during extension initialization.
+** Should be called during extension initialization. The functions
+** share the connection's CypherWriteConn; each registration holds a
+** reference, which SQLite drops when the registration fails or the
+** connection closes.
 ** Returns SQLITE_OK on success, error code on failure.
 */
 int cypherRegisterWriteSqlFunctions(sqlite3 *db) {
+    static const struct {
+        const char *zName;
+        int nArg;
+        void (*xFunc)(sqlite3_context*, int, sqlite3_value**);
+    } aFunc[] = {
+        { "cypher_create_node",              3, cypherCreateNodeSqlFunc },
+        { "cypher_create_relationship",      5, cypherCreateRelationshipSqlFunc },
+        { "cypher_write_test",               0, cypherWriteTestSqlFunc },
+        { "cypher_begin_write",              0, cypherBeginWriteSqlFunc },
+        { "cypher_commit_write",             0, cypherCommitWriteSqlFunc },
+        { "cypher_rollback_write",           0, cypherRollbackWriteSqlFunc },
+        { "cypher_merge_node",               5, cypherMergeNodeSqlFunc },
+        { "cypher_set_property",             4, cypherSetPropertySqlFunc },
+        { "cypher_delete_node",              3, cypherDeleteNodeSqlFunc },
+        { "cypher_write_comprehensive_test", 0, cypherWriteComprehensiveTestSqlFunc },
+    };
+    CypherWriteConn *pConn;
     int rc;
-    
-    /* Register cypher_create_node function */
-    rc = sqlite3_create_function(db, "cypher_create_node", 3, SQLITE_UTF8, 0,
-                                cypherCreateNodeSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register cypher_create_relationship function */
-    rc = sqlite3_create_function(db, "cypher_create_relationship", 5, SQLITE_UTF8, 0,
-                                cypherCreateRelationshipSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register cypher_write_test function */
-    rc = sqlite3_create_function(db, "cypher_write_test", 0, SQLITE_UTF8, 0,
-                                cypherWriteTestSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register transaction management functions */
-    rc = sqlite3_create_function(db, "cypher_begin_write", 0, SQLITE_UTF8, 0,
-                                cypherBeginWriteSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    rc = sqlite3_create_function(db, "cypher_commit_write", 0, SQLITE_UTF8, 0,
-                                cypherCommitWriteSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    rc = sqlite3_create_function(db, "cypher_rollback_write", 0, SQLITE_UTF8, 0,
-                                cypherRollbackWriteSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register cypher_merge_node function */
-    rc = sqlite3_create_function(db, "cypher_merge_node", 5, SQLITE_UTF8, 0,
-                                cypherMergeNodeSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register cypher_set_property function */
-    rc = sqlite3_create_function(db, "cypher_set_property", 4, SQLITE_UTF8, 0,
-                                cypherSetPropertySqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register cypher_delete_node function */
-    rc = sqlite3_create_function(db, "cypher_delete_node", 3, SQLITE_UTF8, 0,
-                                cypherDeleteNodeSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    /* Register cypher_write_comprehensive_test function */
-    rc = sqlite3_create_function(db, "cypher_write_comprehensive_test", 0, SQLITE_UTF8, 0,
-                                cypherWriteComprehensiveTestSqlFunc, 0, 0);
-    if (rc != SQLITE_OK) return rc;
-    
-    return SQLITE_OK;
-}
+    int i;
 
-/*
-** Cleanup global write context and mutex.
-** Should be called during extension shutdown.
-*/
-void cypherWriteSqlCleanup(void) {
-    if (g_pWriteContextMutex) {
-        sqlite3_mutex_enter(g_pWriteContextMutex);
-        
-        if (g_pGlobalWriteContext) {
-            cypherWriteContextDestroy(g_pGlobalWriteContext);
-            g_pGlobalWriteContext = NULL;
-        }
-        
-        sqlite3_mutex_leave(g_pWriteContextMutex);
-        sqlite3_mutex_free(g_pWriteContextMutex);
-        g_pWriteContextMutex = NULL;
+    pConn = sqlite3_malloc(sizeof(*pConn));
+    if (!pConn) return SQLITE_NOMEM;
+    memset(pConn, 0, sizeof(*pConn));
+
+    /* The reference held here keeps pConn until the loop is done */
+    cypherWriteConnRef(pConn);
+    rc = SQLITE_OK;
+    for (i = 0; rc == SQLITE_OK && i < (int)(sizeof(aFunc) / sizeof(aFunc[0])); i++) {
+        cypherWriteConnRef(pConn);
+        rc = sqlite3_create_function_v2(db, aFunc[i].zName, aFunc[i].nArg, SQLITE_UTF8,
+                                        pConn, aFunc[i].xFunc, 0, 0, cypherWriteConnUnref);
     }
-}
\ No newline at end of file
+    cypherWriteConnUnref(pConn);
+
+    return rc;
+}
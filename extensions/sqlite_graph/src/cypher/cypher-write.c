@@ -24,6 +24,8 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "cypher-write.h"
 #include "graph-vtab.h"
 #include "graph-memory.h"
+#include "graph-csr.h"
+#include "cypher-expressions.h"
 
 /*
 ** Constants for input validation
@@ -120,69 +122,6 @@ static int isReservedWord(const char *zWord) {
     return 0;
 }
 
-/*
-** Generate a cryptographically secure unique node ID.
-** Returns node ID > 0 on success, -1 on failure.
-*/
-static sqlite3_int64 cypherGenerateSecureNodeId(GraphVtab *pGraph) {
-    static sqlite3_int64 iNextId = 1;
-    sqlite3_int64 iNodeId;
-    
-    /* Simple implementation - in production, use crypto-secure random */
-    iNodeId = time(NULL) * 1000 + (iNextId++);
-    
-    /* Ensure ID doesn't already exist */
-    while (cypherStorageNodeExists(pGraph, iNodeId) > 0) {
-        iNodeId++;
-    }
-    
-    return iNodeId;
-}
-
-/*
-** Generate cryptographically secure unique relationship ID.
-** Returns unique relationship ID or negative value on failure.
-*/
-static sqlite3_int64 cypherGenerateSecureRelationshipId(GraphVtab *pGraph) {
-    static sqlite3_int64 iNextRelId = 1;
-    sqlite3_int64 iRelId;
-    
-    /* Simple implementation - in production, use crypto-secure random */
-    iRelId = time(NULL) * 1000 + 500000 + (iNextRelId++); /* Offset from node IDs */
-    
-    /* Ensure ID doesn't already exist - check against edge storage */
-    sqlite3_stmt *pStmt = NULL;
-    char *zSql = sqlite3_mprintf("SELECT 1 FROM graph_edges WHERE edge_id = %lld LIMIT 1", iRelId);
-    if (!zSql) return -1;
-    
-    int rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, NULL);
-    sqlite3_free(zSql);
-    
-    while (rc == SQLITE_OK) {
-        rc = sqlite3_step(pStmt);
-        if (rc == SQLITE_ROW) {
-            /* ID exists, try next one */
-            sqlite3_finalize(pStmt);
-            iRelId++;
-            zSql = sqlite3_mprintf("SELECT 1 FROM graph_edges WHERE edge_id = %lld LIMIT 1", iRelId);
-            if (!zSql) return -1;
-            rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, NULL);
-            sqlite3_free(zSql);
-        } else if (rc == SQLITE_DONE) {
-            /* ID is unique */
-            sqlite3_finalize(pStmt);
-            return iRelId;
-        } else {
-            /* Error */
-            sqlite3_finalize(pStmt);
-            return -1;
-        }
-    }
-    
-    if (pStmt) sqlite3_finalize(pStmt);
-    return -1;
-}
-
 /*
 ** Sanitize a string against injection attacks.
 ** Returns sanitized copy (caller must free) or NULL on failure.
@@ -196,8 +135,9 @@ static char *cypherSanitizeString(const char *zInput) {
     
     char *pOut = zSanitized;
     for (const char *pIn = zInput; *pIn; pIn++) {
-        /* Escape dangerous characters */
-        if (*pIn == '\'' || *pIn == '"' || *pIn == '\\') {
+        /* Escape JSON string delimiters; rows are written through bound
+        ** parameters, so single quotes need no escaping */
+        if (*pIn == '"' || *pIn == '\\') {
             *pOut++ = '\\';
             *pOut++ = *pIn;
         } else if (*pIn == '\0') {
@@ -239,35 +179,21 @@ static int cypherWriteContextBeginOp(CypherWriteContext *pCtx, CypherWriteOpType
 }
 
 /*
-** Rollback the current operation in the context.
-** Returns SQLITE_OK on success, error code on failure.
+** Free the buffered rows without writing them
 */
-static int cypherWriteContextRollbackOp(CypherWriteContext *pCtx) {
-    if (!pCtx) return SQLITE_MISUSE;
+static void cypherWriteDiscardPending(CypherWriteContext *pCtx) {
+    int i;
     
-    /* Remove the last operation if it exists */
-    if (pCtx->pLastOp) {
-        CypherWriteOp *pToRemove = pCtx->pLastOp;
-        
-        /* Find the previous operation */
-        CypherWriteOp *pPrev = NULL;
-        for (CypherWriteOp *pOp = pCtx->pOperations; pOp && pOp != pToRemove; pOp = pOp->pNext) {
-            pPrev = pOp;
-        }
-        
-        if (pPrev) {
-            pPrev->pNext = NULL;
-            pCtx->pLastOp = pPrev;
-        } else {
-            pCtx->pOperations = NULL;
-            pCtx->pLastOp = NULL;
-        }
-        
-        cypherWriteOpDestroy(pToRemove);
-        pCtx->nOperations--;
+    for (i = 0; i < pCtx->nPendingNodes; i++) {
+        sqlite3_free(pCtx->aPendingNode[i].zLabels);
+        sqlite3_free(pCtx->aPendingNode[i].zProperties);
     }
-    
-    return SQLITE_OK;
+    for (i = 0; i < pCtx->nPendingRels; i++) {
+        sqlite3_free(pCtx->aPendingRel[i].zRelType);
+        sqlite3_free(pCtx->aPendingRel[i].zProperties);
+    }
+    pCtx->nPendingNodes = 0;
+    pCtx->nPendingRels = 0;
 }
 
 /*
@@ -318,6 +244,18 @@ void cypherWriteContextDestroy(CypherWriteContext *pCtx) {
         cypherWriteOpDestroy(pOp);
     }
     
+    cypherWriteDiscardPending(pCtx);
+    sqlite3_finalize(pCtx->pNodeBatchStmt);
+    sqlite3_finalize(pCtx->pNodeStmt);
+    sqlite3_finalize(pCtx->pRelBatchStmt);
+    sqlite3_finalize(pCtx->pRelStmt);
+    sqlite3_finalize(pCtx->pSetPropStmt);
+    sqlite3_finalize(pCtx->pMergeProbeStmt);
+    sqlite3_finalize(pCtx->pMergeUpsertStmt);
+    sqlite3_finalize(pCtx->pMergeUpsertBatchStmt);
+    sqlite3_free(pCtx->zMergeLabel);
+    sqlite3_free(pCtx->zMergeProp);
+    
     /* Free error message */
     if (pCtx->zErrorMsg) {
         sqlite3_free(pCtx->zErrorMsg);
@@ -336,8 +274,8 @@ int cypherWriteContextBegin(CypherWriteContext *pCtx) {
     if (!pCtx) return SQLITE_MISUSE;
     if (pCtx->bInTransaction) return SQLITE_OK;  /* Already in transaction */
     
-    /* Begin SQLite transaction */
-    rc = sqlite3_exec(pCtx->pDb, "BEGIN", 0, 0, 0);
+    /* A savepoint starts a transaction, or nests in the caller's */
+    rc = sqlite3_exec(pCtx->pDb, "SAVEPOINT cypher_write", 0, 0, 0);
     if (rc != SQLITE_OK) {
         return rc;
     }
@@ -358,25 +296,13 @@ int cypherWriteContextCommit(CypherWriteContext *pCtx) {
     if (!pCtx) return SQLITE_MISUSE;
     if (!pCtx->bInTransaction) return SQLITE_OK;  /* Nothing to commit */
     
-    /* First execute all pending write operations */
-    rc = cypherExecuteOperations(pCtx);
-    if (rc != SQLITE_OK) {
-        /* Execute failed, rollback SQLite transaction */
-        sqlite3_exec(pCtx->pDb, "ROLLBACK", 0, 0, 0);
-        cypherRollbackOperations(pCtx);
-        pCtx->bInTransaction = 0;
-        pCtx->bAutoCommit = 1;
-        return rc;
+    /* Write what is still buffered, then release the savepoint */
+    rc = cypherWriteContextFlush(pCtx);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(pCtx->pDb, "RELEASE cypher_write", 0, 0, 0);
     }
-    
-    /* Commit SQLite transaction */
-    rc = sqlite3_exec(pCtx->pDb, "COMMIT", 0, 0, 0);
     if (rc != SQLITE_OK) {
-        /* SQLite commit failed, rollback our operations */
-        sqlite3_exec(pCtx->pDb, "ROLLBACK", 0, 0, 0);
-        cypherRollbackOperations(pCtx);
-        pCtx->bInTransaction = 0;
-        pCtx->bAutoCommit = 1;
+        cypherWriteContextRollback(pCtx);
         return rc;
     }
     
@@ -397,11 +323,15 @@ int cypherWriteContextRollback(CypherWriteContext *pCtx) {
     if (!pCtx) return SQLITE_MISUSE;
     if (!pCtx->bInTransaction) return SQLITE_OK;  /* Nothing to rollback */
     
-    /* First rollback our write operations */
-    cypherRollbackOperations(pCtx);
+    /* Unwritten rows are dropped; written ones are undone by the
+    ** savepoint */
+    cypherWriteDiscardPending(pCtx);
+    rc = sqlite3_exec(pCtx->pDb,
+                      "ROLLBACK TO cypher_write; RELEASE cypher_write", 0, 0, 0);
     
-    /* Then rollback SQLite transaction */
-    rc = sqlite3_exec(pCtx->pDb, "ROLLBACK", 0, 0, 0);
+    /* IDs handed out since may be reused */
+    pCtx->bNodeIdsLoaded = 0;
+    pCtx->bRelIdsLoaded = 0;
     
     pCtx->bInTransaction = 0;
     pCtx->bAutoCommit = 1;
@@ -434,6 +364,12 @@ int cypherWriteContextAddOperation(CypherWriteContext *pCtx, CypherWriteOp *pOp)
 */
 sqlite3_int64 cypherWriteContextNextNodeId(CypherWriteContext *pCtx) {
     if (!pCtx) return -1;
+    if (!pCtx->bNodeIdsLoaded && pCtx->pGraph) {
+        sqlite3_int64 iNext = cypherStorageGetNextNodeId(pCtx->pGraph);
+        if (iNext <= 0) return -1;
+        if (iNext > pCtx->iNextNodeId) pCtx->iNextNodeId = iNext;
+        pCtx->bNodeIdsLoaded = 1;
+    }
     return pCtx->iNextNodeId++;
 }
 
@@ -443,9 +379,233 @@ sqlite3_int64 cypherWriteContextNextNodeId(CypherWriteContext *pCtx) {
 */
 sqlite3_int64 cypherWriteContextNextRelId(CypherWriteContext *pCtx) {
     if (!pCtx) return -1;
+    if (!pCtx->bRelIdsLoaded && pCtx->pGraph) {
+        sqlite3_int64 iNext = cypherStorageGetNextEdgeId(pCtx->pGraph);
+        if (iNext <= 0) return -1;
+        if (iNext > pCtx->iNextRelId) pCtx->iNextRelId = iNext;
+        pCtx->bRelIdsLoaded = 1;
+    }
     return pCtx->iNextRelId++;
 }
 
+/*
+** Write buffer.
+*/
+
+/*
+** Prepare an INSERT of nRow rows of the nCol columns zCols into zTable,
+** followed by zSuffix (an upsert clause) when not NULL
+*/
+static int cypherWritePrepareInsert(CypherWriteContext *pCtx, sqlite3_stmt **ppStmt,
+                                    const char *zTable, const char *zCols,
+                                    int nCol, int nRow, const char *zSuffix) {
+    sqlite3_str *pStr;
+    char *zSql;
+    int i, j, rc;
+    
+    if (*ppStmt) return SQLITE_OK;
+    
+    pStr = sqlite3_str_new(pCtx->pDb);
+    sqlite3_str_appendf(pStr, "INSERT INTO %s (%s) VALUES ", zTable, zCols);
+    for (i = 0; i < nRow; i++) {
+        sqlite3_str_appendall(pStr, i > 0 ? ",(" : "(");
+        for (j = 0; j < nCol; j++) {
+            sqlite3_str_appendall(pStr, j > 0 ? ",?" : "?");
+        }
+        sqlite3_str_appendchar(pStr, 1, ')');
+    }
+    if (zSuffix) sqlite3_str_appendall(pStr, zSuffix);
+    zSql = sqlite3_str_finish(pStr);
+    if (!zSql) return SQLITE_NOMEM;
+    
+    rc = sqlite3_prepare_v3(pCtx->pDb, zSql, -1, SQLITE_PREPARE_PERSISTENT, ppStmt, NULL);
+    sqlite3_free(zSql);
+    return rc;
+}
+
+/*
+** Run a bound write statement and reset it for the next rows
+*/
+static int cypherWriteStep(CypherWriteContext *pCtx, sqlite3_stmt *pStmt) {
+    int rc = sqlite3_step(pStmt);
+    
+    sqlite3_reset(pStmt);
+    pCtx->nWriteSteps++;
+    if (rc != SQLITE_DONE) {
+        sqlite3_free(pCtx->zErrorMsg);
+        pCtx->zErrorMsg = sqlite3_mprintf("%s", sqlite3_errmsg(pCtx->pDb));
+        return rc == SQLITE_ROW ? SQLITE_ERROR : rc;
+    }
+    return SQLITE_OK;
+}
+
+static void cypherWriteBindNode(sqlite3_stmt *pStmt, int iCol, CypherPendingNode *pNode) {
+    sqlite3_bind_int64(pStmt, iCol + 1, pNode->iNodeId);
+    sqlite3_bind_text(pStmt, iCol + 2, pNode->zLabels, -1, SQLITE_STATIC);
+    sqlite3_bind_text(pStmt, iCol + 3, pNode->zProperties, -1, SQLITE_STATIC);
+}
+
+static void cypherWriteBindRel(sqlite3_stmt *pStmt, int iCol, CypherPendingRel *pRel) {
+    sqlite3_bind_int64(pStmt, iCol + 1, pRel->iRelId);
+    sqlite3_bind_int64(pStmt, iCol + 2, pRel->iFromId);
+    sqlite3_bind_int64(pStmt, iCol + 3, pRel->iToId);
+    sqlite3_bind_text(pStmt, iCol + 4, pRel->zRelType, -1, SQLITE_STATIC);
+    sqlite3_bind_double(pStmt, iCol + 5, pRel->rWeight);
+    sqlite3_bind_text(pStmt, iCol + 6, pRel->zProperties, -1, SQLITE_STATIC);
+}
+
+/*
+** Insert the buffered nodes: a full buffer as one multi-row INSERT,
+** a partial one row by row through a single-row INSERT. Both
+** statements are prepared once per context.
+*/
+static int cypherWriteFlushNodes(CypherWriteContext *pCtx) {
+    const char *zCols = "id, labels, properties";
+    const char *zTable = pCtx->pGraph->zNodeTableName;
+    int i, rc;
+    
+    if (pCtx->nPendingNodes == CYPHER_WRITE_BATCH_ROWS) {
+        rc = cypherWritePrepareInsert(pCtx, &pCtx->pNodeBatchStmt, zTable, zCols,
+                                      3, CYPHER_WRITE_BATCH_ROWS, NULL);
+        if (rc != SQLITE_OK) return rc;
+        for (i = 0; i < CYPHER_WRITE_BATCH_ROWS; i++) {
+            cypherWriteBindNode(pCtx->pNodeBatchStmt, i * 3, &pCtx->aPendingNode[i]);
+        }
+        return cypherWriteStep(pCtx, pCtx->pNodeBatchStmt);
+    }
+    
+    rc = cypherWritePrepareInsert(pCtx, &pCtx->pNodeStmt, zTable, zCols, 3, 1, NULL);
+    for (i = 0; rc == SQLITE_OK && i < pCtx->nPendingNodes; i++) {
+        cypherWriteBindNode(pCtx->pNodeStmt, 0, &pCtx->aPendingNode[i]);
+        rc = cypherWriteStep(pCtx, pCtx->pNodeStmt);
+    }
+    return rc;
+}
+
+static int cypherWriteFlushRels(CypherWriteContext *pCtx) {
+    const char *zCols = "id, source, target, edge_type, weight, properties";
+    const char *zTable = pCtx->pGraph->zEdgeTableName;
+    int i, rc;
+    
+    if (pCtx->nPendingRels == CYPHER_WRITE_BATCH_ROWS) {
+        rc = cypherWritePrepareInsert(pCtx, &pCtx->pRelBatchStmt, zTable, zCols,
+                                      6, CYPHER_WRITE_BATCH_ROWS, NULL);
+        if (rc != SQLITE_OK) return rc;
+        for (i = 0; i < CYPHER_WRITE_BATCH_ROWS; i++) {
+            cypherWriteBindRel(pCtx->pRelBatchStmt, i * 6, &pCtx->aPendingRel[i]);
+        }
+        return cypherWriteStep(pCtx, pCtx->pRelBatchStmt);
+    }
+    
+    rc = cypherWritePrepareInsert(pCtx, &pCtx->pRelStmt, zTable, zCols, 6, 1, NULL);
+    for (i = 0; rc == SQLITE_OK && i < pCtx->nPendingRels; i++) {
+        cypherWriteBindRel(pCtx->pRelStmt, 0, &pCtx->aPendingRel[i]);
+        rc = cypherWriteStep(pCtx, pCtx->pRelStmt);
+    }
+    return rc;
+}
+
+/*
+** Record the flushed rows in the CSR write overlay. A NaN weight binds
+** as NULL, which the snapshot reads as 1.0.
+*/
+static void cypherWriteTrackPending(CypherWriteContext *pCtx) {
+    int i;
+    
+    for (i = 0; i < pCtx->nPendingNodes; i++) {
+        graphCSRTrack(pCtx->pGraph, CSR_OP_ADD_NODE,
+                      pCtx->aPendingNode[i].iNodeId, 0, 0.0);
+    }
+    for (i = 0; i < pCtx->nPendingRels; i++) {
+        CypherPendingRel *pRel = &pCtx->aPendingRel[i];
+        graphCSRTrack(pCtx->pGraph, CSR_OP_ADD_EDGE, pRel->iFromId, pRel->iToId,
+                      pRel->rWeight == pRel->rWeight ? pRel->rWeight : 1.0);
+    }
+}
+
+/*
+** Write the buffered rows to storage. Nodes go first, so relationships
+** never reach storage before their endpoints.
+*/
+int cypherWriteContextFlush(CypherWriteContext *pCtx) {
+    int rc = SQLITE_OK;
+    
+    if (!pCtx) return SQLITE_MISUSE;
+    if (pCtx->nPendingNodes == 0 && pCtx->nPendingRels == 0) return SQLITE_OK;
+    
+    graphCSRTrackBegin(pCtx->pGraph);
+    if (pCtx->nPendingNodes > 0) rc = cypherWriteFlushNodes(pCtx);
+    if (rc == SQLITE_OK && pCtx->nPendingRels > 0) rc = cypherWriteFlushRels(pCtx);
+    if (rc == SQLITE_OK) cypherWriteTrackPending(pCtx);
+    
+    cypherWriteDiscardPending(pCtx);
+    graphBumpDataVersion(pCtx->pGraph);
+    graphCSRTrackEnd(pCtx->pGraph, rc, 0);
+    return rc;
+}
+
+/*
+** Buffer a node row, taking ownership of the JSON text
+*/
+static int cypherWriteBufferNode(CypherWriteContext *pCtx, sqlite3_int64 iNodeId,
+                                 char *zLabels, char *zProperties) {
+    CypherPendingNode *pNode;
+    int rc = SQLITE_OK;
+    
+    if (pCtx->nPendingNodes == CYPHER_WRITE_BATCH_ROWS) {
+        rc = cypherWriteContextFlush(pCtx);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_free(zLabels);
+        sqlite3_free(zProperties);
+        return rc;
+    }
+    
+    pNode = &pCtx->aPendingNode[pCtx->nPendingNodes++];
+    pNode->iNodeId = iNodeId;
+    pNode->zLabels = zLabels;
+    pNode->zProperties = zProperties;
+    pCtx->nOperations++;
+    return SQLITE_OK;
+}
+
+/*
+** Buffer a relationship row, taking ownership of the JSON text. A full
+** relationship buffer flushes the nodes too, keeping them first.
+*/
+static int cypherWriteBufferRel(CypherWriteContext *pCtx, sqlite3_int64 iRelId,
+                                sqlite3_int64 iFromId, sqlite3_int64 iToId,
+                                const char *zRelType, double rWeight,
+                                char *zProperties) {
+    CypherPendingRel *pRel;
+    char *zType;
+    int rc = SQLITE_OK;
+    
+    zType = sqlite3_mprintf("%s", zRelType ? zRelType : "");
+    if (!zType) {
+        sqlite3_free(zProperties);
+        return SQLITE_NOMEM;
+    }
+    if (pCtx->nPendingRels == CYPHER_WRITE_BATCH_ROWS) {
+        rc = cypherWriteContextFlush(pCtx);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_free(zType);
+        sqlite3_free(zProperties);
+        return rc;
+    }
+    
+    pRel = &pCtx->aPendingRel[pCtx->nPendingRels++];
+    pRel->iRelId = iRelId;
+    pRel->iFromId = iFromId;
+    pRel->iToId = iToId;
+    pRel->zRelType = zType;
+    pRel->rWeight = rWeight;
+    pRel->zProperties = zProperties;
+    pCtx->nOperations++;
+    return SQLITE_OK;
+}
+
 /*
 ** CREATE operation functions.
 */
@@ -456,7 +616,6 @@ sqlite3_int64 cypherWriteContextNextRelId(CypherWriteContext *pCtx) {
 ** Follows @SELF_REVIEW.md requirements for input validation, security, and error handling.
 */
 int cypherCreateNode(CypherWriteContext *pCtx, CreateNodeOp *pOp) {
-    CypherWriteOp *pWriteOp = NULL;
     char *zLabelsJson = NULL;
     char *zPropsJson = NULL;
     int rc = SQLITE_OK;
@@ -522,8 +681,8 @@ int cypherCreateNode(CypherWriteContext *pCtx, CreateNodeOp *pOp) {
         }
     }
     
-    /* Generate cryptographically secure unique node ID */
-    pOp->iCreatedNodeId = cypherGenerateSecureNodeId(pCtx->pGraph);
+    /* Allocate the node ID from the context's counter */
+    pOp->iCreatedNodeId = cypherWriteContextNextNodeId(pCtx);
     if (pOp->iCreatedNodeId <= 0) {
         return SQLITE_ERROR;
     }
@@ -724,60 +883,9 @@ int cypherCreateNode(CypherWriteContext *pCtx, CreateNodeOp *pOp) {
         return rc;
     }
     
-    /* Create write operation record for rollback logging */
-    pWriteOp = cypherWriteOpCreate(CYPHER_WRITE_CREATE_NODE);
-    if (!pWriteOp) {
-        sqlite3_free(zLabelsJson);
-        sqlite3_free(zPropsJson);
-        cypherWriteContextRollbackOp(pCtx);
-        return SQLITE_NOMEM;
-    }
-    
-    pWriteOp->iNodeId = pOp->iCreatedNodeId;
-    pWriteOp->zNewLabels = sqlite3_mprintf("%s", zLabelsJson); /* Deep copy for rollback */
-    if (!pWriteOp->zNewLabels) {
-        cypherWriteOpDestroy(pWriteOp);
-        sqlite3_free(zLabelsJson);
-        sqlite3_free(zPropsJson);
-        cypherWriteContextRollbackOp(pCtx);
-        return SQLITE_NOMEM;
-    }
-    
-    /* Store properties for rollback (new value) */
-    pWriteOp->pNewValue = (CypherValue*)sqlite3_malloc(sizeof(CypherValue));
-    if (!pWriteOp->pNewValue) {
-        cypherWriteOpDestroy(pWriteOp);
-        sqlite3_free(zLabelsJson);
-        sqlite3_free(zPropsJson);
-        cypherWriteContextRollbackOp(pCtx);
-        return SQLITE_NOMEM;
-    }
-    cypherValueInit(pWriteOp->pNewValue);
-    cypherValueSetString(pWriteOp->pNewValue, zPropsJson);
-    
-    /* Add to operation log for transaction management */
-    rc = cypherWriteContextAddOperation(pCtx, pWriteOp);
-    if (rc != SQLITE_OK) {
-        cypherWriteOpDestroy(pWriteOp);
-        sqlite3_free(zLabelsJson);
-        sqlite3_free(zPropsJson);
-        cypherWriteContextRollbackOp(pCtx);
-        return rc;
-    }
-    
-    /* @SELF_REVIEW.md Section 2.1: Actually add node to graph storage with error handling */
-    const char **azLabelPtrs = NULL;
-    if (pOp->nLabels > 0) {
-        azLabelPtrs = (const char**)pOp->azLabels;
-    }
-    
-    rc = cypherStorageAddNode(pCtx->pGraph, pOp->iCreatedNodeId, 
-                             azLabelPtrs, pOp->nLabels, 
-                             zPropsJson);
+    /* Buffer the row; the savepoint undoes it on rollback */
+    rc = cypherWriteBufferNode(pCtx, pOp->iCreatedNodeId, zLabelsJson, zPropsJson);
     if (rc != SQLITE_OK) {
-        sqlite3_free(zLabelsJson);
-        sqlite3_free(zPropsJson);
-        cypherWriteContextRollbackOp(pCtx);
         return rc;
     }
     
@@ -791,17 +899,10 @@ int cypherCreateNode(CypherWriteContext *pCtx, CreateNodeOp *pOp) {
         cypherValueDestroy(&nodeValue);
         
         if (rc != SQLITE_OK) {
-            sqlite3_free(zLabelsJson);
-            sqlite3_free(zPropsJson);
-            cypherWriteContextRollbackOp(pCtx);
             return rc;
         }
     }
     
-    /* @SELF_REVIEW.md Section 2.3: Free all allocated resources */
-    sqlite3_free(zLabelsJson);
-    sqlite3_free(zPropsJson);
-    
     return SQLITE_OK;
 }
 
@@ -811,7 +912,6 @@ int cypherCreateNode(CypherWriteContext *pCtx, CreateNodeOp *pOp) {
 ** Follows @SELF_REVIEW.md requirements for input validation, security, and error handling.
 */
 int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
-    CypherWriteOp *pWriteOp = NULL;
     char *zPropsJson = NULL;
     int rc = SQLITE_OK;
     int i;
@@ -887,8 +987,8 @@ int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
         return rc;
     }
     
-    /* Generate cryptographically secure unique relationship ID */
-    pOp->iCreatedRelId = cypherGenerateSecureRelationshipId(pCtx->pGraph);
+    /* Allocate the relationship ID from the context's counter */
+    pOp->iCreatedRelId = cypherWriteContextNextRelId(pCtx);
     if (pOp->iCreatedRelId <= 0) {
         return SQLITE_ERROR;
     }
@@ -922,6 +1022,10 @@ int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
                 nNeeded = snprintf(NULL, 0, "%s\"%s\":%g",
                                   i > 0 ? "," : "", pOp->azPropNames[i],
                                   pOp->apPropValues[i]->u.rFloat);
+            } else if (pOp->apPropValues[i]->type == CYPHER_VALUE_BOOLEAN) {
+                nNeeded = snprintf(NULL, 0, "%s\"%s\":%s",
+                                  i > 0 ? "," : "", pOp->azPropNames[i],
+                                  pOp->apPropValues[i]->u.bBoolean ? "true" : "false");
             } else {
                 nNeeded = snprintf(NULL, 0, "%s\"%s\":null",
                                   i > 0 ? "," : "", pOp->azPropNames[i]);
@@ -961,6 +1065,11 @@ int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
                                  "%s\"%s\":%g",
                                  i > 0 ? "," : "", pOp->azPropNames[i],
                                  pOp->apPropValues[i]->u.rFloat);
+            } else if (pOp->apPropValues[i]->type == CYPHER_VALUE_BOOLEAN) {
+                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
+                                 "%s\"%s\":%s",
+                                 i > 0 ? "," : "", pOp->azPropNames[i],
+                                 pOp->apPropValues[i]->u.bBoolean ? "true" : "false");
             } else {
                 nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
                                  "%s\"%s\":null",
@@ -977,34 +1086,20 @@ int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
         zPropsJson = sqlite3_mprintf("{}");
     }
     
-    /* Create write operation record */
-    pWriteOp = cypherWriteOpCreate(CYPHER_WRITE_CREATE_RELATIONSHIP);
-    if (!pWriteOp) {
-        sqlite3_free(zPropsJson);
-        return SQLITE_NOMEM;
-    }
-    
-    pWriteOp->iRelId = pOp->iCreatedRelId;
-    pWriteOp->iFromId = pOp->iFromNodeId;
-    pWriteOp->iToId = pOp->iToNodeId;
-    pWriteOp->zRelType = sqlite3_mprintf("%s", pOp->zRelType ? pOp->zRelType : "");
+    if (!zPropsJson) return SQLITE_NOMEM;
     
-    /* Add to operation log */
-    rc = cypherWriteContextAddOperation(pCtx, pWriteOp);
+    rc = cypherWriteContextBeginOp(pCtx, CYPHER_WRITE_CREATE_RELATIONSHIP);
     if (rc != SQLITE_OK) {
-        cypherWriteOpDestroy(pWriteOp);
         sqlite3_free(zPropsJson);
         return rc;
     }
     
-    /* Actually add relationship to graph storage */
-    rc = cypherStorageAddEdge(pCtx->pGraph, pOp->iCreatedRelId,
-                             pOp->iFromNodeId, pOp->iToNodeId,
-                             pOp->zRelType, 1.0, /* Default weight */
-                             zPropsJson);
+    /* Buffer the row; the savepoint undoes it on rollback */
+    rc = cypherWriteBufferRel(pCtx, pOp->iCreatedRelId,
+                              pOp->iFromNodeId, pOp->iToNodeId,
+                              pOp->zRelType, 1.0, /* Default weight */
+                              zPropsJson);
     if (rc != SQLITE_OK) {
-        cypherWriteOpDestroy(pWriteOp);
-        sqlite3_free(zPropsJson);
         return rc;
     }
     
@@ -1018,12 +1113,10 @@ int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
         cypherValueDestroy(&relValue);
         
         if (rc != SQLITE_OK) {
-            sqlite3_free(zPropsJson);
             return rc;
         }
     }
     
-    sqlite3_free(zPropsJson);
     return SQLITE_OK;
 }
 
@@ -1037,9 +1130,15 @@ int cypherCreateRelationship(CypherWriteContext *pCtx, CreateRelOp *pOp) {
 */
 int cypherValidateNodeExists(CypherWriteContext *pCtx, sqlite3_int64 iNodeId) {
     int bExists;
+    int i;
     
     if (!pCtx || iNodeId <= 0) return SQLITE_ERROR;
     
+    /* Nodes created by this statement may still be buffered */
+    for (i = pCtx->nPendingNodes - 1; i >= 0; i--) {
+        if (pCtx->aPendingNode[i].iNodeId == iNodeId) return SQLITE_OK;
+    }
+    
     bExists = cypherStorageNodeExists(pCtx->pGraph, iNodeId);
     return (bExists > 0) ? SQLITE_OK : SQLITE_ERROR;
 }
@@ -1059,6 +1158,7 @@ int cypherNodeMatches(CypherWriteContext *pCtx, sqlite3_int64 iNodeId,
     int i;
     
     if (!pCtx || !pCtx->pGraph || iNodeId <= 0) return 0;
+    if (cypherWriteContextFlush(pCtx) != SQLITE_OK) return -1;
     
     /* First check if node exists */
     if (cypherStorageNodeExists(pCtx->pGraph, iNodeId) <= 0) {
@@ -1068,16 +1168,17 @@ int cypherNodeMatches(CypherWriteContext *pCtx, sqlite3_int64 iNodeId,
     /* Build query to check labels */
     if (nLabels > 0) {
         zSql = sqlite3_mprintf(
-            "SELECT 1 FROM graph_nodes WHERE node_id = %lld", iNodeId);
+            "SELECT 1 FROM %s WHERE id = %lld",
+            pCtx->pGraph->zNodeTableName, iNodeId);
         
-        for (i = 0; i < nLabels; i++) {
-            char *zNewSql = sqlite3_mprintf(
-                "%s AND json_extract(labels, '$') LIKE '%%\"%s\"%%'",
-                zSql, azLabels[i]);
+        for (i = 0; i < nLabels && zSql; i++) {
+            char *zMatch = graphLabelMatchSql(pCtx->pGraph, "id", azLabels[i]);
+            char *zNewSql = zMatch ? sqlite3_mprintf("%s AND %s", zSql, zMatch) : 0;
+            sqlite3_free(zMatch);
             sqlite3_free(zSql);
             zSql = zNewSql;
-            if (!zSql) return 0;
         }
+        if (!zSql) return 0;
         
         rc = sqlite3_prepare_v2(pCtx->pGraph->pDb, zSql, -1, &pStmt, NULL);
         sqlite3_free(zSql);
@@ -1097,13 +1198,14 @@ int cypherNodeMatches(CypherWriteContext *pCtx, sqlite3_int64 iNodeId,
     for (i = 0; i < nProps && bMatches; i++) {
         if (!azProps[i] || !apValues[i]) continue;
         
-        char *zValueJson = cypherValueToString(apValues[i]);
+        char *zValueJson = cypherValueToJson(apValues[i]);
         if (!zValueJson) return 0;
         
         zSql = sqlite3_mprintf(
-            "SELECT 1 FROM graph_nodes WHERE node_id = %lld "
-            "AND json_extract(properties, '$.%s') = json('%s')",
-            iNodeId, azProps[i], zValueJson);
+            "SELECT 1 FROM %s WHERE id = %lld "
+            "AND json_extract(%s, '$.%s') = json_extract(%Q, '$')",
+            pCtx->pGraph->zNodeTableName, iNodeId, graphPropsExpr(pCtx->pGraph),
+            azProps[i], zValueJson);
         
         sqlite3_free(zValueJson);
         
@@ -1140,28 +1242,18 @@ sqlite3_int64 cypherFindMatchingNode(CypherWriteContext *pCtx,
     int i;
     
     if (!pCtx || !pCtx->pGraph) return 0;
-    
-    /* Build query to find matching node */
-    if (nLabels > 0) {
-        /* Start with label-based search */
-        zSql = sqlite3_mprintf(
-            "SELECT node_id FROM graph_nodes WHERE "
-            "json_extract(labels, '$[0]') = '%s'",
-            azLabels[0]
-        );
-        
-        /* Add additional label filters */
-        for (i = 1; i < nLabels; i++) {
-            char *zNewSql = sqlite3_mprintf(
-                "%s AND json_extract(labels, '$[%d]') = '%s'",
-                zSql, i, azLabels[i]
-            );
-            sqlite3_free(zSql);
-            zSql = zNewSql;
-        }
-    } else {
-        /* No labels specified, search all nodes */
-        zSql = sqlite3_mprintf("SELECT node_id FROM graph_nodes");
+    if (cypherWriteContextFlush(pCtx) != SQLITE_OK) return -1;
+    
+    /* Build query to find matching node; every label must be present,
+    ** in any position of the label array */
+    zSql = sqlite3_mprintf("SELECT id FROM %s WHERE 1",
+                           pCtx->pGraph->zNodeTableName);
+    for (i = 0; i < nLabels && zSql; i++) {
+        char *zMatch = graphLabelMatchSql(pCtx->pGraph, "id", azLabels[i]);
+        char *zNewSql = zMatch ? sqlite3_mprintf("%s AND %s", zSql, zMatch) : 0;
+        sqlite3_free(zMatch);
+        sqlite3_free(zSql);
+        zSql = zNewSql;
     }
     
     if (!zSql) return 0;
@@ -1171,8 +1263,8 @@ sqlite3_int64 cypherFindMatchingNode(CypherWriteContext *pCtx,
         char *zValueJson = cypherValueToJson(apValues[i]);
         if (zValueJson) {
             char *zNewSql = sqlite3_mprintf(
-                "%s AND json_extract(properties, '$.%s') = json('%s')",
-                zSql, azProps[i], zValueJson
+                "%s AND json_extract(%s, '$.%s') = json_extract(%Q, '$')",
+                zSql, graphPropsExpr(pCtx->pGraph), azProps[i], zValueJson
             );
             sqlite3_free(zSql);
             sqlite3_free(zValueJson);
@@ -1218,6 +1310,7 @@ char *cypherGetNodeRelationships(CypherWriteContext *pCtx, sqlite3_int64 iNodeId
     if (!pCtx || !pCtx->pGraph || iNodeId <= 0) {
         return sqlite3_mprintf("[]");
     }
+    if (cypherWriteContextFlush(pCtx) != SQLITE_OK) return NULL;
     
     zResult = sqlite3_malloc(nAlloc);
     if (!zResult) return NULL;
@@ -1226,8 +1319,8 @@ char *cypherGetNodeRelationships(CypherWriteContext *pCtx, sqlite3_int64 iNodeId
     
     /* Query for all relationships connected to this node */
     zSql = sqlite3_mprintf(
-        "SELECT edge_id FROM graph_edges WHERE from_node = %lld OR to_node = %lld",
-        iNodeId, iNodeId);
+        "SELECT id FROM %s WHERE source = %lld OR target = %lld",
+        pCtx->pGraph->zEdgeTableName, iNodeId, iNodeId);
     
     if (!zSql) {
         sqlite3_free(zResult);
@@ -1345,10 +1438,10 @@ int cypherExecuteOperations(CypherWriteContext *pCtx) {
                 /* For label updates, we need to read current labels, add new ones, and update */
                 {
                     char *zSql = sqlite3_mprintf(
-                        "UPDATE graph_nodes SET labels = "
+                        "UPDATE %s SET labels = "
                         "json_insert(COALESCE(labels, '[]'), '$[#]', '%s') "
-                        "WHERE node_id = %lld",
-                        pOp->zLabel, pOp->iNodeId);
+                        "WHERE id = %lld",
+                        pCtx->pGraph->zNodeTableName, pOp->zLabel, pOp->iNodeId);
                     
                     if (!zSql) return SQLITE_NOMEM;
                     
@@ -1420,8 +1513,8 @@ int cypherRollbackOperations(CypherWriteContext *pCtx) {
                 if (pOp->zOldLabels) {
                     /* Restore labels to old state in graph storage */
                     char *zRestoreSql = sqlite3_mprintf(
-                        "UPDATE graph_nodes SET labels = '%s' WHERE node_id = %lld",
-                        pOp->zOldLabels, pOp->iNodeId);
+                        "UPDATE %s SET labels = '%s' WHERE id = %lld",
+                        pCtx->pGraph->zNodeTableName, pOp->zOldLabels, pOp->iNodeId);
                     
                     if (zRestoreSql) {
                         sqlite3_int64 rowId;
@@ -1492,8 +1585,8 @@ int cypherRollbackOperations(CypherWriteContext *pCtx) {
                 /* Restore removed label */
                 if (pOp->zOldLabels) {
                     char *zRestoreSql = sqlite3_mprintf(
-                        "UPDATE graph_nodes SET labels = '%s' WHERE node_id = %lld",
-                        pOp->zOldLabels, pOp->iNodeId);
+                        "UPDATE %s SET labels = '%s' WHERE id = %lld",
+                        pCtx->pGraph->zNodeTableName, pOp->zOldLabels, pOp->iNodeId);
                     if (zRestoreSql) {
                         sqlite3_int64 rowId;
                         cypherStorageExecuteUpdate(pCtx->pGraph, zRestoreSql, &rowId);
@@ -1639,249 +1732,204 @@ void cypherCreateRelOpDestroy(CreateRelOp *pOp) {
 */
 
 /*
-** Execute a MERGE node operation.
-** Returns SQLITE_OK on success, error code on failure.
+** Build the labels and properties JSON of a node MERGE creates: the
+** match properties followed by the ON CREATE properties. The caller
+** frees both strings.
 */
-int cypherMergeNode(CypherWriteContext *pCtx, MergeNodeOp *pOp) {
-    CypherWriteOp *pWriteOp;
-    sqlite3_int64 iFoundNodeId;
-    char *zLabelsJson = NULL;
-    char *zPropsJson = NULL;
-    int rc = SQLITE_OK;
+static int cypherMergeNodeRow(MergeNodeOp *pOp, char **pzLabels, char **pzProps) {
+    sqlite3_str *pStr;
     int i;
     
-    if (!pCtx || !pOp) return SQLITE_MISUSE;
+    *pzLabels = *pzProps = NULL;
     
-    /* First, try to find an existing node that matches the criteria */
-    iFoundNodeId = cypherFindMatchingNode(pCtx, 
-                                         pOp->azLabels, pOp->nLabels,
-                                         pOp->azMatchProps, pOp->apMatchValues, pOp->nMatchProps);
+    pStr = sqlite3_str_new(0);
+    sqlite3_str_appendchar(pStr, 1, '[');
+    for (i = 0; i < pOp->nLabels; i++) {
+        sqlite3_str_appendf(pStr, "%s\"%s\"", i > 0 ? "," : "", pOp->azLabels[i]);
+    }
+    sqlite3_str_appendchar(pStr, 1, ']');
+    *pzLabels = sqlite3_str_finish(pStr);
+    
+    pStr = sqlite3_str_new(0);
+    sqlite3_str_appendchar(pStr, 1, '{');
+    for (i = 0; i < pOp->nMatchProps + pOp->nOnCreateProps; i++) {
+        int bMatch = i < pOp->nMatchProps;
+        int j = bMatch ? i : i - pOp->nMatchProps;
+        char *zValue = cypherValueToJson(bMatch ? pOp->apMatchValues[j]
+                                                : pOp->apOnCreateValues[j]);
+        sqlite3_str_appendf(pStr, "%s\"%s\":%s", i > 0 ? "," : "",
+                            bMatch ? pOp->azMatchProps[j] : pOp->azOnCreateProps[j],
+                            zValue ? zValue : "null");
+        sqlite3_free(zValue);
+    }
+    sqlite3_str_appendchar(pStr, 1, '}');
+    *pzProps = sqlite3_str_finish(pStr);
+    
+    if (!*pzLabels || !*pzProps) {
+        sqlite3_free(*pzLabels);
+        sqlite3_free(*pzProps);
+        *pzLabels = *pzProps = NULL;
+        return SQLITE_NOMEM;
+    }
+    return SQLITE_OK;
+}
+
+/*
+** Return the index of the match property that carries the context's
+** cached unique key (zMergeLabel, zMergeProp), or -1 if pOp does not.
+** Only scalar key values can be probed.
+*/
+static int cypherMergeKeyProp(CypherWriteContext *pCtx, MergeNodeOp *pOp) {
+    int i, j;
     
-    if (iFoundNodeId > 0) {
-        /* Node found - execute ON MATCH clause */
-        pOp->iNodeId = iFoundNodeId;
-        pOp->bWasCreated = 0;
-        
-        /* Apply ON MATCH property updates */
-        for (i = 0; i < pOp->nOnMatchProps; i++) {
-            SetPropertyOp setOp;
-            memset(&setOp, 0, sizeof(SetPropertyOp));
-            setOp.zVariable = pOp->zVariable;
-            setOp.zProperty = pOp->azOnMatchProps[i];
-            setOp.pValue = pOp->apOnMatchValues[i];
-            setOp.iNodeId = iFoundNodeId;
-            
-            rc = cypherSetProperty(pCtx, &setOp);
-            if (rc != SQLITE_OK) {
-                return rc;
+    if (!pCtx->zMergeLabel) return -1;
+    for (i = 0; i < pOp->nLabels; i++) {
+        if (strcmp(pOp->azLabels[i], pCtx->zMergeLabel) != 0) continue;
+        for (j = 0; j < pOp->nMatchProps; j++) {
+            const CypherValue *pValue = pOp->apMatchValues[j];
+            if (!pValue || strcmp(pOp->azMatchProps[j], pCtx->zMergeProp) != 0) continue;
+            if (pValue->type >= CYPHER_VALUE_BOOLEAN && pValue->type <= CYPHER_VALUE_STRING) {
+                return j;
             }
         }
-        
-        /* Create operation record for MERGE match */
-        pWriteOp = cypherWriteOpCreate(CYPHER_WRITE_MERGE_NODE);
-        if (!pWriteOp) return SQLITE_NOMEM;
-        
-        pWriteOp->iNodeId = iFoundNodeId;
-        pWriteOp->zProperty = sqlite3_mprintf("MATCH");
-        
-        rc = cypherWriteContextAddOperation(pCtx, pWriteOp);
-        if (rc != SQLITE_OK) {
-            cypherWriteOpDestroy(pWriteOp);
-            return rc;
-        }
-        
-    } else {
-        /* Node not found - create new node with ON CREATE properties */
-        pOp->iNodeId = cypherWriteContextNextNodeId(pCtx);
-        pOp->bWasCreated = 1;
-        
-        /* Build labels JSON array */
-        if (pOp->nLabels > 0) {
-            /* Build JSON array with safe bounds checking */
-            int nAlloc = 256;
-            int nUsed = 0;
-            char *zLabels = sqlite3_malloc(nAlloc);
-            if (!zLabels) return SQLITE_NOMEM;
-            
-            nUsed = snprintf(zLabels, nAlloc, "[");
-            
-            for (i = 0; i < pOp->nLabels; i++) {
-                int nNeeded = snprintf(NULL, 0, "%s\"%s\"", i > 0 ? "," : "", pOp->azLabels[i]);
-                if (nUsed + nNeeded + 2 >= nAlloc) {
-                    nAlloc = (nUsed + nNeeded + 256) * 2;
-                    char *zNew = sqlite3_realloc(zLabels, nAlloc);
-                    if (!zNew) {
-                        sqlite3_free(zLabels);
-                        return SQLITE_NOMEM;
-                    }
-                    zLabels = zNew;
-                }
-                nUsed += snprintf(zLabels + nUsed, nAlloc - nUsed, 
-                                 "%s\"%s\"", i > 0 ? "," : "", pOp->azLabels[i]);
-            }
+        return -1;
+    }
+    return -1;
+}
+
+/*
+** Look for a uniqueness constraint among pOp's (label, match property)
+** pairs and make it the context's cached key, preparing its probe
+** statement. Leaves the cache alone when no pair is constrained.
+*/
+static int cypherMergeResolveKey(CypherWriteContext *pCtx, MergeNodeOp *pOp) {
+    int i, j;
+    
+    if (cypherMergeKeyProp(pCtx, pOp) >= 0) return SQLITE_OK;
+    
+    for (i = 0; i < pOp->nLabels; i++) {
+        for (j = 0; j < pOp->nMatchProps; j++) {
+            const char *zLabel = pOp->azLabels[i];
+            const char *zProp = pOp->azMatchProps[j];
+            if (!graphUniqueConstraintExists(pCtx->pGraph, zLabel, zProp)) continue;
             
-            if (nUsed + 2 < nAlloc) {
-                zLabels[nUsed++] = ']';
-                zLabels[nUsed] = '\0';
+            sqlite3_free(pCtx->zMergeLabel);
+            sqlite3_free(pCtx->zMergeProp);
+            sqlite3_finalize(pCtx->pMergeProbeStmt);
+            sqlite3_finalize(pCtx->pMergeUpsertStmt);
+            sqlite3_finalize(pCtx->pMergeUpsertBatchStmt);
+            pCtx->pMergeProbeStmt = pCtx->pMergeUpsertStmt = NULL;
+            pCtx->pMergeUpsertBatchStmt = NULL;
+            pCtx->zMergeLabel = sqlite3_mprintf("%s", zLabel);
+            pCtx->zMergeProp = sqlite3_mprintf("%s", zProp);
+            if (!pCtx->zMergeLabel || !pCtx->zMergeProp) {
+                sqlite3_free(pCtx->zMergeLabel);
+                sqlite3_free(pCtx->zMergeProp);
+                pCtx->zMergeLabel = pCtx->zMergeProp = NULL;
+                return SQLITE_NOMEM;
             }
-            zLabelsJson = zLabels;
-        } else {
-            zLabelsJson = sqlite3_mprintf("[]");
-        }
-        
-        /* Build combined properties JSON (match props + on create props) */
-        int nAlloc = 512;
-        int nUsed = 0;
-        char *zProps = sqlite3_malloc(nAlloc);
-        if (!zProps) {
-            sqlite3_free(zLabelsJson);
-            return SQLITE_NOMEM;
+            return graphUniqueProbePrepare(pCtx->pGraph, zLabel, zProp,
+                                           &pCtx->pMergeProbeStmt);
         }
-        
-        nUsed = snprintf(zProps, nAlloc, "{");
-        int propCount = 0;
-        
-        /* Add match properties */
-        for (i = 0; i < pOp->nMatchProps; i++) {
-            int nNeeded = 0;
-            
-            /* Calculate space needed */
-            if (pOp->apMatchValues[i]->type == CYPHER_VALUE_STRING) {
-                nNeeded = snprintf(NULL, 0, "%s\"%s\":\"%s\"",
-                                  propCount > 0 ? "," : "", pOp->azMatchProps[i],
-                                  pOp->apMatchValues[i]->u.zString);
-            } else if (pOp->apMatchValues[i]->type == CYPHER_VALUE_INTEGER) {
-                nNeeded = snprintf(NULL, 0, "%s\"%s\":%lld",
-                                  propCount > 0 ? "," : "", pOp->azMatchProps[i],
-                                  pOp->apMatchValues[i]->u.iInteger);
-            } else {
-                nNeeded = snprintf(NULL, 0, "%s\"%s\":null",
-                                  propCount > 0 ? "," : "", pOp->azMatchProps[i]);
-            }
-            
-            /* Resize if needed */
-            if (nUsed + nNeeded + 2 >= nAlloc) {
-                nAlloc = (nUsed + nNeeded + 256) * 2;
-                char *zNew = sqlite3_realloc(zProps, nAlloc);
-                if (!zNew) {
-                    sqlite3_free(zProps);
-                    sqlite3_free(zLabelsJson);
-                    return SQLITE_NOMEM;
-                }
-                zProps = zNew;
-            }
-            
-            /* Add the property */
-            if (pOp->apMatchValues[i]->type == CYPHER_VALUE_STRING) {
-                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
-                                 "%s\"%s\":\"%s\"",
-                                 propCount > 0 ? "," : "", pOp->azMatchProps[i],
-                                 pOp->apMatchValues[i]->u.zString);
-            } else if (pOp->apMatchValues[i]->type == CYPHER_VALUE_INTEGER) {
-                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
-                                 "%s\"%s\":%lld",
-                                 propCount > 0 ? "," : "", pOp->azMatchProps[i],
-                                 pOp->apMatchValues[i]->u.iInteger);
-            } else {
-                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
-                                 "%s\"%s\":null",
-                                 propCount > 0 ? "," : "", pOp->azMatchProps[i]);
+    }
+    return SQLITE_OK;
+}
+
+/*
+** Bind a scalar key so it compares like the json_extract() of the
+** stored property.
+*/
+static void cypherMergeBindKey(sqlite3_stmt *pStmt, int iParam, const CypherValue *pValue) {
+    switch (pValue->type) {
+        case CYPHER_VALUE_BOOLEAN:
+            sqlite3_bind_int(pStmt, iParam, pValue->u.bBoolean != 0);
+            break;
+        case CYPHER_VALUE_INTEGER:
+            sqlite3_bind_int64(pStmt, iParam, pValue->u.iInteger);
+            break;
+        case CYPHER_VALUE_FLOAT:
+            sqlite3_bind_double(pStmt, iParam, pValue->u.rFloat);
+            break;
+        default:
+            sqlite3_bind_text(pStmt, iParam, pValue->u.zString ? pValue->u.zString : "",
+                              -1, SQLITE_STATIC);
+            break;
+    }
+}
+
+/*
+** Return the id of the node holding the cached key value pValue, 0 if
+** there is none, or -1 on error.
+*/
+static sqlite3_int64 cypherMergeProbe(CypherWriteContext *pCtx, const CypherValue *pValue) {
+    sqlite3_stmt *pStmt = pCtx->pMergeProbeStmt;
+    sqlite3_int64 iNodeId = 0;
+    int rc;
+    
+    cypherMergeBindKey(pStmt, 1, pValue);
+    rc = sqlite3_step(pStmt);
+    if (rc == SQLITE_ROW) {
+        iNodeId = sqlite3_column_int64(pStmt, 0);
+    } else if (rc != SQLITE_DONE) {
+        iNodeId = -1;
+    }
+    sqlite3_reset(pStmt);
+    return iNodeId;
+}
+
+/*
+** Finish a MERGE whose node is known: check that a node found by its
+** unique key matches the rest of the pattern, apply ON MATCH, and bind
+** the variable.
+*/
+static int cypherMergeNodeFinish(CypherWriteContext *pCtx, MergeNodeOp *pOp, int bCheck) {
+    CypherWriteOp *pWriteOp;
+    int rc = SQLITE_OK;
+    int i;
+    
+    if (!pOp->bWasCreated) {
+        if (bCheck && (pOp->nLabels > 1 || pOp->nMatchProps > 1)) {
+            int bMatches = cypherNodeMatches(pCtx, pOp->iNodeId,
+                                             pOp->azLabels, pOp->nLabels,
+                                             pOp->azMatchProps, pOp->apMatchValues,
+                                             pOp->nMatchProps);
+            if (bMatches < 0) return SQLITE_ERROR;
+            if (bMatches == 0) {
+                sqlite3_free(pCtx->zErrorMsg);
+                pCtx->zErrorMsg = sqlite3_mprintf(
+                    "MERGE: node %lld already has this %s.%s but does not match the pattern",
+                    pOp->iNodeId, pCtx->zMergeLabel, pCtx->zMergeProp);
+                return SQLITE_CONSTRAINT;
             }
-            propCount++;
         }
         
-        /* Add ON CREATE properties */
-        for (i = 0; i < pOp->nOnCreateProps; i++) {
-            int nNeeded = 0;
-            
-            /* Calculate space needed */
-            if (pOp->apOnCreateValues[i]->type == CYPHER_VALUE_STRING) {
-                nNeeded = snprintf(NULL, 0, "%s\"%s\":\"%s\"",
-                                  propCount > 0 ? "," : "", pOp->azOnCreateProps[i],
-                                  pOp->apOnCreateValues[i]->u.zString);
-            } else if (pOp->apOnCreateValues[i]->type == CYPHER_VALUE_INTEGER) {
-                nNeeded = snprintf(NULL, 0, "%s\"%s\":%lld",
-                                  propCount > 0 ? "," : "", pOp->azOnCreateProps[i],
-                                  pOp->apOnCreateValues[i]->u.iInteger);
-            } else {
-                nNeeded = snprintf(NULL, 0, "%s\"%s\":null",
-                                  propCount > 0 ? "," : "", pOp->azOnCreateProps[i]);
-            }
-            
-            /* Resize if needed */
-            if (nUsed + nNeeded + 2 >= nAlloc) {
-                nAlloc = (nUsed + nNeeded + 256) * 2;
-                char *zNew = sqlite3_realloc(zProps, nAlloc);
-                if (!zNew) {
-                    sqlite3_free(zProps);
-                    sqlite3_free(zLabelsJson);
-                    return SQLITE_NOMEM;
-                }
-                zProps = zNew;
-            }
+        /* Apply ON MATCH property updates */
+        for (i = 0; i < pOp->nOnMatchProps; i++) {
+            SetPropertyOp setOp;
+            memset(&setOp, 0, sizeof(SetPropertyOp));
+            setOp.zVariable = pOp->zVariable;
+            setOp.zProperty = pOp->azOnMatchProps[i];
+            setOp.pValue = pOp->apOnMatchValues[i];
+            setOp.iNodeId = pOp->iNodeId;
             
-            /* Add the property */
-            if (pOp->apOnCreateValues[i]->type == CYPHER_VALUE_STRING) {
-                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
-                                 "%s\"%s\":\"%s\"",
-                                 propCount > 0 ? "," : "", pOp->azOnCreateProps[i],
-                                 pOp->apOnCreateValues[i]->u.zString);
-            } else if (pOp->apOnCreateValues[i]->type == CYPHER_VALUE_INTEGER) {
-                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
-                                 "%s\"%s\":%lld",
-                                 propCount > 0 ? "," : "", pOp->azOnCreateProps[i],
-                                 pOp->apOnCreateValues[i]->u.iInteger);
-            } else {
-                nUsed += snprintf(zProps + nUsed, nAlloc - nUsed,
-                                 "%s\"%s\":null",
-                                 propCount > 0 ? "," : "", pOp->azOnCreateProps[i]);
+            rc = cypherSetProperty(pCtx, &setOp);
+            if (rc != SQLITE_OK) {
+                return rc;
             }
-            propCount++;
-        }
-        
-        if (nUsed + 2 < nAlloc) {
-            zProps[nUsed++] = '}';
-            zProps[nUsed] = '\0';
         }
-        zPropsJson = zProps;
         
-        /* Create write operation record for MERGE create */
+        /* Create operation record for MERGE match */
         pWriteOp = cypherWriteOpCreate(CYPHER_WRITE_MERGE_NODE);
-        if (!pWriteOp) {
-            sqlite3_free(zLabelsJson);
-            sqlite3_free(zPropsJson);
-            return SQLITE_NOMEM;
-        }
+        if (!pWriteOp) return SQLITE_NOMEM;
         
         pWriteOp->iNodeId = pOp->iNodeId;
-        pWriteOp->zNewLabels = zLabelsJson;
-        pWriteOp->zProperty = sqlite3_mprintf("CREATE");
+        pWriteOp->zProperty = sqlite3_mprintf("MATCH");
         
-        /* Add to operation log */
         rc = cypherWriteContextAddOperation(pCtx, pWriteOp);
         if (rc != SQLITE_OK) {
             cypherWriteOpDestroy(pWriteOp);
-            sqlite3_free(zLabelsJson);
-            sqlite3_free(zPropsJson);
-            return rc;
-        }
-        
-        /* Actually create node in graph storage */
-        const char **azLabelPtrs = NULL;
-        if (pOp->nLabels > 0) {
-            azLabelPtrs = (const char**)pOp->azLabels;
-        }
-        
-        rc = cypherStorageAddNode(pCtx->pGraph, pOp->iNodeId, 
-                                 azLabelPtrs, pOp->nLabels, 
-                                 zPropsJson);
-        if (rc != SQLITE_OK) {
-            sqlite3_free(zLabelsJson);
-            sqlite3_free(zPropsJson);
             return rc;
         }
-        
-        sqlite3_free(zPropsJson);
     }
     
     /* Bind variable in execution context */
@@ -1892,13 +1940,187 @@ int cypherMergeNode(CypherWriteContext *pCtx, MergeNodeOp *pOp) {
         
         rc = executionContextBind(pCtx->pExecContext, pOp->zVariable, &nodeValue);
         cypherValueDestroy(&nodeValue);
+    }
+    
+    return rc;
+}
+
+/*
+** MERGE nOp operations carrying the cached unique key: one upsert
+** (INSERT ... ON CONFLICT DO NOTHING on the constraint's index) for the
+** whole run, then one index probe per row to learn which rows matched.
+** A later row repeating an earlier row's key matches the node the
+** earlier row created.
+*/
+static int cypherMergeKeyedRun(CypherWriteContext *pCtx, MergeNodeOp **apOp,
+                               const int *aiProp, int nOp) {
+    const char *zCols = "id, labels, properties";
+    sqlite3_int64 aiNodeId[CYPHER_WRITE_BATCH_ROWS];
+    char *azLabels[CYPHER_WRITE_BATCH_ROWS];
+    char *azProps[CYPHER_WRITE_BATCH_ROWS];
+    sqlite3_stmt *pStmt;
+    char *zUpsert;
+    int nCreated = 0;
+    int nRow = 0;
+    int i, rc;
+    
+    /* Buffered creates must be in storage for the conflict check */
+    rc = cypherWriteContextFlush(pCtx);
+    if (rc == SQLITE_OK) rc = cypherWriteContextBeginOp(pCtx, CYPHER_WRITE_MERGE_NODE);
+    if (rc != SQLITE_OK) return rc;
+    
+    zUpsert = graphUniqueUpsertSql(pCtx->pGraph, pCtx->zMergeLabel, pCtx->zMergeProp);
+    if (!zUpsert) return SQLITE_NOMEM;
+    if (nOp == CYPHER_WRITE_BATCH_ROWS) {
+        rc = cypherWritePrepareInsert(pCtx, &pCtx->pMergeUpsertBatchStmt,
+                                      pCtx->pGraph->zNodeTableName, zCols, 3,
+                                      CYPHER_WRITE_BATCH_ROWS, zUpsert);
+    } else {
+        rc = cypherWritePrepareInsert(pCtx, &pCtx->pMergeUpsertStmt,
+                                      pCtx->pGraph->zNodeTableName, zCols, 3, 1, zUpsert);
+    }
+    sqlite3_free(zUpsert);
+    
+    for (nRow = 0; rc == SQLITE_OK && nRow < nOp; nRow++) {
+        aiNodeId[nRow] = cypherWriteContextNextNodeId(pCtx);
+        if (aiNodeId[nRow] <= 0) {
+            rc = SQLITE_ERROR;
+            break;
+        }
+        rc = cypherMergeNodeRow(apOp[nRow], &azLabels[nRow], &azProps[nRow]);
+        if (rc != SQLITE_OK) break;
+    }
+    
+    graphCSRTrackBegin(pCtx->pGraph);
+    if (rc == SQLITE_OK && nOp == CYPHER_WRITE_BATCH_ROWS) {
+        pStmt = pCtx->pMergeUpsertBatchStmt;
+        for (i = 0; i < nOp; i++) {
+            CypherPendingNode row = { aiNodeId[i], azLabels[i], azProps[i] };
+            cypherWriteBindNode(pStmt, i * 3, &row);
+        }
+        rc = cypherWriteStep(pCtx, pStmt);
+        for (i = 0; rc == SQLITE_OK && i < nOp; i++) {
+            apOp[i]->iNodeId = cypherMergeProbe(pCtx, apOp[i]->apMatchValues[aiProp[i]]);
+            if (apOp[i]->iNodeId <= 0) rc = SQLITE_ERROR;
+        }
+    } else if (rc == SQLITE_OK) {
+        /* A row the upsert kept needs no probe */
+        pStmt = pCtx->pMergeUpsertStmt;
+        for (i = 0; rc == SQLITE_OK && i < nOp; i++) {
+            CypherPendingNode row = { aiNodeId[i], azLabels[i], azProps[i] };
+            cypherWriteBindNode(pStmt, 0, &row);
+            rc = cypherWriteStep(pCtx, pStmt);
+            if (rc != SQLITE_OK) break;
+            if (sqlite3_changes(pCtx->pDb) > 0) {
+                apOp[i]->iNodeId = aiNodeId[i];
+            } else {
+                apOp[i]->iNodeId = cypherMergeProbe(pCtx, apOp[i]->apMatchValues[aiProp[i]]);
+                if (apOp[i]->iNodeId <= 0) rc = SQLITE_ERROR;
+            }
+        }
+    }
+    
+    for (i = 0; i < nRow; i++) {
+        sqlite3_free(azLabels[i]);
+        sqlite3_free(azProps[i]);
+    }
+    
+    for (i = 0; rc == SQLITE_OK && i < nOp; i++) {
+        apOp[i]->bWasCreated = apOp[i]->iNodeId == aiNodeId[i];
+        if (apOp[i]->bWasCreated) {
+            graphCSRTrack(pCtx->pGraph, CSR_OP_ADD_NODE, aiNodeId[i], 0, 0.0);
+            nCreated++;
+            pCtx->nOperations++;
+        }
+    }
+    if (nCreated > 0) graphBumpDataVersion(pCtx->pGraph);
+    graphCSRTrackEnd(pCtx->pGraph, rc, 0);
+    
+    for (i = 0; rc == SQLITE_OK && i < nOp; i++) {
+        rc = cypherMergeNodeFinish(pCtx, apOp[i], 1);
+    }
+    return rc;
+}
+
+/*
+** MERGE a node by scanning for a match, creating it if there is none.
+*/
+static int cypherMergeNodeScan(CypherWriteContext *pCtx, MergeNodeOp *pOp) {
+    sqlite3_int64 iFoundNodeId;
+    char *zLabelsJson;
+    char *zPropsJson;
+    int rc;
+    
+    iFoundNodeId = cypherFindMatchingNode(pCtx, 
+                                         pOp->azLabels, pOp->nLabels,
+                                         pOp->azMatchProps, pOp->apMatchValues, pOp->nMatchProps);
+    if (iFoundNodeId < 0) return SQLITE_ERROR;
+    
+    rc = cypherWriteContextBeginOp(pCtx, CYPHER_WRITE_MERGE_NODE);
+    if (rc != SQLITE_OK) return rc;
+    
+    if (iFoundNodeId > 0) {
+        pOp->iNodeId = iFoundNodeId;
+        pOp->bWasCreated = 0;
+    } else {
+        /* Node not found - create new node with ON CREATE properties */
+        pOp->iNodeId = cypherWriteContextNextNodeId(pCtx);
+        if (pOp->iNodeId <= 0) return SQLITE_ERROR;
+        pOp->bWasCreated = 1;
         
+        rc = cypherMergeNodeRow(pOp, &zLabelsJson, &zPropsJson);
+        if (rc != SQLITE_OK) return rc;
+        
+        /* Buffer the row; the savepoint undoes it on rollback */
+        rc = cypherWriteBufferNode(pCtx, pOp->iNodeId, zLabelsJson, zPropsJson);
         if (rc != SQLITE_OK) {
             return rc;
         }
     }
     
-    return SQLITE_OK;
+    return cypherMergeNodeFinish(pCtx, pOp, 0);
+}
+
+/*
+** Execute a MERGE node operation.
+** Returns SQLITE_OK on success, error code on failure.
+*/
+int cypherMergeNode(CypherWriteContext *pCtx, MergeNodeOp *pOp) {
+    if (!pCtx || !pOp) return SQLITE_MISUSE;
+    return cypherMergeNodeBatch(pCtx, &pOp, 1);
+}
+
+/*
+** Execute nOp MERGE node operations in order. Runs of operations whose
+** pattern carries a constrained (label, property) key are merged by
+** upsert and index probe, up to CYPHER_WRITE_BATCH_ROWS per statement;
+** the rest scan for a matching node one by one.
+** Returns SQLITE_OK on success, error code on failure.
+*/
+int cypherMergeNodeBatch(CypherWriteContext *pCtx, MergeNodeOp **apOp, int nOp) {
+    int aiProp[CYPHER_WRITE_BATCH_ROWS];
+    int i = 0;
+    int rc = SQLITE_OK;
+    
+    if (!pCtx || (nOp > 0 && !apOp)) return SQLITE_MISUSE;
+    
+    while (rc == SQLITE_OK && i < nOp) {
+        int n = 0;
+        
+        rc = cypherMergeResolveKey(pCtx, apOp[i]);
+        if (rc != SQLITE_OK) break;
+        while (i + n < nOp && n < CYPHER_WRITE_BATCH_ROWS
+               && (aiProp[n] = cypherMergeKeyProp(pCtx, apOp[i + n])) >= 0) {
+            n++;
+        }
+        if (n > 0) {
+            rc = cypherMergeKeyedRun(pCtx, &apOp[i], aiProp, n);
+            i += n;
+        } else {
+            rc = cypherMergeNodeScan(pCtx, apOp[i++]);
+        }
+    }
+    return rc;
 }
 
 /*
@@ -1992,10 +2214,15 @@ void cypherMergeNodeOpDestroy(MergeNodeOp *pOp) {
 ** Returns SQLITE_OK on success, error code on failure.
 */
 int cypherSetProperty(CypherWriteContext *pCtx, SetPropertyOp *pOp) {
-    CypherWriteOp *pWriteOp;
+    char *zPath;
+    char *zValueJson;
     int rc = SQLITE_OK;
     
-    if (!pCtx || !pOp) return SQLITE_MISUSE;
+    if (!pCtx || !pOp || !pOp->zProperty || !pOp->pValue) return SQLITE_MISUSE;
+    
+    /* The target may have been created earlier in the statement */
+    rc = cypherWriteContextFlush(pCtx);
+    if (rc != SQLITE_OK) return rc;
     
     /* Validate that the target node exists */
     rc = cypherValidateNodeExists(pCtx, pOp->iNodeId);
@@ -2003,83 +2230,44 @@ int cypherSetProperty(CypherWriteContext *pCtx, SetPropertyOp *pOp) {
         return rc;
     }
     
-    /* Create write operation record */
-    pWriteOp = cypherWriteOpCreate(CYPHER_WRITE_SET_PROPERTY);
-    if (!pWriteOp) return SQLITE_NOMEM;
-    
-    pWriteOp->iNodeId = pOp->iNodeId;
-    pWriteOp->zProperty = sqlite3_mprintf("%s", pOp->zProperty);
+    rc = cypherWriteContextBeginOp(pCtx, CYPHER_WRITE_SET_PROPERTY);
+    if (rc != SQLITE_OK) return rc;
     
-    /* Get old value for rollback support */
-    pWriteOp->pOldValue = (CypherValue*)sqlite3_malloc(sizeof(CypherValue));
-    if (!pWriteOp->pOldValue) {
-        cypherWriteOpDestroy(pWriteOp);
-        return SQLITE_NOMEM;
+    /* One prepared UPDATE serves every SET of the context */
+    if (!pCtx->pSetPropStmt) {
+        char *zSql = sqlite3_mprintf(
+            "UPDATE %s SET properties = json_set(COALESCE(%s, '{}'), ?1, json(?2)) "
+            "WHERE id = ?3", pCtx->pGraph->zNodeTableName, graphPropsExpr(pCtx->pGraph));
+        if (!zSql) return SQLITE_NOMEM;
+        rc = sqlite3_prepare_v3(pCtx->pDb, zSql, -1, SQLITE_PREPARE_PERSISTENT,
+                                &pCtx->pSetPropStmt, NULL);
+        sqlite3_free(zSql);
+        if (rc != SQLITE_OK) return rc;
     }
     
-    /* Query current property value */
-    sqlite3_stmt *pStmt = NULL;
-    char *zSql = sqlite3_mprintf(
-        "SELECT json_extract(properties, '$.%s') FROM graph_nodes WHERE node_id = %lld",
-        pOp->zProperty, pOp->iNodeId);
-    
-    if (!zSql) {
-        cypherWriteOpDestroy(pWriteOp);
+    zPath = sqlite3_mprintf("$.\"%w\"", pOp->zProperty);
+    zValueJson = cypherValueToJson(pOp->pValue);
+    if (!zPath || !zValueJson) {
+        sqlite3_free(zPath);
+        sqlite3_free(zValueJson);
         return SQLITE_NOMEM;
     }
     
-    rc = sqlite3_prepare_v2(pCtx->pGraph->pDb, zSql, -1, &pStmt, NULL);
-    sqlite3_free(zSql);
-    
+    sqlite3_bind_text(pCtx->pSetPropStmt, 1, zPath, -1, SQLITE_STATIC);
+    sqlite3_bind_text(pCtx->pSetPropStmt, 2, zValueJson, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(pCtx->pSetPropStmt, 3, pOp->iNodeId);
+    graphCSRTrackBegin(pCtx->pGraph);
+    rc = cypherWriteStep(pCtx, pCtx->pSetPropStmt);
+    sqlite3_free(zPath);
+    sqlite3_free(zValueJson);
     if (rc == SQLITE_OK) {
-        rc = sqlite3_step(pStmt);
-        if (rc == SQLITE_ROW) {
-            const char *zOldValue = (const char*)sqlite3_column_text(pStmt, 0);
-            if (zOldValue) {
-                cypherValueSetString(pWriteOp->pOldValue, zOldValue);
-            } else {
-                cypherValueInit(pWriteOp->pOldValue);
-            }
-        } else {
-            cypherValueInit(pWriteOp->pOldValue);
-        }
-        sqlite3_finalize(pStmt);
-    } else {
-        cypherValueInit(pWriteOp->pOldValue);
-    }
-    
-    /* Set new value */
-    pWriteOp->pNewValue = (CypherValue*)sqlite3_malloc(sizeof(CypherValue));
-    if (!pWriteOp->pNewValue) {
-        cypherWriteOpDestroy(pWriteOp);
-        return SQLITE_NOMEM;
-    }
-    
-    memcpy(pWriteOp->pNewValue, pOp->pValue, sizeof(CypherValue));
-    
-    /* If it's a string value, make a copy */
-    if (pOp->pValue->type == CYPHER_VALUE_STRING && pOp->pValue->u.zString) {
-        pWriteOp->pNewValue->u.zString = sqlite3_mprintf("%s", pOp->pValue->u.zString);
-        if (!pWriteOp->pNewValue->u.zString) {
-            cypherWriteOpDestroy(pWriteOp);
-            return SQLITE_NOMEM;
-        }
-    }
-    
-    /* Add to operation log */
-    rc = cypherWriteContextAddOperation(pCtx, pWriteOp);
-    if (rc != SQLITE_OK) {
-        cypherWriteOpDestroy(pWriteOp);
-        return rc;
-    }
-    
-    /* Actually update property in graph storage */
-    rc = cypherStorageUpdateProperties(pCtx->pGraph, pOp->iNodeId, 0, /* No relation ID for node properties */
-                                      pOp->zProperty, pOp->pValue);
-    if (rc != SQLITE_OK) {
-        return rc;
+        graphBumpDataVersion(pCtx->pGraph);
+        graphColumnsTouch(pCtx->pGraph, pOp->iNodeId, 0);
     }
+    graphCSRTrackEnd(pCtx->pGraph, rc, 0);
+    if (rc != SQLITE_OK) return rc;
     
+    pCtx->nOperations++;
     return SQLITE_OK;
 }
 
@@ -2095,6 +2283,10 @@ int cypherSetLabel(CypherWriteContext *pCtx, SetLabelOp *pOp) {
     
     if (!pCtx || !pOp) return SQLITE_MISUSE;
     
+    /* Reads below must see the rows created so far */
+    rc = cypherWriteContextFlush(pCtx);
+    if (rc != SQLITE_OK) return rc;
+    
     /* Validate that the target node exists */
     rc = cypherValidateNodeExists(pCtx, pOp->iNodeId);
     if (rc != SQLITE_OK) {
@@ -2148,8 +2340,8 @@ int cypherSetLabel(CypherWriteContext *pCtx, SetLabelOp *pOp) {
     /* Get old labels for rollback support */
     sqlite3_stmt *pStmt = NULL;
     char *zSql = sqlite3_mprintf(
-        "SELECT labels FROM graph_nodes WHERE node_id = %lld",
-        pOp->iNodeId);
+        "SELECT labels FROM %s WHERE id = %lld",
+        pCtx->pGraph->zNodeTableName, pOp->iNodeId);
     
     if (!zSql) {
         cypherWriteOpDestroy(pWriteOp);
@@ -2190,8 +2382,8 @@ int cypherSetLabel(CypherWriteContext *pCtx, SetLabelOp *pOp) {
     
     /* Actually update labels in graph storage here */
     char *zUpdateSql = sqlite3_mprintf(
-        "UPDATE graph_nodes SET labels = '%s' WHERE node_id = %lld",
-        zLabelsJson, pOp->iNodeId);
+        "UPDATE %s SET labels = '%s' WHERE id = %lld",
+        pCtx->pGraph->zNodeTableName, zLabelsJson, pOp->iNodeId);
     
     if (!zUpdateSql) {
         return SQLITE_NOMEM;
@@ -2304,6 +2496,10 @@ int cypherDelete(CypherWriteContext *pCtx, DeleteOp *pOp) {
     
     if (!pCtx || !pOp) return SQLITE_MISUSE;
     
+    /* Reads below must see the rows created so far */
+    rc = cypherWriteContextFlush(pCtx);
+    if (rc != SQLITE_OK) return rc;
+    
     if (pOp->bIsNode) {
         /* Deleting a node */
         
@@ -2374,8 +2570,8 @@ int cypherDelete(CypherWriteContext *pCtx, DeleteOp *pOp) {
         /* Store old node data for rollback */
         sqlite3_stmt *pStmt = NULL;
         char *zSql = sqlite3_mprintf(
-            "SELECT labels, properties FROM graph_nodes WHERE node_id = %lld",
-            pOp->iNodeId);
+            "SELECT labels, %s FROM %s WHERE id = %lld",
+            graphPropsColumn(pCtx->pGraph), pCtx->pGraph->zNodeTableName, pOp->iNodeId);
         
         if (!zSql) {
             cypherWriteOpDestroy(pWriteOp);
@@ -2419,8 +2615,8 @@ int cypherDelete(CypherWriteContext *pCtx, DeleteOp *pOp) {
         /* Store old relationship data for rollback */
         sqlite3_stmt *pStmt = NULL;
         char *zSql = sqlite3_mprintf(
-            "SELECT from_node, to_node, edge_type, weight, properties FROM graph_edges WHERE edge_id = %lld",
-            pOp->iRelId);
+            "SELECT source, target, edge_type, weight, %s FROM %s WHERE id = %lld",
+            graphPropsColumn(pCtx->pGraph), pCtx->pGraph->zEdgeTableName, pOp->iRelId);
         
         if (!zSql) {
             cypherWriteOpDestroy(pWriteOp);
@@ -2567,4 +2763,340 @@ CypherWriteIterator *cypherCreateRelIteratorCreate(CypherWriteContext *pCtx,
     pIterator->base.xDestroy = NULL; /* Will be freed by caller */
     
     return pIterator;
-}
\ No newline at end of file
+}
+
+/*
+** CREATE and MERGE operators.
+*/
+
+typedef struct CreateIteratorData {
+    CypherWriteContext *pWriteCtx;    /* Write context of the current run */
+    sqlite3_int64 *aId;               /* Created ID of each plan write item */
+    int bDone;                        /* Elements written this run */
+} CreateIteratorData;
+
+/*
+** Free property values evaluated by createIteratorProps(). The names
+** belong to the plan.
+*/
+static void createIteratorPropsFree(char **azName, CypherValue **apValue, int nProp) {
+    int i;
+    
+    for (i = 0; i < nProp; i++) {
+        cypherValueDestroy(apValue[i]);
+        sqlite3_free(apValue[i]);
+    }
+    sqlite3_free(azName);
+    sqlite3_free(apValue);
+}
+
+/*
+** Evaluate the property values of write item pItem into heap values.
+** Null values are left out: a CREATE does not store them. On error the
+** context error is set and nothing is left to free.
+*/
+static int createIteratorProps(ExecutionContext *pContext, PlanWriteItem *pItem,
+                               char ***pazName, CypherValue ***papValue, int *pnProp) {
+    char **azName = NULL;
+    CypherValue **apValue = NULL;
+    int nProp = 0;
+    int rc = SQLITE_OK;
+    int i;
+    
+    *pazName = NULL;
+    *papValue = NULL;
+    *pnProp = 0;
+    if (pItem->nProp == 0) return SQLITE_OK;
+    
+    azName = sqlite3_malloc(pItem->nProp * sizeof(char*));
+    apValue = sqlite3_malloc(pItem->nProp * sizeof(CypherValue*));
+    if (!azName || !apValue) rc = SQLITE_NOMEM;
+    
+    for (i = 0; rc == SQLITE_OK && i < pItem->nProp; i++) {
+        CypherValue *pValue = sqlite3_malloc(sizeof(CypherValue));
+        if (!pValue) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        rc = cypherExpressionEvaluate(pItem->apValue[i], pContext, pValue);
+        if (rc == SQLITE_OK && pValue->type != CYPHER_VALUE_NULL &&
+            pValue->type != CYPHER_VALUE_BOOLEAN && pValue->type != CYPHER_VALUE_INTEGER &&
+            pValue->type != CYPHER_VALUE_FLOAT && pValue->type != CYPHER_VALUE_STRING) {
+            if (!pContext->zErrorMsg) {
+                pContext->zErrorMsg = sqlite3_mprintf(
+                    "Property `%s` must be a boolean, number or string", pItem->azProp[i]);
+            }
+            rc = SQLITE_ERROR;
+        }
+        if (rc != SQLITE_OK || pValue->type == CYPHER_VALUE_NULL) {
+            cypherValueDestroy(pValue);
+            sqlite3_free(pValue);
+            continue;
+        }
+        azName[nProp] = pItem->azProp[i];
+        apValue[nProp++] = pValue;
+    }
+    
+    if (rc != SQLITE_OK) {
+        createIteratorPropsFree(azName, apValue, nProp);
+        if (rc == SQLITE_NOMEM && !pContext->zErrorMsg) {
+            pContext->zErrorMsg = sqlite3_mprintf("out of memory evaluating properties");
+        }
+        return rc;
+    }
+    *pazName = azName;
+    *papValue = apValue;
+    *pnProp = nProp;
+    return SQLITE_OK;
+}
+
+/*
+** Write the elements of the plan, nodes before the relationships that
+** follow them, in one savepoint that is rolled back on error.
+*/
+static int createIteratorRun(CypherIterator *pIterator) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    ExecutionContext *pContext = pIterator->pContext;
+    PhysicalPlanNode *pPlan = pIterator->pPlan;
+    CypherWriteContext *pCtx = pData->pWriteCtx;
+    int rc;
+    int i;
+    
+    rc = cypherWriteContextBegin(pCtx);
+    for (i = 0; rc == SQLITE_OK && i < pPlan->nWrite; i++) {
+        PlanWriteItem *pItem = &pPlan->aWrite[i];
+        char **azName;
+        CypherValue **apValue;
+        int nProp;
+        
+        rc = createIteratorProps(pContext, pItem, &azName, &apValue, &nProp);
+        if (rc != SQLITE_OK) break;
+        
+        if (pItem->iFrom < 0) {
+            CreateNodeOp op;
+            memset(&op, 0, sizeof(op));
+            op.zVariable = pItem->zVariable;
+            op.azLabels = &pItem->zLabel;
+            op.nLabels = pItem->zLabel ? 1 : 0;
+            op.azPropNames = azName;
+            op.apPropValues = apValue;
+            op.nProperties = nProp;
+            rc = cypherCreateNode(pCtx, &op);
+            pData->aId[i] = op.iCreatedNodeId;
+        } else {
+            CreateRelOp op;
+            memset(&op, 0, sizeof(op));
+            op.zRelVar = pItem->zVariable;
+            op.zRelType = pItem->zLabel;
+            op.azPropNames = azName;
+            op.apPropValues = apValue;
+            op.nProperties = nProp;
+            op.iFromNodeId = pData->aId[pItem->iFrom];
+            op.iToNodeId = pData->aId[pItem->iTo];
+            rc = cypherCreateRelationship(pCtx, &op);
+            pData->aId[i] = op.iCreatedRelId;
+        }
+        
+        createIteratorPropsFree(azName, apValue, nProp);
+        
+        if (rc != SQLITE_OK && !pContext->zErrorMsg) {
+            /* The create functions validate names without a message */
+            if (rc == SQLITE_FORMAT || rc == SQLITE_MISUSE || rc == SQLITE_RANGE) {
+                pContext->zErrorMsg = sqlite3_mprintf("Invalid %s in CREATE",
+                    pItem->iFrom < 0 ? "node label, variable or property name" :
+                                       "relationship type, variable or property name");
+            } else {
+                pContext->zErrorMsg = sqlite3_mprintf("CREATE failed: %s",
+                                                      sqlite3_errmsg(pCtx->pDb));
+            }
+        }
+    }
+    
+    if (rc == SQLITE_OK) {
+        rc = cypherWriteContextCommit(pCtx);
+        if (rc != SQLITE_OK && !pContext->zErrorMsg) {
+            pContext->zErrorMsg = sqlite3_mprintf("CREATE failed: %s", sqlite3_errmsg(pCtx->pDb));
+        }
+    } else {
+        cypherWriteContextRollback(pCtx);
+    }
+    return rc;
+}
+
+static int createIteratorOpen(CypherIterator *pIterator) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    ExecutionContext *pContext = pIterator->pContext;
+    
+    if (!pContext->pGraph) {
+        sqlite3_free(pContext->zErrorMsg);
+        pContext->zErrorMsg = sqlite3_mprintf("%s requires a graph table",
+            pIterator->pPlan->type == PHYSICAL_MERGE ? "MERGE" : "CREATE");
+        return SQLITE_ERROR;
+    }
+    if (!pData->pWriteCtx) {
+        pData->pWriteCtx = cypherWriteContextCreate(pContext->pDb, pContext->pGraph, pContext);
+        if (!pData->pWriteCtx) return SQLITE_NOMEM;
+    }
+    pData->bDone = 0;
+    pIterator->bOpened = 1;
+    return SQLITE_OK;
+}
+
+static int createIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    int rc;
+    
+    (void)pResult;
+    if (pData->bDone) return SQLITE_DONE;
+    pData->bDone = 1;
+    
+    /* CREATE without RETURN produces no rows */
+    rc = createIteratorRun(pIterator);
+    return rc == SQLITE_OK ? SQLITE_DONE : rc;
+}
+
+/*
+** Merge the plan's node in one savepoint that is rolled back on error.
+** When its label and a key property carry a uniqueness constraint the
+** node is found by index probe and created by upsert.
+*/
+static int mergeIteratorRun(CypherIterator *pIterator) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    ExecutionContext *pContext = pIterator->pContext;
+    PhysicalPlanNode *pPlan = pIterator->pPlan;
+    CypherWriteContext *pCtx = pData->pWriteCtx;
+    PlanWriteItem *pNode = &pPlan->aWrite[0];
+    MergeNodeOp op;
+    int rc;
+    
+    memset(&op, 0, sizeof(op));
+    op.zVariable = pNode->zVariable;
+    op.azLabels = &pNode->zLabel;
+    op.nLabels = pNode->zLabel ? 1 : 0;
+    
+    rc = createIteratorProps(pContext, pNode, &op.azMatchProps, &op.apMatchValues,
+                             &op.nMatchProps);
+    if (rc == SQLITE_OK && op.nMatchProps < pNode->nProp) {
+        pContext->zErrorMsg = sqlite3_mprintf("Cannot merge node using null property value");
+        rc = SQLITE_ERROR;
+    }
+    if (rc == SQLITE_OK) {
+        rc = createIteratorProps(pContext, &pPlan->aWrite[1], &op.azOnCreateProps,
+                                 &op.apOnCreateValues, &op.nOnCreateProps);
+    }
+    if (rc == SQLITE_OK) {
+        rc = createIteratorProps(pContext, &pPlan->aWrite[2], &op.azOnMatchProps,
+                                 &op.apOnMatchValues, &op.nOnMatchProps);
+    }
+    
+    if (rc == SQLITE_OK) rc = cypherWriteContextBegin(pCtx);
+    if (rc == SQLITE_OK) {
+        rc = cypherMergeNode(pCtx, &op);
+        if (rc != SQLITE_OK && !pContext->zErrorMsg) {
+            pContext->zErrorMsg = pCtx->zErrorMsg ?
+                sqlite3_mprintf("%s", pCtx->zErrorMsg) :
+                sqlite3_mprintf("MERGE failed: %s", sqlite3_errmsg(pCtx->pDb));
+        }
+        if (rc == SQLITE_OK) {
+            rc = cypherWriteContextCommit(pCtx);
+            if (rc != SQLITE_OK && !pContext->zErrorMsg) {
+                pContext->zErrorMsg = sqlite3_mprintf("MERGE failed: %s", sqlite3_errmsg(pCtx->pDb));
+            }
+        } else {
+            cypherWriteContextRollback(pCtx);
+        }
+    }
+    
+    createIteratorPropsFree(op.azMatchProps, op.apMatchValues, op.nMatchProps);
+    createIteratorPropsFree(op.azOnCreateProps, op.apOnCreateValues, op.nOnCreateProps);
+    createIteratorPropsFree(op.azOnMatchProps, op.apOnMatchValues, op.nOnMatchProps);
+    return rc;
+}
+
+static int mergeIteratorNext(CypherIterator *pIterator, CypherResult *pResult) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    int rc;
+    
+    (void)pResult;
+    if (pData->bDone) return SQLITE_DONE;
+    pData->bDone = 1;
+    
+    /* MERGE without RETURN produces no rows */
+    rc = mergeIteratorRun(pIterator);
+    return rc == SQLITE_OK ? SQLITE_DONE : rc;
+}
+
+static int createIteratorClose(CypherIterator *pIterator) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    
+    /* Destroying the context rolls back an unfinished run */
+    cypherWriteContextDestroy(pData->pWriteCtx);
+    pData->pWriteCtx = NULL;
+    pIterator->bOpened = 0;
+    return SQLITE_OK;
+}
+
+static void createIteratorDestroy(CypherIterator *pIterator) {
+    CreateIteratorData *pData = (CreateIteratorData*)pIterator->pIterData;
+    
+    if (pData) {
+        cypherWriteContextDestroy(pData->pWriteCtx);
+        sqlite3_free(pData->aId);
+        sqlite3_free(pData);
+    }
+}
+
+/*
+** Create a CREATE operator iterator.
+** Returns NULL on allocation failure.
+*/
+CypherIterator *cypherCreateIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+    CypherIterator *pIterator;
+    CreateIteratorData *pData;
+    
+    if (!pPlan || !pContext) return NULL;
+    
+    pIterator = sqlite3_malloc(sizeof(CypherIterator));
+    pData = sqlite3_malloc(sizeof(CreateIteratorData));
+    if (!pIterator || !pData) {
+        sqlite3_free(pIterator);
+        sqlite3_free(pData);
+        return NULL;
+    }
+    memset(pIterator, 0, sizeof(CypherIterator));
+    memset(pData, 0, sizeof(CreateIteratorData));
+    
+    if (pPlan->nWrite > 0) {
+        pData->aId = sqlite3_malloc(pPlan->nWrite * sizeof(sqlite3_int64));
+        if (!pData->aId) {
+            sqlite3_free(pData);
+            sqlite3_free(pIterator);
+            return NULL;
+        }
+        memset(pData->aId, 0, pPlan->nWrite * sizeof(sqlite3_int64));
+    }
+    
+    pIterator->xOpen = createIteratorOpen;
+    pIterator->xNext = createIteratorNext;
+    pIterator->xClose = createIteratorClose;
+    pIterator->xDestroy = createIteratorDestroy;
+    pIterator->pContext = pContext;
+    pIterator->pPlan = pPlan;
+    pIterator->pIterData = pData;
+    
+    return pIterator;
+}
+
+/*
+** Create a MERGE operator iterator. It shares the CREATE operator's
+** state and differs only in what a run writes.
+** Returns NULL on allocation failure.
+*/
+CypherIterator *cypherMergeIteratorCreate(PhysicalPlanNode *pPlan, ExecutionContext *pContext) {
+    CypherIterator *pIterator;
+    
+    if (!pPlan || pPlan->nWrite != 3) return NULL;
+    pIterator = cypherCreateIteratorCreate(pPlan, pContext);
+    if (pIterator) pIterator->xNext = mergeIteratorNext;
+    return pIterator;
+}
@@ -1,30 +1,32 @@
+/*
+** SQLite Graph Database Extension - Advanced Graph Algorithms
+**
+** This file implements whole-graph analyses: strongly connected
+** components (Tarjan), betweenness (Brandes) and closeness centrality,
+** topological sort (Kahn), cycle detection and connected components.
+** All of them run over the CSR snapshot from graph-csr.h with per-node
+** state kept in flat arrays indexed by dense node index.
+*/
 #include "sqlite3ext.h"
 #ifndef SQLITE_CORE
 extern const sqlite3_api_routines *sqlite3_api;
 #endif
 #include "graph.h"
 #include "graph-memory.h"
+#include "graph-csr.h"
+#include "graph-performance.h"
 #include <float.h>
 #include <string.h>
 #include <stdlib.h>
 
 /*
-** Stack entry for Tarjan's algorithm.
-*/
-typedef struct TarjanNode TarjanNode;
-struct TarjanNode {
-  int iIndex;
-  TarjanNode *pNext;
-};
-
-/*
-** Node index mapping for Brandes' algorithm.
-** Maps node IDs to array indices for O(1) access.
+** Explicit call frame for the iterative Tarjan DFS. Keeping the frames
+** on the heap lets deep graphs run without exhausting the C stack.
 */
-typedef struct NodeIndexMap NodeIndexMap;
-struct NodeIndexMap {
-  sqlite3_int64 *aNodeIds;        /* Array of node IDs */
-  int nNodes;                     /* Number of nodes */
+typedef struct TarjanFrame TarjanFrame;
+struct TarjanFrame {
+  int iNode;                /* Dense node index */
+  sqlite3_int64 iEdge;      /* Next out-edge of iNode to examine */
 };
 
 /*
@@ -32,196 +34,83 @@ struct NodeIndexMap {
 */
 typedef struct TarjanState TarjanState;
 struct TarjanState {
-  int *aIndex;      /* DFS index for each node */
-  int *aLowLink;    /* Lowest index reachable */
-  int *aOnStack;    /* Is node on stack? */
-  TarjanNode *pStack;  /* Stack of nodes */
-  int nIndex;       /* Current DFS index */
-  int nSCC;         /* Number of SCCs found */
-  char **azSCC;     /* Array of SCC strings */
-  NodeIndexMap *pMap;
+  const CSRGraph *pCSR;     /* Adjacency snapshot */
+  int *aIndex;              /* DFS index for each node, -1 if unvisited */
+  int *aLowLink;            /* Lowest index reachable */
+  unsigned char *aOnStack;  /* Is node on the component stack? */
+  int *aStack;              /* Component stack of dense indices */
+  int nStack;               /* Entries on aStack */
+  TarjanFrame *aFrame;      /* DFS call stack */
+  int nIndex;               /* Current DFS index */
+  sqlite3_str *pOut;        /* JSON array of components */
+  int nSCC;                 /* Number of SCCs found */
 };
 
-static void tarjanStrongConnect(GraphVtab *pVtab, TarjanState *pState, 
-                               int iNodeIdx);
-NodeIndexMap *createNodeIndexMap(GraphVtab *pVtab);
-int getNodeIndex(NodeIndexMap *pMap, sqlite3_int64 iNodeId);
-void freeNodeIndexMap(NodeIndexMap *pMap);
-
 /*
-** Create a node index map from the backing table.
-** This provides O(1) lookup for node indices in algorithms.
+** Pop one strongly connected component rooted at iRoot and append it
+** to the output as a JSON array of node ids.
 */
-NodeIndexMap *createNodeIndexMap(GraphVtab *pVtab) {
-  NodeIndexMap *pMap = sqlite3_malloc(sizeof(NodeIndexMap));
-  if (!pMap) return NULL;
-  
-  pMap->aNodeIds = NULL;
-  pMap->nNodes = 0;
-  
-  char *zSql = sqlite3_mprintf("SELECT id FROM %s_nodes ORDER BY id", pVtab->zTableName);
-  sqlite3_stmt *pStmt;
-  int rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, NULL);
-  sqlite3_free(zSql);
-  
-  if (rc != SQLITE_OK) {
-    sqlite3_free(pMap);
-    return NULL;
-  }
-  
-  /* Count nodes first */
-  while (sqlite3_step(pStmt) == SQLITE_ROW) {
-    pMap->nNodes++;
-  }
-  
-  sqlite3_finalize(pStmt);
-  
-  if (pMap->nNodes == 0) {
-    sqlite3_free(pMap);
-    return NULL;
-  }
-  
-  /* Allocate array for node IDs */
-  pMap->aNodeIds = sqlite3_malloc(pMap->nNodes * sizeof(sqlite3_int64));
-  if (!pMap->aNodeIds) {
-    sqlite3_free(pMap);
-    return NULL;
-  }
-  
-  /* Fill array with node IDs */
-  zSql = sqlite3_mprintf("SELECT id FROM %s_nodes ORDER BY id", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, NULL);
-  sqlite3_free(zSql);
-  
-  if (rc != SQLITE_OK) {
-    sqlite3_free(pMap->aNodeIds);
-    sqlite3_free(pMap);
-    return NULL;
-  }
-  
-  int i = 0;
-  while (sqlite3_step(pStmt) == SQLITE_ROW && i < pMap->nNodes) {
-    pMap->aNodeIds[i] = sqlite3_column_int64(pStmt, 0);
-    i++;
-  }
-  
-  sqlite3_finalize(pStmt);
-  return pMap;
-}
+static void tarjanEmitComponent(TarjanState *pState, int iRoot){
+  int bFirst = 1;
 
-/*
-** Get the index of a node ID in the index map.
-** Returns -1 if not found.
-*/
-int getNodeIndex(NodeIndexMap *pMap, sqlite3_int64 iNodeId) {
-  if (!pMap || !pMap->aNodeIds) return -1;
-  
-  /* Binary search since nodes are ordered by ID */
-  int left = 0;
-  int right = pMap->nNodes - 1;
-  
-  while (left <= right) {
-    int mid = (left + right) / 2;
-    if (pMap->aNodeIds[mid] == iNodeId) {
-      return mid;
-    } else if (pMap->aNodeIds[mid] < iNodeId) {
-      left = mid + 1;
-    } else {
-      right = mid - 1;
-    }
+  sqlite3_str_appendf(pState->pOut, "%s[", pState->nSCC ? "," : "");
+  while( pState->nStack>0 ){
+    int iIdx = pState->aStack[--pState->nStack];
+    pState->aOnStack[iIdx] = 0;
+    sqlite3_str_appendf(pState->pOut, "%s%lld", bFirst ? "" : ",",
+                        pState->pCSR->aNodeIds[iIdx]);
+    bFirst = 0;
+    if( iIdx==iRoot ) break;
   }
-  
-  return -1;
+  sqlite3_str_appendchar(pState->pOut, 1, ']');
+  pState->nSCC++;
 }
 
 /*
-** Free a node index map.
+** Run Tarjan's DFS from iRoot using the explicit frame stack.
 */
-void freeNodeIndexMap(NodeIndexMap *pMap) {
-  if (pMap) {
-    sqlite3_free(pMap->aNodeIds);
-    sqlite3_free(pMap);
-  }
-}
+static void tarjanStrongConnect(TarjanState *pState, int iRoot){
+  const CSRGraph *pCSR = pState->pCSR;
+  int nFrame = 0;
 
-static void tarjanStrongConnect(GraphVtab *pVtab, TarjanState *pState, 
-                               int iNodeIdx){
-  TarjanNode *pStackNode;
-  sqlite3_int64 iNodeId = pState->pMap->aNodeIds[iNodeIdx];
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int rc;
-  
-  pState->aIndex[iNodeIdx] = pState->nIndex;
-  pState->aLowLink[iNodeIdx] = pState->nIndex;
-  pState->nIndex++;
-  
-  pStackNode = sqlite3_malloc(sizeof(*pStackNode));
-  if( pStackNode ){
-    pStackNode->iIndex = iNodeIdx;
-    pStackNode->pNext = pState->pStack;
-    pState->pStack = pStackNode;
-    pState->aOnStack[iNodeIdx] = 1;
-  }
-  
-  zSql = sqlite3_mprintf("SELECT to_id FROM %s_edges WHERE from_id = %lld", pVtab->zTableName, iNodeId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ) return;
-
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    int iToIdx = getNodeIndex(pState->pMap, sqlite3_column_int64(pStmt, 0));
-    if( iToIdx >= 0 ){
-      if( pState->aIndex[iToIdx] == -1 ){
-        tarjanStrongConnect(pVtab, pState, iToIdx);
-        if( pState->aLowLink[iToIdx] < pState->aLowLink[iNodeIdx] ){
-          pState->aLowLink[iNodeIdx] = pState->aLowLink[iToIdx];
-        }
-      } else if( pState->aOnStack[iToIdx] ){
-        if( pState->aIndex[iToIdx] < pState->aLowLink[iNodeIdx] ){
-          pState->aLowLink[iNodeIdx] = pState->aIndex[iToIdx];
+  pState->aFrame[nFrame].iNode = iRoot;
+  pState->aFrame[nFrame].iEdge = pCSR->rowOffsets[iRoot];
+  nFrame++;
+  pState->aIndex[iRoot] = pState->aLowLink[iRoot] = pState->nIndex++;
+  pState->aStack[pState->nStack++] = iRoot;
+  pState->aOnStack[iRoot] = 1;
+
+  while( nFrame>0 ){
+    TarjanFrame *pFrame = &pState->aFrame[nFrame-1];
+    int iNode = pFrame->iNode;
+
+    if( pFrame->iEdge<pCSR->rowOffsets[iNode+1] ){
+      int iTo = pCSR->columnIndices[pFrame->iEdge++];
+      if( pState->aIndex[iTo]==-1 ){
+        /* Descend into an unvisited successor */
+        pState->aIndex[iTo] = pState->aLowLink[iTo] = pState->nIndex++;
+        pState->aStack[pState->nStack++] = iTo;
+        pState->aOnStack[iTo] = 1;
+        pState->aFrame[nFrame].iNode = iTo;
+        pState->aFrame[nFrame].iEdge = pCSR->rowOffsets[iTo];
+        nFrame++;
+      }else if( pState->aOnStack[iTo] ){
+        if( pState->aIndex[iTo] < pState->aLowLink[iNode] ){
+          pState->aLowLink[iNode] = pState->aIndex[iTo];
         }
       }
+      continue;
     }
-  }
-  sqlite3_finalize(pStmt);
-  
-  if( pState->aLowLink[iNodeIdx] == pState->aIndex[iNodeIdx] ){
-    char *zSCC = sqlite3_mprintf("[");
-    int first = 1;
-    
-    while( pState->pStack ){
-      TarjanNode *pNext = pState->pStack->pNext;
-      int iIdx = pState->pStack->iIndex;
-      
-      if( zSCC ){
-        char *zOld = zSCC;
-        zSCC = sqlite3_mprintf("%s%s%lld", zOld,
-                              first ? "" : ",",
-                              pState->pMap->aNodeIds[iIdx]);
-        sqlite3_free(zOld);
-        first = 0;
-      }
-      
-      pState->aOnStack[iIdx] = 0;
-      sqlite3_free(pState->pStack);
-      pState->pStack = pNext;
-      
-      if( iIdx == iNodeIdx ) break;
+
+    /* All successors done: close the component or return to parent */
+    if( pState->aLowLink[iNode]==pState->aIndex[iNode] ){
+      tarjanEmitComponent(pState, iNode);
     }
-    
-    if( zSCC ){
-      char *zOld = zSCC;
-      zSCC = sqlite3_mprintf("%s]", zOld);
-      sqlite3_free(zOld);
-      
-      char **azNew = sqlite3_realloc(pState->azSCC, 
-                                    sizeof(char*) * (pState->nSCC + 1));
-      if( azNew ){
-        pState->azSCC = azNew;
-        pState->azSCC[pState->nSCC++] = zSCC;
-      } else {
-        sqlite3_free(zSCC);
+    nFrame--;
+    if( nFrame>0 ){
+      int iParent = pState->aFrame[nFrame-1].iNode;
+      if( pState->aLowLink[iNode] < pState->aLowLink[iParent] ){
+        pState->aLowLink[iParent] = pState->aLowLink[iNode];
       }
     }
   }
@@ -229,88 +118,541 @@ static void tarjanStrongConnect(GraphVtab *pVtab, TarjanState *pState,
 
 int graphStronglyConnectedComponents(GraphVtab *pVtab, char **pzSCC){
   TarjanState state;
-  char *zResult = 0;
+  CSRGraph *pCSR = 0;
   int rc = SQLITE_OK;
+  int nNodes;
   int i;
-  int nNodes = 0;
-  char *zSql;
-  sqlite3_stmt *pStmt;
-
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
+
+  *pzSCC = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  nNodes = pCSR->nNodes;
 
   if( nNodes == 0 ){
     *pzSCC = sqlite3_mprintf("[]");
     return *pzSCC ? SQLITE_OK : SQLITE_NOMEM;
   }
-  
+
   memset(&state, 0, sizeof(state));
-  state.pMap = createNodeIndexMap(pVtab);
-  if( state.pMap==0 ) return SQLITE_NOMEM;
-  
-  state.aIndex = sqlite3_malloc(sizeof(int) * nNodes);
-  state.aLowLink = sqlite3_malloc(sizeof(int) * nNodes);
-  state.aOnStack = sqlite3_malloc(sizeof(int) * nNodes);
-  
-  if( !state.aIndex || !state.aLowLink || !state.aOnStack ){
+  state.pCSR = pCSR;
+  state.aIndex = sqlite3_malloc64(sizeof(int) * nNodes);
+  state.aLowLink = sqlite3_malloc64(sizeof(int) * nNodes);
+  state.aOnStack = sqlite3_malloc64(nNodes);
+  state.aStack = sqlite3_malloc64(sizeof(int) * nNodes);
+  state.aFrame = sqlite3_malloc64(sizeof(TarjanFrame) * nNodes);
+
+  if( !state.aIndex || !state.aLowLink || !state.aOnStack
+   || !state.aStack || !state.aFrame ){
     rc = SQLITE_NOMEM;
     goto scc_cleanup;
   }
-  
+
   for( i = 0; i < nNodes; i++ ){
     state.aIndex[i] = -1;
     state.aLowLink[i] = -1;
     state.aOnStack[i] = 0;
   }
-  
+
+  state.pOut = sqlite3_str_new(0);
+  sqlite3_str_appendchar(state.pOut, 1, '[');
   for( i = 0; i < nNodes; i++ ){
     if( state.aIndex[i] == -1 ){
-      tarjanStrongConnect(pVtab, &state, i);
+      tarjanStrongConnect(&state, i);
     }
   }
-  
-  zResult = sqlite3_mprintf("[");
-  for( i = 0; i < state.nSCC && zResult; i++ ){
-    char *zOld = zResult;
-    zResult = sqlite3_mprintf("%s%s%s", zOld,
-                             i > 0 ? "," : "",
-                             state.azSCC[i]);
-    sqlite3_free(zOld);
+  sqlite3_str_appendchar(state.pOut, 1, ']');
+  *pzSCC = sqlite3_str_finish(state.pOut);
+  if( *pzSCC==0 ) rc = SQLITE_NOMEM;
+
+scc_cleanup:
+  sqlite3_free(state.aIndex);
+  sqlite3_free(state.aLowLink);
+  sqlite3_free(state.aOnStack);
+  sqlite3_free(state.aStack);
+  sqlite3_free(state.aFrame);
+
+  return rc;
+}
+
+/*
+** Append {"id":score,...} for every node to a new string.
+*/
+static char *graphScoresToJson(const CSRGraph *pCSR, const double *aScore){
+  sqlite3_str *pStr = sqlite3_str_new(0);
+  int i;
+
+  sqlite3_str_appendchar(pStr, 1, '{');
+  for( i=0; i<pCSR->nNodes; i++ ){
+    sqlite3_str_appendf(pStr, "%s\"%lld\":%.6f", i ? "," : "",
+                        pCSR->aNodeIds[i], aScore[i]);
   }
-  
-  if( zResult ){
-    char *zOld = zResult;
-    zResult = sqlite3_mprintf("%s]", zOld);
-    sqlite3_free(zOld);
+  sqlite3_str_appendchar(pStr, 1, '}');
+  return sqlite3_str_finish(pStr);
+}
+
+/*
+** Per-source centrality work shared by one task. Task iTask handles the
+** sources iTask, iTask+nTask, iTask+2*nTask, ... so every task sees a
+** similar mix of cheap and expensive sources. Scratch arrays are
+** private to the task and reset between sources for visited nodes only.
+*/
+typedef struct CentralityTask CentralityTask;
+struct CentralityTask {
+  const CSRGraph *pCSR;
+  int iTask;                  /* First source handled by this task */
+  int nTask;                  /* Stride between sources */
+  double *aScore;             /* Betweenness: private partial sums.
+                              ** Closeness: shared, own sources only */
+  double *aSigma;             /* Shortest path counts (betweenness) */
+  double *aDelta;             /* Dependencies (betweenness) */
+  int *aDist;                 /* Hop distance, -1 if unreached */
+  int *aOrder;                /* BFS order / queue */
+  CSRProgress *pProgress;     /* Sources done and cancel flag, or NULL */
+};
+
+/*
+** Count one finished source. Returns true if the run was cancelled.
+*/
+static int centralityStep(CentralityTask *p){
+  if( p->pProgress==0 ) return 0;
+  __atomic_add_fetch(&p->pProgress->nDone, 1, __ATOMIC_RELAXED);
+  return __atomic_load_n(&p->pProgress->bCancel, __ATOMIC_RELAXED);
+}
+
+/*
+** Brandes accumulation for the sources owned by one task.
+*/
+static void betweennessWorker(void *pArg){
+  CentralityTask *p = (CentralityTask*)pArg;
+  const CSRGraph *pCSR = p->pCSR;
+  int iSource;
+
+  for( iSource=p->iTask; iSource<pCSR->nNodes; iSource+=p->nTask ){
+    int iHead = 0, iTail = 0;
+    int i;
+
+    p->aSigma[iSource] = 1.0;
+    p->aDist[iSource] = 0;
+    p->aOrder[iTail++] = iSource;
+
+    /* Forward phase: BFS doubles as the non-decreasing distance order */
+    while( iHead<iTail ){
+      int iNode = p->aOrder[iHead++];
+      sqlite3_int64 iEdge;
+      for( iEdge=pCSR->rowOffsets[iNode]; iEdge<pCSR->rowOffsets[iNode+1]; iEdge++ ){
+        int iNext = pCSR->columnIndices[iEdge];
+        if( p->aDist[iNext]<0 ){
+          p->aDist[iNext] = p->aDist[iNode] + 1;
+          p->aOrder[iTail++] = iNext;
+        }
+        if( p->aDist[iNext]==p->aDist[iNode]+1 ){
+          p->aSigma[iNext] += p->aSigma[iNode];
+        }
+      }
+    }
+
+    /* Backward phase: accumulate dependencies onto predecessors */
+    for( i=iTail-1; i>0; i-- ){
+      int iNode = p->aOrder[i];
+      double rCoeff = (1.0 + p->aDelta[iNode]) / p->aSigma[iNode];
+      sqlite3_int64 iEdge;
+      for( iEdge=pCSR->inOffsets[iNode]; iEdge<pCSR->inOffsets[iNode+1]; iEdge++ ){
+        int iPrev = pCSR->inIndices[iEdge];
+        if( p->aDist[iPrev]>=0 && p->aDist[iPrev]==p->aDist[iNode]-1 ){
+          p->aDelta[iPrev] += p->aSigma[iPrev] * rCoeff;
+        }
+      }
+      p->aScore[iNode] += p->aDelta[iNode];
+    }
+
+    /* Only nodes reached from this source need resetting */
+    for( i=0; i<iTail; i++ ){
+      int iNode = p->aOrder[i];
+      p->aSigma[iNode] = 0.0;
+      p->aDelta[iNode] = 0.0;
+      p->aDist[iNode] = -1;
+    }
+    if( centralityStep(p) ) break;
+  }
+}
+
+/*
+** Closeness scores for the sources owned by one task.
+*/
+static void closenessWorker(void *pArg){
+  CentralityTask *p = (CentralityTask*)pArg;
+  const CSRGraph *pCSR = p->pCSR;
+  int iSource;
+
+  for( iSource=p->iTask; iSource<pCSR->nNodes; iSource+=p->nTask ){
+    int iHead = 0, iTail = 0;
+    sqlite3_int64 nSum = 0;
+    int i;
+
+    p->aDist[iSource] = 0;
+    p->aOrder[iTail++] = iSource;
+    while( iHead<iTail ){
+      int iNode = p->aOrder[iHead++];
+      sqlite3_int64 iEdge;
+      nSum += p->aDist[iNode];
+      for( iEdge=pCSR->rowOffsets[iNode]; iEdge<pCSR->rowOffsets[iNode+1]; iEdge++ ){
+        int iNext = pCSR->columnIndices[iEdge];
+        if( p->aDist[iNext]<0 ){
+          p->aDist[iNext] = p->aDist[iNode] + 1;
+          p->aOrder[iTail++] = iNext;
+        }
+      }
+    }
+    p->aScore[iSource] = nSum>0 ? (double)(iTail-1) / (double)nSum : 0.0;
+
+    for( i=0; i<iTail; i++ ) p->aDist[p->aOrder[i]] = -1;
+    if( centralityStep(p) ) break;
+  }
+}
+
+/*
+** Free the scratch arrays of nTask tasks, then the task array.
+*/
+static void centralityTasksFree(CentralityTask *aTask, int nTask,
+                                int bPrivateScore){
+  int i;
+  if( aTask==0 ) return;
+  for( i=0; i<nTask; i++ ){
+    if( bPrivateScore ) sqlite3_free(aTask[i].aScore);
+    sqlite3_free(aTask[i].aSigma);
+    sqlite3_free(aTask[i].aDelta);
+    sqlite3_free(aTask[i].aDist);
+    sqlite3_free(aTask[i].aOrder);
+  }
+  sqlite3_free(aTask);
+}
+
+/*
+** Set up nTask per-source tasks over pCSR and run xWorker on them.
+** With bBetweenness each task gets private score, sigma and delta
+** arrays that are summed into aScore afterwards; otherwise tasks write
+** their own sources' entries of aScore directly. With pProgress, each
+** finished source is counted there and a cancelled run returns
+** SQLITE_INTERRUPT.
+*/
+static int centralityRun(const CSRGraph *pCSR, int nThreads,
+                         int bBetweenness, void (*xWorker)(void*),
+                         CSRProgress *pProgress, double *aScore){
+  TaskScheduler *pScheduler = 0;
+  CentralityTask *aTask = 0;
+  void **apTask = 0;
+  int nNodes = pCSR->nNodes;
+  int nTask = 1;
+  int rc = SQLITE_OK;
+  int i, j;
+
+  if( nThreads!=1 ){
+    pScheduler = graphCreateTaskScheduler(nThreads);
+    if( pScheduler==0 ) return SQLITE_NOMEM;
+    nTask = pScheduler->nThreads;
+    if( nTask>nNodes ) nTask = nNodes;
   }
-  
-  if( zResult==0 ){
+
+  aTask = sqlite3_malloc64(sizeof(CentralityTask)*nTask);
+  apTask = sqlite3_malloc64(sizeof(void*)*nTask);
+  if( !aTask || !apTask ){
     rc = SQLITE_NOMEM;
-  } else {
-    *pzSCC = zResult;
+    goto centrality_cleanup;
   }
-  
-scc_cleanup:
-  for( i = 0; i < state.nSCC; i++ ){
-    sqlite3_free(state.azSCC[i]);
+  memset(aTask, 0, sizeof(CentralityTask)*nTask);
+
+  for( i=0; i<nTask; i++ ){
+    CentralityTask *p = &aTask[i];
+    p->pCSR = pCSR;
+    p->iTask = i;
+    p->nTask = nTask;
+    p->pProgress = pProgress;
+    p->aDist = sqlite3_malloc64(sizeof(int)*nNodes);
+    p->aOrder = sqlite3_malloc64(sizeof(int)*nNodes);
+    if( bBetweenness ){
+      p->aScore = sqlite3_malloc64(sizeof(double)*nNodes);
+      p->aSigma = sqlite3_malloc64(sizeof(double)*nNodes);
+      p->aDelta = sqlite3_malloc64(sizeof(double)*nNodes);
+      if( !p->aScore || !p->aSigma || !p->aDelta ){
+        rc = SQLITE_NOMEM;
+        goto centrality_cleanup;
+      }
+      memset(p->aScore, 0, sizeof(double)*nNodes);
+      memset(p->aSigma, 0, sizeof(double)*nNodes);
+      memset(p->aDelta, 0, sizeof(double)*nNodes);
+    }else{
+      p->aScore = aScore;
+    }
+    if( !p->aDist || !p->aOrder ){
+      rc = SQLITE_NOMEM;
+      goto centrality_cleanup;
+    }
+    memset(p->aDist, 0xff, sizeof(int)*nNodes);  /* -1 == unreached */
+    apTask[i] = p;
   }
-  sqlite3_free(state.azSCC);
-  
-  while( state.pStack ){
-    TarjanNode *pNext = state.pStack->pNext;
-    sqlite3_free(state.pStack);
-    state.pStack = pNext;
+
+  rc = graphRunTasks(pScheduler, xWorker, apTask, nTask);
+  if( rc==SQLITE_OK && pProgress
+   && __atomic_load_n(&pProgress->bCancel, __ATOMIC_RELAXED) ){
+    rc = SQLITE_INTERRUPT;
   }
-  
-  sqlite3_free(state.aIndex);
-  sqlite3_free(state.aLowLink);
-  sqlite3_free(state.aOnStack);
-  freeNodeIndexMap(state.pMap);
-  
+
+  /* Reduce partial sums in task order */
+  if( rc==SQLITE_OK && bBetweenness ){
+    memset(aScore, 0, sizeof(double)*nNodes);
+    for( i=0; i<nTask; i++ ){
+      for( j=0; j<nNodes; j++ ) aScore[j] += aTask[i].aScore[j];
+    }
+  }
+
+centrality_cleanup:
+  centralityTasksFree(aTask, nTask, bBetweenness);
+  sqlite3_free(apTask);
+  graphDestroyTaskScheduler(pScheduler);
+  return rc;
+}
+
+/*
+** Betweenness centrality using Brandes' algorithm on the directed,
+** unweighted graph. One BFS per source counts shortest paths (aSigma);
+** dependencies are then accumulated in reverse BFS order by scanning
+** in-edges for predecessors one level closer to the source, which
+** avoids materializing predecessor lists. Scores are not normalized.
+** Sources are independent, so they are spread across nThreads tasks
+** with per-task partial sums.
+*/
+int graphBetweennessCentralityCSR(const CSRGraph *pCSR, int nThreads,
+                                  char **pzResults){
+  double *aScore = 0;
+  int rc;
+
+  *pzResults = 0;
+  if( pCSR->nNodes==0 ){
+    *pzResults = sqlite3_mprintf("{}");
+    return *pzResults ? SQLITE_OK : SQLITE_NOMEM;
+  }
+
+  aScore = sqlite3_malloc64(sizeof(double)*pCSR->nNodes);
+  if( aScore==0 ) return SQLITE_NOMEM;
+
+  rc = centralityRun(pCSR, nThreads, 1, betweennessWorker, 0, aScore);
+  if( rc==SQLITE_OK ){
+    *pzResults = graphScoresToJson(pCSR, aScore);
+    if( *pzResults==0 ) rc = SQLITE_NOMEM;
+  }
+  sqlite3_free(aScore);
   return rc;
-}
\ No newline at end of file
+}
+
+int graphCentralityScores(const CSRGraph *pCSR, int bBetweenness,
+                          int nThreads, CSRProgress *pProgress,
+                          double **paScore){
+  double *aScore;
+  int rc;
+
+  *paScore = 0;
+  if( pProgress ){
+    __atomic_store_n(&pProgress->nTotal, (sqlite3_int64)pCSR->nNodes,
+                     __ATOMIC_RELAXED);
+  }
+  aScore = sqlite3_malloc64(sizeof(double)*(pCSR->nNodes>0 ? pCSR->nNodes : 1));
+  if( aScore==0 ) return SQLITE_NOMEM;
+  if( pCSR->nNodes==0 ){
+    *paScore = aScore;
+    return SQLITE_OK;
+  }
+  rc = centralityRun(pCSR, nThreads, bBetweenness,
+                     bBetweenness ? betweennessWorker : closenessWorker,
+                     pProgress, aScore);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(aScore);
+    return rc;
+  }
+  *paScore = aScore;
+  return SQLITE_OK;
+}
+
+int graphBetweennessCentrality(GraphVtab *pVtab, int nThreads,
+                               char **pzResults){
+  CSRGraph *pCSR = 0;
+  int rc;
+
+  *pzResults = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  return graphBetweennessCentralityCSR(pCSR, nThreads, pzResults);
+}
+
+/*
+** Closeness centrality following out-edges. For a node that reaches r
+** other nodes with total hop distance d the score is r/d, which equals
+** (n-1)/d on strongly connected graphs and stays meaningful otherwise.
+** Nodes reaching nothing score 0. Sources run on nThreads tasks.
+*/
+int graphClosenessCentrality(GraphVtab *pVtab, int nThreads,
+                             char **pzResults){
+  CSRGraph *pCSR = 0;
+  double *aScore = 0;
+  int rc;
+
+  *pzResults = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  if( pCSR->nNodes==0 ){
+    *pzResults = sqlite3_mprintf("{}");
+    return *pzResults ? SQLITE_OK : SQLITE_NOMEM;
+  }
+
+  aScore = sqlite3_malloc64(sizeof(double)*pCSR->nNodes);
+  if( aScore==0 ) return SQLITE_NOMEM;
+
+  rc = centralityRun(pCSR, nThreads, 0, closenessWorker, 0, aScore);
+  if( rc==SQLITE_OK ){
+    *pzResults = graphScoresToJson(pCSR, aScore);
+    if( *pzResults==0 ) rc = SQLITE_NOMEM;
+  }
+  sqlite3_free(aScore);
+  return rc;
+}
+
+/*
+** Kahn's algorithm. Fills aOrder with dense indices in topological order
+** and returns how many nodes were ordered; fewer than nNodes means the
+** graph has a cycle. Returns -1 on OOM.
+*/
+static int graphKahnOrder(const CSRGraph *pCSR, int *aOrder){
+  int *aInDegree;
+  int iHead = 0, iTail = 0;
+  int i;
+
+  aInDegree = sqlite3_malloc64(sizeof(int)*(pCSR->nNodes>0 ? pCSR->nNodes : 1));
+  if( aInDegree==0 ) return -1;
+  for( i=0; i<pCSR->nNodes; i++ ){
+    aInDegree[i] = graphCSRInDegree(pCSR, i);
+    if( aInDegree[i]==0 ) aOrder[iTail++] = i;
+  }
+  while( iHead<iTail ){
+    int iNode = aOrder[iHead++];
+    sqlite3_int64 iEdge;
+    for( iEdge=pCSR->rowOffsets[iNode]; iEdge<pCSR->rowOffsets[iNode+1]; iEdge++ ){
+      int iNext = pCSR->columnIndices[iEdge];
+      if( --aInDegree[iNext]==0 ) aOrder[iTail++] = iNext;
+    }
+  }
+  sqlite3_free(aInDegree);
+  return iTail;
+}
+
+int graphTopologicalSort(GraphVtab *pVtab, char **pzOrder){
+  CSRGraph *pCSR = 0;
+  int *aOrder;
+  int nOrdered;
+  int rc;
+
+  *pzOrder = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+
+  aOrder = sqlite3_malloc64(sizeof(int)*(pCSR->nNodes>0 ? pCSR->nNodes : 1));
+  if( aOrder==0 ) return SQLITE_NOMEM;
+  nOrdered = graphKahnOrder(pCSR, aOrder);
+  if( nOrdered<0 ){
+    rc = SQLITE_NOMEM;
+  }else if( nOrdered<pCSR->nNodes ){
+    rc = SQLITE_CONSTRAINT;
+  }else{
+    sqlite3_str *pStr = sqlite3_str_new(0);
+    int i;
+    sqlite3_str_appendchar(pStr, 1, '[');
+    for( i=0; i<nOrdered; i++ ){
+      sqlite3_str_appendf(pStr, "%s%lld", i ? "," : "",
+                          pCSR->aNodeIds[aOrder[i]]);
+    }
+    sqlite3_str_appendchar(pStr, 1, ']');
+    *pzOrder = sqlite3_str_finish(pStr);
+    if( *pzOrder==0 ) rc = SQLITE_NOMEM;
+  }
+  sqlite3_free(aOrder);
+  return rc;
+}
+
+int graphHasCycle(GraphVtab *pVtab){
+  CSRGraph *pCSR = 0;
+  int *aOrder;
+  int nOrdered;
+
+  if( graphCSRGet(pVtab, &pCSR)!=SQLITE_OK ) return 0;
+  aOrder = sqlite3_malloc64(sizeof(int)*(pCSR->nNodes>0 ? pCSR->nNodes : 1));
+  if( aOrder==0 ) return 0;
+  nOrdered = graphKahnOrder(pCSR, aOrder);
+  sqlite3_free(aOrder);
+  return nOrdered>=0 && nOrdered<pCSR->nNodes;
+}
+
+/*
+** Weakly connected components. Each component is found by a BFS over
+** out- and in-edges and numbered in order of its smallest node id.
+** Format: {"0":[ids...],"1":[ids...],...}
+*/
+int graphConnectedComponentsCSR(const CSRGraph *pCSR, char **pzComponents){
+  unsigned char *aSeen = 0;
+  int *aQueue = 0;
+  sqlite3_str *pStr;
+  int nComponent = 0;
+  int nNodes;
+  int i;
+
+  *pzComponents = 0;
+  nNodes = pCSR->nNodes;
+
+  aSeen = sqlite3_malloc64(nNodes>0 ? nNodes : 1);
+  aQueue = sqlite3_malloc64(sizeof(int)*(nNodes>0 ? nNodes : 1));
+  if( aSeen==0 || aQueue==0 ){
+    sqlite3_free(aSeen);
+    sqlite3_free(aQueue);
+    return SQLITE_NOMEM;
+  }
+  memset(aSeen, 0, nNodes);
+
+  pStr = sqlite3_str_new(0);
+  sqlite3_str_appendchar(pStr, 1, '{');
+  for( i=0; i<nNodes; i++ ){
+    int iHead = 0, iTail = 0;
+    if( aSeen[i] ) continue;
+    aSeen[i] = 1;
+    aQueue[iTail++] = i;
+    sqlite3_str_appendf(pStr, "%s\"%d\":[", nComponent ? "," : "", nComponent);
+    while( iHead<iTail ){
+      int iNode = aQueue[iHead++];
+      sqlite3_int64 iEdge;
+      sqlite3_str_appendf(pStr, "%s%lld", iHead>1 ? "," : "",
+                          pCSR->aNodeIds[iNode]);
+      for( iEdge=pCSR->rowOffsets[iNode]; iEdge<pCSR->rowOffsets[iNode+1]; iEdge++ ){
+        int iNext = pCSR->columnIndices[iEdge];
+        if( !aSeen[iNext] ){ aSeen[iNext] = 1; aQueue[iTail++] = iNext; }
+      }
+      for( iEdge=pCSR->inOffsets[iNode]; iEdge<pCSR->inOffsets[iNode+1]; iEdge++ ){
+        int iNext = pCSR->inIndices[iEdge];
+        if( !aSeen[iNext] ){ aSeen[iNext] = 1; aQueue[iTail++] = iNext; }
+      }
+    }
+    sqlite3_str_appendchar(pStr, 1, ']');
+    nComponent++;
+  }
+  sqlite3_str_appendchar(pStr, 1, '}');
+  *pzComponents = sqlite3_str_finish(pStr);
+
+  sqlite3_free(aSeen);
+  sqlite3_free(aQueue);
+  return *pzComponents ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+int graphConnectedComponents(GraphVtab *pVtab, char **pzComponents){
+  CSRGraph *pCSR = 0;
+  int rc;
+
+  *pzComponents = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  return graphConnectedComponentsCSR(pCSR, pzComponents);
+}
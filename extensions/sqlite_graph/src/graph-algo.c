@@ -16,9 +16,12 @@ extern const sqlite3_api_routines *sqlite3_api;
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "graph.h"
 #include "graph-memory.h"
+#include "graph-csr.h"
+#include "graph-performance.h"
 #include <float.h>
 #include <math.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <limits.h>
 
@@ -31,351 +34,336 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 
 /*
-** Priority queue element for Dijkstra's algorithm.
-** Stores node ID and distance from source.
+** Visited bitmaps, one bit per dense node index.
 */
-typedef struct PQNode PQNode;
-struct PQNode {
-  sqlite3_int64 iNodeId;    /* Node identifier */
-  double rDistance;         /* Distance from source */
-};
+#define SEEN_BYTES(N)   (((sqlite3_int64)(N)+7)/8)
+#define SEEN_TEST(A,I)  ((A)[(I)>>3] & (1<<((I)&7)))
+#define SEEN_SET(A,I)   ((A)[(I)>>3] |= (unsigned char)(1<<((I)&7)))
 
 /*
-** Min-heap priority queue for Dijkstra's algorithm.
-** Uses dynamic array with parent/child indexing.
+** Indexed 4-ary min-heap of dense node indices keyed by tentative
+** distance. aPos maps a queued node to its slot, so a shorter distance
+** moves the node up in place (decrease-key) instead of queueing a
+** duplicate, and the heap never holds more than one entry per node.
+** Four children per slot halve the depth of a binary heap, and the
+** children of a slot share one cache line.
 */
-typedef struct GraphPriorityQueue GraphPriorityQueue;
-struct GraphPriorityQueue {
-  PQNode *aNodes;           /* Array of nodes */
-  int nUsed;                /* Number of nodes in queue */
-  int nAlloc;               /* Allocated size */
+#define HEAP_ARITY 4
+
+typedef struct GraphHeapEntry GraphHeapEntry;
+struct GraphHeapEntry {
+  double rKey;              /* Tentative distance (plus heuristic) */
+  int iNode;                /* Dense node index */
+};
+
+typedef struct GraphHeap GraphHeap;
+struct GraphHeap {
+  GraphHeapEntry *aEntry;   /* Heap array */
+  int nUsed;                /* Entries in use */
+  int nAlloc;               /* Allocated entries */
+  int *aPos;                /* Borrowed: node -> slot, -1 if not queued */
 };
 
 /*
-** Create a new priority queue.
-** Memory allocation: Uses sqlite3_malloc() for initial capacity.
-** Returns pointer to queue or NULL on OOM.
+** Store entry e in slot i and record the slot in aPos.
 */
-static GraphPriorityQueue *graphPriorityQueueCreate(void){
-  GraphPriorityQueue *pQueue;
-  
-  pQueue = sqlite3_malloc(sizeof(*pQueue));
-  if( pQueue==0 ){
-    testcase( pQueue==0 );  /* Out of memory */
-    return 0;
-  }
-  
-  /* Initialize with small initial capacity */
-  pQueue->nAlloc = 16;
-  pQueue->nUsed = 0;
-  pQueue->aNodes = sqlite3_malloc(pQueue->nAlloc * sizeof(PQNode));
-  if( pQueue->aNodes==0 ){
-    testcase( pQueue->aNodes==0 );  /* Out of memory */
-    sqlite3_free(pQueue);
-    return 0;
-  }
-  
-  return pQueue;
+static void graphHeapPlace(GraphHeap *pHeap, int i, GraphHeapEntry e){
+  pHeap->aEntry[i] = e;
+  pHeap->aPos[e.iNode] = i;
 }
 
 /*
-** Destroy priority queue and free all memory.
+** Move the entry in slot i towards the root until its parent is no larger.
 */
-static void graphPriorityQueueDestroy(GraphPriorityQueue *pQueue){
-  if( pQueue ){
-    sqlite3_free(pQueue->aNodes);
-    sqlite3_free(pQueue);
+static void graphHeapSiftUp(GraphHeap *pHeap, int i){
+  GraphHeapEntry e = pHeap->aEntry[i];
+
+  while( i>0 ){
+    int iParent = (i-1)/HEAP_ARITY;
+    if( pHeap->aEntry[iParent].rKey<=e.rKey ) break;
+    graphHeapPlace(pHeap, i, pHeap->aEntry[iParent]);
+    i = iParent;
   }
+  graphHeapPlace(pHeap, i, e);
 }
 
 /*
-** Get parent index in heap.
+** Move the entry in slot i down until none of its children is smaller.
 */
-static int pqParent(int i){
-  return (i - 1) / 2;
-}
+static void graphHeapSiftDown(GraphHeap *pHeap, int i){
+  GraphHeapEntry e = pHeap->aEntry[i];
 
-/*
-** Get left child index in heap.
-*/
-static int pqLeftChild(int i){
-  return 2 * i + 1;
-}
+  for(;;){
+    int iChild = i*HEAP_ARITY + 1;
+    int iLast = iChild + HEAP_ARITY;
+    int iMin = iChild;
+    int j;
 
-/*
-** Get right child index in heap.
-*/
-static int pqRightChild(int i){
-  return 2 * i + 2;
+    if( iChild>=pHeap->nUsed ) break;
+    if( iLast>pHeap->nUsed ) iLast = pHeap->nUsed;
+    for( j=iChild+1; j<iLast; j++ ){
+      if( pHeap->aEntry[j].rKey<pHeap->aEntry[iMin].rKey ) iMin = j;
+    }
+    if( pHeap->aEntry[iMin].rKey>=e.rKey ) break;
+    graphHeapPlace(pHeap, i, pHeap->aEntry[iMin]);
+    i = iMin;
+  }
+  graphHeapPlace(pHeap, i, e);
 }
 
 /*
-** Swap two nodes in the heap.
+** Queue iNode with key rKey, or lower its key if it is already queued
+** with a larger one. aPos[iNode] must be -1 when iNode is not queued.
+** Returns SQLITE_OK or SQLITE_NOMEM.
 */
-static void pqSwap(GraphPriorityQueue *pQueue, int i, int j){
-  PQNode temp = pQueue->aNodes[i];
-  pQueue->aNodes[i] = pQueue->aNodes[j];
-  pQueue->aNodes[j] = temp;
-}
+static int graphHeapUpdate(GraphHeap *pHeap, int iNode, double rKey){
+  int i = pHeap->aPos[iNode];
 
-/*
-** Bubble up element to maintain heap property.
-*/
-static void pqBubbleUp(GraphPriorityQueue *pQueue, int i){
-  while( i>0 && pQueue->aNodes[pqParent(i)].rDistance > 
-                pQueue->aNodes[i].rDistance ){
-    pqSwap(pQueue, i, pqParent(i));
-    i = pqParent(i);
+  if( i<0 ){
+    if( pHeap->nUsed>=pHeap->nAlloc ){
+      int nNew = pHeap->nAlloc ? pHeap->nAlloc*2 : 64;
+      GraphHeapEntry *aNew;
+      aNew = sqlite3_realloc64(pHeap->aEntry, sizeof(GraphHeapEntry)*nNew);
+      if( aNew==0 ) return SQLITE_NOMEM;
+      pHeap->aEntry = aNew;
+      pHeap->nAlloc = nNew;
+    }
+    i = pHeap->nUsed++;
+  }else if( rKey>=pHeap->aEntry[i].rKey ){
+    return SQLITE_OK;
   }
+  pHeap->aEntry[i].rKey = rKey;
+  pHeap->aEntry[i].iNode = iNode;
+  graphHeapSiftUp(pHeap, i);
+  return SQLITE_OK;
 }
 
 /*
-** Bubble down element to maintain heap property.
+** Remove and return the node with the smallest key. The heap must not
+** be empty.
 */
-static void pqBubbleDown(GraphPriorityQueue *pQueue, int i){
-  int minIndex = i;
-  int left = pqLeftChild(i);
-  int right = pqRightChild(i);
-  
-  if( left<pQueue->nUsed && 
-      pQueue->aNodes[left].rDistance < pQueue->aNodes[minIndex].rDistance ){
-    minIndex = left;
-  }
-  
-  if( right<pQueue->nUsed && 
-      pQueue->aNodes[right].rDistance < pQueue->aNodes[minIndex].rDistance ){
-    minIndex = right;
-  }
-  
-  if( minIndex!=i ){
-    pqSwap(pQueue, i, minIndex);
-    pqBubbleDown(pQueue, minIndex);
+static int graphHeapPop(GraphHeap *pHeap){
+  int iNode = pHeap->aEntry[0].iNode;
+
+  assert( pHeap->nUsed>0 );
+  pHeap->aPos[iNode] = -1;
+  pHeap->nUsed--;
+  if( pHeap->nUsed>0 ){
+    graphHeapPlace(pHeap, 0, pHeap->aEntry[pHeap->nUsed]);
+    graphHeapSiftDown(pHeap, 0);
   }
+  return iNode;
 }
 
+#define graphHeapMinKey(P) ((P)->aEntry[0].rKey)
+
 /*
-** Insert node into priority queue.
-** Returns SQLITE_OK on success, SQLITE_NOMEM on allocation failure.
+** One direction of a shortest path search over a CSR snapshot: forward
+** over out-edges from the start, or backward over in-edges from the
+** end. The per-node arrays are left uninitialized and only read for
+** nodes marked in aSeen, so starting a point-to-point search costs one
+** bitmap clear instead of a pass over the state of every node.
 */
-static int graphPriorityQueueInsert(GraphPriorityQueue *pQueue, 
-                                   sqlite3_int64 iNodeId, double rDistance){
-  PQNode *aNew;
-  
-  assert( pQueue!=0 );
-  
-  /* Grow array if needed */
-  if( pQueue->nUsed >= pQueue->nAlloc ){
-    int nNewAlloc = pQueue->nAlloc * 2;
-    aNew = sqlite3_realloc(pQueue->aNodes, nNewAlloc * sizeof(PQNode));
-    if( aNew==0 ){
-      testcase( aNew==0 );  /* Realloc failed */
-      return SQLITE_NOMEM;
-    }
-    pQueue->aNodes = aNew;
-    pQueue->nAlloc = nNewAlloc;
-  }
-  
-  /* Add node at end */
-  pQueue->aNodes[pQueue->nUsed].iNodeId = iNodeId;
-  pQueue->aNodes[pQueue->nUsed].rDistance = rDistance;
-  
-  /* Bubble up to maintain heap property */
-  pqBubbleUp(pQueue, pQueue->nUsed);
-  pQueue->nUsed++;
-  
-  return SQLITE_OK;
-}
+typedef struct PathSearchSide PathSearchSide;
+struct PathSearchSide {
+  const sqlite3_int64 *aOffset;  /* Adjacency offsets, out or in */
+  const int *aIndex;             /* Adjacent dense indices */
+  const double *aWeight;         /* Edge weights */
+  unsigned char *aSeen;          /* Bitmap: node has a distance */
+  double *aDist;                 /* Tentative distance from the root */
+  int *aPred;                    /* Previous node, -1 at the root */
+  int *aPos;                     /* Heap slot per node */
+  GraphHeap heap;                /* Nodes still to settle */
+};
 
 /*
-** Extract minimum distance node from queue.
-** Returns SQLITE_OK and sets outputs, or SQLITE_NOTFOUND if empty.
+** Allocate pSide for pCSR, searching over in-edges if bReverse. On
+** failure pSide may be partly allocated; pathSideClear() releases it.
 */
-static int graphPriorityQueueExtractMin(GraphPriorityQueue *pQueue,
-                                       sqlite3_int64 *piNodeId,
-                                       double *prDistance){
-  assert( pQueue!=0 );
-  assert( piNodeId!=0 );
-  assert( prDistance!=0 );
-  
-  if( pQueue->nUsed==0 ){
-    testcase( pQueue->nUsed==0 );  /* Queue is empty */
-    return SQLITE_NOTFOUND;
-  }
-  
-  /* Extract root (minimum) */
-  *piNodeId = pQueue->aNodes[0].iNodeId;
-  *prDistance = pQueue->aNodes[0].rDistance;
-  
-  /* Move last element to root */
-  pQueue->nUsed--;
-  if( pQueue->nUsed>0 ){
-    pQueue->aNodes[0] = pQueue->aNodes[pQueue->nUsed];
-    pqBubbleDown(pQueue, 0);
+static int pathSideInit(PathSearchSide *pSide, const CSRGraph *pCSR,
+                        int bReverse){
+  int n = pCSR->nNodes>0 ? pCSR->nNodes : 1;
+
+  memset(pSide, 0, sizeof(*pSide));
+  pSide->aOffset = bReverse ? pCSR->inOffsets : pCSR->rowOffsets;
+  pSide->aIndex = bReverse ? pCSR->inIndices : pCSR->columnIndices;
+  pSide->aWeight = bReverse ? pCSR->inWeights : pCSR->edgeWeights;
+  pSide->aSeen = sqlite3_malloc64(SEEN_BYTES(n));
+  pSide->aDist = sqlite3_malloc64(sizeof(double)*n);
+  pSide->aPred = sqlite3_malloc64(sizeof(int)*n);
+  pSide->aPos = sqlite3_malloc64(sizeof(int)*n);
+  if( pSide->aSeen==0 || pSide->aDist==0 || pSide->aPred==0
+   || pSide->aPos==0 ){
+    return SQLITE_NOMEM;
   }
-  
+  memset(pSide->aSeen, 0, SEEN_BYTES(n));
+  pSide->heap.aPos = pSide->aPos;
   return SQLITE_OK;
 }
 
-/*
-** Check if priority queue is empty.
-*/
-static int graphPriorityQueueIsEmpty(GraphPriorityQueue *pQueue){
-  return pQueue->nUsed == 0;
+static void pathSideClear(PathSearchSide *pSide){
+  sqlite3_free(pSide->aSeen);
+  sqlite3_free(pSide->aDist);
+  sqlite3_free(pSide->aPred);
+  sqlite3_free(pSide->aPos);
+  sqlite3_free(pSide->heap.aEntry);
+  memset(pSide, 0, sizeof(*pSide));
 }
 
 /*
-** Distance information for Dijkstra's algorithm.
-** Maps node IDs to distances and predecessors.
+** Record rDist as the distance of iNode, reached from iPred, unless
+** iNode already has one at least as short, and queue iNode with key
+** rDist+rHeur. A node that was already settled is queued again, which
+** only happens under an inconsistent A* heuristic.
 */
-typedef struct DistanceInfo DistanceInfo;
-struct DistanceInfo {
-  sqlite3_int64 iNodeId;    /* Node ID */
-  double rDistance;         /* Distance from source */
-  sqlite3_int64 iPredecessor; /* Previous node in shortest path */
-  DistanceInfo *pNext;      /* Next in hash bucket */
-};
-
-typedef struct DistanceMap DistanceMap;
-struct DistanceMap {
-  DistanceInfo **aBuckets;  /* Hash table buckets */
-  int nBuckets;             /* Number of buckets */
-  int nEntries;             /* Number of entries */
-};
+static int pathSideRelax(PathSearchSide *pSide, int iNode, int iPred,
+                         double rDist, double rHeur){
+  if( SEEN_TEST(pSide->aSeen, iNode) ){
+    if( rDist>=pSide->aDist[iNode] ) return SQLITE_OK;
+  }else{
+    SEEN_SET(pSide->aSeen, iNode);
+    pSide->aPos[iNode] = -1;
+  }
+  pSide->aDist[iNode] = rDist;
+  pSide->aPred[iNode] = iPred;
+  return graphHeapUpdate(&pSide->heap, iNode, rDist + rHeur);
+}
 
 /*
-** Create distance map for tracking shortest paths.
+** Render the path through dense node iMeet as a JSON array of node ids:
+** aPred is walked from iMeet back to the start, then aBackPred, if not
+** NULL, from iMeet on to the end of a bidirectional search. Both arrays
+** end in -1. Returns NULL on OOM.
 */
-static DistanceMap *distanceMapCreate(int nExpectedNodes){
-  DistanceMap *pMap;
+static char *graphMeetPath(const CSRGraph *pCSR, const int *aPred,
+                           const int *aBackPred, int iMeet){
+  sqlite3_str *pStr;
+  int *aRev;
+  int nRev = 0;
+  int iCur;
   int i;
-  
-  pMap = sqlite3_malloc(sizeof(*pMap));
-  if( pMap==0 ){
-    return 0;
+
+  aRev = sqlite3_malloc64(sizeof(int)*pCSR->nNodes);
+  if( aRev==0 ) return 0;
+  for( iCur=iMeet; iCur>=0 && nRev<pCSR->nNodes; iCur=aPred[iCur] ){
+    aRev[nRev++] = iCur;
   }
-  
-  /* Use prime number of buckets */
-  pMap->nBuckets = nExpectedNodes * 2 + 1;
-  pMap->nEntries = 0;
-  pMap->aBuckets = sqlite3_malloc(pMap->nBuckets * sizeof(DistanceInfo*));
-  if( pMap->aBuckets==0 ){
-    sqlite3_free(pMap);
-    return 0;
+  pStr = sqlite3_str_new(0);
+  sqlite3_str_appendchar(pStr, 1, '[');
+  for( i=nRev-1; i>=0; i-- ){
+    sqlite3_str_appendf(pStr, "%s%lld", i==nRev-1 ? "" : ",",
+                        pCSR->aNodeIds[aRev[i]]);
   }
-  
-  for( i=0; i<pMap->nBuckets; i++ ){
-    pMap->aBuckets[i] = 0;
+  if( aBackPred ){
+    i = 0;
+    for( iCur=aBackPred[iMeet]; iCur>=0 && i<pCSR->nNodes;
+         iCur=aBackPred[iCur], i++ ){
+      sqlite3_str_appendf(pStr, ",%lld", pCSR->aNodeIds[iCur]);
+    }
   }
-  
-  return pMap;
+  sqlite3_str_appendchar(pStr, 1, ']');
+  sqlite3_free(aRev);
+  return sqlite3_str_finish(pStr);
 }
 
 /*
-** Destroy distance map and free all memory.
+** Walk a predecessor array from iEnd back to the source and render the
+** path. aPred[source] must be -1. Returns NULL on OOM.
 */
-static void distanceMapDestroy(DistanceMap *pMap){
-  int i;
-  DistanceInfo *pInfo, *pNext;
-  
-  if( pMap==0 ) return;
-  
-  for( i=0; i<pMap->nBuckets; i++ ){
-    pInfo = pMap->aBuckets[i];
-    while( pInfo ){
-      pNext = pInfo->pNext;
-      sqlite3_free(pInfo);
-      pInfo = pNext;
-    }
-  }
-  
-  sqlite3_free(pMap->aBuckets);
-  sqlite3_free(pMap);
+static char *graphPredecessorPath(const CSRGraph *pCSR, const int *aPred,
+                                  int iEnd){
+  return graphMeetPath(pCSR, aPred, 0, iEnd);
 }
 
 /*
-** Set distance for a node in the map.
+** Bidirectional Dijkstra between dense nodes iStart and iEnd. A forward
+** search over out-edges and a backward search over in-edges each settle
+** their closest node in turn, whichever is closer, and every edge that
+** reaches a node seen by the other side offers a candidate path. The
+** search stops once the two closest unsettled distances add up to no
+** less than the best candidate, which on road-like graphs happens after
+** settling roughly two balls of half the path length instead of one of
+** the full length.
 */
-static int distanceMapSet(DistanceMap *pMap, sqlite3_int64 iNodeId,
-                         double rDistance, sqlite3_int64 iPredecessor){
-  int iBucket = (int)(iNodeId % pMap->nBuckets);
-  DistanceInfo *pInfo;
-  
-  /* Look for existing entry */
-  for( pInfo=pMap->aBuckets[iBucket]; pInfo; pInfo=pInfo->pNext ){
-    if( pInfo->iNodeId==iNodeId ){
-      pInfo->rDistance = rDistance;
-      pInfo->iPredecessor = iPredecessor;
-      return SQLITE_OK;
-    }
-  }
-  
-  /* Create new entry */
-  pInfo = sqlite3_malloc(sizeof(*pInfo));
-  if( pInfo==0 ){
-    return SQLITE_NOMEM;
+static int graphDijkstraBidirectional(const CSRGraph *pCSR, int iStart,
+                                      int iEnd, char **pzPath,
+                                      double *prDistance){
+  PathSearchSide aSide[2];
+  double rBest = DBL_MAX;
+  int iMeet = -1;
+  int rc;
+
+  memset(aSide, 0, sizeof(aSide));
+  rc = pathSideInit(&aSide[0], pCSR, 0);
+  if( rc==SQLITE_OK ) rc = pathSideInit(&aSide[1], pCSR, 1);
+  if( rc==SQLITE_OK ) rc = pathSideRelax(&aSide[0], iStart, -1, 0.0, 0.0);
+  if( rc==SQLITE_OK ) rc = pathSideRelax(&aSide[1], iEnd, -1, 0.0, 0.0);
+  if( iStart==iEnd ){
+    rBest = 0.0;
+    iMeet = iStart;
   }
-  
-  pInfo->iNodeId = iNodeId;
-  pInfo->rDistance = rDistance;
-  pInfo->iPredecessor = iPredecessor;
-  pInfo->pNext = pMap->aBuckets[iBucket];
-  pMap->aBuckets[iBucket] = pInfo;
-  pMap->nEntries++;
-  
-  return SQLITE_OK;
-}
 
-/*
-** Get distance for a node from the map.
-** Returns DBL_MAX if not found.
-*/
-static double distanceMapGet(DistanceMap *pMap, sqlite3_int64 iNodeId){
-  int iBucket = (int)(iNodeId % pMap->nBuckets);
-  DistanceInfo *pInfo;
-  
-  for( pInfo=pMap->aBuckets[iBucket]; pInfo; pInfo=pInfo->pNext ){
-    if( pInfo->iNodeId==iNodeId ){
-      return pInfo->rDistance;
+  while( rc==SQLITE_OK && aSide[0].heap.nUsed>0 && aSide[1].heap.nUsed>0 ){
+    double rFwd = graphHeapMinKey(&aSide[0].heap);
+    double rBack = graphHeapMinKey(&aSide[1].heap);
+    PathSearchSide *pSide = rFwd<=rBack ? &aSide[0] : &aSide[1];
+    PathSearchSide *pOther = rFwd<=rBack ? &aSide[1] : &aSide[0];
+    sqlite3_int64 iEdge;
+    double rDist;
+    int iNode;
+
+    if( rFwd+rBack>=rBest ) break;
+    iNode = graphHeapPop(&pSide->heap);
+    rDist = pSide->aDist[iNode];
+    for( iEdge=pSide->aOffset[iNode];
+         iEdge<pSide->aOffset[iNode+1] && rc==SQLITE_OK; iEdge++ ){
+      int iNext = pSide->aIndex[iEdge];
+      rc = pathSideRelax(pSide, iNext, iNode, rDist+pSide->aWeight[iEdge],
+                         0.0);
+      if( SEEN_TEST(pOther->aSeen, iNext)
+       && pSide->aDist[iNext]+pOther->aDist[iNext]<rBest ){
+        rBest = pSide->aDist[iNext] + pOther->aDist[iNext];
+        iMeet = iNext;
+      }
     }
   }
-  
-  return DBL_MAX;  /* Infinity for unvisited nodes */
-}
 
-/*
-** Get predecessor for a node from the map.
-** Returns -1 if not found.
-*/
-static sqlite3_int64 distanceMapGetPredecessor(DistanceMap *pMap, 
-                                               sqlite3_int64 iNodeId){
-  int iBucket = (int)(iNodeId % pMap->nBuckets);
-  DistanceInfo *pInfo;
-  
-  for( pInfo=pMap->aBuckets[iBucket]; pInfo; pInfo=pInfo->pNext ){
-    if( pInfo->iNodeId==iNodeId ){
-      return pInfo->iPredecessor;
+  if( rc==SQLITE_OK ){
+    if( iMeet<0 ){
+      rc = SQLITE_NOTFOUND;
+    }else{
+      *pzPath = graphMeetPath(pCSR, aSide[0].aPred, aSide[1].aPred, iMeet);
+      if( *pzPath==0 ){
+        rc = SQLITE_NOMEM;
+      }else if( prDistance ){
+        *prDistance = rBest;
+      }
     }
   }
-  
-  return -1;
+  pathSideClear(&aSide[0]);
+  pathSideClear(&aSide[1]);
+  return rc;
 }
 
 /*
 ** Dijkstra's shortest path algorithm implementation.
-** Time complexity: O((V + E) log V) with binary heap.
-** Memory allocation: Uses sqlite3_malloc() for distance map and heap.
+** Time complexity: O((V + E) log V) with the 4-ary heap.
+** Adjacency: Read from the CSR snapshot.
+** With iEndId>=0 the search is bidirectional and stops as soon as the
+** shortest path is known. With iEndId<0 *pzPath is a JSON object
+** mapping each reachable node id to its distance.
+** Returns SQLITE_NOTFOUND if either endpoint is unknown or iEndId is
+** unreachable.
 */
 int graphDijkstra(GraphVtab *pVtab, sqlite3_int64 iStartId, 
                   sqlite3_int64 iEndId, char **pzPath, double *prDistance){
-  GraphPriorityQueue *pQueue = 0;
-  DistanceMap *pDistances = 0;
-  sqlite3_int64 iCurrentId;
-  double rCurrentDist;
-  double rNewDist;
+  CSRGraph *pCSR = 0;
+  PathSearchSide side;
+  sqlite3_str *pStr;
+  int bFirst = 1;
+  int iStart, iEnd;
+  int i;
   int rc = SQLITE_OK;
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int nNodes = 0;
 
   assert( pVtab!=0 );
   assert( pzPath!=0 );
@@ -383,418 +371,982 @@ int graphDijkstra(GraphVtab *pVtab, sqlite3_int64 iStartId,
   *pzPath = 0;
   if( prDistance ) *prDistance = DBL_MAX;
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+
+  iStart = graphCSRIndexOf(pCSR, iStartId);
+  if( iStart<0 ) return SQLITE_NOTFOUND;
+  if( iEndId>=0 ){
+    iEnd = graphCSRIndexOf(pCSR, iEndId);
+    if( iEnd<0 ) return SQLITE_NOTFOUND;
+    return graphDijkstraBidirectional(pCSR, iStart, iEnd, pzPath, prDistance);
   }
-  sqlite3_finalize(pStmt);
 
-  pQueue = graphPriorityQueueCreate();
-  if( pQueue==0 ){
-    return SQLITE_NOMEM;
+  rc = pathSideInit(&side, pCSR, 0);
+  if( rc==SQLITE_OK ) rc = pathSideRelax(&side, iStart, -1, 0.0, 0.0);
+  while( rc==SQLITE_OK && side.heap.nUsed>0 ){
+    int iNode = graphHeapPop(&side.heap);
+    double rDist = side.aDist[iNode];
+    sqlite3_int64 iEdge;
+
+    for( iEdge=side.aOffset[iNode];
+         iEdge<side.aOffset[iNode+1] && rc==SQLITE_OK; iEdge++ ){
+      rc = pathSideRelax(&side, side.aIndex[iEdge], iNode,
+                         rDist+side.aWeight[iEdge], 0.0);
+    }
   }
-  
-  pDistances = distanceMapCreate(nNodes);
-  if( pDistances==0 ){
-    graphPriorityQueueDestroy(pQueue);
-    return SQLITE_NOMEM;
+
+  if( rc==SQLITE_OK ){
+    pStr = sqlite3_str_new(0);
+    sqlite3_str_appendchar(pStr, 1, '{');
+    for( i=0; i<pCSR->nNodes; i++ ){
+      if( !SEEN_TEST(side.aSeen, i) ) continue;
+      sqlite3_str_appendf(pStr, "%s\"%lld\":%.6f", bFirst ? "" : ",",
+                          pCSR->aNodeIds[i], side.aDist[i]);
+      bFirst = 0;
+    }
+    sqlite3_str_appendchar(pStr, 1, '}');
+    *pzPath = sqlite3_str_finish(pStr);
+    rc = *pzPath ? SQLITE_OK : SQLITE_NOMEM;
   }
-  
-  rc = distanceMapSet(pDistances, iStartId, 0.0, -1);
-  if( rc!=SQLITE_OK ){
-    goto dijkstra_cleanup;
+  pathSideClear(&side);
+  return rc;
+}
+
+/*
+** Set *ppCoords to a reference to the coordinates of every node of pCSR
+** read from the zXProperty and zYProperty properties. They are loaded
+** with one scan of the node table and published on the snapshot, so
+** repeated A* queries over the same coordinates pay for the scan once
+** per graph version. The arrays are filled before they are published
+** and never written after, so searches sharing the snapshot on other
+** threads only ever see complete ones. Nodes without numeric
+** coordinates get NaN.
+*/
+static int astarLoadCoords(GraphVtab *pVtab, CSRGraph *pCSR,
+                           const char *zXProperty, const char *zYProperty,
+                           CSRCoords **ppCoords){
+  CSRCoords *p;
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  int i;
+  int rc;
+
+  *ppCoords = graphCSRCoordsGet(pCSR, zXProperty, zYProperty);
+  if( *ppCoords ) return SQLITE_OK;
+
+  p = sqlite3_malloc(sizeof(*p));
+  if( p==0 ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(*p));
+  p->nRef = 1;
+  p->zX = sqlite3_mprintf("%s", zXProperty);
+  p->zY = sqlite3_mprintf("%s", zYProperty);
+  p->aX = sqlite3_malloc64(sizeof(double)*(pCSR->nNodes+1));
+  p->aY = sqlite3_malloc64(sizeof(double)*(pCSR->nNodes+1));
+  if( p->zX==0 || p->zY==0 || p->aX==0 || p->aY==0 ){
+    rc = SQLITE_NOMEM;
+    goto coords_failed;
   }
-  
-  rc = graphPriorityQueueInsert(pQueue, iStartId, 0.0);
-  if( rc!=SQLITE_OK ){
-    goto dijkstra_cleanup;
+  for( i=0; i<pCSR->nNodes; i++ ){
+    p->aX[i] = NAN;
+    p->aY[i] = NAN;
   }
-  
-  while( !graphPriorityQueueIsEmpty(pQueue) ){
-    rc = graphPriorityQueueExtractMin(pQueue, &iCurrentId, &rCurrentDist);
-    if( rc!=SQLITE_OK ){
-      break;
+
+  zSql = sqlite3_mprintf(
+      "SELECT id, json_extract(p, '$.' || ?1), json_extract(p, '$.' || ?2)"
+      " FROM (SELECT id, %s AS p FROM \"%w\")",
+      graphPropsExpr(pVtab), pVtab->zNodeTableName);
+  if( zSql==0 ){
+    rc = SQLITE_NOMEM;
+    goto coords_failed;
+  }
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) goto coords_failed;
+  sqlite3_bind_text(pStmt, 1, zXProperty, -1, SQLITE_STATIC);
+  sqlite3_bind_text(pStmt, 2, zYProperty, -1, SQLITE_STATIC);
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    int eX = sqlite3_column_type(pStmt, 1);
+    int eY = sqlite3_column_type(pStmt, 2);
+    int iNode;
+    if( (eX!=SQLITE_INTEGER && eX!=SQLITE_FLOAT)
+     || (eY!=SQLITE_INTEGER && eY!=SQLITE_FLOAT) ){
+      continue;
     }
-    
-    if( iEndId>=0 && iCurrentId==iEndId ){
+    iNode = graphCSRIndexOf(pCSR, sqlite3_column_int64(pStmt, 0));
+    if( iNode<0 ) continue;
+    p->aX[iNode] = sqlite3_column_double(pStmt, 1);
+    p->aY[iNode] = sqlite3_column_double(pStmt, 2);
+  }
+  rc = sqlite3_finalize(pStmt);
+  if( rc==SQLITE_OK ){
+    graphCSRCoordsSet(pCSR, p);
+    *ppCoords = p;
+    return SQLITE_OK;
+  }
+
+coords_failed:
+  graphCSRCoordsRelease(p);
+  return rc;
+}
+
+/*
+** A* search from iStartId to iEndId over out-edges. Nodes are ordered
+** by distance plus the straight-line distance from their coordinates,
+** the zXProperty and zYProperty properties, to those of the end node,
+** so the search heads towards the target instead of growing a ball
+** around the start. Nodes without numeric coordinates, or every node if
+** the end node has none, get no estimate and are searched as by
+** Dijkstra. The result is a shortest path as long as no edge weighs less
+** than the straight-line distance between its endpoints.
+** Returns SQLITE_NOTFOUND if either endpoint is unknown or iEndId is
+** unreachable.
+*/
+int graphAStar(GraphVtab *pVtab, sqlite3_int64 iStartId, sqlite3_int64 iEndId,
+               const char *zXProperty, const char *zYProperty,
+               char **pzPath, double *prDistance){
+  CSRGraph *pCSR = 0;
+  CSRCoords *pCoords = 0;
+  PathSearchSide side;
+  double rEndX, rEndY;
+  const double *aX, *aY;
+  int bHeuristic;
+  int bFound = 0;
+  int iStart, iEnd;
+  int rc;
+
+  assert( pVtab!=0 );
+  assert( pzPath!=0 );
+
+  *pzPath = 0;
+  if( prDistance ) *prDistance = DBL_MAX;
+
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  iStart = graphCSRIndexOf(pCSR, iStartId);
+  iEnd = graphCSRIndexOf(pCSR, iEndId);
+  if( iStart<0 || iEnd<0 ) return SQLITE_NOTFOUND;
+
+  rc = astarLoadCoords(pVtab, pCSR, zXProperty, zYProperty, &pCoords);
+  if( rc!=SQLITE_OK ) return rc;
+  aX = pCoords->aX;
+  aY = pCoords->aY;
+  rEndX = aX[iEnd];
+  rEndY = aY[iEnd];
+  bHeuristic = !isnan(rEndX);
+
+  rc = pathSideInit(&side, pCSR, 0);
+  if( rc==SQLITE_OK ) rc = pathSideRelax(&side, iStart, -1, 0.0, 0.0);
+  while( rc==SQLITE_OK && side.heap.nUsed>0 ){
+    int iNode = graphHeapPop(&side.heap);
+    double rDist = side.aDist[iNode];
+    sqlite3_int64 iEdge;
+
+    if( iNode==iEnd ){
+      bFound = 1;
       break;
     }
-    
-    if( rCurrentDist > distanceMapGet(pDistances, iCurrentId) ){
-      continue;
-    }
-    
-    zSql = sqlite3_mprintf("SELECT to_id, weight FROM %s_edges WHERE from_id = %lld", pVtab->zTableName, iCurrentId);
-    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) continue;
-
-    while( sqlite3_step(pStmt)==SQLITE_ROW ){
-      sqlite3_int64 to_id = sqlite3_column_int64(pStmt, 0);
-      double weight = sqlite3_column_double(pStmt, 1);
-      rNewDist = rCurrentDist + weight;
-      
-      if( rNewDist < distanceMapGet(pDistances, to_id) ){
-        rc = distanceMapSet(pDistances, to_id, rNewDist, iCurrentId);
-        if( rc!=SQLITE_OK ){
-          sqlite3_finalize(pStmt);
-          goto dijkstra_cleanup;
-        }
-        
-        rc = graphPriorityQueueInsert(pQueue, to_id, rNewDist);
-        if( rc!=SQLITE_OK ){
-          sqlite3_finalize(pStmt);
-          goto dijkstra_cleanup;
-        }
+    for( iEdge=side.aOffset[iNode];
+         iEdge<side.aOffset[iNode+1] && rc==SQLITE_OK; iEdge++ ){
+      int iNext = side.aIndex[iEdge];
+      double rHeur = 0.0;
+
+      if( bHeuristic && !isnan(aX[iNext]) ){
+        double rDx = aX[iNext] - rEndX;
+        double rDy = aY[iNext] - rEndY;
+        rHeur = sqrt(rDx*rDx + rDy*rDy);
       }
+      rc = pathSideRelax(&side, iNext, iNode, rDist+side.aWeight[iEdge],
+                         rHeur);
     }
-    sqlite3_finalize(pStmt);
   }
-  
-  if( iEndId>=0 ){
-    double rFinalDist = distanceMapGet(pDistances, iEndId);
-    if( rFinalDist < DBL_MAX ){
-      sqlite3_int64 *aPath = 0;
-      int nPath = 0;
-      sqlite3_int64 iCurrent = iEndId;
-      char *zPath = 0;
-      int i;
-      
-      while( iCurrent != -1 ){
-        nPath++;
-        if( iCurrent == iStartId ) break;
-        iCurrent = distanceMapGetPredecessor(pDistances, iCurrent);
-      }
-      
-      aPath = sqlite3_malloc(nPath * sizeof(sqlite3_int64));
-      if( aPath==0 ){
+
+  if( rc==SQLITE_OK ){
+    if( bFound ){
+      *pzPath = graphPredecessorPath(pCSR, side.aPred, iEnd);
+      if( *pzPath==0 ){
         rc = SQLITE_NOMEM;
-        goto dijkstra_cleanup;
-      }
-      
-      iCurrent = iEndId;
-      for( i=nPath-1; i>=0; i-- ){
-        aPath[i] = iCurrent;
-        if( iCurrent == iStartId ) break;
-        iCurrent = distanceMapGetPredecessor(pDistances, iCurrent);
+      }else if( prDistance ){
+        *prDistance = side.aDist[iEnd];
       }
-      
-      zPath = sqlite3_mprintf("[");
-      for( i=0; i<nPath && zPath; i++ ){
-        char *zNew;
-        if( i==0 ){
-          zNew = sqlite3_mprintf("%s%lld", zPath, aPath[i]);
-        } else {
-          zNew = sqlite3_mprintf("%s,%lld", zPath, aPath[i]);
+    }else{
+      rc = SQLITE_NOTFOUND;
+    }
+  }
+  pathSideClear(&side);
+  graphCSRCoordsRelease(pCoords);
+  return rc;
+}
+
+/*
+** One direction of a bidirectional BFS: its visited set, the BFS tree
+** and the queue of reached nodes, whose last level is the frontier.
+** As with PathSearchSide, aPred and aDepth are only valid for nodes
+** marked in aSeen.
+*/
+typedef struct BFSSide BFSSide;
+struct BFSSide {
+  const sqlite3_int64 *aOffset;  /* Adjacency offsets, out or in */
+  const int *aIndex;             /* Adjacent dense indices */
+  unsigned char *aSeen;          /* Bitmap: node reached */
+  int *aPred;                    /* BFS parent, -1 at the root */
+  int *aDepth;                   /* Hops from the root */
+  int *aQueue;                   /* Reached nodes in level order */
+  int iHead;                     /* First frontier entry in aQueue */
+  int iTail;                     /* One past the last entry */
+  sqlite3_int64 nFrontierEdges;  /* Edges leaving the frontier */
+};
+
+static int bfsSideInit(BFSSide *pSide, const CSRGraph *pCSR, int bReverse,
+                       int iRoot){
+  int n = pCSR->nNodes;
+
+  memset(pSide, 0, sizeof(*pSide));
+  pSide->aOffset = bReverse ? pCSR->inOffsets : pCSR->rowOffsets;
+  pSide->aIndex = bReverse ? pCSR->inIndices : pCSR->columnIndices;
+  pSide->aSeen = sqlite3_malloc64(SEEN_BYTES(n));
+  pSide->aPred = sqlite3_malloc64(sizeof(int)*n);
+  pSide->aDepth = sqlite3_malloc64(sizeof(int)*n);
+  pSide->aQueue = sqlite3_malloc64(sizeof(int)*n);
+  if( pSide->aSeen==0 || pSide->aPred==0 || pSide->aDepth==0
+   || pSide->aQueue==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pSide->aSeen, 0, SEEN_BYTES(n));
+  SEEN_SET(pSide->aSeen, iRoot);
+  pSide->aPred[iRoot] = -1;
+  pSide->aDepth[iRoot] = 0;
+  pSide->aQueue[pSide->iTail++] = iRoot;
+  pSide->nFrontierEdges = pSide->aOffset[iRoot+1] - pSide->aOffset[iRoot];
+  return SQLITE_OK;
+}
+
+static void bfsSideClear(BFSSide *pSide){
+  sqlite3_free(pSide->aSeen);
+  sqlite3_free(pSide->aPred);
+  sqlite3_free(pSide->aDepth);
+  sqlite3_free(pSide->aQueue);
+}
+
+/*
+** Bidirectional BFS between dense nodes iStart and iEnd. Each
+** step expands one whole level of whichever side has fewer edges
+** leaving its frontier, forward over out-edges or backward over
+** in-edges. The level that first reaches a node seen by the other side
+** is finished and the shortest of the paths it closes is returned, so a
+** path of length d costs two searches of depth about d/2 instead of one
+** of depth d.
+*/
+static int graphBidirectionalBFS(const CSRGraph *pCSR, int iStart, int iEnd,
+                                 char **pzPath){
+  BFSSide aSide[2];
+  int nBest = INT_MAX;
+  int iMeet = -1;
+  int rc;
+
+  memset(aSide, 0, sizeof(aSide));
+  rc = bfsSideInit(&aSide[0], pCSR, 0, iStart);
+  if( rc==SQLITE_OK ) rc = bfsSideInit(&aSide[1], pCSR, 1, iEnd);
+  if( iStart==iEnd ) iMeet = iStart;
+
+  while( rc==SQLITE_OK && iMeet<0
+      && aSide[0].iHead<aSide[0].iTail && aSide[1].iHead<aSide[1].iTail ){
+    int bBack = aSide[1].nFrontierEdges<aSide[0].nFrontierEdges;
+    BFSSide *pSide = &aSide[bBack];
+    BFSSide *pOther = &aSide[!bBack];
+    int iLevelEnd = pSide->iTail;
+    int nDepth = pSide->aDepth[pSide->aQueue[pSide->iHead]] + 1;
+    sqlite3_int64 nEdges = 0;
+    int i;
+
+    for( i=pSide->iHead; i<iLevelEnd; i++ ){
+      int iNode = pSide->aQueue[i];
+      sqlite3_int64 iEdge;
+
+      for( iEdge=pSide->aOffset[iNode]; iEdge<pSide->aOffset[iNode+1]; iEdge++ ){
+        int iNext = pSide->aIndex[iEdge];
+        if( SEEN_TEST(pSide->aSeen, iNext) ) continue;
+        SEEN_SET(pSide->aSeen, iNext);
+        pSide->aPred[iNext] = iNode;
+        pSide->aDepth[iNext] = nDepth;
+        pSide->aQueue[pSide->iTail++] = iNext;
+        nEdges += pSide->aOffset[iNext+1] - pSide->aOffset[iNext];
+        if( SEEN_TEST(pOther->aSeen, iNext)
+         && nDepth+pOther->aDepth[iNext]<nBest ){
+          nBest = nDepth + pOther->aDepth[iNext];
+          iMeet = iNext;
         }
-        sqlite3_free(zPath);
-        zPath = zNew;
-      }
-      
-      if( zPath ){
-        char *zNew = sqlite3_mprintf("%s]", zPath);
-        sqlite3_free(zPath);
-        *pzPath = zNew;
       }
-      
-      sqlite3_free(aPath);
-      
-      if( *pzPath==0 ){
-        rc = SQLITE_NOMEM;
-      } else if( prDistance ){
-        *prDistance = rFinalDist;
-      }
-    } else {
+    }
+    pSide->iHead = iLevelEnd;
+    pSide->nFrontierEdges = nEdges;
+  }
+
+  if( rc==SQLITE_OK ){
+    if( iMeet<0 ){
       rc = SQLITE_NOTFOUND;
+    }else{
+      *pzPath = graphMeetPath(pCSR, aSide[0].aPred, aSide[1].aPred, iMeet);
+      rc = *pzPath ? SQLITE_OK : SQLITE_NOMEM;
     }
-  } else {
-    *pzPath = sqlite3_mprintf("{}");
-    rc = *pzPath ? SQLITE_OK : SQLITE_NOMEM;
   }
-  
-dijkstra_cleanup:
-  graphPriorityQueueDestroy(pQueue);
-  distanceMapDestroy(pDistances);
-  
+  bfsSideClear(&aSide[0]);
+  bfsSideClear(&aSide[1]);
   return rc;
 }
 
 /*
 ** Shortest path for unweighted graphs using BFS.
 ** More efficient than Dijkstra for unweighted graphs: O(V + E).
+** With iEndId<0 this is a plain BFS listing every reachable node. A
+** point-to-point search in GRAPH_BFS_AUTO mode is bidirectional; the
+** other modes run the one-sided direction-optimizing BFS.
+** Returns SQLITE_NOTFOUND if an endpoint is unknown or unreachable.
 */
 int graphShortestPathUnweighted(GraphVtab *pVtab, sqlite3_int64 iStartId,
-                                sqlite3_int64 iEndId, char **pzPath){
-  /* Use BFS which naturally finds shortest paths in unweighted graphs */
-  /* For now, call graphBFS which already implements this */
-  extern int graphBFS(GraphVtab*, sqlite3_int64, int, char**);
-  
-  /* BFS implementation that finds shortest path to specific destination */
-  /* The BFS function already supports finding paths, just need to pass destination */
-  /* For now, call BFS with full traversal and extract path to destination */
-  return graphBFS(pVtab, iStartId, -1, pzPath);
+                                sqlite3_int64 iEndId, int eMode,
+                                char **pzPath){
+  CSRGraph *pCSR = 0;
+  int *aQueue = 0;
+  int *aPred = 0;
+  int nQueue = 0;
+  int iStart, iEnd;
+  int i;
+  int rc;
+
+  assert( pVtab!=0 );
+  assert( pzPath!=0 );
+  *pzPath = 0;
+
+  if( iEndId<0 ){
+    return graphBFS(pVtab, iStartId, -1, eMode, pzPath);
+  }
+
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  iStart = graphCSRIndexOf(pCSR, iStartId);
+  iEnd = graphCSRIndexOf(pCSR, iEndId);
+  if( iStart<0 || iEnd<0 ) return SQLITE_NOTFOUND;
+  if( eMode==GRAPH_BFS_AUTO ){
+    return graphBidirectionalBFS(pCSR, iStart, iEnd, pzPath);
+  }
+
+  aQueue = sqlite3_malloc64(sizeof(int)*pCSR->nNodes);
+  aPred = sqlite3_malloc64(sizeof(int)*pCSR->nNodes);
+  if( aQueue==0 || aPred==0 ){
+    rc = SQLITE_NOMEM;
+    goto sp_cleanup;
+  }
+
+  /* aPred is only written for reached nodes; -2 marks the rest */
+  for(i=0; i<pCSR->nNodes; i++) aPred[i] = -2;
+  rc = graphCSRBFS(pCSR, iStart, iEnd, -1, eMode, aQueue, &nQueue, aPred);
+  if( rc==SQLITE_OK ){
+    if( aPred[iEnd]!=-2 ){
+      *pzPath = graphPredecessorPath(pCSR, aPred, iEnd);
+      rc = *pzPath ? SQLITE_OK : SQLITE_NOMEM;
+    }else{
+      rc = SQLITE_NOTFOUND;
+    }
+  }
+
+sp_cleanup:
+  sqlite3_free(aQueue);
+  sqlite3_free(aPred);
+  return rc;
+}
+
+/*
+** One PageRank work unit: the dense node range [iFirst, iLast).
+** Phase 0 computes out-contributions for the range; phase 1 pulls the
+** new ranks for it from in-edges and records the largest change.
+*/
+typedef struct PageRankTask PageRankTask;
+struct PageRankTask {
+  const CSRGraph *pCSR;
+  double *aPageRank;          /* Current ranks (shared, read-only) */
+  double *aNewPageRank;       /* Next ranks (shared, range-private) */
+  double *aContrib;           /* Rank / out-degree (shared) */
+  double rDamping;
+  int iFirst, iLast;          /* Dense node range */
+  int ePhase;                 /* 0: contributions, 1: pull */
+  double rMaxDiff;            /* Out: largest change in phase 1 */
+};
+
+static void pageRankWorker(void *pArg){
+  PageRankTask *p = (PageRankTask*)pArg;
+  const CSRGraph *pCSR = p->pCSR;
+  int nNodes = pCSR->nNodes;
+  int i;
+
+  if( p->ePhase==0 ){
+    for( i=p->iFirst; i<p->iLast; i++ ){
+      int nOut = graphCSROutDegree(pCSR, i);
+      p->aContrib[i] = nOut>0 ? p->aPageRank[i] / nOut : 0.0;
+    }
+    return;
+  }
+
+  p->rMaxDiff = 0.0;
+  for( i=p->iFirst; i<p->iLast; i++ ){
+    sqlite3_int64 iEdge;
+    double rSum = 0.0;
+    double rDiff;
+    for( iEdge=pCSR->inOffsets[i]; iEdge<pCSR->inOffsets[i+1]; iEdge++ ){
+      rSum += p->aContrib[pCSR->inIndices[iEdge]];
+    }
+    p->aNewPageRank[i] = (1.0 - p->rDamping) / nNodes + p->rDamping * rSum;
+    rDiff = fabs(p->aNewPageRank[i] - p->aPageRank[i]);
+    if( rDiff > p->rMaxDiff ){
+      p->rMaxDiff = rDiff;
+    }
+  }
 }
 
 /*
 ** PageRank algorithm implementation.
 ** Iterative algorithm with configurable damping factor.
+** Pull formulation over CSR in-edges: each node sums the contributions
+** of its in-neighbours, so every iteration is one pass over E.
+** Parallelism: Nodes are split into ranges of similar in-edge volume;
+**              each range is written by exactly one task, so results do
+**              not depend on the thread count.
 ** Convergence: Stops when change between iterations < epsilon.
+** Progress: With pProgress, iterations are counted there against
+**           nMaxIter, and a cancelled run stops with SQLITE_INTERRUPT.
 */
-int graphPageRank(GraphVtab *pVtab, double rDamping, int nMaxIter, 
-                  double rEpsilon, char **pzResults){
+int graphPageRankScores(const CSRGraph *pCSR, double rDamping, int nMaxIter,
+                        double rEpsilon, int nThreads, CSRProgress *pProgress,
+                        double **paScore){
+  TaskScheduler *pScheduler = 0;
+  PageRankTask *aTask = 0;    /* One per node range */
+  void **apTask = 0;
+  int nTask = 1;
   double *aPageRank = 0;      /* Current PageRank values */
   double *aNewPageRank = 0;   /* New PageRank values for iteration */
-  int *aOutDegree = 0;        /* Out-degree for each node */
-  int nNodes = 0;
+  double *aContrib = 0;       /* PageRank / out-degree per node */
+  int nNodes;
   int nIter;
   int i;
-  double rDiff;
   int rc = SQLITE_OK;
-  char *zSql;
-  sqlite3_stmt *pStmt;
 
-  assert( pVtab!=0 );
-  assert( pzResults!=0 );
-
-  *pzResults = 0;
+  assert( pCSR!=0 );
+  assert( paScore!=0 );
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
+  *paScore = 0;
+  nNodes = pCSR->nNodes;
+  if( pProgress ) __atomic_store_n(&pProgress->nTotal, nMaxIter, __ATOMIC_RELAXED);
   
   if( nNodes==0 ){
-    *pzResults = sqlite3_mprintf("{}");
-    return *pzResults ? SQLITE_OK : SQLITE_NOMEM;
+    *paScore = sqlite3_malloc(sizeof(double));
+    return *paScore ? SQLITE_OK : SQLITE_NOMEM;
   }
   
-  aPageRank = sqlite3_malloc(sizeof(double) * (nNodes + 1));
-  aNewPageRank = sqlite3_malloc(sizeof(double) * (nNodes + 1));
-  aOutDegree = sqlite3_malloc(sizeof(int) * (nNodes + 1));
+  aPageRank = sqlite3_malloc64(sizeof(double) * nNodes);
+  aNewPageRank = sqlite3_malloc64(sizeof(double) * nNodes);
+  aContrib = sqlite3_malloc64(sizeof(double) * nNodes);
   
-  if( !aPageRank || !aNewPageRank || !aOutDegree ){
+  if( !aPageRank || !aNewPageRank || !aContrib ){
     rc = SQLITE_NOMEM;
     goto pagerank_cleanup;
   }
-  
-  for( i=0; i<=nNodes; i++ ){
-    aPageRank[i] = 1.0 / nNodes;
-    aOutDegree[i] = 0;
+
+  if( nThreads!=1 ){
+    pScheduler = graphCreateTaskScheduler(nThreads);
+    if( pScheduler==0 ){
+      rc = SQLITE_NOMEM;
+      goto pagerank_cleanup;
+    }
+    /* A few ranges per thread smooths out skewed in-degrees */
+    nTask = pScheduler->nThreads * 4;
+    if( nTask>nNodes ) nTask = nNodes;
+  }
+  aTask = sqlite3_malloc64(sizeof(PageRankTask) * nTask);
+  apTask = sqlite3_malloc64(sizeof(void*) * nTask);
+  if( !aTask || !apTask ){
+    rc = SQLITE_NOMEM;
+    goto pagerank_cleanup;
+  }
+
+  /* Cut ranges so each covers about the same nodes + in-edges */
+  {
+    sqlite3_int64 nWork = (sqlite3_int64)nNodes + pCSR->nEdges;
+    int iNode = 0;
+    for( i=0; i<nTask; i++ ){
+      sqlite3_int64 nTarget = nWork * (i+1) / nTask;
+      aTask[i].pCSR = pCSR;
+      aTask[i].rDamping = rDamping;
+      aTask[i].iFirst = iNode;
+      while( iNode<nNodes && (iNode + pCSR->inOffsets[iNode])<nTarget ){
+        iNode++;
+      }
+      if( i==nTask-1 ) iNode = nNodes;
+      aTask[i].iLast = iNode;
+      apTask[i] = &aTask[i];
+    }
   }
   
-  zSql = sqlite3_mprintf("SELECT from_id, count(*) FROM %s_edges GROUP BY from_id", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    aOutDegree[sqlite3_column_int(pStmt, 0)] = sqlite3_column_int(pStmt, 1);
+  for( i=0; i<nNodes; i++ ){
+    aPageRank[i] = 1.0 / nNodes;
   }
-  sqlite3_finalize(pStmt);
   
   for( nIter=0; nIter<nMaxIter; nIter++ ){
     double rMaxDiff = 0.0;
+    double *aSwap;
+    int ePhase;
     
-    for( i=0; i<=nNodes; i++ ){
-      aNewPageRank[i] = (1.0 - rDamping) / nNodes;
-    }
-    
-    zSql = sqlite3_mprintf("SELECT from_id, to_id FROM %s_edges", pVtab->zTableName);
-    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    while( sqlite3_step(pStmt)==SQLITE_ROW ){
-      int from = sqlite3_column_int(pStmt, 0);
-      int to = sqlite3_column_int(pStmt, 1);
-      if( aOutDegree[from]>0 ){
-        aNewPageRank[to] += rDamping * aPageRank[from] / aOutDegree[from];
+    for( ePhase=0; ePhase<2; ePhase++ ){
+      for( i=0; i<nTask; i++ ){
+        aTask[i].aPageRank = aPageRank;
+        aTask[i].aNewPageRank = aNewPageRank;
+        aTask[i].aContrib = aContrib;
+        aTask[i].ePhase = ePhase;
       }
+      rc = graphRunTasks(pScheduler, pageRankWorker, apTask, nTask);
+      if( rc!=SQLITE_OK ) goto pagerank_cleanup;
     }
-    sqlite3_finalize(pStmt);
-    
-    for( i=0; i<=nNodes; i++ ){
-      rDiff = fabs(aNewPageRank[i] - aPageRank[i]);
-      if( rDiff > rMaxDiff ){
-        rMaxDiff = rDiff;
+    for( i=0; i<nTask; i++ ){
+      if( aTask[i].rMaxDiff > rMaxDiff ){
+        rMaxDiff = aTask[i].rMaxDiff;
       }
-      aPageRank[i] = aNewPageRank[i];
     }
     
+    aSwap = aPageRank;
+    aPageRank = aNewPageRank;
+    aNewPageRank = aSwap;
+    
     if( rMaxDiff < rEpsilon ){
       break;
     }
-  }
-  
-  *pzResults = sqlite3_mprintf("{");
-  zSql = sqlite3_mprintf("SELECT id FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  int bFirst = 1;
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    char *zNew;
-    if( !bFirst ){
-        *pzResults = sqlite3_mprintf("%s,", *pzResults);
+    if( pProgress ){
+      __atomic_store_n(&pProgress->nDone, nIter+1, __ATOMIC_RELAXED);
+      if( __atomic_load_n(&pProgress->bCancel, __ATOMIC_RELAXED) ){
+        rc = SQLITE_INTERRUPT;
+        goto pagerank_cleanup;
+      }
     }
-    bFirst = 0;
-    int iNodeId = sqlite3_column_int(pStmt, 0);
-    zNew = sqlite3_mprintf("%s\"%d\":%.6f", *pzResults, iNodeId, aPageRank[iNodeId]);
-    sqlite3_free(*pzResults);
-    *pzResults = zNew;
   }
-  sqlite3_finalize(pStmt);
-  
-  if( *pzResults ){
-    char *zNew = sqlite3_mprintf("%s}", *pzResults);
-    sqlite3_free(*pzResults);
-    *pzResults = zNew;
-  }
-  
-  if( *pzResults==0 ){
-    rc = SQLITE_NOMEM;
+  if( pProgress ){
+    __atomic_store_n(&pProgress->nDone, nMaxIter, __ATOMIC_RELAXED);
   }
+  *paScore = aPageRank;
+  aPageRank = 0;
   
 pagerank_cleanup:
+  graphDestroyTaskScheduler(pScheduler);
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
   sqlite3_free(aPageRank);
   sqlite3_free(aNewPageRank);
-  sqlite3_free(aOutDegree);
+  sqlite3_free(aContrib);
   
   return rc;
 }
 
-int graphTotalDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId){
-  return graphInDegree(pVtab, iNodeId) + graphOutDegree(pVtab, iNodeId);
+int graphPageRankCSR(const CSRGraph *pCSR, double rDamping, int nMaxIter,
+                     double rEpsilon, int nThreads, char **pzResults){
+  double *aPageRank = 0;
+  sqlite3_str *pStr;
+  int i;
+  int rc;
+
+  assert( pzResults!=0 );
+  *pzResults = 0;
+  rc = graphPageRankScores(pCSR, rDamping, nMaxIter, rEpsilon, nThreads, 0,
+                           &aPageRank);
+  if( rc!=SQLITE_OK ) return rc;
+
+  pStr = sqlite3_str_new(0);
+  sqlite3_str_appendchar(pStr, 1, '{');
+  for( i=0; i<pCSR->nNodes; i++ ){
+    sqlite3_str_appendf(pStr, "%s\"%lld\":%.6f", i ? "," : "",
+                        pCSR->aNodeIds[i], aPageRank[i]);
+  }
+  sqlite3_str_appendchar(pStr, 1, '}');
+  *pzResults = sqlite3_str_finish(pStr);
+  sqlite3_free(aPageRank);
+  return *pzResults ? SQLITE_OK : SQLITE_NOMEM;
 }
 
-int graphInDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId){
-  char *zSql;
-  sqlite3_stmt *pStmt;
+int graphPageRank(GraphVtab *pVtab, double rDamping, int nMaxIter, 
+                  double rEpsilon, int nThreads, char **pzResults){
+  CSRGraph *pCSR = 0;
   int rc;
-  int nInDegree = 0;
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges WHERE to_id = %lld", pVtab->zTableName, iNodeId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nInDegree = sqlite3_column_int(pStmt, 0);
+  assert( pVtab!=0 );
+  *pzResults = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  return graphPageRankCSR(pCSR, rDamping, nMaxIter, rEpsilon, nThreads,
+                          pzResults);
+}
+
+/*
+** Personalized PageRank by forward push (Andersen, Chung and Lang). Every
+** touched node keeps an estimate p and a residual r; pushing node u moves
+** alpha*r(u) into p(u) and spreads the rest evenly over its out-edges, or
+** back over the seeds if it has none. Nodes are pushed while r(u) exceeds
+** epsilon * outdeg(u), so the work is O(1 / (alpha * epsilon)) whatever
+** the size of the graph, and state is kept only for touched nodes, in an
+** open-addressing table keyed by dense index.
+*/
+typedef struct PprNode PprNode;
+struct PprNode {
+  sqlite3_int64 iNodeId;    /* Node id */
+  int iNode;                /* Dense node index */
+  int nOut;                 /* Out-degree */
+  int bQueued;              /* On the next round's list */
+  double rEstimate;         /* p */
+  double rResidual;         /* r */
+};
+
+typedef struct PprState PprState;
+struct PprState {
+  const CSRView *pView;
+  PprNode *aNode;           /* Touched nodes, in touch order */
+  int nNode, nNodeAlloc;
+  int *aHash;               /* Slot -> aNode index, -1 if empty */
+  int nHashMask;            /* Table size - 1, a power of two */
+  int *aQueue;              /* aNode indices to push next round */
+  int nQueue;
+};
+
+/* Index of dense node iNode in p->aNode, adding it if absent */
+static int pprTouch(PprState *p, int iNode, int *piSlot){
+  unsigned int h;
+
+  if( 2*(p->nNode+1) > p->nHashMask+1 ){
+    int nHash = (p->nHashMask+1)*2;
+    int *aHash = sqlite3_malloc64(sizeof(int)*nHash);
+    int i;
+    if( aHash==0 ) return SQLITE_NOMEM;
+    memset(aHash, 0xff, sizeof(int)*nHash);
+    for(i=0; i<p->nNode; i++){
+      h = ((unsigned int)p->aNode[i].iNode * 2654435761u) & (nHash-1);
+      while( aHash[h]>=0 ) h = (h+1) & (nHash-1);
+      aHash[h] = i;
+    }
+    sqlite3_free(p->aHash);
+    p->aHash = aHash;
+    p->nHashMask = nHash-1;
   }
-  sqlite3_finalize(pStmt);
-  return nInDegree;
+
+  h = ((unsigned int)iNode * 2654435761u) & p->nHashMask;
+  while( p->aHash[h]>=0 ){
+    if( p->aNode[p->aHash[h]].iNode==iNode ){
+      *piSlot = p->aHash[h];
+      return SQLITE_OK;
+    }
+    h = (h+1) & p->nHashMask;
+  }
+  if( p->nNode>=p->nNodeAlloc ){
+    int nNew = p->nNodeAlloc*2;
+    PprNode *aNew = sqlite3_realloc64(p->aNode, sizeof(PprNode)*nNew);
+    int *aQueue = sqlite3_realloc64(p->aQueue, sizeof(int)*nNew);
+    if( aNew ) p->aNode = aNew;
+    if( aQueue ) p->aQueue = aQueue;
+    if( aNew==0 || aQueue==0 ) return SQLITE_NOMEM;
+    p->nNodeAlloc = nNew;
+  }
+  memset(&p->aNode[p->nNode], 0, sizeof(PprNode));
+  p->aNode[p->nNode].iNodeId = graphCSRViewNodeId(p->pView, iNode);
+  p->aNode[p->nNode].iNode = iNode;
+  p->aNode[p->nNode].nOut = graphCSRViewDegree(p->pView, iNode, 0);
+  p->aHash[h] = p->nNode;
+  *piSlot = p->nNode++;
+  return SQLITE_OK;
 }
 
-int graphOutDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId){
-  char *zSql;
+/* Add rMass to the residual of dense node iNode, queueing it if needed */
+static int pprAdd(PprState *p, int iNode, double rMass, double rEpsilon){
+  PprNode *pNode;
+  int iSlot;
+  int rc = pprTouch(p, iNode, &iSlot);
+
+  if( rc!=SQLITE_OK ) return rc;
+  pNode = &p->aNode[iSlot];
+  pNode->rResidual += rMass;
+  if( !pNode->bQueued
+   && pNode->rResidual > rEpsilon*(pNode->nOut ? pNode->nOut : 1) ){
+    pNode->bQueued = 1;
+    p->aQueue[p->nQueue++] = iSlot;
+  }
+  return SQLITE_OK;
+}
+
+/* Descending estimate, then ascending node id */
+static int pprCmp(const void *pA, const void *pB){
+  const PprNode *a = (const PprNode*)pA;
+  const PprNode *b = (const PprNode*)pB;
+  if( a->rEstimate!=b->rEstimate ) return a->rEstimate<b->rEstimate ? 1 : -1;
+  return a->iNodeId<b->iNodeId ? -1 : a->iNodeId>b->iNodeId;
+}
+
+int graphPersonalizedPageRank(const CSRView *pView, const int *aSeed,
+                              int nSeed, double rAlpha, double rEpsilon,
+                              int nTopK, sqlite3_int64 **paNodeId,
+                              double **paScore, int *pnResult){
+  PprState s;
+  int *aRound = 0;            /* The round being pushed */
+  int nResult, i;
+  int rc = SQLITE_OK;
+
+  assert( nSeed>0 && rAlpha>0.0 && rAlpha<=1.0 && rEpsilon>0.0 );
+  *paNodeId = 0;
+  *paScore = 0;
+  *pnResult = 0;
+
+  memset(&s, 0, sizeof(s));
+  s.pView = pView;
+  s.nNodeAlloc = 64;
+  s.nHashMask = 127;
+  s.aNode = sqlite3_malloc64(sizeof(PprNode)*s.nNodeAlloc);
+  s.aQueue = sqlite3_malloc64(sizeof(int)*s.nNodeAlloc);
+  s.aHash = sqlite3_malloc64(sizeof(int)*(s.nHashMask+1));
+  if( s.aNode==0 || s.aQueue==0 || s.aHash==0 ){
+    rc = SQLITE_NOMEM;
+    goto ppr_cleanup;
+  }
+  memset(s.aHash, 0xff, sizeof(int)*(s.nHashMask+1));
+
+  for(i=0; i<nSeed && rc==SQLITE_OK; i++){
+    rc = pprAdd(&s, aSeed[i], 1.0/nSeed, rEpsilon);
+  }
+
+  /* Push in rounds: the nodes queued by one round make up the next. A
+  ** node queued again while its round runs is pushed with the mass it
+  ** has by then */
+  while( rc==SQLITE_OK && s.nQueue>0 ){
+    int nRound = s.nQueue;
+    int *aNew = sqlite3_realloc64(aRound, sizeof(int)*nRound);
+    if( aNew==0 ){
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    aRound = aNew;
+    memcpy(aRound, s.aQueue, sizeof(int)*nRound);
+    s.nQueue = 0;
+    for(i=0; i<nRound && rc==SQLITE_OK; i++){
+      PprNode *pNode = &s.aNode[aRound[i]];
+      double rMass = pNode->rResidual;
+      int nOut = pNode->nOut;
+      int iNode = pNode->iNode;
+
+      pNode->bQueued = 0;
+      pNode->rResidual = 0.0;
+      pNode->rEstimate += rAlpha*rMass;
+      rMass *= 1.0 - rAlpha;
+      if( nOut>0 ){
+        CSREdgeIter it;
+        int iNbr;
+        graphCSREdgeFirst(pView, iNode, 0, &it);
+        while( rc==SQLITE_OK && graphCSREdgeNext(&it, &iNbr, 0) ){
+          rc = pprAdd(&s, iNbr, rMass/nOut, rEpsilon);
+        }
+      }else{
+        /* A dead end restarts the walk at the seeds */
+        int j;
+        for(j=0; j<nSeed && rc==SQLITE_OK; j++){
+          rc = pprAdd(&s, aSeed[j], rMass/nSeed, rEpsilon);
+        }
+      }
+    }
+  }
+  if( rc!=SQLITE_OK ) goto ppr_cleanup;
+
+  /* Rank the touched nodes; only they have a non-zero estimate */
+  qsort(s.aNode, s.nNode, sizeof(PprNode), pprCmp);
+  for(nResult=0; nResult<s.nNode && s.aNode[nResult].rEstimate>0.0; nResult++){}
+  if( nTopK>0 && nResult>nTopK ) nResult = nTopK;
+  if( nResult>0 ){
+    *paNodeId = sqlite3_malloc64(sizeof(sqlite3_int64)*nResult);
+    *paScore = sqlite3_malloc64(sizeof(double)*nResult);
+    if( *paNodeId==0 || *paScore==0 ){
+      sqlite3_free(*paNodeId);
+      sqlite3_free(*paScore);
+      *paNodeId = 0;
+      *paScore = 0;
+      rc = SQLITE_NOMEM;
+      goto ppr_cleanup;
+    }
+    for(i=0; i<nResult; i++){
+      (*paNodeId)[i] = s.aNode[i].iNodeId;
+      (*paScore)[i] = s.aNode[i].rEstimate;
+    }
+  }
+  *pnResult = nResult;
+
+ppr_cleanup:
+  sqlite3_free(aRound);
+  sqlite3_free(s.aNode);
+  sqlite3_free(s.aQueue);
+  sqlite3_free(s.aHash);
+  return rc;
+}
+
+/*
+** Degree of a node in the current CSR snapshot and its write overlay,
+** building the snapshot if needed. Unknown nodes have degree 0.
+*/
+static sqlite3_int64 degreeFromCSR(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                                   int eDir){
+  CSRView view;
+  sqlite3_int64 nDegree = 0;
+  int iNode;
+
+  if( graphCSRViewOpen(pVtab, &view)!=SQLITE_OK ) return 0;
+  iNode = graphCSRViewIndexOf(&view, iNodeId);
+  if( iNode>=0 ){
+    if( eDir & GRAPH_DEGREE_OUT ) nDegree += graphCSRViewDegree(&view, iNode, 0);
+    if( eDir & GRAPH_DEGREE_IN ) nDegree += graphCSRViewDegree(&view, iNode, 1);
+  }
+  graphCSRViewClose(&view);
+  return nDegree;
+}
+
+/*
+** Degree of a node with edges of type zType only, counted on the edge
+** adjacency indexes. Used when the graph has no degree index.
+*/
+static sqlite3_int64 degreeFromEdges(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                                     const char *zType, int eDir){
   sqlite3_stmt *pStmt;
-  int rc;
-  int nOutDegree = 0;
+  sqlite3_int64 nDegree = 0;
+  char *zSql;
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges WHERE from_id = %lld", pVtab->zTableName, iNodeId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nOutDegree = sqlite3_column_int(pStmt, 0);
+  zSql = sqlite3_mprintf(
+      "SELECT (SELECT count(*) FROM \"%w\" WHERE source=?1 AND edge_type=?2),"
+      " (SELECT count(*) FROM \"%w\" WHERE target=?1 AND edge_type=?2)",
+      pVtab->zEdgeTableName, pVtab->zEdgeTableName);
+  if( zSql==0 ) return 0;
+  if( sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+    sqlite3_bind_int64(pStmt, 1, iNodeId);
+    sqlite3_bind_text(pStmt, 2, zType, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      if( eDir & GRAPH_DEGREE_OUT ) nDegree += sqlite3_column_int64(pStmt, 0);
+      if( eDir & GRAPH_DEGREE_IN ) nDegree += sqlite3_column_int64(pStmt, 1);
+    }
   }
   sqlite3_finalize(pStmt);
-  return nOutDegree;
+  sqlite3_free(zSql);
+  return nDegree;
 }
 
-double graphDegreeCentrality(GraphVtab *pVtab, sqlite3_int64 iNodeId,
-                            int bDirected){
-  int nDegree;
-  int nNodes = 0;
-  char *zSql;
+/*
+** Untyped lookups read a current CSR snapshot in O(1) after the id
+** lookup, plus the node's overlay edges. After a write the overlay could
+** not follow, the snapshot is stale, and rather than rebuild
+** it in O(V+E) for one node the lookup reads the node's rows of the
+** %s_degree table, one b-tree range per node.
+*/
+sqlite3_int64 graphNodeDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                              const char *zType, int eDir){
   sqlite3_stmt *pStmt;
+  sqlite3_int64 nDegree = 0;
   int rc;
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
+  if( zType==0 && (!pVtab->bDegreeIndex || graphCSRIsCurrent(pVtab)) ){
+    return degreeFromCSR(pVtab, iNodeId, eDir);
   }
-  sqlite3_finalize(pStmt);
-  
+  if( !pVtab->bDegreeIndex ){
+    return degreeFromEdges(pVtab, iNodeId, zType, eDir);
+  }
+
+  rc = graphStmtAcquire(pVtab, zType ? GRAPH_STMT_DEGREE_TYPED
+                                     : GRAPH_STMT_DEGREE, &pStmt);
+  if( rc!=SQLITE_OK ) return 0;
+  sqlite3_bind_int64(pStmt, 1, iNodeId);
+  if( zType ) sqlite3_bind_text(pStmt, 2, zType, -1, SQLITE_STATIC);
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    if( eDir & GRAPH_DEGREE_OUT ) nDegree += sqlite3_column_int64(pStmt, 0);
+    if( eDir & GRAPH_DEGREE_IN ) nDegree += sqlite3_column_int64(pStmt, 1);
+  }
+  graphStmtRelease(pVtab, pStmt);
+  return nDegree;
+}
+
+int graphTotalDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId){
+  return (int)graphNodeDegree(pVtab, iNodeId, 0, GRAPH_DEGREE_BOTH);
+}
+
+int graphInDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId){
+  return (int)graphNodeDegree(pVtab, iNodeId, 0, GRAPH_DEGREE_IN);
+}
+
+int graphOutDegree(GraphVtab *pVtab, sqlite3_int64 iNodeId){
+  return (int)graphNodeDegree(pVtab, iNodeId, 0, GRAPH_DEGREE_OUT);
+}
+
+double graphDegreeCentrality(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                            int bDirected){
+  sqlite3_int64 nNodes;
+
+  if( graphLiveCounts(pVtab, &nNodes, 0)!=SQLITE_OK ) return 0.0;
   if( nNodes <= 1 ) return 0.0;
   
   if( bDirected ){
-    nDegree = graphInDegree(pVtab, iNodeId) + graphOutDegree(pVtab, iNodeId);
-    return (double)nDegree / (2.0 * (nNodes - 1));
+    return (double)graphTotalDegree(pVtab, iNodeId) / (2.0 * (nNodes - 1));
   } else {
-    nDegree = graphOutDegree(pVtab, iNodeId);
-    return (double)nDegree / (nNodes - 1);
+    return (double)graphOutDegree(pVtab, iNodeId) / (nNodes - 1);
   }
 }
 
+/*
+** Weak connectivity: BFS from the first node following edges in both
+** directions and check that every node was reached.
+*/
 int graphIsConnected(GraphVtab *pVtab){
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int rc;
-  int nNodes = 0;
-  sqlite3_int64 iStartId = -1;
+  CSRGraph *pCSR = 0;
+  int *aQueue;
+  unsigned char *aSeen;
+  int iHead = 0, iTail = 0;
+  int bConnected;
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
+  if( graphCSRGet(pVtab, &pCSR)!=SQLITE_OK ) return 0;
+  if( pCSR->nNodes<=1 ) return 1;
 
-  if( nNodes<=1 ) return 1;
-
-  zSql = sqlite3_mprintf("SELECT id FROM %s_nodes LIMIT 1", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    iStartId = sqlite3_column_int64(pStmt, 0);
+  aQueue = sqlite3_malloc64(sizeof(int)*pCSR->nNodes);
+  aSeen = sqlite3_malloc64(pCSR->nNodes);
+  if( aQueue==0 || aSeen==0 ){
+    sqlite3_free(aQueue);
+    sqlite3_free(aSeen);
+    return 0;
   }
-  sqlite3_finalize(pStmt);
-
-  if( iStartId==-1 ) return 0;
+  memset(aSeen, 0, pCSR->nNodes);
 
-  char *zPath = 0;
-  graphShortestPathUnweighted(pVtab, iStartId, -1, &zPath);
-  int nVisited = 0;
-  if( zPath ){
-    const char *p = zPath;
-    while( *p ){
-      if( *p==',' ) nVisited++;
-      p++;
+  aSeen[0] = 1;
+  aQueue[iTail++] = 0;
+  while( iHead<iTail ){
+    int iNode = aQueue[iHead++];
+    sqlite3_int64 iEdge;
+    for( iEdge=pCSR->rowOffsets[iNode]; iEdge<pCSR->rowOffsets[iNode+1]; iEdge++ ){
+      int iNext = pCSR->columnIndices[iEdge];
+      if( !aSeen[iNext] ){ aSeen[iNext] = 1; aQueue[iTail++] = iNext; }
+    }
+    for( iEdge=pCSR->inOffsets[iNode]; iEdge<pCSR->inOffsets[iNode+1]; iEdge++ ){
+      int iNext = pCSR->inIndices[iEdge];
+      if( !aSeen[iNext] ){ aSeen[iNext] = 1; aQueue[iTail++] = iNext; }
     }
-    if( strchr(zPath, '[') ) nVisited++;
   }
-  sqlite3_free(zPath);
+  bConnected = (iTail==pCSR->nNodes);
 
-  return nVisited == nNodes;
+  sqlite3_free(aQueue);
+  sqlite3_free(aSeen);
+  return bConnected;
 }
 
 double graphDensity(GraphVtab *pVtab, int bDirected){
-  int nNodes = 0, nEdges = 0;
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int rc;
+  CSRGraph *pCSR = 0;
+  double nNodes, nEdges;
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nEdges = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
+  if( graphCSRGet(pVtab, &pCSR)!=SQLITE_OK ) return 0.0;
+  nNodes = (double)pCSR->nNodes;
+  nEdges = (double)pCSR->nEdges;
   
   if( nNodes <= 1 ) return 0.0;
   
   if( bDirected ){
-    return (double)nEdges / (nNodes * (nNodes - 1));
+    return nEdges / (nNodes * (nNodes - 1));
   } else {
     return (2.0 * nEdges) / (nNodes * (nNodes - 1));
   }
@@ -0,0 +1,154 @@
+/*
+** SQLite Graph Database Extension - Chunked Bump Arenas
+**
+** Each chunk is a header followed by its payload. The current chunk is
+** the head of pChunk; allocations bump zFree towards zEnd. Oversized
+** requests get a chunk of exactly their size, linked behind the current
+** one so bumping continues where it was. Standard chunks cycle through
+** the spare lists on reset instead of going back to the allocator.
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph-arena.h"
+#include <string.h>
+#include <assert.h>
+
+struct GraphArenaChunk {
+  GraphArenaChunk *pNext;
+  sqlite3_int64 nByte;         /* Payload size */
+};
+
+#define ARENA_ROUND(n)    (((n) + 7) & ~(sqlite3_int64)7)
+#define ARENA_PAYLOAD(c)  ((char*)(c) + sizeof(GraphArenaChunk))
+
+void graphArenaInit(GraphArena *p, GraphArena *pParent, int szChunk){
+  memset(p, 0, sizeof(*p));
+  p->pParent = pParent;
+  if( pParent ) szChunk = pParent->szChunk;
+  p->szChunk = szChunk>0 ? (int)ARENA_ROUND(szChunk) : GRAPH_ARENA_CHUNK;
+}
+
+/* A standard chunk: from the spare lists if possible */
+static GraphArenaChunk *arenaTakeChunk(GraphArena *p){
+  GraphArenaChunk *pChunk;
+  if( p->pSpare ){
+    pChunk = p->pSpare;
+    p->pSpare = pChunk->pNext;
+  }else if( p->pParent && p->pParent->pSpare ){
+    pChunk = p->pParent->pSpare;
+    p->pParent->pSpare = pChunk->pNext;
+  }else{
+    pChunk = sqlite3_malloc64(sizeof(GraphArenaChunk) + p->szChunk);
+    if( pChunk==0 ) return 0;
+    pChunk->nByte = p->szChunk;
+    p->nChunkAlloc++;
+  }
+  return pChunk;
+}
+
+void *graphArenaAlloc(GraphArena *p, sqlite3_int64 n){
+  GraphArenaChunk *pChunk;
+  char *pRet;
+
+  n = n>0 ? ARENA_ROUND(n) : 8;
+  if( p->zEnd - p->zFree >= n ){
+    pRet = p->zFree;
+    p->zFree += n;
+    p->nUsed += n;
+    return pRet;
+  }
+
+  if( n > p->szChunk/4 ){
+    pChunk = sqlite3_malloc64(sizeof(GraphArenaChunk) + n);
+    if( pChunk==0 ) return 0;
+    pChunk->nByte = n;
+    p->nChunkAlloc++;
+    if( p->pChunk ){
+      pChunk->pNext = p->pChunk->pNext;
+      p->pChunk->pNext = pChunk;
+    }else{
+      pChunk->pNext = 0;
+      p->pChunk = pChunk;
+    }
+    p->nUsed += n;
+    return ARENA_PAYLOAD(pChunk);
+  }
+
+  pChunk = arenaTakeChunk(p);
+  if( pChunk==0 ) return 0;
+  pChunk->pNext = p->pChunk;
+  p->pChunk = pChunk;
+  p->zFree = ARENA_PAYLOAD(pChunk) + n;
+  p->zEnd = ARENA_PAYLOAD(pChunk) + pChunk->nByte;
+  p->nUsed += n;
+  return ARENA_PAYLOAD(pChunk);
+}
+
+void *graphArenaRealloc(GraphArena *p, void *pOld, sqlite3_int64 nOld,
+                        sqlite3_int64 nNew){
+  void *pNew;
+
+  if( pOld==0 ) return graphArenaAlloc(p, nNew);
+  if( (char*)pOld + ARENA_ROUND(nOld)==p->zFree
+   && (char*)pOld + ARENA_ROUND(nNew)<=p->zEnd ){
+    p->nUsed += ARENA_ROUND(nNew) - ARENA_ROUND(nOld);
+    p->zFree = (char*)pOld + ARENA_ROUND(nNew);
+    return pOld;
+  }
+  pNew = graphArenaAlloc(p, nNew);
+  if( pNew ) memcpy(pNew, pOld, nOld<nNew ? nOld : nNew);
+  return pNew;
+}
+
+char *graphArenaStrdup(GraphArena *p, const char *z, int n){
+  char *zNew;
+  if( z==0 ) return 0;
+  if( n<0 ) n = (int)strlen(z);
+  zNew = graphArenaAlloc(p, n + 1);
+  if( zNew ){
+    memcpy(zNew, z, n);
+    zNew[n] = 0;
+  }
+  return zNew;
+}
+
+void graphArenaReset(GraphArena *p){
+  GraphArena *pKeep = p->pParent ? p->pParent : p;
+  GraphArenaChunk *pChunk = p->pChunk;
+
+  while( pChunk ){
+    GraphArenaChunk *pNext = pChunk->pNext;
+    if( pChunk->nByte==p->szChunk ){
+      pChunk->pNext = pKeep->pSpare;
+      pKeep->pSpare = pChunk;
+    }else{
+      sqlite3_free(pChunk);
+    }
+    pChunk = pNext;
+  }
+  p->pChunk = 0;
+  p->zFree = p->zEnd = 0;
+  p->nUsed = 0;
+}
+
+sqlite3_int64 graphArenaFootprint(const GraphArena *p){
+  const GraphArenaChunk *pChunk;
+  sqlite3_int64 nByte = 0;
+
+  for( pChunk=p->pChunk; pChunk; pChunk=pChunk->pNext ) nByte += pChunk->nByte;
+  for( pChunk=p->pSpare; pChunk; pChunk=pChunk->pNext ) nByte += pChunk->nByte;
+  return nByte;
+}
+
+void graphArenaRelease(GraphArena *p){
+  graphArenaReset(p);
+  while( p->pSpare ){
+    GraphArenaChunk *pNext = p->pSpare->pNext;
+    sqlite3_free(p->pSpare);
+    p->pSpare = pNext;
+  }
+}
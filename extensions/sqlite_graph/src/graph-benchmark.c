@@ -1,9 +1,25 @@
 /*
 ** graph-benchmark.c - Performance benchmarking suite
 **
-** This file implements the LDBC (Linked Data Benchmark Council)
-** Social Network Benchmark and other performance tests for the
-** SQLite Graph Extension.
+** This file implements a workload shaped after the LDBC (Linked Data
+** Benchmark Council) Social Network Benchmark Interactive workload for
+** the SQLite Graph Extension: the short reads IS1-IS7, the complex reads
+** IC1-IC14 and the updates IU1-IU8, over a social network generated
+** deterministically for a scale factor.
+**
+** The operations are SQL over the graph's backing tables rather than
+** Cypher, so that every one of them runs on the storage the extension
+** maintains (edge indexes, label index, property indexes) whatever the
+** Cypher front end supports. The schema is a reduced SNB schema: places,
+** tag classes, tags, organisations, persons, forums, posts, comments and
+** the relationships between them, with dates as epoch milliseconds.
+**
+** Reads run on nThreads connections at once when the database is a file
+** (one per thread, each with its own parameter stream); updates run on
+** the calling connection inside a savepoint that is rolled back, so that
+** repeated runs see the same data. Each operation is reported with
+** min/avg/p50/p95/p99/max latency, and the suite with its throughput,
+** as JSON that scripts/perf_regression.sh compares between versions.
 */
 
 #include "sqlite3ext.h"
@@ -13,13 +29,12 @@ extern const sqlite3_api_routines *sqlite3_api;
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
-#include <math.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "graph.h"
 #include "graph-memory.h"
 #include "graph-performance.h"
-#include "graph-memory.h"
+#include "graph-metrics.h"
 
 /*
 ** LDBC Social Network Benchmark Implementation
@@ -28,373 +43,1357 @@ extern const sqlite3_api_routines *sqlite3_api;
 /* Benchmark configuration */
 typedef struct BenchmarkConfig {
     int scale;                   /* Scale factor (1, 10, 100, etc.) */
-    int nThreads;                /* Number of threads */
-    int warmupRuns;              /* Number of warmup runs */
-    int measureRuns;             /* Number of measurement runs */
-    const char *outputFile;      /* Results output file */
-    int verboseOutput;           /* Verbose output flag */
+    int nThreads;                /* Connections running reads at once */
+    int warmupRuns;              /* Unmeasured runs of each operation */
+    int measureRuns;             /* Measured runs of each operation */
+    const char *outputFile;      /* JSON report is also written here */
 } BenchmarkConfig;
 
-/* Benchmark result */
-typedef struct BenchmarkResult {
-    const char *queryName;       /* Query name */
-    double minTime;              /* Minimum execution time (ms) */
-    double maxTime;              /* Maximum execution time (ms) */
-    double avgTime;              /* Average execution time (ms) */
-    double stdDev;               /* Standard deviation */
-    sqlite3_int64 resultCount;   /* Number of results returned */
-    char *errorMsg;              /* Error message if failed */
-} BenchmarkResult;
+/* Fixed-size dimensions of the generated network */
+#define LDBC_COUNTRIES      20
+#define LDBC_CITIES         100
+#define LDBC_TAGCLASSES     20
+#define LDBC_TAGS           200
+#define LDBC_UNIVERSITIES   50
+#define LDBC_COMPANIES      100
+
+/* Per-person volumes */
+#define LDBC_PERSONS_PER_SF 1000
+#define LDBC_POSTS          10   /* Posts per person */
+#define LDBC_COMMENTS       20   /* Comments per person */
+#define LDBC_LIKES          30   /* Likes per person */
+#define LDBC_LOCAL_FRIENDS  8    /* Friends among the next 50 persons */
+#define LDBC_RANDOM_FRIENDS 2    /* Friends anywhere after the person */
+#define LDBC_MEMBERS        10   /* Members per forum */
+
+#define LDBC_START_DATE     1262304000000LL   /* 2010-01-01, epoch ms */
+#define LDBC_MS_PER_DAY     86400000LL
+#define LDBC_SPAN_DAYS      (3*365)
+#define LDBC_MAX_HOPS       "4"  /* Depth bound of IC13 and IC14 */
+
+#define LDBC_MAX_STMT       4    /* Statements per operation */
+
+/* Id ranges of the generated entities, a function of the scale only */
+typedef struct LdbcLayout {
+    sqlite3_int64 iCountry, iCity, iTagClass, iTag;
+    sqlite3_int64 iUniversity, iCompany;
+    sqlite3_int64 iPerson, nPerson;
+    sqlite3_int64 iForum, nForum;
+    sqlite3_int64 iPost, nPost;
+    sqlite3_int64 iComment, nComment;
+    sqlite3_int64 iNextId;       /* First id left for updates */
+} LdbcLayout;
+
+static void ldbcLayoutInit(LdbcLayout *p, int scale) {
+    p->iCountry = 1;
+    p->iCity = p->iCountry + LDBC_COUNTRIES;
+    p->iTagClass = p->iCity + LDBC_CITIES;
+    p->iTag = p->iTagClass + LDBC_TAGCLASSES;
+    p->iUniversity = p->iTag + LDBC_TAGS;
+    p->iCompany = p->iUniversity + LDBC_UNIVERSITIES;
+    p->iPerson = p->iCompany + LDBC_COMPANIES;
+    p->nPerson = (sqlite3_int64)LDBC_PERSONS_PER_SF * scale;
+    p->iForum = p->iPerson + p->nPerson;
+    p->nForum = p->nPerson;
+    p->iPost = p->iForum + p->nForum;
+    p->nPost = p->nPerson * LDBC_POSTS;
+    p->iComment = p->iPost + p->nPost;
+    p->nComment = p->nPerson * LDBC_COMMENTS;
+    p->iNextId = p->iComment + p->nComment;
+}
+
+/* splitmix64: the data and parameters depend only on the seed */
+static sqlite3_uint64 ldbcRandom(sqlite3_uint64 *pState) {
+    sqlite3_uint64 z = (*pState += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static sqlite3_int64 ldbcRandomRange(sqlite3_uint64 *pState, sqlite3_int64 n) {
+    return n > 0 ? (sqlite3_int64)(ldbcRandom(pState) % (sqlite3_uint64)n) : 0;
+}
+
+static const char *const azLdbcFirstName[] = {
+    "Jan", "Maria", "Ali", "Chen", "Anna", "Carlos", "Yuki", "Olga",
+    "Ahmed", "Laura", "Ivan", "Mei", "Peter", "Fatima", "Jose", "Sofia",
+    "Hans", "Priya", "Luca", "Emma", "Omar", "Hana", "Pablo", "Nina",
+    "Ravi", "Eva", "Kenji", "Lena", "Mohamed", "Ines", "Tom", "Aiko"
+};
+static const char *const azLdbcLastName[] = {
+    "Smith", "Garcia", "Wang", "Muller", "Rossi", "Kim", "Silva", "Khan",
+    "Novak", "Ito", "Dubois", "Jansen", "Costa", "Ali", "Nagy", "Berg"
+};
+static const char *const azLdbcBrowser[] = {
+    "Chrome", "Firefox", "Safari", "Opera", "Edge"
+};
+#define LDBC_COUNT(a) ((int)(sizeof(a)/sizeof(a[0])))
 
 /*
-** Generate LDBC Social Network data
+** Data generation
 */
-static int generateLDBCData(sqlite3 *db, int scale) {
-    char *zErr = NULL;
-    int rc;
-    
-    /* Create graph extension tables */
-    rc = sqlite3_exec(db, "CREATE VIRTUAL TABLE ldbc_graph USING graph", 
-                      NULL, NULL, &zErr);
-    if (rc != SQLITE_OK) {
-        sqlite3_free(zErr);
-        return rc;
-    }
-    
-    /* Calculate data sizes based on scale */
-    sqlite3_int64 nPersons = 1000 * scale;
-    sqlite3_int64 nKnows = nPersons * 50;  /* Avg 50 friends per person */
-    sqlite3_int64 nPosts = nPersons * 10;   /* Avg 10 posts per person */
-    /* sqlite3_int64 nLikes = nPosts * 20; */ /* Avg 20 likes per post - reserved for future use */
-    
-    /* Begin transaction for bulk loading */
-    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
-    
-    /* Generate Person nodes */
-    sqlite3_stmt *pStmt;
-    rc = sqlite3_prepare_v2(db, 
-        "SELECT graph_node_add(ldbc_graph, ?1, 'Person', ?2)", -1, &pStmt, NULL);
-    if (rc != SQLITE_OK) return rc;
-    
-    for (sqlite3_int64 i = 1; i <= nPersons; i++) {
-        char props[256];
-        sqlite3_snprintf(sizeof(props), props,
-            "{\"firstName\":\"Person%lld\",\"lastName\":\"Test\","
-            "\"birthday\":\"%d-01-01\",\"locationIP\":\"192.168.1.%d\","
-            "\"browserUsed\":\"Chrome\",\"gender\":\"%s\"}",
-            i, 1990 + (int)(i % 30), (int)(i % 255),
-            (i % 2 == 0) ? "male" : "female");
-        
-        sqlite3_bind_int64(pStmt, 1, i);
-        sqlite3_bind_text(pStmt, 2, props, -1, SQLITE_STATIC);
-        sqlite3_step(pStmt);
-        sqlite3_reset(pStmt);
-        
-        if (i % 1000 == 0) {
-            /* Progress indicator */
-            if (i % 10000 == 0) {
-                sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
-                sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+
+typedef struct LdbcGen {
+    sqlite3 *db;
+    const LdbcLayout *pLayout;
+    sqlite3_stmt *pNode;         /* INSERT into the node table */
+    sqlite3_stmt *pEdge;         /* INSERT into the edge table */
+    sqlite3_uint64 iRandom;      /* PRNG state */
+    sqlite3_int64 *aMsgDate;     /* creationDate of every post and comment */
+    int rc;                      /* First error */
+} LdbcGen;
+
+static void ldbcNode(LdbcGen *p, sqlite3_int64 iId, const char *zLabel,
+                     char *zProps) {
+    char zLabels[32];
+
+    if (p->rc == SQLITE_OK && !zProps) p->rc = SQLITE_NOMEM;
+    if (p->rc == SQLITE_OK) {
+        sqlite3_snprintf(sizeof(zLabels), zLabels, "[\"%s\"]", zLabel);
+        sqlite3_bind_int64(p->pNode, 1, iId);
+        sqlite3_bind_text(p->pNode, 2, zLabels, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(p->pNode, 3, zProps, -1, SQLITE_STATIC);
+        sqlite3_step(p->pNode);
+        p->rc = sqlite3_reset(p->pNode);
+    }
+    sqlite3_free(zProps);
+}
+
+/* zProps may be NULL for an edge without properties */
+static void ldbcEdge(LdbcGen *p, sqlite3_int64 iSrc, sqlite3_int64 iDst,
+                     const char *zType, char *zProps) {
+    if (p->rc == SQLITE_OK) {
+        sqlite3_bind_int64(p->pEdge, 1, iSrc);
+        sqlite3_bind_int64(p->pEdge, 2, iDst);
+        sqlite3_bind_text(p->pEdge, 3, zType, -1, SQLITE_STATIC);
+        sqlite3_bind_text(p->pEdge, 4, zProps ? zProps : "{}", -1, SQLITE_STATIC);
+        sqlite3_step(p->pEdge);
+        p->rc = sqlite3_reset(p->pEdge);
+    }
+    sqlite3_free(zProps);
+}
+
+static sqlite3_int64 ldbcRandomDate(LdbcGen *p) {
+    return LDBC_START_DATE
+         + ldbcRandomRange(&p->iRandom, LDBC_SPAN_DAYS * LDBC_MS_PER_DAY);
+}
+
+static void ldbcGenerateStatic(LdbcGen *p) {
+    const LdbcLayout *L = p->pLayout;
+    int i;
+
+    for (i = 0; i < LDBC_COUNTRIES; i++) {
+        ldbcNode(p, L->iCountry + i, "Country",
+                 sqlite3_mprintf("{\"name\":\"Country_%d\"}", i));
+    }
+    for (i = 0; i < LDBC_CITIES; i++) {
+        ldbcNode(p, L->iCity + i, "City",
+                 sqlite3_mprintf("{\"name\":\"City_%d\"}", i));
+        ldbcEdge(p, L->iCity + i, L->iCountry + i % LDBC_COUNTRIES,
+                 "IS_PART_OF", NULL);
+    }
+    for (i = 0; i < LDBC_TAGCLASSES; i++) {
+        ldbcNode(p, L->iTagClass + i, "TagClass",
+                 sqlite3_mprintf("{\"name\":\"TagClass_%d\"}", i));
+    }
+    for (i = 0; i < LDBC_TAGS; i++) {
+        ldbcNode(p, L->iTag + i, "Tag",
+                 sqlite3_mprintf("{\"name\":\"Tag_%d\"}", i));
+        ldbcEdge(p, L->iTag + i, L->iTagClass + i % LDBC_TAGCLASSES,
+                 "HAS_TYPE", NULL);
+    }
+    for (i = 0; i < LDBC_UNIVERSITIES; i++) {
+        ldbcNode(p, L->iUniversity + i, "University",
+                 sqlite3_mprintf("{\"name\":\"University_%d\"}", i));
+        ldbcEdge(p, L->iUniversity + i,
+                 L->iCity + ldbcRandomRange(&p->iRandom, LDBC_CITIES),
+                 "IS_LOCATED_IN", NULL);
+    }
+    for (i = 0; i < LDBC_COMPANIES; i++) {
+        ldbcNode(p, L->iCompany + i, "Company",
+                 sqlite3_mprintf("{\"name\":\"Company_%d\"}", i));
+        ldbcEdge(p, L->iCompany + i,
+                 L->iCountry + ldbcRandomRange(&p->iRandom, LDBC_COUNTRIES),
+                 "IS_LOCATED_IN", NULL);
+    }
+}
+
+/*
+** Persons, their attributes and KNOWS. Friendships are mostly local in
+** id order, which gives the network clusters, plus a few long-range
+** ones. Each pair is generated once, by its smaller id, and stored in
+** both directions.
+*/
+static void ldbcGeneratePersons(LdbcGen *p) {
+    const LdbcLayout *L = p->pLayout;
+    sqlite3_int64 aFriend[LDBC_LOCAL_FRIENDS + LDBC_RANDOM_FRIENDS];
+    sqlite3_int64 i;
+
+    for (i = 0; i < L->nPerson && p->rc == SQLITE_OK; i++) {
+        sqlite3_int64 iId = L->iPerson + i;
+        int iTag = (int)ldbcRandomRange(&p->iRandom, LDBC_TAGS);
+        int j;
+
+        ldbcNode(p, iId, "Person", sqlite3_mprintf(
+            "{\"firstName\":\"%s\",\"lastName\":\"%s\",\"gender\":\"%s\","
+            "\"birthday\":\"%d-%02d-%02d\",\"creationDate\":%lld,"
+            "\"locationIP\":\"10.%d.%d.%d\",\"browserUsed\":\"%s\"}",
+            azLdbcFirstName[ldbcRandomRange(&p->iRandom, LDBC_COUNT(azLdbcFirstName))],
+            azLdbcLastName[ldbcRandomRange(&p->iRandom, LDBC_COUNT(azLdbcLastName))],
+            (i & 1) ? "female" : "male",
+            1980 + (int)ldbcRandomRange(&p->iRandom, 20),
+            1 + (int)ldbcRandomRange(&p->iRandom, 12),
+            1 + (int)ldbcRandomRange(&p->iRandom, 28),
+            ldbcRandomDate(p),
+            (int)(i >> 16) & 255, (int)(i >> 8) & 255, (int)i & 255,
+            azLdbcBrowser[ldbcRandomRange(&p->iRandom, LDBC_COUNT(azLdbcBrowser))]));
+        ldbcEdge(p, iId, L->iCity + ldbcRandomRange(&p->iRandom, LDBC_CITIES),
+                 "IS_LOCATED_IN", NULL);
+        for (j = 0; j < 3; j++) {
+            ldbcEdge(p, iId, L->iTag + (iTag + j) % LDBC_TAGS, "HAS_INTEREST", NULL);
+        }
+        if (ldbcRandomRange(&p->iRandom, 10) < 7) {
+            ldbcEdge(p, iId,
+                     L->iUniversity + ldbcRandomRange(&p->iRandom, LDBC_UNIVERSITIES),
+                     "STUDY_AT", sqlite3_mprintf("{\"classYear\":%d}",
+                         2000 + (int)ldbcRandomRange(&p->iRandom, 13)));
+        }
+        if (ldbcRandomRange(&p->iRandom, 10) < 8) {
+            ldbcEdge(p, iId,
+                     L->iCompany + ldbcRandomRange(&p->iRandom, LDBC_COMPANIES),
+                     "WORK_AT", sqlite3_mprintf("{\"workFrom\":%d}",
+                         1998 + (int)ldbcRandomRange(&p->iRandom, 15)));
+        }
+    }
+
+    for (i = 0; i < L->nPerson && p->rc == SQLITE_OK; i++) {
+        int nFriend = 0;
+        int j, k;
+
+        for (j = 0; j < LDBC_LOCAL_FRIENDS + LDBC_RANDOM_FRIENDS; j++) {
+            sqlite3_int64 iOther;
+            if (j < LDBC_LOCAL_FRIENDS) {
+                iOther = i + 1 + ldbcRandomRange(&p->iRandom, 50);
+            } else {
+                iOther = i + 1 + ldbcRandomRange(&p->iRandom, L->nPerson);
             }
+            if (iOther >= L->nPerson) continue;
+            for (k = 0; k < nFriend && aFriend[k] != iOther; k++) {}
+            if (k < nFriend) continue;
+            aFriend[nFriend++] = iOther;
+        }
+        for (j = 0; j < nFriend; j++) {
+            sqlite3_int64 iDate = ldbcRandomDate(p);
+            ldbcEdge(p, L->iPerson + i, L->iPerson + aFriend[j], "KNOWS",
+                     sqlite3_mprintf("{\"creationDate\":%lld}", iDate));
+            ldbcEdge(p, L->iPerson + aFriend[j], L->iPerson + i, "KNOWS",
+                     sqlite3_mprintf("{\"creationDate\":%lld}", iDate));
         }
     }
-    sqlite3_finalize(pStmt);
-    
-    /* Generate KNOWS relationships */
-    rc = sqlite3_prepare_v2(db,
-        "SELECT graph_edge_add(ldbc_graph, ?1, ?2, 'KNOWS', 1.0, ?3)", 
-        -1, &pStmt, NULL);
-    if (rc != SQLITE_OK) return rc;
-    
-    srand(42); /* Deterministic random seed */
-    
-    for (sqlite3_int64 i = 0; i < nKnows; i++) {
-        sqlite3_int64 person1 = 1 + (rand() % nPersons);
-        sqlite3_int64 person2 = 1 + (rand() % nPersons);
-        
-        if (person1 != person2) {
-            char props[128];
-            int year = 2010 + (rand() % 10);
-            sqlite3_snprintf(sizeof(props), props,
-                "{\"creationDate\":\"%d-01-01\"}", year);
-            
-            sqlite3_bind_int64(pStmt, 1, person1);
-            sqlite3_bind_int64(pStmt, 2, person2);
-            sqlite3_bind_text(pStmt, 3, props, -1, SQLITE_STATIC);
-            sqlite3_step(pStmt);
-            sqlite3_reset(pStmt);
+}
+
+/*
+** Forums, posts, comments and likes. Every person moderates one forum
+** and posts into it; comments reply to an earlier post or comment and
+** are dated after it.
+*/
+static void ldbcGenerateMessages(LdbcGen *p) {
+    const LdbcLayout *L = p->pLayout;
+    sqlite3_int64 i;
+    int j;
+
+    for (i = 0; i < L->nForum && p->rc == SQLITE_OK; i++) {
+        sqlite3_int64 iForum = L->iForum + i;
+        ldbcNode(p, iForum, "Forum", sqlite3_mprintf(
+            "{\"title\":\"Wall of Person_%lld\",\"creationDate\":%lld}",
+            L->iPerson + i, ldbcRandomDate(p)));
+        ldbcEdge(p, iForum, L->iPerson + i, "HAS_MODERATOR", NULL);
+        ldbcEdge(p, iForum, L->iTag + ldbcRandomRange(&p->iRandom, LDBC_TAGS),
+                 "HAS_TAG", NULL);
+        for (j = 0; j < LDBC_MEMBERS; j++) {
+            ldbcEdge(p, iForum,
+                     L->iPerson + ldbcRandomRange(&p->iRandom, L->nPerson),
+                     "HAS_MEMBER", sqlite3_mprintf("{\"joinDate\":%lld}",
+                         ldbcRandomDate(p)));
         }
     }
-    sqlite3_finalize(pStmt);
-    
-    /* Generate Post nodes */
-    rc = sqlite3_prepare_v2(db,
-        "SELECT graph_node_add(ldbc_graph, ?1, 'Post', ?2)", -1, &pStmt, NULL);
-    if (rc != SQLITE_OK) return rc;
-    
-    sqlite3_int64 postId = nPersons + 1;
-    for (sqlite3_int64 i = 0; i < nPosts; i++) {
-        char props[512];
-        sqlite3_int64 creatorId = 1 + (i % nPersons);
-        
-        sqlite3_snprintf(sizeof(props), props,
-            "{\"content\":\"This is post number %lld\","
-            "\"creationDate\":\"2020-01-01\",\"language\":\"en\","
-            "\"creatorId\":%lld}",
-            i, creatorId);
-        
-        sqlite3_bind_int64(pStmt, 1, postId + i);
-        sqlite3_bind_text(pStmt, 2, props, -1, SQLITE_STATIC);
-        sqlite3_step(pStmt);
-        sqlite3_reset(pStmt);
+
+    for (i = 0; i < L->nPost && p->rc == SQLITE_OK; i++) {
+        sqlite3_int64 iPost = L->iPost + i;
+        sqlite3_int64 iCreator = ldbcRandomRange(&p->iRandom, L->nPerson);
+        int iTag = (int)ldbcRandomRange(&p->iRandom, LDBC_TAGS);
+        int nTag = 1 + (int)ldbcRandomRange(&p->iRandom, 2);
+
+        p->aMsgDate[i] = ldbcRandomDate(p);
+        ldbcNode(p, iPost, "Post", sqlite3_mprintf(
+            "{\"content\":\"Post %lld about Tag_%d\",\"length\":%d,"
+            "\"creationDate\":%lld,\"language\":\"en\",\"browserUsed\":\"%s\","
+            "\"locationIP\":\"10.1.1.1\"}",
+            i, iTag, 20 + (int)ldbcRandomRange(&p->iRandom, 200), p->aMsgDate[i],
+            azLdbcBrowser[ldbcRandomRange(&p->iRandom, LDBC_COUNT(azLdbcBrowser))]));
+        ldbcEdge(p, iPost, L->iPerson + iCreator, "HAS_CREATOR", NULL);
+        ldbcEdge(p, L->iForum + iCreator, iPost, "CONTAINER_OF", NULL);
+        ldbcEdge(p, iPost, L->iCountry + ldbcRandomRange(&p->iRandom, LDBC_COUNTRIES),
+                 "IS_LOCATED_IN", NULL);
+        for (j = 0; j < nTag; j++) {
+            ldbcEdge(p, iPost, L->iTag + (iTag + j) % LDBC_TAGS, "HAS_TAG", NULL);
+        }
+    }
+
+    for (i = 0; i < L->nComment && p->rc == SQLITE_OK; i++) {
+        sqlite3_int64 iParent;
+        sqlite3_int64 iDate;
+
+        if (i == 0 || ldbcRandomRange(&p->iRandom, 2) == 0) {
+            iParent = ldbcRandomRange(&p->iRandom, L->nPost);
+        } else {
+            iParent = L->nPost + ldbcRandomRange(&p->iRandom, i);
+        }
+        iDate = p->aMsgDate[iParent]
+              + 1 + ldbcRandomRange(&p->iRandom, 3 * LDBC_MS_PER_DAY);
+        p->aMsgDate[L->nPost + i] = iDate;
+
+        ldbcNode(p, L->iComment + i, "Comment", sqlite3_mprintf(
+            "{\"content\":\"Reply %lld\",\"length\":%d,\"creationDate\":%lld,"
+            "\"browserUsed\":\"%s\",\"locationIP\":\"10.2.2.2\"}",
+            i, 5 + (int)ldbcRandomRange(&p->iRandom, 100), iDate,
+            azLdbcBrowser[ldbcRandomRange(&p->iRandom, LDBC_COUNT(azLdbcBrowser))]));
+        ldbcEdge(p, L->iComment + i,
+                 L->iPerson + ldbcRandomRange(&p->iRandom, L->nPerson),
+                 "HAS_CREATOR", NULL);
+        ldbcEdge(p, L->iComment + i, L->iPost + iParent, "REPLY_OF", NULL);
+        ldbcEdge(p, L->iComment + i,
+                 L->iCountry + ldbcRandomRange(&p->iRandom, LDBC_COUNTRIES),
+                 "IS_LOCATED_IN", NULL);
+        ldbcEdge(p, L->iComment + i,
+                 L->iTag + ldbcRandomRange(&p->iRandom, LDBC_TAGS), "HAS_TAG", NULL);
+    }
+
+    for (i = 0; i < L->nPerson * LDBC_LIKES && p->rc == SQLITE_OK; i++) {
+        sqlite3_int64 iMsg = ldbcRandomRange(&p->iRandom, L->nPost + L->nComment);
+        ldbcEdge(p, L->iPerson + ldbcRandomRange(&p->iRandom, L->nPerson),
+                 L->iPost + iMsg, "LIKES",
+                 sqlite3_mprintf("{\"creationDate\":%lld}", p->aMsgDate[iMsg]
+                     + 1 + ldbcRandomRange(&p->iRandom, 7 * LDBC_MS_PER_DAY)));
     }
-    sqlite3_finalize(pStmt);
-    
-    /* Commit transaction */
-    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
-    
-    /* Create indexes for better performance */
-    sqlite3_exec(db, "SELECT graph_create_label_index(ldbc_graph, 'Person')",
-                 NULL, NULL, NULL);
-    sqlite3_exec(db, "SELECT graph_create_label_index(ldbc_graph, 'Post')",
-                 NULL, NULL, NULL);
-    
-    return SQLITE_OK;
 }
 
 /*
-** LDBC Interactive Query 1: Friends of a person
+** Create graph zGraph and fill it with the network for the layout. The
+** seed is fixed, so a scale factor always produces the same data.
+** Inside the caller's transaction if there is one, otherwise in one of
+** its own.
 */
-static BenchmarkResult* benchmarkLDBCQuery1(sqlite3 *db, BenchmarkConfig *config) {
-    BenchmarkResult *result = sqlite3_malloc(sizeof(BenchmarkResult));
-    if (!result) return NULL;
-    
-    result->queryName = "LDBC Interactive Query 1";
-    result->minTime = 1e9;
-    result->maxTime = 0;
-    result->avgTime = 0;
-    result->errorMsg = NULL;
-    
-    const char *query = 
-        "SELECT * FROM cypher_execute("
-        "  'MATCH (p:Person)-[:KNOWS]->(friend:Person) "
-        "   WHERE p.firstName = \"Person42\" "
-        "   RETURN friend.firstName, friend.lastName "
-        "   ORDER BY friend.lastName, friend.firstName "
-        "   LIMIT 20'"
-        ")";
-    
-    double *times = sqlite3_malloc(config->measureRuns * sizeof(double));
-    if (!times) {
-        sqlite3_free(result);
-        return NULL;
-    }
-    
-    /* Warmup runs */
-    for (int i = 0; i < config->warmupRuns; i++) {
-        sqlite3_exec(db, query, NULL, NULL, NULL);
-    }
-    
-    /* Measurement runs */
-    for (int i = 0; i < config->measureRuns; i++) {
-        clock_t start = clock();
-        
-        sqlite3_stmt *pStmt;
-        int rc = sqlite3_prepare_v2(db, query, -1, &pStmt, NULL);
+static int generateLDBCData(sqlite3 *db, const char *zGraph,
+                            const LdbcLayout *pLayout) {
+    LdbcGen gen;
+    int bOwnTxn = sqlite3_get_autocommit(db);
+    char *zSql;
+    int rc;
+
+    memset(&gen, 0, sizeof(gen));
+    gen.db = db;
+    gen.pLayout = pLayout;
+    gen.iRandom = 42;
+
+    zSql = sqlite3_mprintf("CREATE VIRTUAL TABLE \"%w\" USING graph", zGraph);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_exec(db, zSql, NULL, NULL, NULL);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) return rc;
+
+    gen.aMsgDate = sqlite3_malloc64((pLayout->nPost + pLayout->nComment)
+                                    * sizeof(sqlite3_int64));
+    if (!gen.aMsgDate) return SQLITE_NOMEM;
+
+    if (bOwnTxn) sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    zSql = sqlite3_mprintf(
+        "INSERT INTO \"%w_nodes\"(id, labels, properties) VALUES(?1, ?2, ?3)",
+        zGraph);
+    gen.rc = zSql ? sqlite3_prepare_v2(db, zSql, -1, &gen.pNode, NULL) : SQLITE_NOMEM;
+    sqlite3_free(zSql);
+    if (gen.rc == SQLITE_OK) {
+        zSql = sqlite3_mprintf(
+            "INSERT INTO \"%w_edges\"(source, target, edge_type, weight, properties)"
+            " VALUES(?1, ?2, ?3, 1.0, ?4)", zGraph);
+        gen.rc = zSql ? sqlite3_prepare_v2(db, zSql, -1, &gen.pEdge, NULL)
+                      : SQLITE_NOMEM;
+        sqlite3_free(zSql);
+    }
+
+    ldbcGenerateStatic(&gen);
+    ldbcGeneratePersons(&gen);
+    ldbcGenerateMessages(&gen);
+    sqlite3_finalize(gen.pNode);
+    sqlite3_finalize(gen.pEdge);
+    sqlite3_free(gen.aMsgDate);
+    rc = gen.rc;
+
+    /* Property indexes named and shaped as graph_create_index() makes
+    ** them. No ANALYZE: with sqlite_stat1 present the planner builds
+    ** Bloom filters over the whole edge table for the small recursive
+    ** frontiers these queries join against. */
+    if (rc == SQLITE_OK) {
+        zSql = sqlite3_mprintf(
+            "CREATE INDEX \"%w_prop_firstName\" ON \"%w_nodes\""
+            "(json_extract(properties, '$.firstName'));"
+            "CREATE INDEX \"%w_prop_name\" ON \"%w_nodes\""
+            "(json_extract(properties, '$.name'));",
+            zGraph, zGraph, zGraph, zGraph);
+        rc = zSql ? sqlite3_exec(db, zSql, NULL, NULL, NULL) : SQLITE_NOMEM;
+        sqlite3_free(zSql);
+    }
+
+    if (bOwnTxn) {
         if (rc == SQLITE_OK) {
-            sqlite3_int64 count = 0;
-            while (sqlite3_step(pStmt) == SQLITE_ROW) {
-                count++;
-            }
-            result->resultCount = count;
-            sqlite3_finalize(pStmt);
+            rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+        } else {
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
         }
-        
-        clock_t end = clock();
-        double elapsed = ((double)(end - start)) / CLOCKS_PER_SEC * 1000.0;
-        
-        times[i] = elapsed;
-        result->avgTime += elapsed;
-        if (elapsed < result->minTime) result->minTime = elapsed;
-        if (elapsed > result->maxTime) result->maxTime = elapsed;
-    }
-    
-    /* Calculate average and standard deviation */
-    result->avgTime /= config->measureRuns;
-    
-    double variance = 0;
-    for (int i = 0; i < config->measureRuns; i++) {
-        double diff = times[i] - result->avgTime;
-        variance += diff * diff;
-    }
-    result->stdDev = sqrt(variance / config->measureRuns);
-    
-    sqlite3_free(times);
-    return result;
+    }
+    return rc;
 }
 
 /*
-** LDBC Interactive Query 2: Recent posts of friends
+** Operations
+**
+** {N} and {E} stand for the node and edge tables. Parameters are bound
+** by number from LdbcParams; each operation uses the ones it needs:
+**
+**   ?1 person        ?2 other person    ?3 message        ?4 date (ms)
+**   ?5 first name    ?6 tag name        ?7 country X      ?8 country Y
+**   ?9 days          ?10 month          ?11 tag class     ?12 year
+**   ?13 new id       ?14 post           ?15 comment       ?16 forum
+**   ?17 city         ?18 tag            ?19 country       ?20 company
+**   ?21 university
 */
-static BenchmarkResult* benchmarkLDBCQuery2(sqlite3 *db, BenchmarkConfig *config) {
-    BenchmarkResult *result = sqlite3_malloc(sizeof(BenchmarkResult));
-    if (!result) return NULL;
-    
-    result->queryName = "LDBC Interactive Query 2";
-    result->minTime = 1e9;
-    result->maxTime = 0;
-    result->avgTime = 0;
-    result->errorMsg = NULL;
-    
-    /* Mark unused parameters */
-    (void)db;
-    (void)config;
-    
-    /* const char *query = 
-        "SELECT * FROM cypher_execute("
-        "  'MATCH (p:Person)-[:KNOWS]->(friend:Person), "
-        "         (friend)-[:CREATED]->(post:Post) "
-        "   WHERE p.firstName = \"Person42\" "
-        "   RETURN friend.firstName, post.content, post.creationDate "
-        "   ORDER BY post.creationDate DESC "
-        "   LIMIT 20'"
-        ")"; */
-    
-    /* Similar measurement logic as Query 1 */
-    /* ... implementation ... */
-    
-    return result;
+#define LDBC_NPARAM 21
+
+enum { LDBC_SHORT, LDBC_COMPLEX, LDBC_UPDATE };
+
+typedef struct LdbcOp {
+    const char *zName;
+    int eKind;                   /* LDBC_SHORT, LDBC_COMPLEX or LDBC_UPDATE */
+    const char *azSql[LDBC_MAX_STMT];   /* Run in order; NULL-terminated */
+} LdbcOp;
+
+/* Persons within h KNOWS hops of ?1, other than ?1, with their distance */
+#define LDBC_FRIENDS(h) \
+    "friends(id, d) AS (SELECT ?1, 0 UNION SELECT k.target, friends.d+1" \
+    " FROM friends JOIN {E} k ON k.source=friends.id AND k.edge_type='KNOWS'" \
+    " WHERE friends.d<" h ")," \
+    " people(id, d) AS (SELECT id, min(d) FROM friends WHERE id<>?1 GROUP BY id)"
+
+#define LDBC_PROP(t, p) "json_extract(" t ".properties,'$." p "')"
+#define LDBC_IS(t, l)   t ".labels='[\"" l "\"]'"
+
+static const LdbcOp aLdbcOp[] = {
+    /* IS1: profile of a person */
+    { "IS1", LDBC_SHORT, {
+      "SELECT " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName") ","
+      " " LDBC_PROP("p","birthday") ", " LDBC_PROP("p","locationIP") ","
+      " " LDBC_PROP("p","browserUsed") ", l.target, " LDBC_PROP("p","gender") ","
+      " " LDBC_PROP("p","creationDate")
+      " FROM {N} p JOIN {E} l ON l.source=p.id AND l.edge_type='IS_LOCATED_IN'"
+      " WHERE p.id=?1" } },
+
+    /* IS2: a person's last 10 messages with their original posts */
+    { "IS2", LDBC_SHORT, {
+      "WITH RECURSIVE recent(id, date) AS ("
+      "  SELECT c.source, " LDBC_PROP("m","creationDate")
+      "  FROM {E} c JOIN {N} m ON m.id=c.source"
+      "  WHERE c.target=?1 AND c.edge_type='HAS_CREATOR'"
+      "  ORDER BY 2 DESC, 1 DESC LIMIT 10),"
+      " root(mid, id) AS ("
+      "  SELECT id, id FROM recent"
+      "  UNION ALL SELECT root.mid, r.target FROM root"
+      "  JOIN {E} r ON r.source=root.id AND r.edge_type='REPLY_OF')"
+      " SELECT recent.id, recent.date, root.id, c.target"
+      " FROM recent JOIN root ON root.mid=recent.id"
+      " CROSS JOIN {E} c ON c.source=root.id AND c.edge_type='HAS_CREATOR'"
+      " WHERE NOT EXISTS(SELECT 1 FROM {E} r"
+      "  WHERE r.source=root.id AND r.edge_type='REPLY_OF')"
+      " ORDER BY recent.date DESC, recent.id DESC" } },
+
+    /* IS3: friends of a person */
+    { "IS3", LDBC_SHORT, {
+      "SELECT k.target, " LDBC_PROP("f","firstName") ", " LDBC_PROP("f","lastName") ","
+      " " LDBC_PROP("k","creationDate") " AS since"
+      " FROM {E} k JOIN {N} f ON f.id=k.target"
+      " WHERE k.source=?1 AND k.edge_type='KNOWS'"
+      " ORDER BY since DESC, k.target" } },
+
+    /* IS4: content of a message */
+    { "IS4", LDBC_SHORT, {
+      "SELECT " LDBC_PROP("m","creationDate") ", " LDBC_PROP("m","content")
+      " FROM {N} m WHERE m.id=?3" } },
+
+    /* IS5: creator of a message */
+    { "IS5", LDBC_SHORT, {
+      "SELECT p.id, " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName")
+      " FROM {E} c JOIN {N} p ON p.id=c.target"
+      " WHERE c.source=?3 AND c.edge_type='HAS_CREATOR'" } },
+
+    /* IS6: forum of a message and its moderator */
+    { "IS6", LDBC_SHORT, {
+      "WITH RECURSIVE root(id) AS ("
+      "  SELECT ?3 UNION ALL SELECT r.target FROM root"
+      "  JOIN {E} r ON r.source=root.id AND r.edge_type='REPLY_OF')"
+      " SELECT f.id, " LDBC_PROP("f","title") ", p.id,"
+      " " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName")
+      " FROM root JOIN {E} co ON co.target=root.id AND co.edge_type='CONTAINER_OF'"
+      " JOIN {N} f ON f.id=co.source"
+      " JOIN {E} mo ON mo.source=f.id AND mo.edge_type='HAS_MODERATOR'"
+      " JOIN {N} p ON p.id=mo.target" } },
+
+    /* IS7: replies to a message, and whether their authors know its author */
+    { "IS7", LDBC_SHORT, {
+      "SELECT c.id, " LDBC_PROP("c","content") ","
+      " " LDBC_PROP("c","creationDate") " AS date, a.target AS author,"
+      " " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName") ","
+      " EXISTS(SELECT 1 FROM {E} o JOIN {E} k ON k.source=o.target"
+      "  AND k.edge_type='KNOWS' AND k.target=a.target"
+      "  WHERE o.source=?3 AND o.edge_type='HAS_CREATOR')"
+      " FROM {E} r JOIN {N} c ON c.id=r.source"
+      " JOIN {E} a ON a.source=c.id AND a.edge_type='HAS_CREATOR'"
+      " JOIN {N} p ON p.id=a.target"
+      " WHERE r.target=?3 AND r.edge_type='REPLY_OF'"
+      " ORDER BY date DESC, author" } },
+
+    /* IC1: persons with a given first name within three hops */
+    { "IC1", LDBC_COMPLEX, {
+      "WITH RECURSIVE " LDBC_FRIENDS("3")
+      " SELECT p.id, " LDBC_PROP("p","lastName") " AS lastName, people.d,"
+      " " LDBC_PROP("p","birthday") ", " LDBC_PROP("p","creationDate") ","
+      " " LDBC_PROP("p","gender") ", " LDBC_PROP("p","browserUsed") ","
+      " " LDBC_PROP("p","locationIP") ", " LDBC_PROP("c","name")
+      " FROM people JOIN {N} p ON p.id=people.id"
+      " LEFT JOIN {E} l ON l.source=p.id AND l.edge_type='IS_LOCATED_IN'"
+      " LEFT JOIN {N} c ON c.id=l.target"
+      " WHERE " LDBC_PROP("p","firstName") "=?5"
+      " ORDER BY people.d, lastName, p.id LIMIT 20" } },
+
+    /* IC2: recent messages by friends */
+    { "IC2", LDBC_COMPLEX, {
+      "SELECT f.id, " LDBC_PROP("f","firstName") ", " LDBC_PROP("f","lastName") ","
+      " m.id, " LDBC_PROP("m","content") ", " LDBC_PROP("m","creationDate") " AS date"
+      " FROM {E} k JOIN {N} f ON f.id=k.target"
+      " JOIN {E} c ON c.target=k.target AND c.edge_type='HAS_CREATOR'"
+      " JOIN {N} m ON m.id=c.source"
+      " WHERE k.source=?1 AND k.edge_type='KNOWS' AND date<=?4"
+      " ORDER BY date DESC, m.id LIMIT 20" } },
+
+    /* IC3: friends and friends of friends who posted from countries X and Y */
+    { "IC3", LDBC_COMPLEX, {
+      "WITH RECURSIVE " LDBC_FRIENDS("2") ","
+      " cx(id) AS (SELECT id FROM {N} c WHERE " LDBC_PROP("c","name") "=?7"
+      "  AND " LDBC_IS("c","Country") "),"
+      " cy(id) AS (SELECT id FROM {N} c WHERE " LDBC_PROP("c","name") "=?8"
+      "  AND " LDBC_IS("c","Country") "),"
+      " visits(pid, country) AS ("
+      "  SELECT c.target, l.target FROM people"
+      "  JOIN {E} c ON c.target=people.id AND c.edge_type='HAS_CREATOR'"
+      "  JOIN {N} m ON m.id=c.source"
+      "  JOIN {E} l ON l.source=m.id AND l.edge_type='IS_LOCATED_IN'"
+      "  WHERE " LDBC_PROP("m","creationDate") ">=?4"
+      "  AND " LDBC_PROP("m","creationDate") "<?4+?9*86400000"
+      "  AND l.target IN (SELECT id FROM cx UNION ALL SELECT id FROM cy))"
+      " SELECT pid, sum(country=(SELECT id FROM cx)) AS nx,"
+      " sum(country=(SELECT id FROM cy)) AS ny, count(*)"
+      " FROM visits"
+      " WHERE NOT EXISTS(SELECT 1 FROM {E} pl"
+      "  JOIN {E} cp ON cp.source=pl.target AND cp.edge_type='IS_PART_OF'"
+      "  WHERE pl.source=visits.pid AND pl.edge_type='IS_LOCATED_IN'"
+      "  AND cp.target IN (SELECT id FROM cx UNION ALL SELECT id FROM cy))"
+      " GROUP BY pid HAVING nx>0 AND ny>0"
+      " ORDER BY nx DESC, pid LIMIT 20" } },
+
+    /* IC4: tags first used on friends' posts within a period */
+    { "IC4", LDBC_COMPLEX, {
+      "WITH fposts(id, date) AS ("
+      "  SELECT m.id, " LDBC_PROP("m","creationDate")
+      "  FROM {E} k JOIN {E} c ON c.target=k.target AND c.edge_type='HAS_CREATOR'"
+      "  JOIN {N} m ON m.id=c.source AND " LDBC_IS("m","Post")
+      "  WHERE k.source=?1 AND k.edge_type='KNOWS'),"
+      " fresh(tag) AS ("
+      "  SELECT h.target FROM fposts"
+      "  JOIN {E} h ON h.source=fposts.id AND h.edge_type='HAS_TAG'"
+      "  WHERE fposts.date>=?4 AND fposts.date<?4+?9*86400000),"
+      " old(tag) AS ("
+      "  SELECT h.target FROM fposts"
+      "  JOIN {E} h ON h.source=fposts.id AND h.edge_type='HAS_TAG'"
+      "  WHERE fposts.date<?4)"
+      " SELECT " LDBC_PROP("t","name") " AS name, count(*) AS n"
+      " FROM fresh JOIN {N} t ON t.id=fresh.tag"
+      " WHERE fresh.tag NOT IN (SELECT tag FROM old)"
+      " GROUP BY fresh.tag ORDER BY n DESC, name LIMIT 10" } },
+
+    /* IC5: forums friends and friends of friends joined after a date */
+    { "IC5", LDBC_COMPLEX, {
+      "WITH RECURSIVE " LDBC_FRIENDS("2") ","
+      " joined(forum, pid) AS ("
+      "  SELECT hm.source, hm.target FROM people"
+      "  JOIN {E} hm ON hm.target=people.id AND hm.edge_type='HAS_MEMBER'"
+      "  WHERE " LDBC_PROP("hm","joinDate") ">?4)"
+      " SELECT f.id, " LDBC_PROP("f","title") ","
+      "  (SELECT count(*) FROM {E} co"
+      "   JOIN {E} c ON c.source=co.target AND c.edge_type='HAS_CREATOR'"
+      "   WHERE co.source=f.id AND co.edge_type='CONTAINER_OF'"
+      "   AND c.target IN (SELECT pid FROM joined j WHERE j.forum=f.id)) AS posts"
+      " FROM (SELECT DISTINCT forum FROM joined) g JOIN {N} f ON f.id=g.forum"
+      " ORDER BY posts DESC, f.id LIMIT 20" } },
+
+    /* IC6: tags used together with a given tag by the 2-hop network */
+    { "IC6", LDBC_COMPLEX, {
+      "WITH RECURSIVE " LDBC_FRIENDS("2") ","
+      " tag(id) AS (SELECT id FROM {N} t WHERE " LDBC_PROP("t","name") "=?6"
+      "  AND " LDBC_IS("t","Tag") "),"
+      " tagged(id) AS ("
+      "  SELECT c.source FROM people"
+      "  JOIN {E} c ON c.target=people.id AND c.edge_type='HAS_CREATOR'"
+      "  JOIN {N} m ON m.id=c.source AND " LDBC_IS("m","Post")
+      "  JOIN {E} h ON h.source=c.source AND h.edge_type='HAS_TAG'"
+      "  AND h.target=(SELECT id FROM tag))"
+      " SELECT " LDBC_PROP("t","name") " AS name, count(*) AS n"
+      " FROM tagged JOIN {E} h ON h.source=tagged.id AND h.edge_type='HAS_TAG'"
+      " JOIN {N} t ON t.id=h.target"
+      " WHERE h.target<>(SELECT id FROM tag)"
+      " GROUP BY h.target ORDER BY n DESC, name LIMIT 10" } },
+
+    /* IC7: most recent likers of a person's messages */
+    { "IC7", LDBC_COMPLEX, {
+      "WITH likes(liker, mid, likeDate, msgDate) AS ("
+      "  SELECT l.source, m.id, " LDBC_PROP("l","creationDate") ","
+      "  " LDBC_PROP("m","creationDate")
+      "  FROM {E} c JOIN {E} l ON l.target=c.source AND l.edge_type='LIKES'"
+      "  JOIN {N} m ON m.id=c.source"
+      "  WHERE c.target=?1 AND c.edge_type='HAS_CREATOR'),"
+      " latest(liker, likeDate, mid, msgDate) AS ("
+      "  SELECT liker, max(likeDate), mid, msgDate FROM likes GROUP BY liker)"
+      " SELECT latest.liker, " LDBC_PROP("p","firstName") ","
+      " " LDBC_PROP("p","lastName") ", latest.likeDate, latest.mid,"
+      " (latest.likeDate-latest.msgDate)/60000,"
+      " NOT EXISTS(SELECT 1 FROM {E} k WHERE k.source=?1"
+      "  AND k.edge_type='KNOWS' AND k.target=latest.liker)"
+      " FROM latest JOIN {N} p ON p.id=latest.liker"
+      " ORDER BY latest.likeDate DESC, latest.liker LIMIT 20" } },
+
+    /* IC8: most recent replies to a person's messages */
+    { "IC8", LDBC_COMPLEX, {
+      "SELECT a.target, " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName") ","
+      " " LDBC_PROP("cm","creationDate") " AS date, cm.id, " LDBC_PROP("cm","content")
+      " FROM {E} c JOIN {E} r ON r.target=c.source AND r.edge_type='REPLY_OF'"
+      " JOIN {N} cm ON cm.id=r.source"
+      " JOIN {E} a ON a.source=cm.id AND a.edge_type='HAS_CREATOR'"
+      " JOIN {N} p ON p.id=a.target"
+      " WHERE c.target=?1 AND c.edge_type='HAS_CREATOR'"
+      " ORDER BY date DESC, cm.id LIMIT 20" } },
+
+    /* IC9: recent messages by friends and friends of friends */
+    { "IC9", LDBC_COMPLEX, {
+      "WITH RECURSIVE " LDBC_FRIENDS("2")
+      " SELECT p.id, " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName") ","
+      " m.id, " LDBC_PROP("m","content") ", " LDBC_PROP("m","creationDate") " AS date"
+      " FROM people JOIN {N} p ON p.id=people.id"
+      " JOIN {E} c ON c.target=people.id AND c.edge_type='HAS_CREATOR'"
+      " JOIN {N} m ON m.id=c.source"
+      " WHERE date<?4"
+      " ORDER BY date DESC, m.id LIMIT 20" } },
+
+    /* IC10: friend recommendation by birthday and shared interests */
+    { "IC10", LDBC_COMPLEX, {
+      "WITH fof(id) AS ("
+      "  SELECT DISTINCT k2.target FROM {E} k1"
+      "  JOIN {E} k2 ON k2.source=k1.target AND k2.edge_type='KNOWS'"
+      "  WHERE k1.source=?1 AND k1.edge_type='KNOWS' AND k2.target<>?1"
+      "  AND k2.target NOT IN (SELECT target FROM {E}"
+      "   WHERE source=?1 AND edge_type='KNOWS')),"
+      " cand(id, props, month, day) AS ("
+      "  SELECT p.id, p.properties,"
+      "  CAST(substr(" LDBC_PROP("p","birthday") ",6,2) AS INTEGER),"
+      "  CAST(substr(" LDBC_PROP("p","birthday") ",9,2) AS INTEGER)"
+      "  FROM fof JOIN {N} p ON p.id=fof.id),"
+      " interest(tag) AS (SELECT target FROM {E}"
+      "  WHERE source=?1 AND edge_type='HAS_INTEREST')"
+      " SELECT cand.id, json_extract(cand.props,'$.firstName'),"
+      " json_extract(cand.props,'$.lastName'), json_extract(cand.props,'$.gender'),"
+      " coalesce((SELECT sum(CASE WHEN EXISTS(SELECT 1 FROM {E} h"
+      "   WHERE h.source=c.source AND h.edge_type='HAS_TAG'"
+      "   AND h.target IN (SELECT tag FROM interest)) THEN 1 ELSE -1 END)"
+      "  FROM {E} c JOIN {N} m ON m.id=c.source AND " LDBC_IS("m","Post")
+      "  WHERE c.target=cand.id AND c.edge_type='HAS_CREATOR'), 0) AS score"
+      " FROM cand"
+      " WHERE (month=?10 AND day>=21) OR (month=?10%12+1 AND day<22)"
+      " ORDER BY score DESC, cand.id LIMIT 10" } },
+
+    /* IC11: friends and friends of friends working in a country */
+    { "IC11", LDBC_COMPLEX, {
+      "WITH RECURSIVE " LDBC_FRIENDS("2") ","
+      " country(id) AS (SELECT id FROM {N} c WHERE " LDBC_PROP("c","name") "=?7"
+      "  AND " LDBC_IS("c","Country") ")"
+      " SELECT p.id, " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName") ","
+      " " LDBC_PROP("o","name") " AS org, " LDBC_PROP("w","workFrom") " AS since"
+      " FROM people JOIN {E} w ON w.source=people.id AND w.edge_type='WORK_AT'"
+      " JOIN {E} ol ON ol.source=w.target AND ol.edge_type='IS_LOCATED_IN'"
+      " JOIN {N} o ON o.id=w.target JOIN {N} p ON p.id=people.id"
+      " WHERE ol.target=(SELECT id FROM country) AND since<?12"
+      " ORDER BY since, p.id, org DESC LIMIT 10" } },
+
+    /* IC12: friends replying to posts with tags of a tag class */
+    { "IC12", LDBC_COMPLEX, {
+      "SELECT k.target, " LDBC_PROP("p","firstName") ", " LDBC_PROP("p","lastName") ","
+      " count(DISTINCT r.source) AS replies"
+      " FROM {E} k"
+      " JOIN {E} c ON c.target=k.target AND c.edge_type='HAS_CREATOR'"
+      " JOIN {E} r ON r.source=c.source AND r.edge_type='REPLY_OF'"
+      " JOIN {N} post ON post.id=r.target AND " LDBC_IS("post","Post")
+      " JOIN {E} h ON h.source=r.target AND h.edge_type='HAS_TAG'"
+      " JOIN {E} ty ON ty.source=h.target AND ty.edge_type='HAS_TYPE'"
+      " JOIN {N} tc ON tc.id=ty.target"
+      " JOIN {N} p ON p.id=k.target"
+      " WHERE k.source=?1 AND k.edge_type='KNOWS'"
+      " AND " LDBC_PROP("tc","name") "=?11"
+      " GROUP BY k.target ORDER BY replies DESC, k.target LIMIT 20" } },
+
+    /* IC13: length of the shortest KNOWS path, -1 beyond the bound */
+    { "IC13", LDBC_COMPLEX, {
+      "WITH RECURSIVE bfs(id, d) AS ("
+      "  SELECT ?1, 0 UNION SELECT k.target, bfs.d+1 FROM bfs"
+      "  JOIN {E} k ON k.source=bfs.id AND k.edge_type='KNOWS'"
+      "  WHERE bfs.d<" LDBC_MAX_HOPS ")"
+      " SELECT coalesce(min(d), -1) FROM bfs WHERE id=?2" } },
+
+    /* IC14: all shortest KNOWS paths, weighted by replies between
+    ** neighbours (1.0 to a post, 0.5 to a comment) */
+    { "IC14", LDBC_COMPLEX, {
+      "WITH RECURSIVE"
+      " s(id, d) AS (SELECT ?1, 0 UNION SELECT k.target, s.d+1 FROM s"
+      "  JOIN {E} k ON k.source=s.id AND k.edge_type='KNOWS'"
+      "  WHERE s.d<" LDBC_MAX_HOPS "),"
+      " t(id, d) AS (SELECT ?2, 0 UNION SELECT k.target, t.d+1 FROM t"
+      "  JOIN {E} k ON k.source=t.id AND k.edge_type='KNOWS'"
+      "  WHERE t.d<" LDBC_MAX_HOPS "),"
+      " ds(id, d) AS (SELECT id, min(d) FROM s GROUP BY id),"
+      " dt(id, d) AS (SELECT id, min(d) FROM t GROUP BY id),"
+      " onpath(id, d) AS (SELECT ds.id, ds.d FROM ds JOIN dt ON dt.id=ds.id"
+      "  WHERE ds.d+dt.d=(SELECT d FROM ds WHERE id=?2)),"
+      " path(id, d, nodes, w) AS ("
+      "  SELECT ?1, 0, CAST(?1 AS TEXT), 0.0"
+      "  UNION ALL SELECT k.target, path.d+1, path.nodes||','||k.target,"
+      "  path.w+(SELECT coalesce(sum(CASE WHEN " LDBC_IS("pm","Post")
+      "    THEN 1.0 ELSE 0.5 END), 0)"
+      "   FROM {E} a JOIN {E} r ON r.source=a.source AND r.edge_type='REPLY_OF'"
+      "   JOIN {N} pm ON pm.id=r.target"
+      "   JOIN {E} b ON b.source=r.target AND b.edge_type='HAS_CREATOR'"
+      "   WHERE a.edge_type='HAS_CREATOR' AND a.target IN (path.id, k.target)"
+      "   AND b.target IN (path.id, k.target) AND a.target<>b.target)"
+      "  FROM path JOIN {E} k ON k.source=path.id AND k.edge_type='KNOWS'"
+      "  JOIN onpath o ON o.id=k.target AND o.d=path.d+1)"
+      " SELECT nodes, w FROM path WHERE id=?2 ORDER BY w DESC, nodes" } },
+
+    /* IU1: add a person */
+    { "IU1", LDBC_UPDATE, {
+      "INSERT INTO {N}(id, labels, properties) VALUES(?13, '[\"Person\"]',"
+      " json_object('firstName', ?5, 'lastName', 'Added', 'gender', 'female',"
+      " 'birthday', '1990-01-01', 'creationDate', ?4,"
+      " 'locationIP', '10.9.9.9', 'browserUsed', 'Firefox'))",
+      "INSERT INTO {E}(source, target, edge_type, weight, properties) VALUES"
+      " (?13, ?17, 'IS_LOCATED_IN', 1.0, '{}'),"
+      " (?13, ?18, 'HAS_INTEREST', 1.0, '{}'),"
+      " (?13, ?21, 'STUDY_AT', 1.0, json_object('classYear', ?12)),"
+      " (?13, ?20, 'WORK_AT', 1.0, json_object('workFrom', ?12))" } },
+
+    /* IU2: add a like to a post */
+    { "IU2", LDBC_UPDATE, {
+      "INSERT INTO {E}(source, target, edge_type, weight, properties)"
+      " VALUES(?1, ?14, 'LIKES', 1.0, json_object('creationDate', ?4))" } },
+
+    /* IU3: add a like to a comment */
+    { "IU3", LDBC_UPDATE, {
+      "INSERT INTO {E}(source, target, edge_type, weight, properties)"
+      " VALUES(?1, ?15, 'LIKES', 1.0, json_object('creationDate', ?4))" } },
+
+    /* IU4: add a forum */
+    { "IU4", LDBC_UPDATE, {
+      "INSERT INTO {N}(id, labels, properties) VALUES(?13, '[\"Forum\"]',"
+      " json_object('title', 'Forum '||?13, 'creationDate', ?4))",
+      "INSERT INTO {E}(source, target, edge_type, weight, properties) VALUES"
+      " (?13, ?1, 'HAS_MODERATOR', 1.0, '{}'),"
+      " (?13, ?18, 'HAS_TAG', 1.0, '{}')" } },
+
+    /* IU5: add a forum membership */
+    { "IU5", LDBC_UPDATE, {
+      "INSERT INTO {E}(source, target, edge_type, weight, properties)"
+      " VALUES(?16, ?1, 'HAS_MEMBER', 1.0, json_object('joinDate', ?4))" } },
+
+    /* IU6: add a post */
+    { "IU6", LDBC_UPDATE, {
+      "INSERT INTO {N}(id, labels, properties) VALUES(?13, '[\"Post\"]',"
+      " json_object('content', 'Added post '||?13, 'length', 16,"
+      " 'creationDate', ?4, 'language', 'en', 'browserUsed', 'Firefox',"
+      " 'locationIP', '10.9.9.9'))",
+      "INSERT INTO {E}(source, target, edge_type, weight, properties) VALUES"
+      " (?13, ?1, 'HAS_CREATOR', 1.0, '{}'),"
+      " (?16, ?13, 'CONTAINER_OF', 1.0, '{}'),"
+      " (?13, ?19, 'IS_LOCATED_IN', 1.0, '{}'),"
+      " (?13, ?18, 'HAS_TAG', 1.0, '{}')" } },
+
+    /* IU7: add a comment */
+    { "IU7", LDBC_UPDATE, {
+      "INSERT INTO {N}(id, labels, properties) VALUES(?13, '[\"Comment\"]',"
+      " json_object('content', 'Added reply '||?13, 'length', 17,"
+      " 'creationDate', ?4, 'browserUsed', 'Firefox', 'locationIP', '10.9.9.9'))",
+      "INSERT INTO {E}(source, target, edge_type, weight, properties) VALUES"
+      " (?13, ?1, 'HAS_CREATOR', 1.0, '{}'),"
+      " (?13, ?3, 'REPLY_OF', 1.0, '{}'),"
+      " (?13, ?19, 'IS_LOCATED_IN', 1.0, '{}'),"
+      " (?13, ?18, 'HAS_TAG', 1.0, '{}')" } },
+
+    /* IU8: add a friendship */
+    { "IU8", LDBC_UPDATE, {
+      "INSERT INTO {E}(source, target, edge_type, weight, properties) VALUES"
+      " (?1, ?2, 'KNOWS', 1.0, json_object('creationDate', ?4)),"
+      " (?2, ?1, 'KNOWS', 1.0, json_object('creationDate', ?4))" } },
+};
+
+#define LDBC_NOP LDBC_COUNT(aLdbcOp)
+
+/* Values of ?1 .. ?LDBC_NPARAM for one run of an operation */
+typedef struct LdbcParams {
+    sqlite3_int64 aInt[LDBC_NPARAM + 1];
+    const char *azText[LDBC_NPARAM + 1];  /* Text parameters, else NULL */
+    char zTag[24], zCountryX[24], zCountryY[24], zTagClass[24];
+} LdbcParams;
+
+static void ldbcParamsNext(const LdbcLayout *L, sqlite3_uint64 *pRandom,
+                           LdbcParams *p) {
+    sqlite3_int64 iMsg = ldbcRandomRange(pRandom, L->nPost + L->nComment);
+    int iCountry = (int)ldbcRandomRange(pRandom, LDBC_COUNTRIES);
+
+    memset(p->azText, 0, sizeof(p->azText));
+    p->aInt[1] = L->iPerson + ldbcRandomRange(pRandom, L->nPerson);
+    p->aInt[2] = L->iPerson + ldbcRandomRange(pRandom, L->nPerson - 1);
+    if (p->aInt[2] >= p->aInt[1]) p->aInt[2]++;
+    p->aInt[3] = L->iPost + iMsg;
+    p->aInt[4] = LDBC_START_DATE + LDBC_MS_PER_DAY
+               * ldbcRandomRange(pRandom, LDBC_SPAN_DAYS);
+    p->azText[5] = azLdbcFirstName[ldbcRandomRange(pRandom, LDBC_COUNT(azLdbcFirstName))];
+    sqlite3_snprintf(sizeof(p->zTag), p->zTag, "Tag_%d",
+                     (int)ldbcRandomRange(pRandom, LDBC_TAGS));
+    p->azText[6] = p->zTag;
+    sqlite3_snprintf(sizeof(p->zCountryX), p->zCountryX, "Country_%d", iCountry);
+    p->azText[7] = p->zCountryX;
+    sqlite3_snprintf(sizeof(p->zCountryY), p->zCountryY, "Country_%d",
+                     (iCountry + 1 + (int)ldbcRandomRange(pRandom, LDBC_COUNTRIES - 1))
+                     % LDBC_COUNTRIES);
+    p->azText[8] = p->zCountryY;
+    p->aInt[9] = 30 + ldbcRandomRange(pRandom, 60);
+    p->aInt[10] = 1 + ldbcRandomRange(pRandom, 12);
+    sqlite3_snprintf(sizeof(p->zTagClass), p->zTagClass, "TagClass_%d",
+                     (int)ldbcRandomRange(pRandom, LDBC_TAGCLASSES));
+    p->azText[11] = p->zTagClass;
+    p->aInt[12] = 2000 + ldbcRandomRange(pRandom, 13);
+    p->aInt[13] = 0;
+    p->aInt[14] = L->iPost + ldbcRandomRange(pRandom, L->nPost);
+    p->aInt[15] = L->iComment + ldbcRandomRange(pRandom, L->nComment);
+    p->aInt[16] = L->iForum + ldbcRandomRange(pRandom, L->nForum);
+    p->aInt[17] = L->iCity + ldbcRandomRange(pRandom, LDBC_CITIES);
+    p->aInt[18] = L->iTag + ldbcRandomRange(pRandom, LDBC_TAGS);
+    p->aInt[19] = L->iCountry + iCountry;
+    p->aInt[20] = L->iCompany + ldbcRandomRange(pRandom, LDBC_COMPANIES);
+    p->aInt[21] = L->iUniversity + ldbcRandomRange(pRandom, LDBC_UNIVERSITIES);
+}
+
+/* Replace {N} and {E} in zTemplate with the tables of graph zGraph */
+static char *ldbcExpandSql(const char *zTemplate, const char *zGraph) {
+    sqlite3_str *pStr = sqlite3_str_new(0);
+    const char *z;
+
+    for (z = zTemplate; *z; z++) {
+        if (z[0] == '{' && (z[1] == 'N' || z[1] == 'E') && z[2] == '}') {
+            sqlite3_str_appendf(pStr, "\"%w_%s\"", zGraph,
+                                z[1] == 'N' ? "nodes" : "edges");
+            z += 2;
+        } else {
+            sqlite3_str_appendchar(pStr, 1, *z);
+        }
+    }
+    return sqlite3_str_finish(pStr);
 }
 
 /*
-** Run complete benchmark suite
+** Measurement
 */
-int graphRunBenchmarkSuite(sqlite3 *db, BenchmarkConfig *config) {
+
+/* One connection running a share of the workload */
+typedef struct LdbcWorker {
+    sqlite3 *db;                 /* Connection used */
+    int bOwnDb;                  /* db was opened by this worker */
+    const char *zFile;           /* Database file to open, or NULL */
+    const char *zGraph;
+    const LdbcLayout *pLayout;
+    const BenchmarkConfig *config;
+    int eKind;                   /* Run LDBC_UPDATE ops, or all the others */
+    sqlite3_uint64 iRandom;      /* Parameter stream */
+    sqlite3_int64 iNextId;       /* Next id for inserted nodes */
+    sqlite3_stmt *apStmt[LDBC_NOP][LDBC_MAX_STMT];
+    double *aTime;               /* [op][run] latencies, ms */
+    sqlite3_int64 anRows[LDBC_NOP];
+    int anError[LDBC_NOP];
+    char *azError[LDBC_NOP];     /* First error of each operation */
+    sqlite3_int64 iStart, iEnd;  /* Measured interval, graphMetricsClock() */
     int rc;
-    
-    /* Generate test data if needed */
-    sqlite3_stmt *pStmt;
-    rc = sqlite3_prepare_v2(db, 
-        "SELECT COUNT(*) FROM sqlite_master WHERE name='ldbc_graph'",
-        -1, &pStmt, NULL);
-    
-    int dataExists = 0;
-    if (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
-        dataExists = sqlite3_column_int(pStmt, 0) > 0;
+} LdbcWorker;
+
+static int ldbcWorkerRuns(const LdbcWorker *p, int iOp) {
+    return (aLdbcOp[iOp].eKind == LDBC_UPDATE) == (p->eKind == LDBC_UPDATE);
+}
+
+static int ldbcWorkerPrepare(LdbcWorker *p) {
+    int i, j;
+
+    for (i = 0; i < LDBC_NOP; i++) {
+        if (!ldbcWorkerRuns(p, i)) continue;
+        for (j = 0; j < LDBC_MAX_STMT && aLdbcOp[i].azSql[j]; j++) {
+            char *zSql = ldbcExpandSql(aLdbcOp[i].azSql[j], p->zGraph);
+            int rc;
+            if (!zSql) return SQLITE_NOMEM;
+            rc = sqlite3_prepare_v2(p->db, zSql, -1, &p->apStmt[i][j], NULL);
+            sqlite3_free(zSql);
+            if (rc != SQLITE_OK && !p->azError[i]) {
+                p->azError[i] = sqlite3_mprintf("%s", sqlite3_errmsg(p->db));
+            }
+        }
+    }
+    return SQLITE_OK;
+}
+
+/* Run operation iOp once; returns the time taken in ms */
+static double ldbcWorkerRun(LdbcWorker *p, int iOp, LdbcParams *pParams,
+                            int bMeasure) {
+    sqlite3_int64 iStart = graphMetricsClock();
+    sqlite3_int64 nRows = 0;
+    int rc = SQLITE_OK;
+    int i, j;
+
+    if (aLdbcOp[iOp].eKind == LDBC_UPDATE) pParams->aInt[13] = p->iNextId++;
+    for (i = 0; i < LDBC_MAX_STMT && rc == SQLITE_OK; i++) {
+        sqlite3_stmt *pStmt = p->apStmt[iOp][i];
+        int nParam;
+        if (!pStmt) {
+            if (aLdbcOp[iOp].azSql[i]) rc = SQLITE_ERROR;
+            break;
+        }
+        nParam = sqlite3_bind_parameter_count(pStmt);
+        for (j = 1; j <= nParam && j <= LDBC_NPARAM; j++) {
+            if (pParams->azText[j]) {
+                sqlite3_bind_text(pStmt, j, pParams->azText[j], -1, SQLITE_STATIC);
+            } else {
+                sqlite3_bind_int64(pStmt, j, pParams->aInt[j]);
+            }
+        }
+        while ((rc = sqlite3_step(pStmt)) == SQLITE_ROW) nRows++;
+        if (rc == SQLITE_DONE) rc = SQLITE_OK;
+        if (rc != SQLITE_OK && bMeasure && !p->azError[iOp]) {
+            p->azError[iOp] = sqlite3_mprintf("%s", sqlite3_errmsg(p->db));
+        }
+        sqlite3_reset(pStmt);
+    }
+    if (bMeasure) {
+        if (rc != SQLITE_OK) p->anError[iOp]++;
+        p->anRows[iOp] += nRows;
+    }
+    return (double)(graphMetricsClock() - iStart) / 1000.0;
+}
+
+/*
+** Run the worker's operations: warmup rounds, then measureRuns rounds
+** of every operation in turn. Workers start at different operations so
+** that concurrent connections do not run the same query in lockstep.
+*/
+static void *ldbcWorkerMain(void *pArg) {
+    LdbcWorker *p = (LdbcWorker*)pArg;
+    const BenchmarkConfig *config = p->config;
+    LdbcParams params;
+    int iFirst = (int)(p->iRandom % LDBC_NOP);
+    int iRun, k;
+
+    if (p->zFile) {
+        p->rc = sqlite3_open_v2(p->zFile, &p->db, SQLITE_OPEN_READONLY, NULL);
+        p->bOwnDb = 1;
+        if (p->rc != SQLITE_OK) return NULL;
+        sqlite3_busy_timeout(p->db, 5000);
+    }
+    p->rc = ldbcWorkerPrepare(p);
+    if (p->rc != SQLITE_OK) return NULL;
+
+    for (iRun = 0; iRun < config->warmupRuns; iRun++) {
+        for (k = 0; k < LDBC_NOP; k++) {
+            if (!ldbcWorkerRuns(p, k)) continue;
+            ldbcParamsNext(p->pLayout, &p->iRandom, &params);
+            ldbcWorkerRun(p, k, &params, 0);
+        }
+    }
+
+    p->iStart = graphMetricsClock();
+    for (iRun = 0; iRun < config->measureRuns; iRun++) {
+        for (k = 0; k < LDBC_NOP; k++) {
+            int iOp = (iFirst + k) % LDBC_NOP;
+            if (!ldbcWorkerRuns(p, iOp)) continue;
+            ldbcParamsNext(p->pLayout, &p->iRandom, &params);
+            p->aTime[iOp * config->measureRuns + iRun]
+                = ldbcWorkerRun(p, iOp, &params, 1);
+        }
+    }
+    p->iEnd = graphMetricsClock();
+    return NULL;
+}
+
+static void ldbcWorkerFinish(LdbcWorker *p) {
+    int i, j;
+
+    for (i = 0; i < LDBC_NOP; i++) {
+        for (j = 0; j < LDBC_MAX_STMT; j++) sqlite3_finalize(p->apStmt[i][j]);
+        sqlite3_free(p->azError[i]);
+    }
+    if (p->bOwnDb) sqlite3_close(p->db);
+    sqlite3_free(p->aTime);
+}
+
+static int ldbcCompareDouble(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of n sorted values */
+static double ldbcPercentile(const double *a, int n, double q) {
+    int i = (int)(q * n + 0.999999);
+    if (i < 1) i = 1;
+    if (i > n) i = n;
+    return a[i - 1];
+}
+
+static void ldbcJsonKeyValue(sqlite3_str *pStr, const char *zKey, double r) {
+    sqlite3_str_appendf(pStr, ",\"%s\":%.3f", zKey, r);
+}
+
+/*
+** Append the report entry of operation iOp, merged over nWorker
+** workers, and return the number of measured runs.
+*/
+static int ldbcReportOp(sqlite3_str *pStr, int iOp, LdbcWorker *aWorker,
+                        int nWorker, const BenchmarkConfig *config,
+                        double *aScratch) {
+    const char *azKind[] = { "short", "complex", "update" };
+    const char *zError = NULL;
+    sqlite3_int64 nRows = 0;
+    double rSum = 0.0;
+    int nRun = 0, nError = 0;
+    int i, j;
+
+    for (i = 0; i < nWorker; i++) {
+        LdbcWorker *p = &aWorker[i];
+        if (!ldbcWorkerRuns(p, iOp)) continue;
+        for (j = 0; j < config->measureRuns; j++) {
+            aScratch[nRun] = p->aTime[iOp * config->measureRuns + j];
+            rSum += aScratch[nRun++];
+        }
+        nRows += p->anRows[iOp];
+        nError += p->anError[iOp];
+        if (!zError) zError = p->azError[iOp];
+    }
+    qsort(aScratch, nRun, sizeof(double), ldbcCompareDouble);
+
+    sqlite3_str_appendf(pStr,
+        "{\"test\":\"ldbc_sf%d_%s\",\"query\":\"%s\",\"kind\":\"%s\","
+        "\"runs\":%d,\"errors\":%d,\"rows\":%.1f",
+        config->scale, aLdbcOp[iOp].zName, aLdbcOp[iOp].zName,
+        azKind[aLdbcOp[iOp].eKind], nRun, nError,
+        nRun ? (double)nRows / nRun : 0.0);
+    if (nRun > 0) {
+        ldbcJsonKeyValue(pStr, "min", aScratch[0]);
+        ldbcJsonKeyValue(pStr, "avg", rSum / nRun);
+        ldbcJsonKeyValue(pStr, "p50", ldbcPercentile(aScratch, nRun, 0.50));
+        ldbcJsonKeyValue(pStr, "p95", ldbcPercentile(aScratch, nRun, 0.95));
+        ldbcJsonKeyValue(pStr, "p99", ldbcPercentile(aScratch, nRun, 0.99));
+        ldbcJsonKeyValue(pStr, "max", aScratch[nRun - 1]);
+    }
+    if (zError) {
+        sqlite3_str_appendall(pStr, ",\"error\":\"");
+        for (j = 0; zError[j]; j++) {
+            char c = zError[j];
+            if (c == '"' || c == '\\') sqlite3_str_appendchar(pStr, 1, '\\');
+            if ((unsigned char)c >= 0x20) sqlite3_str_appendchar(pStr, 1, c);
+        }
+        sqlite3_str_appendchar(pStr, 1, '"');
+    }
+    sqlite3_str_appendchar(pStr, 1, '}');
+    return nRun;
+}
+
+/* Measured interval over a set of workers, in seconds */
+static double ldbcElapsed(LdbcWorker *aWorker, int nWorker) {
+    sqlite3_int64 iStart = 0, iEnd = 0;
+    int i;
+    for (i = 0; i < nWorker; i++) {
+        if (i == 0 || aWorker[i].iStart < iStart) iStart = aWorker[i].iStart;
+        if (i == 0 || aWorker[i].iEnd > iEnd) iEnd = aWorker[i].iEnd;
+    }
+    return (double)(iEnd - iStart) / 1e6;
+}
+
+static sqlite3_int64 ldbcCount(sqlite3 *db, const char *zGraph,
+                               const char *zTable) {
+    sqlite3_int64 n = -1;
+    sqlite3_stmt *pStmt = NULL;
+    char *zSql = sqlite3_mprintf("SELECT count(*) FROM \"%w_%s\"", zGraph, zTable);
+    if (zSql && sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) == SQLITE_OK
+     && sqlite3_step(pStmt) == SQLITE_ROW) {
+        n = sqlite3_column_int64(pStmt, 0);
     }
     sqlite3_finalize(pStmt);
-    
-    if (!dataExists) {
-        printf("Generating LDBC benchmark data (scale=%d)...\n", config->scale);
-        rc = generateLDBCData(db, config->scale);
-        if (rc != SQLITE_OK) {
-            fprintf(stderr, "Failed to generate benchmark data\n");
-            return rc;
+    sqlite3_free(zSql);
+    return n;
+}
+
+/*
+** Run the complete benchmark suite. The data for scale factor s lives in
+** graph ldbc_sf<s> and is generated on first use. On success *pzReport
+** is the JSON report, which the caller frees with sqlite3_free().
+*/
+static int graphRunBenchmarkSuite(sqlite3 *db, BenchmarkConfig *config,
+                                  char **pzReport, char **pzErr) {
+    LdbcLayout layout;
+    LdbcWorker *aWorker = NULL;
+    pthread_t *aThread = NULL;
+    sqlite3_str *pStr = NULL;
+    double *aScratch = NULL;
+    char zGraph[32];
+    const char *zFile;
+    double rLoad = 0.0, rRead, rUpdate;
+    sqlite3_int64 nRead = 0, nUpdate = 0;
+    sqlite3_int64 nNode, nEdge;
+    int nWorker, nThreads;
+    int bSavepoint = 0;
+    int rc = SQLITE_OK;
+    int i;
+
+    *pzReport = NULL;
+    *pzErr = NULL;
+    ldbcLayoutInit(&layout, config->scale);
+    sqlite3_snprintf(sizeof(zGraph), zGraph, "ldbc_sf%d", config->scale);
+
+    /* Generate test data if needed */
+    {
+        sqlite3_stmt *pStmt;
+        int dataExists = 0;
+        rc = sqlite3_prepare_v2(db,
+            "SELECT COUNT(*) FROM sqlite_master WHERE name=?1", -1, &pStmt, NULL);
+        if (rc != SQLITE_OK) return rc;
+        sqlite3_bind_text(pStmt, 1, zGraph, -1, SQLITE_STATIC);
+        if (sqlite3_step(pStmt) == SQLITE_ROW) {
+            dataExists = sqlite3_column_int(pStmt, 0) > 0;
+        }
+        sqlite3_finalize(pStmt);
+
+        if (!dataExists) {
+            sqlite3_int64 iStart = graphMetricsClock();
+            rc = generateLDBCData(db, zGraph, &layout);
+            if (rc != SQLITE_OK) {
+                *pzErr = sqlite3_mprintf("failed to generate %s: %s",
+                                         zGraph, sqlite3_errmsg(db));
+                return rc;
+            }
+            rLoad = (double)(graphMetricsClock() - iStart) / 1e6;
         }
     }
-    
-    /* Run benchmarks */
-    BenchmarkResult **results = sqlite3_malloc(10 * sizeof(BenchmarkResult*));
-    int nResults = 0;
-    
-    /* Interactive workload queries */
-    results[nResults++] = benchmarkLDBCQuery1(db, config);
-    results[nResults++] = benchmarkLDBCQuery2(db, config);
-    /* Add more queries... */
-    
-    /* Print results */
-    printf("\n=== Benchmark Results ===\n");
-    printf("Scale Factor: %d\n", config->scale);
-    printf("Threads: %d\n", config->nThreads);
-    printf("Warmup Runs: %d\n", config->warmupRuns);
-    printf("Measurement Runs: %d\n\n", config->measureRuns);
-    
-    printf("%-40s %10s %10s %10s %10s %10s\n",
-           "Query", "Min (ms)", "Max (ms)", "Avg (ms)", "StdDev", "Results");
-    for (int i = 0; i < 120; i++) printf("-");
-    printf("\n");
-    
-    for (int i = 0; i < nResults; i++) {
-        BenchmarkResult *r = results[i];
-        if (r) {
-            printf("%-40s %10.2f %10.2f %10.2f %10.2f %10lld\n",
-                   r->queryName, r->minTime, r->maxTime, 
-                   r->avgTime, r->stdDev, r->resultCount);
-            
-            if (r->errorMsg) {
-                printf("  ERROR: %s\n", r->errorMsg);
+
+    /* Concurrent readers need connections of their own, so a database
+    ** without a file runs its reads on the calling connection only */
+    zFile = sqlite3_db_filename(db, "main");
+    nThreads = config->nThreads > 1 && zFile && zFile[0] ? config->nThreads : 1;
+    nWorker = nThreads + 1;
+
+    aWorker = sqlite3_malloc64(nWorker * sizeof(LdbcWorker));
+    aThread = sqlite3_malloc64(nWorker * sizeof(pthread_t));
+    aScratch = sqlite3_malloc64((sqlite3_int64)nWorker * config->measureRuns
+                                * sizeof(double) + 1);
+    if (!aWorker || !aThread || !aScratch) {
+        rc = SQLITE_NOMEM;
+        goto benchmark_done;
+    }
+    memset(aWorker, 0, nWorker * sizeof(LdbcWorker));
+    for (i = 0; i < nWorker; i++) {
+        LdbcWorker *p = &aWorker[i];
+        p->db = db;
+        p->zFile = nThreads > 1 && i < nThreads ? zFile : NULL;
+        p->zGraph = zGraph;
+        p->pLayout = &layout;
+        p->config = config;
+        p->eKind = i < nThreads ? LDBC_COMPLEX : LDBC_UPDATE;
+        p->iRandom = 1000 + (sqlite3_uint64)i;
+        p->iNextId = layout.iNextId;
+        p->aTime = sqlite3_malloc64((sqlite3_int64)LDBC_NOP * config->measureRuns
+                                    * sizeof(double) + 1);
+        if (!p->aTime) {
+            rc = SQLITE_NOMEM;
+            goto benchmark_done;
+        }
+        memset(p->aTime, 0, (size_t)LDBC_NOP * config->measureRuns * sizeof(double));
+    }
+
+    /* Read phase */
+    if (nThreads > 1) {
+        int nStarted;
+        for (nStarted = 0; nStarted < nThreads; nStarted++) {
+            if (pthread_create(&aThread[nStarted], NULL, ldbcWorkerMain,
+                               &aWorker[nStarted]) != 0) {
+                aWorker[nStarted].rc = SQLITE_ERROR;
+                break;
             }
         }
+        for (i = 0; i < nStarted; i++) pthread_join(aThread[i], NULL);
+    } else {
+        ldbcWorkerMain(&aWorker[0]);
+    }
+    for (i = 0; i < nThreads && rc == SQLITE_OK; i++) {
+        if (aWorker[i].rc != SQLITE_OK) {
+            rc = aWorker[i].rc;
+            *pzErr = sqlite3_mprintf("reader connection %d failed: %s", i,
+                aWorker[i].db ? sqlite3_errmsg(aWorker[i].db) : sqlite3_errstr(rc));
+        }
+    }
+    if (rc != SQLITE_OK) goto benchmark_done;
+
+    /* Update phase, undone afterwards so the data stays as generated */
+    nNode = ldbcCount(db, zGraph, "nodes");
+    nEdge = ldbcCount(db, zGraph, "edges");
+    rc = sqlite3_exec(db, "SAVEPOINT ldbc_updates", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) goto benchmark_done;
+    bSavepoint = 1;
+    ldbcWorkerMain(&aWorker[nThreads]);
+    rc = aWorker[nThreads].rc;
+    if (rc != SQLITE_OK) goto benchmark_done;
+
+    /* Report */
+    rRead = ldbcElapsed(aWorker, nThreads);
+    rUpdate = ldbcElapsed(&aWorker[nThreads], 1);
+    pStr = sqlite3_str_new(db);
+    sqlite3_str_appendall(pStr, "{\"benchmark\":\"ldbc_snb_interactive\"");
+    sqlite3_str_appendf(pStr,
+        ",\"scale_factor\":%d,\"threads\":%d,\"warmup_runs\":%d,\"measure_runs\":%d"
+        ",\"nodes\":%lld,\"edges\":%lld,\"load_s\":%.3f,\"queries\":[",
+        config->scale, nThreads, config->warmupRuns, config->measureRuns,
+        nNode, nEdge, rLoad);
+    for (i = 0; i < LDBC_NOP; i++) {
+        int nRun;
+        if (i > 0) sqlite3_str_appendchar(pStr, 1, ',');
+        if (aLdbcOp[i].eKind == LDBC_UPDATE) {
+            nRun = ldbcReportOp(pStr, i, &aWorker[nThreads], 1, config, aScratch);
+            nUpdate += nRun;
+        } else {
+            nRun = ldbcReportOp(pStr, i, aWorker, nThreads, config, aScratch);
+            nRead += nRun;
+        }
     }
-    
+    sqlite3_str_appendf(pStr,
+        "],\"read_ops\":%lld,\"read_s\":%.3f,\"read_ops_per_s\":%.1f"
+        ",\"update_ops\":%lld,\"update_s\":%.3f,\"update_ops_per_s\":%.1f}",
+        nRead, rRead, rRead > 0 ? nRead / rRead : 0.0,
+        nUpdate, rUpdate, rUpdate > 0 ? nUpdate / rUpdate : 0.0);
+    rc = sqlite3_str_errcode(pStr);
+    *pzReport = sqlite3_str_finish(pStr);
+    if (rc == SQLITE_OK && !*pzReport) rc = SQLITE_NOMEM;
+
     /* Write results to file if specified */
-    if (config->outputFile) {
+    if (rc == SQLITE_OK && config->outputFile) {
         FILE *fp = fopen(config->outputFile, "w");
         if (fp) {
-            fprintf(fp, "query,min_ms,max_ms,avg_ms,stddev,result_count\n");
-            for (int i = 0; i < nResults; i++) {
-                BenchmarkResult *r = results[i];
-                if (r) {
-                    fprintf(fp, "%s,%.2f,%.2f,%.2f,%.2f,%lld\n",
-                            r->queryName, r->minTime, r->maxTime,
-                            r->avgTime, r->stdDev, r->resultCount);
-                }
-            }
-            fclose(fp);
+            fprintf(fp, "%s\n", *pzReport);
+            if (fclose(fp) != 0) fp = NULL;
+        }
+        if (!fp) {
+            *pzErr = sqlite3_mprintf("cannot write %s", config->outputFile);
+            rc = SQLITE_CANTOPEN;
         }
     }
-    
-    /* Cleanup */
-    for (int i = 0; i < nResults; i++) {
-        sqlite3_free(results[i]);
+
+benchmark_done:
+    if (aWorker) {
+        for (i = 0; i < nWorker; i++) ldbcWorkerFinish(&aWorker[i]);
+    }
+    if (bSavepoint) {
+        sqlite3_exec(db, "ROLLBACK TO ldbc_updates; RELEASE ldbc_updates",
+                     NULL, NULL, NULL);
     }
-    sqlite3_free(results);
-    
-    return SQLITE_OK;
+    if (rc != SQLITE_OK) {
+        sqlite3_free(*pzReport);
+        *pzReport = NULL;
+    }
+    sqlite3_free(aWorker);
+    sqlite3_free(aThread);
+    sqlite3_free(aScratch);
+    return rc;
 }
 
 /*
-** SQL function to run benchmarks
+** SQL function: graph_benchmark(scale [, threads [, warmup [, runs [, file]]]])
+**
+** Runs the LDBC-style suite at scale factor scale and returns its JSON
+** report, also writing it to file when one is given.
 */
 static void graphBenchmarkFunc(
     sqlite3_context *context,
     int argc,
     sqlite3_value **argv
 ) {
-    if (argc < 1) {
-        sqlite3_result_error(context, "Usage: graph_benchmark(scale)", -1);
+    char *zReport = NULL;
+    char *zErr = NULL;
+
+    if (argc < 1 || argc > 5) {
+        sqlite3_result_error(context,
+            "Usage: graph_benchmark(scale [, threads [, warmup [, runs [, file]]]])", -1);
         return;
     }
-    
+
     BenchmarkConfig config = {
         .scale = sqlite3_value_int(argv[0]),
         .nThreads = 1,
         .warmupRuns = 3,
         .measureRuns = 10,
-        .outputFile = NULL,
-        .verboseOutput = 0
+        .outputFile = NULL
     };
-    
+
     if (argc >= 2) config.nThreads = sqlite3_value_int(argv[1]);
     if (argc >= 3) config.warmupRuns = sqlite3_value_int(argv[2]);
     if (argc >= 4) config.measureRuns = sqlite3_value_int(argv[3]);
-    
+    if (argc >= 5) config.outputFile = (const char*)sqlite3_value_text(argv[4]);
+    if (config.scale < 1 || config.nThreads < 1 || config.nThreads > 64
+     || config.warmupRuns < 0 || config.measureRuns < 1) {
+        sqlite3_result_error(context, "graph_benchmark: scale, threads (1-64) "
+                             "and runs must be positive", -1);
+        return;
+    }
+
     sqlite3 *db = sqlite3_context_db_handle(context);
-    int rc = graphRunBenchmarkSuite(db, &config);
-    
+    int rc = graphRunBenchmarkSuite(db, &config, &zReport, &zErr);
+
     if (rc == SQLITE_OK) {
-        sqlite3_result_text(context, "Benchmark completed successfully", -1, 
-                           SQLITE_STATIC);
+        sqlite3_result_text(context, zReport, -1, sqlite3_free);
+        sqlite3_result_subtype(context, 'J');
+    } else if (zErr) {
+        sqlite3_result_error(context, zErr, -1);
     } else {
         sqlite3_result_error_code(context, rc);
     }
+    sqlite3_free(zErr);
 }
 
 /*
 ** Register benchmark functions
 */
 int graphRegisterBenchmarkFunctions(sqlite3 *db) {
-    return sqlite3_create_function(db, "graph_benchmark", -1, 
+    return sqlite3_create_function(db, "graph_benchmark", -1,
                                   SQLITE_UTF8, NULL,
                                   graphBenchmarkFunc, NULL, NULL);
-}
\ No newline at end of file
+}
@@ -0,0 +1,530 @@
+/*
+** SQLite Graph Database Extension - Compressed Node Id Bitmaps
+**
+** Roaring-style containers: a bitmap is a key-sorted array of
+** containers, each covering 65536 consecutive (biased) ids. A container
+** is an array of sorted 16-bit values while it holds at most
+** BITMAP_ARRAY_MAX of them and a BITMAP_WORDS-word bitset beyond that.
+**
+** The bitset kernels are plain loops over 64-bit words with no
+** cross-iteration dependency, which GCC and Clang vectorize to SSE2,
+** AVX2 or NEON at -O2 and above; popcount and count-trailing-zeros use
+** the compiler builtins.
+**
+** Ids are biased by flipping the sign bit so that unsigned key order
+** matches signed id order.
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-bitmap.h"
+#include <string.h>
+#include <assert.h>
+
+#define BITMAP_ARRAY_MAX  4096     /* Array container capacity */
+#define BITMAP_WORDS      1024     /* 65536 bits */
+#define BITMAP_SIGN       ((sqlite3_uint64)1 << 63)
+
+typedef unsigned short u16;
+typedef sqlite3_uint64 u64;
+
+/*
+** One 65536-id slice of a bitmap. Exactly one of aVal and aWord is set.
+*/
+typedef struct BitmapContainer BitmapContainer;
+struct BitmapContainer {
+  u64 iKey;          /* High 48 bits of the biased id */
+  int n;             /* Number of ids in the container */
+  int nAlloc;        /* Slots allocated in aVal */
+  u16 *aVal;         /* Sorted low halves (array container) */
+  u64 *aWord;        /* BITMAP_WORDS words (bitset container) */
+};
+
+struct GraphBitmap {
+  BitmapContainer *aCont;  /* Containers in ascending iKey order */
+  int nCont;               /* Containers in use */
+  int nContAlloc;          /* Containers allocated */
+};
+
+static void containerClear(BitmapContainer *pC){
+  sqlite3_free(pC->aVal);
+  sqlite3_free(pC->aWord);
+  memset(pC, 0, sizeof(*pC));
+}
+
+/*
+** Count the bits of a bitset container.
+*/
+static int bitsetCount(const u64 *aWord){
+  int i, n = 0;
+  for(i=0; i<BITMAP_WORDS; i++){
+    n += __builtin_popcountll(aWord[i]);
+  }
+  return n;
+}
+
+/*
+** Convert an array container to a bitset.
+*/
+static int containerToBitset(BitmapContainer *pC){
+  int i;
+  u64 *aWord = sqlite3_malloc(BITMAP_WORDS*sizeof(u64));
+  if( aWord==0 ) return SQLITE_NOMEM;
+  memset(aWord, 0, BITMAP_WORDS*sizeof(u64));
+  for(i=0; i<pC->n; i++){
+    aWord[pC->aVal[i]>>6] |= (u64)1 << (pC->aVal[i]&63);
+  }
+  sqlite3_free(pC->aVal);
+  pC->aVal = 0;
+  pC->nAlloc = 0;
+  pC->aWord = aWord;
+  return SQLITE_OK;
+}
+
+/*
+** Convert a bitset container holding at most BITMAP_ARRAY_MAX values
+** to an array. pC->n must be current.
+*/
+static int containerToArray(BitmapContainer *pC){
+  int i, k = 0;
+  u16 *aVal;
+
+  assert( pC->aWord && pC->n<=BITMAP_ARRAY_MAX );
+  aVal = sqlite3_malloc((pC->n>0 ? pC->n : 1)*sizeof(u16));
+  if( aVal==0 ) return SQLITE_NOMEM;
+  for(i=0; i<BITMAP_WORDS; i++){
+    u64 w = pC->aWord[i];
+    while( w ){
+      aVal[k++] = (u16)(i*64 + __builtin_ctzll(w));
+      w &= w - 1;
+    }
+  }
+  sqlite3_free(pC->aWord);
+  pC->aWord = 0;
+  pC->aVal = aVal;
+  pC->nAlloc = pC->n>0 ? pC->n : 1;
+  return SQLITE_OK;
+}
+
+/*
+** Store a bitset result in pOut, choosing the smaller representation.
+** Takes ownership of aWord.
+*/
+static int containerFromBitset(BitmapContainer *pOut, u64 iKey, u64 *aWord){
+  memset(pOut, 0, sizeof(*pOut));
+  pOut->iKey = iKey;
+  pOut->aWord = aWord;
+  pOut->n = bitsetCount(aWord);
+  if( pOut->n<=BITMAP_ARRAY_MAX ) return containerToArray(pOut);
+  return SQLITE_OK;
+}
+
+static int containerHas(const BitmapContainer *pC, u16 v){
+  int lo = 0, hi = pC->n - 1;
+  if( pC->aWord ) return (pC->aWord[v>>6] >> (v&63)) & 1;
+  while( lo<=hi ){
+    int mid = (lo+hi)/2;
+    if( pC->aVal[mid]==v ) return 1;
+    if( pC->aVal[mid]<v ) lo = mid+1; else hi = mid-1;
+  }
+  return 0;
+}
+
+static int containerAdd(BitmapContainer *pC, u16 v){
+  int lo, hi;
+
+  if( pC->aWord ){
+    u64 m = (u64)1 << (v&63);
+    if( (pC->aWord[v>>6] & m)==0 ){
+      pC->aWord[v>>6] |= m;
+      pC->n++;
+    }
+    return SQLITE_OK;
+  }
+
+  /* Position of v in the sorted array; appends are checked first */
+  if( pC->n==0 || pC->aVal[pC->n-1]<v ){
+    lo = pC->n;
+  }else{
+    lo = 0; hi = pC->n - 1;
+    while( lo<=hi ){
+      int mid = (lo+hi)/2;
+      if( pC->aVal[mid]==v ) return SQLITE_OK;
+      if( pC->aVal[mid]<v ) lo = mid+1; else hi = mid-1;
+    }
+  }
+
+  if( pC->n==BITMAP_ARRAY_MAX ){
+    int rc = containerToBitset(pC);
+    if( rc!=SQLITE_OK ) return rc;
+    return containerAdd(pC, v);
+  }
+  if( pC->n==pC->nAlloc ){
+    int nNew = pC->nAlloc ? pC->nAlloc*2 : 16;
+    u16 *aNew;
+    if( nNew>BITMAP_ARRAY_MAX ) nNew = BITMAP_ARRAY_MAX;
+    aNew = sqlite3_realloc(pC->aVal, nNew*sizeof(u16));
+    if( aNew==0 ) return SQLITE_NOMEM;
+    pC->aVal = aNew;
+    pC->nAlloc = nNew;
+  }
+  memmove(&pC->aVal[lo+1], &pC->aVal[lo], (pC->n-lo)*sizeof(u16));
+  pC->aVal[lo] = v;
+  pC->n++;
+  return SQLITE_OK;
+}
+
+/*
+** Return the container for iKey, creating it if bCreate. NULL if it is
+** absent (or on OOM when creating).
+*/
+static BitmapContainer *bitmapContainer(GraphBitmap *p, u64 iKey, int bCreate){
+  int lo = 0, hi = p->nCont - 1;
+
+  if( p->nCont>0 && p->aCont[p->nCont-1].iKey==iKey ){
+    return &p->aCont[p->nCont-1];
+  }
+  if( p->nCont>0 && p->aCont[p->nCont-1].iKey<iKey ){
+    lo = p->nCont;
+  }else{
+    while( lo<=hi ){
+      int mid = (lo+hi)/2;
+      if( p->aCont[mid].iKey==iKey ) return &p->aCont[mid];
+      if( p->aCont[mid].iKey<iKey ) lo = mid+1; else hi = mid-1;
+    }
+  }
+  if( !bCreate ) return 0;
+
+  if( p->nCont==p->nContAlloc ){
+    int nNew = p->nContAlloc ? p->nContAlloc*2 : 4;
+    BitmapContainer *aNew = sqlite3_realloc64(p->aCont,
+                                              nNew*sizeof(BitmapContainer));
+    if( aNew==0 ) return 0;
+    p->aCont = aNew;
+    p->nContAlloc = nNew;
+  }
+  memmove(&p->aCont[lo+1], &p->aCont[lo],
+          (p->nCont-lo)*sizeof(BitmapContainer));
+  memset(&p->aCont[lo], 0, sizeof(BitmapContainer));
+  p->aCont[lo].iKey = iKey;
+  p->nCont++;
+  return &p->aCont[lo];
+}
+
+/*
+** Append a finished container to an output bitmap, which is built in
+** key order. Empty containers are dropped. Takes ownership of pC's
+** arrays either way.
+*/
+static int bitmapAppend(GraphBitmap *p, BitmapContainer *pC){
+  if( pC->n==0 ){
+    containerClear(pC);
+    return SQLITE_OK;
+  }
+  if( p->nCont==p->nContAlloc ){
+    int nNew = p->nContAlloc ? p->nContAlloc*2 : 4;
+    BitmapContainer *aNew = sqlite3_realloc64(p->aCont,
+                                              nNew*sizeof(BitmapContainer));
+    if( aNew==0 ){
+      containerClear(pC);
+      return SQLITE_NOMEM;
+    }
+    p->aCont = aNew;
+    p->nContAlloc = nNew;
+  }
+  assert( p->nCont==0 || p->aCont[p->nCont-1].iKey<pC->iKey );
+  p->aCont[p->nCont++] = *pC;
+  return SQLITE_OK;
+}
+
+/*
+** Deep-copy a container.
+*/
+static int containerCopy(BitmapContainer *pOut, const BitmapContainer *pIn){
+  *pOut = *pIn;
+  pOut->aVal = 0;
+  pOut->aWord = 0;
+  if( pIn->aWord ){
+    pOut->aWord = sqlite3_malloc(BITMAP_WORDS*sizeof(u64));
+    if( pOut->aWord==0 ) return SQLITE_NOMEM;
+    memcpy(pOut->aWord, pIn->aWord, BITMAP_WORDS*sizeof(u64));
+  }else{
+    pOut->nAlloc = pIn->n>0 ? pIn->n : 1;
+    pOut->aVal = sqlite3_malloc(pOut->nAlloc*sizeof(u16));
+    if( pOut->aVal==0 ) return SQLITE_NOMEM;
+    memcpy(pOut->aVal, pIn->aVal, pIn->n*sizeof(u16));
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Materialize a container as a freshly allocated bitset.
+*/
+static u64 *containerWords(const BitmapContainer *pC){
+  u64 *aWord = sqlite3_malloc(BITMAP_WORDS*sizeof(u64));
+  int i;
+  if( aWord==0 ) return 0;
+  if( pC->aWord ){
+    memcpy(aWord, pC->aWord, BITMAP_WORDS*sizeof(u64));
+  }else{
+    memset(aWord, 0, BITMAP_WORDS*sizeof(u64));
+    for(i=0; i<pC->n; i++){
+      aWord[pC->aVal[i]>>6] |= (u64)1 << (pC->aVal[i]&63);
+    }
+  }
+  return aWord;
+}
+
+#define BITMAP_OP_AND     0
+#define BITMAP_OP_OR      1
+#define BITMAP_OP_ANDNOT  2
+
+/*
+** Combine two containers with the same key.
+*/
+static int containerOp(int eOp, const BitmapContainer *pA,
+                       const BitmapContainer *pB, BitmapContainer *pOut){
+  int i, j, k;
+  u16 *aVal;
+
+  memset(pOut, 0, sizeof(*pOut));
+  pOut->iKey = pA->iKey;
+
+  /* Two bitsets, or a union that may overflow an array: word kernels */
+  if( (pA->aWord && pB->aWord)
+   || (eOp==BITMAP_OP_OR && pA->n+pB->n>BITMAP_ARRAY_MAX)
+   || (eOp==BITMAP_OP_ANDNOT && pA->aWord) ){
+    u64 *aOut = containerWords(pA);
+    u64 *aB = pB->aWord ? pB->aWord : containerWords(pB);
+    if( aOut==0 || aB==0 ){
+      sqlite3_free(aOut);
+      if( aB!=pB->aWord ) sqlite3_free(aB);
+      return SQLITE_NOMEM;
+    }
+    switch( eOp ){
+      case BITMAP_OP_AND:
+        for(i=0; i<BITMAP_WORDS; i++) aOut[i] &= aB[i];
+        break;
+      case BITMAP_OP_OR:
+        for(i=0; i<BITMAP_WORDS; i++) aOut[i] |= aB[i];
+        break;
+      default:
+        for(i=0; i<BITMAP_WORDS; i++) aOut[i] &= ~aB[i];
+        break;
+    }
+    if( aB!=pB->aWord ) sqlite3_free(aB);
+    return containerFromBitset(pOut, pA->iKey, aOut);
+  }
+
+  /* At least one side is an array and the result fits in one */
+  k = 0;
+  if( eOp==BITMAP_OP_OR ){
+    aVal = sqlite3_malloc((pA->n+pB->n)*sizeof(u16));
+    if( aVal==0 ) return SQLITE_NOMEM;
+    i = j = 0;
+    while( i<pA->n && j<pB->n ){
+      if( pA->aVal[i]<pB->aVal[j] ) aVal[k++] = pA->aVal[i++];
+      else if( pA->aVal[i]>pB->aVal[j] ) aVal[k++] = pB->aVal[j++];
+      else{ aVal[k++] = pA->aVal[i++]; j++; }
+    }
+    while( i<pA->n ) aVal[k++] = pA->aVal[i++];
+    while( j<pB->n ) aVal[k++] = pB->aVal[j++];
+    pOut->nAlloc = pA->n + pB->n;
+  }else{
+    /* AND or ANDNOT with pA an array (a bitset pA AND array pB is the
+    ** array pB probed against pA) */
+    const BitmapContainer *pArr = pA->aWord ? pB : pA;
+    const BitmapContainer *pOther = pA->aWord ? pA : pB;
+    int bKeep = (eOp==BITMAP_OP_AND);
+    aVal = sqlite3_malloc((pArr->n>0 ? pArr->n : 1)*sizeof(u16));
+    if( aVal==0 ) return SQLITE_NOMEM;
+    if( pOther->aWord ){
+      for(i=0; i<pArr->n; i++){
+        if( containerHas(pOther, pArr->aVal[i])==bKeep ) aVal[k++] = pArr->aVal[i];
+      }
+    }else{
+      i = j = 0;
+      while( i<pArr->n ){
+        while( j<pOther->n && pOther->aVal[j]<pArr->aVal[i] ) j++;
+        if( (j<pOther->n && pOther->aVal[j]==pArr->aVal[i])==bKeep ){
+          aVal[k++] = pArr->aVal[i];
+        }
+        i++;
+      }
+    }
+    pOut->nAlloc = pArr->n>0 ? pArr->n : 1;
+  }
+  pOut->aVal = aVal;
+  pOut->n = k;
+  return SQLITE_OK;
+}
+
+/*
+** Merge the container lists of pA and pB.
+*/
+static int bitmapOp(int eOp, const GraphBitmap *pA, const GraphBitmap *pB,
+                    GraphBitmap **ppOut){
+  GraphBitmap *pOut = graphBitmapCreate();
+  int i = 0, j = 0;
+  int rc = SQLITE_OK;
+  BitmapContainer c;
+
+  *ppOut = 0;
+  if( pOut==0 ) return SQLITE_NOMEM;
+  while( rc==SQLITE_OK && (i<pA->nCont || j<pB->nCont) ){
+    const BitmapContainer *pCa = i<pA->nCont ? &pA->aCont[i] : 0;
+    const BitmapContainer *pCb = j<pB->nCont ? &pB->aCont[j] : 0;
+
+    if( pCa && pCb && pCa->iKey==pCb->iKey ){
+      rc = containerOp(eOp, pCa, pCb, &c);
+      i++; j++;
+    }else if( pCa && (!pCb || pCa->iKey<pCb->iKey) ){
+      /* Key only in A */
+      i++;
+      if( eOp==BITMAP_OP_AND ) continue;
+      rc = containerCopy(&c, pCa);
+    }else{
+      /* Key only in B */
+      j++;
+      if( eOp!=BITMAP_OP_OR ) continue;
+      rc = containerCopy(&c, pCb);
+    }
+    if( rc==SQLITE_OK ) rc = bitmapAppend(pOut, &c);
+    else containerClear(&c);
+  }
+  if( rc!=SQLITE_OK ){
+    graphBitmapFree(pOut);
+    return rc;
+  }
+  *ppOut = pOut;
+  return SQLITE_OK;
+}
+
+GraphBitmap *graphBitmapCreate(void){
+  GraphBitmap *p = sqlite3_malloc(sizeof(GraphBitmap));
+  if( p ) memset(p, 0, sizeof(*p));
+  return p;
+}
+
+void graphBitmapFree(GraphBitmap *p){
+  int i;
+  if( p==0 ) return;
+  for(i=0; i<p->nCont; i++) containerClear(&p->aCont[i]);
+  sqlite3_free(p->aCont);
+  sqlite3_free(p);
+}
+
+int graphBitmapAdd(GraphBitmap *p, sqlite3_int64 iId){
+  u64 u = (u64)iId ^ BITMAP_SIGN;
+  BitmapContainer *pC = bitmapContainer(p, u>>16, 1);
+  if( pC==0 ) return SQLITE_NOMEM;
+  return containerAdd(pC, (u16)(u & 0xffff));
+}
+
+int graphBitmapContains(const GraphBitmap *p, sqlite3_int64 iId){
+  u64 u = (u64)iId ^ BITMAP_SIGN;
+  BitmapContainer *pC = bitmapContainer((GraphBitmap*)p, u>>16, 0);
+  return pC ? containerHas(pC, (u16)(u & 0xffff)) : 0;
+}
+
+sqlite3_int64 graphBitmapCount(const GraphBitmap *p){
+  sqlite3_int64 n = 0;
+  int i;
+  for(i=0; i<p->nCont; i++) n += p->aCont[i].n;
+  return n;
+}
+
+int graphBitmapAnd(const GraphBitmap *pA, const GraphBitmap *pB,
+                   GraphBitmap **ppOut){
+  return bitmapOp(BITMAP_OP_AND, pA, pB, ppOut);
+}
+
+int graphBitmapOr(const GraphBitmap *pA, const GraphBitmap *pB,
+                  GraphBitmap **ppOut){
+  return bitmapOp(BITMAP_OP_OR, pA, pB, ppOut);
+}
+
+int graphBitmapAndNot(const GraphBitmap *pA, const GraphBitmap *pB,
+                      GraphBitmap **ppOut){
+  return bitmapOp(BITMAP_OP_ANDNOT, pA, pB, ppOut);
+}
+
+int graphBitmapCopy(const GraphBitmap *p, GraphBitmap **ppOut){
+  GraphBitmap *pOut = graphBitmapCreate();
+  int i, rc = SQLITE_OK;
+  BitmapContainer c;
+
+  *ppOut = 0;
+  if( pOut==0 ) return SQLITE_NOMEM;
+  for(i=0; rc==SQLITE_OK && i<p->nCont; i++){
+    rc = containerCopy(&c, &p->aCont[i]);
+    if( rc==SQLITE_OK ) rc = bitmapAppend(pOut, &c);
+    else containerClear(&c);
+  }
+  if( rc!=SQLITE_OK ){
+    graphBitmapFree(pOut);
+    return rc;
+  }
+  *ppOut = pOut;
+  return SQLITE_OK;
+}
+
+int graphBitmapFromStmt(sqlite3_stmt *pStmt, GraphBitmap **ppOut){
+  GraphBitmap *p = graphBitmapCreate();
+  int rc = SQLITE_OK;
+  int rcStep;
+
+  *ppOut = 0;
+  if( p==0 ) return SQLITE_NOMEM;
+  while( (rcStep = sqlite3_step(pStmt))==SQLITE_ROW ){
+    rc = graphBitmapAdd(p, sqlite3_column_int64(pStmt, 0));
+    if( rc!=SQLITE_OK ) break;
+  }
+  if( rc==SQLITE_OK && rcStep!=SQLITE_DONE ) rc = rcStep;
+  if( rc!=SQLITE_OK ){
+    graphBitmapFree(p);
+    return rc;
+  }
+  *ppOut = p;
+  return SQLITE_OK;
+}
+
+int graphBitmapToArray(const GraphBitmap *p, sqlite3_int64 **paId,
+                       int *pnId){
+  sqlite3_int64 n = graphBitmapCount(p);
+  sqlite3_int64 *aId;
+  int i, j, k = 0;
+
+  *paId = 0;
+  *pnId = 0;
+  if( n==0 ) return SQLITE_OK;
+  if( n>0x7fffffff ) return SQLITE_TOOBIG;
+  aId = sqlite3_malloc64(n*sizeof(sqlite3_int64));
+  if( aId==0 ) return SQLITE_NOMEM;
+  for(i=0; i<p->nCont; i++){
+    const BitmapContainer *pC = &p->aCont[i];
+    u64 iBase = pC->iKey << 16;
+    if( pC->aWord ){
+      for(j=0; j<BITMAP_WORDS; j++){
+        u64 w = pC->aWord[j];
+        while( w ){
+          u64 u = iBase | (u64)(j*64 + __builtin_ctzll(w));
+          aId[k++] = (sqlite3_int64)(u ^ BITMAP_SIGN);
+          w &= w - 1;
+        }
+      }
+    }else{
+      for(j=0; j<pC->n; j++){
+        aId[k++] = (sqlite3_int64)((iBase | pC->aVal[j]) ^ BITMAP_SIGN);
+      }
+    }
+  }
+  assert( k==n );
+  *paId = aId;
+  *pnId = k;
+  return SQLITE_OK;
+}
@@ -1,9 +1,12 @@
 /*
 ** graph-bulk.c - Bulk loading optimization implementation
 **
-** This file implements high-performance bulk data loading with
-** deferred indexing, parallel CSV/JSON import, and direct memory
-** mapping for the SQLite Graph Extension.
+** This file implements high-performance bulk data loading for the
+** SQLite Graph Extension: node and edge CSV files are memory mapped,
+** split at row boundaries and parsed on the task scheduler's workers
+** into (pointer, length) field slices over the mapping, which the
+** calling thread binds straight into one prepared INSERT inside large
+** transactions.
 */
 
 #include <sqlite3.h>
@@ -15,466 +18,853 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "graph.h"
+#include "graph-csr.h"
 #include "graph-memory.h"
 #include "graph-performance.h"
-#include "graph-memory.h"
 #include "graph-bulk.h"
-#include "graph-memory.h"
+#include "graph-metrics.h"
+
+/*
+** Input is parsed in rounds of one chunk per worker, each about
+** BULK_CHUNK_BYTES long, so the field slices held at any time stay
+** bounded however large the file is.
+*/
+#define BULK_CHUNK_BYTES (4 * 1024 * 1024)
+
+/* Column roles recognised in the CSV header */
+#define BULK_COL_ID     0
+#define BULK_COL_LABEL  1
+#define BULK_COL_PROPS  2
+#define BULK_COL_SOURCE 3
+#define BULK_COL_TARGET 4
+#define BULK_COL_TYPE   5
+#define BULK_COL_WEIGHT 6
+#define BULK_NCOL       7
+
+/* One CSV field: a slice of the mapping, or of a chunk's scratch buffer
+** when the field had "" escapes. z is NULL for a missing field. */
+typedef struct BulkField {
+    const char *z;
+    int n;
+} BulkField;
 
-/* CSV parser state */
-typedef struct CSVParser {
-    char *buffer;                /* Input buffer */
-    size_t bufferSize;          /* Buffer size */
-    size_t position;            /* Current position */
-    char delimiter;             /* Field delimiter */
-    char quote;                 /* Quote character */
-    int hasHeader;              /* First row is header */
-    char **headers;             /* Column headers */
-    int nColumns;               /* Number of columns */
-} CSVParser;
-
-/* Batch accumulator for deferred loading */
-typedef struct BatchAccumulator {
-    GraphNode **nodes;          /* Accumulated nodes */
-    GraphEdge **edges;          /* Accumulated edges */
-    int nNodes;                 /* Number of nodes */
-    int nEdges;                 /* Number of edges */
-    int capacity;               /* Capacity */
-    int indexingDeferred;       /* Indexing state */
-} BatchAccumulator;
+/* A run of whole rows [zStart, zEnd) parsed by one worker */
+typedef struct BulkChunk {
+    const char *zStart;          /* First byte of the chunk */
+    const char *zEnd;            /* One past the last byte */
+    int nCol;                    /* Fields kept per row */
+    BulkField *aField;           /* nRow * nCol parsed fields */
+    int nRow;                    /* Rows parsed */
+    int nRowAlloc;               /* Rows aField has room for */
+    char *zScratch;              /* Unescaped quoted fields */
+    size_t nScratch;             /* Bytes of zScratch used */
+    int rc;                      /* Parse result */
+} BulkChunk;
+
+/* Shared state of one load */
+typedef struct BulkLoad {
+    GraphVtab *pGraph;
+    BulkLoaderConfig *config;
+    BulkLoadStats *stats;
+    int bEdges;                  /* Loading an edge file */
+    int nCol;                    /* Columns in the header */
+    int aiCol[BULK_NCOL];        /* Header column of each role, or -1 */
+    sqlite3_stmt *pInsert;       /* Node or edge INSERT */
+    sqlite3_stmt *pMapInsert;    /* temp id map INSERT (nodes) */
+    sqlite3_stmt *pMapLookup;    /* temp id map lookup (edges) */
+    sqlite3_int64 iNextId;       /* Next id for non-integer node keys */
+    sqlite3_int64 nTxnRows;      /* Rows written in the open transaction */
+    int bOwnTxn;                 /* The loader opened the transaction */
+    int bSuspended;              /* Indexes are suspended: never commit */
+    char *zLabels;               /* Reusable labels JSON buffer */
+    int nLabelsAlloc;
+    sqlite3_int64 iMinId;        /* Smallest node id written */
+    sqlite3_int64 iMaxId;        /* Largest node id written */
+} BulkLoad;
+
+/* A parsed node row and its sort key for a deferred-index load */
+typedef struct BulkRowRef {
+    sqlite3_int64 iKey;          /* Integer id, or LLONG_MAX for a key */
+    sqlite3_int64 iSeq;          /* Position in the round */
+    const BulkField *aRow;
+} BulkRowRef;
 
 /*
-** Initialize CSV parser
+** Split the next CSV field off [*pz, zEnd). Returns the character that
+** ended it: ',' for another field on the row, '\n' at the end of the
+** row (also for the end of input). Quoted fields lose their quotes;
+** "" escapes are undone into pChunk's scratch buffer, which is sized
+** for the whole chunk up front so its slices never move.
 */
-static CSVParser* csvParserCreate(const char *data, size_t size) {
-    CSVParser *parser = sqlite3_malloc(sizeof(CSVParser));
-    if (!parser) return NULL;
-    
-    parser->buffer = sqlite3_malloc(size + 1);
-    if (!parser->buffer) {
-        sqlite3_free(parser);
-        return NULL;
-    }
-    
-    memcpy(parser->buffer, data, size);
-    parser->buffer[size] = '\0';
-    parser->bufferSize = size;
-    parser->position = 0;
-    parser->delimiter = ',';
-    parser->quote = '"';
-    parser->hasHeader = 1;
-    parser->headers = NULL;
-    parser->nColumns = 0;
-    
-    return parser;
+static int bulkNextField(BulkChunk *pChunk, const char **pz, const char *zEnd,
+                         BulkField *pField) {
+    const char *z = *pz;
+
+    if (z < zEnd && *z == '"') {
+        const char *zStart = ++z;
+        int bEscaped = 0;
+
+        while (z < zEnd) {
+            if (*z == '"') {
+                if (z + 1 < zEnd && z[1] == '"') {
+                    bEscaped = 1;
+                    z += 2;
+                    continue;
+                }
+                break;
+            }
+            z++;
+        }
+        pField->z = zStart;
+        pField->n = (int)(z - zStart);
+        if (bEscaped) {
+            char *zOut;
+            const char *p;
+
+            if (!pChunk->zScratch) {
+                pChunk->zScratch = sqlite3_malloc64(pChunk->zEnd - pChunk->zStart);
+                if (!pChunk->zScratch) {
+                    pChunk->rc = SQLITE_NOMEM;
+                    return '\n';
+                }
+            }
+            zOut = pChunk->zScratch + pChunk->nScratch;
+            pField->z = zOut;
+            for (p = zStart; p < z; p++) {
+                *zOut++ = *p;
+                if (*p == '"') p++;
+            }
+            pField->n = (int)(zOut - pField->z);
+            pChunk->nScratch += pField->n;
+        }
+        if (z < zEnd) z++;   /* closing quote */
+        while (z < zEnd && *z != ',' && *z != '\n') z++;
+    } else {
+        const char *zStart = z;
+        while (z < zEnd && *z != ',' && *z != '\n') z++;
+        pField->z = zStart;
+        pField->n = (int)(z - zStart);
+        if (pField->n > 0 && zStart[pField->n - 1] == '\r') pField->n--;
+    }
+
+    if (z >= zEnd) {
+        *pz = zEnd;
+        return '\n';
+    }
+    *pz = z + 1;
+    return *z;
 }
 
 /*
-** Parse CSV header row
+** Task: parse every row of a chunk into field slices. Only the columns
+** of the first nCol header positions are kept.
 */
-static int csvParseHeader(CSVParser *parser) {
-    if (!parser->hasHeader) return SQLITE_OK;
-    
-    /* Count columns */
-    char *p = parser->buffer;
-    int nCols = 1;
-    int inQuote = 0;
-    
-    while (*p && *p != '\n') {
-        if (*p == parser->quote) {
-            inQuote = !inQuote;
-        } else if (*p == parser->delimiter && !inQuote) {
-            nCols++;
+static void bulkParseChunk(void *pArg) {
+    BulkChunk *pChunk = (BulkChunk*)pArg;
+    const char *z = pChunk->zStart;
+
+    while (z < pChunk->zEnd && pChunk->rc == SQLITE_OK) {
+        BulkField *aRow;
+        int iCol = 0;
+        int c;
+
+        if (*z == '\n' || (*z == '\r' && z + 1 < pChunk->zEnd && z[1] == '\n')) {
+            z += (*z == '\r') ? 2 : 1;   /* blank line */
+            continue;
         }
-        p++;
-    }
-    
-    parser->nColumns = nCols;
-    parser->headers = sqlite3_malloc(nCols * sizeof(char*));
-    if (!parser->headers) return SQLITE_NOMEM;
-    
-    /* Parse header names */
-    p = parser->buffer;
-    int col = 0;
-    char *start = p;
-    inQuote = 0;
-    
-    while (*p && *p != '\n' && col < nCols) {
-        if (*p == parser->quote) {
-            inQuote = !inQuote;
-        } else if ((*p == parser->delimiter || *p == '\n') && !inQuote) {
-            size_t len = p - start;
-            parser->headers[col] = sqlite3_malloc(len + 1);
-            if (parser->headers[col]) {
-                strncpy(parser->headers[col], start, len);
-                parser->headers[col][len] = '\0';
+        if (pChunk->nRow == pChunk->nRowAlloc) {
+            int nNew = pChunk->nRowAlloc ? pChunk->nRowAlloc * 2 : 1024;
+            BulkField *aNew = sqlite3_realloc64(pChunk->aField,
+                (sqlite3_uint64)nNew * pChunk->nCol * sizeof(BulkField));
+            if (!aNew) {
+                pChunk->rc = SQLITE_NOMEM;
+                return;
             }
-            col++;
-            start = p + 1;
+            pChunk->aField = aNew;
+            pChunk->nRowAlloc = nNew;
+        }
+        aRow = &pChunk->aField[(sqlite3_int64)pChunk->nRow * pChunk->nCol];
+        do {
+            BulkField field;
+            c = bulkNextField(pChunk, &z, pChunk->zEnd, &field);
+            if (iCol < pChunk->nCol) aRow[iCol] = field;
+            iCol++;
+        } while (c == ',');
+        for (; iCol < pChunk->nCol; iCol++) {
+            aRow[iCol].z = NULL;
+            aRow[iCol].n = 0;
+        }
+        pChunk->nRow++;
+    }
+}
+
+/*
+** Return the end of the chunk that starts at zStart: the first row
+** boundary at or after zStart + nTarget. A newline only ends a row when
+** the quotes before it are balanced, so the chunk is first scanned for
+** quote parity; that pass is far cheaper than parsing it.
+*/
+static const char *bulkChunkEnd(const char *zStart, const char *zEnd, size_t nTarget) {
+    const char *zSplit = (size_t)(zEnd - zStart) > nTarget ? zStart + nTarget : zEnd;
+    const char *z = zStart;
+    int bQuoted = 0;
+
+    while (z < zSplit && (z = memchr(z, '"', zSplit - z)) != NULL) {
+        bQuoted = !bQuoted;
+        z++;
+    }
+    for (z = zSplit; z < zEnd; z++) {
+        if (*z == '"') {
+            bQuoted = !bQuoted;
+        } else if (*z == '\n' && !bQuoted) {
+            return z + 1;
         }
-        p++;
     }
-    
-    /* Skip to next line */
-    parser->position = p - parser->buffer + 1;
-    
+    return zEnd;
+}
+
+static int bulkFieldIs(const BulkField *pField, const char *zName) {
+    int n = (int)strlen(zName);
+    return pField->n == n && sqlite3_strnicmp(pField->z, zName, n) == 0;
+}
+
+/*
+** Read the header row and assign column roles. A header with source
+** and target columns makes this an edge file.
+*/
+static int bulkParseHeader(BulkLoad *pLoad, const char **pz, const char *zEnd) {
+    BulkChunk hdr;
+    int c;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.zStart = *pz;
+    hdr.zEnd = zEnd;
+    for (c = 0; c < BULK_NCOL; c++) pLoad->aiCol[c] = -1;
+
+    pLoad->nCol = 0;
+    do {
+        BulkField field;
+        int iRole = -1;
+
+        c = bulkNextField(&hdr, pz, zEnd, &field);
+        if (bulkFieldIs(&field, "id")) iRole = BULK_COL_ID;
+        else if (bulkFieldIs(&field, "label") || bulkFieldIs(&field, "labels")) iRole = BULK_COL_LABEL;
+        else if (bulkFieldIs(&field, "properties")) iRole = BULK_COL_PROPS;
+        else if (bulkFieldIs(&field, "source") || bulkFieldIs(&field, "from")) iRole = BULK_COL_SOURCE;
+        else if (bulkFieldIs(&field, "target") || bulkFieldIs(&field, "to")) iRole = BULK_COL_TARGET;
+        else if (bulkFieldIs(&field, "type") || bulkFieldIs(&field, "edge_type")) iRole = BULK_COL_TYPE;
+        else if (bulkFieldIs(&field, "weight")) iRole = BULK_COL_WEIGHT;
+        if (iRole >= 0 && pLoad->aiCol[iRole] < 0) pLoad->aiCol[iRole] = pLoad->nCol;
+        pLoad->nCol++;
+    } while (c == ',');
+    sqlite3_free(hdr.zScratch);
+    if (hdr.rc != SQLITE_OK) return hdr.rc;
+
+    pLoad->bEdges = pLoad->aiCol[BULK_COL_SOURCE] >= 0 && pLoad->aiCol[BULK_COL_TARGET] >= 0;
+    if (!pLoad->bEdges && pLoad->aiCol[BULK_COL_ID] < 0) return SQLITE_ERROR;
     return SQLITE_OK;
 }
 
 /*
-** Parse one CSV row
+** Parse a field that is a whole decimal integer. Returns 1 on success.
 */
-static char** csvParseRow(CSVParser *parser) {
-    if (parser->position >= parser->bufferSize) return NULL;
-    
-    char **values = sqlite3_malloc(parser->nColumns * sizeof(char*));
-    if (!values) return NULL;
-    
-    char *p = parser->buffer + parser->position;
-    int col = 0;
-    char *start = p;
-    int inQuote = 0;
-    
-    while (*p && col < parser->nColumns) {
-        if (*p == parser->quote) {
-            inQuote = !inQuote;
-        } else if ((*p == parser->delimiter || *p == '\n' || *p == '\0') && !inQuote) {
-            size_t len = p - start;
-            
-            /* Remove quotes if present */
-            if (len >= 2 && start[0] == parser->quote && start[len-1] == parser->quote) {
-                start++;
-                len -= 2;
-            }
-            
-            values[col] = sqlite3_malloc(len + 1);
-            if (values[col]) {
-                strncpy(values[col], start, len);
-                values[col][len] = '\0';
+static int bulkFieldInt(const BulkField *pField, sqlite3_int64 *piValue) {
+    sqlite3_uint64 u = 0;
+    int i = 0, bNeg = 0;
+
+    if (!pField->z || pField->n == 0) return 0;
+    if (pField->z[0] == '-' || pField->z[0] == '+') {
+        bNeg = pField->z[0] == '-';
+        i = 1;
+    }
+    if (i == pField->n || pField->n - i > 18) return 0;
+    for (; i < pField->n; i++) {
+        char c = pField->z[i];
+        if (c < '0' || c > '9') return 0;
+        u = u * 10 + (sqlite3_uint64)(c - '0');
+    }
+    *piValue = bNeg ? -(sqlite3_int64)u : (sqlite3_int64)u;
+    return 1;
+}
+
+static void bulkBindField(sqlite3_stmt *pStmt, int iParam, const BulkField *pField,
+                          const char *zDefault) {
+    if (pField && pField->z && pField->n > 0) {
+        sqlite3_bind_text(pStmt, iParam, pField->z, pField->n, SQLITE_STATIC);
+    } else if (zDefault) {
+        sqlite3_bind_text(pStmt, iParam, zDefault, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(pStmt, iParam);
+    }
+}
+
+/*
+** Build the labels JSON array of a label field, whose labels are
+** separated by ';', in the load's reusable buffer.
+*/
+static const char *bulkLabelsJson(BulkLoad *pLoad, const BulkField *pField) {
+    int nNeed = pField && pField->z ? pField->n * 2 + 8 : 8;
+    char *zOut;
+    int i;
+
+    if (nNeed > pLoad->nLabelsAlloc) {
+        char *zNew = sqlite3_realloc(pLoad->zLabels, nNeed);
+        if (!zNew) return NULL;
+        pLoad->zLabels = zNew;
+        pLoad->nLabelsAlloc = nNeed;
+    }
+    zOut = pLoad->zLabels;
+    *zOut++ = '[';
+    if (pField && pField->z && pField->n > 0) {
+        *zOut++ = '"';
+        for (i = 0; i < pField->n; i++) {
+            char c = pField->z[i];
+            if (c == ';') {
+                zOut[0] = '"'; zOut[1] = ','; zOut[2] = '"';
+                zOut += 3;
+                continue;
             }
-            
-            col++;
-            if (*p == '\n' || *p == '\0') break;
-            start = p + 1;
+            if (c == '"' || c == '\\') *zOut++ = '\\';
+            *zOut++ = c;
+        }
+        *zOut++ = '"';
+    }
+    *zOut++ = ']';
+    *zOut = 0;
+    return pLoad->zLabels;
+}
+
+/*
+** Resolve an edge endpoint: through the temporary id map filled by a
+** node load with non-integer keys, else as an integer node id.
+** Returns 1 and sets *piId when the endpoint resolves.
+*/
+static int bulkResolveEndpoint(BulkLoad *pLoad, const BulkField *pField,
+                               sqlite3_int64 *piId) {
+    if (!pField->z || pField->n == 0) return 0;
+    if (pLoad->pMapLookup) {
+        int bFound = 0;
+        sqlite3_bind_text(pLoad->pMapLookup, 1, pField->z, pField->n, SQLITE_STATIC);
+        if (sqlite3_step(pLoad->pMapLookup) == SQLITE_ROW) {
+            *piId = sqlite3_column_int64(pLoad->pMapLookup, 0);
+            bFound = 1;
         }
-        p++;
+        sqlite3_reset(pLoad->pMapLookup);
+        if (bFound) return 1;
     }
-    
-    parser->position = p - parser->buffer + 1;
-    
-    /* Fill remaining columns with NULL */
-    while (col < parser->nColumns) {
-        values[col++] = NULL;
+    return bulkFieldInt(pField, piId);
+}
+
+/*
+** Commit the loader's transaction after every batchSize rows and open
+** the next one. Transactions the caller opened are left alone, and so
+** is a load with suspended indexes, which must not commit before they
+** are rebuilt.
+*/
+static int bulkTxnStep(BulkLoad *pLoad) {
+    sqlite3 *db = pLoad->pGraph->pDb;
+    int rc = SQLITE_OK;
+
+    if (!pLoad->bOwnTxn || pLoad->bSuspended) return SQLITE_OK;
+    if (pLoad->config->batchSize > 0 && ++pLoad->nTxnRows >= pLoad->config->batchSize) {
+        rc = sqlite3_exec(db, "COMMIT; BEGIN", NULL, NULL, NULL);
+        pLoad->nTxnRows = 0;
     }
-    
-    return values;
+    return rc;
 }
 
 /*
-** Free CSV parser
+** Write one parsed node row. Rows with a duplicate or missing id are
+** counted as skipped.
 */
-static void csvParserFree(CSVParser *parser) {
-    if (!parser) return;
-    
-    if (parser->headers) {
-        for (int i = 0; i < parser->nColumns; i++) {
-            sqlite3_free(parser->headers[i]);
+static int bulkWriteNode(BulkLoad *pLoad, const BulkField *aRow) {
+    const BulkField *pId = &aRow[pLoad->aiCol[BULK_COL_ID]];
+    const BulkField *pProps = pLoad->aiCol[BULK_COL_PROPS] >= 0 ? &aRow[pLoad->aiCol[BULK_COL_PROPS]] : NULL;
+    sqlite3_stmt *pStmt = pLoad->pInsert;
+    sqlite3_int64 iId;
+    const char *zLabels;
+    int rc;
+
+    if (!pId->z || pId->n == 0) {
+        pLoad->stats->nodesSkipped++;
+        return SQLITE_OK;
+    }
+
+    if (!bulkFieldInt(pId, &iId)) {
+        /* External key: assign an id and remember it for the edge file */
+        iId = pLoad->iNextId++;
+        sqlite3_bind_text(pLoad->pMapInsert, 1, pId->z, pId->n, SQLITE_STATIC);
+        sqlite3_bind_int64(pLoad->pMapInsert, 2, iId);
+        rc = sqlite3_step(pLoad->pMapInsert);
+        sqlite3_reset(pLoad->pMapInsert);
+        if (rc == SQLITE_CONSTRAINT) {
+            pLoad->stats->nodesSkipped++;
+            return SQLITE_OK;
         }
-        sqlite3_free(parser->headers);
+        if (rc != SQLITE_DONE) return rc;
+    }
+
+    zLabels = bulkLabelsJson(pLoad, pLoad->aiCol[BULK_COL_LABEL] >= 0 ? &aRow[pLoad->aiCol[BULK_COL_LABEL]] : NULL);
+    if (!zLabels) return SQLITE_NOMEM;
+
+    sqlite3_bind_int64(pStmt, 1, iId);
+    sqlite3_bind_text(pStmt, 2, zLabels, -1, SQLITE_STATIC);
+    bulkBindField(pStmt, 3, pProps, "{}");
+    rc = sqlite3_step(pStmt);
+    sqlite3_reset(pStmt);
+
+    if (rc == SQLITE_CONSTRAINT) {
+        pLoad->stats->nodesSkipped++;
+        return SQLITE_OK;
     }
-    
-    sqlite3_free(parser->buffer);
-    sqlite3_free(parser);
+    if (rc != SQLITE_DONE) return rc;
+    if (pLoad->stats->nodesLoaded++ == 0 || iId < pLoad->iMinId) pLoad->iMinId = iId;
+    if (iId > pLoad->iMaxId) pLoad->iMaxId = iId;
+    return bulkTxnStep(pLoad);
 }
 
 /*
-** Create batch accumulator
+** Write one parsed edge row. Rows whose endpoints do not resolve are
+** counted as skipped.
 */
-static BatchAccumulator* batchAccumulatorCreate(int capacity) {
-    BatchAccumulator *batch = sqlite3_malloc(sizeof(BatchAccumulator));
-    if (!batch) return NULL;
-    
-    batch->nodes = sqlite3_malloc(capacity * sizeof(GraphNode*));
-    batch->edges = sqlite3_malloc(capacity * sizeof(GraphEdge*));
-    
-    if (!batch->nodes || !batch->edges) {
-        sqlite3_free(batch->nodes);
-        sqlite3_free(batch->edges);
-        sqlite3_free(batch);
-        return NULL;
-    }
-    
-    batch->nNodes = 0;
-    batch->nEdges = 0;
-    batch->capacity = capacity;
-    batch->indexingDeferred = 0;
-    
-    return batch;
+static int bulkWriteEdge(BulkLoad *pLoad, const BulkField *aRow) {
+    const int *aiCol = pLoad->aiCol;
+    sqlite3_stmt *pStmt = pLoad->pInsert;
+    sqlite3_int64 iSource, iTarget;
+    int rc;
+
+    if (!bulkResolveEndpoint(pLoad, &aRow[aiCol[BULK_COL_SOURCE]], &iSource)
+     || !bulkResolveEndpoint(pLoad, &aRow[aiCol[BULK_COL_TARGET]], &iTarget)) {
+        pLoad->stats->edgesSkipped++;
+        return SQLITE_OK;
+    }
+
+    sqlite3_bind_int64(pStmt, 1, iSource);
+    sqlite3_bind_int64(pStmt, 2, iTarget);
+    bulkBindField(pStmt, 3, aiCol[BULK_COL_TYPE] >= 0 ? &aRow[aiCol[BULK_COL_TYPE]] : NULL, NULL);
+    if (aiCol[BULK_COL_WEIGHT] >= 0 && aRow[aiCol[BULK_COL_WEIGHT]].n > 0) {
+        /* The REAL column affinity converts the text */
+        bulkBindField(pStmt, 4, &aRow[aiCol[BULK_COL_WEIGHT]], NULL);
+    } else {
+        sqlite3_bind_double(pStmt, 4, 1.0);
+    }
+    bulkBindField(pStmt, 5, aiCol[BULK_COL_PROPS] >= 0 ? &aRow[aiCol[BULK_COL_PROPS]] : NULL, "{}");
+    rc = sqlite3_step(pStmt);
+    sqlite3_reset(pStmt);
+
+    if (rc == SQLITE_CONSTRAINT) {
+        pLoad->stats->edgesSkipped++;
+        return SQLITE_OK;
+    }
+    if (rc != SQLITE_DONE) return rc;
+    pLoad->stats->edgesLoaded++;
+    return bulkTxnStep(pLoad);
 }
 
 /*
-** Flush batch to graph
+** Prepare the statements of a load. Node loads create the temporary id
+** map temp."<graph>_bulk_ids"(ext, id) for keys that are not integers;
+** edge loads look endpoints up in it when an earlier node load in this
+** connection created it.
 */
-static int batchFlush(BatchAccumulator *batch, GraphVtab *pGraph) {
-    int rc = SQLITE_OK;
-    char *zSql;
-    sqlite3_stmt *pStmt;
-    
-    /* Begin transaction */
+static int bulkPrepare(BulkLoad *pLoad) {
+    GraphVtab *pGraph = pLoad->pGraph;
     sqlite3 *db = pGraph->pDb;
-    rc = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    char *zEncode;
+    char *zSql;
+    int rc;
+
+    /* Encode properties in the statement so the format triggers stay idle */
+    if (pGraph->ePropFormat == GRAPH_PROPS_JSONB) {
+        zEncode = sqlite3_mprintf("jsonb(?%d)", pLoad->bEdges ? 5 : 3);
+    } else if (pGraph->ePropFormat == GRAPH_PROPS_PACKED) {
+        zEncode = sqlite3_mprintf("graph_pack(%Q, ?%d)", pGraph->zTableName, pLoad->bEdges ? 5 : 3);
+    } else {
+        zEncode = sqlite3_mprintf("?%d", pLoad->bEdges ? 5 : 3);
+    }
+    if (!zEncode) return SQLITE_NOMEM;
+    if (pLoad->bEdges) {
+        zSql = sqlite3_mprintf("INSERT INTO \"%w\"(source, target, edge_type, weight, properties)"
+                               " VALUES(?1, ?2, ?3, ?4, %s)", pGraph->zEdgeTableName, zEncode);
+    } else {
+        zSql = sqlite3_mprintf("INSERT INTO \"%w\"(id, labels, properties) VALUES(?1, ?2, %s)",
+                               pGraph->zNodeTableName, zEncode);
+    }
+    sqlite3_free(zEncode);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v3(db, zSql, -1, SQLITE_PREPARE_PERSISTENT, &pLoad->pInsert, NULL);
+    sqlite3_free(zSql);
     if (rc != SQLITE_OK) return rc;
-    
-    /* Insert nodes */
-    zSql = sqlite3_mprintf("INSERT INTO %s_nodes(id, properties) VALUES(?, ?)", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+
+    if (pLoad->bEdges) {
+        zSql = sqlite3_mprintf("SELECT id FROM temp.\"%w_bulk_ids\" WHERE ext = ?1",
+                               pGraph->zTableName);
+        if (!zSql) return SQLITE_NOMEM;
+        if (sqlite3_prepare_v3(db, zSql, -1, SQLITE_PREPARE_PERSISTENT,
+                               &pLoad->pMapLookup, NULL) != SQLITE_OK) {
+            pLoad->pMapLookup = NULL;   /* no node load made a map */
+        }
+        sqlite3_free(zSql);
+        return SQLITE_OK;
+    }
+
+    zSql = sqlite3_mprintf(
+        "CREATE TABLE IF NOT EXISTS temp.\"%w_bulk_ids\"(ext TEXT PRIMARY KEY, id INTEGER)"
+        " WITHOUT ROWID", pGraph->zTableName);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_exec(db, zSql, NULL, NULL, NULL);
     sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) return rc;
-
-    for (int i = 0; i < batch->nNodes; i++) {
-        GraphNode *node = batch->nodes[i];
-        sqlite3_bind_int64(pStmt, 1, node->iNodeId);
-        sqlite3_bind_text(pStmt, 2, node->zProperties, -1, SQLITE_TRANSIENT);
-        sqlite3_step(pStmt);
-        sqlite3_reset(pStmt);
-        sqlite3_free(node->zProperties);
-        sqlite3_free(node);
-        batch->nodes[i] = NULL;
-    }
-    sqlite3_finalize(pStmt);
-    
-    /* Insert edges */
-    zSql = sqlite3_mprintf("INSERT INTO %s_edges(from_id, to_id, weight, properties) VALUES(?, ?, ?, ?)", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+    if (rc != SQLITE_OK) return rc;
+
+    zSql = sqlite3_mprintf("INSERT INTO temp.\"%w_bulk_ids\"(ext, id) VALUES(?1, ?2)",
+                           pGraph->zTableName);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v3(db, zSql, -1, SQLITE_PREPARE_PERSISTENT, &pLoad->pMapInsert, NULL);
     sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) return rc;
-
-    for (int i = 0; i < batch->nEdges; i++) {
-        GraphEdge *edge = batch->edges[i];
-        sqlite3_bind_int64(pStmt, 1, edge->iFromId);
-        sqlite3_bind_int64(pStmt, 2, edge->iToId);
-        sqlite3_bind_double(pStmt, 3, edge->rWeight);
-        sqlite3_bind_text(pStmt, 4, edge->zProperties, -1, SQLITE_TRANSIENT);
-        sqlite3_step(pStmt);
-        sqlite3_reset(pStmt);
-        sqlite3_free(edge->zProperties);
-        sqlite3_free(edge);
-        batch->edges[i] = NULL;
-    }
-    sqlite3_finalize(pStmt);
-    
-    /* Commit transaction */
-    rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
-    
-    /* Reset batch */
-    batch->nNodes = 0;
-    batch->nEdges = 0;
-    
+    if (rc != SQLITE_OK) return rc;
+
+    /* Ids for external keys follow the largest id already stored */
+    {
+        sqlite3_stmt *pStmt;
+        zSql = sqlite3_mprintf("SELECT coalesce(max(id), 0) + 1 FROM \"%w\"",
+                               pGraph->zNodeTableName);
+        if (!zSql) return SQLITE_NOMEM;
+        rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL);
+        sqlite3_free(zSql);
+        if (rc != SQLITE_OK) return rc;
+        if (sqlite3_step(pStmt) == SQLITE_ROW) {
+            pLoad->iNextId = sqlite3_column_int64(pStmt, 0);
+        }
+        rc = sqlite3_finalize(pStmt);
+    }
     return rc;
 }
 
+/* Order node rows by id; external keys last, then by position */
+static int bulkRowRefCmp(const void *pA, const void *pB) {
+    const BulkRowRef *a = (const BulkRowRef*)pA;
+    const BulkRowRef *b = (const BulkRowRef*)pB;
+    if (a->iKey != b->iKey) return a->iKey < b->iKey ? -1 : 1;
+    return a->iSeq < b->iSeq ? -1 : (a->iSeq > b->iSeq);
+}
+
 /*
-** Free batch accumulator
+** Write the node rows of one parsed round in ascending id order, so the
+** node table's b-tree grows by appending. Duplicate ids keep file order,
+** leaving the first occurrence as the one loaded.
 */
-static void batchAccumulatorFree(BatchAccumulator *batch) {
-    if (!batch) return;
-    
-    /* Free any remaining nodes/edges */
-    for (int i = 0; i < batch->nNodes; i++) {
-        /* Would free node and its data */
-    }
-    for (int i = 0; i < batch->nEdges; i++) {
-        /* Would free edge and its data */
-    }
-    
-    sqlite3_free(batch->nodes);
-    sqlite3_free(batch->edges);
-    sqlite3_free(batch);
+static int bulkWriteNodesSorted(BulkLoad *pLoad, BulkChunk *aChunk, int nChunk) {
+    BulkRowRef *aRef;
+    sqlite3_int64 nRow = 0;
+    sqlite3_int64 i;
+    int iChunk, j;
+    int rc = SQLITE_OK;
+
+    for (iChunk = 0; iChunk < nChunk; iChunk++) {
+        if (aChunk[iChunk].rc != SQLITE_OK) return aChunk[iChunk].rc;
+        nRow += aChunk[iChunk].nRow;
+    }
+    aRef = sqlite3_malloc64(nRow * sizeof(BulkRowRef) + 1);
+    if (!aRef) return SQLITE_NOMEM;
+
+    nRow = 0;
+    for (iChunk = 0; iChunk < nChunk; iChunk++) {
+        for (j = 0; j < aChunk[iChunk].nRow; j++) {
+            BulkRowRef *pRef = &aRef[nRow];
+            pRef->aRow = &aChunk[iChunk].aField[(sqlite3_int64)j * pLoad->nCol];
+            if (!bulkFieldInt(&pRef->aRow[pLoad->aiCol[BULK_COL_ID]], &pRef->iKey)) {
+                pRef->iKey = LLONG_MAX;
+            }
+            pRef->iSeq = nRow++;
+        }
+    }
+    qsort(aRef, nRow, sizeof(BulkRowRef), bulkRowRefCmp);
+    for (i = 0; rc == SQLITE_OK && i < nRow; i++) {
+        rc = bulkWriteNode(pLoad, aRef[i].aRow);
+    }
+    sqlite3_free(aRef);
+    return rc;
 }
 
 /*
-** Bulk load nodes from CSV
+** Load a node or edge CSV file held in memory. The header decides which:
+** a file with source and target columns holds edges, otherwise it must
+** have an id column and holds nodes.
+**
+** Nodes: id, label (';' separates several labels), properties (JSON).
+** Integer ids are used as node ids; other ids are external keys, given
+** fresh node ids and recorded in the connection's temporary id map so a
+** following edge load can resolve them.
+**
+** Edges: source, target, type, weight, properties. Endpoints resolve
+** through the id map, else as integer node ids.
+**
+** Rows are parsed in parallel when config->parallelImport asks for it
+** and written by the calling thread, in file order, through one prepared
+** INSERT. Outside a transaction the loader commits every
+** config->batchSize rows (one transaction when it is 0).
+**
+** With config->deferIndexing the secondary indexes and label triggers of
+** the table being loaded are dropped first and rebuilt once at the end
+** (see graphIndexesSuspend()), node rows are written in id order within
+** each parse round, and a loader-owned load runs with synchronous=OFF.
+** The drop, the load and the rebuild then share one transaction, so a
+** failure or crash never leaves the graph without its indexes.
+** The CSR snapshot is then built straight away from the loaded tables.
 */
 int graphBulkLoadNodesCSV(GraphVtab *pGraph, const char *csvData,
                          size_t dataSize, BulkLoaderConfig *config,
                          BulkLoadStats *stats) {
+    BulkLoadStats localStats;
+    BulkLoad load;
+    TaskScheduler *scheduler = NULL;
+    BulkChunk *aChunk = NULL;
+    void **args = NULL;
+    const char *z = csvData;
+    const char *zEnd = csvData + dataSize;
+    GraphIndexSet *pIndexes = NULL;
+    int iSynchronous = -1;
+    int nWorker = 1;
+    sqlite3_int64 iStart = graphMetricsClock();
+    sqlite3_int64 nMicro;
+    int rc, rc2;
+
     if (!pGraph || !csvData || !config) return SQLITE_MISUSE;
-    
-    /* Initialize stats */
-    if (stats) {
-        memset(stats, 0, sizeof(BulkLoadStats));
+    if (!stats) stats = &localStats;
+    memset(stats, 0, sizeof(BulkLoadStats));
+    memset(&load, 0, sizeof(load));
+    load.pGraph = pGraph;
+    load.config = config;
+    load.stats = stats;
+
+    rc = bulkParseHeader(&load, &z, zEnd);
+    if (rc == SQLITE_ERROR) {
+        stats->lastError = sqlite3_mprintf("CSV header needs an id column, "
+                                           "or source and target columns");
     }
-    
-    /* Create CSV parser */
-    CSVParser *parser = csvParserCreate(csvData, dataSize);
-    if (!parser) return SQLITE_NOMEM;
-    
-    /* Parse header */
-    int rc = csvParseHeader(parser);
-    if (rc != SQLITE_OK) {
-        csvParserFree(parser);
-        return rc;
+    if (rc == SQLITE_OK) rc = bulkPrepare(&load);
+    if (rc != SQLITE_OK) goto done;
+
+    if (config->parallelImport != 0 && (size_t)(zEnd - z) > BULK_CHUNK_BYTES) {
+        scheduler = graphCreateTaskScheduler(config->parallelImport > 0 ? config->parallelImport : 0);
+        if (scheduler) nWorker = scheduler->nThreads;
     }
-    
-    /* Find required columns */
-    int idCol = -1, labelCol = -1, propsCol = -1;
-    for (int i = 0; i < parser->nColumns; i++) {
-        if (strcmp(parser->headers[i], "id") == 0) idCol = i;
-        else if (strcmp(parser->headers[i], "label") == 0) labelCol = i;
-        else if (strcmp(parser->headers[i], "properties") == 0) propsCol = i;
-    }
-    
-    if (idCol < 0) {
-        csvParserFree(parser);
-        return SQLITE_ERROR;
+    aChunk = sqlite3_malloc64(nWorker * sizeof(BulkChunk));
+    args = sqlite3_malloc64(nWorker * sizeof(void*));
+    if (!aChunk || !args) {
+        rc = SQLITE_NOMEM;
+        goto done;
     }
-    
-    /* Create batch accumulator */
-    BatchAccumulator *batch = batchAccumulatorCreate(config->batchSize);
-    if (!batch) {
-        csvParserFree(parser);
-        return SQLITE_NOMEM;
-    }
-    
-    /* Defer indexing if requested */
-    if (config->deferIndexing && pGraph->pLabelIndex) {
-        batch->indexingDeferred = 1;
-        /* Would disable index updates */
-    }
-    
-    /* Process rows */
-    char **row;
-    sqlite3_int64 rowCount = 0;
-    
-    while ((row = csvParseRow(parser)) != NULL) {
-        rowCount++;
-        
-        /* Extract node data */
-        sqlite3_int64 nodeId = 0;
-        if (row[idCol]) {
-            nodeId = strtoll(row[idCol], NULL, 10);
-        }
-        
-        /* Create node */
-        GraphNode *node = sqlite3_malloc(sizeof(GraphNode));
-        if (node) {
-            memset(node, 0, sizeof(GraphNode));
-            node->iNodeId = nodeId;
-            
-            /* Set label if present */
-            if (labelCol >= 0 && row[labelCol]) {
-                node->azLabels = sqlite3_malloc(sizeof(char*));
-                if (node->azLabels) {
-                    node->azLabels[0] = sqlite3_mprintf("%s", row[labelCol]);
-                    node->nLabels = 1;
-                }
-            }
-            
-            /* Set properties */
-            if (propsCol >= 0 && row[propsCol]) {
-                if (config->compressProperties) {
-                    node->zProperties = graphCompressProperties(row[propsCol]);
-                } else {
-                    node->zProperties = sqlite3_mprintf("%s", row[propsCol]);
-                }
-            }
-            
-            /* Add to batch */
-            if (batch->nNodes < batch->capacity) {
-                batch->nodes[batch->nNodes++] = node;
+    memset(aChunk, 0, nWorker * sizeof(BulkChunk));
+
+    if (sqlite3_get_autocommit(pGraph->pDb)) {
+        if (config->deferIndexing) {
+            /* Skip the per-commit fsyncs; restored below */
+            sqlite3_stmt *pStmt;
+            if (sqlite3_prepare_v2(pGraph->pDb, "PRAGMA synchronous", -1, &pStmt, NULL) == SQLITE_OK) {
+                if (sqlite3_step(pStmt) == SQLITE_ROW) iSynchronous = sqlite3_column_int(pStmt, 0);
+                sqlite3_finalize(pStmt);
             }
-            
-            /* Flush batch if full */
-            if (batch->nNodes >= batch->capacity) {
-                rc = batchFlush(batch, pGraph);
-                if (rc != SQLITE_OK) break;
+            if (iSynchronous > 0) sqlite3_exec(pGraph->pDb, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
+        }
+        rc = sqlite3_exec(pGraph->pDb, "BEGIN", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) goto done;
+        load.bOwnTxn = 1;
+    }
+    if (config->deferIndexing) {
+        rc = graphIndexesSuspend(pGraph, load.bEdges, &pIndexes);
+        load.bSuspended = pIndexes != NULL;
+    }
+
+    while (rc == SQLITE_OK && z < zEnd) {
+        int nChunk = 0;
+        int i, j;
+
+        /* Cut the next round at row boundaries and parse it */
+        while (nChunk < nWorker && z < zEnd) {
+            BulkChunk *pChunk = &aChunk[nChunk];
+            pChunk->zStart = z;
+            pChunk->zEnd = bulkChunkEnd(z, zEnd, BULK_CHUNK_BYTES);
+            pChunk->nCol = load.nCol;
+            pChunk->nRow = 0;
+            pChunk->nScratch = 0;
+            pChunk->rc = SQLITE_OK;
+            sqlite3_free(pChunk->zScratch);
+            pChunk->zScratch = NULL;
+            args[nChunk++] = pChunk;
+            z = pChunk->zEnd;
+        }
+        rc = graphRunTasks(nChunk > 1 ? scheduler : NULL, bulkParseChunk, args, nChunk);
+
+        /* Write the rows in file order, or nodes in id order when the
+        ** indexes are deferred */
+        if (rc == SQLITE_OK && pIndexes && !load.bEdges) {
+            rc = bulkWriteNodesSorted(&load, aChunk, nChunk);
+            nChunk = 0;
+        }
+        for (i = 0; rc == SQLITE_OK && i < nChunk; i++) {
+            rc = aChunk[i].rc;
+            for (j = 0; rc == SQLITE_OK && j < aChunk[i].nRow; j++) {
+                const BulkField *aRow = &aChunk[i].aField[(sqlite3_int64)j * load.nCol];
+                rc = load.bEdges ? bulkWriteEdge(&load, aRow) : bulkWriteNode(&load, aRow);
             }
-            
-            if (stats) stats->nodesLoaded++;
         }
-        
-        /* Free row data */
-        for (int i = 0; i < parser->nColumns; i++) {
-            sqlite3_free(row[i]);
+        stats->bytesProcessed = z - csvData;
+        if (config->progressCallback) {
+            config->progressCallback((int)((z - csvData) * 100 / (dataSize ? dataSize : 1)),
+                                     config->progressArg);
         }
-        sqlite3_free(row);
-        
-        /* Progress callback */
-        if (config->progressCallback && rowCount % 1000 == 0) {
-            int percent = (parser->position * 100) / parser->bufferSize;
-            config->progressCallback(percent, config->progressArg);
+    }
+
+    /* Rebuild the deferred indexes inside the load's transaction. A
+    ** failed load of our own is rolled back instead, which restores them;
+    ** in the caller's transaction they are rebuilt whatever happened */
+    if (pIndexes) {
+        if (load.bOwnTxn && rc != SQLITE_OK) {
+            graphIndexesDiscard(pIndexes);
+        } else {
+            rc2 = graphIndexesResume(pGraph, pIndexes, load.iMinId,
+                                     stats->nodesLoaded > 0 ? load.iMaxId : load.iMinId - 1);
+            if (rc == SQLITE_OK) rc = rc2;
         }
+        pIndexes = NULL;
+        load.bSuspended = 0;
     }
-    
-    /* Flush remaining batch */
-    if (batch->nNodes > 0) {
-        batchFlush(batch, pGraph);
+
+    if (load.bOwnTxn) {
+        if (rc == SQLITE_OK) {
+            rc = sqlite3_exec(pGraph->pDb, "COMMIT", NULL, NULL, NULL);
+        } else {
+            sqlite3_exec(pGraph->pDb, "ROLLBACK", NULL, NULL, NULL);
+        }
     }
-    
-    /* Re-enable indexing and rebuild */
-    if (batch->indexingDeferred) {
-        /* Would rebuild indexes */
+    if (stats->nodesLoaded > 0 || stats->edgesLoaded > 0) {
+        graphBumpDataVersion(pGraph);
+        if (rc == SQLITE_OK && config->deferIndexing && load.bOwnTxn) {
+            CSRGraph *pCSR;
+            graphCSRGet(pGraph, &pCSR);
+        }
+    }
+
+done:
+    if (iSynchronous > 0) {
+        char *zPragma = sqlite3_mprintf("PRAGMA synchronous=%d", iSynchronous);
+        if (zPragma) sqlite3_exec(pGraph->pDb, zPragma, NULL, NULL, NULL);
+        sqlite3_free(zPragma);
+    }
+    if (rc != SQLITE_OK && !stats->lastError) {
+        stats->lastError = sqlite3_mprintf("%s", sqlite3_errmsg(pGraph->pDb));
+    }
+    nMicro = graphMetricsClock() - iStart;
+    stats->elapsedTime = nMicro / 1e6;
+    if (rc == SQLITE_OK) {
+        graphMetricAdd(GRAPH_METRIC_BULK_LOADS, 1);
+        graphMetricAdd(GRAPH_METRIC_BULK_ROWS, stats->nodesLoaded + stats->edgesLoaded);
+        graphMetricAdd(GRAPH_METRIC_BULK_BYTES, stats->bytesProcessed);
+        graphMetricAdd(GRAPH_METRIC_BULK_US, nMicro);
     }
-    
-    /* Update stats */
+    if (stats == &localStats) sqlite3_free(localStats.lastError);
+    if (aChunk) {
+        for (int i = 0; i < nWorker; i++) {
+            sqlite3_free(aChunk[i].aField);
+            sqlite3_free(aChunk[i].zScratch);
+        }
+    }
+    sqlite3_free(aChunk);
+    sqlite3_free(args);
+    sqlite3_free(load.zLabels);
+    sqlite3_finalize(load.pInsert);
+    sqlite3_finalize(load.pMapInsert);
+    sqlite3_finalize(load.pMapLookup);
+    graphDestroyTaskScheduler(scheduler);
+    return rc;
+}
+
+/*
+** Report the failure of zWhat ("open", "read") on filename with the
+** system error in errno. Returns rc.
+*/
+static int bulkLoadFileError(BulkLoadStats *stats, int rc, const char *zWhat,
+                             const char *filename) {
     if (stats) {
-        stats->bytesProcessed = parser->position;
+        memset(stats, 0, sizeof(BulkLoadStats));
+        stats->lastError = sqlite3_mprintf("cannot %s '%s': %s", zWhat, filename,
+                                           strerror(errno));
     }
-    
-    /* Cleanup */
-    batchAccumulatorFree(batch);
-    csvParserFree(parser);
-    
     return rc;
 }
 
 /*
-** Memory-mapped file loader
+** Memory-mapped file loader. The mapping is parsed in place; CSV
+** fields are bound to the INSERT without being copied.
 */
 int graphBulkLoadMapped(GraphVtab *pGraph, const char *filename,
                        BulkLoaderConfig *config, BulkLoadStats *stats) {
     struct stat st;
     int fd;
-    
+    int rc;
+
+    if (!filename) return SQLITE_MISUSE;
+
+    /* Only CSV is supported; other formats fail rather than load nothing */
+    if (!strstr(filename, ".csv")) {
+        if (stats) {
+            memset(stats, 0, sizeof(BulkLoadStats));
+            stats->lastError = sqlite3_mprintf("unsupported file type: %s", filename);
+        }
+        return SQLITE_ERROR;
+    }
+
     /* Open file */
     fd = open(filename, O_RDONLY);
-    if (fd < 0) return SQLITE_CANTOPEN;
-    
+    if (fd < 0) return bulkLoadFileError(stats, SQLITE_CANTOPEN, "open", filename);
+
     /* Get file size */
     if (fstat(fd, &st) < 0) {
+        rc = bulkLoadFileError(stats, SQLITE_IOERR, "read", filename);
+        close(fd);
+        return rc;
+    }
+    if (st.st_size == 0) {
         close(fd);
-        return SQLITE_IOERR;
+        if (stats) memset(stats, 0, sizeof(BulkLoadStats));
+        return SQLITE_OK;
     }
-    
+
     /* Memory map the file */
     void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     if (mapped == MAP_FAILED) {
+        rc = bulkLoadFileError(stats, SQLITE_IOERR, "read", filename);
         close(fd);
-        return SQLITE_IOERR;
-    }
-    
-    /* Process based on file type */
-    int rc = SQLITE_OK;
-    if (strstr(filename, ".csv")) {
-        rc = graphBulkLoadNodesCSV(pGraph, mapped, st.st_size, config, stats);
-    } else if (strstr(filename, ".json")) {
-        /* JSON loading would be implemented similarly */
+        return rc;
     }
-    
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+    rc = graphBulkLoadNodesCSV(pGraph, mapped, st.st_size, config, stats);
+
     /* Cleanup */
     munmap(mapped, st.st_size);
     close(fd);
-    
+
     return rc;
 }
 
 /*
-** SQL function for bulk loading
+** SQL function for bulk loading:
+**   graph_bulk_load(graph_name, filename [, config_json])
+** config_json may set batch_size (rows per transaction, 0 for one
+** transaction), threads (parse workers, 0 for the whole pool, 1 to
+** parse on the calling thread) and defer_indexing. compress_properties
+** is accepted for compatibility; property compression is a property of
+** the graph (properties=compressed), applied to every write.
+** Load nodes.csv before edges.csv so edges can refer to node keys.
 */
 static void bulkLoadFunc(
     sqlite3_context *context,
@@ -482,67 +872,71 @@ static void bulkLoadFunc(
     sqlite3_value **argv
 ) {
     if (argc < 2) {
-        sqlite3_result_error(context, 
+        sqlite3_result_error(context,
             "Usage: graph_bulk_load(graph_name, filename, config)", -1);
         return;
     }
-    
+
     const char *graphName = (const char*)sqlite3_value_text(argv[0]);
     const char *filename = (const char*)sqlite3_value_text(argv[1]);
-    (void)graphName;  /* Used in future implementation */
-    
+
     /* Parse configuration */
     BulkLoaderConfig config = {
-        .batchSize = 1000,
+        .batchSize = 100000,
         .deferIndexing = 1,
-        .parallelImport = 0,
+        .parallelImport = -1,
         .validateData = 1,
         .compressProperties = 0,
         .progressCallback = NULL,
         .progressArg = NULL
     };
-    
-    if (argc >= 3) {
-        /* Parse JSON config */
-        const char *configJson = (const char*)sqlite3_value_text(argv[2]);
-        (void)configJson;  /* Used in future implementation */
-        /* Would parse configuration */
-    }
-    
-    /* Get graph */
-    sqlite3 *db = sqlite3_context_db_handle(context);
-    GraphVtab *pGraph = NULL;
-    
-    /* Look up graph virtual table by name */
-    if (graphName && strlen(graphName) > 0) {
-        /* Query the virtual table to get the graph instance */
-        char *zSql = sqlite3_mprintf("SELECT 1 FROM %s LIMIT 0", graphName);
-        if (zSql) {
-            sqlite3_stmt *pStmt;
-            int rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL);
-            if (rc == SQLITE_OK) {
-                /* If we can prepare the statement, the table exists */
-                /* For now, create a temporary graph for demonstration */
-                pGraph = sqlite3_malloc(sizeof(GraphVtab));
-                if (pGraph) {
-                    memset(pGraph, 0, sizeof(GraphVtab));
-                    pGraph->pDb = db;
-                }
-                sqlite3_finalize(pStmt);
+
+    if (argc >= 3 && sqlite3_value_type(argv[2]) != SQLITE_NULL) {
+        sqlite3 *db = sqlite3_context_db_handle(context);
+        sqlite3_stmt *pStmt;
+        int rc = sqlite3_prepare_v2(db,
+            "SELECT json_extract(?1, '$.batch_size'), json_extract(?1, '$.threads'),"
+            " json_extract(?1, '$.defer_indexing'), json_extract(?1, '$.compress_properties')",
+            -1, &pStmt, NULL);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error_code(context, rc);
+            return;
+        }
+        sqlite3_bind_value(pStmt, 1, argv[2]);
+        if (sqlite3_step(pStmt) == SQLITE_ROW) {
+            if (sqlite3_column_type(pStmt, 0) != SQLITE_NULL) {
+                config.batchSize = sqlite3_column_int(pStmt, 0);
+            }
+            if (sqlite3_column_type(pStmt, 1) != SQLITE_NULL) {
+                int nThreads = sqlite3_column_int(pStmt, 1);
+                config.parallelImport = nThreads == 0 ? -1 : (nThreads == 1 ? 0 : nThreads);
+            }
+            if (sqlite3_column_type(pStmt, 2) != SQLITE_NULL) {
+                config.deferIndexing = sqlite3_column_int(pStmt, 2);
+            }
+            if (sqlite3_column_type(pStmt, 3) != SQLITE_NULL) {
+                config.compressProperties = sqlite3_column_int(pStmt, 3);
             }
-            sqlite3_free(zSql);
+        }
+        rc = sqlite3_finalize(pStmt);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error(context, "graph_bulk_load(): malformed config JSON", -1);
+            return;
         }
     }
-    
+
+    /* The loader writes through the named graph's backing tables */
+    GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(context), graphName);
     if (!pGraph) {
         sqlite3_result_error(context, "Graph not found", -1);
         return;
     }
-    
+
     /* Perform bulk load */
     BulkLoadStats stats;
+    memset(&stats, 0, sizeof(stats));
     int rc = graphBulkLoadMapped(pGraph, filename, &config, &stats);
-    
+
     if (rc == SQLITE_OK) {
         /* Return statistics as JSON */
         char *result = sqlite3_mprintf(
@@ -554,12 +948,13 @@ static void bulkLoadFunc(
             stats.bytesProcessed
         );
         sqlite3_result_text(context, result, -1, sqlite3_free);
+    } else if (stats.lastError) {
+        sqlite3_result_error(context, stats.lastError, -1);
+        sqlite3_result_error_code(context, rc);
     } else {
         sqlite3_result_error_code(context, rc);
     }
-    
-    /* Clean up temporary graph allocation */
-    sqlite3_free(pGraph);
+    sqlite3_free(stats.lastError);
 }
 
 /*
@@ -569,4 +964,4 @@ int graphRegisterBulkLoadFunctions(sqlite3 *db) {
     return sqlite3_create_function(db, "graph_bulk_load", -1,
                                   SQLITE_UTF8, NULL,
                                   bulkLoadFunc, NULL, NULL);
-}
\ No newline at end of file
+}
@@ -20,34 +20,87 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "graph-memory.h"
 #include "cypher-planner.h"
 
+
+/*
+** The cache is split into PLAN_CACHE_SHARDS shards, each a hash table
+** with its own mutex, so connections planning different queries rarely
+** meet on a lock. A shard evicts with CLOCK: a hit only sets the entry's
+** reference bit, and the hand sweeping the shard's ring clears bits
+** until it finds an entry that was not used since its last pass.
+**
+** Keys start with their scope, the graph table name, followed by 0x1f.
+** Each scope hashes to one of PLAN_CACHE_SCOPES version counters, and
+** entries remember the version they were planned under. Invalidating a
+** scope bumps its counter, which retires its entries everywhere at
+** once, including in the connections' front caches; stale entries are
+** dropped when found or swept by the clock hand.
+*/
+#define PLAN_CACHE_SHARDS 16
+#define PLAN_CACHE_SCOPES 64
+#define PLAN_FRONT_SLOTS  8
+
 /* Cache entry for compiled query plan */
 typedef struct PlanCacheEntry {
-    char *zQueryHash;            /* Hash of query text */
-    PhysicalPlanNode *pPlan;   /* Cached physical plan */
-    sqlite3_int64 lastUsed;      /* Last access timestamp */
+    char *zQueryHash;            /* Cache key */
+    unsigned int iHash;          /* Hash of the key */
+    PhysicalPlanNode *pPlan;     /* Cached physical plan */
+    int iScope;                  /* Version counter of the key's scope */
+    sqlite3_uint64 iVersion;     /* Scope version the plan was made under */
+    int iSlot;                   /* Position on the shard's clock ring */
+    int bRef;                    /* Used since the clock hand last passed */
     sqlite3_int64 useCount;      /* Number of times used */
-    double avgExecutionTime;     /* Average execution time */
     size_t memorySize;           /* Memory used by plan */
     struct PlanCacheEntry *pNext;/* Next entry in hash chain */
-    struct PlanCacheEntry *pLRU; /* LRU list linkage */
 } PlanCacheEntry;
 
-/* Query plan cache structure */
-typedef struct PlanCache {
+/* One shard of the plan cache */
+typedef struct PlanCacheShard {
+    sqlite3_mutex *mutex;        /* Guards everything below */
     PlanCacheEntry **buckets;    /* Hash table buckets */
     int nBuckets;                /* Number of buckets */
+    PlanCacheEntry **apRing;     /* Clock ring, maxEntries slots */
+    int iHand;                   /* Next ring slot the hand looks at */
     int nEntries;                /* Current number of entries */
     int maxEntries;              /* Maximum entries allowed */
     size_t maxMemory;            /* Maximum memory usage */
     size_t currentMemory;        /* Current memory usage */
-    PlanCacheEntry *pLRUHead;    /* LRU list head (most recent) */
-    PlanCacheEntry *pLRUTail;    /* LRU list tail (least recent) */
-    sqlite3_mutex *mutex;        /* Thread safety */
     
     /* Statistics */
     sqlite3_int64 hits;          /* Cache hits */
     sqlite3_int64 misses;        /* Cache misses */
     sqlite3_int64 evictions;     /* Entries evicted */
+} PlanCacheShard;
+
+/*
+** Per-connection front cache: the last few plans a connection used.
+** A connection runs one statement at a time, so it is read and written
+** without locks; entries are checked against their scope version.
+*/
+typedef struct PlanFrontEntry {
+    char *zKey;                  /* Cache key, or NULL if the slot is free */
+    unsigned int iHash;          /* Hash of the key */
+    PhysicalPlanNode *pPlan;     /* Private copy of the plan */
+    int iScope;                  /* Version counter of the key's scope */
+    sqlite3_uint64 iVersion;     /* Scope version of the plan */
+    sqlite3_uint64 iUsed;        /* Tick of the last use */
+} PlanFrontEntry;
+
+struct GraphPlanFrontCache {
+    PlanFrontEntry aSlot[PLAN_FRONT_SLOTS];
+    sqlite3_uint64 iTick;        /* Use counter for replacement */
+    sqlite3_int64 hits;          /* Hits, read by graphPlanCacheStats() */
+    int nRef;                    /* Registrations sharing this cache */
+    GraphPlanFrontCache *pNextFront; /* List of live front caches */
+};
+
+/* Query plan cache structure */
+typedef struct PlanCache {
+    PlanCacheShard *apShard[PLAN_CACHE_SHARDS];
+    sqlite3_uint64 aScopeVersion[PLAN_CACHE_SCOPES];
+    sqlite3_mutex *mutex;        /* Guards the front cache list */
+    GraphPlanFrontCache *pFronts;/* Live front caches */
+    sqlite3_int64 frontHits;     /* Hits of front caches since destroyed */
+    sqlite3_int64 frontHitsBase; /* Front hits when last cleared */
 } PlanCache;
 
 /* Global plan cache instance */
@@ -67,6 +120,41 @@ static unsigned int planCacheHash(const char *zQuery) {
     return hash;
 }
 
+/*
+** Version counter of the scope of zKey, the text before its first 0x1f
+*/
+static int planCacheScope(const char *zKey) {
+    unsigned int hash = 5381;
+    
+    while (*zKey && *zKey != '\x1f') {
+        hash = ((hash << 5) + hash) + (unsigned char)*zKey++;
+    }
+    
+    return (int)(hash % PLAN_CACHE_SCOPES);
+}
+
+static sqlite3_uint64 planCacheScopeVersion(int iScope) {
+    return __atomic_load_n(&g_planCache->aScopeVersion[iScope], __ATOMIC_ACQUIRE);
+}
+
+/*
+** Retire the entries of every scope
+*/
+static void planCacheBumpAllScopes(void) {
+    for (int i = 0; i < PLAN_CACHE_SCOPES; i++) {
+        __atomic_add_fetch(&g_planCache->aScopeVersion[i], 1, __ATOMIC_RELEASE);
+    }
+}
+
+static PlanCacheShard *planCacheShard(unsigned int iHash) {
+    return g_planCache->apShard[iHash % PLAN_CACHE_SHARDS];
+}
+
+/* Shards use the hash bits above those choosing the shard */
+static int planCacheBucket(PlanCacheShard *pShard, unsigned int iHash) {
+    return (int)((iHash / PLAN_CACHE_SHARDS) % (unsigned int)pShard->nBuckets);
+}
+
 /*
 ** Calculate memory size of a physical plan
 */
@@ -85,6 +173,7 @@ static size_t calculatePlanSize(PhysicalPlanNode *pPlan) {
             break;
         case PHYSICAL_LABEL_INDEX_SCAN:
         case PHYSICAL_PROPERTY_INDEX_SCAN:
+        case PHYSICAL_BITMAP_AND:
             if (pPlan->zLabel) {
                 size += strlen(pPlan->zLabel) + 1;
             }
@@ -92,6 +181,18 @@ static size_t calculatePlanSize(PhysicalPlanNode *pPlan) {
                 size += strlen(pPlan->zProperty) + 1;
             }
             break;
+        case PHYSICAL_EXPAND:
+        case PHYSICAL_VAR_LENGTH_EXPAND:
+            if (pPlan->zLabel) {
+                size += strlen(pPlan->zLabel) + 1;
+            }
+            if (pPlan->zFromAlias) {
+                size += strlen(pPlan->zFromAlias) + 1;
+            }
+            if (pPlan->zRelAlias) {
+                size += strlen(pPlan->zRelAlias) + 1;
+            }
+            break;
         case PHYSICAL_HASH_JOIN:
         case PHYSICAL_NESTED_LOOP_JOIN:
         case PHYSICAL_INDEX_NESTED_LOOP:
@@ -106,6 +207,8 @@ static size_t calculatePlanSize(PhysicalPlanNode *pPlan) {
         case PHYSICAL_SORT:
         case PHYSICAL_LIMIT:
         case PHYSICAL_AGGREGATION:
+        case PHYSICAL_CREATE:
+        case PHYSICAL_MERGE:
             /* Other operators */
             size += 100; /* Estimate */
             break;
@@ -119,8 +222,38 @@ static size_t calculatePlanSize(PhysicalPlanNode *pPlan) {
     return size;
 }
 
+static void planCacheShardFree(PlanCacheShard *pShard) {
+    if (!pShard) return;
+    sqlite3_mutex_free(pShard->mutex);
+    sqlite3_free(pShard->buckets);
+    sqlite3_free(pShard->apRing);
+    sqlite3_free(pShard);
+}
+
+static PlanCacheShard *planCacheShardCreate(int maxEntries, size_t maxMemory) {
+    PlanCacheShard *pShard = sqlite3_malloc(sizeof(PlanCacheShard));
+    if (!pShard) return NULL;
+    
+    memset(pShard, 0, sizeof(PlanCacheShard));
+    pShard->maxEntries = maxEntries;
+    pShard->maxMemory = maxMemory;
+    pShard->nBuckets = maxEntries * 2; /* Load factor 0.5 */
+    pShard->buckets = sqlite3_malloc(pShard->nBuckets * sizeof(PlanCacheEntry*));
+    pShard->apRing = sqlite3_malloc(maxEntries * sizeof(PlanCacheEntry*));
+    pShard->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if (!pShard->buckets || !pShard->apRing) {
+        planCacheShardFree(pShard);
+        return NULL;
+    }
+    
+    memset(pShard->buckets, 0, pShard->nBuckets * sizeof(PlanCacheEntry*));
+    memset(pShard->apRing, 0, maxEntries * sizeof(PlanCacheEntry*));
+    return pShard;
+}
+
 /*
-** Initialize the global plan cache
+** Initialize the global plan cache. The limits are split evenly over
+** the shards.
 */
 int graphInitPlanCache(int maxEntries, size_t maxMemory) {
     if (g_planCache) {
@@ -136,22 +269,16 @@ int graphInitPlanCache(int maxEntries, size_t maxMemory) {
     if (maxEntries <= 0) maxEntries = 100;
     if (maxMemory <= 0) maxMemory = 10 * 1024 * 1024; /* 10MB */
     
-    g_planCache->maxEntries = maxEntries;
-    g_planCache->maxMemory = maxMemory;
-    g_planCache->nBuckets = maxEntries * 2; /* Load factor 0.5 */
-    
-    /* Allocate hash table */
-    g_planCache->buckets = sqlite3_malloc(
-        g_planCache->nBuckets * sizeof(PlanCacheEntry*));
-    if (!g_planCache->buckets) {
-        sqlite3_free(g_planCache);
-        g_planCache = NULL;
-        return SQLITE_NOMEM;
+    for (int i = 0; i < PLAN_CACHE_SHARDS; i++) {
+        g_planCache->apShard[i] = planCacheShardCreate(
+            (maxEntries + PLAN_CACHE_SHARDS - 1) / PLAN_CACHE_SHARDS,
+            (maxMemory + PLAN_CACHE_SHARDS - 1) / PLAN_CACHE_SHARDS);
+        if (!g_planCache->apShard[i]) {
+            graphPlanCacheShutdown();
+            return SQLITE_NOMEM;
+        }
     }
     
-    memset(g_planCache->buckets, 0, 
-           g_planCache->nBuckets * sizeof(PlanCacheEntry*));
-    
     /* Create mutex for thread safety */
     g_planCache->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
     
@@ -159,241 +286,390 @@ int graphInitPlanCache(int maxEntries, size_t maxMemory) {
 }
 
 /*
-** Move entry to front of LRU list
+** Remove an entry from its shard and free it
 */
-static void planCacheTouchLRU(PlanCacheEntry *entry) {
-    if (!g_planCache || !entry) return;
+static void planCacheShardRemove(PlanCacheShard *pShard, PlanCacheEntry *entry) {
+    PlanCacheEntry **pp = &pShard->buckets[planCacheBucket(pShard, entry->iHash)];
     
-    /* Already at front */
-    if (g_planCache->pLRUHead == entry) return;
-    
-    /* Remove from current position */
-    if (entry->pLRU) {
-        entry->pLRU->pLRU = entry->pLRU;
-    }
-    if (g_planCache->pLRUTail == entry) {
-        g_planCache->pLRUTail = entry->pLRU;
+    while (*pp) {
+        if (*pp == entry) {
+            *pp = entry->pNext;
+            break;
+        }
+        pp = &(*pp)->pNext;
     }
+    pShard->apRing[entry->iSlot] = NULL;
     
-    /* Add to front */
-    entry->pLRU = g_planCache->pLRUHead;
-    g_planCache->pLRUHead = entry;
+    pShard->nEntries--;
+    pShard->currentMemory -= entry->memorySize;
     
-    if (!g_planCache->pLRUTail) {
-        g_planCache->pLRUTail = entry;
+    sqlite3_free(entry->zQueryHash);
+    physicalPlanNodeDestroy(entry->pPlan);
+    sqlite3_free(entry);
+}
+
+/*
+** Advance the clock hand to the first entry that is stale or was not
+** used since the hand last passed it, and evict that entry. Two turns
+** of the ring always find one, since the first clears every bit.
+*/
+static void planCacheShardEvict(PlanCacheShard *pShard) {
+    int nStep = 2 * pShard->maxEntries;
+    
+    while (pShard->nEntries > 0 && nStep-- >= 0) {
+        PlanCacheEntry *entry = pShard->apRing[pShard->iHand];
+        pShard->iHand = (pShard->iHand + 1) % pShard->maxEntries;
+        
+        if (!entry) continue;
+        if (entry->bRef &&
+            entry->iVersion == planCacheScopeVersion(entry->iScope)) {
+            entry->bRef = 0;
+            continue;
+        }
+        planCacheShardRemove(pShard, entry);
+        pShard->evictions++;
+        return;
     }
 }
 
 /*
-** Evict least recently used entry
+** Find zKey in a shard, dropping it if its scope changed since
 */
-static void planCacheEvictLRU(void) {
-    if (!g_planCache || !g_planCache->pLRUTail) return;
+static PlanCacheEntry *planCacheShardFind(PlanCacheShard *pShard, const char *zKey,
+                                          unsigned int iHash, sqlite3_uint64 iVersion) {
+    PlanCacheEntry *entry = pShard->buckets[planCacheBucket(pShard, iHash)];
     
-    PlanCacheEntry *victim = g_planCache->pLRUTail;
+    while (entry) {
+        if (entry->iHash == iHash && strcmp(entry->zQueryHash, zKey) == 0) {
+            if (entry->iVersion != iVersion) {
+                planCacheShardRemove(pShard, entry);
+                return NULL;
+            }
+            return entry;
+        }
+        entry = entry->pNext;
+    }
+    return NULL;
+}
+
+/*
+** Front cache operations. The cache is shared by the registrations of
+** one connection's functions, each holding a reference.
+*/
+GraphPlanFrontCache *graphPlanFrontCacheCreate(void) {
+    GraphPlanFrontCache *pFront = sqlite3_malloc(sizeof(GraphPlanFrontCache));
+    if (!pFront) return NULL;
+    
+    memset(pFront, 0, sizeof(GraphPlanFrontCache));
+    if (g_planCache) {
+        sqlite3_mutex_enter(g_planCache->mutex);
+        pFront->pNextFront = g_planCache->pFronts;
+        g_planCache->pFronts = pFront;
+        sqlite3_mutex_leave(g_planCache->mutex);
+    }
+    return pFront;
+}
+
+void graphPlanFrontCacheRef(GraphPlanFrontCache *pFront) {
+    if (pFront) pFront->nRef++;
+}
+
+static void planFrontSlotClear(PlanFrontEntry *pSlot) {
+    sqlite3_free(pSlot->zKey);
+    physicalPlanNodeDestroy(pSlot->pPlan);
+    memset(pSlot, 0, sizeof(PlanFrontEntry));
+}
+
+/* Drop a reference; usable as an xDestroy callback */
+void graphPlanFrontCacheUnref(void *pArg) {
+    GraphPlanFrontCache *pFront = (GraphPlanFrontCache*)pArg;
     
-    /* Remove from hash table */
-    unsigned int bucket = planCacheHash(victim->zQueryHash) % g_planCache->nBuckets;
-    PlanCacheEntry **pp = &g_planCache->buckets[bucket];
+    if (!pFront || --pFront->nRef > 0) return;
     
-    while (*pp) {
-        if (*pp == victim) {
-            *pp = victim->pNext;
+    if (g_planCache) {
+        GraphPlanFrontCache **pp;
+        sqlite3_mutex_enter(g_planCache->mutex);
+        for (pp = &g_planCache->pFronts; *pp; pp = &(*pp)->pNextFront) {
+            if (*pp == pFront) {
+                *pp = pFront->pNextFront;
+                break;
+            }
+        }
+        g_planCache->frontHits += pFront->hits;
+        sqlite3_mutex_leave(g_planCache->mutex);
+    }
+    for (int i = 0; i < PLAN_FRONT_SLOTS; i++) {
+        planFrontSlotClear(&pFront->aSlot[i]);
+    }
+    sqlite3_free(pFront);
+}
+
+/*
+** Keep a copy of pPlan in the front cache, replacing the least
+** recently used slot
+*/
+static void planFrontStore(GraphPlanFrontCache *pFront, const char *zKey,
+                           unsigned int iHash, int iScope, sqlite3_uint64 iVersion,
+                           const PhysicalPlanNode *pPlan) {
+    PlanFrontEntry *pVictim = &pFront->aSlot[0];
+    
+    for (int i = 0; i < PLAN_FRONT_SLOTS; i++) {
+        PlanFrontEntry *pSlot = &pFront->aSlot[i];
+        if (!pSlot->zKey) {
+            pVictim = pSlot;
             break;
         }
-        pp = &(*pp)->pNext;
+        if (pSlot->iUsed < pVictim->iUsed) pVictim = pSlot;
     }
     
-    /* Remove from LRU list */
-    g_planCache->pLRUTail = victim->pLRU;
-    if (!g_planCache->pLRUTail) {
-        g_planCache->pLRUHead = NULL;
+    planFrontSlotClear(pVictim);
+    pVictim->zKey = sqlite3_mprintf("%s", zKey);
+    pVictim->pPlan = physicalPlanNodeCopy(pPlan);
+    if (!pVictim->zKey || !pVictim->pPlan) {
+        planFrontSlotClear(pVictim);
+        return;
     }
-    
-    /* Update statistics */
-    g_planCache->nEntries--;
-    g_planCache->currentMemory -= victim->memorySize;
-    g_planCache->evictions++;
-    
-    /* Free memory */
-    sqlite3_free(victim->zQueryHash);
-    physicalPlanNodeDestroy(victim->pPlan);
-    sqlite3_free(victim);
+    pVictim->iHash = iHash;
+    pVictim->iScope = iScope;
+    pVictim->iVersion = iVersion;
+    pVictim->iUsed = ++pFront->iTick;
 }
 
 /*
-** Look up a plan in the cache
+** Look up a plan, first in the connection's front cache pFront (may be
+** NULL) and then in the shared shards. Returns a copy of the cached
+** plan, so an entry evicted while the query runs is not freed under
+** it, or NULL. *piVersion receives the version of the key's scope,
+** which the caller passes to graphPlanCacheInsert() after a miss.
 */
-PhysicalPlanNode* graphPlanCacheLookup(const char *zQuery) {
-    if (!g_planCache || !zQuery) return NULL;
+PhysicalPlanNode* graphPlanCacheLookup(GraphPlanFrontCache *pFront, const char *zQuery,
+                                       sqlite3_uint64 *piVersion) {
+    PlanCacheShard *pShard;
+    PlanCacheEntry *entry;
+    PhysicalPlanNode *pCopy = NULL;
     
-    sqlite3_mutex_enter(g_planCache->mutex);
-    
-    unsigned int bucket = planCacheHash(zQuery) % g_planCache->nBuckets;
-    PlanCacheEntry *entry = g_planCache->buckets[bucket];
+    *piVersion = 0;
+    if (!g_planCache || !zQuery) return NULL;
     
-    while (entry) {
-        if (strcmp(entry->zQueryHash, zQuery) == 0) {
-            /* Cache hit */
-            g_planCache->hits++;
-            entry->useCount++;
-            entry->lastUsed = (sqlite3_int64)time(NULL);
-            
-            /* Move to front of LRU */
-            planCacheTouchLRU(entry);
-            
-            sqlite3_mutex_leave(g_planCache->mutex);
-            return entry->pPlan;
+    unsigned int iHash = planCacheHash(zQuery);
+    int iScope = planCacheScope(zQuery);
+    sqlite3_uint64 iVersion = planCacheScopeVersion(iScope);
+    *piVersion = iVersion;
+    
+    if (pFront) {
+        for (int i = 0; i < PLAN_FRONT_SLOTS; i++) {
+            PlanFrontEntry *pSlot = &pFront->aSlot[i];
+            if (!pSlot->zKey || pSlot->iHash != iHash) continue;
+            if (strcmp(pSlot->zKey, zQuery) != 0) continue;
+            if (pSlot->iVersion != iVersion) {
+                planFrontSlotClear(pSlot);
+                break;
+            }
+            pSlot->iUsed = ++pFront->iTick;
+            __atomic_store_n(&pFront->hits, pFront->hits + 1, __ATOMIC_RELAXED);
+            return physicalPlanNodeCopy(pSlot->pPlan);
         }
-        entry = entry->pNext;
     }
     
-    /* Cache miss */
-    g_planCache->misses++;
-    sqlite3_mutex_leave(g_planCache->mutex);
-    return NULL;
+    pShard = planCacheShard(iHash);
+    sqlite3_mutex_enter(pShard->mutex);
+    
+    entry = planCacheShardFind(pShard, zQuery, iHash, iVersion);
+    if (entry) {
+        /* Cache hit */
+        pShard->hits++;
+        entry->useCount++;
+        entry->bRef = 1;
+        pCopy = physicalPlanNodeCopy(entry->pPlan);
+    } else {
+        /* Cache miss */
+        pShard->misses++;
+    }
+    
+    sqlite3_mutex_leave(pShard->mutex);
+    
+    if (pCopy && pFront) {
+        planFrontStore(pFront, zQuery, iHash, iScope, iVersion, pCopy);
+    }
+    return pCopy;
 }
 
 /*
-** Insert a plan into the cache
+** Insert a plan into the cache. The cache owns pPlan from here on, and
+** frees it if it cannot be added. iVersion is the scope version the
+** lookup reported; a plan made before its scope was invalidated is
+** dropped instead of cached.
 */
-int graphPlanCacheInsert(const char *zQuery, PhysicalPlanNode *pPlan) {
-    if (!g_planCache || !zQuery || !pPlan) return SQLITE_MISUSE;
-    
-    sqlite3_mutex_enter(g_planCache->mutex);
+int graphPlanCacheInsert(GraphPlanFrontCache *pFront, const char *zQuery,
+                         sqlite3_uint64 iVersion, PhysicalPlanNode *pPlan) {
+    PlanCacheShard *pShard;
+    PlanCacheEntry *entry;
+    
+    if (!g_planCache || !zQuery || !pPlan) {
+        physicalPlanNodeDestroy(pPlan);
+        return SQLITE_MISUSE;
+    }
     
-    /* Check if already exists */
-    unsigned int bucket = planCacheHash(zQuery) % g_planCache->nBuckets;
-    PlanCacheEntry *existing = g_planCache->buckets[bucket];
-    
-    while (existing) {
-        if (strcmp(existing->zQueryHash, zQuery) == 0) {
-            /* Update existing entry */
-            physicalPlanNodeDestroy(existing->pPlan);
-            existing->pPlan = pPlan;
-            existing->memorySize = calculatePlanSize(pPlan);
-            existing->lastUsed = (sqlite3_int64)time(NULL);
-            
-            planCacheTouchLRU(existing);
-            sqlite3_mutex_leave(g_planCache->mutex);
-            return SQLITE_OK;
-        }
-        existing = existing->pNext;
+    unsigned int iHash = planCacheHash(zQuery);
+    int iScope = planCacheScope(zQuery);
+    if (planCacheScopeVersion(iScope) != iVersion) {
+        physicalPlanNodeDestroy(pPlan);
+        return SQLITE_OK;
     }
+    if (pFront) planFrontStore(pFront, zQuery, iHash, iScope, iVersion, pPlan);
     
-    /* Create new entry */
-    PlanCacheEntry *entry = sqlite3_malloc(sizeof(PlanCacheEntry));
+    /* Sized and keyed before taking the shard lock */
+    entry = sqlite3_malloc(sizeof(PlanCacheEntry));
     if (!entry) {
-        sqlite3_mutex_leave(g_planCache->mutex);
+        physicalPlanNodeDestroy(pPlan);
         return SQLITE_NOMEM;
     }
     
     memset(entry, 0, sizeof(PlanCacheEntry));
     entry->zQueryHash = sqlite3_mprintf("%s", zQuery);
+    if (!entry->zQueryHash) {
+        sqlite3_free(entry);
+        physicalPlanNodeDestroy(pPlan);
+        return SQLITE_NOMEM;
+    }
+    entry->iHash = iHash;
     entry->pPlan = pPlan;
+    entry->iScope = iScope;
+    entry->iVersion = iVersion;
     entry->memorySize = calculatePlanSize(pPlan);
-    entry->lastUsed = (sqlite3_int64)time(NULL);
     entry->useCount = 1;
     
+    pShard = planCacheShard(iHash);
+    sqlite3_mutex_enter(pShard->mutex);
+    
+    /* Replace an existing entry for the key */
+    PlanCacheEntry *existing = planCacheShardFind(pShard, zQuery, iHash, iVersion);
+    if (existing) planCacheShardRemove(pShard, existing);
+    
     /* Check cache limits */
-    while ((g_planCache->nEntries >= g_planCache->maxEntries) ||
-           (g_planCache->currentMemory + entry->memorySize > g_planCache->maxMemory)) {
-        planCacheEvictLRU();
-        
-        if (g_planCache->nEntries == 0) break;
+    while ((pShard->nEntries >= pShard->maxEntries) ||
+           (pShard->currentMemory + entry->memorySize > pShard->maxMemory)) {
+        if (pShard->nEntries == 0) break;
+        planCacheShardEvict(pShard);
     }
     
-    /* Insert into hash table */
-    entry->pNext = g_planCache->buckets[bucket];
-    g_planCache->buckets[bucket] = entry;
-    
-    /* Add to LRU list */
-    entry->pLRU = g_planCache->pLRUHead;
-    g_planCache->pLRUHead = entry;
-    if (!g_planCache->pLRUTail) {
-        g_planCache->pLRUTail = entry;
+    /* Take the first free ring slot from the hand on */
+    entry->iSlot = pShard->iHand;
+    while (pShard->apRing[entry->iSlot]) {
+        entry->iSlot = (entry->iSlot + 1) % pShard->maxEntries;
     }
+    pShard->apRing[entry->iSlot] = entry;
+    
+    /* Insert into hash table */
+    int bucket = planCacheBucket(pShard, iHash);
+    entry->pNext = pShard->buckets[bucket];
+    pShard->buckets[bucket] = entry;
     
     /* Update statistics */
-    g_planCache->nEntries++;
-    g_planCache->currentMemory += entry->memorySize;
+    pShard->nEntries++;
+    pShard->currentMemory += entry->memorySize;
     
-    sqlite3_mutex_leave(g_planCache->mutex);
+    sqlite3_mutex_leave(pShard->mutex);
     return SQLITE_OK;
 }
 
 /*
-** Invalidate cache entries matching a pattern
+** Retire every plan of a scope (a graph table name) by bumping its
+** version. Entries are freed lazily, when next found or swept.
+*/
+void graphPlanCacheInvalidateScope(const char *zScope) {
+    if (!g_planCache || !zScope) return;
+    
+    __atomic_add_fetch(&g_planCache->aScopeVersion[planCacheScope(zScope)], 1,
+                       __ATOMIC_RELEASE);
+}
+
+/*
+** The version of scope zScope, which changes whenever its plans are
+** retired. A plan kept outside the cache (a prepared Cypher statement)
+** is stale once this differs from the version it was planned under.
+*/
+sqlite3_uint64 graphPlanCacheVersion(const char *zScope) {
+    if (!g_planCache || !zScope) return 0;
+    return planCacheScopeVersion(planCacheScope(zScope));
+}
+
+/*
+** Invalidate cache entries matching a pattern. Front caches cannot be
+** searched from another connection, so every scope is retired too.
 */
 int graphPlanCacheInvalidate(const char *pattern) {
     if (!g_planCache) return SQLITE_OK;
     
-    sqlite3_mutex_enter(g_planCache->mutex);
-    
     int invalidated = 0;
     
-    /* Scan all buckets */
-    for (int i = 0; i < g_planCache->nBuckets; i++) {
-        PlanCacheEntry **pp = &g_planCache->buckets[i];
+    planCacheBumpAllScopes();
+    
+    for (int s = 0; s < PLAN_CACHE_SHARDS; s++) {
+        PlanCacheShard *pShard = g_planCache->apShard[s];
         
-        while (*pp) {
-            PlanCacheEntry *entry = *pp;
+        sqlite3_mutex_enter(pShard->mutex);
+        for (int i = 0; i < pShard->maxEntries; i++) {
+            PlanCacheEntry *entry = pShard->apRing[i];
             
             /* Check if query matches pattern */
-            int matches = 0;
-            if (!pattern || pattern[0] == '\0') {
-                matches = 1; /* Invalidate all */
-            } else if (strstr(entry->zQueryHash, pattern)) {
-                matches = 1;
-            }
-            
-            if (matches) {
-                /* Remove entry */
-                *pp = entry->pNext;
-                
-                /* Remove from LRU */
-                if (entry == g_planCache->pLRUHead) {
-                    g_planCache->pLRUHead = entry->pLRU;
-                }
-                if (entry == g_planCache->pLRUTail) {
-                    g_planCache->pLRUTail = NULL;
-                }
-                
-                /* Update statistics */
-                g_planCache->nEntries--;
-                g_planCache->currentMemory -= entry->memorySize;
-                
-                /* Free memory */
-                sqlite3_free(entry->zQueryHash);
-                physicalPlanNodeDestroy(entry->pPlan);
-                sqlite3_free(entry);
-                
-                invalidated++;
-            } else {
-                pp = &entry->pNext;
+            if (!entry) continue;
+            if (pattern && pattern[0] != '\0' && !strstr(entry->zQueryHash, pattern)) {
+                continue;
             }
+            planCacheShardRemove(pShard, entry);
+            invalidated++;
         }
+        sqlite3_mutex_leave(pShard->mutex);
     }
     
-    sqlite3_mutex_leave(g_planCache->mutex);
     return invalidated;
 }
 
 /*
-** Get cache statistics
+** Sum of the hits of the live front caches and those destroyed.
+** Caller holds g_planCache->mutex.
+*/
+static sqlite3_int64 planCacheFrontHits(void) {
+    sqlite3_int64 hits = g_planCache->frontHits;
+    GraphPlanFrontCache *pFront;
+    
+    for (pFront = g_planCache->pFronts; pFront; pFront = pFront->pNextFront) {
+        hits += __atomic_load_n(&pFront->hits, __ATOMIC_RELAXED);
+    }
+    return hits;
+}
+
+/*
+** Get cache statistics, summed over the shards. Front cache hits count
+** as hits.
 */
 void graphPlanCacheStats(sqlite3_int64 *hits, sqlite3_int64 *misses,
                         int *nEntries, size_t *memoryUsed) {
+    sqlite3_int64 nHit, nMiss = 0;
+    size_t nMem = 0;
+    int nEntry = 0;
+    
     if (!g_planCache) return;
     
     sqlite3_mutex_enter(g_planCache->mutex);
+    nHit = planCacheFrontHits() - g_planCache->frontHitsBase;
+    sqlite3_mutex_leave(g_planCache->mutex);
     
-    if (hits) *hits = g_planCache->hits;
-    if (misses) *misses = g_planCache->misses;
-    if (nEntries) *nEntries = g_planCache->nEntries;
-    if (memoryUsed) *memoryUsed = g_planCache->currentMemory;
+    for (int s = 0; s < PLAN_CACHE_SHARDS; s++) {
+        PlanCacheShard *pShard = g_planCache->apShard[s];
+        sqlite3_mutex_enter(pShard->mutex);
+        nHit += pShard->hits;
+        nMiss += pShard->misses;
+        nEntry += pShard->nEntries;
+        nMem += pShard->currentMemory;
+        sqlite3_mutex_leave(pShard->mutex);
+    }
     
-    sqlite3_mutex_leave(g_planCache->mutex);
+    if (hits) *hits = nHit;
+    if (misses) *misses = nMiss;
+    if (nEntries) *nEntries = nEntry;
+    if (memoryUsed) *memoryUsed = nMem;
 }
 
 /*
@@ -406,24 +682,37 @@ void graphPlanCacheClear(void) {
     
     /* Reset statistics */
     sqlite3_mutex_enter(g_planCache->mutex);
-    g_planCache->hits = 0;
-    g_planCache->misses = 0;
-    g_planCache->evictions = 0;
+    g_planCache->frontHitsBase = planCacheFrontHits();
     sqlite3_mutex_leave(g_planCache->mutex);
+    
+    for (int s = 0; s < PLAN_CACHE_SHARDS; s++) {
+        PlanCacheShard *pShard = g_planCache->apShard[s];
+        sqlite3_mutex_enter(pShard->mutex);
+        pShard->hits = 0;
+        pShard->misses = 0;
+        pShard->evictions = 0;
+        sqlite3_mutex_leave(pShard->mutex);
+    }
 }
 
 /*
-** Shutdown plan cache
+** Shutdown plan cache. Front caches still registered are detached.
 */
 void graphPlanCacheShutdown(void) {
     if (!g_planCache) return;
     
     /* Clear all entries */
-    graphPlanCacheClear();
+    for (int s = 0; s < PLAN_CACHE_SHARDS; s++) {
+        PlanCacheShard *pShard = g_planCache->apShard[s];
+        if (!pShard) continue;
+        for (int i = 0; i < pShard->maxEntries; i++) {
+            if (pShard->apRing[i]) planCacheShardRemove(pShard, pShard->apRing[i]);
+        }
+        planCacheShardFree(pShard);
+    }
     
     /* Free structures */
     sqlite3_mutex_free(g_planCache->mutex);
-    sqlite3_free(g_planCache->buckets);
     sqlite3_free(g_planCache);
     g_planCache = NULL;
 }
@@ -438,9 +727,9 @@ static void planCacheStatsFunc(
 ) {
     (void)argc;
     (void)argv;
-    sqlite3_int64 hits, misses;
-    int nEntries;
-    size_t memoryUsed;
+    sqlite3_int64 hits = 0, misses = 0;
+    int nEntries = 0;
+    size_t memoryUsed = 0;
     
     graphPlanCacheStats(&hits, &misses, &nEntries, &memoryUsed);
     
@@ -451,8 +740,8 @@ static void planCacheStatsFunc(
     
     char *result = sqlite3_mprintf(
         "{\"hits\":%lld,\"misses\":%lld,\"entries\":%d,"
-        "\"memory_bytes\":%zu,\"hit_rate\":%.1f}",
-        hits, misses, nEntries, memoryUsed, hitRate
+        "\"memory_bytes\":%lld,\"hit_rate\":%.1f}",
+        hits, misses, nEntries, (sqlite3_int64)memoryUsed, hitRate
     );
     
     sqlite3_result_text(context, result, -1, sqlite3_free);
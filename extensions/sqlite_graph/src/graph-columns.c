@@ -0,0 +1,1276 @@
+/*
+** SQLite Graph Database Extension - Hot-Property Columns
+**
+** A filter on a node property either runs json_extract() over every
+** row or walks a property index, one B-tree step and row fetch per
+** match. A property declared with graph_create_column(label, property)
+** is also kept as a typed array over the dense node indices of the CSR
+** snapshot, so comparing it against a literal is one sequential pass
+** over a few contiguous arrays.
+**
+** Layout: Per column, a bitmap of member nodes (those with the label,
+**         or every node for a column without one), a bitmap of members
+**         that have the property, and the values: int64s, doubles (with
+**         a bitmap of those that were integers) or codes into a
+**         dictionary of the distinct strings. A column whose values mix
+**         numbers and strings is marked mixed and keeps no values; the
+**         queries it would have answered go to SQL.
+** Versioning: A column is read with one query over the node table and
+**         stamped with GraphVtab.iCSRSerial. Tracked writes
+**         (graph-csr-delta.c) note the nodes they change and the column
+**         rereads those once the write succeeds, so it stays as current
+**         as the snapshot with its overlay; a compaction carries it
+**         over to the folded snapshot. Anything else that replaces the
+**         snapshot drops the contents, which are read again on next use.
+** Kernels: A comparison yields a bit per node, 64 nodes at a time, with
+**         AVX2 on x86-64 CPUs that have it and a scalar loop elsewhere,
+**         picked once at run time. Build with GRAPH_NO_SIMD for the
+**         scalar kernels only. Strings compare through the dictionary,
+**         once per distinct value. Results are those of comparing
+**         json_extract() with the literal in SQL, type order included.
+** Catalog: Declarations are rows of %s_columns, label '' standing for
+**         all nodes, so every connection to the graph sees them.
+**
+** Memory allocation: sqlite3_malloc64()/sqlite3_free(); id arrays handed
+** to the caller are freed with sqlite3_free(). A column costs about 8
+** bytes per node of the snapshot plus its distinct strings.
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(GRAPH_NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+# define GRAPH_COLUMN_AVX2 1
+# include <immintrin.h>
+#endif
+
+/* Column types */
+#define COLUMN_EMPTY    0      /* No values read yet */
+#define COLUMN_INTEGER  1      /* aInt */
+#define COLUMN_REAL     2      /* aReal, aIsInt */
+#define COLUMN_TEXT     3      /* aCode, dict */
+#define COLUMN_MIXED    4      /* No values kept; queries go to SQL */
+
+/* Largest magnitude up to which every integer is exact as a double */
+#define COLUMN_EXACT_INT ((sqlite3_int64)1<<53)
+
+#define COLUMN_WORDS(N)  (((N)+63)>>6)
+#define COLUMN_BIT(A,I)  (((A)[(I)>>6]>>((I)&63)) & 1)
+#define COLUMN_SET(A,I)  ((A)[(I)>>6] |= (sqlite3_uint64)1<<((I)&63))
+#define COLUMN_CLR(A,I)  ((A)[(I)>>6] &= ~((sqlite3_uint64)1<<((I)&63)))
+
+/*
+** Distinct strings of a text column, found by content through an
+** open-addressed table of codes.
+*/
+typedef struct ColumnDict ColumnDict;
+struct ColumnDict {
+  char **azStr;                /* String per code */
+  int *anStr;                  /* Its length in bytes */
+  int nStr, nAlloc;            /* Codes used and allocated */
+  int *aHash;                  /* Code per slot, -1 if empty */
+  int nHash;                   /* Slot count, a power of two, or 0 */
+};
+
+struct GraphColumn {
+  char *zLabel;                /* Label, or NULL for all nodes */
+  char *zProperty;             /* Property */
+  sqlite3_int64 iSerial;       /* GraphVtab.iCSRSerial read at, or -1 */
+  int eType;                   /* COLUMN_* */
+  int nSlot;                   /* Dense nodes covered */
+  int nAlloc;                  /* Slots allocated, a multiple of 64 */
+  sqlite3_uint64 *aMember;     /* Node belongs to the column */
+  sqlite3_uint64 *aValid;      /* Member has the property */
+  sqlite3_uint64 *aIsInt;      /* COLUMN_REAL: value was an integer */
+  sqlite3_int64 *aInt;         /* COLUMN_INTEGER values */
+  double *aReal;               /* COLUMN_REAL values */
+  int *aCode;                  /* COLUMN_TEXT dictionary codes */
+  ColumnDict dict;             /* COLUMN_TEXT strings */
+  sqlite3_stmt *pRead;         /* Rereads one node for graphColumnsSync() */
+  int bKeep;                   /* Still in the catalog (columnsLoad()) */
+  GraphColumn *pNext;
+};
+
+struct GraphColumns {
+  GraphColumn *pFirst;         /* Declared columns */
+  sqlite3_int64 *aTouch;       /* Nodes changed by the tracked write */
+  int nTouch, nTouchAlloc;
+};
+
+/*
+** Dictionary
+*/
+
+static unsigned int dictHash(const char *z, int n){
+  unsigned int h = 2166136261u;
+  int i;
+  for(i=0; i<n; i++) h = (h ^ (unsigned char)z[i]) * 16777619u;
+  return h;
+}
+
+static void dictClear(ColumnDict *p){
+  int i;
+  for(i=0; i<p->nStr; i++) sqlite3_free(p->azStr[i]);
+  sqlite3_free(p->azStr);
+  sqlite3_free(p->anStr);
+  sqlite3_free(p->aHash);
+  memset(p, 0, sizeof(*p));
+}
+
+static int dictRehash(ColumnDict *p, int nHash){
+  int *aHash = sqlite3_malloc64((sqlite3_int64)nHash*sizeof(int));
+  int i;
+
+  if( aHash==0 ) return SQLITE_NOMEM;
+  memset(aHash, 0xff, (size_t)nHash*sizeof(int));
+  for(i=0; i<p->nStr; i++){
+    unsigned int h = dictHash(p->azStr[i], p->anStr[i]) & (nHash-1);
+    while( aHash[h]>=0 ) h = (h+1) & (nHash-1);
+    aHash[h] = i;
+  }
+  sqlite3_free(p->aHash);
+  p->aHash = aHash;
+  p->nHash = nHash;
+  return SQLITE_OK;
+}
+
+/*
+** Set *piCode to the code of string z of n bytes, adding it if new.
+*/
+static int dictIntern(ColumnDict *p, const char *z, int n, int *piCode){
+  unsigned int h;
+  int rc;
+
+  if( (p->nStr+1)*2>p->nHash ){
+    rc = dictRehash(p, p->nHash ? p->nHash*2 : 64);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  h = dictHash(z, n) & (p->nHash-1);
+  while( p->aHash[h]>=0 ){
+    int i = p->aHash[h];
+    if( p->anStr[i]==n && memcmp(p->azStr[i], z, n)==0 ){
+      *piCode = i;
+      return SQLITE_OK;
+    }
+    h = (h+1) & (p->nHash-1);
+  }
+  if( p->nStr>=p->nAlloc ){
+    int nNew = p->nAlloc ? p->nAlloc*2 : 64;
+    char **azNew = sqlite3_realloc64(p->azStr, (sqlite3_int64)nNew*sizeof(char*));
+    int *anNew;
+    if( azNew==0 ) return SQLITE_NOMEM;
+    p->azStr = azNew;
+    anNew = sqlite3_realloc64(p->anStr, (sqlite3_int64)nNew*sizeof(int));
+    if( anNew==0 ) return SQLITE_NOMEM;
+    p->anStr = anNew;
+    p->nAlloc = nNew;
+  }
+  p->azStr[p->nStr] = sqlite3_malloc64(n+1);
+  if( p->azStr[p->nStr]==0 ) return SQLITE_NOMEM;
+  memcpy(p->azStr[p->nStr], z, n);
+  p->azStr[p->nStr][n] = 0;
+  p->anStr[p->nStr] = n;
+  p->aHash[h] = p->nStr;
+  *piCode = p->nStr++;
+  return SQLITE_OK;
+}
+
+/*
+** Storage
+*/
+
+static void columnFreeValues(GraphColumn *pCol){
+  sqlite3_free(pCol->aIsInt);
+  sqlite3_free(pCol->aInt);
+  sqlite3_free(pCol->aReal);
+  sqlite3_free(pCol->aCode);
+  pCol->aIsInt = 0;
+  pCol->aInt = 0;
+  pCol->aReal = 0;
+  pCol->aCode = 0;
+  dictClear(&pCol->dict);
+}
+
+/*
+** Drop the contents of pCol; it is read again on next use.
+*/
+static void columnClear(GraphColumn *pCol){
+  columnFreeValues(pCol);
+  sqlite3_free(pCol->aMember);
+  sqlite3_free(pCol->aValid);
+  pCol->aMember = 0;
+  pCol->aValid = 0;
+  pCol->eType = COLUMN_EMPTY;
+  pCol->nSlot = 0;
+  pCol->nAlloc = 0;
+  pCol->iSerial = -1;
+}
+
+static void columnFree(GraphColumn *pCol){
+  columnClear(pCol);
+  sqlite3_finalize(pCol->pRead);
+  sqlite3_free(pCol->zLabel);
+  sqlite3_free(pCol->zProperty);
+  sqlite3_free(pCol);
+}
+
+/*
+** Resize *pp from nOld to nNew elements of szElem bytes, zeroing the
+** new ones.
+*/
+static int columnResize(void **pp, int nOld, int nNew, int szElem){
+  char *pNew = sqlite3_realloc64(*pp, (sqlite3_int64)nNew*szElem);
+  if( pNew==0 ) return SQLITE_NOMEM;
+  memset(&pNew[(sqlite3_int64)nOld*szElem], 0,
+         (size_t)((sqlite3_int64)(nNew-nOld)*szElem));
+  *pp = pNew;
+  return SQLITE_OK;
+}
+
+/*
+** Allocate the value arrays of type eType for the slots of pCol.
+*/
+static int columnAllocValues(GraphColumn *pCol, int eType){
+  int rc = SQLITE_OK;
+  int nWord = COLUMN_WORDS(pCol->nAlloc);
+
+  switch( eType ){
+    case COLUMN_INTEGER:
+      rc = columnResize((void**)&pCol->aInt, 0, pCol->nAlloc,
+                        sizeof(sqlite3_int64));
+      break;
+    case COLUMN_REAL:
+      rc = columnResize((void**)&pCol->aReal, 0, pCol->nAlloc, sizeof(double));
+      if( rc==SQLITE_OK ){
+        rc = columnResize((void**)&pCol->aIsInt, 0, nWord,
+                          sizeof(sqlite3_uint64));
+      }
+      break;
+    case COLUMN_TEXT:
+      rc = columnResize((void**)&pCol->aCode, 0, pCol->nAlloc, sizeof(int));
+      break;
+  }
+  if( rc==SQLITE_OK ) pCol->eType = eType;
+  return rc;
+}
+
+/*
+** Cover at least nSlot dense nodes, new slots empty.
+*/
+static int columnGrow(GraphColumn *pCol, int nSlot){
+  int nOld = pCol->nAlloc;
+  int nNew;
+  int rc = SQLITE_OK;
+
+  if( nSlot>nOld || pCol->aMember==0 ){
+    nNew = nOld*2>nSlot ? nOld*2 : nSlot;
+    nNew = COLUMN_WORDS(nNew>0 ? nNew : 1)*64;
+    rc = columnResize((void**)&pCol->aMember, COLUMN_WORDS(nOld),
+                      COLUMN_WORDS(nNew), sizeof(sqlite3_uint64));
+    if( rc==SQLITE_OK ){
+      rc = columnResize((void**)&pCol->aValid, COLUMN_WORDS(nOld),
+                        COLUMN_WORDS(nNew), sizeof(sqlite3_uint64));
+    }
+    if( rc==SQLITE_OK && pCol->aInt ){
+      rc = columnResize((void**)&pCol->aInt, nOld, nNew, sizeof(sqlite3_int64));
+    }
+    if( rc==SQLITE_OK && pCol->aReal ){
+      rc = columnResize((void**)&pCol->aReal, nOld, nNew, sizeof(double));
+    }
+    if( rc==SQLITE_OK && pCol->aIsInt ){
+      rc = columnResize((void**)&pCol->aIsInt, COLUMN_WORDS(nOld),
+                        COLUMN_WORDS(nNew), sizeof(sqlite3_uint64));
+    }
+    if( rc==SQLITE_OK && pCol->aCode ){
+      rc = columnResize((void**)&pCol->aCode, nOld, nNew, sizeof(int));
+    }
+    /* A failure leaves some arrays longer than nAlloc, which is harmless */
+    if( rc!=SQLITE_OK ) return rc;
+    pCol->nAlloc = nNew;
+  }
+  if( nSlot>pCol->nSlot ) pCol->nSlot = nSlot;
+  return SQLITE_OK;
+}
+
+/*
+** Values of more than one type: stop keeping any.
+*/
+static int columnMixed(GraphColumn *pCol){
+  columnFreeValues(pCol);
+  pCol->eType = COLUMN_MIXED;
+  return SQLITE_OK;
+}
+
+/*
+** Turn an integer column into a real one, for a first non-integer.
+*/
+static int columnToReal(GraphColumn *pCol){
+  sqlite3_int64 *aInt = pCol->aInt;
+  int i, rc;
+
+  for(i=0; i<pCol->nSlot; i++){
+    if( COLUMN_BIT(pCol->aValid, i)
+     && (aInt[i]<-COLUMN_EXACT_INT || aInt[i]>COLUMN_EXACT_INT) ){
+      return columnMixed(pCol);
+    }
+  }
+  rc = columnAllocValues(pCol, COLUMN_REAL);
+  if( rc!=SQLITE_OK ) return rc;
+  for(i=0; i<pCol->nSlot; i++){
+    if( COLUMN_BIT(pCol->aValid, i) ){
+      pCol->aReal[i] = (double)aInt[i];
+      COLUMN_SET(pCol->aIsInt, i);
+    }
+  }
+  sqlite3_free(aInt);
+  pCol->aInt = 0;
+  return SQLITE_OK;
+}
+
+/*
+** Store column iCol of the current row of pStmt, a json_extract()
+** result, as the value of slot i.
+*/
+static int columnStore(GraphColumn *pCol, int i, sqlite3_stmt *pStmt,
+                       int iCol){
+  int eVal = sqlite3_column_type(pStmt, iCol);
+  int rc = SQLITE_OK;
+
+  if( eVal==SQLITE_NULL ){
+    COLUMN_CLR(pCol->aValid, i);
+    return SQLITE_OK;
+  }
+  if( pCol->eType==COLUMN_EMPTY ){
+    rc = columnAllocValues(pCol, eVal==SQLITE_INTEGER ? COLUMN_INTEGER :
+                                 eVal==SQLITE_FLOAT ? COLUMN_REAL :
+                                 eVal==SQLITE_TEXT ? COLUMN_TEXT : COLUMN_MIXED);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  if( eVal==SQLITE_FLOAT && pCol->eType==COLUMN_INTEGER ){
+    rc = columnToReal(pCol);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+
+  switch( pCol->eType ){
+    case COLUMN_INTEGER:
+      if( eVal!=SQLITE_INTEGER ) return columnMixed(pCol);
+      pCol->aInt[i] = sqlite3_column_int64(pStmt, iCol);
+      break;
+    case COLUMN_REAL:
+      if( eVal==SQLITE_INTEGER ){
+        sqlite3_int64 iVal = sqlite3_column_int64(pStmt, iCol);
+        if( iVal<-COLUMN_EXACT_INT || iVal>COLUMN_EXACT_INT ){
+          return columnMixed(pCol);
+        }
+        pCol->aReal[i] = (double)iVal;
+        COLUMN_SET(pCol->aIsInt, i);
+      }else if( eVal==SQLITE_FLOAT ){
+        pCol->aReal[i] = sqlite3_column_double(pStmt, iCol);
+        COLUMN_CLR(pCol->aIsInt, i);
+      }else{
+        return columnMixed(pCol);
+      }
+      break;
+    case COLUMN_TEXT:
+      if( eVal!=SQLITE_TEXT ) return columnMixed(pCol);
+      rc = dictIntern(&pCol->dict, (const char*)sqlite3_column_text(pStmt, iCol),
+                      sqlite3_column_bytes(pStmt, iCol), &pCol->aCode[i]);
+      if( rc!=SQLITE_OK ) return rc;
+      break;
+    default:
+      return SQLITE_OK;
+  }
+  COLUMN_SET(pCol->aValid, i);
+  return SQLITE_OK;
+}
+
+/*
+** The snapshot of pVtab with its overlay, not pinned: valid until the
+** next write or rebuild.
+*/
+static void columnView(GraphVtab *pVtab, CSRView *pView){
+  pView->pCSR = pVtab->pCSR;
+  pView->pDelta = pVtab->pCSRDelta;
+}
+
+static int columnIsCurrent(GraphVtab *pVtab, GraphColumn *pCol){
+  return pCol->iSerial>=0 && pCol->iSerial==pVtab->iCSRSerial
+      && pVtab->pCSR!=0 && graphCSRIsCurrent(pVtab);
+}
+
+/*
+** Read pCol from the node table, against the current snapshot.
+*/
+static int columnBuild(GraphVtab *pVtab, GraphColumn *pCol){
+  sqlite3_stmt *pStmt;
+  CSRGraph *pCSR;
+  CSRView view;
+  char *zMatch = 0;
+  char *zSql;
+  int rc;
+
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  columnView(pVtab, &view);
+  columnClear(pCol);
+  rc = columnGrow(pCol, graphCSRViewNodeCount(&view));
+  if( rc!=SQLITE_OK ) return rc;
+
+  if( pCol->zLabel ){
+    zMatch = graphLabelMatchSql(pVtab, "n.id", pCol->zLabel);
+    if( zMatch==0 ){
+      columnClear(pCol);
+      return SQLITE_NOMEM;
+    }
+  }
+  zSql = sqlite3_mprintf(
+      "SELECT n.id, json_extract(%s, '$.%s') FROM \"%w\" n%s%s",
+      graphPropsExpr(pVtab), pCol->zProperty, pVtab->zNodeTableName,
+      zMatch ? " WHERE " : "", zMatch ? zMatch : "");
+  sqlite3_free(zMatch);
+  if( zSql==0 ){
+    columnClear(pCol);
+    return SQLITE_NOMEM;
+  }
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ){
+    columnClear(pCol);
+    return rc;
+  }
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    int i = graphCSRViewIndexOf(&view, sqlite3_column_int64(pStmt, 0));
+    if( i<0 ) continue;
+    COLUMN_SET(pCol->aMember, i);
+    rc = columnStore(pCol, i, pStmt, 1);
+    if( rc!=SQLITE_OK ) break;
+  }
+  sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_DONE ){
+    columnClear(pCol);
+    return rc;
+  }
+  pCol->iSerial = pVtab->iCSRSerial;
+  return SQLITE_OK;
+}
+
+/*
+** Catalog
+*/
+
+static GraphColumn *columnFind(GraphVtab *pVtab, const char *zLabel,
+                               const char *zProperty){
+  GraphColumn *pCol;
+
+  if( pVtab->pColumns==0 ) return 0;
+  for(pCol=pVtab->pColumns->pFirst; pCol; pCol=pCol->pNext){
+    if( strcmp(pCol->zProperty, zProperty)==0
+     && (zLabel ? pCol->zLabel && strcmp(pCol->zLabel, zLabel)==0
+                : pCol->zLabel==0) ){
+      return pCol;
+    }
+  }
+  return 0;
+}
+
+/*
+** Bring the columns of pVtab in line with %s_columns: add the declared
+** ones it lacks, unbuilt, and free those no longer declared. A graph
+** without the table has no columns.
+*/
+static int columnsLoad(GraphVtab *pVtab){
+  GraphColumns *p = pVtab->pColumns;
+  GraphColumn **pp;
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  int rc = SQLITE_OK;
+
+  if( p==0 ){
+    p = sqlite3_malloc64(sizeof(*p));
+    if( p==0 ) return SQLITE_NOMEM;
+    memset(p, 0, sizeof(*p));
+    pVtab->pColumns = p;
+  }
+  zSql = sqlite3_mprintf("SELECT label, property FROM \"%w_columns\"",
+                         pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  if( sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0)!=SQLITE_OK ){
+    pStmt = 0;
+  }
+  sqlite3_free(zSql);
+
+  for(pp=&p->pFirst; *pp; pp=&(*pp)->pNext) (*pp)->bKeep = 0;
+  while( pStmt && sqlite3_step(pStmt)==SQLITE_ROW ){
+    const char *zLabel = (const char*)sqlite3_column_text(pStmt, 0);
+    const char *zProperty = (const char*)sqlite3_column_text(pStmt, 1);
+    GraphColumn *pCol;
+
+    if( zProperty==0 ) continue;
+    if( zLabel && zLabel[0]==0 ) zLabel = 0;
+    pCol = columnFind(pVtab, zLabel, zProperty);
+    if( pCol==0 ){
+      pCol = sqlite3_malloc64(sizeof(*pCol));
+      if( pCol==0 ){ rc = SQLITE_NOMEM; break; }
+      memset(pCol, 0, sizeof(*pCol));
+      pCol->iSerial = -1;
+      pCol->zProperty = sqlite3_mprintf("%s", zProperty);
+      if( zLabel ) pCol->zLabel = sqlite3_mprintf("%s", zLabel);
+      pCol->pNext = p->pFirst;
+      p->pFirst = pCol;
+      if( pCol->zProperty==0 || (zLabel && pCol->zLabel==0) ){
+        rc = SQLITE_NOMEM;
+        break;
+      }
+    }
+    pCol->bKeep = 1;
+  }
+  sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+
+  for(pp=&p->pFirst; *pp; ){
+    GraphColumn *pCol = *pp;
+    if( pCol->bKeep ){
+      pp = &pCol->pNext;
+    }else{
+      *pp = pCol->pNext;
+      columnFree(pCol);
+    }
+  }
+  return SQLITE_OK;
+}
+
+int graphColumnCreate(GraphVtab *pVtab, const char *zLabel,
+                      const char *zProperty){
+  GraphColumn *pCol;
+  char *zSql;
+  int rc;
+
+  if( zLabel && zLabel[0]==0 ) zLabel = 0;
+  if( !pVtab || !graphIsPropertyName(zProperty)
+   || (zLabel && !graphIsPropertyName(zLabel)) ){
+    return SQLITE_MISUSE;
+  }
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w_columns\"("
+      "label TEXT NOT NULL, property TEXT NOT NULL,"
+      " PRIMARY KEY(label, property)) WITHOUT ROWID;"
+      "INSERT OR IGNORE INTO \"%w_columns\" VALUES(%Q, %Q);",
+      pVtab->zTableName, pVtab->zTableName, zLabel ? zLabel : "", zProperty);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK ) rc = columnsLoad(pVtab);
+  if( rc==SQLITE_OK && (pCol = columnFind(pVtab, zLabel, zProperty))!=0
+   && !columnIsCurrent(pVtab, pCol) ){
+    rc = columnBuild(pVtab, pCol);
+  }
+  return rc;
+}
+
+int graphColumnDrop(GraphVtab *pVtab, const char *zLabel,
+                    const char *zProperty, int *pbDropped){
+  char *zSql;
+  int rc;
+
+  *pbDropped = 0;
+  if( zLabel && zLabel[0]==0 ) zLabel = 0;
+  if( !pVtab || !graphIsPropertyName(zProperty)
+   || (zLabel && !graphIsPropertyName(zLabel)) ){
+    return SQLITE_MISUSE;
+  }
+  zSql = sqlite3_mprintf(
+      "DELETE FROM \"%w_columns\" WHERE label=%Q AND property=%Q",
+      pVtab->zTableName, zLabel ? zLabel : "", zProperty);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK ){
+    *pbDropped = sqlite3_changes(pVtab->pDb)>0;
+  }else if( columnFind(pVtab, zLabel, zProperty)==0 ){
+    rc = SQLITE_OK;            /* No %s_columns table: nothing declared */
+  }
+  if( rc==SQLITE_OK ) rc = columnsLoad(pVtab);
+  return rc;
+}
+
+int graphColumnList(GraphVtab *pVtab, char ***pazColumn, int *pnColumn){
+  GraphColumn *pCol;
+  char **azCol;
+  int nCol = 0;
+  int i = 0;
+  int rc;
+
+  *pazColumn = 0;
+  *pnColumn = 0;
+  rc = columnsLoad(pVtab);
+  if( rc!=SQLITE_OK ) return rc;
+  for(pCol=pVtab->pColumns->pFirst; pCol; pCol=pCol->pNext) nCol++;
+  if( nCol==0 ) return SQLITE_OK;
+  azCol = sqlite3_malloc64((sqlite3_int64)nCol*2*sizeof(char*));
+  if( azCol==0 ) return SQLITE_NOMEM;
+  memset(azCol, 0, (size_t)nCol*2*sizeof(char*));
+  for(pCol=pVtab->pColumns->pFirst; pCol; pCol=pCol->pNext, i+=2){
+    if( pCol->zLabel && (azCol[i] = sqlite3_mprintf("%s", pCol->zLabel))==0 ){
+      rc = SQLITE_NOMEM;
+    }
+    if( (azCol[i+1] = sqlite3_mprintf("%s", pCol->zProperty))==0 ){
+      rc = SQLITE_NOMEM;
+    }
+  }
+  if( rc!=SQLITE_OK ){
+    for(i=0; i<nCol*2; i++) sqlite3_free(azCol[i]);
+    sqlite3_free(azCol);
+    return rc;
+  }
+  *pazColumn = azCol;
+  *pnColumn = nCol;
+  return SQLITE_OK;
+}
+
+static sqlite3_int64 columnCount(const sqlite3_uint64 *a, int nSlot){
+  sqlite3_int64 n = 0;
+  int w;
+  for(w=0; a && w<COLUMN_WORDS(nSlot); w++) n += __builtin_popcountll(a[w]);
+  return n;
+}
+
+static sqlite3_int64 columnBytes(const GraphColumn *pCol){
+  sqlite3_int64 nByte = 0;
+  sqlite3_int64 nWord = COLUMN_WORDS(pCol->nAlloc);
+  int i;
+
+  if( pCol->aMember ) nByte += 2*nWord*8;
+  if( pCol->aIsInt ) nByte += nWord*8;
+  if( pCol->aInt ) nByte += (sqlite3_int64)pCol->nAlloc*8;
+  if( pCol->aReal ) nByte += (sqlite3_int64)pCol->nAlloc*8;
+  if( pCol->aCode ) nByte += (sqlite3_int64)pCol->nAlloc*4;
+  nByte += (sqlite3_int64)pCol->dict.nAlloc*(sizeof(char*)+sizeof(int));
+  nByte += (sqlite3_int64)pCol->dict.nHash*sizeof(int);
+  for(i=0; i<pCol->dict.nStr; i++) nByte += pCol->dict.anStr[i]+1;
+  return nByte;
+}
+
+int graphColumnsDescribe(GraphVtab *pVtab, char **pzJson){
+  static const char *const azType[] = {
+    "empty", "integer", "real", "text", "mixed"
+  };
+  GraphColumn *pCol;
+  sqlite3_str *pStr;
+  int rc;
+
+  *pzJson = 0;
+  rc = columnsLoad(pVtab);
+  if( rc!=SQLITE_OK ) return rc;
+  pStr = sqlite3_str_new(pVtab->pDb);
+  sqlite3_str_appendchar(pStr, 1, '[');
+  for(pCol=pVtab->pColumns->pFirst; pCol; pCol=pCol->pNext){
+    int bCurrent = columnIsCurrent(pVtab, pCol);
+    if( pCol->zLabel ){
+      sqlite3_str_appendf(pStr, "{\"label\":\"%s\",", pCol->zLabel);
+    }else{
+      sqlite3_str_appendall(pStr, "{\"label\":null,");
+    }
+    sqlite3_str_appendf(pStr,
+        "\"property\":\"%s\",\"type\":\"%s\",\"nodes\":%lld,\"values\":%lld,"
+        "\"bytes\":%lld,\"current\":%s}%s",
+        pCol->zProperty, bCurrent ? azType[pCol->eType] : "unbuilt",
+        bCurrent ? columnCount(pCol->aMember, pCol->nSlot) : 0,
+        bCurrent && pCol->eType!=COLUMN_MIXED
+            ? columnCount(pCol->aValid, pCol->nSlot) : 0,
+        columnBytes(pCol), bCurrent ? "true" : "false",
+        pCol->pNext ? "," : "");
+  }
+  sqlite3_str_appendchar(pStr, 1, ']');
+  rc = sqlite3_str_errcode(pStr);
+  *pzJson = sqlite3_str_finish(pStr);
+  if( rc==SQLITE_OK && *pzJson==0 ) rc = SQLITE_NOMEM;
+  return rc;
+}
+
+int graphColumnGet(GraphVtab *pVtab, const char *zLabel,
+                   const char *zProperty, int bBuild, GraphColumn **ppCol){
+  GraphColumn *pCol = columnFind(pVtab, zLabel, zProperty);
+  int rc = SQLITE_OK;
+
+  *ppCol = 0;
+  if( pCol==0 ) return SQLITE_OK;
+  if( !columnIsCurrent(pVtab, pCol) ){
+    if( !bBuild ) return SQLITE_OK;
+    rc = columnBuild(pVtab, pCol);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  if( pCol->eType!=COLUMN_MIXED ) *ppCol = pCol;
+  return SQLITE_OK;
+}
+
+/*
+** Kernels. Each sets aMask[w] to the comparison results of slots
+** w*64 .. w*64+63 against v; slots without a value compare as zero and
+** are masked off by the caller.
+*/
+typedef void (*ColumnIntFunc)(const sqlite3_int64*, int, int, sqlite3_int64,
+                              sqlite3_uint64*);
+typedef void (*ColumnRealFunc)(const double*, int, int, double,
+                               sqlite3_uint64*);
+
+#define COLUMN_CMP_LOOP(OP) \
+  for(w=0; w<nWord; w++){                                   \
+    sqlite3_uint64 m = 0;                                   \
+    for(k=0; k<64; k++){                                    \
+      m |= (sqlite3_uint64)(a[w*64+k] OP v) << k;           \
+    }                                                       \
+    aMask[w] = m;                                           \
+  }
+
+static void columnCmpInt(const sqlite3_int64 *a, int nWord, int eCmp,
+                         sqlite3_int64 v, sqlite3_uint64 *aMask){
+  int w, k;
+  switch( eCmp ){
+    case GRAPH_CMP_EQ: COLUMN_CMP_LOOP(==); break;
+    case GRAPH_CMP_LT: COLUMN_CMP_LOOP(<);  break;
+    case GRAPH_CMP_LE: COLUMN_CMP_LOOP(<=); break;
+    case GRAPH_CMP_GT: COLUMN_CMP_LOOP(>);  break;
+    default:           COLUMN_CMP_LOOP(>=); break;
+  }
+}
+
+static void columnCmpReal(const double *a, int nWord, int eCmp, double v,
+                          sqlite3_uint64 *aMask){
+  int w, k;
+  switch( eCmp ){
+    case GRAPH_CMP_EQ: COLUMN_CMP_LOOP(==); break;
+    case GRAPH_CMP_LT: COLUMN_CMP_LOOP(<);  break;
+    case GRAPH_CMP_LE: COLUMN_CMP_LOOP(<=); break;
+    case GRAPH_CMP_GT: COLUMN_CMP_LOOP(>);  break;
+    default:           COLUMN_CMP_LOOP(>=); break;
+  }
+}
+
+#ifdef GRAPH_COLUMN_AVX2
+/*
+** Four values per compare. AVX2 has only = and > on 64-bit integers:
+** < swaps the operands and <=, >= complement > and <.
+*/
+__attribute__((target("avx2")))
+static void columnCmpIntAvx2(const sqlite3_int64 *a, int nWord, int eCmp,
+                             sqlite3_int64 v, sqlite3_uint64 *aMask){
+  const __m256i vv = _mm256_set1_epi64x(v);
+  int w, k;
+
+  for(w=0; w<nWord; w++){
+    sqlite3_uint64 m = 0;
+    for(k=0; k<64; k+=4){
+      __m256i x = _mm256_loadu_si256((const __m256i*)&a[w*64+k]);
+      __m256i c;
+      switch( eCmp ){
+        case GRAPH_CMP_EQ: c = _mm256_cmpeq_epi64(x, vv); break;
+        case GRAPH_CMP_GT:
+        case GRAPH_CMP_LE: c = _mm256_cmpgt_epi64(x, vv); break;
+        default:           c = _mm256_cmpgt_epi64(vv, x); break;
+      }
+      m |= (sqlite3_uint64)_mm256_movemask_pd(_mm256_castsi256_pd(c)) << k;
+    }
+    aMask[w] = (eCmp==GRAPH_CMP_LE || eCmp==GRAPH_CMP_GE) ? ~m : m;
+  }
+}
+
+__attribute__((target("avx2")))
+static void columnCmpRealAvx2(const double *a, int nWord, int eCmp, double v,
+                              sqlite3_uint64 *aMask){
+  const __m256d vv = _mm256_set1_pd(v);
+  int w, k;
+
+  for(w=0; w<nWord; w++){
+    sqlite3_uint64 m = 0;
+    for(k=0; k<64; k+=4){
+      __m256d x = _mm256_loadu_pd(&a[w*64+k]);
+      __m256d c;
+      switch( eCmp ){
+        case GRAPH_CMP_EQ: c = _mm256_cmp_pd(x, vv, _CMP_EQ_OQ); break;
+        case GRAPH_CMP_LT: c = _mm256_cmp_pd(x, vv, _CMP_LT_OQ); break;
+        case GRAPH_CMP_LE: c = _mm256_cmp_pd(x, vv, _CMP_LE_OQ); break;
+        case GRAPH_CMP_GT: c = _mm256_cmp_pd(x, vv, _CMP_GT_OQ); break;
+        default:           c = _mm256_cmp_pd(x, vv, _CMP_GE_OQ); break;
+      }
+      m |= (sqlite3_uint64)_mm256_movemask_pd(c) << k;
+    }
+    aMask[w] = m;
+  }
+}
+#endif /* GRAPH_COLUMN_AVX2 */
+
+/* Kernels chosen for this CPU, or NULL before the first scan */
+static ColumnIntFunc g_xCmpInt = 0;
+static ColumnRealFunc g_xCmpReal = 0;
+
+static void columnKernelsPick(ColumnIntFunc *pxInt, ColumnRealFunc *pxReal){
+  *pxInt = __atomic_load_n(&g_xCmpInt, __ATOMIC_RELAXED);
+  *pxReal = __atomic_load_n(&g_xCmpReal, __ATOMIC_RELAXED);
+  if( *pxInt && *pxReal ) return;
+  *pxInt = columnCmpInt;
+  *pxReal = columnCmpReal;
+#ifdef GRAPH_COLUMN_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") ){
+    *pxInt = columnCmpIntAvx2;
+    *pxReal = columnCmpRealAvx2;
+  }
+#endif
+  __atomic_store_n(&g_xCmpInt, *pxInt, __ATOMIC_RELAXED);
+  __atomic_store_n(&g_xCmpReal, *pxReal, __ATOMIC_RELAXED);
+}
+
+static int columnHolds(int eCmp, int c){
+  switch( eCmp ){
+    case GRAPH_CMP_EQ: return c==0;
+    case GRAPH_CMP_LT: return c<0;
+    case GRAPH_CMP_LE: return c<=0;
+    case GRAPH_CMP_GT: return c>0;
+    default:           return c>=0;
+  }
+}
+
+/*
+** Text against text, in BINARY collation: the comparison is made once
+** per distinct string, then looked up per slot.
+*/
+static int columnCmpText(const GraphColumn *pCol, int eCmp,
+                         const char *zValue, sqlite3_uint64 *aMask){
+  const ColumnDict *pDict = &pCol->dict;
+  int nValue = (int)strlen(zValue);
+  unsigned char *aHit;
+  int i;
+
+  aHit = sqlite3_malloc64(pDict->nStr>0 ? pDict->nStr : 1);
+  if( aHit==0 ) return SQLITE_NOMEM;
+  for(i=0; i<pDict->nStr; i++){
+    int n = pDict->anStr[i]<nValue ? pDict->anStr[i] : nValue;
+    int c = memcmp(pDict->azStr[i], zValue, n);
+    if( c==0 ) c = pDict->anStr[i] - nValue;
+    aHit[i] = (unsigned char)columnHolds(eCmp, c);
+  }
+  for(i=0; i<pCol->nSlot; i++){
+    if( COLUMN_BIT(pCol->aValid, i) && aHit[pCol->aCode[i]] ){
+      COLUMN_SET(aMask, i);
+    }
+  }
+  sqlite3_free(aHit);
+  return SQLITE_OK;
+}
+
+/*
+** Rewrite "integer eCmp rVal" as "integer *peCmp *piVal". Returns 0 if
+** the comparison holds for no integer, 1 if for all, 2 if it needs the
+** rewritten form.
+*/
+static int columnIntBound(double rVal, int *peCmp, sqlite3_int64 *piVal){
+  int bAbove = *peCmp==GRAPH_CMP_GT || *peCmp==GRAPH_CMP_GE;
+
+  if( rVal>=9223372036854775808.0 ){
+    return *peCmp==GRAPH_CMP_LT || *peCmp==GRAPH_CMP_LE;
+  }
+  if( rVal<-9223372036854775808.0 ) return bAbove;
+  if( rVal==floor(rVal) ){
+    *piVal = (sqlite3_int64)rVal;
+    return 2;
+  }
+  /* Between two integers: x > r is x > floor(r), x < r is x <= floor(r) */
+  if( *peCmp==GRAPH_CMP_EQ ) return 0;
+  *piVal = (sqlite3_int64)floor(rVal);
+  *peCmp = bAbove ? GRAPH_CMP_GT : GRAPH_CMP_LE;
+  return 2;
+}
+
+/*
+** Set the bits of aMask (nWord words, zeroed) for the slots of pCol
+** whose value compares eCmp to literal zValue of type eType as SQLite
+** compares values: NULL with nothing, numbers below text. Returns
+** SQLITE_NOTFOUND if the column cannot answer exactly.
+*/
+static int columnCompare(const GraphColumn *pCol, int eCmp,
+                         const char *zValue, int eType, sqlite3_uint64 *aMask){
+  ColumnIntFunc xInt;
+  ColumnRealFunc xReal;
+  int nWord = COLUMN_WORDS(pCol->nSlot);
+  sqlite3_int64 iVal = 0;
+  double rVal = 0.0;
+  int eLit = graphParseLiteral(zValue, eType, &iVal, &rVal);
+  int eAll = 2;                /* 0: none, 1: all, 2: run a kernel */
+
+  if( eLit==SQLITE_FLOAT && rVal!=rVal ) eLit = SQLITE_NULL;  /* Binds as NULL */
+  if( eLit==SQLITE_NULL || pCol->eType==COLUMN_EMPTY ){
+    eAll = 0;
+  }else if( pCol->eType==COLUMN_TEXT ){
+    if( eLit!=SQLITE_TEXT ){
+      eAll = eCmp==GRAPH_CMP_GT || eCmp==GRAPH_CMP_GE;
+    }else{
+      return columnCmpText(pCol, eCmp, zValue, aMask);
+    }
+  }else if( eLit==SQLITE_TEXT ){
+    eAll = eCmp==GRAPH_CMP_LT || eCmp==GRAPH_CMP_LE;
+  }else if( pCol->eType==COLUMN_INTEGER && eLit==SQLITE_FLOAT ){
+    eAll = columnIntBound(rVal, &eCmp, &iVal);
+  }else if( pCol->eType==COLUMN_REAL && eLit==SQLITE_INTEGER ){
+    if( iVal<-COLUMN_EXACT_INT || iVal>COLUMN_EXACT_INT ) return SQLITE_NOTFOUND;
+    rVal = (double)iVal;
+  }
+
+  if( eAll==1 ){
+    memset(aMask, 0xff, (size_t)nWord*sizeof(sqlite3_uint64));
+  }else if( eAll==2 ){
+    columnKernelsPick(&xInt, &xReal);
+    if( pCol->eType==COLUMN_INTEGER ){
+      xInt(pCol->aInt, nWord, eCmp, iVal, aMask);
+    }else{
+      assert( pCol->eType==COLUMN_REAL );
+      xReal(pCol->aReal, nWord, eCmp, rVal, aMask);
+    }
+  }
+  return SQLITE_OK;
+}
+
+static int columnIdCmp(const void *pA, const void *pB){
+  sqlite3_int64 a = *(const sqlite3_int64*)pA;
+  sqlite3_int64 b = *(const sqlite3_int64*)pB;
+  return a<b ? -1 : a>b;
+}
+
+/*
+** Keep the ids of aId[0..*pnId-1], ascending, that carry zLabel.
+*/
+static int columnNarrow(GraphVtab *pVtab, const char *zLabel,
+                        sqlite3_int64 *aId, int *pnId){
+  sqlite3_stmt *pStmt;
+  int i = 0, n = 0;
+  int rc;
+
+  rc = graphLabelScanPrepare(pVtab, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_text(pStmt, 1, zLabel, -1, SQLITE_STATIC);
+  while( i<*pnId && (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    sqlite3_int64 iId = sqlite3_column_int64(pStmt, 0);
+    while( i<*pnId && aId[i]<iId ) i++;
+    if( i<*pnId && aId[i]==iId ) aId[n++] = aId[i++];
+  }
+  sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_ROW && rc!=SQLITE_DONE && i<*pnId ) return rc;
+  *pnId = n;
+  return SQLITE_OK;
+}
+
+int graphColumnMatch(GraphVtab *pVtab, const char *zLabel,
+                     const char *zProperty, int eCmp, const char *zValue,
+                     int eType, sqlite3_int64 **paId, int *pnId){
+  GraphColumn *pCol = 0;
+  sqlite3_uint64 *aMask;
+  sqlite3_int64 *aId;
+  CSRView view;
+  sqlite3_int64 nId = 0;
+  int bNarrow = 0;
+  int bSorted = 1;
+  int nWord, w, n;
+  int rc = SQLITE_OK;
+
+  *paId = 0;
+  *pnId = 0;
+  if( eCmp<GRAPH_CMP_EQ || eCmp>GRAPH_CMP_GE ) return SQLITE_NOTFOUND;
+  if( zLabel ) rc = graphColumnGet(pVtab, zLabel, zProperty, 1, &pCol);
+  if( rc==SQLITE_OK && pCol==0 ){
+    rc = graphColumnGet(pVtab, 0, zProperty, 1, &pCol);
+    bNarrow = zLabel!=0;
+  }
+  if( rc!=SQLITE_OK ) return rc;
+  if( pCol==0 ) return SQLITE_NOTFOUND;
+
+  nWord = COLUMN_WORDS(pCol->nSlot);
+  aMask = sqlite3_malloc64((sqlite3_int64)(nWord>0 ? nWord : 1)*8);
+  if( aMask==0 ) return SQLITE_NOMEM;
+  memset(aMask, 0, (size_t)nWord*8);
+  rc = columnCompare(pCol, eCmp, zValue, eType, aMask);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(aMask);
+    return rc;
+  }
+  for(w=0; w<nWord; w++){
+    aMask[w] &= pCol->aMember[w] & pCol->aValid[w];
+    nId += __builtin_popcountll(aMask[w]);
+  }
+
+  aId = sqlite3_malloc64((nId>0 ? nId : 1)*sizeof(sqlite3_int64));
+  if( aId==0 ){
+    sqlite3_free(aMask);
+    return SQLITE_NOMEM;
+  }
+  columnView(pVtab, &view);
+  n = 0;
+  for(w=0; w<nWord; w++){
+    sqlite3_uint64 m = aMask[w];
+    while( m ){
+      aId[n] = graphCSRViewNodeId(&view, w*64 + __builtin_ctzll(m));
+      if( n>0 && aId[n]<aId[n-1] ) bSorted = 0;
+      n++;
+      m &= m-1;
+    }
+  }
+  sqlite3_free(aMask);
+  /* Snapshot ids ascend; nodes added since need not follow them */
+  if( !bSorted ) qsort(aId, n, sizeof(sqlite3_int64), columnIdCmp);
+  if( bNarrow ) rc = columnNarrow(pVtab, zLabel, aId, &n);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(aId);
+    return rc;
+  }
+  *paId = aId;
+  *pnId = n;
+  return SQLITE_OK;
+}
+
+int graphColumnRead(GraphVtab *pVtab, GraphColumn *pCol,
+                    sqlite3_int64 iNodeId, sqlite3_int64 *piVal,
+                    double *prVal, const char **pzVal, int *pnVal){
+  CSRView view;
+  int i;
+
+  columnView(pVtab, &view);
+  i = graphCSRViewIndexOf(&view, iNodeId);
+  if( i<0 || i>=pCol->nSlot || !COLUMN_BIT(pCol->aMember, i) ) return 0;
+  if( !COLUMN_BIT(pCol->aValid, i) ) return SQLITE_NULL;
+  switch( pCol->eType ){
+    case COLUMN_INTEGER:
+      *piVal = pCol->aInt[i];
+      return SQLITE_INTEGER;
+    case COLUMN_REAL:
+      if( COLUMN_BIT(pCol->aIsInt, i) ){
+        *piVal = (sqlite3_int64)pCol->aReal[i];
+        return SQLITE_INTEGER;
+      }
+      *prVal = pCol->aReal[i];
+      return SQLITE_FLOAT;
+    case COLUMN_TEXT:
+      *pzVal = pCol->dict.azStr[pCol->aCode[i]];
+      *pnVal = pCol->dict.anStr[pCol->aCode[i]];
+      return SQLITE_TEXT;
+  }
+  return 0;
+}
+
+/*
+** Maintenance
+*/
+
+void graphColumnsTouch(GraphVtab *pVtab, sqlite3_int64 iNodeId, int bDelete){
+  GraphColumns *p = pVtab->pColumns;
+  GraphColumn *pCol;
+  int bAny = 0;
+
+  if( p==0 || !pVtab->bCSRTrack ) return;
+  for(pCol=p->pFirst; pCol; pCol=pCol->pNext){
+    if( pCol->iSerial==pVtab->iCSRSerial ) bAny = 1;
+  }
+  if( !bAny ) return;
+
+  if( bDelete ){
+    /* Reported before the node goes, while it still has an index */
+    CSRView view;
+    int i;
+    columnView(pVtab, &view);
+    i = graphCSRViewIndexOf(&view, iNodeId);
+    for(pCol=p->pFirst; i>=0 && pCol; pCol=pCol->pNext){
+      if( pCol->iSerial==pVtab->iCSRSerial && i<pCol->nSlot ){
+        COLUMN_CLR(pCol->aMember, i);
+        COLUMN_CLR(pCol->aValid, i);
+      }
+    }
+    return;
+  }
+
+  if( p->nTouch>=p->nTouchAlloc ){
+    int nNew = p->nTouchAlloc ? p->nTouchAlloc*2 : 64;
+    sqlite3_int64 *aNew = sqlite3_realloc64(p->aTouch,
+                                            (sqlite3_int64)nNew*sizeof(*aNew));
+    if( aNew==0 ){
+      graphColumnsReset(pVtab);
+      return;
+    }
+    p->aTouch = aNew;
+    p->nTouchAlloc = nNew;
+  }
+  p->aTouch[p->nTouch++] = iNodeId;
+}
+
+/*
+** Read node iNodeId into slot i of pCol again.
+*/
+static int columnReread(GraphVtab *pVtab, GraphColumn *pCol, int i,
+                        sqlite3_int64 iNodeId){
+  int rc;
+
+  if( pCol->pRead==0 ){
+    char *zMatch = 0;
+    char *zSql;
+    if( pCol->zLabel ){
+      zMatch = graphLabelMatchSql(pVtab, "n.id", pCol->zLabel);
+      if( zMatch==0 ) return SQLITE_NOMEM;
+    }
+    zSql = sqlite3_mprintf(
+        "SELECT json_extract(%s, '$.%s')%s%s FROM \"%w\" n WHERE n.id=?1",
+        graphPropsExpr(pVtab), pCol->zProperty,
+        zMatch ? ", " : "", zMatch ? zMatch : "", pVtab->zNodeTableName);
+    sqlite3_free(zMatch);
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pCol->pRead, 0);
+    sqlite3_free(zSql);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  sqlite3_bind_int64(pCol->pRead, 1, iNodeId);
+  rc = sqlite3_step(pCol->pRead);
+  if( rc==SQLITE_ROW
+   && (pCol->zLabel==0 || sqlite3_column_int(pCol->pRead, 1)) ){
+    COLUMN_SET(pCol->aMember, i);
+    rc = columnStore(pCol, i, pCol->pRead, 0);
+  }else if( rc==SQLITE_ROW || rc==SQLITE_DONE ){
+    COLUMN_CLR(pCol->aMember, i);
+    COLUMN_CLR(pCol->aValid, i);
+    rc = SQLITE_OK;
+  }
+  sqlite3_reset(pCol->pRead);
+  return rc;
+}
+
+void graphColumnsSync(GraphVtab *pVtab){
+  GraphColumns *p = pVtab->pColumns;
+  GraphColumn *pCol;
+  CSRView view;
+  int nNode, k;
+
+  if( p==0 || p->nTouch==0 ) return;
+  columnView(pVtab, &view);
+  nNode = graphCSRViewNodeCount(&view);
+  for(pCol=p->pFirst; pCol; pCol=pCol->pNext){
+    int rc = SQLITE_OK;
+    if( pCol->iSerial!=pVtab->iCSRSerial ) continue;
+    /* Past a quarter of the nodes, reading the column again is cheaper */
+    if( (sqlite3_int64)p->nTouch*4>nNode ){
+      columnClear(pCol);
+      continue;
+    }
+    rc = columnGrow(pCol, nNode);
+    for(k=0; rc==SQLITE_OK && k<p->nTouch; k++){
+      int i = graphCSRViewIndexOf(&view, p->aTouch[k]);
+      if( i>=0 ) rc = columnReread(pVtab, pCol, i, p->aTouch[k]);
+    }
+    if( rc!=SQLITE_OK ) columnClear(pCol);
+  }
+  p->nTouch = 0;
+}
+
+/*
+** Rebuild pCol over view pTo from its contents over pFrom.
+*/
+static int columnRemap(GraphColumn *pCol, const CSRView *pFrom,
+                       const CSRView *pTo){
+  GraphColumn tmp;
+  int nTo = graphCSRViewNodeCount(pTo);
+  int j, rc;
+
+  memset(&tmp, 0, sizeof(tmp));
+  rc = columnGrow(&tmp, nTo);
+  if( rc==SQLITE_OK && pCol->eType!=COLUMN_MIXED ){
+    rc = columnAllocValues(&tmp, pCol->eType);
+  }
+  if( rc!=SQLITE_OK ){
+    columnClear(&tmp);
+    return rc;
+  }
+  for(j=0; j<nTo; j++){
+    int i = graphCSRViewIndexOf(pFrom, graphCSRViewNodeId(pTo, j));
+    if( i<0 || i>=pCol->nSlot || !COLUMN_BIT(pCol->aMember, i) ) continue;
+    COLUMN_SET(tmp.aMember, j);
+    if( !COLUMN_BIT(pCol->aValid, i) ) continue;
+    COLUMN_SET(tmp.aValid, j);
+    switch( pCol->eType ){
+      case COLUMN_INTEGER: tmp.aInt[j] = pCol->aInt[i]; break;
+      case COLUMN_REAL:
+        tmp.aReal[j] = pCol->aReal[i];
+        if( COLUMN_BIT(pCol->aIsInt, i) ) COLUMN_SET(tmp.aIsInt, j);
+        break;
+      case COLUMN_TEXT: tmp.aCode[j] = pCol->aCode[i]; break;
+    }
+  }
+
+  /* The dictionary stays; everything indexed by slot is replaced */
+  sqlite3_free(pCol->aMember);
+  sqlite3_free(pCol->aValid);
+  sqlite3_free(pCol->aIsInt);
+  sqlite3_free(pCol->aInt);
+  sqlite3_free(pCol->aReal);
+  sqlite3_free(pCol->aCode);
+  pCol->aMember = tmp.aMember;
+  pCol->aValid = tmp.aValid;
+  pCol->aIsInt = tmp.aIsInt;
+  pCol->aInt = tmp.aInt;
+  pCol->aReal = tmp.aReal;
+  pCol->aCode = tmp.aCode;
+  pCol->nSlot = tmp.nSlot;
+  pCol->nAlloc = tmp.nAlloc;
+  return SQLITE_OK;
+}
+
+void graphColumnsRemap(GraphVtab *pVtab, const CSRView *pFrom,
+                       const CSRView *pTo){
+  GraphColumn *pCol;
+
+  if( pVtab->pColumns==0 ) return;
+  for(pCol=pVtab->pColumns->pFirst; pCol; pCol=pCol->pNext){
+    if( pCol->iSerial!=pVtab->iCSRSerial-1 ) continue;
+    if( columnRemap(pCol, pFrom, pTo)==SQLITE_OK ){
+      pCol->iSerial = pVtab->iCSRSerial;
+    }else{
+      columnClear(pCol);
+    }
+  }
+}
+
+void graphColumnsReset(GraphVtab *pVtab){
+  GraphColumn *pCol;
+
+  if( pVtab->pColumns==0 ) return;
+  for(pCol=pVtab->pColumns->pFirst; pCol; pCol=pCol->pNext){
+    columnClear(pCol);
+  }
+  pVtab->pColumns->nTouch = 0;
+}
+
+int graphColumnsDropTable(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  zSql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w_columns\"",
+                         pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+void graphColumnsFree(GraphVtab *pVtab){
+  GraphColumns *p = pVtab->pColumns;
+
+  if( p==0 ) return;
+  while( p->pFirst ){
+    GraphColumn *pCol = p->pFirst;
+    p->pFirst = pCol->pNext;
+    columnFree(pCol);
+  }
+  sqlite3_free(p->aTouch);
+  sqlite3_free(p);
+  pVtab->pColumns = 0;
+}
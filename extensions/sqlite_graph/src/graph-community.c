@@ -0,0 +1,1231 @@
+/*
+** SQLite Graph Database Extension - Community Detection
+**
+** This file implements label propagation and Louvain modularity
+** optimisation over the CSR snapshot. Both treat the graph as
+** undirected (out-edges and in-edges together) and both run their
+** per-node sweeps in parallel over node ranges on the task scheduler.
+** Every parallel sweep reads only state left by the step before it and
+** writes range-private slots, and whatever is then applied is applied
+** in index order, so results are the same for any thread count.
+**
+** A community is reported under the smallest node id among its members.
+**
+** Memory allocation: sqlite3_malloc64()/sqlite3_free(); the caller owns
+** the returned arrays.
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-performance.h"
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* Louvain local-moving passes per level and coarsening levels */
+#define LOUVAIN_MAX_PASSES 64
+#define LOUVAIN_MAX_LEVELS 32
+
+/* Vertex classes a Louvain pass sweeps one after another */
+#define LOUVAIN_CLASSES 32
+
+/* Smallest modularity gain treated as an improvement */
+#define LOUVAIN_EPSILON 1e-12
+
+/* Times a round's moves are halved before it counts as idle */
+#define LOUVAIN_MAX_HALVINGS 16
+
+/*
+** Undirected weighted adjacency. At level 0 it is the CSR out-edges and
+** in-edges of each node laid side by side; coarser Louvain levels have
+** one vertex per community of the level below, with internal weight
+** kept as a self-loop.
+*/
+typedef struct CommGraph CommGraph;
+struct CommGraph {
+  int nNode;
+  sqlite3_int64 *aOff;        /* Adjacency offsets, nNode+1 entries */
+  int *aAdj;                  /* Neighbour per adjacency slot */
+  double *aW;                 /* Weight per slot, 0 when unweighted */
+  double *aK;                 /* Weighted degree, 0 when unweighted */
+  double rTotal;              /* Sum of aK[], i.e. twice the edge weight */
+  int nMaxDeg;                /* Largest adjacency list */
+};
+
+/*
+** (community, weight) pair gathered from a node's neighbourhood.
+*/
+typedef struct CommPair CommPair;
+struct CommPair {
+  int iComm;
+  double rWeight;
+};
+
+static void commGraphFree(CommGraph *pG){
+  sqlite3_free(pG->aOff);
+  sqlite3_free(pG->aAdj);
+  sqlite3_free(pG->aW);
+  sqlite3_free(pG->aK);
+  memset(pG, 0, sizeof(*pG));
+}
+
+/*
+** Build the level-0 undirected view of pCSR. A node's slots are its
+** out-edges followed by its in-edges, so both CSR offset arrays simply
+** add up. With bWeighted the edge weights and degrees are filled in too.
+*/
+static int commGraphFromCSR(const CSRGraph *pCSR, int bWeighted,
+                            CommGraph *pG){
+  sqlite3_int64 nSlot = pCSR->nEdges*2;
+  int n = pCSR->nNodes;
+  int i;
+
+  memset(pG, 0, sizeof(*pG));
+  pG->nNode = n;
+  pG->aOff = sqlite3_malloc64(sizeof(sqlite3_int64)*(n+1));
+  pG->aAdj = sqlite3_malloc64(sizeof(int)*(nSlot ? nSlot : 1));
+  if( bWeighted ){
+    pG->aW = sqlite3_malloc64(sizeof(double)*(nSlot ? nSlot : 1));
+    pG->aK = sqlite3_malloc64(sizeof(double)*n);
+  }
+  if( !pG->aOff || !pG->aAdj || (bWeighted && (!pG->aW || !pG->aK)) ){
+    commGraphFree(pG);
+    return SQLITE_NOMEM;
+  }
+
+  for( i=0; i<=n; i++ ){
+    pG->aOff[i] = pCSR->rowOffsets[i] + pCSR->inOffsets[i];
+  }
+  for( i=0; i<n; i++ ){
+    sqlite3_int64 iOut = pCSR->rowOffsets[i];
+    sqlite3_int64 nOut = pCSR->rowOffsets[i+1] - iOut;
+    sqlite3_int64 iIn = pCSR->inOffsets[i];
+    sqlite3_int64 nIn = pCSR->inOffsets[i+1] - iIn;
+    sqlite3_int64 iSlot = pG->aOff[i];
+
+    memcpy(&pG->aAdj[iSlot], &pCSR->columnIndices[iOut], sizeof(int)*nOut);
+    memcpy(&pG->aAdj[iSlot+nOut], &pCSR->inIndices[iIn], sizeof(int)*nIn);
+    if( nOut+nIn > pG->nMaxDeg ) pG->nMaxDeg = (int)(nOut+nIn);
+    if( bWeighted ){
+      sqlite3_int64 j;
+      double rK = 0.0;
+      memcpy(&pG->aW[iSlot], &pCSR->edgeWeights[iOut], sizeof(double)*nOut);
+      memcpy(&pG->aW[iSlot+nOut], &pCSR->inWeights[iIn], sizeof(double)*nIn);
+      for( j=iSlot; j<pG->aOff[i+1]; j++ ) rK += pG->aW[j];
+      pG->aK[i] = rK;
+      pG->rTotal += rK;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Split the nodes of pG into nTask ranges of about the same number of
+** nodes plus adjacency slots. aFirst[] gets nTask+1 boundaries.
+*/
+static void commSplitRanges(const CommGraph *pG, int nTask, int *aFirst){
+  sqlite3_int64 nWork = (sqlite3_int64)pG->nNode + pG->aOff[pG->nNode];
+  int iNode = 0;
+  int i;
+  for( i=0; i<nTask; i++ ){
+    sqlite3_int64 nTarget = nWork * (i+1) / nTask;
+    aFirst[i] = iNode;
+    while( iNode<pG->nNode && (iNode + pG->aOff[iNode])<nTarget ) iNode++;
+  }
+  aFirst[nTask] = pG->nNode;
+}
+
+/*
+** Start the scheduler for nThreads and pick the task count: a few
+** ranges per thread, but never more ranges than nodes.
+*/
+static int commStartTasks(int nThreads, int nNode,
+                          TaskScheduler **ppScheduler, int *pnTask){
+  *ppScheduler = 0;
+  *pnTask = 1;
+  if( nThreads!=1 ){
+    *ppScheduler = graphCreateTaskScheduler(nThreads);
+    if( *ppScheduler==0 ) return SQLITE_NOMEM;
+    *pnTask = (*ppScheduler)->nThreads * 4;
+    if( *pnTask>nNode ) *pnTask = nNode;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Deterministic stand-in for a coin flip: a mix of a node index and two
+** small integers, so different nodes and rounds decide differently
+** without any shared random state.
+*/
+static unsigned int commHash(int iNode, int iA, int iB){
+  unsigned int h = (unsigned int)iNode*0x9E3779B1u;
+  h ^= (unsigned int)iA*0x85EBCA77u + (unsigned int)iB*0xC2B2AE3Du;
+  h ^= h>>15;
+  h *= 0x2C1B3C6Du;
+  h ^= h>>12;
+  return h;
+}
+
+static int commIntCompare(const void *pA, const void *pB){
+  int a = *(const int*)pA;
+  int b = *(const int*)pB;
+  return (a>b) - (a<b);
+}
+
+static int commPairCompare(const void *pA, const void *pB){
+  int a = ((const CommPair*)pA)->iComm;
+  int b = ((const CommPair*)pB)->iComm;
+  return (a>b) - (a<b);
+}
+
+/*
+** Hand the result to the caller: copy the node ids and name each
+** dense community label aLabel[i] after its smallest member id. Node
+** ids ascend with the dense index, so the first member seen is it.
+*/
+static int commEmit(const CSRGraph *pCSR, const int *aLabel,
+                    sqlite3_int64 **paNode, sqlite3_int64 **paCommunity,
+                    int *pnNode){
+  int n = pCSR->nNodes;
+  sqlite3_int64 *aNode = sqlite3_malloc64(sizeof(sqlite3_int64)*n);
+  sqlite3_int64 *aComm = sqlite3_malloc64(sizeof(sqlite3_int64)*n);
+  int *aFirst = sqlite3_malloc64(sizeof(int)*n);
+  int i;
+
+  if( !aNode || !aComm || !aFirst ){
+    sqlite3_free(aNode);
+    sqlite3_free(aComm);
+    sqlite3_free(aFirst);
+    return SQLITE_NOMEM;
+  }
+  memset(aFirst, 0xff, sizeof(int)*n);
+  for( i=0; i<n; i++ ){
+    if( aFirst[aLabel[i]]<0 ) aFirst[aLabel[i]] = i;
+    aNode[i] = pCSR->aNodeIds[i];
+    aComm[i] = pCSR->aNodeIds[aFirst[aLabel[i]]];
+  }
+  sqlite3_free(aFirst);
+  *paNode = aNode;
+  *paCommunity = aComm;
+  *pnNode = n;
+  return SQLITE_OK;
+}
+
+/*
+** One label propagation work unit: the dense node range [iFirst, iLast).
+*/
+typedef struct LabelPropTask LabelPropTask;
+struct LabelPropTask {
+  const CommGraph *pG;
+  const int *aLabel;          /* Labels from the previous round */
+  int *aNext;                 /* Labels for this round (range-private) */
+  int *aScratch;              /* nMaxDeg labels */
+  int iFirst, iLast;
+  int iRound;                 /* Round number, for tie-breaking */
+  int nChanged;               /* Out: nodes whose label changed */
+};
+
+/*
+** Each node takes the label most common among its neighbours. A node
+** whose own label is among the most common keeps it; otherwise ties go
+** by commHash(). Always picking the smallest label instead would
+** flood every component with a single label in the first rounds, when
+** all counts are 1. Isolated nodes keep their label.
+*/
+static void labelPropWorker(void *pArg){
+  LabelPropTask *p = (LabelPropTask*)pArg;
+  const CommGraph *pG = p->pG;
+  int *aScratch = p->aScratch;
+  int i;
+
+  p->nChanged = 0;
+  for( i=p->iFirst; i<p->iLast; i++ ){
+    sqlite3_int64 iSlot;
+    int iOwn = p->aLabel[i];
+    int nLabel = 0;
+    int iBest = iOwn;
+    int nBest = 0;
+    unsigned int iBestKey = 0;
+    int j;
+
+    for( iSlot=pG->aOff[i]; iSlot<pG->aOff[i+1]; iSlot++ ){
+      aScratch[nLabel++] = p->aLabel[pG->aAdj[iSlot]];
+    }
+    qsort(aScratch, nLabel, sizeof(int), commIntCompare);
+
+    for( j=0; j<nLabel; ){
+      int iLabel = aScratch[j];
+      int k = j;
+      while( k<nLabel && aScratch[k]==iLabel ) k++;
+      if( k-j>nBest ){
+        nBest = k-j;
+        iBest = iLabel;
+        iBestKey = commHash(i, iLabel, p->iRound);
+      }else if( k-j==nBest && iBest!=iOwn ){
+        unsigned int iKey = commHash(i, iLabel, p->iRound);
+        if( iLabel==iOwn || iKey<iBestKey ){
+          iBest = iLabel;
+          iBestKey = iKey;
+        }
+      }
+      j = k;
+    }
+    p->aNext[i] = iBest;
+    if( iBest!=iOwn ) p->nChanged++;
+  }
+}
+
+/*
+** Label propagation (Raghavan et al.) on the undirected, unweighted
+** view of the graph. Every node starts in its own community; rounds
+** run until no label changes or nMaxIter rounds have passed.
+** Parallelism: Nodes are split into ranges of similar degree volume
+**              and labels are double-buffered, so each round is
+**              deterministic regardless of nThreads.
+*/
+int graphLabelPropagationCSR(const CSRGraph *pCSR, int nMaxIter,
+                             int nThreads, sqlite3_int64 **paNode,
+                             sqlite3_int64 **paCommunity, int *pnNode){
+  CommGraph g;
+  TaskScheduler *pScheduler = 0;
+  LabelPropTask *aTask = 0;
+  void **apTask = 0;
+  int *aFirst = 0;
+  int *aLabel = 0;
+  int *aNext = 0;
+  int nTask = 1;
+  int nIter;
+  int i, n;
+  int rc;
+
+  *paNode = 0;
+  *paCommunity = 0;
+  *pnNode = 0;
+  memset(&g, 0, sizeof(g));
+
+  n = pCSR->nNodes;
+  if( n==0 ) return SQLITE_OK;
+
+  rc = commGraphFromCSR(pCSR, 0, &g);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = commStartTasks(nThreads, n, &pScheduler, &nTask);
+  if( rc!=SQLITE_OK ) goto lp_cleanup;
+
+  aTask = sqlite3_malloc64(sizeof(LabelPropTask)*nTask);
+  apTask = sqlite3_malloc64(sizeof(void*)*nTask);
+  aFirst = sqlite3_malloc64(sizeof(int)*(nTask+1));
+  aLabel = sqlite3_malloc64(sizeof(int)*n);
+  aNext = sqlite3_malloc64(sizeof(int)*n);
+  if( !aTask || !apTask || !aFirst || !aLabel || !aNext ){
+    rc = SQLITE_NOMEM;
+    goto lp_cleanup;
+  }
+  memset(aTask, 0, sizeof(LabelPropTask)*nTask);
+
+  commSplitRanges(&g, nTask, aFirst);
+  for( i=0; i<nTask; i++ ){
+    aTask[i].pG = &g;
+    aTask[i].iFirst = aFirst[i];
+    aTask[i].iLast = aFirst[i+1];
+    aTask[i].aScratch = sqlite3_malloc64(sizeof(int)*(g.nMaxDeg+1));
+    if( aTask[i].aScratch==0 ){
+      rc = SQLITE_NOMEM;
+      goto lp_cleanup;
+    }
+    apTask[i] = &aTask[i];
+  }
+  for( i=0; i<n; i++ ) aLabel[i] = i;
+
+  for( nIter=0; nIter<nMaxIter; nIter++ ){
+    int nChanged = 0;
+    int *aSwap;
+    for( i=0; i<nTask; i++ ){
+      aTask[i].aLabel = aLabel;
+      aTask[i].aNext = aNext;
+      aTask[i].iRound = nIter;
+    }
+    rc = graphRunTasks(pScheduler, labelPropWorker, apTask, nTask);
+    if( rc!=SQLITE_OK ) goto lp_cleanup;
+    for( i=0; i<nTask; i++ ) nChanged += aTask[i].nChanged;
+    aSwap = aLabel;
+    aLabel = aNext;
+    aNext = aSwap;
+    if( nChanged==0 ) break;
+  }
+
+  rc = commEmit(pCSR, aLabel, paNode, paCommunity, pnNode);
+
+lp_cleanup:
+  if( aTask ){
+    for( i=0; i<nTask; i++ ) sqlite3_free(aTask[i].aScratch);
+  }
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
+  sqlite3_free(aFirst);
+  sqlite3_free(aLabel);
+  sqlite3_free(aNext);
+  graphDestroyTaskScheduler(pScheduler);
+  commGraphFree(&g);
+  return rc;
+}
+
+int graphLabelPropagation(GraphVtab *pVtab, int nMaxIter, int nThreads,
+                          sqlite3_int64 **paNode,
+                          sqlite3_int64 **paCommunity, int *pnNode){
+  CSRGraph *pCSR = 0;
+  int rc;
+
+  *paNode = 0;
+  *paCommunity = 0;
+  *pnNode = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  return graphLabelPropagationCSR(pCSR, nMaxIter, nThreads, paNode,
+                                  paCommunity, pnNode);
+}
+
+/*
+** One Louvain local-moving work unit: the entries [iFirst, iLast) of
+** aVertex, which lists the vertices of the class being swept.
+*/
+typedef struct LouvainTask LouvainTask;
+struct LouvainTask {
+  const CommGraph *pG;
+  const int *aVertex;         /* Vertices of the current class */
+  const int *aComm;           /* Community per vertex at sweep start */
+  const double *aTot;         /* Total degree per community */
+  int *aBest;                 /* Out: preferred community (range-private) */
+  CommPair *aScratch;         /* nMaxDeg pairs */
+  double rResolution;
+  int iFirst, iLast;
+};
+
+/*
+** Pick the community each vertex would gain most modularity by joining,
+** given everyone else stays put. With k_i the vertex degree, k_i,c its
+** edge weight into community c and tot_c the community's total degree
+** (without i), the gain is proportional to k_i,c - gamma*tot_c*k_i/2m.
+** Staying wins ties; among other communities the smallest index does.
+*/
+static void louvainWorker(void *pArg){
+  LouvainTask *p = (LouvainTask*)pArg;
+  const CommGraph *pG = p->pG;
+  CommPair *aScratch = p->aScratch;
+  double rScale = p->rResolution / pG->rTotal;
+  int k;
+
+  for( k=p->iFirst; k<p->iLast; k++ ){
+    int i = p->aVertex[k];
+    int iOld = p->aComm[i];
+    double rK = pG->aK[i];
+    double rBestGain, rOldIn = 0.0;
+    int iBest = iOld;
+    int nPair = 0;
+    sqlite3_int64 iSlot;
+    int j;
+
+    for( iSlot=pG->aOff[i]; iSlot<pG->aOff[i+1]; iSlot++ ){
+      int iNbr = pG->aAdj[iSlot];
+      if( iNbr==i ) continue;
+      aScratch[nPair].iComm = p->aComm[iNbr];
+      aScratch[nPair].rWeight = pG->aW[iSlot];
+      nPair++;
+    }
+    qsort(aScratch, nPair, sizeof(CommPair), commPairCompare);
+
+    for( j=0; j<nPair && aScratch[j].iComm<=iOld; j++ ){
+      if( aScratch[j].iComm==iOld ) rOldIn += aScratch[j].rWeight;
+    }
+    rBestGain = rOldIn - (p->aTot[iOld] - rK)*rK*rScale;
+
+    for( j=0; j<nPair; ){
+      int iComm = aScratch[j].iComm;
+      double rIn = 0.0;
+      while( j<nPair && aScratch[j].iComm==iComm ){
+        rIn += aScratch[j].rWeight;
+        j++;
+      }
+      if( iComm!=iOld ){
+        double rGain = rIn - p->aTot[iComm]*rK*rScale;
+        if( rGain > rBestGain + LOUVAIN_EPSILON ){
+          rBestGain = rGain;
+          iBest = iComm;
+        }
+      }
+    }
+    p->aBest[i] = iBest;
+  }
+}
+
+/*
+** Modularity bookkeeping for one level: rIn is the weight of adjacency
+** slots inside a community and rTot2 the sum of squared community
+** totals, so Q = rIn/2m - gamma*rTot2/(2m)^2.
+*/
+typedef struct LouvainQ LouvainQ;
+struct LouvainQ {
+  double rIn;
+  double rTot2;
+};
+
+static double louvainModularity(const CommGraph *pG, const LouvainQ *pQ,
+                                double rResolution){
+  return pQ->rIn/pG->rTotal
+       - rResolution*pQ->rTot2/(pG->rTotal*pG->rTotal);
+}
+
+/*
+** Apply the preferred moves of the vertices aVertex[0..nVertex-1] whose
+** commHash() bits under mask are clear, updating aComm, aTot and *pQ.
+** aPrev[] must be -1 for every vertex on entry; movers get their old
+** community there. Returns the number of vertices moved.
+*/
+static int louvainApply(const CommGraph *pG, const int *aVertex,
+                        int nVertex, const int *aBest, unsigned int mask,
+                        int iSeed, int *aComm, double *aTot, int *aPrev,
+                        LouvainQ *pQ){
+  int nMoved = 0;
+  int k;
+
+  for( k=0; k<nVertex; k++ ){
+    int i = aVertex[k];
+    int iOld = aComm[i];
+    int iNew = aBest[i];
+    double rK = pG->aK[i];
+    if( iNew==iOld || (commHash(i, iSeed, (int)mask) & mask)!=0 ) continue;
+    pQ->rTot2 += (aTot[iOld]-rK)*(aTot[iOld]-rK) - aTot[iOld]*aTot[iOld];
+    pQ->rTot2 += (aTot[iNew]+rK)*(aTot[iNew]+rK) - aTot[iNew]*aTot[iNew];
+    aTot[iOld] -= rK;
+    aTot[iNew] += rK;
+    aComm[i] = iNew;
+    aPrev[i] = iOld;
+    nMoved++;
+  }
+
+  /* Internal weight changes only on slots touching a mover. A slot to a
+  ** vertex that stayed stands for its mirror image too, so counts twice */
+  for( k=0; k<nVertex; k++ ){
+    int i = aVertex[k];
+    sqlite3_int64 iSlot;
+    if( aPrev[i]<0 ) continue;
+    for( iSlot=pG->aOff[i]; iSlot<pG->aOff[i+1]; iSlot++ ){
+      int j = pG->aAdj[iSlot];
+      int jOld = aPrev[j]>=0 ? aPrev[j] : aComm[j];
+      int d = (aComm[j]==aComm[i]) - (jOld==aPrev[i]);
+      if( d ) pQ->rIn += d * pG->aW[iSlot] * (aPrev[j]>=0 ? 1 : 2);
+    }
+  }
+  return nMoved;
+}
+
+/*
+** Undo louvainApply() for aVertex[0..nVertex-1] and clear aPrev[].
+** The caller restores the LouvainQ it saved.
+*/
+static void louvainRevert(const CommGraph *pG, const int *aVertex,
+                          int nVertex, int *aComm, double *aTot, int *aPrev){
+  int k;
+  for( k=0; k<nVertex; k++ ){
+    int i = aVertex[k];
+    if( aPrev[i]<0 ) continue;
+    aTot[aComm[i]] -= pG->aK[i];
+    aTot[aPrev[i]] += pG->aK[i];
+    aComm[i] = aPrev[i];
+    aPrev[i] = -1;
+  }
+}
+
+/*
+** Collapse pG into pOut, one vertex per community of aComm (dense,
+** 0..nComm-1). Parallel slots between two communities merge into one,
+** and edges inside a community become a self-loop on its vertex.
+*/
+static int louvainAggregate(const CommGraph *pG, const int *aComm,
+                            int nComm, CommGraph *pOut){
+  int *aStart = 0;            /* Members of community c: aMember[aStart[c]..] */
+  int *aMember = 0;
+  CommPair *aPair = 0;
+  sqlite3_int64 nSlot = 0;
+  int i, c;
+  int rc = SQLITE_OK;
+
+  memset(pOut, 0, sizeof(*pOut));
+  pOut->nNode = nComm;
+  pOut->rTotal = pG->rTotal;
+  aStart = sqlite3_malloc64(sizeof(int)*(nComm+1));
+  aMember = sqlite3_malloc64(sizeof(int)*pG->nNode);
+  aPair = sqlite3_malloc64(sizeof(CommPair)*(pG->aOff[pG->nNode]+1));
+  pOut->aOff = sqlite3_malloc64(sizeof(sqlite3_int64)*(nComm+1));
+  pOut->aK = sqlite3_malloc64(sizeof(double)*nComm);
+  if( !aStart || !aMember || !aPair || !pOut->aOff || !pOut->aK ){
+    rc = SQLITE_NOMEM;
+    goto aggregate_cleanup;
+  }
+
+  /* Counting sort of the vertices by community */
+  memset(aStart, 0, sizeof(int)*(nComm+1));
+  for( i=0; i<pG->nNode; i++ ) aStart[aComm[i]+1]++;
+  for( c=0; c<nComm; c++ ) aStart[c+1] += aStart[c];
+  for( i=0; i<pG->nNode; i++ ) aMember[aStart[aComm[i]]++] = i;
+  for( c=nComm; c>0; c-- ) aStart[c] = aStart[c-1];
+  aStart[0] = 0;
+
+  /* Merged adjacency, written into aPair as it shrinks in place */
+  for( c=0; c<nComm; c++ ){
+    sqlite3_int64 iBegin = nSlot;
+    sqlite3_int64 iEnd = nSlot;
+    sqlite3_int64 j;
+    double rK = 0.0;
+    for( i=aStart[c]; i<aStart[c+1]; i++ ){
+      int iNode = aMember[i];
+      sqlite3_int64 iSlot;
+      for( iSlot=pG->aOff[iNode]; iSlot<pG->aOff[iNode+1]; iSlot++ ){
+        aPair[iEnd].iComm = aComm[pG->aAdj[iSlot]];
+        aPair[iEnd].rWeight = pG->aW[iSlot];
+        iEnd++;
+      }
+      rK += pG->aK[iNode];
+    }
+    qsort(&aPair[iBegin], iEnd-iBegin, sizeof(CommPair), commPairCompare);
+    for( j=iBegin; j<iEnd; j++ ){
+      if( nSlot>iBegin && aPair[nSlot-1].iComm==aPair[j].iComm ){
+        aPair[nSlot-1].rWeight += aPair[j].rWeight;
+      }else{
+        aPair[nSlot++] = aPair[j];
+      }
+    }
+    pOut->aOff[c] = iBegin;
+    pOut->aK[c] = rK;
+    if( nSlot-iBegin > pOut->nMaxDeg ) pOut->nMaxDeg = (int)(nSlot-iBegin);
+  }
+  pOut->aOff[nComm] = nSlot;
+
+  pOut->aAdj = sqlite3_malloc64(sizeof(int)*(nSlot ? nSlot : 1));
+  pOut->aW = sqlite3_malloc64(sizeof(double)*(nSlot ? nSlot : 1));
+  if( !pOut->aAdj || !pOut->aW ){
+    rc = SQLITE_NOMEM;
+    goto aggregate_cleanup;
+  }
+  for( i=0; i<nSlot; i++ ){
+    pOut->aAdj[i] = aPair[i].iComm;
+    pOut->aW[i] = aPair[i].rWeight;
+  }
+
+aggregate_cleanup:
+  if( rc!=SQLITE_OK ) commGraphFree(pOut);
+  sqlite3_free(aStart);
+  sqlite3_free(aMember);
+  sqlite3_free(aPair);
+  return rc;
+}
+
+/*
+** Renumber aComm[] densely in order of first appearance and return the
+** number of communities. aMap is nNode scratch entries.
+*/
+static int louvainRenumber(int *aComm, int nNode, int *aMap){
+  int nComm = 0;
+  int i;
+  memset(aMap, 0xff, sizeof(int)*nNode);
+  for( i=0; i<nNode; i++ ){
+    if( aMap[aComm[i]]<0 ) aMap[aComm[i]] = nComm++;
+    aComm[i] = aMap[aComm[i]];
+  }
+  return nComm;
+}
+
+/*
+** Louvain modularity optimisation (Blondel et al.) on the undirected,
+** weighted view of the graph. Each level moves vertices between
+** communities until no move helps, then collapses every community into
+** one vertex and repeats on the smaller graph; it stops once a level
+** merges nothing. rResolution is the gamma of generalised modularity,
+** 1.0 for the classic definition.
+** Parallelism: The vertices of a level are hashed into LOUVAIN_CLASSES
+**              classes that are swept one after another. Within a class
+**              every vertex picks its community in parallel against the
+**              same state, then the moves are applied in order. Sweeping
+**              a small class at a time keeps neighbours from moving
+**              blindly together, which is what makes fully synchronous
+**              Louvain glue unrelated communities. A batch of moves that
+**              still lowers modularity is undone and retried on a hashed
+**              half of itself. Nothing depends on nThreads, so neither
+**              does the result.
+*/
+int graphLouvainCSR(const CSRGraph *pCSR, double rResolution, int nThreads,
+                    sqlite3_int64 **paNode, sqlite3_int64 **paCommunity,
+                    int *pnNode){
+  CommGraph g;
+  TaskScheduler *pScheduler = 0;
+  LouvainTask *aTask = 0;
+  void **apTask = 0;
+  int aClass[LOUVAIN_CLASSES+1];  /* Class c is aVertex[aClass[c]..] */
+  int *aVertex = 0;           /* Level vertices grouped by class */
+  int *aMember = 0;           /* Original vertex -> current level vertex */
+  int *aComm = 0;             /* Level vertex -> community */
+  int *aBest = 0;             /* Preferred community per level vertex */
+  int *aPrev = 0;             /* Community before the current move, or -1 */
+  double *aTot = 0;           /* Total degree per community */
+  int nTaskMax = 1;
+  int nLevel;
+  int i, n;
+  int rc;
+
+  *paNode = 0;
+  *paCommunity = 0;
+  *pnNode = 0;
+  memset(&g, 0, sizeof(g));
+
+  n = pCSR->nNodes;
+  if( n==0 ) return SQLITE_OK;
+
+  rc = commGraphFromCSR(pCSR, 1, &g);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = commStartTasks(nThreads, n, &pScheduler, &nTaskMax);
+  if( rc!=SQLITE_OK ) goto louvain_cleanup;
+
+  aTask = sqlite3_malloc64(sizeof(LouvainTask)*nTaskMax);
+  apTask = sqlite3_malloc64(sizeof(void*)*nTaskMax);
+  aVertex = sqlite3_malloc64(sizeof(int)*n);
+  aMember = sqlite3_malloc64(sizeof(int)*n);
+  aComm = sqlite3_malloc64(sizeof(int)*n);
+  aBest = sqlite3_malloc64(sizeof(int)*n);
+  aPrev = sqlite3_malloc64(sizeof(int)*n);
+  aTot = sqlite3_malloc64(sizeof(double)*n);
+  if( !aTask || !apTask || !aVertex || !aMember || !aComm || !aBest
+   || !aPrev || !aTot ){
+    rc = SQLITE_NOMEM;
+    goto louvain_cleanup;
+  }
+  memset(aTask, 0, sizeof(LouvainTask)*nTaskMax);
+  for( i=0; i<n; i++ ) aMember[i] = i;
+
+  /* Without edges every node is its own community */
+  for( nLevel=0; g.rTotal>0.0 && nLevel<LOUVAIN_MAX_LEVELS; nLevel++ ){
+    CommGraph next;
+    LouvainQ q;
+    double rQ;
+    int nIdle = 0;
+    int nComm;
+    int iPass, c;
+
+    for( i=0; i<nTaskMax; i++ ){
+      sqlite3_free(aTask[i].aScratch);
+      aTask[i].aScratch = sqlite3_malloc64(sizeof(CommPair)*(g.nMaxDeg+1));
+      if( aTask[i].aScratch==0 ){
+        rc = SQLITE_NOMEM;
+        goto louvain_cleanup;
+      }
+    }
+
+    /* Counting sort of the level's vertices by class */
+    memset(aClass, 0, sizeof(aClass));
+    for( i=0; i<g.nNode; i++ ){
+      aClass[commHash(i, nLevel, 0)%LOUVAIN_CLASSES + 1]++;
+    }
+    for( c=0; c<LOUVAIN_CLASSES; c++ ) aClass[c+1] += aClass[c];
+    for( i=0; i<g.nNode; i++ ){
+      aVertex[aClass[commHash(i, nLevel, 0)%LOUVAIN_CLASSES]++] = i;
+    }
+    for( c=LOUVAIN_CLASSES; c>0; c-- ) aClass[c] = aClass[c-1];
+    aClass[0] = 0;
+
+    memset(&q, 0, sizeof(q));
+    for( i=0; i<g.nNode; i++ ){
+      sqlite3_int64 iSlot;
+      aComm[i] = i;
+      aPrev[i] = -1;
+      aTot[i] = g.aK[i];
+      q.rTot2 += g.aK[i]*g.aK[i];
+      for( iSlot=g.aOff[i]; iSlot<g.aOff[i+1]; iSlot++ ){
+        if( g.aAdj[iSlot]==i ) q.rIn += g.aW[iSlot];
+      }
+    }
+    rQ = louvainModularity(&g, &q, rResolution);
+
+    /* Local moving until a pass in each direction changes nothing */
+    for( iPass=0; iPass<LOUVAIN_MAX_PASSES && nIdle<2; iPass++ ){
+      int nPassMoved = 0;
+      for( c=0; c<LOUVAIN_CLASSES; c++ ){
+        const int *aCls = &aVertex[aClass[c]];
+        int nCls = aClass[c+1] - aClass[c];
+        int nTask = nTaskMax<nCls ? nTaskMax : nCls;
+        int nShift;
+        if( nCls==0 ) continue;
+
+        for( i=0; i<nTask; i++ ){
+          LouvainTask *p = &aTask[i];
+          p->pG = &g;
+          p->aVertex = aCls;
+          p->aComm = aComm;
+          p->aTot = aTot;
+          p->aBest = aBest;
+          p->rResolution = rResolution;
+          p->iFirst = (int)((sqlite3_int64)nCls*i/nTask);
+          p->iLast = (int)((sqlite3_int64)nCls*(i+1)/nTask);
+          apTask[i] = p;
+        }
+        rc = graphRunTasks(pScheduler, louvainWorker, apTask, nTask);
+        if( rc!=SQLITE_OK ) goto louvain_cleanup;
+
+        /* Only moves towards smaller community indexes on even passes
+        ** and larger ones on odd passes, so two vertices cannot keep
+        ** trading places */
+        for( i=0; i<nCls; i++ ){
+          int iV = aCls[i];
+          int bDown = aBest[iV]<aComm[iV];
+          if( bDown==(iPass&1) ) aBest[iV] = aComm[iV];
+        }
+
+        for( nShift=0; nShift<=LOUVAIN_MAX_HALVINGS; nShift++ ){
+          LouvainQ saved = q;
+          double rNewQ;
+          int nMoved = louvainApply(&g, aCls, nCls, aBest,
+                                    (1u<<nShift)-1, iPass*LOUVAIN_CLASSES+c,
+                                    aComm, aTot, aPrev, &q);
+          if( nMoved==0 ) break;
+          rNewQ = louvainModularity(&g, &q, rResolution);
+          if( rNewQ > rQ + LOUVAIN_EPSILON ){
+            rQ = rNewQ;
+            nPassMoved += nMoved;
+            for( i=0; i<nCls; i++ ) aPrev[aCls[i]] = -1;
+            break;
+          }
+          louvainRevert(&g, aCls, nCls, aComm, aTot, aPrev);
+          q = saved;
+        }
+      }
+      nIdle = nPassMoved ? 0 : nIdle+1;
+    }
+
+    nComm = louvainRenumber(aComm, g.nNode, aPrev);
+    for( i=0; i<n; i++ ) aMember[i] = aComm[aMember[i]];
+    if( nComm==g.nNode ) break;
+
+    rc = louvainAggregate(&g, aComm, nComm, &next);
+    if( rc!=SQLITE_OK ) goto louvain_cleanup;
+    commGraphFree(&g);
+    g = next;
+  }
+
+  rc = commEmit(pCSR, aMember, paNode, paCommunity, pnNode);
+
+louvain_cleanup:
+  if( aTask ){
+    for( i=0; i<nTaskMax; i++ ) sqlite3_free(aTask[i].aScratch);
+  }
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
+  sqlite3_free(aVertex);
+  sqlite3_free(aMember);
+  sqlite3_free(aComm);
+  sqlite3_free(aBest);
+  sqlite3_free(aPrev);
+  sqlite3_free(aTot);
+  graphDestroyTaskScheduler(pScheduler);
+  commGraphFree(&g);
+  return rc;
+}
+
+int graphLouvain(GraphVtab *pVtab, double rResolution, int nThreads,
+                 sqlite3_int64 **paNode, sqlite3_int64 **paCommunity,
+                 int *pnNode){
+  CSRGraph *pCSR = 0;
+  int rc;
+
+  *paNode = 0;
+  *paCommunity = 0;
+  *pnNode = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  return graphLouvainCSR(pCSR, rResolution, nThreads, paNode, paCommunity,
+                         pnNode);
+}
+
+/*
+** Connected components: Afforest (Sutton, Ben-Nun and Barak, 2018)
+** over the out-edges and in-edges of the snapshot. aParent[] is a
+** union-find forest in which every node points at a node of smaller
+** dense index, so the root of a tree is its smallest member. A link
+** hooks the larger of two roots under the smaller with one
+** compare-and-swap and takes no lock:
+**
+**   1. link every node to its first COMP_SAMPLE_ROUNDS out-neighbours,
+**      compressing the forest after each round;
+**   2. take the most common root of COMP_SAMPLE_NODES sampled nodes as
+**      the giant component;
+**   3. link the remaining out-edges and all in-edges of every node
+**      outside it, then compress once more.
+**
+** Step 3 skips the adjacency of most nodes when there is a giant
+** component. An edge with one end inside it is still linked from the
+** other end, as an out-edge or an in-edge.
+** Parallelism: Steps run over node ranges on the task scheduler, one
+**              after another. Roots only ever move to smaller indices,
+**              so the forest left at the end does not depend on the
+**              interleaving, the thread count or the sample.
+*/
+#define COMP_SAMPLE_ROUNDS 2
+#define COMP_SAMPLE_NODES  1024
+
+/* Steps a CompTask runs */
+#define COMP_STEP_SAMPLE   0
+#define COMP_STEP_COMPRESS 1
+#define COMP_STEP_FINISH   2
+
+/* Within a step, aParent[] slots are read and written concurrently */
+#define COMP_LOAD(A,I)     __atomic_load_n(&(A)[I], __ATOMIC_RELAXED)
+#define COMP_STORE(A,I,V)  __atomic_store_n(&(A)[I], (V), __ATOMIC_RELAXED)
+
+/*
+** One components work unit: the dense node range [iFirst, iLast).
+*/
+typedef struct CompTask CompTask;
+struct CompTask {
+  const CSRGraph *pCSR;
+  int *aParent;
+  int eStep;                  /* COMP_STEP_* */
+  int iRound;                 /* Out-neighbour linked by COMP_STEP_SAMPLE */
+  int iGiant;                 /* Root COMP_STEP_FINISH skips */
+  int iFirst, iLast;
+};
+
+/*
+** Join the trees of dense nodes u and v. The CAS only succeeds on a
+** root, so a root hooked by another thread meanwhile is retried from
+** its new parent.
+*/
+static void compLink(int *aParent, int u, int v){
+  int p1 = COMP_LOAD(aParent, u);
+  int p2 = COMP_LOAD(aParent, v);
+
+  while( p1!=p2 ){
+    int iHigh = p1>p2 ? p1 : p2;
+    int iLow = p1>p2 ? p2 : p1;
+    int pHigh = COMP_LOAD(aParent, iHigh);
+    if( pHigh==iLow ) break;
+    if( pHigh==iHigh
+     && __atomic_compare_exchange_n(&aParent[iHigh], &pHigh, iLow, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED) ){
+      break;
+    }
+    p1 = COMP_LOAD(aParent, COMP_LOAD(aParent, iHigh));
+    p2 = COMP_LOAD(aParent, iLow);
+  }
+}
+
+/*
+** Point every node of [iFirst, iLast) straight at its root.
+*/
+static void compCompress(int *aParent, int iFirst, int iLast){
+  int i;
+  for( i=iFirst; i<iLast; i++ ){
+    int p = COMP_LOAD(aParent, i);
+    int pp;
+    while( p!=(pp = COMP_LOAD(aParent, p)) ){
+      COMP_STORE(aParent, i, pp);
+      p = pp;
+    }
+  }
+}
+
+static void compWorker(void *pArg){
+  CompTask *p = (CompTask*)pArg;
+  const CSRGraph *pCSR = p->pCSR;
+  int *aParent = p->aParent;
+  int i;
+
+  switch( p->eStep ){
+    case COMP_STEP_SAMPLE:
+      for( i=p->iFirst; i<p->iLast; i++ ){
+        sqlite3_int64 iEdge = pCSR->rowOffsets[i] + p->iRound;
+        if( iEdge<pCSR->rowOffsets[i+1] ){
+          compLink(aParent, i, pCSR->columnIndices[iEdge]);
+        }
+      }
+      break;
+    case COMP_STEP_COMPRESS:
+      compCompress(aParent, p->iFirst, p->iLast);
+      break;
+    default: {
+      assert( p->eStep==COMP_STEP_FINISH );
+      for( i=p->iFirst; i<p->iLast; i++ ){
+        sqlite3_int64 iEdge;
+        if( COMP_LOAD(aParent, i)==p->iGiant ) continue;
+        iEdge = pCSR->rowOffsets[i] + COMP_SAMPLE_ROUNDS;
+        for( ; iEdge<pCSR->rowOffsets[i+1]; iEdge++ ){
+          compLink(aParent, i, pCSR->columnIndices[iEdge]);
+        }
+        for( iEdge=pCSR->inOffsets[i]; iEdge<pCSR->inOffsets[i+1]; iEdge++ ){
+          compLink(aParent, i, pCSR->inIndices[iEdge]);
+        }
+      }
+      break;
+    }
+  }
+}
+
+/*
+** Run step eStep on every task and wait for all of them.
+*/
+static int compRunStep(TaskScheduler *pScheduler, CompTask *aTask,
+                       void **apTask, int nTask, int eStep){
+  int i;
+  for( i=0; i<nTask; i++ ) aTask[i].eStep = eStep;
+  return graphRunTasks(pScheduler, compWorker, apTask, nTask);
+}
+
+/*
+** The most common root among COMP_SAMPLE_NODES hashed nodes of a
+** compressed forest.
+*/
+static int compGiant(const int *aParent, int nNode){
+  int aRoot[COMP_SAMPLE_NODES];
+  int iBest = 0, nBest = 0;
+  int i, j;
+
+  for( i=0; i<COMP_SAMPLE_NODES; i++ ){
+    aRoot[i] = aParent[commHash(i, 0, 0) % (unsigned int)nNode];
+  }
+  qsort(aRoot, COMP_SAMPLE_NODES, sizeof(int), commIntCompare);
+  for( i=0; i<COMP_SAMPLE_NODES; i=j ){
+    for( j=i; j<COMP_SAMPLE_NODES && aRoot[j]==aRoot[i]; j++ ){}
+    if( j-i>nBest ){
+      nBest = j-i;
+      iBest = aRoot[i];
+    }
+  }
+  return iBest;
+}
+
+/*
+** Fill aParent[] with the compressed forest of pCSR.
+*/
+static int compAfforest(const CSRGraph *pCSR, int nThreads, int *aParent){
+  int n = pCSR->nNodes;
+  TaskScheduler *pScheduler = 0;
+  CompTask *aTask = 0;
+  void **apTask = 0;
+  int nTask = 1;
+  int i;
+  int rc;
+
+  for( i=0; i<n; i++ ) aParent[i] = i;
+  if( n==0 ) return SQLITE_OK;
+
+  rc = commStartTasks(nThreads, n, &pScheduler, &nTask);
+  if( rc!=SQLITE_OK ) return rc;
+  aTask = sqlite3_malloc64(sizeof(CompTask)*nTask);
+  apTask = sqlite3_malloc64(sizeof(void*)*nTask);
+  if( !aTask || !apTask ){
+    rc = SQLITE_NOMEM;
+    goto afforest_cleanup;
+  }
+
+  /* Ranges of about the same number of nodes plus adjacency slots */
+  {
+    sqlite3_int64 nWork = (sqlite3_int64)n + pCSR->nEdges*2;
+    int iNode = 0;
+    for( i=0; i<nTask; i++ ){
+      sqlite3_int64 nTarget = nWork * (i+1) / nTask;
+      memset(&aTask[i], 0, sizeof(CompTask));
+      aTask[i].pCSR = pCSR;
+      aTask[i].aParent = aParent;
+      aTask[i].iFirst = iNode;
+      while( iNode<n && (iNode + pCSR->rowOffsets[iNode]
+                         + pCSR->inOffsets[iNode])<nTarget ){
+        iNode++;
+      }
+      aTask[i].iLast = i==nTask-1 ? n : iNode;
+      apTask[i] = &aTask[i];
+    }
+  }
+
+  for( i=0; rc==SQLITE_OK && i<COMP_SAMPLE_ROUNDS; i++ ){
+    int k;
+    for( k=0; k<nTask; k++ ) aTask[k].iRound = i;
+    rc = compRunStep(pScheduler, aTask, apTask, nTask, COMP_STEP_SAMPLE);
+    if( rc==SQLITE_OK ){
+      rc = compRunStep(pScheduler, aTask, apTask, nTask, COMP_STEP_COMPRESS);
+    }
+  }
+  if( rc==SQLITE_OK ){
+    int iGiant = compGiant(aParent, n);
+    for( i=0; i<nTask; i++ ) aTask[i].iGiant = iGiant;
+    rc = compRunStep(pScheduler, aTask, apTask, nTask, COMP_STEP_FINISH);
+  }
+  if( rc==SQLITE_OK ){
+    rc = compRunStep(pScheduler, aTask, apTask, nTask, COMP_STEP_COMPRESS);
+  }
+
+afforest_cleanup:
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
+  graphDestroyTaskScheduler(pScheduler);
+  return rc;
+}
+
+/*
+** Root of dense node i, halving the path on the way. Single-threaded.
+*/
+static int compFind(int *aParent, int i){
+  while( aParent[i]!=i ){
+    aParent[i] = aParent[aParent[i]];
+    i = aParent[i];
+  }
+  return i;
+}
+
+/*
+** Link into p the writes the overlay of pView logged after p->nOp and
+** compress the forest again. Nodes the overlay added are not in id
+** order, so roots are compared by node id here. Returns SQLITE_NOTFOUND
+** if a logged write deleted anything.
+*/
+static int compApplyOps(const CSRView *pView, GraphComponents *p){
+  int nOp = graphCSRDeltaOpCount(pView->pDelta);
+  int nNode = graphCSRViewNodeCount(pView);
+  int *aParent;
+  int i;
+
+  for( i=p->nOp; i<nOp; i++ ){
+    sqlite3_int64 iFrom, iTo;
+    int eOp = graphCSRDeltaOp(pView->pDelta, i, &iFrom, &iTo);
+    if( eOp!=CSR_OP_ADD_NODE && eOp!=CSR_OP_ADD_EDGE ) return SQLITE_NOTFOUND;
+  }
+
+  if( nNode>p->nNode ){
+    aParent = sqlite3_realloc64(p->aParent, sizeof(int)*nNode);
+    if( aParent==0 ) return SQLITE_NOMEM;
+    for( i=p->nNode; i<nNode; i++ ) aParent[i] = i;
+    p->aParent = aParent;
+    p->nNode = nNode;
+  }
+  aParent = p->aParent;
+
+  for( i=p->nOp; i<nOp; i++ ){
+    sqlite3_int64 iFrom, iTo;
+    int u, v;
+    if( graphCSRDeltaOp(pView->pDelta, i, &iFrom, &iTo)!=CSR_OP_ADD_EDGE ){
+      continue;
+    }
+    u = graphCSRViewIndexOf(pView, iFrom);
+    v = graphCSRViewIndexOf(pView, iTo);
+    assert( u>=0 && v>=0 );   /* Logged adds only name live nodes */
+    u = compFind(aParent, u);
+    v = compFind(aParent, v);
+    if( u==v ) continue;
+    if( graphCSRViewNodeId(pView, v)<graphCSRViewNodeId(pView, u) ){
+      aParent[u] = v;
+    }else{
+      aParent[v] = u;
+    }
+  }
+  if( nOp>p->nOp ) compCompress(aParent, 0, nNode);
+  p->nOp = nOp;
+  return SQLITE_OK;
+}
+
+void graphComponentsRelease(GraphComponents *pComp){
+  if( pComp && --pComp->nRef<=0 ){
+    sqlite3_free(pComp->aParent);
+    sqlite3_free(pComp);
+  }
+}
+
+void graphComponentsReset(GraphVtab *pVtab){
+  graphComponentsRelease(pVtab->pComponents);
+  pVtab->pComponents = 0;
+}
+
+/*
+** Copy p for a caller that is about to change it while a cursor still
+** reads it.
+*/
+static GraphComponents *compClone(const GraphComponents *p){
+  GraphComponents *pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ) return 0;
+  *pNew = *p;
+  pNew->nRef = 1;
+  pNew->aParent = sqlite3_malloc64(sizeof(int)*(p->nNode ? p->nNode : 1));
+  if( pNew->aParent==0 ){
+    sqlite3_free(pNew);
+    return 0;
+  }
+  memcpy(pNew->aParent, p->aParent, sizeof(int)*p->nNode);
+  return pNew;
+}
+
+int graphComponents(GraphVtab *pVtab, int bIncremental, int nThreads,
+                    CSRView *pView, GraphComponents **ppComp){
+  GraphComponents *p;
+  CSRGraph *pCSR = 0;
+  int rc;
+
+  *ppComp = 0;
+  memset(pView, 0, sizeof(*pView));
+
+  /* Catch up on the overlay if the kept result is over this snapshot */
+  if( bIncremental && pVtab->pComponents ){
+    rc = graphCSRViewOpen(pVtab, pView);
+    if( rc!=SQLITE_OK ) return rc;
+    p = pVtab->pComponents;     /* Reset if the view open replaced pCSR */
+    if( p && p->pCSR==pView->pCSR ){
+      if( p->nRef>1 && graphCSRDeltaOpCount(pView->pDelta)>p->nOp ){
+        GraphComponents *pNew = compClone(p);
+        if( pNew==0 ){
+          graphCSRViewClose(pView);
+          return SQLITE_NOMEM;
+        }
+        graphComponentsReset(pVtab);
+        pVtab->pComponents = p = pNew;
+      }
+      rc = compApplyOps(pView, p);
+      if( rc==SQLITE_OK ){
+        p->nRef++;
+        *ppComp = p;
+        return SQLITE_OK;
+      }
+      if( rc!=SQLITE_NOTFOUND ){
+        graphCSRViewClose(pView);
+        return rc;
+      }
+    }
+    graphCSRViewClose(pView);
+  }
+
+  /* Full run over the snapshot with the overlay folded in */
+  if( bIncremental ) graphComponentsReset(pVtab);
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc==SQLITE_OK ) rc = graphCSRViewOpen(pVtab, pView);
+  if( rc!=SQLITE_OK ) return rc;
+  assert( pView->pCSR==pCSR && pView->pDelta==0 );
+
+  p = sqlite3_malloc(sizeof(*p));
+  if( p ){
+    memset(p, 0, sizeof(*p));
+    p->nRef = 1;
+    p->pCSR = pCSR;
+    p->nNode = pCSR->nNodes;
+    p->aParent = sqlite3_malloc64(sizeof(int)*(p->nNode ? p->nNode : 1));
+  }
+  if( p==0 || p->aParent==0 ){
+    rc = SQLITE_NOMEM;
+  }else{
+    rc = compAfforest(pCSR, nThreads, p->aParent);
+  }
+  if( rc!=SQLITE_OK ){
+    graphComponentsRelease(p);
+    graphCSRViewClose(pView);
+    return rc;
+  }
+  if( bIncremental ){
+    p->nRef++;
+    pVtab->pComponents = p;
+  }
+  *ppComp = p;
+  return SQLITE_OK;
+}
@@ -1,8 +1,37 @@
 /*
 ** graph-compress.c - Property compression implementation
 **
-** This file implements dictionary encoding and other compression
-** techniques for efficient property storage in the graph database.
+** This file implements the packed property format of graphs created with
+** the properties=compressed module argument. A packed value is a BLOB
+** whose first byte holds the codec in its low nibble and, for zstd, the
+** trained dictionary slot in its high nibble (see graph-performance.h):
+**
+**   GRAPH_PACK_TEXT  JSON text in which repeated string literals, keys
+**                    and values alike, are replaced by 0x01 and a varint
+**                    id into the graph's string dictionary
+**   GRAPH_PACK_ZSTD  a zstd frame compressed against a dictionary trained
+**                    on sampled property documents (HAVE_ZSTD builds)
+**   GRAPH_PACK_ZLIB  varint length and a zlib stream, for large values
+**                    (HAVE_ZLIB builds)
+**
+** The string dictionary lives in "<graph>_dict"(id, value) and trained
+** zstd dictionaries in "<graph>_zdict"(slot, dict), so packed values
+** written by one process decode in any other. Each connection loads a
+** graph's dictionaries lazily on first use and appends to them as new
+** repeated strings appear. Committed ids are never reused, but ids this
+** connection adds in a transaction that rolls back can be taken again,
+** for other strings, by another connection. A connection holding such
+** ids therefore reloads its copy once the database changes (see
+** dictRefresh()) before it decodes again.
+**
+** SQL functions:
+**   graph_pack(graph, value)        pack JSON text; packed input is repacked
+**   graph_props(graph, value)       JSON text of a packed value; other
+**                                   values are returned unchanged
+**   graph_compress_train(graph [, samples])
+**                                   train a zstd dictionary, return its slot
+**   graph_compression_stats([graph])
+**                                   dictionary sizes and stored savings
 */
 
 #include <sqlite3.h>
@@ -14,455 +43,1033 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include <string.h>
 #include <stdlib.h>
 
-/* Check if zlib is available - temporarily disabled for testing */
-#define HAVE_ZLIB 0
+/* Optional codecs, enabled by the Makefile's WITH_ZLIB and WITH_ZSTD */
+#ifndef HAVE_ZLIB
+# define HAVE_ZLIB 0
+#endif
+#ifndef HAVE_ZSTD
+# define HAVE_ZSTD 0
+#endif
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+#if HAVE_ZSTD
+# include <zstd.h>
+# include <zdict.h>
+#endif
 
 #include "graph.h"
 #include "graph-memory.h"
 #include "graph-performance.h"
-#include "graph-memory.h"
 
-/* Dictionary entry for string compression */
-typedef struct DictEntry {
-    char *zValue;                /* String value */
-    sqlite3_int64 dictId;        /* Dictionary ID */
-    sqlite3_int64 refCount;      /* Reference count */
-    size_t length;               /* String length */
-    struct DictEntry *pNext;     /* Hash chain */
-} DictEntry;
-
-/* String dictionary for property compression */
-typedef struct StringDictionary {
-    DictEntry **buckets;         /* Hash table */
-    int nBuckets;                /* Number of buckets */
-    sqlite3_int64 nEntries;      /* Total entries */
-    sqlite3_int64 nextId;        /* Next dictionary ID */
-    size_t totalSize;            /* Total memory used */
-    size_t savedBytes;           /* Bytes saved by compression */
-    sqlite3_mutex *mutex;        /* Thread safety */
-} StringDictionary;
-
-/* Compressed property storage */
-typedef struct CompressedProperty {
-    int type;                    /* Property type */
-    union {
-        sqlite3_int64 dictId;    /* Dictionary ID for strings */
-        sqlite3_int64 intVal;    /* Integer value */
-        double floatVal;         /* Float value */
-    } value;
-} CompressedProperty;
-
-/* Property type enumeration */
-enum {
-    PROP_TYPE_NULL = 0,
-    PROP_TYPE_BOOL = 1,
-    PROP_TYPE_INT = 2,
-    PROP_TYPE_FLOAT = 3,
-    PROP_TYPE_STRING = 4,
-    PROP_TYPE_DICT_STRING = 5,   /* Dictionary-encoded string */
-    PROP_TYPE_COMPRESSED = 6      /* zlib compressed */
+/* Dictionary reference marker; raw JSON text never contains it */
+#define PACK_REF 0x01
+
+/* Strings outside this length range stay inline */
+#define DICT_MIN_LEN 4
+#define DICT_MAX_LEN 256
+
+/* Direct-mapped table counting sightings of strings not yet in the
+** dictionary; a string joins the dictionary when seen a second time */
+#define DICT_NCAND 65536
+
+/* Values shorter than these are not tried with zstd or zlib */
+#define PACK_ZSTD_MIN 48
+#define PACK_ZLIB_MIN 1024
+
+/* Trained zstd dictionaries: slots 1..15, at most this many bytes */
+#define ZDICT_NSLOT 16
+#define ZDICT_CAPACITY (64 * 1024)
+
+/* A string seen once, identified by hash and length only */
+typedef struct DictCand {
+    unsigned int h;
+    int n;
+} DictCand;
+
+/* The dictionaries of one graph as seen by one connection */
+typedef struct GraphDict GraphDict;
+struct GraphDict {
+    char *zGraph;                /* Graph (virtual table) name */
+    sqlite3 *db;
+    char **azValue;              /* azValue[id]: escaped string content */
+    int *anValue;                /* Lengths of azValue[] */
+    int nValue;                  /* Largest id loaded */
+    int nValueAlloc;
+    int *aHash;                  /* Open addressing: ids, 0 for empty */
+    int nHash;                   /* Slots in aHash, a power of two */
+    DictCand *aCand;             /* DICT_NCAND sighting slots */
+    int bLoaded;                 /* azValue holds the table's rows */
+    int bUnsure;                 /* Holds ids or slots a rollback may undo */
+    unsigned int iDataVersion;   /* SQLITE_FCNTL_DATA_VERSION when checked */
+    sqlite3_stmt *pInsert;       /* INSERT INTO <graph>_dict */
+    sqlite3_stmt *pCheck;        /* SELECT value ... WHERE id=? */
+    int iZstdSlot;               /* Newest trained slot, 0 if none */
+    int bZstdLoaded;             /* Slots have been read */
+#if HAVE_ZSTD
+    ZSTD_CDict *apCDict[ZDICT_NSLOT];
+    ZSTD_DDict *apDDict[ZDICT_NSLOT];
+    ZSTD_CCtx *pCCtx;
+    ZSTD_DCtx *pDCtx;
+#endif
+    sqlite3_int64 anPacked[3];   /* Values packed by codec: text, zstd, zlib */
+    sqlite3_int64 nBytesIn;      /* JSON bytes packed this session */
+    sqlite3_int64 nBytesOut;     /* Packed bytes produced this session */
+    GraphDict *pNext;
 };
 
-/* Global string dictionary */
-static StringDictionary *g_stringDict = NULL;
+/* Per-connection list of graph dictionaries, the functions' user data */
+typedef struct GraphDictSet {
+    GraphDict *pList;
+} GraphDictSet;
 
-/*
-** Hash function for dictionary
-*/
-static unsigned int dictHash(const char *zStr) {
-    unsigned int hash = 5381;
-    int c;
-    
-    while ((c = *zStr++)) {
-        hash = ((hash << 5) + hash) + c;
-    }
-    
-    return hash;
+static unsigned int dictHash(const char *z, int n) {
+    unsigned int h = 5381;
+    int i;
+    for (i = 0; i < n; i++) h = ((h << 5) + h) + (unsigned char)z[i];
+    return h;
 }
 
-/*
-** Initialize string dictionary
-*/
-int graphInitStringDictionary(int initialBuckets) {
-    if (g_stringDict) return SQLITE_MISUSE;
-    
-    g_stringDict = sqlite3_malloc(sizeof(StringDictionary));
-    if (!g_stringDict) return SQLITE_NOMEM;
-    
-    memset(g_stringDict, 0, sizeof(StringDictionary));
-    
-    if (initialBuckets <= 0) initialBuckets = 1024;
-    g_stringDict->nBuckets = initialBuckets;
-    
-    g_stringDict->buckets = sqlite3_malloc(
-        initialBuckets * sizeof(DictEntry*));
-    if (!g_stringDict->buckets) {
-        sqlite3_free(g_stringDict);
-        g_stringDict = NULL;
-        return SQLITE_NOMEM;
-    }
-    
-    memset(g_stringDict->buckets, 0, 
-           initialBuckets * sizeof(DictEntry*));
-    
-    g_stringDict->nextId = 1;
-    g_stringDict->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
-    
-    return SQLITE_OK;
+static void dictClear(GraphDict *p) {
+    int i;
+    for (i = 1; i <= p->nValue; i++) sqlite3_free(p->azValue[i]);
+    sqlite3_free(p->azValue);
+    sqlite3_free(p->anValue);
+    sqlite3_free(p->aHash);
+    p->azValue = NULL;
+    p->anValue = NULL;
+    p->aHash = NULL;
+    p->nValue = p->nValueAlloc = p->nHash = 0;
+    p->bLoaded = 0;
 }
 
-/*
-** Add string to dictionary
-*/
-static sqlite3_int64 dictAddString(const char *zStr) {
-    if (!g_stringDict || !zStr) return 0;
-    
-    sqlite3_mutex_enter(g_stringDict->mutex);
-    
-    /* Check if already exists */
-    unsigned int bucket = dictHash(zStr) % g_stringDict->nBuckets;
-    DictEntry *entry = g_stringDict->buckets[bucket];
-    
-    while (entry) {
-        if (strcmp(entry->zValue, zStr) == 0) {
-            /* Found existing entry */
-            entry->refCount++;
-            sqlite3_int64 id = entry->dictId;
-            sqlite3_mutex_leave(g_stringDict->mutex);
-            return id;
+static void dictFree(GraphDict *p) {
+#if HAVE_ZSTD
+    int i;
+    for (i = 0; i < ZDICT_NSLOT; i++) {
+        ZSTD_freeCDict(p->apCDict[i]);
+        ZSTD_freeDDict(p->apDDict[i]);
+    }
+    ZSTD_freeCCtx(p->pCCtx);
+    ZSTD_freeDCtx(p->pDCtx);
+#endif
+    dictClear(p);
+    sqlite3_finalize(p->pInsert);
+    sqlite3_finalize(p->pCheck);
+    sqlite3_free(p->aCand);
+    sqlite3_free(p->zGraph);
+    sqlite3_free(p);
+}
+
+static void dictSetFree(void *pArg) {
+    GraphDictSet *pSet = (GraphDictSet*)pArg;
+    while (pSet->pList) {
+        GraphDict *p = pSet->pList;
+        pSet->pList = p->pNext;
+        dictFree(p);
+    }
+    sqlite3_free(pSet);
+}
+
+/* Find id of string z[0..n) in the dictionary, 0 if absent */
+static int dictFind(GraphDict *p, const char *z, int n) {
+    unsigned int i;
+    if (p->nHash == 0) return 0;
+    for (i = dictHash(z, n) & (p->nHash - 1); p->aHash[i]; i = (i + 1) & (p->nHash - 1)) {
+        int id = p->aHash[i];
+        if (p->anValue[id] == n && memcmp(p->azValue[id], z, n) == 0) return id;
+    }
+    return 0;
+}
+
+/* Record value z[0..n) under id in memory */
+static int dictSet(GraphDict *p, int id, const char *z, int n) {
+    unsigned int i;
+
+    if (id >= p->nValueAlloc) {
+        int nNew = p->nValueAlloc ? p->nValueAlloc * 2 : 256;
+        char **azNew;
+        int *anNew;
+        while (nNew <= id) nNew *= 2;
+        azNew = sqlite3_realloc64(p->azValue, nNew * sizeof(char*));
+        if (!azNew) return SQLITE_NOMEM;
+        p->azValue = azNew;
+        anNew = sqlite3_realloc64(p->anValue, nNew * sizeof(int));
+        if (!anNew) return SQLITE_NOMEM;
+        p->anValue = anNew;
+        memset(&p->azValue[p->nValueAlloc], 0, (nNew - p->nValueAlloc) * sizeof(char*));
+        memset(&p->anValue[p->nValueAlloc], 0, (nNew - p->nValueAlloc) * sizeof(int));
+        p->nValueAlloc = nNew;
+    }
+    if (2 * (id + 1) > p->nHash) {
+        int nNew = p->nHash ? p->nHash * 2 : 512;
+        int *aNew = sqlite3_malloc64(nNew * sizeof(int));
+        int j;
+        if (!aNew) return SQLITE_NOMEM;
+        memset(aNew, 0, nNew * sizeof(int));
+        for (j = 1; j <= p->nValue; j++) {
+            if (!p->azValue[j]) continue;
+            for (i = dictHash(p->azValue[j], p->anValue[j]) & (nNew - 1); aNew[i]; i = (i + 1) & (nNew - 1));
+            aNew[i] = j;
         }
-        entry = entry->pNext;
+        sqlite3_free(p->aHash);
+        p->aHash = aNew;
+        p->nHash = nNew;
     }
-    
-    /* Create new entry */
-    entry = sqlite3_malloc(sizeof(DictEntry));
-    if (!entry) {
-        sqlite3_mutex_leave(g_stringDict->mutex);
-        return 0;
+
+    p->azValue[id] = sqlite3_malloc(n + 1);
+    if (!p->azValue[id]) return SQLITE_NOMEM;
+    memcpy(p->azValue[id], z, n);
+    p->azValue[id][n] = 0;
+    p->anValue[id] = n;
+    if (id > p->nValue) p->nValue = id;
+    for (i = dictHash(z, n) & (p->nHash - 1); p->aHash[i]; i = (i + 1) & (p->nHash - 1));
+    p->aHash[i] = id;
+    return SQLITE_OK;
+}
+
+/* (Re)load the string dictionary from <graph>_dict */
+static int dictLoad(GraphDict *p) {
+    sqlite3_stmt *pStmt;
+    char *zSql;
+    int rc;
+
+    dictClear(p);
+    zSql = sqlite3_mprintf("SELECT id, value FROM \"%w_dict\" ORDER BY id", p->zGraph);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) return rc;
+    while (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
+        sqlite3_int64 id = sqlite3_column_int64(pStmt, 0);
+        if (id <= 0 || id > 0x7fffffff) continue;
+        rc = dictSet(p, (int)id, (const char*)sqlite3_column_text(pStmt, 1),
+                     sqlite3_column_bytes(pStmt, 1));
     }
-    
-    size_t len = strlen(zStr);
-    entry->zValue = sqlite3_malloc(len + 1);
-    if (!entry->zValue) {
-        sqlite3_free(entry);
-        sqlite3_mutex_leave(g_stringDict->mutex);
-        return 0;
+    if (rc == SQLITE_OK) rc = sqlite3_finalize(pStmt);
+    else sqlite3_finalize(pStmt);
+    if (rc == SQLITE_OK) {
+        p->bLoaded = 1;
+        /* Rows read inside our own write transaction may yet roll back */
+        p->bUnsure = sqlite3_txn_state(p->db, NULL) == SQLITE_TXN_WRITE;
     }
-    
-    strcpy(entry->zValue, zStr);
-    entry->dictId = g_stringDict->nextId++;
-    entry->refCount = 1;
-    entry->length = len;
-    
-    /* Insert into hash table */
-    entry->pNext = g_stringDict->buckets[bucket];
-    g_stringDict->buckets[bucket] = entry;
-    
-    /* Update statistics */
-    g_stringDict->nEntries++;
-    g_stringDict->totalSize += sizeof(DictEntry) + len + 1;
-    
-    /* Track compression savings */
-    if (entry->refCount > 1) {
-        g_stringDict->savedBytes += len - sizeof(sqlite3_int64);
-    }
-    
-    sqlite3_int64 id = entry->dictId;
-    sqlite3_mutex_leave(g_stringDict->mutex);
-    
-    return id;
+    return rc;
 }
 
 /*
-** Get string from dictionary by ID
+** Make sure the in-memory dictionary matches the table before ids are
+** handed out. Ids are assigned in ascending order, so a rollback can
+** only remove a suffix of them; if the newest id this connection knows
+** still holds its value, every older one does too.
 */
-static const char* dictGetString(sqlite3_int64 dictId) {
-    if (!g_stringDict || dictId <= 0) return NULL;
-    
-    sqlite3_mutex_enter(g_stringDict->mutex);
-    
-    /* Linear search through all buckets (could optimize with reverse index) */
-    for (int i = 0; i < g_stringDict->nBuckets; i++) {
-        DictEntry *entry = g_stringDict->buckets[i];
-        while (entry) {
-            if (entry->dictId == dictId) {
-                const char *value = entry->zValue;
-                sqlite3_mutex_leave(g_stringDict->mutex);
-                return value;
-            }
-            entry = entry->pNext;
-        }
+static int dictValidate(GraphDict *p) {
+    int rc;
+    int bOk;
+
+    if (!p->bLoaded) return dictLoad(p);
+    if (p->nValue == 0) return SQLITE_OK;
+    if (!p->pCheck) {
+        char *zSql = sqlite3_mprintf("SELECT value FROM \"%w_dict\" WHERE id = ?1", p->zGraph);
+        if (!zSql) return SQLITE_NOMEM;
+        rc = sqlite3_prepare_v3(p->db, zSql, -1, SQLITE_PREPARE_PERSISTENT, &p->pCheck, NULL);
+        sqlite3_free(zSql);
+        if (rc != SQLITE_OK) return rc;
     }
-    
-    sqlite3_mutex_leave(g_stringDict->mutex);
-    return NULL;
+    sqlite3_bind_int(p->pCheck, 1, p->nValue);
+    bOk = sqlite3_step(p->pCheck) == SQLITE_ROW
+       && sqlite3_column_bytes(p->pCheck, 0) == p->anValue[p->nValue]
+       && memcmp(sqlite3_column_text(p->pCheck, 0), p->azValue[p->nValue],
+                 p->anValue[p->nValue]) == 0;
+    sqlite3_reset(p->pCheck);
+    return bOk ? SQLITE_OK : dictLoad(p);
 }
 
 /*
-** Compress properties using dictionary encoding
+** Return the id of string z[0..n), adding it to the dictionary on its
+** second sighting if bPromote is set. Returns 0 when the string stays
+** inline.
 */
-char* graphCompressProperties(const char *zProperties) {
-    if (!zProperties || !g_stringDict) return NULL;
-    
-    /* Parse JSON properties */
-    /* This is a simplified implementation - real version would use proper JSON parser */
-    
-    /* Look for string values that appear frequently */
-    char *compressed = sqlite3_malloc(strlen(zProperties) + 100);
-    if (!compressed) return NULL;
-    
-    strcpy(compressed, "{\"_compressed\":true,");
-    
-    /* Simple pattern matching for demonstration */
-    const char *p = zProperties;
-    while (*p) {
-        if (*p == '"') {
-            /* Found start of string */
-            p++;
-            const char *start = p;
-            while (*p && *p != '"') p++;
-            
-            if (*p == '"') {
-                /* Extract string value */
-                size_t len = p - start;
-                char *value = sqlite3_malloc(len + 1);
-                if (value) {
-                    strncpy(value, start, len);
-                    value[len] = '\0';
-                    
-                    /* Check if worth compressing (length > 10) */
-                    if (len > 10) {
-                        sqlite3_int64 dictId = dictAddString(value);
-                        if (dictId > 0) {
-                            /* Replace with dictionary reference */
-                            char dictRef[32];
-                            sqlite3_snprintf(sizeof(dictRef), dictRef,
-                                           "\"_dict\":%lld", dictId);
-                            strcat(compressed, dictRef);
-                        }
-                    } else {
-                        /* Keep original string */
-                        strcat(compressed, "\"");
-                        strcat(compressed, value);
-                        strcat(compressed, "\"");
-                    }
-                    
-                    sqlite3_free(value);
-                }
-            }
+static int dictIntern(GraphDict *p, const char *z, int n, int bPromote, int *pRc) {
+    unsigned int h;
+    DictCand *pCand;
+    int id;
+    int rc;
+
+    if (n < DICT_MIN_LEN || n > DICT_MAX_LEN) return 0;
+    id = dictFind(p, z, n);
+    if (id || !bPromote) return id;
+
+    h = dictHash(z, n);
+    pCand = &p->aCand[h & (DICT_NCAND - 1)];
+    if (pCand->h != h || pCand->n != n) {
+        pCand->h = h;
+        pCand->n = n;
+        return 0;
+    }
+
+    if (!p->pInsert) {
+        char *zSql = sqlite3_mprintf("INSERT INTO \"%w_dict\"(id, value) VALUES(?1, ?2)", p->zGraph);
+        if (!zSql) { *pRc = SQLITE_NOMEM; return 0; }
+        rc = sqlite3_prepare_v3(p->db, zSql, -1, SQLITE_PREPARE_PERSISTENT, &p->pInsert, NULL);
+        sqlite3_free(zSql);
+        if (rc != SQLITE_OK) { *pRc = rc; return 0; }
+    }
+    id = p->nValue + 1;
+    sqlite3_bind_int(p->pInsert, 1, id);
+    sqlite3_bind_text(p->pInsert, 2, z, n, SQLITE_STATIC);
+    rc = sqlite3_step(p->pInsert);
+    sqlite3_reset(p->pInsert);
+    if (rc == SQLITE_CONSTRAINT) {
+        /* Another connection added it or took the id: catch up */
+        rc = dictLoad(p);
+        if (rc != SQLITE_OK) { *pRc = rc; return 0; }
+        return dictFind(p, z, n);
+    }
+    if (rc != SQLITE_DONE) { *pRc = rc; return 0; }
+    p->bUnsure = 1;
+    rc = dictSet(p, id, z, n);
+    if (rc != SQLITE_OK) { *pRc = rc; return 0; }
+    pCand->n = -1;
+    return id;
+}
+
+/* Find or create the dictionaries of zGraph on this connection */
+static GraphDict *dictGet(GraphDictSet *pSet, sqlite3 *db, const char *zGraph) {
+    GraphDict *p;
+
+    for (p = pSet->pList; p; p = p->pNext) {
+        if (sqlite3_stricmp(p->zGraph, zGraph) == 0) return p;
+    }
+    p = sqlite3_malloc(sizeof(*p));
+    if (!p) return NULL;
+    memset(p, 0, sizeof(*p));
+    p->db = db;
+    p->zGraph = sqlite3_mprintf("%s", zGraph);
+    p->aCand = sqlite3_malloc64(DICT_NCAND * sizeof(DictCand));
+    if (!p->zGraph || !p->aCand) {
+        dictFree(p);
+        return NULL;
+    }
+    memset(p->aCand, 0, DICT_NCAND * sizeof(DictCand));
+    p->pNext = pSet->pList;
+    pSet->pList = p;
+    return p;
+}
+
+static void putVarint(sqlite3_str *pOut, sqlite3_uint64 v) {
+    while (v >= 0x80) {
+        sqlite3_str_appendchar(pOut, 1, (char)((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    sqlite3_str_appendchar(pOut, 1, (char)v);
+}
+
+static int getVarint(const unsigned char *a, int n, int *pi, sqlite3_uint64 *pv) {
+    sqlite3_uint64 v = 0;
+    int shift = 0;
+    while (*pi < n && shift < 64) {
+        unsigned char c = a[(*pi)++];
+        v |= (sqlite3_uint64)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *pv = v;
+            return 1;
         }
-        p++;
+        shift += 7;
     }
-    
-    strcat(compressed, "}");
-    return compressed;
+    return 0;
 }
 
 /*
-** Decompress properties
+** Encode JSON text z[0..n) as GRAPH_PACK_TEXT into pOut, header byte
+** included. Text holding raw control characters other than whitespace
+** is not JSON, and is stored without references so it decodes intact.
+** Without bPromote only strings already in the dictionary are replaced.
 */
-char* graphDecompressProperties(const char *zCompressed) {
-    if (!zCompressed) return NULL;
-    
-    /* Check if compressed */
-    if (!strstr(zCompressed, "_compressed")) {
-        /* Not compressed, return copy */
-        return sqlite3_mprintf("%s", zCompressed);
-    }
-    
-    char *decompressed = sqlite3_malloc(strlen(zCompressed) * 2);
-    if (!decompressed) return NULL;
-    
-    strcpy(decompressed, "{");
-    
-    /* Look for dictionary references */
-    const char *p = strstr(zCompressed, "_dict");
-    while (p) {
-        /* Extract dictionary ID */
-        p += 7; /* Skip "_dict":" */
-        sqlite3_int64 dictId = 0;
-        while (*p >= '0' && *p <= '9') {
-            dictId = dictId * 10 + (*p - '0');
-            p++;
+static int packText(GraphDict *p, const char *z, int n, int bPromote,
+                    sqlite3_str *pOut) {
+    int bRefs = 1;
+    int i = 0;
+    int rc = SQLITE_OK;
+
+    for (i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)z[i];
+        if (c < 0x20 && c != '\t' && c != '\n' && c != '\r') {
+            bRefs = 0;
+            break;
+        }
+    }
+
+    sqlite3_str_appendchar(pOut, 1, (char)GRAPH_PACK_TEXT);
+    if (!bRefs) {
+        sqlite3_str_append(pOut, z, n);
+        return SQLITE_OK;
+    }
+    i = 0;
+    while (i < n && rc == SQLITE_OK) {
+        int iStart;
+        int id;
+
+        if (z[i] != '"') {
+            int j = i;
+            while (j < n && z[j] != '"') j++;
+            sqlite3_str_append(pOut, z + i, j - i);
+            i = j;
+            continue;
+        }
+        iStart = ++i;
+        while (i < n && z[i] != '"') i += (z[i] == '\\') ? 2 : 1;
+        if (i > n) i = n;
+        id = dictIntern(p, z + iStart, i - iStart, bPromote, &rc);
+        if (id) {
+            sqlite3_str_appendchar(pOut, 1, PACK_REF);
+            putVarint(pOut, (sqlite3_uint64)id);
+        } else {
+            sqlite3_str_appendchar(pOut, 1, '"');
+            sqlite3_str_append(pOut, z + iStart, i - iStart);
+            if (i < n) sqlite3_str_appendchar(pOut, 1, '"');
         }
-        
-        /* Look up string */
-        const char *value = dictGetString(dictId);
-        if (value) {
-            strcat(decompressed, "\"");
-            strcat(decompressed, value);
-            strcat(decompressed, "\"");
+        if (i < n) i++;
+    }
+    return rc;
+}
+
+#if HAVE_ZSTD
+/* Load the trained dictionaries from <graph>_zdict */
+static int zstdLoad(GraphDict *p) {
+    sqlite3_stmt *pStmt;
+    char *zSql;
+    int rc;
+
+    p->bZstdLoaded = 1;
+    zSql = sqlite3_mprintf("SELECT slot, dict FROM \"%w_zdict\" ORDER BY slot", p->zGraph);
+    if (!zSql) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL);
+    sqlite3_free(zSql);
+    if (rc != SQLITE_OK) return SQLITE_OK;    /* no trained dictionary yet */
+    while (sqlite3_step(pStmt) == SQLITE_ROW) {
+        int iSlot = sqlite3_column_int(pStmt, 0);
+        const void *pDict = sqlite3_column_blob(pStmt, 1);
+        int nDict = sqlite3_column_bytes(pStmt, 1);
+        if (iSlot <= 0 || iSlot >= ZDICT_NSLOT || p->apDDict[iSlot]) continue;
+        p->apCDict[iSlot] = ZSTD_createCDict(pDict, nDict, 3);
+        p->apDDict[iSlot] = ZSTD_createDDict(pDict, nDict);
+        if (!p->apCDict[iSlot] || !p->apDDict[iSlot]) rc = SQLITE_NOMEM;
+        if (iSlot > p->iZstdSlot) p->iZstdSlot = iSlot;
+    }
+    sqlite3_finalize(pStmt);
+    return rc;
+}
+
+/* zstd-compress z[0..n) against the newest dictionary. Returns a
+** sqlite3_malloc'd buffer with the header byte, or NULL. */
+static unsigned char *packZstd(GraphDict *p, const char *z, int n, int *pnOut) {
+    size_t nCap = ZSTD_compressBound(n) + 1;
+    unsigned char *a;
+    size_t nOut;
+
+    if (!p->pCCtx && !(p->pCCtx = ZSTD_createCCtx())) return NULL;
+    a = sqlite3_malloc64(nCap);
+    if (!a) return NULL;
+    nOut = ZSTD_compress_usingCDict(p->pCCtx, a + 1, nCap - 1, z, n,
+                                    p->apCDict[p->iZstdSlot]);
+    if (ZSTD_isError(nOut)) {
+        sqlite3_free(a);
+        return NULL;
+    }
+    a[0] = (unsigned char)((p->iZstdSlot << 4) | GRAPH_PACK_ZSTD);
+    *pnOut = (int)nOut + 1;
+    return a;
+}
+#endif
+
+#if HAVE_ZLIB
+/* zlib-compress z[0..n). Returns a sqlite3_malloc'd buffer with the
+** header byte and length varint, or NULL. */
+static unsigned char *packZlib(const char *z, int n, int *pnOut) {
+    uLongf nDest = compressBound(n);
+    sqlite3_str *pHdr = sqlite3_str_new(NULL);
+    unsigned char *a;
+    int nHdr;
+    char *zHdr;
+
+    sqlite3_str_appendchar(pHdr, 1, (char)GRAPH_PACK_ZLIB);
+    putVarint(pHdr, (sqlite3_uint64)n);
+    nHdr = sqlite3_str_length(pHdr);
+    zHdr = sqlite3_str_finish(pHdr);
+    if (!zHdr) return NULL;
+    a = sqlite3_malloc64(nHdr + nDest);
+    if (a) {
+        memcpy(a, zHdr, nHdr);
+        if (compress2(a + nHdr, &nDest, (const Bytef*)z, n, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            sqlite3_free(a);
+            a = NULL;
+        } else {
+            *pnOut = nHdr + (int)nDest;
         }
-        
-        p = strstr(p, "_dict");
     }
-    
-    strcat(decompressed, "}");
-    return decompressed;
+    sqlite3_free(zHdr);
+    return a;
 }
+#endif
 
 /*
-** Compress using zlib for large properties
+** Pack JSON text z[0..n): the dictionary text form, or zstd or zlib
+** where one is built in and comes out smaller. Values that zstd will
+** take do not promote new strings, so documents covered by a trained
+** dictionary do not also grow the string dictionary. *paOut is a
+** sqlite3_malloc'd BLOB.
 */
-char* graphCompressLarge(const char *zData, size_t *pCompressedSize) {
-    if (!zData) return NULL;
-    
-    size_t srcLen = strlen(zData);
-    
-    /* Only compress if large enough */
-    if (srcLen < 1024) {
-        *pCompressedSize = srcLen;
-        return sqlite3_mprintf("%s", zData);
-    }
-    
+static int packProperties(GraphDict *p, const char *z, int n,
+                          unsigned char **paOut, int *pnOut) {
+    sqlite3_str *pOut;
+    unsigned char *a;
+    unsigned char *aZ = NULL;
+    int nOut;
+    int nZ = 0;
+    int eCodec = 0;              /* Index into anPacked[] */
+    int rc;
+
+    rc = dictValidate(p);
+    if (rc != SQLITE_OK) return rc;
+
+#if HAVE_ZSTD
+    if (!p->bZstdLoaded) rc = zstdLoad(p);
+    if (rc != SQLITE_OK) return rc;
+    if (p->iZstdSlot && n >= PACK_ZSTD_MIN) aZ = packZstd(p, z, n, &nZ);
+#endif
+
+    pOut = sqlite3_str_new(p->db);
+    rc = packText(p, z, n, aZ == NULL, pOut);
+    nOut = sqlite3_str_length(pOut);
+    a = (unsigned char*)sqlite3_str_finish(pOut);
+    if (rc == SQLITE_OK && !a) rc = SQLITE_NOMEM;
+    if (rc != SQLITE_OK) {
+        sqlite3_free(a);
+        sqlite3_free(aZ);
+        return rc;
+    }
+    if (aZ && nZ < nOut) {
+        sqlite3_free(a);
+        a = aZ;
+        nOut = nZ;
+        eCodec = 1;
+    } else {
+        sqlite3_free(aZ);
+    }
+
 #if HAVE_ZLIB
-    /* Allocate buffer for compressed data */
-    uLongf destLen = compressBound(srcLen);
-    unsigned char *compressed = sqlite3_malloc(destLen + 16);
-    if (!compressed) return NULL;
-    
-    /* Add header indicating compression */
-    strcpy((char*)compressed, "ZLIB:");
-    
-    /* Compress data */
-    int rc = compress(compressed + 5, &destLen, 
-                     (const unsigned char*)zData, srcLen);
-    
-    if (rc != Z_OK) {
-        sqlite3_free(compressed);
-        return NULL;
+    if (n >= PACK_ZLIB_MIN) {
+        aZ = packZlib(z, n, &nZ);
+        if (aZ && nZ < nOut) {
+            sqlite3_free(a);
+            a = aZ;
+            nOut = nZ;
+            eCodec = 2;
+        } else {
+            sqlite3_free(aZ);
+        }
     }
-    
-    *pCompressedSize = destLen + 5;
-    
-    /* Check if compression was worthwhile */
-    if (*pCompressedSize >= srcLen * 0.9) {
-        /* Not worth it, return original */
-        sqlite3_free(compressed);
-        *pCompressedSize = srcLen;
-        return sqlite3_mprintf("%s", zData);
-    }
-    
-    return (char*)compressed;
-#else
-    /* Compression not available, return original */
-    *pCompressedSize = srcLen;
-    return sqlite3_mprintf("%s", zData);
 #endif
+
+    p->anPacked[eCodec]++;
+    p->nBytesIn += n;
+    p->nBytesOut += nOut;
+    *paOut = a;
+    *pnOut = nOut;
+    return SQLITE_OK;
 }
 
 /*
-** Decompress zlib data
+** Make the dictionaries safe to decode with. Ids and slots loaded
+** outside a write transaction were committed and keep their values; the
+** ones this connection added since may have been rolled back and taken
+** by another connection, so while it holds any, a change of the
+** database's data version reloads everything.
 */
-char* graphDecompressLarge(const char *zCompressed, size_t compressedSize) {
-    if (!zCompressed || compressedSize < 6) return NULL;
-    
-    /* Check for zlib header */
-    if (strncmp(zCompressed, "ZLIB:", 5) != 0) {
-        /* Not compressed */
-        return sqlite3_mprintf("%s", zCompressed);
-    }
-    
-#if HAVE_ZLIB
-    /* Estimate decompressed size (could be stored in header) */
-    uLongf destLen = compressedSize * 10;
-    unsigned char *decompressed = sqlite3_malloc(destLen);
-    if (!decompressed) return NULL;
-    
-    /* Decompress */
-    int rc = uncompress(decompressed, &destLen,
-                       (const unsigned char*)zCompressed + 5,
-                       compressedSize - 5);
-    
-    if (rc != Z_OK) {
-        sqlite3_free(decompressed);
-        return NULL;
+static int dictRefresh(GraphDict *p) {
+    unsigned int iVersion = 0;
+
+    if (sqlite3_file_control(p->db, NULL, SQLITE_FCNTL_DATA_VERSION, &iVersion) != SQLITE_OK) {
+        iVersion = 0;
+    }
+    if (!p->bLoaded) {
+        p->iDataVersion = iVersion;
+        return dictLoad(p);
+    }
+    if (iVersion == p->iDataVersion) return SQLITE_OK;
+    p->iDataVersion = iVersion;
+    if (!p->bUnsure) return SQLITE_OK;
+#if HAVE_ZSTD
+    {
+        int i;
+        for (i = 0; i < ZDICT_NSLOT; i++) {
+            ZSTD_freeCDict(p->apCDict[i]);
+            ZSTD_freeDDict(p->apDDict[i]);
+            p->apCDict[i] = NULL;
+            p->apDDict[i] = NULL;
+        }
+        p->iZstdSlot = 0;
+        p->bZstdLoaded = 0;
     }
-    
-    /* Null terminate */
-    decompressed[destLen] = '\0';
-    
-    return (char*)decompressed;
-#else
-    /* Decompression not available, return error */
-    return NULL;
 #endif
+    return dictLoad(p);
 }
 
 /*
-** Get compression statistics
+** Decode a packed value into JSON text. *pzOut is sqlite3_malloc'd and
+** nul-terminated. Call dictRefresh() first.
 */
-void graphCompressionStats(sqlite3_int64 *pDictEntries,
-                          size_t *pDictMemory,
-                          size_t *pSavedBytes) {
-    if (!g_stringDict) return;
-    
-    sqlite3_mutex_enter(g_stringDict->mutex);
-    
-    if (pDictEntries) *pDictEntries = g_stringDict->nEntries;
-    if (pDictMemory) *pDictMemory = g_stringDict->totalSize;
-    if (pSavedBytes) *pSavedBytes = g_stringDict->savedBytes;
-    
-    sqlite3_mutex_leave(g_stringDict->mutex);
+static int unpackProperties(GraphDict *p, const unsigned char *a, int n,
+                            char **pzOut, int *pnOut) {
+    int eCodec = a[0] & 0x0f;
+    int rc = SQLITE_OK;
+
+    if (eCodec == GRAPH_PACK_TEXT) {
+        sqlite3_str *pOut = sqlite3_str_new(p->db);
+        int i = 1;
+        while (i < n && rc == SQLITE_OK) {
+            const unsigned char *pRef = memchr(a + i, PACK_REF, n - i);
+            int j = pRef ? (int)(pRef - a) : n;
+            sqlite3_uint64 id;
+            sqlite3_str_append(pOut, (const char*)a + i, j - i);
+            if (j == n) break;
+            i = j + 1;
+            if (!getVarint(a, n, &i, &id)) {
+                rc = SQLITE_CORRUPT;
+                break;
+            }
+            if (id > (sqlite3_uint64)p->nValue || !p->azValue[id]) {
+                /* Written by another connection since the last load */
+                rc = dictLoad(p);
+                if (rc == SQLITE_OK && (id > (sqlite3_uint64)p->nValue || !p->azValue[id])) {
+                    rc = SQLITE_CORRUPT;
+                }
+                if (rc != SQLITE_OK) break;
+            }
+            sqlite3_str_appendchar(pOut, 1, '"');
+            sqlite3_str_append(pOut, p->azValue[id], p->anValue[id]);
+            sqlite3_str_appendchar(pOut, 1, '"');
+        }
+        *pnOut = sqlite3_str_length(pOut);
+        *pzOut = sqlite3_str_finish(pOut);
+        if (rc == SQLITE_OK && !*pzOut) rc = SQLITE_NOMEM;
+        if (rc != SQLITE_OK) {
+            sqlite3_free(*pzOut);
+            *pzOut = NULL;
+        }
+        return rc;
+    }
+
+#if HAVE_ZSTD
+    if (eCodec == GRAPH_PACK_ZSTD) {
+        int iSlot = a[0] >> 4;
+        unsigned long long nRaw = ZSTD_getFrameContentSize(a + 1, n - 1);
+        size_t nGot;
+        char *z;
+
+        if (!p->bZstdLoaded || !p->apDDict[iSlot]) {
+            p->bZstdLoaded = 0;
+            rc = zstdLoad(p);
+            if (rc != SQLITE_OK) return rc;
+        }
+        if (!p->apDDict[iSlot] || nRaw == ZSTD_CONTENTSIZE_ERROR
+         || nRaw == ZSTD_CONTENTSIZE_UNKNOWN || nRaw > 0x7ffffffe) {
+            return SQLITE_CORRUPT;
+        }
+        if (!p->pDCtx && !(p->pDCtx = ZSTD_createDCtx())) return SQLITE_NOMEM;
+        z = sqlite3_malloc64(nRaw + 1);
+        if (!z) return SQLITE_NOMEM;
+        nGot = ZSTD_decompress_usingDDict(p->pDCtx, z, nRaw, a + 1, n - 1, p->apDDict[iSlot]);
+        if (ZSTD_isError(nGot) || nGot != nRaw) {
+            sqlite3_free(z);
+            return SQLITE_CORRUPT;
+        }
+        z[nRaw] = 0;
+        *pzOut = z;
+        *pnOut = (int)nRaw;
+        return SQLITE_OK;
+    }
+#endif
+
+#if HAVE_ZLIB
+    if (eCodec == GRAPH_PACK_ZLIB) {
+        int i = 1;
+        sqlite3_uint64 nRaw;
+        uLongf nGot;
+        char *z;
+
+        if (!getVarint(a, n, &i, &nRaw) || nRaw > 0x7ffffffe) return SQLITE_CORRUPT;
+        z = sqlite3_malloc64(nRaw + 1);
+        if (!z) return SQLITE_NOMEM;
+        nGot = (uLongf)nRaw;
+        if (uncompress((Bytef*)z, &nGot, a + i, n - i) != Z_OK || nGot != nRaw) {
+            sqlite3_free(z);
+            return SQLITE_CORRUPT;
+        }
+        z[nRaw] = 0;
+        *pzOut = z;
+        *pnOut = (int)nRaw;
+        return SQLITE_OK;
+    }
+#endif
+
+    /* A codec this build lacks */
+    return SQLITE_ERROR;
+}
+
+/* True if a BLOB is a packed property value rather than JSONB */
+static int isPacked(sqlite3_value *pVal) {
+    const unsigned char *a;
+    if (sqlite3_value_type(pVal) != SQLITE_BLOB || sqlite3_value_bytes(pVal) < 1) return 0;
+    a = sqlite3_value_blob(pVal);
+    return (a[0] & 0x0f) >= GRAPH_PACK_TEXT;
+}
+
+static GraphDict *dictForCall(sqlite3_context *ctx, sqlite3_value *pGraphName) {
+    const char *zGraph = (const char*)sqlite3_value_text(pGraphName);
+    GraphDict *p;
+    if (!zGraph) {
+        sqlite3_result_error(ctx, "graph name required", -1);
+        return NULL;
+    }
+    p = dictGet((GraphDictSet*)sqlite3_user_data(ctx), sqlite3_context_db_handle(ctx), zGraph);
+    if (!p) sqlite3_result_error_nomem(ctx);
+    return p;
+}
+
+static void unpackResult(sqlite3_context *ctx, GraphDict *p, sqlite3_value *pVal) {
+    char *z = NULL;
+    int n = 0;
+    int rc;
+    if ((rc = dictRefresh(p)) != SQLITE_OK) {
+        sqlite3_result_error_code(ctx, rc);
+        return;
+    }
+    rc = unpackProperties(p, sqlite3_value_blob(pVal), sqlite3_value_bytes(pVal), &z, &n);
+    if (rc == SQLITE_ERROR) {
+        sqlite3_result_error(ctx, "packed properties use a codec this build lacks", -1);
+    } else if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(ctx, rc);
+    } else {
+        sqlite3_result_text(ctx, z, n, sqlite3_free);
+        sqlite3_result_subtype(ctx, 'J');
+    }
+}
+
+/* graph_props(graph, value) */
+static void graphPropsFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    GraphDict *p;
+    (void)argc;
+    if (!isPacked(argv[1])) {
+        sqlite3_result_value(ctx, argv[1]);
+        return;
+    }
+    p = dictForCall(ctx, argv[0]);
+    if (p) unpackResult(ctx, p, argv[1]);
+}
+
+/* graph_pack(graph, value) */
+static void graphPackFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    GraphDict *p;
+    char *zText = NULL;
+    const char *z;
+    unsigned char *a = NULL;
+    int n, nOut = 0;
+    int rc;
+    (void)argc;
+
+    if (sqlite3_value_type(argv[1]) != SQLITE_TEXT && !isPacked(argv[1])) {
+        sqlite3_result_value(ctx, argv[1]);   /* NULL, numbers, JSONB */
+        return;
+    }
+    p = dictForCall(ctx, argv[0]);
+    if (!p) return;
+
+    if (isPacked(argv[1])) {
+        /* Repack, e.g. against a newly trained dictionary */
+        if ((rc = dictRefresh(p)) != SQLITE_OK) {
+            sqlite3_result_error_code(ctx, rc);
+            return;
+        }
+        rc = unpackProperties(p, sqlite3_value_blob(argv[1]), sqlite3_value_bytes(argv[1]),
+                              &zText, &n);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error_code(ctx, rc);
+            return;
+        }
+        z = zText;
+    } else {
+        z = (const char*)sqlite3_value_text(argv[1]);
+        n = sqlite3_value_bytes(argv[1]);
+    }
+
+    rc = packProperties(p, z, n, &a, &nOut);
+    sqlite3_free(zText);
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(ctx, rc);
+        return;
+    }
+    sqlite3_result_blob(ctx, a, nOut, sqlite3_free);
 }
 
 /*
-** SQL function to get compression statistics
+** graph_compress_train(graph [, samples]): train a zstd dictionary on
+** up to samples (default 10000) property documents of the graph's node
+** and edge tables, store it in the next free slot and return the slot.
+** Values packed from then on use it; existing rows can be repacked with
+** UPDATE <table> SET properties = graph_pack(<graph>, properties).
 */
-static void compressionStatsFunc(
-    sqlite3_context *context,
-    int argc,
-    sqlite3_value **argv
-) {
+static void graphCompressTrainFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+#if HAVE_ZSTD
+    GraphDict *p = dictForCall(ctx, argv[0]);
+    GraphVtab *pGraph;
+    const char *zNodes, *zEdges;
+    sqlite3_stmt *pStmt = NULL;
+    sqlite3_str *pSamples;
+    size_t *anSize = NULL;
+    int nSample = argc > 1 ? sqlite3_value_int(argv[1]) : 10000;
+    int nRow = 0, nAlloc = 0;
+    char *zSql;
+    char *zAll;
+    void *pDict = NULL;
+    size_t nDict;
+    int iSlot;
+    int rc;
+
+    if (!p) return;
+    if (nSample <= 0) nSample = 10000;
+    if (!p->bZstdLoaded && (rc = zstdLoad(p)) != SQLITE_OK) {
+        sqlite3_result_error_code(ctx, rc);
+        return;
+    }
+    iSlot = p->iZstdSlot + 1;
+    if (iSlot >= ZDICT_NSLOT) {
+        sqlite3_result_error(ctx, "all 15 zstd dictionary slots are in use", -1);
+        return;
+    }
+
+    /* Both tables are sampled through graph_props() so packed rows count */
+    pGraph = graphRegistryFind(sqlite3_context_db_handle(ctx), p->zGraph);
+    zNodes = pGraph ? pGraph->zNodeTableName : NULL;
+    zEdges = zNodes ? pGraph->zEdgeTableName : NULL;
+    zSql = zNodes
+        ? sqlite3_mprintf("SELECT graph_props(%Q, properties) FROM"
+                          " (SELECT properties FROM \"%w\" UNION ALL SELECT properties FROM \"%w\")"
+                          " WHERE properties IS NOT NULL ORDER BY random() LIMIT %d",
+                          p->zGraph, zNodes, zEdges, nSample)
+        : sqlite3_mprintf("SELECT graph_props(%Q, properties) FROM"
+                          " (SELECT properties FROM \"%w_nodes\" UNION ALL SELECT properties FROM \"%w_edges\")"
+                          " WHERE properties IS NOT NULL ORDER BY random() LIMIT %d",
+                          p->zGraph, p->zGraph, p->zGraph, nSample);
+    if (!zSql) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    rc = sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL);
+    sqlite3_free(zSql);
+    pSamples = sqlite3_str_new(p->db);
+    while (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
+        if (nRow == nAlloc) {
+            size_t *anNew;
+            nAlloc = nAlloc ? nAlloc * 2 : 1024;
+            anNew = sqlite3_realloc64(anSize, nAlloc * sizeof(size_t));
+            if (!anNew) { rc = SQLITE_NOMEM; break; }
+            anSize = anNew;
+        }
+        anSize[nRow++] = sqlite3_column_bytes(pStmt, 0);
+        sqlite3_str_append(pSamples, (const char*)sqlite3_column_text(pStmt, 0),
+                           sqlite3_column_bytes(pStmt, 0));
+    }
+    if (rc == SQLITE_OK) rc = sqlite3_finalize(pStmt);
+    else sqlite3_finalize(pStmt);
+    zAll = sqlite3_str_finish(pSamples);
+    if (rc == SQLITE_OK && nRow < 8) {
+        sqlite3_result_error(ctx, "too few property documents to train a dictionary", -1);
+        goto train_done;
+    }
+    if (rc == SQLITE_OK && !zAll) rc = SQLITE_NOMEM;
+    if (rc == SQLITE_OK && !(pDict = sqlite3_malloc(ZDICT_CAPACITY))) rc = SQLITE_NOMEM;
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error_code(ctx, rc);
+        goto train_done;
+    }
+    nDict = ZDICT_trainFromBuffer(pDict, ZDICT_CAPACITY, zAll, anSize, nRow);
+    if (ZDICT_isError(nDict)) {
+        sqlite3_result_error(ctx, ZDICT_getErrorName(nDict), -1);
+        goto train_done;
+    }
+
+    zSql = sqlite3_mprintf(
+        "CREATE TABLE IF NOT EXISTS \"%w_zdict\"(slot INTEGER PRIMARY KEY, dict BLOB NOT NULL)",
+        p->zGraph);
+    rc = zSql ? sqlite3_exec(p->db, zSql, NULL, NULL, NULL) : SQLITE_NOMEM;
+    sqlite3_free(zSql);
+    if (rc == SQLITE_OK) {
+        zSql = sqlite3_mprintf("INSERT INTO \"%w_zdict\"(slot, dict) VALUES(%d, ?1)", p->zGraph, iSlot);
+        rc = zSql ? sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL) : SQLITE_NOMEM;
+        sqlite3_free(zSql);
+        if (rc == SQLITE_OK) {
+            sqlite3_bind_blob(pStmt, 1, pDict, (int)nDict, SQLITE_STATIC);
+            sqlite3_step(pStmt);
+            rc = sqlite3_finalize(pStmt);
+        }
+    }
+    if (rc == SQLITE_OK) {
+        p->apCDict[iSlot] = ZSTD_createCDict(pDict, nDict, 3);
+        p->apDDict[iSlot] = ZSTD_createDDict(pDict, nDict);
+        p->iZstdSlot = iSlot;
+        p->bUnsure = 1;
+        sqlite3_result_int(ctx, iSlot);
+    } else {
+        sqlite3_result_error(ctx, sqlite3_errmsg(p->db), -1);
+    }
+
+train_done:
+    sqlite3_free(pDict);
+    sqlite3_free(zAll);
+    sqlite3_free(anSize);
+#else
     (void)argc;
     (void)argv;
-    sqlite3_int64 dictEntries = 0;
-    size_t dictMemory = 0, savedBytes = 0;
-    
-    graphCompressionStats(&dictEntries, &dictMemory, &savedBytes);
-    
-    double ratio = 0.0;
-    if (dictMemory > 0) {
-        ratio = (double)savedBytes / dictMemory * 100.0;
-    }
-    
-    char *result = sqlite3_mprintf(
-        "{\"dict_entries\":%lld,\"dict_memory\":%zu,"
-        "\"saved_bytes\":%zu,\"compression_ratio\":%.1f}",
-        dictEntries, dictMemory, savedBytes, ratio
-    );
-    
-    sqlite3_result_text(context, result, -1, sqlite3_free);
+    sqlite3_result_error(ctx, "graph_compress_train(): built without zstd (WITH_ZSTD=1)", -1);
+#endif
 }
 
 /*
-** Shutdown compression system
+** graph_compression_stats([graph]): dictionary sizes, the values packed
+** by each codec on this connection, and the stored property bytes
+** against their JSON size, dictionary tables included.
 */
-void graphCompressionShutdown(void) {
-    if (!g_stringDict) return;
-    
-    /* Free all dictionary entries */
-    for (int i = 0; i < g_stringDict->nBuckets; i++) {
-        DictEntry *entry = g_stringDict->buckets[i];
-        while (entry) {
-            DictEntry *next = entry->pNext;
-            sqlite3_free(entry->zValue);
-            sqlite3_free(entry);
-            entry = next;
+static void compressionStatsFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    GraphDict *p;
+    const char *zGraph = argc > 0 ? (const char*)sqlite3_value_text(argv[0]) : NULL;
+    GraphVtab *pGraph;
+    const char *zNodes, *zEdges;
+    sqlite3_stmt *pStmt = NULL;
+    sqlite3_int64 nRows = 0, nStored = 0, nJson = 0, nDictBytes = 0;
+    char *zSql;
+    int rc;
+
+    pGraph = graphRegistryFind(sqlite3_context_db_handle(ctx), zGraph);
+    if (!zGraph && pGraph) zGraph = pGraph->zTableName;
+    if (!zGraph) {
+        sqlite3_result_error(ctx, "No graph table available", -1);
+        return;
+    }
+    p = dictGet((GraphDictSet*)sqlite3_user_data(ctx), sqlite3_context_db_handle(ctx), zGraph);
+    if (!p) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    rc = p->bLoaded ? SQLITE_OK : dictLoad(p);
+    if (rc != SQLITE_OK) {
+        /* Not a compressed graph: no dictionary */
+        dictClear(p);
+        rc = SQLITE_OK;
+    }
+
+    if (pGraph) {
+        zNodes = pGraph->zNodeTableName;
+        zEdges = pGraph->zEdgeTableName;
+        zSql = sqlite3_mprintf(
+            "SELECT count(*), total(length(properties)),"
+            " total(length(CAST(graph_props(%Q, properties) AS BLOB)))"
+            " FROM (SELECT properties FROM \"%w\" UNION ALL SELECT properties FROM \"%w\")",
+            zGraph, zNodes, zEdges);
+    } else {
+        zSql = sqlite3_mprintf(
+            "SELECT count(*), total(length(properties)),"
+            " total(length(CAST(graph_props(%Q, properties) AS BLOB)))"
+            " FROM (SELECT properties FROM \"%w_nodes\" UNION ALL SELECT properties FROM \"%w_edges\")",
+            zGraph, zGraph, zGraph);
+    }
+    if (!zSql) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    if (sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL) == SQLITE_OK
+     && sqlite3_step(pStmt) == SQLITE_ROW) {
+        nRows = sqlite3_column_int64(pStmt, 0);
+        nStored = (sqlite3_int64)sqlite3_column_double(pStmt, 1);
+        nJson = (sqlite3_int64)sqlite3_column_double(pStmt, 2);
+    }
+    sqlite3_finalize(pStmt);
+    sqlite3_free(zSql);
+
+    zSql = sqlite3_mprintf("SELECT total(length(value)) + 8 * count(*) FROM \"%w_dict\"", zGraph);
+    if (zSql && sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL) == SQLITE_OK
+     && sqlite3_step(pStmt) == SQLITE_ROW) {
+        nDictBytes += (sqlite3_int64)sqlite3_column_double(pStmt, 0);
+    }
+    sqlite3_finalize(pStmt);
+    sqlite3_free(zSql);
+    pStmt = NULL;
+    zSql = sqlite3_mprintf("SELECT total(length(dict)) FROM \"%w_zdict\"", zGraph);
+    if (zSql && sqlite3_prepare_v2(p->db, zSql, -1, &pStmt, NULL) == SQLITE_OK
+     && sqlite3_step(pStmt) == SQLITE_ROW) {
+        nDictBytes += (sqlite3_int64)sqlite3_column_double(pStmt, 0);
+    }
+    sqlite3_finalize(pStmt);
+    sqlite3_free(zSql);
+
+    zSql = sqlite3_mprintf(
+        "{\"dict_entries\":%d,\"dict_bytes\":%lld,\"zstd_dictionaries\":%d,"
+        "\"packed_text\":%lld,\"packed_zstd\":%lld,\"packed_zlib\":%lld,"
+        "\"session_json_bytes\":%lld,\"session_packed_bytes\":%lld,"
+        "\"rows\":%lld,\"json_bytes\":%lld,\"stored_bytes\":%lld,"
+        "\"saved_bytes\":%lld,\"compression_ratio\":%.2f}",
+        p->nValue, nDictBytes, p->iZstdSlot,
+        p->anPacked[0], p->anPacked[1], p->anPacked[2],
+        p->nBytesIn, p->nBytesOut,
+        nRows, nJson, nStored, nJson - nStored - nDictBytes,
+        nStored + nDictBytes > 0 ? (double)nJson / (double)(nStored + nDictBytes) : 1.0);
+    if (!zSql) {
+        sqlite3_result_error_nomem(ctx);
+        return;
+    }
+    sqlite3_result_text(ctx, zSql, -1, sqlite3_free);
+}
+
+void graphCompressRelease(void *pCodec, const char *zGraph) {
+    GraphDictSet *pSet = (GraphDictSet*)pCodec;
+    GraphDict **pp;
+
+    if (!pSet || !zGraph) return;
+    for (pp = &pSet->pList; *pp; pp = &(*pp)->pNext) {
+        if (sqlite3_stricmp((*pp)->zGraph, zGraph) == 0) {
+            GraphDict *p = *pp;
+            *pp = p->pNext;
+            dictFree(p);
+            return;
         }
     }
-    
-    sqlite3_free(g_stringDict->buckets);
-    sqlite3_mutex_free(g_stringDict->mutex);
-    sqlite3_free(g_stringDict);
-    g_stringDict = NULL;
 }
 
 /*
-** Register compression SQL functions
+** Register compression SQL functions. The functions share one
+** per-connection GraphDictSet, freed with the connection; *ppCodec is
+** set to it for the graph module (graphCompressRelease()).
 */
-int graphRegisterCompressionFunctions(sqlite3 *db) {
-    return sqlite3_create_function(db, "graph_compression_stats", 0,
-                                  SQLITE_UTF8, NULL,
-                                  compressionStatsFunc, NULL, NULL);
-}
\ No newline at end of file
+int graphRegisterCompressionFunctions(sqlite3 *db, void **ppCodec) {
+    GraphDictSet *pSet = sqlite3_malloc(sizeof(GraphDictSet));
+    int rc;
+
+    if (!pSet) return SQLITE_NOMEM;
+    *ppCodec = pSet;
+    memset(pSet, 0, sizeof(*pSet));
+    rc = sqlite3_create_function_v2(db, "graph_props", 2,
+                                    SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS,
+                                    pSet, graphPropsFunc, NULL, NULL, dictSetFree);
+    if (rc != SQLITE_OK) return rc;
+    rc = sqlite3_create_function(db, "graph_pack", 2, SQLITE_UTF8, pSet,
+                                 graphPackFunc, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "graph_compress_train", -1, SQLITE_UTF8, pSet,
+                                     graphCompressTrainFunc, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "graph_compression_stats", -1, SQLITE_UTF8, pSet,
+                                     compressionStatsFunc, NULL, NULL);
+    }
+    return rc;
+}
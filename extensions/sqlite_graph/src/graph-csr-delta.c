@@ -0,0 +1,1081 @@
+/*
+** SQLite Graph Database Extension - CSR Write Overlay
+**
+** Dropping the CSR snapshot on every write would make a workload mixing
+** writes with traversals pay a full two-scan rebuild on the first read
+** after each write. Writes that know their effect on the adjacency
+** record it in a CSRDelta layered over the snapshot instead:
+**
+**   - per node and direction, the edges added since the build, listed
+**     after the row's snapshot edges in insertion order (a rebuild lists
+**     a row in edge index order; no caller depends on either);
+**   - tombstone bitmaps over the snapshot's out- and in-edge slots;
+**   - the nodes added since the build, numbered after the snapshot's,
+**     and a bitmap of deleted nodes whose edges no longer count;
+**   - the operations themselves, in order.
+**
+** Adjacency iterators (graphCSREdgeFirst()/Next()) merge a snapshot row
+** with the overlay as they go. Kernels that index the arrays directly
+** get a snapshot with the overlay folded in from graphCSRGet(); a fold
+** is one O(V+E) pass over memory and runs no SQL. Once the operation log
+** reaches CSR_COMPACT_MIN entries and 1/16 of the edge count, a fold is
+** started on the worker pool. When it has finished, the next writer or
+** reader swaps the folded snapshot in and replays over it the
+** operations logged in the meantime.
+**
+** Versions: graphCSRViewOpen() pins a snapshot and its overlay. Both are
+** reference counted, and a writer that finds the overlay pinned copies
+** it before changing it, so a view never changes under its reader. A
+** replaced version is freed by whichever of the GraphVtab, the views and
+** the compaction lets go of it last. Reference counts are only touched
+** on the connection's thread; the worker reads pinned versions only.
+**
+** A change the overlay cannot express (an edge to a node it does not
+** know, a deleted node id coming back, a delete it cannot match) drops
+** the snapshot, and the next read rebuilds it.
+**
+** Memory allocation: All arrays use sqlite3_malloc()/sqlite3_free()
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-performance.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define DELTA_BIT(A,I)  ((A)[(I)>>3] & (1<<((I)&7)))
+#define DELTA_SET(A,I)  ((A)[(I)>>3] |= (unsigned char)(1<<((I)&7)))
+
+/*
+** Growable open-addressed map from a 64-bit key to a non-negative int.
+*/
+typedef struct DeltaHash DeltaHash;
+struct DeltaHash {
+  sqlite3_int64 *aKey;         /* Key per slot */
+  int *aVal;                   /* Value per slot, -1 if empty */
+  int nBits;                   /* log2 of the slot count, 0 if none */
+  int nUsed;                   /* Occupied slots */
+};
+
+/* One logged write */
+typedef struct CSRDeltaOp CSRDeltaOp;
+struct CSRDeltaOp {
+  int eOp;                     /* CSR_OP_* */
+  sqlite3_int64 iFrom;         /* Node id, or edge source */
+  sqlite3_int64 iTo;           /* Edge target */
+  double rWeight;              /* Edge weight */
+};
+
+/* Edges added to one node since the build */
+typedef struct CSRDeltaAdj CSRDeltaAdj;
+struct CSRDeltaAdj {
+  CSRDeltaEdge *aOut;          /* Out-edges in insertion order */
+  int nOut, nOutAlloc;
+  CSRDeltaEdge *aIn;           /* In-edges in insertion order */
+  int nIn, nInAlloc;
+};
+
+struct CSRDelta {
+  int nRef;                    /* GraphVtab, views and compaction */
+  sqlite3_int64 *aNewId;       /* Added nodes, dense index nNodes+i */
+  int nNew, nNewAlloc;
+  DeltaHash newMap;            /* Added node id -> dense index */
+  unsigned char *aDeadNode;    /* Deleted nodes, bit per dense index */
+  int nDeadBytes;              /* Allocated size of aDeadNode */
+  unsigned char *aDeadOut;     /* Deleted snapshot out-edge slots */
+  unsigned char *aDeadIn;      /* Deleted snapshot in-edge slots */
+  sqlite3_int64 nSlotBytes;    /* Size of aDeadOut and aDeadIn */
+  CSRDeltaAdj *aAdj;           /* Added edges of the nodes that have any */
+  int nAdj, nAdjAlloc;
+  DeltaHash adjMap;            /* Dense index -> aAdj entry */
+  CSRDeltaOp *aOp;             /* Every write applied, in order */
+  int nOp, nOpAlloc;
+};
+
+/*
+** A fold running on the worker pool. The inputs are pinned, so the
+** overlay the writer keeps extending is a copy and nOp marks where the
+** fold's input ends in its log.
+*/
+struct CSRCompact {
+  CSRGraph *pBase;             /* Snapshot folded, referenced */
+  CSRDelta *pDelta;            /* Overlay folded, referenced */
+  int nOp;                     /* pDelta->nOp when the fold started */
+  TaskScheduler *pScheduler;   /* Keeps the pool running until adopted */
+  pthread_mutex_t mutex;       /* Guards bDone, rc and pNew */
+  pthread_cond_t done;         /* Signalled when bDone is set */
+  int bDone;                   /* The worker has finished */
+  int rc;                      /* Result of the fold */
+  CSRGraph *pNew;              /* Folded snapshot */
+};
+
+/*
+** Grow *pa to hold at least nNeed elements of szElem bytes.
+*/
+static int deltaGrow(void **pa, int *pnAlloc, int nNeed, int szElem){
+  int nNew;
+  void *aNew;
+
+  if( nNeed<=*pnAlloc ) return SQLITE_OK;
+  nNew = *pnAlloc ? *pnAlloc*2 : 8;
+  while( nNew<nNeed ) nNew *= 2;
+  aNew = sqlite3_realloc64(*pa, (sqlite3_uint64)nNew*szElem);
+  if( aNew==0 ) return SQLITE_NOMEM;
+  *pa = aNew;
+  *pnAlloc = nNew;
+  return SQLITE_OK;
+}
+
+/*
+** Return a copy of the n bytes at p in *pp. NULL copies to NULL.
+*/
+static int deltaDup(void **pp, const void *p, sqlite3_int64 n){
+  *pp = 0;
+  if( p==0 || n==0 ) return SQLITE_OK;
+  *pp = sqlite3_malloc64(n);
+  if( *pp==0 ) return SQLITE_NOMEM;
+  memcpy(*pp, p, n);
+  return SQLITE_OK;
+}
+
+static unsigned int deltaHashSlot(sqlite3_int64 iKey, int nBits){
+  sqlite3_uint64 h = (sqlite3_uint64)iKey * 0x9E3779B97F4A7C15ULL;
+  return (unsigned int)(h >> (64 - nBits));
+}
+
+static int deltaHashFind(const DeltaHash *p, sqlite3_int64 iKey){
+  unsigned int mask, h;
+
+  if( p->nBits==0 ) return -1;
+  mask = (1u << p->nBits) - 1;
+  h = deltaHashSlot(iKey, p->nBits);
+  while( p->aVal[h]>=0 ){
+    if( p->aKey[h]==iKey ) return p->aVal[h];
+    h = (h + 1) & mask;
+  }
+  return -1;
+}
+
+/*
+** Add iKey -> iVal to the map, which must not hold iKey yet. The table
+** doubles to keep the load factor at or below one half.
+*/
+static int deltaHashInsert(DeltaHash *p, sqlite3_int64 iKey, int iVal){
+  unsigned int mask, h;
+
+  if( ((sqlite3_int64)p->nUsed+1)*2 > ((sqlite3_int64)1 << p->nBits) ){
+    DeltaHash n;
+    int nSlot, i;
+
+    n.nBits = p->nBits ? p->nBits+1 : 4;
+    n.nUsed = 0;
+    nSlot = 1 << n.nBits;
+    n.aKey = sqlite3_malloc64(sizeof(sqlite3_int64)*nSlot);
+    n.aVal = sqlite3_malloc64(sizeof(int)*nSlot);
+    if( n.aKey==0 || n.aVal==0 ){
+      sqlite3_free(n.aKey);
+      sqlite3_free(n.aVal);
+      return SQLITE_NOMEM;
+    }
+    memset(n.aVal, 0xff, sizeof(int)*nSlot);
+    for(i=0; p->nBits && i<(1<<p->nBits); i++){
+      if( p->aVal[i]>=0 ){
+        h = deltaHashSlot(p->aKey[i], n.nBits);
+        while( n.aVal[h]>=0 ) h = (h + 1) & (unsigned int)(nSlot-1);
+        n.aKey[h] = p->aKey[i];
+        n.aVal[h] = p->aVal[i];
+        n.nUsed++;
+      }
+    }
+    sqlite3_free(p->aKey);
+    sqlite3_free(p->aVal);
+    *p = n;
+  }
+
+  mask = (1u << p->nBits) - 1;
+  h = deltaHashSlot(iKey, p->nBits);
+  while( p->aVal[h]>=0 ){
+    assert( p->aKey[h]!=iKey );
+    h = (h + 1) & mask;
+  }
+  p->aKey[h] = iKey;
+  p->aVal[h] = iVal;
+  p->nUsed++;
+  return SQLITE_OK;
+}
+
+static int deltaHashCopy(DeltaHash *pTo, const DeltaHash *pFrom){
+  sqlite3_int64 nSlot = pFrom->nBits ? ((sqlite3_int64)1 << pFrom->nBits) : 0;
+  int rc;
+
+  *pTo = *pFrom;
+  pTo->aVal = 0;
+  rc = deltaDup((void**)&pTo->aKey, pFrom->aKey, sizeof(sqlite3_int64)*nSlot);
+  if( rc==SQLITE_OK ){
+    rc = deltaDup((void**)&pTo->aVal, pFrom->aVal, sizeof(int)*nSlot);
+  }
+  return rc;
+}
+
+static void deltaHashClear(DeltaHash *p){
+  sqlite3_free(p->aKey);
+  sqlite3_free(p->aVal);
+  memset(p, 0, sizeof(*p));
+}
+
+static void deltaFree(CSRDelta *p){
+  int i;
+
+  if( p==0 ) return;
+  for(i=0; i<p->nAdj; i++){
+    sqlite3_free(p->aAdj[i].aOut);
+    sqlite3_free(p->aAdj[i].aIn);
+  }
+  sqlite3_free(p->aAdj);
+  deltaHashClear(&p->adjMap);
+  deltaHashClear(&p->newMap);
+  sqlite3_free(p->aNewId);
+  sqlite3_free(p->aDeadNode);
+  sqlite3_free(p->aDeadOut);
+  sqlite3_free(p->aDeadIn);
+  sqlite3_free(p->aOp);
+  sqlite3_free(p);
+}
+
+void graphCSRDeltaRelease(CSRDelta *pDelta){
+  if( pDelta && --pDelta->nRef<=0 ){
+    deltaFree(pDelta);
+  }
+}
+
+static CSRDelta *deltaNew(void){
+  CSRDelta *p = sqlite3_malloc(sizeof(*p));
+  if( p ){
+    memset(p, 0, sizeof(*p));
+    p->nRef = 1;
+  }
+  return p;
+}
+
+/*
+** Deep copy of p, for a writer that finds p pinned by a reader.
+*/
+static int deltaClone(const CSRDelta *p, CSRDelta **ppOut){
+  CSRDelta *pNew;
+  int rc, i;
+
+  *ppOut = 0;
+  pNew = deltaNew();
+  if( pNew==0 ) return SQLITE_NOMEM;
+  pNew->nNew = pNew->nNewAlloc = p->nNew;
+  pNew->nDeadBytes = p->nDeadBytes;
+  pNew->nSlotBytes = p->nSlotBytes;
+  pNew->nOp = pNew->nOpAlloc = p->nOp;
+  rc = deltaDup((void**)&pNew->aNewId, p->aNewId,
+                sizeof(sqlite3_int64)*p->nNew);
+  if( rc==SQLITE_OK ) rc = deltaHashCopy(&pNew->newMap, &p->newMap);
+  if( rc==SQLITE_OK ){
+    rc = deltaDup((void**)&pNew->aDeadNode, p->aDeadNode, p->nDeadBytes);
+  }
+  if( rc==SQLITE_OK && p->aDeadOut ){
+    rc = deltaDup((void**)&pNew->aDeadOut, p->aDeadOut, p->nSlotBytes);
+  }
+  if( rc==SQLITE_OK && p->aDeadIn ){
+    rc = deltaDup((void**)&pNew->aDeadIn, p->aDeadIn, p->nSlotBytes);
+  }
+  if( rc==SQLITE_OK ) rc = deltaHashCopy(&pNew->adjMap, &p->adjMap);
+  if( rc==SQLITE_OK ){
+    rc = deltaDup((void**)&pNew->aOp, p->aOp, sizeof(CSRDeltaOp)*p->nOp);
+  }
+  if( rc==SQLITE_OK && p->nAdj ){
+    pNew->aAdj = sqlite3_malloc64(sizeof(CSRDeltaAdj)*p->nAdj);
+    if( pNew->aAdj==0 ){
+      rc = SQLITE_NOMEM;
+    }else{
+      memset(pNew->aAdj, 0, sizeof(CSRDeltaAdj)*p->nAdj);
+      pNew->nAdj = pNew->nAdjAlloc = p->nAdj;
+    }
+  }
+  for(i=0; rc==SQLITE_OK && i<p->nAdj; i++){
+    const CSRDeltaAdj *pFrom = &p->aAdj[i];
+    CSRDeltaAdj *pTo = &pNew->aAdj[i];
+    rc = deltaDup((void**)&pTo->aOut, pFrom->aOut,
+                  sizeof(CSRDeltaEdge)*pFrom->nOut);
+    if( rc==SQLITE_OK ){
+      rc = deltaDup((void**)&pTo->aIn, pFrom->aIn,
+                    sizeof(CSRDeltaEdge)*pFrom->nIn);
+    }
+    if( rc==SQLITE_OK ){
+      pTo->nOut = pTo->nOutAlloc = pFrom->nOut;
+      pTo->nIn = pTo->nInAlloc = pFrom->nIn;
+    }
+  }
+  if( rc!=SQLITE_OK ){
+    deltaFree(pNew);
+    return rc;
+  }
+  *ppOut = pNew;
+  return SQLITE_OK;
+}
+
+static int deltaIsDead(const CSRDelta *p, int iNode){
+  return p && iNode < p->nDeadBytes*8 && DELTA_BIT(p->aDeadNode, iNode);
+}
+
+/*
+** Dense index of iNodeId in the snapshot pCSR overlaid by p, or -1.
+** Deleted nodes count as missing when bLive is set.
+*/
+static int deltaIndexOf(const CSRGraph *pCSR, const CSRDelta *p,
+                        sqlite3_int64 iNodeId, int bLive){
+  int iNode = graphCSRIndexOf(pCSR, iNodeId);
+  if( iNode<0 && p ) iNode = deltaHashFind(&p->newMap, iNodeId);
+  if( iNode>=0 && bLive && deltaIsDead(p, iNode) ) iNode = -1;
+  return iNode;
+}
+
+static CSRDeltaAdj *deltaAdjFind(const CSRDelta *p, int iNode){
+  int i = p ? deltaHashFind(&p->adjMap, iNode) : -1;
+  return i>=0 ? &p->aAdj[i] : 0;
+}
+
+/*
+** Append an added edge to the out- (bIn==0) or in-list of iNode.
+*/
+static int deltaAdjAppend(CSRDelta *p, int iNode, int bIn, int iNbr,
+                          double rWeight){
+  CSRDeltaAdj *pAdj = deltaAdjFind(p, iNode);
+  CSRDeltaEdge **paEdge;
+  int *pnEdge, *pnAlloc;
+  int rc;
+
+  if( pAdj==0 ){
+    rc = deltaGrow((void**)&p->aAdj, &p->nAdjAlloc, p->nAdj+1,
+                   sizeof(CSRDeltaAdj));
+    if( rc==SQLITE_OK ) rc = deltaHashInsert(&p->adjMap, iNode, p->nAdj);
+    if( rc!=SQLITE_OK ) return rc;
+    pAdj = &p->aAdj[p->nAdj++];
+    memset(pAdj, 0, sizeof(*pAdj));
+  }
+  paEdge = bIn ? &pAdj->aIn : &pAdj->aOut;
+  pnEdge = bIn ? &pAdj->nIn : &pAdj->nOut;
+  pnAlloc = bIn ? &pAdj->nInAlloc : &pAdj->nOutAlloc;
+  rc = deltaGrow((void**)paEdge, pnAlloc, *pnEdge+1, sizeof(CSRDeltaEdge));
+  if( rc!=SQLITE_OK ) return rc;
+  (*paEdge)[*pnEdge].iNbr = iNbr;
+  (*paEdge)[*pnEdge].rWeight = rWeight;
+  (*pnEdge)++;
+  return SQLITE_OK;
+}
+
+/*
+** Remove the first added edge of iNode to iNbr of weight rWeight (of any
+** weight if bAnyWeight) and return its weight in *prWeight. Returns 1 if
+** an edge was removed.
+*/
+static int deltaAdjRemove(CSRDelta *p, int iNode, int bIn, int iNbr,
+                          double rWeight, int bAnyWeight, double *prWeight){
+  CSRDeltaAdj *pAdj = deltaAdjFind(p, iNode);
+  CSRDeltaEdge *aEdge;
+  int *pnEdge;
+  int i;
+
+  if( pAdj==0 ) return 0;
+  aEdge = bIn ? pAdj->aIn : pAdj->aOut;
+  pnEdge = bIn ? &pAdj->nIn : &pAdj->nOut;
+  for(i=0; i<*pnEdge; i++){
+    if( aEdge[i].iNbr==iNbr && (bAnyWeight || aEdge[i].rWeight==rWeight) ){
+      *prWeight = aEdge[i].rWeight;
+      memmove(&aEdge[i], &aEdge[i+1], sizeof(CSRDeltaEdge)*(*pnEdge-i-1));
+      (*pnEdge)--;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** First live snapshot slot in the out- (bIn==0) or in-row of iNode that
+** reaches iNbr with weight rWeight (any weight if bAnyWeight), or -1.
+*/
+static sqlite3_int64 deltaFindSlot(const CSRGraph *pCSR, const CSRDelta *p,
+                                   int bIn, int iNode, int iNbr,
+                                   double rWeight, int bAnyWeight){
+  const sqlite3_int64 *aOff = bIn ? pCSR->inOffsets : pCSR->rowOffsets;
+  const int *aIdx = bIn ? pCSR->inIndices : pCSR->columnIndices;
+  const double *aW = bIn ? pCSR->inWeights : pCSR->edgeWeights;
+  const unsigned char *aDead = bIn ? p->aDeadIn : p->aDeadOut;
+  sqlite3_int64 k;
+
+  for(k=aOff[iNode]; k<aOff[iNode+1]; k++){
+    if( aIdx[k]==iNbr && (bAnyWeight || aW[k]==rWeight)
+     && (aDead==0 || !DELTA_BIT(aDead, k)) ){
+      return k;
+    }
+  }
+  return -1;
+}
+
+/*
+** Tombstone snapshot slot k of the out- (bIn==0) or in-edge arrays.
+*/
+static int deltaKillSlot(const CSRGraph *pCSR, CSRDelta *p, int bIn,
+                         sqlite3_int64 k){
+  unsigned char **paDead = bIn ? &p->aDeadIn : &p->aDeadOut;
+
+  if( *paDead==0 ){
+    p->nSlotBytes = (pCSR->nEdges + 7)/8;
+    *paDead = sqlite3_malloc64(p->nSlotBytes ? p->nSlotBytes : 1);
+    if( *paDead==0 ) return SQLITE_NOMEM;
+    memset(*paDead, 0, p->nSlotBytes);
+  }
+  DELTA_SET(*paDead, k);
+  return SQLITE_OK;
+}
+
+/*
+** Make the deleted-node bitmap cover dense indices 0..nNode-1.
+*/
+static int deltaDeadCover(CSRDelta *p, int nNode){
+  int nNeed = (nNode + 7)/8;
+  int nOld = p->nDeadBytes;
+  int rc = deltaGrow((void**)&p->aDeadNode, &p->nDeadBytes, nNeed, 1);
+  if( rc==SQLITE_OK && p->nDeadBytes>nOld ){
+    memset(&p->aDeadNode[nOld], 0, p->nDeadBytes - nOld);
+  }
+  return rc;
+}
+
+/*
+** Remove one edge iFrom -> iTo of weight rWeight, or all of them if
+** bAll. Returns SQLITE_NOTFOUND if a single edge the database held is
+** not in the overlaid snapshot.
+*/
+static int deltaDeleteEdges(const CSRGraph *pCSR, CSRDelta *p,
+                            const CSRDeltaOp *pOp, int bAll){
+  int iSrc = deltaIndexOf(pCSR, p, pOp->iFrom, 1);
+  int iDst = deltaIndexOf(pCSR, p, pOp->iTo, 1);
+  int nFound = 0;
+  int rc = SQLITE_OK;
+
+  /* An edge with a missing or deleted endpoint is not in the view */
+  if( iSrc<0 || iDst<0 ) return SQLITE_OK;
+
+  while( rc==SQLITE_OK ){
+    sqlite3_int64 kOut = -1, kIn;
+    double rWeight;
+
+    if( iSrc<pCSR->nNodes && iDst<pCSR->nNodes ){
+      kOut = deltaFindSlot(pCSR, p, 0, iSrc, iDst, pOp->rWeight, bAll);
+    }
+    if( kOut>=0 ){
+      rWeight = pCSR->edgeWeights[kOut];
+      kIn = deltaFindSlot(pCSR, p, 1, iDst, iSrc, rWeight, 0);
+      if( kIn<0 ) return SQLITE_NOTFOUND;
+      rc = deltaKillSlot(pCSR, p, 0, kOut);
+      if( rc==SQLITE_OK ) rc = deltaKillSlot(pCSR, p, 1, kIn);
+    }else if( deltaAdjRemove(p, iSrc, 0, iDst, pOp->rWeight, bAll,
+                             &rWeight) ){
+      if( !deltaAdjRemove(p, iDst, 1, iSrc, rWeight, 0, &rWeight) ){
+        return SQLITE_NOTFOUND;
+      }
+    }else{
+      break;
+    }
+    nFound++;
+    if( !bAll ) break;
+  }
+  if( rc==SQLITE_OK && nFound==0 && !bAll ) rc = SQLITE_NOTFOUND;
+  return rc;
+}
+
+/*
+** Apply one write to overlay p of snapshot pCSR and log it. Returns
+** SQLITE_NOTFOUND if the overlay cannot express it.
+*/
+static int deltaApply(const CSRGraph *pCSR, CSRDelta *p,
+                      const CSRDeltaOp *pOp){
+  int rc = SQLITE_OK;
+  int iSrc, iDst;
+
+  switch( pOp->eOp ){
+    case CSR_OP_ADD_NODE: {
+      int iNode = deltaIndexOf(pCSR, p, pOp->iFrom, 0);
+      if( iNode>=0 ){
+        /* An upsert that kept the node changes no adjacency; a deleted
+        ** id coming back would bring its old edges with it */
+        if( !deltaIsDead(p, iNode) ) break;
+        return SQLITE_NOTFOUND;
+      }
+      iNode = pCSR->nNodes + p->nNew;
+      rc = deltaGrow((void**)&p->aNewId, &p->nNewAlloc, p->nNew+1,
+                     sizeof(sqlite3_int64));
+      if( rc==SQLITE_OK ) rc = deltaDeadCover(p, iNode+1);
+      if( rc==SQLITE_OK ) rc = deltaHashInsert(&p->newMap, pOp->iFrom, iNode);
+      if( rc==SQLITE_OK ) p->aNewId[p->nNew++] = pOp->iFrom;
+      break;
+    }
+    case CSR_OP_DEL_NODE: {
+      int iNode = deltaIndexOf(pCSR, p, pOp->iFrom, 1);
+      if( iNode>=0 ){
+        rc = deltaDeadCover(p, pCSR->nNodes + p->nNew);
+        if( rc==SQLITE_OK ) DELTA_SET(p->aDeadNode, iNode);
+      }
+      break;
+    }
+    case CSR_OP_ADD_EDGE: {
+      /* A rebuild would drop the edge as dangling, then pick it up once
+      ** the node appeared; the overlay cannot do that */
+      iSrc = deltaIndexOf(pCSR, p, pOp->iFrom, 1);
+      iDst = deltaIndexOf(pCSR, p, pOp->iTo, 1);
+      if( iSrc<0 || iDst<0 ) return SQLITE_NOTFOUND;
+      rc = deltaAdjAppend(p, iSrc, 0, iDst, pOp->rWeight);
+      if( rc==SQLITE_OK ) rc = deltaAdjAppend(p, iDst, 1, iSrc, pOp->rWeight);
+      break;
+    }
+    case CSR_OP_DEL_EDGE:
+    case CSR_OP_DEL_EDGES:
+      rc = deltaDeleteEdges(pCSR, p, pOp, pOp->eOp==CSR_OP_DEL_EDGES);
+      break;
+    default:
+      assert( 0 );
+      return SQLITE_MISUSE;
+  }
+
+  if( rc==SQLITE_OK ){
+    rc = deltaGrow((void**)&p->aOp, &p->nOpAlloc, p->nOp+1,
+                   sizeof(CSRDeltaOp));
+    if( rc==SQLITE_OK ) p->aOp[p->nOp++] = *pOp;
+  }
+  return rc;
+}
+
+/*
+** Views and iteration
+*/
+
+int graphCSRViewIndexOf(const CSRView *pView, sqlite3_int64 iNodeId){
+  return deltaIndexOf(pView->pCSR, pView->pDelta, iNodeId, 1);
+}
+
+sqlite3_int64 graphCSRViewNodeId(const CSRView *pView, int iNode){
+  if( iNode<pView->pCSR->nNodes ) return pView->pCSR->aNodeIds[iNode];
+  return pView->pDelta->aNewId[iNode - pView->pCSR->nNodes];
+}
+
+int graphCSRViewNodeCount(const CSRView *pView){
+  return pView->pCSR->nNodes + (pView->pDelta ? pView->pDelta->nNew : 0);
+}
+
+int graphCSRDeltaOpCount(const CSRDelta *pDelta){
+  return pDelta ? pDelta->nOp : 0;
+}
+
+int graphCSRDeltaOp(const CSRDelta *pDelta, int iOp,
+                    sqlite3_int64 *piFrom, sqlite3_int64 *piTo){
+  const CSRDeltaOp *pOp = &pDelta->aOp[iOp];
+  assert( iOp>=0 && iOp<pDelta->nOp );
+  *piFrom = pOp->iFrom;
+  *piTo = pOp->iTo;
+  return pOp->eOp;
+}
+
+void graphCSREdgeFirst(const CSRView *pView, int iNode, int bIn,
+                       CSREdgeIter *pIter){
+  const CSRGraph *pCSR = pView->pCSR;
+  const CSRDeltaAdj *pAdj;
+
+  memset(pIter, 0, sizeof(*pIter));
+  pIter->pView = pView;
+  pIter->bIn = bIn;
+  if( iNode<0 || deltaIsDead(pView->pDelta, iNode) ) return;
+  if( iNode<pCSR->nNodes ){
+    const sqlite3_int64 *aOff = bIn ? pCSR->inOffsets : pCSR->rowOffsets;
+    pIter->k = aOff[iNode];
+    pIter->kEnd = aOff[iNode+1];
+  }
+  pAdj = deltaAdjFind(pView->pDelta, iNode);
+  if( pAdj ){
+    pIter->aAdd = bIn ? pAdj->aIn : pAdj->aOut;
+    pIter->nAdd = bIn ? pAdj->nIn : pAdj->nOut;
+  }
+}
+
+int graphCSREdgeNext(CSREdgeIter *pIter, int *piNbr, double *prWeight){
+  const CSRGraph *pCSR = pIter->pView->pCSR;
+  const CSRDelta *p = pIter->pView->pDelta;
+
+  while( pIter->k<pIter->kEnd ){
+    sqlite3_int64 k = pIter->k++;
+    int iNbr = pIter->bIn ? pCSR->inIndices[k] : pCSR->columnIndices[k];
+    if( p ){
+      const unsigned char *aDead = pIter->bIn ? p->aDeadIn : p->aDeadOut;
+      if( aDead && DELTA_BIT(aDead, k) ) continue;
+      if( deltaIsDead(p, iNbr) ) continue;
+    }
+    *piNbr = iNbr;
+    if( prWeight ){
+      *prWeight = pIter->bIn ? pCSR->inWeights[k] : pCSR->edgeWeights[k];
+    }
+    return 1;
+  }
+  while( pIter->iAdd<pIter->nAdd ){
+    const CSRDeltaEdge *pEdge = &pIter->aAdd[pIter->iAdd++];
+    if( deltaIsDead(p, pEdge->iNbr) ) continue;
+    *piNbr = pEdge->iNbr;
+    if( prWeight ) *prWeight = pEdge->rWeight;
+    return 1;
+  }
+  return 0;
+}
+
+int graphCSRViewDegree(const CSRView *pView, int iNode, int bIn){
+  CSREdgeIter it;
+  int iNbr, nDegree = 0;
+
+  if( pView->pDelta==0 ){
+    return bIn ? graphCSRInDegree(pView->pCSR, iNode)
+               : graphCSROutDegree(pView->pCSR, iNode);
+  }
+  graphCSREdgeFirst(pView, iNode, bIn, &it);
+  while( graphCSREdgeNext(&it, &iNbr, 0) ) nDegree++;
+  return nDegree;
+}
+
+/*
+** Folding
+*/
+
+typedef struct DeltaNewNode DeltaNewNode;
+struct DeltaNewNode {
+  sqlite3_int64 iId;           /* Node id */
+  int iNode;                   /* Dense index in the overlaid view */
+};
+
+static int deltaNewNodeCmp(const void *a, const void *b){
+  sqlite3_int64 x = ((const DeltaNewNode*)a)->iId;
+  sqlite3_int64 y = ((const DeltaNewNode*)b)->iId;
+  return x<y ? -1 : x>y;
+}
+
+/*
+** Build in *ppNew the snapshot that pCSR overlaid by p describes: live
+** nodes renumbered in ascending id order, tombstoned edges dropped and
+** added edges appended to their rows. Safe to run on a worker thread.
+*/
+static int deltaFold(const CSRGraph *pCSR, const CSRDelta *p,
+                     CSRGraph **ppNew){
+  CSRView view;
+  CSRGraph *pNew;
+  DeltaNewNode *aAdded = 0;
+  int *aMap = 0;               /* View dense index -> new index, or -1 */
+  int *aOrder = 0;             /* New index -> view dense index */
+  int nAll = pCSR->nNodes + p->nNew;
+  int nAdded = 0, nLive = 0;
+  int i, j, bIn;
+  int rc = SQLITE_NOMEM;
+
+  *ppNew = 0;
+  view.pCSR = (CSRGraph*)pCSR;
+  view.pDelta = (CSRDelta*)p;
+
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  aMap = sqlite3_malloc64(sizeof(int)*(nAll>0 ? nAll : 1));
+  aOrder = sqlite3_malloc64(sizeof(int)*(nAll>0 ? nAll : 1));
+  aAdded = sqlite3_malloc64(sizeof(DeltaNewNode)*(p->nNew>0 ? p->nNew : 1));
+  if( pNew==0 || aMap==0 || aOrder==0 || aAdded==0 ) goto fold_error;
+  memset(pNew, 0, sizeof(*pNew));
+
+  /* Live nodes in ascending id order: the snapshot's are sorted already,
+  ** the added ones are sorted here and merged in */
+  for(i=0; i<p->nNew; i++){
+    if( !deltaIsDead(p, pCSR->nNodes + i) ){
+      aAdded[nAdded].iId = p->aNewId[i];
+      aAdded[nAdded].iNode = pCSR->nNodes + i;
+      nAdded++;
+    }
+  }
+  qsort(aAdded, nAdded, sizeof(DeltaNewNode), deltaNewNodeCmp);
+  for(i=0, j=0; i<pCSR->nNodes || j<nAdded; ){
+    int iNode;
+    while( i<pCSR->nNodes && deltaIsDead(p, i) ) aMap[i++] = -1;
+    if( i<pCSR->nNodes
+     && (j>=nAdded || pCSR->aNodeIds[i]<aAdded[j].iId) ){
+      iNode = i++;
+    }else if( j<nAdded ){
+      iNode = aAdded[j++].iNode;
+    }else{
+      break;
+    }
+    aMap[iNode] = nLive;
+    aOrder[nLive++] = iNode;
+  }
+  for(i=0; i<p->nNew; i++){
+    if( deltaIsDead(p, pCSR->nNodes + i) ) aMap[pCSR->nNodes + i] = -1;
+  }
+
+  pNew->nNodes = nLive;
+  pNew->aNodeIds = sqlite3_malloc64(sizeof(sqlite3_int64)*(nLive>0 ? nLive : 1));
+  pNew->rowOffsets = sqlite3_malloc64(sizeof(sqlite3_int64)*(nLive+1));
+  pNew->inOffsets = sqlite3_malloc64(sizeof(sqlite3_int64)*(nLive+1));
+  if( !pNew->aNodeIds || !pNew->rowOffsets || !pNew->inOffsets ){
+    goto fold_error;
+  }
+  pNew->rowOffsets[0] = pNew->inOffsets[0] = 0;
+  for(j=0; j<nLive; j++){
+    pNew->aNodeIds[j] = graphCSRViewNodeId(&view, aOrder[j]);
+    pNew->rowOffsets[j+1] = pNew->rowOffsets[j]
+                          + graphCSRViewDegree(&view, aOrder[j], 0);
+    pNew->inOffsets[j+1] = pNew->inOffsets[j]
+                         + graphCSRViewDegree(&view, aOrder[j], 1);
+  }
+  pNew->nEdges = pNew->rowOffsets[nLive];
+  assert( pNew->inOffsets[nLive]==pNew->nEdges );
+
+  pNew->columnIndices = sqlite3_malloc64(sizeof(int)*(pNew->nEdges>0 ? pNew->nEdges : 1));
+  pNew->edgeWeights = sqlite3_malloc64(sizeof(double)*(pNew->nEdges>0 ? pNew->nEdges : 1));
+  pNew->inIndices = sqlite3_malloc64(sizeof(int)*(pNew->nEdges>0 ? pNew->nEdges : 1));
+  pNew->inWeights = sqlite3_malloc64(sizeof(double)*(pNew->nEdges>0 ? pNew->nEdges : 1));
+  if( !pNew->columnIndices || !pNew->edgeWeights
+   || !pNew->inIndices || !pNew->inWeights ){
+    goto fold_error;
+  }
+  for(bIn=0; bIn<2; bIn++){
+    const sqlite3_int64 *aOff = bIn ? pNew->inOffsets : pNew->rowOffsets;
+    int *aIdx = bIn ? pNew->inIndices : pNew->columnIndices;
+    double *aW = bIn ? pNew->inWeights : pNew->edgeWeights;
+    for(j=0; j<nLive; j++){
+      CSREdgeIter it;
+      sqlite3_int64 k = aOff[j];
+      int iNbr;
+      double rWeight;
+      graphCSREdgeFirst(&view, aOrder[j], bIn, &it);
+      while( graphCSREdgeNext(&it, &iNbr, &rWeight) ){
+        aIdx[k] = aMap[iNbr];
+        aW[k] = rWeight;
+        k++;
+      }
+    }
+  }
+
+  rc = graphIdMapBuild(&pNew->idMap, pNew->aNodeIds, pNew->nNodes);
+  if( rc!=SQLITE_OK ) goto fold_error;
+
+  sqlite3_free(aAdded);
+  sqlite3_free(aMap);
+  sqlite3_free(aOrder);
+  *ppNew = pNew;
+  return SQLITE_OK;
+
+fold_error:
+  sqlite3_free(aAdded);
+  sqlite3_free(aMap);
+  sqlite3_free(aOrder);
+  graphCSRFree(pNew);
+  return rc;
+}
+
+/*
+** Make pNew, the fold of the current snapshot with the first nOp logged
+** writes of the current overlay, the current snapshot: replay the rest
+** of the log over it and move the stamp across. Takes ownership of pNew.
+*/
+static int deltaSwap(GraphVtab *pVtab, CSRGraph *pNew, int nOp){
+  CSRGraph *pOld = pVtab->pCSR;
+  CSRDelta *pLive = pVtab->pCSRDelta;
+  CSRDelta *pRest = 0;
+  int rc = SQLITE_OK;
+  int i;
+
+  assert( pLive && pLive->nOp>=nOp );
+  for(i=nOp; rc==SQLITE_OK && i<pLive->nOp; i++){
+    if( pRest==0 && (pRest = deltaNew())==0 ){
+      rc = SQLITE_NOMEM;
+    }else{
+      rc = deltaApply(pNew, pRest, &pLive->aOp[i]);
+    }
+  }
+  if( rc!=SQLITE_OK ){
+    deltaFree(pRest);
+    graphCSRFree(pNew);
+    graphCSRInvalidate(pVtab);
+    return rc==SQLITE_NOTFOUND ? SQLITE_OK : rc;
+  }
+
+  pNew->nRef = 1;
+  pNew->iDataVersion = pOld->iDataVersion;
+  pNew->iFileVersion = pOld->iFileVersion;
+  pNew->nTotalChanges = pOld->nTotalChanges;
+  pNew->nUncounted = pOld->nUncounted;
+  pNew->iForeignVersion = pOld->iForeignVersion;
+  pNew->bUncommitted = pOld->bUncommitted;
+  pNew->iEpoch = pOld->iEpoch;
+  pNew->nUnsaved = pOld->nUnsaved<0 ? -1 : pOld->nUnsaved + nOp;
+  pVtab->pCSR = pNew;
+  pVtab->iCSRSerial++;
+  pVtab->pCSRDelta = pRest;
+  {
+    CSRView from, to;
+    from.pCSR = pOld;
+    from.pDelta = pLive;
+    to.pCSR = pNew;
+    to.pDelta = pRest;
+    graphColumnsRemap(pVtab, &from, &to);
+  }
+  graphComponentsReset(pVtab);    /* Dense indices have moved */
+  graphNbrSetsReset(pVtab);
+  graphReachReset(pVtab);
+  graphCSRRelease(pOld);
+  graphCSRDeltaRelease(pLive);
+  return SQLITE_OK;
+}
+
+/*
+** Background compaction
+*/
+
+static void deltaCompactTask(void *pArg){
+  CSRCompact *pJob = (CSRCompact*)pArg;
+  CSRGraph *pNew = 0;
+  int rc = deltaFold(pJob->pBase, pJob->pDelta, &pNew);
+
+  pthread_mutex_lock(&pJob->mutex);
+  pJob->pNew = pNew;
+  pJob->rc = rc;
+  pJob->bDone = 1;
+  pthread_cond_broadcast(&pJob->done);
+  pthread_mutex_unlock(&pJob->mutex);
+}
+
+/*
+** Start folding the overlay of pVtab on the worker pool once its log is
+** long enough. Failing to start is harmless: graphCSRGet() folds on
+** demand.
+*/
+static void deltaCompactStart(GraphVtab *pVtab){
+  CSRDelta *p = pVtab->pCSRDelta;
+  CSRCompact *pJob;
+  ParallelTask *pTask;
+
+  if( pVtab->pCSRCompact || p==0 || p->nOp<CSR_COMPACT_MIN
+   || p->nOp<pVtab->pCSR->nEdges/16 ){
+    return;
+  }
+  pJob = sqlite3_malloc(sizeof(*pJob));
+  pTask = sqlite3_malloc(sizeof(*pTask));
+  if( pJob==0 || pTask==0 ){
+    sqlite3_free(pJob);
+    sqlite3_free(pTask);
+    return;
+  }
+  memset(pJob, 0, sizeof(*pJob));
+  pJob->pScheduler = graphCreateTaskScheduler(1);
+  if( pJob->pScheduler==0 ){
+    sqlite3_free(pJob);
+    sqlite3_free(pTask);
+    return;
+  }
+  pthread_mutex_init(&pJob->mutex, 0);
+  pthread_cond_init(&pJob->done, 0);
+  pJob->pBase = pVtab->pCSR;
+  pJob->pBase->nRef++;
+  pJob->pDelta = p;
+  p->nRef++;                   /* The next write copies the overlay */
+  pJob->nOp = p->nOp;
+
+  memset(pTask, 0, sizeof(*pTask));
+  pTask->execute = deltaCompactTask;
+  pTask->arg = pJob;
+  pVtab->pCSRCompact = pJob;
+  graphScheduleTask(pJob->pScheduler, pTask);
+}
+
+/*
+** Collect the background fold of pVtab, if any: return at once if it is
+** still running unless bWait, and swap its result in if bAdopt and it is
+** still of use.
+*/
+static int deltaCompactFinish(GraphVtab *pVtab, int bWait, int bAdopt){
+  CSRCompact *pJob = pVtab->pCSRCompact;
+  int rc = SQLITE_OK;
+
+  if( pJob==0 ) return SQLITE_OK;
+  pthread_mutex_lock(&pJob->mutex);
+  if( !pJob->bDone && !bWait ){
+    pthread_mutex_unlock(&pJob->mutex);
+    return SQLITE_OK;
+  }
+  while( !pJob->bDone ) pthread_cond_wait(&pJob->done, &pJob->mutex);
+  pthread_mutex_unlock(&pJob->mutex);
+
+  pVtab->pCSRCompact = 0;
+  if( bAdopt && pJob->rc==SQLITE_OK
+   && pVtab->pCSR==pJob->pBase && pVtab->pCSRDelta ){
+    rc = deltaSwap(pVtab, pJob->pNew, pJob->nOp);
+    pJob->pNew = 0;
+  }
+  graphCSRFree(pJob->pNew);
+  graphCSRRelease(pJob->pBase);
+  graphCSRDeltaRelease(pJob->pDelta);
+  graphDestroyTaskScheduler(pJob->pScheduler);
+  pthread_cond_destroy(&pJob->done);
+  pthread_mutex_destroy(&pJob->mutex);
+  sqlite3_free(pJob);
+  return rc;
+}
+
+int graphCSRDeltaFold(GraphVtab *pVtab){
+  CSRGraph *pNew;
+  int rc;
+
+  rc = deltaCompactFinish(pVtab, 1, 1);
+  if( rc!=SQLITE_OK || pVtab->pCSRDelta==0 ) return rc;
+  rc = deltaFold(pVtab->pCSR, pVtab->pCSRDelta, &pNew);
+  if( rc!=SQLITE_OK ) return rc;
+  return deltaSwap(pVtab, pNew, pVtab->pCSRDelta->nOp);
+}
+
+void graphCSRDeltaDrop(GraphVtab *pVtab){
+  deltaCompactFinish(pVtab, 1, 0);
+  graphCSRDeltaRelease(pVtab->pCSRDelta);
+  pVtab->pCSRDelta = 0;
+}
+
+int graphCSRViewOpen(GraphVtab *pVtab, CSRView *pView){
+  CSRGraph *pCSR;
+  int rc;
+
+  memset(pView, 0, sizeof(*pView));
+  deltaCompactFinish(pVtab, 0, 1);
+  if( !graphCSRIsCurrent(pVtab) ){
+    rc = graphCSRGet(pVtab, &pCSR);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  pView->pCSR = pVtab->pCSR;
+  pView->pCSR->nRef++;
+  pView->pDelta = pVtab->pCSRDelta;
+  if( pView->pDelta ) pView->pDelta->nRef++;
+  return SQLITE_OK;
+}
+
+void graphCSRViewClose(CSRView *pView){
+  graphCSRDeltaRelease(pView->pDelta);
+  graphCSRRelease(pView->pCSR);
+  pView->pDelta = 0;
+  pView->pCSR = 0;
+}
+
+int graphCSRViewIsCurrent(GraphVtab *pVtab, const CSRView *pView){
+  return pView->pCSR!=0
+      && pVtab->pCSR==pView->pCSR
+      && pVtab->pCSRDelta==pView->pDelta
+      && graphCSRIsCurrent(pVtab);
+}
+
+int graphCSRViewFold(const CSRView *pView, CSRGraph **ppNew){
+  assert( pView->pDelta!=0 );
+  return deltaFold(pView->pCSR, pView->pDelta, ppNew);
+}
+
+/*
+** Tracked writes
+*/
+
+int graphCSRTrackBegin(GraphVtab *pVtab){
+  if( pVtab->bCSRTrack ){
+    /* Writes do not nest; if one ever does, stop trusting the snapshot */
+    testcase( pVtab->bCSRTrack );
+    pVtab->bCSRTrack = 0;
+    graphCSRInvalidate(pVtab);
+    return 0;
+  }
+  deltaCompactFinish(pVtab, 0, 1);
+  pVtab->bCSRTrack = graphCSRIsCurrent(pVtab);
+  return pVtab->bCSRTrack;
+}
+
+void graphCSRTrack(GraphVtab *pVtab, int eOp, sqlite3_int64 iFrom,
+                   sqlite3_int64 iTo, double rWeight){
+  CSRDeltaOp op;
+  CSRDelta *p = pVtab->pCSRDelta;
+  int rc = SQLITE_OK;
+
+  if( !pVtab->bCSRTrack ) return;
+  op.eOp = eOp;
+  op.iFrom = iFrom;
+  op.iTo = iTo;
+  op.rWeight = rWeight;
+
+  /* Copy on write while a view or the compaction holds the overlay */
+  if( p==0 ){
+    p = deltaNew();
+    if( p==0 ) rc = SQLITE_NOMEM;
+  }else if( p->nRef>1 ){
+    rc = deltaClone(pVtab->pCSRDelta, &p);
+  }
+  if( rc==SQLITE_OK && p!=pVtab->pCSRDelta ){
+    graphCSRDeltaRelease(pVtab->pCSRDelta);
+    pVtab->pCSRDelta = p;
+  }
+  if( rc==SQLITE_OK && eOp==CSR_OP_DEL_NODE ){
+    graphColumnsTouch(pVtab, iFrom, 1);
+  }
+  if( rc==SQLITE_OK ) rc = deltaApply(pVtab->pCSR, p, &op);
+  if( rc==SQLITE_OK && eOp==CSR_OP_ADD_NODE ){
+    graphColumnsTouch(pVtab, iFrom, 0);
+  }
+  if( rc!=SQLITE_OK ){
+    pVtab->bCSRTrack = 0;
+    graphCSRInvalidate(pVtab);
+  }
+}
+
+void graphCSRTrackEdgeRow(GraphVtab *pVtab, int eOp, sqlite3_int64 iEdgeId){
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  if( !pVtab->bCSRTrack ) return;
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_EDGE_BY_ID, &pStmt);
+  if( rc==SQLITE_OK ){
+    sqlite3_bind_int64(pStmt, 1, iEdgeId);
+    rc = sqlite3_step(pStmt);
+    if( rc==SQLITE_ROW ){
+      graphCSRTrack(pVtab, eOp, sqlite3_column_int64(pStmt, 0),
+                    sqlite3_column_int64(pStmt, 1),
+                    sqlite3_column_double(pStmt, 2));
+      rc = SQLITE_OK;
+    }else if( rc==SQLITE_DONE ){
+      /* Deleting a missing edge changes nothing; adding one must exist */
+      rc = eOp==CSR_OP_ADD_EDGE ? SQLITE_NOTFOUND : SQLITE_OK;
+    }
+    graphStmtRelease(pVtab, pStmt);
+  }
+  if( rc!=SQLITE_OK ){
+    pVtab->bCSRTrack = 0;
+    graphCSRInvalidate(pVtab);
+  }
+}
+
+void graphCSRTrackEnd(GraphVtab *pVtab, int rc, int nUncounted){
+  CSRGraph *pCSR = pVtab->pCSR;
+
+  if( !pVtab->bCSRTrack ) return;
+  pVtab->bCSRTrack = 0;
+  if( rc!=SQLITE_OK || graphCSRStampWrite(pVtab, nUncounted)!=SQLITE_OK ){
+    graphCSRInvalidate(pVtab);
+    return;
+  }
+
+  /* Properties may have changed; graphAStar() rereads coordinates */
+  graphCSRCoordsSet(pCSR, 0);
+  graphColumnsSync(pVtab);
+
+  deltaCompactStart(pVtab);
+}
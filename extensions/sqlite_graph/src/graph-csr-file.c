@@ -0,0 +1,466 @@
+/*
+** SQLite Graph Database Extension - Persisted CSR Snapshots
+**
+** A graph created with the csr_file=<path> module argument keeps a copy
+** of its CSR snapshot in a sidecar file laid out for mmap(). A process
+** that finds the file current maps it read-only instead of rebuilding
+** the snapshot from the edge table, and processes mapping the same file
+** share its pages.
+**
+** File layout (native byte order, every section 64-byte aligned):
+**
+**   CSRFileHeader                    128 bytes
+**   aNodeIds                         nNodes x int64
+**   rowOffsets, inOffsets            (nNodes+1) x int64 each
+**   columnIndices, inIndices         nEdges x int32 each
+**   edgeWeights, inWeights           nEdges x double each
+**   id map slots                     2^nSlotBits x int32
+**
+** Validity: triggers on the backing tables bump <graph>_csr.generation
+** in the writing transaction, so every committed change to nodes or
+** edges, by any path or process, moves it. The header records the
+** generation, a random per-graph instance id and PRAGMA schema_version
+** (backing tables recreated, triggers suspended by a bulk load); the
+** file is used only if all three still match. A checksum over the whole
+** file guards against torn or foreign files.
+**
+** Writes: the file is written to a temporary name and renamed over the
+** old one, so a process that has the old file mapped keeps a consistent
+** copy. Only committed snapshots are written: after a build from SQL,
+** and after enough tracked writes have been folded in to be worth it.
+**
+** Memory allocation: A loaded snapshot's arrays point into the mapping,
+**                    released by graphCSRFree() through graphCSRFileUnmap()
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-metrics.h"
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CSR_FILE_MAGIC      "GRAPHCSR"
+#define CSR_FILE_FORMAT     1
+#define CSR_FILE_BYTE_ORDER 0x01020304
+#define CSR_FILE_ALIGN      64
+
+/*
+** First 128 bytes of a CSR file.
+*/
+typedef struct CSRFileHeader CSRFileHeader;
+struct CSRFileHeader {
+  char zMagic[8];                /* CSR_FILE_MAGIC, not NUL terminated */
+  unsigned int iByteOrder;       /* CSR_FILE_BYTE_ORDER as stored */
+  unsigned int iFormat;          /* CSR_FILE_FORMAT */
+  sqlite3_int64 iInstance;       /* <graph>_csr.instance */
+  sqlite3_int64 iGeneration;     /* <graph>_csr.generation */
+  sqlite3_int64 iSchemaVersion;  /* PRAGMA schema_version */
+  sqlite3_int64 nNodes;          /* CSRGraph.nNodes */
+  sqlite3_int64 nEdges;          /* CSRGraph.nEdges */
+  sqlite3_int64 nSlotBits;       /* GraphIdMap.nBits */
+  sqlite3_int64 nFile;           /* Size of the whole file */
+  unsigned int aChecksum[2];     /* Over the file, with this field zero */
+  unsigned char aPad[128 - 80];
+};
+
+/*
+** Sections in file order, computed from the header counts.
+*/
+#define CSR_SEC_NODE_IDS   0
+#define CSR_SEC_ROW_OFF    1
+#define CSR_SEC_IN_OFF     2
+#define CSR_SEC_COL_IDX    3
+#define CSR_SEC_IN_IDX     4
+#define CSR_SEC_OUT_W      5
+#define CSR_SEC_IN_W       6
+#define CSR_SEC_SLOTS      7
+#define CSR_SEC_COUNT      8
+
+static sqlite3_int64 csrFileAlign(sqlite3_int64 n){
+  return (n + CSR_FILE_ALIGN - 1) & ~(sqlite3_int64)(CSR_FILE_ALIGN - 1);
+}
+
+/*
+** Fill aOff[] with the offset of every section and return the file size.
+*/
+static sqlite3_int64 csrFileLayout(sqlite3_int64 nNodes, sqlite3_int64 nEdges,
+                                   int nSlotBits, sqlite3_int64 *aOff,
+                                   sqlite3_int64 *aSize){
+  sqlite3_int64 iOff = sizeof(CSRFileHeader);
+  int i;
+
+  aSize[CSR_SEC_NODE_IDS] = nNodes*8;
+  aSize[CSR_SEC_ROW_OFF] = (nNodes+1)*8;
+  aSize[CSR_SEC_IN_OFF] = (nNodes+1)*8;
+  aSize[CSR_SEC_COL_IDX] = nEdges*4;
+  aSize[CSR_SEC_IN_IDX] = nEdges*4;
+  aSize[CSR_SEC_OUT_W] = nEdges*8;
+  aSize[CSR_SEC_IN_W] = nEdges*8;
+  aSize[CSR_SEC_SLOTS] = ((sqlite3_int64)1 << nSlotBits)*4;
+  for(i=0; i<CSR_SEC_COUNT; i++){
+    aOff[i] = iOff;
+    iOff = csrFileAlign(iOff + aSize[i]);
+  }
+  return iOff;
+}
+
+/*
+** Running checksum over n bytes (a multiple of 8), in the style of the
+** SQLite WAL checksum: two 32-bit sums, each feeding the other.
+*/
+static void csrFileChecksum(const void *p, sqlite3_int64 n,
+                            unsigned int *aSum){
+  const unsigned int *a = (const unsigned int*)p;
+  const unsigned int *aEnd = a + n/4;
+  unsigned int s1 = aSum[0], s2 = aSum[1];
+
+  assert( (n & 7)==0 );
+  while( a<aEnd ){
+    s1 += a[0] + s2;
+    s2 += a[1] + s1;
+    a += 2;
+  }
+  aSum[0] = s1;
+  aSum[1] = s2;
+}
+
+/*
+** Resolve the csr_file= path of pVtab: relative paths are taken from
+** the directory of the database file. Caller frees the result.
+*/
+static char *csrFilePath(GraphVtab *pVtab){
+  const char *zDbFile;
+  const char *zSlash;
+
+  if( pVtab->zCSRFile[0]=='/' ) return sqlite3_mprintf("%s", pVtab->zCSRFile);
+  zDbFile = sqlite3_db_filename(pVtab->pDb, pVtab->zDbName);
+  zSlash = zDbFile ? strrchr(zDbFile, '/') : 0;
+  if( zSlash==0 ) return sqlite3_mprintf("%s", pVtab->zCSRFile);
+  return sqlite3_mprintf("%.*s/%s", (int)(zSlash - zDbFile), zDbFile,
+                         pVtab->zCSRFile);
+}
+
+/*
+** Read the tag the database currently gives pVtab's snapshot, which a
+** CSR file must match to be used. Fails if the graph has no <graph>_csr
+** table (csr_file= could not set it up).
+*/
+int graphCSRFileTag(GraphVtab *pVtab, CSRFileTag *pTag){
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  memset(pTag, 0, sizeof(*pTag));
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_CSR_TAG, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    pTag->iInstance = sqlite3_column_int64(pStmt, 0);
+    pTag->iGeneration = sqlite3_column_int64(pStmt, 1);
+  }else{
+    rc = SQLITE_CORRUPT;
+  }
+  graphStmtRelease(pVtab, pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_SCHEMA_VERSION, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    pTag->iSchemaVersion = sqlite3_column_int64(pStmt, 0);
+  }else{
+    rc = SQLITE_ERROR;
+  }
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
+}
+
+int graphCSRFileInit(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  if( pVtab->zCSRFile==0 && !pVtab->bResultPersist ) return SQLITE_OK;
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w\".\"%w_csr\"("
+      "instance INTEGER NOT NULL, generation INTEGER NOT NULL);"
+      "INSERT INTO \"%w\".\"%w_csr\"(instance, generation)"
+      " SELECT random(), 0"
+      " WHERE NOT EXISTS (SELECT 1 FROM \"%w\".\"%w_csr\");"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_csr_ni\" AFTER INSERT ON \"%w\""
+      " BEGIN UPDATE \"%w_csr\" SET generation=generation+1; END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_csr_nd\" AFTER DELETE ON \"%w\""
+      " BEGIN UPDATE \"%w_csr\" SET generation=generation+1; END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_csr_nu\""
+      " AFTER UPDATE OF id ON \"%w\""
+      " BEGIN UPDATE \"%w_csr\" SET generation=generation+1; END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_csr_ei\" AFTER INSERT ON \"%w\""
+      " BEGIN UPDATE \"%w_csr\" SET generation=generation+1; END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_csr_ed\" AFTER DELETE ON \"%w\""
+      " BEGIN UPDATE \"%w_csr\" SET generation=generation+1; END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_csr_eu\""
+      " AFTER UPDATE OF id, source, target, weight ON \"%w\""
+      " BEGIN UPDATE \"%w_csr\" SET generation=generation+1; END;",
+      pVtab->zDbName, pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+int graphCSRFileDrop(GraphVtab *pVtab){
+  char *zSql;
+  char *zPath;
+  int rc;
+
+  if( pVtab->zCSRFile==0 && !pVtab->bResultPersist ) return SQLITE_OK;
+  zSql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\".\"%w_csr\"",
+                         pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK && pVtab->zCSRFile && (zPath = csrFilePath(pVtab))!=0 ){
+    unlink(zPath);
+    sqlite3_free(zPath);
+  }
+  return rc;
+}
+
+/*
+** Map the file at zPath and check it against pTag. Returns the mapping
+** in *ppMap and *pnMap, or leaves *ppMap NULL if the file is missing,
+** stale or damaged.
+*/
+static void csrFileMap(const char *zPath, const CSRFileTag *pTag,
+                       void **ppMap, sqlite3_int64 *pnMap){
+  CSRFileHeader hdr;
+  sqlite3_int64 aOff[CSR_SEC_COUNT], aSize[CSR_SEC_COUNT];
+  unsigned int aSum[2] = {0, 0};
+  struct stat st;
+  void *pMap;
+  int fd;
+
+  *ppMap = 0;
+  fd = open(zPath, O_RDONLY);
+  if( fd<0 ) return;
+  if( fstat(fd, &st)<0 || st.st_size<(off_t)sizeof(hdr)
+   || pread(fd, &hdr, sizeof(hdr), 0)!=(ssize_t)sizeof(hdr) ){
+    close(fd);
+    return;
+  }
+  if( memcmp(hdr.zMagic, CSR_FILE_MAGIC, 8)!=0
+   || hdr.iByteOrder!=CSR_FILE_BYTE_ORDER
+   || hdr.iFormat!=CSR_FILE_FORMAT
+   || hdr.iInstance!=pTag->iInstance
+   || hdr.iGeneration!=pTag->iGeneration
+   || hdr.iSchemaVersion!=pTag->iSchemaVersion
+   || hdr.nNodes<0 || hdr.nNodes>=INT_MAX
+   || hdr.nEdges<0 || hdr.nSlotBits<4 || hdr.nSlotBits>32
+   || hdr.nFile!=(sqlite3_int64)st.st_size
+   || csrFileLayout(hdr.nNodes, hdr.nEdges, (int)hdr.nSlotBits,
+                    aOff, aSize)!=hdr.nFile ){
+    close(fd);
+    return;
+  }
+
+  pMap = mmap(0, (size_t)hdr.nFile, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if( pMap==MAP_FAILED ) return;
+  csrFileChecksum(pMap, offsetof(CSRFileHeader, aChecksum), aSum);
+  csrFileChecksum((const char*)pMap + sizeof(hdr), hdr.nFile - sizeof(hdr),
+                  aSum);
+  if( aSum[0]!=hdr.aChecksum[0] || aSum[1]!=hdr.aChecksum[1] ){
+    munmap(pMap, (size_t)hdr.nFile);
+    return;
+  }
+  *ppMap = pMap;
+  *pnMap = hdr.nFile;
+}
+
+int graphCSRFileLoad(GraphVtab *pVtab, CSRGraph **ppCSR){
+  const CSRFileHeader *pHdr;
+  sqlite3_int64 aOff[CSR_SEC_COUNT], aSize[CSR_SEC_COUNT];
+  CSRFileTag tag;
+  CSRGraph *pNew;
+  char *zPath;
+  char *pMap;
+  sqlite3_int64 nMap;
+
+  *ppCSR = 0;
+  if( pVtab->zCSRFile==0 || graphCSRFileTag(pVtab, &tag)!=SQLITE_OK ){
+    return SQLITE_OK;
+  }
+  zPath = csrFilePath(pVtab);
+  if( zPath==0 ) return SQLITE_NOMEM;
+  csrFileMap(zPath, &tag, (void**)&pMap, &nMap);
+  sqlite3_free(zPath);
+  if( pMap==0 ) return SQLITE_OK;
+
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    munmap(pMap, (size_t)nMap);
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pHdr = (const CSRFileHeader*)pMap;
+  csrFileLayout(pHdr->nNodes, pHdr->nEdges, (int)pHdr->nSlotBits, aOff, aSize);
+  pNew->nNodes = (int)pHdr->nNodes;
+  pNew->nEdges = pHdr->nEdges;
+  pNew->aNodeIds = (sqlite3_int64*)&pMap[aOff[CSR_SEC_NODE_IDS]];
+  pNew->rowOffsets = (sqlite3_int64*)&pMap[aOff[CSR_SEC_ROW_OFF]];
+  pNew->inOffsets = (sqlite3_int64*)&pMap[aOff[CSR_SEC_IN_OFF]];
+  pNew->columnIndices = (int*)&pMap[aOff[CSR_SEC_COL_IDX]];
+  pNew->inIndices = (int*)&pMap[aOff[CSR_SEC_IN_IDX]];
+  pNew->edgeWeights = (double*)&pMap[aOff[CSR_SEC_OUT_W]];
+  pNew->inWeights = (double*)&pMap[aOff[CSR_SEC_IN_W]];
+  pNew->idMap.aKey = pNew->aNodeIds;
+  pNew->idMap.aSlot = (int*)&pMap[aOff[CSR_SEC_SLOTS]];
+  pNew->idMap.nBits = (int)pHdr->nSlotBits;
+  pNew->pMap = pMap;
+  pNew->nMap = nMap;
+  *ppCSR = pNew;
+  graphMetricAdd(GRAPH_METRIC_CSR_FILE_LOADS, 1);
+  return SQLITE_OK;
+}
+
+void graphCSRFileUnmap(CSRGraph *pCSR){
+  munmap(pCSR->pMap, (size_t)pCSR->nMap);
+  pCSR->pMap = 0;
+}
+
+/*
+** Write n bytes at p to fd, then zero padding up to the next section
+** boundary.
+*/
+static int csrFileWriteSection(int fd, const void *p, sqlite3_int64 n){
+  static const unsigned char aZero[CSR_FILE_ALIGN] = {0};
+  const char *z = (const char*)p;
+  sqlite3_int64 nPad = csrFileAlign(n) - n;
+
+  while( n>0 ){
+    ssize_t nDone = write(fd, z, n>(1<<24) ? (1<<24) : (size_t)n);
+    if( nDone<0 && errno==EINTR ) continue;
+    if( nDone<=0 ) return SQLITE_IOERR_WRITE;
+    z += nDone;
+    n -= nDone;
+  }
+  if( nPad>0 && write(fd, aZero, (size_t)nPad)!=(ssize_t)nPad ){
+    return SQLITE_IOERR_WRITE;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Write pCSR to zPath, tagged with pTag.
+*/
+static int csrFileWrite(const char *zPath, const CSRGraph *pCSR,
+                        const CSRFileTag *pTag){
+  sqlite3_int64 aOff[CSR_SEC_COUNT], aSize[CSR_SEC_COUNT];
+  const void *aSec[CSR_SEC_COUNT];
+  CSRFileHeader hdr;
+  char *zTmp;
+  int rc = SQLITE_OK;
+  int fd;
+  int i;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.zMagic, CSR_FILE_MAGIC, 8);
+  hdr.iByteOrder = CSR_FILE_BYTE_ORDER;
+  hdr.iFormat = CSR_FILE_FORMAT;
+  hdr.iInstance = pTag->iInstance;
+  hdr.iGeneration = pTag->iGeneration;
+  hdr.iSchemaVersion = pTag->iSchemaVersion;
+  hdr.nNodes = pCSR->nNodes;
+  hdr.nEdges = pCSR->nEdges;
+  hdr.nSlotBits = pCSR->idMap.nBits;
+  hdr.nFile = csrFileLayout(hdr.nNodes, hdr.nEdges, pCSR->idMap.nBits,
+                            aOff, aSize);
+  aSec[CSR_SEC_NODE_IDS] = pCSR->aNodeIds;
+  aSec[CSR_SEC_ROW_OFF] = pCSR->rowOffsets;
+  aSec[CSR_SEC_IN_OFF] = pCSR->inOffsets;
+  aSec[CSR_SEC_COL_IDX] = pCSR->columnIndices;
+  aSec[CSR_SEC_IN_IDX] = pCSR->inIndices;
+  aSec[CSR_SEC_OUT_W] = pCSR->edgeWeights;
+  aSec[CSR_SEC_IN_W] = pCSR->inWeights;
+  aSec[CSR_SEC_SLOTS] = pCSR->idMap.aSlot;
+
+  /* Checksum the sections as laid out, padding included */
+  csrFileChecksum(&hdr, offsetof(CSRFileHeader, aChecksum), hdr.aChecksum);
+  for(i=0; i<CSR_SEC_COUNT; i++){
+    sqlite3_int64 nBody = aSize[i] & ~(sqlite3_int64)7;
+    csrFileChecksum(aSec[i], nBody, hdr.aChecksum);
+    if( csrFileAlign(aSize[i])>nBody ){
+      unsigned char aTail[CSR_FILE_ALIGN];
+      memset(aTail, 0, sizeof(aTail));
+      memcpy(aTail, (const char*)aSec[i] + nBody, aSize[i] - nBody);
+      csrFileChecksum(aTail, csrFileAlign(aSize[i]) - nBody, hdr.aChecksum);
+    }
+  }
+
+  zTmp = sqlite3_mprintf("%s-%d.tmp", zPath, (int)getpid());
+  if( zTmp==0 ) return SQLITE_NOMEM;
+  fd = open(zTmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if( fd<0 ){
+    sqlite3_free(zTmp);
+    return SQLITE_CANTOPEN;
+  }
+  rc = csrFileWriteSection(fd, &hdr, sizeof(hdr));
+  for(i=0; rc==SQLITE_OK && i<CSR_SEC_COUNT; i++){
+    rc = csrFileWriteSection(fd, aSec[i], aSize[i]);
+  }
+  if( close(fd)!=0 && rc==SQLITE_OK ) rc = SQLITE_IOERR_CLOSE;
+  if( rc==SQLITE_OK && rename(zTmp, zPath)!=0 ) rc = SQLITE_IOERR;
+  if( rc!=SQLITE_OK ) unlink(zTmp);
+  sqlite3_free(zTmp);
+  return rc;
+}
+
+void graphCSRFileSync(GraphVtab *pVtab){
+  CSRGraph *pCSR = pVtab->pCSR;
+  CSRFileTag tag;
+  char *zPath;
+
+  if( pVtab->zCSRFile==0 || pCSR==0 || pVtab->pCSRDelta ) return;
+  if( pCSR->nUnsaved>=0 && (pCSR->nUnsaved<CSR_COMPACT_MIN
+                            || pCSR->nUnsaved<pCSR->nEdges/16) ){
+    return;
+  }
+  /* Uncommitted data would be tagged with a generation a rollback reuses */
+  if( sqlite3_txn_state(pVtab->pDb, pVtab->zDbName)==SQLITE_TXN_WRITE ){
+    return;
+  }
+  if( graphCSRFileTag(pVtab, &tag)!=SQLITE_OK ) return;
+  /* The tag read may have seen a commit the snapshot has not */
+  if( !graphCSRIsCurrent(pVtab) || pCSR->bUncommitted ) return;
+
+  zPath = csrFilePath(pVtab);
+  if( zPath==0 ) return;
+  if( csrFileWrite(zPath, pCSR, &tag)==SQLITE_OK ){
+    graphMetricAdd(GRAPH_METRIC_CSR_FILE_SAVES, 1);
+  }
+  sqlite3_free(zPath);
+  pCSR->nUnsaved = 0;  /* Saved, or not worth retrying for this snapshot */
+}
@@ -0,0 +1,655 @@
+/*
+** SQLite Graph Database Extension - CSR Adjacency Snapshot
+**
+** This file builds and caches the compressed sparse row view of a graph.
+** The snapshot is read once from the backing tables and then shared by
+** every traversal and algorithm entry point until the data changes.
+**
+** Build cost: Two sequential table scans plus O(V + E) array work
+** Staleness: Checked per use against the vtab data version counter,
+**            SQLITE_FCNTL_DATA_VERSION (commits by other connections)
+**            and sqlite3_total_changes() (direct SQL on this connection).
+**            Tracked writes restamp the snapshot rather than stale it
+**            and record their effect in the write overlay
+**            (graph-csr-delta.c); see csrStampMatches().
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-metrics.h"
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+
+/* Guards CSRGraph.pCoords and CSRCoords.nRef of every snapshot */
+static pthread_mutex_t g_coordsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+** Grow a dynamic array to hold at least nNeed elements of szElem bytes.
+** Returns SQLITE_OK or SQLITE_NOMEM. *pnAlloc is updated on success.
+*/
+static int csrGrow(void **pa, sqlite3_int64 *pnAlloc, sqlite3_int64 nNeed,
+                   int szElem){
+  sqlite3_int64 nNew;
+  void *aNew;
+
+  if( nNeed<=*pnAlloc ) return SQLITE_OK;
+  nNew = *pnAlloc ? *pnAlloc*2 : 64;
+  while( nNew<nNeed ) nNew *= 2;
+  aNew = sqlite3_realloc64(*pa, (sqlite3_uint64)nNew*szElem);
+  if( aNew==0 ){
+    testcase( aNew==0 );  /* Out of memory */
+    return SQLITE_NOMEM;
+  }
+  *pa = aNew;
+  *pnAlloc = nNew;
+  return SQLITE_OK;
+}
+
+/*
+** Bucket nEdges (key, value, weight) triples by key into a CSR layout.
+** aOffsets must hold nNodes+1 zeroed entries on entry.
+*/
+static int csrScatter(int nNodes, sqlite3_int64 nEdges,
+                      const int *aKey, const int *aVal, const double *aW,
+                      sqlite3_int64 *aOffsets, int *aIndices,
+                      double *aWeights){
+  sqlite3_int64 *aCursor;
+  sqlite3_int64 i;
+
+  for( i=0; i<nEdges; i++ ){
+    aOffsets[aKey[i]+1]++;
+  }
+  for( i=0; i<nNodes; i++ ){
+    aOffsets[i+1] += aOffsets[i];
+  }
+
+  aCursor = sqlite3_malloc64(sizeof(sqlite3_int64)*(nNodes>0 ? nNodes : 1));
+  if( aCursor==0 ) return SQLITE_NOMEM;
+  memcpy(aCursor, aOffsets, sizeof(sqlite3_int64)*nNodes);
+  for( i=0; i<nEdges; i++ ){
+    sqlite3_int64 iSlot = aCursor[aKey[i]]++;
+    aIndices[iSlot] = aVal[i];
+    aWeights[iSlot] = aW[i];
+  }
+  sqlite3_free(aCursor);
+  return SQLITE_OK;
+}
+
+/*
+** Free a snapshot and all arrays it owns.
+*/
+void graphCSRFree(CSRGraph *pCSR){
+  if( pCSR ){
+    if( pCSR->pMap ){
+      graphCSRFileUnmap(pCSR);
+    }else{
+      sqlite3_free(pCSR->rowOffsets);
+      sqlite3_free(pCSR->columnIndices);
+      sqlite3_free(pCSR->edgeWeights);
+      sqlite3_free(pCSR->inOffsets);
+      sqlite3_free(pCSR->inIndices);
+      sqlite3_free(pCSR->inWeights);
+      graphIdMapClear(&pCSR->idMap);
+      sqlite3_free(pCSR->aNodeIds);
+    }
+    graphCSRCoordsRelease(pCSR->pCoords);
+    sqlite3_free(pCSR);
+  }
+}
+
+/*
+** Fibonacci hash of a node id down to nBits bits. Multiplying by 2^64/phi
+** spreads sequential and snowflake-style ids alike across the table.
+*/
+static unsigned int csrIdHash(sqlite3_int64 iId, int nBits){
+  sqlite3_uint64 h = (sqlite3_uint64)iId * 0x9E3779B97F4A7C15ULL;
+  return (unsigned int)(h >> (64 - nBits));
+}
+
+int graphIdMapBuild(GraphIdMap *pMap, const sqlite3_int64 *aKey, int nKey){
+  sqlite3_int64 nSlot;
+  unsigned int mask;
+  int nBits = 4;
+  int i;
+
+  memset(pMap, 0, sizeof(*pMap));
+  /* Keep the load factor at or below one half */
+  while( ((sqlite3_int64)1<<nBits) < (sqlite3_int64)nKey*2 ) nBits++;
+  nSlot = (sqlite3_int64)1<<nBits;
+  mask = (unsigned int)(nSlot - 1);
+
+  pMap->aSlot = sqlite3_malloc64(sizeof(int)*nSlot);
+  if( pMap->aSlot==0 ) return SQLITE_NOMEM;
+  memset(pMap->aSlot, 0xff, sizeof(int)*nSlot);  /* -1 == empty */
+  pMap->aKey = aKey;
+  pMap->nBits = nBits;
+
+  for(i=0; i<nKey; i++){
+    unsigned int h = csrIdHash(aKey[i], nBits);
+    while( pMap->aSlot[h]>=0 ){
+      assert( aKey[pMap->aSlot[h]]!=aKey[i] );
+      h = (h + 1) & mask;
+    }
+    pMap->aSlot[h] = i;
+  }
+  return SQLITE_OK;
+}
+
+int graphIdMapLookup(const GraphIdMap *pMap, sqlite3_int64 iId){
+  unsigned int mask;
+  unsigned int h;
+  int iSlot;
+
+  if( pMap->aSlot==0 ) return -1;
+  mask = (unsigned int)(((sqlite3_uint64)1 << pMap->nBits) - 1);
+  h = csrIdHash(iId, pMap->nBits);
+  while( (iSlot = pMap->aSlot[h])>=0 ){
+    if( pMap->aKey[iSlot]==iId ) return iSlot;
+    h = (h + 1) & mask;
+  }
+  return -1;
+}
+
+void graphIdMapClear(GraphIdMap *pMap){
+  sqlite3_free(pMap->aSlot);
+  memset(pMap, 0, sizeof(*pMap));
+}
+
+/*
+** Hash lookup through the snapshot's id map.
+*/
+int graphCSRIndexOf(const CSRGraph *pCSR, sqlite3_int64 iNodeId){
+  if( pCSR==0 ) return -1;
+  return graphIdMapLookup(&pCSR->idMap, iNodeId);
+}
+
+/*
+** Build a CSR snapshot from the backing tables.
+*/
+int graphCSRBuild(sqlite3 *pDb, const char *zNodeTable,
+                  const char *zEdgeTable, CSRGraph **ppCSR){
+  char *zNodeSql;
+  char *zEdgeSql;
+  int rc = SQLITE_NOMEM;
+
+  *ppCSR = 0;
+  zNodeSql = sqlite3_mprintf("SELECT id FROM %s ORDER BY id", zNodeTable);
+  zEdgeSql = sqlite3_mprintf(
+      "SELECT source, target, coalesce(weight, 1.0) FROM %s", zEdgeTable);
+  if( zNodeSql && zEdgeSql ){
+    rc = graphCSRBuildQuery(pDb, zNodeSql, zEdgeSql, ppCSR);
+  }
+  sqlite3_free(zNodeSql);
+  sqlite3_free(zEdgeSql);
+  return rc;
+}
+
+/*
+** Build a CSR snapshot from a node id query and an edge query.
+** Memory allocation: All arrays allocated with sqlite3_malloc64().
+** Returns: SQLITE_OK, SQLITE_NOMEM, SQLITE_TOOBIG or a prepare error.
+*/
+int graphCSRBuildQuery(sqlite3 *pDb, const char *zNodeSql,
+                       const char *zEdgeSql, CSRGraph **ppCSR){
+  CSRGraph *pNew;
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+  sqlite3_int64 nIdAlloc = 0;
+  sqlite3_int64 nNodes = 0;
+  int *aSrc = 0;
+  int *aDst = 0;
+  double *aW = 0;
+  sqlite3_int64 nSrcAlloc = 0, nDstAlloc = 0, nWAlloc = 0;
+  sqlite3_int64 nEdges = 0;
+  sqlite3_int64 iStart = graphMetricsClock();
+
+  assert( ppCSR!=0 );
+  *ppCSR = 0;
+
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ) return SQLITE_NOMEM;
+  memset(pNew, 0, sizeof(*pNew));
+
+  /* Pass 1: node ids in ascending order define the dense numbering */
+  rc = sqlite3_prepare_v2(pDb, zNodeSql, -1, &pStmt, 0);
+  if( rc!=SQLITE_OK ) goto csr_build_error;
+
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    if( nNodes>=INT_MAX ){
+      rc = SQLITE_TOOBIG;
+      goto csr_build_error;
+    }
+    rc = csrGrow((void**)&pNew->aNodeIds, &nIdAlloc, nNodes+1,
+                 sizeof(sqlite3_int64));
+    if( rc!=SQLITE_OK ) goto csr_build_error;
+    pNew->aNodeIds[nNodes++] = sqlite3_column_int64(pStmt, 0);
+  }
+  rc = sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( rc!=SQLITE_OK ) goto csr_build_error;
+  pNew->nNodes = (int)nNodes;
+  rc = graphIdMapBuild(&pNew->idMap, pNew->aNodeIds, pNew->nNodes);
+  if( rc!=SQLITE_OK ) goto csr_build_error;
+
+  /* Pass 2: edge list mapped to dense indices, dangling edges dropped */
+  rc = sqlite3_prepare_v2(pDb, zEdgeSql, -1, &pStmt, 0);
+  if( rc!=SQLITE_OK ) goto csr_build_error;
+
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    int iSrc = graphCSRIndexOf(pNew, sqlite3_column_int64(pStmt, 0));
+    int iDst = graphCSRIndexOf(pNew, sqlite3_column_int64(pStmt, 1));
+    if( iSrc<0 || iDst<0 ){
+      testcase( iSrc<0 );  /* Edge references a missing node */
+      continue;
+    }
+    rc = csrGrow((void**)&aSrc, &nSrcAlloc, nEdges+1, sizeof(int));
+    if( rc==SQLITE_OK ){
+      rc = csrGrow((void**)&aDst, &nDstAlloc, nEdges+1, sizeof(int));
+    }
+    if( rc==SQLITE_OK ){
+      rc = csrGrow((void**)&aW, &nWAlloc, nEdges+1, sizeof(double));
+    }
+    if( rc!=SQLITE_OK ) goto csr_build_error;
+    aSrc[nEdges] = iSrc;
+    aDst[nEdges] = iDst;
+    aW[nEdges] = sqlite3_column_double(pStmt, 2);
+    nEdges++;
+  }
+  rc = sqlite3_finalize(pStmt);
+  pStmt = 0;
+  if( rc!=SQLITE_OK ) goto csr_build_error;
+  pNew->nEdges = nEdges;
+
+  /* Pass 3: counting sort into out- and in-adjacency */
+  pNew->rowOffsets = sqlite3_malloc64(sizeof(sqlite3_int64)*(nNodes+1));
+  pNew->inOffsets = sqlite3_malloc64(sizeof(sqlite3_int64)*(nNodes+1));
+  pNew->columnIndices = sqlite3_malloc64(sizeof(int)*(nEdges>0 ? nEdges : 1));
+  pNew->inIndices = sqlite3_malloc64(sizeof(int)*(nEdges>0 ? nEdges : 1));
+  pNew->edgeWeights = sqlite3_malloc64(sizeof(double)*(nEdges>0 ? nEdges : 1));
+  pNew->inWeights = sqlite3_malloc64(sizeof(double)*(nEdges>0 ? nEdges : 1));
+  if( !pNew->rowOffsets || !pNew->inOffsets || !pNew->columnIndices
+   || !pNew->inIndices || !pNew->edgeWeights || !pNew->inWeights ){
+    rc = SQLITE_NOMEM;
+    goto csr_build_error;
+  }
+  memset(pNew->rowOffsets, 0, sizeof(sqlite3_int64)*(nNodes+1));
+  memset(pNew->inOffsets, 0, sizeof(sqlite3_int64)*(nNodes+1));
+
+  rc = csrScatter(pNew->nNodes, nEdges, aSrc, aDst, aW,
+                  pNew->rowOffsets, pNew->columnIndices, pNew->edgeWeights);
+  if( rc==SQLITE_OK ){
+    rc = csrScatter(pNew->nNodes, nEdges, aDst, aSrc, aW,
+                    pNew->inOffsets, pNew->inIndices, pNew->inWeights);
+  }
+  if( rc!=SQLITE_OK ) goto csr_build_error;
+
+  sqlite3_free(aSrc);
+  sqlite3_free(aDst);
+  sqlite3_free(aW);
+  *ppCSR = pNew;
+  graphMetricAdd(GRAPH_METRIC_CSR_BUILDS, 1);
+  graphMetricAdd(GRAPH_METRIC_CSR_BUILD_US, graphMetricsClock() - iStart);
+  return SQLITE_OK;
+
+csr_build_error:
+  sqlite3_finalize(pStmt);
+  sqlite3_free(aSrc);
+  sqlite3_free(aDst);
+  sqlite3_free(aW);
+  graphCSRFree(pNew);
+  return rc;
+}
+
+sqlite3_int64 graphCSRBytes(const CSRGraph *pCSR){
+  sqlite3_int64 nNodes = pCSR->nNodes;
+  sqlite3_int64 nEdges = pCSR->nEdges>0 ? pCSR->nEdges : 1;
+  sqlite3_int64 nByte = sizeof(*pCSR);
+
+  nByte += 2*sizeof(sqlite3_int64)*(nNodes+1);         /* Offsets */
+  nByte += 2*(sizeof(int) + sizeof(double))*nEdges;     /* Both directions */
+  nByte += sizeof(sqlite3_int64)*nNodes;                /* aNodeIds */
+  if( pCSR->idMap.aSlot ){
+    nByte += sizeof(int)*((sqlite3_int64)1 << pCSR->idMap.nBits);
+  }
+  pthread_mutex_lock(&g_coordsMutex);
+  if( pCSR->pCoords ) nByte += 2*sizeof(double)*nNodes;
+  pthread_mutex_unlock(&g_coordsMutex);
+  return nByte;
+}
+
+CSRCoords *graphCSRCoordsGet(CSRGraph *pCSR, const char *zX, const char *zY){
+  CSRCoords *p;
+
+  pthread_mutex_lock(&g_coordsMutex);
+  p = pCSR->pCoords;
+  if( p && strcmp(p->zX, zX)==0 && strcmp(p->zY, zY)==0 ){
+    p->nRef++;
+  }else{
+    p = 0;
+  }
+  pthread_mutex_unlock(&g_coordsMutex);
+  return p;
+}
+
+void graphCSRCoordsSet(CSRGraph *pCSR, CSRCoords *pCoords){
+  CSRCoords *pOld;
+
+  pthread_mutex_lock(&g_coordsMutex);
+  pOld = pCSR->pCoords;
+  pCSR->pCoords = pCoords;
+  if( pCoords ) pCoords->nRef++;
+  pthread_mutex_unlock(&g_coordsMutex);
+  graphCSRCoordsRelease(pOld);
+}
+
+void graphCSRCoordsRelease(CSRCoords *pCoords){
+  int nRef;
+
+  if( pCoords==0 ) return;
+  pthread_mutex_lock(&g_coordsMutex);
+  nRef = --pCoords->nRef;
+  pthread_mutex_unlock(&g_coordsMutex);
+  if( nRef<=0 ){
+    sqlite3_free(pCoords->zX);
+    sqlite3_free(pCoords->zY);
+    sqlite3_free(pCoords->aX);
+    sqlite3_free(pCoords->aY);
+    sqlite3_free(pCoords);
+  }
+}
+
+/*
+** Read the external change indicators for pVtab's database.
+*/
+void graphDataStamp(GraphVtab *pVtab, unsigned int *piFileVersion,
+                    int *pnTotalChanges){
+  unsigned int iFileVersion = 0;
+
+  if( sqlite3_file_control(pVtab->pDb, pVtab->zDbName,
+                           SQLITE_FCNTL_DATA_VERSION,
+                           &iFileVersion)!=SQLITE_OK ){
+    iFileVersion = 0;
+  }
+  *piFileVersion = iFileVersion;
+  *pnTotalChanges = sqlite3_total_changes(pVtab->pDb);
+}
+
+/*
+** Run single-value statement eStmt of pVtab (binding iArg to ?1 if
+** bBind) and return its result in *piVal, or 0 if it returned no row.
+*/
+static int csrStmtValue(GraphVtab *pVtab, int eStmt, int bBind,
+                        sqlite3_int64 iArg, sqlite3_int64 *piVal){
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  *piVal = 0;
+  rc = graphStmtAcquire(pVtab, eStmt, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  if( bBind ) sqlite3_bind_int64(pStmt, 1, iArg);
+  rc = sqlite3_step(pStmt);
+  if( rc==SQLITE_ROW ){
+    *piVal = sqlite3_column_int64(pStmt, 0);
+    rc = SQLITE_OK;
+  }else if( rc==SQLITE_DONE ){
+    rc = SQLITE_OK;
+  }
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
+}
+
+/*
+** Commits by other connections since the database was opened. Unlike
+** SQLITE_FCNTL_DATA_VERSION this does not move on this connection's
+** own commits.
+*/
+static int csrForeignVersion(GraphVtab *pVtab, int *piVersion){
+  sqlite3_int64 iVal;
+  int rc = csrStmtValue(pVtab, GRAPH_STMT_DATA_VERSION, 0, 0, &iVal);
+  *piVersion = (int)iVal;
+  return rc;
+}
+
+/*
+** Create the TEMP epoch table of pVtab if this connection has none yet.
+** Only done outside explicit transactions: a schema change inside one
+** makes a later ROLLBACK TO reset every schema on the connection, which
+** disconnects the graph tables along with it.
+*/
+static void csrEpochCreate(GraphVtab *pVtab){
+  char *zSql;
+
+  if( pVtab->bCSREpoch || !sqlite3_get_autocommit(pVtab->pDb) ) return;
+  zSql = sqlite3_mprintf(
+      "CREATE TEMP TABLE IF NOT EXISTS \"%w_%w_csr_epoch\""
+      "(k INTEGER PRIMARY KEY, v INTEGER)",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return;
+  if( sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0)==SQLITE_OK ){
+    pVtab->bCSREpoch = 1;
+  }
+  sqlite3_free(zSql);
+}
+
+/*
+** Write a fresh epoch to the TEMP epoch row of pVtab. The row changes
+** inside the current transaction, so a rollback (or ROLLBACK TO) that
+** takes back a tracked write takes the epoch back with it. Fails if
+** the table could not be created yet, leaving the write untracked.
+*/
+static int csrEpochWrite(GraphVtab *pVtab, sqlite3_int64 *piEpoch){
+  static sqlite3_int64 iNextEpoch = 0;
+  sqlite3_int64 iEpoch = __atomic_add_fetch(&iNextEpoch, 1, __ATOMIC_RELAXED);
+  sqlite3_int64 iLastRowid = sqlite3_last_insert_rowid(pVtab->pDb);
+  sqlite3_int64 iUnused;
+  int rc;
+
+  if( !pVtab->bCSREpoch ) return SQLITE_ERROR;
+  rc = csrStmtValue(pVtab, GRAPH_STMT_EPOCH_SET, 1, iEpoch, &iUnused);
+  if( rc!=SQLITE_OK ) pVtab->bCSREpoch = 0;  /* Dropped by the user */
+  /* The caller's write is the one last_insert_rowid() should report */
+  sqlite3_set_last_insert_rowid(pVtab->pDb, iLastRowid);
+  *piEpoch = iEpoch;
+  return rc;
+}
+
+/*
+** True if the cached snapshot of pVtab, with its overlay, reflects the
+** database as of the given change indicators.
+**
+** Writes on this connection move nTotalChanges; tracked writes restamp
+** the snapshot, anything else makes it stale. A tracked write inside a
+** transaction needs more care: rolling the transaction back moves no
+** counter at all, and committing it moves iFileVersion just as a commit
+** by another connection does. So the stamp of such a write also holds
+** the epoch it wrote to a TEMP table, which a rollback restores to an
+** older value, and the other connections' commit count, which tells
+** this connection's commit from theirs.
+*/
+static int csrStampMatches(GraphVtab *pVtab, unsigned int iFileVersion,
+                           int nTotalChanges){
+  CSRGraph *pCur = pVtab->pCSR;
+  sqlite3_int64 iEpoch;
+  int iForeign;
+
+  if( pCur==0 || pCur->iDataVersion!=pVtab->iDataVersion ) return 0;
+  if( pCur->nTotalChanges!=nTotalChanges ){
+    /* The vtab statement that made tracked writes has completed */
+    if( pCur->nUncounted==0
+     || nTotalChanges - pCur->nTotalChanges!=pCur->nUncounted ){
+      return 0;
+    }
+    pCur->nTotalChanges = nTotalChanges;
+    pCur->nUncounted = 0;
+  }
+  if( !pCur->bUncommitted ) return pCur->iFileVersion==iFileVersion;
+
+  if( csrStmtValue(pVtab, GRAPH_STMT_EPOCH_GET, 0, 0, &iEpoch)!=SQLITE_OK
+   || iEpoch!=pCur->iEpoch ){
+    testcase( iEpoch!=pCur->iEpoch );  /* Rolled back */
+    return 0;
+  }
+  if( pCur->iFileVersion==iFileVersion ) return 1;  /* Still open */
+
+  /* Committed, by this connection alone if no other one committed */
+  if( csrForeignVersion(pVtab, &iForeign)!=SQLITE_OK
+   || iForeign!=pCur->iForeignVersion ){
+    return 0;
+  }
+  pCur->iFileVersion = iFileVersion;
+  pCur->bUncommitted = 0;
+  return 1;
+}
+
+int graphCSRStampWrite(GraphVtab *pVtab, int nUncounted){
+  CSRGraph *pCur = pVtab->pCSR;
+  int iForeign;
+  int rc;
+
+  if( pCur==0 ) return SQLITE_OK;
+  rc = csrForeignVersion(pVtab, &iForeign);
+  if( rc!=SQLITE_OK ) return rc;
+  if( iForeign!=pCur->iForeignVersion ){
+    /* Another connection committed after the snapshot was stamped and
+    ** before this write locked the database */
+    return SQLITE_BUSY_SNAPSHOT;
+  }
+  if( sqlite3_txn_state(pVtab->pDb, pVtab->zDbName)==SQLITE_TXN_WRITE ){
+    rc = csrEpochWrite(pVtab, &pCur->iEpoch);
+    if( rc!=SQLITE_OK ) return rc;
+    pCur->bUncommitted = 1;
+  }else{
+    pCur->bUncommitted = 0;  /* The write has committed already */
+  }
+  graphDataStamp(pVtab, &pCur->iFileVersion, &pCur->nTotalChanges);
+  pCur->iDataVersion = pVtab->iDataVersion;
+  pCur->nUncounted += nUncounted;
+  return SQLITE_OK;
+}
+
+/*
+** Make pNew, taken from the database as of the given change indicators,
+** the cached snapshot of pVtab.
+*/
+static void csrInstall(GraphVtab *pVtab, CSRGraph *pNew,
+                       unsigned int iFileVersion, int nTotalChanges,
+                       int iForeign){
+  csrEpochCreate(pVtab);
+  pNew->nRef = 1;
+  pNew->iDataVersion = pVtab->iDataVersion;
+  pNew->iFileVersion = iFileVersion;
+  pNew->nTotalChanges = nTotalChanges;
+  pNew->iForeignVersion = iForeign;
+  pVtab->pCSR = pNew;
+  pVtab->iCSRSerial++;
+
+  /* Built from uncommitted data: a rollback must make it stale */
+  if( sqlite3_txn_state(pVtab->pDb, pVtab->zDbName)==SQLITE_TXN_WRITE
+   && graphCSRStampWrite(pVtab, 0)!=SQLITE_OK ){
+    pNew->iDataVersion--;  /* Usable by this caller, rebuilt by the next */
+  }
+}
+
+int graphCSRIsCurrent(GraphVtab *pVtab){
+  unsigned int iFileVersion;
+  int nTotalChanges;
+
+  if( pVtab->pCSR==0 ){
+    CSRGraph *pNew = 0;
+    int iForeign;
+
+    /* A cold connection maps a matching csr_file= copy, once, rather
+    ** than leave its callers to per-hop lookups */
+    if( pVtab->zCSRFile==0 || pVtab->bCSRFileTried ) return 0;
+    pVtab->bCSRFileTried = 1;
+    graphDataStamp(pVtab, &iFileVersion, &nTotalChanges);
+    if( csrForeignVersion(pVtab, &iForeign)!=SQLITE_OK
+     || graphCSRFileLoad(pVtab, &pNew)!=SQLITE_OK || pNew==0 ){
+      return 0;
+    }
+    csrInstall(pVtab, pNew, iFileVersion, nTotalChanges, iForeign);
+  }
+  graphDataStamp(pVtab, &iFileVersion, &nTotalChanges);
+  return csrStampMatches(pVtab, iFileVersion, nTotalChanges);
+}
+
+/*
+** Return the cached snapshot for pVtab, rebuilding it when stale.
+*/
+int graphCSRGet(GraphVtab *pVtab, CSRGraph **ppCSR){
+  CSRGraph *pNew = 0;
+  unsigned int iFileVersion;
+  int nTotalChanges;
+  int iForeign;
+  int rc;
+
+  assert( pVtab!=0 );
+  assert( ppCSR!=0 );
+  *ppCSR = 0;
+
+  /* Stamp before building so writes racing the build force a rebuild */
+  graphDataStamp(pVtab, &iFileVersion, &nTotalChanges);
+
+  if( pVtab->pCSR ){
+    if( csrStampMatches(pVtab, iFileVersion, nTotalChanges) ){
+      rc = graphCSRDeltaFold(pVtab);
+      if( rc!=SQLITE_OK ) return rc;
+      graphCSRFileSync(pVtab);
+      *ppCSR = pVtab->pCSR;
+      return SQLITE_OK;
+    }
+    graphCSRInvalidate(pVtab);
+  }
+
+  rc = csrForeignVersion(pVtab, &iForeign);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = graphCSRFileLoad(pVtab, &pNew);
+  if( rc==SQLITE_OK && pNew==0 ){
+    rc = graphCSRBuild(pVtab->pDb, pVtab->zNodeTableName,
+                       pVtab->zEdgeTableName, &pNew);
+    if( rc==SQLITE_OK ) pNew->nUnsaved = -1;
+  }
+  if( rc!=SQLITE_OK ) return rc;
+  csrInstall(pVtab, pNew, iFileVersion, nTotalChanges, iForeign);
+  graphCSRFileSync(pVtab);
+  *ppCSR = pNew;
+  return SQLITE_OK;
+}
+
+void graphCSRRelease(CSRGraph *pCSR){
+  if( pCSR && --pCSR->nRef<=0 ){
+    graphCSRFree(pCSR);
+  }
+}
+
+/*
+** Release the cached snapshot. The next graphCSRGet() rebuilds it.
+** Views still reading it keep it alive until they close.
+*/
+void graphCSRInvalidate(GraphVtab *pVtab){
+  if( pVtab ){
+    graphCSRDeltaDrop(pVtab);
+    graphComponentsReset(pVtab);
+    graphNbrSetsReset(pVtab);
+    graphReachReset(pVtab);
+    graphColumnsReset(pVtab);
+    graphCSRRelease(pVtab->pCSR);
+    pVtab->pCSR = 0;
+  }
+}
+
+/*
+** Advance the data version after a write through the graph interfaces.
+*/
+void graphBumpDataVersion(GraphVtab *pVtab){
+  if( pVtab ){
+    pVtab->iDataVersion++;
+  }
+}
@@ -56,7 +56,7 @@ int graphAddEdgeWithType(GraphVtab *pVtab, sqlite3_int64 iFromId,
   char *zSql;
   int rc;
 
-  zSql = sqlite3_mprintf("INSERT INTO %s_edges(from_id, to_id, weight, properties, rel_type) VALUES(%lld, %lld, %f, %Q, %Q)", pVtab->zTableName, iFromId, iToId, rWeight, zProperties, zType);
+  zSql = sqlite3_mprintf("INSERT INTO %s(source, target, weight, properties, edge_type) VALUES(%lld, %lld, %f, %Q, %Q)", pVtab->zEdgeTableName, iFromId, iToId, rWeight, zProperties, zType);
   rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
   sqlite3_free(zSql);
 
@@ -0,0 +1,404 @@
+/*
+** SQLite Graph Database Extension - Approximate k-Hop Reach
+**
+** Estimates how many nodes each node reaches within k hops along
+** out-edges, the count an exact graphBFS() to depth k would list, with
+** HyperANF: every node holds a HyperLogLog counter of m = 2^p one-byte
+** registers, seeded with its own id. Round t sets a node's counter to
+** the register-wise maximum of its own and its out-neighbours' counters
+** of round t-1, so after round t it counts the ball of radius t. Each
+** round pulls over the out-edges of the CSR snapshot, in node ranges on
+** the task scheduler, and writes only the nodes of its own range.
+**
+** Caching: The counters of the last round and one float estimate per
+**          node per round are kept on the GraphVtab for the snapshot
+**          they were computed from (graphReachReset()). A query for a
+**          round already run is a lookup; a larger k runs the missing
+**          rounds. Once a round changes no register, every later round
+**          equals it and costs nothing.
+** Memory: nNodes * 2^p bytes of registers, twice that while a round
+**         runs, plus 4 bytes per node per round run.
+** Error: The relative standard error is 1.04 / sqrt(m), from 26% at
+**        p=4 to 1.6% at p=12; counts of up to 2.5m nodes use linear
+**        counting and are closer than that.
+**
+** Memory allocation: sqlite3_malloc64()/sqlite3_free(); the caller owns
+** the returned arrays.
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-performance.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(GRAPH_NO_SIMD) && defined(__SSE2__)
+# define GRAPH_REACH_SSE2 1
+# include <emmintrin.h>
+#endif
+
+/*
+** HyperLogLog counters of one snapshot. Node i's registers are
+** aReg[i<<nLog2m .. (i+1)<<nLog2m); aEst[t*nNodes + i] is the size of
+** its radius-t ball, itself included, for t = 0..nRound.
+*/
+struct GraphReachSketch {
+  const CSRGraph *pCSR;        /* Snapshot the counters belong to */
+  int nLog2m;                  /* Precision p: 2^p registers per node */
+  int nRound;                  /* Rounds run so far */
+  int bStable;                 /* Round nRound changed no register */
+  uint8_t *aReg;               /* Registers after round nRound */
+  float *aEst;                 /* Ball size estimates, nRound+1 rounds */
+};
+
+/*
+** One work unit of a round: the dense node range [iFirst, iLast).
+*/
+typedef struct ReachTask ReachTask;
+struct ReachTask {
+  const CSRGraph *pCSR;
+  const uint8_t *aPrev;       /* Registers of the previous round */
+  uint8_t *aNext;             /* Registers of this round */
+  float *aEst;                /* Estimates of this round */
+  int nLog2m;
+  int iFirst, iLast;
+  int bChanged;               /* Out: some register of the range grew */
+};
+
+/*
+** 64-bit finalizer of SplitMix64; spreads node ids over all bits.
+*/
+static uint64_t reachHash(sqlite3_int64 iNode){
+  uint64_t h = (uint64_t)iNode + 0x9E3779B97F4A7C15ULL;
+  h = (h ^ (h>>30)) * 0xBF58476D1CE4E5B9ULL;
+  h = (h ^ (h>>27)) * 0x94D049BB133111EBULL;
+  return h ^ (h>>31);
+}
+
+/*
+** Add node id iNode to the counter aReg[] of 2^nLog2m registers. The
+** top p bits pick the register, which keeps the rank (leading zeros
+** plus one) of the rest.
+*/
+static void reachAdd(uint8_t *aReg, int nLog2m, sqlite3_int64 iNode){
+  uint64_t h = reachHash(iNode);
+  uint64_t w = h << nLog2m;
+  int iReg = (int)(h >> (64-nLog2m));
+  int nRank = w ? __builtin_clzll(w)+1 : 64-nLog2m+1;
+
+  if( nRank>aReg[iReg] ) aReg[iReg] = (uint8_t)nRank;
+}
+
+/*
+** 2^-r for a register value r (at most 61), built from its exponent
+** bits; ldexp() dominated the estimate at high precision.
+*/
+static double reachInvPow2(int r){
+  union { uint64_t u; double r; } x;
+  x.u = (uint64_t)(1023-r) << 52;
+  return x.r;
+}
+
+/*
+** Estimated number of distinct ids added to a counter: the harmonic
+** mean estimate, or linear counting while it is at most 2.5m and some
+** register is still empty. With 64-bit hashes no large-range
+** correction is needed.
+*/
+static double reachEstimate(const uint8_t *aReg, int nLog2m){
+  int m = 1<<nLog2m;
+  double rAlpha;
+  double rSum = 0.0;
+  double rEst;
+  int nZero = 0;
+  int i;
+
+  switch( m ){
+    case 16: rAlpha = 0.673; break;
+    case 32: rAlpha = 0.697; break;
+    case 64: rAlpha = 0.709; break;
+    default: rAlpha = 0.7213/(1.0 + 1.079/m); break;
+  }
+  for( i=0; i<m; i++ ){
+    rSum += reachInvPow2(aReg[i]);
+    nZero += (aReg[i]==0);
+  }
+  rEst = rAlpha * m * m / rSum;
+  if( rEst<=2.5*m && nZero>0 ){
+    rEst = m * log((double)m / nZero);
+  }
+  return rEst;
+}
+
+/*
+** aDst[] = max(aDst[], aSrc[]) over nReg registers, a multiple of 16.
+** Returns true if some register of aDst grew.
+*/
+static int reachMerge(uint8_t *aDst, const uint8_t *aSrc, int nReg){
+#ifdef GRAPH_REACH_SSE2
+  __m128i vGrew = _mm_setzero_si128();
+  int i;
+  for( i=0; i<nReg; i+=16 ){
+    __m128i vOld = _mm_loadu_si128((const __m128i*)&aDst[i]);
+    __m128i vNew = _mm_max_epu8(vOld, _mm_loadu_si128((const __m128i*)&aSrc[i]));
+    vGrew = _mm_or_si128(vGrew, _mm_xor_si128(vOld, vNew));
+    _mm_storeu_si128((__m128i*)&aDst[i], vNew);
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(vGrew, _mm_setzero_si128()))!=0xFFFF;
+#else
+  int bGrew = 0;
+  int i;
+  for( i=0; i<nReg; i++ ){
+    if( aSrc[i]>aDst[i] ){
+      aDst[i] = aSrc[i];
+      bGrew = 1;
+    }
+  }
+  return bGrew;
+#endif
+}
+
+/*
+** Run one round over the range: start each counter from its previous
+** value, fold in each out-neighbour's and estimate the result.
+*/
+static void reachRoundWorker(void *pArg){
+  ReachTask *p = (ReachTask*)pArg;
+  const CSRGraph *pCSR = p->pCSR;
+  int nReg = 1<<p->nLog2m;
+  int i;
+
+  p->bChanged = 0;
+  for( i=p->iFirst; i<p->iLast; i++ ){
+    uint8_t *aDst = &p->aNext[(sqlite3_int64)i<<p->nLog2m];
+    sqlite3_int64 e;
+
+    memcpy(aDst, &p->aPrev[(sqlite3_int64)i<<p->nLog2m], nReg);
+    for( e=pCSR->rowOffsets[i]; e<pCSR->rowOffsets[i+1]; e++ ){
+      int j = pCSR->columnIndices[e];
+      if( j==i ) continue;
+      if( reachMerge(aDst, &p->aPrev[(sqlite3_int64)j<<p->nLog2m], nReg) ){
+        p->bChanged = 1;
+      }
+    }
+    p->aEst[i] = (float)reachEstimate(aDst, p->nLog2m);
+  }
+}
+
+static void reachSketchFree(GraphReachSketch *pSketch){
+  if( pSketch ){
+    sqlite3_free(pSketch->aReg);
+    sqlite3_free(pSketch->aEst);
+    sqlite3_free(pSketch);
+  }
+}
+
+void graphReachReset(GraphVtab *pVtab){
+  reachSketchFree(pVtab->pReach);
+  pVtab->pReach = 0;
+}
+
+/*
+** Run rounds nRound+1 .. nTarget of pSketch on nThreads workers, or
+** fewer if a round leaves every register as it was.
+*/
+static int reachRounds(GraphReachSketch *pSketch, int nTarget, int nThreads){
+  const CSRGraph *pCSR = pSketch->pCSR;
+  int n = pCSR->nNodes;
+  uint8_t *aNext = 0;
+  float *aEst;
+  TaskScheduler *pScheduler = 0;
+  ReachTask *aTask = 0;
+  void **apTask = 0;
+  int nTask = 1;
+  int i;
+  int rc = SQLITE_OK;
+
+  if( n==0 || pSketch->bStable || pSketch->nRound>=nTarget ) return SQLITE_OK;
+
+  aEst = sqlite3_realloc64(pSketch->aEst,
+                           sizeof(float)*(sqlite3_int64)n*(nTarget+1));
+  if( aEst==0 ) return SQLITE_NOMEM;
+  pSketch->aEst = aEst;
+  aNext = sqlite3_malloc64((sqlite3_int64)n<<pSketch->nLog2m);
+  if( aNext==0 ) return SQLITE_NOMEM;
+
+  if( nThreads!=1 && n>1 ){
+    pScheduler = graphCreateTaskScheduler(nThreads);
+    if( pScheduler==0 ){
+      rc = SQLITE_NOMEM;
+      goto rounds_cleanup;
+    }
+    nTask = pScheduler->nThreads * 4;
+    if( nTask>n ) nTask = n;
+  }
+  aTask = sqlite3_malloc64(sizeof(ReachTask)*nTask);
+  apTask = sqlite3_malloc64(sizeof(void*)*nTask);
+  if( !aTask || !apTask ){
+    rc = SQLITE_NOMEM;
+    goto rounds_cleanup;
+  }
+
+  /* Ranges of about the same number of nodes plus edges */
+  memset(aTask, 0, sizeof(ReachTask)*nTask);
+  {
+    sqlite3_int64 nWork = (sqlite3_int64)n + pCSR->rowOffsets[n];
+    int iNode = 0;
+    for( i=0; i<nTask; i++ ){
+      sqlite3_int64 nGoal = nWork * (i+1) / nTask;
+      aTask[i].pCSR = pCSR;
+      aTask[i].nLog2m = pSketch->nLog2m;
+      aTask[i].iFirst = iNode;
+      while( iNode<n && iNode+pCSR->rowOffsets[iNode]<nGoal ) iNode++;
+      aTask[i].iLast = (i==nTask-1) ? n : iNode;
+      apTask[i] = &aTask[i];
+    }
+  }
+
+  while( pSketch->nRound<nTarget ){
+    int bChanged = 0;
+    uint8_t *aSwap;
+
+    for( i=0; i<nTask; i++ ){
+      aTask[i].aPrev = pSketch->aReg;
+      aTask[i].aNext = aNext;
+      aTask[i].aEst = &pSketch->aEst[(sqlite3_int64)n*(pSketch->nRound+1)];
+    }
+    rc = graphRunTasks(pScheduler, reachRoundWorker, apTask, nTask);
+    if( rc!=SQLITE_OK ) break;
+    for( i=0; i<nTask; i++ ) bChanged |= aTask[i].bChanged;
+
+    aSwap = pSketch->aReg;
+    pSketch->aReg = aNext;
+    aNext = aSwap;
+    pSketch->nRound++;
+    if( !bChanged ){
+      pSketch->bStable = 1;
+      break;
+    }
+  }
+
+rounds_cleanup:
+  sqlite3_free(aNext);
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
+  graphDestroyTaskScheduler(pScheduler);
+  return rc;
+}
+
+/*
+** Return in *ppSketch the counters of pVtab's current snapshot at
+** precision nLog2m, with at least nHops rounds run unless a shorter run
+** is already stable. Counters kept at another precision are dropped.
+*/
+static int reachSketchGet(GraphVtab *pVtab, int nHops, int nLog2m,
+                          int nThreads, const GraphReachSketch **ppSketch){
+  CSRGraph *pCSR = 0;
+  GraphReachSketch *pSketch;
+  int rc;
+
+  *ppSketch = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  pSketch = pVtab->pReach;       /* Only now: a rebuild frees it */
+  if( pSketch==0 || pSketch->pCSR!=pCSR || pSketch->nLog2m!=nLog2m ){
+    int n = pCSR->nNodes;
+    int i;
+
+    graphReachReset(pVtab);
+    pSketch = sqlite3_malloc(sizeof(*pSketch));
+    if( pSketch==0 ) return SQLITE_NOMEM;
+    memset(pSketch, 0, sizeof(*pSketch));
+    pSketch->pCSR = pCSR;
+    pSketch->nLog2m = nLog2m;
+    pSketch->aReg = sqlite3_malloc64(((sqlite3_int64)n<<nLog2m) + 1);
+    pSketch->aEst = sqlite3_malloc64(sizeof(float)*(n ? n : 1));
+    if( pSketch->aReg==0 || pSketch->aEst==0 ){
+      reachSketchFree(pSketch);
+      return SQLITE_NOMEM;
+    }
+    memset(pSketch->aReg, 0, (sqlite3_int64)n<<nLog2m);
+    for( i=0; i<n; i++ ){
+      uint8_t *aReg = &pSketch->aReg[(sqlite3_int64)i<<nLog2m];
+      reachAdd(aReg, nLog2m, pCSR->aNodeIds[i]);
+      pSketch->aEst[i] = (float)reachEstimate(aReg, nLog2m);
+    }
+    pVtab->pReach = pSketch;
+  }
+  rc = reachRounds(pSketch, nHops, nThreads);
+  if( rc!=SQLITE_OK ){
+    graphReachReset(pVtab);
+    return rc;
+  }
+  *ppSketch = pSketch;
+  return SQLITE_OK;
+}
+
+/*
+** Estimate of dense node i's k-hop reach, the node itself excluded.
+*/
+static double reachOf(const GraphReachSketch *pSketch, int i, int nHops){
+  int t = nHops<pSketch->nRound ? nHops : pSketch->nRound;
+  double rBall = pSketch->aEst[(sqlite3_int64)t*pSketch->pCSR->nNodes + i];
+  return rBall>1.0 ? rBall-1.0 : 0.0;
+}
+
+double graphReachError(int nLog2m){
+  return 1.04 / sqrt((double)(1<<nLog2m));
+}
+
+int graphReachEstimate(GraphVtab *pVtab, sqlite3_int64 iNode, int nHops,
+                       int nLog2m, double *prReach){
+  const GraphReachSketch *pSketch;
+  int i;
+  int rc;
+
+  assert( nHops>=0 && nHops<=GRAPH_REACH_MAX_HOPS );
+  assert( nLog2m>=GRAPH_REACH_MIN_PRECISION );
+  assert( nLog2m<=GRAPH_REACH_MAX_PRECISION );
+  *prReach = 0.0;
+  rc = reachSketchGet(pVtab, nHops, nLog2m, 0, &pSketch);
+  if( rc!=SQLITE_OK ) return rc;
+  i = graphCSRIndexOf(pSketch->pCSR, iNode);
+  if( i<0 ) return SQLITE_NOTFOUND;
+  *prReach = reachOf(pSketch, i, nHops);
+  return SQLITE_OK;
+}
+
+int graphReachAll(GraphVtab *pVtab, int nHops, int nLog2m, int nThreads,
+                  sqlite3_int64 **paNode, double **paReach, int *pnNode){
+  const GraphReachSketch *pSketch;
+  sqlite3_int64 *aNode;
+  double *aReach;
+  int n, i;
+  int rc;
+
+  assert( nHops>=0 && nHops<=GRAPH_REACH_MAX_HOPS );
+  *paNode = 0;
+  *paReach = 0;
+  *pnNode = 0;
+  rc = reachSketchGet(pVtab, nHops, nLog2m, nThreads, &pSketch);
+  if( rc!=SQLITE_OK ) return rc;
+  n = pSketch->pCSR->nNodes;
+  if( n==0 ) return SQLITE_OK;
+
+  aNode = sqlite3_malloc64(sizeof(sqlite3_int64)*n);
+  aReach = sqlite3_malloc64(sizeof(double)*n);
+  if( !aNode || !aReach ){
+    sqlite3_free(aNode);
+    sqlite3_free(aReach);
+    return SQLITE_NOMEM;
+  }
+  memcpy(aNode, pSketch->pCSR->aNodeIds, sizeof(sqlite3_int64)*n);
+  for( i=0; i<n; i++ ) aReach[i] = reachOf(pSketch, i, nHops);
+  *paNode = aNode;
+  *paReach = aReach;
+  *pnNode = n;
+  return SQLITE_OK;
+}
@@ -0,0 +1,643 @@
+/*
+** SQLite Graph Database Extension - Background Algorithm Jobs
+**
+** graph_betweenness_centrality() on a large graph runs for minutes to
+** hours inside one SQL call, and the connection, with any transaction
+** it holds, waits for it. A job runs the algorithm on the worker pool
+** instead and hands the connection straight back:
+**
+**   SELECT graph_job_submit('betweenness');             -- returns 7
+**   SELECT graph_job_submit('pagerank', '{"damping":0.9}');
+**   SELECT graph_job_status(7);    -- {"state":"running","progress":0.42,...}
+**   SELECT graph_job_cancel(7);
+**   SELECT node_id, value FROM g_job_results WHERE job_id = 7;
+**
+** graph_job_submit(algorithm [, args]) pins a read view of the default
+** graph's adjacency (graphCSRViewOpen()), or of the projection picked
+** with graph_use(), and schedules the algorithm on one pool worker as
+** the stale-while-revalidate refresh in graph-results.c does. The job
+** reads only the pinned arrays, so writes, commits and other queries on
+** the connection go ahead while it runs and do not change what it
+** computes. args is a JSON object: damping, max_iter and epsilon for
+** pagerank, resolution for louvain, max_iter for label_propagation.
+**
+** Progress: The centrality kernels count finished sources and PageRank
+**           its iterations in a CSRProgress, which graph_job_status()
+**           reads; graph_job_cancel() sets its cancel flag, honoured
+**           after the current source or iteration. Louvain and label
+**           propagation report 0 or 1 and only stop when done.
+** Results: The connection collects a finished job on its next
+**          graph_job_status() call outside an explicit transaction and
+**          writes one (job_id, node_id, value) row per node to the
+**          graph's %s_job_results table in one savepoint. Job ids are
+**          above every id already in that table.
+** Lifetime: Jobs are listed on the connection's registry entry; closing
+**           the connection cancels and waits for the running ones.
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-metrics.h"
+#include "graph-performance.h"
+#include "cypher-executor.h"
+#include <pthread.h>
+#include <string.h>
+
+#define JOB_PAGERANK      1
+#define JOB_BETWEENNESS   2
+#define JOB_CLOSENESS     3
+#define JOB_LOUVAIN       4
+#define JOB_LABELPROP     5
+
+#define JOB_RUNNING       0   /* On the pool */
+#define JOB_FINISHED      1   /* Computed, results not written yet */
+#define JOB_DONE          2   /* Results in %s_job_results */
+#define JOB_FAILED        3
+#define JOB_CANCELLED     4
+
+static const struct {
+  const char *zName;
+  int eAlgo;
+} aJobAlgo[] = {
+  { "pagerank",          JOB_PAGERANK },
+  { "betweenness",       JOB_BETWEENNESS },
+  { "closeness",         JOB_CLOSENESS },
+  { "louvain",           JOB_LOUVAIN },
+  { "label_propagation", JOB_LABELPROP },
+};
+
+static const char *const azJobState[] = {
+  "running", "finished", "done", "failed", "cancelled"
+};
+
+struct GraphJob {
+  sqlite3_int64 iId;           /* Job id, the job_id of its result rows */
+  char *zGraph;                /* Graph table the results go to */
+  int eAlgo;                   /* JOB_* algorithm */
+  double rDamping, rEpsilon;   /* PageRank */
+  double rResolution;          /* Louvain */
+  int nMaxIter;                /* PageRank, label propagation */
+  CSRView view;                /* Adjacency computed on, pinned */
+  TaskScheduler *pScheduler;   /* Keeps the pool running until collected */
+  CSRProgress progress;        /* Shared with the worker */
+  sqlite3_int64 iStart;        /* graphMetricsClock() at submit */
+  int eState;                  /* JOB_* state, connection side */
+  char *zError;                /* Why the job failed, or NULL */
+
+  pthread_mutex_t mutex;       /* Guards the fields below */
+  pthread_cond_t done;         /* Signalled when bDone is set */
+  int bDone;                   /* The worker has finished */
+  int rc;                      /* Result of the algorithm */
+  sqlite3_int64 iEnd;          /* graphMetricsClock() when it finished */
+  sqlite3_int64 *aNode;        /* Node ids of the results */
+  double *aScore;              /* Scores, or NULL if aCommunity */
+  sqlite3_int64 *aCommunity;   /* Community ids, or NULL if aScore */
+  int nResult;                 /* Entries in aNode and aScore/aCommunity */
+
+  GraphJob *pNext;             /* Next job of the connection */
+};
+
+/*
+** Run one job on a pool worker.
+*/
+static void jobTask(void *pArg){
+  GraphJob *pJob = (GraphJob*)pArg;
+  const CSRGraph *pCSR = pJob->view.pCSR;
+  CSRGraph *pFolded = 0;
+  sqlite3_int64 *aNode = 0;
+  sqlite3_int64 *aCommunity = 0;
+  double *aScore = 0;
+  int nResult = 0;
+  int rc = SQLITE_OK;
+
+  if( pJob->view.pDelta ){
+    rc = graphCSRViewFold(&pJob->view, &pFolded);
+    pCSR = pFolded;
+  }
+  if( rc==SQLITE_OK ){
+    switch( pJob->eAlgo ){
+      case JOB_PAGERANK:
+        rc = graphPageRankScores(pCSR, pJob->rDamping, pJob->nMaxIter,
+                                 pJob->rEpsilon, 1, &pJob->progress, &aScore);
+        break;
+      case JOB_BETWEENNESS:
+      case JOB_CLOSENESS:
+        rc = graphCentralityScores(pCSR, pJob->eAlgo==JOB_BETWEENNESS, 1,
+                                   &pJob->progress, &aScore);
+        break;
+      case JOB_LOUVAIN:
+        __atomic_store_n(&pJob->progress.nTotal, 1, __ATOMIC_RELAXED);
+        rc = graphLouvainCSR(pCSR, pJob->rResolution, 1, &aNode,
+                             &aCommunity, &nResult);
+        break;
+      default:
+        __atomic_store_n(&pJob->progress.nTotal, 1, __ATOMIC_RELAXED);
+        rc = graphLabelPropagationCSR(pCSR, pJob->nMaxIter, 1, &aNode,
+                                      &aCommunity, &nResult);
+        break;
+    }
+  }
+  if( rc==SQLITE_OK && aScore ){
+    /* Scores are in dense order; the ids go with them */
+    nResult = pCSR->nNodes;
+    aNode = sqlite3_malloc64(sizeof(sqlite3_int64)*(nResult>0 ? nResult : 1));
+    if( aNode ){
+      if( nResult>0 ){
+        memcpy(aNode, pCSR->aNodeIds, sizeof(sqlite3_int64)*nResult);
+      }
+    }else{
+      rc = SQLITE_NOMEM;
+    }
+  }
+  if( rc==SQLITE_OK
+   && __atomic_load_n(&pJob->progress.bCancel, __ATOMIC_RELAXED) ){
+    rc = SQLITE_INTERRUPT;
+  }
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(aNode);
+    sqlite3_free(aScore);
+    sqlite3_free(aCommunity);
+    aNode = aCommunity = 0;
+    aScore = 0;
+    nResult = 0;
+  }else{
+    __atomic_store_n(&pJob->progress.nDone,
+                     __atomic_load_n(&pJob->progress.nTotal, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+  }
+  graphCSRFree(pFolded);
+
+  pthread_mutex_lock(&pJob->mutex);
+  pJob->aNode = aNode;
+  pJob->aScore = aScore;
+  pJob->aCommunity = aCommunity;
+  pJob->nResult = nResult;
+  pJob->rc = rc;
+  pJob->iEnd = graphMetricsClock();
+  pJob->bDone = 1;
+  pthread_cond_broadcast(&pJob->done);
+  pthread_mutex_unlock(&pJob->mutex);
+}
+
+static void jobFreeResults(GraphJob *pJob){
+  sqlite3_free(pJob->aNode);
+  sqlite3_free(pJob->aScore);
+  sqlite3_free(pJob->aCommunity);
+  pJob->aNode = pJob->aCommunity = 0;
+  pJob->aScore = 0;
+  pJob->nResult = 0;
+}
+
+/*
+** Free a job that is not on the pool, or has finished there.
+*/
+static void jobFree(GraphJob *pJob){
+  jobFreeResults(pJob);
+  graphCSRViewClose(&pJob->view);
+  graphDestroyTaskScheduler(pJob->pScheduler);
+  pthread_cond_destroy(&pJob->done);
+  pthread_mutex_destroy(&pJob->mutex);
+  sqlite3_free(pJob->zGraph);
+  sqlite3_free(pJob->zError);
+  sqlite3_free(pJob);
+}
+
+void graphJobListFree(GraphJob *pList){
+  while( pList ){
+    GraphJob *pJob = pList;
+    pList = pJob->pNext;
+    __atomic_store_n(&pJob->progress.bCancel, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pJob->mutex);
+    while( !pJob->bDone ) pthread_cond_wait(&pJob->done, &pJob->mutex);
+    pthread_mutex_unlock(&pJob->mutex);
+    jobFree(pJob);
+  }
+}
+
+static GraphJob *jobFind(GraphConn *pConn, sqlite3_int64 iId){
+  GraphJob *pJob;
+  for(pJob=*graphConnJobs(pConn); pJob; pJob=pJob->pNext){
+    if( pJob->iId==iId ) return pJob;
+  }
+  return 0;
+}
+
+/*
+** Write the results of finished job pJob to its graph's %s_job_results
+** table in one savepoint and free them. Errors other than a busy
+** database fail the job; the caller retries a busy write later.
+*/
+static int jobSave(sqlite3 *pDb, GraphJob *pJob){
+  GraphVtab *pVtab = graphRegistryFind(pDb, pJob->zGraph);
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  int bCurrent;
+  int rc, i;
+
+  if( pVtab==0 ){
+    pJob->zError = sqlite3_mprintf("no such graph: %s", pJob->zGraph);
+    return SQLITE_ERROR;
+  }
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w\".\"%w_job_results\"("
+      "job_id INTEGER, node_id INTEGER, value,"
+      " PRIMARY KEY(job_id, node_id)) WITHOUT ROWID",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+
+  zSql = sqlite3_mprintf(
+      "INSERT OR REPLACE INTO \"%w\".\"%w_job_results\"(job_id, node_id, value)"
+      " VALUES(?1, ?2, ?3)", pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* The rows are not graph data: restamp the snapshot past them */
+  bCurrent = graphCSRIsCurrent(pVtab);
+  rc = sqlite3_exec(pDb, "SAVEPOINT graph_job", 0, 0, 0);
+  sqlite3_bind_int64(pStmt, 1, pJob->iId);
+  for(i=0; rc==SQLITE_OK && i<pJob->nResult; i++){
+    sqlite3_bind_int64(pStmt, 2, pJob->aNode[i]);
+    if( pJob->aScore ){
+      sqlite3_bind_double(pStmt, 3, pJob->aScore[i]);
+    }else{
+      sqlite3_bind_int64(pStmt, 3, pJob->aCommunity[i]);
+    }
+    sqlite3_step(pStmt);
+    rc = sqlite3_reset(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_exec(pDb, "RELEASE graph_job", 0, 0, 0);
+  }else{
+    sqlite3_exec(pDb, "ROLLBACK TO graph_job; RELEASE graph_job", 0, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    if( bCurrent ) graphCSRStampWrite(pVtab, 0);
+    jobFreeResults(pJob);
+  }else if( rc!=SQLITE_BUSY && rc!=SQLITE_LOCKED ){
+    pJob->zError = sqlite3_mprintf("%s", sqlite3_errmsg(pDb));
+  }
+  return rc;
+}
+
+/*
+** Bring the connection-side state of pJob up to date with its worker,
+** writing its results if it finished and the connection is not inside
+** an explicit transaction, whose rollback would take them back.
+*/
+static void jobCollect(sqlite3 *pDb, GraphJob *pJob){
+  int bDone, rc;
+
+  if( pJob->eState==JOB_RUNNING ){
+    pthread_mutex_lock(&pJob->mutex);
+    bDone = pJob->bDone;
+    rc = pJob->rc;
+    pthread_mutex_unlock(&pJob->mutex);
+    if( !bDone ) return;
+    graphCSRViewClose(&pJob->view);
+    graphDestroyTaskScheduler(pJob->pScheduler);
+    pJob->pScheduler = 0;
+    if( rc==SQLITE_INTERRUPT ){
+      pJob->eState = JOB_CANCELLED;
+    }else if( rc!=SQLITE_OK ){
+      pJob->eState = JOB_FAILED;
+      pJob->zError = sqlite3_mprintf("%s", sqlite3_errstr(rc));
+    }else{
+      pJob->eState = JOB_FINISHED;
+    }
+  }
+  if( pJob->eState==JOB_FINISHED && sqlite3_get_autocommit(pDb) ){
+    rc = jobSave(pDb, pJob);
+    if( rc==SQLITE_OK ){
+      pJob->eState = JOB_DONE;
+    }else if( rc!=SQLITE_BUSY && rc!=SQLITE_LOCKED ){
+      pJob->eState = JOB_FAILED;
+      jobFreeResults(pJob);
+    }
+  }
+}
+
+/*
+** Append z to pStr as a JSON string, escaped by the Cypher result
+** writer, or null if z is NULL or escaping it runs out of memory.
+*/
+static void jobAppendJsonString(sqlite3_str *pStr, const char *z){
+  CypherJsonWriter w;
+  char *zJson;
+
+  if( z==0 ){
+    sqlite3_str_appendall(pStr, "null");
+    return;
+  }
+  cypherJsonWriterInit(&w);
+  cypherJsonAppendString(&w, z, (int)strlen(z));
+  zJson = cypherJsonWriterFinish(&w);
+  sqlite3_str_appendall(pStr, zJson ? zJson : "null");
+  sqlite3_free(zJson);
+}
+
+/*
+** Append the status object of pJob to pStr.
+*/
+static void jobStatus(sqlite3_str *pStr, GraphJob *pJob){
+  static const char *const azAlgo[] = {
+    "", "pagerank", "betweenness", "closeness", "louvain", "label_propagation"
+  };
+  sqlite3_int64 nDone = __atomic_load_n(&pJob->progress.nDone,
+                                        __ATOMIC_RELAXED);
+  sqlite3_int64 nTotal = __atomic_load_n(&pJob->progress.nTotal,
+                                         __ATOMIC_RELAXED);
+  sqlite3_int64 iEnd;
+  int nRow;
+
+  pthread_mutex_lock(&pJob->mutex);
+  iEnd = pJob->bDone ? pJob->iEnd : graphMetricsClock();
+  nRow = pJob->nResult;
+  pthread_mutex_unlock(&pJob->mutex);
+
+  sqlite3_str_appendf(pStr, "{\"id\":%lld,\"graph\":", pJob->iId);
+  jobAppendJsonString(pStr, pJob->zGraph);
+  sqlite3_str_appendf(pStr,
+      ",\"algorithm\":\"%s\",\"state\":\"%s\","
+      "\"progress\":%.4f,\"done\":%lld,\"total\":%lld,\"elapsed_ms\":%lld,",
+      azAlgo[pJob->eAlgo], azJobState[pJob->eState],
+      nTotal>0 ? (double)nDone/(double)nTotal : 0.0, nDone, nTotal,
+      (iEnd - pJob->iStart)/1000);
+  if( pJob->eState==JOB_FINISHED ){
+    sqlite3_str_appendf(pStr, "\"pending_rows\":%d,", nRow);
+  }
+  sqlite3_str_appendall(pStr, "\"error\":");
+  jobAppendJsonString(pStr, pJob->zError);
+  sqlite3_str_appendchar(pStr, 1, '}');
+}
+
+/*
+** Read the options of graph_job_submit() from the JSON object zArgs.
+*/
+static int jobArgs(sqlite3 *pDb, GraphJob *pJob, const char *zArgs,
+                   const char **pzErr){
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+
+  pJob->rDamping = 0.85;
+  pJob->nMaxIter = 100;
+  pJob->rEpsilon = 0.0001;
+  pJob->rResolution = 1.0;
+  if( zArgs==0 ) return SQLITE_OK;
+
+  rc = sqlite3_prepare_v2(pDb,
+      "SELECT json_type(?1)='object', json_extract(?1, '$.damping'),"
+      " json_extract(?1, '$.max_iter'), json_extract(?1, '$.epsilon'),"
+      " json_extract(?1, '$.resolution')", -1, &pStmt, 0);
+  if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_text(pStmt, 1, zArgs, -1, SQLITE_STATIC);
+  if( sqlite3_step(pStmt)!=SQLITE_ROW || !sqlite3_column_int(pStmt, 0) ){
+    *pzErr = "args must be a JSON object";
+  }else{
+    if( sqlite3_column_type(pStmt, 1)!=SQLITE_NULL ){
+      pJob->rDamping = sqlite3_column_double(pStmt, 1);
+    }
+    if( sqlite3_column_type(pStmt, 2)!=SQLITE_NULL ){
+      pJob->nMaxIter = sqlite3_column_int(pStmt, 2);
+    }
+    if( sqlite3_column_type(pStmt, 3)!=SQLITE_NULL ){
+      pJob->rEpsilon = sqlite3_column_double(pStmt, 3);
+    }
+    if( sqlite3_column_type(pStmt, 4)!=SQLITE_NULL ){
+      pJob->rResolution = sqlite3_column_double(pStmt, 4);
+    }
+    if( pJob->rDamping<0.0 || pJob->rDamping>1.0 ){
+      *pzErr = "Damping factor must be between 0 and 1";
+    }else if( pJob->nMaxIter<1 ){
+      *pzErr = "Max iterations must be positive";
+    }else if( !(pJob->rEpsilon>0.0) ){
+      *pzErr = "Epsilon must be positive";
+    }else if( !(pJob->rResolution>0.0) ){
+      *pzErr = "Resolution must be positive";
+    }
+  }
+  rc = sqlite3_finalize(pStmt);
+  return *pzErr ? SQLITE_ERROR : rc;
+}
+
+/*
+** The next job id for pVtab: above the ids of this connection's jobs and
+** every id already in its %s_job_results table.
+*/
+static sqlite3_int64 jobNextId(sqlite3 *pDb, GraphConn *pConn,
+                               GraphVtab *pVtab){
+  sqlite3_int64 iMax = 0;
+  sqlite3_stmt *pStmt = 0;
+  GraphJob *pJob;
+  char *zSql;
+
+  for(pJob=*graphConnJobs(pConn); pJob; pJob=pJob->pNext){
+    if( pJob->iId>iMax ) iMax = pJob->iId;
+  }
+  zSql = sqlite3_mprintf("SELECT max(job_id) FROM \"%w\".\"%w_job_results\"",
+                         pVtab->zDbName, pVtab->zTableName);
+  if( zSql && sqlite3_prepare_v2(pDb, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_column_int64(pStmt, 0)>iMax ){
+    iMax = sqlite3_column_int64(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  return iMax+1;
+}
+
+/*
+** SQL function: graph_job_submit(algorithm [, args])
+** Start algorithm ('pagerank', 'betweenness', 'closeness', 'louvain' or
+** 'label_propagation') in the background on the default graph, or on
+** the projection picked with graph_use(). args is a JSON object of
+** options. Returns the job id.
+** Usage: SELECT graph_job_submit('betweenness');
+**        SELECT graph_job_submit('pagerank', '{"damping":0.9}');
+*/
+static void graphJobSubmitFunc(sqlite3_context *pCtx, int argc,
+                               sqlite3_value **argv){
+  sqlite3 *pDb = sqlite3_context_db_handle(pCtx);
+  GraphConn *pConn = graphRegistryConn(pDb);
+  const char *zAlgo = (const char*)sqlite3_value_text(argv[0]);
+  const char *zArgs = argc>1 ? (const char*)sqlite3_value_text(argv[1]) : 0;
+  GraphProjection *pProj = graphConnProjection(pConn, 0);
+  GraphVtab *pVtab;
+  GraphJob *pJob;
+  ParallelTask *pTask;
+  const char *zErr = 0;
+  int eAlgo = 0;
+  int rc;
+  int i;
+
+  if( argc<1 || argc>2 ){
+    sqlite3_result_error(pCtx, "graph_job_submit() takes 1 or 2 arguments", -1);
+    return;
+  }
+  for(i=0; zAlgo && i<(int)(sizeof(aJobAlgo)/sizeof(aJobAlgo[0])); i++){
+    if( sqlite3_stricmp(zAlgo, aJobAlgo[i].zName)==0 ){
+      eAlgo = aJobAlgo[i].eAlgo;
+    }
+  }
+  if( eAlgo==0 ){
+    sqlite3_result_error(pCtx, "algorithm must be 'pagerank', 'betweenness',"
+                         " 'closeness', 'louvain' or 'label_propagation'", -1);
+    return;
+  }
+  pVtab = graphRegistryFind(pDb, pProj ? pProj->zGraph : 0);
+  if( pConn==0 || pVtab==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+
+  pJob = sqlite3_malloc(sizeof(*pJob));
+  pTask = sqlite3_malloc(sizeof(*pTask));
+  if( pJob==0 || pTask==0 ){
+    sqlite3_free(pJob);
+    sqlite3_free(pTask);
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  memset(pJob, 0, sizeof(*pJob));
+  pthread_mutex_init(&pJob->mutex, 0);
+  pthread_cond_init(&pJob->done, 0);
+  pJob->bDone = 1;              /* Until it is on the pool */
+  pJob->eAlgo = eAlgo;
+  pJob->zGraph = sqlite3_mprintf("%s", pVtab->zTableName);
+  rc = pJob->zGraph ? jobArgs(pDb, pJob, zArgs, &zErr) : SQLITE_NOMEM;
+  if( rc==SQLITE_OK ){
+    if( pProj ){
+      graphProjectionView(pDb, pProj->zName, &pJob->view);
+    }else{
+      rc = graphCSRViewOpen(pVtab, &pJob->view);
+    }
+  }
+  if( rc==SQLITE_OK ){
+    pJob->pScheduler = graphCreateTaskScheduler(1);
+    if( pJob->pScheduler==0 ) rc = SQLITE_NOMEM;
+  }
+  if( rc!=SQLITE_OK ){
+    jobFree(pJob);
+    sqlite3_free(pTask);
+    if( zErr ){
+      sqlite3_result_error(pCtx, zErr, -1);
+    }else if( rc==SQLITE_NOMEM ){
+      sqlite3_result_error_nomem(pCtx);
+    }else{
+      sqlite3_result_error_code(pCtx, rc);
+    }
+    return;
+  }
+
+  pJob->iId = jobNextId(pDb, pConn, pVtab);
+  pJob->iStart = graphMetricsClock();
+  pJob->bDone = 0;
+  pJob->pNext = *graphConnJobs(pConn);
+  *graphConnJobs(pConn) = pJob;
+
+  memset(pTask, 0, sizeof(*pTask));
+  pTask->execute = jobTask;
+  pTask->arg = pJob;
+  graphScheduleTask(pJob->pScheduler, pTask);
+  sqlite3_result_int64(pCtx, pJob->iId);
+}
+
+/*
+** SQL function: graph_job_status([id])
+** Status of job id as JSON, or a JSON array of every job of the
+** connection. Finished jobs have their results written first.
+** {"id":7,"graph":"g","algorithm":"betweenness","state":"running",
+**  "progress":0.42,"done":42000,"total":100000,"elapsed_ms":5120,
+**  "error":null}
+** state: running, finished (results not written yet: inside an explicit
+** transaction or the database was busy), done, failed or cancelled.
+*/
+static void graphJobStatusFunc(sqlite3_context *pCtx, int argc,
+                               sqlite3_value **argv){
+  sqlite3 *pDb = sqlite3_context_db_handle(pCtx);
+  GraphConn *pConn = graphRegistryConn(pDb);
+  sqlite3_str *pStr;
+  GraphJob *pJob;
+  char *zJson;
+
+  if( argc>1 ){
+    sqlite3_result_error(pCtx, "graph_job_status() takes at most 1 argument", -1);
+    return;
+  }
+  if( pConn==0 ){
+    sqlite3_result_null(pCtx);
+    return;
+  }
+  pStr = sqlite3_str_new(pDb);
+  if( argc==1 ){
+    pJob = jobFind(pConn, sqlite3_value_int64(argv[0]));
+    if( pJob==0 ){
+      sqlite3_free(sqlite3_str_finish(pStr));
+      sqlite3_result_null(pCtx);
+      return;
+    }
+    jobCollect(pDb, pJob);
+    jobStatus(pStr, pJob);
+  }else{
+    sqlite3_str_appendchar(pStr, 1, '[');
+    for(pJob=*graphConnJobs(pConn); pJob; pJob=pJob->pNext){
+      jobCollect(pDb, pJob);
+      jobStatus(pStr, pJob);
+      if( pJob->pNext ) sqlite3_str_appendchar(pStr, 1, ',');
+    }
+    sqlite3_str_appendchar(pStr, 1, ']');
+  }
+  zJson = sqlite3_str_finish(pStr);
+  if( zJson==0 ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  sqlite3_result_text(pCtx, zJson, -1, sqlite3_free);
+}
+
+/*
+** SQL function: graph_job_cancel(id)
+** Ask job id to stop. Returns 1 if it was still running, else 0.
+*/
+static void graphJobCancelFunc(sqlite3_context *pCtx, int argc,
+                               sqlite3_value **argv){
+  GraphConn *pConn = graphRegistryConn(sqlite3_context_db_handle(pCtx));
+  GraphJob *pJob = pConn ? jobFind(pConn, sqlite3_value_int64(argv[0])) : 0;
+  int bRunning = 0;
+
+  (void)argc;
+  if( pJob && pJob->eState==JOB_RUNNING ){
+    pthread_mutex_lock(&pJob->mutex);
+    bRunning = !pJob->bDone;
+    pthread_mutex_unlock(&pJob->mutex);
+    if( bRunning ){
+      __atomic_store_n(&pJob->progress.bCancel, 1, __ATOMIC_RELAXED);
+    }
+  }
+  sqlite3_result_int(pCtx, bRunning);
+}
+
+int graphRegisterJobs(sqlite3 *pDb){
+  int rc;
+
+  rc = sqlite3_create_function(pDb, "graph_job_submit", -1, SQLITE_UTF8, 0,
+                               graphJobSubmitFunc, 0, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(pDb, "graph_job_status", -1, SQLITE_UTF8,
+                                 0, graphJobStatusFunc, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(pDb, "graph_job_cancel", 1, SQLITE_UTF8, 0,
+                                 graphJobCancelFunc, 0, 0);
+  }
+  return rc;
+}
@@ -0,0 +1,335 @@
+/*
+** SQLite Graph Database Extension - graph_metrics Virtual Table
+**
+** Eponymous virtual table over the process-wide metrics: one row per
+** counter, per operator type and per query fingerprint, shaped so a
+** Prometheus exporter can turn each row into a sample:
+**
+**   metric   Metric name, e.g. plan_cache_hits_total
+**   label    Operator type or query fingerprint, NULL for plain counters
+**   value    Counter value; the sample count for query_latency_us
+**   query    Normalized query text of a fingerprint
+**   sum      Sum of the samples, in microseconds
+**   p50, p90, p99, max
+**            Percentiles, as the upper bound of the bucket holding them
+**   buckets  JSON [[upper_bound, count], ...] for the non-empty buckets
+**
+** Each scan takes one snapshot in xFilter, so the rows of a scan are
+** consistent with each other.
+**
+** Memory allocation: Rows are built with sqlite3_malloc() at xFilter
+** Error handling: Returns SQLite error codes
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include <string.h>
+#include "graph.h"
+#include "graph-metrics.h"
+#include "graph-performance.h"
+#include "cypher-planner.h"
+
+#define METRICS_COL_METRIC   0
+#define METRICS_COL_LABEL    1
+#define METRICS_COL_VALUE    2
+#define METRICS_COL_QUERY    3
+#define METRICS_COL_SUM      4
+#define METRICS_COL_P50      5
+#define METRICS_COL_P90      6
+#define METRICS_COL_P99      7
+#define METRICS_COL_MAX      8
+#define METRICS_COL_BUCKETS  9
+
+/* Names of the GraphMetric counters, in enum order */
+static const char *const azMetricName[GRAPH_METRIC_COUNT] = {
+  "queries_total",
+  "csr_builds_total",
+  "csr_build_us_total",
+  "csr_file_loads_total",
+  "csr_file_saves_total",
+  "result_cache_hits_total",
+  "result_cache_stale_hits_total",
+  "result_cache_misses_total",
+  "result_cache_refreshes_total",
+  "bulk_loads_total",
+  "bulk_load_rows_total",
+  "bulk_load_bytes_total",
+  "bulk_load_us_total",
+  "arena_peak_bytes",
+};
+
+typedef struct MetricsRow {
+  const char *zMetric;           /* Static metric name */
+  const char *zLabel;            /* Static label, or NULL */
+  sqlite3_int64 iValue;
+  GraphMetricHist *pHist;        /* Histogram rows only */
+} MetricsRow;
+
+typedef struct MetricsCursor {
+  sqlite3_vtab_cursor base;      /* Base class - must be first */
+  GraphMetricsSnapshot snap;     /* Snapshot the rows point into */
+  MetricsRow *aRow;
+  int nRow;
+  int iRow;                      /* Current row */
+} MetricsCursor;
+
+static int metricsConnect(sqlite3 *db, void *pAux, int argc,
+                          const char *const *argv, sqlite3_vtab **ppVtab,
+                          char **pzErr) {
+  sqlite3_vtab *pNew;
+  int rc;
+  (void)pAux; (void)argc; (void)argv; (void)pzErr;
+
+  rc = sqlite3_declare_vtab(db,
+      "CREATE TABLE x(metric, label, value, query, sum, p50, p90, p99, max,"
+      " buckets)");
+  if( rc != SQLITE_OK ) return rc;
+
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( !pNew ) return SQLITE_NOMEM;
+  memset(pNew, 0, sizeof(*pNew));
+  *ppVtab = pNew;
+  return SQLITE_OK;
+}
+
+static int metricsDisconnect(sqlite3_vtab *pVtab) {
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+static int metricsBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo) {
+  (void)pVtab;
+  pInfo->estimatedCost = 100.0;
+  pInfo->estimatedRows = 100;
+  return SQLITE_OK;
+}
+
+static int metricsOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+  MetricsCursor *pCur;
+  (void)pVtab;
+
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( !pCur ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void metricsCursorReset(MetricsCursor *pCur) {
+  graphMetricsSnapshotFree(&pCur->snap);
+  sqlite3_free(pCur->aRow);
+  pCur->aRow = NULL;
+  pCur->nRow = 0;
+  pCur->iRow = 0;
+}
+
+static int metricsClose(sqlite3_vtab_cursor *pCursor) {
+  MetricsCursor *pCur = (MetricsCursor*)pCursor;
+  metricsCursorReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static void metricsAddRow(MetricsCursor *pCur, const char *zMetric,
+                          const char *zLabel, sqlite3_int64 iValue,
+                          GraphMetricHist *pHist) {
+  MetricsRow *pRow = &pCur->aRow[pCur->nRow++];
+  pRow->zMetric = zMetric;
+  pRow->zLabel = zLabel;
+  pRow->iValue = iValue;
+  pRow->pHist = pHist;
+}
+
+static int metricsFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                         const char *idxStr, int argc, sqlite3_value **argv) {
+  MetricsCursor *pCur = (MetricsCursor*)pCursor;
+  GraphMetricsSnapshot *pSnap = &pCur->snap;
+  sqlite3_int64 nHits, nMisses, nQueued;
+  size_t nCacheBytes;
+  int nEntries, nWorkers;
+  int nAlloc;
+  int rc;
+  int i;
+  (void)idxNum; (void)idxStr; (void)argc; (void)argv;
+
+  metricsCursorReset(pCur);
+  rc = graphMetricsSnapshot(pSnap);
+  if( rc != SQLITE_OK ) return rc;
+  graphPlanCacheStats(&nHits, &nMisses, &nEntries, &nCacheBytes);
+  graphSchedulerQueueDepth(&nQueued, &nWorkers);
+
+  nAlloc = GRAPH_METRIC_COUNT + GRAPH_METRIC_OPERATORS + 6 + pSnap->nHist;
+  pCur->aRow = sqlite3_malloc64(nAlloc * sizeof(MetricsRow));
+  if( !pCur->aRow ) return SQLITE_NOMEM;
+
+  for( i = 0; i < GRAPH_METRIC_COUNT; i++ ) {
+    metricsAddRow(pCur, azMetricName[i], NULL, pSnap->aCounter[i], NULL);
+  }
+  for( i = 0; i < GRAPH_METRIC_OPERATORS; i++ ) {
+    if( pSnap->aOperator[i] == 0 ) continue;
+    metricsAddRow(pCur, "operator_executions_total",
+                  physicalOperatorTypeName((PhysicalOperatorType)i),
+                  pSnap->aOperator[i], NULL);
+  }
+  metricsAddRow(pCur, "plan_cache_hits_total", NULL, nHits, NULL);
+  metricsAddRow(pCur, "plan_cache_misses_total", NULL, nMisses, NULL);
+  metricsAddRow(pCur, "plan_cache_entries", NULL, nEntries, NULL);
+  metricsAddRow(pCur, "plan_cache_bytes", NULL, (sqlite3_int64)nCacheBytes, NULL);
+  metricsAddRow(pCur, "worker_queue_depth", NULL, nQueued, NULL);
+  metricsAddRow(pCur, "workers", NULL, nWorkers, NULL);
+  for( i = 0; i < pSnap->nHist; i++ ) {
+    metricsAddRow(pCur, "query_latency_us", NULL, pSnap->aHist[i].nCount,
+                  &pSnap->aHist[i]);
+  }
+  return SQLITE_OK;
+}
+
+static int metricsNext(sqlite3_vtab_cursor *pCursor) {
+  ((MetricsCursor*)pCursor)->iRow++;
+  return SQLITE_OK;
+}
+
+static int metricsEof(sqlite3_vtab_cursor *pCursor) {
+  MetricsCursor *pCur = (MetricsCursor*)pCursor;
+  return pCur->iRow >= pCur->nRow;
+}
+
+/* Non-empty buckets of a histogram as a JSON array of [upper, count] */
+static char *metricsBucketsJson(const GraphMetricHist *pHist) {
+  sqlite3_str *pStr = sqlite3_str_new(0);
+  int bFirst = 1;
+  int i;
+
+  sqlite3_str_appendchar(pStr, 1, '[');
+  for( i = 0; i < GRAPH_HIST_BUCKETS; i++ ) {
+    if( pHist->aBucket[i] == 0 ) continue;
+    sqlite3_str_appendf(pStr, "%s[%lld,%lld]", bFirst ? "" : ",",
+                        graphHistBucketMax(i), pHist->aBucket[i]);
+    bFirst = 0;
+  }
+  sqlite3_str_appendchar(pStr, 1, ']');
+  return sqlite3_str_finish(pStr);
+}
+
+/*
+** Plan cache keys are "<graph>\x1f<normalized query>"; the separator is
+** shown as ": " so the text reads as graph and query.
+*/
+static void metricsResultQuery(sqlite3_context *pCtx, const char *zKey) {
+  const char *zSep = strchr(zKey, '\x1f');
+  char *z;
+
+  if( !zSep ) {
+    sqlite3_result_text(pCtx, zKey, -1, SQLITE_TRANSIENT);
+    return;
+  }
+  z = sqlite3_mprintf("%.*s: %s", (int)(zSep - zKey), zKey, zSep + 1);
+  if( !z ) {
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  sqlite3_result_text(pCtx, z, -1, sqlite3_free);
+}
+
+static int metricsColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx,
+                         int iCol) {
+  MetricsCursor *pCur = (MetricsCursor*)pCursor;
+  MetricsRow *pRow = &pCur->aRow[pCur->iRow];
+  GraphMetricHist *pHist = pRow->pHist;
+  char *z;
+
+  switch( iCol ) {
+    case METRICS_COL_METRIC:
+      sqlite3_result_text(pCtx, pRow->zMetric, -1, SQLITE_STATIC);
+      return SQLITE_OK;
+    case METRICS_COL_LABEL:
+      if( pHist && pHist->iFinger ) {
+        z = sqlite3_mprintf("%016llx", pHist->iFinger);
+        if( !z ) return SQLITE_NOMEM;
+        sqlite3_result_text(pCtx, z, -1, sqlite3_free);
+      } else if( pHist ) {
+        sqlite3_result_text(pCtx, "(other)", -1, SQLITE_STATIC);
+      } else if( pRow->zLabel ) {
+        sqlite3_result_text(pCtx, pRow->zLabel, -1, SQLITE_STATIC);
+      }
+      return SQLITE_OK;
+    case METRICS_COL_VALUE:
+      sqlite3_result_int64(pCtx, pRow->iValue);
+      return SQLITE_OK;
+    default:
+      break;
+  }
+
+  if( !pHist ) return SQLITE_OK;
+  switch( iCol ) {
+    case METRICS_COL_QUERY:
+      if( pHist->zKey ) metricsResultQuery(pCtx, pHist->zKey);
+      break;
+    case METRICS_COL_SUM:
+      sqlite3_result_int64(pCtx, pHist->nSum);
+      break;
+    case METRICS_COL_P50:
+      sqlite3_result_int64(pCtx, graphHistPercentile(pHist, 0.50));
+      break;
+    case METRICS_COL_P90:
+      sqlite3_result_int64(pCtx, graphHistPercentile(pHist, 0.90));
+      break;
+    case METRICS_COL_P99:
+      sqlite3_result_int64(pCtx, graphHistPercentile(pHist, 0.99));
+      break;
+    case METRICS_COL_MAX:
+      sqlite3_result_int64(pCtx, pHist->nMax);
+      break;
+    case METRICS_COL_BUCKETS:
+      z = metricsBucketsJson(pHist);
+      if( !z ) return SQLITE_NOMEM;
+      sqlite3_result_text(pCtx, z, -1, sqlite3_free);
+      sqlite3_result_subtype(pCtx, 'J');
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int metricsRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+  *pRowid = ((MetricsCursor*)pCursor)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only module: xCreate is NULL, so graph_metrics exists in
+** every schema without CREATE VIRTUAL TABLE.
+*/
+static sqlite3_module graphMetricsModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  metricsConnect,         /* xConnect */
+  metricsBestIndex,       /* xBestIndex */
+  metricsDisconnect,      /* xDisconnect */
+  0,                      /* xDestroy */
+  metricsOpen,            /* xOpen */
+  metricsClose,           /* xClose */
+  metricsFilter,          /* xFilter */
+  metricsNext,            /* xNext */
+  metricsEof,             /* xEof */
+  metricsColumn,          /* xColumn */
+  metricsRowid,           /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+int graphRegisterMetrics(sqlite3 *db) {
+  return sqlite3_create_module(db, "graph_metrics", &graphMetricsModule, 0);
+}
@@ -0,0 +1,383 @@
+/*
+** SQLite Graph Database Extension - Always-On Metrics
+**
+** Per-thread metric shards and the log-linear latency histograms kept in
+** them. See graph-metrics.h for the model; the graph_metrics virtual
+** table that reads them is in graph-metrics-vtab.c.
+**
+** A shard is written only by its thread. Values are updated with a
+** relaxed load and store rather than a read-modify-write, which costs the
+** same as a plain increment; readers may see a histogram's count ahead of
+** its buckets by a sample or two, never a torn value. Histograms are
+** published into a shard with a release store of the slot followed by
+** one of the slot count, so a reader that sees the count sees the slot.
+**
+** Memory allocation: sqlite3_malloc(); a failed allocation drops the
+** sample rather than reporting an error
+** Thread safety: Recording is lock-free; the shard list, the retired
+** shard and snapshots are guarded by g_metricsMutex
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "graph.h"
+#include "graph-metrics.h"
+
+typedef struct MetricShard MetricShard;
+struct MetricShard {
+  sqlite3_int64 aCounter[GRAPH_METRIC_COUNT];
+  sqlite3_int64 aOperator[GRAPH_METRIC_OPERATORS];
+  int nHist;                                   /* Slots published */
+  GraphMetricHist *apHist[GRAPH_METRIC_QUERY_SLOTS];
+  GraphMetricHist *pOther;                     /* Fingerprints past the slots */
+  MetricShard *pNext;                          /* Next live shard */
+};
+
+static pthread_mutex_t g_metricsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_metricsOnce = PTHREAD_ONCE_INIT;
+
+/* Guarded by g_metricsMutex, except key and bKey (g_metricsOnce) */
+static struct {
+  pthread_key_t key;             /* Retires a shard at thread exit */
+  int bKey;                      /* True if key was created */
+  MetricShard *pShards;          /* Shards of live threads */
+  MetricShard retired;           /* Sum of the shards of exited threads */
+} g_metrics;
+
+static __thread MetricShard *t_pShard;
+
+static sqlite3_int64 metricLoad(const sqlite3_int64 *p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void metricStore(sqlite3_int64 *p, sqlite3_int64 v) {
+  __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static int metricIsPeak(int iMetric) {
+  return iMetric == GRAPH_METRIC_ARENA_PEAK;
+}
+
+/*
+** Find the histogram for fingerprint iFinger in p, adding it if there is
+** a free slot. Fingerprints past the slots, and fingerprint 0, share
+** p->pOther. Called by the shard's thread, or on the retired shard with
+** the mutex held.
+*/
+static GraphMetricHist *metricHistFind(MetricShard *p, sqlite3_uint64 iFinger,
+                                       const char *zKey) {
+  GraphMetricHist *pHist;
+  int n = __atomic_load_n(&p->nHist, __ATOMIC_RELAXED);
+  int i;
+
+  if( iFinger != 0 ) {
+    for( i = 0; i < n; i++ ) {
+      if( p->apHist[i]->iFinger == iFinger ) return p->apHist[i];
+    }
+    if( n < GRAPH_METRIC_QUERY_SLOTS ) {
+      pHist = sqlite3_malloc(sizeof(*pHist));
+      if( !pHist ) return NULL;
+      memset(pHist, 0, sizeof(*pHist));
+      pHist->iFinger = iFinger;
+      pHist->zKey = sqlite3_mprintf("%s", zKey ? zKey : "");
+      if( !pHist->zKey ) {
+        sqlite3_free(pHist);
+        return NULL;
+      }
+      __atomic_store_n(&p->apHist[n], pHist, __ATOMIC_RELEASE);
+      __atomic_store_n(&p->nHist, n + 1, __ATOMIC_RELEASE);
+      return pHist;
+    }
+  }
+
+  if( !p->pOther ) {
+    pHist = sqlite3_malloc(sizeof(*pHist));
+    if( !pHist ) return NULL;
+    memset(pHist, 0, sizeof(*pHist));
+    __atomic_store_n(&p->pOther, pHist, __ATOMIC_RELEASE);
+  }
+  return p->pOther;
+}
+
+/* Add the counts of pFrom to pTo, which no other thread writes */
+static void metricHistMerge(GraphMetricHist *pTo, const GraphMetricHist *pFrom) {
+  sqlite3_int64 nMax = metricLoad(&pFrom->nMax);
+  int i;
+
+  pTo->nCount += metricLoad(&pFrom->nCount);
+  pTo->nSum += metricLoad(&pFrom->nSum);
+  if( nMax > pTo->nMax ) pTo->nMax = nMax;
+  for( i = 0; i < GRAPH_HIST_BUCKETS; i++ ) {
+    pTo->aBucket[i] += metricLoad(&pFrom->aBucket[i]);
+  }
+}
+
+static void metricHistFree(GraphMetricHist *pHist) {
+  if( pHist ) {
+    sqlite3_free(pHist->zKey);
+    sqlite3_free(pHist);
+  }
+}
+
+/*
+** Thread-exit destructor: fold a shard into the retired shard and free
+** it. The fold happens under the mutex, so a concurrent snapshot counts
+** the shard either live or retired, never both.
+*/
+static void metricShardRetire(void *pArg) {
+  MetricShard *p = (MetricShard*)pArg;
+  MetricShard *pRetired = &g_metrics.retired;
+  MetricShard **pp;
+  int i;
+
+  pthread_mutex_lock(&g_metricsMutex);
+  for( pp = &g_metrics.pShards; *pp; pp = &(*pp)->pNext ) {
+    if( *pp == p ) {
+      *pp = p->pNext;
+      break;
+    }
+  }
+  for( i = 0; i < GRAPH_METRIC_COUNT; i++ ) {
+    if( metricIsPeak(i) ) {
+      if( p->aCounter[i] > pRetired->aCounter[i] ) {
+        metricStore(&pRetired->aCounter[i], p->aCounter[i]);
+      }
+    } else {
+      metricStore(&pRetired->aCounter[i], pRetired->aCounter[i] + p->aCounter[i]);
+    }
+  }
+  for( i = 0; i < GRAPH_METRIC_OPERATORS; i++ ) {
+    metricStore(&pRetired->aOperator[i], pRetired->aOperator[i] + p->aOperator[i]);
+  }
+  for( i = 0; i < p->nHist; i++ ) {
+    GraphMetricHist *pTo = metricHistFind(pRetired, p->apHist[i]->iFinger,
+                                          p->apHist[i]->zKey);
+    if( pTo ) metricHistMerge(pTo, p->apHist[i]);
+  }
+  if( p->pOther ) {
+    GraphMetricHist *pTo = metricHistFind(pRetired, 0, NULL);
+    if( pTo ) metricHistMerge(pTo, p->pOther);
+  }
+  pthread_mutex_unlock(&g_metricsMutex);
+
+  for( i = 0; i < p->nHist; i++ ) metricHistFree(p->apHist[i]);
+  metricHistFree(p->pOther);
+  sqlite3_free(p);
+  t_pShard = NULL;
+}
+
+static void metricsInitKey(void) {
+  g_metrics.bKey = pthread_key_create(&g_metrics.key, metricShardRetire) == 0;
+}
+
+/* The calling thread's shard, created on first use. NULL on OOM. */
+static MetricShard *metricShard(void) {
+  MetricShard *p = t_pShard;
+
+  if( p ) return p;
+  pthread_once(&g_metricsOnce, metricsInitKey);
+  p = sqlite3_malloc(sizeof(*p));
+  if( !p ) return NULL;
+  memset(p, 0, sizeof(*p));
+
+  pthread_mutex_lock(&g_metricsMutex);
+  p->pNext = g_metrics.pShards;
+  g_metrics.pShards = p;
+  pthread_mutex_unlock(&g_metricsMutex);
+
+  /* Without a key the shard simply outlives its thread */
+  if( g_metrics.bKey ) pthread_setspecific(g_metrics.key, p);
+  t_pShard = p;
+  return p;
+}
+
+void graphMetricAdd(GraphMetric eMetric, sqlite3_int64 n) {
+  MetricShard *p = metricShard();
+  if( !p || eMetric < 0 || eMetric >= GRAPH_METRIC_COUNT ) return;
+  metricStore(&p->aCounter[eMetric], p->aCounter[eMetric] + n);
+}
+
+void graphMetricPeak(GraphMetric eMetric, sqlite3_int64 n) {
+  MetricShard *p = metricShard();
+  if( !p || eMetric < 0 || eMetric >= GRAPH_METRIC_COUNT ) return;
+  if( n > p->aCounter[eMetric] ) metricStore(&p->aCounter[eMetric], n);
+}
+
+void graphMetricOperator(int eType) {
+  MetricShard *p = metricShard();
+  if( !p || eType < 0 || eType >= GRAPH_METRIC_OPERATORS ) return;
+  metricStore(&p->aOperator[eType], p->aOperator[eType] + 1);
+}
+
+/* FNV-1a of the key; 0 is reserved for "(other)" */
+static sqlite3_uint64 metricFingerprint(const char *zKey) {
+  sqlite3_uint64 h = 14695981039346656037ULL;
+  const unsigned char *z = (const unsigned char*)zKey;
+
+  for( ; *z; z++ ) {
+    h ^= *z;
+    h *= 1099511628211ULL;
+  }
+  return h ? h : 1;
+}
+
+void graphMetricLatency(const char *zKey, sqlite3_int64 nMicro) {
+  MetricShard *p;
+  GraphMetricHist *pHist;
+  int iBucket;
+
+  if( !zKey ) return;
+  p = metricShard();
+  if( !p ) return;
+  pHist = metricHistFind(p, metricFingerprint(zKey), zKey);
+  if( !pHist ) return;
+
+  if( nMicro < 0 ) nMicro = 0;
+  iBucket = graphHistBucket(nMicro);
+  metricStore(&pHist->aBucket[iBucket], pHist->aBucket[iBucket] + 1);
+  metricStore(&pHist->nSum, pHist->nSum + nMicro);
+  if( nMicro > pHist->nMax ) metricStore(&pHist->nMax, nMicro);
+  metricStore(&pHist->nCount, pHist->nCount + 1);
+}
+
+sqlite3_int64 graphMetricsClock(void) {
+  struct timespec ts;
+  if( clock_gettime(CLOCK_MONOTONIC, &ts) != 0 ) return 0;
+  return (sqlite3_int64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+** Values below GRAPH_HIST_SUB have a bucket each. Above that, the bucket
+** is the position of the top bit followed by the GRAPH_HIST_SUB_LOG bits
+** under it.
+*/
+int graphHistBucket(sqlite3_int64 v) {
+  int e;
+
+  if( v < GRAPH_HIST_SUB ) return v < 0 ? 0 : (int)v;
+  e = 63 - __builtin_clzll((unsigned long long)v);
+  if( e > GRAPH_HIST_MAX_LOG ) return GRAPH_HIST_BUCKETS - 1;
+  return (e - GRAPH_HIST_SUB_LOG + 1) * GRAPH_HIST_SUB
+       + (int)((v >> (e - GRAPH_HIST_SUB_LOG)) & (GRAPH_HIST_SUB - 1));
+}
+
+sqlite3_int64 graphHistBucketMax(int iBucket) {
+  int e, iSub;
+
+  if( iBucket < GRAPH_HIST_SUB ) return iBucket;
+  e = iBucket / GRAPH_HIST_SUB + GRAPH_HIST_SUB_LOG - 1;
+  iSub = iBucket % GRAPH_HIST_SUB;
+  return ((sqlite3_int64)(GRAPH_HIST_SUB + iSub + 1) << (e - GRAPH_HIST_SUB_LOG)) - 1;
+}
+
+sqlite3_int64 graphHistPercentile(const GraphMetricHist *pHist, double q) {
+  sqlite3_int64 nRank, nSeen = 0;
+  double rRank;
+  int i;
+
+  if( pHist->nCount <= 0 ) return 0;
+  rRank = q * (double)pHist->nCount;
+  nRank = (sqlite3_int64)rRank;
+  if( (double)nRank < rRank ) nRank++;
+  if( nRank < 1 ) nRank = 1;
+
+  for( i = 0; i < GRAPH_HIST_BUCKETS; i++ ) {
+    nSeen += pHist->aBucket[i];
+    if( nSeen >= nRank ) {
+      sqlite3_int64 v = graphHistBucketMax(i);
+      return v < pHist->nMax ? v : pHist->nMax;
+    }
+  }
+  return pHist->nMax;
+}
+
+/* Merge one shard into a snapshot. Snapshot histograms own their keys. */
+static int metricSnapshotAdd(GraphMetricsSnapshot *pSnap, MetricShard *p,
+                             GraphMetricHist **ppOther) {
+  int nHist = __atomic_load_n(&p->nHist, __ATOMIC_ACQUIRE);
+  GraphMetricHist *pOther;
+  int i, j;
+
+  for( i = 0; i < GRAPH_METRIC_COUNT; i++ ) {
+    sqlite3_int64 v = metricLoad(&p->aCounter[i]);
+    if( !metricIsPeak(i) ) {
+      pSnap->aCounter[i] += v;
+    } else if( v > pSnap->aCounter[i] ) {
+      pSnap->aCounter[i] = v;
+    }
+  }
+  for( i = 0; i < GRAPH_METRIC_OPERATORS; i++ ) {
+    pSnap->aOperator[i] += metricLoad(&p->aOperator[i]);
+  }
+
+  for( i = 0; i < nHist; i++ ) {
+    GraphMetricHist *pFrom = __atomic_load_n(&p->apHist[i], __ATOMIC_ACQUIRE);
+    for( j = 0; j < pSnap->nHist; j++ ) {
+      if( pSnap->aHist[j].iFinger == pFrom->iFinger ) break;
+    }
+    if( j == pSnap->nHist ) {
+      GraphMetricHist *aNew = sqlite3_realloc64(pSnap->aHist,
+                                  (pSnap->nHist + 1) * sizeof(GraphMetricHist));
+      if( !aNew ) return SQLITE_NOMEM;
+      pSnap->aHist = aNew;
+      memset(&aNew[j], 0, sizeof(GraphMetricHist));
+      aNew[j].iFinger = pFrom->iFinger;
+      aNew[j].zKey = sqlite3_mprintf("%s", pFrom->zKey);
+      if( !aNew[j].zKey ) return SQLITE_NOMEM;
+      pSnap->nHist++;
+    }
+    metricHistMerge(&pSnap->aHist[j], pFrom);
+  }
+
+  pOther = __atomic_load_n(&p->pOther, __ATOMIC_ACQUIRE);
+  if( pOther ) {
+    if( !*ppOther ) {
+      *ppOther = sqlite3_malloc(sizeof(GraphMetricHist));
+      if( !*ppOther ) return SQLITE_NOMEM;
+      memset(*ppOther, 0, sizeof(GraphMetricHist));
+    }
+    metricHistMerge(*ppOther, pOther);
+  }
+  return SQLITE_OK;
+}
+
+int graphMetricsSnapshot(GraphMetricsSnapshot *pSnap) {
+  GraphMetricHist *pOther = NULL;
+  MetricShard *p;
+  int rc;
+
+  memset(pSnap, 0, sizeof(*pSnap));
+  pthread_mutex_lock(&g_metricsMutex);
+  rc = metricSnapshotAdd(pSnap, &g_metrics.retired, &pOther);
+  for( p = g_metrics.pShards; p && rc == SQLITE_OK; p = p->pNext ) {
+    rc = metricSnapshotAdd(pSnap, p, &pOther);
+  }
+  pthread_mutex_unlock(&g_metricsMutex);
+
+  if( rc == SQLITE_OK && pOther ) {
+    GraphMetricHist *aNew = sqlite3_realloc64(pSnap->aHist,
+                                (pSnap->nHist + 1) * sizeof(GraphMetricHist));
+    if( aNew ) {
+      pSnap->aHist = aNew;
+      aNew[pSnap->nHist++] = *pOther;
+    } else {
+      rc = SQLITE_NOMEM;
+    }
+  }
+  sqlite3_free(pOther);
+  if( rc != SQLITE_OK ) graphMetricsSnapshotFree(pSnap);
+  return rc;
+}
+
+void graphMetricsSnapshotFree(GraphMetricsSnapshot *pSnap) {
+  int i;
+  for( i = 0; i < pSnap->nHist; i++ ) sqlite3_free(pSnap->aHist[i].zKey);
+  sqlite3_free(pSnap->aHist);
+  memset(pSnap, 0, sizeof(*pSnap));
+}
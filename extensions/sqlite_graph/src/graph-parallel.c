@@ -3,6 +3,12 @@
 **
 ** This file implements multi-threaded query processing with a
 ** work-stealing task scheduler for the SQLite Graph Extension.
+**
+** Each worker owns a Chase-Lev deque (Chase & Lev, SPAA 2005). The owner pushes and pops at
+** the bottom without locking; thieves take from the top with a single
+** CAS. Tasks submitted from outside the pool land in a per-worker inbox
+** that the owner drains into its deque, and idle workers park on their
+** own condition variable rather than a pool-wide one.
 */
 
 #include <sqlite3.h>
@@ -21,26 +27,321 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "graph-performance.h"
 #include "graph-memory.h"
 
+#define TASK_RING_INITIAL_LOG 6      /* 64 slots before the first grow */
+#define TASK_STEAL_ROUNDS     4      /* Rescans after a lost steal race */
+#define TASK_CACHE_LINE       64
+
+/* Circular task buffer. Rings only grow; the ring a deque outgrew stays
+** reachable through pRetired because a thief may still be reading it. */
+typedef struct TaskRing {
+    sqlite3_int64 nMask;         /* Capacity - 1 (capacity is a power of 2) */
+    struct TaskRing *pRetired;   /* Previous, smaller ring */
+    ParallelTask *aSlot[1];      /* Task slots */
+} TaskRing;
+
+/* Chase-Lev work-stealing deque. iTop and iBottom live on separate cache
+** lines so thieves polling top do not bounce the owner's bottom. */
+typedef struct TaskDeque {
+    sqlite3_int64 iTop;          /* Next index to steal */
+    char padTop[TASK_CACHE_LINE - sizeof(sqlite3_int64)];
+    sqlite3_int64 iBottom;       /* Next index to push */
+    TaskRing *pRing;             /* Current ring */
+    char padBottom[TASK_CACHE_LINE - sizeof(sqlite3_int64) - sizeof(void*)];
+} TaskDeque;
+
+/* Completion group for one graphExecuteParallel() call */
+typedef struct ParallelBatch {
+    int nPending;                /* Tasks not yet finished, under mutex */
+    pthread_mutex_t mutex;       /* Guards nPending and the done wait */
+    pthread_cond_t done;         /* Signalled when nPending drops to 0 */
+} ParallelBatch;
+
+/* Per-worker counters, kept apart from the worker so they outlive it */
+typedef struct WorkerStats {
+    sqlite3_int64 tasksExecuted; /* Tasks run by this worker */
+    sqlite3_int64 tasksStolen;   /* Tasks taken from other workers */
+} WorkerStats;
+
 /* Thread-local storage for worker threads */
 typedef struct WorkerContext {
+    TaskDeque deque;             /* Owner-local task deque */
     int threadId;                /* Worker thread ID */
-    TaskScheduler *scheduler;    /* Parent scheduler */
-    ParallelTask *localQueue;    /* Thread-local task queue */
-    int localQueueSize;          /* Number of tasks in local queue */
     pthread_t thread;            /* Thread handle */
+    pthread_mutex_t mutex;       /* Guards pInbox, bWake and shouldStop */
+    pthread_cond_t wake;         /* Parking event for this worker */
+    ParallelTask *pInbox;        /* Tasks submitted from other threads */
+    ParallelTask *pInboxTail;    /* Last task in pInbox */
+    int bWake;                   /* Event flag, cleared when consumed */
+    int bParked;                 /* True while waiting on wake */
     int shouldStop;              /* Stop flag */
-    sqlite3_int64 tasksExecuted; /* Statistics */
-    sqlite3_int64 tasksStolen;   /* Work stealing statistics */
+    unsigned int iRand;          /* Victim selection state */
+    WorkerStats *pStats;         /* Statistics */
 } WorkerContext;
 
 /* Global thread pool state */
 static struct {
     WorkerContext *workers;      /* Array of worker contexts */
     int nWorkers;                /* Number of worker threads */
-    pthread_mutex_t globalMutex; /* Global synchronization */
-    pthread_cond_t workAvailable;/* Work available condition */
+    int nRef;                    /* Live schedulers sharing the pool */
+    int nTarget;                 /* Size for the next start, 0 for every core */
+    int nUsers;                  /* Connections with the extension loaded */
+    int stealingEnabled;         /* Work stealing between workers */
+    unsigned int iNextWorker;    /* Round-robin submission cursor (atomic) */
     int initialized;             /* Initialization flag */
-} g_threadPool = {0};
+    WorkerStats *aStats;         /* Counters of the current or last pool */
+    int nStats;                  /* Entries in aStats */
+} g_threadPool = { .stealingEnabled = 1 };
+
+/* Serializes pool start-up, tear-down, resizing and statistics reads */
+static pthread_mutex_t g_poolLifecycleMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sentinel returned by dequeSteal() when it lost a race */
+#define TASK_ABORT ((ParallelTask*)1)
+
+static TaskRing *taskRingNew(sqlite3_int64 nSlot) {
+    TaskRing *pRing = sqlite3_malloc64(sizeof(TaskRing)
+                                     + (nSlot - 1) * sizeof(ParallelTask*));
+    if (!pRing) return NULL;
+    pRing->nMask = nSlot - 1;
+    pRing->pRetired = NULL;
+    return pRing;
+}
+
+static int dequeInit(TaskDeque *pDeque) {
+    memset(pDeque, 0, sizeof(*pDeque));
+    pDeque->pRing = taskRingNew((sqlite3_int64)1 << TASK_RING_INITIAL_LOG);
+    return pDeque->pRing ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+static void dequeFree(TaskDeque *pDeque) {
+    TaskRing *pRing = pDeque->pRing;
+    while (pRing) {
+        TaskRing *pOld = pRing->pRetired;
+        sqlite3_free(pRing);
+        pRing = pOld;
+    }
+    pDeque->pRing = NULL;
+}
+
+/*
+** Owner only: push pTask at the bottom, doubling the ring when full
+*/
+static int dequePush(TaskDeque *pDeque, ParallelTask *pTask) {
+    sqlite3_int64 b = __atomic_load_n(&pDeque->iBottom, __ATOMIC_RELAXED);
+    sqlite3_int64 t = __atomic_load_n(&pDeque->iTop, __ATOMIC_ACQUIRE);
+    TaskRing *pRing = __atomic_load_n(&pDeque->pRing, __ATOMIC_RELAXED);
+
+    if (b - t > pRing->nMask) {
+        TaskRing *pNew = taskRingNew((pRing->nMask + 1) * 2);
+        if (!pNew) return SQLITE_NOMEM;
+        for (sqlite3_int64 i = t; i < b; i++) {
+            pNew->aSlot[i & pNew->nMask] = __atomic_load_n(
+                &pRing->aSlot[i & pRing->nMask], __ATOMIC_RELAXED);
+        }
+        pNew->pRetired = pRing;
+        __atomic_store_n(&pDeque->pRing, pNew, __ATOMIC_RELEASE);
+        pRing = pNew;
+    }
+    __atomic_store_n(&pRing->aSlot[b & pRing->nMask], pTask, __ATOMIC_RELAXED);
+    __atomic_store_n(&pDeque->iBottom, b + 1, __ATOMIC_RELEASE);
+    return SQLITE_OK;
+}
+
+/*
+** Owner only: pop the most recently pushed task, or NULL when empty
+*/
+static ParallelTask *dequePop(TaskDeque *pDeque) {
+    sqlite3_int64 b = __atomic_load_n(&pDeque->iBottom, __ATOMIC_RELAXED) - 1;
+    TaskRing *pRing = __atomic_load_n(&pDeque->pRing, __ATOMIC_RELAXED);
+    ParallelTask *pTask = NULL;
+    sqlite3_int64 t;
+
+    /* Publish the claim on slot b before reading top (store-load order) */
+    __atomic_store_n(&pDeque->iBottom, b, __ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&pDeque->iTop, __ATOMIC_SEQ_CST);
+
+    if (t <= b) {
+        pTask = __atomic_load_n(&pRing->aSlot[b & pRing->nMask],
+                                __ATOMIC_RELAXED);
+        if (t == b) {
+            /* Last task: race any thief for it */
+            if (!__atomic_compare_exchange_n(&pDeque->iTop, &t, t + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED)) {
+                pTask = NULL;
+            }
+            __atomic_store_n(&pDeque->iBottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&pDeque->iBottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return pTask;
+}
+
+/*
+** Any thread: take the oldest task. Returns NULL when empty and
+** TASK_ABORT when another thread won the race for the top slot.
+*/
+static ParallelTask *dequeSteal(TaskDeque *pDeque) {
+    sqlite3_int64 t = __atomic_load_n(&pDeque->iTop, __ATOMIC_SEQ_CST);
+    sqlite3_int64 b = __atomic_load_n(&pDeque->iBottom, __ATOMIC_SEQ_CST);
+
+    if (t >= b) return NULL;
+
+    TaskRing *pRing = __atomic_load_n(&pDeque->pRing, __ATOMIC_ACQUIRE);
+    ParallelTask *pTask = __atomic_load_n(&pRing->aSlot[t & pRing->nMask],
+                                          __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&pDeque->iTop, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return TASK_ABORT;
+    }
+    return pTask;
+}
+
+/*
+** Set the wake event of worker and signal it if parked
+*/
+static void wakeWorker(WorkerContext *worker) {
+    pthread_mutex_lock(&worker->mutex);
+    worker->bWake = 1;
+    if (worker->bParked) pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+/*
+** Wake one parked worker other than iSelf, if there is one. Called when
+** a worker has stealable tasks queued behind the one it is running.
+*/
+static void wakeIdleWorker(int iSelf) {
+    for (int k = 1; k < g_threadPool.nWorkers; k++) {
+        WorkerContext *worker =
+            &g_threadPool.workers[(iSelf + k) % g_threadPool.nWorkers];
+        if (__atomic_load_n(&worker->bParked, __ATOMIC_RELAXED)) {
+            wakeWorker(worker);
+            return;
+        }
+    }
+}
+
+static void bumpCounter(sqlite3_int64 *pCounter) {
+    /* Single writer; atomic only so graphSchedulerStats() reads whole values */
+    __atomic_store_n(pCounter,
+                     __atomic_load_n(pCounter, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+}
+
+static void runTask(WorkerContext *ctx, ParallelTask *task) {
+    ParallelBatch *pBatch = task->pBatch;
+
+    task->execute(task->arg);
+    bumpCounter(&ctx->pStats->tasksExecuted);
+    sqlite3_free(task);
+
+    /* Decrement and signal under the mutex: the batch lives on the
+    ** waiter's stack, which may return as soon as it sees zero */
+    if (pBatch) {
+        pthread_mutex_lock(&pBatch->mutex);
+        if (--pBatch->nPending == 0) pthread_cond_broadcast(&pBatch->done);
+        pthread_mutex_unlock(&pBatch->mutex);
+    }
+}
+
+/*
+** Move the inbox into the deque and return its first task to run now
+*/
+static ParallelTask *drainInbox(WorkerContext *ctx) {
+    ParallelTask *pList;
+    ParallelTask *task;
+    int nQueued = 0;
+
+    pthread_mutex_lock(&ctx->mutex);
+    pList = ctx->pInbox;
+    __atomic_store_n(&ctx->pInbox, NULL, __ATOMIC_RELAXED);
+    ctx->pInboxTail = NULL;
+    pthread_mutex_unlock(&ctx->mutex);
+
+    if (!pList) return NULL;
+    task = pList;
+    pList = pList->pNext;
+    while (pList) {
+        ParallelTask *pNext = pList->pNext;
+        pList->pNext = NULL;
+        if (dequePush(&ctx->deque, pList) == SQLITE_OK) {
+            nQueued++;
+        } else {
+            runTask(ctx, pList);
+        }
+        pList = pNext;
+    }
+    task->pNext = NULL;
+    if (nQueued > 0 && g_threadPool.stealingEnabled) {
+        wakeIdleWorker(ctx->threadId);
+    }
+    return task;
+}
+
+/*
+** Take one task from another worker's deque or, failing that, from the
+** head of its inbox so submitted work does not wait behind a long task
+*/
+static ParallelTask *stealTask(WorkerContext *ctx) {
+    int nWorkers = g_threadPool.nWorkers;
+
+    for (int iRound = 0; iRound < TASK_STEAL_ROUNDS; iRound++) {
+        int bContended = 0;
+        int iStart;
+
+        ctx->iRand = ctx->iRand * 1103515245u + 12345u;
+        iStart = (int)((ctx->iRand >> 16) % (unsigned int)nWorkers);
+        for (int k = 0; k < nWorkers; k++) {
+            int iVictim = (iStart + k) % nWorkers;
+            WorkerContext *victim = &g_threadPool.workers[iVictim];
+            ParallelTask *task;
+
+            if (iVictim == ctx->threadId) continue;
+            task = dequeSteal(&victim->deque);
+            if (task == TASK_ABORT) {
+                bContended = 1;
+                continue;
+            }
+            if (!task && __atomic_load_n(&victim->pInbox, __ATOMIC_RELAXED)
+             && pthread_mutex_trylock(&victim->mutex) == 0) {
+                task = victim->pInbox;
+                if (task) {
+                    __atomic_store_n(&victim->pInbox, task->pNext, __ATOMIC_RELAXED);
+                    if (!task->pNext) victim->pInboxTail = NULL;
+                    task->pNext = NULL;
+                }
+                pthread_mutex_unlock(&victim->mutex);
+            }
+            if (task) {
+                bumpCounter(&ctx->pStats->tasksStolen);
+                /* More left behind: let another idle worker help */
+                if (__atomic_load_n(&victim->deque.iBottom, __ATOMIC_RELAXED)
+                  > __atomic_load_n(&victim->deque.iTop, __ATOMIC_RELAXED)) {
+                    wakeIdleWorker(ctx->threadId);
+                }
+                return task;
+            }
+        }
+        if (!bContended) break;
+    }
+    return NULL;
+}
+
+/*
+** Block until this worker's wake event is set or its inbox is non-empty
+*/
+static void parkWorker(WorkerContext *ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+    __atomic_store_n(&ctx->bParked, 1, __ATOMIC_RELAXED);
+    while (!ctx->bWake && !ctx->pInbox && !ctx->shouldStop) {
+        pthread_cond_wait(&ctx->wake, &ctx->mutex);
+    }
+    __atomic_store_n(&ctx->bParked, 0, __ATOMIC_RELAXED);
+    ctx->bWake = 0;
+    pthread_mutex_unlock(&ctx->mutex);
+}
 
 /*
 ** Worker thread main function
@@ -48,62 +349,16 @@ static struct {
 static void* workerThreadMain(void *arg) {
     WorkerContext *ctx = (WorkerContext*)arg;
     
-    while (!ctx->shouldStop) {
-        ParallelTask *task = NULL;
+    while (!__atomic_load_n(&ctx->shouldStop, __ATOMIC_RELAXED)) {
+        ParallelTask *task = dequePop(&ctx->deque);
         
-        /* Try to get task from local queue */
-        pthread_mutex_lock(&g_threadPool.globalMutex);
-        if (ctx->localQueue) {
-            task = ctx->localQueue;
-            ctx->localQueue = task->pNext;
-            ctx->localQueueSize--;
-        }
-        pthread_mutex_unlock(&g_threadPool.globalMutex);
-        
-        /* If no local task, try work stealing */
-        if (!task && ctx->scheduler->stealingEnabled) {
-            /* Try to steal from other workers */
-            for (int i = 0; i < g_threadPool.nWorkers; i++) {
-                if (i == ctx->threadId) continue;
-                
-                WorkerContext *victim = &g_threadPool.workers[i];
-                pthread_mutex_lock(&g_threadPool.globalMutex);
-                
-                if (victim->localQueueSize > 1) {
-                    /* Steal half of victim's tasks */
-                    int stealCount = victim->localQueueSize / 2;
-                    ParallelTask **pCurrent = &victim->localQueue;
-                    
-                    /* Find the middle of the queue */
-                    for (int j = 0; j < victim->localQueueSize - stealCount; j++) {
-                        pCurrent = &(*pCurrent)->pNext;
-                    }
-                    
-                    /* Steal tasks */
-                    task = *pCurrent;
-                    *pCurrent = NULL;
-                    victim->localQueueSize -= stealCount;
-                    ctx->tasksStolen += stealCount;
-                }
-                
-                pthread_mutex_unlock(&g_threadPool.globalMutex);
-                if (task) break;
-            }
-        }
+        if (!task) task = drainInbox(ctx);
+        if (!task && g_threadPool.stealingEnabled) task = stealTask(ctx);
         
-        /* Execute task if found */
         if (task) {
-            task->execute(task->arg);
-            ctx->tasksExecuted++;
-            sqlite3_free(task);
+            runTask(ctx, task);
         } else {
-            /* Wait for work */
-            pthread_mutex_lock(&g_threadPool.globalMutex);
-            if (!ctx->shouldStop && !ctx->localQueue) {
-                pthread_cond_wait(&g_threadPool.workAvailable, 
-                                 &g_threadPool.globalMutex);
-            }
-            pthread_mutex_unlock(&g_threadPool.globalMutex);
+            parkWorker(ctx);
         }
     }
     
@@ -111,92 +366,160 @@ static void* workerThreadMain(void *arg) {
 }
 
 /*
-** Create task scheduler
+** Clamp a requested pool size to 1..2*cores, 0 meaning every core
 */
-TaskScheduler* graphCreateTaskScheduler(int nThreads) {
-    TaskScheduler *scheduler = sqlite3_malloc(sizeof(TaskScheduler));
-    if (!scheduler) return NULL;
+static int poolClampSize(int nThreads) {
+    int nCores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nCores < 1) nCores = 1;
+    if (nThreads <= 0) return nCores;
+    if (nThreads > nCores * 2) return nCores * 2;
+    return nThreads;
+}
+
+/*
+** Start nThreads workers. Caller holds g_poolLifecycleMutex.
+*/
+static int poolStart(int nThreads) {
+    WorkerStats *aStats = sqlite3_malloc(nThreads * sizeof(WorkerStats));
+    WorkerContext *workers = sqlite3_malloc(nThreads * sizeof(WorkerContext));
+    int nReady = 0;
     
-    /* Limit threads to available cores */
-    int nCores = sysconf(_SC_NPROCESSORS_ONLN);
-    if (nThreads <= 0 || nThreads > nCores * 2) {
-        nThreads = nCores;
+    if (aStats && workers) {
+        memset(aStats, 0, nThreads * sizeof(WorkerStats));
+        memset(workers, 0, nThreads * sizeof(WorkerContext));
+        while (nReady < nThreads && dequeInit(&workers[nReady].deque) == SQLITE_OK) {
+            nReady++;
+        }
+    }
+    if (nReady < nThreads) {
+        for (int i = 0; i < nReady; i++) dequeFree(&workers[i].deque);
+        sqlite3_free(workers);
+        sqlite3_free(aStats);
+        return SQLITE_NOMEM;
     }
     
-    scheduler->nThreads = nThreads;
-    scheduler->stealingEnabled = 1;
-    scheduler->queues = sqlite3_malloc(nThreads * sizeof(ParallelTask*));
+    sqlite3_free(g_threadPool.aStats);
+    g_threadPool.aStats = aStats;
+    g_threadPool.nStats = nThreads;
+    g_threadPool.workers = workers;
+    g_threadPool.nWorkers = nThreads;
+    g_threadPool.iNextWorker = 0;
     
-    if (!scheduler->queues) {
-        sqlite3_free(scheduler);
-        return NULL;
+    /* Create worker threads */
+    for (int i = 0; i < nThreads; i++) {
+        WorkerContext *worker = &workers[i];
+        worker->threadId = i;
+        worker->iRand = 2654435761u * (unsigned int)(i + 1);
+        worker->pStats = &aStats[i];
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->wake, NULL);
     }
-    
-    /* Initialize global thread pool if needed */
-    if (!g_threadPool.initialized) {
-        pthread_mutex_init(&g_threadPool.globalMutex, NULL);
-        pthread_cond_init(&g_threadPool.workAvailable, NULL);
-        
-        g_threadPool.workers = sqlite3_malloc(nThreads * sizeof(WorkerContext));
-        if (!g_threadPool.workers) {
-            sqlite3_free(scheduler->queues);
-            sqlite3_free(scheduler);
-            return NULL;
-        }
-        
-        g_threadPool.nWorkers = nThreads;
-        
-        /* Create worker threads */
-        for (int i = 0; i < nThreads; i++) {
-            WorkerContext *worker = &g_threadPool.workers[i];
-            memset(worker, 0, sizeof(WorkerContext));
-            worker->threadId = i;
-            worker->scheduler = scheduler;
-            worker->shouldStop = 0;
-            
-            pthread_create(&worker->thread, NULL, workerThreadMain, worker);
-        }
-        
-        g_threadPool.initialized = 1;
+    for (int i = 0; i < nThreads; i++) {
+        pthread_create(&workers[i].thread, NULL, workerThreadMain, &workers[i]);
     }
     
-    return scheduler;
+    g_threadPool.initialized = 1;
+    return SQLITE_OK;
 }
 
 /*
-** Schedule a task for execution
+** Stop and join every worker. Caller holds g_poolLifecycleMutex and no
+** scheduler is live. aStats is kept for graphSchedulerStats().
 */
-int graphScheduleTask(TaskScheduler *scheduler, ParallelTask *task) {
-    if (!scheduler || !task) return SQLITE_MISUSE;
+static void poolStop(void) {
+    if (!g_threadPool.initialized) return;
     
-    /* Find worker with smallest queue */
-    int minQueueSize = INT_MAX;
-    int targetWorker = 0;
+    for (int i = 0; i < g_threadPool.nWorkers; i++) {
+        WorkerContext *worker = &g_threadPool.workers[i];
+        pthread_mutex_lock(&worker->mutex);
+        __atomic_store_n(&worker->shouldStop, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&worker->wake);
+        pthread_mutex_unlock(&worker->mutex);
+    }
     
-    pthread_mutex_lock(&g_threadPool.globalMutex);
+    /* Wait for threads to finish */
+    for (int i = 0; i < g_threadPool.nWorkers; i++) {
+        pthread_join(g_threadPool.workers[i].thread, NULL);
+    }
     
     for (int i = 0; i < g_threadPool.nWorkers; i++) {
-        if (g_threadPool.workers[i].localQueueSize < minQueueSize) {
-            minQueueSize = g_threadPool.workers[i].localQueueSize;
-            targetWorker = i;
-        }
+        WorkerContext *worker = &g_threadPool.workers[i];
+        dequeFree(&worker->deque);
+        pthread_mutex_destroy(&worker->mutex);
+        pthread_cond_destroy(&worker->wake);
+    }
+    sqlite3_free(g_threadPool.workers);
+    g_threadPool.workers = NULL;
+    g_threadPool.nWorkers = 0;
+    g_threadPool.initialized = 0;
+}
+
+/*
+** Create task scheduler. The worker pool is started on first use and
+** then kept for the life of the process, so a scheduler is only a
+** handle: creating one spawns no threads. nThreads picks how many
+** workers the caller splits its work for (0 means the whole pool) and
+** is capped at the pool size.
+*/
+TaskScheduler* graphCreateTaskScheduler(int nThreads) {
+    TaskScheduler *scheduler = sqlite3_malloc(sizeof(TaskScheduler));
+    if (!scheduler) return NULL;
+    
+    pthread_mutex_lock(&g_poolLifecycleMutex);
+    if (!g_threadPool.initialized
+     && poolStart(poolClampSize(g_threadPool.nTarget)) != SQLITE_OK) {
+        pthread_mutex_unlock(&g_poolLifecycleMutex);
+        sqlite3_free(scheduler);
+        return NULL;
     }
+    g_threadPool.nRef++;
     
-    /* Add task to target worker's queue */
-    WorkerContext *worker = &g_threadPool.workers[targetWorker];
-    task->pNext = worker->localQueue;
-    worker->localQueue = task;
-    worker->localQueueSize++;
+    if (nThreads <= 0 || nThreads > g_threadPool.nWorkers) {
+        nThreads = g_threadPool.nWorkers;
+    }
+    scheduler->nThreads = nThreads;
+    scheduler->stealingEnabled = g_threadPool.stealingEnabled;
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
     
-    /* Signal work available */
-    pthread_cond_broadcast(&g_threadPool.workAvailable);
-    pthread_mutex_unlock(&g_threadPool.globalMutex);
+    return scheduler;
+}
+
+/*
+** Append the chain pHead..pTail to worker's inbox and wake it
+*/
+static void submitChain(WorkerContext *worker, ParallelTask *pHead,
+                        ParallelTask *pTail) {
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->pInboxTail) {
+        worker->pInboxTail->pNext = pHead;
+    } else {
+        __atomic_store_n(&worker->pInbox, pHead, __ATOMIC_RELAXED);
+    }
+    worker->pInboxTail = pTail;
+    worker->bWake = 1;
+    if (worker->bParked) pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+/*
+** Schedule a task for execution. Tasks go round-robin into worker
+** inboxes; idle workers steal to even out the load.
+*/
+int graphScheduleTask(TaskScheduler *scheduler, ParallelTask *task) {
+    if (!scheduler || !task) return SQLITE_MISUSE;
+    
+    unsigned int iWorker = __atomic_fetch_add(&g_threadPool.iNextWorker, 1,
+                                              __ATOMIC_RELAXED);
+    task->pNext = NULL;
+    submitChain(&g_threadPool.workers[iWorker % (unsigned int)g_threadPool.nWorkers],
+                task, task);
     
     return SQLITE_OK;
 }
 
 /*
-** Execute multiple tasks in parallel
+** Execute multiple tasks in parallel. The batch is cut into one
+** contiguous chain per worker, so each inbox lock is taken once.
 */
 int graphExecuteParallel(TaskScheduler *scheduler,
                         void (*taskFunc)(void*),
@@ -205,221 +528,410 @@ int graphExecuteParallel(TaskScheduler *scheduler,
         return SQLITE_MISUSE;
     }
     
-    /* Create and schedule tasks */
+    ParallelTask **apTask = sqlite3_malloc(nTasks * sizeof(ParallelTask*));
+    if (!apTask) return SQLITE_NOMEM;
+    
+    ParallelBatch batch;
+    batch.nPending = nTasks;
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done, NULL);
+    
+    /* Create every task before queueing any, so failure leaves nothing
+    ** running that references args */
+    int rc = SQLITE_OK;
     for (int i = 0; i < nTasks; i++) {
-        ParallelTask *task = sqlite3_malloc(sizeof(ParallelTask));
-        if (!task) return SQLITE_NOMEM;
-        
-        task->execute = taskFunc;
-        task->arg = args[i];
-        task->priority = 0;
-        task->pNext = NULL;
-        
-        int rc = graphScheduleTask(scheduler, task);
-        if (rc != SQLITE_OK) {
-            sqlite3_free(task);
-            return rc;
+        apTask[i] = sqlite3_malloc(sizeof(ParallelTask));
+        if (!apTask[i]) {
+            while (i-- > 0) sqlite3_free(apTask[i]);
+            rc = SQLITE_NOMEM;
+            goto done;
         }
+        apTask[i]->execute = taskFunc;
+        apTask[i]->arg = args[i];
+        apTask[i]->priority = 0;
+        apTask[i]->pNext = NULL;
+        apTask[i]->pBatch = &batch;
+        if (i > 0) apTask[i-1]->pNext = apTask[i];
     }
     
-    /* Wait for all tasks to complete */
-    int allDone = 0;
-    while (!allDone) {
-        pthread_mutex_lock(&g_threadPool.globalMutex);
-        
-        allDone = 1;
-        for (int i = 0; i < g_threadPool.nWorkers; i++) {
-            if (g_threadPool.workers[i].localQueueSize > 0) {
-                allDone = 0;
-                break;
-            }
-        }
-        
-        pthread_mutex_unlock(&g_threadPool.globalMutex);
-        
-        if (!allDone) {
-            usleep(1000); /* 1ms sleep */
-        }
+    int nChain = scheduler->nThreads < nTasks ? scheduler->nThreads : nTasks;
+    unsigned int iWorker = __atomic_fetch_add(&g_threadPool.iNextWorker,
+                                              (unsigned int)nChain,
+                                              __ATOMIC_RELAXED);
+    for (int c = 0; c < nChain; c++) {
+        int iFirst = (int)((sqlite3_int64)nTasks * c / nChain);
+        int iLast = (int)((sqlite3_int64)nTasks * (c + 1) / nChain) - 1;
+        apTask[iLast]->pNext = NULL;
+        submitChain(&g_threadPool.workers[(iWorker + c) % (unsigned int)g_threadPool.nWorkers],
+                    apTask[iFirst], apTask[iLast]);
     }
     
-    return SQLITE_OK;
+    /* Wait for every task to finish running */
+    pthread_mutex_lock(&batch.mutex);
+    while (batch.nPending > 0) {
+        pthread_cond_wait(&batch.done, &batch.mutex);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+    
+done:
+    pthread_cond_destroy(&batch.done);
+    pthread_mutex_destroy(&batch.mutex);
+    sqlite3_free(apTask);
+    return rc;
 }
 
 /*
-** Destroy task scheduler
+** Run taskFunc over args[0..nTasks-1] on scheduler, or inline on the
+** calling thread when scheduler is NULL
+*/
+int graphRunTasks(TaskScheduler *scheduler, void (*taskFunc)(void*),
+                  void **args, int nTasks) {
+    if (!scheduler) {
+        for (int i = 0; i < nTasks; i++) {
+            taskFunc(args[i]);
+        }
+        return SQLITE_OK;
+    }
+    return graphExecuteParallel(scheduler, taskFunc, args, nTasks);
+}
+
+/*
+** Destroy task scheduler. The pool keeps running for the next caller;
+** a resize requested while schedulers were live takes effect here.
 */
 void graphDestroyTaskScheduler(TaskScheduler *scheduler) {
     if (!scheduler) return;
     
-    /* Stop all worker threads */
+    pthread_mutex_lock(&g_poolLifecycleMutex);
+    if (--g_threadPool.nRef == 0 && g_threadPool.initialized
+     && g_threadPool.nWorkers != poolClampSize(g_threadPool.nTarget)) {
+        poolStop();
+    }
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
+    
+    sqlite3_free(scheduler);
+}
+
+/*
+** Set the pool size for parallel operators (0 for every core) and
+** return the effective size through pnThreads. A running pool of a
+** different size is restarted once no scheduler is using it.
+*/
+int graphThreadPoolSetSize(int nThreads, int *pnThreads) {
+    if (nThreads < 0) return SQLITE_RANGE;
+    
+    pthread_mutex_lock(&g_poolLifecycleMutex);
+    g_threadPool.nTarget = nThreads;
+    if (g_threadPool.initialized && g_threadPool.nRef == 0
+     && g_threadPool.nWorkers != poolClampSize(nThreads)) {
+        poolStop();
+    }
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
+    
+    if (pnThreads) *pnThreads = poolClampSize(nThreads);
+    return SQLITE_OK;
+}
+
+/*
+** Register a connection as a pool user. Each sqlite3_graph_init() call
+** retains the pool and the matching release runs when the connection
+** closes (as the xDestroy of graph_set_threads), so the workers are
+** joined once the last connection using the extension goes away.
+*/
+void graphThreadPoolRetain(void) {
+    pthread_mutex_lock(&g_poolLifecycleMutex);
+    g_threadPool.nUsers++;
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
+}
+
+void graphThreadPoolRelease(void *pArg) {
+    (void)pArg;
+    pthread_mutex_lock(&g_poolLifecycleMutex);
+    if (g_threadPool.nUsers > 0 && --g_threadPool.nUsers == 0
+     && g_threadPool.nRef == 0) {
+        poolStop();
+    }
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
+}
+
+/*
+** Report per-worker counters of the running pool, or of the last pool
+** if none is running, as a JSON array:
+**   [{"worker":0,"executed":120,"stolen":14}, ...]
+*/
+int graphSchedulerStats(char **pzJson) {
+    sqlite3_str *pStr = sqlite3_str_new(0);
+    int rc;
+    
+    pthread_mutex_lock(&g_poolLifecycleMutex);
+    sqlite3_str_appendchar(pStr, 1, '[');
+    for (int i = 0; i < g_threadPool.nStats; i++) {
+        WorkerStats *pStats = &g_threadPool.aStats[i];
+        sqlite3_str_appendf(pStr, "%s{\"worker\":%d,\"executed\":%lld,"
+                            "\"stolen\":%lld}", i ? "," : "", i,
+                            __atomic_load_n(&pStats->tasksExecuted, __ATOMIC_RELAXED),
+                            __atomic_load_n(&pStats->tasksStolen, __ATOMIC_RELAXED));
+    }
+    sqlite3_str_appendchar(pStr, 1, ']');
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
+    
+    rc = sqlite3_str_errcode(pStr);
+    *pzJson = sqlite3_str_finish(pStr);
+    if (rc == SQLITE_OK && !*pzJson) rc = SQLITE_NOMEM;
+    return rc;
+}
+
+/*
+** Tasks queued and not yet started, over every worker's deque and
+** inbox, and the number of workers; both 0 while the pool is down. The
+** deques are read without stopping their owners, so the count is a
+** snapshot that may be off by the tasks in flight.
+*/
+void graphSchedulerQueueDepth(sqlite3_int64 *pnQueued, int *pnWorkers) {
+    sqlite3_int64 nQueued = 0;
+    int nWorkers = 0;
+    
+    pthread_mutex_lock(&g_poolLifecycleMutex);
     if (g_threadPool.initialized) {
-        pthread_mutex_lock(&g_threadPool.globalMutex);
-        
-        for (int i = 0; i < g_threadPool.nWorkers; i++) {
-            g_threadPool.workers[i].shouldStop = 1;
-        }
-        
-        pthread_cond_broadcast(&g_threadPool.workAvailable);
-        pthread_mutex_unlock(&g_threadPool.globalMutex);
-        
-        /* Wait for threads to finish */
-        for (int i = 0; i < g_threadPool.nWorkers; i++) {
-            pthread_join(g_threadPool.workers[i].thread, NULL);
+        nWorkers = g_threadPool.nWorkers;
+        for (int i = 0; i < nWorkers; i++) {
+            WorkerContext *worker = &g_threadPool.workers[i];
+            sqlite3_int64 t = __atomic_load_n(&worker->deque.iTop, __ATOMIC_RELAXED);
+            sqlite3_int64 b = __atomic_load_n(&worker->deque.iBottom, __ATOMIC_RELAXED);
+            if (b > t) nQueued += b - t;
+            pthread_mutex_lock(&worker->mutex);
+            for (ParallelTask *p = worker->pInbox; p; p = p->pNext) nQueued++;
+            pthread_mutex_unlock(&worker->mutex);
         }
-        
-        /* Cleanup */
-        sqlite3_free(g_threadPool.workers);
-        pthread_mutex_destroy(&g_threadPool.globalMutex);
-        pthread_cond_destroy(&g_threadPool.workAvailable);
-        g_threadPool.initialized = 0;
     }
+    pthread_mutex_unlock(&g_poolLifecycleMutex);
     
-    sqlite3_free(scheduler->queues);
-    sqlite3_free(scheduler);
+    *pnQueued = nQueued;
+    *pnWorkers = nWorkers;
 }
 
 /*
 ** Parallel pattern matching implementation
+**
+** A parallel node scan cuts [min(id), max(id)] into equal-width rowid
+** ranges ("morsels"), several per worker, so skew in the id space is
+** evened out by workers pulling the next morsel from a shared cursor.
+** Each worker reads through its own read-only connection to the same
+** database file (a sqlite3* must not be shared across threads), keeps
+** matches in per-morsel buffers, and the buffers are concatenated in
+** morsel order at the end, so results come back sorted by id.
+**
+** In-memory databases, connections inside an explicit transaction
+** (whose uncommitted rows other connections cannot see) and nThreads==1
+** scan the same morsels serially on the caller's connection.
 */
+#define SCAN_MORSELS_PER_WORKER 16
+
+typedef struct ScanMorsel {
+    sqlite3_int64 iFirst;        /* First id in range */
+    sqlite3_int64 iLast;         /* Last id in range (inclusive) */
+    sqlite3_int64 *aId;          /* Matching ids */
+    int nId;                     /* Entries used in aId */
+    int nAlloc;                  /* Entries allocated in aId */
+} ScanMorsel;
+
 typedef struct ParallelPatternMatch {
-    GraphVtab *pGraph;
-    CypherAst *pattern;
-    sqlite3_int64 startNode;
-    sqlite3_int64 endNode;
-    sqlite3_int64 *results;
-    int nResults;
-    pthread_mutex_t resultMutex;
+    GraphVtab *pGraph;           /* Graph being scanned */
+    const char *zFile;           /* File for a private connection, or NULL */
+    const char *zNeedle;         /* Quoted label to find, or NULL for all */
+    ScanMorsel *aMorsel;         /* Shared morsel array */
+    int nMorsel;                 /* Entries in aMorsel */
+    int *piNextMorsel;           /* Shared cursor (atomic) */
+    int rc;                      /* First error seen by this worker */
 } ParallelPatternMatch;
 
+static int scanMorselAppend(ScanMorsel *pMorsel, sqlite3_int64 iId) {
+    if (pMorsel->nId == pMorsel->nAlloc) {
+        int nNew = pMorsel->nAlloc ? pMorsel->nAlloc * 2 : 64;
+        sqlite3_int64 *aNew = sqlite3_realloc64(pMorsel->aId,
+                                                nNew * sizeof(sqlite3_int64));
+        if (!aNew) return SQLITE_NOMEM;
+        pMorsel->aId = aNew;
+        pMorsel->nAlloc = nNew;
+    }
+    pMorsel->aId[pMorsel->nId++] = iId;
+    return SQLITE_OK;
+}
+
 static void parallelPatternWorker(void *arg) {
     ParallelPatternMatch *match = (ParallelPatternMatch*)arg;
+    sqlite3 *pDb = match->pGraph->pDb;
+    sqlite3_stmt *pStmt = NULL;
     char *zSql;
-    sqlite3_stmt *pStmt;
-    int rc;
+    int rc = SQLITE_OK;
+    
+    if (match->zFile) {
+        rc = sqlite3_open_v2(match->zFile, &pDb,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, 0);
+        if (rc != SQLITE_OK) goto done;
+    }
     
-    zSql = sqlite3_mprintf("SELECT id, labels, properties FROM %s_nodes LIMIT %lld OFFSET %lld", 
-                           match->pGraph->zTableName, 
-                           match->endNode - match->startNode, 
-                           match->startNode);
-    rc = sqlite3_prepare_v2(match->pGraph->pDb, zSql, -1, &pStmt, 0);
+    zSql = sqlite3_mprintf("SELECT id, labels FROM \"%w\" "
+                           "WHERE id BETWEEN ?1 AND ?2",
+                           match->pGraph->zNodeTableName);
+    if (!zSql) {
+        rc = SQLITE_NOMEM;
+        goto done;
+    }
+    rc = sqlite3_prepare_v2(pDb, zSql, -1, &pStmt, 0);
     sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) return;
-
-    while( sqlite3_step(pStmt)==SQLITE_ROW ){
-      sqlite3_int64 nodeId = sqlite3_column_int64(pStmt, 0);
-      const unsigned char *labels = sqlite3_column_text(pStmt, 1);
-
-      int matches = 1;
-      if (match->pattern->zValue && labels) {
-          matches = 0;
-          if( strstr((const char*)labels, match->pattern->zValue) ){
-            matches = 1;
-          }
-      }
-      
-      if (matches) {
-          pthread_mutex_lock(&match->resultMutex);
-          if (match->nResults < 1000) { /* Limit results */
-              match->results[match->nResults++] = nodeId;
-          }
-          pthread_mutex_unlock(&match->resultMutex);
-      }
+    if (rc != SQLITE_OK) goto done;
+    
+    while (rc == SQLITE_OK) {
+        int iMorsel = __atomic_fetch_add(match->piNextMorsel, 1,
+                                         __ATOMIC_RELAXED);
+        if (iMorsel >= match->nMorsel) break;
+        ScanMorsel *pMorsel = &match->aMorsel[iMorsel];
+        
+        sqlite3_bind_int64(pStmt, 1, pMorsel->iFirst);
+        sqlite3_bind_int64(pStmt, 2, pMorsel->iLast);
+        while (rc == SQLITE_OK && sqlite3_step(pStmt) == SQLITE_ROW) {
+            const char *zLabels = (const char*)sqlite3_column_text(pStmt, 1);
+            if (match->zNeedle
+             && (!zLabels || !strstr(zLabels, match->zNeedle))) {
+                continue;
+            }
+            rc = scanMorselAppend(pMorsel, sqlite3_column_int64(pStmt, 0));
+        }
+        if (rc == SQLITE_OK) rc = sqlite3_reset(pStmt);
     }
+    
+done:
     sqlite3_finalize(pStmt);
+    if (match->zFile) sqlite3_close(pDb);
+    match->rc = rc;
 }
 
-int graphParallelPatternMatch(GraphVtab *pGraph, CypherAst *pattern,
-                             sqlite3_int64 **pResults, int *pnResults) {
-    if (!pGraph || !pattern || !pResults || !pnResults) {
-        return SQLITE_MISUSE;
-    }
-    
-    TaskScheduler *scheduler = graphCreateTaskScheduler(0);
-    if (!scheduler) return SQLITE_NOMEM;
-    
-    sqlite3_int64 *results = sqlite3_malloc(1000 * sizeof(sqlite3_int64));
-    if (!results) {
-        graphDestroyTaskScheduler(scheduler);
-        return SQLITE_NOMEM;
-    }
+/*
+** Scan the nodes of pGraph on nThreads workers (0 for the whole pool),
+** returning the ids whose labels contain zLabel (all ids when zLabel is
+** NULL) in ascending order. *paId is from sqlite3_malloc(), NULL when
+** nothing matched.
+*/
+int graphParallelNodeScan(GraphVtab *pGraph, const char *zLabel,
+                          int nThreads, sqlite3_int64 **paId, int *pnId) {
+    if (!pGraph || !paId || !pnId) return SQLITE_MISUSE;
+    *paId = NULL;
+    *pnId = 0;
     
-    int nThreads = scheduler->nThreads;
-    int nNodes = 0;
-    char *zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
+    sqlite3_int64 iMin = 0, iMax = -1;
     sqlite3_stmt *pStmt;
+    char *zSql = sqlite3_mprintf("SELECT min(id), max(id) FROM \"%w\"",
+                                 pGraph->zNodeTableName);
+    if (!zSql) return SQLITE_NOMEM;
     int rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
     sqlite3_free(zSql);
-    if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-      nNodes = sqlite3_column_int(pStmt, 0);
+    if (rc != SQLITE_OK) return rc;
+    if (sqlite3_step(pStmt) == SQLITE_ROW
+     && sqlite3_column_type(pStmt, 0) != SQLITE_NULL) {
+        iMin = sqlite3_column_int64(pStmt, 0);
+        iMax = sqlite3_column_int64(pStmt, 1);
     }
-    sqlite3_finalize(pStmt);
-
-    sqlite3_int64 nodesPerThread = nNodes / nThreads;
+    rc = sqlite3_finalize(pStmt);
+    if (rc != SQLITE_OK || iMax < iMin) return rc;
     
-    ParallelPatternMatch *matches = sqlite3_malloc(
-        nThreads * sizeof(ParallelPatternMatch));
-    if (!matches) {
-        sqlite3_free(results);
-        graphDestroyTaskScheduler(scheduler);
-        return SQLITE_NOMEM;
+    /* Private connections only see committed rows of a file database */
+    const char *zFile = sqlite3_db_filename(pGraph->pDb, "main");
+    TaskScheduler *scheduler = NULL;
+    if (nThreads != 1 && zFile && zFile[0] && sqlite3_get_autocommit(pGraph->pDb)) {
+        scheduler = graphCreateTaskScheduler(nThreads);
+        if (!scheduler) return SQLITE_NOMEM;
+        nThreads = scheduler->nThreads;
+    } else {
+        zFile = NULL;
+        nThreads = 1;
     }
     
-    pthread_mutex_t resultMutex;
-    pthread_mutex_init(&resultMutex, NULL);
+    /* Equal-width id ranges; span arithmetic is unsigned so full-range
+    ** 64-bit ids cannot overflow */
+    sqlite3_uint64 nSpan = (sqlite3_uint64)iMax - (sqlite3_uint64)iMin + 1;
+    sqlite3_uint64 nMorsel = (sqlite3_uint64)nThreads * SCAN_MORSELS_PER_WORKER;
+    if (nSpan != 0 && nSpan < nMorsel) nMorsel = nSpan;
+    sqlite3_uint64 nStep = nSpan ? nSpan / nMorsel : (~(sqlite3_uint64)0 / nMorsel);
+    sqlite3_uint64 nExtra = nSpan ? nSpan % nMorsel : 0;
     
-    void **args = sqlite3_malloc(nThreads * sizeof(void*));
-    if (!args) {
-        sqlite3_free(matches);
-        sqlite3_free(results);
-        graphDestroyTaskScheduler(scheduler);
-        return SQLITE_NOMEM;
+    ScanMorsel *aMorsel = sqlite3_malloc64(nMorsel * sizeof(ScanMorsel));
+    ParallelPatternMatch *aMatch = sqlite3_malloc64(nThreads * sizeof(ParallelPatternMatch));
+    void **args = sqlite3_malloc64(nThreads * sizeof(void*));
+    char *zNeedle = zLabel ? sqlite3_mprintf("\"%s\"", zLabel) : NULL;
+    int iNextMorsel = 0;
+    
+    if (!aMorsel || !aMatch || !args || (zLabel && !zNeedle)) {
+        rc = SQLITE_NOMEM;
+        goto done;
+    }
+    memset(aMorsel, 0, nMorsel * sizeof(ScanMorsel));
+    
+    sqlite3_uint64 iStart = (sqlite3_uint64)iMin;
+    for (sqlite3_uint64 k = 0; k < nMorsel; k++) {
+        sqlite3_uint64 nLen = nStep + (k < nExtra ? 1 : 0);
+        aMorsel[k].iFirst = (sqlite3_int64)iStart;
+        aMorsel[k].iLast = (k == nMorsel - 1) ? iMax
+                                              : (sqlite3_int64)(iStart + nLen - 1);
+        iStart += nLen;
     }
     
-    int totalResults = 0;
     for (int i = 0; i < nThreads; i++) {
-        matches[i].pGraph = pGraph;
-        matches[i].pattern = pattern;
-        matches[i].startNode = i * nodesPerThread;
-        matches[i].endNode = (i == nThreads - 1) ? 
-            nNodes : (i + 1) * nodesPerThread;
-        matches[i].results = results;
-        matches[i].nResults = 0;
-        matches[i].resultMutex = resultMutex;
-        
-        args[i] = &matches[i];
+        aMatch[i].pGraph = pGraph;
+        aMatch[i].zFile = zFile;
+        aMatch[i].zNeedle = zNeedle;
+        aMatch[i].aMorsel = aMorsel;
+        aMatch[i].nMorsel = (int)nMorsel;
+        aMatch[i].piNextMorsel = &iNextMorsel;
+        aMatch[i].rc = SQLITE_OK;
+        args[i] = &aMatch[i];
     }
     
-    rc = graphExecuteParallel(scheduler, parallelPatternWorker, 
-                                 args, nThreads);
+    rc = graphRunTasks(scheduler, parallelPatternWorker, args, nThreads);
+    for (int i = 0; i < nThreads && rc == SQLITE_OK; i++) {
+        rc = aMatch[i].rc;
+    }
     
+    /* Merge thread-local results in id order */
     if (rc == SQLITE_OK) {
-        for (int i = 0; i < nThreads; i++) {
-            totalResults += matches[i].nResults;
+        sqlite3_int64 nTotal = 0;
+        for (sqlite3_uint64 k = 0; k < nMorsel; k++) nTotal += aMorsel[k].nId;
+        if (nTotal > INT_MAX) {
+            rc = SQLITE_TOOBIG;
+        } else if (nTotal > 0) {
+            sqlite3_int64 *aId = sqlite3_malloc64(nTotal * sizeof(sqlite3_int64));
+            if (!aId) {
+                rc = SQLITE_NOMEM;
+            } else {
+                int n = 0;
+                for (sqlite3_uint64 k = 0; k < nMorsel; k++) {
+                    memcpy(&aId[n], aMorsel[k].aId,
+                           aMorsel[k].nId * sizeof(sqlite3_int64));
+                    n += aMorsel[k].nId;
+                }
+                *paId = aId;
+                *pnId = n;
+            }
         }
-        
-        *pResults = results;
-        *pnResults = totalResults;
-    } else {
-        sqlite3_free(results);
     }
     
-    pthread_mutex_destroy(&resultMutex);
+done:
+    if (aMorsel) {
+        for (sqlite3_uint64 k = 0; k < nMorsel; k++) sqlite3_free(aMorsel[k].aId);
+    }
+    sqlite3_free(aMorsel);
+    sqlite3_free(aMatch);
     sqlite3_free(args);
-    sqlite3_free(matches);
+    sqlite3_free(zNeedle);
     graphDestroyTaskScheduler(scheduler);
-    
     return rc;
 }
 
-/*
-** Parallel aggregation implementation
-*/
-typedef struct ParallelAggregation {
-    GraphVtab *pGraph;
-    const char *property;
-    double sum;
-    sqlite3_int64 count;
-    double min;
-    double max;
-    pthread_mutex_t mutex;
-} ParallelAggregation;
\ No newline at end of file
+int graphParallelPatternMatch(GraphVtab *pGraph, CypherAst *pattern,
+                             sqlite3_int64 **pResults, int *pnResults) {
+    if (!pGraph || !pattern || !pResults || !pnResults) {
+        return SQLITE_MISUSE;
+    }
+    return graphParallelNodeScan(pGraph, pattern->zValue, 0,
+                                 pResults, pnResults);
+}
@@ -17,7 +17,7 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "graph.h"
 #include "graph-memory.h"
 #include "graph-performance.h"
-#include "graph-memory.h"
+#include "graph-stats.h"
 #include "cypher-planner.h"
 #include <sys/time.h>
 
@@ -31,147 +31,463 @@ extern const sqlite3_api_routines *sqlite3_api;
 */
 
 /*
-** Estimate selectivity for a pattern
+** Estimate selectivity for a pattern. Node counts, label frequencies
+** and property selectivities come from the graph-stats.h estimator,
+** so no query runs unless the cached live counts are stale.
 */
 SelectivityEstimate graphEstimateSelectivity(GraphVtab *pGraph, 
                                            CypherAst *pattern) {
     SelectivityEstimate estimate;
-    sqlite3_int64 totalNodes = 0;
-    sqlite3_int64 totalEdges = 0;
-    char *zSql;
-    sqlite3_stmt *pStmt;
-    int rc;
-
-    zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-      totalNodes = sqlite3_column_int64(pStmt, 0);
-    }
-    sqlite3_finalize(pStmt);
-
-    zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-      totalEdges = sqlite3_column_int64(pStmt, 0);
-    }
-    sqlite3_finalize(pStmt);
+    double totalNodes = graphEstimateNodes(pGraph);
+    double rows;
+    const char *zLabel = NULL;
+    CypherAst *pProperties = NULL;
     
     /* Initialize estimate */
     estimate.selectivity = 1.0;
-    
-    /* Use edge statistics in selectivity calculation */
-    if (totalEdges > 0) {
-        estimate.selectivity *= 0.8; /* Adjust based on edge density */
-    }
-    estimate.estimatedRows = totalNodes;
+    estimate.estimatedRows = (sqlite3_int64)totalNodes;
     estimate.confidence = 50;
     
     if (!pattern) return estimate;
     
-    /* Label selectivity - traverse AST to find label information */
-    const char *zLabel = NULL;
-    
-    /* Traverse AST to find node label */
-    if (pattern && pattern->type == CYPHER_AST_NODE_PATTERN) {
-        /* Look for label child node */
+    if (pattern->type != CYPHER_AST_NODE_PATTERN) {
+        /* MATCH clauses and pattern lists: estimate the first node pattern */
         for (int i = 0; i < pattern->nChildren; i++) {
             CypherAst *pChild = pattern->apChildren[i];
-            if (pChild && pChild->type == CYPHER_AST_LABELS && pChild->nChildren > 0) {
-                /* Get first label */
-                CypherAst *pLabel = pChild->apChildren[0];
-                if (pLabel && pLabel->type == CYPHER_AST_IDENTIFIER && pLabel->zValue) {
-                    zLabel = pLabel->zValue;
-                    break;
-                }
+            if (pChild && (pChild->type == CYPHER_AST_NODE_PATTERN ||
+                           pChild->type == CYPHER_AST_PATTERN ||
+                           pChild->type == CYPHER_AST_MATCH)) {
+                return graphEstimateSelectivity(pGraph, pChild);
             }
         }
-    } else if (pattern && pattern->type == CYPHER_AST_MATCH) {
-        /* Recursively search MATCH children for node patterns */
-        for (int i = 0; i < pattern->nChildren; i++) {
-            CypherAst *pChild = pattern->apChildren[i];
-            if (pChild && pChild->type == CYPHER_AST_NODE_PATTERN) {
-                SelectivityEstimate childEst = graphEstimateSelectivity(pGraph, pChild);
-                return childEst; /* Return first found pattern's estimate */
+        return estimate;
+    }
+    
+    /* First label and the inline property map of the node pattern */
+    for (int i = 0; i < pattern->nChildren; i++) {
+        CypherAst *pChild = pattern->apChildren[i];
+        if (!pChild) continue;
+        if (pChild->type == CYPHER_AST_LABELS && !zLabel) {
+            /* A single label is the LABELS node's own value */
+            CypherAst *pLabel = pChild->nChildren > 0 ? pChild->apChildren[0] : pChild;
+            if (pLabel && pLabel->zValue) {
+                zLabel = pLabel->zValue;
             }
+        } else if (pChild->type == CYPHER_AST_MAP) {
+            pProperties = pChild;
         }
     }
     
-    if (zLabel) {
-        /* Estimate based on label index statistics */
-        int labelCount = 0;
-        zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes WHERE labels LIKE '%%\"%s\"%%'", pGraph->zTableName, zLabel);
-        rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-        sqlite3_free(zSql);
-        if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-          labelCount = sqlite3_column_int(pStmt, 0);
+    rows = zLabel ? graphEstimateLabel(pGraph, zLabel) : totalNodes;
+    
+    /* Each {key: literal} pair is an independent equality predicate */
+    for (int i = 0; pProperties && i < pProperties->nChildren; i++) {
+        CypherAst *pPair = pProperties->apChildren[i];
+        const char *zKey;
+        CypherAst *pValue;
+        
+        if (!pPair || pPair->type != CYPHER_AST_PROPERTY_PAIR || pPair->nChildren < 1) continue;
+        zKey = pPair->nChildren >= 2 ? pPair->apChildren[0]->zValue : pPair->zValue;
+        pValue = pPair->apChildren[pPair->nChildren - 1];
+        if (!zKey || !pValue || pValue->type != CYPHER_AST_LITERAL) continue;
+        rows *= graphEstimateProperty(pGraph, zKey, GRAPH_CMP_EQ, pValue->zValue);
+    }
+    
+    if (rows < 1.0) rows = 1.0;
+    estimate.selectivity = rows / totalNodes;
+    estimate.estimatedRows = (sqlite3_int64)rows;
+    if (pGraph && pGraph->pStats) {
+        estimate.confidence = 90;
+    } else if (zLabel && pGraph && pGraph->bLabelIndex) {
+        estimate.confidence = 80;
+    }
+    
+    return estimate;
+}
+
+/*
+** Join enumeration over the query graph. A plan over a set of inputs
+** (a bitmask of joins[]) joins two connected halves: the driving half
+** expands along one relationship crossing into the other half, which
+** is then probed by id (index nested loop, single inputs only) or
+** hash joined. Further crossing relationships become EXPAND INTO
+** checks. Costs follow logicalPlanEstimateCost() so the chosen plan
+** costs the same once it is re-estimated.
+*/
+typedef struct JoinPlanEntry {
+    sqlite3_uint64 mask;         /* Inputs covered */
+    double rows;                 /* Estimated output rows */
+    double cost;                 /* Estimated cost */
+    int iLeaf;                   /* Input of a single-input plan, else -1 */
+    int iDrive;                  /* Entry of the driving half */
+    int iOther;                  /* Entry of the other half */
+    int iEdge;                   /* Edge expanded from the driving half */
+    int bIndexLoop;              /* Probe iOther by id instead of hashing */
+} JoinPlanEntry;
+
+typedef struct JoinEnum {
+    JoinOrderOptimizer *pOpt;
+    JoinPlanEntry *aEntry;       /* Plans built so far */
+    int nEntry;
+    int nEntryAlloc;
+    sqlite3_uint64 *aAdj;        /* Per input: inputs sharing an edge */
+    const char **azAlias;        /* Per input: pattern variable */
+    double *aFan;                /* Per edge: rows per expanded row */
+    int *aBest;                  /* DP only: best entry per mask, or -1 */
+    double rNodes;               /* Join divisor, as logicalPlanEstimateRows() */
+    int nOrder;                  /* Inputs placed in bestOrder so far */
+    int rc;
+} JoinEnum;
+
+static int joinAddEntry(JoinEnum *p, const JoinPlanEntry *pEntry) {
+    if (p->nEntry >= p->nEntryAlloc) {
+        int nNew = p->nEntryAlloc ? p->nEntryAlloc * 2 : 64;
+        JoinPlanEntry *aNew = sqlite3_realloc(p->aEntry, nNew * sizeof(JoinPlanEntry));
+        if (!aNew) {
+            p->rc = SQLITE_NOMEM;
+            return -1;
         }
-        sqlite3_finalize(pStmt);
+        p->aEntry = aNew;
+        p->nEntryAlloc = nNew;
+    }
+    p->aEntry[p->nEntry] = *pEntry;
+    return p->nEntry++;
+}
 
-        if (totalNodes > 0) {
-            estimate.selectivity = (double)labelCount / totalNodes;
-            estimate.estimatedRows = labelCount;
-            estimate.confidence = 80;
+static int joinEdgeCrosses(const JoinEdge *pEdge, sqlite3_uint64 mA, sqlite3_uint64 mB) {
+    sqlite3_uint64 mFrom = (sqlite3_uint64)1 << pEdge->iFrom;
+    sqlite3_uint64 mTo = (sqlite3_uint64)1 << pEdge->iTo;
+    return ((mA & mFrom) && (mB & mTo)) || ((mA & mTo) && (mB & mFrom));
+}
+
+/*
+** Cheapest way to join entries iA and iB, written to *pOut. Returns 0
+** when no relationship connects them.
+*/
+static int joinCombine(JoinEnum *p, int iA, int iB, JoinPlanEntry *pOut) {
+    const JoinOrderOptimizer *pOpt = p->pOpt;
+    sqlite3_uint64 mA = p->aEntry[iA].mask;
+    sqlite3_uint64 mB = p->aEntry[iB].mask;
+    int iEdge = -1;
+    int i, k;
+    
+    /* Expand along the crossing edge with the smallest fan-out */
+    for (i = 0; i < pOpt->nEdges; i++) {
+        if (!joinEdgeCrosses(&pOpt->aEdges[i], mA, mB)) continue;
+        if (iEdge < 0 || p->aFan[i] < p->aFan[iEdge]) iEdge = i;
+    }
+    if (iEdge < 0) return 0;
+    
+    pOut->mask = mA | mB;
+    pOut->iLeaf = -1;
+    pOut->iEdge = iEdge;
+    pOut->cost = -1.0;
+    for (k = 0; k < 2; k++) {
+        const JoinPlanEntry *pDrive = &p->aEntry[k ? iB : iA];
+        const JoinPlanEntry *pOther = &p->aEntry[k ? iA : iB];
+        double rExpand = fmax(1.0, pDrive->rows * p->aFan[iEdge]);
+        double rRows = fmax(1.0, rExpand * pOther->rows / p->rNodes);
+        double rBase = pDrive->cost + rExpand + pDrive->rows + rRows;
+        double rCost = rBase + rExpand + pOther->rows + pOther->cost;
+        int bIndexLoop = 0;
+        
+        /* One id lookup per expanded row beats building a hash table
+        ** from a scan that returns more rows than are probed */
+        if (pOther->iLeaf >= 0 && rBase + 2.0 * rExpand < rCost) {
+            rCost = rBase + 2.0 * rExpand;
+            bIndexLoop = 1;
+        }
+        for (i = 0; i < pOpt->nEdges; i++) {
+            double rInto;
+            if (i == iEdge || !joinEdgeCrosses(&pOpt->aEdges[i], mA, mB)) continue;
+            rInto = fmax(1.0, rRows * p->aFan[i] / p->rNodes);
+            rCost += rRows + rInto;
+            rRows = rInto;
+        }
+        if (pOut->cost < 0.0 || rCost < pOut->cost) {
+            pOut->cost = rCost;
+            pOut->rows = rRows;
+            pOut->iDrive = k ? iB : iA;
+            pOut->iOther = k ? iA : iB;
+            pOut->bIndexLoop = bIndexLoop;
         }
     }
-    
-    /* Property selectivity */
-    if (pattern->zValue && pattern->zValue) {
-        /* Rough estimate: assume 10% selectivity for property filters */
-        estimate.selectivity *= 0.1;
-        estimate.estimatedRows = (sqlite3_int64)(estimate.estimatedRows * 0.1);
-        estimate.confidence = 40;
+    return 1;
+}
+
+static sqlite3_uint64 joinNeighbours(JoinEnum *p, sqlite3_uint64 mSet) {
+    sqlite3_uint64 mN = 0;
+    int i;
+    for (i = 0; i < p->pOpt->nJoins; i++) {
+        if (mSet & ((sqlite3_uint64)1 << i)) mN |= p->aAdj[i];
     }
+    return mN & ~mSet;
+}
+
+/*
+** DPccp (Moerkotte and Neumann): enumerate each pair of connected,
+** disjoint and adjacent input sets exactly once, in an order where
+** both halves are already planned.
+*/
+static void joinEmitPair(JoinEnum *p, sqlite3_uint64 mS1, sqlite3_uint64 mS2) {
+    JoinPlanEntry cand;
+    int iCur;
+    
+    if (p->rc != SQLITE_OK || p->aBest[mS1] < 0 || p->aBest[mS2] < 0) return;
+    if (!joinCombine(p, p->aBest[mS1], p->aBest[mS2], &cand)) return;
+    iCur = p->aBest[mS1 | mS2];
+    if (iCur >= 0 && p->aEntry[iCur].cost <= cand.cost) return;
+    iCur = joinAddEntry(p, &cand);
+    if (iCur >= 0) p->aBest[mS1 | mS2] = iCur;
+}
+
+static void joinEnumerateCmpRec(JoinEnum *p, sqlite3_uint64 mS1, sqlite3_uint64 mS2,
+                                sqlite3_uint64 mX) {
+    sqlite3_uint64 mN = joinNeighbours(p, mS2) & ~mX;
+    sqlite3_uint64 mSub;
+    
+    if (!mN) return;
+    for (mSub = (0 - mN) & mN; mSub; mSub = (mSub - mN) & mN) {
+        joinEmitPair(p, mS1, mS2 | mSub);
+    }
+    for (mSub = (0 - mN) & mN; mSub; mSub = (mSub - mN) & mN) {
+        joinEnumerateCmpRec(p, mS1, mS2 | mSub, mX | mN);
+    }
+}
+
+static void joinEmitCsg(JoinEnum *p, sqlite3_uint64 mS1) {
+    sqlite3_uint64 mLow = mS1 & (0 - mS1);
+    sqlite3_uint64 mX = mS1 | (mLow | (mLow - 1));
+    sqlite3_uint64 mN = joinNeighbours(p, mS1) & ~mX;
+    int i;
+    
+    for (i = p->pOpt->nJoins - 1; i >= 0; i--) {
+        sqlite3_uint64 mI = (sqlite3_uint64)1 << i;
+        if (!(mN & mI)) continue;
+        joinEmitPair(p, mS1, mI);
+        joinEnumerateCmpRec(p, mS1, mI, mX | (mN & (mI | (mI - 1))));
+    }
+}
+
+static void joinEnumerateCsgRec(JoinEnum *p, sqlite3_uint64 mS, sqlite3_uint64 mX) {
+    sqlite3_uint64 mN = joinNeighbours(p, mS) & ~mX;
+    sqlite3_uint64 mSub;
     
-    /* Relationship type selectivity */
-    if (pattern->zValue) {
-        /* Estimate based on relationship type frequency */
-        double typeSelectivity = 0.3; /* Default estimate */
-        estimate.selectivity *= typeSelectivity;
-        estimate.estimatedRows = (sqlite3_int64)(estimate.estimatedRows * typeSelectivity);
+    if (!mN) return;
+    for (mSub = (0 - mN) & mN; mSub; mSub = (mSub - mN) & mN) {
+        joinEmitCsg(p, mS | mSub);
+    }
+    for (mSub = (0 - mN) & mN; mSub; mSub = (mSub - mN) & mN) {
+        joinEnumerateCsgRec(p, mS | mSub, mX | mN);
+    }
+}
+
+/*
+** Fill aLive with the best plan of each connected component of the
+** query graph: exhaustively up to GRAPH_JOIN_DP_LIMIT inputs, else by
+** greedily merging the cheapest connected pair until none is left.
+*/
+static int joinComponents(JoinEnum *p, int *aLive, int *pnLive) {
+    int n = p->pOpt->nJoins;
+    int nLive = n;
+    int i, j;
+    
+    if (n <= GRAPH_JOIN_DP_LIMIT) {
+        sqlite3_uint64 mDone = 0;
+        
+        p->aBest = sqlite3_malloc(((size_t)1 << n) * sizeof(int));
+        if (!p->aBest) return SQLITE_NOMEM;
+        memset(p->aBest, 0xff, ((size_t)1 << n) * sizeof(int));
+        for (i = 0; i < n; i++) p->aBest[(sqlite3_uint64)1 << i] = i;
+        for (i = n - 1; i >= 0 && p->rc == SQLITE_OK; i--) {
+            sqlite3_uint64 mI = (sqlite3_uint64)1 << i;
+            joinEmitCsg(p, mI);
+            joinEnumerateCsgRec(p, mI, mI | (mI - 1));
+        }
+        if (p->rc != SQLITE_OK) return p->rc;
+        
+        nLive = 0;
+        for (i = 0; i < n; i++) {
+            sqlite3_uint64 mComp = (sqlite3_uint64)1 << i;
+            sqlite3_uint64 mNext;
+            if (mDone & mComp) continue;
+            while ((mNext = joinNeighbours(p, mComp)) != 0) mComp |= mNext;
+            mDone |= mComp;
+            aLive[nLive++] = p->aBest[mComp];
+        }
+        *pnLive = nLive;
+        return SQLITE_OK;
     }
     
-    return estimate;
+    for (i = 0; i < n; i++) aLive[i] = i;
+    while (1) {
+        JoinPlanEntry cand, best;
+        int iBest = -1, jBest = -1;
+        int iNew;
+        
+        memset(&best, 0, sizeof(best));
+        for (i = 0; i < nLive; i++) {
+            for (j = i + 1; j < nLive; j++) {
+                if (!joinCombine(p, aLive[i], aLive[j], &cand)) continue;
+                if (iBest < 0 || cand.cost < best.cost) {
+                    best = cand;
+                    iBest = i;
+                    jBest = j;
+                }
+            }
+        }
+        if (iBest < 0) break;
+        iNew = joinAddEntry(p, &best);
+        if (iNew < 0) return p->rc;
+        aLive[iBest] = iNew;
+        aLive[jBest] = aLive[--nLive];
+    }
+    *pnLive = nLive;
+    return SQLITE_OK;
 }
 
 /*
-** Optimize join order based on selectivity estimates
+** Wrap pChild in an EXPAND along pEdge from whichever endpoint mBound
+** contains, or a VAR_LENGTH_EXPAND when pEdge is a hop range. pChild is
+** freed on error.
 */
-int graphOptimizeJoinOrder(JoinOrderOptimizer *optimizer) {
-    if (!optimizer || optimizer->nJoins < 2) return SQLITE_OK;
+static LogicalPlanNode *joinExpand(JoinEnum *p, LogicalPlanNode *pChild,
+                                   const JoinEdge *pEdge, sqlite3_uint64 mBound,
+                                   int iFlags) {
+    int bForward = (mBound >> pEdge->iFrom) & 1;
+    int bVarLength = pEdge->nMinHops != 1 || pEdge->nMaxHops != 1;
+    LogicalPlanNode *pExpand = logicalPlanNodeCreate(bVarLength ? LOGICAL_VAR_LENGTH_EXPAND
+                                                                : LOGICAL_EXPAND);
+    
+    if (!pExpand || logicalPlanNodeAddChild(pExpand, pChild) != SQLITE_OK) {
+        logicalPlanNodeDestroy(pExpand);
+        logicalPlanNodeDestroy(pChild);
+        p->rc = SQLITE_NOMEM;
+        return NULL;
+    }
+    if (logicalPlanNodeSetFromAlias(pExpand, p->azAlias[bForward ? pEdge->iFrom : pEdge->iTo]) ||
+        logicalPlanNodeSetAlias(pExpand, p->azAlias[bForward ? pEdge->iTo : pEdge->iFrom]) ||
+        logicalPlanNodeSetLabel(pExpand, pEdge->zType) ||
+        logicalPlanNodeSetRelAlias(pExpand, pEdge->zRel)) {
+        logicalPlanNodeDestroy(pExpand);
+        p->rc = SQLITE_NOMEM;
+        return NULL;
+    }
+    if (pEdge->eDirection == GRAPH_EXPAND_BOTH) {
+        pExpand->eDirection = GRAPH_EXPAND_BOTH;
+    } else {
+        pExpand->eDirection = bForward ? GRAPH_EXPAND_OUT : GRAPH_EXPAND_IN;
+    }
+    pExpand->iFlags = iFlags;
+    pExpand->nMinHops = pEdge->nMinHops;
+    pExpand->nMaxHops = pEdge->nMaxHops;
+    return pExpand;
+}
+
+/*
+** Build the logical plan of entry iEntry, moving the inputs it covers
+** out of joins[] in the order they are joined.
+*/
+static LogicalPlanNode *joinBuild(JoinEnum *p, int iEntry) {
+    JoinOrderOptimizer *pOpt = p->pOpt;
+    const JoinPlanEntry *pEntry = &p->aEntry[iEntry];
+    sqlite3_uint64 mDrive, mOther;
+    LogicalPlanNode *pPlan, *pOther, *pJoin;
+    const JoinEdge *pEdge;
+    int i;
+    
+    if (pEntry->iLeaf >= 0) {
+        pPlan = pOpt->joins[pEntry->iLeaf];
+        pOpt->joins[pEntry->iLeaf] = NULL;
+        if (pOpt->bestOrder) pOpt->bestOrder[p->nOrder++] = pEntry->iLeaf;
+        return pPlan;
+    }
+    
+    mDrive = p->aEntry[pEntry->iDrive].mask;
+    mOther = p->aEntry[pEntry->iOther].mask;
+    pEdge = &pOpt->aEdges[pEntry->iEdge];
+    pPlan = joinBuild(p, pEntry->iDrive);
+    if (!pPlan) return NULL;
+    pPlan = joinExpand(p, pPlan, pEdge, mDrive, 0);
+    if (!pPlan) return NULL;
+    
+    pOther = joinBuild(p, pEntry->iOther);
+    pJoin = logicalPlanNodeCreate(pEntry->bIndexLoop ? LOGICAL_NESTED_LOOP_JOIN
+                                                     : LOGICAL_HASH_JOIN);
+    if (!pOther || !pJoin) {
+        logicalPlanNodeDestroy(pPlan);
+        logicalPlanNodeDestroy(pOther);
+        logicalPlanNodeDestroy(pJoin);
+        p->rc = SQLITE_NOMEM;
+        return NULL;
+    }
+    if (logicalPlanNodeAddChild(pJoin, pPlan) != SQLITE_OK) {
+        logicalPlanNodeDestroy(pPlan);
+        logicalPlanNodeDestroy(pOther);
+        logicalPlanNodeDestroy(pJoin);
+        p->rc = SQLITE_NOMEM;
+        return NULL;
+    }
+    if (logicalPlanNodeAddChild(pJoin, pOther) != SQLITE_OK) {
+        logicalPlanNodeDestroy(pOther);
+        logicalPlanNodeDestroy(pJoin);
+        p->rc = SQLITE_NOMEM;
+        return NULL;
+    }
+    /* The join key is the node the expand reached */
+    if (logicalPlanNodeSetAlias(pJoin, pPlan->zAlias)) {
+        logicalPlanNodeDestroy(pJoin);
+        p->rc = SQLITE_NOMEM;
+        return NULL;
+    }
+    pPlan = pJoin;
     
-    /* Calculate costs for different join orders */
-    int nPermutations = 1;
-    for (int i = 2; i <= optimizer->nJoins; i++) {
-        nPermutations *= i;
+    for (i = 0; i < pOpt->nEdges && pPlan; i++) {
+        if (i == pEntry->iEdge || !joinEdgeCrosses(&pOpt->aEdges[i], mDrive, mOther)) continue;
+        pPlan = joinExpand(p, pPlan, &pOpt->aEdges[i], mDrive, PLAN_EXPAND_INTO);
     }
+    return pPlan;
+}
+
+/*
+** Input order by increasing row estimate. Used when the inputs do not
+** fit a 64-bit input set.
+*/
+static int joinOrderByRows(JoinOrderOptimizer *optimizer) {
+    if (optimizer->nJoins < 2) return SQLITE_OK;
     
-    /* Simple greedy algorithm: order by increasing selectivity */
+    /* Simple greedy algorithm: order by increasing row estimate */
     typedef struct {
         int index;
-        double selectivity;
+        double rows;
     } JoinInfo;
     
     JoinInfo *joins = sqlite3_malloc(optimizer->nJoins * sizeof(JoinInfo));
     if (!joins) return SQLITE_NOMEM;
     
-    /* Get selectivity for each join */
+    /* Get row estimate for each join input */
     for (int i = 0; i < optimizer->nJoins; i++) {
+        LogicalPlanNode *pJoin = optimizer->joins ? optimizer->joins[i] : NULL;
         joins[i].index = i;
-        /* Estimate selectivity - simplified */
-        joins[i].selectivity = 0.5; /* Default */
+        if (pJoin && optimizer->pContext) {
+            joins[i].rows = (double)logicalPlanEstimateRows(pJoin, optimizer->pContext);
+            if (optimizer->costs) {
+                optimizer->costs[i] = logicalPlanEstimateCost(pJoin, optimizer->pContext);
+            }
+        } else {
+            joins[i].rows = pJoin ? (double)pJoin->iEstimatedRows : 0.0;
+        }
     }
     
-    /* Sort by selectivity (most selective first) */
-    for (int i = 0; i < optimizer->nJoins - 1; i++) {
-        for (int j = i + 1; j < optimizer->nJoins; j++) {
-            if (joins[j].selectivity < joins[i].selectivity) {
-                JoinInfo temp = joins[i];
-                joins[i] = joins[j];
-                joins[j] = temp;
-            }
+    /* Stable sort by rows (smallest first) */
+    for (int i = 1; i < optimizer->nJoins; i++) {
+        JoinInfo temp = joins[i];
+        int j = i - 1;
+        while (j >= 0 && joins[j].rows > temp.rows) {
+            joins[j + 1] = joins[j];
+            j--;
         }
+        joins[j + 1] = temp;
     }
     
     /* Set best order */
@@ -183,6 +499,138 @@ int graphOptimizeJoinOrder(JoinOrderOptimizer *optimizer) {
     return SQLITE_OK;
 }
 
+/*
+** Choose a join order for the inputs joins[] connected by aEdges and
+** build it into optimizer->pPlan: DPccp over the query graph up to
+** GRAPH_JOIN_DP_LIMIT inputs, greedy above. Each connection expands
+** from the cheaper side and then probes by id or hash joins, so a
+** triangle or diamond closes with EXPAND INTO checks instead of a
+** Cartesian product. Only disconnected components are combined with
+** CARTESIAN_PRODUCT, smallest first.
+**
+** The inputs are moved into pPlan: each joins[] slot used is set to
+** NULL, and on error the caller frees pPlan and what is left in joins[].
+** bestOrder, if set, receives the inputs in the order they are joined.
+** With more than 64 inputs no plan is built and bestOrder receives the
+** inputs by increasing row estimate.
+*/
+int graphOptimizeJoinOrder(JoinOrderOptimizer *optimizer) {
+    JoinEnum e;
+    GraphVtab *pGraph;
+    int *aLive = NULL;
+    int nLive = 0;
+    int i, j;
+    
+    if (!optimizer || optimizer->nJoins < 1) return SQLITE_OK;
+    optimizer->pPlan = NULL;
+    if (!optimizer->joins || optimizer->nJoins > 64) {
+        return optimizer->bestOrder ? joinOrderByRows(optimizer) : SQLITE_OK;
+    }
+    
+    memset(&e, 0, sizeof(e));
+    e.pOpt = optimizer;
+    pGraph = optimizer->pContext ? optimizer->pContext->pGraph : NULL;
+    e.rNodes = pGraph ? graphEstimateNodes(pGraph) : 100.0;
+    e.aAdj = sqlite3_malloc(optimizer->nJoins * sizeof(sqlite3_uint64));
+    e.azAlias = sqlite3_malloc(optimizer->nJoins * sizeof(const char*));
+    e.aFan = sqlite3_malloc((optimizer->nEdges + 1) * sizeof(double));
+    aLive = sqlite3_malloc(optimizer->nJoins * sizeof(int));
+    if (!e.aAdj || !e.azAlias || !e.aFan || !aLive) {
+        e.rc = SQLITE_NOMEM;
+        goto join_done;
+    }
+    memset(e.aAdj, 0, optimizer->nJoins * sizeof(sqlite3_uint64));
+    
+    /* Single-input plans */
+    for (i = 0; i < optimizer->nJoins && e.rc == SQLITE_OK; i++) {
+        LogicalPlanNode *pInput = optimizer->joins[i];
+        JoinPlanEntry leaf;
+        
+        memset(&leaf, 0, sizeof(leaf));
+        leaf.mask = (sqlite3_uint64)1 << i;
+        leaf.iLeaf = i;
+        leaf.iDrive = leaf.iOther = leaf.iEdge = -1;
+        if (optimizer->pContext) {
+            leaf.rows = (double)logicalPlanEstimateRows(pInput, optimizer->pContext);
+            leaf.cost = logicalPlanEstimateCost(pInput, optimizer->pContext);
+        } else {
+            leaf.rows = pInput->iEstimatedRows > 0 ? (double)pInput->iEstimatedRows : 1.0;
+            leaf.cost = pInput->rEstimatedCost;
+        }
+        if (optimizer->costs) optimizer->costs[i] = leaf.cost;
+        e.azAlias[i] = pInput->zAlias;
+        joinAddEntry(&e, &leaf);
+    }
+    
+    /* Fan-out of each relationship, as logicalPlanEstimateRows() */
+    for (i = 0; i < optimizer->nEdges; i++) {
+        const JoinEdge *pEdge = &optimizer->aEdges[i];
+        e.aFan[i] = pGraph ? graphEstimateFanout(pGraph, pEdge->zType) : 5.0;
+        if (pEdge->eDirection == GRAPH_EXPAND_BOTH) e.aFan[i] *= 2.0;
+        if (pEdge->nMinHops != 1 || pEdge->nMaxHops != 1) {
+            e.aFan[i] = graphEstimatePathFanout(e.aFan[i], pEdge->nMinHops, pEdge->nMaxHops);
+        }
+        if (pEdge->iFrom != pEdge->iTo) {
+            e.aAdj[pEdge->iFrom] |= (sqlite3_uint64)1 << pEdge->iTo;
+            e.aAdj[pEdge->iTo] |= (sqlite3_uint64)1 << pEdge->iFrom;
+        }
+    }
+    if (e.rc == SQLITE_OK) e.rc = joinComponents(&e, aLive, &nLive);
+    if (e.rc != SQLITE_OK) goto join_done;
+    
+    /* Disconnected components: smallest first, as Cartesian products */
+    for (i = 1; i < nLive; i++) {
+        int iLive = aLive[i];
+        for (j = i; j > 0 && e.aEntry[aLive[j-1]].rows > e.aEntry[iLive].rows; j--) {
+            aLive[j] = aLive[j-1];
+        }
+        aLive[j] = iLive;
+    }
+    for (i = 0; i < nLive && e.rc == SQLITE_OK; i++) {
+        LogicalPlanNode *pComponent = joinBuild(&e, aLive[i]);
+        LogicalPlanNode *pProduct;
+        
+        if (!pComponent) break;
+        if (!optimizer->pPlan) {
+            optimizer->pPlan = pComponent;
+            continue;
+        }
+        pProduct = logicalPlanNodeCreate(LOGICAL_CARTESIAN_PRODUCT);
+        if (!pProduct || logicalPlanNodeAddChild(pProduct, optimizer->pPlan) != SQLITE_OK) {
+            logicalPlanNodeDestroy(pProduct);
+            logicalPlanNodeDestroy(pComponent);
+            e.rc = SQLITE_NOMEM;
+            break;
+        }
+        optimizer->pPlan = pProduct;
+        if (logicalPlanNodeAddChild(pProduct, pComponent) != SQLITE_OK) {
+            logicalPlanNodeDestroy(pComponent);
+            e.rc = SQLITE_NOMEM;
+        }
+    }
+    
+    /* Relationships from a node to itself only filter */
+    for (i = 0; i < optimizer->nEdges && e.rc == SQLITE_OK; i++) {
+        const JoinEdge *pEdge = &optimizer->aEdges[i];
+        if (pEdge->iFrom != pEdge->iTo) continue;
+        optimizer->pPlan = joinExpand(&e, optimizer->pPlan, pEdge,
+                                      (sqlite3_uint64)1 << pEdge->iFrom, PLAN_EXPAND_INTO);
+    }
+    if (e.rc == SQLITE_OK && optimizer->pContext) {
+        logicalPlanEstimateRows(optimizer->pPlan, optimizer->pContext);
+        logicalPlanEstimateCost(optimizer->pPlan, optimizer->pContext);
+    }
+    
+join_done:
+    sqlite3_free(e.aEntry);
+    sqlite3_free(e.aAdj);
+    sqlite3_free(e.azAlias);
+    sqlite3_free(e.aFan);
+    sqlite3_free(e.aBest);
+    sqlite3_free(aLive);
+    return e.rc;
+}
+
 /*
 ** Eliminate Cartesian products from execution plan
 */
@@ -209,88 +657,6 @@ int graphEliminateCartesianProduct(PhysicalPlanNode *plan) {
     return SQLITE_OK;
 }
 
-/*
-** Memory Pool Implementation
-*/
-
-/*
-** Create a per-query memory pool
-*/
-QueryMemoryPool* graphCreateMemoryPool(size_t initialSize) {
-    QueryMemoryPool *pool = sqlite3_malloc(sizeof(QueryMemoryPool));
-    if (!pool) return NULL;
-    
-    pool->totalSize = initialSize;
-    pool->basePtr = sqlite3_malloc(initialSize);
-    if (!pool->basePtr) {
-        sqlite3_free(pool);
-        return NULL;
-    }
-    
-    pool->usedSize = 0;
-    pool->nAllocations = 0;
-    pool->allocations = sqlite3_malloc(100 * sizeof(void*));
-    if (!pool->allocations) {
-        sqlite3_free(pool->basePtr);
-        sqlite3_free(pool);
-        return NULL;
-    }
-    
-    pool->recycleEnabled = 1;
-    
-    return pool;
-}
-
-/*
-** Allocate memory from pool
-*/
-void* graphPoolAlloc(QueryMemoryPool *pool, size_t size) {
-    if (!pool || size == 0) return NULL;
-    
-    /* Align to 8-byte boundary */
-    size = (size + 7) & ~7;
-    
-    /* Check if enough space */
-    if (pool->usedSize + size > pool->totalSize) {
-        /* Pool exhausted - fall back to regular allocation */
-        return sqlite3_malloc(size);
-    }
-    
-    /* Allocate from pool */
-    void *ptr = (char*)pool->basePtr + pool->usedSize;
-    pool->usedSize += size;
-    
-    /* Track allocation */
-    if (pool->nAllocations < 100) {
-        pool->allocations[pool->nAllocations++] = ptr;
-    }
-    
-    return ptr;
-}
-
-/*
-** Free memory back to pool (no-op for pool allocations)
-*/
-void graphPoolFree(QueryMemoryPool *pool, void *ptr) {
-    /* Pool allocations are freed all at once */
-    /* Individual frees are no-ops */
-    
-    /* Pool allocations are freed all at once - individual frees are no-ops */
-    (void)pool;
-    (void)ptr;
-}
-
-/*
-** Destroy memory pool
-*/
-void graphDestroyMemoryPool(QueryMemoryPool *pool) {
-    if (!pool) return;
-    
-    sqlite3_free(pool->basePtr);
-    sqlite3_free(pool->allocations);
-    sqlite3_free(pool);
-}
-
 /*
 ** Performance Metrics Implementation
 */
@@ -425,57 +791,63 @@ CompositeIndex* graphCreateCompositeIndex(GraphVtab *pGraph,
 }
 
 /*
-** Convert graph to Compressed Sparse Row format
+** Intersect nBitmap sets. Inputs are combined smallest first so the
+** running result shrinks as fast as possible, stopping early once it
+** is empty. *ppResult is a new bitmap the caller frees.
 */
-CSRGraph* graphConvertToCSR(GraphVtab *pGraph) {
-    if (!pGraph) return NULL;
-    
-    CSRGraph *csr = sqlite3_malloc(sizeof(CSRGraph));
-    if (!csr) return NULL;
-    
-    int nNodes = 0, nEdges = 0;
-    char *zSql;
-    sqlite3_stmt *pStmt;
-    int rc;
+int graphIntersectBitmaps(GraphBitmap **apBitmap, int nBitmap,
+                         GraphBitmap **ppResult) {
+    GraphBitmap *pAcc = NULL;
+    int *aOrder;
+    int rc = SQLITE_OK;
 
-    zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-      nNodes = sqlite3_column_int(pStmt, 0);
+    *ppResult = NULL;
+    if (nBitmap <= 0) return SQLITE_MISUSE;
+
+    aOrder = sqlite3_malloc(nBitmap * sizeof(int));
+    if (!aOrder) return SQLITE_NOMEM;
+    for (int i = 0; i < nBitmap; i++) aOrder[i] = i;
+    for (int i = 1; i < nBitmap; i++) {
+        int k = aOrder[i], j = i;
+        sqlite3_int64 n = graphBitmapCount(apBitmap[k]);
+        while (j > 0 && graphBitmapCount(apBitmap[aOrder[j-1]]) > n) {
+            aOrder[j] = aOrder[j-1];
+            j--;
+        }
+        aOrder[j] = k;
     }
-    sqlite3_finalize(pStmt);
 
-    zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-      nEdges = sqlite3_column_int(pStmt, 0);
+    rc = graphBitmapCopy(apBitmap[aOrder[0]], &pAcc);
+    for (int i = 1; rc == SQLITE_OK && i < nBitmap; i++) {
+        GraphBitmap *pNext = NULL;
+        if (graphBitmapCount(pAcc) == 0) break;
+        rc = graphBitmapAnd(pAcc, apBitmap[aOrder[i]], &pNext);
+        graphBitmapFree(pAcc);
+        pAcc = pNext;
     }
-    sqlite3_finalize(pStmt);
+    sqlite3_free(aOrder);
 
-    csr->nNodes = nNodes;
-    csr->nEdges = nEdges;
-    
-    /* Allocate arrays */
-    csr->rowOffsets = sqlite3_malloc((csr->nNodes + 1) * sizeof(sqlite3_int64));
-    csr->columnIndices = sqlite3_malloc(csr->nEdges * sizeof(sqlite3_int64));
-    csr->edgeWeights = sqlite3_malloc(csr->nEdges * sizeof(double));
-    
-    if (!csr->rowOffsets || !csr->columnIndices || !csr->edgeWeights) {
-        sqlite3_free(csr->rowOffsets);
-        sqlite3_free(csr->columnIndices);
-        sqlite3_free(csr->edgeWeights);
-        sqlite3_free(csr);
+    if (rc != SQLITE_OK) {
+        graphBitmapFree(pAcc);
+        return rc;
+    }
+    *ppResult = pAcc;
+    return SQLITE_OK;
+}
+
+/*
+** Convert graph to Compressed Sparse Row format.
+** Returns a standalone copy; the caller owns it and must release it
+** with graphCSRFree(). Algorithms should prefer graphCSRGet(), which
+** reuses the snapshot cached on the virtual table.
+*/
+CSRGraph* graphConvertToCSR(GraphVtab *pGraph) {
+    CSRGraph *csr = NULL;
+    if (!pGraph) return NULL;
+
+    if (graphCSRBuild(pGraph->pDb, pGraph->zNodeTableName,
+                      pGraph->zEdgeTableName, &csr) != SQLITE_OK) {
         return NULL;
     }
-    
-    /* Build CSR representation */
-    /* Convert adjacency list to Compressed Sparse Row format */
-    /* CSR is efficient for graph algorithms but requires full implementation */
-    /* For Phase 1/2, return basic structure */
-    /* nNodes and nEdges already set above */
-    /* Initialize pointers - full implementation would populate these */
-    
     return csr;
 }
\ No newline at end of file
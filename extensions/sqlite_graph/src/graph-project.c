@@ -0,0 +1,329 @@
+/*
+** SQLite Graph Database Extension - Named Graph Projections
+**
+** A multi-relation graph often needs an algorithm over one slice of it:
+** PageRank over :FOLLOWS edges between :User nodes, Louvain over
+** weighted :TRANSFER edges. Filtering while traversing scans every edge
+** of every type; a projection filters once instead.
+**
+**   SELECT graph_project('follows', 'User', 'FOLLOWS', 'strength');
+**   SELECT graph_use('follows');       -- algorithms now read it
+**   SELECT graph_pagerank();
+**   SELECT * FROM graph_bfs('follows', 42, 2);
+**   SELECT graph_project_drop('follows');
+**
+** graph_project(name, node_labels, rel_types, weight_property) reads the
+** default graph table once and builds a CSR snapshot
+** (graphCSRBuildQuery()) over the nodes carrying any of node_labels and
+** the edges of rel_types between them, weighted by weight_property
+** (the edge weight column if NULL; missing values weigh 1.0). Node ids
+** keep their values and get dense indices of their own. The projection
+** is immutable: later writes to the graph do not reach it, and it is
+** rebuilt by dropping and projecting again.
+**
+** Projections belong to the connection's registry entry
+** (graph-registry.c), named in the same namespace as graph tables. The
+** whole-graph algorithms read the one picked with graph_use(), and
+** graph_bfs()/graph_dfs() take a projection name wherever they take a
+** graph name. graph_projections() reports each projection and the bytes
+** its arrays hold (graphCSRBytes()).
+**
+** Lifetime: A projection holds one reference on its snapshot; readers
+**           pin it with graphProjectionView(), so dropping a projection
+**           under a running cursor only frees it when the cursor closes
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include <string.h>
+
+void graphProjectionFree(GraphProjection *p){
+  if( p ){
+    graphCSRRelease(p->pCSR);
+    sqlite3_free(p->zName);
+    sqlite3_free(p->zGraph);
+    sqlite3_free(p->zLabels);
+    sqlite3_free(p->zTypes);
+    sqlite3_free(p->zWeight);
+    sqlite3_free(p);
+  }
+}
+
+int graphProjectionView(sqlite3 *pDb, const char *zName, CSRView *pView){
+  GraphProjection *p = graphConnProjection(graphRegistryConn(pDb), zName);
+
+  memset(pView, 0, sizeof(*pView));
+  if( p==0 ) return 0;
+  pView->pCSR = p->pCSR;
+  pView->pCSR->nRef++;
+  return 1;
+}
+
+/*
+** Append to pStr, separated by zSep, the SQL zFormat makes of each
+** trimmed, non-empty item of the comma-separated list zList. zFormat
+** takes the item as its one %Q argument, or as the label of
+** graphLabelMatchSql() when pVtab is not NULL. Returns the item count,
+** or -1 on OOM.
+*/
+static int projectList(sqlite3_str *pStr, GraphVtab *pVtab,
+                       const char *zList, const char *zFormat,
+                       const char *zSep){
+  const char *z = zList;
+  int nItem = 0;
+
+  for(;;){
+    const char *zEnd;
+    int n;
+    while( *z==' ' ) z++;
+    for(zEnd=z; *zEnd && *zEnd!=','; zEnd++){}
+    for(n=(int)(zEnd-z); n>0 && z[n-1]==' '; n--){}
+    if( n>0 ){
+      char *zItem = sqlite3_mprintf("%.*s", n, z);
+      char *zSql;
+      if( zItem==0 ) return -1;
+      zSql = pVtab ? graphLabelMatchSql(pVtab, "id", zItem)
+                   : sqlite3_mprintf(zFormat, zItem);
+      sqlite3_free(zItem);
+      if( zSql==0 ) return -1;
+      if( nItem++ ) sqlite3_str_appendall(pStr, zSep);
+      sqlite3_str_appendall(pStr, zSql);
+      sqlite3_free(zSql);
+    }
+    if( *zEnd==0 ) break;
+    z = zEnd+1;
+  }
+  return nItem;
+}
+
+/*
+** Build the snapshot of projection p over pGraph.
+*/
+static int projectBuild(GraphVtab *pGraph, GraphProjection *p){
+  sqlite3_str *pNodes = sqlite3_str_new(pGraph->pDb);
+  sqlite3_str *pEdges = sqlite3_str_new(pGraph->pDb);
+  char *zNodeSql, *zEdgeSql;
+  int rc = SQLITE_OK;
+
+  sqlite3_str_appendf(pNodes, "SELECT id FROM \"%w\"",
+                      pGraph->zNodeTableName);
+  if( p->zLabels ){
+    sqlite3_str_appendall(pNodes, " WHERE (");
+    if( projectList(pNodes, pGraph, p->zLabels, 0, " OR ")<=0 ){
+      sqlite3_str_appendall(pNodes, "0");
+    }
+    sqlite3_str_appendall(pNodes, ")");
+  }
+  sqlite3_str_appendall(pNodes, " ORDER BY id");
+
+  if( p->zWeight ){
+    sqlite3_str_appendf(pEdges,
+        "SELECT source, target,"
+        " coalesce(json_extract(%s, '$.%s'), 1.0) FROM \"%w\"",
+        graphPropsExpr(pGraph), p->zWeight, pGraph->zEdgeTableName);
+  }else{
+    sqlite3_str_appendf(pEdges,
+        "SELECT source, target, coalesce(weight, 1.0) FROM \"%w\"",
+        pGraph->zEdgeTableName);
+  }
+  if( p->zTypes ){
+    sqlite3_str_appendall(pEdges, " WHERE edge_type IN (");
+    if( projectList(pEdges, 0, p->zTypes, "%Q", ",")<=0 ){
+      sqlite3_str_appendall(pEdges, "NULL");
+    }
+    sqlite3_str_appendall(pEdges, ")");
+  }
+
+  zNodeSql = sqlite3_str_finish(pNodes);
+  zEdgeSql = sqlite3_str_finish(pEdges);
+  if( zNodeSql==0 || zEdgeSql==0 ){
+    rc = SQLITE_NOMEM;
+  }else{
+    rc = graphCSRBuildQuery(pGraph->pDb, zNodeSql, zEdgeSql, &p->pCSR);
+  }
+  sqlite3_free(zNodeSql);
+  sqlite3_free(zEdgeSql);
+  if( rc==SQLITE_OK ){
+    p->pCSR->nRef = 1;
+    p->nBytes = graphCSRBytes(p->pCSR);
+  }
+  return rc;
+}
+
+/* Copy of the text of pVal, or NULL for NULL or an empty string */
+static int projectArg(sqlite3_value *pVal, char **pz){
+  const char *z = (const char*)sqlite3_value_text(pVal);
+
+  *pz = 0;
+  if( z==0 || z[0]==0 ) return SQLITE_OK;
+  *pz = sqlite3_mprintf("%s", z);
+  return *pz ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+/*
+** SQL function: graph_project(name [, node_labels [, rel_types
+**                             [, weight_property]]])
+** Build projection name of the default graph: the nodes with any of the
+** comma-separated node_labels and the edges of rel_types between them,
+** weighted by edge property weight_property. NULL or '' keeps every
+** node, every type or the weight column. Returns the projection's
+** name, graph, node and edge counts and bytes as JSON.
+** Usage: SELECT graph_project('follows', 'User', 'FOLLOWS', 'strength');
+*/
+static void graphProjectFunc(sqlite3_context *pCtx, int argc,
+                             sqlite3_value **argv){
+  sqlite3 *pDb = sqlite3_context_db_handle(pCtx);
+  GraphConn *pConn = graphRegistryConn(pDb);
+  const char *zName = (const char*)sqlite3_value_text(argv[0]);
+  GraphVtab *pGraph;
+  GraphProjection *p;
+  char *zErr = 0;
+  int rc;
+
+  if( argc<1 || argc>4 ){
+    sqlite3_result_error(pCtx, "graph_project() takes 1 to 4 arguments", -1);
+    return;
+  }
+  if( zName==0 || zName[0]==0 ){
+    sqlite3_result_error(pCtx, "Projection name must not be empty", -1);
+    return;
+  }
+  if( argc>=4 && sqlite3_value_type(argv[3])!=SQLITE_NULL
+   && !graphIsPropertyName((const char*)sqlite3_value_text(argv[3])) ){
+    sqlite3_result_error(pCtx, "Weight property must be an identifier", -1);
+    return;
+  }
+  if( graphConnProjection(pConn, zName) ){
+    zErr = sqlite3_mprintf("projection already exists: %s", zName);
+  }else if( graphRegistryFind(pDb, zName) ){
+    zErr = sqlite3_mprintf("a graph table is named %s", zName);
+  }
+  if( zErr ){
+    sqlite3_result_error(pCtx, zErr, -1);
+    sqlite3_free(zErr);
+    return;
+  }
+  pGraph = graphRegistryFind(pDb, 0);
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+
+  p = sqlite3_malloc(sizeof(*p));
+  if( p==0 ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  memset(p, 0, sizeof(*p));
+  p->zName = sqlite3_mprintf("%s", zName);
+  p->zGraph = sqlite3_mprintf("%s", pGraph->zTableName);
+  rc = (p->zName && p->zGraph) ? SQLITE_OK : SQLITE_NOMEM;
+  if( rc==SQLITE_OK && argc>=2 ) rc = projectArg(argv[1], &p->zLabels);
+  if( rc==SQLITE_OK && argc>=3 ) rc = projectArg(argv[2], &p->zTypes);
+  if( rc==SQLITE_OK && argc>=4 ) rc = projectArg(argv[3], &p->zWeight);
+  if( rc==SQLITE_OK ) rc = projectBuild(pGraph, p);
+  if( rc!=SQLITE_OK ){
+    graphProjectionFree(p);
+    if( rc==SQLITE_NOMEM ){
+      sqlite3_result_error_nomem(pCtx);
+    }else{
+      sqlite3_result_error(pCtx, sqlite3_errmsg(pDb), -1);
+      sqlite3_result_error_code(pCtx, rc);
+    }
+    return;
+  }
+  graphProjectionAdd(pConn, p);
+
+  sqlite3_result_text(pCtx, sqlite3_mprintf(
+      "{\"name\":\"%s\",\"graph\":\"%s\",\"nodes\":%d,\"edges\":%lld,"
+      "\"bytes\":%lld}", p->zName, p->zGraph, p->pCSR->nNodes,
+      p->pCSR->nEdges, p->nBytes), -1, sqlite3_free);
+}
+
+/*
+** SQL function: graph_project_drop(name)
+** Drop projection name. Returns 1, or 0 if there was no such projection.
+** If graph_use() had picked it, the algorithms go back to the default
+** graph table.
+*/
+static void graphProjectDropFunc(sqlite3_context *pCtx, int argc,
+                                 sqlite3_value **argv){
+  GraphConn *pConn = graphRegistryConn(sqlite3_context_db_handle(pCtx));
+  const char *zName = (const char*)sqlite3_value_text(argv[0]);
+  GraphProjection *p;
+
+  (void)argc;
+  p = zName ? graphProjectionRemove(pConn, zName) : 0;
+  graphProjectionFree(p);
+  sqlite3_result_int(pCtx, p!=0);
+}
+
+/*
+** SQL function: graph_projections()
+** The connection's projections and the memory they hold, as JSON:
+** {"bytes":N,"in_use":"name"|null,"projections":[{"name":...,
+** "graph":...,"node_labels":...,"rel_types":...,"weight_property":...,
+** "nodes":N,"edges":N,"bytes":N},...]}
+*/
+static void graphProjectionsFunc(sqlite3_context *pCtx, int argc,
+                                 sqlite3_value **argv){
+  GraphConn *pConn = graphRegistryConn(sqlite3_context_db_handle(pCtx));
+  GraphProjection *pInUse = graphConnProjection(pConn, 0);
+  GraphProjection *p;
+  sqlite3_str *pStr = sqlite3_str_new(0);
+  sqlite3_int64 nBytes = 0;
+  char *zJson;
+  int i = 0;
+
+  (void)argc;
+  (void)argv;
+  for(p=graphConnProjectionList(pConn); p; p=p->pNext) nBytes += p->nBytes;
+  sqlite3_str_appendf(pStr, "{\"bytes\":%lld,\"in_use\":", nBytes);
+  if( pInUse ){
+    sqlite3_str_appendf(pStr, "\"%s\"", pInUse->zName);
+  }else{
+    sqlite3_str_appendall(pStr, "null");
+  }
+  sqlite3_str_appendall(pStr, ",\"projections\":[");
+  for(p=graphConnProjectionList(pConn); p; p=p->pNext){
+    sqlite3_str_appendf(pStr,
+        "%s{\"name\":\"%s\",\"graph\":\"%s\",\"node_labels\":%s%s%s,"
+        "\"rel_types\":%s%s%s,\"weight_property\":%s%s%s,"
+        "\"nodes\":%d,\"edges\":%lld,\"bytes\":%lld}",
+        i++ ? "," : "", p->zName, p->zGraph,
+        p->zLabels ? "\"" : "", p->zLabels ? p->zLabels : "null",
+        p->zLabels ? "\"" : "",
+        p->zTypes ? "\"" : "", p->zTypes ? p->zTypes : "null",
+        p->zTypes ? "\"" : "",
+        p->zWeight ? "\"" : "", p->zWeight ? p->zWeight : "null",
+        p->zWeight ? "\"" : "",
+        p->pCSR->nNodes, p->pCSR->nEdges, p->nBytes);
+  }
+  sqlite3_str_appendall(pStr, "]}");
+  zJson = sqlite3_str_finish(pStr);
+  if( zJson==0 ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  sqlite3_result_text(pCtx, zJson, -1, sqlite3_free);
+}
+
+int graphRegisterProjections(sqlite3 *pDb){
+  int rc;
+
+  rc = sqlite3_create_function(pDb, "graph_project", -1, SQLITE_UTF8, 0,
+                               graphProjectFunc, 0, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(pDb, "graph_project_drop", 1, SQLITE_UTF8,
+                                 0, graphProjectDropFunc, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(pDb, "graph_projections", 0, SQLITE_UTF8,
+                                 0, graphProjectionsFunc, 0, 0);
+  }
+  return rc;
+}
@@ -0,0 +1,298 @@
+/*
+** SQLite Graph Database Extension - Graph Registry
+**
+** SQL functions find the graph they act on through a registry keyed by
+** connection and table name, so graphs on different connections share
+** no state and a connection may hold any number of graphs. Each
+** connected graph virtual table is listed under its connection; a
+** function that takes no graph name uses the connection's default
+** graph: the one picked with graph_use(), else the one connected last.
+** Graph projections (graph-project.c) and background jobs
+** (graph-jobs.c) are listed on the same entry.
+**
+** Locking: g_registryMutex guards the connection hash only. The graph
+**          list of a connection is changed and read by that connection
+**          alone, under its database mutex, so lookups of a known
+**          connection take no process-wide lock
+** Lifetime: A connection's entry is created when the extension is
+**           loaded and freed by the graph_use() destructor on close
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GRAPH_REGISTRY_NHASH 64
+
+struct GraphConn {
+  sqlite3 *pDb;             /* Connection */
+  int nRef;                 /* Live graph_use() registrations */
+  GraphVtab *pList;         /* Connected graphs, most recent first */
+  char *zDefault;           /* Name chosen with graph_use(), or NULL */
+  GraphProjection *pProjections; /* graph_project() results, newest first */
+  char *zProjection;        /* Projection chosen with graph_use(), or NULL */
+  GraphJob *pJobs;          /* graph_job_submit() jobs, newest first */
+  GraphConn *pNext;         /* Next entry in the same hash bucket */
+};
+
+static pthread_mutex_t g_registryMutex = PTHREAD_MUTEX_INITIALIZER;
+static GraphConn *g_aConn[GRAPH_REGISTRY_NHASH];
+
+/*
+** Return the hash chain slot holding pDb's entry, or the NULL slot at
+** the end of its bucket. The caller holds g_registryMutex.
+*/
+static GraphConn **registrySlot(sqlite3 *pDb){
+  uintptr_t h = (uintptr_t)pDb;
+  GraphConn **pp;
+
+  h ^= h>>12;
+  pp = &g_aConn[(h>>4) % GRAPH_REGISTRY_NHASH];
+  while( *pp && (*pp)->pDb!=pDb ) pp = &(*pp)->pNext;
+  return pp;
+}
+
+GraphConn *graphRegistryConn(sqlite3 *pDb){
+  GraphConn *pConn;
+
+  pthread_mutex_lock(&g_registryMutex);
+  pConn = *registrySlot(pDb);
+  pthread_mutex_unlock(&g_registryMutex);
+  return pConn;
+}
+
+/*
+** Drop one reference to a connection entry; the xDestroy of graph_use().
+*/
+static void registryRelease(void *pArg){
+  GraphConn *pConn = (GraphConn*)pArg;
+  GraphConn **pp;
+  GraphJob *pJobs = 0;
+
+  pthread_mutex_lock(&g_registryMutex);
+  if( --pConn->nRef<=0 ){
+    pp = registrySlot(pConn->pDb);
+    if( *pp==pConn ) *pp = pConn->pNext;
+    pJobs = pConn->pJobs;
+    while( pConn->pProjections ){
+      GraphProjection *p = pConn->pProjections;
+      pConn->pProjections = p->pNext;
+      graphProjectionFree(p);
+    }
+    sqlite3_free(pConn->zDefault);
+    sqlite3_free(pConn->zProjection);
+    sqlite3_free(pConn);
+  }
+  pthread_mutex_unlock(&g_registryMutex);
+
+  /* Running jobs are waited for, so not under the registry lock */
+  graphJobListFree(pJobs);
+}
+
+void graphRegistryAdd(GraphVtab *pVtab){
+  GraphConn *pConn = graphRegistryConn(pVtab->pDb);
+
+  pVtab->pNextGraph = 0;
+  if( pConn==0 ) return;
+  pVtab->pNextGraph = pConn->pList;
+  pConn->pList = pVtab;
+}
+
+void graphRegistryRemove(GraphVtab *pVtab){
+  GraphConn *pConn = graphRegistryConn(pVtab->pDb);
+  GraphVtab **pp;
+
+  if( pConn==0 ) return;
+  for(pp=&pConn->pList; *pp; pp=&(*pp)->pNextGraph){
+    if( *pp==pVtab ){
+      *pp = pVtab->pNextGraph;
+      break;
+    }
+  }
+  pVtab->pNextGraph = 0;
+}
+
+GraphVtab *graphConnFind(GraphConn *pConn, const char *zName){
+  GraphVtab *p;
+
+  if( pConn==0 ) return 0;
+  if( zName==0 ) zName = pConn->zDefault;
+  if( zName==0 ) return pConn->pList;
+  for(p=pConn->pList; p; p=p->pNextGraph){
+    if( sqlite3_stricmp(p->zTableName, zName)==0 ) return p;
+  }
+  return 0;
+}
+
+void graphProjectionAdd(GraphConn *pConn, GraphProjection *p){
+  p->pNext = pConn->pProjections;
+  pConn->pProjections = p;
+}
+
+GraphProjection *graphProjectionRemove(GraphConn *pConn, const char *zName){
+  GraphProjection **pp;
+
+  if( pConn==0 ) return 0;
+  for(pp=&pConn->pProjections; *pp; pp=&(*pp)->pNext){
+    GraphProjection *p = *pp;
+    if( sqlite3_stricmp(p->zName, zName)==0 ){
+      *pp = p->pNext;
+      p->pNext = 0;
+      if( pConn->zProjection
+       && sqlite3_stricmp(pConn->zProjection, zName)==0 ){
+        sqlite3_free(pConn->zProjection);
+        pConn->zProjection = 0;
+      }
+      return p;
+    }
+  }
+  return 0;
+}
+
+GraphProjection *graphConnProjection(GraphConn *pConn, const char *zName){
+  GraphProjection *p;
+
+  if( pConn==0 ) return 0;
+  if( zName==0 ) zName = pConn->zProjection;
+  if( zName==0 ) return 0;
+  for(p=pConn->pProjections; p; p=p->pNext){
+    if( sqlite3_stricmp(p->zName, zName)==0 ) return p;
+  }
+  return 0;
+}
+
+GraphProjection *graphConnProjectionList(GraphConn *pConn){
+  return pConn ? pConn->pProjections : 0;
+}
+
+GraphJob **graphConnJobs(GraphConn *pConn){
+  return pConn ? &pConn->pJobs : 0;
+}
+
+/*
+** Connect graph table zName of pDb by preparing a statement that names
+** it. Errors are ignored: the caller looks the graph up again.
+*/
+static void registryConnect(sqlite3 *pDb, const char *zName){
+  sqlite3_stmt *pStmt = 0;
+  char *zSql = sqlite3_mprintf("SELECT 1 FROM \"%w\" WHERE 0", zName);
+
+  if( zSql==0 ) return;
+  sqlite3_prepare_v2(pDb, zSql, -1, &pStmt, 0);
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+}
+
+GraphVtab *graphRegistryFind(sqlite3 *pDb, const char *zName){
+  GraphConn *pConn = graphRegistryConn(pDb);
+  GraphVtab *pVtab;
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+
+  pVtab = graphConnFind(pConn, zName);
+  if( pVtab || pConn==0 ) return pVtab;
+
+  /* Graph tables are connected on first use by a statement */
+  if( zName==0 ) zName = pConn->zDefault;
+  if( zName ){
+    registryConnect(pDb, zName);
+    return graphConnFind(pConn, zName);
+  }
+  rc = sqlite3_prepare_v2(pDb,
+      "SELECT name FROM main.sqlite_master WHERE type='table'"
+      " AND sql LIKE 'CREATE VIRTUAL TABLE%USING graph%' ORDER BY rowid",
+      -1, &pStmt, 0);
+  while( rc==SQLITE_OK && pConn->pList==0
+      && sqlite3_step(pStmt)==SQLITE_ROW ){
+    registryConnect(pDb, (const char*)sqlite3_column_text(pStmt, 0));
+  }
+  sqlite3_finalize(pStmt);
+  return pConn->pList;
+}
+
+/*
+** SQL function: graph_use(name)
+** Make graph table name the default graph of this connection, for the
+** functions that take no graph argument. If name is a projection, the
+** whole-graph algorithms run on it instead and the default graph table
+** stays as it was. graph_use(NULL) goes back to the graph connected last
+** and no projection. Returns the name.
+*/
+static void graphUseFunc(sqlite3_context *pCtx, int argc,
+                         sqlite3_value **argv){
+  GraphConn *pConn = (GraphConn*)sqlite3_user_data(pCtx);
+  const char *zName = (const char*)sqlite3_value_text(argv[0]);
+  GraphProjection *pProj;
+  GraphVtab *pVtab;
+  char *zDefault;
+
+  assert( argc==1 );
+  if( zName==0 ){
+    sqlite3_free(pConn->zDefault);
+    sqlite3_free(pConn->zProjection);
+    pConn->zDefault = 0;
+    pConn->zProjection = 0;
+    sqlite3_result_null(pCtx);
+    return;
+  }
+  pProj = graphConnProjection(pConn, zName);
+  if( pProj ){
+    zDefault = sqlite3_mprintf("%s", pProj->zName);
+    if( zDefault==0 ){
+      sqlite3_result_error_nomem(pCtx);
+      return;
+    }
+    sqlite3_free(pConn->zProjection);
+    pConn->zProjection = zDefault;
+    sqlite3_result_text(pCtx, zDefault, -1, SQLITE_TRANSIENT);
+    return;
+  }
+  pVtab = graphRegistryFind(sqlite3_context_db_handle(pCtx), zName);
+  if( pVtab==0 ){
+    char *zErr = sqlite3_mprintf("no such graph: %s", zName);
+    sqlite3_result_error(pCtx, zErr ? zErr : "no such graph", -1);
+    sqlite3_free(zErr);
+    return;
+  }
+  zDefault = sqlite3_mprintf("%s", pVtab->zTableName);
+  if( zDefault==0 ){
+    sqlite3_result_error_nomem(pCtx);
+    return;
+  }
+  sqlite3_free(pConn->zDefault);
+  sqlite3_free(pConn->zProjection);
+  pConn->zDefault = zDefault;
+  pConn->zProjection = 0;
+  sqlite3_result_text(pCtx, zDefault, -1, SQLITE_TRANSIENT);
+}
+
+int graphRegisterRegistry(sqlite3 *pDb){
+  GraphConn **pp;
+  GraphConn *pConn;
+
+  pthread_mutex_lock(&g_registryMutex);
+  pp = registrySlot(pDb);
+  pConn = *pp;
+  if( pConn==0 ){
+    pConn = sqlite3_malloc(sizeof(*pConn));
+    if( pConn ){
+      memset(pConn, 0, sizeof(*pConn));
+      pConn->pDb = pDb;
+      *pp = pConn;
+    }
+  }
+  if( pConn ) pConn->nRef++;
+  pthread_mutex_unlock(&g_registryMutex);
+  if( pConn==0 ) return SQLITE_NOMEM;
+
+  /* On failure sqlite3_create_function_v2() calls the destructor */
+  return sqlite3_create_function_v2(pDb, "graph_use", 1, SQLITE_UTF8, pConn,
+                                    graphUseFunc, 0, 0, registryRelease);
+}
@@ -0,0 +1,565 @@
+/*
+** SQLite Graph Database Extension - Memoized Algorithm Results
+**
+** Dashboards call graph_pagerank(), graph_betweenness_centrality() and
+** graph_connected_components() over and over with the same arguments on
+** a graph that rarely changes. Each graph keeps the JSON these returned,
+** keyed by algorithm and arguments, and hands out a copy while the graph
+** is unchanged.
+**
+** Versioning: An entry records GraphVtab.iCSRSerial, which moves each
+**             time the CSR snapshot is replaced, and iDataVersion, which
+**             moves on every write through the graph. It is current if
+**             both still match and the snapshot is current, the check
+**             graphCSRIsCurrent() makes for every CSR reader, so writes
+**             by other paths and connections retire it too.
+** Budget: Entries are kept most recently used first and evicted from the
+**         tail once their keys and results take more than the budget.
+** Stale-while-revalidate: In GRAPH_RESULT_STALE mode a retired entry is
+**         returned as it is, and its algorithm is started on the worker
+**         pool against a pinned view of the current adjacency, as the
+**         background overlay fold in graph-csr-delta.c does; the job
+**         folds tracked writes into a private snapshot itself. The next
+**         call that finds the run finished adopts its result. Other
+**         writes make the snapshot be rebuilt from the database, which
+**         still happens on the calling thread.
+** Persistence: With result_cache=persist, results also go to the
+**         %s_results table, tagged like a csr_file= snapshot with the
+**         <graph>_csr instance and generation and the schema version
+**         (graph-csr-file.c). A connection that has not built the
+**         snapshot yet reads them from there instead of computing.
+**
+** Memory allocation: sqlite3_malloc64()/sqlite3_free(); results handed
+** to the caller are copies it frees with sqlite3_free().
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-metrics.h"
+#include "graph-performance.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct GraphResultEntry GraphResultEntry;
+typedef struct GraphResultJob GraphResultJob;
+
+/*
+** A recomputation running on the worker pool. The view is pinned, so
+** it outlives writes and rebuilds on the connection.
+*/
+struct GraphResultJob {
+  CSRView view;                /* Adjacency computed on */
+  sqlite3_int64 iSerial;       /* GraphVtab.iCSRSerial of view.pCSR */
+  sqlite3_int64 iDataVersion;  /* GraphVtab.iDataVersion at the start */
+  GraphResultArgs args;        /* What to compute */
+  TaskScheduler *pScheduler;   /* Keeps the pool running until collected */
+  pthread_mutex_t mutex;       /* Guards bDone, rc and zJson */
+  pthread_cond_t done;         /* Signalled when bDone is set */
+  int bDone;                   /* The worker has finished */
+  int rc;                      /* Result of the algorithm */
+  char *zJson;                 /* Its output */
+};
+
+struct GraphResultEntry {
+  char *zKey;                  /* Algorithm and arguments, as text */
+  GraphResultArgs args;        /* The same, for recomputation */
+  char *zJson;                 /* Result */
+  sqlite3_int64 nJson;         /* strlen(zJson) */
+  sqlite3_int64 iSerial;       /* GraphVtab.iCSRSerial computed on, or -1 */
+  sqlite3_int64 iDataVersion;  /* GraphVtab.iDataVersion computed at */
+  GraphResultJob *pJob;        /* Recomputation in flight, or NULL */
+  GraphResultEntry *pPrev;     /* More recently used */
+  GraphResultEntry *pNext;     /* Less recently used */
+};
+
+struct GraphResultCache {
+  GraphResultEntry *pFirst;    /* Most recently used */
+  GraphResultEntry *pLast;     /* Least recently used, evicted first */
+  int nEntry;
+  sqlite3_int64 nByte;         /* Bytes held by the entries */
+  sqlite3_int64 nBudget;       /* Most bytes to hold, 0 = disabled */
+  int eMode;                   /* GRAPH_RESULT_FRESH or _STALE */
+};
+
+/*
+** The cache of pVtab, created with the default budget on first use.
+** Returns NULL on OOM.
+*/
+static GraphResultCache *resultCache(GraphVtab *pVtab){
+  GraphResultCache *p = pVtab->pResults;
+  if( p==0 ){
+    p = sqlite3_malloc(sizeof(*p));
+    if( p==0 ) return 0;
+    memset(p, 0, sizeof(*p));
+    p->nBudget = GRAPH_RESULT_DEFAULT_BUDGET;
+    p->eMode = GRAPH_RESULT_FRESH;
+    pVtab->pResults = p;
+  }
+  return p;
+}
+
+/*
+** Write r to z in the fewest digits that read back as r.
+*/
+static void resultDouble(char *z, int n, double r){
+  snprintf(z, n, "%.15g", r);
+  if( strtod(z, 0)!=r ) snprintf(z, n, "%.17g", r);
+}
+
+static char *resultKey(const GraphResultArgs *pArgs){
+  char zDamping[32], zEpsilon[32];
+
+  switch( pArgs->eAlgo ){
+    case GRAPH_RESULT_PAGERANK:
+      resultDouble(zDamping, sizeof(zDamping), pArgs->rDamping);
+      resultDouble(zEpsilon, sizeof(zEpsilon), pArgs->rEpsilon);
+      return sqlite3_mprintf("pagerank(%s,%d,%s)", zDamping,
+                             pArgs->nMaxIter, zEpsilon);
+    case GRAPH_RESULT_BETWEENNESS:
+      return sqlite3_mprintf("betweenness()");
+    case GRAPH_RESULT_COMPONENTS:
+      return sqlite3_mprintf("connected_components()");
+  }
+  assert( 0 );
+  return 0;
+}
+
+/*
+** Run the algorithm *pArgs describes on pCSR. Safe on any thread.
+*/
+static int resultRun(const CSRGraph *pCSR, const GraphResultArgs *pArgs,
+                     int nThreads, char **pzJson){
+  switch( pArgs->eAlgo ){
+    case GRAPH_RESULT_PAGERANK:
+      return graphPageRankCSR(pCSR, pArgs->rDamping, pArgs->nMaxIter,
+                              pArgs->rEpsilon, nThreads, pzJson);
+    case GRAPH_RESULT_BETWEENNESS:
+      return graphBetweennessCentralityCSR(pCSR, nThreads, pzJson);
+    case GRAPH_RESULT_COMPONENTS:
+      return graphConnectedComponentsCSR(pCSR, pzJson);
+  }
+  assert( 0 );
+  return SQLITE_MISUSE;
+}
+
+static sqlite3_int64 resultCost(const GraphResultEntry *pEntry){
+  return (sqlite3_int64)(sizeof(*pEntry) + strlen(pEntry->zKey) + 1)
+       + pEntry->nJson + 1;
+}
+
+static char *resultCopy(const char *zJson, sqlite3_int64 nJson){
+  char *z = sqlite3_malloc64(nJson+1);
+  if( z ) memcpy(z, zJson, nJson+1);
+  return z;
+}
+
+/*
+** Whether pEntry describes the graph as it is now. Asks about the
+** snapshot first, since that may install a new one.
+*/
+static int resultIsFresh(GraphVtab *pVtab, const GraphResultEntry *pEntry){
+  return graphCSRIsCurrent(pVtab)
+      && pEntry->iSerial==pVtab->iCSRSerial
+      && pEntry->iDataVersion==pVtab->iDataVersion;
+}
+
+static GraphResultEntry *resultFind(GraphResultCache *p, const char *zKey){
+  GraphResultEntry *pEntry;
+  for(pEntry=p->pFirst; pEntry; pEntry=pEntry->pNext){
+    if( strcmp(pEntry->zKey, zKey)==0 ) return pEntry;
+  }
+  return 0;
+}
+
+static void resultUnlink(GraphResultCache *p, GraphResultEntry *pEntry){
+  if( pEntry->pPrev ) pEntry->pPrev->pNext = pEntry->pNext;
+  else p->pFirst = pEntry->pNext;
+  if( pEntry->pNext ) pEntry->pNext->pPrev = pEntry->pPrev;
+  else p->pLast = pEntry->pPrev;
+  pEntry->pPrev = pEntry->pNext = 0;
+}
+
+static void resultPushFront(GraphResultCache *p, GraphResultEntry *pEntry){
+  pEntry->pPrev = 0;
+  pEntry->pNext = p->pFirst;
+  if( p->pFirst ) p->pFirst->pPrev = pEntry;
+  else p->pLast = pEntry;
+  p->pFirst = pEntry;
+}
+
+static void resultTouch(GraphResultCache *p, GraphResultEntry *pEntry){
+  if( p->pFirst!=pEntry ){
+    resultUnlink(p, pEntry);
+    resultPushFront(p, pEntry);
+  }
+}
+
+/*
+** Background recomputation
+*/
+
+static void resultJobTask(void *pArg){
+  GraphResultJob *pJob = (GraphResultJob*)pArg;
+  const CSRGraph *pCSR = pJob->view.pCSR;
+  CSRGraph *pFolded = 0;
+  char *zJson = 0;
+  int rc = SQLITE_OK;
+
+  if( pJob->view.pDelta ){
+    rc = graphCSRViewFold(&pJob->view, &pFolded);
+    pCSR = pFolded;
+  }
+  /* One worker per job: the connection's own calls keep the rest */
+  if( rc==SQLITE_OK ) rc = resultRun(pCSR, &pJob->args, 1, &zJson);
+  graphCSRFree(pFolded);
+
+  pthread_mutex_lock(&pJob->mutex);
+  pJob->zJson = zJson;
+  pJob->rc = rc;
+  pJob->bDone = 1;
+  pthread_cond_broadcast(&pJob->done);
+  pthread_mutex_unlock(&pJob->mutex);
+}
+
+/*
+** Start recomputing pEntry against the current adjacency of pVtab.
+** Failing to start leaves pEntry->pJob NULL; the caller then computes
+** on its own thread.
+*/
+static void resultJobStart(GraphVtab *pVtab, GraphResultEntry *pEntry){
+  GraphResultJob *pJob;
+  ParallelTask *pTask;
+
+  assert( pEntry->pJob==0 );
+  pJob = sqlite3_malloc(sizeof(*pJob));
+  pTask = sqlite3_malloc(sizeof(*pTask));
+  if( pJob==0 || pTask==0 ){
+    sqlite3_free(pJob);
+    sqlite3_free(pTask);
+    return;
+  }
+  memset(pJob, 0, sizeof(*pJob));
+  if( graphCSRViewOpen(pVtab, &pJob->view)!=SQLITE_OK
+   || (pJob->pScheduler = graphCreateTaskScheduler(1))==0 ){
+    graphCSRViewClose(&pJob->view);
+    sqlite3_free(pJob);
+    sqlite3_free(pTask);
+    return;
+  }
+  pthread_mutex_init(&pJob->mutex, 0);
+  pthread_cond_init(&pJob->done, 0);
+  pJob->iSerial = pVtab->iCSRSerial;
+  pJob->iDataVersion = pVtab->iDataVersion;
+  pJob->args = pEntry->args;
+
+  memset(pTask, 0, sizeof(*pTask));
+  pTask->execute = resultJobTask;
+  pTask->arg = pJob;
+  pEntry->pJob = pJob;
+  graphScheduleTask(pJob->pScheduler, pTask);
+}
+
+/*
+** Collect the recomputation of pEntry, if any: return at once if it is
+** still running unless bWait, and make its output the entry's result if
+** bAdopt and it succeeded. Returns true if a result was adopted.
+*/
+static int resultJobFinish(GraphResultCache *p, GraphResultEntry *pEntry,
+                           int bWait, int bAdopt){
+  GraphResultJob *pJob = pEntry->pJob;
+  int bAdopted = 0;
+
+  if( pJob==0 ) return 0;
+  pthread_mutex_lock(&pJob->mutex);
+  if( !pJob->bDone && !bWait ){
+    pthread_mutex_unlock(&pJob->mutex);
+    return 0;
+  }
+  while( !pJob->bDone ) pthread_cond_wait(&pJob->done, &pJob->mutex);
+  pthread_mutex_unlock(&pJob->mutex);
+
+  pEntry->pJob = 0;
+  if( bAdopt && pJob->rc==SQLITE_OK ){
+    p->nByte -= resultCost(pEntry);
+    sqlite3_free(pEntry->zJson);
+    pEntry->zJson = pJob->zJson;
+    pEntry->nJson = (sqlite3_int64)strlen(pJob->zJson);
+    pEntry->iSerial = pJob->iSerial;
+    pEntry->iDataVersion = pJob->iDataVersion;
+    p->nByte += resultCost(pEntry);
+    pJob->zJson = 0;
+    bAdopted = 1;
+    graphMetricAdd(GRAPH_METRIC_RESULT_REFRESHES, 1);
+  }
+  sqlite3_free(pJob->zJson);
+  graphCSRViewClose(&pJob->view);
+  graphDestroyTaskScheduler(pJob->pScheduler);
+  pthread_cond_destroy(&pJob->done);
+  pthread_mutex_destroy(&pJob->mutex);
+  sqlite3_free(pJob);
+  return bAdopted;
+}
+
+static void resultEntryFree(GraphResultCache *p, GraphResultEntry *pEntry){
+  resultJobFinish(p, pEntry, 1, 0);
+  resultUnlink(p, pEntry);
+  p->nByte -= resultCost(pEntry);
+  p->nEntry--;
+  sqlite3_free(pEntry->zKey);
+  sqlite3_free(pEntry->zJson);
+  sqlite3_free(pEntry);
+}
+
+/*
+** Evict least recently used entries until the cache is within budget.
+*/
+static void resultTrim(GraphResultCache *p){
+  while( p->pLast && p->nByte>p->nBudget ){
+    resultEntryFree(p, p->pLast);
+  }
+}
+
+/*
+** Keep a copy of zJson as the result for zKey, computed on snapshot
+** iSerial (-1 if not known) as of the current data version. Failing to
+** keep it is not an error.
+*/
+static void resultStore(GraphVtab *pVtab, GraphResultCache *p,
+                        const char *zKey, const GraphResultArgs *pArgs,
+                        const char *zJson, sqlite3_int64 iSerial){
+  GraphResultEntry *pEntry = resultFind(p, zKey);
+  sqlite3_int64 nJson = (sqlite3_int64)strlen(zJson);
+
+  if( pEntry ) resultEntryFree(p, pEntry);
+  if( (sqlite3_int64)(sizeof(*pEntry) + strlen(zKey)) + nJson + 2>p->nBudget ){
+    return;
+  }
+  pEntry = sqlite3_malloc(sizeof(*pEntry));
+  if( pEntry==0 ) return;
+  memset(pEntry, 0, sizeof(*pEntry));
+  pEntry->zKey = sqlite3_mprintf("%s", zKey);
+  pEntry->zJson = resultCopy(zJson, nJson);
+  if( pEntry->zKey==0 || pEntry->zJson==0 ){
+    sqlite3_free(pEntry->zKey);
+    sqlite3_free(pEntry->zJson);
+    sqlite3_free(pEntry);
+    return;
+  }
+  pEntry->args = *pArgs;
+  pEntry->nJson = nJson;
+  pEntry->iSerial = iSerial;
+  pEntry->iDataVersion = pVtab->iDataVersion;
+  resultPushFront(p, pEntry);
+  p->nEntry++;
+  p->nByte += resultCost(pEntry);
+  resultTrim(p);
+}
+
+/*
+** Persistence (result_cache=persist)
+*/
+
+/*
+** Read the saved result for zKey into *pzJson if its tag matches the
+** data as it is now, else leave *pzJson NULL. The table is only a
+** cache, so failing to read it is a miss.
+*/
+static int resultLoad(GraphVtab *pVtab, const char *zKey, char **pzJson){
+  CSRFileTag tag;
+  sqlite3_stmt *pStmt;
+  int rc = SQLITE_OK;
+
+  *pzJson = 0;
+  if( graphCSRFileTag(pVtab, &tag)!=SQLITE_OK
+   || graphStmtAcquire(pVtab, GRAPH_STMT_RESULT_GET, &pStmt)!=SQLITE_OK ){
+    return SQLITE_OK;
+  }
+  sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+  if( sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_column_int64(pStmt, 0)==tag.iInstance
+   && sqlite3_column_int64(pStmt, 1)==tag.iGeneration
+   && sqlite3_column_int64(pStmt, 2)==tag.iSchemaVersion
+   && sqlite3_column_type(pStmt, 3)==SQLITE_TEXT ){
+    *pzJson = resultCopy((const char*)sqlite3_column_text(pStmt, 3),
+                         sqlite3_column_bytes(pStmt, 3));
+    if( *pzJson==0 ) rc = SQLITE_NOMEM;
+  }
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
+}
+
+/*
+** Save zJson, the result for zKey on the current snapshot, to
+** %s_results. Errors are not reported, since the table is only a cache.
+*/
+static void resultSave(GraphVtab *pVtab, const char *zKey,
+                       const char *zJson){
+  CSRFileTag tag;
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  if( !pVtab->bResultPersist ) return;
+  /* Uncommitted data would be tagged with a generation a rollback reuses */
+  if( sqlite3_txn_state(pVtab->pDb, pVtab->zDbName)==SQLITE_TXN_WRITE ){
+    return;
+  }
+  if( graphCSRFileTag(pVtab, &tag)!=SQLITE_OK ) return;
+  /* The tag read may have seen a commit the snapshot has not */
+  if( !graphCSRIsCurrent(pVtab) ) return;
+  if( graphStmtAcquire(pVtab, GRAPH_STMT_RESULT_PUT, &pStmt)!=SQLITE_OK ){
+    return;
+  }
+  sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(pStmt, 2, tag.iInstance);
+  sqlite3_bind_int64(pStmt, 3, tag.iGeneration);
+  sqlite3_bind_int64(pStmt, 4, tag.iSchemaVersion);
+  sqlite3_bind_text(pStmt, 5, zJson, -1, SQLITE_STATIC);
+  rc = sqlite3_step(pStmt);
+  graphStmtRelease(pVtab, pStmt);
+
+  /* The row is not graph data: restamp the snapshot past this write, as
+  ** a tracked write would, rather than have it rebuilt */
+  if( rc==SQLITE_DONE ) graphCSRStampWrite(pVtab, 0);
+}
+
+int graphResultGet(GraphVtab *pVtab, const GraphResultArgs *pArgs,
+                   int nThreads, char **pzJson){
+  GraphResultCache *p = resultCache(pVtab);
+  GraphResultEntry *pEntry;
+  CSRGraph *pCSR = 0;
+  char *zKey;
+  char *zJson = 0;
+  int rc;
+
+  assert( pzJson!=0 );
+  *pzJson = 0;
+  if( p==0 || p->nBudget==0 ){
+    rc = graphCSRGet(pVtab, &pCSR);
+    if( rc!=SQLITE_OK ) return rc;
+    return resultRun(pCSR, pArgs, nThreads, pzJson);
+  }
+  zKey = resultKey(pArgs);
+  if( zKey==0 ) return SQLITE_NOMEM;
+
+  pEntry = resultFind(p, zKey);
+  if( pEntry && pEntry->pJob && resultJobFinish(p, pEntry, 0, 1) ){
+    if( pVtab->bResultPersist && resultIsFresh(pVtab, pEntry) ){
+      resultSave(pVtab, zKey, pEntry->zJson);
+    }
+    resultTrim(p);
+    pEntry = resultFind(p, zKey);
+  }
+  if( pEntry && resultIsFresh(pVtab, pEntry) ){
+    graphMetricAdd(GRAPH_METRIC_RESULT_HITS, 1);
+    resultTouch(p, pEntry);
+    *pzJson = resultCopy(pEntry->zJson, pEntry->nJson);
+    rc = *pzJson ? SQLITE_OK : SQLITE_NOMEM;
+    goto result_done;
+  }
+
+  if( pVtab->bResultPersist ){
+    rc = resultLoad(pVtab, zKey, &zJson);
+    if( rc!=SQLITE_OK ) goto result_done;
+    if( zJson ){
+      graphMetricAdd(GRAPH_METRIC_RESULT_HITS, 1);
+      resultStore(pVtab, p, zKey, pArgs, zJson,
+                  graphCSRIsCurrent(pVtab) ? pVtab->iCSRSerial : -1);
+      *pzJson = zJson;
+      goto result_done;
+    }
+  }
+
+  if( pEntry && p->eMode==GRAPH_RESULT_STALE ){
+    if( pEntry->pJob==0 ) resultJobStart(pVtab, pEntry);
+    if( pEntry->pJob ){
+      graphMetricAdd(GRAPH_METRIC_RESULT_STALE_HITS, 1);
+      resultTouch(p, pEntry);
+      *pzJson = resultCopy(pEntry->zJson, pEntry->nJson);
+      rc = *pzJson ? SQLITE_OK : SQLITE_NOMEM;
+      goto result_done;
+    }
+  }
+
+  graphMetricAdd(GRAPH_METRIC_RESULT_MISSES, 1);
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc==SQLITE_OK ) rc = resultRun(pCSR, pArgs, nThreads, &zJson);
+  if( rc==SQLITE_OK ){
+    resultStore(pVtab, p, zKey, pArgs, zJson, pVtab->iCSRSerial);
+    resultSave(pVtab, zKey, zJson);
+    *pzJson = zJson;
+  }
+
+result_done:
+  sqlite3_free(zKey);
+  return rc;
+}
+
+int graphResultCacheConfig(GraphVtab *pVtab, sqlite3_int64 nBudget,
+                           int eMode, char **pzJson){
+  GraphResultCache *p = resultCache(pVtab);
+  GraphResultEntry *pEntry;
+  int nJob = 0;
+
+  *pzJson = 0;
+  if( p==0 ) return SQLITE_NOMEM;
+  if( nBudget>=0 ){
+    p->nBudget = nBudget;
+    resultTrim(p);
+  }
+  if( eMode>=0 ) p->eMode = eMode;
+  for(pEntry=p->pFirst; pEntry; pEntry=pEntry->pNext){
+    if( pEntry->pJob ) nJob++;
+  }
+  *pzJson = sqlite3_mprintf(
+      "{\"budget\":%lld,\"bytes\":%lld,\"entries\":%d,\"refreshing\":%d,"
+      "\"mode\":\"%s\",\"persist\":%s}",
+      p->nBudget, p->nByte, p->nEntry, nJob,
+      p->eMode==GRAPH_RESULT_STALE ? "stale" : "fresh",
+      pVtab->bResultPersist ? "true" : "false");
+  return *pzJson ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+int graphResultCacheInit(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  if( !pVtab->bResultPersist ) return SQLITE_OK;
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w\".\"%w_results\"("
+      "key TEXT PRIMARY KEY, instance INTEGER, generation INTEGER,"
+      " schema_version INTEGER, result TEXT)",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+int graphResultCacheDrop(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  if( !pVtab->bResultPersist ) return SQLITE_OK;
+  zSql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\".\"%w_results\"",
+                         pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+void graphResultCacheFree(GraphVtab *pVtab){
+  GraphResultCache *p = pVtab->pResults;
+  if( p ){
+    while( p->pFirst ) resultEntryFree(p, p->pFirst);
+    sqlite3_free(p);
+    pVtab->pResults = 0;
+  }
+}
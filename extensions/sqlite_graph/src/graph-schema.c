@@ -6,7 +6,13 @@
 ** Cypher compatibility.
 **
 ** Key features:
-** - Label-based node indexing with hash tables
+** - Label index: a %s_labels dictionary of label ids and a
+**   %s_node_labels(label_id, node_id) shadow table, kept in sync with
+**   the backing node table by triggers
+** - Degree index: a %s_degree(node_id, edge_type, out_degree, in_degree)
+**   shadow table and %s_counts node and edge totals, kept by triggers
+** - Property indexes: expression indexes on json_extract() of the node
+**   properties, created by graph_create_index()
 ** - Relationship type tracking and indexing
 ** - Dynamic schema discovery and validation
 ** - Property schema inference for optimization
@@ -23,7 +29,9 @@ extern const sqlite3_api_routines *sqlite3_api;
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "graph.h"
 #include "graph-memory.h"
+#include "graph-csr.h"
 #include "cypher/cypher-schema.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -187,51 +195,1036 @@ int graphRegisterRelationshipType(CypherSchema *pSchema, const char *zType) {
 }
 
 /*
-** Create a label-based index for fast node lookups.
-** Creates hash table for O(1) label-based node access.
+** Expression yielding the JSON labels array of a node row, so that a
+** malformed labels value indexes as "no labels" instead of failing the
+** write that stored it.
+*/
+#define GRAPH_LABELS_JSON(zRow) \
+  "json_each(CASE WHEN json_valid(" zRow ".labels) THEN " zRow ".labels " \
+  "ELSE '[]' END)"
+
+/*
+** Create the label index for pVtab if it does not exist yet. The
+** dictionary maps each label to a small integer, the shadow table holds
+** one (label_id, node_id) row per node label in primary-key order, so
+** all nodes with a label form one contiguous b-tree range. Triggers on
+** the backing node table keep both in sync for every write path (the
+** virtual table, the SQL functions, Cypher writes and direct SQL).
+**
+** Nodes already present when the index is created are backfilled. If
+** the index cannot be created (e.g. read-only database) bLabelIndex
+** stays 0 and label scans fall back to matching the labels column.
+*/
+int graphLabelIndexInit(GraphVtab *pVtab){
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int bExists = 0;
+  int rc;
+
+  if( !pVtab ) return SQLITE_MISUSE;
+
+  zSql = sqlite3_mprintf(
+      "SELECT 1 FROM \"%w\".sqlite_master "
+      "WHERE type='table' AND name='%q_node_labels'",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  bExists = sqlite3_step(pStmt)==SQLITE_ROW;
+  sqlite3_finalize(pStmt);
+
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w_labels\"("
+      "label_id INTEGER PRIMARY KEY, label TEXT NOT NULL UNIQUE);"
+      "CREATE TABLE IF NOT EXISTS \"%w_node_labels\"("
+      "label_id INTEGER NOT NULL, node_id INTEGER NOT NULL,"
+      " PRIMARY KEY(label_id, node_id)) WITHOUT ROWID;"
+      "CREATE INDEX IF NOT EXISTS \"%w_node_labels_node\""
+      " ON \"%w_node_labels\"(node_id);"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_labels_ai\" AFTER INSERT ON \"%w\" BEGIN"
+      " INSERT OR IGNORE INTO \"%w_labels\"(label)"
+      "  SELECT value FROM " GRAPH_LABELS_JSON("NEW") " WHERE type='text';"
+      " INSERT OR IGNORE INTO \"%w_node_labels\"(label_id, node_id)"
+      "  SELECT d.label_id, NEW.id FROM " GRAPH_LABELS_JSON("NEW") " j"
+      "  JOIN \"%w_labels\" d ON d.label=j.value WHERE j.type='text';"
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_labels_au\""
+      " AFTER UPDATE OF id, labels ON \"%w\" BEGIN"
+      " DELETE FROM \"%w_node_labels\" WHERE node_id=OLD.id;"
+      " INSERT OR IGNORE INTO \"%w_labels\"(label)"
+      "  SELECT value FROM " GRAPH_LABELS_JSON("NEW") " WHERE type='text';"
+      " INSERT OR IGNORE INTO \"%w_node_labels\"(label_id, node_id)"
+      "  SELECT d.label_id, NEW.id FROM " GRAPH_LABELS_JSON("NEW") " j"
+      "  JOIN \"%w_labels\" d ON d.label=j.value WHERE j.type='text';"
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_labels_ad\" AFTER DELETE ON \"%w\" BEGIN"
+      " DELETE FROM \"%w_node_labels\" WHERE node_id=OLD.id;"
+      "END;",
+      pVtab->zTableName, pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName,
+      pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zTableName, pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zTableName, pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName,
+      pVtab->zTableName, pVtab->zNodeTableName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+
+  if( !bExists ){
+    zSql = sqlite3_mprintf(
+        "INSERT OR IGNORE INTO \"%w_labels\"(label)"
+        " SELECT DISTINCT j.value FROM \"%w\" n, " GRAPH_LABELS_JSON("n") " j"
+        " WHERE j.type='text';"
+        "INSERT OR IGNORE INTO \"%w_node_labels\"(label_id, node_id)"
+        " SELECT d.label_id, n.id FROM \"%w\" n, " GRAPH_LABELS_JSON("n") " j"
+        " JOIN \"%w_labels\" d ON d.label=j.value WHERE j.type='text';",
+        pVtab->zTableName, pVtab->zNodeTableName,
+        pVtab->zTableName, pVtab->zNodeTableName, pVtab->zTableName);
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+    sqlite3_free(zSql);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+
+  pVtab->bLabelIndex = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Drop the label index tables of pVtab. Its triggers go away with the
+** backing node table.
+*/
+int graphLabelIndexDrop(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  zSql = sqlite3_mprintf(
+      "DROP TABLE IF EXISTS \"%w_node_labels\";"
+      "DROP TABLE IF EXISTS \"%w_labels\";",
+      pVtab->zTableName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  pVtab->bLabelIndex = 0;
+  return rc;
+}
+
+/*
+** Create the adjacency indexes of pVtab's edge table if they do not
+** exist yet. Each leads with one endpoint and the edge type and carries
+** the other endpoint and the weight, so an out- or in-expansion, typed
+** or not, is answered from the index b-tree alone without touching the
+** edge rows.
+*/
+int graphEdgeIndexInit(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  if( !pVtab ) return SQLITE_MISUSE;
+  zSql = sqlite3_mprintf(
+      "CREATE INDEX IF NOT EXISTS \"%w_edges_out\""
+      " ON \"%w\"(source, edge_type, target, weight);"
+      "CREATE INDEX IF NOT EXISTS \"%w_edges_in\""
+      " ON \"%w\"(target, edge_type, source, weight);",
+      pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName, pVtab->zEdgeTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Trigger bodies adding the edge in row zRow ("NEW") to the degrees of
+** its endpoints, or removing the one in "OLD". A row whose counts both
+** drop to zero is deleted, so %s_degree only holds nodes with edges.
+*/
+#define GRAPH_DEGREE_ADD(zRow) \
+  " INSERT INTO \"%w_degree\"(node_id, edge_type, out_degree, in_degree)" \
+  "  SELECT " zRow ".source, coalesce(" zRow ".edge_type, ''), 1, 0" \
+  "  WHERE " zRow ".source IS NOT NULL" \
+  "  ON CONFLICT DO UPDATE SET out_degree=out_degree+1;" \
+  " INSERT INTO \"%w_degree\"(node_id, edge_type, out_degree, in_degree)" \
+  "  SELECT " zRow ".target, coalesce(" zRow ".edge_type, ''), 0, 1" \
+  "  WHERE " zRow ".target IS NOT NULL" \
+  "  ON CONFLICT DO UPDATE SET in_degree=in_degree+1;"
+#define GRAPH_DEGREE_SUB(zRow) \
+  " UPDATE \"%w_degree\" SET out_degree=out_degree-1" \
+  "  WHERE node_id=" zRow ".source AND edge_type=coalesce(" zRow ".edge_type, '');" \
+  " UPDATE \"%w_degree\" SET in_degree=in_degree-1" \
+  "  WHERE node_id=" zRow ".target AND edge_type=coalesce(" zRow ".edge_type, '');" \
+  " DELETE FROM \"%w_degree\" WHERE node_id IN (" zRow ".source, " zRow ".target)" \
+  "  AND edge_type=coalesce(" zRow ".edge_type, '')" \
+  "  AND out_degree<=0 AND in_degree<=0;"
+
+/*
+** Create the degree index for pVtab if it does not exist yet: per-node,
+** per-type out and in degrees and the graph's node and edge counts,
+** kept by triggers on the backing tables so every write path updates
+** them in its own transaction. A degree lookup is then one primary-key
+** range read, however stale the CSR snapshot is.
+**
+** A graph that already has edges is backfilled. If the tables cannot be
+** created (e.g. read-only database) bDegreeIndex stays 0 and degrees
+** come from the CSR snapshot, counts from count(*).
+**
+** INSERT OR REPLACE over an existing row only fires the delete triggers
+** with PRAGMA recursive_triggers on; graphDegreeIndexRebuild(), which
+** graph_analyze() runs, repairs counts left off by such writes.
+*/
+int graphDegreeIndexInit(GraphVtab *pVtab){
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int bExists = 0;
+  int rc;
+
+  if( !pVtab ) return SQLITE_MISUSE;
+
+  zSql = sqlite3_mprintf(
+      "SELECT 1 FROM \"%w\".sqlite_master "
+      "WHERE type='table' AND name='%q_counts'",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  bExists = sqlite3_step(pStmt)==SQLITE_ROW;
+  sqlite3_finalize(pStmt);
+
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w_degree\"("
+      "node_id INTEGER NOT NULL, edge_type TEXT NOT NULL,"
+      " out_degree INTEGER NOT NULL, in_degree INTEGER NOT NULL,"
+      " PRIMARY KEY(node_id, edge_type)) WITHOUT ROWID;"
+      "CREATE TABLE IF NOT EXISTS \"%w_counts\"("
+      "nodes INTEGER NOT NULL, edges INTEGER NOT NULL);"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_counts_ai\" AFTER INSERT ON \"%w\" BEGIN"
+      " UPDATE \"%w_counts\" SET nodes=nodes+1;"
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_counts_ad\" AFTER DELETE ON \"%w\" BEGIN"
+      " UPDATE \"%w_counts\" SET nodes=nodes-1;"
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_degree_ai\" AFTER INSERT ON \"%w\" BEGIN"
+      GRAPH_DEGREE_ADD("NEW")
+      " UPDATE \"%w_counts\" SET edges=edges+1;"
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_degree_au\""
+      " AFTER UPDATE OF source, target, edge_type ON \"%w\" BEGIN"
+      GRAPH_DEGREE_SUB("OLD")
+      GRAPH_DEGREE_ADD("NEW")
+      "END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w_degree_ad\" AFTER DELETE ON \"%w\" BEGIN"
+      GRAPH_DEGREE_SUB("OLD")
+      " UPDATE \"%w_counts\" SET edges=edges-1;"
+      "END;",
+      pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zNodeTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zNodeTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName, pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName, pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zTableName, pVtab->zTableName, pVtab->zTableName,
+      pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+
+  pVtab->bDegreeIndex = 1;
+  if( !bExists ){
+    rc = graphDegreeIndexRebuild(pVtab, 1);
+    if( rc!=SQLITE_OK ) pVtab->bDegreeIndex = 0;
+  }
+  return rc;
+}
+
+/*
+** Recount the node and edge totals of pVtab and, with bEdges, every
+** node's degrees, from the backing tables. The degree rows are written
+** in primary-key order.
+*/
+int graphDegreeIndexRebuild(GraphVtab *pVtab, int bEdges){
+  char *zSql;
+  int rc;
+
+  if( !pVtab->bDegreeIndex ) return SQLITE_OK;
+  zSql = sqlite3_mprintf(
+      "DELETE FROM \"%w_counts\";"
+      "INSERT INTO \"%w_counts\"(nodes, edges)"
+      " SELECT (SELECT count(*) FROM \"%w\"), (SELECT count(*) FROM \"%w\");",
+      pVtab->zTableName, pVtab->zTableName,
+      pVtab->zNodeTableName, pVtab->zEdgeTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK || !bEdges ) return rc;
+
+  zSql = sqlite3_mprintf(
+      "DELETE FROM \"%w_degree\";"
+      "INSERT INTO \"%w_degree\"(node_id, edge_type, out_degree, in_degree)"
+      " SELECT node_id, edge_type, sum(o), sum(i) FROM ("
+      "  SELECT source AS node_id, coalesce(edge_type, '') AS edge_type,"
+      "   1 AS o, 0 AS i FROM \"%w\" WHERE source IS NOT NULL"
+      "  UNION ALL"
+      "  SELECT target, coalesce(edge_type, ''), 0, 1"
+      "   FROM \"%w\" WHERE target IS NOT NULL)"
+      " GROUP BY node_id, edge_type ORDER BY node_id, edge_type;",
+      pVtab->zTableName, pVtab->zTableName,
+      pVtab->zEdgeTableName, pVtab->zEdgeTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+int graphDegreeIndexDrop(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  zSql = sqlite3_mprintf(
+      "DROP TABLE IF EXISTS \"%w_degree\";"
+      "DROP TABLE IF EXISTS \"%w_counts\";",
+      pVtab->zTableName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  pVtab->bDegreeIndex = 0;
+  return rc;
+}
+
+int graphLiveCounts(GraphVtab *pVtab, sqlite3_int64 *pnNodes,
+                    sqlite3_int64 *pnEdges){
+  sqlite3_stmt *pStmt = 0;
+  unsigned int iFileVersion;
+  int nChanges;
+  int bCache;
+  int rc;
+
+  graphDataStamp(pVtab, &iFileVersion, &nChanges);
+  bCache = sqlite3_get_autocommit(pVtab->pDb);
+  if( bCache
+   && pVtab->iLiveVersion==pVtab->iDataVersion+1
+   && pVtab->iLiveFileVersion==iFileVersion
+   && pVtab->nLiveChanges==nChanges ){
+    if( pnNodes ) *pnNodes = pVtab->nLiveNodes;
+    if( pnEdges ) *pnEdges = pVtab->nLiveEdges;
+    return SQLITE_OK;
+  }
+
+  if( pVtab->bDegreeIndex ){
+    rc = graphStmtAcquire(pVtab, GRAPH_STMT_COUNTS, &pStmt);
+  }else{
+    char *zSql = sqlite3_mprintf(
+        "SELECT (SELECT count(*) FROM \"%w\".\"%w\"),"
+        " (SELECT count(*) FROM \"%w\".\"%w\")",
+        pVtab->zDbName, pVtab->zNodeTableName,
+        pVtab->zDbName, pVtab->zEdgeTableName);
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+    sqlite3_free(zSql);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+
+  rc = sqlite3_step(pStmt);
+  if( rc==SQLITE_ROW ){
+    pVtab->nLiveNodes = sqlite3_column_int64(pStmt, 0);
+    pVtab->nLiveEdges = sqlite3_column_int64(pStmt, 1);
+    pVtab->iLiveVersion = bCache ? pVtab->iDataVersion+1 : 0;
+    pVtab->iLiveFileVersion = iFileVersion;
+    pVtab->nLiveChanges = nChanges;
+    if( pnNodes ) *pnNodes = pVtab->nLiveNodes;
+    if( pnEdges ) *pnEdges = pVtab->nLiveEdges;
+    rc = SQLITE_OK;
+  }else if( rc==SQLITE_DONE ){
+    rc = SQLITE_CORRUPT;
+  }
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
+}
+
+/*
+** Encode properties written as JSON text to JSONB, or pack them for a
+** compressed graph, on both backing tables. The triggers fire only for
+** text values, so writers that already bind jsonb(?) or graph_pack()
+** skip the second write, and their own UPDATE does not retrigger them.
+** jsonb() rejects malformed JSON, so a JSONB graph only accepts valid
+** property documents. A compressed graph also gets its dictionary
+** tables, "<graph>_dict" and "<graph>_zdict".
+*/
+int graphPropertyFormatInit(GraphVtab *pVtab, int bConvert){
+  char *zEncode;
+  char *zSql;
+  int rc;
+
+  if( pVtab->ePropFormat==GRAPH_PROPS_PACKED ){
+    zSql = sqlite3_mprintf(
+        "CREATE TABLE IF NOT EXISTS \"%w\".\"%w_dict\""
+        "(id INTEGER PRIMARY KEY, value TEXT NOT NULL UNIQUE);"
+        "CREATE TABLE IF NOT EXISTS \"%w\".\"%w_zdict\""
+        "(slot INTEGER PRIMARY KEY, dict BLOB NOT NULL);",
+        pVtab->zDbName, pVtab->zTableName, pVtab->zDbName, pVtab->zTableName);
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+    sqlite3_free(zSql);
+    if( rc!=SQLITE_OK ) return rc;
+    zEncode = sqlite3_mprintf("graph_pack(%Q, ", pVtab->zTableName);
+  }else{
+    zEncode = sqlite3_mprintf("jsonb(");
+  }
+  if( zEncode==0 ) return SQLITE_NOMEM;
+
+  zSql = sqlite3_mprintf(
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_props_node_ai\""
+      " AFTER INSERT ON \"%w\" WHEN typeof(NEW.properties)='text' BEGIN"
+      "  UPDATE \"%w\" SET properties=%sNEW.properties) WHERE id=NEW.id;"
+      " END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_props_node_au\""
+      " AFTER UPDATE OF properties ON \"%w\""
+      " WHEN typeof(NEW.properties)='text' BEGIN"
+      "  UPDATE \"%w\" SET properties=%sNEW.properties) WHERE id=NEW.id;"
+      " END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_props_edge_ai\""
+      " AFTER INSERT ON \"%w\" WHEN typeof(NEW.properties)='text' BEGIN"
+      "  UPDATE \"%w\" SET properties=%sNEW.properties) WHERE id=NEW.id;"
+      " END;"
+      "CREATE TRIGGER IF NOT EXISTS \"%w\".\"%w_props_edge_au\""
+      " AFTER UPDATE OF properties ON \"%w\""
+      " WHEN typeof(NEW.properties)='text' BEGIN"
+      "  UPDATE \"%w\" SET properties=%sNEW.properties) WHERE id=NEW.id;"
+      " END;",
+      pVtab->zDbName, pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zNodeTableName, zEncode,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zNodeTableName,
+      pVtab->zNodeTableName, zEncode,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zEdgeTableName, zEncode,
+      pVtab->zDbName, pVtab->zTableName, pVtab->zEdgeTableName,
+      pVtab->zEdgeTableName, zEncode);
+  if( zSql==0 ){
+    sqlite3_free(zEncode);
+    return SQLITE_NOMEM;
+  }
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK || !bConvert ){
+    sqlite3_free(zEncode);
+    return rc;
+  }
+
+  zSql = sqlite3_mprintf(
+      "UPDATE \"%w\" SET properties=%sproperties)"
+      " WHERE typeof(properties)='text';"
+      "UPDATE \"%w\" SET properties=%sproperties)"
+      " WHERE typeof(properties)='text';",
+      pVtab->zNodeTableName, zEncode, pVtab->zEdgeTableName, zEncode);
+  sqlite3_free(zEncode);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+const char *graphPropsColumn(GraphVtab *pVtab){
+  switch( pVtab->ePropFormat ){
+    case GRAPH_PROPS_JSONB:  return "json(properties)";
+    case GRAPH_PROPS_PACKED: return pVtab->zPropsExpr;
+  }
+  return "properties";
+}
+
+const char *graphPropsExpr(GraphVtab *pVtab){
+  return pVtab->ePropFormat==GRAPH_PROPS_PACKED ? pVtab->zPropsExpr : "properties";
+}
+
+/*
+** Secondary index definitions held back during a deferred-index bulk
+** load: CREATE statements in recreation order, indexes first.
+*/
+struct GraphIndexSet {
+  int nObj;                     /* Entries in azSql */
+  char **azSql;                 /* CREATE INDEX / CREATE TRIGGER text */
+  int bLabelTriggers;           /* The label index triggers were dropped */
+  int bDegreeTriggers;          /* The degree or count triggers were dropped */
+  int bEdges;                   /* Objects of the edge table */
+};
+
+/*
+** Drop the indexes and triggers the extension maintains on pVtab's edge
+** table (bEdges) or on its node and label tables, keeping their
+** definitions in *ppSet. Uniqueness constraint indexes stay, since they
+** decide which rows load, and so do the JSONB property triggers. Objects
+** not named after the graph are left alone.
+*/
+int graphIndexesSuspend(GraphVtab *pVtab, int bEdges, GraphIndexSet **ppSet){
+  GraphIndexSet *pSet;
+  sqlite3_stmt *pStmt;
+  char *zPrefix;
+  char *zUniq;
+  char *zSql;
+  int rc;
+
+  *ppSet = 0;
+  pSet = sqlite3_malloc(sizeof(*pSet));
+  zPrefix = sqlite3_mprintf("%s_", pVtab->zTableName);
+  zUniq = sqlite3_mprintf("%s_uniq_", pVtab->zTableName);
+  if( pSet==0 || zPrefix==0 || zUniq==0 ){
+    sqlite3_free(pSet);
+    sqlite3_free(zPrefix);
+    sqlite3_free(zUniq);
+    return SQLITE_NOMEM;
+  }
+  memset(pSet, 0, sizeof(*pSet));
+  pSet->bEdges = bEdges;
+
+  zSql = sqlite3_mprintf(
+      "SELECT type, name, sql FROM \"%w\".sqlite_master"
+      " WHERE type IN ('index','trigger') AND sql IS NOT NULL"
+      " AND tbl_name IN (%Q, '%q_node_labels')"
+      " AND substr(name, 1, %d)=%Q AND substr(name, 1, %d)<>%Q"
+      " AND name NOT LIKE '%q\\_props\\_%%' ESCAPE '\\'"
+      " ORDER BY type='trigger'",
+      pVtab->zDbName,
+      bEdges ? pVtab->zEdgeTableName : pVtab->zNodeTableName,
+      bEdges ? "" : pVtab->zTableName, (int)strlen(zPrefix), zPrefix,
+      (int)strlen(zUniq), zUniq, pVtab->zTableName);
+  sqlite3_free(zPrefix);
+  sqlite3_free(zUniq);
+  if( zSql==0 ){
+    sqlite3_free(pSet);
+    return SQLITE_NOMEM;
+  }
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(pSet);
+    return rc;
+  }
+
+  /* Collect every definition before dropping anything */
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    const char *zType = (const char*)sqlite3_column_text(pStmt, 0);
+    const char *zName = (const char*)sqlite3_column_text(pStmt, 1);
+    char **azNew = sqlite3_realloc(pSet->azSql, (pSet->nObj+2)*sizeof(char*));
+    if( azNew==0 ){ rc = SQLITE_NOMEM; break; }
+    pSet->azSql = azNew;
+    azNew[pSet->nObj] = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 2));
+    azNew[pSet->nObj+1] = sqlite3_mprintf("DROP %s \"%w\".\"%w\"",
+                                          zType[0]=='t' ? "TRIGGER" : "INDEX",
+                                          pVtab->zDbName, zName);
+    if( azNew[pSet->nObj]==0 || azNew[pSet->nObj+1]==0 ){
+      sqlite3_free(azNew[pSet->nObj]);
+      sqlite3_free(azNew[pSet->nObj+1]);
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    if( zType[0]=='t' ){
+      const char *zSuffix = &zName[strlen(pVtab->zTableName)+1];
+      if( strncmp(zSuffix, "labels_", 7)==0 ) pSet->bLabelTriggers = 1;
+      if( strncmp(zSuffix, "degree_", 7)==0
+       || strncmp(zSuffix, "counts_", 7)==0 ){
+        pSet->bDegreeTriggers = 1;
+      }
+    }
+    pSet->nObj += 2;
+  }
+  sqlite3_finalize(pStmt);
+
+  /* azSql alternates CREATE and DROP; run the drops, keep the creates */
+  if( rc==SQLITE_OK ){
+    int i, n = 0;
+    for(i=0; i<pSet->nObj; i+=2){
+      if( rc==SQLITE_OK ){
+        rc = sqlite3_exec(pVtab->pDb, pSet->azSql[i+1], 0, 0, 0);
+      }
+      sqlite3_free(pSet->azSql[i+1]);
+      pSet->azSql[n++] = pSet->azSql[i];
+    }
+    pSet->nObj = n;
+    if( rc!=SQLITE_OK ){
+      graphIndexesResume(pVtab, pSet, 1, 0);
+      return rc;
+    }
+  }else{
+    graphIndexesDiscard(pSet);
+    return rc;
+  }
+  *ppSet = pSet;
+  return SQLITE_OK;
+}
+
+/*
+** Free pSet without recreating anything, once a rollback has restored
+** what graphIndexesSuspend() dropped.
+*/
+void graphIndexesDiscard(GraphIndexSet *pSet){
+  int i;
+
+  if( pSet==0 ) return;
+  for(i=0; i<pSet->nObj; i++) sqlite3_free(pSet->azSql[i]);
+  sqlite3_free(pSet->azSql);
+  sqlite3_free(pSet);
+}
+
+/*
+** Recreate what graphIndexesSuspend() dropped and free pSet. Label
+** index rows are first added for the nodes with ids in [iMinId, iMaxId]
+** in (label_id, node_id) order, so they append to the shadow table, and
+** the counts (and for an edge load the degrees) are recounted in one
+** pass; each recreated index is then built by SQLite in one sorted pass
+** over its table.
+*/
+int graphIndexesResume(GraphVtab *pVtab, GraphIndexSet *pSet,
+                       sqlite3_int64 iMinId, sqlite3_int64 iMaxId){
+  int rc = SQLITE_OK;
+  int i;
+
+  if( pSet==0 ) return SQLITE_OK;
+  if( pSet->bLabelTriggers && iMinId<=iMaxId ){
+    char *zSql = sqlite3_mprintf(
+        "INSERT OR IGNORE INTO \"%w_labels\"(label)"
+        " SELECT DISTINCT j.value FROM \"%w\" n, " GRAPH_LABELS_JSON("n") " j"
+        " WHERE n.id BETWEEN %lld AND %lld AND j.type='text';"
+        "INSERT OR IGNORE INTO \"%w_node_labels\"(label_id, node_id)"
+        " SELECT d.label_id, n.id FROM \"%w\" n, " GRAPH_LABELS_JSON("n") " j"
+        " JOIN \"%w_labels\" d ON d.label=j.value"
+        " WHERE n.id BETWEEN %lld AND %lld AND j.type='text'"
+        " ORDER BY 1, 2;",
+        pVtab->zTableName, pVtab->zNodeTableName, iMinId, iMaxId,
+        pVtab->zTableName, pVtab->zNodeTableName, pVtab->zTableName,
+        iMinId, iMaxId);
+    if( zSql==0 ){
+      rc = SQLITE_NOMEM;
+    }else{
+      rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+      sqlite3_free(zSql);
+    }
+  }
+  if( pSet->bDegreeTriggers && rc==SQLITE_OK ){
+    rc = graphDegreeIndexRebuild(pVtab, pSet->bEdges);
+  }
+  for(i=0; i<pSet->nObj; i++){
+    if( rc==SQLITE_OK ){
+      rc = sqlite3_exec(pVtab->pDb, pSet->azSql[i], 0, 0, 0);
+    }
+    sqlite3_free(pSet->azSql[i]);
+  }
+  sqlite3_free(pSet->azSql);
+  sqlite3_free(pSet);
+  return rc;
+}
+
+/*
+** Return a boolean SQL expression, true when the node whose id is in
+** column zIdColumn carries zLabel. Uses the label index when present.
+** Caller must sqlite3_free() the result; NULL on OOM.
+*/
+char *graphLabelMatchSql(GraphVtab *pVtab, const char *zIdColumn,
+                         const char *zLabel){
+  if( pVtab->bLabelIndex ){
+    return sqlite3_mprintf(
+        "%s IN (SELECT node_id FROM \"%w_node_labels\" WHERE label_id="
+        "(SELECT label_id FROM \"%w_labels\" WHERE label=%Q))",
+        zIdColumn, pVtab->zTableName, pVtab->zTableName, zLabel);
+  }
+  return sqlite3_mprintf(
+      "EXISTS (SELECT 1 FROM \"%w\" m, json_each(m.labels)"
+      " WHERE m.id=%s AND json_each.value=%Q)",
+      pVtab->zNodeTableName, zIdColumn, zLabel);
+}
+
+/*
+** Prepare a statement returning the ids of all nodes carrying the label
+** bound to ?1, in ascending order.
+*/
+int graphLabelScanPrepare(GraphVtab *pVtab, sqlite3_stmt **ppStmt){
+  char *zSql;
+  int rc;
+
+  if( pVtab->bLabelIndex ){
+    zSql = sqlite3_mprintf(
+        "SELECT node_id FROM \"%w_node_labels\" WHERE label_id="
+        "(SELECT label_id FROM \"%w_labels\" WHERE label=?1)"
+        " ORDER BY node_id",
+        pVtab->zTableName, pVtab->zTableName);
+  }else{
+    zSql = sqlite3_mprintf(
+        "SELECT n.id FROM \"%w\" n WHERE EXISTS"
+        " (SELECT 1 FROM json_each(n.labels) WHERE value=?1)"
+        " ORDER BY n.id",
+        pVtab->zNodeTableName);
+  }
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, ppStmt, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Count the nodes carrying zLabel.
+*/
+int graphLabelCount(GraphVtab *pVtab, const char *zLabel,
+                    sqlite3_int64 *pnCount){
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int rc;
+
+  *pnCount = 0;
+  if( pVtab->bLabelIndex ){
+    zSql = sqlite3_mprintf(
+        "SELECT count(*) FROM \"%w_node_labels\" WHERE label_id="
+        "(SELECT label_id FROM \"%w_labels\" WHERE label=%Q)",
+        pVtab->zTableName, pVtab->zTableName, zLabel);
+  }else{
+    char *zMatch = graphLabelMatchSql(pVtab, "n.id", zLabel);
+    if( zMatch==0 ) return SQLITE_NOMEM;
+    zSql = sqlite3_mprintf("SELECT count(*) FROM \"%w\" n WHERE %s",
+                           pVtab->zNodeTableName, zMatch);
+    sqlite3_free(zMatch);
+  }
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    *pnCount = sqlite3_column_int64(pStmt, 0);
+  }
+  return sqlite3_finalize(pStmt);
+}
+
+/*
+** Create the label index (if missing) and make sure zLabel has a
+** dictionary id, so the planner sees it before any node carries it.
 ** Returns SQLITE_OK on success.
 */
 int graphCreateLabelIndex(GraphVtab *pVtab, const char *zLabel) {
-  (void)pVtab;
-  (void)zLabel;
-  // This function is now a no-op, as indexing is handled by the underlying SQLite tables.
-  return SQLITE_OK;
+  char *zSql;
+  int rc;
+
+  if( !pVtab ) return SQLITE_MISUSE;
+  rc = graphLabelIndexInit(pVtab);
+  if( rc!=SQLITE_OK || !zLabel ) return rc;
+
+  zSql = sqlite3_mprintf("INSERT OR IGNORE INTO \"%w_labels\"(label) VALUES(%Q)",
+                         pVtab->zTableName, zLabel);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK && pVtab->pSchema ){
+    rc = graphRegisterLabel(pVtab->pSchema, zLabel);
+  }
+  return rc;
+}
+
+/*
+** Property names are spliced into JSON paths and index names, so only
+** identifier characters are accepted.
+*/
+int graphIsPropertyName(const char *z){
+  if( z==0 || z[0]==0 ) return 0;
+  for(; *z; z++){
+    char c = *z;
+    if( !((c>='a' && c<='z') || (c>='A' && c<='Z') || (c>='0' && c<='9')
+          || c=='_') ){
+      return 0;
+    }
+  }
+  return 1;
 }
 
 /*
-** Create a property-based index for fast property lookups.
-** Implements property-based indexing for graph optimization.
+** Create a property index: an expression index %s_prop_<property> on
+** json_extract(properties, '$.<property>') over the node table. SQLite
+** keeps it current on every write, whichever path makes it. The index
+** covers all nodes; zLabel (may be NULL) is entered in the label
+** dictionary and narrows lookups at query time through the label index.
+** Returns SQLITE_OK on success, SQLITE_MISUSE for a bad property name.
 */
 int graphCreatePropertyIndex(GraphVtab *pVtab, const char *zLabel,
                              const char *zProperty) {
-  if( !pVtab || !zProperty ) return SQLITE_MISUSE;
-  
-  /* Suppress unused parameter warning */
-  (void)zLabel;
-  
-  /* Initialize schema if needed */
-  if( !pVtab->pSchema ) {
-    int rc = graphInitSchema(pVtab);
-    if( rc != SQLITE_OK ) return rc;
+  char *zSql;
+  int rc;
+
+  if( !pVtab || !graphIsPropertyName(zProperty) ) return SQLITE_MISUSE;
+
+  zSql = sqlite3_mprintf(
+      "CREATE INDEX IF NOT EXISTS \"%w_prop_%w\""
+      " ON \"%w\"(json_extract(%s, '$.%s'))",
+      pVtab->zTableName, zProperty, pVtab->zNodeTableName,
+      graphPropsExpr(pVtab), zProperty);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK && zLabel ){
+    rc = graphCreateLabelIndex(pVtab, zLabel);
   }
-  
-  /* Property indexing implementation will be added in next iteration */
-  testcase( zLabel != 0 );
-  testcase( zProperty != 0 );
-  
+  return rc;
+}
+
+/*
+** List the properties that have an index. On success *pazProperty is an
+** array of *pnProperty strings; free each and the array with
+** sqlite3_free().
+*/
+int graphPropertyIndexList(GraphVtab *pVtab, char ***pazProperty,
+                           int *pnProperty){
+  sqlite3_stmt *pStmt;
+  char **azProp = 0;
+  int nProp = 0;
+  char *zPrefix;
+  char *zSql;
+  int nPrefix;
+  int rc;
+
+  *pazProperty = 0;
+  *pnProperty = 0;
+  zPrefix = sqlite3_mprintf("%s_prop_", pVtab->zTableName);
+  if( zPrefix==0 ) return SQLITE_NOMEM;
+  nPrefix = (int)strlen(zPrefix);
+  zSql = sqlite3_mprintf(
+      "SELECT substr(name, %d) FROM \"%w\".sqlite_master"
+      " WHERE type='index' AND tbl_name=%Q AND substr(name, 1, %d)=%Q",
+      nPrefix + 1, pVtab->zDbName, pVtab->zNodeTableName, nPrefix, zPrefix);
+  sqlite3_free(zPrefix);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    char **azNew = sqlite3_realloc(azProp, (nProp+1)*sizeof(char*));
+    if( azNew==0 ){ rc = SQLITE_NOMEM; break; }
+    azProp = azNew;
+    azProp[nProp] = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+    if( azProp[nProp]==0 ){ rc = SQLITE_NOMEM; break; }
+    nProp++;
+  }
+  sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_OK ){
+    while( nProp>0 ) sqlite3_free(azProp[--nProp]);
+    sqlite3_free(azProp);
+    return rc;
+  }
+  *pazProperty = azProp;
+  *pnProperty = nProp;
   return SQLITE_OK;
 }
 
+/*
+** Prepare a statement returning, in ascending order, the ids of nodes
+** [carrying zLabel] whose property zProperty compares eCmp to ?1. The
+** predicate is spelled exactly like the index expression so SQLite can
+** answer it from %s_prop_<property> when that index exists.
+*/
+int graphPropertyScanPrepare(GraphVtab *pVtab, const char *zLabel,
+                             const char *zProperty, int eCmp,
+                             sqlite3_stmt **ppStmt){
+  static const char *const azOp[] = { "=", "<", "<=", ">", ">=" };
+  char *zMatch = 0;
+  char *zSql;
+  int rc;
+
+  if( !graphIsPropertyName(zProperty) || eCmp<GRAPH_CMP_EQ
+   || eCmp>GRAPH_CMP_GE ){
+    return SQLITE_MISUSE;
+  }
+  if( zLabel ){
+    zMatch = graphLabelMatchSql(pVtab, "n.id", zLabel);
+    if( zMatch==0 ) return SQLITE_NOMEM;
+  }
+  zSql = sqlite3_mprintf(
+      "SELECT n.id FROM \"%w\" n"
+      " WHERE json_extract(%s, '$.%s') %s ?1%s%s ORDER BY n.id",
+      pVtab->zNodeTableName, graphPropsExpr(pVtab), zProperty, azOp[eCmp],
+      zMatch ? " AND " : "", zMatch ? zMatch : "");
+  sqlite3_free(zMatch);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, ppStmt, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Read the text zValue of a Cypher literal of type eType as the value
+** json_extract() would compare it with. eType is the SQLITE_* type the
+** literal was written as: SQLITE_TEXT for a quoted string, whatever its
+** text, SQLITE_INTEGER for integers and booleans (true and false read
+** as 1 and 0), SQLITE_FLOAT for reals and SQLITE_NULL for null.
+** Returns the SQLITE_* type and sets *piVal or *prVal for the numeric
+** ones, or SQLITE_TEXT if the text is not a number of that type.
+*/
+int graphParseLiteral(const char *zValue, int eType, sqlite3_int64 *piVal,
+                      double *prVal){
+  char *zEnd;
+
+  if( zValue==0 || eType==SQLITE_NULL ) return SQLITE_NULL;
+  if( eType==SQLITE_TEXT || eType==SQLITE_BLOB ) return SQLITE_TEXT;
+  if( sqlite3_stricmp(zValue, "true")==0 || sqlite3_stricmp(zValue, "false")==0 ){
+    *piVal = zValue[0]=='t' || zValue[0]=='T';
+    return SQLITE_INTEGER;
+  }
+  if( zValue[0] ){
+    if( eType!=SQLITE_FLOAT ){
+      *piVal = strtoll(zValue, &zEnd, 10);
+      if( *zEnd==0 ) return SQLITE_INTEGER;
+    }
+    *prVal = strtod(zValue, &zEnd);
+    if( *zEnd==0 ) return SQLITE_FLOAT;
+  }
+  return SQLITE_TEXT;
+}
+
+/*
+** Bind the Cypher literal zValue of type eType so it compares like the
+** value json_extract() returns; see graphParseLiteral().
+*/
+void graphBindLiteral(sqlite3_stmt *pStmt, int iParam, const char *zValue,
+                      int eType){
+  sqlite3_int64 iVal = 0;
+  double rVal = 0.0;
+
+  switch( graphParseLiteral(zValue, eType, &iVal, &rVal) ){
+    case SQLITE_NULL:
+      sqlite3_bind_null(pStmt, iParam);
+      break;
+    case SQLITE_INTEGER:
+      sqlite3_bind_int64(pStmt, iParam, iVal);
+      break;
+    case SQLITE_FLOAT:
+      sqlite3_bind_double(pStmt, iParam, rVal);
+      break;
+    default:
+      sqlite3_bind_text(pStmt, iParam, zValue, -1, SQLITE_TRANSIENT);
+      break;
+  }
+}
+
+/*
+** Uniqueness constraints. Each (label, property) pair is a row of
+** %s_constraints backed by a partial unique expression index
+** %s_uniq_<label>_<property> on json_extract(properties, '$.<property>')
+** over the nodes whose label array contains "<label>". Labels and
+** properties are restricted to identifier characters, so the quoted
+** label can be searched for with instr() and spliced into SQL. The
+** probe and upsert statements below repeat the index expression and
+** WHERE term verbatim, which is what lets SQLite use the index for them.
+*/
+int graphCreateUniqueConstraint(GraphVtab *pVtab, const char *zLabel,
+                                const char *zProperty){
+  char *zSql;
+  int rc;
+
+  if( !pVtab || !graphIsPropertyName(zLabel) || !graphIsPropertyName(zProperty) ){
+    return SQLITE_MISUSE;
+  }
+  zSql = sqlite3_mprintf(
+      "CREATE TABLE IF NOT EXISTS \"%w_constraints\"("
+      "label TEXT NOT NULL, property TEXT NOT NULL,"
+      " PRIMARY KEY(label, property)) WITHOUT ROWID;"
+      "CREATE UNIQUE INDEX IF NOT EXISTS \"%w_uniq_%w_%w\""
+      " ON \"%w\"(json_extract(%s, '$.%s'))"
+      " WHERE instr(labels, '\"%s\"')>0;"
+      "INSERT OR IGNORE INTO \"%w_constraints\" VALUES(%Q, %Q);",
+      pVtab->zTableName, pVtab->zTableName, zLabel, zProperty,
+      pVtab->zNodeTableName, graphPropsExpr(pVtab), zProperty, zLabel,
+      pVtab->zTableName, zLabel, zProperty);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc==SQLITE_OK ){
+    rc = graphCreateLabelIndex(pVtab, zLabel);
+  }
+  return rc;
+}
+
+/*
+** Return 1 if (zLabel, zProperty) has a uniqueness constraint, 0 if
+** not (including when no constraint was ever declared on the graph).
+*/
+int graphUniqueConstraintExists(GraphVtab *pVtab, const char *zLabel,
+                                const char *zProperty){
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int bFound = 0;
+
+  if( !graphIsPropertyName(zLabel) || !graphIsPropertyName(zProperty) ) return 0;
+  zSql = sqlite3_mprintf(
+      "SELECT 1 FROM \"%w_constraints\" WHERE label=%Q AND property=%Q",
+      pVtab->zTableName, zLabel, zProperty);
+  if( zSql==0 ) return 0;
+  if( sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0)==SQLITE_OK ){
+    bFound = sqlite3_step(pStmt)==SQLITE_ROW;
+    sqlite3_finalize(pStmt);
+  }
+  sqlite3_free(zSql);
+  return bFound;
+}
+
+/*
+** Prepare "id of the node with zLabel whose zProperty equals ?1", a
+** single probe of the constraint's unique index.
+*/
+int graphUniqueProbePrepare(GraphVtab *pVtab, const char *zLabel,
+                            const char *zProperty, sqlite3_stmt **ppStmt){
+  char *zSql;
+  int rc;
+
+  if( !graphIsPropertyName(zLabel) || !graphIsPropertyName(zProperty) ){
+    return SQLITE_MISUSE;
+  }
+  zSql = sqlite3_mprintf(
+      "SELECT id FROM \"%w\" WHERE json_extract(%s, '$.%s')=?1"
+      " AND instr(labels, '\"%s\"')>0",
+      pVtab->zNodeTableName, graphPropsExpr(pVtab), zProperty, zLabel);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v3(pVtab->pDb, zSql, -1, SQLITE_PREPARE_PERSISTENT,
+                          ppStmt, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Return the upsert clause that makes an INSERT of node rows skip rows
+** whose (zLabel, zProperty) key already exists. Free with sqlite3_free().
+** The conflict target repeats the unique index expression exactly.
+*/
+char *graphUniqueUpsertSql(GraphVtab *pVtab, const char *zLabel,
+                           const char *zProperty){
+  if( !graphIsPropertyName(zLabel) || !graphIsPropertyName(zProperty) ) return 0;
+  return sqlite3_mprintf(
+      " ON CONFLICT(json_extract(%s, '$.%s'))"
+      " WHERE instr(labels, '\"%s\"')>0 DO NOTHING",
+      graphPropsExpr(pVtab), zProperty, zLabel);
+}
+
 /*
 ** Find nodes by label using index.
-** Returns first node in the bucket chain for the label.
-** Caller should iterate through pLabelNext to get all nodes.
+** Returns a list of id-only nodes chained through pLabelNext, in id
+** order, or NULL if none match. Free each node with sqlite3_free().
 */
 GraphNode *graphFindNodesByLabel(GraphVtab *pVtab, const char *zLabel) {
-  (void)pVtab;
-  (void)zLabel;
-  // This function is now a no-op, as node lookups are done via SQL queries.
-  return 0;
+  GraphNode *pHead = 0;
+  GraphNode **ppTail = &pHead;
+  sqlite3_stmt *pStmt;
+
+  if( !pVtab || !zLabel ) return 0;
+  if( graphLabelScanPrepare(pVtab, &pStmt)!=SQLITE_OK ) return 0;
+  sqlite3_bind_text(pStmt, 1, zLabel, -1, SQLITE_STATIC);
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    GraphNode *pNode = sqlite3_malloc(sizeof(GraphNode));
+    if( pNode==0 ) break;
+    memset(pNode, 0, sizeof(GraphNode));
+    pNode->iNodeId = sqlite3_column_int64(pStmt, 0);
+    *ppTail = pNode;
+    ppTail = &pNode->pLabelNext;
+  }
+  sqlite3_finalize(pStmt);
+  return pHead;
 }
 
 /*
@@ -315,13 +1308,31 @@ int graphLabelsEqual(const char **azLabels1, int nLabels1,
 
 /*
 ** Discover all labels and relationship types in the current graph.
-** Updates the schema with found labels and types.
+** Updates the schema with found labels and types. Labels come from the
+** label index dictionary, so this needs no scan of the node table.
 ** Returns SQLITE_OK on success.
 */
 int graphDiscoverSchema(GraphVtab *pVtab) {
-  (void)pVtab;
-  // This function is now a no-op, as schema is not explicitly stored.
-  return SQLITE_OK;
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int rc;
+
+  if( !pVtab ) return SQLITE_MISUSE;
+  rc = graphInitSchema(pVtab);
+  if( rc!=SQLITE_OK || !pVtab->bLabelIndex ) return rc;
+
+  zSql = sqlite3_mprintf("SELECT label FROM \"%w_labels\" ORDER BY label_id",
+                         pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  while( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
+    rc = graphRegisterLabel(pVtab->pSchema,
+                            (const char*)sqlite3_column_text(pStmt, 0));
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
 }
 
 /*
@@ -0,0 +1,542 @@
+/*
+** SQLite Graph Database Extension - Persisted Graph Statistics
+**
+** This file implements graph_analyze(): it summarizes the backing node
+** and edge tables into %s_stats and keeps an in-memory copy on the
+** GraphVtab for the cost model in graphBestIndex() and the planner.
+** It also implements the graphEstimate*() cardinality estimator on top
+** of that copy.
+**
+** Cost: One pass over each table plus one pass over each adjacency
+**       and property index.
+** Atomicity: The stats table is rewritten inside a savepoint.
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-stats.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Degree histogram buckets: bucket 0 holds degree 0 and bucket b>0
+** holds degrees in [2^(b-1), 2^b - 1].
+*/
+#define GRAPH_STATS_NBUCKET 64
+
+/*
+** Buckets of a numeric property histogram.
+*/
+#define GRAPH_STATS_NHIST 16
+
+/*
+** Estimates used when a predicate has no statistics.
+*/
+#define GRAPH_STATS_EQ_SELECTIVITY    0.01
+#define GRAPH_STATS_RANGE_SELECTIVITY (1.0/3.0)
+
+static int statsBucket(sqlite3_int64 nDegree){
+  int b = 0;
+  while( nDegree>0 ){ b++; nDegree >>= 1; }
+  return b;
+}
+
+/*
+** Run a statement that INSERTs into %s_stats, formatted from zFormat.
+*/
+static int statsExec(GraphVtab *pVtab, const char *zFormat, ...){
+  va_list ap;
+  char *zSql;
+  int rc;
+
+  va_start(ap, zFormat);
+  zSql = sqlite3_vmprintf(zFormat, ap);
+  va_end(ap);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Write the zKind degree histogram for the edge column zColumn. Nodes
+** without any edge in that direction land in bucket 0.
+*/
+static int statsDegreeHistogram(GraphVtab *pVtab, const char *zKind,
+                                const char *zColumn, sqlite3_int64 nNodes){
+  sqlite3_int64 aHist[GRAPH_STATS_NBUCKET];
+  sqlite3_int64 nWithEdges = 0;
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int rc;
+  int b;
+
+  memset(aHist, 0, sizeof(aHist));
+  zSql = sqlite3_mprintf("SELECT count(*) FROM \"%w\" GROUP BY %s",
+                         pVtab->zEdgeTableName, zColumn);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    aHist[statsBucket(sqlite3_column_int64(pStmt, 0))]++;
+    nWithEdges++;
+  }
+  sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_DONE ) return rc;
+  if( nNodes>nWithEdges ) aHist[0] += nNodes - nWithEdges;
+
+  for(b=0; b<GRAPH_STATS_NBUCKET; b++){
+    sqlite3_int64 iLo = b ? ((sqlite3_int64)1)<<(b-1) : 0;
+    sqlite3_int64 iHi = b ? (iLo<<1)-1 : 0;
+    if( aHist[b]==0 ) continue;
+    rc = statsExec(pVtab,
+        "INSERT INTO \"%w_stats\"(kind, name, n, lo, hi)"
+        " VALUES(%Q, '%lld', %lld, %lld, %lld)",
+        pVtab->zTableName, zKind, iLo, aHist[b], iLo, iHi);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Rewrite every row of %s_stats. Runs inside graphAnalyze()'s savepoint.
+*/
+static int statsCollect(GraphVtab *pVtab){
+  const char *zT = pVtab->zTableName;
+  const char *zN = pVtab->zNodeTableName;
+  const char *zE = pVtab->zEdgeTableName;
+  char **azProp = 0;
+  int nProp = 0;
+  sqlite3_int64 nNodes = 0;
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int rc;
+  int i;
+
+  rc = statsExec(pVtab,
+      "CREATE TABLE IF NOT EXISTS \"%w_stats\"("
+      "kind TEXT NOT NULL, name TEXT NOT NULL, n INTEGER, ndv INTEGER,"
+      " lo, hi, PRIMARY KEY(kind, name)) WITHOUT ROWID;"
+      "DELETE FROM \"%w_stats\";"
+      "INSERT INTO \"%w_stats\"(kind, name, n)"
+      " SELECT 'graph', 'nodes', count(*) FROM \"%w\";"
+      "INSERT INTO \"%w_stats\"(kind, name, n)"
+      " SELECT 'graph', 'edges', count(*) FROM \"%w\";"
+      "INSERT INTO \"%w_stats\"(kind, name, n)"
+      " SELECT 'graph', 'sources', count(DISTINCT source) FROM \"%w\";"
+      "INSERT INTO \"%w_stats\"(kind, name, n)"
+      " SELECT 'graph', 'targets', count(DISTINCT target) FROM \"%w\";"
+      "INSERT INTO \"%w_stats\"(kind, name, n, ndv)"
+      " SELECT 'type', edge_type, count(*), count(DISTINCT source)"
+      " FROM \"%w\" WHERE edge_type IS NOT NULL GROUP BY edge_type;",
+      zT, zT, zT, zN, zT, zE, zT, zE, zT, zE, zT, zE);
+  if( rc!=SQLITE_OK ) return rc;
+
+  if( pVtab->bLabelIndex ){
+    rc = statsExec(pVtab,
+        "INSERT INTO \"%w_stats\"(kind, name, n)"
+        " SELECT 'label', d.label, count(*) FROM \"%w_node_labels\" l"
+        " JOIN \"%w_labels\" d USING(label_id) GROUP BY d.label",
+        zT, zT, zT);
+  }else{
+    rc = statsExec(pVtab,
+        "INSERT INTO \"%w_stats\"(kind, name, n)"
+        " SELECT 'label', j.value, count(DISTINCT n.id) FROM \"%w\" n,"
+        " json_each(CASE WHEN json_valid(n.labels) THEN n.labels"
+        " ELSE '[]' END) j WHERE j.type='text' GROUP BY j.value",
+        zT, zN);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+
+  zSql = sqlite3_mprintf("SELECT count(*) FROM \"%w\"", zN);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  if( sqlite3_step(pStmt)==SQLITE_ROW ) nNodes = sqlite3_column_int64(pStmt, 0);
+  rc = sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+
+  rc = statsDegreeHistogram(pVtab, "out_degree", "source", nNodes);
+  if( rc==SQLITE_OK ){
+    rc = statsDegreeHistogram(pVtab, "in_degree", "target", nNodes);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* Property names come from index names, which graph_create_index()
+  ** restricts to identifier characters */
+  rc = graphPropertyIndexList(pVtab, &azProp, &nProp);
+  for(i=0; rc==SQLITE_OK && i<nProp; i++){
+    rc = statsExec(pVtab,
+        "INSERT INTO \"%w_stats\"(kind, name, n, ndv, lo, hi)"
+        " SELECT 'property', %Q, count(v), count(DISTINCT v), min(v), max(v)"
+        " FROM (SELECT json_extract(%s, '$.%s') AS v FROM \"%w\")",
+        zT, azProp[i], graphPropsExpr(pVtab), azProp[i], zN);
+    if( rc!=SQLITE_OK ) break;
+    rc = statsExec(pVtab,
+        "INSERT INTO \"%w_stats\"(kind, name, n, lo, hi)"
+        " SELECT 'histogram', printf('%%s:%%02d', %Q, b), count(*), min(v), max(v)"
+        " FROM (SELECT v, ntile(%d) OVER (ORDER BY v) AS b"
+        " FROM (SELECT json_extract(%s, '$.%s') AS v FROM \"%w\")"
+        " WHERE typeof(v) IN ('integer', 'real')) GROUP BY b",
+        zT, azProp[i], GRAPH_STATS_NHIST, graphPropsExpr(pVtab), azProp[i], zN);
+  }
+  for(i=0; i<nProp; i++) sqlite3_free(azProp[i]);
+  sqlite3_free(azProp);
+  return rc;
+}
+
+int graphAnalyze(GraphVtab *pVtab){
+  int rc;
+
+  if( pVtab==0 ) return SQLITE_MISUSE;
+  rc = sqlite3_exec(pVtab->pDb, "SAVEPOINT graph_analyze", 0, 0, 0);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = statsCollect(pVtab);
+  if( rc==SQLITE_OK ) rc = graphDegreeIndexRebuild(pVtab, 1);
+  if( rc!=SQLITE_OK ){
+    sqlite3_exec(pVtab->pDb, "ROLLBACK TO graph_analyze", 0, 0, 0);
+  }
+  sqlite3_exec(pVtab->pDb, "RELEASE graph_analyze", 0, 0, 0);
+  if( rc!=SQLITE_OK ) return rc;
+  return graphStatsLoad(pVtab);
+}
+
+void graphStatsFree(GraphStats *pStats){
+  int i;
+  if( pStats==0 ) return;
+  for(i=0; i<pStats->nLabel; i++) sqlite3_free(pStats->aLabel[i].zName);
+  for(i=0; i<pStats->nType; i++) sqlite3_free(pStats->aType[i].zName);
+  for(i=0; i<pStats->nProp; i++){
+    sqlite3_free(pStats->aProp[i].zName);
+    sqlite3_free(pStats->aProp[i].aBucket);
+  }
+  sqlite3_free(pStats->aLabel);
+  sqlite3_free(pStats->aType);
+  sqlite3_free(pStats->aProp);
+  sqlite3_free(pStats);
+}
+
+/*
+** Append one entry to *paEntry, growing it as needed.
+*/
+static int statsAppend(GraphStatsEntry **paEntry, int *pnEntry,
+                       sqlite3_stmt *pStmt){
+  GraphStatsEntry *aNew;
+  GraphStatsEntry *pEntry;
+
+  aNew = sqlite3_realloc64(*paEntry, sizeof(GraphStatsEntry)*(*pnEntry+1));
+  if( aNew==0 ) return SQLITE_NOMEM;
+  *paEntry = aNew;
+  pEntry = &aNew[*pnEntry];
+  memset(pEntry, 0, sizeof(*pEntry));
+  pEntry->zName = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
+  if( pEntry->zName==0 ) return SQLITE_NOMEM;
+  pEntry->n = sqlite3_column_int64(pStmt, 2);
+  pEntry->nDistinct = sqlite3_column_int64(pStmt, 3);
+  if( sqlite3_column_type(pStmt, 4)!=SQLITE_TEXT
+   && sqlite3_column_type(pStmt, 4)!=SQLITE_NULL
+   && sqlite3_column_type(pStmt, 5)!=SQLITE_TEXT
+   && sqlite3_column_type(pStmt, 5)!=SQLITE_NULL ){
+    pEntry->bNumeric = 1;
+    pEntry->rMin = sqlite3_column_double(pStmt, 4);
+    pEntry->rMax = sqlite3_column_double(pStmt, 5);
+  }
+  (*pnEntry)++;
+  return SQLITE_OK;
+}
+
+/*
+** Attach the 'histogram' rows of %s_stats to their property entries.
+** Bucket names are "<property>:<NN>", so name order is bucket order.
+*/
+static int statsLoadHistograms(GraphVtab *pVtab, GraphStats *pStats){
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int rc;
+
+  zSql = sqlite3_mprintf(
+      "SELECT name, n, lo, hi FROM \"%w\".\"%w_stats\""
+      " WHERE kind='histogram' ORDER BY name",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    const char *zName = (const char*)sqlite3_column_text(pStmt, 0);
+    const char *zColon = zName ? strrchr(zName, ':') : 0;
+    GraphStatsEntry *pEntry;
+    GraphStatsBucket *aNew;
+    char *zProp;
+
+    rc = SQLITE_OK;
+    if( zColon==0 ) continue;
+    zProp = sqlite3_mprintf("%.*s", (int)(zColon-zName), zName);
+    if( zProp==0 ){
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    pEntry = (GraphStatsEntry*)graphStatsProperty(pStats, zProp);
+    sqlite3_free(zProp);
+    if( pEntry==0 ) continue;
+    aNew = sqlite3_realloc64(pEntry->aBucket,
+                             sizeof(GraphStatsBucket)*(pEntry->nBucket+1));
+    if( aNew==0 ){
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    pEntry->aBucket = aNew;
+    aNew[pEntry->nBucket].n = sqlite3_column_int64(pStmt, 1);
+    aNew[pEntry->nBucket].rLo = sqlite3_column_double(pStmt, 2);
+    aNew[pEntry->nBucket].rHi = sqlite3_column_double(pStmt, 3);
+    pEntry->nBucket++;
+  }
+  sqlite3_finalize(pStmt);
+  return rc==SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+int graphStatsLoad(GraphVtab *pVtab){
+  GraphStats *pStats;
+  sqlite3_stmt *pStmt;
+  char *zSql;
+  int rc;
+
+  graphStatsFree(pVtab->pStats);
+  pVtab->pStats = 0;
+
+  /* Rows come back in (kind, name) primary key order, so each entry
+  ** array is already sorted by name for graphStatsFind() */
+  zSql = sqlite3_mprintf(
+      "SELECT kind, name, n, ndv, lo, hi FROM \"%w\".\"%w_stats\""
+      " WHERE kind IN ('graph', 'label', 'type', 'property')"
+      " ORDER BY kind, name",
+      pVtab->zDbName, pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ){
+    /* Never analyzed */
+    return SQLITE_OK;
+  }
+
+  pStats = sqlite3_malloc(sizeof(GraphStats));
+  if( pStats==0 ){
+    sqlite3_finalize(pStmt);
+    return SQLITE_NOMEM;
+  }
+  memset(pStats, 0, sizeof(GraphStats));
+
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    const char *zKind = (const char*)sqlite3_column_text(pStmt, 0);
+    const char *zName = (const char*)sqlite3_column_text(pStmt, 1);
+    sqlite3_int64 n = sqlite3_column_int64(pStmt, 2);
+    rc = SQLITE_OK;
+    if( strcmp(zKind, "graph")==0 ){
+      if( strcmp(zName, "nodes")==0 ) pStats->nNodes = n;
+      else if( strcmp(zName, "edges")==0 ) pStats->nEdges = n;
+      else if( strcmp(zName, "sources")==0 ) pStats->nSources = n;
+      else if( strcmp(zName, "targets")==0 ) pStats->nTargets = n;
+    }else if( strcmp(zKind, "label")==0 ){
+      rc = statsAppend(&pStats->aLabel, &pStats->nLabel, pStmt);
+    }else if( strcmp(zKind, "type")==0 ){
+      rc = statsAppend(&pStats->aType, &pStats->nType, pStmt);
+    }else{
+      rc = statsAppend(&pStats->aProp, &pStats->nProp, pStmt);
+    }
+    if( rc!=SQLITE_OK ) break;
+  }
+  sqlite3_finalize(pStmt);
+  if( rc==SQLITE_DONE ) rc = statsLoadHistograms(pVtab, pStats);
+  else if( rc==SQLITE_OK ) rc = SQLITE_ERROR;
+  if( rc!=SQLITE_OK ){
+    graphStatsFree(pStats);
+    return rc;
+  }
+  pVtab->pStats = pStats;
+  return SQLITE_OK;
+}
+
+int graphStatsDrop(GraphVtab *pVtab){
+  char *zSql;
+  int rc;
+
+  graphStatsFree(pVtab->pStats);
+  pVtab->pStats = 0;
+  zSql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w_stats\"",
+                         pVtab->zTableName);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Binary search a name-sorted entry array.
+*/
+static const GraphStatsEntry *graphStatsFind(const GraphStatsEntry *aEntry,
+                                             int nEntry, const char *zName){
+  int iLo = 0;
+  int iHi = nEntry-1;
+
+  if( zName==0 ) return 0;
+  while( iLo<=iHi ){
+    int iMid = (iLo+iHi)/2;
+    int c = strcmp(aEntry[iMid].zName, zName);
+    if( c==0 ) return &aEntry[iMid];
+    if( c<0 ) iLo = iMid+1;
+    else iHi = iMid-1;
+  }
+  return 0;
+}
+
+const GraphStatsEntry *graphStatsLabel(const GraphStats *pStats,
+                                       const char *zLabel){
+  if( pStats==0 ) return 0;
+  return graphStatsFind(pStats->aLabel, pStats->nLabel, zLabel);
+}
+
+const GraphStatsEntry *graphStatsType(const GraphStats *pStats,
+                                      const char *zType){
+  if( pStats==0 ) return 0;
+  return graphStatsFind(pStats->aType, pStats->nType, zType);
+}
+
+const GraphStatsEntry *graphStatsProperty(const GraphStats *pStats,
+                                          const char *zProperty){
+  if( pStats==0 ) return 0;
+  return graphStatsFind(pStats->aProp, pStats->nProp, zProperty);
+}
+
+/*
+** Refresh the cached live node and edge counts if the graph changed
+** since they were taken. A failed count keeps the analyzed totals.
+*/
+static void statsLiveCounts(GraphVtab *pVtab){
+  if( graphLiveCounts(pVtab, 0, 0)!=SQLITE_OK ){
+    pVtab->nLiveNodes = pVtab->pStats ? pVtab->pStats->nNodes : 0;
+    pVtab->nLiveEdges = pVtab->pStats ? pVtab->pStats->nEdges : 0;
+  }
+}
+
+double graphEstimateNodes(GraphVtab *pVtab){
+  if( pVtab==0 ) return 1.0;
+  statsLiveCounts(pVtab);
+  return pVtab->nLiveNodes>0 ? (double)pVtab->nLiveNodes : 1.0;
+}
+
+double graphEstimateLabel(GraphVtab *pVtab, const char *zLabel){
+  const GraphStats *pStats;
+  const GraphStatsEntry *pEntry;
+  sqlite3_int64 nCount;
+  double nNodes;
+
+  nNodes = graphEstimateNodes(pVtab);
+  if( pVtab==0 || zLabel==0 ) return nNodes;
+  pStats = pVtab->pStats;
+  if( pStats && pStats->nNodes>0 ){
+    pEntry = graphStatsLabel(pStats, zLabel);
+    if( pEntry==0 ) return 1.0;
+    return pEntry->n * nNodes / pStats->nNodes;
+  }
+  if( pVtab->bLabelIndex && graphLabelCount(pVtab, zLabel, &nCount)==SQLITE_OK ){
+    return nCount>0 ? (double)nCount : 1.0;
+  }
+  return nNodes/10.0;
+}
+
+double graphEstimateFanout(GraphVtab *pVtab, const char *zType){
+  const GraphStats *pStats;
+  const GraphStatsEntry *pEntry;
+  double nNodes;
+
+  nNodes = graphEstimateNodes(pVtab);
+  if( pVtab==0 ) return 1.0;
+  pStats = pVtab->pStats;
+  if( zType && pStats && pStats->nNodes>0 ){
+    pEntry = graphStatsType(pStats, zType);
+    return pEntry ? (double)pEntry->n / pStats->nNodes : 0.0;
+  }
+  return pVtab->nLiveEdges / nNodes;
+}
+
+/*
+** Sum of rFan^k over the hop range. An unbounded range is costed as two
+** hops past its lower bound, and a range stops contributing once its
+** levels are negligible or the total is beyond any real result.
+*/
+double graphEstimatePathFanout(double rFan, int nMinHops, int nMaxHops){
+  double rPaths = 0.0;
+  double rLevel = 1.0;
+  int k;
+
+  if( nMaxHops<0 ) nMaxHops = nMinHops + 2;
+  for(k=0; k<=nMaxHops; k++){
+    if( k>=nMinHops ) rPaths += rLevel;
+    rLevel *= rFan;
+    if( rPaths>1e15 || rLevel<1e-9 ) break;
+  }
+  return rPaths;
+}
+
+/*
+** Fraction of the non-null values of pEntry below rValue, from the
+** histogram when there is one and by interpolating min/max otherwise.
+*/
+static double statsFractionBelow(const GraphStatsEntry *pEntry, double rValue){
+  double nBelow = 0.0;
+  int i;
+
+  if( pEntry->nBucket==0 ){
+    if( rValue<=pEntry->rMin ) return 0.0;
+    if( rValue>=pEntry->rMax ) return 1.0;
+    return (rValue - pEntry->rMin) / (pEntry->rMax - pEntry->rMin);
+  }
+  for(i=0; i<pEntry->nBucket; i++){
+    const GraphStatsBucket *pBucket = &pEntry->aBucket[i];
+    if( rValue>=pBucket->rHi ){
+      nBelow += pBucket->n;
+    }else if( rValue>pBucket->rLo ){
+      nBelow += pBucket->n * (rValue - pBucket->rLo)/(pBucket->rHi - pBucket->rLo);
+    }
+  }
+  return pEntry->n>0 ? nBelow / pEntry->n : 0.0;
+}
+
+double graphEstimateProperty(GraphVtab *pVtab, const char *zProperty,
+                             int eCmp, const char *zValue){
+  const GraphStats *pStats = pVtab ? pVtab->pStats : 0;
+  const GraphStatsEntry *pEntry = graphStatsProperty(pStats, zProperty);
+  double rNonNull;
+  double rSel;
+  double rValue;
+  char *zEnd = 0;
+
+  if( pEntry==0 || pStats->nNodes<=0 ){
+    return eCmp==GRAPH_CMP_EQ ? GRAPH_STATS_EQ_SELECTIVITY
+                              : GRAPH_STATS_RANGE_SELECTIVITY;
+  }
+  rNonNull = (double)pEntry->n / pStats->nNodes;
+  if( eCmp==GRAPH_CMP_EQ ){
+    rSel = rNonNull / (pEntry->nDistinct>0 ? pEntry->nDistinct : 1);
+  }else{
+    if( zValue ) rValue = strtod(zValue, &zEnd);
+    if( !pEntry->bNumeric || zEnd==0 || zEnd==zValue || *zEnd ){
+      rSel = rNonNull * GRAPH_STATS_RANGE_SELECTIVITY;
+    }else if( eCmp==GRAPH_CMP_LT || eCmp==GRAPH_CMP_LE ){
+      rSel = rNonNull * statsFractionBelow(pEntry, rValue);
+    }else{
+      rSel = rNonNull * (1.0 - statsFractionBelow(pEntry, rValue));
+    }
+  }
+  /* Never estimate an empty result: it would zero whole join trees */
+  if( rSel < 1.0/pStats->nNodes ) rSel = 1.0/pStats->nNodes;
+  return rSel;
+}
@@ -0,0 +1,167 @@
+/*
+** SQLite Graph Database Extension - Cached Lookup Statements
+**
+** This file keeps one prepared statement per lookup shape on each graph
+** virtual table. Per-hop neighbor scans and point lookups bind their
+** parameters into the cached statement instead of formatting, parsing
+** and finalizing fresh SQL on every call.
+**
+** Lifetime: Prepared lazily, reset after each use, finalized on
+**           disconnect/destroy through graphStmtCacheClear()
+** Schema changes: sqlite3_prepare_v2() re-prepares transparently
+*/
+
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include <assert.h>
+
+/*
+** Format the SQL text for statement eStmt of pVtab. Returns a string
+** obtained from sqlite3_mprintf(), or NULL on OOM.
+*/
+static char *graphStmtSql(GraphVtab *pVtab, int eStmt){
+  switch( eStmt ){
+    case GRAPH_STMT_NEIGHBORS_OUT:
+      return sqlite3_mprintf(
+          "SELECT target, coalesce(weight, 1.0) FROM %s WHERE source = ?1",
+          pVtab->zEdgeTableName);
+    case GRAPH_STMT_NEIGHBORS_IN:
+      return sqlite3_mprintf(
+          "SELECT source, coalesce(weight, 1.0) FROM %s WHERE target = ?1",
+          pVtab->zEdgeTableName);
+    case GRAPH_STMT_NODE_BY_ID:
+      return sqlite3_mprintf(
+          "SELECT id, labels, %s FROM %s WHERE id = ?1",
+          graphPropsColumn(pVtab), pVtab->zNodeTableName);
+    case GRAPH_STMT_EDGE_BY_ENDS:
+      return sqlite3_mprintf(
+          "SELECT id, source, target, edge_type, weight, %s "
+          "FROM %s WHERE source = ?1 AND target = ?2",
+          graphPropsColumn(pVtab), pVtab->zEdgeTableName);
+    case GRAPH_STMT_NEIGHBORS_OUT_TYPED:
+      return sqlite3_mprintf(
+          "SELECT target, coalesce(weight, 1.0) FROM %s "
+          "WHERE source = ?1 AND edge_type = ?2",
+          pVtab->zEdgeTableName);
+    case GRAPH_STMT_NEIGHBORS_IN_TYPED:
+      return sqlite3_mprintf(
+          "SELECT source, coalesce(weight, 1.0) FROM %s "
+          "WHERE target = ?1 AND edge_type = ?2",
+          pVtab->zEdgeTableName);
+    case GRAPH_STMT_DEGREE:
+      return sqlite3_mprintf(
+          "SELECT sum(out_degree), sum(in_degree) FROM \"%w_degree\" "
+          "WHERE node_id = ?1",
+          pVtab->zTableName);
+    case GRAPH_STMT_DEGREE_TYPED:
+      return sqlite3_mprintf(
+          "SELECT out_degree, in_degree FROM \"%w_degree\" "
+          "WHERE node_id = ?1 AND edge_type = ?2",
+          pVtab->zTableName);
+    case GRAPH_STMT_COUNTS:
+      return sqlite3_mprintf(
+          "SELECT nodes, edges FROM \"%w_counts\"",
+          pVtab->zTableName);
+    case GRAPH_STMT_EDGE_BY_ID:
+      return sqlite3_mprintf(
+          "SELECT source, target, coalesce(weight, 1.0) FROM %s WHERE id = ?1",
+          pVtab->zEdgeTableName);
+    case GRAPH_STMT_EPOCH_GET:
+      return sqlite3_mprintf(
+          "SELECT v FROM temp.\"%w_%w_csr_epoch\" WHERE k = 0",
+          pVtab->zDbName, pVtab->zTableName);
+    case GRAPH_STMT_EPOCH_SET:
+      return sqlite3_mprintf(
+          "REPLACE INTO temp.\"%w_%w_csr_epoch\"(k, v) VALUES(0, ?1)",
+          pVtab->zDbName, pVtab->zTableName);
+    case GRAPH_STMT_DATA_VERSION:
+      return sqlite3_mprintf("PRAGMA \"%w\".data_version", pVtab->zDbName);
+    case GRAPH_STMT_CSR_TAG:
+      return sqlite3_mprintf(
+          "SELECT instance, generation FROM \"%w\".\"%w_csr\"",
+          pVtab->zDbName, pVtab->zTableName);
+    case GRAPH_STMT_SCHEMA_VERSION:
+      return sqlite3_mprintf("PRAGMA \"%w\".schema_version", pVtab->zDbName);
+    case GRAPH_STMT_RESULT_GET:
+      return sqlite3_mprintf(
+          "SELECT instance, generation, schema_version, result "
+          "FROM \"%w\".\"%w_results\" WHERE key = ?1",
+          pVtab->zDbName, pVtab->zTableName);
+    case GRAPH_STMT_RESULT_PUT:
+      return sqlite3_mprintf(
+          "REPLACE INTO \"%w\".\"%w_results\""
+          "(key, instance, generation, schema_version, result) "
+          "VALUES(?1, ?2, ?3, ?4, ?5)",
+          pVtab->zDbName, pVtab->zTableName);
+  }
+  assert( 0 );
+  return 0;
+}
+
+/*
+** Prepare a fresh copy of statement eStmt.
+*/
+static int graphStmtPrepare(GraphVtab *pVtab, int eStmt,
+                            sqlite3_stmt **ppStmt){
+  char *zSql;
+  int rc;
+
+  zSql = graphStmtSql(pVtab, eStmt);
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, ppStmt, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+int graphStmtAcquire(GraphVtab *pVtab, int eStmt, sqlite3_stmt **ppStmt){
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  assert( pVtab!=0 );
+  assert( eStmt>=0 && eStmt<GRAPH_STMT_COUNT );
+  assert( ppStmt!=0 );
+  *ppStmt = 0;
+
+  pStmt = pVtab->aStmt[eStmt];
+  if( pStmt==0 ){
+    rc = graphStmtPrepare(pVtab, eStmt, &pStmt);
+    if( rc!=SQLITE_OK ) return rc;
+    pVtab->aStmt[eStmt] = pStmt;
+  }else if( sqlite3_stmt_busy(pStmt) ){
+    /* An outer caller is mid-scan on the cached copy */
+    testcase( sqlite3_stmt_busy(pStmt) );
+    return graphStmtPrepare(pVtab, eStmt, ppStmt);
+  }
+
+  sqlite3_reset(pStmt);
+  sqlite3_clear_bindings(pStmt);
+  *ppStmt = pStmt;
+  return SQLITE_OK;
+}
+
+void graphStmtRelease(GraphVtab *pVtab, sqlite3_stmt *pStmt){
+  int i;
+
+  if( pStmt==0 ) return;
+  for(i=0; i<GRAPH_STMT_COUNT; i++){
+    if( pVtab->aStmt[i]==pStmt ){
+      sqlite3_reset(pStmt);
+      return;
+    }
+  }
+  sqlite3_finalize(pStmt);
+}
+
+void graphStmtCacheClear(GraphVtab *pVtab){
+  int i;
+
+  if( pVtab==0 ) return;
+  for(i=0; i<GRAPH_STMT_COUNT; i++){
+    sqlite3_finalize(pVtab->aStmt[i]);
+    pVtab->aStmt[i] = 0;
+  }
+}
@@ -17,126 +17,360 @@ extern const sqlite3_api_routines *sqlite3_api;
 #include "graph.h"
 #include "graph-memory.h"
 #include "graph-util.h"
-#include "graph-memory.h"
+#include "graph-csr.h"
+#include <string.h>
 #include <assert.h>
 
 /*
-** Visited set structure for tracking nodes during traversal.
-** Uses dynamic array for O(1) insertion and O(n) lookup.
-** SQLite-style memory management with sqlite3_malloc/free.
+** Visited bitmap over dense node indices, one bit per node.
+*/
+#define VISITED_BYTES(N)   (((sqlite3_int64)(N)+7)/8)
+#define VISITED_TEST(A,I)  ((A)[(I)>>3] & (1<<((I)&7)))
+#define VISITED_SET(A,I)   ((A)[(I)>>3] |= (unsigned char)(1<<((I)&7)))
+
+/*
+** Explicit DFS stack frame: node, next out-edge to try and its depth.
 */
-typedef struct GraphVisitedSet GraphVisitedSet;
-struct GraphVisitedSet {
-  sqlite3_int64 *aNodes;    /* Array of visited node IDs */
-  int nUsed;                /* Number of nodes currently in set */
-  int nAlloc;               /* Allocated size of array */
+typedef struct DFSFrame DFSFrame;
+struct DFSFrame {
+  sqlite3_int64 iEdge;      /* Next edge offset in rowOffsets space */
+  int iNode;                /* Dense node index */
+  int nDepth;               /* Depth from the start node */
 };
 
-/* Forward declarations for internal functions */
-static int graphDFSRecursive(GraphVtab *pVtab, sqlite3_int64 iNodeId, 
-                            int nMaxDepth, int nCurrentDepth,
-                            GraphVisitedSet *pVisited, char **pzPath);
+/*
+** Bounded traversals that run before any CSR snapshot exists expand hop
+** by hop through the cached neighbor statement instead of paying for a
+** full build. Past GRAPH_LOCAL_MAX_EXPAND expansions the local attempt
+** is abandoned and the traversal restarts over the snapshot.
+*/
+#define GRAPH_LOCAL_MAX_DEPTH   3
+#define GRAPH_LOCAL_MAX_EXPAND  256
 
+/*
+** Open-addressed set of node ids seen by a local traversal.
+*/
+typedef struct LocalIdSet LocalIdSet;
+struct LocalIdSet {
+  sqlite3_int64 *aId;       /* Slot contents */
+  unsigned char *aUsed;     /* Slot occupancy flags */
+  int nSlot;                /* Number of slots, a power of two */
+  int nUsed;                /* Number of occupied slots */
+};
 
+static unsigned int localIdHash(sqlite3_int64 iId){
+  sqlite3_uint64 h = (sqlite3_uint64)iId * 0x9E3779B97F4A7C15ULL;
+  return (unsigned int)(h >> 32);
+}
 
+static void localIdSetFree(LocalIdSet *p){
+  sqlite3_free(p->aId);
+  sqlite3_free(p->aUsed);
+  memset(p, 0, sizeof(*p));
+}
 
 /*
-** Create a new visited set for tracking traversal state.
-** Memory allocation: Uses sqlite3_malloc() for initial capacity.
-** Returns pointer to set or NULL on OOM.
+** Insert iId into the set. *pbNew is set to 1 if it was not present.
 */
-static GraphVisitedSet *graphVisitedSetCreate(void){
-  GraphVisitedSet *pSet;
-  
-  pSet = sqlite3_malloc(sizeof(*pSet));
-  if( pSet==0 ){
-    testcase( pSet==0 );  /* Out of memory */
-    return 0;
+static int localIdSetAdd(LocalIdSet *p, sqlite3_int64 iId, int *pbNew){
+  unsigned int i;
+
+  if( (p->nUsed+1)*2>p->nSlot ){
+    LocalIdSet sNew;
+    int j, bDummy;
+    sNew.nSlot = p->nSlot ? p->nSlot*2 : 64;
+    sNew.nUsed = 0;
+    sNew.aId = sqlite3_malloc64(sizeof(sqlite3_int64)*sNew.nSlot);
+    sNew.aUsed = sqlite3_malloc64(sNew.nSlot);
+    if( sNew.aId==0 || sNew.aUsed==0 ){
+      localIdSetFree(&sNew);
+      return SQLITE_NOMEM;
+    }
+    memset(sNew.aUsed, 0, sNew.nSlot);
+    for(j=0; j<p->nSlot; j++){
+      if( p->aUsed[j] ) localIdSetAdd(&sNew, p->aId[j], &bDummy);
+    }
+    localIdSetFree(p);
+    *p = sNew;
   }
-  
-  /* Initialize with small initial capacity */
-  pSet->nAlloc = 16;
-  pSet->nUsed = 0;
-  pSet->aNodes = sqlite3_malloc(pSet->nAlloc * sizeof(sqlite3_int64));
-  if( pSet->aNodes==0 ){
-    testcase( pSet->aNodes==0 );  /* Out of memory */
-    sqlite3_free(pSet);
-    return 0;
+
+  i = localIdHash(iId) & (p->nSlot-1);
+  while( p->aUsed[i] ){
+    if( p->aId[i]==iId ){
+      *pbNew = 0;
+      return SQLITE_OK;
+    }
+    i = (i+1) & (p->nSlot-1);
   }
-  
-  return pSet;
+  p->aUsed[i] = 1;
+  p->aId[i] = iId;
+  p->nUsed++;
+  *pbNew = 1;
+  return SQLITE_OK;
 }
 
 /*
-** Add a node to the visited set.
-** Returns SQLITE_OK on success, SQLITE_NOMEM on allocation failure.
-** Grows array as needed using sqlite3_realloc().
+** Append iId to a dynamic array.
 */
-static int graphVisitedSetAdd(GraphVisitedSet *pSet, sqlite3_int64 iNodeId){
-  sqlite3_int64 *aNew;
-  
-  assert( pSet!=0 );
-  
-  /* Grow array if needed */
-  if( pSet->nUsed>=pSet->nAlloc ){
-    int nNewAlloc = pSet->nAlloc * 2;
-    aNew = sqlite3_realloc(pSet->aNodes, nNewAlloc * sizeof(sqlite3_int64));
-    if( aNew==0 ){
-      testcase( aNew==0 );  /* Realloc failed */
-      return SQLITE_NOMEM;
-    }
-    pSet->aNodes = aNew;
-    pSet->nAlloc = nNewAlloc;
+static int localAppend(sqlite3_int64 **pa, int *pn, int *pnAlloc,
+                       sqlite3_int64 iId){
+  if( *pn>=*pnAlloc ){
+    int nNew = *pnAlloc ? *pnAlloc*2 : 16;
+    sqlite3_int64 *aNew = sqlite3_realloc64(*pa, sizeof(sqlite3_int64)*nNew);
+    if( aNew==0 ) return SQLITE_NOMEM;
+    *pa = aNew;
+    *pnAlloc = nNew;
   }
-  
-  /* Add node to set */
-  pSet->aNodes[pSet->nUsed++] = iNodeId;
+  (*pa)[(*pn)++] = iId;
   return SQLITE_OK;
 }
 
 /*
-** Check if a node is in the visited set.
-** Returns non-zero if node is visited, zero otherwise.
-** Time complexity: O(n) linear search.
+** Append the out-neighbors of iNodeId to *pa using the cached
+** neighbor statement.
 */
-static int graphVisitedSetContains(GraphVisitedSet *pSet, 
-                                   sqlite3_int64 iNodeId){
-  int i;
-  
-  assert( pSet!=0 );
-  
-  for( i=0; i<pSet->nUsed; i++ ){
-    if( pSet->aNodes[i]==iNodeId ){
-      testcase( pSet->aNodes[i]==iNodeId );  /* Node found in set */
-      return 1;
-    }
+static int localNeighbors(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                          sqlite3_int64 **pa, int *pn, int *pnAlloc){
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_NEIGHBORS_OUT, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_int64(pStmt, 1, iNodeId);
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    rc = localAppend(pa, pn, pnAlloc, sqlite3_column_int64(pStmt, 0));
+    if( rc!=SQLITE_OK ) break;
   }
-  
-  testcase( i==pSet->nUsed );  /* Node not found in set */
-  return 0;
+  if( rc==SQLITE_DONE ) rc = SQLITE_OK;
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
 }
 
 /*
-** Destroy visited set and free all memory.
-** Memory management: Calls sqlite3_free() on all allocated memory.
+** Append the ends of iNodeId's edges in one direction, restricted to
+** type zType when it is not NULL, using the cached neighbor statements.
 */
-static void graphVisitedSetDestroy(GraphVisitedSet *pSet){
-  if( pSet ){
-    sqlite3_free(pSet->aNodes);
-    sqlite3_free(pSet);
+static int localExpandDir(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                          const char *zType, int bIn,
+                          sqlite3_int64 **pa, int *pn, int *pnAlloc){
+  sqlite3_stmt *pStmt;
+  int eStmt;
+  int rc;
+
+  if( zType ){
+    eStmt = bIn ? GRAPH_STMT_NEIGHBORS_IN_TYPED : GRAPH_STMT_NEIGHBORS_OUT_TYPED;
+  }else{
+    eStmt = bIn ? GRAPH_STMT_NEIGHBORS_IN : GRAPH_STMT_NEIGHBORS_OUT;
   }
+  rc = graphStmtAcquire(pVtab, eStmt, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_int64(pStmt, 1, iNodeId);
+  if( zType ) sqlite3_bind_text(pStmt, 2, zType, -1, SQLITE_STATIC);
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    rc = localAppend(pa, pn, pnAlloc, sqlite3_column_int64(pStmt, 0));
+    if( rc!=SQLITE_OK ) break;
+  }
+  if( rc==SQLITE_DONE ) rc = SQLITE_OK;
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
+}
+
+int graphExpand(GraphVtab *pVtab, sqlite3_int64 iNodeId, const char *zType,
+                int eDir, sqlite3_int64 **paId, int *pnId){
+  sqlite3_int64 *aId = 0;
+  int nId = 0;
+  int nAlloc = 0;
+  int rc = SQLITE_OK;
+
+  *paId = 0;
+  *pnId = 0;
+  if( pVtab==0 ) return SQLITE_MISUSE;
+  if( eDir & GRAPH_EXPAND_OUT ){
+    rc = localExpandDir(pVtab, iNodeId, zType, 0, &aId, &nId, &nAlloc);
+  }
+  if( rc==SQLITE_OK && (eDir & GRAPH_EXPAND_IN) ){
+    rc = localExpandDir(pVtab, iNodeId, zType, 1, &aId, &nId, &nAlloc);
+  }
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(aId);
+    return rc;
+  }
+  *paId = aId;
+  *pnId = nId;
+  return SQLITE_OK;
+}
+
+/*
+** Set *pbExists according to whether iNodeId is in the node table.
+*/
+static int localNodeExists(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                           int *pbExists){
+  sqlite3_stmt *pStmt;
+  int rc;
+
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_NODE_BY_ID, &pStmt);
+  if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_int64(pStmt, 1, iNodeId);
+  rc = sqlite3_step(pStmt);
+  *pbExists = (rc==SQLITE_ROW);
+  rc = (rc==SQLITE_ROW || rc==SQLITE_DONE) ? SQLITE_OK : rc;
+  graphStmtRelease(pVtab, pStmt);
+  return rc;
+}
+
+/*
+** Finish a traversal's output buffer into *pzPath.
+*/
+static int graphFinishPath(sqlite3_str *pOut, int rc, char **pzPath){
+  char *zPath;
+  if( rc==SQLITE_OK ) rc = sqlite3_str_errcode(pOut);
+  zPath = sqlite3_str_finish(pOut);
+  if( rc==SQLITE_OK ){
+    *pzPath = zPath;
+  }else{
+    sqlite3_free(zPath);
+  }
+  return rc;
+}
+
+/*
+** One level of local DFS. Mirrors graphDFSRecursive(): nodes deeper than
+** nMaxDepth-1 are not emitted. Returns SQLITE_DONE once the expansion
+** budget runs out.
+*/
+static int localDFSStep(GraphVtab *pVtab, sqlite3_int64 iNodeId,
+                        int nMaxDepth, int nDepth, LocalIdSet *pVisited,
+                        int *pnExpand, sqlite3_str *pOut){
+  sqlite3_int64 *aNext = 0;
+  int nNext = 0, nAlloc = 0;
+  int bNew, i;
+  int rc;
+
+  if( nDepth>=nMaxDepth ) return SQLITE_OK;
+  rc = localIdSetAdd(pVisited, iNodeId, &bNew);
+  if( rc!=SQLITE_OK || !bNew ) return rc;
+  sqlite3_str_appendf(pOut, sqlite3_str_length(pOut) ? ",%lld" : "[%lld",
+                      iNodeId);
+  if( nDepth+1>=nMaxDepth ) return SQLITE_OK;
+
+  if( ++(*pnExpand)>GRAPH_LOCAL_MAX_EXPAND ) return SQLITE_DONE;
+  rc = localNeighbors(pVtab, iNodeId, &aNext, &nNext, &nAlloc);
+  for(i=0; rc==SQLITE_OK && i<nNext; i++){
+    rc = localDFSStep(pVtab, aNext[i], nMaxDepth, nDepth+1, pVisited,
+                      pnExpand, pOut);
+  }
+  sqlite3_free(aNext);
+  return rc;
+}
+
+/*
+** Depth-bounded DFS over per-hop lookups. Returns SQLITE_DONE if the
+** expansion budget ran out and the caller should use the snapshot.
+*/
+static int graphDFSLocal(GraphVtab *pVtab, sqlite3_int64 iStartId,
+                         int nMaxDepth, char **pzPath){
+  LocalIdSet visited;
+  sqlite3_str *pOut;
+  int nExpand = 0;
+  int bExists = 0;
+  int rc;
+
+  rc = localNodeExists(pVtab, iStartId, &bExists);
+  if( rc!=SQLITE_OK ) return rc;
+  if( !bExists ) return SQLITE_NOTFOUND;
+
+  memset(&visited, 0, sizeof(visited));
+  pOut = sqlite3_str_new(pVtab->pDb);
+  rc = localDFSStep(pVtab, iStartId, nMaxDepth, 0, &visited, &nExpand, pOut);
+  localIdSetFree(&visited);
+  if( sqlite3_str_length(pOut)==0 ){
+    sqlite3_str_appendall(pOut, "[");
+  }
+  sqlite3_str_appendchar(pOut, 1, ']');
+  return graphFinishPath(pOut, rc, pzPath);
+}
+
+/*
+** Depth-bounded, level-synchronous BFS over per-hop lookups. Output
+** order matches graphBFS(). Returns SQLITE_DONE if the expansion budget
+** ran out and the caller should use the snapshot.
+*/
+static int graphBFSLocal(GraphVtab *pVtab, sqlite3_int64 iStartId,
+                         int nMaxDepth, char **pzPath){
+  LocalIdSet visited;
+  sqlite3_str *pOut;
+  sqlite3_int64 *aLevel = 0, *aNext = 0, *aNbr = 0;
+  int nLevel = 0, nLevelAlloc = 0;
+  int nNext = 0, nNextAlloc = 0;
+  int nNbr = 0, nNbrAlloc = 0;
+  int nExpand = 0;
+  int bExists = 0, bNew;
+  int nDepth, i, j;
+  int rc;
+
+  rc = localNodeExists(pVtab, iStartId, &bExists);
+  if( rc!=SQLITE_OK ) return rc;
+  if( !bExists ) return SQLITE_NOTFOUND;
+
+  memset(&visited, 0, sizeof(visited));
+  pOut = sqlite3_str_new(pVtab->pDb);
+  sqlite3_str_appendf(pOut, "[%lld", iStartId);
+  rc = localIdSetAdd(&visited, iStartId, &bNew);
+  if( rc==SQLITE_OK ) rc = localAppend(&aLevel, &nLevel, &nLevelAlloc, iStartId);
+
+  for(nDepth=0; rc==SQLITE_OK && nLevel>0 && nDepth<nMaxDepth; nDepth++){
+    nNext = 0;
+    for(i=0; rc==SQLITE_OK && i<nLevel; i++){
+      if( ++nExpand>GRAPH_LOCAL_MAX_EXPAND ){
+        rc = SQLITE_DONE;
+        break;
+      }
+      nNbr = 0;
+      rc = localNeighbors(pVtab, aLevel[i], &aNbr, &nNbr, &nNbrAlloc);
+      for(j=0; rc==SQLITE_OK && j<nNbr; j++){
+        rc = localIdSetAdd(&visited, aNbr[j], &bNew);
+        if( rc==SQLITE_OK && bNew ){
+          sqlite3_str_appendf(pOut, ",%lld", aNbr[j]);
+          rc = localAppend(&aNext, &nNext, &nNextAlloc, aNbr[j]);
+        }
+      }
+    }
+    if( rc==SQLITE_OK ){
+      sqlite3_int64 *aTmp = aLevel;
+      int nTmp = nLevelAlloc;
+      aLevel = aNext;
+      nLevel = nNext;
+      nLevelAlloc = nNextAlloc;
+      aNext = aTmp;
+      nNextAlloc = nTmp;
+    }
+  }
+  sqlite3_str_appendchar(pOut, 1, ']');
+
+  localIdSetFree(&visited);
+  sqlite3_free(aLevel);
+  sqlite3_free(aNext);
+  sqlite3_free(aNbr);
+  return graphFinishPath(pOut, rc, pzPath);
 }
 
 /*
 ** Depth-first search with cycle detection.
-** Recursive implementation with configurable depth limits.
-** Memory allocation: Uses sqlite3_malloc() for visited set and path.
-** Returns: SQLITE_OK on success, error codes on failure.
+** Iterative pre-order walk on an explicit stack, so deep graphs cannot
+** exhaust the C stack. Visit order matches the recursive formulation.
+** Adjacency: Read from the CSR snapshot cached on the virtual table,
+**            or hop by hop for shallow searches when none is current.
+** Memory allocation: Visited bitmap, stack and output buffer only.
+** Returns: SQLITE_OK on success, SQLITE_NOTFOUND for an unknown start.
 */
 int graphDFS(GraphVtab *pVtab, sqlite3_int64 iStartId, int nMaxDepth,
              char **pzPath){
-  GraphVisitedSet *pVisited = 0;
-  GraphNode *pStartNode;
+  CSRGraph *pCSR = 0;
+  unsigned char *aVisited = 0;
+  DFSFrame *aStack = 0;
+  int nStack = 0, nStackAlloc = 0;
+  sqlite3_str *pOut;
+  int iStart;
   int rc = SQLITE_OK;
   
   assert( pVtab!=0 );
@@ -144,230 +378,248 @@ int graphDFS(GraphVtab *pVtab, sqlite3_int64 iStartId, int nMaxDepth,
   
   *pzPath = 0;
   
+  if( nMaxDepth>=0 && nMaxDepth<=GRAPH_LOCAL_MAX_DEPTH
+   && !graphCSRIsCurrent(pVtab) ){
+    rc = graphDFSLocal(pVtab, iStartId, nMaxDepth, pzPath);
+    if( rc!=SQLITE_DONE ) return rc;
+  }
+
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+
   /* Validate start node exists */
-  pStartNode = graphFindNode(pVtab, iStartId);
-  if( pStartNode==0 ){
-    testcase( pStartNode==0 );  /* Start node not found */
+  iStart = graphCSRIndexOf(pCSR, iStartId);
+  if( iStart<0 ){
+    testcase( iStart<0 );  /* Start node not found */
     return SQLITE_NOTFOUND;
   }
   
-  /* Create visited set */
-  pVisited = graphVisitedSetCreate();
-  if( pVisited==0 ){
+  aVisited = sqlite3_malloc64(VISITED_BYTES(pCSR->nNodes));
+  if( aVisited==0 ){
     return SQLITE_NOMEM;
   }
+  memset(aVisited, 0, VISITED_BYTES(pCSR->nNodes));
   
-  /* Perform DFS traversal */
-  rc = graphDFSRecursive(pVtab, iStartId, nMaxDepth, 0, pVisited, pzPath);
-  
-  /* Close JSON array */
-  if( rc==SQLITE_OK && *pzPath ){
-    char *zNewPath = sqlite3_mprintf("%s]", *pzPath);
-    sqlite3_free(*pzPath);
-    *pzPath = zNewPath;
-    if( *pzPath==0 ){
-      testcase( *pzPath==0 );  /* Final path allocation failed */
+  pOut = sqlite3_str_new(pVtab->pDb);
+  sqlite3_str_appendchar(pOut, 1, '[');
+
+  if( nMaxDepth!=0 ){
+    nStackAlloc = 64;
+    aStack = sqlite3_malloc64(sizeof(DFSFrame)*nStackAlloc);
+    if( aStack==0 ){
       rc = SQLITE_NOMEM;
+      goto dfs_cleanup;
     }
+    VISITED_SET(aVisited, iStart);
+    sqlite3_str_appendf(pOut, "%lld", iStartId);
+    aStack[0].iNode = iStart;
+    aStack[0].iEdge = pCSR->rowOffsets[iStart];
+    aStack[0].nDepth = 0;
+    nStack = 1;
   }
-  
-  /* Cleanup */
-  graphVisitedSetDestroy(pVisited);
-  
-  return rc;
+
+  while( nStack>0 ){
+    DFSFrame *pTop = &aStack[nStack-1];
+    int iNext;
+
+    /* Children beyond the depth limit would not be emitted */
+    if( pTop->iEdge>=pCSR->rowOffsets[pTop->iNode+1]
+     || (nMaxDepth>=0 && pTop->nDepth+1>=nMaxDepth) ){
+      nStack--;
+      continue;
+    }
+    iNext = pCSR->columnIndices[pTop->iEdge++];
+    if( VISITED_TEST(aVisited, iNext) ) continue;
+
+    VISITED_SET(aVisited, iNext);
+    sqlite3_str_appendf(pOut, ",%lld", pCSR->aNodeIds[iNext]);
+    if( nStack>=nStackAlloc ){
+      DFSFrame *aNew;
+      aNew = sqlite3_realloc64(aStack, sizeof(DFSFrame)*nStackAlloc*2);
+      if( aNew==0 ){
+        rc = SQLITE_NOMEM;
+        goto dfs_cleanup;
+      }
+      aStack = aNew;
+      nStackAlloc *= 2;
+      pTop = &aStack[nStack-1];
+    }
+    aStack[nStack].iNode = iNext;
+    aStack[nStack].iEdge = pCSR->rowOffsets[iNext];
+    aStack[nStack].nDepth = pTop->nDepth + 1;
+    nStack++;
+  }
+  sqlite3_str_appendchar(pOut, 1, ']');
+
+dfs_cleanup:
+  sqlite3_free(aStack);
+  sqlite3_free(aVisited);
+  return graphFinishPath(pOut, rc, pzPath);
 }
 
 /*
-** Recursive DFS implementation.
-** Explores graph depth-first with cycle detection and depth limiting.
-** Path tracking: Builds JSON array of visited node IDs.
+** Direction-optimizing switch thresholds (Beamer et al.). Go bottom-up
+** once the frontier's out-edges exceed 1/BFS_ALPHA of the edges still
+** unexplored; return top-down once a shrinking frontier holds fewer
+** than 1/BFS_BETA of all nodes.
 */
-static int graphDFSRecursive(GraphVtab *pVtab, sqlite3_int64 iNodeId, 
-                            int nMaxDepth, int nCurrentDepth,
-                            GraphVisitedSet *pVisited, char **pzPath){
-  char *zNewPath = 0;
-  int rc;
-  char *zSql;
-  sqlite3_stmt *pStmt;
+#define BFS_ALPHA  14
+#define BFS_BETA   24
 
-  assert( pVtab!=0 );
-  assert( pVisited!=0 );
-  assert( pzPath!=0 );
-  
-  if( nMaxDepth>=0 && nCurrentDepth>=nMaxDepth ){
-    return SQLITE_OK;
-  }
-  
-  if( graphVisitedSetContains(pVisited, iNodeId) ){
-    return SQLITE_OK;
-  }
-  
-  rc = graphVisitedSetAdd(pVisited, iNodeId);
-  if( rc!=SQLITE_OK ){
-    return rc;
-  }
-  
-  if( *pzPath==0 ){
-    *pzPath = sqlite3_mprintf("[%lld", iNodeId);
-  } else {
-    zNewPath = sqlite3_mprintf("%s,%lld", *pzPath, iNodeId);
-    sqlite3_free(*pzPath);
-    *pzPath = zNewPath;
-  }
-  
-  if( *pzPath==0 ){
-    return SQLITE_NOMEM;
+int graphCSRBFS(const CSRGraph *pCSR, int iStart, int iTarget,
+                int nMaxDepth, int eMode, int *aQueue, int *pnQueue,
+                int *aParent){
+  unsigned char *aVisited = 0;
+  unsigned char *aFrontier = 0;
+  int iLevel = 0, iLevelEnd, iTail = 0;
+  int nDepth = 0;
+  int nPrevFrontier = 0;
+  int bBottomUp = (eMode==GRAPH_BFS_BOTTOM_UP);
+  sqlite3_int64 nFrontierEdges;     /* Out-edges of the current frontier */
+  sqlite3_int64 nUnexploredEdges;   /* In-edges of unvisited nodes */
+  int i;
+
+  assert( pCSR!=0 );
+  assert( iStart>=0 && iStart<pCSR->nNodes );
+  *pnQueue = 0;
+
+  aVisited = sqlite3_malloc64(VISITED_BYTES(pCSR->nNodes));
+  if( aVisited==0 ) return SQLITE_NOMEM;
+  memset(aVisited, 0, VISITED_BYTES(pCSR->nNodes));
+  if( eMode!=GRAPH_BFS_TOP_DOWN ){
+    aFrontier = sqlite3_malloc64(VISITED_BYTES(pCSR->nNodes));
+    if( aFrontier==0 ){
+      sqlite3_free(aVisited);
+      return SQLITE_NOMEM;
+    }
   }
-  
-  zSql = sqlite3_mprintf("SELECT to_id FROM %s_edges WHERE from_id = %lld", pVtab->zTableName, iNodeId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ) return rc;
 
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    sqlite3_int64 to_id = sqlite3_column_int64(pStmt, 0);
-    rc = graphDFSRecursive(pVtab, to_id, nMaxDepth, 
-                          nCurrentDepth + 1, pVisited, pzPath);
-    if( rc!=SQLITE_OK ){
-      sqlite3_finalize(pStmt);
-      return rc;
+  aQueue[iTail++] = iStart;
+  VISITED_SET(aVisited, iStart);
+  if( aParent ) aParent[iStart] = -1;
+  nFrontierEdges = graphCSROutDegree(pCSR, iStart);
+  nUnexploredEdges = pCSR->nEdges - graphCSRInDegree(pCSR, iStart);
+
+  /* Expand one whole frontier [iLevel, iLevelEnd) per iteration */
+  while( iLevel<iTail && (nMaxDepth<0 || nDepth<nMaxDepth)
+      && !(iTarget>=0 && VISITED_TEST(aVisited, iTarget)) ){
+    int nFrontier = iTail - iLevel;
+
+    if( eMode==GRAPH_BFS_AUTO ){
+      if( !bBottomUp && nFrontierEdges > nUnexploredEdges/BFS_ALPHA ){
+        bBottomUp = 1;
+      }else if( bBottomUp && nFrontier<nPrevFrontier
+             && nFrontier < pCSR->nNodes/BFS_BETA ){
+        bBottomUp = 0;
+      }
+    }
+    nPrevFrontier = nFrontier;
+    iLevelEnd = iTail;
+
+    if( bBottomUp ){
+      /* Every unvisited node looks for any parent in the frontier */
+      memset(aFrontier, 0, VISITED_BYTES(pCSR->nNodes));
+      for(i=iLevel; i<iLevelEnd; i++) VISITED_SET(aFrontier, aQueue[i]);
+      for(i=0; i<pCSR->nNodes; i++){
+        sqlite3_int64 iEdge;
+        if( VISITED_TEST(aVisited, i) ) continue;
+        for( iEdge=pCSR->inOffsets[i]; iEdge<pCSR->inOffsets[i+1]; iEdge++ ){
+          int iParent = pCSR->inIndices[iEdge];
+          if( VISITED_TEST(aFrontier, iParent) ){
+            VISITED_SET(aVisited, i);
+            if( aParent ) aParent[i] = iParent;
+            aQueue[iTail++] = i;
+            break;
+          }
+        }
+        if( i==iTarget && VISITED_TEST(aVisited, i) ) break;
+      }
+    }else{
+      for(i=iLevel; i<iLevelEnd; i++){
+        int iCurrent = aQueue[i];
+        sqlite3_int64 iEdge;
+        for( iEdge=pCSR->rowOffsets[iCurrent];
+             iEdge<pCSR->rowOffsets[iCurrent+1]; iEdge++ ){
+          int iNext = pCSR->columnIndices[iEdge];
+          if( !VISITED_TEST(aVisited, iNext) ){
+            VISITED_SET(aVisited, iNext);
+            if( aParent ) aParent[iNext] = iCurrent;
+            aQueue[iTail++] = iNext;
+          }
+        }
+        if( iTarget>=0 && VISITED_TEST(aVisited, iTarget) ) break;
+      }
+    }
+
+    /* Edge counts that drive the next level's direction choice */
+    nFrontierEdges = 0;
+    for(i=iLevelEnd; i<iTail; i++){
+      nFrontierEdges += graphCSROutDegree(pCSR, aQueue[i]);
+      nUnexploredEdges -= graphCSRInDegree(pCSR, aQueue[i]);
     }
+    iLevel = iLevelEnd;
+    nDepth++;
   }
-  sqlite3_finalize(pStmt);
-  
+
+  *pnQueue = iTail;
+  sqlite3_free(aVisited);
+  sqlite3_free(aFrontier);
   return SQLITE_OK;
 }
 
+/*
+** Breadth-first search with level-order traversal.
+** Level-synchronous: each level is a contiguous frontier slice of one
+** queue array. Once a snapshot exists, levels may be expanded bottom-up
+** according to eMode (see graphCSRBFS()).
+** Adjacency: Read from the CSR snapshot cached on the virtual table,
+**            or hop by hop for shallow searches when none is current.
+** Memory allocation: Visited bitmaps, queue and output buffer only.
+** Returns: SQLITE_OK on success, SQLITE_NOTFOUND for an unknown start.
+*/
 int graphBFS(GraphVtab *pVtab, sqlite3_int64 iStartId, int nMaxDepth,
-             char **pzPath){
-  Queue *pQueue = 0;
-  GraphVisitedSet *pVisited = 0;
-  GraphDepthInfo *pDepthList = 0;
-  GraphDepthInfo *pDepthInfo;
-  sqlite3_int64 iCurrentId;
-  int nCurrentDepth;
-  char *zNewPath = 0;
+             int eMode, char **pzPath){
+  CSRGraph *pCSR = 0;
+  int *aQueue = 0;
+  int nQueue = 0;
+  sqlite3_str *pOut;
+  int iStart;
+  int i;
   int rc = SQLITE_OK;
-  char *zSql;
-  sqlite3_stmt *pStmt;
 
   assert( pVtab!=0 );
   assert( pzPath!=0 );
   
   *pzPath = 0;
   
-  pQueue = graphQueueCreate();
-  if( pQueue==0 ){
-    return SQLITE_NOMEM;
-  }
-  
-  pVisited = graphVisitedSetCreate();
-  if( pVisited==0 ){
-    graphQueueDestroy(pQueue);
-    return SQLITE_NOMEM;
-  }
-  
-  rc = graphQueueEnqueue(pQueue, iStartId);
-  if( rc!=SQLITE_OK ){
-    goto bfs_cleanup;
-  }
-  
-  rc = graphVisitedSetAdd(pVisited, iStartId);
-  if( rc!=SQLITE_OK ){
-    goto bfs_cleanup;
-  }
-  
-  pDepthInfo = sqlite3_malloc(sizeof(*pDepthInfo));
-  if( pDepthInfo==0 ){
-    rc = SQLITE_NOMEM;
-    goto bfs_cleanup;
-  }
-  pDepthInfo->iNodeId = iStartId;
-  pDepthInfo->nDepth = 0;
-  pDepthInfo->pNext = pDepthList;
-  pDepthList = pDepthInfo;
-  
-  *pzPath = sqlite3_mprintf("[%lld", iStartId);
-  if( *pzPath==0 ){
-    rc = SQLITE_NOMEM;
-    goto bfs_cleanup;
-  }
-  
-  while( graphQueueDequeue(pQueue, &iCurrentId)==SQLITE_OK ){
-    nCurrentDepth = 0;
-    for( pDepthInfo=pDepthList; pDepthInfo; pDepthInfo=pDepthInfo->pNext ){
-      if( pDepthInfo->iNodeId==iCurrentId ){
-        nCurrentDepth = pDepthInfo->nDepth;
-        break;
-      }
-    }
-    
-    if( nMaxDepth>=0 && nCurrentDepth>=nMaxDepth ){
-      continue;
-    }
-    
-    zSql = sqlite3_mprintf("SELECT to_id FROM %s_edges WHERE from_id = %lld", pVtab->zTableName, iCurrentId);
-    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) continue;
-
-    while( sqlite3_step(pStmt)==SQLITE_ROW ){
-      sqlite3_int64 to_id = sqlite3_column_int64(pStmt, 0);
-      if( !graphVisitedSetContains(pVisited, to_id) ){
-        rc = graphVisitedSetAdd(pVisited, to_id);
-        if( rc!=SQLITE_OK ){
-          sqlite3_finalize(pStmt);
-          goto bfs_cleanup;
-        }
-        
-        rc = graphQueueEnqueue(pQueue, to_id);
-        if( rc!=SQLITE_OK ){
-          sqlite3_finalize(pStmt);
-          goto bfs_cleanup;
-        }
-        
-        pDepthInfo = sqlite3_malloc(sizeof(*pDepthInfo));
-        if( pDepthInfo==0 ){
-          rc = SQLITE_NOMEM;
-          sqlite3_finalize(pStmt);
-          goto bfs_cleanup;
-        }
-        pDepthInfo->iNodeId = to_id;
-        pDepthInfo->nDepth = nCurrentDepth + 1;
-        pDepthInfo->pNext = pDepthList;
-        pDepthList = pDepthInfo;
-        
-        zNewPath = sqlite3_mprintf("%s,%lld", *pzPath, to_id);
-        sqlite3_free(*pzPath);
-        *pzPath = zNewPath;
-        if( *pzPath==0 ){
-          rc = SQLITE_NOMEM;
-          sqlite3_finalize(pStmt);
-          goto bfs_cleanup;
-        }
-      }
-    }
-    sqlite3_finalize(pStmt);
+  if( nMaxDepth>=0 && nMaxDepth<=GRAPH_LOCAL_MAX_DEPTH
+   && !graphCSRIsCurrent(pVtab) ){
+    rc = graphBFSLocal(pVtab, iStartId, nMaxDepth, pzPath);
+    if( rc!=SQLITE_DONE ) return rc;
   }
-  
-  if( rc==SQLITE_OK && *pzPath ){
-    zNewPath = sqlite3_mprintf("%s]", *pzPath);
-    sqlite3_free(*pzPath);
-    *pzPath = zNewPath;
-    if( *pzPath==0 ){
-      rc = SQLITE_NOMEM;
-    }
+
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+
+  iStart = graphCSRIndexOf(pCSR, iStartId);
+  if( iStart<0 ){
+    testcase( iStart<0 );  /* Start node not found */
+    return SQLITE_NOTFOUND;
   }
-  
-bfs_cleanup:
-  while( pDepthList ){
-    pDepthInfo = pDepthList;
-    pDepthList = pDepthList->pNext;
-    sqlite3_free(pDepthInfo);
+
+  /* Each node is enqueued at most once, so nNodes slots suffice */
+  aQueue = sqlite3_malloc64(sizeof(int)*pCSR->nNodes);
+  if( aQueue==0 ) return SQLITE_NOMEM;
+  rc = graphCSRBFS(pCSR, iStart, -1, nMaxDepth, eMode, aQueue, &nQueue, 0);
+
+  pOut = sqlite3_str_new(pVtab->pDb);
+  sqlite3_str_appendchar(pOut, 1, '[');
+  for(i=0; rc==SQLITE_OK && i<nQueue; i++){
+    sqlite3_str_appendf(pOut, i ? ",%lld" : "%lld",
+                        pCSR->aNodeIds[aQueue[i]]);
   }
+  sqlite3_str_appendchar(pOut, 1, ']');
   
-  graphQueueDestroy(pQueue);
-  graphVisitedSetDestroy(pVisited);
-  
-  return rc;
-}
\ No newline at end of file
+  sqlite3_free(aQueue);
+  return graphFinishPath(pOut, rc, pzPath);
+}
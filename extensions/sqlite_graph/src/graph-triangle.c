@@ -0,0 +1,655 @@
+/*
+** SQLite Graph Database Extension - Triangles and Neighbour Similarity
+**
+** Triangle counting, local clustering coefficients and the link
+** prediction scores (common neighbours, Jaccard, Adamic-Adar) all work
+** on the undirected simple view of the CSR snapshot: each node's out-
+** and in-neighbours merged, sorted by dense index, with duplicate edges
+** and self-loops dropped. Those neighbour sets are built once per
+** snapshot, in parallel, and kept on the GraphVtab until the snapshot
+** is replaced (graphNbrSetsReset()). Every query then comes down to
+** intersecting sorted int arrays.
+**
+** Kernels: AVX2 on x86-64 CPUs that have it, NEON on AArch64 and a
+**          scalar merge elsewhere, picked once at run time. Lists of
+**          very different lengths are intersected by galloping through
+**          the longer one instead. Build with GRAPH_NO_SIMD for the
+**          scalar kernel only.
+** Triangles: Each is counted once, by orienting every edge towards the
+**            endpoint of higher degree (ties by index) and intersecting
+**            forward lists, which keeps the lists of hubs short. Node
+**            ranges of similar forward volume run on the task scheduler.
+**
+** Memory allocation: sqlite3_malloc64()/sqlite3_free(); the caller owns
+** the returned arrays.
+*/
+#include "sqlite3ext.h"
+#ifndef SQLITE_CORE
+extern const sqlite3_api_routines *sqlite3_api;
+#endif
+/* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
+#include "graph.h"
+#include "graph-csr.h"
+#include "graph-performance.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(GRAPH_NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+# define GRAPH_INTERSECT_AVX2 1
+# include <immintrin.h>
+#endif
+#if !defined(GRAPH_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+# define GRAPH_INTERSECT_NEON 1
+# include <arm_neon.h>
+#endif
+
+/* Gallop when one list is this many times longer than the other */
+#define INTERSECT_GALLOP 32
+
+/*
+** Undirected simple adjacency of a snapshot. Node i's set is
+** aNbr[aStart[i] .. aStart[i]+aDeg[i]-1], ascending; aStart[i] is where
+** its out- and in-edges start in the two CSR arrays laid end to end, so
+** the sets need no second pass to pack.
+*/
+struct GraphNbrSets {
+  const CSRGraph *pCSR;        /* Snapshot the sets were built from */
+  sqlite3_int64 *aStart;       /* First slot per node, nNodes+1 entries */
+  int *aDeg;                   /* Distinct neighbours per node */
+  int *aNbr;                   /* The sets */
+  int nMaxDeg;                 /* Largest aDeg[] */
+};
+
+/*
+** Intersection kernels. Each takes two ascending lists of distinct
+** values, returns the size of their intersection and, if aOut is not
+** NULL, writes its elements there in ascending order.
+*/
+typedef int (*IntersectFunc)(const int*, int, const int*, int, int*);
+
+static int intersectScalar(const int *aA, int nA, const int *aB, int nB,
+                           int *aOut){
+  int i = 0, j = 0, n = 0;
+  while( i<nA && j<nB ){
+    int x = aA[i];
+    int y = aB[j];
+    if( x==y ){
+      if( aOut ) aOut[n] = x;
+      n++;
+      i++;
+      j++;
+    }else{
+      i += x<y;
+      j += y<x;
+    }
+  }
+  return n;
+}
+
+/*
+** Probe the longer list aB for each element of aA, moving forward with
+** an exponential search and then a binary one.
+*/
+static int intersectGallop(const int *aA, int nA, const int *aB, int nB,
+                           int *aOut){
+  int i, j = 0, n = 0;
+  for( i=0; i<nA && j<nB; i++ ){
+    int x = aA[i];
+    if( aB[j]<x ){
+      int lo = j, hi, step = 1;
+      while( lo+step<nB && aB[lo+step]<x ){
+        lo += step;
+        step <<= 1;
+      }
+      hi = lo+step<nB ? lo+step : nB;
+      while( hi-lo>1 ){                 /* aB[lo]<x<=aB[hi] */
+        int mid = lo + (hi-lo)/2;
+        if( aB[mid]<x ) lo = mid; else hi = mid;
+      }
+      j = hi;
+    }
+    if( j<nB && aB[j]==x ){
+      if( aOut ) aOut[n] = x;
+      n++;
+      j++;
+    }
+  }
+  return n;
+}
+
+#ifdef GRAPH_INTERSECT_AVX2
+/*
+** Compare 8 elements of each list all-against-all (the B block rotated
+** through the 8 lanes), then step past whichever block ends lower.
+*/
+__attribute__((target("avx2")))
+static int intersectAvx2(const int *aA, int nA, const int *aB, int nB,
+                         int *aOut){
+  const __m256i vRot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+  int i = 0, j = 0, n = 0;
+
+  while( i+8<=nA && j+8<=nB ){
+    __m256i va = _mm256_loadu_si256((const __m256i*)&aA[i]);
+    __m256i vb = _mm256_loadu_si256((const __m256i*)&aB[j]);
+    __m256i vEq = _mm256_cmpeq_epi32(va, vb);
+    unsigned int mask;
+    int k;
+
+    for( k=1; k<8; k++ ){
+      vb = _mm256_permutevar8x32_epi32(vb, vRot);
+      vEq = _mm256_or_si256(vEq, _mm256_cmpeq_epi32(va, vb));
+    }
+    mask = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(vEq));
+    if( aOut ){
+      while( mask ){
+        aOut[n++] = aA[i + __builtin_ctz(mask)];
+        mask &= mask-1;
+      }
+    }else{
+      n += __builtin_popcount(mask);
+    }
+    k = aA[i+7];
+    if( k<=aB[j+7] ) i += 8;
+    if( aB[j+7]<=k ) j += 8;
+  }
+  return n + intersectScalar(&aA[i], nA-i, &aB[j], nB-j, aOut ? &aOut[n] : 0);
+}
+#endif /* GRAPH_INTERSECT_AVX2 */
+
+#ifdef GRAPH_INTERSECT_NEON
+/*
+** The AVX2 kernel on 4-lane blocks.
+*/
+static int intersectNeon(const int *aA, int nA, const int *aB, int nB,
+                         int *aOut){
+  static const uint32_t aBit[4] = { 1, 2, 4, 8 };
+  const uint32x4_t vBit = vld1q_u32(aBit);
+  int i = 0, j = 0, n = 0;
+
+  while( i+4<=nA && j+4<=nB ){
+    int32x4_t va = vld1q_s32(&aA[i]);
+    int32x4_t vb = vld1q_s32(&aB[j]);
+    uint32x4_t vEq = vceqq_s32(va, vb);
+    unsigned int mask;
+    int k;
+
+    vEq = vorrq_u32(vEq, vceqq_s32(va, vextq_s32(vb, vb, 1)));
+    vEq = vorrq_u32(vEq, vceqq_s32(va, vextq_s32(vb, vb, 2)));
+    vEq = vorrq_u32(vEq, vceqq_s32(va, vextq_s32(vb, vb, 3)));
+    mask = vaddvq_u32(vandq_u32(vEq, vBit));
+    if( aOut ){
+      while( mask ){
+        aOut[n++] = aA[i + __builtin_ctz(mask)];
+        mask &= mask-1;
+      }
+    }else{
+      n += __builtin_popcount(mask);
+    }
+    k = aA[i+3];
+    if( k<=aB[j+3] ) i += 4;
+    if( aB[j+3]<=k ) j += 4;
+  }
+  return n + intersectScalar(&aA[i], nA-i, &aB[j], nB-j, aOut ? &aOut[n] : 0);
+}
+#endif /* GRAPH_INTERSECT_NEON */
+
+/* Kernel chosen for this CPU, or NULL before the first call */
+static IntersectFunc g_xIntersect = 0;
+
+static IntersectFunc intersectPick(void){
+#ifdef GRAPH_INTERSECT_AVX2
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("avx2") ) return intersectAvx2;
+#endif
+#ifdef GRAPH_INTERSECT_NEON
+  return intersectNeon;
+#endif
+  return intersectScalar;
+}
+
+/*
+** Intersect two ascending lists of distinct dense indices; see the
+** kernels above. Threads racing the first call pick the same kernel.
+*/
+static int nbrIntersect(const int *aA, int nA, const int *aB, int nB,
+                        int *aOut){
+  IntersectFunc xIntersect = __atomic_load_n(&g_xIntersect, __ATOMIC_RELAXED);
+
+  if( (sqlite3_int64)nA*INTERSECT_GALLOP<nB ){
+    return intersectGallop(aA, nA, aB, nB, aOut);
+  }
+  if( (sqlite3_int64)nB*INTERSECT_GALLOP<nA ){
+    return intersectGallop(aB, nB, aA, nA, aOut);
+  }
+  if( xIntersect==0 ){
+    xIntersect = intersectPick();
+    __atomic_store_n(&g_xIntersect, xIntersect, __ATOMIC_RELAXED);
+  }
+  return xIntersect(aA, nA, aB, nB, aOut);
+}
+
+/*
+** Start the scheduler for nThreads and pick the task count: a few
+** ranges per thread, but never more ranges than nodes.
+*/
+static int nbrStartTasks(int nThreads, int nNode,
+                         TaskScheduler **ppScheduler, int *pnTask){
+  *ppScheduler = 0;
+  *pnTask = 1;
+  if( nThreads!=1 && nNode>1 ){
+    *ppScheduler = graphCreateTaskScheduler(nThreads);
+    if( *ppScheduler==0 ) return SQLITE_NOMEM;
+    *pnTask = (*ppScheduler)->nThreads * 4;
+    if( *pnTask>nNode ) *pnTask = nNode;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Split nNode nodes into nTask ranges of about the same number of nodes
+** plus slots, aOff[] (nNode+1 entries) giving each node's first slot.
+** aFirst[] gets nTask+1 boundaries.
+*/
+static void nbrSplitRanges(const sqlite3_int64 *aOff, int nNode, int nTask,
+                           int *aFirst){
+  sqlite3_int64 nWork = (sqlite3_int64)nNode + aOff[nNode];
+  int iNode = 0;
+  int i;
+  for( i=0; i<nTask; i++ ){
+    sqlite3_int64 nTarget = nWork * (i+1) / nTask;
+    aFirst[i] = iNode;
+    while( iNode<nNode && (iNode + aOff[iNode])<nTarget ) iNode++;
+  }
+  aFirst[nTask] = nNode;
+}
+
+static int nbrIntCompare(const void *pA, const void *pB){
+  int a = *(const int*)pA;
+  int b = *(const int*)pB;
+  return (a>b) - (a<b);
+}
+
+/*
+** One work unit of the set build or of triangle counting: the dense
+** node range [iFirst, iLast).
+*/
+typedef struct NbrTask NbrTask;
+struct NbrTask {
+  const CSRGraph *pCSR;
+  GraphNbrSets *pSets;        /* Set build: sets being filled */
+  const sqlite3_int64 *aFwdOff; /* Triangles: forward list offsets */
+  const int *aFwd;            /* Triangles: forward lists */
+  sqlite3_int64 *aTriangle;   /* Per-node counts, or NULL */
+  int *aScratch;              /* Intersection output when aTriangle set */
+  int iFirst, iLast;
+  int nMaxDeg;                /* Out: largest set of the range */
+  sqlite3_int64 nTriangle;    /* Out: triangles found from the range */
+};
+
+/*
+** Fill the sets of the range: copy out- and in-neighbours into the
+** node's slots, sort, and keep each neighbour other than itself once.
+*/
+static void nbrBuildWorker(void *pArg){
+  NbrTask *p = (NbrTask*)pArg;
+  const CSRGraph *pCSR = p->pCSR;
+  GraphNbrSets *pSets = p->pSets;
+  int i;
+
+  for( i=p->iFirst; i<p->iLast; i++ ){
+    int *aSet = &pSets->aNbr[pSets->aStart[i]];
+    sqlite3_int64 nOut = pCSR->rowOffsets[i+1] - pCSR->rowOffsets[i];
+    sqlite3_int64 nIn = pCSR->inOffsets[i+1] - pCSR->inOffsets[i];
+    int nSlot = (int)(nOut + nIn);
+    int j, k = 0;
+
+    memcpy(aSet, &pCSR->columnIndices[pCSR->rowOffsets[i]], sizeof(int)*nOut);
+    memcpy(&aSet[nOut], &pCSR->inIndices[pCSR->inOffsets[i]], sizeof(int)*nIn);
+    qsort(aSet, nSlot, sizeof(int), nbrIntCompare);
+    for( j=0; j<nSlot; j++ ){
+      if( aSet[j]==i || (k>0 && aSet[j]==aSet[k-1]) ) continue;
+      aSet[k++] = aSet[j];
+    }
+    pSets->aDeg[i] = k;
+    if( k>p->nMaxDeg ) p->nMaxDeg = k;
+  }
+}
+
+static void nbrSetsFree(GraphNbrSets *pSets){
+  if( pSets ){
+    sqlite3_free(pSets->aStart);
+    sqlite3_free(pSets->aDeg);
+    sqlite3_free(pSets->aNbr);
+    sqlite3_free(pSets);
+  }
+}
+
+void graphNbrSetsReset(GraphVtab *pVtab){
+  nbrSetsFree(pVtab->pNbrSets);
+  pVtab->pNbrSets = 0;
+}
+
+/*
+** Return in *ppSets the neighbour sets of pVtab's current snapshot,
+** building them on nThreads workers unless they are kept already.
+*/
+static int nbrSetsGet(GraphVtab *pVtab, int nThreads,
+                      const GraphNbrSets **ppSets){
+  CSRGraph *pCSR = 0;
+  GraphNbrSets *pSets;
+  TaskScheduler *pScheduler = 0;
+  NbrTask *aTask = 0;
+  void **apTask = 0;
+  int *aFirst = 0;
+  int nTask = 1;
+  int i, n;
+  int rc;
+
+  *ppSets = 0;
+  rc = graphCSRGet(pVtab, &pCSR);
+  if( rc!=SQLITE_OK ) return rc;
+  if( pVtab->pNbrSets && pVtab->pNbrSets->pCSR==pCSR ){
+    *ppSets = pVtab->pNbrSets;
+    return SQLITE_OK;
+  }
+  graphNbrSetsReset(pVtab);
+
+  n = pCSR->nNodes;
+  pSets = sqlite3_malloc(sizeof(*pSets));
+  if( pSets==0 ) return SQLITE_NOMEM;
+  memset(pSets, 0, sizeof(*pSets));
+  pSets->pCSR = pCSR;
+  pSets->aStart = sqlite3_malloc64(sizeof(sqlite3_int64)*(n+1));
+  pSets->aDeg = sqlite3_malloc64(sizeof(int)*(n ? n : 1));
+  pSets->aNbr = sqlite3_malloc64(sizeof(int)*(pCSR->nEdges ? pCSR->nEdges*2 : 1));
+  if( !pSets->aStart || !pSets->aDeg || !pSets->aNbr ){
+    rc = SQLITE_NOMEM;
+    goto sets_cleanup;
+  }
+  for( i=0; i<=n; i++ ){
+    pSets->aStart[i] = pCSR->rowOffsets[i] + pCSR->inOffsets[i];
+  }
+
+  if( n>0 ){
+    rc = nbrStartTasks(nThreads, n, &pScheduler, &nTask);
+    if( rc!=SQLITE_OK ) goto sets_cleanup;
+    aTask = sqlite3_malloc64(sizeof(NbrTask)*nTask);
+    apTask = sqlite3_malloc64(sizeof(void*)*nTask);
+    aFirst = sqlite3_malloc64(sizeof(int)*(nTask+1));
+    if( !aTask || !apTask || !aFirst ){
+      rc = SQLITE_NOMEM;
+      goto sets_cleanup;
+    }
+    memset(aTask, 0, sizeof(NbrTask)*nTask);
+    nbrSplitRanges(pSets->aStart, n, nTask, aFirst);
+    for( i=0; i<nTask; i++ ){
+      aTask[i].pCSR = pCSR;
+      aTask[i].pSets = pSets;
+      aTask[i].iFirst = aFirst[i];
+      aTask[i].iLast = aFirst[i+1];
+      apTask[i] = &aTask[i];
+    }
+    rc = graphRunTasks(pScheduler, nbrBuildWorker, apTask, nTask);
+    if( rc!=SQLITE_OK ) goto sets_cleanup;
+    for( i=0; i<nTask; i++ ){
+      if( aTask[i].nMaxDeg>pSets->nMaxDeg ) pSets->nMaxDeg = aTask[i].nMaxDeg;
+    }
+  }
+
+  pVtab->pNbrSets = pSets;
+  *ppSets = pSets;
+  pSets = 0;
+
+sets_cleanup:
+  nbrSetsFree(pSets);
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
+  sqlite3_free(aFirst);
+  graphDestroyTaskScheduler(pScheduler);
+  return rc;
+}
+
+/* Node u comes before v in degree order */
+#define NBR_BEFORE(D,U,V) ((D)[U]<(D)[V] || ((D)[U]==(D)[V] && (U)<(V)))
+
+/*
+** Count the triangles closed by the forward lists of the range. With
+** aTriangle set, every corner of each triangle is credited as well.
+*/
+static void nbrTriangleWorker(void *pArg){
+  NbrTask *p = (NbrTask*)pArg;
+  const sqlite3_int64 *aOff = p->aFwdOff;
+  const int *aFwd = p->aFwd;
+  int u;
+
+  p->nTriangle = 0;
+  for( u=p->iFirst; u<p->iLast; u++ ){
+    const int *aU = &aFwd[aOff[u]];
+    int nU = (int)(aOff[u+1] - aOff[u]);
+    sqlite3_int64 nNode = 0;
+    int k;
+
+    for( k=0; k<nU; k++ ){
+      int v = aU[k];
+      const int *aV = &aFwd[aOff[v]];
+      int nV = (int)(aOff[v+1] - aOff[v]);
+      int nCommon;
+
+      if( p->aTriangle==0 ){
+        nNode += nbrIntersect(aU, nU, aV, nV, 0);
+        continue;
+      }
+      nCommon = nbrIntersect(aU, nU, aV, nV, p->aScratch);
+      if( nCommon>0 ){
+        int w;
+        __atomic_fetch_add(&p->aTriangle[v], nCommon, __ATOMIC_RELAXED);
+        for( w=0; w<nCommon; w++ ){
+          __atomic_fetch_add(&p->aTriangle[p->aScratch[w]], 1,
+                             __ATOMIC_RELAXED);
+        }
+        nNode += nCommon;
+      }
+    }
+    if( p->aTriangle && nNode>0 ){
+      __atomic_fetch_add(&p->aTriangle[u], nNode, __ATOMIC_RELAXED);
+    }
+    p->nTriangle += nNode;
+  }
+}
+
+/*
+** Count the triangles of pVtab's graph into *pnTriangle and, if
+** aTriangle is not NULL, the triangles through each dense node into
+** aTriangle[] (pSets->pCSR->nNodes entries, zeroed here).
+*/
+static int nbrTriangles(const GraphNbrSets *pSets, int nThreads,
+                        sqlite3_int64 *aTriangle, sqlite3_int64 *pnTriangle){
+  int n = pSets->pCSR->nNodes;
+  sqlite3_int64 *aFwdOff = 0;
+  int *aFwd = 0;
+  TaskScheduler *pScheduler = 0;
+  NbrTask *aTask = 0;
+  void **apTask = 0;
+  int *aFirst = 0;
+  int nTask = 1;
+  int nMaxFwd = 0;
+  int i;
+  int rc;
+
+  *pnTriangle = 0;
+  if( aTriangle ) memset(aTriangle, 0, sizeof(sqlite3_int64)*n);
+  if( n==0 ) return SQLITE_OK;
+
+  /* Forward lists: the neighbours after each node in degree order */
+  aFwdOff = sqlite3_malloc64(sizeof(sqlite3_int64)*(n+1));
+  if( aFwdOff==0 ) return SQLITE_NOMEM;
+  aFwdOff[0] = 0;
+  for( i=0; i<n; i++ ){
+    const int *aSet = &pSets->aNbr[pSets->aStart[i]];
+    int j, nFwd = 0;
+    for( j=0; j<pSets->aDeg[i]; j++ ){
+      nFwd += NBR_BEFORE(pSets->aDeg, i, aSet[j]);
+    }
+    aFwdOff[i+1] = aFwdOff[i] + nFwd;
+    if( nFwd>nMaxFwd ) nMaxFwd = nFwd;
+  }
+  aFwd = sqlite3_malloc64(sizeof(int)*(aFwdOff[n] ? aFwdOff[n] : 1));
+  if( aFwd==0 ){
+    rc = SQLITE_NOMEM;
+    goto triangle_cleanup;
+  }
+  for( i=0; i<n; i++ ){
+    const int *aSet = &pSets->aNbr[pSets->aStart[i]];
+    sqlite3_int64 iSlot = aFwdOff[i];
+    int j;
+    for( j=0; j<pSets->aDeg[i]; j++ ){
+      if( NBR_BEFORE(pSets->aDeg, i, aSet[j]) ) aFwd[iSlot++] = aSet[j];
+    }
+  }
+
+  rc = nbrStartTasks(nThreads, n, &pScheduler, &nTask);
+  if( rc!=SQLITE_OK ) goto triangle_cleanup;
+  aTask = sqlite3_malloc64(sizeof(NbrTask)*nTask);
+  apTask = sqlite3_malloc64(sizeof(void*)*nTask);
+  aFirst = sqlite3_malloc64(sizeof(int)*(nTask+1));
+  if( !aTask || !apTask || !aFirst ){
+    rc = SQLITE_NOMEM;
+    goto triangle_cleanup;
+  }
+  memset(aTask, 0, sizeof(NbrTask)*nTask);
+  nbrSplitRanges(aFwdOff, n, nTask, aFirst);
+  for( i=0; i<nTask; i++ ){
+    aTask[i].aFwdOff = aFwdOff;
+    aTask[i].aFwd = aFwd;
+    aTask[i].aTriangle = aTriangle;
+    aTask[i].iFirst = aFirst[i];
+    aTask[i].iLast = aFirst[i+1];
+    if( aTriangle ){
+      aTask[i].aScratch = sqlite3_malloc64(sizeof(int)*(nMaxFwd+1));
+      if( aTask[i].aScratch==0 ){
+        rc = SQLITE_NOMEM;
+        goto triangle_cleanup;
+      }
+    }
+    apTask[i] = &aTask[i];
+  }
+  rc = graphRunTasks(pScheduler, nbrTriangleWorker, apTask, nTask);
+  if( rc==SQLITE_OK ){
+    for( i=0; i<nTask; i++ ) *pnTriangle += aTask[i].nTriangle;
+  }
+
+triangle_cleanup:
+  if( aTask ){
+    for( i=0; i<nTask; i++ ) sqlite3_free(aTask[i].aScratch);
+  }
+  sqlite3_free(aTask);
+  sqlite3_free(apTask);
+  sqlite3_free(aFirst);
+  sqlite3_free(aFwd);
+  sqlite3_free(aFwdOff);
+  graphDestroyTaskScheduler(pScheduler);
+  return rc;
+}
+
+int graphTriangleCount(GraphVtab *pVtab, int nThreads,
+                       sqlite3_int64 *pnTriangle){
+  const GraphNbrSets *pSets;
+  int rc;
+
+  *pnTriangle = 0;
+  rc = nbrSetsGet(pVtab, nThreads, &pSets);
+  if( rc!=SQLITE_OK ) return rc;
+  return nbrTriangles(pSets, nThreads, 0, pnTriangle);
+}
+
+int graphClustering(GraphVtab *pVtab, int nThreads, sqlite3_int64 **paNode,
+                    int **paDegree, sqlite3_int64 **paTriangle, int *pnNode){
+  const GraphNbrSets *pSets;
+  sqlite3_int64 *aNode = 0;
+  sqlite3_int64 *aTriangle = 0;
+  int *aDegree = 0;
+  sqlite3_int64 nTotal;
+  int n;
+  int rc;
+
+  *paNode = 0;
+  *paDegree = 0;
+  *paTriangle = 0;
+  *pnNode = 0;
+  rc = nbrSetsGet(pVtab, nThreads, &pSets);
+  if( rc!=SQLITE_OK ) return rc;
+  n = pSets->pCSR->nNodes;
+  if( n==0 ) return SQLITE_OK;
+
+  aNode = sqlite3_malloc64(sizeof(sqlite3_int64)*n);
+  aDegree = sqlite3_malloc64(sizeof(int)*n);
+  aTriangle = sqlite3_malloc64(sizeof(sqlite3_int64)*n);
+  if( !aNode || !aDegree || !aTriangle ){
+    rc = SQLITE_NOMEM;
+  }else{
+    rc = nbrTriangles(pSets, nThreads, aTriangle, &nTotal);
+  }
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(aNode);
+    sqlite3_free(aDegree);
+    sqlite3_free(aTriangle);
+    return rc;
+  }
+  memcpy(aNode, pSets->pCSR->aNodeIds, sizeof(sqlite3_int64)*n);
+  memcpy(aDegree, pSets->aDeg, sizeof(int)*n);
+  *paNode = aNode;
+  *paDegree = aDegree;
+  *paTriangle = aTriangle;
+  *pnNode = n;
+  return SQLITE_OK;
+}
+
+int graphNeighborScore(GraphVtab *pVtab, int eScore, sqlite3_int64 iA,
+                       sqlite3_int64 iB, double *prScore){
+  const GraphNbrSets *pSets;
+  const int *aA, *aB;
+  int *aCommon = 0;
+  int u, v, nA, nB, nCommon;
+  int rc;
+
+  *prScore = 0.0;
+  rc = nbrSetsGet(pVtab, 0, &pSets);
+  if( rc!=SQLITE_OK ) return rc;
+  u = graphCSRIndexOf(pSets->pCSR, iA);
+  v = graphCSRIndexOf(pSets->pCSR, iB);
+  if( u<0 || v<0 ) return SQLITE_NOTFOUND;
+
+  aA = &pSets->aNbr[pSets->aStart[u]];
+  aB = &pSets->aNbr[pSets->aStart[v]];
+  nA = pSets->aDeg[u];
+  nB = pSets->aDeg[v];
+  if( eScore==GRAPH_SCORE_ADAMIC_ADAR ){
+    aCommon = sqlite3_malloc64(sizeof(int)*((nA<nB ? nA : nB)+1));
+    if( aCommon==0 ) return SQLITE_NOMEM;
+  }
+  nCommon = nbrIntersect(aA, nA, aB, nB, aCommon);
+
+  switch( eScore ){
+    case GRAPH_SCORE_COMMON:
+      *prScore = nCommon;
+      break;
+    case GRAPH_SCORE_JACCARD:
+      if( nA+nB-nCommon>0 ) *prScore = (double)nCommon/(nA+nB-nCommon);
+      break;
+    default: {
+      int i;
+      assert( eScore==GRAPH_SCORE_ADAMIC_ADAR );
+      /* A common neighbour of two distinct nodes has degree 2 or more;
+      ** with u==v a degree-1 neighbour would divide by log(1) */
+      for( i=0; i<nCommon; i++ ){
+        int nDeg = pSets->aDeg[aCommon[i]];
+        if( nDeg>1 ) *prScore += 1.0/log((double)nDeg);
+      }
+      sqlite3_free(aCommon);
+      break;
+    }
+  }
+  return SQLITE_OK;
+}
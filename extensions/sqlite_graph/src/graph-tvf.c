@@ -1,12 +1,65 @@
 /*
 ** SQLite Graph Database Extension - Table-Valued Functions
 **
-** This file implements table-valued functions for graph traversal including
-** graph_dfs() and graph_bfs(). These functions return virtual tables with
-** traversal results.
+** This file implements the graph_dfs() and graph_bfs() table-valued
+** functions:
 **
-** Table-valued functions are implemented as virtual tables in SQLite.
-** Each function creates a specialized virtual table module.
+**   SELECT node_id, depth, parent_id, position
+**     FROM graph_bfs('g', 42, 3);       -- graph, start node, max depth
+**
+** Both are eponymous-only virtual tables whose arguments bind the hidden
+** columns graph, start and max_depth (optional, unlimited by default).
+** The traversal runs incrementally: xFilter emits the start node and
+** every xNext expands just enough of the frontier to produce one more
+** row, so a LIMIT or a join that stops reading ends the search early.
+** Rows come out in visit order; depth is the hop count from the start
+** and parent_id the node it was reached from (NULL for the start).
+**
+** Neighbours come from the graph's CSR snapshot when the named graph has
+** a current one, and otherwise from one indexed query per expanded node,
+** so a short traversal never pays for a snapshot build. Either way they
+** are taken in edge index order and edges to missing nodes are skipped.
+** A projection (graph-project.c) may be named instead of a graph; it is
+** traversed over its own snapshot.
+**
+** graph_label_propagation(max_iter, threads) and graph_louvain(resolution,
+** threads) return one (node_id, community_id) row per node of the current
+** graph; both arguments are optional. The assignment is computed in
+** xFilter by graph-community.c and streamed from arrays, so no JSON
+** document is built.
+**
+** graph_components(incremental, threads) returns one (node_id,
+** component_id) row per node: its weakly connected component, named
+** after the smallest member id. Rows are read straight off the
+** union-find forest, snapshot nodes in id order first. With incremental
+** set the forest is kept and the next incremental call only links the
+** nodes and edges written since.
+**
+** graph_clustering(threads) returns (node_id, degree, triangles,
+** coefficient) per node, over the undirected simple view of the graph
+** (graph-triangle.c).
+**
+** graph_khop_approx(k, precision, threads) returns (node_id, reach,
+** error): HyperLogLog estimates of how many nodes each node reaches in
+** at most k hops (graph-hll.c).
+**
+** graph_vector_expand(vec_table, query, k, rel_types, hops, hop_cost,
+** direction) seeds a traversal with the k nearest neighbours of query in
+** a sqlite-vec vec0 table, whose rowids are node ids, and returns
+** (node_id, seed_id, distance, depth, score) for the nodes within hops
+** of a seed in ascending score = distance + hop_cost * depth. Rows are
+** produced best-first, so a LIMIT prunes the expansion to the top rows.
+**
+** graph_ppr(seeds, alpha, epsilon, top_k) returns (node_id, score): the
+** top_k nodes by personalized PageRank from seeds, a node id or a list
+** of them, computed by forward push over the snapshot (graph-algo.c) so
+** that only the neighbourhood the seeds reach is explored.
+**
+** graph_label_propagation(), graph_louvain() and graph_ppr() run on the
+** projection picked with graph_use() when there is one.
+**
+** Memory allocation: cursors own their queue or stack and visited bitmap,
+** or their result arrays, allocated with sqlite3_malloc() and released on re-filter and close
 */
 
 #include "sqlite3ext.h"
@@ -15,9 +68,9 @@ extern const sqlite3_api_routines *sqlite3_api;
 #endif
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "graph.h"
-#include "graph-memory.h"
-#include "graph-vtab.h"
-#include "graph-memory.h"
+#include "graph-bitmap.h"
+#include "graph-csr.h"
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -26,450 +79,2361 @@ extern const sqlite3_api_routines *sqlite3_api;
 #define UNUSED(x) ((void)(x))
 #endif
 
+/* Columns; the last three are the hidden function arguments */
+#define TRAV_COL_NODE       0
+#define TRAV_COL_DEPTH      1
+#define TRAV_COL_PARENT     2
+#define TRAV_COL_POSITION   3
+#define TRAV_COL_GRAPH      4
+#define TRAV_COL_START      5
+#define TRAV_COL_MAXDEPTH   6
+
+/* idxNum bits: which arguments xBestIndex passed to xFilter */
+#define TRAV_ARG_GRAPH      0x01
+#define TRAV_ARG_START      0x02
+#define TRAV_ARG_MAXDEPTH   0x04
+
+#define TRAV_DFS  0
+#define TRAV_BFS  1
+
 /*
 ** Virtual table structure for graph traversal table-valued functions.
-** Subclass of sqlite3_vtab with traversal-specific data.
 */
 typedef struct GraphTraversalVtab GraphTraversalVtab;
 struct GraphTraversalVtab {
   sqlite3_vtab base;        /* Base class - must be first */
-  GraphVtab *pGraphVtab;    /* Pointer to source graph vtab */
-  int iTraversalType;       /* 0=DFS, 1=BFS */
+  sqlite3 *pDb;             /* Database connection */
+  int iTraversalType;       /* TRAV_DFS or TRAV_BFS */
 };
 
-/*
-** Cursor structure for graph traversal results.
-** Iterates through the result path from DFS/BFS.
-*/
-typedef struct GraphTraversalCursor GraphTraversalCursor;
-struct GraphTraversalCursor {
-  sqlite3_vtab_cursor base;  /* Base class - must be first */
-  char *zPath;               /* JSON array of node IDs */
-  sqlite3_int64 *aNodeIds;   /* Parsed array of node IDs */
-  int nNodes;                /* Number of nodes in path */
-  int iCurrentNode;          /* Current position in array */
+/* A node waiting in the BFS queue */
+typedef struct TravEntry TravEntry;
+struct TravEntry {
+  sqlite3_int64 iNode;      /* Node id */
+  sqlite3_int64 iParent;    /* Node it was reached from */
+  int iDepth;               /* Hops from the start node */
 };
 
-/* Forward declarations for DFS virtual table methods */
-static int graphDFSCreate(sqlite3*, void*, int, const char*const*, 
-                         sqlite3_vtab**, char**);
-static int graphDFSConnect(sqlite3*, void*, int, const char*const*,
-                          sqlite3_vtab**, char**);
-static int graphDFSBestIndex(sqlite3_vtab*, sqlite3_index_info*);
-static int graphDFSDisconnect(sqlite3_vtab*);
-static int graphDFSDestroy(sqlite3_vtab*);
-static int graphDFSOpen(sqlite3_vtab*, sqlite3_vtab_cursor**);
-static int graphDFSClose(sqlite3_vtab_cursor*);
-static int graphDFSFilter(sqlite3_vtab_cursor*, int, const char*, int,
-                         sqlite3_value**);
-static int graphDFSNext(sqlite3_vtab_cursor*);
-static int graphDFSEof(sqlite3_vtab_cursor*);
-static int graphDFSColumn(sqlite3_vtab_cursor*, sqlite3_context*, int);
-static int graphDFSRowid(sqlite3_vtab_cursor*, sqlite3_int64*);
-
-/*
-** Virtual table module for graph_dfs() table-valued function.
-** Implements depth-first search traversal.
+/*
+** A node on the DFS stack. Its neighbours are aNbr[iBase..iBase+nNbr-1]
+** of the cursor's shared neighbour array; iNext is the next one to try.
 */
-static sqlite3_module graphDFSModule = {
-  0,                      /* iVersion */
-  graphDFSCreate,         /* xCreate */
-  graphDFSConnect,        /* xConnect */
-  graphDFSBestIndex,      /* xBestIndex */
-  graphDFSDisconnect,     /* xDisconnect */
-  graphDFSDestroy,        /* xDestroy */
-  graphDFSOpen,           /* xOpen */
-  graphDFSClose,          /* xClose */
-  graphDFSFilter,         /* xFilter */
-  graphDFSNext,           /* xNext */
-  graphDFSEof,            /* xEof */
-  graphDFSColumn,         /* xColumn */
-  graphDFSRowid,          /* xRowid */
-  0,                      /* xUpdate */
-  0,                      /* xBegin */
-  0,                      /* xSync */
-  0,                      /* xCommit */
-  0,                      /* xRollback */
-  0,                      /* xFindFunction */
-  0,                      /* xRename */
-  0,                      /* xSavepoint */
-  0,                      /* xRelease */
-  0,                      /* xRollbackTo */
-  0,                      /* xShadowName */
-  0                       /* xIntegrity */
+typedef struct TravFrame TravFrame;
+struct TravFrame {
+  sqlite3_int64 iNode;      /* Node id */
+  int iDepth;               /* Hops from the start node */
+  int iBase;                /* First neighbour in GraphTraversalCursor.aNbr */
+  int nNbr;                 /* Number of neighbours */
+  int iNext;                /* Next neighbour to visit */
 };
 
 /*
-** Virtual table module for graph_bfs() table-valued function.
-** Implements breadth-first search traversal.
+** Cursor structure for graph traversal results. Holds the frontier
+** between rows: a FIFO queue for BFS, a stack of frames for DFS.
 */
-static sqlite3_module graphBFSModule = {
-  0,                      /* iVersion */
-  graphDFSCreate,         /* xCreate (reuse DFS create) */
-  graphDFSConnect,        /* xConnect (reuse DFS connect) */
-  graphDFSBestIndex,      /* xBestIndex (reuse DFS) */
-  graphDFSDisconnect,     /* xDisconnect (reuse DFS) */
-  graphDFSDestroy,        /* xDestroy (reuse DFS) */
-  graphDFSOpen,           /* xOpen (reuse DFS) */
-  graphDFSClose,          /* xClose (reuse DFS) */
-  graphDFSFilter,         /* xFilter (modified for BFS) */
-  graphDFSNext,           /* xNext (reuse DFS) */
-  graphDFSEof,            /* xEof (reuse DFS) */
-  graphDFSColumn,         /* xColumn (reuse DFS) */
-  graphDFSRowid,          /* xRowid (reuse DFS) */
-  0,                      /* xUpdate */
-  0,                      /* xBegin */
-  0,                      /* xSync */
-  0,                      /* xCommit */
-  0,                      /* xRollback */
-  0,                      /* xFindFunction */
-  0,                      /* xRename */
-  0,                      /* xSavepoint */
-  0,                      /* xRelease */
-  0,                      /* xRollbackTo */
-  0,                      /* xShadowName */
-  0                       /* xIntegrity */
+typedef struct GraphTraversalCursor GraphTraversalCursor;
+struct GraphTraversalCursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+
+  /* Arguments */
+  char *zGraph;              /* Graph name */
+  sqlite3_int64 iStart;      /* Start node id */
+  int nMaxDepth;             /* Depth limit, <0 for unlimited */
+
+  /* Neighbour source */
+  GraphConn *pConn;          /* Registry entry of the connection */
+  GraphVtab *pSrc;           /* Graph whose snapshot view pins, or NULL */
+  CSRView view;              /* Pinned snapshot, view.pCSR NULL for SQL */
+  sqlite3_stmt *pNbrStmt;    /* Out-neighbours of ?1, NULL for projections */
+
+  /* Traversal state */
+  GraphBitmap *pVisited;     /* Nodes already emitted or queued */
+  TravEntry *aQueue;         /* BFS: queued nodes, head at iHead */
+  int nQueue, nQueueAlloc, iHead;
+  TravFrame *aFrame;         /* DFS: stack of partly explored nodes */
+  int nFrame, nFrameAlloc;
+  sqlite3_int64 *aNbr;       /* DFS frames' neighbours; BFS scratch */
+  int nNbr, nNbrAlloc;
+
+  /* Current row */
+  sqlite3_int64 iNode;       /* node_id */
+  sqlite3_int64 iParent;     /* parent_id, valid if bHasParent */
+  int bHasParent;            /* False for the start node */
+  int iDepth;                /* depth */
+  sqlite3_int64 iPosition;   /* position: rows emitted before this one */
+  int bEof;                  /* No current row */
 };
 
 /*
-** Create virtual table for graph traversal.
-** Schema: CREATE TABLE x(node_id INTEGER, depth INTEGER, position INTEGER)
+** Connect to the eponymous traversal table. pAux selects BFS.
 */
-static int graphDFSCreate(sqlite3 *pDb, void *pAux, int argc,
-                         const char *const *argv, sqlite3_vtab **ppVtab,
-                         char **pzErr){
+static int graphTravConnect(sqlite3 *pDb, void *pAux, int argc,
+                            const char *const *argv, sqlite3_vtab **ppVtab,
+                            char **pzErr){
   GraphTraversalVtab *pNew;
   int rc;
-  
-  /* Suppress unused parameter warnings */
-  UNUSED(pAux);
+
   UNUSED(argc);
   UNUSED(argv);
   UNUSED(pzErr);
-  
-  /* Allocate virtual table structure */
-  pNew = sqlite3_malloc(sizeof(*pNew));
-  if( pNew==0 ){
-    return SQLITE_NOMEM;
-  }
-  memset(pNew, 0, sizeof(*pNew));
-  
-  /* Declare schema for traversal results */
+
   rc = sqlite3_declare_vtab(pDb, "CREATE TABLE x("
                                 "node_id INTEGER,"
                                 "depth INTEGER,"
-                                "position INTEGER"
+                                "parent_id INTEGER,"
+                                "position INTEGER,"
+                                "graph HIDDEN,"
+                                "start HIDDEN,"
+                                "max_depth HIDDEN"
                                 ")");
   if( rc!=SQLITE_OK ){
-    sqlite3_free(pNew);
     return rc;
   }
-  
-  /* Set traversal type based on module */
-  pNew->iTraversalType = (pAux!=0) ? 1 : 0;  /* 0=DFS, 1=BFS */
-  
+
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->pDb = pDb;
+  pNew->iTraversalType = (pAux!=0) ? TRAV_BFS : TRAV_DFS;
+
   *ppVtab = &pNew->base;
   return SQLITE_OK;
 }
 
 /*
-** Connect to existing traversal virtual table.
-*/
-static int graphDFSConnect(sqlite3 *pDb, void *pAux, int argc,
-                          const char *const *argv, sqlite3_vtab **ppVtab,
-                          char **pzErr){
-  return graphDFSCreate(pDb, pAux, argc, argv, ppVtab, pzErr);
-}
-
-/*
-** Query planner for traversal functions.
-** Expects arguments: start_node_id, max_depth (optional)
+** Query planner for traversal functions. graph and start must be bound
+** by equality; max_depth is optional. A plan that cannot supply the two
+** required arguments is rejected with SQLITE_CONSTRAINT so that SQLite
+** picks a join order that does.
 */
-static int graphDFSBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo){
-  int iStartNodeArg = -1;
-  int iMaxDepthArg = -1;
+static int graphTravBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo){
+  int aArg[3] = { -1, -1, -1 };   /* Constraint index per hidden column */
+  int idxNum = 0;
+  int nArg = 0;
   int i;
-  
-  /* Suppress unused parameter warnings */
+
   UNUSED(pVtab);
-  
-  /* Look for start_node_id and max_depth constraints */
+
   for( i=0; i<pInfo->nConstraint; i++ ){
-    if( pInfo->aConstraint[i].iColumn==-1 &&  /* Hidden column */
-        pInfo->aConstraint[i].usable ){
-      if( iStartNodeArg<0 ){
-        iStartNodeArg = i;
-      } else if( iMaxDepthArg<0 ){
-        iMaxDepthArg = i;
-      }
-    }
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    int iArg = pCons->iColumn - TRAV_COL_GRAPH;
+    if( iArg<0 || pCons->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !pCons->usable ) continue;
+    aArg[iArg] = i;
+    idxNum |= 1<<iArg;
   }
-  
-  /* Start node is required */
-  if( iStartNodeArg<0 ){
+
+  if( (idxNum & (TRAV_ARG_GRAPH|TRAV_ARG_START))!=(TRAV_ARG_GRAPH|TRAV_ARG_START) ){
     return SQLITE_CONSTRAINT;
   }
-  
-  /* Set argument indices */
-  pInfo->aConstraintUsage[iStartNodeArg].argvIndex = 1;
-  pInfo->aConstraintUsage[iStartNodeArg].omit = 1;
-  
-  if( iMaxDepthArg>=0 ){
-    pInfo->aConstraintUsage[iMaxDepthArg].argvIndex = 2;
-    pInfo->aConstraintUsage[iMaxDepthArg].omit = 1;
+  for( i=0; i<3; i++ ){
+    if( aArg[i]<0 ) continue;
+    pInfo->aConstraintUsage[aArg[i]].argvIndex = ++nArg;
+    pInfo->aConstraintUsage[aArg[i]].omit = 1;
   }
-  
+
+  pInfo->idxNum = idxNum;
   pInfo->estimatedCost = 100.0;
   pInfo->estimatedRows = 100;
-  
   return SQLITE_OK;
 }
 
 /*
 ** Disconnect from traversal virtual table.
 */
-static int graphDFSDisconnect(sqlite3_vtab *pVtab){
-  GraphTraversalVtab *pTrav = (GraphTraversalVtab*)pVtab;
-  sqlite3_free(pTrav);
+static int graphTravDisconnect(sqlite3_vtab *pVtab){
+  sqlite3_free(pVtab);
   return SQLITE_OK;
 }
 
-/*
-** Destroy traversal virtual table.
-*/
-static int graphDFSDestroy(sqlite3_vtab *pVtab){
-  return graphDFSDisconnect(pVtab);
-}
-
 /*
 ** Open cursor for traversal results.
 */
-static int graphDFSOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+static int graphTravOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
   GraphTraversalCursor *pCur;
-  
-  /* Suppress unused parameter warnings */
+
   UNUSED(pVtab);
-  
+
   pCur = sqlite3_malloc(sizeof(*pCur));
   if( pCur==0 ){
     return SQLITE_NOMEM;
   }
   memset(pCur, 0, sizeof(*pCur));
-  
+  pCur->bEof = 1;
+
   *ppCursor = &pCur->base;
   return SQLITE_OK;
 }
 
+/*
+** Release everything a previous xFilter set up.
+*/
+static void graphTravReset(GraphTraversalCursor *pCur){
+  graphCSRViewClose(&pCur->view);
+  sqlite3_free(pCur->zGraph);
+  sqlite3_finalize(pCur->pNbrStmt);
+  graphBitmapFree(pCur->pVisited);
+  sqlite3_free(pCur->aQueue);
+  sqlite3_free(pCur->aFrame);
+  sqlite3_free(pCur->aNbr);
+  memset(&pCur->zGraph, 0,
+         sizeof(*pCur) - offsetof(GraphTraversalCursor, zGraph));
+  pCur->bEof = 1;
+}
+
 /*
 ** Close traversal cursor.
 */
-static int graphDFSClose(sqlite3_vtab_cursor *pCursor){
+static int graphTravClose(sqlite3_vtab_cursor *pCursor){
   GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
-  sqlite3_free(pCur->zPath);
-  sqlite3_free(pCur->aNodeIds);
+  graphTravReset(pCur);
   sqlite3_free(pCur);
   return SQLITE_OK;
 }
 
 /*
-** Parse JSON path array into node ID array.
-** Format: "[1,2,3,4]" -> array of sqlite3_int64
+** The view pinned at xFilter stays usable only while the graph is still
+** at that version; a write from the enclosing statement switches the
+** cursor to SQL lookups for the rest of the traversal. A projection's
+** view (pSrc NULL) never goes stale.
 */
-static int parseTraversalPath(const char *zPath, sqlite3_int64 **paNodeIds,
-                             int *pnNodes){
-  sqlite3_int64 *aIds = 0;
-  int nAlloc = 0;
-  int nUsed = 0;
-  const char *p;
-  sqlite3_int64 iNodeId;
-  char *zEnd;
-  
-  if( zPath==0 || zPath[0]!='[' ){
-    return SQLITE_ERROR;
+static const CSRView *graphTravSnapshot(GraphTraversalCursor *pCur){
+  if( pCur->view.pCSR && pCur->pSrc
+   && (graphConnFind(pCur->pConn, pCur->zGraph)!=pCur->pSrc
+       || !graphCSRViewIsCurrent(pCur->pSrc, &pCur->view)) ){
+    graphCSRViewClose(&pCur->view);
   }
-  
-  p = zPath + 1;  /* Skip opening bracket */
-  
-  while( *p && *p!=']' ){
-    /* Skip whitespace and commas */
-    while( *p && (*p==' ' || *p==',') ) p++;
-    if( *p==']' ) break;
-    
-    /* Parse node ID */
-    iNodeId = strtoll(p, &zEnd, 10);
-    if( p==zEnd ){
-      sqlite3_free(aIds);
-      return SQLITE_ERROR;
+  return pCur->view.pCSR ? &pCur->view : 0;
+}
+
+/*
+** Append the out-neighbours of iNode to pCur->aNbr.
+*/
+static int graphTravNeighbors(GraphTraversalCursor *pCur, sqlite3_int64 iNode){
+  const CSRView *pView = graphTravSnapshot(pCur);
+  int rc = SQLITE_OK;
+
+  if( pView ){
+    CSREdgeIter it;
+    int iNbr;
+    graphCSREdgeFirst(pView, graphCSRViewIndexOf(pView, iNode), 0, &it);
+    while( graphCSREdgeNext(&it, &iNbr, 0) ){
+      if( pCur->nNbr>=pCur->nNbrAlloc ){
+        int nNew = pCur->nNbrAlloc ? pCur->nNbrAlloc*2 : 64;
+        sqlite3_int64 *aNew = sqlite3_realloc64(pCur->aNbr,
+                                                nNew*sizeof(sqlite3_int64));
+        if( aNew==0 ) return SQLITE_NOMEM;
+        pCur->aNbr = aNew;
+        pCur->nNbrAlloc = nNew;
+      }
+      pCur->aNbr[pCur->nNbr++] = graphCSRViewNodeId(pView, iNbr);
     }
-    p = zEnd;
-    
-    /* Grow array if needed */
-    if( nUsed>=nAlloc ){
-      sqlite3_int64 *aNew;
-      nAlloc = nAlloc ? nAlloc*2 : 16;
-      aNew = sqlite3_realloc(aIds, nAlloc * sizeof(sqlite3_int64));
+    return SQLITE_OK;
+  }
+
+  sqlite3_bind_int64(pCur->pNbrStmt, 1, iNode);
+  while( sqlite3_step(pCur->pNbrStmt)==SQLITE_ROW ){
+    if( pCur->nNbr>=pCur->nNbrAlloc ){
+      int nNew = pCur->nNbrAlloc ? pCur->nNbrAlloc*2 : 64;
+      sqlite3_int64 *aNew = sqlite3_realloc64(pCur->aNbr,
+                                              nNew*sizeof(sqlite3_int64));
       if( aNew==0 ){
-        sqlite3_free(aIds);
-        return SQLITE_NOMEM;
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      pCur->aNbr = aNew;
+      pCur->nNbrAlloc = nNew;
+    }
+    pCur->aNbr[pCur->nNbr++] = sqlite3_column_int64(pCur->pNbrStmt, 0);
+  }
+  if( sqlite3_reset(pCur->pNbrStmt)!=SQLITE_OK && rc==SQLITE_OK ){
+    rc = sqlite3_errcode(sqlite3_db_handle(pCur->pNbrStmt));
+  }
+  return rc;
+}
+
+/*
+** BFS step: queue the unvisited neighbours of the current row, then make
+** the queue head the current row.
+*/
+static int graphTravNextBFS(GraphTraversalCursor *pCur){
+  int rc, i;
+
+  if( pCur->nMaxDepth<0 || pCur->iDepth<pCur->nMaxDepth ){
+    pCur->nNbr = 0;
+    rc = graphTravNeighbors(pCur, pCur->iNode);
+    if( rc!=SQLITE_OK ) return rc;
+
+    /* Drop the consumed half of the queue before growing it */
+    if( pCur->iHead>0 && pCur->iHead>=pCur->nQueue/2 ){
+      memmove(pCur->aQueue, &pCur->aQueue[pCur->iHead],
+              (pCur->nQueue - pCur->iHead)*sizeof(TravEntry));
+      pCur->nQueue -= pCur->iHead;
+      pCur->iHead = 0;
+    }
+
+    for( i=0; i<pCur->nNbr; i++ ){
+      sqlite3_int64 iNbr = pCur->aNbr[i];
+      TravEntry *pEntry;
+      if( graphBitmapContains(pCur->pVisited, iNbr) ) continue;
+      rc = graphBitmapAdd(pCur->pVisited, iNbr);
+      if( rc!=SQLITE_OK ) return rc;
+      if( pCur->nQueue>=pCur->nQueueAlloc ){
+        int nNew = pCur->nQueueAlloc ? pCur->nQueueAlloc*2 : 64;
+        TravEntry *aNew = sqlite3_realloc64(pCur->aQueue,
+                                            nNew*sizeof(TravEntry));
+        if( aNew==0 ) return SQLITE_NOMEM;
+        pCur->aQueue = aNew;
+        pCur->nQueueAlloc = nNew;
       }
-      aIds = aNew;
+      pEntry = &pCur->aQueue[pCur->nQueue++];
+      pEntry->iNode = iNbr;
+      pEntry->iParent = pCur->iNode;
+      pEntry->iDepth = pCur->iDepth + 1;
     }
-    
-    /* Add node ID to array */
-    aIds[nUsed++] = iNodeId;
   }
-  
-  *paNodeIds = aIds;
-  *pnNodes = nUsed;
+
+  if( pCur->iHead>=pCur->nQueue ){
+    pCur->bEof = 1;
+    return SQLITE_OK;
+  }
+  pCur->iNode = pCur->aQueue[pCur->iHead].iNode;
+  pCur->iParent = pCur->aQueue[pCur->iHead].iParent;
+  pCur->iDepth = pCur->aQueue[pCur->iHead].iDepth;
+  pCur->bHasParent = 1;
+  pCur->iHead++;
   return SQLITE_OK;
 }
 
 /*
-** Filter traversal results based on arguments.
-** Arguments: start_node_id, max_depth (optional)
+** DFS step: push the current row with its neighbours, then descend into
+** the first unvisited neighbour of the deepest frame that has one,
+** popping exhausted frames on the way.
 */
-static int graphDFSFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
-                         const char *idxStr, int argc, sqlite3_value **argv){
-  GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
-  GraphTraversalVtab *pVtab = (GraphTraversalVtab*)pCursor->pVtab;
-  sqlite3_int64 iStartId;
-  int nMaxDepth = -1;
+static int graphTravNextDFS(GraphTraversalCursor *pCur){
   int rc;
-  
-  /* Suppress unused parameter warnings */
-  UNUSED(idxNum);
-  UNUSED(idxStr);
-  
-  /* Free previous results */
-  sqlite3_free(pCur->zPath);
-  sqlite3_free(pCur->aNodeIds);
-  pCur->zPath = 0;
-  pCur->aNodeIds = 0;
-  pCur->nNodes = 0;
-  pCur->iCurrentNode = 0;
-  
-  /* Get arguments */
-  if( argc<1 ){
-    return SQLITE_ERROR;
+
+  if( pCur->nMaxDepth<0 || pCur->iDepth<pCur->nMaxDepth ){
+    TravFrame *pFrame;
+    int iBase = pCur->nNbr;
+    rc = graphTravNeighbors(pCur, pCur->iNode);
+    if( rc!=SQLITE_OK ) return rc;
+    if( pCur->nFrame>=pCur->nFrameAlloc ){
+      int nNew = pCur->nFrameAlloc ? pCur->nFrameAlloc*2 : 32;
+      TravFrame *aNew = sqlite3_realloc64(pCur->aFrame,
+                                          nNew*sizeof(TravFrame));
+      if( aNew==0 ) return SQLITE_NOMEM;
+      pCur->aFrame = aNew;
+      pCur->nFrameAlloc = nNew;
+    }
+    pFrame = &pCur->aFrame[pCur->nFrame++];
+    pFrame->iNode = pCur->iNode;
+    pFrame->iDepth = pCur->iDepth;
+    pFrame->iBase = iBase;
+    pFrame->nNbr = pCur->nNbr - iBase;
+    pFrame->iNext = 0;
   }
-  
-  iStartId = sqlite3_value_int64(argv[0]);
-  if( argc>=2 ){
-    nMaxDepth = sqlite3_value_int(argv[1]);
-  }
-  
-  /* Suppress unused variable warning for nMaxDepth - used in future implementation */
-  UNUSED(nMaxDepth);
-  
-  /* Graph traversal requires a graph table instance */
-  /* For now, return error since we don't have a graph reference */
-  /* In a future implementation, this would look up the graph by name */
-  return SQLITE_ERROR;
-  
-  /* Perform traversal (DFS or BFS based on vtab type) */
-  if( pVtab->iTraversalType==0 ){
-    /* DFS traversal */
-    /* Cannot perform traversal without graph instance */
-    /* Return single-node path as minimal valid result */
-    pCur->zPath = sqlite3_mprintf("[%lld]", iStartId);
-  } else {
-    /* BFS traversal */
-    /* Cannot perform traversal without graph instance */
-    /* Return single-node path as minimal valid result */
-    pCur->zPath = sqlite3_mprintf("[%lld]", iStartId);
-  }
-  
-  if( pCur->zPath==0 ){
-    return SQLITE_NOMEM;
+
+  while( pCur->nFrame>0 ){
+    TravFrame *pFrame = &pCur->aFrame[pCur->nFrame-1];
+    while( pFrame->iNext<pFrame->nNbr ){
+      sqlite3_int64 iNbr = pCur->aNbr[pFrame->iBase + pFrame->iNext++];
+      if( graphBitmapContains(pCur->pVisited, iNbr) ) continue;
+      rc = graphBitmapAdd(pCur->pVisited, iNbr);
+      if( rc!=SQLITE_OK ) return rc;
+      pCur->iNode = iNbr;
+      pCur->iParent = pFrame->iNode;
+      pCur->iDepth = pFrame->iDepth + 1;
+      pCur->bHasParent = 1;
+      return SQLITE_OK;
+    }
+    pCur->nNbr = pFrame->iBase;
+    pCur->nFrame--;
   }
-  
-  /* Parse path into node array */
-  rc = parseTraversalPath(pCur->zPath, &pCur->aNodeIds, &pCur->nNodes);
+  pCur->bEof = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Move to the next node of the traversal.
+*/
+static int graphTravNext(sqlite3_vtab_cursor *pCursor){
+  GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
+  GraphTraversalVtab *pVtab = (GraphTraversalVtab*)pCursor->pVtab;
+  int rc;
+
+  if( pCur->bEof ) return SQLITE_OK;
+  rc = pVtab->iTraversalType==TRAV_BFS ? graphTravNextBFS(pCur)
+                                       : graphTravNextDFS(pCur);
   if( rc!=SQLITE_OK ){
-    sqlite3_free(pCur->zPath);
-    pCur->zPath = 0;
+    pCur->bEof = 1;
     return rc;
   }
-  
-  pCur->iCurrentNode = 0;
+  pCur->iPosition++;
   return SQLITE_OK;
 }
 
 /*
-** Move to next node in traversal result.
+** Start a traversal. Arguments, in the order xBestIndex numbered them:
+** graph name, start node id, optional max depth.
 */
-static int graphDFSNext(sqlite3_vtab_cursor *pCursor){
+static int graphTravFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                           const char *idxStr, int argc, sqlite3_value **argv){
   GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
-  pCur->iCurrentNode++;
+  GraphTraversalVtab *pVtab = (GraphTraversalVtab*)pCursor->pVtab;
+  GraphVtab *pGraph;
+  const char *zGraph;
+  const char *zNodes = 0, *zEdges = 0;
+  char *zSql;
+  int bExists = 0;
+  int rc;
+
+  UNUSED(idxStr);
+  graphTravReset(pCur);
+
+  if( argc<2 || (idxNum & (TRAV_ARG_GRAPH|TRAV_ARG_START))!=(TRAV_ARG_GRAPH|TRAV_ARG_START) ){
+    return SQLITE_ERROR;
+  }
+  zGraph = (const char*)sqlite3_value_text(argv[0]);
+  if( zGraph==0 || sqlite3_value_type(argv[1])==SQLITE_NULL ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf(
+        "usage: %s(graph, start [, max_depth])",
+        pVtab->iTraversalType==TRAV_BFS ? "graph_bfs" : "graph_dfs");
+    return SQLITE_ERROR;
+  }
+  pCur->zGraph = sqlite3_mprintf("%s", zGraph);
+  if( pCur->zGraph==0 ) return SQLITE_NOMEM;
+  pCur->iStart = sqlite3_value_int64(argv[1]);
+  pCur->nMaxDepth = -1;
+  if( (idxNum & TRAV_ARG_MAXDEPTH) && argc>2
+   && sqlite3_value_type(argv[2])!=SQLITE_NULL ){
+    pCur->nMaxDepth = sqlite3_value_int(argv[2]);
+  }
+
+  /* A projection (graph_project()) is read from its snapshot only */
+  pCur->pConn = graphRegistryConn(pVtab->pDb);
+  if( graphProjectionView(pVtab->pDb, zGraph, &pCur->view) ){
+    pGraph = 0;
+  }else{
+    /* Use the snapshot of the named graph if it is already current */
+    pGraph = graphRegistryFind(pVtab->pDb, zGraph);
+    if( pGraph ){
+      zNodes = pGraph->zNodeTableName;
+      zEdges = pGraph->zEdgeTableName;
+      if( graphCSRIsCurrent(pGraph)
+       && graphCSRViewOpen(pGraph, &pCur->view)==SQLITE_OK ){
+        pCur->pSrc = pGraph;
+      }
+    }
+    if( zNodes ){
+      zSql = sqlite3_mprintf(
+          "SELECT e.target FROM \"%w\" e JOIN \"%w\" n ON n.id = e.target"
+          " WHERE e.source = ?1", zEdges, zNodes);
+    }else{
+      zSql = sqlite3_mprintf(
+          "SELECT e.target FROM \"%w_edges\" e JOIN \"%w_nodes\" n"
+          " ON n.id = e.target WHERE e.source = ?1",
+          zGraph, zGraph);
+    }
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pCur->pNbrStmt, 0);
+    sqlite3_free(zSql);
+    if( rc!=SQLITE_OK ){
+      sqlite3_free(pVtab->base.zErrMsg);
+      pVtab->base.zErrMsg = sqlite3_mprintf("no such graph: %s", zGraph);
+      return rc;
+    }
+  }
+
+  /* The start node must exist */
+  if( pCur->view.pCSR ){
+    bExists = graphCSRViewIndexOf(&pCur->view, pCur->iStart)>=0;
+  }else{
+    sqlite3_stmt *pStmt = 0;
+    zSql = zNodes ? sqlite3_mprintf("SELECT 1 FROM \"%w\" WHERE id = ?1", zNodes)
+                  : sqlite3_mprintf("SELECT 1 FROM \"%w_nodes\" WHERE id = ?1", zGraph);
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+    sqlite3_free(zSql);
+    if( rc!=SQLITE_OK ) return rc;
+    sqlite3_bind_int64(pStmt, 1, pCur->iStart);
+    bExists = sqlite3_step(pStmt)==SQLITE_ROW;
+    rc = sqlite3_finalize(pStmt);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  if( !bExists ) return SQLITE_OK;
+
+  pCur->pVisited = graphBitmapCreate();
+  if( pCur->pVisited==0 ) return SQLITE_NOMEM;
+  rc = graphBitmapAdd(pCur->pVisited, pCur->iStart);
+  if( rc!=SQLITE_OK ) return rc;
+
+  pCur->iNode = pCur->iStart;
+  pCur->iDepth = 0;
+  pCur->bHasParent = 0;
+  pCur->iPosition = 0;
+  pCur->bEof = 0;
   return SQLITE_OK;
 }
 
 /*
 ** Check if at end of traversal results.
 */
-static int graphDFSEof(sqlite3_vtab_cursor *pCursor){
-  GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
-  return pCur->iCurrentNode >= pCur->nNodes;
+static int graphTravEof(sqlite3_vtab_cursor *pCursor){
+  return ((GraphTraversalCursor*)pCursor)->bEof;
 }
 
 /*
-** Return column value for current node.
-** Columns: node_id, depth, position
+** Return column value for the current node.
 */
-static int graphDFSColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx,
-                         int iCol){
+static int graphTravColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx,
+                           int iCol){
   GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
-  
-  if( pCur->iCurrentNode >= pCur->nNodes ){
-    return SQLITE_ERROR;
-  }
-  
+
   switch( iCol ){
-    case 0:  /* node_id */
-      sqlite3_result_int64(pCtx, pCur->aNodeIds[pCur->iCurrentNode]);
+    case TRAV_COL_NODE:
+      sqlite3_result_int64(pCtx, pCur->iNode);
+      break;
+    case TRAV_COL_DEPTH:
+      sqlite3_result_int(pCtx, pCur->iDepth);
+      break;
+    case TRAV_COL_PARENT:
+      if( pCur->bHasParent ) sqlite3_result_int64(pCtx, pCur->iParent);
+      break;
+    case TRAV_COL_POSITION:
+      sqlite3_result_int64(pCtx, pCur->iPosition);
+      break;
+    case TRAV_COL_GRAPH:
+      sqlite3_result_text(pCtx, pCur->zGraph, -1, SQLITE_TRANSIENT);
       break;
-    case 1:  /* depth */
-      /* Depth tracking requires actual traversal implementation */
-      /* For single-node result, depth is always 0 */
-      sqlite3_result_int(pCtx, 0);
+    case TRAV_COL_START:
+      sqlite3_result_int64(pCtx, pCur->iStart);
       break;
-    case 2:  /* position */
-      sqlite3_result_int(pCtx, pCur->iCurrentNode);
+    case TRAV_COL_MAXDEPTH:
+      if( pCur->nMaxDepth>=0 ) sqlite3_result_int(pCtx, pCur->nMaxDepth);
       break;
     default:
       return SQLITE_ERROR;
   }
-  
   return SQLITE_OK;
 }
 
 /*
 ** Return rowid for current position.
 */
-static int graphDFSRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid){
-  GraphTraversalCursor *pCur = (GraphTraversalCursor*)pCursor;
-  *pRowid = pCur->iCurrentNode;
+static int graphTravRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid){
+  *pRowid = ((GraphTraversalCursor*)pCursor)->iPosition;
   return SQLITE_OK;
 }
 
 /*
-** Register table-valued functions with SQLite.
-** Called from main extension init function.
+** Eponymous-only modules: xCreate is NULL, so graph_dfs and graph_bfs
+** are usable as table-valued functions without CREATE VIRTUAL TABLE.
+** The two share every method; xConnect reads the traversal order from
+** the module's pAux.
 */
-int graphRegisterTVF(sqlite3 *pDb){
+static sqlite3_module graphDFSModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  graphTravConnect,       /* xConnect */
+  graphTravBestIndex,     /* xBestIndex */
+  graphTravDisconnect,    /* xDisconnect */
+  0,                      /* xDestroy */
+  graphTravOpen,          /* xOpen */
+  graphTravClose,         /* xClose */
+  graphTravFilter,        /* xFilter */
+  graphTravNext,          /* xNext */
+  graphTravEof,           /* xEof */
+  graphTravColumn,        /* xColumn */
+  graphTravRowid,         /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+/* Community function columns; the last two are the hidden arguments */
+#define COMM_COL_NODE       0
+#define COMM_COL_COMMUNITY  1
+#define COMM_COL_PARAM      2   /* max_iter, resolution or incremental */
+#define COMM_COL_THREADS    3
+
+/* idxNum bits: which arguments xBestIndex passed to xFilter */
+#define COMM_ARG_PARAM      0x01
+#define COMM_ARG_THREADS    0x02
+
+#define COMM_LABEL_PROPAGATION  0
+#define COMM_LOUVAIN            1
+#define COMM_COMPONENTS         2
+
+/* Module pAux per algorithm, indexed by COMM_* */
+static int aCommAlgorithm[] = {
+  COMM_LABEL_PROPAGATION, COMM_LOUVAIN, COMM_COMPONENTS
+};
+
+/* Defaults for omitted arguments */
+#define COMM_DEFAULT_MAX_ITER   20
+#define COMM_DEFAULT_RESOLUTION 1.0
+
+/*
+** Virtual table structure for the community detection functions.
+*/
+typedef struct GraphCommunityVtab GraphCommunityVtab;
+struct GraphCommunityVtab {
+  sqlite3_vtab base;        /* Base class - must be first */
+  sqlite3 *pDb;             /* Database connection */
+  int eAlgorithm;           /* COMM_* */
+};
+
+/*
+** Cursor over a finished community assignment. xFilter runs the whole
+** algorithm; rows then stream out of the two result arrays, or for
+** graph_components() straight out of the union-find forest and the
+** view it was found on.
+*/
+typedef struct GraphCommunityCursor GraphCommunityCursor;
+struct GraphCommunityCursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+  sqlite3_int64 *aNode;      /* Node ids, ascending */
+  sqlite3_int64 *aCommunity; /* Smallest member id of each node's community */
+  GraphComponents *pComp;    /* graph_components() forest, referenced */
+  CSRView view;              /* Adjacency pComp describes, pinned */
+  int nNode;
+  int iRow;                  /* Current row, nNode at EOF */
+  int nMaxIter;              /* Label propagation round limit */
+  double rResolution;        /* Louvain resolution */
+  int bIncremental;          /* graph_components() incremental mode */
+  int nThreads;
+};
+
+/*
+** Connect to an eponymous community table. pAux points at the COMM_*
+** algorithm.
+*/
+static int graphCommConnect(sqlite3 *pDb, void *pAux, int argc,
+                            const char *const *argv, sqlite3_vtab **ppVtab,
+                            char **pzErr){
+  GraphCommunityVtab *pNew;
   int rc;
-  
-  /* Register graph_dfs() table-valued function */
-  rc = sqlite3_create_module(pDb, "graph_dfs", &graphDFSModule, 0);
+
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(pzErr);
+
+  static const char *const azSchema[] = {
+    "CREATE TABLE x(node_id INTEGER, community_id INTEGER,"
+    " max_iter HIDDEN, threads HIDDEN)",
+    "CREATE TABLE x(node_id INTEGER, community_id INTEGER,"
+    " resolution HIDDEN, threads HIDDEN)",
+    "CREATE TABLE x(node_id INTEGER, component_id INTEGER,"
+    " incremental HIDDEN, threads HIDDEN)"
+  };
+  int eAlgorithm = *(int*)pAux;
+
+  rc = sqlite3_declare_vtab(pDb, azSchema[eAlgorithm]);
   if( rc!=SQLITE_OK ){
     return rc;
   }
-  
-  /* Register graph_bfs() table-valued function */
-  rc = sqlite3_create_module(pDb, "graph_bfs", &graphBFSModule, (void*)1);
-  if( rc!=SQLITE_OK ){
-    return rc;
+
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->pDb = pDb;
+  pNew->eAlgorithm = eAlgorithm;
+
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+/*
+** Query planner for community functions. Both arguments are optional
+** and taken by equality only; every plan scans the whole graph.
+*/
+static int graphCommBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo){
+  int aArg[2] = { -1, -1 };       /* Constraint index per hidden column */
+  int idxNum = 0;
+  int nArg = 0;
+  int i;
+
+  UNUSED(pVtab);
+
+  for( i=0; i<pInfo->nConstraint; i++ ){
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    int iArg = pCons->iColumn - COMM_COL_PARAM;
+    if( iArg<0 || pCons->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !pCons->usable ) continue;
+    aArg[iArg] = i;
+    idxNum |= 1<<iArg;
+  }
+  for( i=0; i<2; i++ ){
+    if( aArg[i]<0 ) continue;
+    pInfo->aConstraintUsage[aArg[i]].argvIndex = ++nArg;
+    pInfo->aConstraintUsage[aArg[i]].omit = 1;
+  }
+
+  pInfo->idxNum = idxNum;
+  pInfo->estimatedCost = 1000000.0;
+  pInfo->estimatedRows = 10000;
+  return SQLITE_OK;
+}
+
+/*
+** Open cursor for community results.
+*/
+static int graphCommOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  GraphCommunityCursor *pCur;
+
+  UNUSED(pVtab);
+
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( pCur==0 ){
+    return SQLITE_NOMEM;
   }
-  
+  memset(pCur, 0, sizeof(*pCur));
+
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+/*
+** Close community cursor.
+*/
+static int graphCommClose(sqlite3_vtab_cursor *pCursor){
+  GraphCommunityCursor *pCur = (GraphCommunityCursor*)pCursor;
+  sqlite3_free(pCur->aNode);
+  sqlite3_free(pCur->aCommunity);
+  graphComponentsRelease(pCur->pComp);
+  graphCSRViewClose(&pCur->view);
+  sqlite3_free(pCur);
   return SQLITE_OK;
-}
\ No newline at end of file
+}
+
+/*
+** Run the algorithm on the current graph. Arguments, in the order
+** xBestIndex numbered them: max_iter, resolution or incremental, then
+** threads.
+*/
+static int graphCommFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                           const char *idxStr, int argc, sqlite3_value **argv){
+  GraphCommunityCursor *pCur = (GraphCommunityCursor*)pCursor;
+  GraphCommunityVtab *pVtab = (GraphCommunityVtab*)pCursor->pVtab;
+  GraphVtab *pGraph = graphRegistryFind(pVtab->pDb, 0);
+  CSRView proj;
+  const char *zErr = 0;
+  int iArg = 0;
+  int rc;
+
+  UNUSED(idxStr);
+  sqlite3_free(pCur->aNode);
+  sqlite3_free(pCur->aCommunity);
+  graphComponentsRelease(pCur->pComp);
+  graphCSRViewClose(&pCur->view);
+  pCur->aNode = 0;
+  pCur->aCommunity = 0;
+  pCur->pComp = 0;
+  pCur->nNode = 0;
+  pCur->iRow = 0;
+
+  pCur->nMaxIter = COMM_DEFAULT_MAX_ITER;
+  pCur->rResolution = COMM_DEFAULT_RESOLUTION;
+  pCur->bIncremental = 0;
+  pCur->nThreads = 1;
+  if( (idxNum & COMM_ARG_PARAM) && iArg<argc ){
+    sqlite3_value *pVal = argv[iArg++];
+    if( sqlite3_value_type(pVal)!=SQLITE_NULL ){
+      if( pVtab->eAlgorithm==COMM_COMPONENTS ){
+        pCur->bIncremental = sqlite3_value_int(pVal)!=0;
+      }else if( pVtab->eAlgorithm==COMM_LOUVAIN ){
+        pCur->rResolution = sqlite3_value_double(pVal);
+        if( !(pCur->rResolution>0.0) ) zErr = "Resolution must be positive";
+      }else{
+        pCur->nMaxIter = sqlite3_value_int(pVal);
+        if( pCur->nMaxIter<=0 ) zErr = "Max iterations must be positive";
+      }
+    }
+  }
+  if( (idxNum & COMM_ARG_THREADS) && iArg<argc ){
+    sqlite3_value *pVal = argv[iArg++];
+    if( sqlite3_value_type(pVal)!=SQLITE_NULL ){
+      pCur->nThreads = sqlite3_value_int(pVal);
+      if( pCur->nThreads<0 ) zErr = "Thread count must not be negative";
+    }
+  }
+  if( zErr==0 && pGraph==0 ){
+    zErr = "No graph table available. Create a graph table first using: "
+           "CREATE VIRTUAL TABLE mygraph USING graph();";
+  }
+  if( zErr ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", zErr);
+    return SQLITE_ERROR;
+  }
+
+  /* Louvain and label propagation run on the projection graph_use() picked */
+  if( pVtab->eAlgorithm!=COMM_COMPONENTS
+   && graphProjectionView(pVtab->pDb, 0, &proj) ){
+    if( pVtab->eAlgorithm==COMM_LOUVAIN ){
+      rc = graphLouvainCSR(proj.pCSR, pCur->rResolution, pCur->nThreads,
+                           &pCur->aNode, &pCur->aCommunity, &pCur->nNode);
+    }else{
+      rc = graphLabelPropagationCSR(proj.pCSR, pCur->nMaxIter, pCur->nThreads,
+                                    &pCur->aNode, &pCur->aCommunity,
+                                    &pCur->nNode);
+    }
+    graphCSRViewClose(&proj);
+    return rc;
+  }
+
+  if( pVtab->eAlgorithm==COMM_COMPONENTS ){
+    rc = graphComponents(pGraph, pCur->bIncremental, pCur->nThreads,
+                         &pCur->view, &pCur->pComp);
+    if( rc==SQLITE_OK ) pCur->nNode = pCur->pComp->nNode;
+  }else if( pVtab->eAlgorithm==COMM_LOUVAIN ){
+    rc = graphLouvain(pGraph, pCur->rResolution, pCur->nThreads,
+                      &pCur->aNode, &pCur->aCommunity, &pCur->nNode);
+  }else{
+    rc = graphLabelPropagation(pGraph, pCur->nMaxIter, pCur->nThreads,
+                               &pCur->aNode, &pCur->aCommunity, &pCur->nNode);
+  }
+  return rc;
+}
+
+/*
+** Advance to the next node.
+*/
+static int graphCommNext(sqlite3_vtab_cursor *pCursor){
+  ((GraphCommunityCursor*)pCursor)->iRow++;
+  return SQLITE_OK;
+}
+
+/*
+** Check if every node has been returned.
+*/
+static int graphCommEof(sqlite3_vtab_cursor *pCursor){
+  GraphCommunityCursor *pCur = (GraphCommunityCursor*)pCursor;
+  return pCur->iRow>=pCur->nNode;
+}
+
+/*
+** Return column value for the current node.
+*/
+static int graphCommColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *pCtx,
+                           int iCol){
+  GraphCommunityCursor *pCur = (GraphCommunityCursor*)pCursor;
+  GraphCommunityVtab *pVtab = (GraphCommunityVtab*)pCursor->pVtab;
+
+  switch( iCol ){
+    case COMM_COL_NODE:
+      if( pCur->pComp ){
+        sqlite3_result_int64(pCtx,
+            graphCSRViewNodeId(&pCur->view, pCur->iRow));
+      }else{
+        sqlite3_result_int64(pCtx, pCur->aNode[pCur->iRow]);
+      }
+      break;
+    case COMM_COL_COMMUNITY:
+      if( pCur->pComp ){
+        sqlite3_result_int64(pCtx, graphCSRViewNodeId(&pCur->view,
+            pCur->pComp->aParent[pCur->iRow]));
+      }else{
+        sqlite3_result_int64(pCtx, pCur->aCommunity[pCur->iRow]);
+      }
+      break;
+    case COMM_COL_PARAM:
+      if( pVtab->eAlgorithm==COMM_COMPONENTS ){
+        sqlite3_result_int(pCtx, pCur->bIncremental);
+      }else if( pVtab->eAlgorithm==COMM_LOUVAIN ){
+        sqlite3_result_double(pCtx, pCur->rResolution);
+      }else{
+        sqlite3_result_int(pCtx, pCur->nMaxIter);
+      }
+      break;
+    case COMM_COL_THREADS:
+      sqlite3_result_int(pCtx, pCur->nThreads);
+      break;
+    default:
+      return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Return rowid for current position.
+*/
+static int graphCommRowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid){
+  *pRowid = ((GraphCommunityCursor*)pCursor)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only modules for graph_label_propagation, graph_louvain and
+** graph_components. They share every method; xConnect reads the
+** algorithm from pAux.
+*/
+static sqlite3_module graphCommunityModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  graphCommConnect,       /* xConnect */
+  graphCommBestIndex,     /* xBestIndex */
+  graphTravDisconnect,    /* xDisconnect */
+  0,                      /* xDestroy */
+  graphCommOpen,          /* xOpen */
+  graphCommClose,         /* xClose */
+  graphCommFilter,        /* xFilter */
+  graphCommNext,          /* xNext */
+  graphCommEof,           /* xEof */
+  graphCommColumn,        /* xColumn */
+  graphCommRowid,         /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+/* graph_clustering() columns; the last is the hidden argument */
+#define CLUST_COL_NODE         0
+#define CLUST_COL_DEGREE       1
+#define CLUST_COL_TRIANGLES    2
+#define CLUST_COL_COEFFICIENT  3
+#define CLUST_COL_THREADS      4
+
+/*
+** Cursor over per-node triangle counts. xFilter counts every triangle;
+** rows then stream out of the result arrays.
+*/
+typedef struct GraphClusteringCursor GraphClusteringCursor;
+struct GraphClusteringCursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+  sqlite3_int64 *aNode;      /* Node ids, ascending */
+  int *aDegree;              /* Distinct neighbours per node */
+  sqlite3_int64 *aTriangle;  /* Triangles through each node */
+  int nNode;
+  int iRow;                  /* Current row, nNode at EOF */
+  int nThreads;
+};
+
+/*
+** Connect to the eponymous graph_clustering table. The community vtab
+** serves as the table object; only its pDb is used.
+*/
+static int graphClustConnect(sqlite3 *pDb, void *pAux, int argc,
+                             const char *const *argv, sqlite3_vtab **ppVtab,
+                             char **pzErr){
+  GraphCommunityVtab *pNew;
+  int rc;
+
+  UNUSED(pAux);
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(pzErr);
+
+  rc = sqlite3_declare_vtab(pDb,
+      "CREATE TABLE x(node_id INTEGER, degree INTEGER, triangles INTEGER,"
+      " coefficient REAL, threads HIDDEN)");
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->pDb = pDb;
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+/*
+** Query planner for graph_clustering(): threads is optional and taken
+** by equality only.
+*/
+static int graphClustBestIndex(sqlite3_vtab *pVtab,
+                               sqlite3_index_info *pInfo){
+  int i;
+
+  UNUSED(pVtab);
+
+  pInfo->idxNum = 0;
+  for( i=0; i<pInfo->nConstraint; i++ ){
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    if( pCons->iColumn!=CLUST_COL_THREADS ) continue;
+    if( pCons->op!=SQLITE_INDEX_CONSTRAINT_EQ || !pCons->usable ) continue;
+    pInfo->aConstraintUsage[i].argvIndex = 1;
+    pInfo->aConstraintUsage[i].omit = 1;
+    pInfo->idxNum = 1;
+    break;
+  }
+  pInfo->estimatedCost = 1000000.0;
+  pInfo->estimatedRows = 10000;
+  return SQLITE_OK;
+}
+
+static int graphClustOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  GraphClusteringCursor *pCur;
+
+  UNUSED(pVtab);
+
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( pCur==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void graphClustReset(GraphClusteringCursor *pCur){
+  sqlite3_free(pCur->aNode);
+  sqlite3_free(pCur->aDegree);
+  sqlite3_free(pCur->aTriangle);
+  pCur->aNode = 0;
+  pCur->aDegree = 0;
+  pCur->aTriangle = 0;
+  pCur->nNode = 0;
+  pCur->iRow = 0;
+}
+
+static int graphClustClose(sqlite3_vtab_cursor *pCursor){
+  graphClustReset((GraphClusteringCursor*)pCursor);
+  sqlite3_free(pCursor);
+  return SQLITE_OK;
+}
+
+/*
+** Count the triangles through every node of the current graph.
+*/
+static int graphClustFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                            const char *idxStr, int argc,
+                            sqlite3_value **argv){
+  GraphClusteringCursor *pCur = (GraphClusteringCursor*)pCursor;
+  GraphCommunityVtab *pVtab = (GraphCommunityVtab*)pCursor->pVtab;
+  GraphVtab *pGraph = graphRegistryFind(pVtab->pDb, 0);
+  const char *zErr = 0;
+
+  UNUSED(idxStr);
+  graphClustReset(pCur);
+  pCur->nThreads = 1;
+  if( idxNum && argc>0 && sqlite3_value_type(argv[0])!=SQLITE_NULL ){
+    pCur->nThreads = sqlite3_value_int(argv[0]);
+    if( pCur->nThreads<0 ) zErr = "Thread count must not be negative";
+  }
+  if( zErr==0 && pGraph==0 ){
+    zErr = "No graph table available. Create a graph table first using: "
+           "CREATE VIRTUAL TABLE mygraph USING graph();";
+  }
+  if( zErr ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", zErr);
+    return SQLITE_ERROR;
+  }
+  return graphClustering(pGraph, pCur->nThreads, &pCur->aNode,
+                         &pCur->aDegree, &pCur->aTriangle, &pCur->nNode);
+}
+
+static int graphClustNext(sqlite3_vtab_cursor *pCursor){
+  ((GraphClusteringCursor*)pCursor)->iRow++;
+  return SQLITE_OK;
+}
+
+static int graphClustEof(sqlite3_vtab_cursor *pCursor){
+  GraphClusteringCursor *pCur = (GraphClusteringCursor*)pCursor;
+  return pCur->iRow>=pCur->nNode;
+}
+
+/*
+** Return column value for the current node. The coefficient is 0 for
+** nodes with fewer than two neighbours.
+*/
+static int graphClustColumn(sqlite3_vtab_cursor *pCursor,
+                            sqlite3_context *pCtx, int iCol){
+  GraphClusteringCursor *pCur = (GraphClusteringCursor*)pCursor;
+  sqlite3_int64 nDeg = pCur->aDegree[pCur->iRow];
+
+  switch( iCol ){
+    case CLUST_COL_NODE:
+      sqlite3_result_int64(pCtx, pCur->aNode[pCur->iRow]);
+      break;
+    case CLUST_COL_DEGREE:
+      sqlite3_result_int64(pCtx, nDeg);
+      break;
+    case CLUST_COL_TRIANGLES:
+      sqlite3_result_int64(pCtx, pCur->aTriangle[pCur->iRow]);
+      break;
+    case CLUST_COL_COEFFICIENT:
+      sqlite3_result_double(pCtx, nDeg<2 ? 0.0 :
+          2.0*pCur->aTriangle[pCur->iRow]/(nDeg*(nDeg-1)));
+      break;
+    case CLUST_COL_THREADS:
+      sqlite3_result_int(pCtx, pCur->nThreads);
+      break;
+    default:
+      return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+static int graphClustRowid(sqlite3_vtab_cursor *pCursor,
+                           sqlite3_int64 *pRowid){
+  *pRowid = ((GraphClusteringCursor*)pCursor)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only module for graph_clustering.
+*/
+static sqlite3_module graphClusteringModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  graphClustConnect,      /* xConnect */
+  graphClustBestIndex,    /* xBestIndex */
+  graphTravDisconnect,    /* xDisconnect */
+  0,                      /* xDestroy */
+  graphClustOpen,         /* xOpen */
+  graphClustClose,        /* xClose */
+  graphClustFilter,       /* xFilter */
+  graphClustNext,         /* xNext */
+  graphClustEof,          /* xEof */
+  graphClustColumn,       /* xColumn */
+  graphClustRowid,        /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+/* graph_khop_approx() columns; hidden arguments from REACH_COL_HOPS on */
+#define REACH_COL_NODE         0
+#define REACH_COL_REACH        1
+#define REACH_COL_ERROR        2
+#define REACH_COL_HOPS         3
+#define REACH_COL_PRECISION    4
+#define REACH_COL_THREADS      5
+#define REACH_NARG             3
+
+/*
+** Cursor over estimated k-hop reach counts, streamed from the arrays
+** graphReachAll() returns.
+*/
+typedef struct GraphReachCursor GraphReachCursor;
+struct GraphReachCursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+  sqlite3_int64 *aNode;      /* Node ids, ascending */
+  double *aReach;            /* Estimated reach per node */
+  int nNode;
+  int iRow;                  /* Current row, nNode at EOF */
+  int nHops;
+  int nLog2m;                /* Precision */
+  int nThreads;
+};
+
+/*
+** Connect to the eponymous graph_khop_approx table. As for
+** graph_clustering, the community vtab serves as the table object.
+*/
+static int graphReachConnect(sqlite3 *pDb, void *pAux, int argc,
+                             const char *const *argv, sqlite3_vtab **ppVtab,
+                             char **pzErr){
+  GraphCommunityVtab *pNew;
+  int rc;
+
+  UNUSED(pAux);
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(pzErr);
+
+  rc = sqlite3_declare_vtab(pDb,
+      "CREATE TABLE x(node_id INTEGER, reach INTEGER, error REAL,"
+      " k HIDDEN, precision HIDDEN, threads HIDDEN)");
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->pDb = pDb;
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+/*
+** Query planner for graph_khop_approx(): k, precision and threads are
+** taken by equality. Bit i of idxNum is set if argument i is present.
+*/
+static int graphReachBestIndex(sqlite3_vtab *pVtab,
+                               sqlite3_index_info *pInfo){
+  int aArg[REACH_NARG] = { -1, -1, -1 };
+  int idxNum = 0;
+  int nArg = 0;
+  int i;
+
+  UNUSED(pVtab);
+
+  for( i=0; i<pInfo->nConstraint; i++ ){
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    int iArg = pCons->iColumn - REACH_COL_HOPS;
+    if( iArg<0 || pCons->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !pCons->usable ) continue;
+    aArg[iArg] = i;
+    idxNum |= 1<<iArg;
+  }
+  for( i=0; i<REACH_NARG; i++ ){
+    if( aArg[i]<0 ) continue;
+    pInfo->aConstraintUsage[aArg[i]].argvIndex = ++nArg;
+    pInfo->aConstraintUsage[aArg[i]].omit = 1;
+  }
+
+  pInfo->idxNum = idxNum;
+  pInfo->estimatedCost = (idxNum & 1) ? 1000000.0 : 1e12;
+  pInfo->estimatedRows = 10000;
+  return SQLITE_OK;
+}
+
+static int graphReachOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  GraphReachCursor *pCur;
+
+  UNUSED(pVtab);
+
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( pCur==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void graphReachCursorReset(GraphReachCursor *pCur){
+  sqlite3_free(pCur->aNode);
+  sqlite3_free(pCur->aReach);
+  pCur->aNode = 0;
+  pCur->aReach = 0;
+  pCur->nNode = 0;
+  pCur->iRow = 0;
+}
+
+static int graphReachClose(sqlite3_vtab_cursor *pCursor){
+  graphReachCursorReset((GraphReachCursor*)pCursor);
+  sqlite3_free(pCursor);
+  return SQLITE_OK;
+}
+
+/*
+** Estimate the k-hop reach of every node of the current graph.
+*/
+static int graphReachFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                            const char *idxStr, int argc,
+                            sqlite3_value **argv){
+  GraphReachCursor *pCur = (GraphReachCursor*)pCursor;
+  GraphCommunityVtab *pVtab = (GraphCommunityVtab*)pCursor->pVtab;
+  GraphVtab *pGraph = graphRegistryFind(pVtab->pDb, 0);
+  sqlite3_value *apArg[REACH_NARG] = { 0, 0, 0 };
+  const char *zErr = 0;
+  int i, iArg = 0;
+
+  UNUSED(idxStr);
+  graphReachCursorReset(pCur);
+  for( i=0; i<REACH_NARG; i++ ){
+    if( (idxNum & (1<<i)) && iArg<argc ) apArg[i] = argv[iArg++];
+  }
+
+  pCur->nHops = -1;
+  pCur->nLog2m = GRAPH_REACH_DEFAULT_PRECISION;
+  pCur->nThreads = 1;
+  if( apArg[0] && sqlite3_value_type(apArg[0])!=SQLITE_NULL ){
+    pCur->nHops = sqlite3_value_int(apArg[0]);
+  }
+  if( pCur->nHops<0 || pCur->nHops>GRAPH_REACH_MAX_HOPS ){
+    zErr = "graph_khop_approx() needs k between 0 and 64";
+  }
+  if( apArg[1] && sqlite3_value_type(apArg[1])!=SQLITE_NULL ){
+    pCur->nLog2m = sqlite3_value_int(apArg[1]);
+    if( pCur->nLog2m<GRAPH_REACH_MIN_PRECISION
+     || pCur->nLog2m>GRAPH_REACH_MAX_PRECISION ){
+      zErr = "Precision must be between 4 and 12";
+    }
+  }
+  if( apArg[2] && sqlite3_value_type(apArg[2])!=SQLITE_NULL ){
+    pCur->nThreads = sqlite3_value_int(apArg[2]);
+    if( pCur->nThreads<0 ) zErr = "Thread count must not be negative";
+  }
+  if( zErr==0 && pGraph==0 ){
+    zErr = "No graph table available. Create a graph table first using: "
+           "CREATE VIRTUAL TABLE mygraph USING graph();";
+  }
+  if( zErr ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", zErr);
+    return SQLITE_ERROR;
+  }
+  return graphReachAll(pGraph, pCur->nHops, pCur->nLog2m, pCur->nThreads,
+                       &pCur->aNode, &pCur->aReach, &pCur->nNode);
+}
+
+static int graphReachNext(sqlite3_vtab_cursor *pCursor){
+  ((GraphReachCursor*)pCursor)->iRow++;
+  return SQLITE_OK;
+}
+
+static int graphReachEof(sqlite3_vtab_cursor *pCursor){
+  GraphReachCursor *pCur = (GraphReachCursor*)pCursor;
+  return pCur->iRow>=pCur->nNode;
+}
+
+/*
+** Return column value for the current node. error is one standard
+** error of the estimate, in nodes.
+*/
+static int graphReachColumn(sqlite3_vtab_cursor *pCursor,
+                            sqlite3_context *pCtx, int iCol){
+  GraphReachCursor *pCur = (GraphReachCursor*)pCursor;
+  double rReach = pCur->aReach[pCur->iRow];
+
+  switch( iCol ){
+    case REACH_COL_NODE:
+      sqlite3_result_int64(pCtx, pCur->aNode[pCur->iRow]);
+      break;
+    case REACH_COL_REACH:
+      sqlite3_result_int64(pCtx, (sqlite3_int64)(rReach + 0.5));
+      break;
+    case REACH_COL_ERROR:
+      sqlite3_result_double(pCtx, (rReach + 1.0)*graphReachError(pCur->nLog2m));
+      break;
+    case REACH_COL_HOPS:
+      sqlite3_result_int(pCtx, pCur->nHops);
+      break;
+    case REACH_COL_PRECISION:
+      sqlite3_result_int(pCtx, pCur->nLog2m);
+      break;
+    case REACH_COL_THREADS:
+      sqlite3_result_int(pCtx, pCur->nThreads);
+      break;
+    default:
+      return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+static int graphReachRowid(sqlite3_vtab_cursor *pCursor,
+                           sqlite3_int64 *pRowid){
+  *pRowid = ((GraphReachCursor*)pCursor)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only module for graph_khop_approx.
+*/
+static sqlite3_module graphReachModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  graphReachConnect,      /* xConnect */
+  graphReachBestIndex,    /* xBestIndex */
+  graphTravDisconnect,    /* xDisconnect */
+  0,                      /* xDestroy */
+  graphReachOpen,         /* xOpen */
+  graphReachClose,        /* xClose */
+  graphReachFilter,       /* xFilter */
+  graphReachNext,         /* xNext */
+  graphReachEof,          /* xEof */
+  graphReachColumn,       /* xColumn */
+  graphReachRowid,        /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+/* graph_vector_expand() columns; hidden arguments from VEXP_COL_TABLE on */
+#define VEXP_COL_NODE          0
+#define VEXP_COL_SEED          1
+#define VEXP_COL_DISTANCE      2
+#define VEXP_COL_DEPTH         3
+#define VEXP_COL_SCORE         4
+#define VEXP_COL_TABLE         5
+#define VEXP_COL_QUERY         6
+#define VEXP_COL_K             7
+#define VEXP_COL_TYPES         8
+#define VEXP_COL_HOPS          9
+#define VEXP_COL_HOPCOST      10
+#define VEXP_COL_DIRECTION    11
+#define VEXP_NARG              7
+
+/* Defaults of the optional arguments */
+#define VEXP_DEFAULT_HOPS      1
+#define VEXP_DEFAULT_HOPCOST   0.1
+#define VEXP_MAX_HOPS         64
+
+/* A node reached from a seed, waiting in the cursor's heap */
+typedef struct VexpEntry VexpEntry;
+struct VexpEntry {
+  double rScore;            /* rDist + hop cost * nDepth */
+  double rDist;             /* Vector distance of the seed */
+  sqlite3_int64 iNode;      /* Node id */
+  sqlite3_int64 iSeed;      /* Seed it was reached from */
+  int nDepth;               /* Hops from the seed */
+};
+
+/*
+** Cursor over a vector-seeded expansion. The seeds are read in xFilter;
+** from then on each xNext expands the current row and pops the best
+** entry not yet emitted from a binary min-heap, which is multi-source
+** Dijkstra with every edge costing hop_cost: a node is emitted once,
+** with its lowest score, and rows come out in score order.
+*/
+typedef struct GraphVexpCursor GraphVexpCursor;
+struct GraphVexpCursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+
+  /* Arguments */
+  char *zGraph;              /* Default graph when xFilter ran */
+  char *zTypes;              /* Copy of rel_types, split in place */
+  const char **azType;       /* Edge types to follow, none for any */
+  int nType;
+  int nHops;                 /* Depth limit */
+  double rHopCost;           /* Score added per hop */
+  int eDir;                  /* GRAPH_EXPAND_* */
+
+  /* Neighbour source, as for graph_bfs() */
+  GraphConn *pConn;          /* Registry entry of the connection */
+  GraphVtab *pSrc;           /* Graph whose snapshot view pins, or NULL */
+  CSRView view;              /* Pinned snapshot, view.pCSR NULL for SQL */
+
+  /* Expansion state */
+  GraphBitmap *pDone;        /* Nodes already emitted */
+  VexpEntry *aHeap;          /* Min-heap on (score, depth, node) */
+  int nHeap, nHeapAlloc;
+
+  /* Current row */
+  VexpEntry cur;
+  sqlite3_int64 iRow;        /* Rows emitted before this one */
+  int bEof;                  /* No current row */
+
+  /* Hidden column values, reported back as given */
+  char *zVecTable;
+  sqlite3_int64 nK;
+};
+
+/*
+** Connect to the eponymous graph_vector_expand table. As for
+** graph_clustering, the community vtab serves as the table object.
+*/
+static int graphVexpConnect(sqlite3 *pDb, void *pAux, int argc,
+                            const char *const *argv, sqlite3_vtab **ppVtab,
+                            char **pzErr){
+  GraphCommunityVtab *pNew;
+  int rc;
+
+  UNUSED(pAux);
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(pzErr);
+
+  rc = sqlite3_declare_vtab(pDb,
+      "CREATE TABLE x(node_id INTEGER, seed_id INTEGER, distance REAL,"
+      " depth INTEGER, score REAL, vec_table HIDDEN, query HIDDEN,"
+      " k HIDDEN, rel_types HIDDEN, hops HIDDEN, hop_cost HIDDEN,"
+      " direction HIDDEN)");
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->pDb = pDb;
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+/*
+** Query planner for graph_vector_expand(): every argument is taken by
+** equality and vec_table, query and k are required. Bit i of idxNum is
+** set if argument i is present.
+*/
+static int graphVexpBestIndex(sqlite3_vtab *pVtab,
+                              sqlite3_index_info *pInfo){
+  int aArg[VEXP_NARG];
+  int idxNum = 0;
+  int nArg = 0;
+  int i;
+
+  UNUSED(pVtab);
+
+  for( i=0; i<VEXP_NARG; i++ ) aArg[i] = -1;
+  for( i=0; i<pInfo->nConstraint; i++ ){
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    int iArg = pCons->iColumn - VEXP_COL_TABLE;
+    if( iArg<0 || pCons->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !pCons->usable ) continue;
+    aArg[iArg] = i;
+    idxNum |= 1<<iArg;
+  }
+  if( (idxNum & 7)!=7 ){
+    return SQLITE_CONSTRAINT;
+  }
+  for( i=0; i<VEXP_NARG; i++ ){
+    if( aArg[i]<0 ) continue;
+    pInfo->aConstraintUsage[aArg[i]].argvIndex = ++nArg;
+    pInfo->aConstraintUsage[aArg[i]].omit = 1;
+  }
+
+  pInfo->idxNum = idxNum;
+  pInfo->estimatedCost = 1000.0;
+  pInfo->estimatedRows = 100;
+  return SQLITE_OK;
+}
+
+static int graphVexpOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  GraphVexpCursor *pCur;
+
+  UNUSED(pVtab);
+
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( pCur==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+  pCur->bEof = 1;
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void graphVexpReset(GraphVexpCursor *pCur){
+  graphCSRViewClose(&pCur->view);
+  sqlite3_free(pCur->zGraph);
+  sqlite3_free(pCur->zTypes);
+  sqlite3_free((void*)pCur->azType);
+  graphBitmapFree(pCur->pDone);
+  sqlite3_free(pCur->aHeap);
+  sqlite3_free(pCur->zVecTable);
+  memset(&pCur->zGraph, 0,
+         sizeof(*pCur) - offsetof(GraphVexpCursor, zGraph));
+  pCur->bEof = 1;
+}
+
+static int graphVexpClose(sqlite3_vtab_cursor *pCursor){
+  graphVexpReset((GraphVexpCursor*)pCursor);
+  sqlite3_free(pCursor);
+  return SQLITE_OK;
+}
+
+/* True if heap entry a comes out before b */
+static int vexpBefore(const VexpEntry *a, const VexpEntry *b){
+  if( a->rScore!=b->rScore ) return a->rScore<b->rScore;
+  if( a->nDepth!=b->nDepth ) return a->nDepth<b->nDepth;
+  return a->iNode<b->iNode;
+}
+
+static int vexpPush(GraphVexpCursor *pCur, const VexpEntry *pEntry){
+  int i;
+
+  if( pCur->nHeap>=pCur->nHeapAlloc ){
+    int nNew = pCur->nHeapAlloc ? pCur->nHeapAlloc*2 : 64;
+    VexpEntry *aNew = sqlite3_realloc64(pCur->aHeap, nNew*sizeof(VexpEntry));
+    if( aNew==0 ) return SQLITE_NOMEM;
+    pCur->aHeap = aNew;
+    pCur->nHeapAlloc = nNew;
+  }
+  i = pCur->nHeap++;
+  while( i>0 && vexpBefore(pEntry, &pCur->aHeap[(i-1)/2]) ){
+    pCur->aHeap[i] = pCur->aHeap[(i-1)/2];
+    i = (i-1)/2;
+  }
+  pCur->aHeap[i] = *pEntry;
+  return SQLITE_OK;
+}
+
+static void vexpPop(GraphVexpCursor *pCur, VexpEntry *pOut){
+  VexpEntry last;
+  int i = 0;
+
+  *pOut = pCur->aHeap[0];
+  last = pCur->aHeap[--pCur->nHeap];
+  for(;;){
+    int c = 2*i + 1;
+    if( c>=pCur->nHeap ) break;
+    if( c+1<pCur->nHeap && vexpBefore(&pCur->aHeap[c+1], &pCur->aHeap[c]) ){
+      c++;
+    }
+    if( !vexpBefore(&pCur->aHeap[c], &last) ) break;
+    pCur->aHeap[i] = pCur->aHeap[c];
+    i = c;
+  }
+  if( pCur->nHeap>0 ) pCur->aHeap[i] = last;
+}
+
+/*
+** Queue iNbr one hop past the current row unless it was emitted already.
+*/
+static int vexpReach(GraphVexpCursor *pCur, sqlite3_int64 iNbr){
+  VexpEntry e;
+
+  if( graphBitmapContains(pCur->pDone, iNbr) ) return SQLITE_OK;
+  e.iNode = iNbr;
+  e.iSeed = pCur->cur.iSeed;
+  e.rDist = pCur->cur.rDist;
+  e.nDepth = pCur->cur.nDepth + 1;
+  e.rScore = pCur->cur.rScore + pCur->rHopCost;
+  return vexpPush(pCur, &e);
+}
+
+/*
+** Queue the neighbours of the current row: from the pinned view while it
+** is current, as graphTravSnapshot() decides for graph_bfs(), otherwise
+** through the covering edge indexes, one probe per edge type.
+*/
+static int vexpExpand(GraphVexpCursor *pCur){
+  GraphVtab *pGraph = graphConnFind(pCur->pConn, pCur->zGraph);
+  int rc = SQLITE_OK;
+  int i;
+
+  if( pCur->view.pCSR
+   && (pGraph!=pCur->pSrc || !graphCSRViewIsCurrent(pCur->pSrc, &pCur->view)) ){
+    graphCSRViewClose(&pCur->view);
+  }
+  if( pCur->view.pCSR ){
+    int iNode = graphCSRViewIndexOf(&pCur->view, pCur->cur.iNode);
+    int bIn;
+    if( iNode<0 ) return SQLITE_OK;
+    for(bIn=0; bIn<2 && rc==SQLITE_OK; bIn++){
+      CSREdgeIter it;
+      int iNbr;
+      if( !(pCur->eDir & (bIn ? GRAPH_EXPAND_IN : GRAPH_EXPAND_OUT)) ) continue;
+      graphCSREdgeFirst(&pCur->view, iNode, bIn, &it);
+      while( rc==SQLITE_OK && graphCSREdgeNext(&it, &iNbr, 0) ){
+        rc = vexpReach(pCur, graphCSRViewNodeId(&pCur->view, iNbr));
+      }
+    }
+    return rc;
+  }
+
+  if( pGraph==0 ) return SQLITE_ERROR;
+  for(i=0; i==0 || i<pCur->nType; i++){
+    sqlite3_int64 *aId = 0;
+    int nId = 0, j;
+    rc = graphExpand(pGraph, pCur->cur.iNode,
+                     pCur->nType ? pCur->azType[i] : 0, pCur->eDir,
+                     &aId, &nId);
+    for(j=0; rc==SQLITE_OK && j<nId; j++){
+      rc = vexpReach(pCur, aId[j]);
+    }
+    sqlite3_free(aId);
+    if( rc!=SQLITE_OK ) break;
+  }
+  return rc;
+}
+
+/*
+** Make the best queued node not yet emitted the current row.
+*/
+static int vexpAdvance(GraphVexpCursor *pCur){
+  while( pCur->nHeap>0 ){
+    vexpPop(pCur, &pCur->cur);
+    if( graphBitmapContains(pCur->pDone, pCur->cur.iNode) ) continue;
+    pCur->bEof = 0;
+    return graphBitmapAdd(pCur->pDone, pCur->cur.iNode);
+  }
+  pCur->bEof = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Split the rel_types list ("KNOWS, WORKS_AT") into pCur->azType.
+*/
+static int vexpSplitTypes(GraphVexpCursor *pCur, const char *zList){
+  char *z;
+  int nMax = 1;
+
+  for(z=(char*)zList; *z; z++) if( *z==',' ) nMax++;
+  pCur->zTypes = sqlite3_mprintf("%s", zList);
+  pCur->azType = sqlite3_malloc64(sizeof(char*)*nMax);
+  if( pCur->zTypes==0 || pCur->azType==0 ) return SQLITE_NOMEM;
+  z = pCur->zTypes;
+  for(;;){
+    char *zEnd = z, *zTrim;
+    int bLast;
+    while( *z==' ' ) z++;
+    for(zEnd=z; *zEnd && *zEnd!=','; zEnd++){}
+    bLast = *zEnd==0;
+    for(zTrim=zEnd; zTrim>z && zTrim[-1]==' '; zTrim--){}
+    *zTrim = 0;
+    if( *z ) pCur->azType[pCur->nType++] = z;
+    if( bLast ) break;
+    z = zEnd+1;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Run the k-nearest-neighbour query on the vec0 table and queue the seeds
+** that are nodes of the graph. zVecTable is "table" or "table.column",
+** the column defaulting to embedding as VectorDB creates it.
+*/
+static int vexpSeed(GraphVexpCursor *pCur, GraphCommunityVtab *pVtab,
+                    GraphVtab *pGraph, sqlite3_value *pQuery){
+  const char *zDot = strchr(pCur->zVecTable, '.');
+  int nTable = zDot ? (int)(zDot - pCur->zVecTable)
+                     : (int)strlen(pCur->zVecTable);
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  int rc;
+
+  zSql = sqlite3_mprintf(
+      "SELECT rowid, distance FROM \"%.*w\" WHERE \"%w\" MATCH ?1 AND k = ?2",
+      nTable, pCur->zVecTable, zDot ? zDot+1 : "embedding");
+  if( zSql==0 ) return SQLITE_NOMEM;
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(pVtab->pDb));
+    return rc;
+  }
+  sqlite3_bind_value(pStmt, 1, pQuery);
+  sqlite3_bind_int64(pStmt, 2, pCur->nK);
+  while( (rc = sqlite3_step(pStmt))==SQLITE_ROW ){
+    VexpEntry e;
+    e.iNode = e.iSeed = sqlite3_column_int64(pStmt, 0);
+    e.rDist = e.rScore = sqlite3_column_double(pStmt, 1);
+    e.nDepth = 0;
+    if( pCur->view.pCSR ){
+      if( graphCSRViewIndexOf(&pCur->view, e.iNode)<0 ) continue;
+    }else{
+      sqlite3_stmt *pNode;
+      int bExists;
+      rc = graphStmtAcquire(pGraph, GRAPH_STMT_NODE_BY_ID, &pNode);
+      if( rc!=SQLITE_OK ) break;
+      sqlite3_bind_int64(pNode, 1, e.iNode);
+      bExists = sqlite3_step(pNode)==SQLITE_ROW;
+      graphStmtRelease(pGraph, pNode);
+      if( !bExists ) continue;
+    }
+    rc = vexpPush(pCur, &e);
+    if( rc!=SQLITE_OK ) break;
+  }
+  if( rc==SQLITE_DONE ) rc = SQLITE_OK;
+  if( rc!=SQLITE_OK && rc!=SQLITE_NOMEM ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(pVtab->pDb));
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+/*
+** Seed and start an expansion. Arguments, in the order xBestIndex
+** numbered them: vec_table, query, k, then the optional rel_types, hops,
+** hop_cost and direction.
+*/
+static int graphVexpFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                           const char *idxStr, int argc,
+                           sqlite3_value **argv){
+  GraphVexpCursor *pCur = (GraphVexpCursor*)pCursor;
+  GraphCommunityVtab *pVtab = (GraphCommunityVtab*)pCursor->pVtab;
+  GraphVtab *pGraph = graphRegistryFind(pVtab->pDb, 0);
+  sqlite3_value *apArg[VEXP_NARG];
+  const char *zErr = 0;
+  const char *zTable;
+  int i, iArg = 0;
+  int rc;
+
+  UNUSED(idxStr);
+  graphVexpReset(pCur);
+  for( i=0; i<VEXP_NARG; i++ ){
+    apArg[i] = ((idxNum & (1<<i)) && iArg<argc) ? argv[iArg++] : 0;
+  }
+
+  zTable = (const char*)sqlite3_value_text(apArg[0]);
+  pCur->nK = sqlite3_value_int64(apArg[2]);
+  pCur->nHops = VEXP_DEFAULT_HOPS;
+  pCur->rHopCost = VEXP_DEFAULT_HOPCOST;
+  pCur->eDir = GRAPH_EXPAND_BOTH;
+  if( zTable==0 || zTable[0]==0 || sqlite3_value_type(apArg[1])==SQLITE_NULL ){
+    zErr = "usage: graph_vector_expand(vec_table, query, k [, rel_types"
+           " [, hops [, hop_cost [, direction]]]])";
+  }else if( pCur->nK<1 ){
+    zErr = "graph_vector_expand() needs k of at least 1";
+  }
+  if( apArg[4] && sqlite3_value_type(apArg[4])!=SQLITE_NULL ){
+    pCur->nHops = sqlite3_value_int(apArg[4]);
+    if( pCur->nHops<0 || pCur->nHops>VEXP_MAX_HOPS ){
+      zErr = "hops must be between 0 and 64";
+    }
+  }
+  if( apArg[5] && sqlite3_value_type(apArg[5])!=SQLITE_NULL ){
+    pCur->rHopCost = sqlite3_value_double(apArg[5]);
+    if( !(pCur->rHopCost>=0.0) ) zErr = "hop_cost must not be negative";
+  }
+  if( apArg[6] && sqlite3_value_type(apArg[6])!=SQLITE_NULL ){
+    const char *zDir = (const char*)sqlite3_value_text(apArg[6]);
+    if( zDir && sqlite3_stricmp(zDir, "out")==0 ){
+      pCur->eDir = GRAPH_EXPAND_OUT;
+    }else if( zDir && sqlite3_stricmp(zDir, "in")==0 ){
+      pCur->eDir = GRAPH_EXPAND_IN;
+    }else if( zDir==0 || sqlite3_stricmp(zDir, "both")!=0 ){
+      zErr = "direction must be 'out', 'in' or 'both'";
+    }
+  }
+  if( zErr==0 && pGraph==0 ){
+    zErr = "No graph table available. Create a graph table first using: "
+           "CREATE VIRTUAL TABLE mygraph USING graph();";
+  }
+  if( zErr ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", zErr);
+    return SQLITE_ERROR;
+  }
+
+  pCur->zVecTable = sqlite3_mprintf("%s", zTable);
+  pCur->zGraph = sqlite3_mprintf("%s", pGraph->zTableName);
+  pCur->pDone = graphBitmapCreate();
+  if( pCur->zVecTable==0 || pCur->zGraph==0 || pCur->pDone==0 ){
+    return SQLITE_NOMEM;
+  }
+  if( apArg[3] && sqlite3_value_type(apArg[3])!=SQLITE_NULL ){
+    rc = vexpSplitTypes(pCur, (const char*)sqlite3_value_text(apArg[3]));
+    if( rc!=SQLITE_OK ) return rc;
+  }
+
+  /* The snapshot carries no edge types: typed hops always probe the
+  ** edge indexes, untyped ones use the snapshot if it is current */
+  pCur->pConn = graphRegistryConn(pVtab->pDb);
+  if( pCur->nType==0 && graphCSRIsCurrent(pGraph)
+   && graphCSRViewOpen(pGraph, &pCur->view)==SQLITE_OK ){
+    pCur->pSrc = pGraph;
+  }
+
+  rc = vexpSeed(pCur, pVtab, pGraph, apArg[1]);
+  if( rc!=SQLITE_OK ) return rc;
+  return vexpAdvance(pCur);
+}
+
+/*
+** Expand the current row, unless it is at the depth limit, and move to
+** the best node not yet emitted.
+*/
+static int graphVexpNext(sqlite3_vtab_cursor *pCursor){
+  GraphVexpCursor *pCur = (GraphVexpCursor*)pCursor;
+  int rc = SQLITE_OK;
+
+  if( pCur->bEof ) return SQLITE_OK;
+  if( pCur->cur.nDepth<pCur->nHops ){
+    rc = vexpExpand(pCur);
+  }
+  if( rc==SQLITE_OK ) rc = vexpAdvance(pCur);
+  if( rc!=SQLITE_OK ){
+    pCur->bEof = 1;
+    return rc;
+  }
+  pCur->iRow++;
+  return SQLITE_OK;
+}
+
+static int graphVexpEof(sqlite3_vtab_cursor *pCursor){
+  return ((GraphVexpCursor*)pCursor)->bEof;
+}
+
+static int graphVexpColumn(sqlite3_vtab_cursor *pCursor,
+                           sqlite3_context *pCtx, int iCol){
+  GraphVexpCursor *pCur = (GraphVexpCursor*)pCursor;
+
+  switch( iCol ){
+    case VEXP_COL_NODE:
+      sqlite3_result_int64(pCtx, pCur->cur.iNode);
+      break;
+    case VEXP_COL_SEED:
+      sqlite3_result_int64(pCtx, pCur->cur.iSeed);
+      break;
+    case VEXP_COL_DISTANCE:
+      sqlite3_result_double(pCtx, pCur->cur.rDist);
+      break;
+    case VEXP_COL_DEPTH:
+      sqlite3_result_int(pCtx, pCur->cur.nDepth);
+      break;
+    case VEXP_COL_SCORE:
+      sqlite3_result_double(pCtx, pCur->cur.rScore);
+      break;
+    case VEXP_COL_TABLE:
+      sqlite3_result_text(pCtx, pCur->zVecTable, -1, SQLITE_TRANSIENT);
+      break;
+    case VEXP_COL_K:
+      sqlite3_result_int64(pCtx, pCur->nK);
+      break;
+    case VEXP_COL_HOPS:
+      sqlite3_result_int(pCtx, pCur->nHops);
+      break;
+    case VEXP_COL_HOPCOST:
+      sqlite3_result_double(pCtx, pCur->rHopCost);
+      break;
+    default:
+      /* query, rel_types and direction read back as NULL */
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int graphVexpRowid(sqlite3_vtab_cursor *pCursor,
+                          sqlite3_int64 *pRowid){
+  *pRowid = ((GraphVexpCursor*)pCursor)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only module for graph_vector_expand.
+*/
+static sqlite3_module graphVexpModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  graphVexpConnect,       /* xConnect */
+  graphVexpBestIndex,     /* xBestIndex */
+  graphTravDisconnect,    /* xDisconnect */
+  0,                      /* xDestroy */
+  graphVexpOpen,          /* xOpen */
+  graphVexpClose,         /* xClose */
+  graphVexpFilter,        /* xFilter */
+  graphVexpNext,          /* xNext */
+  graphVexpEof,           /* xEof */
+  graphVexpColumn,        /* xColumn */
+  graphVexpRowid,         /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+/* graph_ppr() columns; hidden arguments from PPR_COL_SEEDS on */
+#define PPR_COL_NODE           0
+#define PPR_COL_SCORE          1
+#define PPR_COL_SEEDS          2
+#define PPR_COL_ALPHA          3
+#define PPR_COL_EPSILON        4
+#define PPR_COL_TOPK           5
+#define PPR_NARG               4
+
+/* Defaults of the optional arguments */
+#define PPR_DEFAULT_ALPHA      0.15
+#define PPR_DEFAULT_EPSILON    1e-4
+
+/*
+** Cursor over a personalized PageRank ranking. xFilter runs the push on
+** a view pinned for the duration and keeps only the top rows.
+*/
+typedef struct GraphPprCursor GraphPprCursor;
+struct GraphPprCursor {
+  sqlite3_vtab_cursor base;  /* Base class - must be first */
+  sqlite3_int64 *aNode;      /* Node ids, best first */
+  double *aScore;            /* Their scores */
+  int nNode;
+  int iRow;                  /* Current row, nNode at EOF */
+  char *zSeeds;              /* seeds argument as given */
+  double rAlpha;
+  double rEpsilon;
+  int nTopK;                 /* 0 for every touched node */
+};
+
+/*
+** Connect to the eponymous graph_ppr table. As for graph_clustering,
+** the community vtab serves as the table object.
+*/
+static int graphPprConnect(sqlite3 *pDb, void *pAux, int argc,
+                           const char *const *argv, sqlite3_vtab **ppVtab,
+                           char **pzErr){
+  GraphCommunityVtab *pNew;
+  int rc;
+
+  UNUSED(pAux);
+  UNUSED(argc);
+  UNUSED(argv);
+  UNUSED(pzErr);
+
+  rc = sqlite3_declare_vtab(pDb,
+      "CREATE TABLE x(node_id INTEGER, score REAL, seeds HIDDEN,"
+      " alpha HIDDEN, epsilon HIDDEN, top_k HIDDEN)");
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+  pNew = sqlite3_malloc(sizeof(*pNew));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pNew, 0, sizeof(*pNew));
+  pNew->pDb = pDb;
+  *ppVtab = &pNew->base;
+  return SQLITE_OK;
+}
+
+/*
+** Query planner for graph_ppr(): every argument is taken by equality and
+** seeds is required. Bit i of idxNum is set if argument i is present.
+*/
+static int graphPprBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo){
+  int aArg[PPR_NARG];
+  int idxNum = 0;
+  int nArg = 0;
+  int i;
+
+  UNUSED(pVtab);
+
+  for( i=0; i<PPR_NARG; i++ ) aArg[i] = -1;
+  for( i=0; i<pInfo->nConstraint; i++ ){
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    int iArg = pCons->iColumn - PPR_COL_SEEDS;
+    if( iArg<0 || pCons->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !pCons->usable ) continue;
+    aArg[iArg] = i;
+    idxNum |= 1<<iArg;
+  }
+  if( (idxNum & 1)==0 ){
+    return SQLITE_CONSTRAINT;
+  }
+  for( i=0; i<PPR_NARG; i++ ){
+    if( aArg[i]<0 ) continue;
+    pInfo->aConstraintUsage[aArg[i]].argvIndex = ++nArg;
+    pInfo->aConstraintUsage[aArg[i]].omit = 1;
+  }
+
+  pInfo->idxNum = idxNum;
+  pInfo->estimatedCost = 1000.0;
+  pInfo->estimatedRows = 100;
+  return SQLITE_OK;
+}
+
+static int graphPprOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  GraphPprCursor *pCur;
+
+  UNUSED(pVtab);
+
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( pCur==0 ){
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void graphPprReset(GraphPprCursor *pCur){
+  sqlite3_free(pCur->aNode);
+  sqlite3_free(pCur->aScore);
+  sqlite3_free(pCur->zSeeds);
+  memset(&pCur->aNode, 0,
+         sizeof(*pCur) - offsetof(GraphPprCursor, aNode));
+}
+
+static int graphPprClose(sqlite3_vtab_cursor *pCursor){
+  graphPprReset((GraphPprCursor*)pCursor);
+  sqlite3_free(pCursor);
+  return SQLITE_OK;
+}
+
+/*
+** Parse the seeds argument, a node id or a list of them ("1, 2, 3" or
+** the JSON array "[1,2,3]"), into the dense indices of pView. Ids that
+** are not nodes are skipped. Returns SQLITE_ERROR on a malformed list.
+*/
+static int pprSeeds(const CSRView *pView, const char *zList,
+                    int **paSeed, int *pnSeed){
+  const char *z;
+  int nMax = 1, nSeed = 0;
+  int *aSeed;
+
+  for(z=zList; *z; z++) if( *z==',' ) nMax++;
+  aSeed = sqlite3_malloc64(sizeof(int)*nMax);
+  if( aSeed==0 ) return SQLITE_NOMEM;
+  z = zList;
+  while( *z==' ' ) z++;
+  if( *z=='[' ) z++;
+  for(;;){
+    char *zEnd;
+    sqlite3_int64 iId;
+    int iNode;
+    while( *z==' ' ) z++;
+    if( *z==']' || *z==0 ) break;
+    iId = strtoll(z, &zEnd, 10);
+    if( zEnd==z ) goto bad_seeds;
+    iNode = graphCSRViewIndexOf(pView, iId);
+    if( iNode>=0 ) aSeed[nSeed++] = iNode;
+    for(z=zEnd; *z==' '; z++){}
+    if( *z==',' ) z++;
+    else if( *z!=']' && *z!=0 ) goto bad_seeds;
+  }
+  if( *z==']' ) for(z++; *z==' '; z++){}
+  if( *z ) goto bad_seeds;
+  *paSeed = aSeed;
+  *pnSeed = nSeed;
+  return SQLITE_OK;
+
+bad_seeds:
+  sqlite3_free(aSeed);
+  return SQLITE_ERROR;
+}
+
+/*
+** Run the push. Arguments, in the order xBestIndex numbered them: seeds,
+** then the optional alpha, epsilon and top_k.
+*/
+static int graphPprFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                          const char *idxStr, int argc,
+                          sqlite3_value **argv){
+  GraphPprCursor *pCur = (GraphPprCursor*)pCursor;
+  GraphCommunityVtab *pVtab = (GraphCommunityVtab*)pCursor->pVtab;
+  GraphVtab *pGraph = graphRegistryFind(pVtab->pDb, 0);
+  sqlite3_value *apArg[PPR_NARG];
+  const char *zErr = 0;
+  const char *zSeeds;
+  CSRView view;
+  int *aSeed = 0;
+  int nSeed = 0;
+  int i, iArg = 0;
+  int rc;
+
+  UNUSED(idxStr);
+  graphPprReset(pCur);
+  for( i=0; i<PPR_NARG; i++ ){
+    apArg[i] = ((idxNum & (1<<i)) && iArg<argc) ? argv[iArg++] : 0;
+  }
+
+  zSeeds = (const char*)sqlite3_value_text(apArg[0]);
+  pCur->rAlpha = PPR_DEFAULT_ALPHA;
+  pCur->rEpsilon = PPR_DEFAULT_EPSILON;
+  if( zSeeds==0 ){
+    zErr = "usage: graph_ppr(seeds [, alpha [, epsilon [, top_k]]])";
+  }
+  if( apArg[1] && sqlite3_value_type(apArg[1])!=SQLITE_NULL ){
+    pCur->rAlpha = sqlite3_value_double(apArg[1]);
+    if( !(pCur->rAlpha>0.0 && pCur->rAlpha<=1.0) ){
+      zErr = "alpha must be in (0, 1]";
+    }
+  }
+  if( apArg[2] && sqlite3_value_type(apArg[2])!=SQLITE_NULL ){
+    pCur->rEpsilon = sqlite3_value_double(apArg[2]);
+    if( !(pCur->rEpsilon>0.0) ) zErr = "epsilon must be positive";
+  }
+  if( apArg[3] && sqlite3_value_type(apArg[3])!=SQLITE_NULL ){
+    pCur->nTopK = sqlite3_value_int(apArg[3]);
+    if( pCur->nTopK<1 ) zErr = "top_k must be at least 1";
+  }
+  if( zErr==0 && pGraph==0 ){
+    zErr = "No graph table available. Create a graph table first using: "
+           "CREATE VIRTUAL TABLE mygraph USING graph();";
+  }
+  if( zErr ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf("%s", zErr);
+    return SQLITE_ERROR;
+  }
+
+  pCur->zSeeds = sqlite3_mprintf("%s", zSeeds);
+  if( pCur->zSeeds==0 ) return SQLITE_NOMEM;
+  if( !graphProjectionView(pVtab->pDb, 0, &view) ){
+    rc = graphCSRViewOpen(pGraph, &view);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  rc = pprSeeds(&view, zSeeds, &aSeed, &nSeed);
+  if( rc==SQLITE_ERROR ){
+    sqlite3_free(pVtab->base.zErrMsg);
+    pVtab->base.zErrMsg = sqlite3_mprintf(
+        "seeds must be a node id or a list of them, got '%s'", zSeeds);
+  }else if( rc==SQLITE_OK && nSeed>0 ){
+    rc = graphPersonalizedPageRank(&view, aSeed, nSeed, pCur->rAlpha,
+                                   pCur->rEpsilon, pCur->nTopK,
+                                   &pCur->aNode, &pCur->aScore,
+                                   &pCur->nNode);
+  }
+  sqlite3_free(aSeed);
+  graphCSRViewClose(&view);
+  return rc;
+}
+
+static int graphPprNext(sqlite3_vtab_cursor *pCursor){
+  ((GraphPprCursor*)pCursor)->iRow++;
+  return SQLITE_OK;
+}
+
+static int graphPprEof(sqlite3_vtab_cursor *pCursor){
+  GraphPprCursor *pCur = (GraphPprCursor*)pCursor;
+  return pCur->iRow>=pCur->nNode;
+}
+
+static int graphPprColumn(sqlite3_vtab_cursor *pCursor,
+                          sqlite3_context *pCtx, int iCol){
+  GraphPprCursor *pCur = (GraphPprCursor*)pCursor;
+
+  switch( iCol ){
+    case PPR_COL_NODE:
+      sqlite3_result_int64(pCtx, pCur->aNode[pCur->iRow]);
+      break;
+    case PPR_COL_SCORE:
+      sqlite3_result_double(pCtx, pCur->aScore[pCur->iRow]);
+      break;
+    case PPR_COL_SEEDS:
+      sqlite3_result_text(pCtx, pCur->zSeeds, -1, SQLITE_TRANSIENT);
+      break;
+    case PPR_COL_ALPHA:
+      sqlite3_result_double(pCtx, pCur->rAlpha);
+      break;
+    case PPR_COL_EPSILON:
+      sqlite3_result_double(pCtx, pCur->rEpsilon);
+      break;
+    case PPR_COL_TOPK:
+      if( pCur->nTopK>0 ) sqlite3_result_int(pCtx, pCur->nTopK);
+      break;
+    default:
+      return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+static int graphPprRowid(sqlite3_vtab_cursor *pCursor,
+                         sqlite3_int64 *pRowid){
+  *pRowid = ((GraphPprCursor*)pCursor)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Eponymous-only module for graph_ppr.
+*/
+static sqlite3_module graphPprModule = {
+  0,                      /* iVersion */
+  0,                      /* xCreate */
+  graphPprConnect,        /* xConnect */
+  graphPprBestIndex,      /* xBestIndex */
+  graphTravDisconnect,    /* xDisconnect */
+  0,                      /* xDestroy */
+  graphPprOpen,           /* xOpen */
+  graphPprClose,          /* xClose */
+  graphPprFilter,         /* xFilter */
+  graphPprNext,           /* xNext */
+  graphPprEof,            /* xEof */
+  graphPprColumn,         /* xColumn */
+  graphPprRowid,          /* xRowid */
+  0,                      /* xUpdate */
+  0,                      /* xBegin */
+  0,                      /* xSync */
+  0,                      /* xCommit */
+  0,                      /* xRollback */
+  0,                      /* xFindFunction */
+  0,                      /* xRename */
+  0,                      /* xSavepoint */
+  0,                      /* xRelease */
+  0,                      /* xRollbackTo */
+  0,                      /* xShadowName */
+  0                       /* xIntegrity */
+};
+
+/*
+** Register table-valued functions with SQLite.
+** Called from main extension init function.
+*/
+int graphRegisterTVF(sqlite3 *pDb){
+  int rc;
+
+  /* Register graph_dfs() table-valued function */
+  rc = sqlite3_create_module(pDb, "graph_dfs", &graphDFSModule, 0);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  /* Register graph_bfs() table-valued function */
+  rc = sqlite3_create_module(pDb, "graph_bfs", &graphDFSModule, (void*)1);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  /* Register graph_label_propagation(), graph_louvain() and
+  ** graph_components() */
+  rc = sqlite3_create_module(pDb, "graph_label_propagation",
+                             &graphCommunityModule,
+                             &aCommAlgorithm[COMM_LABEL_PROPAGATION]);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+  rc = sqlite3_create_module(pDb, "graph_louvain",
+                             &graphCommunityModule,
+                             &aCommAlgorithm[COMM_LOUVAIN]);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+  rc = sqlite3_create_module(pDb, "graph_components",
+                             &graphCommunityModule,
+                             &aCommAlgorithm[COMM_COMPONENTS]);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  /* Register graph_clustering() */
+  rc = sqlite3_create_module(pDb, "graph_clustering",
+                             &graphClusteringModule, 0);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  /* Register graph_khop_approx() */
+  rc = sqlite3_create_module(pDb, "graph_khop_approx",
+                             &graphReachModule, 0);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  /* Register graph_vector_expand() */
+  rc = sqlite3_create_module(pDb, "graph_vector_expand",
+                             &graphVexpModule, 0);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  /* Register graph_ppr() */
+  rc = sqlite3_create_module(pDb, "graph_ppr", &graphPprModule, 0);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  return SQLITE_OK;
+}
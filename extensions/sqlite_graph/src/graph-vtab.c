@@ -16,6 +16,8 @@ extern const sqlite3_api_routines *sqlite3_api;
 /* SQLITE_EXTENSION_INIT1 - removed to prevent multiple definition */
 #include "graph.h"
 #include "graph-vtab.h"
+#include "graph-csr.h"
+#include "graph-stats.h"
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
@@ -60,6 +62,90 @@ sqlite3_module graphModule = {
   0                     /* xIntegrity */
 };
 
+/*
+** Parse the module arguments of CREATE VIRTUAL TABLE ... USING graph(...).
+** Plain arguments name the backing node and edge tables, as in
+** graph(nodes_table, edges_table); without both the tables are named
+** <vtab>_nodes and <vtab>_edges. The option properties=jsonb stores
+** properties as SQLite JSONB (graph-schema.c), properties=compressed
+** packs them against per-graph dictionaries (graph-compress.c) and
+** properties=json keeps text. csr_file=<path> keeps a copy of the CSR
+** snapshot in an mmap()able file (graph-csr-file.c), relative to the
+** database file's directory unless absolute. result_cache=persist keeps
+** memoized algorithm results in a %s_results table (graph-results.c);
+** result_cache=memory, the default, keeps them in memory only.
+** SQLite keeps the arguments with the table, so xConnect sees them too.
+*/
+static int graphParseArgs(GraphVtab *pNew, int argc, const char *const *argv,
+                          char **pzErr){
+  const char *azPos[2] = {0, 0};
+  int nPos = 0;
+  int i;
+
+  for(i=3; i<argc; i++){
+    const char *z = argv[i];
+    while( *z==' ' || *z=='\t' ) z++;
+    if( sqlite3_strnicmp(z, "properties", 10)==0 && strchr(z, '=') ){
+      const char *zVal = strchr(z, '=') + 1;
+      while( *zVal==' ' || *zVal=='\t' ) zVal++;
+      if( sqlite3_strnicmp(zVal, "jsonb", 5)==0 ){
+        if( sqlite3_libversion_number()<3045000 ){
+          *pzErr = sqlite3_mprintf("properties=jsonb needs SQLite 3.45.0 "
+                                   "or later, this is %s", sqlite3_libversion());
+          return SQLITE_ERROR;
+        }
+        pNew->ePropFormat = GRAPH_PROPS_JSONB;
+      }else if( sqlite3_strnicmp(zVal, "compressed", 10)==0 ){
+        pNew->ePropFormat = GRAPH_PROPS_PACKED;
+        pNew->zPropsExpr = sqlite3_mprintf("graph_props(%Q, properties)", argv[2]);
+        if( pNew->zPropsExpr==0 ) return SQLITE_NOMEM;
+      }else if( sqlite3_strnicmp(zVal, "json", 4)!=0 ){
+        *pzErr = sqlite3_mprintf("unknown property format: %s", zVal);
+        return SQLITE_ERROR;
+      }
+    }else if( sqlite3_strnicmp(z, "csr_file", 8)==0 && strchr(z, '=') ){
+      const char *zVal = strchr(z, '=') + 1;
+      int n;
+      while( *zVal==' ' || *zVal=='\t' ) zVal++;
+      n = (int)strlen(zVal);
+      while( n>0 && (zVal[n-1]==' ' || zVal[n-1]=='\t') ) n--;
+      if( n>=2 && (zVal[0]=='\'' || zVal[0]=='"') && zVal[n-1]==zVal[0] ){
+        zVal++;
+        n -= 2;
+      }
+      if( n==0 ){
+        *pzErr = sqlite3_mprintf("csr_file= needs a path");
+        return SQLITE_ERROR;
+      }
+      sqlite3_free(pNew->zCSRFile);
+      pNew->zCSRFile = sqlite3_mprintf("%.*s", n, zVal);
+      if( pNew->zCSRFile==0 ) return SQLITE_NOMEM;
+    }else if( sqlite3_strnicmp(z, "result_cache", 12)==0 && strchr(z, '=') ){
+      const char *zVal = strchr(z, '=') + 1;
+      while( *zVal==' ' || *zVal=='\t' ) zVal++;
+      if( sqlite3_strnicmp(zVal, "persist", 7)==0 ){
+        pNew->bResultPersist = 1;
+      }else if( sqlite3_strnicmp(zVal, "memory", 6)==0 ){
+        pNew->bResultPersist = 0;
+      }else{
+        *pzErr = sqlite3_mprintf("unknown result cache mode: %s", zVal);
+        return SQLITE_ERROR;
+      }
+    }else if( nPos<2 ){
+      azPos[nPos++] = argv[i];
+    }
+  }
+
+  if( nPos==2 ){
+    pNew->zNodeTableName = sqlite3_mprintf("%s", azPos[0]);
+    pNew->zEdgeTableName = sqlite3_mprintf("%s", azPos[1]);
+  }else{
+    pNew->zNodeTableName = sqlite3_mprintf("%s_nodes", argv[2]);
+    pNew->zEdgeTableName = sqlite3_mprintf("%s_edges", argv[2]);
+  }
+  return SQLITE_OK;
+}
+
 /*
 ** Create a new virtual table instance.
 ** Called when CREATE VIRTUAL TABLE is executed.
@@ -71,8 +157,6 @@ sqlite3_module graphModule = {
 int graphCreate(sqlite3 *pDb, void *pAux, int argc, 
                 const char *const *argv, sqlite3_vtab **ppVtab, 
                 char **pzErr){
-  /* Suppress unused parameter warnings */
-  (void)pAux;
   GraphVtab *pNew;
   int rc = SQLITE_OK;
   
@@ -93,32 +177,30 @@ int graphCreate(sqlite3 *pDb, void *pAux, int argc,
   /* Set up virtual table base */
   pNew->pDb = pDb;
   pNew->nRef = 1;
+  pNew->pCodec = pAux;
   
   /* Copy database and table names */
   pNew->zDbName = sqlite3_mprintf("%s", argv[1]);
   pNew->zTableName = sqlite3_mprintf("%s", argv[2]);
-/* 
- * Minimal patch for graphCreate to support custom table names
- * This adds the logic after the original table name copying
- */
-
-  /* Parse node and edge table names from arguments if provided */
-  if (argc >= 5) {
-    /* Custom table names: CREATE VIRTUAL TABLE graph USING graph(nodes_table, edges_table) */
-    pNew->zNodeTableName = sqlite3_mprintf("%s", argv[3]);
-    pNew->zEdgeTableName = sqlite3_mprintf("%s", argv[4]);
-  } else {
-    /* Default: use virtual table name with _nodes and _edges suffixes */
-    pNew->zNodeTableName = sqlite3_mprintf("%s_nodes", argv[2]);
-    pNew->zEdgeTableName = sqlite3_mprintf("%s_edges", argv[2]);
+  rc = graphParseArgs(pNew, argc, argv, pzErr);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(pNew->zDbName);
+    sqlite3_free(pNew->zTableName);
+    sqlite3_free(pNew->zNodeTableName);
+    sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
+    sqlite3_free(pNew);
+    return rc;
   }
-  
-  
+
   if( pNew->zDbName==0 || pNew->zTableName==0 || pNew->zNodeTableName==0 || pNew->zEdgeTableName==0 ){
     sqlite3_free(pNew->zDbName);
     sqlite3_free(pNew->zTableName);
     sqlite3_free(pNew->zNodeTableName);
     sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
     sqlite3_free(pNew);
     return SQLITE_NOMEM;
   }
@@ -143,6 +225,8 @@ int graphCreate(sqlite3 *pDb, void *pAux, int argc,
     sqlite3_free(pNew->zTableName);
     sqlite3_free(pNew->zNodeTableName);
     sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
     sqlite3_free(pNew);
     *pzErr = sqlite3_mprintf("Failed to declare vtab schema: %s", 
                              sqlite3_errmsg(pDb));
@@ -162,13 +246,34 @@ int graphCreate(sqlite3 *pDb, void *pAux, int argc,
     sqlite3_free(pNew->zTableName);
     sqlite3_free(pNew->zNodeTableName);
     sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
+    sqlite3_free(pNew);
+    return rc;
+  }
+
+  rc = graphLabelIndexInit(pNew);
+  if( rc==SQLITE_OK ) rc = graphEdgeIndexInit(pNew);
+  if( rc==SQLITE_OK ) rc = graphDegreeIndexInit(pNew);
+  if( rc==SQLITE_OK && pNew->ePropFormat ) rc = graphPropertyFormatInit(pNew, 1);
+  if( rc==SQLITE_OK ) rc = graphCSRFileInit(pNew);
+  if( rc==SQLITE_OK ) rc = graphResultCacheInit(pNew);
+  if( rc==SQLITE_OK ) rc = graphStatsLoad(pNew);
+  if( rc!=SQLITE_OK ){
+    *pzErr = sqlite3_mprintf("Failed to create graph indexes: %s",
+                             sqlite3_errmsg(pDb));
+    sqlite3_free(pNew->zDbName);
+    sqlite3_free(pNew->zTableName);
+    sqlite3_free(pNew->zNodeTableName);
+    sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
     sqlite3_free(pNew);
     return rc;
   }
   
   *ppVtab = &pNew->base;
-  extern void setGlobalGraph(GraphVtab *pNewGraph);
-  setGlobalGraph(pNew);
+  graphRegistryAdd(pNew);
   return SQLITE_OK;
 }
 
@@ -180,10 +285,6 @@ int graphCreate(sqlite3 *pDb, void *pAux, int argc,
 int graphConnect(sqlite3 *pDb, void *pAux, int argc, 
                  const char *const *argv, sqlite3_vtab **ppVtab,
                  char **pzErr){
-  (void)pAux;
-  (void)argc;
-  (void)argv;
-  (void)pzErr;
   GraphVtab *pNew;
   int rc = SQLITE_OK;
 
@@ -196,26 +297,30 @@ int graphConnect(sqlite3 *pDb, void *pAux, int argc,
   
   pNew->pDb = pDb;
   pNew->nRef = 1;
+  pNew->pCodec = pAux;
   
   pNew->zDbName = sqlite3_mprintf("%s", argv[1]);
   pNew->zTableName = sqlite3_mprintf("%s", argv[2]);
   
-  /* Parse node and edge table names from arguments if provided */
-  if (argc >= 5) {
-    /* Custom table names: CREATE VIRTUAL TABLE graph USING graph(nodes_table, edges_table) */
-    pNew->zNodeTableName = sqlite3_mprintf("%s", argv[3]);
-    pNew->zEdgeTableName = sqlite3_mprintf("%s", argv[4]);
-  } else {
-    /* Default: use virtual table name with _nodes and _edges suffixes */
-    pNew->zNodeTableName = sqlite3_mprintf("%s_nodes", argv[2]);
-    pNew->zEdgeTableName = sqlite3_mprintf("%s_edges", argv[2]);
+  rc = graphParseArgs(pNew, argc, argv, pzErr);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(pNew->zDbName);
+    sqlite3_free(pNew->zTableName);
+    sqlite3_free(pNew->zNodeTableName);
+    sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
+    sqlite3_free(pNew);
+    return rc;
   }
-  
+
   if( pNew->zDbName==0 || pNew->zTableName==0 || pNew->zNodeTableName==0 || pNew->zEdgeTableName==0 ){
     sqlite3_free(pNew->zDbName);
     sqlite3_free(pNew->zTableName);
     sqlite3_free(pNew->zNodeTableName);
     sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
     sqlite3_free(pNew);
     return SQLITE_NOMEM;
   }
@@ -239,6 +344,8 @@ int graphConnect(sqlite3 *pDb, void *pAux, int argc,
     sqlite3_free(pNew->zTableName);
     sqlite3_free(pNew->zNodeTableName);
     sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
     sqlite3_free(pNew);
     *pzErr = sqlite3_mprintf("Failed to declare vtab schema: %s", 
                              sqlite3_errmsg(pDb));
@@ -278,61 +385,228 @@ int graphConnect(sqlite3 *pDb, void *pAux, int argc,
       sqlite3_free(pNew->zTableName);
     sqlite3_free(pNew->zNodeTableName);
     sqlite3_free(pNew->zEdgeTableName);
+    sqlite3_free(pNew->zPropsExpr);
+    sqlite3_free(pNew->zCSRFile);
       sqlite3_free(pNew);
       return rc;
     }
   }
 
+  /* Older databases get their label, edge and degree indexes here; a
+  ** read-only database without them keeps working with unindexed scans */
+  graphLabelIndexInit(pNew);
+  graphEdgeIndexInit(pNew);
+  graphDegreeIndexInit(pNew);
+  graphCSRFileInit(pNew);
+  graphResultCacheInit(pNew);
+  graphStatsLoad(pNew);
+
   *ppVtab = &pNew->base;
-  extern void setGlobalGraph(GraphVtab *pNewGraph);
-  setGlobalGraph(pNew);
+  graphRegistryAdd(pNew);
   return SQLITE_OK;
 }
 
+/*
+** Columns of the graph virtual table, in declaration order.
+*/
+#define GRAPH_COL_TYPE        0
+#define GRAPH_COL_ID          1
+#define GRAPH_COL_FROM_ID     2
+#define GRAPH_COL_TO_ID       3
+#define GRAPH_COL_LABELS      4
+#define GRAPH_COL_REL_TYPE    5
+
+/* Edge rowids carry this bit; node rowids are the node id */
+#define GRAPH_EDGE_ROWID_BIT  (((sqlite3_int64)1)<<62)
+
+/* Row counts assumed before graph_analyze() has run */
+#define GRAPH_DEFAULT_NODES   1000
+#define GRAPH_DEFAULT_EDGES   2000
+
+/*
+** Map a constraint operator to the character graphFilter() reads back
+** from idxStr, or return 0 if the operator is not pushed down.
+*/
+static char graphConstraintOp(unsigned char op){
+  switch( op ){
+    case SQLITE_INDEX_CONSTRAINT_EQ: return '=';
+    case SQLITE_INDEX_CONSTRAINT_LT: return '<';
+    case SQLITE_INDEX_CONSTRAINT_LE: return '{';
+    case SQLITE_INDEX_CONSTRAINT_GT: return '>';
+    case SQLITE_INDEX_CONSTRAINT_GE: return '}';
+  }
+  return 0;
+}
+
+/*
+** Return the text of the right-hand side of constraint i when SQLite
+** knows it at planning time, or NULL.
+*/
+static const char *graphConstraintText(sqlite3_index_info *pInfo, int i){
+  sqlite3_value *pVal = 0;
+  if( sqlite3_vtab_rhs_value(pInfo, i, &pVal)!=SQLITE_OK || pVal==0 ){
+    return 0;
+  }
+  if( sqlite3_value_type(pVal)!=SQLITE_TEXT ) return 0;
+  return (const char*)sqlite3_value_text(pVal);
+}
+
+/*
+** Estimated nodes carrying the labels value zLabels. Only a one-label
+** array such as '["Person"]' is looked up in the statistics.
+*/
+static double graphLabelsEstimate(const GraphStats *pStats, double nNodes,
+                                  const char *zLabels){
+  const GraphStatsEntry *pEntry = 0;
+  int n;
+
+  if( zLabels && zLabels[0]=='[' && zLabels[1]=='"' ){
+    n = (int)strlen(zLabels);
+    if( n>4 && zLabels[n-1]==']' && zLabels[n-2]=='"'
+     && memchr(zLabels+2, '"', n-4)==0 ){
+      char *zLabel = sqlite3_mprintf("%.*s", n-4, zLabels+2);
+      pEntry = graphStatsLabel(pStats, zLabel);
+      sqlite3_free(zLabel);
+      if( pEntry ) return (double)pEntry->n;
+      if( pStats ) return 1.0;
+    }
+  }
+  if( pStats && pStats->nLabel>0 ) return nNodes / pStats->nLabel;
+  return nNodes / 10.0;
+}
+
 /*
 ** Query planner interface.
-** Provides cost estimates and index usage hints to SQLite.
-** Performance: Critical for query optimization.
+** Pushes EQ and range constraints on rowid, type, id, from_id, to_id,
+** labels and rel_type down into SQL against the backing tables and
+** costs the result from the graph_analyze() statistics when present.
+** IN lists arrive as repeated EQ lookups.
+**
+** idxStr holds two characters per argv entry: the column ('r' for the
+** rowid, otherwise '0' + column index) and the operator character from
+** graphConstraintOp(). idxNum is 1 when the rowid is constrained.
 */
 int graphBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo){
-  int nNodes = 0, nEdges = 0;
-  int hasRowidConstraint = 0;
-  int constraintIdx = 0;
-  /* Debug output removed for production */
-
-  /* Check for rowid constraints (column == -1) */
-  for(int i = 0; i < pInfo->nConstraint; i++){
-    if( pInfo->aConstraint[i].usable ){
-      if( pInfo->aConstraint[i].iColumn == -1 && pInfo->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ ){
-        /* This is a rowid = ? constraint - we can handle this efficiently */
-        pInfo->aConstraintUsage[i].argvIndex = ++constraintIdx;
-        pInfo->aConstraintUsage[i].omit = 1;  /* We'll handle this constraint */
-        hasRowidConstraint = 1;
-      } else {
-        /* Other constraints - let SQLite handle them */
-        pInfo->aConstraintUsage[i].argvIndex = 0;
-        pInfo->aConstraintUsage[i].omit = 0;
+  GraphVtab *pGraphVtab = (GraphVtab*)pVtab;
+  const GraphStats *pStats = pGraphVtab->pStats;
+  double nNodes = pStats ? (double)pStats->nNodes : GRAPH_DEFAULT_NODES;
+  double nEdges = pStats ? (double)pStats->nEdges : GRAPH_DEFAULT_EDGES;
+  double rNodeRows = nNodes, rEdgeRows = nEdges;
+  int bNode = 1, bEdge = 1;          /* Side can still produce rows */
+  int bNodeSeek = 0, bEdgeSeek = 0;  /* Side is reached through an index */
+  int bRowid = 0;
+  int nArg = 0;
+  char *zIdx;
+  int i;
+
+  zIdx = sqlite3_malloc(pInfo->nConstraint*2 + 1);
+  if( zIdx==0 ) return SQLITE_NOMEM;
+
+  for(i=0; i<pInfo->nConstraint; i++){
+    const struct sqlite3_index_constraint *pCons = &pInfo->aConstraint[i];
+    const char *zColl;
+    char cOp;
+    int bEq;
+
+    if( !pCons->usable ) continue;
+    cOp = graphConstraintOp(pCons->op);
+    if( cOp==0 ) continue;
+    bEq = (cOp=='=');
+    zColl = sqlite3_vtab_collation(pInfo, i);
+    if( zColl && sqlite3_stricmp(zColl, "BINARY")!=0 ) continue;
+
+    switch( pCons->iColumn ){
+      case -1:
+        if( !bEq ) continue;
+        bRowid = 1;
+        rNodeRows = rEdgeRows = 1.0;
+        bNodeSeek = bEdgeSeek = 1;
+        break;
+      case GRAPH_COL_TYPE: {
+        const char *zType = bEq ? graphConstraintText(pInfo, i) : 0;
+        if( zType ){
+          if( strcmp(zType, "node")!=0 ) bNode = 0;
+          if( strcmp(zType, "edge")!=0 ) bEdge = 0;
+        }
+        break;
+      }
+      case GRAPH_COL_ID:
+        if( bEq ){
+          rNodeRows = rNodeRows<1.0 ? rNodeRows : 1.0;
+          rEdgeRows = rEdgeRows<1.0 ? rEdgeRows : 1.0;
+        }else{
+          rNodeRows *= 0.25;
+          rEdgeRows *= 0.25;
+        }
+        bNodeSeek = bEdgeSeek = 1;
+        break;
+      case GRAPH_COL_FROM_ID:
+      case GRAPH_COL_TO_ID: {
+        double nEnds = 0;
+        if( pStats ){
+          nEnds = (double)(pCons->iColumn==GRAPH_COL_FROM_ID ?
+                           pStats->nSources : pStats->nTargets);
+        }
+        if( nEnds<1.0 ) nEnds = nNodes>1.0 ? nNodes : 1.0;
+        bNode = 0;
+        rEdgeRows *= bEq ? 1.0/nEnds : 0.25;
+        bEdgeSeek = 1;
+        break;
+      }
+      case GRAPH_COL_LABELS:
+        if( !bEq ) continue;
+        bEdge = 0;
+        rNodeRows *= graphLabelsEstimate(pStats, nNodes,
+                                         graphConstraintText(pInfo, i))
+                     / (nNodes>1.0 ? nNodes : 1.0);
+        break;
+      case GRAPH_COL_REL_TYPE: {
+        const GraphStatsEntry *pEntry = 0;
+        if( !bEq ) continue;
+        pEntry = graphStatsType(pStats, graphConstraintText(pInfo, i));
+        bNode = 0;
+        if( pEntry ){
+          rEdgeRows *= (double)pEntry->n / (nEdges>1.0 ? nEdges : 1.0);
+        }else if( pStats ){
+          rEdgeRows *= 1.0 / (pStats->nType>0 ? pStats->nType : 1);
+        }else{
+          rEdgeRows *= 0.1;
+        }
+        break;
       }
+      default:
+        continue;
     }
+
+    zIdx[nArg*2] = pCons->iColumn<0 ? 'r' : (char)('0' + pCons->iColumn);
+    zIdx[nArg*2+1] = cOp;
+    pInfo->aConstraintUsage[i].argvIndex = ++nArg;
+    pInfo->aConstraintUsage[i].omit = 1;
   }
+  zIdx[nArg*2] = 0;
 
-  /* Use static estimates to avoid potential infinite loops */
-  nNodes = 1000;  /* Default estimate */
-  nEdges = 2000;  /* Default estimate */
-  if( hasRowidConstraint ){
-    /* If we have a rowid constraint, this should be very efficient */
-    pInfo->estimatedCost = 1.0;
-    pInfo->estimatedRows = 1;
-    pInfo->idxNum = 1;  /* Indicate we're using rowid lookup */
-  } else {
-    pInfo->estimatedCost = (double)(nNodes + nEdges);
-    pInfo->estimatedRows = nNodes + nEdges;
-    pInfo->idxNum = 0;  /* Full table scan */
+  /* A side without an index seek is a full scan of its backing table */
+  {
+    double rCost = 0.0, rRows = 0.0;
+    if( bNode ){
+      rCost += bNodeSeek ? 1.0 + rNodeRows : nNodes;
+      rRows += rNodeRows;
+    }
+    if( bEdge ){
+      rCost += bEdgeSeek ? 1.0 + rEdgeRows : nEdges;
+      rRows += rEdgeRows;
+    }
+    if( rRows<1.0 ) rRows = 1.0;
+    if( bRowid ) rRows = 1.0;
+    pInfo->estimatedCost = rCost>1.0 ? rCost : 1.0;
+    pInfo->estimatedRows = (sqlite3_int64)rRows;
   }
-  
-  pInfo->idxStr = 0;
-  pInfo->needToFreeIdxStr = 0;
-  
+  if( bRowid ) pInfo->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+
+  pInfo->idxNum = bRowid;
+  pInfo->idxStr = zIdx;
+  pInfo->needToFreeIdxStr = 1;
+
   return SQLITE_OK;
 }
 
@@ -350,8 +624,19 @@ int graphDisconnect(sqlite3_vtab *pVtab){
   pGraphVtab->nRef--;
   if( pGraphVtab->nRef<=0 ){
     /* Free memory but DON'T drop backing tables */
+    graphRegistryRemove(pGraphVtab);
+    graphStmtCacheClear(pGraphVtab);
+    graphCompressRelease(pGraphVtab->pCodec, pGraphVtab->zTableName);
+    graphResultCacheFree(pGraphVtab);
+    graphColumnsFree(pGraphVtab);
+    graphCSRInvalidate(pGraphVtab);
+    graphStatsFree(pGraphVtab->pStats);
     sqlite3_free(pGraphVtab->zDbName);
     sqlite3_free(pGraphVtab->zTableName);
+    sqlite3_free(pGraphVtab->zNodeTableName);
+    sqlite3_free(pGraphVtab->zEdgeTableName);
+    sqlite3_free(pGraphVtab->zPropsExpr);
+    sqlite3_free(pGraphVtab->zCSRFile);
     sqlite3_free(pGraphVtab);
   }
   
@@ -370,19 +655,45 @@ int graphDestroy(sqlite3_vtab *pVtab){
 
   assert( pGraphVtab!=0 );
 
+  /* Cached statements would keep the backing tables busy */
+  graphStmtCacheClear(pGraphVtab);
+  graphCompressRelease(pGraphVtab->pCodec, pGraphVtab->zTableName);
+  graphColumnsFree(pGraphVtab);
+
   /* Only drop backing tables on explicit DROP TABLE, not on disconnect */
   zSql = sqlite3_mprintf("DROP TABLE IF EXISTS %s; DROP TABLE IF EXISTS %s;", 
-                         pGraphVtab->zTableName, pGraphVtab->zTableName);
+                         pGraphVtab->zNodeTableName, pGraphVtab->zEdgeTableName);
   rc = sqlite3_exec(pGraphVtab->pDb, zSql, 0, 0, 0);
   sqlite3_free(zSql);
+  if( rc==SQLITE_OK ) rc = graphLabelIndexDrop(pGraphVtab);
+  if( rc==SQLITE_OK ) rc = graphDegreeIndexDrop(pGraphVtab);
+  if( rc==SQLITE_OK ) rc = graphStatsDrop(pGraphVtab);
+  if( rc==SQLITE_OK ) rc = graphCSRFileDrop(pGraphVtab);
+  if( rc==SQLITE_OK ) rc = graphResultCacheDrop(pGraphVtab);
+  if( rc==SQLITE_OK ) rc = graphColumnsDropTable(pGraphVtab);
+  if( rc==SQLITE_OK && pGraphVtab->ePropFormat==GRAPH_PROPS_PACKED ){
+    zSql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\".\"%w_dict\";"
+                           "DROP TABLE IF EXISTS \"%w\".\"%w_zdict\";",
+                           pGraphVtab->zDbName, pGraphVtab->zTableName,
+                           pGraphVtab->zDbName, pGraphVtab->zTableName);
+    rc = zSql ? sqlite3_exec(pGraphVtab->pDb, zSql, 0, 0, 0) : SQLITE_NOMEM;
+    sqlite3_free(zSql);
+  }
 
   if( rc!=SQLITE_OK ){
     return rc;
   }
   
   /* Free table names and structure */
+  graphRegistryRemove(pGraphVtab);
+  graphResultCacheFree(pGraphVtab);
+  graphCSRInvalidate(pGraphVtab);
   sqlite3_free(pGraphVtab->zDbName);
   sqlite3_free(pGraphVtab->zTableName);
+  sqlite3_free(pGraphVtab->zNodeTableName);
+  sqlite3_free(pGraphVtab->zEdgeTableName);
+  sqlite3_free(pGraphVtab->zPropsExpr);
+  sqlite3_free(pGraphVtab->zCSRFile);
   sqlite3_free(pGraphVtab);
   
   return SQLITE_OK;
@@ -424,20 +735,100 @@ int graphClose(sqlite3_vtab_cursor *pCursor){
   return SQLITE_OK;
 }
 
+/*
+** Append "AND <term>" for argv entry iArg, a cOp constraint on column
+** cCol as encoded by graphBestIndex(), to the node and edge WHERE
+** clauses. A column that is NULL on one side clears that side's flag,
+** since no comparison with NULL is true.
+*/
+static void graphFilterTerm(sqlite3_str *pNode, sqlite3_str *pEdge,
+                            char cCol, char cOp, int iArg,
+                            int *pbNode, int *pbEdge){
+  const char *zOp;
+  const char *zNodeCol = 0;
+  const char *zEdgeCol = 0;
+
+  switch( cOp ){
+    case '<': zOp = "<";  break;
+    case '{': zOp = "<="; break;
+    case '>': zOp = ">";  break;
+    case '}': zOp = ">="; break;
+    default:  zOp = "=";  break;
+  }
+  switch( cCol ){
+    case 'r':
+      sqlite3_str_appendf(pNode, " AND id = ?%d AND (?%d & %lld) = 0",
+                          iArg, iArg, GRAPH_EDGE_ROWID_BIT);
+      sqlite3_str_appendf(pEdge, " AND id = (?%d & ~%lld) AND (?%d & %lld) <> 0",
+                          iArg, GRAPH_EDGE_ROWID_BIT, iArg, GRAPH_EDGE_ROWID_BIT);
+      return;
+    case '0' + GRAPH_COL_TYPE:
+      sqlite3_str_appendf(pNode, " AND 'node' %s ?%d", zOp, iArg);
+      sqlite3_str_appendf(pEdge, " AND 'edge' %s ?%d", zOp, iArg);
+      return;
+    case '0' + GRAPH_COL_ID:       zNodeCol = "id"; zEdgeCol = "id"; break;
+    case '0' + GRAPH_COL_FROM_ID:  zEdgeCol = "source"; break;
+    case '0' + GRAPH_COL_TO_ID:    zEdgeCol = "target"; break;
+    case '0' + GRAPH_COL_LABELS:   zNodeCol = "labels"; break;
+    case '0' + GRAPH_COL_REL_TYPE: zEdgeCol = "edge_type"; break;
+  }
+  if( zNodeCol ){
+    sqlite3_str_appendf(pNode, " AND %s %s ?%d", zNodeCol, zOp, iArg);
+  }else{
+    *pbNode = 0;
+  }
+  if( zEdgeCol ){
+    sqlite3_str_appendf(pEdge, " AND %s %s ?%d", zEdgeCol, zOp, iArg);
+  }else{
+    *pbEdge = 0;
+  }
+}
+
+/*
+** Prepare one side of a filtered scan and bind every argv value whose
+** parameter number the statement uses.
+*/
+static int graphFilterPrepare(GraphVtab *pVtab, sqlite3_str *pSql,
+                              int argc, sqlite3_value **argv,
+                              sqlite3_stmt **ppStmt){
+  char *zSql;
+  int nParam;
+  int rc;
+  int i;
+
+  rc = sqlite3_str_errcode(pSql);
+  zSql = sqlite3_str_finish(pSql);
+  if( rc!=SQLITE_OK ){
+    sqlite3_free(zSql);
+    return rc;
+  }
+  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, ppStmt, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ) return rc;
+  nParam = sqlite3_bind_parameter_count(*ppStmt);
+  for(i=0; i<argc && i<nParam; i++){
+    rc = sqlite3_bind_value(*ppStmt, i+1, argv[i]);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+
 /*
 ** Filter cursor based on constraints.
-** Query processing: Implements WHERE clause filtering.
-** Performance: Optimizes iteration based on provided constraints.
+** Query processing: Turns the constraints chosen by graphBestIndex()
+** into WHERE clauses on the backing node and edge tables. A side that
+** cannot match is not scanned at all.
 */
 int graphFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
                 const char *idxStr, int argc, sqlite3_value **argv){
-  (void)idxStr;
+  (void)idxNum;
   GraphCursor *pGraphCursor = (GraphCursor*)pCursor;
   GraphVtab *pVtab = pGraphCursor->pVtab;
-  char *zSql;
-  int rc;
-
-  /* Debug output removed for production */
+  sqlite3_str *pNode;
+  sqlite3_str *pEdge;
+  int bNode = 1, bEdge = 1;
+  int rc = SQLITE_OK;
+  int i;
 
   sqlite3_finalize(pGraphCursor->pNodeStmt);
   pGraphCursor->pNodeStmt = 0;
@@ -447,64 +838,32 @@ int graphFilter(sqlite3_vtab_cursor *pCursor, int idxNum,
   /* Initialize cursor state - we start in "need to fetch first row" mode */
   pGraphCursor->iIterMode = -1;  /* -1 means "need to fetch first row" */
 
-  if( idxNum == 1 && argc > 0 ){
-    /* Rowid constraint - look up specific row */
-    sqlite3_int64 targetRowid = sqlite3_value_int64(argv[0]);
-    
-    if( targetRowid & (1LL << 62) ){
-      /* This is an edge rowid */
-      sqlite3_int64 edgeId = targetRowid & ~(1LL << 62);
-      zSql = sqlite3_mprintf("SELECT id, source, target, edge_type, weight, properties FROM %s WHERE id = %lld", 
-                             pVtab->zEdgeTableName, edgeId);
-      rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pGraphCursor->pEdgeStmt, 0);
-      sqlite3_free(zSql);
-      if( rc!=SQLITE_OK ) return rc;
-      
-      /* Skip nodes for this specific lookup, start with edge mode */
-      pGraphCursor->iIterMode = 0;  /* 0 means "fetch from edge stmt first" */
-    } else {
-      /* This is a node rowid */
-      zSql = sqlite3_mprintf("SELECT id, labels, properties FROM %s WHERE id = %lld", 
-                             pVtab->zNodeTableName, targetRowid);
-      rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pGraphCursor->pNodeStmt, 0);
-      sqlite3_free(zSql);
-      if( rc!=SQLITE_OK ) return rc;
-      
-      /* Skip edges for this specific lookup, start with node mode */
-      pGraphCursor->iIterMode = -1;  /* -1 means "fetch from node stmt first" */
-    }
-    
-    /* For rowid lookup, we don't need both statements */
-    if( pGraphCursor->iIterMode == -1 && !pGraphCursor->pEdgeStmt ){
-      /* Create empty edge statement to avoid issues in graphNext */
-      zSql = sqlite3_mprintf("SELECT id, source, target, edge_type, weight, properties FROM %s WHERE 0", pVtab->zEdgeTableName);
-      rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pGraphCursor->pEdgeStmt, 0);
-      sqlite3_free(zSql);
-      if( rc!=SQLITE_OK ) return rc;
-    }
-    
-    if( pGraphCursor->iIterMode == 0 && !pGraphCursor->pNodeStmt ){
-      /* Create empty node statement to avoid issues in graphNext */
-      zSql = sqlite3_mprintf("SELECT id, labels, properties FROM %s WHERE 0", pVtab->zNodeTableName);
-      rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pGraphCursor->pNodeStmt, 0);
-      sqlite3_free(zSql);
-      if( rc!=SQLITE_OK ) return rc;
-    }
-  } else {
-    /* Full table scan */
-    zSql = sqlite3_mprintf("SELECT id, labels, properties FROM %s", pVtab->zNodeTableName);
-    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pGraphCursor->pNodeStmt, 0);
-    sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) return rc;
+  pNode = sqlite3_str_new(pVtab->pDb);
+  pEdge = sqlite3_str_new(pVtab->pDb);
+  sqlite3_str_appendf(pNode,
+      "SELECT id, labels, %s FROM \"%w\" WHERE 1",
+      graphPropsColumn(pVtab), pVtab->zNodeTableName);
+  sqlite3_str_appendf(pEdge,
+      "SELECT id, source, target, edge_type, weight, %s"
+      " FROM \"%w\" WHERE 1", graphPropsColumn(pVtab), pVtab->zEdgeTableName);
+  for(i=0; idxStr && i<argc && idxStr[i*2]; i++){
+    graphFilterTerm(pNode, pEdge, idxStr[i*2], idxStr[i*2+1], i+1,
+                    &bNode, &bEdge);
+  }
 
-    zSql = sqlite3_mprintf("SELECT id, source, target, edge_type, weight, properties FROM %s", pVtab->zEdgeTableName);
-    rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pGraphCursor->pEdgeStmt, 0);
-    sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) return rc;
-    
-    /* For full scan, start with nodes */
-    pGraphCursor->iIterMode = -1;  /* -1 means "fetch from node stmt first" */
+  if( bNode ){
+    rc = graphFilterPrepare(pVtab, pNode, argc, argv,
+                            &pGraphCursor->pNodeStmt);
+  }else{
+    sqlite3_free(sqlite3_str_finish(pNode));
   }
+  if( bEdge && rc==SQLITE_OK ){
+    rc = graphFilterPrepare(pVtab, pEdge, argc, argv,
+                            &pGraphCursor->pEdgeStmt);
+  }else{
+    sqlite3_free(sqlite3_str_finish(pEdge));
+  }
+  if( rc!=SQLITE_OK ) return rc;
 
   /* Position cursor on first row */
   return graphNext(pCursor);
@@ -710,7 +1069,7 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
    * 0: type, 1: id, 2: from_id, 3: to_id, 4: labels, 5: rel_type, 6: weight, 7: properties, 8: query
    * So column indices for INSERT/UPDATE are: argv[2] = type, argv[3] = id, etc.
    */
-
+  graphCSRTrackBegin(pGraphVtab);
 
   // DELETE operation
   if (argc == 1) {
@@ -719,12 +1078,16 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
     if (rowid & (1LL << 62)) { // Edge
       zSql = sqlite3_mprintf("DELETE FROM %s WHERE id = %lld", 
                              pGraphVtab->zEdgeTableName, rowid & ~(1LL << 62));
+      graphCSRTrackEdgeRow(pGraphVtab, CSR_OP_DEL_EDGE, rowid & ~(1LL << 62));
     } else { // Node
       zSql = sqlite3_mprintf("DELETE FROM %s WHERE id = %lld", 
                              pGraphVtab->zNodeTableName, rowid);
     }
     rc = sqlite3_exec(pGraphVtab->pDb, zSql, 0, 0, &zErr);
     sqlite3_free(zSql);
+    if (rc == SQLITE_OK && !(rowid & (1LL << 62))) {
+      graphCSRTrack(pGraphVtab, CSR_OP_DEL_NODE, rowid, 0, 0.0);
+    }
   }
   // INSERT operation (argv[0] and argv[1] are NULL)
   else if (argc >= 11 && sqlite3_value_type(argv[0]) == SQLITE_NULL && 
@@ -809,8 +1172,10 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
       }
       char *zSql;
       if (node_id > 0) {
-        // Insert with specific ID - use INSERT OR REPLACE for upsert behavior
-        zSql = sqlite3_mprintf("INSERT OR REPLACE INTO %s (id, labels, properties) VALUES (%lld, %Q, %Q)", 
+        // Insert with specific ID - upsert, so the update triggers keep the
+        // label and degree indexes right (REPLACE skips the delete triggers)
+        zSql = sqlite3_mprintf("INSERT INTO %s (id, labels, properties) VALUES (%lld, %Q, %Q)"
+                               " ON CONFLICT(id) DO UPDATE SET labels=excluded.labels, properties=excluded.properties", 
                                pGraphVtab->zNodeTableName, node_id, labels, properties);
       } else {
         // Auto-generate ID
@@ -827,6 +1192,7 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
         } else {
           *pRowid = sqlite3_last_insert_rowid(pGraphVtab->pDb);
         }
+        graphCSRTrack(pGraphVtab, CSR_OP_ADD_NODE, *pRowid, 0, 0.0);
       }
     } 
     else if (type && strcmp(type, "edge") == 0) {
@@ -891,6 +1257,8 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
             
             if (rc == SQLITE_OK) {
               *pRowid = sqlite3_last_insert_rowid(pGraphVtab->pDb) | (1LL << 62);
+              graphCSRTrackEdgeRow(pGraphVtab, CSR_OP_ADD_EDGE,
+                                   sqlite3_last_insert_rowid(pGraphVtab->pDb));
             }
           } else {
             // One or both nodes don't exist
@@ -931,17 +1299,22 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
       if (old_rowid & (1LL << 62)) { // Edge
         // Update edge
         sqlite3_int64 edge_id = old_rowid & ~(1LL << 62);
-        char *zUpdates[4] = {0, 0, 0, 0};
+        char *zUpdates[5] = {0, 0, 0, 0, 0};
         int nUpdates = 0;
 
         // from_id (argv[4])
         if (sqlite3_value_type(argv[4]) != SQLITE_NULL) {
-          zUpdates[nUpdates++] = sqlite3_mprintf("from_id = %lld", sqlite3_value_int64(argv[4]));
+          zUpdates[nUpdates++] = sqlite3_mprintf("source = %lld", sqlite3_value_int64(argv[4]));
         }
         
         // to_id (argv[5])
         if (sqlite3_value_type(argv[5]) != SQLITE_NULL) {
-          zUpdates[nUpdates++] = sqlite3_mprintf("to_id = %lld", sqlite3_value_int64(argv[5]));
+          zUpdates[nUpdates++] = sqlite3_mprintf("target = %lld", sqlite3_value_int64(argv[5]));
+        }
+
+        // rel_type (argv[7])
+        if (sqlite3_value_type(argv[7]) != SQLITE_NULL) {
+          zUpdates[nUpdates++] = sqlite3_mprintf("edge_type = %Q", sqlite3_value_text(argv[7]));
         }
         
         // weight (argv[8])
@@ -955,6 +1328,12 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
         }
 
         if (nUpdates > 0) {
+          // A new end or weight moves the edge in the snapshot
+          int bMoved = sqlite3_value_type(argv[4]) != SQLITE_NULL
+                    || sqlite3_value_type(argv[5]) != SQLITE_NULL
+                    || sqlite3_value_type(argv[8]) != SQLITE_NULL;
+          if (bMoved) graphCSRTrackEdgeRow(pGraphVtab, CSR_OP_DEL_EDGE, edge_id);
+
           // Build UPDATE statement
           char *zJoinedUpdates = sqlite3_mprintf("%s", zUpdates[0]);
           for (int i = 1; i < nUpdates; i++) {
@@ -964,10 +1343,13 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
           }
 
           zSql = sqlite3_mprintf("UPDATE %s SET %s WHERE id = %lld", 
-                                 pGraphVtab->zTableName, zJoinedUpdates, edge_id);
+                                 pGraphVtab->zEdgeTableName, zJoinedUpdates, edge_id);
           rc = sqlite3_exec(pGraphVtab->pDb, zSql, 0, 0, &zErr);
           sqlite3_free(zSql);
           sqlite3_free(zJoinedUpdates);
+          if (rc == SQLITE_OK && bMoved) {
+            graphCSRTrackEdgeRow(pGraphVtab, CSR_OP_ADD_EDGE, edge_id);
+          }
         }
 
         // Free update strings
@@ -982,6 +1364,7 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
                                  pGraphVtab->zNodeTableName, properties, old_rowid);
           rc = sqlite3_exec(pGraphVtab->pDb, zSql, 0, 0, &zErr);
           sqlite3_free(zSql);
+          if (rc == SQLITE_OK) graphColumnsTouch(pGraphVtab, old_rowid, 0);
         }
       }
     }
@@ -990,10 +1373,14 @@ int graphUpdate(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int
     zErr = sqlite3_mprintf("Invalid number of arguments: %d", argc);
   }
 
-  if (rc != SQLITE_OK && zErr) {
+  if (rc == SQLITE_OK) {
+    graphBumpDataVersion(pGraphVtab);
+  } else if (zErr) {
     pVtab->zErrMsg = sqlite3_mprintf("graph operation failed: %s", zErr);
     sqlite3_free(zErr);
   }
+  /* The row this call writes counts in total_changes at statement end */
+  graphCSRTrackEnd(pGraphVtab, rc, 1);
 
   return rc;
 }
@@ -17,6 +17,10 @@ SQLITE_EXTENSION_INIT1
 #include "graph-memory.h"
 #include "cypher.h"
 #include "graph-util.h"
+#include "graph-csr.h"
+#include "graph-stats.h"
+#include "graph-performance.h"
+#include "graph-metrics.h"
 #include "graph-memory.h"
 #include "cypher-planner.h"
 #include "cypher-executor.h"
@@ -34,18 +38,6 @@ SQLITE_EXTENSION_INIT1
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
 #endif
 
-/* A global pointer to the graph virtual table. Not ideal, but simple. */
-GraphVtab *pGraph = 0;
-
-/* Simple access to global pGraph without mutex for now */
-GraphVtab *getGlobalGraph(void) {
-  return pGraph;
-}
-
-void setGlobalGraph(GraphVtab *pNewGraph) {
-  pGraph = pNewGraph;
-}
-
 /*
 ** Forward declarations for SQL functions.
 ** These will be implemented as the extension develops.
@@ -57,6 +49,7 @@ static void graphCountEdgesFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphShortestPathFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphPageRankFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphDegreeCentralityFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphDegreeFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphIsConnectedFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphDensityFunc(sqlite3_context*, int, sqlite3_value**);
 void graphBetweennessCentralityFunc(sqlite3_context*, int, sqlite3_value**);
@@ -65,6 +58,19 @@ static void graphTopologicalSortFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphHasCycleFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphConnectedComponentsFunc(sqlite3_context*, int, sqlite3_value**);
 static void graphStronglyConnectedComponentsFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphTriangleCountFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphNeighborScoreFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphKhopCountApproxFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphSchedulerStatsFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphResultCacheFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphSetThreadsFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphCreateIndexFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphCreateConstraintFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphCreateColumnFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphDropColumnFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphColumnsFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphExpandFunc(sqlite3_context*, int, sqlite3_value**);
+static void graphAnalyzeFunc(sqlite3_context*, int, sqlite3_value**);
 
 /* Additional operations */
 static void graphNodeUpdateFunc(sqlite3_context*, int, sqlite3_value**);
@@ -94,12 +100,40 @@ int sqlite3_graph_init(
   const sqlite3_api_routines *pApi
 ){
   int rc = SQLITE_OK;
+  void *pCodec = 0;
   SQLITE_EXTENSION_INIT2(pApi);
   
-  /* No mutex initialization needed for simplified approach */
+  /* Graphs register under the connection as they are connected */
+  rc = graphRegisterRegistry(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_use: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  rc = graphRegisterProjections(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_project: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  rc = graphRegisterJobs(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_job_submit: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
   
+  /* The module receives the connection's property dictionaries, so a
+  ** graph releases its cached dictionary statements on disconnect */
+  rc = graphRegisterCompressionFunctions(pDb, &pCodec);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register compression functions: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
   /* Register the graph virtual table module */
-  rc = sqlite3_create_module(pDb, "graph", &graphModule, (void *)&pGraph);
+  rc = sqlite3_create_module(pDb, "graph", &graphModule, pCodec);
   if( rc!=SQLITE_OK ){
     *pzErrMsg = sqlite3_mprintf("Failed to register graph module: %s", 
                                 sqlite3_errmsg(pDb));
@@ -148,7 +182,7 @@ int sqlite3_graph_init(
   }
   
   /* Register algorithm functions */
-  rc = sqlite3_create_function(pDb, "graph_shortest_path", 2, SQLITE_UTF8, 0,
+  rc = sqlite3_create_function(pDb, "graph_shortest_path", -1, SQLITE_UTF8, 0,
                               graphShortestPathFunc, 0, 0);
   if( rc!=SQLITE_OK ){
     *pzErrMsg = sqlite3_mprintf("Failed to register graph_shortest_path: %s",
@@ -172,6 +206,14 @@ int sqlite3_graph_init(
     return rc;
   }
   
+  rc = sqlite3_create_function(pDb, "graph_degree", -1, SQLITE_UTF8, 0,
+                              graphDegreeFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_degree: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
   rc = sqlite3_create_function(pDb, "graph_is_connected", 0, SQLITE_UTF8, 0,
                               graphIsConnectedFunc, 0, 0);
   if( rc!=SQLITE_OK ){
@@ -189,7 +231,7 @@ int sqlite3_graph_init(
   }
   
   /* Register advanced algorithm functions */
-  rc = sqlite3_create_function(pDb, "graph_betweenness_centrality", 0, SQLITE_UTF8, 0,
+  rc = sqlite3_create_function(pDb, "graph_betweenness_centrality", -1, SQLITE_UTF8, 0,
                               graphBetweennessCentralityFunc, 0, 0);
   if( rc!=SQLITE_OK ){
     *pzErrMsg = sqlite3_mprintf("Failed to register graph_betweenness_centrality: %s",
@@ -197,7 +239,7 @@ int sqlite3_graph_init(
     return rc;
   }
   
-  rc = sqlite3_create_function(pDb, "graph_closeness_centrality", 0, SQLITE_UTF8, 0,
+  rc = sqlite3_create_function(pDb, "graph_closeness_centrality", -1, SQLITE_UTF8, 0,
                               graphClosenessCentralityFunc, 0, 0);
   if( rc!=SQLITE_OK ){
     *pzErrMsg = sqlite3_mprintf("Failed to register graph_closeness_centrality: %s",
@@ -237,6 +279,127 @@ int sqlite3_graph_init(
     return rc;
   }
   
+  rc = sqlite3_create_function(pDb, "graph_triangle_count", -1, SQLITE_UTF8, 0,
+                              graphTriangleCountFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_triangle_count: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  /* Link prediction scores share one function; user data picks the score */
+  {
+    static int aScore[] = {
+      GRAPH_SCORE_COMMON, GRAPH_SCORE_JACCARD, GRAPH_SCORE_ADAMIC_ADAR
+    };
+    static const char *const azScore[] = {
+      "graph_common_neighbors", "graph_jaccard", "graph_adamic_adar"
+    };
+    int i;
+    for( i=0; i<3; i++ ){
+      rc = sqlite3_create_function(pDb, azScore[i], 2, SQLITE_UTF8,
+                                   &aScore[i], graphNeighborScoreFunc, 0, 0);
+      if( rc!=SQLITE_OK ){
+        *pzErrMsg = sqlite3_mprintf("Failed to register %s: %s",
+                                    azScore[i], sqlite3_errmsg(pDb));
+        return rc;
+      }
+    }
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_khop_count_approx", -1, SQLITE_UTF8,
+                              0, graphKhopCountApproxFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_khop_count_approx: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_scheduler_stats", 0, SQLITE_UTF8, 0,
+                              graphSchedulerStatsFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_scheduler_stats: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
+  rc = sqlite3_create_function(pDb, "graph_result_cache", -1, SQLITE_UTF8, 0,
+                              graphResultCacheFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_result_cache: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
+  /* The worker pool outlives queries; this connection holds a reference
+  ** that graphThreadPoolRelease() drops when the function is destroyed
+  ** (connection close, or on registration failure) */
+  graphThreadPoolRetain();
+  rc = sqlite3_create_function_v2(pDb, "graph_set_threads", 1, SQLITE_UTF8, 0,
+                                  graphSetThreadsFunc, 0, 0,
+                                  graphThreadPoolRelease);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_set_threads: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
+  rc = sqlite3_create_function(pDb, "graph_create_index", 2, SQLITE_UTF8, 0,
+                              graphCreateIndexFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_create_index: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_create_constraint", 2, SQLITE_UTF8, 0,
+                              graphCreateConstraintFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_create_constraint: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_create_column", 2, SQLITE_UTF8, 0,
+                              graphCreateColumnFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_create_column: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_drop_column", 2, SQLITE_UTF8, 0,
+                              graphDropColumnFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_drop_column: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_columns", 0, SQLITE_UTF8, 0,
+                              graphColumnsFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_columns: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_expand", -1, SQLITE_UTF8, 0,
+                              graphExpandFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_expand: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = sqlite3_create_function(pDb, "graph_analyze", 0, SQLITE_UTF8, 0,
+                              graphAnalyzeFunc, 0, 0);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_analyze: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
   /* Register Cypher language support functions */
   rc = cypherRegisterSqlFunctions(pDb);
   if( rc!=SQLITE_OK ){
@@ -261,6 +424,14 @@ int sqlite3_graph_init(
     return rc;
   }
   
+  /* The plan cache is shared by all connections; the first load
+  ** creates it, before the executor functions add their front cache */
+  rc = graphInitPlanCache(0, 0);
+  if( rc!=SQLITE_OK && rc!=SQLITE_MISUSE ){
+    *pzErrMsg = sqlite3_mprintf("Failed to create the Cypher plan cache");
+    return rc;
+  }
+  
   /* Register Cypher executor functions */
   rc = cypherRegisterExecutorSqlFunctions(pDb);
   if( rc!=SQLITE_OK ){
@@ -269,6 +440,34 @@ int sqlite3_graph_init(
     return rc;
   }
   
+  rc = graphRegisterPlanCacheFunctions(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register plan cache functions: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = graphRegisterBulkLoadFunctions(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_bulk_load: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
+  rc = graphRegisterMetrics(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_metrics: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+
+  rc = graphRegisterBenchmarkFunctions(pDb);
+  if( rc!=SQLITE_OK ){
+    *pzErrMsg = sqlite3_mprintf("Failed to register graph_benchmark: %s",
+                                sqlite3_errmsg(pDb));
+    return rc;
+  }
+  
   /* Register additional graph operations */
   rc = sqlite3_create_function(pDb, "graph_node_update", 2, SQLITE_UTF8, 0,
                               graphNodeUpdateFunc, 0, 0);
@@ -335,7 +534,7 @@ const unsigned char *zProperties;
 char *zSql;
 int rc;
 
-GraphVtab *pLocalGraph = getGlobalGraph();
+GraphVtab *pLocalGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
 if( pLocalGraph==0 ){
 sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
   return;
@@ -352,7 +551,13 @@ sqlite3_result_error(pCtx, "No graph table available. Create a graph table first
   zProperties = sqlite3_value_text(argv[1]);
 
   zSql = sqlite3_mprintf("INSERT INTO %s_nodes(id, properties) VALUES(%lld, %Q)", pLocalGraph->zTableName, iNodeId, zProperties);
+  graphCSRTrackBegin(pLocalGraph);
   rc = sqlite3_exec(pLocalGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pLocalGraph);
+    graphCSRTrack(pLocalGraph, CSR_OP_ADD_NODE, iNodeId, 0, 0.0);
+  }
+  graphCSRTrackEnd(pLocalGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -370,6 +575,7 @@ sqlite3_result_error(pCtx, "No graph table available. Create a graph table first
 */
 static void graphEdgeAddFunc(sqlite3_context *pCtx, int argc,
                             sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iFromId, iToId;
   double rWeight;
   const unsigned char *zProperties;
@@ -393,8 +599,15 @@ static void graphEdgeAddFunc(sqlite3_context *pCtx, int argc,
   rWeight = sqlite3_value_double(argv[2]);
   zProperties = sqlite3_value_text(argv[3]);
 
-  zSql = sqlite3_mprintf("INSERT INTO %s_edges(from_id, to_id, weight, properties) VALUES(%lld, %lld, %f, %Q)", pGraph->zTableName, iFromId, iToId, rWeight, zProperties);
+  zSql = sqlite3_mprintf("INSERT INTO %s(source, target, weight, properties) VALUES(%lld, %lld, %f, %Q)", pGraph->zEdgeTableName, iFromId, iToId, rWeight, zProperties);
+  graphCSRTrackBegin(pGraph);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pGraph);
+    graphCSRTrackEdgeRow(pGraph, CSR_OP_ADD_EDGE,
+                         sqlite3_last_insert_rowid(pGraph->pDb));
+  }
+  graphCSRTrackEnd(pGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -412,9 +625,9 @@ static void graphEdgeAddFunc(sqlite3_context *pCtx, int argc,
 */
 static void graphCountNodesFunc(sqlite3_context *pCtx, int argc,
                                sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   (void)argv;  /* Currently unused */
-  char *zSql;
-  sqlite3_stmt *pStmt;
+  sqlite3_int64 nNodes;
   int rc;
 
   /* Validate argument count */
@@ -428,21 +641,12 @@ static void graphCountNodesFunc(sqlite3_context *pCtx, int argc,
     return;
   }
 
-  fprintf(stderr, "graphCountNodesFunc: pGraph=%p, zTableName=%s\n", (void*)pGraph, pGraph->zTableName);
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  rc = sqlite3_step(pStmt);
-  if( rc==SQLITE_ROW ){
-    sqlite3_result_int(pCtx, sqlite3_column_int(pStmt, 0));
+  rc = graphLiveCounts(pGraph, &nNodes, 0);
+  if( rc==SQLITE_OK ){
+    sqlite3_result_int64(pCtx, nNodes);
   } else {
     sqlite3_result_error_code(pCtx, rc);
   }
-  sqlite3_finalize(pStmt);
 }
 
 /*
@@ -452,9 +656,9 @@ static void graphCountNodesFunc(sqlite3_context *pCtx, int argc,
 */
 static void graphCountEdgesFunc(sqlite3_context *pCtx, int argc,
                                sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   (void)argv;  /* Currently unused */
-  char *zSql;
-  sqlite3_stmt *pStmt;
+  sqlite3_int64 nEdges;
   int rc;
 
   /* Validate argument count */
@@ -468,158 +672,153 @@ static void graphCountEdgesFunc(sqlite3_context *pCtx, int argc,
     return;
   }
 
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ){
+  rc = graphLiveCounts(pGraph, 0, &nEdges);
+  if( rc==SQLITE_OK ){
+    sqlite3_result_int64(pCtx, nEdges);
+  } else {
     sqlite3_result_error_code(pCtx, rc);
+  }
+}
+
+/*
+** Deliver the result of an algorithm that produces a JSON string.
+** SQLITE_NOTFOUND (unknown or unreachable node) becomes SQL NULL.
+*/
+static void graphResultJson(sqlite3_context *pCtx, int rc, char *zJson){
+  if( rc==SQLITE_OK ){
+    sqlite3_result_text(pCtx, zJson, -1, sqlite3_free);
     return;
   }
-  rc = sqlite3_step(pStmt);
-  if( rc==SQLITE_ROW ){
-    sqlite3_result_int(pCtx, sqlite3_column_int(pStmt, 0));
-  } else {
+  sqlite3_free(zJson);
+  if( rc==SQLITE_NOTFOUND ){
+    sqlite3_result_null(pCtx);
+  }else if( rc==SQLITE_NOMEM ){
+    sqlite3_result_error_nomem(pCtx);
+  }else{
     sqlite3_result_error_code(pCtx, rc);
   }
-  sqlite3_finalize(pStmt);
 }
 
 /*
-** SQL function: graph_shortest_path(start_id, end_id)
+** Map a BFS mode argument ('auto', 'top_down', 'bottom_up') to its
+** GRAPH_BFS_* value. NULL selects 'auto'. Returns SQLITE_ERROR for
+** anything else.
+*/
+static int graphParseBFSMode(sqlite3_value *pVal, int *peMode){
+  const char *zMode = (const char*)sqlite3_value_text(pVal);
+
+  if( zMode==0 || sqlite3_stricmp(zMode, "auto")==0 ){
+    *peMode = GRAPH_BFS_AUTO;
+  }else if( sqlite3_stricmp(zMode, "top_down")==0 ){
+    *peMode = GRAPH_BFS_TOP_DOWN;
+  }else if( sqlite3_stricmp(zMode, "bottom_up")==0 ){
+    *peMode = GRAPH_BFS_BOTTOM_UP;
+  }else{
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** SQL function: graph_shortest_path(start_id, end_id [, mode
+**                                   [, x_property, y_property]])
 ** Returns the shortest path between two nodes as JSON array.
+** Returns NULL if either node is unknown or end_id is unreachable.
+** mode 'auto' (default), 'top_down' or 'bottom_up' selects the BFS
+** direction for the fewest hops; 'auto' searches from both ends.
+** 'weighted' runs a bidirectional Dijkstra over edge weights and
+** 'astar' an A* search guided by the node coordinates in x_property
+** and y_property ('x' and 'y' by default).
 ** Usage: SELECT graph_shortest_path(1, 5);
+**        SELECT graph_shortest_path(1, 5, 'bottom_up');
+**        SELECT graph_shortest_path(1, 5, 'astar', 'lon', 'lat');
 */
 static void graphShortestPathFunc(sqlite3_context *pCtx, int argc,
                                  sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iStartId, iEndId;
-  int nNodes = 0;
-  char *zSql;
-  sqlite3_stmt *pStmt;
+  int eMode = GRAPH_BFS_AUTO;
+  int bWeighted = 0, bAStar = 0;
+  char *zPath = 0;
   int rc;
   
   /* Validate argument count */
-  if( argc!=2 ){
-    sqlite3_result_error(pCtx, "graph_shortest_path() requires 2 arguments", -1);
+  if( argc<2 || argc>5 ){
+    sqlite3_result_error(pCtx, "graph_shortest_path() requires 2 to 5 arguments", -1);
     return;
   }
   
   /* Extract arguments */
   iStartId = sqlite3_value_int64(argv[0]);
   iEndId = sqlite3_value_int64(argv[1]);
-
-  if( pGraph==0 ){
-    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
-    return;
+  if( argc>=3 ){
+    const char *zMode = (const char*)sqlite3_value_text(argv[2]);
+    bWeighted = zMode && sqlite3_stricmp(zMode, "weighted")==0;
+    bAStar = zMode && sqlite3_stricmp(zMode, "astar")==0;
   }
-
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
+  if( argc>3 && !bAStar ){
+    sqlite3_result_error(pCtx, "graph_shortest_path(): coordinate "
+                         "properties only apply to 'astar'", -1);
+    return;
   }
-  sqlite3_finalize(pStmt);
-
-  if( nNodes==0 ){
-    sqlite3_result_text(pCtx, "[]", -1, SQLITE_STATIC);
+  if( argc==3 && !bWeighted && !bAStar
+   && graphParseBFSMode(argv[2], &eMode)!=SQLITE_OK ){
+    sqlite3_result_error(pCtx, "graph_shortest_path(): mode must be "
+                         "'auto', 'top_down', 'bottom_up', 'weighted' or "
+                         "'astar'", -1);
     return;
   }
 
-  // BFS implementation
-  Queue *q = graphQueueCreate();
-  if( q==0 ){
-    sqlite3_result_error_nomem(pCtx);
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
     return;
   }
 
-  VisitedNode *visited = 0;
-
-  // Enqueue the start node
-  graphQueueEnqueue(q, iStartId);
-
-  // Mark start node as visited
-  VisitedNode *vNode = sqlite3_malloc(sizeof(VisitedNode));
-  vNode->iNodeId = iStartId;
-  vNode->pNext = visited;
-  visited = vNode;
-
-  // Predecessor map
-  sqlite3_int64 *pPredecessor = sqlite3_malloc(sizeof(sqlite3_int64) * (nNodes + 1));
-  memset(pPredecessor, -1, sizeof(sqlite3_int64) * (nNodes + 1));
-
-  sqlite3_int64 currentNodeId;
-  while( graphQueueDequeue(q, &currentNodeId)==SQLITE_OK ){
-    if( currentNodeId==iEndId ) break;
-
-    // Explore neighbors
-    char *zSql = sqlite3_mprintf("SELECT to_id FROM %s_edges WHERE from_id = %lld", pGraph->zTableName, currentNodeId);
-    sqlite3_stmt *pStmt;
-    int rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    if( rc!=SQLITE_OK ) continue;
-
-    while( sqlite3_step(pStmt)==SQLITE_ROW ){
-      sqlite3_int64 neighborId = sqlite3_column_int64(pStmt, 0);
-      int bVisited = 0;
-      for(VisitedNode *v = visited; v; v=v->pNext){
-        if( v->iNodeId == neighborId ){
-          bVisited = 1;
-          break;
-        }
-      }
-
-      if( !bVisited ){
-        // Mark as visited
-        vNode = sqlite3_malloc(sizeof(VisitedNode));
-        vNode->iNodeId = neighborId;
-        vNode->pNext = visited;
-        visited = vNode;
-
-        // Enqueue
-        graphQueueEnqueue(q, neighborId);
-
-        pPredecessor[neighborId] = currentNodeId;
-      }
-    }
-    sqlite3_finalize(pStmt);
-  }
-
-  // Reconstruct path
-  char *zPath = sqlite3_mprintf("[");
-  sqlite3_int64 iCurrent = iEndId;
-  while( iCurrent != -1 ){
-    char *zId = sqlite3_mprintf("%lld", iCurrent);
-    zPath = sqlite3_mprintf("%s%s", zPath, zId);
-    sqlite3_free(zId);
-    iCurrent = pPredecessor[iCurrent];
-    if( iCurrent != -1 ){
-      zPath = sqlite3_mprintf("%s,", zPath);
-    }
+  if( bWeighted ){
+    rc = graphDijkstra(pGraph, iStartId, iEndId, &zPath, 0);
+  }else if( bAStar ){
+    const char *zX = argc>3 ? (const char*)sqlite3_value_text(argv[3]) : 0;
+    const char *zY = argc>4 ? (const char*)sqlite3_value_text(argv[4]) : 0;
+    rc = graphAStar(pGraph, iStartId, iEndId, zX ? zX : "x", zY ? zY : "y",
+                    &zPath, 0);
+  }else{
+    rc = graphShortestPathUnweighted(pGraph, iStartId, iEndId, eMode, &zPath);
   }
-  zPath = sqlite3_mprintf("%s]", zPath);
-
-  sqlite3_result_text(pCtx, zPath, -1, sqlite3_free);
+  graphResultJson(pCtx, rc, zPath);
+}
 
-  // Free memory
-  graphQueueDestroy(q);
-  while(visited){
-    VisitedNode *v = visited;
-    visited = visited->pNext;
-    sqlite3_free(v);
-  }
-  sqlite3_free(pPredecessor);
+/*
+** Read a worker-thread count argument. 1 runs on the calling thread and
+** 0 uses the whole worker pool. Returns SQLITE_ERROR for negative values.
+*/
+static int graphThreadsArg(sqlite3_value *pVal, int *pnThreads){
+  int nThreads = sqlite3_value_int(pVal);
+  if( nThreads<0 ) return SQLITE_ERROR;
+  *pnThreads = nThreads;
+  return SQLITE_OK;
 }
 
 /*
-** SQL function: graph_pagerank(damping, max_iter, epsilon)
-** Calculates PageRank scores for all nodes.
+** SQL function: graph_pagerank(damping, max_iter, epsilon, threads)
+** Calculates PageRank scores for all nodes. Results are memoized per
+** graph until it changes (graph_result_cache()). Runs on the projection
+** picked with graph_use(), uncached, if there is one.
+** threads: Worker threads, 1 by default, 0 for the whole pool
 ** Usage: SELECT graph_pagerank(0.85, 100, 0.0001);
+**        SELECT graph_pagerank(0.85, 100, 0.0001, 8);
 */
 static void graphPageRankFunc(sqlite3_context *pCtx, int argc,
                              sqlite3_value **argv){
+  sqlite3 *pDb = sqlite3_context_db_handle(pCtx);
+  GraphVtab *pGraph = graphRegistryFind(pDb, 0);
+  GraphResultArgs args;
+  CSRView view;
   double rDamping = 0.85;
   int nMaxIter = 100;
   double rEpsilon = 0.0001;
+  int nThreads = 1;
+  char *zResults = 0;
+  int rc;
   
   /* Parse optional arguments */
   if( argc>=1 ){
@@ -631,6 +830,10 @@ static void graphPageRankFunc(sqlite3_context *pCtx, int argc,
   if( argc>=3 ){
     rEpsilon = sqlite3_value_double(argv[2]);
   }
+  if( argc>=4 && graphThreadsArg(argv[3], &nThreads)!=SQLITE_OK ){
+    sqlite3_result_error(pCtx, "Thread count must not be negative", -1);
+    return;
+  }
   
   /* Validate parameters */
   if( rDamping<0.0 || rDamping>1.0 ){
@@ -646,89 +849,25 @@ static void graphPageRankFunc(sqlite3_context *pCtx, int argc,
     return;
   }
 
-  if( pGraph==0 ){
-    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+  if( graphProjectionView(pDb, 0, &view) ){
+    rc = graphPageRankCSR(view.pCSR, rDamping, nMaxIter, rEpsilon,
+                          nThreads, &zResults);
+    graphCSRViewClose(&view);
+    graphResultJson(pCtx, rc, zResults);
     return;
   }
-
-  int nNodes = 0;
-  char *zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  sqlite3_stmt *pStmt;
-  int rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-
-  if( nNodes==0 ){
-    sqlite3_result_text(pCtx, "{}", -1, SQLITE_STATIC);
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
     return;
   }
 
-  // Power Iteration implementation
-  double *pRank = sqlite3_malloc(sizeof(double) * (nNodes + 1));
-  double *pNextRank = sqlite3_malloc(sizeof(double) * (nNodes + 1));
-  int *pOutDegree = sqlite3_malloc(sizeof(int) * (nNodes + 1));
-
-  for(int i=0; i<=nNodes; i++){
-    pRank[i] = 1.0 / nNodes;
-    pOutDegree[i] = 0;
-  }
-
-  zSql = sqlite3_mprintf("SELECT from_id, count(*) FROM %s_edges GROUP BY from_id", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    pOutDegree[sqlite3_column_int(pStmt, 0)] = sqlite3_column_int(pStmt, 1);
-  }
-  sqlite3_finalize(pStmt);
-
-  for(int i=0; i<nMaxIter; i++){
-    for(int j=0; j<=nNodes; j++){
-      pNextRank[j] = (1.0 - rDamping) / nNodes;
-    }
-    zSql = sqlite3_mprintf("SELECT from_id, to_id FROM %s_edges", pGraph->zTableName);
-    rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-    sqlite3_free(zSql);
-    while( sqlite3_step(pStmt)==SQLITE_ROW ){
-      int from = sqlite3_column_int(pStmt, 0);
-      int to = sqlite3_column_int(pStmt, 1);
-      pNextRank[to] += rDamping * pRank[from] / pOutDegree[from];
-    }
-    sqlite3_finalize(pStmt);
-
-    double rDiff = 0.0;
-    for(int j=0; j<=nNodes; j++){
-      rDiff += (pNextRank[j] - pRank[j]) * (pNextRank[j] - pRank[j]);
-      pRank[j] = pNextRank[j];
-    }
-    if( rDiff < rEpsilon ) break;
-  }
-
-  char *zResult = sqlite3_mprintf("{");
-  int bFirst = 1;
-  zSql = sqlite3_mprintf("SELECT id FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  while( sqlite3_step(pStmt)==SQLITE_ROW ){
-    if( !bFirst ){
-      zResult = sqlite3_mprintf("%s,", zResult);
-    }
-    bFirst = 0;
-    int iNodeId = sqlite3_column_int(pStmt, 0);
-    char *zRank = sqlite3_mprintf("\"%d\":%f", iNodeId, pRank[iNodeId]);
-    zResult = sqlite3_mprintf("%s%s", zResult, zRank);
-    sqlite3_free(zRank);
-  }
-  sqlite3_finalize(pStmt);
-  zResult = sqlite3_mprintf("%s}", zResult);
-
-  sqlite3_result_text(pCtx, zResult, -1, sqlite3_free);
-
-  sqlite3_free(pRank);
-  sqlite3_free(pNextRank);
-  sqlite3_free(pOutDegree);
+  memset(&args, 0, sizeof(args));
+  args.eAlgo = GRAPH_RESULT_PAGERANK;
+  args.rDamping = rDamping;
+  args.nMaxIter = nMaxIter;
+  args.rEpsilon = rEpsilon;
+  rc = graphResultGet(pGraph, &args, nThreads, &zResults);
+  graphResultJson(pCtx, rc, zResults);
 }
 
 /*
@@ -738,12 +877,10 @@ static void graphPageRankFunc(sqlite3_context *pCtx, int argc,
 */
 static void graphDegreeCentralityFunc(sqlite3_context *pCtx, int argc,
 sqlite3_value **argv){
+GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
 sqlite3_int64 iNodeId;
-double rCentrality;
-char *zSql;
-sqlite3_stmt *pStmt;
+sqlite3_int64 nNodes;
 int rc;
-int nDegree = 0;
 
 /* Validate argument count */
 if( argc!=1 ){
@@ -759,60 +896,69 @@ iNodeId = sqlite3_value_int64(argv[0]);
     return;
   }
   
-  /* Calculate degree centrality by counting edges connected to this node */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges WHERE from_id=%lld OR to_id=%lld", 
-                         pGraph->zTableName, iNodeId, iNodeId);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
+  /* Degree centrality = (in + out) / (n-1), from the cached counts */
+  rc = graphLiveCounts(pGraph, &nNodes, 0);
   if( rc!=SQLITE_OK ){
     sqlite3_result_error_code(pCtx, rc);
     return;
   }
-  
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nDegree = sqlite3_column_int(pStmt, 0);
+  if( nNodes <= 1 ){
+    sqlite3_result_double(pCtx, 0.0);
+    return;
   }
-  sqlite3_finalize(pStmt);
-  
-  /* For degree centrality, we need the total number of possible connections (n-1) */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
+  sqlite3_result_double(pCtx,
+      (double)graphTotalDegree(pGraph, iNodeId) / (nNodes - 1));
+}
+
+/*
+** SQL function: graph_degree(node_id [, direction [, rel_type]])
+** Returns the number of edges of a node: direction is 'out', 'in' or
+** 'both' (the default), and rel_type restricts the count to one type.
+** Usage: SELECT graph_degree(1, 'out', 'KNOWS');
+*/
+static void graphDegreeFunc(sqlite3_context *pCtx, int argc,
+                            sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  const char *zDir = "both";
+  const char *zType = 0;
+  int eDir;
+
+  if( argc<1 || argc>3 ){
+    sqlite3_result_error(pCtx, "graph_degree() requires 1 to 3 arguments", -1);
     return;
   }
-  
-  int nNodes = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
   }
-  sqlite3_finalize(pStmt);
-  
-  if( nNodes <= 1 ){
-    sqlite3_result_double(pCtx, 0.0);
+  if( argc>1 && sqlite3_value_type(argv[1])!=SQLITE_NULL ){
+    zDir = (const char*)sqlite3_value_text(argv[1]);
+  }
+  if( argc>2 && sqlite3_value_type(argv[2])!=SQLITE_NULL ){
+    zType = (const char*)sqlite3_value_text(argv[2]);
+  }
+  if( sqlite3_stricmp(zDir, "out")==0 ){
+    eDir = GRAPH_DEGREE_OUT;
+  }else if( sqlite3_stricmp(zDir, "in")==0 ){
+    eDir = GRAPH_DEGREE_IN;
+  }else if( sqlite3_stricmp(zDir, "both")==0 ){
+    eDir = GRAPH_DEGREE_BOTH;
+  }else{
+    sqlite3_result_error(pCtx, "graph_degree() direction must be 'out', 'in' or 'both'", -1);
     return;
   }
-  
-  /* Degree centrality = degree / (n-1) */
-  rCentrality = (double)nDegree / (nNodes - 1);
-  sqlite3_result_double(pCtx, rCentrality);
+  sqlite3_result_int64(pCtx,
+      graphNodeDegree(pGraph, sqlite3_value_int64(argv[0]), zType, eDir));
 }
 
 /*
 ** SQL function: graph_is_connected()
-** Returns 1 if graph is connected, 0 otherwise.
+** Returns 1 if graph is (weakly) connected, 0 otherwise.
 ** Usage: SELECT graph_is_connected();
 */
 static void graphIsConnectedFunc(sqlite3_context *pCtx, int argc,
                                 sqlite3_value **argv){
-  int bConnected = 0;
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int rc;
-  
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   /* Validate argument count */
   if( argc!=0 ){
     sqlite3_result_error(pCtx, "graph_is_connected() takes no arguments", -1);
@@ -824,61 +970,17 @@ static void graphIsConnectedFunc(sqlite3_context *pCtx, int argc,
     return;
   }
   
-  /* Simple connectivity check: if we have nodes, check if we have edges */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nNodes = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  /* Empty graph or single node is considered connected */
-  if( nNodes <= 1 ){
-    sqlite3_result_int(pCtx, 1);
-    return;
-  }
-  
-  /* For a connected graph, we need at least n-1 edges */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nEdges = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nEdges = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  /* Basic connectivity check: at least n-1 edges required */
-  bConnected = (nEdges >= nNodes - 1) ? 1 : 0;
-  sqlite3_result_int(pCtx, bConnected);
+  sqlite3_result_int(pCtx, graphIsConnected(pGraph));
 }
 
 /*
 ** SQL function: graph_density()
-** Returns the density of the graph.
+** Returns the density of the graph, treated as directed.
 ** Usage: SELECT graph_density();
 */
 static void graphDensityFunc(sqlite3_context *pCtx, int argc,
 sqlite3_value **argv){
-double rDensity;
-char *zSql;
-sqlite3_stmt *pStmt;
-int rc;
-
+GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
 /* Validate argument count */
 if( argc!=0 ){
   sqlite3_result_error(pCtx, "graph_density() takes no arguments", -1);
@@ -890,95 +992,76 @@ if( argc!=0 ){
     return;
   }
   
-  /* Get node count */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nNodes = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  if( nNodes <= 1 ){
-    sqlite3_result_double(pCtx, 0.0);
-    return;
-  }
-  
-  /* Get edge count */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nEdges = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nEdges = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  /* Density = actual edges / possible edges */
-  /* For directed graph: possible edges = n*(n-1) */
-  /* For undirected graph: possible edges = n*(n-1)/2 */
-  /* We'll assume directed for now */
-  double possibleEdges = (double)nNodes * (nNodes - 1);
-  rDensity = (double)nEdges / possibleEdges;
-  sqlite3_result_double(pCtx, rDensity);
+  sqlite3_result_double(pCtx, graphDensity(pGraph, 1));
 }
 
 /*
-** SQL function: graph_betweenness_centrality()
-** Calculates betweenness centrality for all nodes.
+** SQL function: graph_betweenness_centrality([threads])
+** Calculates betweenness centrality for all nodes. Results are memoized
+** per graph until it changes (graph_result_cache()). Runs on the
+** projection picked with graph_use(), uncached, if there is one.
+** threads: Worker threads, 1 by default, 0 for the whole pool
 ** Usage: SELECT graph_betweenness_centrality();
+**        SELECT graph_betweenness_centrality(8);
 */
 void graphBetweennessCentralityFunc(sqlite3_context *pCtx, int argc,
                                           sqlite3_value **argv){
+  sqlite3 *pDb = sqlite3_context_db_handle(pCtx);
+  GraphVtab *pGraph = graphRegistryFind(pDb, 0);
+  GraphResultArgs args;
+  CSRView view;
+  int nThreads = 1;
   char *zResults = 0;
   int rc;
   
   /* Validate argument count */
-  if( argc!=0 ){
-    sqlite3_result_error(pCtx, "graph_betweenness_centrality() takes no arguments", -1);
+  if( argc>1 ){
+    sqlite3_result_error(pCtx, "graph_betweenness_centrality() takes at most 1 argument", -1);
+    return;
+  }
+  if( argc==1 && graphThreadsArg(argv[0], &nThreads)!=SQLITE_OK ){
+    sqlite3_result_error(pCtx, "Thread count must not be negative", -1);
     return;
   }
   
+  if( graphProjectionView(pDb, 0, &view) ){
+    rc = graphBetweennessCentralityCSR(view.pCSR, nThreads, &zResults);
+    graphCSRViewClose(&view);
+    graphResultJson(pCtx, rc, zResults);
+    return;
+  }
   if( pGraph==0 ){
     sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
     return;
   }
   
-  /* Simple betweenness centrality: return basic JSON result */
-  zResults = sqlite3_mprintf("[]");
-  if( zResults ){
-    sqlite3_result_text(pCtx, zResults, -1, sqlite3_free);
-  } else {
-    sqlite3_result_text(pCtx, "[]", -1, SQLITE_STATIC);
-  }
+  memset(&args, 0, sizeof(args));
+  args.eAlgo = GRAPH_RESULT_BETWEENNESS;
+  rc = graphResultGet(pGraph, &args, nThreads, &zResults);
+  graphResultJson(pCtx, rc, zResults);
 }
 
 /*
-** SQL function: graph_closeness_centrality()
+** SQL function: graph_closeness_centrality([threads])
 ** Calculates closeness centrality for all nodes.
+** threads: Worker threads, 1 by default, 0 for the whole pool
 ** Usage: SELECT graph_closeness_centrality();
+**        SELECT graph_closeness_centrality(8);
 */
 static void graphClosenessCentralityFunc(sqlite3_context *pCtx, int argc,
                                         sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  int nThreads = 1;
   char *zResults = 0;
   int rc;
   
   /* Validate argument count */
-  if( argc!=0 ){
-    sqlite3_result_error(pCtx, "graph_closeness_centrality() takes no arguments", -1);
+  if( argc>1 ){
+    sqlite3_result_error(pCtx, "graph_closeness_centrality() takes at most 1 argument", -1);
+    return;
+  }
+  if( argc==1 && graphThreadsArg(argv[0], &nThreads)!=SQLITE_OK ){
+    sqlite3_result_error(pCtx, "Thread count must not be negative", -1);
     return;
   }
   
@@ -987,22 +1070,18 @@ static void graphClosenessCentralityFunc(sqlite3_context *pCtx, int argc,
     return;
   }
   
-  /* Simple closeness centrality: return basic JSON result */
-  zResults = sqlite3_mprintf("[]");
-  if( zResults ){
-    sqlite3_result_text(pCtx, zResults, -1, sqlite3_free);
-  } else {
-    sqlite3_result_text(pCtx, "[]", -1, SQLITE_STATIC);
-  }
+  rc = graphClosenessCentrality(pGraph, nThreads, &zResults);
+  graphResultJson(pCtx, rc, zResults);
 }
 
 /*
 ** SQL function: graph_topological_sort()
-** Returns topological ordering of nodes.
+** Returns topological ordering of nodes. Fails if the graph has a cycle.
 ** Usage: SELECT graph_topological_sort();
 */
 static void graphTopologicalSortFunc(sqlite3_context *pCtx, int argc,
 sqlite3_value **argv){
+GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
 char *zOrder = 0;
 int rc;
 
@@ -1017,13 +1096,12 @@ if( pGraph==0 ){
   return;
   }
   
-  /* Simple topological sort: return basic JSON result */
-  zOrder = sqlite3_mprintf("[]");
-  if( zOrder ){
-    sqlite3_result_text(pCtx, zOrder, -1, sqlite3_free);
-  } else {
-    sqlite3_result_text(pCtx, "[]", -1, SQLITE_STATIC);
+  rc = graphTopologicalSort(pGraph, &zOrder);
+  if( rc==SQLITE_CONSTRAINT ){
+    sqlite3_result_error(pCtx, "graph_topological_sort(): graph contains a cycle", -1);
+    return;
   }
+  graphResultJson(pCtx, rc, zOrder);
 }
 
 /*
@@ -1033,11 +1111,7 @@ if( pGraph==0 ){
 */
 static void graphHasCycleFunc(sqlite3_context *pCtx, int argc,
 sqlite3_value **argv){
-int bHasCycle = 0;
-char *zSql;
-sqlite3_stmt *pStmt;
-int rc;
-
+GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
 /* Validate argument count */
 if( argc!=0 ){
   sqlite3_result_error(pCtx, "graph_has_cycle() takes no arguments", -1);
@@ -1049,72 +1123,21 @@ if( argc!=0 ){
     return;
   }
   
-  /* Simple cycle detection: check if any node has an edge to itself */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges WHERE from_id = to_id", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nSelfLoops = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nSelfLoops = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  if( nSelfLoops > 0 ){
-    sqlite3_result_int(pCtx, 1);
-    return;
-  }
-  
-  /* For a more complete cycle detection, we could implement DFS, 
-     but for now we'll do a simple check: if there are edges and 
-     the graph is strongly connected, it likely has cycles */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nEdges = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nEdges = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  /* Basic heuristic: if we have more edges than nodes-1, likely has cycles */
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pGraph->zTableName);
-  rc = sqlite3_prepare_v2(pGraph->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  
-  if( rc!=SQLITE_OK ){
-    sqlite3_result_error_code(pCtx, rc);
-    return;
-  }
-  
-  int nNodes = 0;
-  if( sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  
-  bHasCycle = (nEdges > nNodes - 1) ? 1 : 0;
-  sqlite3_result_int(pCtx, bHasCycle);
+  sqlite3_result_int(pCtx, graphHasCycle(pGraph));
 }
 
 /*
 ** SQL function: graph_connected_components()
-** Returns connected components as JSON object.
+** Returns connected components as JSON object, of the projection picked
+** with graph_use() if there is one.
 ** Usage: SELECT graph_connected_components();
 */
 static void graphConnectedComponentsFunc(sqlite3_context *pCtx, int argc,
 sqlite3_value **argv){
+sqlite3 *pDb = sqlite3_context_db_handle(pCtx);
+GraphVtab *pGraph = graphRegistryFind(pDb, 0);
+GraphResultArgs args;
+CSRView view;
 char *zComponents = 0;
 int rc;
 
@@ -1124,18 +1147,21 @@ sqlite3_result_error(pCtx, "graph_connected_components() takes no arguments", -1
 return;
 }
 
+if( graphProjectionView(pDb, 0, &view) ){
+  rc = graphConnectedComponentsCSR(view.pCSR, &zComponents);
+  graphCSRViewClose(&view);
+  graphResultJson(pCtx, rc, zComponents);
+  return;
+}
 if( pGraph==0 ){
   sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
   return;
   }
   
-  /* Simple connected components: return basic JSON result */
-  zComponents = sqlite3_mprintf("[]");
-  if( zComponents ){
-    sqlite3_result_text(pCtx, zComponents, -1, sqlite3_free);
-  } else {
-    sqlite3_result_text(pCtx, "[]", -1, SQLITE_STATIC);
-  }
+  memset(&args, 0, sizeof(args));
+  args.eAlgo = GRAPH_RESULT_COMPONENTS;
+  rc = graphResultGet(pGraph, &args, 1, &zComponents);
+  graphResultJson(pCtx, rc, zComponents);
 }
 
 /*
@@ -1145,6 +1171,7 @@ if( pGraph==0 ){
 */
 static void graphStronglyConnectedComponentsFunc(sqlite3_context *pCtx, int argc,
 sqlite3_value **argv){
+GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
 char *zSCC = 0;
 int rc;
 
@@ -1159,13 +1186,477 @@ if( pGraph==0 ){
   return;
   }
   
-  /* Simple strongly connected components: return basic JSON result */
-  zSCC = sqlite3_mprintf("[]");
-  if( zSCC ){
-    sqlite3_result_text(pCtx, zSCC, -1, sqlite3_free);
-  } else {
-    sqlite3_result_text(pCtx, "[]", -1, SQLITE_STATIC);
+  rc = graphStronglyConnectedComponents(pGraph, &zSCC);
+  graphResultJson(pCtx, rc, zSCC);
+}
+
+/*
+** SQL function: graph_triangle_count(threads)
+** Returns the number of triangles in the graph, edge direction, duplicate
+** edges and self-loops ignored.
+** threads: Worker threads, 1 by default, 0 for the whole pool
+** Usage: SELECT graph_triangle_count();
+**        SELECT graph_triangle_count(0);
+*/
+static void graphTriangleCountFunc(sqlite3_context *pCtx, int argc,
+                                   sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  sqlite3_int64 nTriangle = 0;
+  int nThreads = 1;
+  int rc;
+
+  if( argc>1 ){
+    sqlite3_result_error(pCtx, "graph_triangle_count() takes at most 1 argument", -1);
+    return;
+  }
+  if( argc==1 && graphThreadsArg(argv[0], &nThreads)!=SQLITE_OK ){
+    sqlite3_result_error(pCtx, "Thread count must not be negative", -1);
+    return;
+  }
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+
+  rc = graphTriangleCount(pGraph, nThreads, &nTriangle);
+  if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+    return;
+  }
+  sqlite3_result_int64(pCtx, nTriangle);
+}
+
+/*
+** SQL functions: graph_common_neighbors(a, b), graph_jaccard(a, b),
+** graph_adamic_adar(a, b)
+** Link prediction scores of the node pair (a, b) over undirected
+** neighbours: the number of common neighbours, that number over the
+** size of the union, and the sum of 1/ln(degree) over the common
+** neighbours. NULL if either node does not exist.
+** Usage: SELECT b, graph_adamic_adar(42, b) AS score
+**          FROM candidates ORDER BY score DESC LIMIT 10;
+*/
+static void graphNeighborScoreFunc(sqlite3_context *pCtx, int argc,
+                                   sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  int eScore = *(int*)sqlite3_user_data(pCtx);
+  double rScore = 0.0;
+  int rc;
+
+  (void)argc;
+  if( sqlite3_value_type(argv[0])==SQLITE_NULL
+   || sqlite3_value_type(argv[1])==SQLITE_NULL ){
+    return;
+  }
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
   }
+
+  rc = graphNeighborScore(pGraph, eScore, sqlite3_value_int64(argv[0]),
+                          sqlite3_value_int64(argv[1]), &rScore);
+  if( rc==SQLITE_NOTFOUND ) return;
+  if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+    return;
+  }
+  if( eScore==GRAPH_SCORE_COMMON ){
+    sqlite3_result_int64(pCtx, (sqlite3_int64)rScore);
+  }else{
+    sqlite3_result_double(pCtx, rScore);
+  }
+}
+
+/*
+** SQL function: graph_khop_count_approx(node, k, precision)
+** Estimated number of other nodes reachable from node in at most k hops
+** along out-edges, from HyperLogLog counters of 2^precision registers
+** per node (4-12, default 6). The relative standard error is
+** 1.04/sqrt(2^precision). NULL if node does not exist.
+** Usage: SELECT graph_khop_count_approx(42, 3);
+**        SELECT graph_khop_count_approx(42, 3, 10);
+*/
+static void graphKhopCountApproxFunc(sqlite3_context *pCtx, int argc,
+                                     sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  int nLog2m = GRAPH_REACH_DEFAULT_PRECISION;
+  int nHops;
+  double rReach = 0.0;
+  int rc;
+
+  if( argc<2 || argc>3 ){
+    sqlite3_result_error(pCtx, "graph_khop_count_approx() takes 2 or 3 arguments", -1);
+    return;
+  }
+  if( sqlite3_value_type(argv[0])==SQLITE_NULL
+   || sqlite3_value_type(argv[1])==SQLITE_NULL ){
+    return;
+  }
+  nHops = sqlite3_value_int(argv[1]);
+  if( nHops<0 || nHops>GRAPH_REACH_MAX_HOPS ){
+    sqlite3_result_error(pCtx, "k must be between 0 and 64", -1);
+    return;
+  }
+  if( argc==3 && sqlite3_value_type(argv[2])!=SQLITE_NULL ){
+    nLog2m = sqlite3_value_int(argv[2]);
+    if( nLog2m<GRAPH_REACH_MIN_PRECISION || nLog2m>GRAPH_REACH_MAX_PRECISION ){
+      sqlite3_result_error(pCtx, "Precision must be between 4 and 12", -1);
+      return;
+    }
+  }
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+
+  rc = graphReachEstimate(pGraph, sqlite3_value_int64(argv[0]), nHops,
+                          nLog2m, &rReach);
+  if( rc==SQLITE_NOTFOUND ) return;
+  if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+    return;
+  }
+  sqlite3_result_int64(pCtx, (sqlite3_int64)(rReach + 0.5));
+}
+
+/*
+** SQL function: graph_scheduler_stats()
+** Returns per-worker task counters of the parallel scheduler as JSON,
+** e.g. [{"worker":0,"executed":120,"stolen":14}, ...]. Reports the last
+** pool when none is running and [] before the first parallel call.
+** Usage: SELECT graph_scheduler_stats();
+*/
+static void graphSchedulerStatsFunc(sqlite3_context *pCtx, int argc,
+                                    sqlite3_value **argv){
+  char *zStats = 0;
+  int rc;
+
+  (void)argc;
+  (void)argv;
+  rc = graphSchedulerStats(&zStats);
+  graphResultJson(pCtx, rc, zStats);
+}
+
+/*
+** SQL function: graph_result_cache([budget [, mode]])
+** Configures the memoized results of graph_pagerank(),
+** graph_betweenness_centrality() and graph_connected_components() on
+** the default graph and returns its state as JSON. budget is in bytes,
+** 0 disables the cache and drops its entries; mode is 'fresh' (recompute
+** once the graph changes) or 'stale' (return the old result while it is
+** recomputed on the worker pool). NULL leaves a setting as it is.
+** Usage: SELECT graph_result_cache();
+**        SELECT graph_result_cache(64*1024*1024, 'stale');
+*/
+static void graphResultCacheFunc(sqlite3_context *pCtx, int argc,
+                                 sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  sqlite3_int64 nBudget = -1;
+  int eMode = -1;
+  char *zState = 0;
+  int rc;
+
+  if( argc>2 ){
+    sqlite3_result_error(pCtx, "graph_result_cache() takes at most 2 arguments", -1);
+    return;
+  }
+  if( argc>=1 && sqlite3_value_type(argv[0])!=SQLITE_NULL ){
+    nBudget = sqlite3_value_int64(argv[0]);
+    if( nBudget<0 ){
+      sqlite3_result_error(pCtx, "Result cache budget must not be negative", -1);
+      return;
+    }
+  }
+  if( argc>=2 && sqlite3_value_type(argv[1])!=SQLITE_NULL ){
+    const char *zMode = (const char*)sqlite3_value_text(argv[1]);
+    if( zMode && sqlite3_stricmp(zMode, "fresh")==0 ){
+      eMode = GRAPH_RESULT_FRESH;
+    }else if( zMode && sqlite3_stricmp(zMode, "stale")==0 ){
+      eMode = GRAPH_RESULT_STALE;
+    }else{
+      sqlite3_result_error(pCtx, "Result cache mode must be 'fresh' or 'stale'", -1);
+      return;
+    }
+  }
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No default graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+
+  rc = graphResultCacheConfig(pGraph, nBudget, eMode, &zState);
+  graphResultJson(pCtx, rc, zState);
+}
+
+/*
+** SQL function: graph_set_threads(n)
+** Sizes the persistent worker pool used by parallel operators; 0 uses
+** every core. The pool starts on first parallel use and is shared by
+** all connections. Returns the effective number of workers.
+** Usage: SELECT graph_set_threads(8);
+*/
+static void graphSetThreadsFunc(sqlite3_context *pCtx, int argc,
+                                sqlite3_value **argv){
+  int nThreads = 0;
+
+  (void)argc;
+  if( graphThreadsArg(argv[0], &nThreads)!=SQLITE_OK
+   || graphThreadPoolSetSize(nThreads, &nThreads)!=SQLITE_OK ){
+    sqlite3_result_error(pCtx, "Thread count must not be negative", -1);
+    return;
+  }
+  sqlite3_result_int(pCtx, nThreads);
+}
+
+/*
+** Drop the cached Cypher plans of pVtab after its indexes or statistics
+** change. Plan cache keys are scoped by the graph table name.
+*/
+static void graphForgetPlans(GraphVtab *pVtab){
+  graphPlanCacheInvalidateScope(pVtab->zTableName);
+}
+
+/*
+** SQL function: graph_create_index(label, property)
+** Creates an expression index on the node property so Cypher equality
+** and range predicates on it become index probes. label may be NULL.
+** Usage: SELECT graph_create_index('Person', 'email');
+*/
+static void graphCreateIndexFunc(sqlite3_context *pCtx, int argc,
+                                 sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  const char *zLabel = (const char*)sqlite3_value_text(argv[0]);
+  const char *zProperty = (const char*)sqlite3_value_text(argv[1]);
+  int rc;
+
+  (void)argc;
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+  rc = graphCreatePropertyIndex(pGraph, zLabel, zProperty);
+  if( rc==SQLITE_MISUSE ){
+    sqlite3_result_error(pCtx, "graph_create_index(): property must be a "
+                         "non-empty name of letters, digits and '_'", -1);
+  }else if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+  }else{
+    graphForgetPlans(pGraph);
+    sqlite3_result_int(pCtx, 1);
+  }
+}
+
+/*
+** SQL function: graph_create_constraint(label, property)
+** Declares property unique among nodes with label. Cypher MERGE on a
+** constrained key becomes one unique index probe and an upsert.
+** Usage: SELECT graph_create_constraint('Person', 'email');
+*/
+static void graphCreateConstraintFunc(sqlite3_context *pCtx, int argc,
+                                      sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  const char *zLabel = (const char*)sqlite3_value_text(argv[0]);
+  const char *zProperty = (const char*)sqlite3_value_text(argv[1]);
+  int rc;
+
+  (void)argc;
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+  rc = graphCreateUniqueConstraint(pGraph, zLabel, zProperty);
+  if( rc==SQLITE_MISUSE ){
+    sqlite3_result_error(pCtx, "graph_create_constraint(): label and property "
+                         "must be non-empty names of letters, digits and '_'", -1);
+  }else if( rc==SQLITE_CONSTRAINT ){
+    sqlite3_result_error(pCtx, "graph_create_constraint(): existing nodes "
+                         "repeat the key", -1);
+  }else if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+  }else{
+    graphForgetPlans(pGraph);
+    sqlite3_result_int(pCtx, 1);
+  }
+}
+
+/*
+** SQL function: graph_create_column(label, property)
+** Keeps property of the nodes with label (all nodes if label is NULL)
+** in a typed in-memory column, which Cypher comparisons on it scan
+** instead of the node table. The declaration persists with the graph.
+** Usage: SELECT graph_create_column('Person', 'age');
+*/
+static void graphCreateColumnFunc(sqlite3_context *pCtx, int argc,
+                                  sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  const char *zLabel = (const char*)sqlite3_value_text(argv[0]);
+  const char *zProperty = (const char*)sqlite3_value_text(argv[1]);
+  int rc;
+
+  (void)argc;
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+  rc = graphColumnCreate(pGraph, zLabel, zProperty);
+  if( rc==SQLITE_MISUSE ){
+    sqlite3_result_error(pCtx, "graph_create_column(): label and property "
+                         "must be names of letters, digits and '_'", -1);
+  }else if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+  }else{
+    graphForgetPlans(pGraph);
+    sqlite3_result_int(pCtx, 1);
+  }
+}
+
+/*
+** SQL function: graph_drop_column(label, property)
+** Forgets a column made by graph_create_column(). Returns 1 if there
+** was one, 0 if not.
+** Usage: SELECT graph_drop_column('Person', 'age');
+*/
+static void graphDropColumnFunc(sqlite3_context *pCtx, int argc,
+                                sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  const char *zLabel = (const char*)sqlite3_value_text(argv[0]);
+  const char *zProperty = (const char*)sqlite3_value_text(argv[1]);
+  int bDropped = 0;
+  int rc;
+
+  (void)argc;
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+  rc = graphColumnDrop(pGraph, zLabel, zProperty, &bDropped);
+  if( rc==SQLITE_MISUSE ){
+    sqlite3_result_error(pCtx, "graph_drop_column(): label and property "
+                         "must be names of letters, digits and '_'", -1);
+  }else if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+  }else{
+    graphForgetPlans(pGraph);
+    sqlite3_result_int(pCtx, bDropped);
+  }
+}
+
+/*
+** SQL function: graph_columns()
+** Describes the declared columns as a JSON array: label, property,
+** value type, member nodes, nodes with a value, bytes held and whether
+** the contents are current.
+** Usage: SELECT graph_columns();
+*/
+static void graphColumnsFunc(sqlite3_context *pCtx, int argc,
+                             sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  char *zJson = 0;
+  int rc;
+
+  (void)argc;
+  (void)argv;
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+  rc = graphColumnsDescribe(pGraph, &zJson);
+  graphResultJson(pCtx, rc, zJson);
+}
+
+/*
+** SQL function: graph_expand(node_id [, type [, direction]])
+** Returns the ids at the other end of node_id's edges as a JSON array.
+** type restricts the edges to one relationship type (NULL for any) and
+** direction is 'out' (default), 'in' or 'both'. Each call probes the
+** covering edge index, so its cost follows the node's degree.
+** Usage: SELECT graph_expand(1);
+**        SELECT graph_expand(1, 'KNOWS', 'both');
+*/
+static void graphExpandFunc(sqlite3_context *pCtx, int argc,
+                               sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  sqlite3_int64 *aId = 0;
+  const char *zType = 0;
+  const char *zDir = 0;
+  int eDir = GRAPH_EXPAND_OUT;
+  int nId = 0;
+  sqlite3_str *pOut;
+  int rc;
+  int i;
+
+  if( argc<1 || argc>3 ){
+    sqlite3_result_error(pCtx, "graph_expand() requires 1 to 3 arguments", -1);
+    return;
+  }
+  if( argc>=2 ) zType = (const char*)sqlite3_value_text(argv[1]);
+  if( argc==3 ) zDir = (const char*)sqlite3_value_text(argv[2]);
+  if( zDir==0 || sqlite3_stricmp(zDir, "out")==0 ){
+    eDir = GRAPH_EXPAND_OUT;
+  }else if( sqlite3_stricmp(zDir, "in")==0 ){
+    eDir = GRAPH_EXPAND_IN;
+  }else if( sqlite3_stricmp(zDir, "both")==0 ){
+    eDir = GRAPH_EXPAND_BOTH;
+  }else{
+    sqlite3_result_error(pCtx, "graph_expand(): direction must be "
+                         "'out', 'in' or 'both'", -1);
+    return;
+  }
+
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+
+  rc = graphExpand(pGraph, sqlite3_value_int64(argv[0]), zType, eDir,
+                   &aId, &nId);
+  if( rc!=SQLITE_OK ){
+    graphResultJson(pCtx, rc, 0);
+    return;
+  }
+  pOut = sqlite3_str_new(0);
+  sqlite3_str_appendchar(pOut, 1, '[');
+  for(i=0; i<nId; i++){
+    sqlite3_str_appendf(pOut, i ? ",%lld" : "%lld", aId[i]);
+  }
+  sqlite3_str_appendchar(pOut, 1, ']');
+  sqlite3_free(aId);
+  rc = sqlite3_str_errcode(pOut);
+  graphResultJson(pCtx, rc, sqlite3_str_finish(pOut));
+}
+
+/*
+** SQL function: graph_analyze()
+** Recomputes the <graph>_stats table used to cost queries against the
+** graph virtual table and returns a JSON summary of the totals.
+** Usage: SELECT graph_analyze();
+*/
+static void graphAnalyzeFunc(sqlite3_context *pCtx, int argc,
+                             sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
+  GraphStats *pStats;
+  char *zJson;
+  int rc;
+
+  (void)argc;
+  (void)argv;
+  if( pGraph==0 ){
+    sqlite3_result_error(pCtx, "No graph table available. Create a graph table first using: CREATE VIRTUAL TABLE mygraph USING graph();", -1);
+    return;
+  }
+  rc = graphAnalyze(pGraph);
+  if( rc!=SQLITE_OK ){
+    sqlite3_result_error_code(pCtx, rc);
+    return;
+  }
+  graphForgetPlans(pGraph);
+  pStats = pGraph->pStats;
+  zJson = sqlite3_mprintf(
+      "{\"nodes\":%lld,\"edges\":%lld,\"labels\":%d,\"types\":%d,"
+      "\"properties\":%d}",
+      pStats ? pStats->nNodes : 0, pStats ? pStats->nEdges : 0,
+      pStats ? pStats->nLabel : 0, pStats ? pStats->nType : 0,
+      pStats ? pStats->nProp : 0);
+  graphResultJson(pCtx, zJson ? SQLITE_OK : SQLITE_NOMEM, zJson);
 }
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
@@ -1177,7 +1668,13 @@ int graphAddNode(GraphVtab *pVtab, sqlite3_int64 iNodeId,
   int rc;
 
   zSql = sqlite3_mprintf("INSERT INTO %s_nodes(id, properties) VALUES(%lld, %Q)", pVtab->zTableName, iNodeId, zProperties);
+  graphCSRTrackBegin(pVtab);
   rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pVtab);
+    graphCSRTrack(pVtab, CSR_OP_ADD_NODE, iNodeId, 0, 0.0);
+  }
+  graphCSRTrackEnd(pVtab, rc, 0);
   sqlite3_free(zSql);
 
   return rc;
@@ -1187,38 +1684,43 @@ int graphRemoveNode(GraphVtab *pVtab, sqlite3_int64 iNodeId){
   char *zSql;
   int rc;
 
+  /* Hiding the node hides its edges too */
+  graphCSRTrackBegin(pVtab);
   zSql = sqlite3_mprintf("DELETE FROM %s_nodes WHERE id = %lld", pVtab->zTableName, iNodeId);
   rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ) graphBumpDataVersion(pVtab);
   sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ) return rc;
 
-  zSql = sqlite3_mprintf("DELETE FROM %s_edges WHERE from_id = %lld OR to_id = %lld", pVtab->zTableName, iNodeId, iNodeId);
-  rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
-  sqlite3_free(zSql);
+  if( rc==SQLITE_OK ){
+    zSql = sqlite3_mprintf("DELETE FROM %s WHERE source = %lld OR target = %lld", pVtab->zEdgeTableName, iNodeId, iNodeId);
+    rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+    if( rc==SQLITE_OK ) graphBumpDataVersion(pVtab);
+    sqlite3_free(zSql);
+  }
+  if( rc==SQLITE_OK ) graphCSRTrack(pVtab, CSR_OP_DEL_NODE, iNodeId, 0, 0.0);
+  graphCSRTrackEnd(pVtab, rc, 0);
 
   return rc;
 }
 
 int graphGetNode(GraphVtab *pVtab, sqlite3_int64 iNodeId, 
                  char **pzProperties){
-  char *zSql;
   sqlite3_stmt *pStmt;
   int rc;
 
-  zSql = sqlite3_mprintf("SELECT properties FROM %s_nodes WHERE id = %lld", pVtab->zTableName, iNodeId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
+  *pzProperties = 0;
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_NODE_BY_ID, &pStmt);
   if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_int64(pStmt, 1, iNodeId);
 
   rc = sqlite3_step(pStmt);
   if( rc==SQLITE_ROW ){
-    *pzProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
-    rc = SQLITE_OK;
-  } else {
-    *pzProperties = 0;
+    *pzProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 2));
+    rc = *pzProperties ? SQLITE_OK : SQLITE_NOMEM;
+  } else if( rc==SQLITE_DONE ){
     rc = SQLITE_NOTFOUND;
   }
-  sqlite3_finalize(pStmt);
+  graphStmtRelease(pVtab, pStmt);
   return rc;
 }
 
@@ -1228,8 +1730,15 @@ int graphAddEdge(GraphVtab *pVtab, sqlite3_int64 iFromId,
   char *zSql;
   int rc;
 
-  zSql = sqlite3_mprintf("INSERT INTO %s_edges(from_id, to_id, weight, properties) VALUES(%lld, %lld, %f, %Q)", pVtab->zTableName, iFromId, iToId, rWeight, zProperties);
+  zSql = sqlite3_mprintf("INSERT INTO %s(source, target, weight, properties) VALUES(%lld, %lld, %f, %Q)", pVtab->zEdgeTableName, iFromId, iToId, rWeight, zProperties);
+  graphCSRTrackBegin(pVtab);
   rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pVtab);
+    graphCSRTrackEdgeRow(pVtab, CSR_OP_ADD_EDGE,
+                         sqlite3_last_insert_rowid(pVtab->pDb));
+  }
+  graphCSRTrackEnd(pVtab, rc, 0);
   sqlite3_free(zSql);
 
   return rc;
@@ -1240,8 +1749,14 @@ int graphRemoveEdge(GraphVtab *pVtab, sqlite3_int64 iFromId,
   char *zSql;
   int rc;
 
-  zSql = sqlite3_mprintf("DELETE FROM %s_edges WHERE from_id = %lld AND to_id = %lld", pVtab->zTableName, iFromId, iToId);
+  zSql = sqlite3_mprintf("DELETE FROM %s WHERE source = %lld AND target = %lld", pVtab->zEdgeTableName, iFromId, iToId);
+  graphCSRTrackBegin(pVtab);
   rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pVtab);
+    graphCSRTrack(pVtab, CSR_OP_DEL_EDGES, iFromId, iToId, 0.0);
+  }
+  graphCSRTrackEnd(pVtab, rc, 0);
   sqlite3_free(zSql);
 
   return rc;
@@ -1253,7 +1768,13 @@ int graphUpdateNode(GraphVtab *pVtab, sqlite3_int64 iNodeId,
   int rc;
 
   zSql = sqlite3_mprintf("UPDATE %s_nodes SET properties = %Q WHERE id = %lld", pVtab->zTableName, zProperties, iNodeId);
+  graphCSRTrackBegin(pVtab);
   rc = sqlite3_exec(pVtab->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pVtab);
+    graphColumnsTouch(pVtab, iNodeId, 0);
+  }
+  graphCSRTrackEnd(pVtab, rc, 0);
   sqlite3_free(zSql);
 
   return rc;
@@ -1262,108 +1783,84 @@ int graphUpdateNode(GraphVtab *pVtab, sqlite3_int64 iNodeId,
 int graphGetEdge(GraphVtab *pVtab, sqlite3_int64 iFromId, 
                  sqlite3_int64 iToId, double *prWeight, 
                  char **pzProperties){
-  char *zSql;
   sqlite3_stmt *pStmt;
   int rc;
 
-  zSql = sqlite3_mprintf("SELECT weight, properties FROM %s_edges WHERE from_id = %lld AND to_id = %lld", pVtab->zTableName, iFromId, iToId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
+  *prWeight = 0.0;
+  *pzProperties = 0;
+  rc = graphStmtAcquire(pVtab, GRAPH_STMT_EDGE_BY_ENDS, &pStmt);
   if( rc!=SQLITE_OK ) return rc;
+  sqlite3_bind_int64(pStmt, 1, iFromId);
+  sqlite3_bind_int64(pStmt, 2, iToId);
 
   rc = sqlite3_step(pStmt);
   if( rc==SQLITE_ROW ){
-    *prWeight = sqlite3_column_double(pStmt, 0);
-    *pzProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
-    rc = SQLITE_OK;
-  } else {
-    *prWeight = 0.0;
-    *pzProperties = 0;
+    *prWeight = sqlite3_column_double(pStmt, 4);
+    *pzProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 5));
+    rc = *pzProperties ? SQLITE_OK : SQLITE_NOMEM;
+  } else if( rc==SQLITE_DONE ){
     rc = SQLITE_NOTFOUND;
   }
-  sqlite3_finalize(pStmt);
+  graphStmtRelease(pVtab, pStmt);
   return rc;
 }
 
 int graphCountNodes(GraphVtab *pVtab){
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int rc;
-  int nNodes = 0;
-
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_nodes", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nNodes = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  return nNodes;
+  sqlite3_int64 nNodes = 0;
+  graphLiveCounts(pVtab, &nNodes, 0);
+  return (int)nNodes;
 }
 
 int graphCountEdges(GraphVtab *pVtab){
-  char *zSql;
-  sqlite3_stmt *pStmt;
-  int rc;
-  int nEdges = 0;
-
-  zSql = sqlite3_mprintf("SELECT count(*) FROM %s_edges", pVtab->zTableName);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
-    nEdges = sqlite3_column_int(pStmt, 0);
-  }
-  sqlite3_finalize(pStmt);
-  return nEdges;
+  sqlite3_int64 nEdges = 0;
+  graphLiveCounts(pVtab, 0, &nEdges);
+  return (int)nEdges;
 }
 
 GraphNode *graphFindNode(GraphVtab *pVtab, sqlite3_int64 iNodeId){
-  char *zSql;
   sqlite3_stmt *pStmt;
-  int rc;
   GraphNode *pNode = 0;
 
-  zSql = sqlite3_mprintf("SELECT id, properties FROM %s_nodes WHERE id = %lld", pVtab->zTableName, iNodeId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ) return 0;
+  if( graphStmtAcquire(pVtab, GRAPH_STMT_NODE_BY_ID, &pStmt)!=SQLITE_OK ){
+    return 0;
+  }
+  sqlite3_bind_int64(pStmt, 1, iNodeId);
 
-  rc = sqlite3_step(pStmt);
-  if( rc==SQLITE_ROW ){
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
     pNode = sqlite3_malloc(sizeof(GraphNode));
     if( pNode ){
+      memset(pNode, 0, sizeof(GraphNode));
       pNode->iNodeId = sqlite3_column_int64(pStmt, 0);
-      pNode->zProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 1));
+      pNode->zProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 2));
     }
   }
-  sqlite3_finalize(pStmt);
+  graphStmtRelease(pVtab, pStmt);
   return pNode;
 }
 
 GraphEdge *graphFindEdge(GraphVtab *pVtab, sqlite3_int64 iFromId, 
                          sqlite3_int64 iToId){
-  char *zSql;
   sqlite3_stmt *pStmt;
-  int rc;
   GraphEdge *pEdge = 0;
 
-  zSql = sqlite3_mprintf("SELECT id, from_id, to_id, weight, properties FROM %s_edges WHERE from_id = %lld AND to_id = %lld", pVtab->zTableName, iFromId, iToId);
-  rc = sqlite3_prepare_v2(pVtab->pDb, zSql, -1, &pStmt, 0);
-  sqlite3_free(zSql);
-  if( rc!=SQLITE_OK ) return 0;
+  if( graphStmtAcquire(pVtab, GRAPH_STMT_EDGE_BY_ENDS, &pStmt)!=SQLITE_OK ){
+    return 0;
+  }
+  sqlite3_bind_int64(pStmt, 1, iFromId);
+  sqlite3_bind_int64(pStmt, 2, iToId);
 
-  rc = sqlite3_step(pStmt);
-  if( rc==SQLITE_ROW ){
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
     pEdge = sqlite3_malloc(sizeof(GraphEdge));
     if( pEdge ){
+      memset(pEdge, 0, sizeof(GraphEdge));
       pEdge->iEdgeId = sqlite3_column_int64(pStmt, 0);
       pEdge->iFromId = sqlite3_column_int64(pStmt, 1);
       pEdge->iToId = sqlite3_column_int64(pStmt, 2);
-      pEdge->rWeight = sqlite3_column_double(pStmt, 3);
-      pEdge->zProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 4));
+      pEdge->rWeight = sqlite3_column_double(pStmt, 4);
+      pEdge->zProperties = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 5));
     }
   }
-  sqlite3_finalize(pStmt);
+  graphStmtRelease(pVtab, pStmt);
   return pEdge;
 }
 
@@ -1373,6 +1870,7 @@ GraphEdge *graphFindEdge(GraphVtab *pVtab, sqlite3_int64 iFromId,
 ** Usage: SELECT graph_node_update(1, '{"name": "Alice Updated"}');
 */
 static void graphNodeUpdateFunc(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iNodeId;
   const unsigned char *zProperties;
   char *zSql;
@@ -1393,7 +1891,13 @@ static void graphNodeUpdateFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 
   zSql = sqlite3_mprintf("UPDATE %s_nodes SET properties = %Q WHERE id = %lld", 
                          pGraph->zTableName, zProperties, iNodeId);
+  graphCSRTrackBegin(pGraph);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pGraph);
+    graphColumnsTouch(pGraph, iNodeId, 0);
+  }
+  graphCSRTrackEnd(pGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -1410,6 +1914,7 @@ static void graphNodeUpdateFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 ** Usage: SELECT graph_node_delete(1);
 */
 static void graphNodeDeleteFunc(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iNodeId;
   char *zSql;
   int rc;
@@ -1428,7 +1933,13 @@ static void graphNodeDeleteFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 
   zSql = sqlite3_mprintf("DELETE FROM %s_nodes WHERE id = %lld", 
                          pGraph->zTableName, iNodeId);
+  graphCSRTrackBegin(pGraph);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pGraph);
+    graphCSRTrack(pGraph, CSR_OP_DEL_NODE, iNodeId, 0, 0.0);
+  }
+  graphCSRTrackEnd(pGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -1445,6 +1956,7 @@ static void graphNodeDeleteFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 ** Usage: SELECT graph_edge_update(1, 1, 2, 2.0, '{"updated": true}');
 */
 static void graphEdgeUpdateFunc(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iEdgeId, iFromId, iToId;
   double rWeight;
   const unsigned char *zProperties;
@@ -1467,9 +1979,16 @@ static void graphEdgeUpdateFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
   rWeight = sqlite3_value_double(argv[3]);
   zProperties = sqlite3_value_text(argv[4]);
 
-  zSql = sqlite3_mprintf("UPDATE %s_edges SET from_id = %lld, to_id = %lld, weight = %f, properties = %Q WHERE id = %lld", 
-                         pGraph->zTableName, iFromId, iToId, rWeight, zProperties, iEdgeId);
+  zSql = sqlite3_mprintf("UPDATE %s SET source = %lld, target = %lld, weight = %f, properties = %Q WHERE id = %lld", 
+                         pGraph->zEdgeTableName, iFromId, iToId, rWeight, zProperties, iEdgeId);
+  graphCSRTrackBegin(pGraph);
+  graphCSRTrackEdgeRow(pGraph, CSR_OP_DEL_EDGE, iEdgeId);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pGraph);
+    graphCSRTrackEdgeRow(pGraph, CSR_OP_ADD_EDGE, iEdgeId);
+  }
+  graphCSRTrackEnd(pGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -1486,6 +2005,7 @@ static void graphEdgeUpdateFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 ** Usage: SELECT graph_edge_delete(1);
 */
 static void graphEdgeDeleteFunc(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iEdgeId;
   char *zSql;
   int rc;
@@ -1504,7 +2024,11 @@ static void graphEdgeDeleteFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 
   zSql = sqlite3_mprintf("DELETE FROM %s_edges WHERE id = %lld", 
                          pGraph->zTableName, iEdgeId);
+  graphCSRTrackBegin(pGraph);
+  graphCSRTrackEdgeRow(pGraph, CSR_OP_DEL_EDGE, iEdgeId);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ) graphBumpDataVersion(pGraph);
+  graphCSRTrackEnd(pGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -1521,6 +2045,7 @@ static void graphEdgeDeleteFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 ** Usage: SELECT graph_node_upsert(1, '{"name": "Alice"}');
 */
 static void graphNodeUpsertFunc(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iNodeId;
   const unsigned char *zProperties;
   char *zSql;
@@ -1539,9 +2064,12 @@ static void graphNodeUpsertFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
   iNodeId = sqlite3_value_int64(argv[0]);
   zProperties = sqlite3_value_text(argv[1]);
 
-  zSql = sqlite3_mprintf("INSERT OR REPLACE INTO %s_nodes (id, properties) VALUES (%lld, %Q)", 
+  zSql = sqlite3_mprintf("INSERT INTO %s_nodes (id, properties) VALUES (%lld, %Q)"
+                         " ON CONFLICT(id) DO UPDATE SET labels=excluded.labels,"
+                         " properties=excluded.properties",
                          pGraph->zTableName, iNodeId, zProperties);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ) graphBumpDataVersion(pGraph);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -1558,6 +2086,7 @@ static void graphNodeUpsertFunc(sqlite3_context *pCtx, int argc, sqlite3_value *
 ** Usage: SELECT graph_cascade_delete_node(1);
 */
 static void graphCascadeDeleteNodeFunc(sqlite3_context *pCtx, int argc, sqlite3_value **argv){
+  GraphVtab *pGraph = graphRegistryFind(sqlite3_context_db_handle(pCtx), 0);
   sqlite3_int64 iNodeId;
   char *zSql;
   int rc;
@@ -1575,20 +2104,28 @@ static void graphCascadeDeleteNodeFunc(sqlite3_context *pCtx, int argc, sqlite3_
   iNodeId = sqlite3_value_int64(argv[0]);
 
   /* Delete all edges connected to this node */
-  zSql = sqlite3_mprintf("DELETE FROM %s_edges WHERE from_id = %lld OR to_id = %lld", 
-                         pGraph->zTableName, iNodeId, iNodeId);
+  zSql = sqlite3_mprintf("DELETE FROM %s WHERE source = %lld OR target = %lld", 
+                         pGraph->zEdgeTableName, iNodeId, iNodeId);
+  graphCSRTrackBegin(pGraph);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ) graphBumpDataVersion(pGraph);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
+    graphCSRTrackEnd(pGraph, rc, 0);
     sqlite3_result_error_code(pCtx, rc);
     return;
   }
 
-  /* Delete the node */
+  /* Delete the node; the snapshot hides its edges with it */
   zSql = sqlite3_mprintf("DELETE FROM %s_nodes WHERE id = %lld", 
                          pGraph->zTableName, iNodeId);
   rc = sqlite3_exec(pGraph->pDb, zSql, 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    graphBumpDataVersion(pGraph);
+    graphCSRTrack(pGraph, CSR_OP_DEL_NODE, iNodeId, 0, 0.0);
+  }
+  graphCSRTrackEnd(pGraph, rc, 0);
   sqlite3_free(zSql);
 
   if( rc!=SQLITE_OK ){
@@ -0,0 +1,181 @@
+/*
+** test_cypher_return.c - RETURN items projected by cypher_execute()
+**
+** Each RETURN item is one output column, named by its alias or else by
+** the item's text. ORDER BY and LIMIT sort and cut the rows; clauses the
+** planner does not support are rejected rather than ignored.
+*/
+#include <string.h>
+#include "unity.h"
+#include "sqlite3.h"
+#include "graph.h"
+#include "cypher-expressions.h"
+
+int sqlite3_graph_init(sqlite3 *db, char **pzErrMsg,
+                       const sqlite3_api_routines *pApi);
+
+static sqlite3 *db;
+static char *zResult;
+
+static void execSql(const char *zSql) {
+  char *zErr = 0;
+  int rc = sqlite3_exec(db, zSql, 0, 0, &zErr);
+  TEST_ASSERT_EQUAL_MESSAGE(SQLITE_OK, rc, zErr);
+  sqlite3_free(zErr);
+}
+
+/*
+** Run cypher_execute(zQuery [, zParams]) and return its JSON result, or
+** the error message prefixed with "ERR: ". Valid until the next call.
+*/
+static const char *cypherExec(const char *zQuery, const char *zParams) {
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+
+  sqlite3_free(zResult);
+  rc = sqlite3_prepare_v2(db, zParams ? "SELECT cypher_execute(?1, ?2)" :
+                          "SELECT cypher_execute(?1)", -1, &pStmt, 0);
+  TEST_ASSERT_EQUAL(SQLITE_OK, rc);
+  sqlite3_bind_text(pStmt, 1, zQuery, -1, SQLITE_STATIC);
+  if( zParams ) sqlite3_bind_text(pStmt, 2, zParams, -1, SQLITE_STATIC);
+  rc = sqlite3_step(pStmt);
+  if( rc == SQLITE_ROW ) {
+    zResult = sqlite3_mprintf("%s", (const char*)sqlite3_column_text(pStmt, 0));
+  } else {
+    zResult = sqlite3_mprintf("ERR: %s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return zResult;
+}
+
+void setUp(void) {
+  TEST_ASSERT_EQUAL(SQLITE_OK, sqlite3_open(":memory:", &db));
+  execSql("CREATE VIRTUAL TABLE g USING graph();"
+          "INSERT INTO g_nodes(id, labels, properties) VALUES"
+          " (1, '[\"Person\"]', '{\"name\":\"alice\",\"age\":30}'),"
+          " (2, '[\"Person\"]', '{\"name\":\"bob\",\"age\":25}'),"
+          " (3, '[\"Person\"]', '{\"name\":\"carol\",\"age\":35}'),"
+          " (4, '[\"City\"]', '{\"name\":\"Paris\"}');"
+          "INSERT INTO g_edges(source, target, edge_type, properties) VALUES"
+          " (1, 2, 'KNOWS', '{\"since\":2001}'),"
+          " (2, 3, 'KNOWS', '{}');");
+}
+
+void tearDown(void) {
+  sqlite3_free(zResult);
+  zResult = 0;
+  sqlite3_close(db);
+  db = 0;
+}
+
+void test_return_property_returnsValue(void) {
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"n.name\":\"alice\"},{\"n.name\":\"bob\"},{\"n.name\":\"carol\"}]",
+      cypherExec("MATCH (n:Person) RETURN n.name", 0));
+}
+
+void test_return_severalItems_oneColumnEach(void) {
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"a.name\":\"alice\",\"b.name\":\"bob\"},"
+      "{\"a.name\":\"bob\",\"b.name\":\"carol\"}]",
+      cypherExec("MATCH (a:Person)-[:KNOWS]->(b:Person) RETURN a.name, b.name", 0));
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"a\":Node(1),\"r\":Relationship(1),\"b\":Node(2)},"
+      "{\"a\":Node(2),\"r\":Relationship(2),\"b\":Node(3)}]",
+      cypherExec("MATCH (a:Person)-[r:KNOWS]->(b) RETURN a, r, b", 0));
+}
+
+void test_return_alias_namesColumn(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"who\":\"bob\",\"n.age\":25}]",
+      cypherExec("MATCH (n:Person) WHERE n.age = 25 RETURN n.name AS who, n.age", 0));
+}
+
+void test_return_expressions_evaluatedPerRow(void) {
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"n.age * 2 + 1\":51,\"toUpper(n.name)\":\"BOB\",\"$p\":7,\"'x'\":\"x\"}]",
+      cypherExec("MATCH (n:Person) WHERE n.age = 25 "
+                 "RETURN n.age * 2 + 1, toUpper(n.name), $p, 'x'", "{\"p\":7}"));
+}
+
+void test_return_missingProperty_isNull(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"n.missing\":null}]",
+      cypherExec("MATCH (n:Person) WHERE n.age = 25 RETURN n.missing", 0));
+}
+
+void test_return_orderBy_sortsRows(void) {
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"n.name\":\"carol\"},{\"n.name\":\"bob\"},{\"n.name\":\"alice\"}]",
+      cypherExec("MATCH (n:Person) RETURN n.name ORDER BY n.name DESC", 0));
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"who\":\"bob\"},{\"who\":\"alice\"},{\"who\":\"carol\"}]",
+      cypherExec("MATCH (n:Person) RETURN n.name AS who ORDER BY n.age, who", 0));
+}
+
+void test_return_orderByLimit_keepsTopRows(void) {
+  const char *zQuery = "MATCH (n:Person) RETURN n.name ORDER BY n.age DESC LIMIT 2";
+  CypherParser *pParser = cypherParserCreate();
+  CypherPlanner *pPlanner;
+  PhysicalPlanNode *pNode;
+  PhysicalPlanNode *pSort = 0;
+  CypherAst *pAst;
+
+  TEST_ASSERT_NOT_NULL(pParser);
+  pAst = cypherParse(pParser, zQuery, 0);
+  TEST_ASSERT_NOT_NULL(pAst);
+  pPlanner = cypherPlannerCreate(db, graphRegistryFind(db, 0));
+  TEST_ASSERT_NOT_NULL(pPlanner);
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherPlannerCompile(pPlanner, pAst));
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherPlannerOptimize(pPlanner));
+  for( pNode = cypherPlannerGetPlan(pPlanner); pNode && !pSort;
+       pNode = pNode->nChildren > 0 ? pNode->apChildren[0] : 0 ) {
+    if( pNode->type == PHYSICAL_SORT ) pSort = pNode;
+  }
+  TEST_ASSERT_NOT_NULL(pSort);
+  TEST_ASSERT_EQUAL(1, pSort->nSortKeys);
+  TEST_ASSERT_EQUAL(2, pSort->nLimit);
+  cypherPlannerDestroy(pPlanner);
+  cypherParserDestroy(pParser);
+
+  TEST_ASSERT_EQUAL_STRING("[{\"n.name\":\"carol\"},{\"n.name\":\"alice\"}]",
+      cypherExec(zQuery, 0));
+  TEST_ASSERT_EQUAL_STRING("[]",
+      cypherExec("MATCH (n:Person) RETURN n LIMIT 0", 0));
+}
+
+void test_return_orderByAggregate_sortsGroups(void) {
+  execSql("INSERT INTO g_nodes(id, labels, properties) VALUES"
+          " (5, '[\"Person\"]', '{\"name\":\"bob\",\"age\":40}');");
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"n.name\":\"bob\",\"c\":2},{\"n.name\":\"alice\",\"c\":1}]",
+      cypherExec("MATCH (n:Person) RETURN n.name, count(*) AS c "
+                 "ORDER BY c DESC, n.name LIMIT 2", 0));
+  TEST_ASSERT_EQUAL_STRING(
+      "ERR: Compilation failed: ORDER BY after an aggregation must name a RETURN column",
+      cypherExec("MATCH (n:Person) RETURN n.name, count(*) ORDER BY n.age", 0));
+}
+
+void test_return_unsupportedClauses_areRejected(void) {
+  TEST_ASSERT_EQUAL_STRING("ERR: Compilation failed: SKIP is not supported",
+      cypherExec("MATCH (n:Person) RETURN n SKIP 1", 0));
+  TEST_ASSERT_EQUAL_STRING(
+      "ERR: Compilation failed: LIMIT must be a non-negative integer literal",
+      cypherExec("MATCH (n:Person) RETURN n LIMIT $k", "{\"k\":1}"));
+  TEST_ASSERT_NOT_NULL(strstr(
+      cypherExec("MATCH (n:Person) WHERE n.name = 'bob' SET n.age = 42", 0),
+      "Unexpected or unsupported input near 'SET'"));
+}
+
+int main(void) {
+  sqlite3_auto_extension((void(*)(void))sqlite3_graph_init);
+  UNITY_BEGIN();
+  RUN_TEST(test_return_property_returnsValue);
+  RUN_TEST(test_return_severalItems_oneColumnEach);
+  RUN_TEST(test_return_alias_namesColumn);
+  RUN_TEST(test_return_expressions_evaluatedPerRow);
+  RUN_TEST(test_return_missingProperty_isNull);
+  RUN_TEST(test_return_orderBy_sortsRows);
+  RUN_TEST(test_return_orderByLimit_keepsTopRows);
+  RUN_TEST(test_return_orderByAggregate_sortsGroups);
+  RUN_TEST(test_return_unsupportedClauses_areRejected);
+  return UNITY_END();
+}
@@ -0,0 +1,236 @@
+/*
+** test_cypher_where.c - WHERE predicates evaluated by cypher_execute()
+**
+** The Person nodes carry no property index, so every predicate here is
+** planned as a filter over a label scan and evaluated per row, in chunks
+** unless the iterators are switched to row mode.
+*/
+#include <string.h>
+#include "unity.h"
+#include "sqlite3.h"
+#include "graph.h"
+#include "cypher-expressions.h"
+#include "cypher-executor.h"
+
+int sqlite3_graph_init(sqlite3 *db, char **pzErrMsg,
+                       const sqlite3_api_routines *pApi);
+
+static sqlite3 *db;
+static char *zResult;
+
+static void execSql(const char *zSql) {
+  char *zErr = 0;
+  int rc = sqlite3_exec(db, zSql, 0, 0, &zErr);
+  TEST_ASSERT_EQUAL_MESSAGE(SQLITE_OK, rc, zErr);
+  sqlite3_free(zErr);
+}
+
+/*
+** Run cypher_execute(zQuery [, zParams]) and return its JSON result, or
+** the error message prefixed with "ERR: ". Valid until the next call.
+*/
+static const char *cypherExec(const char *zQuery, const char *zParams) {
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+
+  sqlite3_free(zResult);
+  rc = sqlite3_prepare_v2(db, zParams ? "SELECT cypher_execute(?1, ?2)" :
+                          "SELECT cypher_execute(?1)", -1, &pStmt, 0);
+  TEST_ASSERT_EQUAL(SQLITE_OK, rc);
+  sqlite3_bind_text(pStmt, 1, zQuery, -1, SQLITE_STATIC);
+  if( zParams ) sqlite3_bind_text(pStmt, 2, zParams, -1, SQLITE_STATIC);
+  rc = sqlite3_step(pStmt);
+  if( rc == SQLITE_ROW ) {
+    zResult = sqlite3_mprintf("%s", (const char*)sqlite3_column_text(pStmt, 0));
+  } else {
+    zResult = sqlite3_mprintf("ERR: %s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return zResult;
+}
+
+void setUp(void) {
+  TEST_ASSERT_EQUAL(SQLITE_OK, sqlite3_open(":memory:", &db));
+  execSql("CREATE VIRTUAL TABLE g USING graph();"
+          "INSERT INTO g_nodes(id, labels, properties) VALUES"
+          " (1, '[\"Person\"]', '{\"name\":\"alice\",\"age\":30}'),"
+          " (2, '[\"Person\"]', '{\"name\":\"bob\",\"age\":25}'),"
+          " (3, '[\"Person\"]', '{\"name\":\"carol\",\"age\":35}'),"
+          " (4, '[\"City\"]', '{\"name\":\"Paris\"}');"
+          "INSERT INTO g_edges(source, target, edge_type, properties) VALUES"
+          " (1, 2, 'KNOWS', '{\"since\":2001}'),"
+          " (2, 3, 'KNOWS', '{}');");
+}
+
+void tearDown(void) {
+  sqlite3_free(zResult);
+  zResult = 0;
+  sqlite3_close(db);
+  db = 0;
+}
+
+void test_where_unindexedGreaterThan_returnsMatchingNodes(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(1)},{\"n\":Node(3)}]",
+      cypherExec("MATCH (n:Person) WHERE n.age > 29 RETURN n", 0));
+  TEST_ASSERT_EQUAL_STRING("[]",
+      cypherExec("MATCH (n:Person) WHERE n.age > 35 RETURN n", 0));
+}
+
+void test_where_unindexedEquals_returnsMatchingNode(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(2)}]",
+      cypherExec("MATCH (n:Person) WHERE n.name = 'bob' RETURN n", 0));
+}
+
+void test_where_booleanOperators_combinePredicates(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(1)}]",
+      cypherExec("MATCH (n:Person) WHERE n.age >= 30 AND n.name <> 'carol' "
+                 "RETURN n", 0));
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(2)},{\"n\":Node(3)}]",
+      cypherExec("MATCH (n:Person) WHERE n.name CONTAINS 'ro' OR n.age < 26 "
+                 "RETURN n", 0));
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(2)},{\"n\":Node(3)}]",
+      cypherExec("MATCH (n:Person) WHERE NOT n.age = 30 RETURN n", 0));
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(2)},{\"n\":Node(3)}]",
+      cypherExec("MATCH (n:Person) WHERE n.age IN [25, 35] RETURN n", 0));
+}
+
+void test_where_missingProperty_matchesNothing(void) {
+  TEST_ASSERT_EQUAL_STRING("[]",
+      cypherExec("MATCH (n:Person) WHERE n.missing = 1 RETURN n", 0));
+}
+
+void test_where_parameter_readPerExecution(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(1)},{\"n\":Node(3)}]",
+      cypherExec("MATCH (n:Person) WHERE n.age > $a RETURN n", "{\"a\":26}"));
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(3)}]",
+      cypherExec("MATCH (n:Person) WHERE n.age > $a RETURN n", "{\"a\":30}"));
+  TEST_ASSERT_EQUAL_STRING("ERR: Missing parameter: $a",
+      cypherExec("MATCH (n:Person) WHERE n.age > $a RETURN n", 0));
+}
+
+void test_where_relationshipProperty_filtersEdges(void) {
+  TEST_ASSERT_EQUAL_STRING("[{\"b\":Node(2)}]",
+      cypherExec("MATCH (a)-[r:KNOWS]->(b) WHERE r.since = 2001 RETURN b", 0));
+}
+
+/*
+** Of "prop > literal AND <expression>", the comparison becomes a
+** property filter with its own predicate and only the expression is
+** left to the generic filter above it.
+*/
+void test_where_mixedConjuncts_residualHoldsOnlyUnpushed(void) {
+  const char *zQuery = "MATCH (n:Person) WHERE n.age > 26 AND n.age * 2 < 70 RETURN n";
+  CypherParser *pParser = cypherParserCreate();
+  CypherPlanner *pPlanner;
+  PhysicalPlanNode *pNode;
+  PhysicalPlanNode *pResidual = 0;
+  PhysicalPlanNode *pProperty = 0;
+  CypherAst *pAst;
+
+  TEST_ASSERT_NOT_NULL(pParser);
+  pAst = cypherParse(pParser, zQuery, 0);
+  TEST_ASSERT_NOT_NULL(pAst);
+  pPlanner = cypherPlannerCreate(db, graphRegistryFind(db, 0));
+  TEST_ASSERT_NOT_NULL(pPlanner);
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherPlannerCompile(pPlanner, pAst));
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherPlannerOptimize(pPlanner));
+
+  for( pNode = cypherPlannerGetPlan(pPlanner); pNode;
+       pNode = pNode->nChildren > 0 ? pNode->apChildren[0] : 0 ) {
+    if( pNode->type != PHYSICAL_FILTER ) continue;
+    if( pNode->zProperty ) pProperty = pNode;
+    else if( !pResidual ) pResidual = pNode;
+  }
+  TEST_ASSERT_NOT_NULL(pProperty);
+  TEST_ASSERT_NOT_NULL(pProperty->pFilterExpr);
+  TEST_ASSERT_NOT_NULL(pResidual);
+  TEST_ASSERT_NOT_NULL(pResidual->pFilterExpr);
+  TEST_ASSERT_EQUAL(CYPHER_EXPR_COMPARISON, pResidual->pFilterExpr->type);
+  TEST_ASSERT_EQUAL(CYPHER_EXPR_ARITHMETIC,
+                    pResidual->pFilterExpr->u.binary.pLeft->type);
+
+  cypherPlannerDestroy(pPlanner);
+  cypherParserDestroy(pParser);
+
+  TEST_ASSERT_EQUAL_STRING("[{\"n\":Node(1)}]", cypherExec(zQuery, 0));
+}
+
+/* Drop xNextBatch throughout an iterator tree so it runs row by row. */
+static void iteratorTreeRowMode(CypherIterator *pIterator) {
+  int i;
+  pIterator->xNextBatch = 0;
+  for( i = 0; i < pIterator->nChildren; i++ ) {
+    iteratorTreeRowMode(pIterator->apChildren[i]);
+  }
+}
+
+/*
+** Plan zQuery and run it to a JSON array, in chunks when bRowMode is
+** zero and through xNext only otherwise. The caller frees the result.
+*/
+static char *runPlan(const char *zQuery, int bRowMode) {
+  CypherParser *pParser = cypherParserCreate();
+  GraphVtab *pGraph = graphRegistryFind(db, 0);
+  CypherPlanner *pPlanner;
+  CypherExecutor *pExecutor;
+  char *zJson = 0;
+
+  TEST_ASSERT_NOT_NULL(pParser);
+  pPlanner = cypherPlannerCreate(db, pGraph);
+  TEST_ASSERT_NOT_NULL(pPlanner);
+  TEST_ASSERT_EQUAL(SQLITE_OK,
+                    cypherPlannerCompile(pPlanner, cypherParse(pParser, zQuery, 0)));
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherPlannerOptimize(pPlanner));
+  pExecutor = cypherExecutorCreate(db, pGraph);
+  TEST_ASSERT_NOT_NULL(pExecutor);
+  TEST_ASSERT_EQUAL(SQLITE_OK,
+                    cypherExecutorPrepare(pExecutor, cypherPlannerGetPlan(pPlanner)));
+  TEST_ASSERT_NOT_NULL(pExecutor->pRootIterator->xNextBatch);
+  if( bRowMode ) iteratorTreeRowMode(pExecutor->pRootIterator);
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherExecutorExecute(pExecutor, &zJson));
+
+  cypherExecutorDestroy(pExecutor);
+  cypherPlannerDestroy(pPlanner);
+  cypherParserDestroy(pParser);
+  return zJson;
+}
+
+/*
+** A WHERE over more rows than one chunk holds gives the same rows in
+** the same order whether it runs batched or row at a time.
+*/
+void test_where_batchedAndRowModes_sameRows(void) {
+  const char *zQuery = "MATCH (n:Person) WHERE n.age > 40 AND n.age % 3 <> 0 "
+                       "RETURN n.name, n.age * 2 AS twice";
+  char *zBatch;
+  char *zRow;
+
+  execSql("WITH RECURSIVE s(i) AS (SELECT 10 UNION ALL SELECT i+1 FROM s"
+          " WHERE i < 2600)"
+          " INSERT INTO g_nodes(id, labels, properties)"
+          " SELECT i, '[\"Person\"]',"
+          " json_object('name', 'p' || i, 'age', i % 97) FROM s;");
+  zBatch = runPlan(zQuery, 0);
+  zRow = runPlan(zQuery, 1);
+  TEST_ASSERT_NOT_NULL(zBatch);
+  TEST_ASSERT_NOT_NULL(zRow);
+  TEST_ASSERT_NOT_NULL(strstr(zBatch, "{\"n.name\":\"p41\",\"twice\":82}"));
+  TEST_ASSERT_NULL(strstr(zBatch, "\"p42\""));
+  TEST_ASSERT_EQUAL_STRING(zBatch, zRow);
+  sqlite3_free(zBatch);
+  sqlite3_free(zRow);
+}
+
+int main(void) {
+  sqlite3_auto_extension((void(*)(void))sqlite3_graph_init);
+  UNITY_BEGIN();
+  RUN_TEST(test_where_unindexedGreaterThan_returnsMatchingNodes);
+  RUN_TEST(test_where_unindexedEquals_returnsMatchingNode);
+  RUN_TEST(test_where_booleanOperators_combinePredicates);
+  RUN_TEST(test_where_missingProperty_matchesNothing);
+  RUN_TEST(test_where_parameter_readPerExecution);
+  RUN_TEST(test_where_relationshipProperty_filtersEdges);
+  RUN_TEST(test_where_mixedConjuncts_residualHoldsOnlyUnpushed);
+  RUN_TEST(test_where_batchedAndRowModes_sameRows);
+  return UNITY_END();
+}
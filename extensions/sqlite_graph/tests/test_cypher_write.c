@@ -0,0 +1,254 @@
+/*
+** test_cypher_write.c - writes through cypher_execute() and the
+** cypher_* write functions
+**
+** CREATE and MERGE queries are planned onto write operators; the write
+** functions run against the connection's default graph, in a savepoint
+** of their own or in the transaction cypher_begin_write() opened.
+*/
+#include <string.h>
+#include "unity.h"
+#include "sqlite3.h"
+#include "graph.h"
+#include "cypher-write.h"
+
+int sqlite3_graph_init(sqlite3 *db, char **pzErrMsg,
+                       const sqlite3_api_routines *pApi);
+
+static sqlite3 *db;
+static char *zResult;
+
+static void execSql(const char *zSql) {
+  char *zErr = 0;
+  int rc = sqlite3_exec(db, zSql, 0, 0, &zErr);
+  TEST_ASSERT_EQUAL_MESSAGE(SQLITE_OK, rc, zErr);
+  sqlite3_free(zErr);
+}
+
+/*
+** Run the one-column query zSql and return its text result, or the
+** error message prefixed with "ERR: ". Valid until the next call.
+*/
+static const char *querySql(const char *zSql) {
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+
+  sqlite3_free(zResult);
+  rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+  TEST_ASSERT_EQUAL_MESSAGE(SQLITE_OK, rc, sqlite3_errmsg(db));
+  rc = sqlite3_step(pStmt);
+  if( rc == SQLITE_ROW ) {
+    zResult = sqlite3_mprintf("%s", (const char*)sqlite3_column_text(pStmt, 0));
+  } else {
+    zResult = sqlite3_mprintf("ERR: %s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return zResult;
+}
+
+/*
+** Run cypher_execute(zQuery [, zParams]) and return its JSON result, or
+** the error message prefixed with "ERR: ". Valid until the next call.
+*/
+static const char *cypherExec(const char *zQuery, const char *zParams) {
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+
+  sqlite3_free(zResult);
+  rc = sqlite3_prepare_v2(db, zParams ? "SELECT cypher_execute(?1, ?2)" :
+                          "SELECT cypher_execute(?1)", -1, &pStmt, 0);
+  TEST_ASSERT_EQUAL(SQLITE_OK, rc);
+  sqlite3_bind_text(pStmt, 1, zQuery, -1, SQLITE_STATIC);
+  if( zParams ) sqlite3_bind_text(pStmt, 2, zParams, -1, SQLITE_STATIC);
+  rc = sqlite3_step(pStmt);
+  if( rc == SQLITE_ROW ) {
+    zResult = sqlite3_mprintf("%s", (const char*)sqlite3_column_text(pStmt, 0));
+  } else {
+    zResult = sqlite3_mprintf("ERR: %s", sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(pStmt);
+  return zResult;
+}
+
+void setUp(void) {
+  TEST_ASSERT_EQUAL(SQLITE_OK, sqlite3_open(":memory:", &db));
+  execSql("CREATE VIRTUAL TABLE g USING graph();"
+          "INSERT INTO g_nodes(id, labels, properties) VALUES"
+          " (1, '[\"Person\"]', '{\"name\":\"alice\",\"age\":30}'),"
+          " (2, '[\"Person\"]', '{\"name\":\"bob\",\"age\":25}'),"
+          " (3, '[\"Person\"]', '{\"name\":\"carol\",\"age\":35}'),"
+          " (4, '[\"City\"]', '{\"name\":\"Paris\"}');"
+          "INSERT INTO g_edges(source, target, edge_type, properties) VALUES"
+          " (1, 2, 'KNOWS', '{\"since\":2001}'),"
+          " (2, 3, 'KNOWS', '{}');");
+}
+
+void tearDown(void) {
+  sqlite3_free(zResult);
+  zResult = 0;
+  sqlite3_close(db);
+  db = 0;
+}
+
+void test_create_node_isMatched(void) {
+  TEST_ASSERT_EQUAL_STRING("[]",
+      cypherExec("CREATE (n:Person {name: 'dave', age: 41})", 0));
+  TEST_ASSERT_EQUAL_STRING("[{\"n.age\":41}]",
+      cypherExec("MATCH (n:Person) WHERE n.name = 'dave' RETURN n.age", 0));
+}
+
+void test_create_relationship_withPropertiesAndParams(void) {
+  TEST_ASSERT_EQUAL_STRING("[]",
+      cypherExec("CREATE (a:Person {name: $a})-[:KNOWS {since: $y}]->"
+                 "(b:Person {name: 'frank'})", "{\"a\":\"erin\",\"y\":2020}"));
+  TEST_ASSERT_EQUAL_STRING(
+      "[{\"a.name\":\"erin\",\"b.name\":\"frank\",\"r.since\":2020}]",
+      cypherExec("MATCH (a:Person)-[r:KNOWS]->(b:Person) WHERE a.name = 'erin' "
+                 "RETURN a.name, b.name, r.since", 0));
+}
+
+void test_create_error_writesNothing(void) {
+  TEST_ASSERT_EQUAL_STRING(
+      "ERR: Compilation failed: Only directed relationships are supported in CREATE",
+      cypherExec("CREATE (a:Person {name: 'x'})-[:KNOWS]-(b:Person)", 0));
+  TEST_ASSERT_EQUAL_STRING("4", querySql("SELECT count(*) FROM g_nodes"));
+}
+
+void test_merge_repeated_isIdempotent(void) {
+  const char *zMerge = "MERGE (n:Person {email: $e}) "
+                       "ON CREATE SET n.visits = 1 ON MATCH SET n.visits = 2";
+
+  TEST_ASSERT_EQUAL_STRING("1", querySql("SELECT graph_create_constraint('Person', 'email')"));
+  TEST_ASSERT_EQUAL_STRING("[]", cypherExec(zMerge, "{\"e\":\"dan@x\"}"));
+  TEST_ASSERT_EQUAL_STRING("[]", cypherExec(zMerge, "{\"e\":\"dan@x\"}"));
+  TEST_ASSERT_EQUAL_STRING("[]", cypherExec(zMerge, "{\"e\":\"dan@x\"}"));
+  TEST_ASSERT_EQUAL_STRING("[{\"n.visits\":2}]",
+      cypherExec("MATCH (n:Person) WHERE n.email = 'dan@x' RETURN n.visits", 0));
+  TEST_ASSERT_EQUAL_STRING("5", querySql("SELECT count(*) FROM g_nodes"));
+}
+
+void test_merge_constrainedKey_usesUpsert(void) {
+  GraphVtab *pGraph;
+  ExecutionContext *pExec;
+  CypherWriteContext *pCtx;
+  char *azLabel[] = { "Person" };
+  char *azProp[] = { "email" };
+  CypherValue value;
+  CypherValue *apValue[] = { &value };
+  MergeNodeOp op;
+  int i;
+
+  querySql("SELECT graph_create_constraint('Person', 'email')");
+  pGraph = graphRegistryFind(db, 0);
+  TEST_ASSERT_NOT_NULL(pGraph);
+  pExec = executionContextCreate(db, pGraph);
+  TEST_ASSERT_NOT_NULL(pExec);
+  pCtx = cypherWriteContextCreate(db, pGraph, pExec);
+  TEST_ASSERT_NOT_NULL(pCtx);
+  cypherValueInit(&value);
+  cypherValueSetString(&value, "eve@x");
+
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherWriteContextBegin(pCtx));
+  for( i = 0; i < 2; i++ ) {
+    int nSteps = pCtx->nWriteSteps;
+
+    memset(&op, 0, sizeof(op));
+    op.azLabels = azLabel;
+    op.nLabels = 1;
+    op.azMatchProps = azProp;
+    op.apMatchValues = apValue;
+    op.nMatchProps = 1;
+    TEST_ASSERT_EQUAL(SQLITE_OK, cypherMergeNode(pCtx, &op));
+    TEST_ASSERT_EQUAL(5, op.iNodeId);
+    TEST_ASSERT_EQUAL(i == 0, op.bWasCreated);
+
+    /* One upsert statement per MERGE, no scan-and-insert */
+    TEST_ASSERT_NOT_NULL(pCtx->pMergeUpsertStmt);
+    TEST_ASSERT_EQUAL(nSteps + 1, pCtx->nWriteSteps);
+  }
+  TEST_ASSERT_EQUAL(SQLITE_OK, cypherWriteContextCommit(pCtx));
+
+  cypherValueDestroy(&value);
+  cypherWriteContextDestroy(pCtx);
+  executionContextDestroy(pExec);
+  TEST_ASSERT_EQUAL_STRING("5", querySql("SELECT count(*) FROM g_nodes"));
+}
+
+void test_merge_invalidPatterns_areRejected(void) {
+  TEST_ASSERT_EQUAL_STRING("ERR: Cannot merge node using null property value",
+      cypherExec("MERGE (n:Person {email: $e})", "{\"e\":null}"));
+  TEST_ASSERT_EQUAL_STRING("ERR: Compilation failed: MERGE supports a single node pattern",
+      cypherExec("MERGE (a:Person)-[:KNOWS]->(b:Person)", 0));
+  TEST_ASSERT_EQUAL_STRING("ERR: Compilation failed: Variable `m` not defined",
+      cypherExec("MERGE (n:Person {name: 'x'}) ON MATCH SET m.age = 1", 0));
+  TEST_ASSERT_EQUAL_STRING("4", querySql("SELECT count(*) FROM g_nodes"));
+}
+
+void test_createNodeFunction_writesDefaultGraph(void) {
+  TEST_ASSERT_EQUAL_STRING("{\"node_id\": 5, \"variable\": \"n\"}",
+      querySql("SELECT cypher_create_node('n', '[\"Person\"]',"
+               " '{\"name\": \"gina\", \"age\": 28, \"admin\": false, \"nick\": null}')"));
+  TEST_ASSERT_EQUAL_STRING("[{\"n.age\":28,\"n.nick\":null}]",
+      cypherExec("MATCH (n:Person) WHERE n.name = 'gina' RETURN n.age, n.nick", 0));
+  TEST_ASSERT_EQUAL_STRING("false",
+      querySql("SELECT json_type(properties, '$.admin') FROM g_nodes WHERE id = 5"));
+  TEST_ASSERT_EQUAL_STRING("ERR: properties must be a JSON object",
+      querySql("SELECT cypher_create_node('n', '[\"Person\"]', '[1]')"));
+  TEST_ASSERT_EQUAL_STRING("ERR: labels must be a JSON array of strings",
+      querySql("SELECT cypher_create_node('n', '[1]', '{}')"));
+}
+
+void test_writeTransaction_bindsVariablesAndRollsBack(void) {
+  querySql("SELECT cypher_begin_write()");
+  TEST_ASSERT_EQUAL_STRING("{\"node_id\": 5, \"variable\": \"a\"}",
+      querySql("SELECT cypher_create_node('a', '[\"Person\"]', '{\"name\": \"hal\"}')"));
+  TEST_ASSERT_EQUAL_STRING("{\"rel_id\": 3, \"type\": \"KNOWS\", \"from\": 5, \"to\": 1}",
+      querySql("SELECT cypher_create_relationship('a', 1, 'r', 'KNOWS', '{}')"));
+  TEST_ASSERT_EQUAL_STRING(
+      "ERR: `b` is not a node ID or a node variable of the write transaction",
+      querySql("SELECT cypher_create_relationship('a', 'b', 'r', 'KNOWS', '{}')"));
+  TEST_ASSERT_NOT_NULL(strstr(querySql("SELECT cypher_rollback_write()"), "rolled back"));
+  TEST_ASSERT_EQUAL_STRING("4", querySql("SELECT count(*) FROM g_nodes"));
+  TEST_ASSERT_EQUAL_STRING("2", querySql("SELECT count(*) FROM g_edges"));
+  TEST_ASSERT_EQUAL_STRING("ERR: No write transaction in progress",
+      querySql("SELECT cypher_commit_write()"));
+}
+
+void test_createRelationshipFunction_keepsBooleans(void) {
+  TEST_ASSERT_EQUAL_STRING("{\"rel_id\": 3, \"type\": \"LIVES_IN\", \"from\": 1, \"to\": 4}",
+      querySql("SELECT cypher_create_relationship(1, 4, 'r', 'LIVES_IN',"
+               " '{\"owner\": true}')"));
+  TEST_ASSERT_EQUAL_STRING("true",
+      querySql("SELECT json_type(properties, '$.owner') FROM g_edges"
+               " WHERE edge_type = 'LIVES_IN'"));
+}
+
+void test_writeFunctions_missingNode_isError(void) {
+  TEST_ASSERT_EQUAL_STRING("ERR: node 99 does not exist",
+      querySql("SELECT cypher_create_relationship(1, 99, 'r', 'KNOWS', '{}')"));
+}
+
+void test_writeFunctions_withoutGraph_isError(void) {
+  sqlite3_close(db);
+  TEST_ASSERT_EQUAL(SQLITE_OK, sqlite3_open(":memory:", &db));
+  TEST_ASSERT_EQUAL_STRING(
+      "ERR: No graph table: create one with CREATE VIRTUAL TABLE ... USING graph()",
+      querySql("SELECT cypher_create_node('n', '[]', '{}')"));
+}
+
+int main(void) {
+  sqlite3_auto_extension((void(*)(void))sqlite3_graph_init);
+  UNITY_BEGIN();
+  RUN_TEST(test_create_node_isMatched);
+  RUN_TEST(test_create_relationship_withPropertiesAndParams);
+  RUN_TEST(test_create_error_writesNothing);
+  RUN_TEST(test_merge_repeated_isIdempotent);
+  RUN_TEST(test_merge_constrainedKey_usesUpsert);
+  RUN_TEST(test_merge_invalidPatterns_areRejected);
+  RUN_TEST(test_createNodeFunction_writesDefaultGraph);
+  RUN_TEST(test_writeTransaction_bindsVariablesAndRollsBack);
+  RUN_TEST(test_createRelationshipFunction_keepsBooleans);
+  RUN_TEST(test_writeFunctions_missingNode_isError);
+  RUN_TEST(test_writeFunctions_withoutGraph_isError);
+  return UNITY_END();
+}
@@ -5,6 +5,8 @@ import (
 	"database/sql"
 	"encoding/json"
 	"fmt"
+	"reflect"
+	"sort"
 	"strings"
 
 	"github.com/gogo-agent/jsonschema"
@@ -116,6 +118,7 @@ type GraphDB struct {
 	tableName  string
 	nodesTable string
 	edgesTable string
+	labelIndex bool // the graph module keeps <table>_node_labels current
 }
 
 // Node represents a node in the graph
@@ -140,6 +143,26 @@ type Path struct {
 	Relationships []*Relationship `json:"relationships"`
 }
 
+// NodeQuery selects nodes for QueryNodes. Every criterion must hold.
+type NodeQuery struct {
+	Labels         []string       // labels the node must all carry
+	Properties     map[string]any // top-level properties the node must have, by JSON value
+	AfterID        int64          // if positive, return only nodes with a larger id
+	Limit          int            // maximum number of nodes, 0 for all
+	SkipLabels     bool           // leave Node.Labels unset
+	SkipProperties bool           // leave Node.Properties unset
+}
+
+// RelationshipQuery selects relationships for QueryRelationships. Every
+// criterion must hold.
+type RelationshipQuery struct {
+	Type           string         // relationship type, "" for any
+	Properties     map[string]any // top-level properties the relationship must have, by JSON value
+	AfterID        int64          // if positive, return only relationships with a larger id
+	Limit          int            // maximum number of relationships, 0 for all
+	SkipProperties bool           // leave Relationship.Properties unset
+}
+
 // GraphUpdate represents an update operation for the graph
 type GraphUpdate struct {
 	Operation  string         `json:"operation"` // "create_node", "create_relationship", "update_node", "update_relationship"
@@ -197,6 +220,18 @@ func NewGraphDB(ctx context.Context, db *sql.DB, tableName string) (*GraphDB, er
 		}
 	}
 
+	// The graph module maintains a label index next to its table; use it when present
+	var labelIndex int
+	err = g.db.QueryRowContext(ctx, "SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = ?",
+		g.tableName+"_node_labels").Scan(&labelIndex)
+	g.labelIndex = err == nil && labelIndex > 0
+
+	// Relationship lookups by type go through this index instead of a table scan
+	query := fmt.Sprintf(`CREATE INDEX IF NOT EXISTS "%s_edges_type" ON %s(edge_type)`, g.tableName, g.edgesTable)
+	if _, err := g.db.ExecContext(ctx, query); err != nil {
+		return nil, fmt.Errorf("failed to create edge type index: %w", err)
+	}
+
 	return g, nil
 }
 
@@ -275,83 +310,89 @@ func (g *GraphDB) CreateRelationship(ctx context.Context, startNodeID, endNodeID
 
 // FindNodes finds nodes matching the given criteria
 func (g *GraphDB) FindNodes(ctx context.Context, labels []string, properties map[string]any) ([]*Node, error) {
+	return g.QueryNodes(ctx, NodeQuery{Labels: labels, Properties: properties})
+}
+
+// QueryNodes returns the nodes matching q in id order. The criteria are
+// evaluated by SQLite: labels through the label index when the graph module
+// maintains one, properties through json_extract() spelled like the
+// expression indexes graph_create_index() creates. To page, pass the last
+// returned id as AfterID.
+func (g *GraphDB) QueryNodes(ctx context.Context, q NodeQuery) ([]*Node, error) {
+	var where []string
+	var args []any
+
+	if q.AfterID > 0 {
+		where = append(where, "id > ?")
+		args = append(args, q.AfterID)
+	}
+	for _, label := range q.Labels {
+		if g.labelIndex {
+			where = append(where, fmt.Sprintf(`id IN (SELECT node_id FROM "%s_node_labels" WHERE label_id = `+
+				`(SELECT label_id FROM "%s_labels" WHERE label = ?))`, g.tableName, g.tableName))
+		} else {
+			where = append(where, "CASE WHEN json_valid(labels) THEN EXISTS "+
+				"(SELECT 1 FROM json_each(labels) WHERE json_each.value = ?) END")
+		}
+		args = append(args, label)
+	}
+	propWhere, propArgs, err := propertyPredicates(q.Properties)
+	if err != nil {
+		return nil, err
+	}
+	where = append(where, propWhere...)
+	args = append(args, propArgs...)
+
+	columns := "id"
+	if !q.SkipLabels {
+		columns += ", coalesce(labels, '')"
+	}
+	if !q.SkipProperties {
+		columns += ", coalesce(properties, '')"
+	}
+	query := fmt.Sprintf("SELECT %s FROM %s%s ORDER BY id%s", columns, g.nodesTable, whereClause(where), limitClause(q.Limit))
+
 	// WORKAROUND: Query backing table directly due to virtual table cursor bug
 	// TODO: Switch back to virtual table once cursor is fixed
-	query := fmt.Sprintf("SELECT id, labels, properties FROM %s", g.nodesTable)
-	rows, err := g.db.QueryContext(ctx, query)
+	rows, err := g.db.QueryContext(ctx, query, args...)
 	if err != nil {
 		return nil, fmt.Errorf("failed to query nodes: %w", err)
 	}
 	defer rows.Close()
 
 	var nodes []*Node
+	var labelsJSON, propertiesJSON string
+	dest := []any{nil}
+	if !q.SkipLabels {
+		dest = append(dest, &labelsJSON)
+	}
+	if !q.SkipProperties {
+		dest = append(dest, &propertiesJSON)
+	}
 	for rows.Next() {
-		var id int64
-		var labelsJSON, propertiesJSON string
-
-		if err := rows.Scan(&id, &labelsJSON, &propertiesJSON); err != nil {
+		node := &Node{}
+		dest[0] = &node.ID
+		if err := rows.Scan(dest...); err != nil {
 			continue
 		}
 
 		// Parse properties from JSON
-		var nodeProps map[string]interface{}
-		if propertiesJSON != "" {
-			if err := json.Unmarshal([]byte(propertiesJSON), &nodeProps); err != nil {
-				continue
-			}
-		}
-		if nodeProps == nil {
-			nodeProps = make(map[string]interface{})
-		}
-
-		// Parse labels from JSON array
-		var nodeLabels []string
-		if labelsJSON != "" && labelsJSON != "[]" {
-			if err := json.Unmarshal([]byte(labelsJSON), &nodeLabels); err != nil {
-				// Fallback to space-separated parsing if JSON fails
-				nodeLabels = strings.Fields(labelsJSON)
-			}
-		}
-
-		// Create node from data
-		node := &Node{
-			ID:         id,
-			Labels:     nodeLabels,
-			Properties: nodeProps,
-		}
-
-		// Filter by labels if specified
-		if len(labels) > 0 {
-			match := true
-			for _, requiredLabel := range labels {
-				found := false
-				for _, nodeLabel := range node.Labels {
-					if nodeLabel == requiredLabel {
-						found = true
-						break
-					}
-				}
-				if !found {
-					match = false
-					break
+		if !q.SkipProperties {
+			if propertiesJSON != "" {
+				if err := json.Unmarshal([]byte(propertiesJSON), &node.Properties); err != nil {
+					continue
 				}
 			}
-			if !match {
-				continue
+			if node.Properties == nil {
+				node.Properties = make(map[string]interface{})
 			}
 		}
 
-		// Filter by properties if specified
-		if len(properties) > 0 {
-			match := true
-			for k, v := range properties {
-				if nodeVal, ok := node.Properties[k]; !ok || nodeVal != v {
-					match = false
-					break
-				}
-			}
-			if !match {
-				continue
+		// Parse labels from JSON array
+		if !q.SkipLabels && labelsJSON != "" && labelsJSON != "[]" {
+			if err := json.Unmarshal([]byte(labelsJSON), &node.Labels); err != nil {
+				// Fallback to space-separated parsing if JSON fails
+				node.Labels = strings.Fields(labelsJSON)
 			}
 		}
 
@@ -363,74 +404,194 @@ func (g *GraphDB) FindNodes(ctx context.Context, labels []string, properties map
 
 // FindRelationships finds relationships matching the given criteria
 func (g *GraphDB) FindRelationships(ctx context.Context, relType string, properties map[string]interface{}) ([]*Relationship, error) {
+	return g.QueryRelationships(ctx, RelationshipQuery{Type: relType, Properties: properties})
+}
+
+// QueryRelationships returns the relationships matching q in id order, with
+// the criteria evaluated by SQLite as in QueryNodes. A type filter uses the
+// edge type index. Relationships without a type are reported, and matched,
+// as "UNKNOWN".
+func (g *GraphDB) QueryRelationships(ctx context.Context, q RelationshipQuery) ([]*Relationship, error) {
+	var where []string
+	var args []any
+
+	if q.AfterID > 0 {
+		where = append(where, "id > ?")
+		args = append(args, q.AfterID)
+	}
+	switch q.Type {
+	case "":
+	case "UNKNOWN":
+		where = append(where, "coalesce(edge_type, '') IN ('', 'UNKNOWN')")
+	default:
+		where = append(where, "edge_type = ?")
+		args = append(args, q.Type)
+	}
+	propWhere, propArgs, err := propertyPredicates(q.Properties)
+	if err != nil {
+		return nil, err
+	}
+	where = append(where, propWhere...)
+	args = append(args, propArgs...)
+
+	columns := "id, source, target, coalesce(edge_type, '')"
+	if !q.SkipProperties {
+		columns += ", coalesce(properties, '')"
+	}
+	query := fmt.Sprintf("SELECT %s FROM %s%s ORDER BY id%s", columns, g.edgesTable, whereClause(where), limitClause(q.Limit))
+
 	// WORKAROUND: Query backing table directly due to virtual table cursor bug
 	// TODO: Switch back to virtual table once cursor is fixed
-	query := fmt.Sprintf("SELECT id, source, target, edge_type, weight, properties FROM %s", g.edgesTable)
-	rows, err := g.db.QueryContext(ctx, query)
+	rows, err := g.db.QueryContext(ctx, query, args...)
 	if err != nil {
 		return nil, fmt.Errorf("failed to query relationships: %w", err)
 	}
 	defer rows.Close()
 
 	var relationships []*Relationship
+	var propertiesJSON string
 	for rows.Next() {
-		var id, fromID, toID int64
-		var edgeType, propertiesJSON string
-		var weight float64
-
-		if err := rows.Scan(&id, &fromID, &toID, &edgeType, &weight, &propertiesJSON); err != nil {
+		rel := &Relationship{}
+		dest := []any{&rel.ID, &rel.StartNode, &rel.EndNode, &rel.Type}
+		if !q.SkipProperties {
+			dest = append(dest, &propertiesJSON)
+		}
+		if err := rows.Scan(dest...); err != nil {
 			continue
 		}
 
 		// Parse properties from JSON
-		var allProps map[string]interface{}
-		if propertiesJSON != "" {
-			if err := json.Unmarshal([]byte(propertiesJSON), &allProps); err != nil {
-				continue
+		if !q.SkipProperties {
+			if propertiesJSON != "" {
+				if err := json.Unmarshal([]byte(propertiesJSON), &rel.Properties); err != nil {
+					continue
+				}
+			}
+			if rel.Properties == nil {
+				rel.Properties = make(map[string]interface{})
 			}
-		}
-		if allProps == nil {
-			allProps = make(map[string]interface{})
 		}
 
 		// Use the edge_type column for the relationship type
-		actualRelType := edgeType
-		if actualRelType == "" {
-			actualRelType = "UNKNOWN"
+		if rel.Type == "" {
+			rel.Type = "UNKNOWN"
 		}
 
-		// Create relationship from data
-		rel := &Relationship{
-			ID:         id,
-			StartNode:  fromID,
-			EndNode:    toID,
-			Type:       actualRelType,
-			Properties: allProps,
-		}
+		relationships = append(relationships, rel)
+	}
 
-		// Filter by type if specified
-		if relType != "" && rel.Type != relType {
-			continue
+	return relationships, nil
+}
+
+// propertyPredicates compiles property criteria into WHERE terms and their
+// arguments, in key order so equal criteria produce equal SQL. A key made
+// of letters, digits and underscores is spelled into the path literally so
+// SQLite can answer the term from a <graph>_prop_<key> expression index.
+// Values match like the decoded JSON would: numbers by value whatever their
+// Go type, and strings, booleans and null only their own JSON type.
+func propertyPredicates(properties map[string]any) ([]string, []any, error) {
+	keys := make([]string, 0, len(properties))
+	for k := range properties {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+
+	var where []string
+	var args []any
+	for _, k := range keys {
+		var extract, jsonType string
+		var pathArgs []any
+		if isPropertyName(k) {
+			extract = fmt.Sprintf("json_extract(properties, '$.%s')", k)
+			jsonType = fmt.Sprintf("json_type(properties, '$.%s')", k)
+		} else {
+			quoted, err := json.Marshal(k)
+			if err != nil {
+				return nil, nil, fmt.Errorf("invalid property name %q: %w", k, err)
+			}
+			extract = "json_extract(properties, ?)"
+			jsonType = "json_type(properties, ?)"
+			pathArgs = []any{"$." + string(quoted)}
 		}
 
-		// Filter by properties if specified
-		if len(properties) > 0 {
-			match := true
-			for k, v := range properties {
-				if relVal, ok := rel.Properties[k]; !ok || relVal != v {
-					match = false
-					break
-				}
+		switch v := properties[k].(type) {
+		case nil:
+			where = append(where, jsonType+" = 'null'")
+			args = append(args, pathArgs...)
+		case bool:
+			where = append(where, extract+" = ? AND "+jsonType+" = ?")
+			args = append(args, pathArgs...)
+			args = append(args, v)
+			args = append(args, pathArgs...)
+			args = append(args, fmt.Sprint(v))
+		case string:
+			where = append(where, extract+" = ? AND "+jsonType+" = 'text'")
+			args = append(args, pathArgs...)
+			args = append(args, v)
+			args = append(args, pathArgs...)
+		case json.Number:
+			where = append(where, extract+" = ?")
+			args = append(args, pathArgs...)
+			if i, err := v.Int64(); err == nil {
+				args = append(args, i)
+			} else if f, err := v.Float64(); err == nil {
+				args = append(args, f)
+			} else {
+				return nil, nil, fmt.Errorf("invalid number for property %q: %w", k, err)
 			}
-			if !match {
-				continue
+		default:
+			rv := reflect.ValueOf(v)
+			var arg any
+			switch rv.Kind() {
+			case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+				arg = rv.Int()
+			case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64:
+				arg = float64(rv.Uint())
+				if rv.Uint() <= 1<<63-1 {
+					arg = int64(rv.Uint())
+				}
+			case reflect.Float32, reflect.Float64:
+				arg = rv.Float()
+			default:
+				return nil, nil, fmt.Errorf("unsupported value type %T for property %q", v, k)
 			}
+			where = append(where, extract+" = ?")
+			args = append(args, pathArgs...)
+			args = append(args, arg)
 		}
+	}
 
-		relationships = append(relationships, rel)
+	return where, args, nil
+}
+
+// isPropertyName reports whether k can be spelled into a JSON path as is,
+// using the same rule as the graph module's property indexes
+func isPropertyName(k string) bool {
+	if k == "" {
+		return false
 	}
+	for _, c := range k {
+		if !(c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z' || c >= '0' && c <= '9' || c == '_') {
+			return false
+		}
+	}
+	return true
+}
 
-	return relationships, nil
+// whereClause joins WHERE terms with AND, or returns "" when there are none
+func whereClause(terms []string) string {
+	if len(terms) == 0 {
+		return ""
+	}
+	return " WHERE " + strings.Join(terms, " AND ")
+}
+
+// limitClause returns a LIMIT clause for a positive limit
+func limitClause(limit int) string {
+	if limit <= 0 {
+		return ""
+	}
+	return fmt.Sprintf(" LIMIT %d", limit)
 }
 
 func (g *GraphDB) DeleteNode(ctx context.Context, nodeID int64) error {
@@ -487,6 +648,95 @@ func (g *GraphDB) Search(ctx context.Context, query string) ([]string, error) {
 	return results, nil
 }
 
+// CypherStmt is a Cypher query parsed and planned once by the graph
+// extension and run any number of times with different parameters. The
+// statement lives on one database connection, which it holds out of the
+// pool until Close.
+type CypherStmt struct {
+	conn   *sql.Conn
+	handle int64
+	params map[string]any
+}
+
+// PrepareCypher prepares query against the graph. Parameters are written
+// $name in the query and set with the Bind methods before Query.
+func (g *GraphDB) PrepareCypher(ctx context.Context, query string) (*CypherStmt, error) {
+	conn, err := g.db.Conn(ctx)
+	if err != nil {
+		return nil, fmt.Errorf("failed to get connection: %w", err)
+	}
+
+	var handle int64
+	if err := conn.QueryRowContext(ctx, "SELECT cypher_prepare(?, ?)", query, g.tableName).Scan(&handle); err != nil {
+		conn.Close()
+		return nil, fmt.Errorf("failed to prepare cypher query: %w", err)
+	}
+
+	return &CypherStmt{conn: conn, handle: handle, params: make(map[string]any)}, nil
+}
+
+// BindInt64 sets parameter $name for the following runs.
+func (s *CypherStmt) BindInt64(name string, value int64) {
+	s.params[strings.TrimPrefix(name, "$")] = value
+}
+
+// BindDouble sets parameter $name for the following runs.
+func (s *CypherStmt) BindDouble(name string, value float64) {
+	s.params[strings.TrimPrefix(name, "$")] = value
+}
+
+// BindText sets parameter $name for the following runs. The value stays
+// text, so "02139" matches the string and not the number 2139.
+func (s *CypherStmt) BindText(name string, value string) {
+	s.params[strings.TrimPrefix(name, "$")] = value
+}
+
+// ClearBindings forgets the parameters bound so far.
+func (s *CypherStmt) ClearBindings() {
+	s.params = make(map[string]any)
+}
+
+// Query runs the statement with the bound parameters and returns its rows,
+// each as the object text cypher_query() gives for it.
+func (s *CypherStmt) Query(ctx context.Context) ([]string, error) {
+	params, err := json.Marshal(s.params)
+	if err != nil {
+		return nil, fmt.Errorf("failed to marshal parameters: %w", err)
+	}
+
+	rows, err := s.conn.QueryContext(ctx, "SELECT row FROM cypher_query(?, ?)", s.handle, string(params))
+	if err != nil {
+		return nil, fmt.Errorf("failed to run cypher query: %w", err)
+	}
+	defer rows.Close()
+
+	var results []string
+	for rows.Next() {
+		var row string
+		if err := rows.Scan(&row); err != nil {
+			return nil, fmt.Errorf("failed to scan cypher row: %w", err)
+		}
+		results = append(results, row)
+	}
+	if err := rows.Err(); err != nil {
+		return nil, fmt.Errorf("failed to run cypher query: %w", err)
+	}
+
+	return results, nil
+}
+
+// Close frees the statement and returns its connection to the pool.
+func (s *CypherStmt) Close() error {
+	_, err := s.conn.ExecContext(context.Background(), "SELECT cypher_finalize(?)", s.handle)
+	if cerr := s.conn.Close(); err == nil && cerr != nil {
+		err = cerr
+	}
+	if err != nil {
+		return fmt.Errorf("failed to finalize cypher statement: %w", err)
+	}
+	return nil
+}
+
 // Close closes the graph (does not close the underlying database connection)
 func (g *GraphDB) Close() error {
 	// Nothing to close for now, as we don't own the database connection
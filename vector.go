@@ -3,7 +3,10 @@ package sqlite
 import (
 	"context"
 	"database/sql"
+	"encoding/binary"
+	"errors"
 	"fmt"
+	"math"
 	"unsafe"
 
 	"github.com/gogo-agent/jsonschema"
@@ -116,11 +119,58 @@ var (
 	}
 )
 
+// DefaultVectorBatchSize is the number of vectors InsertVectors commits per transaction
+const DefaultVectorBatchSize = 1000
+
+// DefaultVectorOversample is how many quantized candidates per requested
+// result a quantized search reranks
+const DefaultVectorOversample = 8
+
+// VectorQuantization selects the compressed companion column a VectorDB
+// searches before reranking against the full float32 vectors
+type VectorQuantization string
+
+const (
+	// QuantizeNone searches the float32 vectors directly
+	QuantizeNone VectorQuantization = ""
+	// QuantizeInt8 keeps one signed byte per dimension, 4x smaller
+	QuantizeInt8 VectorQuantization = "int8"
+	// QuantizeBinary keeps the sign of each dimension as one bit, 32x smaller
+	QuantizeBinary VectorQuantization = "bit"
+)
+
+// VectorDBOption configures NewVectorDB
+type VectorDBOption func(*VectorDB)
+
+// WithQuantization adds a quantized companion column. Searches take
+// limit*oversample candidates from it (DefaultVectorOversample if
+// oversample < 1) and rerank them by exact L2 distance. The kind is
+// recorded with the table, and reopening it uses the recorded kind.
+func WithQuantization(kind VectorQuantization, oversample int) VectorDBOption {
+	return func(vs *VectorDB) {
+		vs.quantization = kind
+		vs.oversample = oversample
+	}
+}
+
+// WithInt8Scale sets the magnitude QuantizeInt8 maps to 127 (default 1, for
+// unit-normalized embeddings); larger values are clamped. It is recorded
+// with the table when the table is created.
+func WithInt8Scale(scale float32) VectorDBOption {
+	return func(vs *VectorDB) { vs.int8Scale = scale }
+}
+
 // VectorDB represents a vector database for embeddings
 type VectorDB struct {
-	db         *sql.DB
-	tableName  string
-	dimensions int
+	db           *sql.DB
+	tableName    string
+	dimensions   int
+	batchSize    int
+	quantization VectorQuantization
+	oversample   int
+	int8Scale    float32
+	insertQuery  string
+	searchQuery  string
 }
 
 // VectorResult represents a vector search result
@@ -131,44 +181,236 @@ type VectorResult struct {
 }
 
 // NewVectorDB creates a new vector database instance with the given database and table name
-func NewVectorDB(ctx context.Context, db *sql.DB, tableName string, dimensions int) (*VectorDB, error) {
+func NewVectorDB(ctx context.Context, db *sql.DB, tableName string, dimensions int, opts ...VectorDBOption) (*VectorDB, error) {
 	vs := &VectorDB{
 		db:         db,
 		tableName:  tableName,
 		dimensions: dimensions,
+		batchSize:  DefaultVectorBatchSize,
+		int8Scale:  1,
+	}
+	for _, opt := range opts {
+		opt(vs)
 	}
 
 	if vs.tableName == "" {
 		vs.tableName = "vectors"
 	}
+	if vs.oversample < 1 {
+		vs.oversample = DefaultVectorOversample
+	}
+
+	if err := vs.loadQuantization(ctx); err != nil {
+		return nil, err
+	}
 
 	// Create the virtual table using the vec extension
-	query := fmt.Sprintf("CREATE VIRTUAL TABLE IF NOT EXISTS %s USING vec0(embedding float[%d])", vs.tableName, dimensions)
-	if _, err := vs.db.ExecContext(ctx, query); err != nil {
-		return nil, fmt.Errorf("failed to create vector table: %w", err)
+	var column string
+	switch vs.quantization {
+	case QuantizeNone:
+	case QuantizeInt8:
+		if !(vs.int8Scale > 0) {
+			return nil, fmt.Errorf("int8 scale must be positive, got %g", vs.int8Scale)
+		}
+		column = fmt.Sprintf(", embedding_q int8[%d]", dimensions)
+	case QuantizeBinary:
+		if dimensions%8 != 0 {
+			return nil, fmt.Errorf("binary quantization needs dimensions divisible by 8, got %d", dimensions)
+		}
+		column = fmt.Sprintf(", embedding_q bit[%d]", dimensions)
+	default:
+		return nil, fmt.Errorf("unknown vector quantization %q", vs.quantization)
+	}
+	if err := vs.createTables(ctx, dimensions, column); err != nil {
+		return nil, err
+	}
+
+	// Statement text is fixed per table, so build it once
+	switch vs.quantization {
+	case QuantizeNone:
+		vs.insertQuery = fmt.Sprintf("INSERT INTO %s(rowid, embedding) VALUES (?, ?)", vs.tableName)
+		vs.searchQuery = fmt.Sprintf(`
+		SELECT rowid, distance 
+		FROM %s 
+		WHERE embedding MATCH ? 
+		ORDER BY distance 
+		LIMIT ?
+	`, vs.tableName)
+	default:
+		// Candidates come from the quantized column, distances from the full vectors
+		vs.insertQuery = fmt.Sprintf("INSERT INTO %s(rowid, embedding, embedding_q) VALUES (?, ?, vec_%s(?))",
+			vs.tableName, vs.quantization)
+		vs.searchQuery = fmt.Sprintf(`
+		WITH candidates AS (
+			SELECT rowid 
+			FROM %[1]s 
+			WHERE embedding_q MATCH vec_%[2]s(?1) AND k = ?2
+		)
+		SELECT v.rowid, vec_distance_l2(v.embedding, ?3) AS distance 
+		FROM candidates c JOIN %[1]s v ON v.rowid = c.rowid 
+		ORDER BY distance 
+		LIMIT ?4
+	`, vs.tableName, vs.quantization)
 	}
 
 	return vs, nil
 }
 
+// createTables creates the vec0 table and, for a quantized one, records its
+// quantization in <table>_quantization, all in one transaction so that a
+// failure leaves neither table behind
+func (vs *VectorDB) createTables(ctx context.Context, dimensions int, column string) error {
+	tx, err := vs.db.BeginTx(ctx, nil)
+	if err != nil {
+		return fmt.Errorf("failed to begin transaction: %w", err)
+	}
+	defer tx.Rollback()
+
+	query := fmt.Sprintf("CREATE VIRTUAL TABLE IF NOT EXISTS %s USING vec0(embedding float[%d]%s)", vs.tableName, dimensions, column)
+	if _, err := tx.ExecContext(ctx, query); err != nil {
+		return fmt.Errorf("failed to create vector table: %w", err)
+	}
+	if vs.quantization != QuantizeNone {
+		query = fmt.Sprintf(`CREATE TABLE IF NOT EXISTS "%s_quantization"(id INTEGER PRIMARY KEY, kind TEXT NOT NULL, scale REAL)`, vs.tableName)
+		if _, err := tx.ExecContext(ctx, query); err != nil {
+			return fmt.Errorf("failed to create vector quantization table: %w", err)
+		}
+		query = fmt.Sprintf(`INSERT OR IGNORE INTO "%s_quantization"(id, kind, scale) VALUES (1, ?, ?)`, vs.tableName)
+		if _, err := tx.ExecContext(ctx, query, string(vs.quantization), vs.int8Scale); err != nil {
+			return fmt.Errorf("failed to record vector quantization: %w", err)
+		}
+	}
+
+	return tx.Commit()
+}
+
+// loadQuantization adopts the quantization parameters recorded in
+// <table>_quantization when the table was created, so that inserts keep
+// quantizing the same way
+func (vs *VectorDB) loadQuantization(ctx context.Context) error {
+	var hasTable, hasRecord bool
+	err := vs.db.QueryRowContext(ctx, `
+		SELECT EXISTS(SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?1),
+		       EXISTS(SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?1 || '_quantization')`,
+		vs.tableName).Scan(&hasTable, &hasRecord)
+	if err != nil {
+		return fmt.Errorf("failed to look up vector table: %w", err)
+	}
+
+	var kind string
+	var scale sql.NullFloat64
+	if hasRecord {
+		query := fmt.Sprintf(`SELECT kind, scale FROM "%s_quantization" WHERE id = 1`, vs.tableName)
+		err = vs.db.QueryRowContext(ctx, query).Scan(&kind, &scale)
+		if errors.Is(err, sql.ErrNoRows) {
+			hasRecord = false
+		} else if err != nil {
+			return fmt.Errorf("failed to read vector quantization: %w", err)
+		}
+	}
+
+	if !hasRecord {
+		if vs.quantization == QuantizeNone {
+			return nil
+		}
+		// A quantized column cannot be added to an existing table
+		if hasTable {
+			return fmt.Errorf("vector table %s already exists without a quantized column", vs.tableName)
+		}
+		return nil
+	}
+
+	if vs.quantization != QuantizeNone && vs.quantization != VectorQuantization(kind) {
+		return fmt.Errorf("vector table %s is quantized as %s, not %s", vs.tableName, kind, vs.quantization)
+	}
+	vs.quantization = VectorQuantization(kind)
+	if scale.Valid {
+		vs.int8Scale = float32(scale.Float64)
+	}
+	return nil
+}
+
+// quantize returns vector in the encoding of the quantized column: int8
+// bytes of round(v/scale*127) clamped to +-127, or one bit per dimension,
+// set for positive values, least significant bit first
+func (vs *VectorDB) quantize(vector []float32) []byte {
+	switch vs.quantization {
+	case QuantizeInt8:
+		b := make([]byte, len(vector))
+		k := 127 / float64(vs.int8Scale)
+		for i, f := range vector {
+			q := math.Round(float64(f) * k)
+			b[i] = byte(int8(max(-127, min(127, q))))
+		}
+		return b
+	case QuantizeBinary:
+		b := make([]byte, (len(vector)+7)/8)
+		for i, f := range vector {
+			if f > 0 {
+				b[i/8] |= 1 << (i % 8)
+			}
+		}
+		return b
+	}
+	return nil
+}
+
+// insertArgs returns the arguments of insertQuery for one vector
+func (vs *VectorDB) insertArgs(id uint64, vector []float32) []any {
+	if vs.quantization == QuantizeNone {
+		return []any{id, vectorBytes(vector)}
+	}
+	return []any{id, vectorBytes(vector), vs.quantize(vector)}
+}
+
+// searchArgs returns the arguments of searchQuery for one query vector
+func (vs *VectorDB) searchArgs(queryVector []float32, limit int) []any {
+	if vs.quantization == QuantizeNone {
+		return []any{vectorBytes(queryVector), limit}
+	}
+	return []any{vs.quantize(queryVector), limit * vs.oversample, vectorBytes(queryVector), limit}
+}
+
+// SetBatchSize sets how many vectors InsertVectors commits per transaction.
+// A size below 1 restores DefaultVectorBatchSize.
+func (vs *VectorDB) SetBatchSize(n int) {
+	if n < 1 {
+		n = DefaultVectorBatchSize
+	}
+	vs.batchSize = n
+}
+
+// nativeLittleEndian reports whether float32 memory already has the
+// little-endian layout vec0 expects
+var nativeLittleEndian = func() bool {
+	x := uint16(1)
+	return *(*byte)(unsafe.Pointer(&x)) == 1
+}()
+
+// vectorBytes returns vector as the little-endian float32 blob vec0 expects.
+// On little-endian hosts the result aliases vector's memory without a copy,
+// so the caller must not modify vector while the blob is in use.
+func vectorBytes(vector []float32) []byte {
+	if len(vector) == 0 {
+		return []byte{}
+	}
+	if nativeLittleEndian {
+		return unsafe.Slice((*byte)(unsafe.Pointer(unsafe.SliceData(vector))), len(vector)*4)
+	}
+	b := make([]byte, len(vector)*4) // 4 bytes per float32
+	for i, f := range vector {
+		binary.LittleEndian.PutUint32(b[i*4:], *(*uint32)(unsafe.Pointer(&f)))
+	}
+	return b
+}
+
 // InsertVector inserts a vector with the given ID
 func (vs *VectorDB) InsertVector(ctx context.Context, id uint64, vector []float32) error {
 	if len(vector) != vs.dimensions {
 		return fmt.Errorf("vector dimension mismatch: expected %d, got %d", vs.dimensions, len(vector))
 	}
 
-	// Convert float32 slice to byte slice
-	vectorBytes := make([]byte, len(vector)*4) // 4 bytes per float32
-	for i, f := range vector {
-		bits := *(*uint32)(unsafe.Pointer(&f))
-		vectorBytes[i*4] = byte(bits)
-		vectorBytes[i*4+1] = byte(bits >> 8)
-		vectorBytes[i*4+2] = byte(bits >> 16)
-		vectorBytes[i*4+3] = byte(bits >> 24)
-	}
-
-	query := fmt.Sprintf("INSERT INTO %s(rowid, embedding) VALUES (?, ?)", vs.tableName)
-	_, err := vs.db.ExecContext(ctx, query, id, vectorBytes)
+	_, err := vs.db.ExecContext(ctx, vs.insertQuery, vs.insertArgs(id, vector)...)
 	if err != nil {
 		return fmt.Errorf("failed to insert vector: %w", err)
 	}
@@ -176,42 +418,120 @@ func (vs *VectorDB) InsertVector(ctx context.Context, id uint64, vector []float3
 	return nil
 }
 
-// SearchSimilarVectors searches for vectors similar to the query vector
+// InsertVectors inserts vectors[i] under ids[i]. Each batch of up to the
+// configured batch size runs in one transaction through one prepared
+// statement. All vectors are checked before anything is written; if a batch
+// fails it is rolled back, and batches committed before it are kept.
+func (vs *VectorDB) InsertVectors(ctx context.Context, ids []uint64, vectors [][]float32) error {
+	if len(ids) != len(vectors) {
+		return fmt.Errorf("ids and vectors length mismatch: %d ids, %d vectors", len(ids), len(vectors))
+	}
+	for i, vector := range vectors {
+		if len(vector) != vs.dimensions {
+			return fmt.Errorf("vector %d dimension mismatch: expected %d, got %d", ids[i], vs.dimensions, len(vector))
+		}
+	}
+
+	batchSize := vs.batchSize
+	if batchSize < 1 {
+		batchSize = DefaultVectorBatchSize
+	}
+	for start := 0; start < len(ids); start += batchSize {
+		end := min(start+batchSize, len(ids))
+		if err := vs.insertBatch(ctx, ids[start:end], vectors[start:end]); err != nil {
+			return fmt.Errorf("failed to insert vectors (%d of %d committed): %w", start, len(ids), err)
+		}
+	}
+
+	return nil
+}
+
+// insertBatch writes one batch of InsertVectors in a single transaction
+func (vs *VectorDB) insertBatch(ctx context.Context, ids []uint64, vectors [][]float32) error {
+	tx, err := vs.db.BeginTx(ctx, nil)
+	if err != nil {
+		return fmt.Errorf("failed to begin transaction: %w", err)
+	}
+	defer tx.Rollback()
+
+	stmt, err := tx.PrepareContext(ctx, vs.insertQuery)
+	if err != nil {
+		return fmt.Errorf("failed to prepare insert: %w", err)
+	}
+	defer stmt.Close()
+
+	for i, vector := range vectors {
+		if _, err := stmt.ExecContext(ctx, vs.insertArgs(ids[i], vector)...); err != nil {
+			return fmt.Errorf("failed to insert vector %d: %w", ids[i], err)
+		}
+	}
+
+	return tx.Commit()
+}
+
+// SearchSimilarVectors searches for vectors similar to the query vector. On a
+// quantized table the candidates come from the quantized column and the
+// returned distances are exact L2 distances over the float32 vectors.
 func (vs *VectorDB) SearchSimilarVectors(ctx context.Context, queryVector []float32, limit int) ([]VectorResult, error) {
 	if len(queryVector) != vs.dimensions {
 		return nil, fmt.Errorf("query vector dimension mismatch: expected %d, got %d", vs.dimensions, len(queryVector))
 	}
 
-	// Convert query vector to bytes
-	queryBytes := make([]byte, len(queryVector)*4)
-	for i, f := range queryVector {
-		bits := *(*uint32)(unsafe.Pointer(&f))
-		queryBytes[i*4] = byte(bits)
-		queryBytes[i*4+1] = byte(bits >> 8)
-		queryBytes[i*4+2] = byte(bits >> 16)
-		queryBytes[i*4+3] = byte(bits >> 24)
+	rows, err := vs.db.QueryContext(ctx, vs.searchQuery, vs.searchArgs(queryVector, limit)...)
+	if err != nil {
+		return nil, fmt.Errorf("failed to search vectors: %w", err)
 	}
+	defer rows.Close()
 
-	query := fmt.Sprintf(`
-		SELECT rowid, distance 
-		FROM %s 
-		WHERE embedding MATCH ? 
-		ORDER BY distance 
-		LIMIT ?
-	`, vs.tableName)
+	return scanVectorResults(rows)
+}
 
-	rows, err := vs.db.QueryContext(ctx, query, queryBytes, limit)
+// SearchSimilarVectorsBatch runs SearchSimilarVectors for each query vector on
+// one connection and one prepared statement. results[i] holds the matches for
+// queryVectors[i].
+func (vs *VectorDB) SearchSimilarVectorsBatch(ctx context.Context, queryVectors [][]float32, limit int) ([][]VectorResult, error) {
+	for i, queryVector := range queryVectors {
+		if len(queryVector) != vs.dimensions {
+			return nil, fmt.Errorf("query vector %d dimension mismatch: expected %d, got %d", i, vs.dimensions, len(queryVector))
+		}
+	}
+
+	conn, err := vs.db.Conn(ctx)
 	if err != nil {
-		return nil, fmt.Errorf("failed to search vectors: %w", err)
+		return nil, fmt.Errorf("failed to get connection: %w", err)
 	}
-	defer rows.Close()
+	defer conn.Close()
+
+	stmt, err := conn.PrepareContext(ctx, vs.searchQuery)
+	if err != nil {
+		return nil, fmt.Errorf("failed to prepare search: %w", err)
+	}
+	defer stmt.Close()
 
+	results := make([][]VectorResult, len(queryVectors))
+	for i, queryVector := range queryVectors {
+		rows, err := stmt.QueryContext(ctx, vs.searchArgs(queryVector, limit)...)
+		if err != nil {
+			return nil, fmt.Errorf("failed to search vectors: %w", err)
+		}
+		results[i], err = scanVectorResults(rows)
+		rows.Close()
+		if err != nil {
+			return nil, err
+		}
+	}
+
+	return results, nil
+}
+
+// scanVectorResults reads (rowid, distance) rows into results
+func scanVectorResults(rows *sql.Rows) ([]VectorResult, error) {
 	var results []VectorResult
 	for rows.Next() {
 		var id int64
 		var distance float64
 		if err := rows.Scan(&id, &distance); err != nil {
-			continue
+			return nil, fmt.Errorf("failed to scan search result: %w", err)
 		}
 
 		results = append(results, VectorResult{
@@ -219,6 +539,9 @@ func (vs *VectorDB) SearchSimilarVectors(ctx context.Context, queryVector []floa
 			Distance: distance,
 		})
 	}
+	if err := rows.Err(); err != nil {
+		return nil, fmt.Errorf("failed to search vectors: %w", err)
+	}
 
 	return results, nil
 }